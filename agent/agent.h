@@ -77,6 +77,8 @@ struct
   const char *scdaemon_program;
 
   int disable_scdaemon;         /* Never use the SCdaemon. */
+  int route_card_keys;          /* Let the SCdaemon pick the card by
+                                   keygrip.  */
 
   int no_grab;         /* Don't let the pinentry grab the keyboard */
 
@@ -90,6 +92,12 @@ struct
   unsigned long max_cache_ttl;     /* Default. */
   unsigned long max_cache_ttl_ssh; /* for SSH. */
 
+  /* The maximum number of concurrently served connections for the
+     standard, the extra and the ssh socket; 0 for no limit.  */
+  unsigned int max_connections;
+  unsigned int max_extra_connections;
+  unsigned int max_ssh_connections;
+
   /* Flag disallowing bypassing of the warning.  */
   int enforce_passphrase_constraints;
 
@@ -116,6 +124,10 @@ struct
      for signing operations.  */
   int ignore_cache_for_signing;
 
+  /* Keep the unprotected keys along with their cached passphrases so
+     that the S2K is not run for every operation.  */
+  int cache_unprotected_keys;
+
   /* If this global option is true, the user is allowed to
      interactively mark certificate in trustlist.txt as trusted. */
   int allow_mark_trusted;
@@ -139,6 +151,50 @@ struct
   /* This global option enables the ssh-agent subsystem.  */
   int ssh_support;
 
+  /* The number of worker threads used for a vanity key search.  A
+     value of 0 uses one thread per CPU.  */
+  unsigned int vanity_workers;
+
+  /* Sweep also on an OpenCL device during a vanity key search.  */
+  int vanity_gpu;
+
+  /* Reseed the random stream of each vanity search thread after this
+     many KiB; 0 uses VANITY_RESEED_INTERVAL.  */
+  unsigned int vanity_reseed;
+
+  /* Bind the vanity search threads to the CPUs and use only one
+     hardware thread of each core.  */
+  int vanity_pin;
+  int vanity_no_smt;
+
+  /* Keep the keys generated by vanity searches in the key pools and
+     sweep them first.  */
+  int vanity_pool;
+
+  /* Let vanity searches shrink their default window to what the
+     rates of the host need.  */
+  int vanity_autotune;
+
+  /* The limits of the vanity search threads by the hour of the day
+     (see vanity_set_governor) or NULL, and the temperature in
+     degrees Celsius above which they slow down or 0.  */
+  const char *vanity_governor;
+  unsigned int vanity_max_temp;
+
+  /* The KiB a vanity search and each of its hash workers may use or
+     0 for no limit.  */
+  unsigned long vanity_memory;
+  unsigned long vanity_worker_memory;
+
+  /* The kinds of keys to keep pregenerated for GENKEY, e.g.
+     "rsa3072,rsa4096", or NULL, and the number of keys of each.  */
+  const char *key_pool;
+  unsigned int key_pool_size;
+
+  /* Keep the private keys in a single indexed file instead of one
+     file per key; see keystore.c.  */
+  int key_store_file;
+
   /* This global options indicates the use of an extra socket. Note
      that we use a hack for cleanup handling in gpg-agent.c: If the
      value is less than 2 the name has not yet been malloced. */
@@ -182,6 +238,8 @@ struct server_control_s
      spawning a new connection thread.  */
   struct {
     gnupg_fd_t fd;
+    int conn_class;                    /* The socket type.  */
+    struct server_control_s *next;     /* Used by the connection queue.  */
   } thread_startup;
 
   /* Flag indicating the connection is run in restricted mode.  */
@@ -269,7 +327,8 @@ typedef enum
     CACHE_MODE_NORMAL,     /* Normal cache (gpg-agent). */
     CACHE_MODE_USER,       /* GET_PASSPHRASE related cache. */
     CACHE_MODE_SSH,        /* SSH related cache. */
-    CACHE_MODE_NONCE       /* This is a non-predictable nonce.  */
+    CACHE_MODE_NONCE,      /* This is a non-predictable nonce.  */
+    CACHE_MODE_KEY         /* An unprotected key (--cache-unprotected-keys). */
   }
 cache_mode_t;
 
@@ -285,11 +344,62 @@ cache_mode_t;
 typedef int (*lookup_ttl_t)(const char *hexgrip);
 
 
+/* A vanity key search of the engine in vanity/.  */
+struct vanity_job_s;
+
+/* A file of stored candidate keys for vanity searches.  */
+struct vanity_pool_s;
+
+/* The resources used by a vanity search.  */
+struct vanity_cost_s;
+
+/* A vanity search for a subkey next to the one for its primary key.  */
+struct vanity_subkey_s;
+
+/* A progress report of a vanity search.  */
+struct vanity_progress_s;
+
+/* The counters of a running vanity search already added to the
+   metrics of vanitymetrics.c.  */
+struct agent_vanity_metrics_run_s
+{
+  unsigned long long iterations;
+  unsigned long long keys;
+  unsigned long long gpu_iterations;
+  unsigned long long gpu_keys;
+  double last;                  /* Time of the last progress report.  */
+};
+
+/* The share of a vanity search distributed over several hosts: the
+   COUNT key streams starting at FIRST of the stream key KEY of the
+   job (see vanity_set_stream_range).  Kept in secure memory.  */
+struct agent_vanity_seeds_s
+{
+  unsigned char key[32];
+  unsigned int first;
+  unsigned int count;
+};
+
+/* A further key found by a vanity search collecting several keys.  */
+struct vanity_result_s
+{
+  struct vanity_result_s *next;
+  gcry_sexp_t s_private;
+  gcry_sexp_t s_public;
+  u32 created;                  /* Its creation time.  */
+  unsigned char fpr[20];        /* Its fingerprint.  */
+  unsigned int match;           /* The pattern item it matches.  */
+  unsigned int score;           /* Its score for a scoring pattern.  */
+  char jobid[17];               /* The ID of the search as hex string.  */
+};
+
+
 /*-- gpg-agent.c --*/
 void agent_exit (int rc) GPGRT_GCC_A_NR; /* Also implemented in other tools */
 gpg_error_t agent_copy_startup_env (ctrl_t ctrl);
 const char *get_agent_socket_name (void);
 const char *get_agent_ssh_socket_name (void);
+int get_agent_connection_stats (int idx, char *buffer, size_t size);
 #ifdef HAVE_W32_SYSTEM
 void *get_agent_scd_notify_event (void);
 #endif
@@ -303,8 +413,10 @@ gpg_error_t agent_write_status (ctrl_t ctrl, const char *keyword, ...)
 gpg_error_t agent_print_status (ctrl_t ctrl, const char *keyword,
                                 const char *format, ...)
      GPGRT_GCC_A_PRINTF(3,4);
+gpg_error_t agent_write_data (ctrl_t ctrl, const void *buffer, size_t length);
 void bump_key_eventcounter (void);
 void bump_card_eventcounter (void);
+void get_eventcounters (unsigned int *r_key, unsigned int *r_card);
 void start_command_handler (ctrl_t, gnupg_fd_t, gnupg_fd_t);
 gpg_error_t pinentry_loopback (ctrl_t, const char *keyword,
 	                       unsigned char **buffer, size_t *size,
@@ -348,6 +460,9 @@ gpg_error_t agent_public_key_from_file (ctrl_t ctrl,
 int agent_is_dsa_key (gcry_sexp_t s_key);
 int agent_is_eddsa_key (gcry_sexp_t s_key);
 int agent_key_available (const unsigned char *grip);
+gpg_error_t agent_list_key_grips (unsigned char **r_grips, size_t *r_count);
+int agent_key_in_list (const unsigned char *grip,
+                       const unsigned char *grips, size_t count);
 gpg_error_t agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
                                       int *r_keytype,
                                       unsigned char **r_shadow_info);
@@ -382,6 +497,9 @@ void agent_flush_cache (void);
 int agent_put_cache (const char *key, cache_mode_t cache_mode,
                      const char *data, int ttl);
 char *agent_get_cache (const char *key, cache_mode_t cache_mode);
+gpg_error_t agent_put_cache_key (const char *key, const void *data,
+                                 size_t datalen, int ttl);
+void *agent_get_cache_key (const char *key, size_t *r_datalen);
 void agent_store_cache_hit (const char *key);
 
 
@@ -394,11 +512,32 @@ int agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 int agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                   const char *desc_text,
                   membuf_t *outbuf, cache_mode_t cache_mode);
+struct agent_digest_s
+{
+  int algo;
+  unsigned char value[MAX_DIGEST_LEN];
+  int valuelen;
+};
+int agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                        const char *desc_text,
+                        const struct agent_digest_s *digests,
+                        unsigned int ndigests, cache_mode_t cache_mode,
+                        gpg_error_t (*put_sig) (void *opaque,
+                                                const void *sig,
+                                                size_t siglen),
+                        void *opaque);
 
 /*-- pkdecrypt.c --*/
 int agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
                      const unsigned char *ciphertext, size_t ciphertextlen,
                      membuf_t *outbuf, int *r_padding);
+int agent_pkdecrypt_batch (ctrl_t ctrl, const char *desc_text,
+                           const unsigned char *ciphertexts,
+                           size_t ciphertextslen,
+                           gpg_error_t (*put_plain) (void *opaque,
+                                                     const void *plain,
+                                                     size_t plainlen),
+                           void *opaque);
 
 /*-- genkey.c --*/
 int check_passphrase_constraints (ctrl_t ctrl, const char *pw, int silent);
@@ -407,13 +546,101 @@ gpg_error_t agent_ask_new_passphrase (ctrl_t ctrl, const char *prompt,
 int agent_genkey (ctrl_t ctrl, const char *cache_nonce,
                   const char *keyparam, size_t keyparmlen,
                   int no_protection, const char *override_passphrase,
-                  int preset, membuf_t *outbuf);
+                  int preset, const char *vanity_pattern,
+                  const char *vanity_window, int vanity_backward,
+                  int vanity_algo, unsigned int vanity_hits,
+                  unsigned long vanity_budget,
+                  unsigned long long vanity_iterations, int vanity_stream,
+                  const struct agent_vanity_seeds_s *vanity_seeds,
+                  const char *subkeyparam, size_t subkeyparamlen,
+                  const char *subkey_pattern, int subkey_algo,
+                  const char *subkey_kdf, membuf_t *outbuf);
+gpg_error_t agent_vanity_store_key (gcry_sexp_t s_private,
+                                    const char *passphrase,
+                                    unsigned long s2k_count,
+                                    unsigned char *r_grip);
 gpg_error_t agent_protect_and_store (ctrl_t ctrl, gcry_sexp_t s_skey,
                                      char **passphrase_addr);
 
+/*-- keypool.c --*/
+void agent_keypool_flush (void);
+gcry_sexp_t agent_keypool_take (gcry_sexp_t s_keyparam);
+
+/*-- keystore.c --*/
+gpg_error_t agent_keystore_put (const unsigned char *grip,
+                                const void *buffer, size_t length,
+                                int force);
+gpg_error_t agent_keystore_get (const unsigned char *grip,
+                                unsigned char **r_buf, size_t *r_len,
+                                off_t *r_off);
+gpg_error_t agent_keystore_delete (const unsigned char *grip);
+int agent_keystore_has (const unsigned char *grip);
+gpg_error_t agent_keystore_list (unsigned char **r_grips, size_t *r_count);
+
+/*-- vanityjob.c --*/
+gpg_error_t agent_vanity_search (ctrl_t ctrl, gcry_sexp_t s_keyparam,
+                                 const char *pattern, const char *window,
+                                 int backward, int algo, unsigned int nhits,
+                                 unsigned long budget,
+                                 unsigned long long max_iterations,
+                                 unsigned int nworkers,
+                                 const struct agent_vanity_seeds_s *seeds,
+                                 gcry_sexp_t *r_private, gcry_sexp_t *r_public,
+                                 u32 *r_created, unsigned char *r_fpr,
+                                 struct vanity_result_s **r_more);
+gpg_error_t agent_vanity_subkey_start (gcry_sexp_t s_keyparam,
+                                       const char *pattern, int algo,
+                                       const char *kdf,
+                                       const char *window, int backward,
+                                       unsigned long budget,
+                                       const char *primary_pattern,
+                                       struct vanity_subkey_s **r_sub,
+                                       unsigned int *r_nworkers);
+gpg_error_t agent_vanity_subkey_finish (struct vanity_subkey_s *sub,
+                                        int cancel, gcry_sexp_t *r_private,
+                                        u32 *r_created, unsigned char *r_fpr,
+                                        unsigned char *r_kdf);
+gpg_error_t agent_vanity_write_cost (ctrl_t ctrl, const char *jobid,
+                                     const struct vanity_cost_s *cost);
+void agent_vanity_release_results (struct vanity_result_s *list);
+gpg_error_t agent_vanity_record_result (ctrl_t ctrl, const char *pattern,
+                                        struct vanity_result_s *result,
+                                        const unsigned char *grip);
+gpg_error_t agent_vanity_list_results (ctrl_t ctrl, const char *jobid);
+gpg_error_t agent_vanity_delete_result (const char *hexfpr);
+void agent_vanity_resume (void);
+void agent_vanity_set_limits (struct vanity_job_s *job);
+void agent_vanity_open_pool (gcry_sexp_t s_keyparam,
+                             struct vanity_pool_s **r_pool);
+void agent_vanity_close_pool (struct vanity_pool_s *pool);
+
+/*-- vanityqueue.c --*/
+gpg_error_t agent_vanity_submit (ctrl_t ctrl, gcry_sexp_t s_keyparam,
+                                 const char *pattern, const char *window,
+                                 int backward, int algo, unsigned int nhits,
+                                 unsigned long budget,
+                                 unsigned long long max_iterations,
+                                 unsigned int priority,
+                                 const char *passphrase, char *r_id);
+gpg_error_t agent_vanity_queue_status (ctrl_t ctrl, const char *id);
+gpg_error_t agent_vanity_queue_cancel (const char *id);
+gpg_error_t agent_vanity_queue_result (ctrl_t ctrl, const char *id);
+void agent_vanity_queue_counts (unsigned int *r_queued,
+                                unsigned int *r_running);
+
+/*-- vanitymetrics.c --*/
+void agent_vanity_metrics_start (struct agent_vanity_metrics_run_s *run);
+void agent_vanity_metrics_progress (struct agent_vanity_metrics_run_s *run,
+                                    const struct vanity_progress_s *prog);
+void agent_vanity_metrics_end (struct agent_vanity_metrics_run_s *run,
+                               struct vanity_job_s *job, gpg_error_t err);
+void agent_vanity_metrics_checkpoint (double start);
+void agent_vanity_metrics_format (membuf_t *mb);
+
 /*-- protect.c --*/
 unsigned long get_standard_s2k_count (void);
 unsigned char get_standard_s2k_count_rfc4880 (void);
+void agent_set_kdf_hooks (void (*enter) (void), void (*leave) (void));
 int agent_protect (const unsigned char *plainkey, const char *passphrase,
                    unsigned char **result, size_t *resultlen,
 		   unsigned long s2k_count);
@@ -475,7 +702,7 @@ int agent_card_learn (ctrl_t ctrl,
                       void (*sinfo_cb)(void*, const char *,
                                        size_t, const char *),
                       void *sinfo_cb_arg);
-int agent_card_serialno (ctrl_t ctrl, char **r_serialno);
+int agent_card_serialno (ctrl_t ctrl, char **r_serialno, const char *demand);
 int agent_card_pksign (ctrl_t ctrl,
                        const char *keyid,
                        int (*getpin_cb)(void *, const char *, char*, size_t),
@@ -507,6 +734,25 @@ int agent_card_scd (ctrl_t ctrl, const char *cmdline,
 int agent_handle_learn (ctrl_t ctrl, int send, void *assuan_context, int force);
 
 
+/*-- trace.c --*/
+enum agent_trace_point
+  {
+    TRACE_LOCK_WAIT,    /* Waiting for the pinentry or scdaemon lock.  */
+    TRACE_KEY_READ,     /* Reading a key file.  */
+    TRACE_SEXP_PARSE,   /* Parsing a key file.  */
+    TRACE_UNPROTECT,    /* Unprotecting a key including the S2K.  */
+    TRACE_S2K,          /* Deriving the key from a passphrase.  */
+    TRACE_PKSIGN,       /* The libgcrypt signing operation.  */
+    TRACE_PKDECRYPT,    /* The libgcrypt decryption.  */
+    TRACE_PINENTRY,     /* Holding the pinentry.  */
+    TRACE_SCDAEMON      /* Holding the scdaemon.  */
+  };
+
+double agent_trace_start (void);
+void agent_trace_end (enum agent_trace_point point, double start);
+int agent_trace_stats (int idx, char *buffer, size_t size);
+
+
 /*-- cvt-openpgp.c --*/
 gpg_error_t
 extract_private_key (gcry_sexp_t s_key, int req_private_key_data,
@@ -51,19 +51,40 @@ struct secret_data_s {
   char data[1];  /* A string.  */
 };
 
+/* The initial number of buckets of the cache table; it is doubled
+   whenever there are more than twice as many items.  */
+#define INITIAL_TABLE_SIZE 64
+
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;       /* The next item in the same bucket.  */
   time_t created;
   time_t accessed;
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
+  time_t deadline; /* When housekeeping has to look at the item again;
+                      0 for never.  */
+  unsigned int heapidx;  /* The index of the item in EXPIRY_HEAP.  */
   struct secret_data_s *pw;
   cache_mode_t cache_mode;
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
+/* The cache himself.  This is a hash table indexed by the key only,
+   because all modes but CACHE_MODE_USER and CACHE_MODE_NONCE match
+   items of any mode.  Items with the same key are thus in the same
+   bucket, the most recently inserted first.  */
+static ITEM *cache_table;
+static unsigned int cache_table_size;
+static unsigned int cache_nitems;
+
+/* All items of the cache as a binary heap ordered by their
+   deadlines.  It has space for CACHE_NITEMS items.  */
+static ITEM *expiry_heap;
+static unsigned int expiry_heap_size;
+
+/* The maximum TTLs the deadlines were computed with.  */
+static unsigned long deadline_max_ttl;
+static unsigned long deadline_max_ttl_ssh;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
@@ -148,12 +169,13 @@ release_data (struct secret_data_s *data)
    xfree (data);
 }
 
+/* Encrypt the LENGTH bytes at DATA into a new object stored at
+   R_DATA.  */
 static gpg_error_t
-new_data (const char *string, struct secret_data_s **r_data)
+new_data (const void *data, size_t length, struct secret_data_s **r_data)
 {
   gpg_error_t err;
   struct secret_data_s *d, *d_enc;
-  size_t length;
   int total;
   int res;
 
@@ -163,8 +185,6 @@ new_data (const char *string, struct secret_data_s **r_data)
   if (err)
     return err;
 
-  length = strlen (string) + 1;
-
   /* We pad the data to 32 bytes so that it get more complicated
      finding something out by watching allocation patterns.  This is
      usally not possible but we better assume nothing about our secure
@@ -175,7 +195,8 @@ new_data (const char *string, struct secret_data_s **r_data)
   d = xtrymalloc_secure (sizeof *d + total - 1);
   if (!d)
     return gpg_error_from_syserror ();
-  memcpy (d->data, string, length);
+  memcpy (d->data, data, length);
+  memset (d->data + length, 0, total - 8 - length);
 
   d_enc = xtrymalloc (sizeof *d_enc + total - 1);
   if (!d_enc)
@@ -208,70 +229,280 @@ new_data (const char *string, struct secret_data_s **r_data)
 
 
 
-/* Check whether there are items to expire.  */
+/* Return the bucket for KEY.  */
+static unsigned int
+hash_key (const char *key, unsigned int size)
+{
+  unsigned int h = 2166136261U;
+
+  for (; *key; key++)
+    h = (h ^ *(const unsigned char *)key) * 16777619U;
+  return h & (size - 1);
+}
+
+
+/* Return the maximum lifetime of the data of item R.  */
+static unsigned long
+max_ttl (ITEM r)
+{
+  switch (r->cache_mode)
+    {
+    case CACHE_MODE_SSH: return opt.max_cache_ttl_ssh;
+    default: return opt.max_cache_ttl;
+    }
+}
+
+
+/* Compute the deadline of item R; that is the first second at which
+   housekeeping would change it.  */
+static void
+compute_deadline (ITEM r)
+{
+  time_t d;
+
+  if (r->pw)
+    {
+      d = r->created + max_ttl (r) + 1;
+      if (r->ttl >= 0 && r->accessed + r->ttl + 1 < d)
+        d = r->accessed + r->ttl + 1;
+    }
+  else if (r->ttl >= 0)
+    d = r->accessed + 60*30 + 1;
+  else
+    d = 0;
+  r->deadline = d;
+}
+
+
+/* Return true if item A has to be looked at before item B.  */
+static int
+deadline_before (ITEM a, ITEM b)
+{
+  return a->deadline && (!b->deadline || a->deadline < b->deadline);
+}
+
+
+static void
+heap_swap (unsigned int i, unsigned int j)
+{
+  ITEM tmp = expiry_heap[i];
+
+  expiry_heap[i] = expiry_heap[j];
+  expiry_heap[j] = tmp;
+  expiry_heap[i]->heapidx = i;
+  expiry_heap[j]->heapidx = j;
+}
+
+
+/* Move the item at index I of the heap to its place.  */
+static void
+heap_fix (unsigned int i)
+{
+  unsigned int c;
+
+  while (i && deadline_before (expiry_heap[i], expiry_heap[(i - 1) / 2]))
+    {
+      heap_swap (i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+  for (;;)
+    {
+      c = 2 * i + 1;
+      if (c >= cache_nitems)
+        break;
+      if (c + 1 < cache_nitems
+          && deadline_before (expiry_heap[c + 1], expiry_heap[c]))
+        c++;
+      if (!deadline_before (expiry_heap[c], expiry_heap[i]))
+        break;
+      heap_swap (i, c);
+      i = c;
+    }
+}
+
+
+/* Recompute the deadline of item R after it changed.  */
+static void
+update_deadline (ITEM r)
+{
+  compute_deadline (r);
+  heap_fix (r->heapidx);
+}
+
+
+/* Double the number of buckets.  On error the table stays as it is;
+   it just gets slower.  */
+static void
+grow_table (void)
+{
+  ITEM *table, r, r2, *tail;
+  unsigned int size = cache_table_size * 2;
+  unsigned int i, h;
+
+  table = xtrycalloc (size, sizeof *table);
+  if (!table)
+    return;
+  /* Append to keep the order of the items with the same key.  */
+  for (i=0; i < cache_table_size; i++)
+    for (r=cache_table[i]; r; r = r2)
+      {
+        r2 = r->next;
+        h = hash_key (r->key, size);
+        for (tail=&table[h]; *tail; tail = &(*tail)->next)
+          ;
+        r->next = NULL;
+        *tail = r;
+      }
+  xfree (cache_table);
+  cache_table = table;
+  cache_table_size = size;
+}
+
+
+/* Add the new item R to the cache.  */
+static gpg_error_t
+insert_item (ITEM r)
+{
+  ITEM *heap;
+  unsigned int h;
+
+  if (!cache_table)
+    {
+      cache_table = xtrycalloc (INITIAL_TABLE_SIZE, sizeof *cache_table);
+      if (!cache_table)
+        return gpg_error_from_syserror ();
+      cache_table_size = INITIAL_TABLE_SIZE;
+    }
+  if (cache_nitems == expiry_heap_size)
+    {
+      heap = xtryrealloc (expiry_heap, ((expiry_heap_size + INITIAL_TABLE_SIZE)
+                                        * sizeof *heap));
+      if (!heap)
+        return gpg_error_from_syserror ();
+      expiry_heap = heap;
+      expiry_heap_size += INITIAL_TABLE_SIZE;
+    }
+  if (cache_nitems >= 2 * cache_table_size)
+    grow_table ();
+
+  h = hash_key (r->key, cache_table_size);
+  r->next = cache_table[h];
+  cache_table[h] = r;
+  r->heapidx = cache_nitems;
+  expiry_heap[cache_nitems++] = r;
+  update_deadline (r);
+  return 0;
+}
+
+
+/* Remove item R from the cache and release it.  */
+static void
+remove_item (ITEM r)
+{
+  ITEM *rp;
+  unsigned int i;
+
+  for (rp=&cache_table[hash_key (r->key, cache_table_size)]; *rp != r;
+       rp = &(*rp)->next)
+    ;
+  *rp = r->next;
+
+  i = r->heapidx;
+  cache_nitems--;
+  if (i != cache_nitems)
+    {
+      expiry_heap[i] = expiry_heap[cache_nitems];
+      expiry_heap[i]->heapidx = i;
+      heap_fix (i);
+    }
+  if (r->pw)
+    release_data (r->pw);
+  xfree (r);
+}
+
+
+/* Return the first item matching KEY and CACHE_MODE.  If WITH_DATA
+   is set only items which have data are considered.  Unprotected
+   keys are only found with CACHE_MODE_KEY.  */
+static ITEM
+find_item (const char *key, cache_mode_t cache_mode, int with_data)
+{
+  ITEM r;
+
+  if (!cache_table)
+    return NULL;
+  for (r=cache_table[hash_key (key, cache_table_size)]; r; r = r->next)
+    {
+      if ((!with_data || r->pw)
+          && ((cache_mode != CACHE_MODE_USER
+               && cache_mode != CACHE_MODE_NONCE
+               && cache_mode != CACHE_MODE_KEY
+               && r->cache_mode != CACHE_MODE_KEY)
+              || r->cache_mode == cache_mode)
+          && !strcmp (r->key, key))
+        break;
+    }
+  return r;
+}
+
+
+/* Check whether there are items to expire.  Only the items whose
+   deadline has passed are looked at.  */
 static void
 housekeeping (void)
 {
-  ITEM r, rprev;
+  ITEM r;
+  unsigned int i;
   time_t current = gnupg_get_time ();
 
-  /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+  /* The deadlines depend on the maximum TTLs, which may have been
+     changed by a reload.  */
+  if (deadline_max_ttl != opt.max_cache_ttl
+      || deadline_max_ttl_ssh != opt.max_cache_ttl_ssh)
+    {
+      deadline_max_ttl = opt.max_cache_ttl;
+      deadline_max_ttl_ssh = opt.max_cache_ttl_ssh;
+      for (i=0; i < cache_nitems; i++)
+        compute_deadline (expiry_heap[i]);
+      for (i=cache_nitems/2; i-- > 0; )
+        heap_fix (i);
+    }
+
+  while (cache_nitems && expiry_heap[0]->deadline
+         && expiry_heap[0]->deadline <= current)
     {
+      r = expiry_heap[0];
       if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
         {
+          /* Expire the actual data.  */
           if (DBG_CACHE)
             log_debug ("  expired '%s' (%ds after last access)\n",
                        r->key, r->ttl);
           release_data (r->pw);
           r->pw = NULL;
           r->accessed = current;
+          update_deadline (r);
         }
-    }
-
-  /* Second, make sure that we also remove them based on the created stamp so
-     that the user has to enter it from time to time. */
-  for (r=thecache; r; r = r->next)
-    {
-      unsigned long maxttl;
-
-      switch (r->cache_mode)
-        {
-        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
-        default: maxttl = opt.max_cache_ttl; break;
-        }
-      if (r->pw && r->created + maxttl < current)
+      else if (r->pw)
         {
+          /* Remove them based on the created stamp so that the user
+             has to enter it from time to time.  */
           if (DBG_CACHE)
             log_debug ("  expired '%s' (%lus after creation)\n",
                        r->key, opt.max_cache_ttl);
           release_data (r->pw);
           r->pw = NULL;
           r->accessed = current;
+          update_deadline (r);
         }
-    }
-
-  /* Third, make sure that we don't have too many items in the list.
-     Expire old and unused entries after 30 minutes */
-  for (rprev=NULL, r=thecache; r; )
-    {
-      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
+      else
         {
-          ITEM r2 = r->next;
+          /* Make sure that we don't have too many items in the list.
+             Expire old and unused entries after 30 minutes.  */
           if (DBG_CACHE)
             log_debug ("  removed '%s' (mode %d) (slot not used for 30m)\n",
                        r->key, r->cache_mode);
-          xfree (r);
-          if (!rprev)
-            thecache = r2;
-          else
-            rprev->next = r2;
-          r = r2;
-        }
-      else
-        {
-          rprev = r;
-          r = r->next;
+          remove_item (r);
         }
     }
 }
@@ -281,12 +512,14 @@ void
 agent_flush_cache (void)
 {
   ITEM r;
+  unsigned int i;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache\n");
 
-  for (r=thecache; r; r = r->next)
+  for (i=0; i < cache_nitems; i++)
     {
+      r = expiry_heap[i];
       if (r->pw)
         {
           if (DBG_CACHE)
@@ -294,28 +527,24 @@ agent_flush_cache (void)
           release_data (r->pw);
           r->pw = NULL;
           r->accessed = 0;
+          compute_deadline (r);
         }
     }
+  for (i=cache_nitems/2; i-- > 0; )
+    heap_fix (i);
 }
 
 
 
-/* Store the string DATA in the cache under KEY and mark it with a
-   maximum lifetime of TTL seconds.  If there is already data under
-   this key, it will be replaced.  Using a DATA of NULL deletes the
-   entry.  A TTL of 0 is replaced by the default TTL and a TTL of -1
-   set infinite timeout.  CACHE_MODE is stored with the cache entry
-   and used to select different timeouts.  */
-int
-agent_put_cache (const char *key, cache_mode_t cache_mode,
-                 const char *data, int ttl)
+/* Store the DATALEN bytes at DATA in the cache under KEY; see
+   agent_put_cache.  */
+static gpg_error_t
+put_cache (const char *key, cache_mode_t cache_mode,
+           const void *data, size_t datalen, int ttl)
 {
   gpg_error_t err = 0;
   ITEM r;
 
-  if (DBG_CACHE)
-    log_debug ("agent_put_cache '%s' (mode %d) requested ttl=%d\n",
-               key, cache_mode, ttl);
   housekeeping ();
 
   if (!ttl)
@@ -329,14 +558,16 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     return 0;
 
-  for (r=thecache; r; r = r->next)
+  /* Clearing a passphrase also forgets the key it unprotected.  */
+  if (!data && cache_mode != CACHE_MODE_KEY
+      && (r = find_item (key, CACHE_MODE_KEY, 1)))
     {
-      if (((cache_mode != CACHE_MODE_USER
-            && cache_mode != CACHE_MODE_NONCE)
-           || r->cache_mode == cache_mode)
-          && !strcmp (r->key, key))
-        break;
+      release_data (r->pw);
+      r->pw = NULL;
+      update_deadline (r);
     }
+
+  r = find_item (key, cache_mode, 0);
   if (r) /* Replace.  */
     {
       if (r->pw)
@@ -349,10 +580,11 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = new_data (data, datalen, &r->pw);
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
         }
+      update_deadline (r);
     }
   else if (data) /* Insert.  */
     {
@@ -365,13 +597,14 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = new_data (data, datalen, &r->pw);
+          if (!err)
+            err = insert_item (r);
           if (err)
-            xfree (r);
-          else
             {
-              r->next = thecache;
-              thecache = r;
+              if (r->pw)
+                release_data (r->pw);
+              xfree (r);
             }
         }
       if (err)
@@ -381,11 +614,42 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
 }
 
 
-/* Try to find an item in the cache.  Note that we currently don't
-   make use of CACHE_MODE except for CACHE_MODE_NONCE and
-   CACHE_MODE_USER.  */
-char *
-agent_get_cache (const char *key, cache_mode_t cache_mode)
+/* Store the string DATA in the cache under KEY and mark it with a
+   maximum lifetime of TTL seconds.  If there is already data under
+   this key, it will be replaced.  Using a DATA of NULL deletes the
+   entry.  A TTL of 0 is replaced by the default TTL and a TTL of -1
+   set infinite timeout.  CACHE_MODE is stored with the cache entry
+   and used to select different timeouts.  */
+int
+agent_put_cache (const char *key, cache_mode_t cache_mode,
+                 const char *data, int ttl)
+{
+  if (DBG_CACHE)
+    log_debug ("agent_put_cache '%s' (mode %d) requested ttl=%d\n",
+               key, cache_mode, ttl);
+  return put_cache (key, cache_mode, data, data? strlen (data) + 1 : 0, ttl);
+}
+
+
+/* Store the unprotected key of DATALEN bytes at DATA in the cache
+   under KEY with CACHE_MODE_KEY.  Apart from that this is like
+   agent_put_cache; clearing the passphrase under KEY also clears the
+   key.  */
+gpg_error_t
+agent_put_cache_key (const char *key, const void *data, size_t datalen,
+                     int ttl)
+{
+  if (DBG_CACHE)
+    log_debug ("agent_put_cache_key '%s' requested ttl=%d\n", key, ttl);
+  return put_cache (key, CACHE_MODE_KEY, data, datalen, ttl);
+}
+
+
+/* Return the data of the item KEY and CACHE_MODE in secure memory
+   and store its length including the padding at R_DATALEN.  See
+   agent_get_cache.  */
+static void *
+get_cache (const char *key, cache_mode_t cache_mode, size_t *r_datalen)
 {
   gpg_error_t err;
   ITEM r;
@@ -406,52 +670,51 @@ agent_get_cache (const char *key, cache_mode_t cache_mode)
 
 
   if (DBG_CACHE)
-    log_debug ("agent_get_cache '%s' (mode %d)%s ...\n",
+    log_debug ("%s '%s' (mode %d)%s ...\n",
+               cache_mode == CACHE_MODE_KEY? "agent_get_cache_key"
+               /**/                        : "agent_get_cache",
                key, cache_mode,
                last_stored? " (stored cache key)":"");
   housekeeping ();
 
-  for (r=thecache; r; r = r->next)
+  r = find_item (key, cache_mode, 1);
+  if (r)
     {
-      if (r->pw
-          && ((cache_mode != CACHE_MODE_USER
-               && cache_mode != CACHE_MODE_NONCE)
-              || r->cache_mode == cache_mode)
-          && !strcmp (r->key, key))
+      /* Note: To avoid races KEY may not be accessed anymore below.  */
+      r->accessed = gnupg_get_time ();
+      update_deadline (r);
+      if (DBG_CACHE)
+        log_debug ("... hit\n");
+      if (r->pw->totallen < 32)
+        err = gpg_error (GPG_ERR_INV_LENGTH);
+      else if ((err = init_encryption ()))
+        ;
+      else if (!(value = xtrymalloc_secure (r->pw->totallen - 8)))
+        err = gpg_error_from_syserror ();
+      else
         {
-          /* Note: To avoid races KEY may not be accessed anymore below.  */
-          r->accessed = gnupg_get_time ();
-          if (DBG_CACHE)
-            log_debug ("... hit\n");
-          if (r->pw->totallen < 32)
-            err = gpg_error (GPG_ERR_INV_LENGTH);
-          else if ((err = init_encryption ()))
-            ;
-          else if (!(value = xtrymalloc_secure (r->pw->totallen - 8)))
-            err = gpg_error_from_syserror ();
-          else
-            {
-              res = npth_mutex_lock (&encryption_lock);
-              if (res)
-                log_fatal ("failed to acquire cache encryption mutex: %s\n",
-			   strerror (res));
-              err = gcry_cipher_decrypt (encryption_handle,
-                                         value, r->pw->totallen - 8,
-                                         r->pw->data, r->pw->totallen);
-              res = npth_mutex_unlock (&encryption_lock);
-              if (res)
-                log_fatal ("failed to release cache encryption mutex: %s\n",
-			   strerror (res));
-            }
-          if (err)
-            {
-              xfree (value);
-              value = NULL;
-              log_error ("retrieving cache entry '%s' failed: %s\n",
-                         key, gpg_strerror (err));
-            }
-          return value;
+          res = npth_mutex_lock (&encryption_lock);
+          if (res)
+            log_fatal ("failed to acquire cache encryption mutex: %s\n",
+                       strerror (res));
+          err = gcry_cipher_decrypt (encryption_handle,
+                                     value, r->pw->totallen - 8,
+                                     r->pw->data, r->pw->totallen);
+          res = npth_mutex_unlock (&encryption_lock);
+          if (res)
+            log_fatal ("failed to release cache encryption mutex: %s\n",
+                       strerror (res));
         }
+      if (err)
+        {
+          xfree (value);
+          value = NULL;
+          log_error ("retrieving cache entry '%s' failed: %s\n",
+                     key, gpg_strerror (err));
+        }
+      else
+        *r_datalen = r->pw->totallen - 8;
+      return value;
     }
   if (DBG_CACHE)
     log_debug ("... miss\n");
@@ -460,6 +723,30 @@ agent_get_cache (const char *key, cache_mode_t cache_mode)
 }
 
 
+/* Try to find an item in the cache.  Note that we currently don't
+   make use of CACHE_MODE except for CACHE_MODE_NONCE and
+   CACHE_MODE_USER.  */
+char *
+agent_get_cache (const char *key, cache_mode_t cache_mode)
+{
+  size_t datalen;
+
+  return get_cache (key, cache_mode, &datalen);
+}
+
+
+/* Return the unprotected key stored under KEY with
+   agent_put_cache_key or NULL.  The key is returned in secure
+   memory; its length, which includes some zero padding, is stored at
+   R_DATALEN.  */
+void *
+agent_get_cache_key (const char *key, size_t *r_datalen)
+{
+  *r_datalen = 0;
+  return get_cache (key, CACHE_MODE_KEY, r_datalen);
+}
+
+
 /* Store the key for the last successful cache hit.  That value is
    used by agent_get_cache if the requested KEY is given as NULL.
    NULL may be used to remove that key. */
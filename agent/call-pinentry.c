@@ -64,6 +64,9 @@ static ctrl_t entry_owner;
 /* A mutex used to serialize access to the pinentry. */
 static npth_mutex_t entry_lock;
 
+/* The time the current owner took ENTRY_LOCK.  */
+static double entry_lock_start;
+
 /* The thread ID of the popup working thread. */
 static npth_t  popup_tid;
 
@@ -162,6 +165,7 @@ unlock_pinentry (int rc)
     }
 
   entry_ctx = NULL;
+  agent_trace_end (TRACE_PINENTRY, entry_lock_start);
   err = npth_mutex_unlock (&entry_lock);
   if (err)
     {
@@ -243,11 +247,14 @@ start_pinentry (ctrl_t ctrl)
   unsigned long pinentry_pid;
   const char *value;
   struct timespec abstime;
+  double start;
   int err;
 
   npth_clock_gettime (&abstime);
   abstime.tv_sec += LOCK_TIMEOUT;
+  start = agent_trace_start ();
   err = npth_mutex_timedlock (&entry_lock, &abstime);
+  agent_trace_end (TRACE_LOCK_WAIT, start);
   if (err)
     {
       if (err == ETIMEDOUT)
@@ -260,6 +267,7 @@ start_pinentry (ctrl_t ctrl)
     }
 
   entry_owner = ctrl;
+  entry_lock_start = agent_trace_start ();
 
   if (entry_ctx)
     return 0;
@@ -46,6 +46,9 @@
 #define MAX_OPEN_FDS 20
 #endif
 
+/* The number of idle connections to the SCdaemon kept for reuse.  */
+#define SCD_POOL_SIZE 8
+
 /* Definition of module local data of the CTRL structure.  */
 struct scd_local_s
 {
@@ -63,7 +66,14 @@ struct scd_local_s
                            used with this connection. */
   int locked;           /* This flag is used to assert proper use of
                            start_scd and unlock_scd. */
-
+  double lock_start;    /* The time start_scd took the lock.  */
+
+  /* The result of the last SERIALNO command on CTX, the value of its
+     --demand option and the card event counter at that time.  The
+     result is used again as long as no card event happened.  */
+  char *serialno;
+  char *serialno_demand;
+  unsigned int serialno_events;
 };
 
 
@@ -110,6 +120,13 @@ static assuan_context_t primary_scd_ctx;
    any connection. */
 static int primary_scd_ctx_reusable;
 
+/* The additional connections are not closed at the end of an agent
+   connection but kept here for the next one; this saves the connect
+   and keeps their serial number cache.  The objects are not linked
+   into SCD_LOCAL_LIST.  Protected by START_SCD_LOCK.  */
+static struct scd_local_s *scd_pool[SCD_POOL_SIZE];
+static int scd_pool_len;
+
 
 
 /* Local prototypes.  */
@@ -150,6 +167,74 @@ agent_scd_dump_state (void)
             primary_scd_ctx_reusable);
   if (socket_name)
     log_info ("agent_scd_dump_state: socket='%s'\n", socket_name);
+  log_info ("agent_scd_dump_state: pooled connections=%d\n", scd_pool_len);
+}
+
+
+/* Forget the cached serial number of the connection SL.  */
+static void
+clear_serialno_cache (struct scd_local_s *sl)
+{
+  xfree (sl->serialno);
+  sl->serialno = NULL;
+  xfree (sl->serialno_demand);
+  sl->serialno_demand = NULL;
+}
+
+
+/* Release all pooled connections.  Must be called with the
+   START_SCD_LOCK held.  */
+static void
+release_scd_pool (void)
+{
+  struct scd_local_s *sl;
+
+  while (scd_pool_len)
+    {
+      sl = scd_pool[--scd_pool_len];
+      assuan_release (sl->ctx);
+      clear_serialno_cache (sl);
+      xfree (sl);
+    }
+}
+
+
+/* Put the connection of SL into the pool.  SL->CTX is cleared if this
+   succeeded.  */
+static void
+pool_scd_connection (struct scd_local_s *sl)
+{
+  struct scd_local_s *item;
+  int rc;
+
+  /* Make the SCdaemon forget the state of the session.  This is the
+     same as done for the primary connection.  */
+  if (assuan_transact (sl->ctx, "RESTART",
+                       NULL, NULL, NULL, NULL, NULL, NULL))
+    return;
+
+  rc = npth_mutex_lock (&start_scd_lock);
+  if (rc)
+    {
+      log_error ("failed to acquire the start_scd lock: %s\n",
+                 strerror (rc));
+      return;
+    }
+  if (primary_scd_ctx && scd_pool_len < SCD_POOL_SIZE
+      && (item = xtrycalloc (1, sizeof *item)))
+    {
+      item->ctx = sl->ctx;
+      item->serialno = sl->serialno;
+      item->serialno_demand = sl->serialno_demand;
+      item->serialno_events = sl->serialno_events;
+      scd_pool[scd_pool_len++] = item;
+      sl->ctx = NULL;
+      sl->serialno = NULL;
+      sl->serialno_demand = NULL;
+    }
+  rc = npth_mutex_unlock (&start_scd_lock);
+  if (rc)
+    log_error ("failed to release the start_scd lock: %s\n", strerror (rc));
 }
 
 
@@ -170,6 +255,8 @@ unlock_scd (ctrl_t ctrl, int rc)
       if (!rc)
         rc = gpg_error (GPG_ERR_INTERNAL);
     }
+  else
+    agent_trace_end (TRACE_SCDAEMON, ctrl->scd_local->lock_start);
   ctrl->scd_local->locked = 0;
   return rc;
 }
@@ -226,6 +313,7 @@ start_scd (ctrl_t ctrl)
       return gpg_error (GPG_ERR_INTERNAL);
     }
   ctrl->scd_local->locked++;
+  ctrl->scd_local->lock_start = agent_trace_start ();
 
   if (ctrl->scd_local->ctx)
     return 0; /* Okay, the context is fine.  We used to test for an
@@ -236,7 +324,12 @@ start_scd (ctrl_t ctrl)
 
 
   /* We need to protect the following code. */
-  rc = npth_mutex_lock (&start_scd_lock);
+  {
+    double start = agent_trace_start ();
+
+    rc = npth_mutex_lock (&start_scd_lock);
+    agent_trace_end (TRACE_LOCK_WAIT, start);
+  }
   if (rc)
     {
       log_error ("failed to acquire the start_scd lock: %s\n",
@@ -245,8 +338,23 @@ start_scd (ctrl_t ctrl)
     }
 
   /* Check whether the pipe server has already been started and in
-     this case either reuse a lingering pipe connection or establish a
-     new socket based one. */
+     this case either reuse a lingering pipe connection, a pooled
+     connection or establish a new socket based one. */
+  if (primary_scd_ctx && scd_pool_len)
+    {
+      struct scd_local_s *item = scd_pool[--scd_pool_len];
+
+      ctx = item->ctx;
+      clear_serialno_cache (ctrl->scd_local);
+      ctrl->scd_local->serialno = item->serialno;
+      ctrl->scd_local->serialno_demand = item->serialno_demand;
+      ctrl->scd_local->serialno_events = item->serialno_events;
+      xfree (item);
+      if (DBG_IPC)
+        log_debug ("connection to SCdaemon taken from the pool\n");
+      goto leave;
+    }
+
   if (primary_scd_ctx && primary_scd_ctx_reusable)
     {
       ctx = primary_scd_ctx;
@@ -491,6 +599,7 @@ agent_scd_check_aliveness (void)
                 }
             }
 
+          release_scd_pool ();
           primary_scd_ctx = NULL;
           primary_scd_ctx_reusable = 0;
 
@@ -537,7 +646,11 @@ agent_reset_scd (ctrl_t ctrl)
               primary_scd_ctx_reusable = 1;
             }
           else
-            assuan_release (ctrl->scd_local->ctx);
+            {
+              pool_scd_connection (ctrl->scd_local);
+              if (ctrl->scd_local->ctx)
+                assuan_release (ctrl->scd_local->ctx);
+            }
           ctrl->scd_local->ctx = NULL;
         }
 
@@ -557,6 +670,7 @@ agent_reset_scd (ctrl_t ctrl)
             BUG ();
           sl->next_local = ctrl->scd_local->next_local;
         }
+      clear_serialno_cache (ctrl->scd_local);
       xfree (ctrl->scd_local);
       ctrl->scd_local = NULL;
     }
@@ -661,18 +775,49 @@ get_serialno_cb (void *opaque, const char *line)
 }
 
 /* Return the serial number of the card or an appropriate error.  The
-   serial number is returned as a hexstring. */
+   serial number is returned as a hexstring.  If DEMAND is not NULL
+   the SCdaemon is asked to use the card with that serial number if
+   it is available in any reader.  As long as the SCdaemon reports no
+   card event, the result of the last call on the same SCdaemon
+   connection is returned without asking again.  */
 int
-agent_card_serialno (ctrl_t ctrl, char **r_serialno)
+agent_card_serialno (ctrl_t ctrl, char **r_serialno, const char *demand)
 {
   int rc;
   char *serialno = NULL;
+  char line[ASSUAN_LINELENGTH];
+  struct scd_local_s *sl;
+  unsigned int key_events, card_events;
 
   rc = start_scd (ctrl);
   if (rc)
     return rc;
+  sl = ctrl->scd_local;
+
+  /* We can only rely on the cache if the SCdaemon tells us about
+     card events.  */
+  get_eventcounters (&key_events, &card_events);
+  if (opt.sigusr2_enabled && sl->serialno
+      && sl->serialno_events == card_events
+      && (demand? (sl->serialno_demand
+                   && !strcmp (sl->serialno_demand, demand))
+          /**/  : !sl->serialno_demand))
+    {
+      serialno = xtrystrdup (sl->serialno);
+      if (!serialno)
+        return unlock_scd (ctrl, gpg_error_from_syserror ());
+      if (DBG_IPC)
+        log_debug ("using cached serial number %s\n", serialno);
+      *r_serialno = serialno;
+      return unlock_scd (ctrl, 0);
+    }
+  clear_serialno_cache (sl);
 
-  rc = assuan_transact (ctrl->scd_local->ctx, "SERIALNO",
+  if (demand)
+    snprintf (line, DIM(line), "SERIALNO --demand=%s", demand);
+  else
+    strcpy (line, "SERIALNO");
+  rc = assuan_transact (sl->ctx, line,
                         NULL, NULL, NULL, NULL,
                         get_serialno_cb, &serialno);
   if (rc)
@@ -680,6 +825,13 @@ agent_card_serialno (ctrl_t ctrl, char **r_serialno)
       xfree (serialno);
       return unlock_scd (ctrl, rc);
     }
+
+  sl->serialno = xtrystrdup (serialno);
+  sl->serialno_demand = demand? xtrystrdup (demand) : NULL;
+  if (!sl->serialno || (demand && !sl->serialno_demand))
+    clear_serialno_cache (sl);
+  sl->serialno_events = card_events;
+
   *r_serialno = serialno;
   return unlock_scd (ctrl, 0);
 }
@@ -1249,6 +1401,10 @@ agent_card_scd (ctrl_t ctrl, const char *cmdline,
   inqparm.getpin_cb_arg = getpin_cb_arg;
   inqparm.passthru = assuan_context;
   inqparm.any_inq_seen = 0;
+
+  /* The command may switch the SCdaemon to another card.  */
+  clear_serialno_cache (ctrl->scd_local);
+
   saveflag = assuan_get_flag (ctrl->scd_local->ctx, ASSUAN_CONVEY_COMMENTS);
   assuan_set_flag (ctrl->scd_local->ctx, ASSUAN_CONVEY_COMMENTS, 1);
   rc = assuan_transact (ctrl->scd_local->ctx, cmdline,
@@ -305,6 +305,59 @@ static ssh_key_type_spec_t ssh_key_types[] =
     }
   };
 
+
+/* The number of hash buckets of the sshcontrol index.  */
+#define CONTROL_TABLE_SIZE 256
+
+/* An entry of the sshcontrol index.  */
+struct control_entry_s
+{
+  struct control_entry_s *next;      /* The next entry in file order.  */
+  struct control_entry_s *hashnext;  /* The next entry of the bucket.  */
+  int disabled;                      /* The item is disabled.  */
+  int ttl;                           /* The TTL of the item.  */
+  int confirm;                       /* The confirm flag is set.  */
+  char hexgrip[40+1];                /* The hexgrip (uppercase).  */
+};
+
+/* The parsed sshcontrol file.  It is read again if the file has been
+   modified, as detected by its device, inode, size and mtime.  Only
+   the first entry for a keygrip is put into the hash table so that
+   lookups find the same entry as a scan of the file.  */
+static struct
+{
+  int valid;                /* The index is valid.  */
+  unsigned int serial;      /* Incremented each time it is read.  */
+  dev_t dev;                /* The file read.  */
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  struct control_entry_s *entries;  /* All entries in file order.  */
+  struct control_entry_s *table[CONTROL_TABLE_SIZE];
+} control_index;
+
+/* The reply to REQUEST_IDENTITIES is built from the sshcontrol file,
+   the key files and the card, which is too slow to do on each
+   connection.  Thus the serialized key blobs are kept here.  The
+   blobs of the sshcontrol keys are rebuilt if the sshcontrol index
+   has been read again or the key event counter changed; the blob of
+   the card key if the card event counter changed or scdaemon is not
+   running anymore.  */
+static struct
+{
+  int valid;               /* The sshcontrol part is valid.  */
+  unsigned int key_events; /* The key event counter used.  */
+  unsigned int control_serial; /* The serial of the index used.  */
+  unsigned char *blobs;    /* The blobs of the sshcontrol keys.  */
+  size_t blobslen;
+  u32 count;               /* The number of sshcontrol keys.  */
+
+  int card_valid;          /* The card part is valid.  */
+  unsigned int card_events;/* The card event counter used.  */
+  unsigned char *card_blob;/* The blob of the card key or NULL.  */
+  size_t card_bloblen;
+} identity_cache;
+
 
 
 
@@ -767,65 +820,6 @@ stream_copy (estream_t dst, estream_t src)
 }
 
 
-/* Read the content of the file specified by FILENAME into a newly
-   create buffer, which is to be stored in BUFFER; store length of
-   buffer in BUFFER_N.  */
-static gpg_error_t
-file_to_buffer (const char *filename, unsigned char **buffer, size_t *buffer_n)
-{
-  unsigned char *buffer_new;
-  struct stat statbuf;
-  estream_t stream;
-  gpg_error_t err;
-  int ret;
-
-  *buffer = NULL;
-  *buffer_n = 0;
-
-  buffer_new = NULL;
-  err = 0;
-
-  stream = es_fopen (filename, "rb");
-  if (! stream)
-    {
-      err = gpg_error_from_syserror ();
-      goto out;
-    }
-
-  ret = fstat (es_fileno (stream), &statbuf);
-  if (ret)
-    {
-      err = gpg_error_from_syserror ();
-      goto out;
-    }
-
-  buffer_new = xtrymalloc (statbuf.st_size);
-  if (! buffer_new)
-    {
-      err = gpg_error_from_syserror ();
-      goto out;
-    }
-
-  err = stream_read_data (stream, buffer_new, statbuf.st_size);
-  if (err)
-    goto out;
-
-  *buffer = buffer_new;
-  *buffer_n = statbuf.st_size;
-
- out:
-
-  if (stream)
-    es_fclose (stream);
-
-  if (err)
-    xfree (buffer_new);
-
-  return err;
-}
-
-
-
 
 /* Open the ssh control file and create it if not available.  With
    APPEND passed as true the file will be opened in append mode,
@@ -1100,58 +1094,186 @@ add_control_entry (ctrl_t ctrl, ssh_key_type_spec_t *spec,
 
     }
   close_control_file (cf);
+  /* The mtime has only a resolution of a second.  */
+  control_index.valid = 0;
   return 0;
 }
 
 
-/* Scan the sshcontrol file and return the TTL.  */
+/* Return the hash bucket for HEXGRIP.  Keygrips are uniformly
+   distributed, thus the first two bytes are sufficient.  */
+static unsigned int
+control_hash (const char *hexgrip)
+{
+  return ((xtoi_2 (hexgrip) << 8) | xtoi_2 (hexgrip+2)) % CONTROL_TABLE_SIZE;
+}
+
+
+/* Release the entries of the sshcontrol index.  */
+static void
+flush_control_index (void)
+{
+  struct control_entry_s *e, *enext;
+
+  for (e = control_index.entries; e; e = enext)
+    {
+      enext = e->next;
+      xfree (e);
+    }
+  control_index.entries = NULL;
+  memset (control_index.table, 0, sizeof control_index.table);
+  control_index.valid = 0;
+}
+
+
+/* Make sure that the sshcontrol index reflects the current file.
+   Returns an error if the file can't be read.  */
+static gpg_error_t
+update_control_index (void)
+{
+  gpg_error_t err;
+  ssh_control_file_t cf;
+  struct control_entry_s *e, **tail;
+  struct stat st;
+  char *fname;
+  unsigned int h;
+
+  if (control_index.valid)
+    {
+      fname = make_filename_try (opt.homedir, SSH_CONTROL_FILE_NAME, NULL);
+      if (!fname)
+        return gpg_error_from_syserror ();
+      if (!stat (fname, &st)
+          && st.st_dev == control_index.dev
+          && st.st_ino == control_index.ino
+          && st.st_size == control_index.size
+          && st.st_mtime == control_index.mtime)
+        {
+          xfree (fname);
+          return 0;
+        }
+      xfree (fname);
+    }
+
+  flush_control_index ();
+
+  err = open_control_file (&cf, 0);
+  if (err)
+    return err;
+  if (fstat (fileno (cf->fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      close_control_file (cf);
+      return err;
+    }
+
+  tail = &control_index.entries;
+  while (!read_control_file_item (cf))
+    {
+      if (!cf->item.valid)
+        continue; /* Should not happen.  */
+      e = xtrycalloc (1, sizeof *e);
+      if (!e)
+        {
+          err = gpg_error_from_syserror ();
+          close_control_file (cf);
+          flush_control_index ();
+          return err;
+        }
+      e->disabled = cf->item.disabled;
+      e->ttl = cf->item.ttl;
+      e->confirm = cf->item.confirm;
+      strcpy (e->hexgrip, cf->item.hexgrip);
+      *tail = e;
+      tail = &e->next;
+
+      h = control_hash (e->hexgrip);
+      if (!control_index.table[h])
+        control_index.table[h] = e;
+      else
+        {
+          struct control_entry_s *b;
+
+          for (b = control_index.table[h]; ; b = b->hashnext)
+            {
+              if (!strcmp (b->hexgrip, e->hexgrip))
+                break; /* Keep the first one.  */
+              if (!b->hashnext)
+                {
+                  b->hashnext = e;
+                  break;
+                }
+            }
+        }
+    }
+  close_control_file (cf);
+
+  control_index.dev = st.st_dev;
+  control_index.ino = st.st_ino;
+  control_index.size = st.st_size;
+  control_index.mtime = st.st_mtime;
+  control_index.serial++;
+  control_index.valid = 1;
+  return 0;
+}
+
+
+/* Return the sshcontrol entry for HEXGRIP or NULL if there is none.
+   The caller must have updated the index.  */
+static struct control_entry_s *
+find_control_entry (const char *hexgrip)
+{
+  struct control_entry_s *e;
+
+  for (e = control_index.table[control_hash (hexgrip)]; e; e = e->hashnext)
+    if (!strcmp (e->hexgrip, hexgrip))
+      return e;
+  return NULL;
+}
+
+
+/* Look up the sshcontrol entry and return the TTL.  */
 static int
 ttl_from_sshcontrol (const char *hexgrip)
 {
-  ssh_control_file_t cf;
-  int disabled, ttl;
+  struct control_entry_s *e;
 
   if (!hexgrip || strlen (hexgrip) != 40)
     return 0;  /* Wrong input: Use global default.  */
 
-  if (open_control_file (&cf, 0))
+  if (update_control_index ())
     return 0; /* Error: Use the global default TTL.  */
 
-  if (search_control_file (cf, hexgrip, &disabled, &ttl, NULL)
-      || disabled)
-    ttl = 0;  /* Use the global default if not found or disabled.  */
-
-  close_control_file (cf);
+  e = find_control_entry (hexgrip);
+  if (!e || e->disabled)
+    return 0;  /* Use the global default if not found or disabled.  */
 
-  return ttl;
+  return e->ttl;
 }
 
 
-/* Scan the sshcontrol file and return the confirm flag.  */
+/* Look up the sshcontrol entry and return the confirm flag.  */
 static int
 confirm_flag_from_sshcontrol (const char *hexgrip)
 {
-  ssh_control_file_t cf;
-  int disabled, confirm;
+  struct control_entry_s *e;
 
   if (!hexgrip || strlen (hexgrip) != 40)
     return 1;  /* Wrong input: Better ask for confirmation.  */
 
-  if (open_control_file (&cf, 0))
+  if (update_control_index ())
     return 1; /* Error: Better ask for confirmation.  */
 
-  if (search_control_file (cf, hexgrip, &disabled, NULL, &confirm)
-      || disabled)
-    confirm = 0;  /* If not found or disabled, there is no reason to
-                     ask for confirmation.  */
-
-  close_control_file (cf);
+  e = find_control_entry (hexgrip);
+  if (!e || e->disabled)
+    return 0;  /* If not found or disabled, there is no reason to
+                  ask for confirmation.  */
 
-  return confirm;
+  return e->confirm;
 }
 
 
-
+
 
 /* Open the ssh control file for reading.  This is a public version of
    open_control_file.  The caller must use ssh_close_control_file to
@@ -2423,7 +2545,7 @@ card_key_available (ctrl_t ctrl, gcry_sexp_t *r_pk, char **cardsn)
   if ( gpg_err_code (err) == GPG_ERR_CARD_REMOVED )
     {
       /* Ask for the serial number to reset the card.  */
-      err = agent_card_serialno (ctrl, &serialno);
+      err = agent_card_serialno (ctrl, &serialno, NULL);
       if (err)
         {
           if (opt.verbose)
@@ -2573,30 +2695,82 @@ card_key_available (ctrl_t ctrl, gcry_sexp_t *r_pk, char **cardsn)
 */
 
 
-/* Handler for the "request_identities" command.  */
+/* Return true if the sshcontrol part of the identity cache is still
+   valid for the current KEY_EVENTS.  The caller must have updated the
+   sshcontrol index.  */
+static int
+identity_cache_is_valid (unsigned int key_events)
+{
+  return (identity_cache.valid
+          && identity_cache.key_events == key_events
+          && identity_cache.control_serial == control_index.serial);
+}
+
+
+/* Update the card part of the identity cache for CARD_EVENTS.  */
+static void
+update_card_identity (ctrl_t ctrl, unsigned int card_events)
+{
+  gcry_sexp_t key_public;
+  char *cardsn;
+  estream_t stream;
+  void *blob = NULL;
+  size_t bloblen = 0;
+  gpg_error_t err;
+
+  if (identity_cache.card_valid
+      && identity_cache.card_events == card_events
+      && agent_scd_check_running ())
+    return;
+
+  if (!card_key_available (ctrl, &key_public, &cardsn))
+    {
+      stream = es_fopenmem (0, "r+b");
+      if (!stream)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = ssh_send_key_public (stream, key_public, cardsn);
+          if (!err && es_fclose_snatch (stream, &blob, &bloblen))
+            err = gpg_error_from_syserror ();
+          else if (err)
+            es_fclose (stream);
+        }
+      gcry_sexp_release (key_public);
+      xfree (cardsn);
+      if (err)
+        {
+          /* Don't cache anything; the next request tries again.  */
+          identity_cache.card_valid = 0;
+          return;
+        }
+    }
+
+  xfree (identity_cache.card_blob);
+  identity_cache.card_blob = blob;
+  identity_cache.card_bloblen = bloblen;
+  identity_cache.card_events = card_events;
+  identity_cache.card_valid = 1;
+}
+
+
+/* Rebuild the sshcontrol part of the identity cache for KEY_EVENTS
+   from the up-to-date sshcontrol index.  */
 static gpg_error_t
-ssh_handler_request_identities (ctrl_t ctrl,
-                                estream_t request, estream_t response)
+update_control_identities (unsigned int key_events)
 {
   ssh_key_type_spec_t spec;
-  char *key_fname = NULL;
-  char *fnameptr;
   u32 key_counter;
   estream_t key_blobs;
   gcry_sexp_t key_secret;
-  gcry_sexp_t key_public;
   gpg_error_t err;
-  int ret;
-  ssh_control_file_t cf = NULL;
-  char *cardsn;
-  gpg_error_t ret_err;
-
-  (void)request;
+  struct control_entry_s *e;
+  void *blobs;
+  size_t blobslen;
 
   /* Prepare buffer stream.  */
 
   key_secret = NULL;
-  key_public = NULL;
   key_counter = 0;
   err = 0;
 
@@ -2607,79 +2781,28 @@ ssh_handler_request_identities (ctrl_t ctrl,
       goto out;
     }
 
-  /* First check whether a key is currently available in the card
-     reader - this should be allowed even without being listed in
-     sshcontrol. */
-
-  if (!opt.disable_scdaemon
-      && !card_key_available (ctrl, &key_public, &cardsn))
+  /* Look at all the registered and non-disabled keys. */
+  for (e = control_index.entries; e; e = e->next)
     {
-      err = ssh_send_key_public (key_blobs, key_public, cardsn);
-      gcry_sexp_release (key_public);
-      key_public = NULL;
-      xfree (cardsn);
-      if (err)
-        goto out;
-
-      key_counter++;
-    }
-
-
-  /* Prepare buffer for key name construction.  */
-  {
-    char *dname;
-
-    dname = make_filename (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, NULL);
-    if (!dname)
-      {
-        err = gpg_err_code_from_syserror ();
-        goto out;
-      }
-
-    key_fname = xtrymalloc (strlen (dname) + 1 + 40 + 4 + 1);
-    if (!key_fname)
-      {
-        err = gpg_err_code_from_syserror ();
-        xfree (dname);
-        goto out;
-      }
-    fnameptr = stpcpy (stpcpy (key_fname, dname), "/");
-    xfree (dname);
-  }
-
-  /* Then look at all the registered and non-disabled keys. */
-  err = open_control_file (&cf, 0);
-  if (err)
-    goto out;
-
-  while (!read_control_file_item (cf))
-    {
-      if (!cf->item.valid)
-        continue; /* Should not happen.  */
-      if (cf->item.disabled)
+      if (e->disabled)
         continue;
-      assert (strlen (cf->item.hexgrip) == 40);
+      assert (strlen (e->hexgrip) == 40);
 
-      stpcpy (stpcpy (fnameptr, cf->item.hexgrip), ".key");
-
-      /* Read file content.  */
+      /* Read the key through findkey.c so that the key cache and
+         the key store are used.  */
       {
-        unsigned char *buffer;
-        size_t buffer_n;
+        unsigned char grip[20];
 
-        err = file_to_buffer (key_fname, &buffer, &buffer_n);
+        if (hex2bin (e->hexgrip, grip, 20) < 0)
+          continue;
+        err = agent_raw_key_from_file (NULL, grip, &key_secret);
         if (err)
           {
-            log_error ("%s:%d: key '%s' skipped: %s\n",
-                       cf->fname, cf->lnr, cf->item.hexgrip,
+            log_error ("%s: key '%s' skipped: %s\n",
+                       SSH_CONTROL_FILE_NAME, e->hexgrip,
                        gpg_strerror (err));
             continue;
           }
-
-        err = gcry_sexp_sscan (&key_secret, NULL, (char*)buffer, buffer_n);
-        xfree (buffer);
-        if (err)
-          goto out;
       }
 
       {
@@ -2705,36 +2828,78 @@ ssh_handler_request_identities (ctrl_t ctrl,
     }
   err = 0;
 
-  ret = es_fseek (key_blobs, 0, SEEK_SET);
-  if (ret)
+  if (es_fclose_snatch (key_blobs, &blobs, &blobslen))
     {
       err = gpg_error_from_syserror ();
       goto out;
     }
+  key_blobs = NULL;
 
- out:
-  /* Send response.  */
+  xfree (identity_cache.blobs);
+  identity_cache.blobs = blobs;
+  identity_cache.blobslen = blobslen;
+  identity_cache.count = key_counter;
+  identity_cache.key_events = key_events;
+  identity_cache.control_serial = control_index.serial;
+  identity_cache.valid = 1;
 
+ out:
   gcry_sexp_release (key_secret);
-  gcry_sexp_release (key_public);
+  es_fclose (key_blobs);
+  return err;
+}
+
+
+/* Handler for the "request_identities" command.  The reply is taken
+   from the identity cache, which is updated as needed.  */
+static gpg_error_t
+ssh_handler_request_identities (ctrl_t ctrl,
+                                estream_t request, estream_t response)
+{
+  unsigned int key_events, card_events;
+  u32 key_counter;
+  gpg_error_t err;
+  gpg_error_t ret_err;
+
+  (void)request;
+
+  /* Take the counters first so that events while updating the cache
+     cause another update with the next request.  */
+  get_eventcounters (&key_events, &card_events);
+
+  /* First check whether a key is currently available in the card
+     reader - this should be allowed even without being listed in
+     sshcontrol. */
+  if (!opt.disable_scdaemon)
+    update_card_identity (ctrl, card_events);
+
+  /* Then look at all the registered and non-disabled keys. */
+  err = update_control_index ();
+  if (!err && !identity_cache_is_valid (key_events))
+    err = update_control_identities (key_events);
+
+  /* Send response.  */
 
   if (!err)
     {
+      key_counter = identity_cache.count;
+      if (!opt.disable_scdaemon && identity_cache.card_blob)
+        key_counter++;
       ret_err = stream_write_byte (response, SSH_RESPONSE_IDENTITIES_ANSWER);
       if (!ret_err)
         ret_err = stream_write_uint32 (response, key_counter);
+      if (!ret_err && !opt.disable_scdaemon && identity_cache.card_blob)
+        ret_err = stream_write_data (response, identity_cache.card_blob,
+                                     identity_cache.card_bloblen);
       if (!ret_err)
-        ret_err = stream_copy (response, key_blobs);
+        ret_err = stream_write_data (response, identity_cache.blobs,
+                                     identity_cache.blobslen);
     }
   else
     {
       ret_err = stream_write_byte (response, SSH_RESPONSE_FAILURE);
     }
 
-  es_fclose (key_blobs);
-  close_control_file (cf);
-  xfree (key_fname);
-
   return ret_err;
 }
 
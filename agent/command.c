@@ -32,7 +32,6 @@
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <dirent.h>
 
 #include "agent.h"
 #include <assuan.h>
@@ -40,6 +39,7 @@
 #include "cvt-openpgp.h"
 #include "../common/ssh-utils.h"
 #include "../common/asshelp.h"
+#include "../common/openpgpdefs.h"
 
 
 /* Maximum allowed size of the inquired ciphertext.  */
@@ -48,6 +48,12 @@
 #define MAXLEN_KEYPARAM 1024
 /* Maximum allowed size of key data as used in inquiries (bytes). */
 #define MAXLEN_KEYDATA 4096
+/* Maximum allowed size of the list of digests for PKSIGN_BATCH.  */
+#define MAXLEN_DIGESTS (128*1024)
+/* Maximum allowed size of the ciphertexts for PKDECRYPT_BATCH.  */
+#define MAXLEN_CIPHERTEXTS (256*1024)
+/* Maximum allowed size of data read with --input-fd.  */
+#define MAXLEN_INPUT_FD (64*1024)
 /* The size of the import/export KEK key (in bytes).  */
 #define KEYWRAP_KEYSIZE (128/8)
 
@@ -152,15 +158,7 @@ static int command_has_option (const char *cmd, const char *cmdopt);
 static void
 clear_outbuf (membuf_t *mb)
 {
-  void *p;
-  size_t n;
-
-  p = get_membuf (mb, &n);
-  if (p)
-    {
-      wipememory (p, n);
-      xfree (p);
-    }
+  release_membuf (mb);
 }
 
 
@@ -170,15 +168,17 @@ static gpg_error_t
 write_and_clear_outbuf (assuan_context_t ctx, membuf_t *mb)
 {
   gpg_error_t ae;
-  void *p;
+  const void *p;
   size_t n;
 
-  p = get_membuf (mb, &n);
+  p = peek_membuf (mb, &n);
   if (!p)
-    return out_of_core ();
+    {
+      release_membuf (mb);
+      return out_of_core ();
+    }
   ae = assuan_send_data (ctx, p, n);
-  memset (p, 0, n);
-  xfree (p);
+  release_membuf (mb);
   return ae;
 }
 
@@ -308,6 +308,28 @@ option_value (const char *line, const char *name)
 }
 
 
+/* Store a malloced copy of the argument of the option with NAME at
+   R_VALUE.  If such an option is not given, NULL is stored.  */
+static gpg_error_t
+dup_option_value (const char *line, const char *name, char **r_value)
+{
+  const char *s, *pend;
+
+  *r_value = NULL;
+  s = option_value (line, name);
+  if (!s)
+    return 0;
+  for (pend = s; *pend && !spacep (pend); pend++)
+    ;
+  *r_value = xtrymalloc (pend - s + 1);
+  if (!*r_value)
+    return gpg_error_from_syserror ();
+  memcpy (*r_value, s, pend - s);
+  (*r_value)[pend - s] = 0;
+  return 0;
+}
+
+
 /* Replace all '+' by a blank in the string S. */
 static void
 plus_to_blank (char *s)
@@ -363,6 +385,72 @@ parse_keygrip (assuan_context_t ctx, const char *string, unsigned char *buf)
 }
 
 
+/* Read the data for the current command from the file the client
+   passed with "INPUT FD" and close it.  This is used instead of an
+   inquiry if the command has the option --input-fd; the data is then
+   neither escaped nor split into D lines.  At most MAXLEN bytes are
+   accepted.  The data is stored in a new buffer at R_BUF and its
+   length at R_BUFLEN.  */
+static gpg_error_t
+read_input_fd (assuan_context_t ctx, size_t maxlen,
+               unsigned char **r_buf, size_t *r_buflen)
+{
+  gpg_error_t err = 0;
+  int fd;
+  struct stat st;
+  unsigned char *buf = NULL;
+  size_t len = 0;
+  ssize_t n;
+
+  *r_buf = NULL;
+  *r_buflen = 0;
+
+  fd = translate_sys2libc_fd (assuan_get_input_fd (ctx), 0);
+  if (fd == -1)
+    return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+
+  if (fstat (fd, &st))
+    err = gpg_error_from_syserror ();
+  else if (!S_ISREG (st.st_mode))
+    err = set_error (GPG_ERR_INV_ARG, "input is not a file");
+  else if (st.st_size > maxlen)
+    err = gpg_error (GPG_ERR_TOO_LARGE);
+  else if (lseek (fd, 0, SEEK_SET) == (off_t)(-1))
+    err = gpg_error_from_syserror ();
+  else if (!(buf = xtrymalloc (st.st_size? st.st_size : 1)))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      while (len < st.st_size)
+        {
+          n = read (fd, buf + len, st.st_size - len);
+          if (n < 0 && errno == EINTR)
+            continue;
+          if (n < 0)
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+          if (!n)
+            break;
+          len += n;
+        }
+      if (!err && len != st.st_size)
+        err = set_error (GPG_ERR_INV_LENGTH, "input file shrunk");
+    }
+  assuan_close_input_fd (ctx);
+
+  if (err)
+    xfree (buf);
+  else
+    {
+      *r_buf = buf;
+      *r_buflen = len;
+    }
+  return err;
+}
+
+
 /* Write an Assuan status line.  KEYWORD is the first item on the
    status line.  The following arguments are all separated by a space
    in the output.  The last argument must be a NULL.  Linefeeds and
@@ -429,6 +517,23 @@ agent_print_status (ctrl_t ctrl, const char *keyword, const char *format, ...)
 }
 
 
+/* Send BUFFER of LENGTH bytes as data lines to the client of CTRL
+   right away.  This is used to pass data along with a status line in
+   the middle of a command; the data is flushed so that the client
+   sees it before the next status line.  */
+gpg_error_t
+agent_write_data (ctrl_t ctrl, const void *buffer, size_t length)
+{
+  assuan_context_t ctx = ctrl->server_local->assuan_ctx;
+  gpg_error_t err;
+
+  err = assuan_send_data (ctx, buffer, length);
+  if (!err)
+    err = assuan_send_data (ctx, NULL, 0);
+  return err;
+}
+
+
 /* Helper to notify the client about a launched Pinentry.  Because
    that might disturb some older clients, this is only done if enabled
    via an option.  Returns an gpg error code. */
@@ -523,6 +628,17 @@ bump_key_eventcounter (void)
 }
 
 
+/* Store the current key and card event counters at R_KEY and
+   R_CARD.  This function is assured not to do any context
+   switches. */
+void
+get_eventcounters (unsigned int *r_key, unsigned int *r_card)
+{
+  *r_key = eventcounter.key;
+  *r_card = eventcounter.card;
+}
+
+
 /* This function should be called for all card reader status
    changes.  This function is assured not to do any context
    switches. */
@@ -866,11 +982,154 @@ cmd_pksign (assuan_context_t ctx, char *line)
 }
 
 
+/* Send the result RESULT of RESULTLEN bytes of a batch command as
+   data line and flush it so that the client sees it right away.  */
+static gpg_error_t
+put_batch_result (void *opaque, const void *result, size_t resultlen)
+{
+  assuan_context_t ctx = opaque;
+  gpg_error_t err;
+
+  err = assuan_send_data (ctx, result, resultlen);
+  if (!err)
+    err = assuan_send_data (ctx, NULL, 0);
+  return err;
+}
+
+
+/* Parse the digests in the LENGTH bytes at LIST, one per line as
+   "<algonumber> <hexstring>", into a new array stored at R_DIGESTS
+   and their number at R_NDIGESTS.  */
+static gpg_error_t
+parse_digest_list (char *list, size_t length,
+                   struct agent_digest_s **r_digests,
+                   unsigned int *r_ndigests)
+{
+  struct agent_digest_s *digests, *d;
+  unsigned int ndigests, n;
+  char *line, *endp, *p;
+  int algo;
+
+  *r_digests = NULL;
+  *r_ndigests = 0;
+  for (ndigests=1, p=list; p < list + length; p++)
+    if (*p == '\n')
+      ndigests++;
+  digests = xtrycalloc (ndigests, sizeof *digests);
+  if (!digests)
+    return gpg_error_from_syserror ();
+
+  list[length] = 0;
+  for (ndigests=0, line=list; line; line = endp)
+    {
+      endp = strchr (line, '\n');
+      if (endp)
+        *endp++ = 0;
+      trim_spaces (line);
+      if (!*line)
+        continue;
+      algo = (int)strtoul (line, &p, 10);
+      while (spacep (p))
+        p++;
+      for (n=0; hexdigitp (p + n); n++)
+        ;
+      n /= 2;
+      if (!algo || gcry_md_test_algo (algo))
+        goto bad;
+      if (p[2*n] || (n != 16 && n != 20 && n != 24
+                     && n != 28 && n != 32 && n != 48 && n != 64))
+        goto bad;
+      d = digests + ndigests++;
+      d->algo = algo;
+      d->valuelen = n;
+      for (n=0; n < d->valuelen; p += 2, n++)
+        d->value[n] = xtoi_2 (p);
+    }
+  if (!ndigests)
+    {
+      xfree (digests);
+      return gpg_error (GPG_ERR_NO_DATA);
+    }
+  *r_digests = digests;
+  *r_ndigests = ndigests;
+  return 0;
+
+ bad:
+  xfree (digests);
+  return gpg_error (GPG_ERR_INV_DATA);
+}
+
+
+static const char hlp_pksign_batch[] =
+  "PKSIGN_BATCH [<cache_nonce>]\n"
+  "\n"
+  "Sign many digests with the key set by SIGKEY.  The digests are\n"
+  "inquired with the keyword DIGESTS, one per line as\n"
+  "\"<algonumber> <hexstring>\".  The key is unprotected only once.\n"
+  "The signatures are returned as canonical S-expressions in the\n"
+  "order of the digests; each is flushed as soon as it is done.";
+static gpg_error_t
+cmd_pksign_batch (assuan_context_t ctx, char *line)
+{
+  int rc;
+  cache_mode_t cache_mode = CACHE_MODE_NORMAL;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  char *cache_nonce = NULL;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  struct agent_digest_s *digests = NULL;
+  unsigned int ndigests;
+  char *p;
+
+  line = skip_options (line);
+
+  for (p=line; *p && *p != ' ' && *p != '\t'; p++)
+    ;
+  *p = '\0';
+  if (*line)
+    cache_nonce = xtrystrdup (line);
+
+  if (opt.ignore_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+  else if (!ctrl->server_local->use_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+
+  rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_DIGESTS);
+  if (!rc)
+    rc = assuan_inquire (ctx, "DIGESTS", &value, &valuelen, MAXLEN_DIGESTS);
+  if (!rc)
+    {
+      /* Make room for the terminating Nul.  */
+      p = xtryrealloc (value, valuelen + 1);
+      if (!p)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          value = (unsigned char *)p;
+          rc = parse_digest_list (p, valuelen, &digests, &ndigests);
+        }
+    }
+  if (!rc)
+    rc = agent_pksign_batch (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                             digests, ndigests, cache_mode,
+                             put_batch_result, ctx);
+
+  xfree (digests);
+  xfree (value);
+  xfree (cache_nonce);
+  xfree (ctrl->server_local->keydesc);
+  ctrl->server_local->keydesc = NULL;
+  return leave_cmd (ctx, rc);
+}
+
+
 static const char hlp_pkdecrypt[] =
-  "PKDECRYPT [<options>]\n"
+  "PKDECRYPT [--input-fd]\n"
   "\n"
   "Perform the actual decrypt operation.  Input is not\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.  The ciphertext is inquired with\n"
+  "\"CIPHERTEXT\" or, with --input-fd, read from the file passed\n"
+  "with the INPUT FD command.";
 static gpg_error_t
 cmd_pkdecrypt (assuan_context_t ctx, char *line)
 {
@@ -881,17 +1140,23 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
   membuf_t outbuf;
   int padding;
 
-  (void)line;
-
-  /* First inquire the data to decrypt */
-  rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_CIPHERTEXT);
-  if (!rc)
-    rc = assuan_inquire (ctx, "CIPHERTEXT",
-			&value, &valuelen, MAXLEN_CIPHERTEXT);
+  /* First get the data to decrypt */
+  if (has_option (line, "--input-fd"))
+    rc = read_input_fd (ctx, MAXLEN_INPUT_FD, &value, &valuelen);
+  else
+    {
+      rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u",
+                                MAXLEN_CIPHERTEXT);
+      if (!rc)
+        rc = assuan_inquire (ctx, "CIPHERTEXT",
+                             &value, &valuelen, MAXLEN_CIPHERTEXT);
+    }
   if (rc)
-    return rc;
+    return leave_cmd (ctx, rc);
 
+  /* The plaintext is not longer than the ciphertext.  */
   init_membuf (&outbuf, 512);
+  membuf_reserve (&outbuf, valuelen + 32);
 
   rc = agent_pkdecrypt (ctrl, ctrl->server_local->keydesc,
                         value, valuelen, &outbuf, &padding);
@@ -913,8 +1178,49 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_pkdecrypt_batch[] =
+  "PKDECRYPT_BATCH\n"
+  "\n"
+  "Decrypt many ciphertexts with the key set by SETKEY.  The ciphertexts\n"
+  "are inquired with the keyword CIPHERTEXTS as canonical S-expressions,\n"
+  "one after the other.  The key is unprotected only once.  The\n"
+  "plaintexts are returned as with PKDECRYPT in the order of the\n"
+  "ciphertexts, each flushed as soon as it is done; a ciphertext which\n"
+  "can't be decrypted yields \"(error <code>)\" instead.  Keys on a\n"
+  "smartcard are not supported.";
+static gpg_error_t
+cmd_pkdecrypt_batch (assuan_context_t ctx, char *line)
+{
+  int rc;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  unsigned char *value = NULL;
+  size_t valuelen;
+
+  (void)line;
+
+  rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_CIPHERTEXTS);
+  if (!rc)
+    rc = assuan_inquire (ctx, "CIPHERTEXTS",
+                         &value, &valuelen, MAXLEN_CIPHERTEXTS);
+  if (!rc)
+    rc = agent_pkdecrypt_batch (ctrl, ctrl->server_local->keydesc,
+                                value, valuelen, put_batch_result, ctx);
+
+  xfree (value);
+  xfree (ctrl->server_local->keydesc);
+  ctrl->server_local->keydesc = NULL;
+  return leave_cmd (ctx, rc);
+}
+
+
 static const char hlp_genkey[] =
-  "GENKEY [--no-protection] [--preset] [--inq-passwd] [<cache_nonce>]\n"
+  "GENKEY [--no-protection] [--preset] [--inq-passwd]\n"
+  "       [--vanity=<pattern> [--window=<windows>] [--backward]\n"
+  "        [--algo=<n>] [--hits=<n>] [--budget=<seconds>]\n"
+  "        [--iterations=<n>] [--stream] [--seed-range=<first>,<count>]\n"
+  "        [--subkey-vanity=<pattern> [--subkey-algo=<n>]\n"
+  "         [--subkey-kdf=<list>]]]\n"
+  "       [<cache_nonce>]\n"
   "\n"
   "Generate a new key, store the secret part and return the public\n"
   "part.  Here is an example transaction:\n"
@@ -930,7 +1236,81 @@ static const char hlp_genkey[] =
   "When the --preset option is used the passphrase for the generated\n"
   "key will be added to the cache.  When --inq-passwd is used an inquire\n"
   "with the keyword NEWPASSWD is used to request the passphrase for the\n"
-  "new key.\n";
+  "new key.  With --vanity, keys are generated until one has a keyid\n"
+  "matching PATTERN; the items of PATTERN are separated by commas.\n"
+  "The creation times tried are given by --window as a comma separated\n"
+  "list of START/END pairs in seconds since Epoch; the default are the\n"
+  "last few weeks.  --backward sweeps each window from its end.\n"
+  "--algo gives the OpenPGP algorithm number of the key for the\n"
+  "fingerprint; the default is EdDSA (22).\n"
+  "The creation time and the fingerprint of that key are returned with\n"
+  "the status line\n"
+  "\n"
+  "  S VANITY_KEY <timestamp> <hexfingerprint>\n"
+  "\n"
+  "While searching, the number of fingerprints computed so far is sent\n"
+  "every few seconds with \"S PROGRESS vanity . <n> 0\", followed by\n"
+  "\n"
+  "  S VANITY_STATS <keys/s> <hashes/s> <n> <probability> <eta>\n"
+  "\n"
+  "with the current rates, the chance of a fingerprint to match and the\n"
+  "expected seconds to a hit (-1 if not yet known); the search is\n"
+  "canceled if that fails because the client is gone.  When the search\n"
+  "ends the resources it used, including those of the runs before a\n"
+  "restart of the agent, are sent with\n"
+  "\n"
+  "  S VANITY_COST <jobid> <cpu-ms> <gpu-ms> <keys> <hashes> <wall-ms>\n"
+  "\n"
+  "(see VANITY).\n"
+  "\n"
+  "With --hits the search goes on until N keys have been found and\n"
+  "with --budget it stops after SECONDS with the keys found so far;\n"
+  "--iterations=N likewise stops after N fingerprints.  --hits=0\n"
+  "then collects as many as possible.  All keys are stored with the\n"
+  "same passphrase and reported with\n"
+  "\n"
+  "  S VANITY_RESULT <jobid> <timestamp> <hexfpr> <hexgrip> <item> <score>\n"
+  "\n"
+  "where ITEM is the index of the pattern item matched by the key.\n"
+  "A pattern of score items (score:zeros, score:run, score:word:W)\n"
+  "keeps the N keys with the best SCORE instead; it needs a budget\n"
+  "and the keys are reported best first.  SCORE is 0 for other\n"
+  "patterns.\n"
+  "They are also kept in the result store (see VANITY_RESULTS); only\n"
+  "the public key of the first one is returned.  With --stream the\n"
+  "public key of each key is sent as data right before its\n"
+  "VANITY_RESULT line, so that the client can take the data received\n"
+  "so far as that key; the public key of the first one follows at the\n"
+  "end as usual.  Such a search is not checkpointed.\n"
+  "\n"
+  "With --seed-range the search is the share of a search distributed\n"
+  "over several hosts: the Ed25519 keys are derived from the COUNT key\n"
+  "streams starting at FIRST of a job key inquired with SEEDKEY as 64\n"
+  "hex digits.  Each search thread takes one stream; the search fails\n"
+  "if fewer are given.  Hosts given disjoint ranges for the same job\n"
+  "key never check the same key.  When the search ends\n"
+  "\n"
+  "  S VANITY_SEEDS <first> <next> <keys>\n"
+  "\n"
+  "tells the first stream not used and the number of keys swept; a new\n"
+  "search for the rest of the range starts at NEXT.  Such a search is\n"
+  "not checkpointed and does not use the key pool.\n"
+  "\n"
+  "With --subkey-vanity a subkey is searched in the same windows at\n"
+  "the same time; its parameters are inquired with SUBKEYPARAM after\n"
+  "KEYPARAM and --subkey-algo gives its OpenPGP algorithm number (the\n"
+  "default is ECDH, 18).  The workers are shared between both\n"
+  "searches and the subkey is stored with the same passphrase and\n"
+  "reported with\n"
+  "\n"
+  "  S VANITY_SUBKEY <timestamp> <hexfingerprint> <hexgrip> [<hexkdf>]\n"
+  "\n"
+  "For an ECDH subkey --subkey-kdf gives a comma separated list of KDF\n"
+  "parameters as HASH/CIPHER, e.g. SHA256/AES128, or \"all\"; each key\n"
+  "is then tried with each of them, which multiplies the fingerprints\n"
+  "per key.  The KDF parameters of the subkey found are appended to\n"
+  "its status line as hex string; the key packet must use them.\n"
+  "Only one subkey is searched and that search is not checkpointed.\n";
 static gpg_error_t
 cmd_genkey (assuan_context_t ctx, char *line)
 {
@@ -942,8 +1322,25 @@ cmd_genkey (assuan_context_t ctx, char *line)
   unsigned char *newpasswd = NULL;
   membuf_t outbuf;
   char *cache_nonce = NULL;
+  char *vanity_pattern = NULL;
+  char *vanity_window = NULL;
+  char *subkey_pattern = NULL;
+  char *subkey_kdf = NULL;
+  unsigned char *subkey_value = NULL;
+  size_t subkey_valuelen = 0;
+  int subkey_algo = PUBKEY_ALGO_ECDH;
   int opt_preset;
   int opt_inq_passwd;
+  int opt_backward;
+  int opt_stream;
+  int vanity_algo = PUBKEY_ALGO_EDDSA;
+  unsigned int vanity_hits = 1;
+  unsigned long vanity_budget = 0;
+  unsigned long long vanity_iterations = 0;
+  int opt_seed_range;
+  unsigned int seed_first = 0, seed_count = 0;
+  struct agent_vanity_seeds_s *vanity_seeds = NULL;
+  unsigned char *seedkey;
   size_t n;
   char *p;
 
@@ -953,6 +1350,66 @@ cmd_genkey (assuan_context_t ctx, char *line)
   no_protection = has_option (line, "--no-protection");
   opt_preset = has_option (line, "--preset");
   opt_inq_passwd = has_option (line, "--inq-passwd");
+  opt_backward = has_option (line, "--backward");
+  opt_stream = has_option (line, "--stream");
+  if (has_option_name (line, "--algo"))
+    {
+      p = option_value (line, "--algo");
+      vanity_algo = p? atoi (p) : 0;
+    }
+  if (has_option_name (line, "--hits"))
+    {
+      p = option_value (line, "--hits");
+      vanity_hits = p? strtoul (p, NULL, 10) : 0;
+    }
+  if (has_option_name (line, "--budget"))
+    {
+      p = option_value (line, "--budget");
+      vanity_budget = p? strtoul (p, NULL, 10) : 0;
+    }
+  if (has_option_name (line, "--iterations"))
+    {
+      p = option_value (line, "--iterations");
+      vanity_iterations = p? strtoull (p, NULL, 10) : 0;
+    }
+  opt_seed_range = has_option_name (line, "--seed-range");
+  if (opt_seed_range)
+    {
+      p = option_value (line, "--seed-range");
+      if (p)
+        seed_first = strtoul (p, &p, 10);
+      if (p && *p == ',')
+        seed_count = strtoul (p+1, NULL, 10);
+    }
+  if (has_option_name (line, "--subkey-algo"))
+    {
+      p = option_value (line, "--subkey-algo");
+      subkey_algo = p? atoi (p) : 0;
+    }
+  rc = dup_option_value (line, "--vanity", &vanity_pattern);
+  if (!rc)
+    rc = dup_option_value (line, "--window", &vanity_window);
+  if (!rc)
+    rc = dup_option_value (line, "--subkey-vanity", &subkey_pattern);
+  if (!rc)
+    rc = dup_option_value (line, "--subkey-kdf", &subkey_kdf);
+  if (!rc && subkey_pattern && !vanity_pattern)
+    rc = set_error (GPG_ERR_ASS_PARAMETER, "--subkey-vanity needs --vanity");
+  if (!rc && subkey_kdf && !subkey_pattern)
+    rc = set_error (GPG_ERR_ASS_PARAMETER,
+                    "--subkey-kdf needs --subkey-vanity");
+  if (!rc && opt_seed_range && !vanity_pattern)
+    rc = set_error (GPG_ERR_ASS_PARAMETER, "--seed-range needs --vanity");
+  if (!rc && opt_seed_range && !seed_count)
+    rc = set_error (GPG_ERR_ASS_PARAMETER, "invalid value for --seed-range");
+  if (rc)
+    {
+      xfree (vanity_pattern);
+      xfree (vanity_window);
+      xfree (subkey_pattern);
+      xfree (subkey_kdf);
+      return leave_cmd (ctx, rc);
+    }
   line = skip_options (line);
 
   p = line;
@@ -966,49 +1423,325 @@ cmd_genkey (assuan_context_t ctx, char *line)
   rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_KEYPARAM);
   if (!rc)
     rc = assuan_inquire (ctx, "KEYPARAM", &value, &valuelen, MAXLEN_KEYPARAM);
+  if (!rc && subkey_pattern)
+    {
+      rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u",
+                                MAXLEN_KEYPARAM);
+      if (!rc)
+        rc = assuan_inquire (ctx, "SUBKEYPARAM", &subkey_value,
+                             &subkey_valuelen, MAXLEN_KEYPARAM);
+      if (rc)
+        xfree (value);
+    }
   if (rc)
-    return rc;
+    {
+      xfree (vanity_pattern);
+      xfree (vanity_window);
+      xfree (subkey_pattern);
+      xfree (subkey_kdf);
+      return rc;
+    }
 
   init_membuf (&outbuf, 512);
 
-  /* If requested, ask for the password to be used for the key.  If
-     this is not used the regular Pinentry mechanism is used.  */
-  if (opt_inq_passwd && !no_protection)
+  /* If requested, ask for the password to be used for the key.  If
+     this is not used the regular Pinentry mechanism is used.  */
+  if (opt_inq_passwd && !no_protection)
+    {
+      /* (N is used as a dummy) */
+      assuan_begin_confidential (ctx);
+      rc = assuan_inquire (ctx, "NEWPASSWD", &newpasswd, &n, 256);
+      assuan_end_confidential (ctx);
+      if (rc)
+        goto leave;
+      if (!*newpasswd)
+        {
+          /* Empty password given - switch to no-protection mode.  */
+          xfree (newpasswd);
+          newpasswd = NULL;
+          no_protection = 1;
+        }
+
+    }
+
+  /* The job key of a distributed search.  */
+  if (opt_seed_range)
+    {
+      vanity_seeds = xtrycalloc_secure (1, sizeof *vanity_seeds);
+      if (!vanity_seeds)
+        {
+          rc = gpg_error_from_syserror ();
+          goto leave;
+        }
+      vanity_seeds->first = seed_first;
+      vanity_seeds->count = seed_count;
+      assuan_begin_confidential (ctx);
+      rc = assuan_inquire (ctx, "SEEDKEY", &seedkey, &n,
+                           2 * sizeof vanity_seeds->key + 1);
+      assuan_end_confidential (ctx);
+      if (rc)
+        goto leave;
+      if (n != 2 * sizeof vanity_seeds->key
+          || hex2bin ((char*)seedkey, vanity_seeds->key,
+                      sizeof vanity_seeds->key) < 0)
+        rc = set_error (GPG_ERR_ASS_PARAMETER, "invalid SEEDKEY");
+      wipememory (seedkey, n);
+      xfree (seedkey);
+      if (rc)
+        goto leave;
+    }
+
+  rc = agent_genkey (ctrl, cache_nonce, (char*)value, valuelen, no_protection,
+                     newpasswd, opt_preset, vanity_pattern, vanity_window,
+                     opt_backward, vanity_algo, vanity_hits, vanity_budget,
+                     vanity_iterations, opt_stream, vanity_seeds,
+                     (char*)subkey_value, subkey_valuelen,
+                     subkey_pattern, subkey_algo, subkey_kdf, &outbuf);
+
+ leave:
+  if (newpasswd)
+    {
+      /* Assuan_inquire does not allow us to read into secure memory
+         thus we need to wipe it ourself.  */
+      wipememory (newpasswd, strlen (newpasswd));
+      xfree (newpasswd);
+    }
+  if (vanity_seeds)
+    {
+      wipememory (vanity_seeds, sizeof *vanity_seeds);
+      xfree (vanity_seeds);
+    }
+  xfree (value);
+  xfree (subkey_value);
+  if (rc)
+    clear_outbuf (&outbuf);
+  else
+    rc = write_and_clear_outbuf (ctx, &outbuf);
+  xfree (cache_nonce);
+  xfree (vanity_pattern);
+  xfree (vanity_window);
+  xfree (subkey_pattern);
+  xfree (subkey_kdf);
+  return leave_cmd (ctx, rc);
+}
+
+
+
+static const char hlp_vanity_results[] =
+  "VANITY_RESULTS [--delete=<hexfpr>]\n"
+  "\n"
+  "List the keys collected by vanity searches with --hits or --budget\n"
+  "with one status line per key, in the same format as GENKEY reports\n"
+  "them:\n"
+  "\n"
+  "  S VANITY_RESULT <jobid> <timestamp> <hexfpr> <hexgrip> <item> <score>\n"
+  "\n"
+  "The keys of one search have the same JOBID.  With --delete the key\n"
+  "with the fingerprint HEXFPR is removed from the list instead; the\n"
+  "key itself is not deleted.";
+static gpg_error_t
+cmd_vanity_results (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  char *hexfpr = NULL;
+
+  if (ctrl->restricted)
+    return leave_cmd (ctx, gpg_error (GPG_ERR_FORBIDDEN));
+
+  err = dup_option_value (line, "--delete", &hexfpr);
+  if (err)
+    return leave_cmd (ctx, err);
+  if (hexfpr)
+    err = agent_vanity_delete_result (hexfpr);
+  else
+    err = agent_vanity_list_results (ctrl, NULL);
+  xfree (hexfpr);
+  return leave_cmd (ctx, err);
+}
+
+
+
+static const char hlp_vanity[] =
+  "VANITY SUBMIT [--priority=<n>] --vanity=<pattern> [--window=<windows>]\n"
+  "              [--backward] [--algo=<n>] [--hits=<n>] [--budget=<seconds>]\n"
+  "              [--iterations=<n>] [--no-protection] [--inq-passwd]\n"
+  "VANITY STATUS [<jobid>]\n"
+  "VANITY CANCEL <jobid>\n"
+  "VANITY RESULT <jobid>\n"
+  "\n"
+  "Manage vanity searches running in the background.  SUBMIT inquires\n"
+  "KEYPARAM like GENKEY and queues a search with the GENKEY options of\n"
+  "the same names; --hits defaults to 1.  The passphrase is asked for\n"
+  "now.  The ID of the job is returned with\n"
+  "\n"
+  "  S VANITY_JOB <jobid> queued <priority> 0 <hits> 0 0\n"
+  "\n"
+  "The queued jobs share the vanity workers; a job with priority N\n"
+  "(1 to 100, default 10) gets about N times the time of a job with\n"
+  "priority 1.  Jobs with the same key parameters, --algo, --window\n"
+  "and --backward are searched for together.  The keys are stored as\n"
+  "soon as they are found and recorded in the result store.\n"
+  "\n"
+  "STATUS reports one job, or all, with\n"
+  "\n"
+  "  S VANITY_JOB <jobid> <state> <priority> <found> <hits> <n> <seconds>\n"
+  "\n"
+  "where STATE is one of queued, running, done, expired, canceled or\n"
+  "failed, FOUND the number of keys stored so far and N the number of\n"
+  "fingerprints tried in SECONDS, followed by\n"
+  "\n"
+  "  S VANITY_COST <jobid> <cpu-ms> <gpu-ms> <keys> <hashes> <wall-ms>\n"
+  "\n"
+  "with the resources used for the job by the slices which ended: the\n"
+  "CPU time, the time of the OpenCL device, the keys generated, the\n"
+  "fingerprints computed and the time searched.  A slice for several\n"
+  "jobs is charged to them by the chance of their patterns to match.\n"
+  "CANCEL stops a job; the keys it found are kept.  RESULT sends these\n"
+  "two lines followed by a VANITY_RESULT line for each key of the job\n"
+  "(see VANITY_RESULTS); a job which has ended is then removed from\n"
+  "the queue.  The queue is lost when the agent terminates.";
+static gpg_error_t
+cmd_vanity (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  char *subcmd, *p;
+  char *pattern = NULL;
+  char *window = NULL;
+  unsigned char *value = NULL;
+  size_t valuelen, n;
+  unsigned char *newpasswd = NULL;
+  char *passphrase = NULL;
+  gcry_sexp_t s_keyparam = NULL;
+  int no_protection, backward;
+  int algo = PUBKEY_ALGO_EDDSA;
+  unsigned int priority = 0;
+  unsigned int hits = 1;
+  unsigned long budget = 0;
+  unsigned long long iterations = 0;
+  char jobid[17];
+
+  if (ctrl->restricted)
+    return leave_cmd (ctx, gpg_error (GPG_ERR_FORBIDDEN));
+
+  subcmd = line;
+  for (p=line; *p && *p != ' ' && *p != '\t'; p++)
+    ;
+  if (*p)
+    *p++ = 0;
+  while (spacep (p))
+    p++;
+  line = p;
+
+  if (!ascii_strcasecmp (subcmd, "STATUS"))
+    return leave_cmd (ctx, agent_vanity_queue_status (ctrl,
+                                                      *line? line : NULL));
+  if (!ascii_strcasecmp (subcmd, "CANCEL")
+      || !ascii_strcasecmp (subcmd, "RESULT"))
+    {
+      if (!*line)
+        return leave_cmd (ctx, set_error (GPG_ERR_ASS_PARAMETER,
+                                          "no job ID given"));
+      if (!ascii_strcasecmp (subcmd, "CANCEL"))
+        err = agent_vanity_queue_cancel (line);
+      else
+        err = agent_vanity_queue_result (ctrl, line);
+      return leave_cmd (ctx, err);
+    }
+  if (ascii_strcasecmp (subcmd, "SUBMIT"))
+    return leave_cmd (ctx, set_error (GPG_ERR_ASS_PARAMETER,
+                                      "unknown sub-command"));
+
+  no_protection = has_option (line, "--no-protection");
+  backward = has_option (line, "--backward");
+  if (has_option_name (line, "--priority"))
+    {
+      p = option_value (line, "--priority");
+      priority = p? strtoul (p, NULL, 10) : 0;
+      if (!priority)
+        return leave_cmd (ctx, set_error (GPG_ERR_ASS_PARAMETER,
+                                          "invalid priority"));
+    }
+  if (has_option_name (line, "--algo"))
+    {
+      p = option_value (line, "--algo");
+      algo = p? atoi (p) : 0;
+    }
+  if (has_option_name (line, "--hits"))
+    {
+      p = option_value (line, "--hits");
+      hits = p? strtoul (p, NULL, 10) : 0;
+    }
+  if (has_option_name (line, "--budget"))
+    {
+      p = option_value (line, "--budget");
+      budget = p? strtoul (p, NULL, 10) : 0;
+    }
+  if (has_option_name (line, "--iterations"))
+    {
+      p = option_value (line, "--iterations");
+      iterations = p? strtoull (p, NULL, 10) : 0;
+    }
+  err = dup_option_value (line, "--vanity", &pattern);
+  if (!err)
+    err = dup_option_value (line, "--window", &window);
+  if (!err && !pattern)
+    err = set_error (GPG_ERR_ASS_PARAMETER, "no pattern given");
+  if (err)
+    goto leave;
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_KEYPARAM);
+  if (!err)
+    err = assuan_inquire (ctx, "KEYPARAM", &value, &valuelen,
+                          MAXLEN_KEYPARAM);
+  if (!err)
+    err = gcry_sexp_sscan (&s_keyparam, NULL, (char*)value, valuelen);
+  if (err)
+    goto leave;
+
+  if (has_option (line, "--inq-passwd") && !no_protection)
     {
       /* (N is used as a dummy) */
       assuan_begin_confidential (ctx);
-      rc = assuan_inquire (ctx, "NEWPASSWD", &newpasswd, &n, 256);
+      err = assuan_inquire (ctx, "NEWPASSWD", &newpasswd, &n, 256);
       assuan_end_confidential (ctx);
-      if (rc)
+      if (err)
+        goto leave;
+      if (*newpasswd)
+        passphrase = (char*)newpasswd;
+    }
+  else if (!no_protection)
+    {
+      err = agent_ask_new_passphrase (ctrl,
+                                      _("Please enter the passphrase to%0A"
+                                        "protect your new keys"),
+                                      &passphrase);
+      if (err)
         goto leave;
-      if (!*newpasswd)
-        {
-          /* Empty password given - switch to no-protection mode.  */
-          xfree (newpasswd);
-          newpasswd = NULL;
-          no_protection = 1;
-        }
-
     }
 
-  rc = agent_genkey (ctrl, cache_nonce, (char*)value, valuelen, no_protection,
-                     newpasswd, opt_preset, &outbuf);
+  err = agent_vanity_submit (ctrl, s_keyparam, pattern, window, backward,
+                             algo, hits, budget, iterations, priority,
+                             passphrase, jobid);
+  if (!err)
+    err = agent_vanity_queue_status (ctrl, jobid);
 
  leave:
   if (newpasswd)
     {
       /* Assuan_inquire does not allow us to read into secure memory
          thus we need to wipe it ourself.  */
-      wipememory (newpasswd, strlen (newpasswd));
+      wipememory (newpasswd, strlen ((char*)newpasswd));
       xfree (newpasswd);
     }
-  xfree (value);
-  if (rc)
-    clear_outbuf (&outbuf);
   else
-    rc = write_and_clear_outbuf (ctx, &outbuf);
-  xfree (cache_nonce);
-  return leave_cmd (ctx, rc);
+    xfree (passphrase);
+  gcry_sexp_release (s_keyparam);
+  xfree (value);
+  xfree (pattern);
+  xfree (window);
+  return leave_cmd (ctx, err);
 }
 
 
@@ -1061,12 +1794,16 @@ cmd_readkey (assuan_context_t ctx, char *line)
 
 static const char hlp_keyinfo[] =
   "KEYINFO [--[ssh-]list] [--data] [--ssh-fpr] [--with-ssh] <keygrip>\n"
+  "KEYINFO --multi [--data] [--ssh-fpr] [--with-ssh] <keygrips>\n"
   "\n"
   "Return information about the key specified by the KEYGRIP.  If the\n"
   "key is not available GPG_ERR_NOT_FOUND is returned.  If the option\n"
   "--list is given the keygrip is ignored and information about all\n"
   "available keys are returned.  If --ssh-list is given information\n"
-  "about all keys listed in the sshcontrol are returned.  With --with-ssh\n"
+  "about all keys listed in the sshcontrol are returned.  With --multi\n"
+  "any number of space separated keygrips may be given; information is\n"
+  "returned for those keys which are available and the command succeeds\n"
+  "even if none is available.  With --with-ssh\n"
   "information from sshcontrol is always added to the info. Unless --data\n"
   "is given, the information is returned as a status line using the format:\n"
   "\n"
@@ -1249,18 +1986,21 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
   ctrl_t ctrl = assuan_get_pointer (ctx);
   int err;
   unsigned char grip[20];
-  DIR *dir = NULL;
   int list_mode;
   int opt_data, opt_ssh_fpr, opt_with_ssh;
   ssh_control_file_t cf = NULL;
   char hexgrip[41];
   int disabled, ttl, confirm, is_ssh;
+  unsigned char *grips = NULL;
+  size_t ngrips;
 
   if (ctrl->restricted)
     return leave_cmd (ctx, gpg_error (GPG_ERR_FORBIDDEN));
 
   if (has_option (line, "--ssh-list"))
     list_mode = 2;
+  else if (has_option (line, "--multi"))
+    list_mode = 3;
   else
     list_mode = has_option (line, "--list");
   opt_data = has_option (line, "--data");
@@ -1288,36 +2028,60 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
         }
       err = 0;
     }
-  else if (list_mode)
+  else if (list_mode == 3)
     {
-      char *dirname;
-      struct dirent *dir_entry;
-
-      dirname = make_filename_try (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, NULL);
-      if (!dirname)
-        {
-          err = gpg_error_from_syserror ();
-          goto leave;
-        }
-      dir = opendir (dirname);
-      if (!dir)
+      /* Reading the directory once is cheaper than looking for each
+         of a large number of key files.  */
+      err = agent_list_key_grips (&grips, &ngrips);
+      if (err)
+        goto leave;
+      while (*line)
         {
-          err = gpg_error_from_syserror ();
-          xfree (dirname);
-          goto leave;
-        }
-      xfree (dirname);
+          err = parse_keygrip (ctx, line, grip);
+          if (err)
+            goto leave;
+          memcpy (hexgrip, line, 40);
+          hexgrip[40] = 0;
+          while (*line && !spacep (line))
+            line++;
+          while (spacep (line))
+            line++;
 
-      while ( (dir_entry = readdir (dir)) )
-        {
-          if (strlen (dir_entry->d_name) != 44
-              || strcmp (dir_entry->d_name + 40, ".key"))
+          if (!agent_key_in_list (grip, grips, ngrips))
             continue;
-          strncpy (hexgrip, dir_entry->d_name, 40);
-          hexgrip[40] = 0;
 
-          if ( hex2bin (hexgrip, grip, 20) < 0 )
-            continue; /* Bad hex string.  */
+          disabled = ttl = confirm = is_ssh = 0;
+          if (opt_with_ssh)
+            {
+              err = ssh_search_control_file (cf, hexgrip,
+                                             &disabled, &ttl, &confirm);
+              if (!err)
+                is_ssh = 1;
+              else if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+                goto leave;
+            }
+
+          err = do_one_keyinfo (ctrl, grip, ctx, opt_data, opt_ssh_fpr, is_ssh,
+                                ttl, disabled, confirm);
+          if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+            err = 0;  /* Removed meanwhile.  */
+          if (err)
+            goto leave;
+        }
+      err = 0;
+    }
+  else if (list_mode)
+    {
+      size_t n;
+
+      err = agent_list_key_grips (&grips, &ngrips);
+      if (err)
+        goto leave;
+
+      for (n=0; n < ngrips; n++)
+        {
+          memcpy (grip, grips + 20*n, 20);
+          bin2hex (grip, 20, hexgrip);
 
           disabled = ttl = confirm = is_ssh = 0;
           if (opt_with_ssh)
@@ -1332,6 +2096,8 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
 
           err = do_one_keyinfo (ctrl, grip, ctx, opt_data, opt_ssh_fpr, is_ssh,
                                 ttl, disabled, confirm);
+          if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+            err = 0;  /* Removed meanwhile.  */
           if (err)
             goto leave;
         }
@@ -1358,9 +2124,8 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
     }
 
  leave:
+  xfree (grips);
   ssh_close_control_file (cf);
-  if (dir)
-    closedir (dir);
   if (err && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
     leave_cmd (ctx, err);
   return err;
@@ -2004,13 +2769,15 @@ cmd_keywrap_key (assuan_context_t ctx, char *line)
 
 
 static const char hlp_import_key[] =
-  "IMPORT_KEY [--unattended] [<cache_nonce>]\n"
+  "IMPORT_KEY [--unattended] [--input-fd] [<cache_nonce>]\n"
   "\n"
   "Import a secret key into the key store.  The key is expected to be\n"
   "encrypted using the current session's key wrapping key (cf. command\n"
   "KEYWRAP_KEY) using the AESWRAP-128 algorithm.  This function takes\n"
   "no arguments but uses the inquiry \"KEYDATA\" to ask for the actual\n"
-  "key data.  The unwrapped key must be a canonical S-expression.  The\n"
+  "key data; with --input-fd the key data is read from the file passed\n"
+  "with the INPUT FD command instead.  The unwrapped key must be a\n"
+  "canonical S-expression.  The\n"
   "option --unattended tries to import the key as-is without any\n"
   "re-encryption";
 static gpg_error_t
@@ -2018,7 +2785,7 @@ cmd_import_key (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
   gpg_error_t err;
-  int opt_unattended;
+  int opt_unattended, opt_input_fd;
   unsigned char *wrappedkey = NULL;
   size_t wrappedkeylen;
   gcry_cipher_hd_t cipherhd = NULL;
@@ -2042,6 +2809,7 @@ cmd_import_key (assuan_context_t ctx, char *line)
     }
 
   opt_unattended = has_option (line, "--unattended");
+  opt_input_fd = has_option (line, "--input-fd");
   line = skip_options (line);
 
   p = line;
@@ -2051,10 +2819,15 @@ cmd_import_key (assuan_context_t ctx, char *line)
   if (*line)
     cache_nonce = xtrystrdup (line);
 
-  assuan_begin_confidential (ctx);
-  err = assuan_inquire (ctx, "KEYDATA",
-                        &wrappedkey, &wrappedkeylen, MAXLEN_KEYDATA);
-  assuan_end_confidential (ctx);
+  if (opt_input_fd)
+    err = read_input_fd (ctx, MAXLEN_INPUT_FD, &wrappedkey, &wrappedkeylen);
+  else
+    {
+      assuan_begin_confidential (ctx);
+      err = assuan_inquire (ctx, "KEYDATA",
+                            &wrappedkey, &wrappedkeylen, MAXLEN_KEYDATA);
+      assuan_end_confidential (ctx);
+    }
   if (err)
     goto leave;
   if (wrappedkeylen < 24)
@@ -2198,6 +2971,306 @@ cmd_import_key (assuan_context_t ctx, char *line)
 
 
 
+/* The most keys of one IMPORT_KEY_BATCH.  */
+#define MAX_IMPORT_BATCH 64
+
+/* Unwrap the key at position IDX of the list S_LIST with CIPHERHD.
+   On success the OpenPGP transfer key is stored at R_PGP.  */
+static gpg_error_t
+unwrap_openpgp_key (gcry_cipher_hd_t cipherhd, gcry_sexp_t s_list, int idx,
+                    gcry_sexp_t *r_pgp)
+{
+  gpg_error_t err;
+  const char *wrapped, *tag;
+  size_t wrappedlen, taglen;
+  unsigned char *key;
+  size_t keylen, realkeylen;
+  gcry_sexp_t s_pgp = NULL;
+
+  *r_pgp = NULL;
+  wrapped = gcry_sexp_nth_data (s_list, idx, &wrappedlen);
+  if (!wrapped || wrappedlen < 24)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+  keylen = wrappedlen - 8;
+  key = xtrymalloc_secure (keylen);
+  if (!key)
+    return gpg_error_from_syserror ();
+
+  err = gcry_cipher_decrypt (cipherhd, key, keylen, wrapped, wrappedlen);
+  if (!err)
+    {
+      realkeylen = gcry_sexp_canon_len (key, keylen, NULL, &err);
+      if (realkeylen)
+        err = gcry_sexp_sscan (&s_pgp, NULL, key, realkeylen);
+    }
+  wipememory (key, keylen);
+  xfree (key);
+  if (err)
+    return err;
+
+  tag = gcry_sexp_nth_data (s_pgp, 0, &taglen);
+  if (!tag || taglen != 19 || memcmp (tag, "openpgp-private-key", 19))
+    {
+      gcry_sexp_release (s_pgp);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  *r_pgp = s_pgp;
+  return 0;
+}
+
+
+/* Return true if the OpenPGP transfer key S_PGP is protected.  */
+static int
+openpgp_key_protected_p (gcry_sexp_t s_pgp)
+{
+  gcry_sexp_t l;
+  const char *s;
+  size_t n;
+  int prot;
+
+  l = gcry_sexp_find_token (s_pgp, "protection", 0);
+  s = l? gcry_sexp_nth_data (l, 1, &n) : NULL;
+  prot = !(s && n == 4 && !memcmp (s, "none", 4));
+  gcry_sexp_release (l);
+  return prot;
+}
+
+
+/* Import the OpenPGP transfer key S_PGP the way IMPORT_KEY does.
+   CACHE_NONCE_ADDR has the cache nonce, which is created if a
+   passphrase was entered.  On success the passphrase used, if any,
+   is stored at R_PASSPHRASE.  */
+static gpg_error_t
+import_openpgp_key (ctrl_t ctrl, assuan_context_t ctx, gcry_sexp_t s_pgp,
+                    char **cache_nonce_addr, int unattended,
+                    char **r_passphrase)
+{
+  gpg_error_t err;
+  unsigned char grip[20];
+  unsigned char *key = NULL;
+  unsigned char *finalkey = NULL;
+  size_t finalkeylen;
+  char *passphrase = NULL;
+
+  *r_passphrase = NULL;
+  err = convert_from_openpgp (ctrl, s_pgp, grip,
+                              ctrl->server_local->keydesc, *cache_nonce_addr,
+                              &key, unattended? NULL : &passphrase);
+  if (err)
+    return err;
+
+  if (passphrase)
+    {
+      if (!*cache_nonce_addr)
+        {
+          char buf[12];
+          gcry_create_nonce (buf, 12);
+          *cache_nonce_addr = bin2hex (buf, 12, NULL);
+        }
+      if (*cache_nonce_addr
+          && !agent_put_cache (*cache_nonce_addr, CACHE_MODE_NONCE,
+                               passphrase, CACHE_TTL_NONCE))
+        assuan_write_status (ctx, "CACHE_NONCE", *cache_nonce_addr);
+      err = agent_protect (key, passphrase, &finalkey, &finalkeylen,
+                           ctrl->s2k_count);
+      if (!err)
+        err = agent_write_private_key (grip, finalkey, finalkeylen, 0);
+    }
+  else
+    err = agent_write_private_key (grip, key,
+                                   gcry_sexp_canon_len (key, 0, NULL, NULL), 0);
+  xfree (finalkey);
+  xfree (key);
+  if (err)
+    xfree (passphrase);
+  else
+    *r_passphrase = passphrase;
+  return err;
+}
+
+
+static const char hlp_import_key_batch[] =
+  "IMPORT_KEY_BATCH [--unattended] [<cache_nonce>]\n"
+  "\n"
+  "Import several OpenPGP secret keys as with IMPORT_KEY.  The keys are\n"
+  "asked for with the inquiry \"KEYDATA\" as one canonical S-expression\n"
+  "\n"
+  "  (wrapped-keys KEY1 KEY2 ...)\n"
+  "\n"
+  "where each key is wrapped with the current session's key wrapping\n"
+  "key like the key data of IMPORT_KEY.  The passphrase entered for one\n"
+  "key is tried first for the other keys; the keys it unlocks are\n"
+  "protected again on parallel threads.  The result of each key is\n"
+  "returned with the status line\n"
+  "\n"
+  "  S IMPORT_RESULT <index> <error_code>\n"
+  "\n"
+  "where INDEX is the position of the key in the list, counting from 0.\n"
+  "The command itself fails only if the key data is not valid or the\n"
+  "passphrase entry was canceled.";
+static gpg_error_t
+cmd_import_key_batch (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err, err2;
+  int opt_unattended;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  gcry_sexp_t s_list = NULL;
+  gcry_cipher_hd_t cipherhd = NULL;
+  gcry_sexp_t s_pgp[MAX_IMPORT_BATCH];
+  gpg_error_t errs[MAX_IMPORT_BATCH];
+  gcry_sexp_t pending[MAX_IMPORT_BATCH];
+  unsigned int pendingidx[MAX_IMPORT_BATCH];
+  unsigned char grips[20 * MAX_IMPORT_BATCH];
+  unsigned char *keys[MAX_IMPORT_BATCH];
+  gpg_error_t keyerrs[MAX_IMPORT_BATCH];
+  char *passphrase = NULL;
+  char *cache_nonce = NULL;
+  char *newpass;
+  const char *s;
+  size_t n;
+  unsigned int nkeys = 0;
+  unsigned int npending = 0;
+  unsigned int i, k;
+  char *p;
+
+  memset (s_pgp, 0, sizeof s_pgp);
+  if (ctrl->restricted)
+    return leave_cmd (ctx, gpg_error (GPG_ERR_FORBIDDEN));
+
+  if (!ctrl->server_local->import_key)
+    {
+      err = gpg_error (GPG_ERR_MISSING_KEY);
+      goto leave;
+    }
+
+  opt_unattended = has_option (line, "--unattended");
+  line = skip_options (line);
+
+  for (p=line; *p && *p != ' ' && *p != '\t'; p++)
+    ;
+  *p = '\0';
+  if (*line)
+    cache_nonce = xtrystrdup (line);
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u",
+                             MAX_IMPORT_BATCH * MAXLEN_KEYDATA);
+  if (err)
+    goto leave;
+  assuan_begin_confidential (ctx);
+  err = assuan_inquire (ctx, "KEYDATA", &value, &valuelen,
+                        MAX_IMPORT_BATCH * MAXLEN_KEYDATA);
+  assuan_end_confidential (ctx);
+  if (err)
+    goto leave;
+  err = gcry_sexp_sscan (&s_list, NULL, value, valuelen);
+  xfree (value);
+  if (err)
+    goto leave;
+  s = gcry_sexp_nth_data (s_list, 0, &n);
+  if (!s || n != 12 || memcmp (s, "wrapped-keys", 12))
+    {
+      err = set_error (GPG_ERR_INV_SEXP, "wrapped-keys expected");
+      goto leave;
+    }
+  nkeys = gcry_sexp_length (s_list) - 1;
+  if (nkeys > MAX_IMPORT_BATCH)
+    {
+      nkeys = 0;
+      err = gpg_error (GPG_ERR_TOO_LARGE);
+      goto leave;
+    }
+
+  err = gcry_cipher_open (&cipherhd, GCRY_CIPHER_AES128,
+                          GCRY_CIPHER_MODE_AESWRAP, 0);
+  if (err)
+    goto leave;
+  err = gcry_cipher_setkey (cipherhd,
+                            ctrl->server_local->import_key, KEYWRAP_KEYSIZE);
+  if (err)
+    goto leave;
+  for (i=0; i < nkeys; i++)
+    errs[i] = unwrap_openpgp_key (cipherhd, s_list, i + 1, s_pgp + i);
+  gcry_cipher_close (cipherhd);
+  cipherhd = NULL;
+  gcry_sexp_release (s_list);
+  s_list = NULL;
+
+  /* Import the keys one after the other until a passphrase has been
+     entered.  The protected keys after that are set aside to be
+     converted with that passphrase in one go.  */
+  for (i=0; i < nkeys; i++)
+    {
+      if (errs[i])
+        continue;
+      if (passphrase && *passphrase && openpgp_key_protected_p (s_pgp[i]))
+        {
+          pendingidx[npending] = i;
+          pending[npending++] = s_pgp[i];
+          continue;
+        }
+      errs[i] = import_openpgp_key (ctrl, ctx, s_pgp[i], &cache_nonce,
+                                    opt_unattended, &newpass);
+      if (gpg_err_code (errs[i]) == GPG_ERR_CANCELED
+          || gpg_err_code (errs[i]) == GPG_ERR_FULLY_CANCELED)
+        {
+          err = errs[i];
+          goto leave;
+        }
+      if (!passphrase)
+        passphrase = newpass;
+      else
+        xfree (newpass);
+    }
+
+  if (npending)
+    convert_from_openpgp_many (ctrl, pending, npending, passphrase,
+                               ctrl->s2k_count, grips, keys, keyerrs);
+  for (k=0; k < npending; k++)
+    {
+      err2 = keyerrs[k];
+      if (err)
+        ; /* Canceled; only release the keys.  */
+      else if (!err2 && !agent_key_available (grips + 20 * k))
+        err2 = gpg_error (GPG_ERR_EEXIST);
+      else if (!err2)
+        err2 = agent_write_private_key (grips + 20 * k, keys[k],
+                                        gcry_sexp_canon_len (keys[k], 0,
+                                                             NULL, NULL), 0);
+      else if (gpg_err_code (err2) == GPG_ERR_BAD_PASSPHRASE)
+        {
+          /* A different passphrase; ask for it.  */
+          err2 = import_openpgp_key (ctrl, ctx, pending[k], &cache_nonce,
+                                     opt_unattended, &newpass);
+          xfree (newpass);
+          if (gpg_err_code (err2) == GPG_ERR_CANCELED
+              || gpg_err_code (err2) == GPG_ERR_FULLY_CANCELED)
+            err = err2;
+        }
+      xfree (keys[k]);
+      errs[pendingidx[k]] = err2;
+    }
+  if (err)
+    goto leave;
+
+  for (i=0; i < nkeys && !err; i++)
+    err = print_assuan_status (ctx, "IMPORT_RESULT", "%u %u", i, errs[i]);
+
+ leave:
+  for (i=0; i < nkeys; i++)
+    gcry_sexp_release (s_pgp[i]);
+  gcry_sexp_release (s_list);
+  gcry_cipher_close (cipherhd);
+  xfree (passphrase);
+  xfree (cache_nonce);
+  xfree (ctrl->server_local->keydesc);
+  ctrl->server_local->keydesc = NULL;
+  return leave_cmd (ctx, err);
+}
+
+
+
 static const char hlp_export_key[] =
   "EXPORT_KEY [--cache-nonce=<nonce>] [--openpgp] <hexstring_with_keygrip>\n"
   "\n"
@@ -2751,6 +3824,10 @@ static const char hlp_getinfo[] =
   "  ssh_socket_name - Return the name of the ssh socket.\n"
   "  scd_running - Return OK if the SCdaemon is already running.\n"
   "  s2k_count   - Return the calibrated S2K count.\n"
+  "  connections - Return one line of statistics per socket type.\n"
+  "  stats       - Return one line of timing statistics per trace point.\n"
+  "  vanity-metrics - Return the counters of the vanity searches in the\n"
+  "                   text format of Prometheus.\n"
   "  std_session_env - List the standard session environment.\n"
   "  std_startup_env - List the standard startup environment.\n"
   "  cmd_has_option\n"
@@ -2844,6 +3921,44 @@ cmd_getinfo (assuan_context_t ctx, char *line)
     {
       rc = agent_scd_check_running ()? 0 : gpg_error (GPG_ERR_GENERAL);
     }
+  else if (!strcmp (line, "connections"))
+    {
+      char buffer[200];
+      int idx;
+
+      for (idx=0;
+           !rc && get_agent_connection_stats (idx, buffer, sizeof buffer-1);
+           idx++)
+        {
+          strcat (buffer, "\n");
+          rc = assuan_send_data (ctx, buffer, strlen (buffer));
+          if (!rc)
+            rc = assuan_send_data (ctx, NULL, 0);
+        }
+    }
+  else if (!strcmp (line, "stats"))
+    {
+      char buffer[200];
+      int idx;
+
+      for (idx=0;
+           !rc && agent_trace_stats (idx, buffer, sizeof buffer-1);
+           idx++)
+        {
+          strcat (buffer, "\n");
+          rc = assuan_send_data (ctx, buffer, strlen (buffer));
+          if (!rc)
+            rc = assuan_send_data (ctx, NULL, 0);
+        }
+    }
+  else if (!strcmp (line, "vanity-metrics"))
+    {
+      membuf_t mb;
+
+      init_membuf (&mb, 4096);
+      agent_vanity_metrics_format (&mb);
+      rc = write_and_clear_outbuf (ctx, &mb);
+    }
   else if (!strcmp (line, "std_session_env")
            || !strcmp (line, "std_startup_env"))
     {
@@ -3032,6 +4147,24 @@ command_has_option (const char *cmd, const char *cmdopt)
       if (!strcmp (cmdopt, "repeat"))
           return 1;
     }
+  else if (!strcmp (cmd, "KEYINFO"))
+    {
+      if (!strcmp (cmdopt, "multi"))
+          return 1;
+    }
+  else if (!strcmp (cmd, "GENKEY"))
+    {
+      if (!strcmp (cmdopt, "stream"))
+          return 1;
+    }
+#ifndef HAVE_W32_SYSTEM
+  else if (!strcmp (cmd, "PKDECRYPT") || !strcmp (cmd, "IMPORT_KEY"))
+    {
+      /* Requires descriptor passing.  */
+      if (!strcmp (cmdopt, "input-fd"))
+          return 1;
+    }
+#endif
 
   return 0;
 }
@@ -3056,8 +4189,12 @@ register_commands (assuan_context_t ctx)
     { "SETKEYDESC",     cmd_setkeydesc,hlp_setkeydesc },
     { "SETHASH",        cmd_sethash,   hlp_sethash },
     { "PKSIGN",         cmd_pksign,    hlp_pksign },
+    { "PKSIGN_BATCH",   cmd_pksign_batch, hlp_pksign_batch },
     { "PKDECRYPT",      cmd_pkdecrypt, hlp_pkdecrypt },
+    { "PKDECRYPT_BATCH", cmd_pkdecrypt_batch, hlp_pkdecrypt_batch },
     { "GENKEY",         cmd_genkey,    hlp_genkey },
+    { "VANITY_RESULTS", cmd_vanity_results, hlp_vanity_results },
+    { "VANITY",         cmd_vanity,    hlp_vanity },
     { "READKEY",        cmd_readkey,   hlp_readkey },
     { "GET_PASSPHRASE", cmd_get_passphrase, hlp_get_passphrase },
     { "PRESET_PASSPHRASE", cmd_preset_passphrase, hlp_preset_passphrase },
@@ -3072,6 +4209,7 @@ register_commands (assuan_context_t ctx)
     { "SCD",            cmd_scd,       hlp_scd },
     { "KEYWRAP_KEY",    cmd_keywrap_key, hlp_keywrap_key },
     { "IMPORT_KEY",     cmd_import_key, hlp_import_key },
+    { "IMPORT_KEY_BATCH", cmd_import_key_batch, hlp_import_key_batch },
     { "EXPORT_KEY",     cmd_export_key, hlp_export_key },
     { "DELETE_KEY",     cmd_delete_key, hlp_delete_key },
     { "GETVAL",         cmd_getval,    hlp_getval },
@@ -3138,7 +4276,9 @@ start_command_handler (ctrl_t ctrl, gnupg_fd_t listen_fd, gnupg_fd_t fd)
     }
   else
     {
-      rc = assuan_init_socket_server (ctx, fd, ASSUAN_SOCKET_SERVER_ACCEPTED);
+      /* Descriptor passing is used for --input-fd.  */
+      rc = assuan_init_socket_server (ctx, fd, (ASSUAN_SOCKET_SERVER_ACCEPTED
+                                                |ASSUAN_SOCKET_SERVER_FDPASSING));
     }
   if (rc)
     {
@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <npth.h>
 
 #include "agent.h"
 #include "i18n.h"
@@ -1077,6 +1079,129 @@ convert_from_openpgp_native (ctrl_t ctrl,
 }
 
 
+/* The most threads used by convert_from_openpgp_many.  */
+#define MAX_CONVERT_THREADS 16
+
+/* The state shared by the threads of convert_from_openpgp_many.  */
+struct convert_many_s
+{
+  ctrl_t ctrl;
+  gcry_sexp_t *s_pgp;
+  unsigned int n;
+  unsigned int next;            /* The next key to take.  */
+  const char *passphrase;
+  unsigned long s2k_count;
+  unsigned char *grips;
+  unsigned char **r_keys;
+  gpg_error_t *r_errs;
+};
+
+
+/* The thread function of convert_from_openpgp_many.  It takes keys
+   until none are left.  */
+static void *
+convert_many_thread (void *arg)
+{
+  struct convert_many_s *parm = arg;
+  unsigned char *key, *protectedkey;
+  size_t protectedkeylen;
+  gpg_error_t err;
+  unsigned int idx;
+
+  while (parm->next < parm->n)
+    {
+      idx = parm->next++;
+      key = protectedkey = NULL;
+      /* Both steps are mostly S2K hashing, which is done without the
+         npth lock.  Everything else, including the diagnostics, runs
+         with the lock held.  */
+      err = convert_from_openpgp_main (parm->ctrl, parm->s_pgp[idx],
+                                       parm->grips + 20 * idx, NULL, NULL,
+                                       parm->passphrase, &key, NULL);
+      if (!err)
+        err = agent_protect (key, parm->passphrase,
+                             &protectedkey, &protectedkeylen,
+                             parm->s2k_count);
+      xfree (key);
+      parm->r_keys[idx] = err? NULL : protectedkey;
+      parm->r_errs[idx] = err;
+    }
+  return NULL;
+}
+
+
+/* Convert the N OpenPGP transfer keys S_PGP, which are protected with
+   the non-empty PASSPHRASE, into our internal format and protect
+   them again with PASSPHRASE and S2K_COUNT.  Each key takes two S2K
+   computations, which release the npth lock, thus the keys are
+   converted on parallel threads.
+   For key I the keygrip is stored at GRIPS + 20 * I and either the
+   protected key at R_KEYS[I] or the error at R_ERRS[I]; the caller
+   needs to release the keys.  Other than convert_from_openpgp this
+   neither checks whether the keys already exist nor asks for a
+   passphrase; a key with another passphrase fails with
+   GPG_ERR_BAD_PASSPHRASE.  */
+void
+convert_from_openpgp_many (ctrl_t ctrl, gcry_sexp_t *s_pgp, unsigned int n,
+                           const char *passphrase, unsigned long s2k_count,
+                           unsigned char *grips, unsigned char **r_keys,
+                           gpg_error_t *r_errs)
+{
+  struct convert_many_s parm;
+  npth_attr_t tattr;
+  npth_t threads[MAX_CONVERT_THREADS];
+  unsigned int nthreads, nstarted, i;
+  long ncpus = 1;
+  int rc;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctrl = ctrl;
+  parm.s_pgp = s_pgp;
+  parm.n = n;
+  parm.passphrase = passphrase;
+  parm.s2k_count = s2k_count;
+  parm.grips = grips;
+  parm.r_keys = r_keys;
+  parm.r_errs = r_errs;
+  for (i=0; i < n; i++)
+    {
+      r_keys[i] = NULL;
+      r_errs[i] = gpg_error (GPG_ERR_INTERNAL);
+    }
+
+#ifdef _SC_NPROCESSORS_ONLN
+  ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+  nthreads = ncpus > 1? ncpus : 1;
+  if (nthreads > MAX_CONVERT_THREADS)
+    nthreads = MAX_CONVERT_THREADS;
+  if (nthreads > n)
+    nthreads = n;
+
+  nstarted = 0;
+  if (nthreads > 1 && !npth_attr_init (&tattr))
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (; nstarted < nthreads; nstarted++)
+        {
+          rc = npth_create (threads + nstarted, &tattr,
+                            convert_many_thread, &parm);
+          if (rc)
+            {
+              log_error ("error spawning key conversion thread: %s\n",
+                         strerror (rc));
+              break;
+            }
+        }
+      npth_attr_destroy (&tattr);
+    }
+  /* Without threads the keys are converted right here.  */
+  convert_many_thread (&parm);
+  for (i=0; i < nstarted; i++)
+    npth_join (threads[i], NULL);
+}
+
+
 /* Given an ARRAY of mpis with the key parameters, protect the secret
    parameters in that array and replace them by one opaque encoded
    mpi.  NPKEY is the number of public key parameters and NSKEY is
@@ -27,6 +27,11 @@ gpg_error_t convert_from_openpgp_native (ctrl_t ctrl,
                                          gcry_sexp_t s_pgp,
                                          const char *passphrase,
                                          unsigned char **r_key);
+void convert_from_openpgp_many (ctrl_t ctrl, gcry_sexp_t *s_pgp,
+                                unsigned int n, const char *passphrase,
+                                unsigned long s2k_count,
+                                unsigned char *grips,
+                                unsigned char **r_keys, gpg_error_t *r_errs);
 
 gpg_error_t convert_to_openpgp (ctrl_t ctrl, gcry_sexp_t s_key,
                                 const char *passphrase,
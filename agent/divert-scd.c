@@ -58,7 +58,7 @@ ask_for_card (ctrl_t ctrl, const unsigned char *shadow_info, char **r_kid)
 
   for (;;)
     {
-      rc = agent_card_serialno (ctrl, &serialno);
+      rc = agent_card_serialno (ctrl, &serialno, want_sn);
       if (!rc)
         {
           log_debug ("detected card with S/N %s\n", serialno);
@@ -332,27 +332,20 @@ getpin_cb (void *opaque, const char *info, char *buf, size_t maxbuf)
 
 
 
-int
-divert_pksign (ctrl_t ctrl,
-               const unsigned char *digest, size_t digestlen, int algo,
-               const unsigned char *shadow_info, unsigned char **r_sig,
-               size_t *r_siglen)
+/* Sign DIGEST with the card key KID.  */
+static int
+do_divert_pksign (ctrl_t ctrl, const char *kid,
+                  const unsigned char *digest, size_t digestlen, int algo,
+                  unsigned char **r_sig, size_t *r_siglen)
 {
   int rc;
-  char *kid;
-  size_t siglen;
-  unsigned char *sigval = NULL;
-
-  rc = ask_for_card (ctrl, shadow_info, &kid);
-  if (rc)
-    return rc;
 
   if (algo == MD_USER_TLS_MD5SHA1)
     {
       int save = ctrl->use_auth_call;
       ctrl->use_auth_call = 1;
       rc = agent_card_pksign (ctrl, kid, getpin_cb, ctrl,
-                              algo, digest, digestlen, &sigval, &siglen);
+                              algo, digest, digestlen, r_sig, r_siglen);
       ctrl->use_auth_call = save;
     }
   else
@@ -364,19 +357,56 @@ divert_pksign (ctrl_t ctrl,
       if (!rc)
         {
           rc = agent_card_pksign (ctrl, kid, getpin_cb, ctrl,
-                                  algo, data, ndata, &sigval, &siglen);
+                                  algo, data, ndata, r_sig, r_siglen);
           xfree (data);
         }
     }
 
-  if (!rc)
+  return rc;
+}
+
+
+int
+divert_pksign (ctrl_t ctrl,
+               const unsigned char *digest, size_t digestlen, int algo,
+               const unsigned char *shadow_info, unsigned char **r_sig,
+               size_t *r_siglen)
+{
+  int rc;
+  char *kid;
+  size_t siglen;
+  unsigned char *sigval = NULL;
+
+  /* With --route-card-keys the SCdaemon uses any card holding the
+     key; we only ask for the card of the shadow info if there is no
+     such card.  */
+  if (opt.route_card_keys && ctrl->have_keygrip)
     {
-      *r_sig = sigval;
-      *r_siglen = siglen;
+      kid = xtrymalloc (1 + 40 + 1);
+      if (!kid)
+        return gpg_error_from_syserror ();
+      *kid = '&';
+      bin2hex (ctrl->keygrip, 20, kid+1);
+      rc = do_divert_pksign (ctrl, kid, digest, digestlen, algo,
+                             &sigval, &siglen);
+      xfree (kid);
+      if (gpg_err_code (rc) != GPG_ERR_NO_SECKEY)
+        goto leave;
     }
 
+  rc = ask_for_card (ctrl, shadow_info, &kid);
+  if (rc)
+    return rc;
+  rc = do_divert_pksign (ctrl, kid, digest, digestlen, algo,
+                         &sigval, &siglen);
   xfree (kid);
 
+ leave:
+  if (!rc)
+    {
+      *r_sig = sigval;
+      *r_siglen = siglen;
+    }
   return rc;
 }
 
@@ -29,6 +29,7 @@
 #include <assert.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <assert.h>
 #include <npth.h> /* (we use pth_sleep) */
 
@@ -40,6 +41,26 @@
 #define O_BINARY 0
 #endif
 
+/* The number of parsed key files kept by read_key_file.  */
+#define KEY_FILE_CACHE_SIZE 32
+
+/* A parsed key file as kept by read_key_file.  The entry is only
+   used as long as the file still has the same inode, size and
+   modification time.  */
+struct key_file_cache_s
+{
+  unsigned char grip[20];
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  unsigned long used;   /* The time of the last use or 0 if unused.  */
+  gcry_sexp_t s_key;
+};
+static struct key_file_cache_s key_file_cache[KEY_FILE_CACHE_SIZE];
+static unsigned long key_file_cache_clock;
+
+
 /* Helper to pass data to the check callback of the unprotect function. */
 struct try_unprotect_arg_s
 {
@@ -51,6 +72,83 @@ struct try_unprotect_arg_s
 };
 
 
+/* Forget the parsed key file for GRIP.  */
+static void
+flush_key_file_cache (const unsigned char *grip)
+{
+  int i;
+
+  for (i=0; i < KEY_FILE_CACHE_SIZE; i++)
+    if (key_file_cache[i].used && !memcmp (key_file_cache[i].grip, grip, 20))
+      {
+        gcry_sexp_release (key_file_cache[i].s_key);
+        memset (&key_file_cache[i], 0, sizeof key_file_cache[i]);
+      }
+}
+
+
+/* Return the cached parsed key file for GRIP if it is still the file
+   described by ST.  */
+static struct key_file_cache_s *
+find_key_file_cache (const unsigned char *grip, struct stat *st)
+{
+  int i;
+
+  for (i=0; i < KEY_FILE_CACHE_SIZE; i++)
+    if (key_file_cache[i].used && !memcmp (key_file_cache[i].grip, grip, 20))
+      {
+        if (key_file_cache[i].dev != st->st_dev
+            || key_file_cache[i].ino != st->st_ino
+            || key_file_cache[i].size != st->st_size
+            || key_file_cache[i].mtime != st->st_mtime)
+          {
+            flush_key_file_cache (grip);
+            return NULL;
+          }
+        key_file_cache[i].used = ++key_file_cache_clock;
+        return key_file_cache + i;
+      }
+  return NULL;
+}
+
+
+/* Remember the parsed key file S_KEY for GRIP which has been read
+   from the file described by ST.  Only protected and shadowed keys
+   are kept so that no plain secret key lingers in memory.  */
+static void
+put_key_file_cache (const unsigned char *grip, struct stat *st,
+                    gcry_sexp_t s_key)
+{
+  struct key_file_cache_s *kc;
+  const char *name;
+  size_t n;
+  int i;
+
+  name = gcry_sexp_nth_data (s_key, 0, &n);
+  if (!name || !((n == 21 && !memcmp (name, "protected-private-key", 21))
+                 || (n == 20 && !memcmp (name, "shadowed-private-key", 20))))
+    return;
+
+  flush_key_file_cache (grip);
+  for (kc=key_file_cache, i=1; i < KEY_FILE_CACHE_SIZE; i++)
+    if (key_file_cache[i].used < kc->used)
+      kc = key_file_cache + i;
+  gcry_sexp_release (kc->s_key);
+  memset (kc, 0, sizeof *kc);
+  if (gcry_sexp_build (&kc->s_key, NULL, "%S", s_key))
+    {
+      kc->s_key = NULL;
+      return;
+    }
+  memcpy (kc->grip, grip, 20);
+  kc->dev = st->st_dev;
+  kc->ino = st->st_ino;
+  kc->size = st->st_size;
+  kc->mtime = st->st_mtime;
+  kc->used = ++key_file_cache_clock;
+}
+
+
 /* Write an S-expression formatted key to our key storage.  With FORCE
    passed as true an existing key with the given GRIP will get
    overwritten.  */
@@ -61,6 +159,19 @@ agent_write_private_key (const unsigned char *grip,
   char *fname;
   estream_t fp;
   char hexgrip[40+4+1];
+  gpg_error_t err;
+
+  flush_key_file_cache (grip);
+  if (opt.key_store_file)
+    {
+      err = agent_keystore_put (grip, buffer, length, force);
+      if (gpg_err_code (err) == GPG_ERR_EEXIST)
+        log_error ("secret key '%s' already exists\n",
+                   bin2hex (grip, 20, hexgrip));
+      else if (!err)
+        bump_key_eventcounter ();
+      return err;
+    }
 
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
@@ -309,6 +420,81 @@ modify_description (const char *in, const char *comment, const gcry_sexp_t key,
 
 
 
+/* Compute the digest which binds an unprotected key kept in the
+   passphrase cache to the protected key KEYBUF and the passphrase PW
+   and store it at DIGEST.  */
+static gpg_error_t
+cached_key_digest (const unsigned char *keybuf, const char *pw,
+                   unsigned char *digest)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256, GCRY_MD_FLAG_SECURE);
+  if (err)
+    return err;
+  gcry_md_write (md, keybuf, gcry_sexp_canon_len (keybuf, 0, NULL, NULL));
+  gcry_md_write (md, pw, strlen (pw) + 1);
+  memcpy (digest, gcry_md_read (md, GCRY_MD_SHA256), 32);
+  gcry_md_close (md);
+  return 0;
+}
+
+
+/* Take the unprotected form of KEYBUF from the passphrase cache if
+   it was stored there for the same protected key and passphrase PW.
+   Returns true and stores the key in secure memory at R_RESULT if
+   so.  */
+static int
+get_cached_key (const char *hexgrip, const unsigned char *keybuf,
+                const char *pw, unsigned char **r_result)
+{
+  unsigned char digest[32];
+  unsigned char *data;
+  size_t datalen, n;
+  int found = 0;
+
+  if (cached_key_digest (keybuf, pw, digest))
+    return 0;
+  data = agent_get_cache_key (hexgrip, &datalen);
+  if (!data)
+    return 0;
+  if (datalen > 32 && !memcmp (data, digest, 32)
+      && (n = gcry_sexp_canon_len (data + 32, datalen - 32, NULL, NULL))
+      && (*r_result = xtrymalloc_secure (n)))
+    {
+      memcpy (*r_result, data + 32, n);
+      found = 1;
+    }
+  wipememory (data, datalen);
+  xfree (data);
+  return found;
+}
+
+
+/* Store RESULT, the unprotected form of KEYBUF using the passphrase
+   PW, in the passphrase cache with TTL.  */
+static void
+put_cached_key (const char *hexgrip, const unsigned char *keybuf,
+                const char *pw, const unsigned char *result, int ttl)
+{
+  unsigned char *data;
+  size_t n;
+
+  n = gcry_sexp_canon_len (result, 0, NULL, NULL);
+  data = xtrymalloc_secure (32 + n);
+  if (!data)
+    return;
+  if (!cached_key_digest (keybuf, pw, data))
+    {
+      memcpy (data + 32, result, n);
+      agent_put_cache_key (hexgrip, data, 32 + n, ttl);
+    }
+  wipememory (data, 32 + n);
+  xfree (data);
+}
+
+
 /* Unprotect the canconical encoded S-expression key in KEYBUF.  GRIP
    should be the hex encoded keygrip of that key to be used with the
    caching mechanism. DESC_TEXT may be set to override the default
@@ -317,7 +503,8 @@ modify_description (const char *in, const char *comment, const gcry_sexp_t key,
    NULL, the function succeeded and the key was protected the used
    passphrase (entered or from the cache) is stored there; if not NULL
    will be stored.  The caller needs to free the returned
-   passphrase. */
+   passphrase.  With --cache-unprotected-keys the key unprotected
+   with a cached passphrase is kept in the cache as well.  */
 static int
 unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
            unsigned char **keybuf, const unsigned char *grip,
@@ -369,7 +556,17 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
       pw = agent_get_cache (hexgrip, cache_mode);
       if (pw)
         {
-          rc = agent_unprotect (ctrl, *keybuf, pw, NULL, &result, &resultlen);
+          if (opt.cache_unprotected_keys
+              && get_cached_key (hexgrip, *keybuf, pw, &result))
+            rc = 0;
+          else
+            {
+              rc = agent_unprotect (ctrl, *keybuf, pw, NULL,
+                                    &result, &resultlen);
+              if (!rc && opt.cache_unprotected_keys)
+                put_cached_key (hexgrip, *keybuf, pw, result,
+                                lookup_ttl? lookup_ttl (hexgrip) : 0);
+            }
           if (!rc)
             {
               if (cache_mode == CACHE_MODE_NORMAL)
@@ -518,7 +715,9 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 
 /* Read the key identified by GRIP from the private key directory and
    return it as an gcrypt S-expression object in RESULT.  On failure
-   returns an error code and stores NULL at RESULT. */
+   returns an error code and stores NULL at RESULT.  Protected keys
+   are taken from KEY_FILE_CACHE as long as their file did not
+   change. */
 static gpg_error_t
 read_key_file (const unsigned char *grip, gcry_sexp_t *result)
 {
@@ -530,13 +729,63 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result)
   size_t buflen, erroff;
   gcry_sexp_t s_skey;
   char hexgrip[40+4+1];
+  struct key_file_cache_s *kc;
+  double start;
 
   *result = NULL;
 
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
 
+  start = agent_trace_start ();
+  if (opt.key_store_file)
+    {
+      off_t off;
+
+      rc = agent_keystore_get (grip, &buf, &buflen, &off);
+      if (rc)
+        return rc;
+      agent_trace_end (TRACE_KEY_READ, start);
+
+      /* The offset of the record stands in for the file; it changes
+         with each write of the key.  */
+      memset (&st, 0, sizeof st);
+      st.st_ino = off;
+      st.st_size = buflen;
+      if ((kc = find_key_file_cache (grip, &st)))
+        {
+          xfree (buf);
+          rc = gcry_sexp_build (result, NULL, "%S", kc->s_key);
+          if (rc)
+            *result = NULL;
+          return rc;
+        }
+      start = agent_trace_start ();
+      rc = gcry_sexp_sscan (&s_skey, &erroff, (char*)buf, buflen);
+      agent_trace_end (TRACE_SEXP_PARSE, start);
+      xfree (buf);
+      if (rc)
+        {
+          log_error ("failed to build S-Exp (off=%u): %s\n",
+                     (unsigned int)erroff, gpg_strerror (rc));
+          return rc;
+        }
+      put_key_file_cache (grip, &st, s_skey);
+      *result = s_skey;
+      return 0;
+    }
+
   fname = make_filename (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, hexgrip, NULL);
+  if (!stat (fname, &st) && (kc = find_key_file_cache (grip, &st)))
+    {
+      xfree (fname);
+      rc = gcry_sexp_build (result, NULL, "%S", kc->s_key);
+      if (rc)
+        *result = NULL;
+      agent_trace_end (TRACE_KEY_READ, start);
+      return rc;
+    }
+
   fp = es_fopen (fname, "rb");
   if (!fp)
     {
@@ -581,8 +830,12 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result)
       return rc;
     }
 
+  agent_trace_end (TRACE_KEY_READ, start);
+
   /* Convert the file into a gcrypt S-expression object.  */
+  start = agent_trace_start ();
   rc = gcry_sexp_sscan (&s_skey, &erroff, (char*)buf, buflen);
+  agent_trace_end (TRACE_SEXP_PARSE, start);
   xfree (fname);
   es_fclose (fp);
   xfree (buf);
@@ -592,6 +845,7 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result)
                  (unsigned int)erroff, gpg_strerror (rc));
       return rc;
     }
+  put_key_file_cache (grip, &st, s_skey);
   *result = s_skey;
   return 0;
 }
@@ -605,11 +859,22 @@ remove_key_file (const unsigned char *grip)
   char *fname;
   char hexgrip[40+4+1];
 
+  flush_key_file_cache (grip);
+  if (opt.key_store_file)
+    {
+      err = agent_keystore_delete (grip);
+      if (!err)
+        bump_key_eventcounter ();
+      return err;
+    }
+
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
   fname = make_filename (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, hexgrip, NULL);
   if (gnupg_remove (fname))
     err = gpg_error_from_syserror ();
+  else
+    bump_key_eventcounter ();
   xfree (fname);
   return err;
 }
@@ -1126,6 +1391,9 @@ agent_key_available (const unsigned char *grip)
   char *fname;
   char hexgrip[40+4+1];
 
+  if (opt.key_store_file)
+    return agent_keystore_has (grip)? 0 : -1;
+
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
 
@@ -1136,6 +1404,87 @@ agent_key_available (const unsigned char *grip)
 }
 
 
+static int
+compare_grips (const void *a, const void *b)
+{
+  return memcmp (a, b, 20);
+}
+
+
+/* Return a sorted array with the keygrips of all keys in the private
+   key directory at R_GRIPS and their number at R_COUNT.  The caller
+   must release the array.  This allows checking many keygrips with a
+   single pass over the directory; see agent_key_in_list.  */
+gpg_error_t
+agent_list_key_grips (unsigned char **r_grips, size_t *r_count)
+{
+  gpg_error_t err = 0;
+  char *dirname;
+  DIR *dir;
+  struct dirent *dir_entry;
+  unsigned char *grips = NULL, *tmp;
+  size_t count = 0, size = 0;
+
+  *r_grips = NULL;
+  *r_count = 0;
+
+  if (opt.key_store_file)
+    return agent_keystore_list (r_grips, r_count);
+
+  dirname = make_filename_try (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (!dirname)
+    return gpg_error_from_syserror ();
+  dir = opendir (dirname);
+  if (!dir)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (dirname);
+      return err;
+    }
+  xfree (dirname);
+
+  while ( (dir_entry = readdir (dir)) )
+    {
+      if (strlen (dir_entry->d_name) != 44
+          || strcmp (dir_entry->d_name + 40, ".key"))
+        continue;
+      if (count == size)
+        {
+          size = size? 2 * size : 256;
+          tmp = xtryrealloc (grips, size * 20);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              xfree (grips);
+              closedir (dir);
+              return err;
+            }
+          grips = tmp;
+        }
+      if (hex2bin (dir_entry->d_name, grips + 20 * count, 20) < 0)
+        continue; /* Bad hex string.  */
+      count++;
+    }
+  closedir (dir);
+
+  if (count)
+    qsort (grips, count, 20, compare_grips);
+  *r_grips = grips;
+  *r_count = count;
+  return 0;
+}
+
+
+/* Return true if GRIP is in the array GRIPS of COUNT keygrips as
+   returned by agent_list_key_grips.  */
+int
+agent_key_in_list (const unsigned char *grip,
+                   const unsigned char *grips, size_t count)
+{
+  return !!bsearch (grip, grips, count, 20, compare_grips);
+}
+
+
 
 /* Return the information about the secret key specified by the binary
    keygrip GRIP.  If the key is a shadowed one the shadow information
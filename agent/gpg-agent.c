@@ -60,6 +60,7 @@
 #include "asshelp.h"
 #include "openpgpdefs.h"  /* for PUBKEY_ALGO_ECDSA, PUBKEY_ALGO_ECDH */
 #include "../common/init.h"
+#include "../vanity/vanity.h" /* for VANITY_RESEED_INTERVAL */
 
 
 enum cmd_and_opt_values
@@ -86,8 +87,10 @@ enum cmd_and_opt_values
   oNoDetach,
   oNoGrab,
   oLogFile,
+  oAsyncLog,
   oServer,
   oDaemon,
+  oSupervised,
   oBatch,
 
   oPinentryProgram,
@@ -103,6 +106,9 @@ enum cmd_and_opt_values
   oDefCacheTTLSSH,
   oMaxCacheTTL,
   oMaxCacheTTLSSH,
+  oMaxConnections,
+  oMaxExtraConnections,
+  oMaxSSHConnections,
   oEnforcePassphraseConstraints,
   oMinPassphraseLen,
   oMinPassphraseNonalpha,
@@ -115,6 +121,7 @@ enum cmd_and_opt_values
   oFakedSystemTime,
 
   oIgnoreCacheForSigning,
+  oCacheUnprotectedKeys,
   oAllowMarkTrusted,
   oNoAllowMarkTrusted,
   oAllowPresetPassphrase,
@@ -125,7 +132,22 @@ enum cmd_and_opt_values
   oSSHSupport,
   oPuttySupport,
   oDisableScdaemon,
+  oRouteCardKeys,
   oDisableCheckOwnSocket,
+  oVanityWorkers,
+  oVanityGpu,
+  oVanityReseed,
+  oVanityPin,
+  oVanityNoSmt,
+  oVanityPool,
+  oVanityAutotune,
+  oVanityGovernor,
+  oVanityMaxTemp,
+  oVanityMemory,
+  oVanityWorkerMemory,
+  oKeyPool,
+  oKeyPoolSize,
+  oKeyStoreFile,
   oWriteEnvFile
 };
 
@@ -145,6 +167,7 @@ static ARGPARSE_OPTS opts[] = {
 
   ARGPARSE_s_n (oDaemon,  "daemon", N_("run in daemon mode (background)")),
   ARGPARSE_s_n (oServer,  "server", N_("run in server mode (foreground)")),
+  ARGPARSE_s_n (oSupervised, "supervised", "@"),
   ARGPARSE_s_n (oVerbose, "verbose", N_("verbose")),
   ARGPARSE_s_n (oQuiet,	  "quiet",     N_("be somewhat more quiet")),
   ARGPARSE_s_n (oSh,	  "sh",        N_("sh-style command output")),
@@ -161,6 +184,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oNoDetach,  "no-detach", N_("do not detach from the console")),
   ARGPARSE_s_n (oNoGrab,    "no-grab",   N_("do not grab keyboard and mouse")),
   ARGPARSE_s_s (oLogFile,   "log-file",  N_("use a log file for the server")),
+  ARGPARSE_s_n (oAsyncLog,  "async-log", "@"),
   ARGPARSE_s_s (oPinentryProgram, "pinentry-program",
                 /* */             N_("|PGM|use PGM as the PIN-Entry program")),
   ARGPARSE_s_s (oPinentryTouchFile, "pinentry-touch-file", "@"),
@@ -168,6 +192,9 @@ static ARGPARSE_OPTS opts[] = {
                 /* */             N_("|PGM|use PGM as the SCdaemon program") ),
   ARGPARSE_s_n (oDisableScdaemon, "disable-scdaemon",
                 /* */             N_("do not use the SCdaemon") ),
+  ARGPARSE_s_n (oRouteCardKeys, "route-card-keys",
+                /* */             N_("let the SCdaemon use any card "
+                                     "holding the key") ),
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
 
   ARGPARSE_s_s (oExtraSocket, "extra-socket",
@@ -194,6 +221,9 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_u (oDefCacheTTLSSH, "default-cache-ttl-ssh", "@" ),
   ARGPARSE_s_u (oMaxCacheTTL,    "max-cache-ttl",         "@" ),
   ARGPARSE_s_u (oMaxCacheTTLSSH, "max-cache-ttl-ssh",     "@" ),
+  ARGPARSE_s_u (oMaxConnections,      "max-connections",       "@" ),
+  ARGPARSE_s_u (oMaxExtraConnections, "max-extra-connections", "@" ),
+  ARGPARSE_s_u (oMaxSSHConnections,   "max-ssh-connections",   "@" ),
 
   ARGPARSE_s_n (oEnforcePassphraseConstraints, "enforce-passphrase-constraints",
                 /* */                          "@"),
@@ -205,6 +235,7 @@ static ARGPARSE_OPTS opts[] = {
 
   ARGPARSE_s_n (oIgnoreCacheForSigning, "ignore-cache-for-signing",
                 /* */    N_("do not use the PIN cache when signing")),
+  ARGPARSE_s_n (oCacheUnprotectedKeys, "cache-unprotected-keys", "@"),
   ARGPARSE_s_n (oNoAllowExternalCache,  "no-allow-external-cache",
                 /* */    N_("disallow the use of an external password cache")),
   ARGPARSE_s_n (oNoAllowMarkTrusted, "no-allow-mark-trusted",
@@ -216,6 +247,35 @@ static ARGPARSE_OPTS opts[] = {
                                    N_("allow caller to override the pinentry")),
 
   ARGPARSE_s_n (oSSHSupport,   "enable-ssh-support", N_("enable ssh support")),
+  ARGPARSE_s_u (oVanityWorkers, "vanity-workers",
+                /* */    N_("|N|use N threads for vanity key searches")),
+  ARGPARSE_s_n (oVanityGpu, "vanity-gpu",
+                /* */    N_("use an OpenCL device for vanity key searches")),
+  ARGPARSE_s_u (oVanityReseed, "vanity-reseed-interval",
+                /* */    N_("|N|reseed the vanity key generation every N KiB")),
+  ARGPARSE_s_n (oVanityPin, "vanity-pin-workers",
+                /* */    N_("bind the vanity search threads to the CPUs")),
+  ARGPARSE_s_n (oVanityNoSmt, "vanity-no-smt",
+                /* */    N_("use one vanity search thread per CPU core")),
+  ARGPARSE_s_n (oVanityPool, "vanity-pool",
+                /* */    N_("keep and reuse the keys of vanity searches")),
+  ARGPARSE_s_n (oVanityAutotune, "vanity-autotune",
+                /* */    N_("fit the vanity search window to the host")),
+  ARGPARSE_s_s (oVanityGovernor, "vanity-governor",
+                /* */    N_("|SCHEDULE|limit vanity searches by the hour")),
+  ARGPARSE_s_u (oVanityMaxTemp, "vanity-max-temperature",
+                /* */    N_("|N|slow down vanity searches above N C")),
+  ARGPARSE_s_u (oVanityMemory, "vanity-memory-limit",
+                /* */    N_("|N|use at most N KiB for a vanity search")),
+  ARGPARSE_s_u (oVanityWorkerMemory, "vanity-worker-memory",
+                /* */    N_("|N|use at most N KiB for a vanity worker")),
+  ARGPARSE_s_s (oKeyPool, "key-pool",
+                /* */    N_("|LIST|keep keys of the kinds in LIST ready")),
+  ARGPARSE_s_u (oKeyPoolSize, "key-pool-size",
+                /* */    N_("|N|keep N keys of each kind ready")),
+  ARGPARSE_s_n (oKeyStoreFile, "key-store-file",
+                /* */    N_("keep the private keys in one indexed file")),
+
   ARGPARSE_s_n (oPuttySupport, "enable-putty-support",
 #ifdef HAVE_W32_SYSTEM
                 /* */           N_("enable putty support")
@@ -240,6 +300,7 @@ static ARGPARSE_OPTS opts[] = {
 #define MIN_PASSPHRASE_LEN    (8)
 #define MIN_PASSPHRASE_NONALPHA (1)
 #define MAX_PASSPHRASE_DAYS   (0)
+#define DEFAULT_KEY_POOL_SIZE (2)
 
 /* The timer tick used for housekeeping stuff.  For Windows we use a
    longer period as the SetWaitableTimer seems to signal earlier than
@@ -288,6 +349,10 @@ static int check_own_socket_running;
 /* Flags to indicate that check_own_socket shall not be called.  */
 static int disable_check_own_socket;
 
+/* Flag indicating that the listening sockets have been passed to us
+   by a supervisor and are not ours to remove.  */
+static int supervised;
+
 /* It is possible that we are currently running under setuid permissions */
 static int maybe_setuid = 1;
 
@@ -338,12 +403,58 @@ static pid_t parent_pid = (pid_t)(-1);
 /* Number of active connections.  */
 static int active_connections;
 
+/* The number of idle connection threads kept for new connections.  */
+#define MAX_IDLE_CONNECTION_THREADS 8
+
+/* The number of accepted connections of one socket type which may
+   wait for a free slot.  Further connections are closed.  */
+#define MAX_QUEUED_CONNECTIONS 64
+
+/* The number of released control objects kept for new
+   connections.  */
+#define MAX_FREE_CTRLS 16
+
+/* The socket types in the order of the table below.  */
+enum { CONN_STD, CONN_EXTRA, CONN_SSH };
+
+/* The connections of one socket type.  */
+struct conn_class_s
+{
+  const char *name;          /* The name for diagnostics.  */
+  unsigned int nactive;      /* The number of connections served.  */
+  unsigned int peak;         /* The highest NACTIVE seen.  */
+  unsigned int nqueued;      /* The number of waiting connections.  */
+  ctrl_t queue;              /* The waiting connections ...  */
+  ctrl_t *queue_tail;        /* ... and the end of that list.  */
+  unsigned long accepted;    /* The number of accepted connections.  */
+  unsigned long delayed;     /* The number of those which had to wait.  */
+  unsigned long rejected;    /* The number of those which were closed.  */
+};
+static struct conn_class_s conn_classes[] =
+  {
+    { "std" }, { "extra" }, { "ssh" }
+  };
+
+/* The connection threads wait on CONN_POOL_COND for new connections.
+   CONN_WAKEUPS is the number of signals sent to idle threads which
+   have not yet been taken up.  */
+static npth_mutex_t conn_pool_lock;
+static npth_cond_t conn_pool_cond;
+static unsigned int conn_threads;
+static unsigned int idle_conn_threads;
+static unsigned int conn_wakeups;
+
+/* Released control objects for reuse.  */
+static ctrl_t free_ctrls;
+static unsigned int nfree_ctrls;
+
 
 /*
    Local prototypes.
  */
 
 static char *create_socket_name (char *standard_name, int with_homedir);
+static void get_supervised_sockets (gnupg_fd_t *r_fd, gnupg_fd_t *r_fd_ssh);
 static gnupg_fd_t create_server_socket (char *name, int primary,
                                         char **r_redir_name,
                                         assuan_sock_nonce_t *nonce);
@@ -526,6 +637,8 @@ cleanup (void)
     return;
   done = 1;
   deinitialize_module_cache ();
+  if (supervised)
+    return;
   remove_socket (socket_name, redir_socket_name);
   if (opt.extra_socket > 1)
     remove_socket (socket_name_extra, redir_socket_name_extra);
@@ -556,6 +669,9 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       opt.def_cache_ttl_ssh = DEFAULT_CACHE_TTL_SSH;
       opt.max_cache_ttl = MAX_CACHE_TTL;
       opt.max_cache_ttl_ssh = MAX_CACHE_TTL_SSH;
+      opt.max_connections = 0;
+      opt.max_extra_connections = 0;
+      opt.max_ssh_connections = 0;
       opt.enforce_passphrase_constraints = 0;
       opt.min_passphrase_len = MIN_PASSPHRASE_LEN;
       opt.min_passphrase_nonalpha = MIN_PASSPHRASE_NONALPHA;
@@ -563,9 +679,24 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       opt.max_passphrase_days = MAX_PASSPHRASE_DAYS;
       opt.enable_passhrase_history = 0;
       opt.ignore_cache_for_signing = 0;
+      opt.cache_unprotected_keys = 0;
       opt.allow_mark_trusted = 1;
       opt.allow_external_cache = 1;
       opt.disable_scdaemon = 0;
+      opt.route_card_keys = 0;
+      opt.vanity_workers = 0;
+      opt.vanity_gpu = 0;
+      opt.vanity_reseed = 0;
+      opt.vanity_pin = 0;
+      opt.vanity_no_smt = 0;
+      opt.vanity_pool = 0;
+      opt.vanity_autotune = 0;
+      opt.vanity_governor = NULL;
+      opt.vanity_max_temp = 0;
+      opt.vanity_memory = 0;
+      opt.vanity_worker_memory = 0;
+      opt.key_pool = NULL;
+      opt.key_pool_size = DEFAULT_KEY_POOL_SIZE;
       disable_check_own_socket = 0;
       return 1;
     }
@@ -598,6 +729,7 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oPinentryTouchFile: opt.pinentry_touch_file = pargs->r.ret_str; break;
     case oScdaemonProgram: opt.scdaemon_program = pargs->r.ret_str; break;
     case oDisableScdaemon: opt.disable_scdaemon = 1; break;
+    case oRouteCardKeys: opt.route_card_keys = 1; break;
     case oDisableCheckOwnSocket: disable_check_own_socket = 1; break;
 
     case oDefCacheTTL: opt.def_cache_ttl = pargs->r.ret_ulong; break;
@@ -605,6 +737,12 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oMaxCacheTTL: opt.max_cache_ttl = pargs->r.ret_ulong; break;
     case oMaxCacheTTLSSH: opt.max_cache_ttl_ssh = pargs->r.ret_ulong; break;
 
+    case oMaxConnections: opt.max_connections = pargs->r.ret_ulong; break;
+    case oMaxExtraConnections:
+      opt.max_extra_connections = pargs->r.ret_ulong;
+      break;
+    case oMaxSSHConnections: opt.max_ssh_connections = pargs->r.ret_ulong; break;
+
     case oEnforcePassphraseConstraints:
       opt.enforce_passphrase_constraints=1;
       break;
@@ -623,6 +761,7 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       break;
 
     case oIgnoreCacheForSigning: opt.ignore_cache_for_signing = 1; break;
+    case oCacheUnprotectedKeys: opt.cache_unprotected_keys = 1; break;
 
     case oAllowMarkTrusted: opt.allow_mark_trusted = 1; break;
     case oNoAllowMarkTrusted: opt.allow_mark_trusted = 0; break;
@@ -634,6 +773,22 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oNoAllowExternalCache: opt.allow_external_cache = 0;
       break;
 
+    case oVanityWorkers: opt.vanity_workers = pargs->r.ret_ulong; break;
+    case oVanityGpu: opt.vanity_gpu = 1; break;
+    case oVanityReseed: opt.vanity_reseed = pargs->r.ret_ulong; break;
+    case oVanityPin: opt.vanity_pin = 1; break;
+    case oVanityNoSmt: opt.vanity_no_smt = 1; break;
+    case oVanityPool: opt.vanity_pool = 1; break;
+    case oVanityAutotune: opt.vanity_autotune = 1; break;
+    case oVanityGovernor: opt.vanity_governor = pargs->r.ret_str; break;
+    case oVanityMaxTemp: opt.vanity_max_temp = pargs->r.ret_ulong; break;
+    case oVanityMemory: opt.vanity_memory = pargs->r.ret_ulong; break;
+    case oVanityWorkerMemory:
+      opt.vanity_worker_memory = pargs->r.ret_ulong;
+      break;
+    case oKeyPool: opt.key_pool = pargs->r.ret_str; break;
+    case oKeyPoolSize: opt.key_pool_size = pargs->r.ret_ulong; break;
+
     default:
       return 0; /* not handled */
     }
@@ -671,9 +826,11 @@ main (int argc, char **argv )
   int default_config =1;
   int pipe_server = 0;
   int is_daemon = 0;
+  int is_supervised = 0;
   int nodetach = 0;
   int csh_style = 0;
   char *logfile = NULL;
+  int async_log = 0;
   int debug_wait = 0;
   int gpgconf_list = 0;
   gpg_error_t err;
@@ -703,6 +860,8 @@ main (int argc, char **argv )
   init_common_subsystems (&argc, &argv);
 
   npth_init ();
+  /* Let other threads run while a passphrase is hashed.  */
+  agent_set_kdf_hooks (npth_unprotect, npth_protect);
 
   /* Check that the libraries are suitable.  Do it here because
      the option parsing may need services of the library. */
@@ -876,10 +1035,12 @@ main (int argc, char **argv )
         case oHomedir: opt.homedir = pargs.r.ret_str; break;
         case oNoDetach: nodetach = 1; break;
         case oLogFile: logfile = pargs.r.ret_str; break;
+        case oAsyncLog: async_log = 1; break;
         case oCsh: csh_style = 1; break;
         case oSh: csh_style = 0; break;
         case oServer: pipe_server = 1; break;
         case oDaemon: is_daemon = 1; break;
+        case oSupervised: is_supervised = 1; break;
 
         case oDisplay: default_display = xstrdup (pargs.r.ret_str); break;
         case oTTYname: default_ttyname = xstrdup (pargs.r.ret_str); break;
@@ -906,6 +1067,7 @@ main (int argc, char **argv )
         case oKeepDISPLAY: opt.keep_display = 1; break;
 
 	case oSSHSupport:  opt.ssh_support = 1; break;
+        case oKeyStoreFile: opt.key_store_file = 1; break;
         case oPuttySupport:
 #        ifdef HAVE_W32_SYSTEM
           putty_support = 1;
@@ -972,7 +1134,7 @@ main (int argc, char **argv )
     bind_textdomain_codeset (PACKAGE_GT, "UTF-8");
 #endif
 
-  if (!pipe_server && !is_daemon && !gpgconf_list)
+  if (!pipe_server && !is_daemon && !is_supervised && !gpgconf_list)
     {
      /* We have been called without any options and thus we merely
         check whether an agent is already running.  We do this right
@@ -1078,8 +1240,24 @@ main (int argc, char **argv )
 #else
       es_printf ("enable-ssh-support:%lu:\n", GC_OPT_FLAG_NONE);
 #endif
+      es_printf ("key-store-file:%lu:\n", GC_OPT_FLAG_NONE);
       es_printf ("allow-loopback-pinentry:%lu:\n",
                  GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
+      es_printf ("vanity-workers:%lu:%d:\n",
+                 GC_OPT_FLAG_DEFAULT|GC_OPT_FLAG_RUNTIME, 0);
+      es_printf ("vanity-gpu:%lu:\n",
+                 GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
+      es_printf ("vanity-reseed-interval:%lu:%d:\n",
+                 GC_OPT_FLAG_DEFAULT|GC_OPT_FLAG_RUNTIME,
+                 VANITY_RESEED_INTERVAL);
+      es_printf ("vanity-pin-workers:%lu:\n",
+                 GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
+      es_printf ("vanity-no-smt:%lu:\n",
+                 GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
+      es_printf ("vanity-pool:%lu:\n",
+                 GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
+      es_printf ("vanity-autotune:%lu:\n",
+                 GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
 
       agent_exit (0);
     }
@@ -1126,6 +1304,29 @@ main (int argc, char **argv )
       agent_deinit_default_ctrl (ctrl);
       xfree (ctrl);
     }
+  else if (is_supervised)
+    {
+      gnupg_fd_t fd, fd_ssh;
+
+      get_supervised_sockets (&fd, &fd_ssh);
+#ifndef HAVE_W32_SYSTEM
+      {
+        struct sigaction sa;
+
+        sa.sa_handler = SIG_IGN;
+        sigemptyset (&sa.sa_mask);
+        sa.sa_flags = 0;
+        sigaction (SIGPIPE, &sa, NULL);
+      }
+#endif /*!HAVE_W32_SYSTEM*/
+
+      if (async_log && log_set_async (1))
+        log_error ("error enabling asynchronous logging: %s\n",
+                   strerror (errno));
+      log_info ("%s %s started\n", strusage(11), strusage(13) );
+      handle_connections (fd, GNUPG_INVALID_FD, fd_ssh);
+      assuan_sock_close (fd);
+    }
   else if (!is_daemon)
     ; /* NOTREACHED */
   else
@@ -1340,6 +1541,10 @@ main (int argc, char **argv )
       }
 #endif /*!HAVE_W32_SYSTEM*/
 
+      /* The writer thread must be created after the fork.  */
+      if (async_log && log_set_async (1))
+        log_error ("error enabling asynchronous logging: %s\n",
+                   strerror (errno));
       log_info ("%s %s started\n", strusage(11), strusage(13) );
       handle_connections (fd, fd_extra, fd_ssh);
       assuan_sock_close (fd);
@@ -1592,6 +1797,59 @@ create_socket_name (char *standard_name, int with_homedir)
 
 
 
+/* Take the listening sockets passed by a supervisor like systemd.
+   They are expected as file descriptors starting at 3 and announced
+   by the LISTEN_PID and LISTEN_FDS environment variables.  The first
+   socket is used for the standard socket and, with ssh support
+   enabled, the second one for the ssh socket.  The function
+   terminates the process in case of an error.  */
+static void
+get_supervised_sockets (gnupg_fd_t *r_fd, gnupg_fd_t *r_fd_ssh)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)r_fd;
+  (void)r_fd_ssh;
+  log_error ("option '%s' is not supported on this platform\n",
+             "--supervised");
+  agent_exit (2);
+#else /*!HAVE_W32_SYSTEM*/
+  const char *s;
+  int nfds;
+
+  s = getenv ("LISTEN_PID");
+  if (!s || strtoul (s, NULL, 10) != (unsigned long)getpid ())
+    {
+      log_error ("no sockets have been passed by the supervisor\n");
+      agent_exit (2);
+    }
+  s = getenv ("LISTEN_FDS");
+  nfds = s? atoi (s) : 0;
+  if (nfds < 1 || (opt.ssh_support && nfds < 2))
+    {
+      log_error ("not enough sockets have been passed by the supervisor\n");
+      agent_exit (2);
+    }
+  gnupg_unsetenv ("LISTEN_PID");
+  gnupg_unsetenv ("LISTEN_FDS");
+  gnupg_unsetenv ("LISTEN_FDNAMES");
+
+  supervised = 1;
+  /* The socket file belongs to the supervisor; a new agent taking it
+     over is not possible.  */
+  disable_check_own_socket = 1;
+
+  socket_name = create_socket_name (GPG_AGENT_SOCK_NAME, 1);
+  *r_fd = INT2FD (3);
+  *r_fd_ssh = GNUPG_INVALID_FD;
+  if (opt.ssh_support)
+    {
+      socket_name_ssh = create_socket_name (GPG_AGENT_SSH_SOCK_NAME, 1);
+      *r_fd_ssh = INT2FD (4);
+    }
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
 /* Create a Unix domain socket with NAME.  Returns the file descriptor
    or terminates the process in case of an error.  Note that this
    function needs to be used for the regular socket first (indicated
@@ -1846,6 +2104,7 @@ agent_sighup_action (void)
 
   agent_flush_cache ();
   reread_configuration ();
+  agent_keypool_flush ();
   agent_reload_trustlist ();
   /* We flush the module name cache so that after installing a
      "pinentry" binary that one can be used in case the
@@ -1930,7 +2189,6 @@ check_nonce (ctrl_t ctrl, assuan_sock_nonce_t *nonce)
       log_info (_("error reading nonce on fd %d: %s\n"),
                 FD2INT(ctrl->thread_startup.fd), strerror (errno));
       assuan_sock_close (ctrl->thread_startup.fd);
-      xfree (ctrl);
       return -1;
     }
   else
@@ -2128,14 +2386,16 @@ putty_message_thread (void *arg)
 #endif /*HAVE_W32_SYSTEM*/
 
 
-static void *
-start_connection_thread (ctrl_t ctrl)
+/* Serve a connection on the standard or the extra socket.  */
+static void
+serve_connection (ctrl_t ctrl)
 {
   if (check_nonce (ctrl, &socket_nonce))
     {
       log_error ("handler 0x%lx nonce check FAILED\n",
                  (unsigned long) npth_self());
-      return NULL;
+      agent_deinit_default_ctrl (ctrl);
+      return;
     }
 
   agent_init_default_ctrl (ctrl);
@@ -2149,59 +2409,285 @@ start_connection_thread (ctrl_t ctrl)
               (unsigned long) npth_self(), FD2INT(ctrl->thread_startup.fd));
 
   agent_deinit_default_ctrl (ctrl);
-  xfree (ctrl);
+}
+
+
+/* Serve a connection on the ssh socket.  */
+static void
+serve_connection_ssh (ctrl_t ctrl)
+{
+  if (check_nonce (ctrl, &socket_nonce_ssh))
+    {
+      agent_deinit_default_ctrl (ctrl);
+      return;
+    }
+
+  agent_init_default_ctrl (ctrl);
+  if (opt.verbose)
+    log_info (_("ssh handler 0x%lx for fd %d started\n"),
+              (unsigned long) npth_self(), FD2INT(ctrl->thread_startup.fd));
+
+  start_command_handler_ssh (ctrl, ctrl->thread_startup.fd);
+  if (opt.verbose)
+    log_info (_("ssh handler 0x%lx for fd %d terminated\n"),
+              (unsigned long) npth_self(), FD2INT(ctrl->thread_startup.fd));
+
+  agent_deinit_default_ctrl (ctrl);
+}
+
+
+/* Return a control object for a new connection; either a released
+   one or a new one.  Returns NULL on error with ERRNO set.  Must be
+   called with CONN_POOL_LOCK held.  */
+static ctrl_t
+new_conn_ctrl (void)
+{
+  ctrl_t ctrl;
+
+  if (free_ctrls)
+    {
+      ctrl = free_ctrls;
+      free_ctrls = ctrl->thread_startup.next;
+      nfree_ctrls--;
+      memset (ctrl, 0, sizeof *ctrl);
+    }
+  else if (!(ctrl = xtrycalloc (1, sizeof *ctrl)))
+    return NULL;
+
+  if (!(ctrl->session_env = session_env_new ()))
+    {
+      int saved_errno = errno;
+      xfree (ctrl);
+      gpg_err_set_errno (saved_errno);
+      return NULL;
+    }
+  return ctrl;
+}
+
+
+/* Release CTRL, whose resources have already been released with
+   agent_deinit_default_ctrl.  Must be called with CONN_POOL_LOCK
+   held.  */
+static void
+release_conn_ctrl (ctrl_t ctrl)
+{
+  if (nfree_ctrls < MAX_FREE_CTRLS)
+    {
+      ctrl->thread_startup.next = free_ctrls;
+      free_ctrls = ctrl;
+      nfree_ctrls++;
+    }
+  else
+    xfree (ctrl);
+}
+
+
+/* Return the configured limit for connections of socket type IDX or
+   0 for no limit.  */
+static unsigned int
+conn_class_limit (int idx)
+{
+  switch (idx)
+    {
+    case CONN_STD:   return opt.max_connections;
+    case CONN_EXTRA: return opt.max_extra_connections;
+    case CONN_SSH:   return opt.max_ssh_connections;
+    default:         return 0;
+    }
+}
+
+
+/* Take the next waiting connection whose socket type has a free
+   slot off its queue.  Returns NULL if there is none.  Must be called
+   with CONN_POOL_LOCK held.  */
+static ctrl_t
+take_connection (void)
+{
+  struct conn_class_s *cls;
+  unsigned int limit;
+  ctrl_t ctrl;
+  int idx;
+
+  for (idx=0; idx < DIM (conn_classes); idx++)
+    {
+      cls = conn_classes + idx;
+      limit = conn_class_limit (idx);
+      if (!cls->queue || (limit && cls->nactive >= limit))
+        continue;
+
+      ctrl = cls->queue;
+      cls->queue = ctrl->thread_startup.next;
+      if (!cls->queue)
+        cls->queue_tail = &cls->queue;
+      cls->nqueued--;
+      cls->nactive++;
+      if (cls->nactive > cls->peak)
+        cls->peak = cls->nactive;
+      return ctrl;
+    }
   return NULL;
 }
 
 
-/* This is the standard connection thread's main function.  */
+/* The main function of the connection threads.  A thread serves
+   waiting connections until there are none left and then stays idle
+   for the next connections unless there are already enough idle
+   threads.  */
 static void *
-start_connection_thread_std (void *arg)
+connection_thread (void *arg)
 {
-  ctrl_t ctrl = arg;
+  ctrl_t ctrl;
+  int idx;
+
+  (void)arg;
+
+  npth_mutex_lock (&conn_pool_lock);
+  for (;;)
+    {
+      ctrl = take_connection ();
+      if (!ctrl)
+        {
+          if (idle_conn_threads >= MAX_IDLE_CONNECTION_THREADS)
+            break;
+          idle_conn_threads++;
+          while (!conn_wakeups)
+            npth_cond_wait (&conn_pool_cond, &conn_pool_lock);
+          conn_wakeups--;
+          idle_conn_threads--;
+          continue;
+        }
+      npth_mutex_unlock (&conn_pool_lock);
 
-  return start_connection_thread (ctrl);
+      idx = ctrl->thread_startup.conn_class;
+      if (idx == CONN_SSH)
+        serve_connection_ssh (ctrl);
+      else
+        {
+          ctrl->restricted = (idx == CONN_EXTRA);
+          serve_connection (ctrl);
+        }
+
+      npth_mutex_lock (&conn_pool_lock);
+      release_conn_ctrl (ctrl);
+      conn_classes[idx].nactive--;
+      active_connections--;
+    }
+  conn_threads--;
+  npth_mutex_unlock (&conn_pool_lock);
+  return NULL;
 }
 
 
-/* This is the extra socket connection thread's main function.  */
-static void *
-start_connection_thread_extra (void *arg)
+/* Queue the new connection FD of socket type IDX and make sure that a
+   connection thread takes care of it.  New threads are created with
+   TATTR.  */
+static void
+queue_connection (npth_attr_t *tattr, int idx, gnupg_fd_t fd)
 {
-  ctrl_t ctrl = arg;
+  struct conn_class_s *cls = conn_classes + idx;
+  unsigned int limit = conn_class_limit (idx);
+  ctrl_t ctrl, *ctrlp;
+  npth_t thread;
+  int ret;
+
+  npth_mutex_lock (&conn_pool_lock);
+  if (cls->nqueued >= MAX_QUEUED_CONNECTIONS)
+    {
+      log_error ("too many waiting connections for %s - closing fd %d\n",
+                 cls->name, FD2INT (fd));
+      cls->rejected++;
+      assuan_sock_close (fd);
+      goto leave;
+    }
 
-  ctrl->restricted = 1;
-  return start_connection_thread (ctrl);
+  if (!(ctrl = new_conn_ctrl ()))
+    {
+      log_error ("error allocating connection data for %s: %s\n",
+                 cls->name, strerror (errno) );
+      assuan_sock_close (fd);
+      goto leave;
+    }
+  ctrl->thread_startup.fd = fd;
+  ctrl->thread_startup.conn_class = idx;
+
+  *cls->queue_tail = ctrl;
+  cls->queue_tail = &ctrl->thread_startup.next;
+  cls->nqueued++;
+  cls->accepted++;
+  active_connections++;
+
+  if (limit && cls->nactive >= limit)
+    cls->delayed++;  /* Served as soon as a slot is free.  */
+  else if (idle_conn_threads > conn_wakeups)
+    {
+      conn_wakeups++;
+      npth_cond_signal (&conn_pool_cond);
+    }
+  else if ((ret = npth_create (&thread, tattr, connection_thread, NULL)))
+    {
+      log_error ("error spawning connection handler for %s: %s\n",
+                 cls->name, strerror (ret));
+      for (ctrlp = &cls->queue; *ctrlp != ctrl;
+           ctrlp = &(*ctrlp)->thread_startup.next)
+        ;
+      *ctrlp = NULL;
+      cls->queue_tail = ctrlp;
+      cls->nqueued--;
+      active_connections--;
+      assuan_sock_close (fd);
+      session_env_release (ctrl->session_env);
+      release_conn_ctrl (ctrl);
+    }
+  else
+    conn_threads++;
+
+ leave:
+  npth_mutex_unlock (&conn_pool_lock);
 }
 
 
-/* This is the ssh connection thread's main function.  */
-static void *
-start_connection_thread_ssh (void *arg)
+/* Format the statistics of the connections of socket type IDX into
+   BUFFER of SIZE bytes.  IDX one past the last socket type gives the
+   statistics of the connection threads.  Returns false if IDX is out
+   of range.  */
+int
+get_agent_connection_stats (int idx, char *buffer, size_t size)
 {
-  ctrl_t ctrl = arg;
+  struct conn_class_s *cls;
 
-  if (check_nonce (ctrl, &socket_nonce_ssh))
-    return NULL;
+  if (idx < 0 || idx > DIM (conn_classes))
+    return 0;
+  if (idx == DIM (conn_classes))
+    {
+      snprintf (buffer, size, "threads total=%u idle=%u",
+                conn_threads, idle_conn_threads);
+      return 1;
+    }
+  cls = conn_classes + idx;
+  snprintf (buffer, size,
+            "%s active=%u peak=%u queued=%u limit=%u"
+            " accepted=%lu delayed=%lu rejected=%lu",
+            cls->name, cls->nactive, cls->peak, cls->nqueued,
+            conn_class_limit (idx),
+            cls->accepted, cls->delayed, cls->rejected);
+  return 1;
+}
 
-  agent_init_default_ctrl (ctrl);
-  if (opt.verbose)
-    log_info (_("ssh handler 0x%lx for fd %d started\n"),
-              (unsigned long) npth_self(), FD2INT(ctrl->thread_startup.fd));
 
-  start_command_handler_ssh (ctrl, ctrl->thread_startup.fd);
-  if (opt.verbose)
-    log_info (_("ssh handler 0x%lx for fd %d terminated\n"),
-              (unsigned long) npth_self(), FD2INT(ctrl->thread_startup.fd));
+/* The thread looking up the S2K count so that the first request
+   which protects a key does not have to wait for its calibration.  */
+static void *
+s2k_calibration_thread (void *arg)
+{
+  (void)arg;
 
-  agent_deinit_default_ctrl (ctrl);
-  xfree (ctrl);
+  get_standard_s2k_count ();
   return NULL;
 }
 
 
-/* Connection handler loop.  Wait for connection requests and spawn a
-   thread after accepting a connection.  */
+/* Connection handler loop.  Wait for connection requests and hand
+   them over to the connection threads after accepting them.  */
 static void
 handle_connections (gnupg_fd_t listen_fd,
                     gnupg_fd_t listen_fd_extra,
@@ -2222,15 +2708,8 @@ handle_connections (gnupg_fd_t listen_fd,
   HANDLE events[2];
   unsigned int events_set;
 #endif
-  struct {
-    const char *name;
-    void *(*func) (void *arg);
-    gnupg_fd_t l_fd;
-  } listentbl[] = {
-    { "std",  start_connection_thread_std   },
-    { "extra",start_connection_thread_extra },
-    { "ssh",  start_connection_thread_ssh   }
-  };
+  gnupg_fd_t listentbl[DIM (conn_classes)];
+  int idx;
 
 
   ret = npth_attr_init(&tattr);
@@ -2239,6 +2718,15 @@ handle_connections (gnupg_fd_t listen_fd,
 	       strerror (ret));
   npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
 
+  ret = npth_mutex_init (&conn_pool_lock, NULL);
+  if (!ret)
+    ret = npth_cond_init (&conn_pool_cond, NULL);
+  if (ret)
+    log_fatal ("error initializing the connection pool: %s\n",
+               strerror (ret));
+  for (idx=0; idx < DIM (conn_classes); idx++)
+    conn_classes[idx].queue_tail = &conn_classes[idx].queue;
+
 #ifndef HAVE_W32_SYSTEM
   npth_sigev_init ();
   npth_sigev_add (SIGHUP);
@@ -2274,6 +2762,21 @@ handle_connections (gnupg_fd_t listen_fd,
     }
 #endif /*HAVE_W32_SYSTEM*/
 
+  /* Continue a vanity key search interrupted by the last shutdown.  */
+  agent_vanity_resume ();
+
+  /* Start filling the key pool.  */
+  agent_keypool_flush ();
+
+  {
+    npth_t thread;
+
+    ret = npth_create (&thread, &tattr, s2k_calibration_thread, NULL);
+    if (ret)
+      log_error ("error spawning the S2K calibration thread: %s\n",
+                 strerror (ret));
+  }
+
   /* Set a flag to tell call-scd.c that it may enable event
      notifications.  */
   opt.sigusr2_enabled = 1;
@@ -2294,9 +2797,9 @@ handle_connections (gnupg_fd_t listen_fd,
         nfd = FD2INT (listen_fd_ssh);
     }
 
-  listentbl[0].l_fd = listen_fd;
-  listentbl[1].l_fd = listen_fd_extra;
-  listentbl[2].l_fd = listen_fd_ssh;
+  listentbl[CONN_STD] = listen_fd;
+  listentbl[CONN_EXTRA] = listen_fd_extra;
+  listentbl[CONN_SSH] = listen_fd_ssh;
 
   npth_clock_gettime (&abstime);
   abstime.tv_sec += TIMERTICK_INTERVAL;
@@ -2362,51 +2865,23 @@ handle_connections (gnupg_fd_t listen_fd,
 
       if (!shutdown_pending)
         {
-          int idx;
-          ctrl_t ctrl;
-          npth_t thread;
-
           for (idx=0; idx < DIM(listentbl); idx++)
             {
-              if (listentbl[idx].l_fd == GNUPG_INVALID_FD)
+              if (listentbl[idx] == GNUPG_INVALID_FD)
                 continue;
-              if (!FD_ISSET (FD2INT (listentbl[idx].l_fd), &read_fdset))
+              if (!FD_ISSET (FD2INT (listentbl[idx]), &read_fdset))
                 continue;
 
               plen = sizeof paddr;
-              fd = INT2FD (npth_accept (FD2INT(listentbl[idx].l_fd),
+              fd = INT2FD (npth_accept (FD2INT(listentbl[idx]),
                                         (struct sockaddr *)&paddr, &plen));
               if (fd == GNUPG_INVALID_FD)
                 {
                   log_error ("accept failed for %s: %s\n",
-                             listentbl[idx].name, strerror (errno));
-                }
-              else if ( !(ctrl = xtrycalloc (1, sizeof *ctrl)))
-                {
-                  log_error ("error allocating connection data for %s: %s\n",
-                             listentbl[idx].name, strerror (errno) );
-                  assuan_sock_close (fd);
-                }
-              else if ( !(ctrl->session_env = session_env_new ()))
-                {
-                  log_error ("error allocating session env block for %s: %s\n",
-                             listentbl[idx].name, strerror (errno) );
-                  xfree (ctrl);
-                  assuan_sock_close (fd);
+                             conn_classes[idx].name, strerror (errno));
                 }
               else
-                {
-                  ctrl->thread_startup.fd = fd;
-                  ret = npth_create (&thread, &tattr,
-                                     listentbl[idx].func, ctrl);
-                  if (ret)
-                    {
-                      log_error ("error spawning connection handler for %s:"
-                                 " %s\n", listentbl[idx].name, strerror (ret));
-                      assuan_sock_close (fd);
-                      xfree (ctrl);
-                    }
-                }
+                queue_connection (&tattr, idx, fd);
               fd = GNUPG_INVALID_FD;
             }
         }
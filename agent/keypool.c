@@ -0,0 +1,331 @@
+/* keypool.c - A pool of pregenerated keys for GENKEY
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Generating an RSA or Elgamal key of 3072 bits or more takes
+   seconds.  With --key-pool the agent keeps --key-pool-size keys of
+   each of the listed kinds ready, so that a GENKEY with exactly the
+   key parameters gpg uses for such a key returns at once.  The keys
+   are generated by a refill thread which runs only while the pool is
+   not full and, where the system allows it, with the idle scheduling
+   priority, so that it takes only CPU time nobody else wants.
+
+   The keys stay in secure memory: Libgcrypt allocates the secret
+   parts of a generated key there and then also the S-expression
+   holding them.  That memory is small, thus the pool holds at most
+   MAX_POOL_BITS bits of keys in all.  A key is removed from the pool
+   before it is handed out, thus no key is returned twice, and the
+   whole pool is wiped when the agent flushes its caches on SIGHUP.
+   The pool is not kept across a restart.  All state is only touched
+   while holding the npth lock.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+#if defined(HAVE_SCHED_SETSCHEDULER)
+# include <sched.h>
+#endif
+
+#include "agent.h"
+
+
+/* The number of kinds of keys the pool can hold.  */
+#define MAX_SLOTS 8
+
+/* The most keys kept of one kind.  */
+#define MAX_SLOT_KEYS 8
+
+/* The most bits of all keys kept.  A private RSA key of N bits takes
+   about N/2 bytes of secure memory, thus this is at most a third of
+   the 32 KiB the agent has.  */
+#define MAX_POOL_BITS (5 * 4096)
+
+/* The sizes accepted by --key-pool; the same range gpg allows.  */
+#define MIN_POOL_NBITS 1024
+#define MAX_POOL_NBITS 4096
+
+
+/* The keys of one kind.  */
+struct slot_s
+{
+  char name[16];                    /* As given with --key-pool.  */
+  gcry_sexp_t keyparam;
+  unsigned int nbits;
+  unsigned int nkeys;
+  gcry_sexp_t keys[MAX_SLOT_KEYS];  /* Each the result of gcry_pk_genkey.  */
+  int failed;                       /* Do not try again until a flush.  */
+};
+
+static struct slot_s slots[MAX_SLOTS];
+static unsigned int nslots;
+
+/* The keys wanted of each kind.  */
+static unsigned int pool_size;
+
+/* The bits of all keys in the pool.  */
+static unsigned int pool_bits;
+
+/* Incremented by each flush so that a key generated across a flush
+   is dropped.  */
+static unsigned int pool_generation;
+
+/* Set while the refill thread runs.  */
+static int refill_running;
+
+
+
+/* Set up SLOT for the kind NAME, which is of the form "rsa3072" or
+   "elg3072".  The key parameters are those gpg sends for a key of
+   that kind which is not transient.  */
+static gpg_error_t
+init_slot (struct slot_s *slot, const char *name, size_t namelen)
+{
+  const char *algo;
+  unsigned long nbits;
+  char *endp;
+  char nbitsstr[35];
+
+  memset (slot, 0, sizeof *slot);
+  if (namelen > 3 && !ascii_strncasecmp (name, "rsa", 3))
+    algo = "rsa";
+  else if (namelen > 3 && !ascii_strncasecmp (name, "elg", 3))
+    algo = "openpgp-elg";
+  else
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+  nbits = strtoul (name + 3, &endp, 10);
+  if (endp != name + namelen || nbits < MIN_POOL_NBITS
+      || nbits > MAX_POOL_NBITS || (nbits % 32))
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  memcpy (slot->name, name, namelen);
+  slot->name[namelen] = 0;
+  slot->nbits = nbits;
+  snprintf (nbitsstr, sizeof nbitsstr, "%lu", nbits);
+  return gcry_sexp_build (&slot->keyparam, NULL, "(genkey(%s(nbits%s)))",
+                          algo, nbitsstr);
+}
+
+
+/* Release all keys of the pool.  */
+static void
+clear_pool (void)
+{
+  unsigned int i, k;
+
+  for (i=0; i < nslots; i++)
+    {
+      for (k=0; k < slots[i].nkeys; k++)
+        gcry_sexp_release (slots[i].keys[k]);
+      gcry_sexp_release (slots[i].keyparam);
+    }
+  memset (slots, 0, sizeof slots);
+  nslots = 0;
+  pool_bits = 0;
+  pool_generation++;
+}
+
+
+/* Return the slot which shall get the next key or NULL if the pool
+   is full.  The kind with the fewest keys comes first.  */
+static struct slot_s *
+next_slot (void)
+{
+  struct slot_s *slot = NULL;
+  unsigned int i;
+
+  for (i=0; i < nslots; i++)
+    if (!slots[i].failed && slots[i].nkeys < pool_size
+        && pool_bits + slots[i].nbits <= MAX_POOL_BITS
+        && (!slot || slots[i].nkeys < slot->nkeys))
+      slot = slots + i;
+  return slot;
+}
+
+
+/* The thread function of the refill thread.  It ends when the pool
+   is full.  */
+static void *
+refill_thread (void *arg)
+{
+  struct slot_s *slot;
+  gcry_sexp_t keyparam, s_key;
+  unsigned int generation, nbits;
+  char name[sizeof slot->name];
+  gpg_error_t err;
+
+  (void)arg;
+#if defined(HAVE_SCHED_SETSCHEDULER) && defined(SCHED_IDLE)
+  {
+    struct sched_param param;
+
+    /* This applies to the calling thread only.  */
+    memset (&param, 0, sizeof param);
+    sched_setscheduler (0, SCHED_IDLE, &param);
+  }
+#endif
+
+  while ((slot = next_slot ()))
+    {
+      /* The slot may be gone when the generation returns.  */
+      generation = pool_generation;
+      nbits = slot->nbits;
+      strcpy (name, slot->name);
+      err = gcry_sexp_build (&keyparam, NULL, "%S", slot->keyparam);
+      if (!err)
+        {
+          npth_unprotect ();
+          err = gcry_pk_genkey (&s_key, keyparam);
+          npth_protect ();
+          gcry_sexp_release (keyparam);
+        }
+      if (generation != pool_generation)
+        {
+          if (!err)
+            gcry_sexp_release (s_key);
+          continue;
+        }
+      if (err)
+        {
+          log_error ("error generating a %s key for the key pool: %s\n",
+                     name, gpg_strerror (err));
+          slot->failed = 1;
+          continue;
+        }
+      slot->keys[slot->nkeys++] = s_key;
+      pool_bits += nbits;
+      if (DBG_CRYPTO)
+        log_debug ("key pool holds %u %s keys\n", slot->nkeys, name);
+    }
+
+  refill_running = 0;
+  return NULL;
+}
+
+
+/* Start the refill thread unless it is already running or the pool
+   is full.  */
+static void
+start_refill (void)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  int rc;
+
+  if (refill_running || !next_slot ())
+    return;
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      refill_running = 1;
+      rc = npth_create (&thread, &tattr, refill_thread, NULL);
+      npth_attr_destroy (&tattr);
+    }
+  if (rc)
+    {
+      refill_running = 0;
+      log_error ("error spawning the key pool thread: %s\n", strerror (rc));
+      return;
+    }
+  npth_setname_np (thread, "key-pool");
+}
+
+
+
+/* Wipe the key pool and set it up again for the options --key-pool
+   and --key-pool-size.  This is called when the agent starts and
+   after it re-read its options.  */
+void
+agent_keypool_flush (void)
+{
+  const char *s, *e;
+  gpg_error_t err;
+  unsigned int i;
+
+  clear_pool ();
+  pool_size = opt.key_pool_size;
+  if (pool_size > MAX_SLOT_KEYS)
+    pool_size = MAX_SLOT_KEYS;
+  if (!opt.key_pool || !pool_size)
+    return;
+
+  for (s = opt.key_pool; *s; s = *e? e + 1 : e)
+    {
+      for (e = s; *e && *e != ',' && *e != ' '; e++)
+        ;
+      if (e == s)
+        continue;
+      if (nslots == MAX_SLOTS)
+        {
+          log_info ("only %d kinds of keys fit into the key pool\n",
+                    MAX_SLOTS);
+          break;
+        }
+      if ((size_t)(e - s) >= sizeof slots[0].name)
+        err = gpg_error (GPG_ERR_INV_VALUE);
+      else
+        err = init_slot (slots + nslots, s, e - s);
+      if (err)
+        {
+          log_error ("invalid key pool entry '%.*s': %s\n",
+                     (int)(e - s), s, gpg_strerror (err));
+          continue;
+        }
+      for (i=0; i < nslots; i++)
+        if (slots[i].nbits == slots[nslots].nbits
+            && same_sexp (slots[i].keyparam, slots[nslots].keyparam))
+          break;
+      if (i < nslots)
+        gcry_sexp_release (slots[nslots].keyparam);
+      else
+        nslots++;
+    }
+  start_refill ();
+}
+
+
+/* Return a pregenerated key for the key parameters S_KEYPARAM in the
+   format gcry_pk_genkey returns, or NULL if the pool has none.  The
+   key is removed from the pool.  */
+gcry_sexp_t
+agent_keypool_take (gcry_sexp_t s_keyparam)
+{
+  struct slot_s *slot;
+  gcry_sexp_t s_key;
+  unsigned int i;
+
+  for (i=0; i < nslots; i++)
+    if (slots[i].nkeys && same_sexp (slots[i].keyparam, s_keyparam))
+      break;
+  if (i == nslots)
+    return NULL;
+
+  /* Hand out the oldest key.  */
+  slot = slots + i;
+  s_key = slot->keys[0];
+  memmove (slot->keys, slot->keys + 1,
+           (slot->nkeys - 1) * sizeof *slot->keys);
+  slot->keys[--slot->nkeys] = NULL;
+  pool_bits -= slot->nbits;
+  if (DBG_CRYPTO)
+    log_debug ("took a %s key from the key pool\n", slot->name);
+  start_refill ();
+  return s_key;
+}
@@ -0,0 +1,845 @@
+/* keystore.c - The private keys in a single indexed file
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* With --key-store-file the private keys are not kept as one file per
+   key in the private key directory but in the single file STORE_NAME
+   in the home directory.  This saves the directory lookups and the
+   opening of a file for each key, which dominate with many thousands
+   of keys.
+
+   The file starts with the 8 byte magic STORE_MAGIC followed by 8
+   reserved bytes and is otherwise a sequence of records, each with a
+   header of RECORD_HEADER_LEN bytes:
+
+     4 bytes  Length of the data in network byte order.
+     1 byte   The type: RECORD_KEY or RECORD_DELETED.
+     3 bytes  Reserved, 0.
+    20 bytes  The keygrip.
+     4 bytes  The CRC-32 of the data.
+     n bytes  The data: the key exactly as it would be written to the
+              key file, thus the protection of the key is unchanged.
+
+   Records are only appended.  A new record for a keygrip replaces
+   all earlier ones; a RECORD_DELETED record without data removes the
+   key.  The index of the live records is a hash table built by one
+   pass over the record headers when the store is first used; the
+   data is read from a read-only mapping of the file.  A record cut
+   short at the end of the file, which is what a crash during an
+   append leaves, is ignored and overwritten by the next append; any
+   other damage makes the store read-only.
+
+   Once the replaced records take more than half of the file and at
+   least COMPACT_MIN bytes, the live records are copied to a new file
+   which then replaces the store by a rename, thus a crash during the
+   compaction leaves the old store intact.
+
+   If the store does not yet exist, it is created with a copy of the
+   keys in the private key directory.  The files there are not used
+   afterwards but removed along with their keys so that a deleted key
+   does not survive in them.  All state is only touched while holding
+   the npth lock.  */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#include "agent.h"
+#include "../common/host2net.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* The name of the store in the home directory.  */
+#define STORE_NAME "private-keys-v1.store"
+
+#define STORE_MAGIC "GPGAKS1\n"
+#define STORE_HEADER_LEN 16
+
+#define RECORD_HEADER_LEN 32
+#define RECORD_KEY        1
+#define RECORD_DELETED    2
+
+/* The largest key accepted; the same limit gpg-agent has for a key
+   sent to it.  */
+#define MAX_RECORD_DATA (1024 * 1024)
+
+/* The least number of bytes of replaced records for a compaction.  */
+#define COMPACT_MIN (1024 * 1024)
+
+
+/* An entry of the index.  */
+struct slot_s
+{
+  unsigned char grip[20];
+  int state;                /* SLOT_EMPTY, SLOT_USED or SLOT_REMOVED.  */
+  off_t off;                /* The offset of the record.  */
+  size_t len;               /* The length of its data.  */
+};
+#define SLOT_EMPTY   0
+#define SLOT_USED    1
+#define SLOT_REMOVED 2
+
+static char *store_fname;
+static int store_fd = -1;
+static int store_readonly;  /* Set if the store is damaged.  */
+static off_t store_end;     /* The end of the last valid record.  */
+static off_t dead_bytes;    /* The bytes of replaced records.  */
+
+static struct slot_s *slots;
+static size_t nslots;       /* The size of SLOTS, a power of 2.  */
+static size_t nused;        /* The number of live keys.  */
+static size_t nremoved;     /* The number of SLOT_REMOVED entries.  */
+
+#ifdef HAVE_MMAP
+static const unsigned char *store_map;
+static size_t store_map_len;
+#endif
+
+
+
+/* Return the CRC-32 of the LEN bytes at DATA.  */
+static u32
+record_crc (const void *data, size_t len)
+{
+  unsigned char crc[4];
+
+  gcry_md_hash_buffer (GCRY_MD_CRC32, crc, data, len);
+  return buf32_to_u32 (crc);
+}
+
+
+static void
+store_buf32 (unsigned char *p, u32 value)
+{
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+
+/* Return the slot of the index for GRIP: the one holding it or the
+   empty one where it would go.  */
+static struct slot_s *
+find_slot (const unsigned char *grip)
+{
+  struct slot_s *removed = NULL;
+  size_t i;
+
+  /* Keygrips are hash values, thus their first bytes are good
+     enough.  */
+  for (i = buf32_to_size_t (grip) & (nslots - 1); ;
+       i = (i + 1) & (nslots - 1))
+    {
+      if (slots[i].state == SLOT_EMPTY)
+        return removed? removed : slots + i;
+      if (slots[i].state == SLOT_REMOVED)
+        {
+          if (!removed)
+            removed = slots + i;
+        }
+      else if (!memcmp (slots[i].grip, grip, 20))
+        return slots + i;
+    }
+}
+
+
+/* Make sure that the index has room for one more key.  */
+static gpg_error_t
+grow_index (void)
+{
+  struct slot_s *old = slots;
+  size_t oldn = nslots;
+  size_t i;
+
+  if (2 * (nused + nremoved + 1) <= nslots)
+    return 0;
+
+  nslots = oldn? oldn : 1024;
+  while (2 * (nused + 1) > nslots / 2)
+    nslots *= 2;
+  slots = xtrycalloc (nslots, sizeof *slots);
+  if (!slots)
+    {
+      gpg_error_t err = gpg_error_from_syserror ();
+      slots = old;
+      nslots = oldn;
+      return err;
+    }
+  nremoved = 0;
+  for (i=0; i < oldn; i++)
+    if (old[i].state == SLOT_USED)
+      *find_slot (old[i].grip) = old[i];
+  xfree (old);
+  return 0;
+}
+
+
+/* Record in the index that the record at OFF with LEN bytes of data
+   holds the key GRIP, or with DELETED set that it removes it.  */
+static gpg_error_t
+index_record (const unsigned char *grip, off_t off, size_t len, int deleted)
+{
+  gpg_error_t err;
+  struct slot_s *slot;
+
+  err = grow_index ();
+  if (err)
+    return err;
+  slot = find_slot (grip);
+  if (slot->state == SLOT_USED)
+    {
+      dead_bytes += RECORD_HEADER_LEN + slot->len;
+      if (deleted)
+        {
+          slot->state = SLOT_REMOVED;
+          nused--;
+          nremoved++;
+        }
+    }
+  else if (!deleted)
+    {
+      if (slot->state == SLOT_REMOVED)
+        nremoved--;
+      memcpy (slot->grip, grip, 20);
+      slot->state = SLOT_USED;
+      nused++;
+    }
+  if (deleted)
+    dead_bytes += RECORD_HEADER_LEN;
+  else
+    {
+      slot->off = off;
+      slot->len = len;
+    }
+  return 0;
+}
+
+
+/* Map the store for reading unless the mapping already covers it.  */
+static void
+update_map (void)
+{
+#ifdef HAVE_MMAP
+  void *p;
+
+  if (store_end <= (off_t)store_map_len)
+    return;
+  if (store_map)
+    munmap ((void *)store_map, store_map_len);
+  store_map = NULL;
+  store_map_len = 0;
+  p = mmap (NULL, store_end, PROT_READ, MAP_SHARED, store_fd, 0);
+  if (p == MAP_FAILED)
+    {
+      log_info ("can't map '%s': %s\n", store_fname, strerror (errno));
+      return;
+    }
+  store_map = p;
+  store_map_len = store_end;
+#endif /*HAVE_MMAP*/
+}
+
+
+/* Read N bytes at OFF of the store into BUF.  */
+static gpg_error_t
+read_at (off_t off, void *buf, size_t n)
+{
+  ssize_t nread;
+
+#ifdef HAVE_MMAP
+  if (off + (off_t)n <= (off_t)store_map_len)
+    {
+      memcpy (buf, store_map + off, n);
+      return 0;
+    }
+#endif /*HAVE_MMAP*/
+
+  if (lseek (store_fd, off, SEEK_SET) == (off_t)(-1))
+    return gpg_error_from_syserror ();
+  while (n)
+    {
+      nread = read (store_fd, buf, n);
+      if (nread < 0 && errno == EINTR)
+        continue;
+      if (nread < 0)
+        return gpg_error_from_syserror ();
+      if (!nread)
+        return gpg_error (GPG_ERR_EOF);
+      buf = (char*)buf + nread;
+      n -= nread;
+    }
+  return 0;
+}
+
+
+/* Write the N bytes at BUF to FD.  */
+static gpg_error_t
+write_all (int fd, const void *buf, size_t n)
+{
+  ssize_t nwritten;
+
+  while (n)
+    {
+      nwritten = write (fd, buf, n);
+      if (nwritten < 0 && errno == EINTR)
+        continue;
+      if (nwritten < 0)
+        return gpg_error_from_syserror ();
+      buf = (const char*)buf + nwritten;
+      n -= nwritten;
+    }
+  return 0;
+}
+
+
+/* Build the record for GRIP with the LEN bytes of DATA at BUF, which
+   must have room for RECORD_HEADER_LEN + LEN bytes.  */
+static void
+build_record (unsigned char *buf, int type, const unsigned char *grip,
+              const void *data, size_t len)
+{
+  store_buf32 (buf, len);
+  buf[4] = type;
+  buf[5] = buf[6] = buf[7] = 0;
+  memcpy (buf + 8, grip, 20);
+  store_buf32 (buf + 28, record_crc (data, len));
+  if (len)
+    memcpy (buf + RECORD_HEADER_LEN, data, len);
+}
+
+
+/* Forget the index and close the store.  */
+static void
+close_store (void)
+{
+#ifdef HAVE_MMAP
+  if (store_map)
+    munmap ((void *)store_map, store_map_len);
+  store_map = NULL;
+  store_map_len = 0;
+#endif /*HAVE_MMAP*/
+  if (store_fd != -1)
+    close (store_fd);
+  store_fd = -1;
+  xfree (slots);
+  slots = NULL;
+  nslots = nused = nremoved = 0;
+  store_end = dead_bytes = 0;
+  store_readonly = 0;
+}
+
+
+/* Build the index from the records of the store.  */
+static gpg_error_t
+scan_store (void)
+{
+  gpg_error_t err;
+  struct stat st;
+  unsigned char hdr[RECORD_HEADER_LEN];
+  unsigned char *data;
+  off_t off, size;
+  size_t len;
+
+  err = grow_index ();
+  if (err)
+    return err;
+  if (fstat (store_fd, &st))
+    return gpg_error_from_syserror ();
+  size = st.st_size;
+  err = read_at (0, hdr, STORE_HEADER_LEN);
+  if (err || memcmp (hdr, STORE_MAGIC, 8))
+    {
+      log_error ("'%s' is not a key store\n", store_fname);
+      return gpg_error (GPG_ERR_INV_KEYRING);
+    }
+  store_end = size;
+  update_map ();
+
+  for (off = STORE_HEADER_LEN; off < size; off += RECORD_HEADER_LEN + len)
+    {
+      len = 0;
+      if (size - off < RECORD_HEADER_LEN)
+        break;
+      err = read_at (off, hdr, RECORD_HEADER_LEN);
+      if (err)
+        return err;
+      len = buf32_to_size_t (hdr);
+      if ((hdr[4] != RECORD_KEY && hdr[4] != RECORD_DELETED)
+          || (hdr[4] == RECORD_DELETED && len) || len > MAX_RECORD_DATA)
+        {
+          log_error ("key store '%s' is damaged at offset %lu;"
+                     " not writing to it\n",
+                     store_fname, (unsigned long)off);
+          store_readonly = 1;
+          break;
+        }
+      if (size - off - RECORD_HEADER_LEN < (off_t)len)
+        break;
+      if (off + RECORD_HEADER_LEN + (off_t)len == size)
+        {
+          /* A crash may have left the last record with the right size
+             but not its data.  */
+          data = xtrymalloc (len + 1);
+          if (!data)
+            return gpg_error_from_syserror ();
+          err = read_at (off + RECORD_HEADER_LEN, data, len);
+          if (!err && record_crc (data, len) != buf32_to_u32 (hdr + 28))
+            err = gpg_error (GPG_ERR_CHECKSUM);
+          xfree (data);
+          if (err)
+            break;
+        }
+      err = index_record (hdr + 8, off, len, hdr[4] == RECORD_DELETED);
+      if (err)
+        return err;
+    }
+  if (off < size && !store_readonly)
+    log_info ("ignoring %lu bytes of an interrupted write at the end"
+              " of '%s'\n", (unsigned long)(size - off), store_fname);
+  store_end = off;
+  return 0;
+}
+
+
+/* Read the key file HEXGRIP.key of the private key directory.  */
+static gpg_error_t
+read_dir_key (const char *dirname, const char *name,
+              unsigned char **r_buf, size_t *r_len)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  estream_t fp;
+  struct stat st;
+  unsigned char *buf;
+
+  *r_buf = NULL;
+  fname = make_filename (dirname, name, NULL);
+  fp = es_fopen (fname, "rb");
+  xfree (fname);
+  if (!fp)
+    return gpg_error_from_syserror ();
+  if (fstat (es_fileno (fp), &st))
+    err = gpg_error_from_syserror ();
+  else if (!st.st_size || st.st_size > MAX_RECORD_DATA)
+    err = gpg_error (GPG_ERR_INV_LENGTH);
+  else if (!(buf = xtrymalloc (st.st_size)))
+    err = gpg_error_from_syserror ();
+  else if (es_fread (buf, st.st_size, 1, fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (buf);
+    }
+  else
+    {
+      *r_buf = buf;
+      *r_len = st.st_size;
+    }
+  es_fclose (fp);
+  return err;
+}
+
+
+/* Create a new store at FNAME with a copy of the keys of the private
+   key directory.  */
+static gpg_error_t
+create_store (const char *fname)
+{
+  gpg_error_t err = 0;
+  char *tmpname, *dirname;
+  DIR *dir;
+  struct dirent *dir_entry;
+  unsigned char grip[20];
+  unsigned char *data, *rec;
+  size_t len;
+  unsigned int count = 0;
+  int fd;
+
+  tmpname = strconcat (fname, ".tmp", NULL);
+  if (!tmpname)
+    return gpg_error_from_syserror ();
+  fd = open (tmpname, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, S_IRUSR|S_IWUSR);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("can't create '%s': %s\n", tmpname, gpg_strerror (err));
+      xfree (tmpname);
+      return err;
+    }
+  err = write_all (fd, STORE_MAGIC "\0\0\0\0\0\0\0\0", STORE_HEADER_LEN);
+
+  dirname = make_filename (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, NULL);
+  dir = err? NULL : opendir (dirname);
+  while (dir && !err && (dir_entry = readdir (dir)))
+    {
+      if (strlen (dir_entry->d_name) != 44
+          || strcmp (dir_entry->d_name + 40, ".key")
+          || hex2bin (dir_entry->d_name, grip, 20) < 0)
+        continue;
+      err = read_dir_key (dirname, dir_entry->d_name, &data, &len);
+      if (err)
+        {
+          log_error ("key '%s' not copied to the key store: %s\n",
+                     dir_entry->d_name, gpg_strerror (err));
+          err = 0;
+          continue;
+        }
+      rec = xtrymalloc (RECORD_HEADER_LEN + len);
+      if (!rec)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          build_record (rec, RECORD_KEY, grip, data, len);
+          err = write_all (fd, rec, RECORD_HEADER_LEN + len);
+          xfree (rec);
+          count++;
+        }
+      wipememory (data, len);
+      xfree (data);
+    }
+  if (dir)
+    closedir (dir);
+  xfree (dirname);
+
+  if (!err && fsync (fd))
+    err = gpg_error_from_syserror ();
+  if (close (fd) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err && rename (tmpname, fname))
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      log_error ("error creating '%s': %s\n", fname, gpg_strerror (err));
+      gnupg_remove (tmpname);
+    }
+  else
+    log_info ("created key store '%s' with %u keys\n", fname, count);
+  xfree (tmpname);
+  return err;
+}
+
+
+/* Open the store and build its index unless this has already been
+   done.  */
+static gpg_error_t
+open_store (void)
+{
+  gpg_error_t err;
+
+  if (store_fd != -1)
+    return 0;
+
+  if (!store_fname)
+    {
+      store_fname = make_filename_try (opt.homedir, STORE_NAME, NULL);
+      if (!store_fname)
+        return gpg_error_from_syserror ();
+    }
+  store_fd = open (store_fname, O_RDWR|O_BINARY);
+  if (store_fd == -1 && errno == ENOENT)
+    {
+      err = create_store (store_fname);
+      if (err)
+        return err;
+      store_fd = open (store_fname, O_RDWR|O_BINARY);
+    }
+  if (store_fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("can't open '%s': %s\n", store_fname, gpg_strerror (err));
+      return err;
+    }
+  err = scan_store ();
+  if (err)
+    close_store ();
+  return err;
+}
+
+
+/* Replace the store by a copy of its live records.  */
+static gpg_error_t
+compact_store (void)
+{
+  gpg_error_t err = 0;
+  char *tmpname;
+  unsigned char *buf = NULL;
+  size_t i, n, bufsize = 0;
+  int fd;
+
+  tmpname = strconcat (store_fname, ".tmp", NULL);
+  if (!tmpname)
+    return gpg_error_from_syserror ();
+  fd = open (tmpname, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, S_IRUSR|S_IWUSR);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (tmpname);
+      return err;
+    }
+  err = write_all (fd, STORE_MAGIC "\0\0\0\0\0\0\0\0", STORE_HEADER_LEN);
+  for (i=0; !err && i < nslots; i++)
+    {
+      if (slots[i].state != SLOT_USED)
+        continue;
+      n = RECORD_HEADER_LEN + slots[i].len;
+      if (n > bufsize)
+        {
+          xfree (buf);
+          bufsize = n;
+          buf = xtrymalloc (bufsize);
+          if (!buf)
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+        }
+      err = read_at (slots[i].off, buf, n);
+      if (!err)
+        err = write_all (fd, buf, n);
+    }
+  if (buf)
+    wipememory (buf, bufsize);
+  xfree (buf);
+  if (!err && fsync (fd))
+    err = gpg_error_from_syserror ();
+  if (close (fd) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err && rename (tmpname, store_fname))
+    err = gpg_error_from_syserror ();
+  if (err)
+    gnupg_remove (tmpname);
+  xfree (tmpname);
+  if (err)
+    return err;
+
+  /* The offsets have changed.  */
+  close_store ();
+  err = open_store ();
+  if (!err && opt.verbose)
+    log_info ("compacted key store '%s' to %lu bytes\n",
+              store_fname, (unsigned long)store_end);
+  return err;
+}
+
+
+/* Append the record for GRIP with the LEN bytes of DATA to the store
+   and add it to the index.  */
+static gpg_error_t
+append_record (int type, const unsigned char *grip,
+               const void *data, size_t len)
+{
+  gpg_error_t err;
+  unsigned char *buf;
+  off_t off = store_end;
+
+  if (store_readonly)
+    return gpg_error (GPG_ERR_EACCES);
+  if (len > MAX_RECORD_DATA)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  buf = xtrymalloc (RECORD_HEADER_LEN + len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  build_record (buf, type, grip, data, len);
+  /* An interrupted earlier write is overwritten.  */
+  if (lseek (store_fd, off, SEEK_SET) == (off_t)(-1))
+    err = gpg_error_from_syserror ();
+  else
+    err = write_all (store_fd, buf, RECORD_HEADER_LEN + len);
+  if (!err && fsync (store_fd))
+    err = gpg_error_from_syserror ();
+  wipememory (buf, RECORD_HEADER_LEN + len);
+  xfree (buf);
+  if (err)
+    {
+      log_error ("error writing '%s': %s\n", store_fname, gpg_strerror (err));
+      /* Do not leave a partial record for the next scan.  If that
+         fails too the next append overwrites it.  */
+      if (ftruncate (store_fd, off))
+        log_error ("error truncating '%s': %s\n",
+                   store_fname, strerror (errno));
+      return err;
+    }
+  store_end = off + RECORD_HEADER_LEN + len;
+  err = index_record (grip, off, len, type == RECORD_DELETED);
+  if (err)
+    {
+      /* The index is now incomplete; build it again from the file on
+         the next use.  */
+      close_store ();
+      return err;
+    }
+
+  if (dead_bytes >= COMPACT_MIN && dead_bytes > store_end / 2)
+    {
+      err = compact_store ();
+      if (err)
+        log_error ("error compacting '%s': %s\n",
+                   store_fname, gpg_strerror (err));
+    }
+  return 0;
+}
+
+
+
+/* Store the LENGTH bytes of the key at BUFFER under GRIP.  An
+   existing key is only replaced if FORCE is set.  */
+gpg_error_t
+agent_keystore_put (const unsigned char *grip,
+                    const void *buffer, size_t length, int force)
+{
+  gpg_error_t err;
+  struct slot_s *slot;
+
+  err = open_store ();
+  if (err)
+    return err;
+  slot = find_slot (grip);
+  if (!force && slot->state == SLOT_USED)
+    return gpg_error (GPG_ERR_EEXIST);
+  return append_record (RECORD_KEY, grip, buffer, length);
+}
+
+
+/* Return the key GRIP in a new buffer at R_BUF and its length at
+   R_LEN.  The offset of its record is stored at R_OFF; it changes
+   whenever the key is written.  Returns GPG_ERR_ENOENT if there is no
+   such key.  */
+gpg_error_t
+agent_keystore_get (const unsigned char *grip,
+                    unsigned char **r_buf, size_t *r_len, off_t *r_off)
+{
+  gpg_error_t err;
+  struct slot_s *slot;
+  unsigned char hdr[RECORD_HEADER_LEN];
+  unsigned char *buf;
+
+  *r_buf = NULL;
+  err = open_store ();
+  if (err)
+    return err;
+  slot = find_slot (grip);
+  if (slot->state != SLOT_USED)
+    return gpg_error (GPG_ERR_ENOENT);
+
+  update_map ();
+  buf = xtrymalloc (slot->len + 1);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  err = read_at (slot->off, hdr, RECORD_HEADER_LEN);
+  if (!err)
+    err = read_at (slot->off + RECORD_HEADER_LEN, buf, slot->len);
+  if (!err && (memcmp (hdr + 8, grip, 20)
+               || record_crc (buf, slot->len) != buf32_to_u32 (hdr + 28)))
+    err = gpg_error (GPG_ERR_CHECKSUM);
+  if (err)
+    {
+      log_error ("error reading a key from '%s': %s\n",
+                 store_fname, gpg_strerror (err));
+      xfree (buf);
+      return err;
+    }
+  *r_buf = buf;
+  *r_len = slot->len;
+  *r_off = slot->off;
+  return 0;
+}
+
+
+/* Remove the key GRIP.  Returns GPG_ERR_ENOENT if there is no such
+   key.  */
+gpg_error_t
+agent_keystore_delete (const unsigned char *grip)
+{
+  gpg_error_t err;
+  char hexgrip[40+4+1];
+  char *fname;
+
+  err = open_store ();
+  if (err)
+    return err;
+  if (find_slot (grip)->state != SLOT_USED)
+    return gpg_error (GPG_ERR_ENOENT);
+  err = append_record (RECORD_DELETED, grip, NULL, 0);
+  if (err)
+    return err;
+
+  /* The copy in the key directory, if any, shall not survive.  */
+  bin2hex (grip, 20, hexgrip);
+  strcpy (hexgrip+40, ".key");
+  fname = make_filename (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, hexgrip, NULL);
+  gnupg_remove (fname);
+  xfree (fname);
+  return 0;
+}
+
+
+/* Return true if the store holds the key GRIP.  */
+int
+agent_keystore_has (const unsigned char *grip)
+{
+  return !open_store () && find_slot (grip)->state == SLOT_USED;
+}
+
+
+static int
+compare_grips (const void *a, const void *b)
+{
+  return memcmp (a, b, 20);
+}
+
+
+/* Return a sorted array with the keygrips of all keys of the store
+   at R_GRIPS and their number at R_COUNT.  The caller must release
+   the array.  */
+gpg_error_t
+agent_keystore_list (unsigned char **r_grips, size_t *r_count)
+{
+  gpg_error_t err;
+  unsigned char *grips;
+  size_t i, count;
+
+  *r_grips = NULL;
+  *r_count = 0;
+  err = open_store ();
+  if (err)
+    return err;
+  grips = xtrymalloc (nused? nused * 20 : 1);
+  if (!grips)
+    return gpg_error_from_syserror ();
+  for (i=count=0; i < nslots; i++)
+    if (slots[i].state == SLOT_USED)
+      memcpy (grips + 20 * count++, slots[i].grip, 20);
+  if (count)
+    qsort (grips, count, 20, compare_grips);
+  *r_grips = grips;
+  *r_count = count;
+  return 0;
+}
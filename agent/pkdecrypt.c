@@ -106,7 +106,10 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
 /*           gcry_sexp_dump (s_skey); */
 /*         } */
 
+      double start = agent_trace_start ();
+
       rc = gcry_pk_decrypt (&s_plain, s_cipher, s_skey);
+      agent_trace_end (TRACE_PKDECRYPT, start);
       if (rc)
         {
           log_error ("decryption failed: %s\n", gpg_strerror (rc));
@@ -144,3 +147,117 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
   xfree (shadow_info);
   return rc;
 }
+
+
+/* Decrypt the CIPHERTEXTSLEN bytes at CIPHERTEXTS, which are a
+   sequence of canonical S-expressions, with the key set in CTRL.  The
+   key is read and unprotected only once.  For each ciphertext the
+   plaintext is passed in the format agent_pkdecrypt uses or, if that
+   ciphertext can't be decrypted, as "(error <code>)" to PUT_PLAIN
+   along with OPAQUE, in the order of the ciphertexts.  An error
+   returned by PUT_PLAIN stops the operation.  Keys on a smartcard are
+   not supported because the padding of each result would be needed
+   as well.  */
+int
+agent_pkdecrypt_batch (ctrl_t ctrl, const char *desc_text,
+                       const unsigned char *ciphertexts,
+                       size_t ciphertextslen,
+                       gpg_error_t (*put_plain) (void *opaque,
+                                                 const void *plain,
+                                                 size_t plainlen),
+                       void *opaque)
+{
+  gcry_sexp_t s_skey = NULL, s_cipher, s_plain;
+  unsigned char *shadow_info = NULL;
+  gpg_error_t err;
+  size_t off, n, len;
+  char *buf;
+  char numbuf[35];
+  char errbuf[50];
+  int rc;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  rc = agent_key_from_file (ctrl, NULL, desc_text,
+                            ctrl->keygrip, &shadow_info,
+                            CACHE_MODE_NORMAL, NULL, &s_skey, NULL);
+  if (rc)
+    {
+      if (gpg_err_code (rc) != GPG_ERR_NO_SECKEY)
+        log_error ("failed to read the secret key\n");
+      return rc;
+    }
+  if (shadow_info)
+    {
+      rc = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  for (off=0; off < ciphertextslen; off += n)
+    {
+      n = gcry_sexp_canon_len (ciphertexts + off, ciphertextslen - off,
+                               NULL, &rc);
+      if (!n)
+        break;
+
+      s_plain = NULL;
+      buf = NULL;
+      err = gcry_sexp_sscan (&s_cipher, NULL,
+                             (const char*)ciphertexts + off, n);
+      if (!err)
+        {
+          double start = agent_trace_start ();
+
+          err = gcry_pk_decrypt (&s_plain, s_cipher, s_skey);
+          agent_trace_end (TRACE_PKDECRYPT, start);
+          gcry_sexp_release (s_cipher);
+        }
+      if (!err)
+        {
+          /* Leave room to turn an old style result into a complete
+             S-expression.  */
+          len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON, NULL, 0);
+          buf = xtrymalloc_secure (len + 9);
+          if (!buf)
+            err = gpg_error_from_syserror ();
+          else
+            {
+              len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON,
+                                      buf + 8, len);
+              assert (len);
+              if (buf[8] == '(')
+                memmove (buf, buf + 8, len);
+              else
+                {
+                  memcpy (buf, "(5:value", 8);
+                  buf[8 + len] = ')';
+                  len += 9;
+                }
+            }
+          gcry_sexp_release (s_plain);
+        }
+
+      if (err)
+        {
+          log_error ("decryption failed: %s\n", gpg_strerror (err));
+          snprintf (numbuf, sizeof numbuf, "%u", err);
+          snprintf (errbuf, sizeof errbuf, "(5:error%u:%s)",
+                    (unsigned int)strlen (numbuf), numbuf);
+          rc = put_plain (opaque, errbuf, strlen (errbuf));
+        }
+      else
+        {
+          rc = put_plain (opaque, buf, len);
+          wipememory (buf, len);
+        }
+      xfree (buf);
+      if (rc)
+        break;
+    }
+
+ leave:
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
+  return rc;
+}
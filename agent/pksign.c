@@ -274,50 +274,17 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 
 
 
-/* SIGN whatever information we have accumulated in CTRL and return
-   the signature S-expression.  LOOKUP is an optional function to
-   provide a way for lower layers to ask for the caching TTL.  If a
-   CACHE_NONCE is given that cache item is first tried to get a
-   passphrase.  If OVERRIDEDATA is not NULL, OVERRIDEDATALEN bytes
-   from this buffer are used instead of the data in CTRL.  The
-   override feature is required to allow the use of Ed25519 with ssh
-   because Ed25519 dies the hashing itself.  */
-int
-agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
-                 const char *desc_text,
-		 gcry_sexp_t *signature_sexp,
-                 cache_mode_t cache_mode, lookup_ttl_t lookup_ttl,
-                 const void *overridedata, size_t overridedatalen)
+/* Sign the DATALEN bytes at DATA, a digest of type ALGO, with the
+   secret key S_SKEY or, if SHADOW_INFO is not NULL, with the
+   smartcard it describes.  RAW_VALUE is the flag of the same name
+   from CTRL->digest.  The signature is stored at R_SIG.  */
+static int
+sign_digest (ctrl_t ctrl, gcry_sexp_t s_skey, const unsigned char *shadow_info,
+             const unsigned char *data, int datalen, int algo, int raw_value,
+             gcry_sexp_t *r_sig)
 {
-  gcry_sexp_t s_skey = NULL, s_sig = NULL;
-  unsigned char *shadow_info = NULL;
-  unsigned int rc = 0;		/* FIXME: gpg-error? */
-  const unsigned char *data;
-  int datalen;
-
-  if (overridedata)
-    {
-      data = overridedata;
-      datalen = overridedatalen;
-    }
-  else
-    {
-      data = ctrl->digest.value;
-      datalen = ctrl->digest.valuelen;
-    }
-
-  if (!ctrl->have_keygrip)
-    return gpg_error (GPG_ERR_NO_SECKEY);
-
-  rc = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
-                            &shadow_info, cache_mode, lookup_ttl,
-                            &s_skey, NULL);
-  if (rc)
-    {
-      if (gpg_err_code (rc) != GPG_ERR_NO_SECKEY)
-        log_error ("failed to read the secret key\n");
-      goto leave;
-    }
+  gcry_sexp_t s_sig = NULL;
+  unsigned int rc = 0;
 
   if (shadow_info)
     {
@@ -342,7 +309,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 
       rc = divert_pksign (ctrl,
                           data, datalen,
-                          ctrl->digest.algo,
+                          algo,
                           shadow_info, &buf, &len);
       if (rc)
         {
@@ -433,12 +400,13 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
       /* No smartcard, but a private key */
       gcry_sexp_t s_hash = NULL;
       int dsaalgo;
+      double start;
 
       /* Put the hash into a sexp */
       if (agent_is_eddsa_key (s_skey))
         rc = do_encode_eddsa (data, datalen,
                               &s_hash);
-      else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
+      else if (algo == MD_USER_TLS_MD5SHA1)
         rc = do_encode_raw_pkcs1 (data, datalen,
                                   gcry_pk_get_nbits (s_skey),
                                   &s_hash);
@@ -448,9 +416,9 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
                             &s_hash);
       else
         rc = do_encode_md (data, datalen,
-                           ctrl->digest.algo,
+                           algo,
                            &s_hash,
-                           ctrl->digest.raw_value);
+                           raw_value);
       if (rc)
         goto leave;
 
@@ -461,7 +429,9 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
         }
 
       /* sign */
+      start = agent_trace_start ();
       rc = gcry_pk_sign (&s_sig, s_hash, s_skey);
+      agent_trace_end (TRACE_PKSIGN, start);
       gcry_sexp_release (s_hash);
       if (rc)
         {
@@ -473,6 +443,60 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
         gcry_log_debugsxp ("rslt", s_sig);
     }
 
+ leave:
+  *r_sig = s_sig;
+  return rc;
+}
+
+
+/* SIGN whatever information we have accumulated in CTRL and return
+   the signature S-expression.  LOOKUP is an optional function to
+   provide a way for lower layers to ask for the caching TTL.  If a
+   CACHE_NONCE is given that cache item is first tried to get a
+   passphrase.  If OVERRIDEDATA is not NULL, OVERRIDEDATALEN bytes
+   from this buffer are used instead of the data in CTRL.  The
+   override feature is required to allow the use of Ed25519 with ssh
+   because Ed25519 dies the hashing itself.  */
+int
+agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
+                 const char *desc_text,
+		 gcry_sexp_t *signature_sexp,
+                 cache_mode_t cache_mode, lookup_ttl_t lookup_ttl,
+                 const void *overridedata, size_t overridedatalen)
+{
+  gcry_sexp_t s_skey = NULL, s_sig = NULL;
+  unsigned char *shadow_info = NULL;
+  unsigned int rc = 0;		/* FIXME: gpg-error? */
+  const unsigned char *data;
+  int datalen;
+
+  if (overridedata)
+    {
+      data = overridedata;
+      datalen = overridedatalen;
+    }
+  else
+    {
+      data = ctrl->digest.value;
+      datalen = ctrl->digest.valuelen;
+    }
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  rc = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
+                            &shadow_info, cache_mode, lookup_ttl,
+                            &s_skey, NULL);
+  if (rc)
+    {
+      if (gpg_err_code (rc) != GPG_ERR_NO_SECKEY)
+        log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+
+  rc = sign_digest (ctrl, s_skey, shadow_info, data, datalen,
+                    ctrl->digest.algo, ctrl->digest.raw_value, &s_sig);
+
  leave:
 
   *signature_sexp = s_sig;
@@ -514,3 +538,61 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 
   return rc;
 }
+
+
+/* Sign the NDIGESTS digests at DIGESTS with the key set in CTRL.
+   The key is read and unprotected only once.  For each digest the
+   signature is passed as canonical S-expression to PUT_SIG along
+   with OPAQUE, in the order of DIGESTS; an error returned by PUT_SIG
+   stops the operation.  CACHE_NONCE, DESC_TEXT and CACHE_MODE are
+   used as with agent_pksign.  */
+int
+agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text,
+                    const struct agent_digest_s *digests,
+                    unsigned int ndigests, cache_mode_t cache_mode,
+                    gpg_error_t (*put_sig) (void *opaque,
+                                            const void *sig, size_t siglen),
+                    void *opaque)
+{
+  gcry_sexp_t s_skey = NULL, s_sig;
+  unsigned char *shadow_info = NULL;
+  unsigned char *buf;
+  size_t len;
+  unsigned int i;
+  int rc;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  rc = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
+                            &shadow_info, cache_mode, NULL, &s_skey, NULL);
+  if (rc)
+    {
+      if (gpg_err_code (rc) != GPG_ERR_NO_SECKEY)
+        log_error ("failed to read the secret key\n");
+      return rc;
+    }
+
+  for (i=0; !rc && i < ndigests; i++)
+    {
+      rc = sign_digest (ctrl, s_skey, shadow_info,
+                        digests[i].value, digests[i].valuelen,
+                        digests[i].algo, 0, &s_sig);
+      if (!rc && !s_sig)
+        rc = gpg_error (GPG_ERR_ENOMEM);
+      if (rc)
+        break;
+      rc = make_canon_sexp (s_sig, &buf, &len);
+      gcry_sexp_release (s_sig);
+      if (!rc)
+        {
+          rc = put_sig (opaque, buf, len);
+          xfree (buf);
+        }
+    }
+
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
+  return rc;
+}
@@ -47,6 +47,10 @@
 #define PROT_CIPHER_STRING "aes"
 #define PROT_CIPHER_KEYLEN (128/8)
 
+/* The file in the home directory with the S2K count calibrated on
+   this CPU.  */
+#define S2K_CALIBRATION_FILE "s2k-calibration"
+
 /* Decode an rfc4880 encoded S2K count.  */
 #define S2K_DECODE_COUNT(_val) ((16ul + ((_val) & 15)) << (((_val) >> 4) + 6))
 
@@ -85,6 +89,25 @@ hash_passphrase (const char *passphrase, int hashalgo,
                  int s2kmode,
                  const unsigned char *s2ksalt, unsigned long s2kcount,
                  unsigned char *key, size_t keylen);
+static int
+derive_key (const char *passphrase, int hashalgo,
+            int s2kmode,
+            const unsigned char *s2ksalt, unsigned long s2kcount,
+            unsigned char *key, size_t keylen);
+
+
+/* Functions run before and after the key derivation of a protection
+   or unprotection, which is the costly part of it.  gpg-agent sets
+   them to release the npth lock meanwhile.  */
+static void (*kdf_enter_hook) (void);
+static void (*kdf_leave_hook) (void);
+
+void
+agent_set_kdf_hooks (void (*enter) (void), void (*leave) (void))
+{
+  kdf_enter_hook = enter;
+  kdf_leave_hook = leave;
+}
 
 
 
@@ -188,14 +211,128 @@ calibrate_s2k_count (void)
 
 
 
-/* Return the standard S2K count.  */
+/* Return a string describing the CPU and the hash code on which the
+   S2K count has been calibrated, or NULL if that can't be told.
+   The caller must release the string.  */
+static char *
+s2k_calibration_id (void)
+{
+  estream_t fp;
+  char line[256], *p, *id = NULL;
+
+  fp = es_fopen ("/proc/cpuinfo", "r");
+  if (!fp)
+    return NULL;
+  while (!id && es_fgets (line, sizeof line, fp))
+    {
+      if (strncmp (line, "model name", 10) || !(p = strchr (line, ':')))
+        continue;
+      trim_spaces (++p);
+      if (*p)
+        id = xtryasprintf ("%s/libgcrypt %s", p, gcry_check_version (NULL));
+    }
+  es_fclose (fp);
+  return id;
+}
+
+
+/* Return the S2K count stored for the CPU ID in the home directory
+   or 0 if there is none.  */
+static unsigned long
+read_s2k_calibration (const char *id)
+{
+  char *fname;
+  estream_t fp;
+  char buf[512];
+  size_t len;
+  gcry_sexp_t sexp = NULL, l1;
+  char *string;
+  unsigned long count = 0;
+
+  fname = make_filename (opt.homedir, S2K_CALIBRATION_FILE, NULL);
+  fp = es_fopen (fname, "rb");
+  xfree (fname);
+  if (!fp)
+    return 0;
+  if (!es_read (fp, buf, sizeof buf, &len)
+      && !gcry_sexp_sscan (&sexp, NULL, buf, len))
+    {
+      l1 = gcry_sexp_find_token (sexp, "cpu", 0);
+      string = l1? gcry_sexp_nth_string (l1, 1) : NULL;
+      gcry_sexp_release (l1);
+      if (string && !strcmp (string, id))
+        {
+          gcry_free (string);
+          l1 = gcry_sexp_find_token (sexp, "count", 0);
+          string = l1? gcry_sexp_nth_string (l1, 1) : NULL;
+          gcry_sexp_release (l1);
+          if (string)
+            count = strtoul (string, NULL, 10);
+        }
+      gcry_free (string);
+      gcry_sexp_release (sexp);
+    }
+  es_fclose (fp);
+  return count;
+}
+
+
+/* Store the S2K COUNT calibrated for the CPU ID in the home
+   directory.  */
+static void
+write_s2k_calibration (const char *id, unsigned long count)
+{
+  char *fname;
+  estream_t fp;
+  gcry_sexp_t sexp;
+  char buf[512];
+  size_t len;
+
+  if (gcry_sexp_build (&sexp, NULL, "(s2k-calibration(cpu%s)(count%u))",
+                       id, (unsigned int)count))
+    return;
+  len = gcry_sexp_sprint (sexp, GCRYSEXP_FMT_ADVANCED, buf, sizeof buf);
+  gcry_sexp_release (sexp);
+  if (!len)
+    return;
+  fname = make_filename (opt.homedir, S2K_CALIBRATION_FILE, NULL);
+  fp = es_fopen (fname, "wb,mode=-rw");
+  if (!fp)
+    log_info ("can't create '%s': %s\n", fname, strerror (errno));
+  else
+    {
+      es_fwrite (buf, len, 1, fp);
+      if (es_fclose (fp))
+        log_info ("error writing '%s': %s\n", fname, strerror (errno));
+    }
+  xfree (fname);
+}
+
+
+/* Return the standard S2K count.  The calibrated count is kept in
+   the home directory so that it needs to be measured again only on
+   a different CPU.  */
 unsigned long
 get_standard_s2k_count (void)
 {
   static unsigned long count;
+  char *id;
 
   if (!count)
-    count = calibrate_s2k_count ();
+    {
+      id = opt.homedir? s2k_calibration_id () : NULL;
+      if (id)
+        count = read_s2k_calibration (id);
+      if (!count)
+        {
+          count = calibrate_s2k_count ();
+          if (id)
+            write_s2k_calibration (id, count);
+        }
+      else if (opt.verbose)
+        log_info ("S2K calibration: %lu (stored)\n", count);
+      xfree (id);
+    }
 
   /* Enforce a lower limit.  */
   return count < 65536 ? 65536 : count;
@@ -374,10 +511,10 @@ do_encryption (const unsigned char *protbegin, size_t protlen,
         rc = out_of_core ();
       else
         {
-          rc = hash_passphrase (passphrase, GCRY_MD_SHA1,
-                                3, iv+2*blklen,
-				s2k_count ? s2k_count : get_standard_s2k_count(),
-				key, keylen);
+          rc = derive_key (passphrase, GCRY_MD_SHA1,
+                           3, iv+2*blklen,
+                           s2k_count ? s2k_count : get_standard_s2k_count(),
+                           key, keylen);
           if (!rc)
             rc = gcry_cipher_setkey (hd, key, keylen);
           xfree (key);
@@ -665,8 +802,11 @@ do_decryption (const unsigned char *protected, size_t protectedlen,
         rc = out_of_core ();
       else
         {
-          rc = hash_passphrase (passphrase, GCRY_MD_SHA1,
-                                3, s2ksalt, s2kcount, key, prot_cipher_keylen);
+          double start = agent_trace_start ();
+
+          rc = derive_key (passphrase, GCRY_MD_SHA1,
+                           3, s2ksalt, s2kcount, key, prot_cipher_keylen);
+          agent_trace_end (TRACE_S2K, start);
           if (!rc)
             rc = gcry_cipher_setkey (hd, key, prot_cipher_keylen);
           xfree (key);
@@ -852,14 +992,12 @@ merge_lists (const unsigned char *protectedkey,
 
 
 
-/* Unprotect the key encoded in canonical format.  We assume a valid
-   S-Exp here.  If a protected-at item is available, its value will
-   be stored at protected_at unless this is NULL.  */
-int
-agent_unprotect (ctrl_t ctrl,
-                 const unsigned char *protectedkey, const char *passphrase,
-                 gnupg_isotime_t protected_at,
-                 unsigned char **result, size_t *resultlen)
+/* Worker for agent_unprotect.  */
+static int
+unprotect_key (ctrl_t ctrl,
+               const unsigned char *protectedkey, const char *passphrase,
+               gnupg_isotime_t protected_at,
+               unsigned char **result, size_t *resultlen)
 {
   static struct {
     const char *name; /* Name of the protection method. */
@@ -1097,6 +1235,26 @@ agent_unprotect (ctrl_t ctrl,
   return 0;
 }
 
+/* Unprotect the key encoded in canonical format.  We assume a valid
+   S-Exp here.  If a protected-at item is available, its value will
+   be stored at protected_at unless this is NULL.  */
+int
+agent_unprotect (ctrl_t ctrl,
+                 const unsigned char *protectedkey, const char *passphrase,
+                 gnupg_isotime_t protected_at,
+                 unsigned char **result, size_t *resultlen)
+{
+  double start;
+  int rc;
+
+  start = agent_trace_start ();
+  rc = unprotect_key (ctrl, protectedkey, passphrase, protected_at,
+                      result, resultlen);
+  agent_trace_end (TRACE_UNPROTECT, start);
+  return rc;
+}
+
+
 /* Check the type of the private key, this is one of the constants:
    PRIVATE_KEY_UNKNOWN if we can't figure out the type (this is the
    value 0), PRIVATE_KEY_CLEAR for an unprotected private key.
@@ -1225,6 +1383,26 @@ hash_passphrase (const char *passphrase, int hashalgo,
 }
 
 
+
+/* Run hash_passphrase between the hooks set with
+   agent_set_kdf_hooks.  */
+static int
+derive_key (const char *passphrase, int hashalgo,
+            int s2kmode,
+            const unsigned char *s2ksalt, unsigned long s2kcount,
+            unsigned char *key, size_t keylen)
+{
+  int rc;
+
+  if (kdf_enter_hook)
+    kdf_enter_hook ();
+  rc = hash_passphrase (passphrase, hashalgo, s2kmode, s2ksalt, s2kcount,
+                        key, keylen);
+  if (kdf_leave_hook)
+    kdf_leave_hook ();
+  return rc;
+}
+
 gpg_error_t
 s2k_hash_passphrase (const char *passphrase, int hashalgo,
                      int s2kmode,
@@ -1232,9 +1410,9 @@ s2k_hash_passphrase (const char *passphrase, int hashalgo,
                      unsigned int s2kcount,
                      unsigned char *key, size_t keylen)
 {
-  return hash_passphrase (passphrase, hashalgo, s2kmode, s2ksalt,
-                          S2K_DECODE_COUNT (s2kcount),
-                          key, keylen);
+  return derive_key (passphrase, hashalgo, s2kmode, s2ksalt,
+                     S2K_DECODE_COUNT (s2kcount),
+                     key, keylen);
 }
 
 
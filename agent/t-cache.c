@@ -0,0 +1,280 @@
+/* t-cache.c - Module tests for cache.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <npth.h>
+
+#include "agent.h"
+
+
+#define pass()  do { ; } while(0)
+#define fail()  do { fprintf (stderr, "%s:%d: test failed\n",\
+                              __FILE__,__LINE__);            \
+                     exit (1);                               \
+                   } while(0)
+
+/* The time the tests pretend to run at.  */
+static time_t base_time;
+
+
+/* Let SECONDS pass since the start of the test.  */
+static void
+at_time (int seconds)
+{
+  gnupg_set_time (base_time + seconds, 0);
+}
+
+
+/* Check that the cache returns VALUE for KEY and CACHE_MODE; a VALUE
+   of NULL checks for a miss.  */
+static int
+check_get (const char *key, cache_mode_t cache_mode, const char *value)
+{
+  char *p;
+  int okay;
+
+  p = agent_get_cache (key, cache_mode);
+  okay = value? (p && !strcmp (p, value)) : !p;
+  xfree (p);
+  return okay;
+}
+
+
+/* Stored passphrases are found by key; the modes only separate the
+   user and the nonce entries.  */
+static void
+test_put_get (void)
+{
+  at_time (1);
+  agent_flush_cache ();
+
+  if (agent_put_cache ("A1", CACHE_MODE_NORMAL, "pass-a", 100))
+    fail ();
+  if (!check_get ("A1", CACHE_MODE_NORMAL, "pass-a"))
+    fail ();
+  if (!check_get ("A1", CACHE_MODE_ANY, "pass-a"))
+    fail ();
+  if (!check_get ("A1", CACHE_MODE_SSH, "pass-a"))
+    fail ();
+  if (!check_get ("A1", CACHE_MODE_USER, NULL))
+    fail ();
+  if (!check_get ("A1", CACHE_MODE_NONCE, NULL))
+    fail ();
+  if (!check_get ("A1", CACHE_MODE_IGNORE, NULL))
+    fail ();
+  if (!check_get ("A2", CACHE_MODE_NORMAL, NULL))
+    fail ();
+
+  if (agent_put_cache ("U1", CACHE_MODE_USER, "pass-u", 100))
+    fail ();
+  if (!check_get ("U1", CACHE_MODE_USER, "pass-u"))
+    fail ();
+  if (!check_get ("U1", CACHE_MODE_NORMAL, "pass-u"))
+    fail ();
+
+  /* Replace and delete.  */
+  if (agent_put_cache ("A1", CACHE_MODE_NORMAL, "pass-a2", 100))
+    fail ();
+  if (!check_get ("A1", CACHE_MODE_NORMAL, "pass-a2"))
+    fail ();
+  if (agent_put_cache ("A1", CACHE_MODE_NORMAL, NULL, 0))
+    fail ();
+  if (!check_get ("A1", CACHE_MODE_NORMAL, NULL))
+    fail ();
+
+  /* The ignore mode stores nothing.  */
+  if (agent_put_cache ("I1", CACHE_MODE_IGNORE, "pass-i", 100))
+    fail ();
+  if (!check_get ("I1", CACHE_MODE_ANY, NULL))
+    fail ();
+
+  /* The last stored cache key.  */
+  agent_store_cache_hit ("U1");
+  if (!check_get (NULL, CACHE_MODE_USER, "pass-u"))
+    fail ();
+  agent_store_cache_hit (NULL);
+  if (!check_get (NULL, CACHE_MODE_USER, NULL))
+    fail ();
+
+  agent_flush_cache ();
+  if (!check_get ("U1", CACHE_MODE_USER, NULL))
+    fail ();
+}
+
+
+/* Unprotected keys are only found with CACHE_MODE_KEY and are
+   forgotten along with the passphrase.  */
+static void
+test_keys (void)
+{
+  static const unsigned char key[40] = "0123456789 unprotected key data";
+  unsigned char *p;
+  size_t len;
+
+  at_time (1);
+  agent_flush_cache ();
+
+  if (agent_put_cache ("K1", CACHE_MODE_NORMAL, "pass-k", 100))
+    fail ();
+  if (agent_put_cache_key ("K1", key, sizeof key, 100))
+    fail ();
+  p = agent_get_cache_key ("K1", &len);
+  if (!p || len < sizeof key || memcmp (p, key, sizeof key))
+    fail ();
+  xfree (p);
+  if (!check_get ("K1", CACHE_MODE_NORMAL, "pass-k"))
+    fail ();
+
+  if (agent_put_cache ("K1", CACHE_MODE_NORMAL, NULL, 0))
+    fail ();
+  p = agent_get_cache_key ("K1", &len);
+  if (p || len)
+    fail ();
+}
+
+
+/* The data expires after the TTL since the last access and after the
+   maximum TTL since its creation.  */
+static void
+test_expire (void)
+{
+  at_time (1);
+  agent_flush_cache ();
+
+  opt.max_cache_ttl = 100;
+  if (agent_put_cache ("E1", CACHE_MODE_NORMAL, "pass-e1", 10))
+    fail ();
+  if (agent_put_cache ("E2", CACHE_MODE_NORMAL, "pass-e2", -1))
+    fail ();
+  if (agent_put_cache ("E3", CACHE_MODE_NORMAL, "pass-e3", 10))
+    fail ();
+
+  at_time (6);
+  if (!check_get ("E1", CACHE_MODE_NORMAL, "pass-e1"))
+    fail ();
+  at_time (13);
+  if (!check_get ("E1", CACHE_MODE_NORMAL, "pass-e1"))
+    fail ();
+  if (!check_get ("E3", CACHE_MODE_NORMAL, NULL))
+    fail ();
+  at_time (30);
+  if (!check_get ("E1", CACHE_MODE_NORMAL, NULL))
+    fail ();
+  if (!check_get ("E2", CACHE_MODE_NORMAL, "pass-e2"))
+    fail ();
+
+  /* A reload lowering the maximum TTL applies to existing items.  */
+  opt.max_cache_ttl = 40;
+  at_time (45);
+  if (!check_get ("E2", CACHE_MODE_NORMAL, NULL))
+    fail ();
+
+  /* A new passphrase for an expired slot.  */
+  if (agent_put_cache ("E1", CACHE_MODE_NORMAL, "pass-e1b", 10))
+    fail ();
+  if (!check_get ("E1", CACHE_MODE_NORMAL, "pass-e1b"))
+    fail ();
+
+  opt.max_cache_ttl = 7200;
+  agent_flush_cache ();
+}
+
+
+/* Many items, some of them sharing a key, in a growing table.  Every
+   other one expires early.  */
+static void
+test_many (void)
+{
+  char key[32], value[32];
+  int i;
+
+  at_time (1);
+  agent_flush_cache ();
+
+  for (i=0; i < 2000; i++)
+    {
+      snprintf (key, sizeof key, "M%d", i);
+      snprintf (value, sizeof value, "pass-%d", i);
+      if (agent_put_cache (key, CACHE_MODE_NORMAL, value, (i & 1)? 10 : 1000))
+        fail ();
+      snprintf (value, sizeof value, "user-%d", i);
+      if (agent_put_cache (key, CACHE_MODE_USER, value, 1000))
+        fail ();
+    }
+
+  at_time (20);
+  for (i=0; i < 2000; i++)
+    {
+      snprintf (key, sizeof key, "M%d", i);
+      snprintf (value, sizeof value, "user-%d", i);
+      if (!check_get (key, CACHE_MODE_USER, value))
+        fail ();
+      if (!check_get (key, CACHE_MODE_NONCE, NULL))
+        fail ();
+    }
+  /* With the user entries gone the others show up.  */
+  for (i=0; i < 2000; i++)
+    {
+      snprintf (key, sizeof key, "M%d", i);
+      if (agent_put_cache (key, CACHE_MODE_USER, NULL, 0))
+        fail ();
+      snprintf (value, sizeof value, "pass-%d", i);
+      if (!check_get (key, CACHE_MODE_NORMAL, (i & 1)? NULL : value))
+        fail ();
+    }
+
+  agent_flush_cache ();
+  for (i=0; i < 2000; i += 100)
+    {
+      snprintf (key, sizeof key, "M%d", i);
+      if (!check_get (key, CACHE_MODE_ANY, NULL))
+        fail ();
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  npth_init ();
+  initialize_module_cache ();
+
+  base_time = time (NULL);
+  opt.def_cache_ttl = 600;
+  opt.def_cache_ttl_ssh = 1800;
+  opt.max_cache_ttl = 7200;
+  opt.max_cache_ttl_ssh = 7200;
+
+  test_put_get ();
+  test_keys ();
+  test_expire ();
+  test_many ();
+
+  deinitialize_module_cache ();
+  return 0;
+}
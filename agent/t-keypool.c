@@ -0,0 +1,180 @@
+/* t-keypool.c - Module tests for keypool.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "agent.h"
+
+
+#define pass()  do { ; } while(0)
+#define fail()  do { fprintf (stderr, "%s:%d: test failed\n",\
+                              __FILE__,__LINE__);            \
+                     exit (1);                               \
+                   } while(0)
+
+/* The key parameters gpg sends for an RSA key of 1024 bits.  */
+#define RSA1024 "(genkey(rsa(nbits 4:1024)))"
+
+/* The seconds to wait for the refill thread.  */
+#define MAX_WAIT 60
+
+
+/* Return the key parameters PARMS as S-expression.  */
+static gcry_sexp_t
+keyparam (const char *parms)
+{
+  gcry_sexp_t s_parms;
+
+  if (gcry_sexp_new (&s_parms, parms, 0, 1))
+    fail ();
+  return s_parms;
+}
+
+
+/* Take a key for PARMS from the pool and give the refill thread time
+   until there is one.  */
+static gcry_sexp_t
+wait_for_key (const char *parms)
+{
+  gcry_sexp_t s_parms, s_key;
+  int i;
+
+  s_parms = keyparam (parms);
+  for (i=0; i < 10 * MAX_WAIT; i++)
+    {
+      s_key = agent_keypool_take (s_parms);
+      if (s_key)
+        break;
+      npth_usleep (100000);
+    }
+  gcry_sexp_release (s_parms);
+  return s_key;
+}
+
+
+/* Return true if the pool hands out a key for PARMS right now.  */
+static int
+have_key (const char *parms)
+{
+  gcry_sexp_t s_parms, s_key;
+
+  s_parms = keyparam (parms);
+  s_key = agent_keypool_take (s_parms);
+  gcry_sexp_release (s_parms);
+  gcry_sexp_release (s_key);
+  return !!s_key;
+}
+
+
+/* Check that S_KEY is what gcry_pk_genkey returns for an RSA key of
+   NBITS bits.  */
+static void
+check_key (gcry_sexp_t s_key, unsigned int nbits)
+{
+  gcry_sexp_t s_private, s_public;
+
+  s_private = gcry_sexp_find_token (s_key, "private-key", 0);
+  s_public = gcry_sexp_find_token (s_key, "public-key", 0);
+  if (!s_private || !s_public)
+    fail ();
+  if (gcry_pk_testkey (s_private))
+    fail ();
+  if (gcry_pk_get_nbits (s_public) != nbits)
+    fail ();
+  gcry_sexp_release (s_private);
+  gcry_sexp_release (s_public);
+}
+
+
+/* The keys of the pool are handed out for the key parameters gpg
+   sends, each only once.  */
+static void
+test_take (void)
+{
+  gcry_sexp_t s_key1, s_key2;
+
+  opt.key_pool = "rsa1024,RSA1024 nosuch2048";
+  opt.key_pool_size = 2;
+  agent_keypool_flush ();
+
+  s_key1 = wait_for_key (RSA1024);
+  if (!s_key1)
+    fail ();
+  check_key (s_key1, 1024);
+
+  /* The same parameters in another encoding.  */
+  s_key2 = wait_for_key ("(genkey (rsa (nbits \"1024\")))");
+  if (!s_key2)
+    fail ();
+  check_key (s_key2, 1024);
+  if (same_sexp (s_key1, s_key2))
+    fail ();
+  gcry_sexp_release (s_key1);
+  gcry_sexp_release (s_key2);
+
+  /* Other key parameters do not get a pooled key.  */
+  if (have_key ("(genkey(rsa(nbits 4:2048)))"))
+    fail ();
+  if (have_key ("(genkey(rsa(nbits 4:1024)(transient-key)))"))
+    fail ();
+  if (have_key ("(genkey(ecc(curve 7:Ed25519)(flags eddsa)))"))
+    fail ();
+}
+
+
+/* A flush wipes the pool; without --key-pool it stays empty.  */
+static void
+test_flush (void)
+{
+  gcry_sexp_t s_key;
+
+  opt.key_pool = "rsa1024";
+  opt.key_pool_size = 1;
+  agent_keypool_flush ();
+  s_key = wait_for_key (RSA1024);
+  if (!s_key)
+    fail ();
+  gcry_sexp_release (s_key);
+
+  opt.key_pool = NULL;
+  agent_keypool_flush ();
+  npth_usleep (500000);
+  if (have_key (RSA1024))
+    fail ();
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  npth_init ();
+
+  test_take ();
+  test_flush ();
+
+  return 0;
+}
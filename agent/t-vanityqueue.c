@@ -0,0 +1,324 @@
+/* t-vanityqueue.c - Module tests for vanityqueue.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <npth.h>
+
+#include "agent.h"
+#include "../common/openpgpdefs.h"
+#include "../vanity/vanity.h"
+
+
+#define pass()  do { ; } while(0)
+#define fail()  do { fprintf (stderr, "%s:%d: test failed\n",\
+                              __FILE__,__LINE__);            \
+                     exit (1);                               \
+                   } while(0)
+
+/* The seconds to wait for the scheduler.  */
+#define MAX_WAIT 120
+
+/* The key parameters gpg sends for an Ed25519 key and the same in
+   another encoding.  */
+#define ED25519   "(genkey(ecc(curve 7:Ed25519)(flags eddsa)))"
+#define ED25519_2 "(genkey (ecc (curve \"Ed25519\") (flags eddsa)))"
+
+/* Other key parameters for the same algorithm.  */
+#define ED25519_COMP "(genkey(ecc(curve 7:Ed25519)(flags eddsa comp)))"
+
+
+/* The jobs of each slice as seen when the slice starts.  */
+static struct
+{
+  unsigned int running;
+  unsigned int queued;
+} slices[64];
+static unsigned int nslices;
+
+/* The keys recorded in the result store.  */
+static struct
+{
+  char jobid[17];
+  unsigned char fpr[20];
+  unsigned int match;
+} results[16];
+static unsigned int nresults;
+
+/* The last VANITY_JOB status line.  */
+static char job_status[200];
+
+
+
+/* Replacements for the agent functions the queue uses.  */
+
+gpg_error_t
+agent_write_status (ctrl_t ctrl, const char *keyword, ...)
+{
+  va_list arg_ptr;
+  const char *text;
+
+  (void)ctrl;
+  va_start (arg_ptr, keyword);
+  if (!strcmp (keyword, "VANITY_JOB"))
+    {
+      *job_status = 0;
+      while ((text = va_arg (arg_ptr, const char *)))
+        {
+          if (*job_status)
+            strcat (job_status, " ");
+          strncat (job_status, text,
+                   sizeof job_status - strlen (job_status) - 2);
+        }
+    }
+  va_end (arg_ptr);
+  return 0;
+}
+
+
+gpg_error_t
+agent_vanity_store_key (gcry_sexp_t s_private, const char *passphrase,
+                        unsigned long s2k_count, unsigned char *r_grip)
+{
+  (void)passphrase;
+  (void)s2k_count;
+  if (!gcry_pk_get_keygrip (s_private, r_grip))
+    return gpg_error (GPG_ERR_INV_OBJ);
+  return 0;
+}
+
+
+gpg_error_t
+agent_vanity_record_result (ctrl_t ctrl, const char *pattern,
+                            struct vanity_result_s *result,
+                            const unsigned char *grip)
+{
+  (void)ctrl;
+  (void)pattern;
+  (void)grip;
+  if (nresults == DIM (results))
+    return gpg_error (GPG_ERR_TOO_MANY);
+  strcpy (results[nresults].jobid, result->jobid);
+  memcpy (results[nresults].fpr, result->fpr, 20);
+  results[nresults].match = result->match;
+  nresults++;
+  return 0;
+}
+
+
+gpg_error_t
+agent_vanity_list_results (ctrl_t ctrl, const char *jobid)
+{
+  (void)ctrl;
+  (void)jobid;
+  return 0;
+}
+
+
+gpg_error_t
+agent_vanity_write_cost (ctrl_t ctrl, const char *jobid,
+                         const struct vanity_cost_s *cost)
+{
+  (void)ctrl;
+  (void)jobid;
+  (void)cost;
+  return 0;
+}
+
+
+void
+agent_vanity_release_results (struct vanity_result_s *list)
+{
+  struct vanity_result_s *next;
+
+  for (; list; list = next)
+    {
+      next = list->next;
+      gcry_sexp_release (list->s_private);
+      gcry_sexp_release (list->s_public);
+      xfree (list);
+    }
+}
+
+
+/* This is called once for each slice while its jobs are marked
+   running.  */
+void
+agent_vanity_set_limits (struct vanity_job_s *job)
+{
+  (void)job;
+  if (nslices < DIM (slices))
+    {
+      agent_vanity_queue_counts (&slices[nslices].queued,
+                                 &slices[nslices].running);
+      nslices++;
+    }
+}
+
+
+void
+agent_vanity_open_pool (gcry_sexp_t s_keyparam, struct vanity_pool_s **r_pool)
+{
+  (void)s_keyparam;
+  *r_pool = NULL;
+}
+
+
+void
+agent_vanity_close_pool (struct vanity_pool_s *pool)
+{
+  (void)pool;
+}
+
+
+void
+agent_vanity_metrics_start (struct agent_vanity_metrics_run_s *run)
+{
+  (void)run;
+}
+
+
+void
+agent_vanity_metrics_progress (struct agent_vanity_metrics_run_s *run,
+                               const struct vanity_progress_s *prog)
+{
+  (void)run;
+  (void)prog;
+}
+
+
+void
+agent_vanity_metrics_end (struct agent_vanity_metrics_run_s *run,
+                          struct vanity_job_s *job, gpg_error_t err)
+{
+  (void)run;
+  (void)job;
+  (void)err;
+}
+
+
+
+/* Queue a job for one key for PARMS matching PATTERN and store its
+   ID at R_ID.  */
+static void
+submit (ctrl_t ctrl, const char *parms, const char *pattern, char *r_id)
+{
+  gcry_sexp_t s_parms;
+
+  if (gcry_sexp_new (&s_parms, parms, 0, 1))
+    fail ();
+  if (agent_vanity_submit (ctrl, s_parms, pattern, NULL, 0,
+                           PUBKEY_ALGO_EDDSA, 1, MAX_WAIT, 0, 0, NULL, r_id))
+    fail ();
+  gcry_sexp_release (s_parms);
+}
+
+
+/* Wait until the queue has no active jobs.  */
+static void
+wait_for_queue (void)
+{
+  unsigned int queued, running;
+  int i;
+
+  for (i=0; i < 10 * MAX_WAIT; i++)
+    {
+      agent_vanity_queue_counts (&queued, &running);
+      if (!queued && !running)
+        return;
+      npth_usleep (100000);
+    }
+  fail ();
+}
+
+
+/* Check that the job ID is done with one key whose keyid ends in the
+   hex digit DIGIT followed by any other.  The job is removed from the
+   queue.  */
+static void
+check_job (ctrl_t ctrl, const char *id, int digit)
+{
+  unsigned int i, n;
+
+  if (agent_vanity_queue_result (ctrl, id))
+    fail ();
+  if (strncmp (job_status, id, 16)
+      || strncmp (job_status + 16, " done ", 6))
+    fail ();
+  for (n=i=0; i < nresults; i++)
+    if (!strcmp (results[i].jobid, id))
+      {
+        n++;
+        if ((results[i].fpr[19] >> 4) != digit || results[i].match)
+          fail ();
+      }
+  if (n != 1)
+    fail ();
+  if (agent_vanity_queue_status (ctrl, id) != gpg_error (GPG_ERR_NOT_FOUND))
+    fail ();
+}
+
+
+/* Jobs for the same key parameters are searched for in one slice;
+   a job for other parameters is never part of it.  */
+static void
+test_merge (ctrl_t ctrl)
+{
+  char id_a[17], id_b[17], id_c[17];
+  unsigned int i;
+
+  nslices = nresults = 0;
+  submit (ctrl, ED25519, "A?", id_a);
+  submit (ctrl, ED25519_2, "B?", id_b);
+  submit (ctrl, ED25519_COMP, "C?", id_c);
+  wait_for_queue ();
+
+  /* The first slice serves the first two jobs.  */
+  if (!nslices || slices[0].running != 2 || slices[0].queued != 1)
+    fail ();
+  for (i=0; i < nslices; i++)
+    if (slices[i].running > 2 || slices[i].running + slices[i].queued > 3)
+      fail ();
+
+  check_job (ctrl, id_a, 0xa);
+  check_job (ctrl, id_b, 0xb);
+  check_job (ctrl, id_c, 0xc);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  ctrl_t ctrl;
+
+  (void)argc;
+  (void)argv;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  npth_init ();
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+  test_merge (ctrl);
+  xfree (ctrl);
+
+  return 0;
+}
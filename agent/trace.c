@@ -0,0 +1,121 @@
+/* trace.c - Timing of the processing stages of the agent
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The trace points record how long the stages of a request take:
+   waiting for the pinentry and scdaemon locks, reading and parsing a
+   key file, unprotecting a key, the S2K, the public key operations
+   and the time a pinentry or the scdaemon is in use.  For each point
+   the number of events, the total and the largest time are kept;
+   "GETINFO stats" returns them.  The counters are only updated while
+   holding the npth lock and thus need no lock of their own.
+
+   If the system provides <sys/sdt.h>, each event also fires the
+   static probe gpg_agent:trace with the name of the point and the
+   time in microseconds as arguments.  Such a probe costs nothing
+   unless a tracer like perf or systemtap is attached.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#ifdef HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+#endif
+
+#include "agent.h"
+
+
+static struct
+{
+  const char *name;
+  unsigned long count;
+  double seconds;
+  double max;
+} trace_points[] =
+  {
+    { "lock-wait" },
+    { "key-read" },
+    { "sexp-parse" },
+    { "unprotect" },
+    { "s2k" },
+    { "pksign" },
+    { "pkdecrypt" },
+    { "pinentry" },
+    { "scdaemon" }
+  };
+
+
+/* Return the current time in seconds.  */
+double
+agent_trace_start (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+  {
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+}
+
+
+/* Record an event of POINT which started at START, a value returned
+   by agent_trace_start.  */
+void
+agent_trace_end (enum agent_trace_point point, double start)
+{
+  double used;
+
+  if (point < 0 || point >= DIM (trace_points))
+    return;
+  used = agent_trace_start () - start;
+  if (used < 0)
+    used = 0;
+  trace_points[point].count++;
+  trace_points[point].seconds += used;
+  if (used > trace_points[point].max)
+    trace_points[point].max = used;
+#ifdef HAVE_SYS_SDT_H
+  DTRACE_PROBE2 (gpg_agent, trace, trace_points[point].name,
+                 (unsigned long)(used * 1e6));
+#endif
+}
+
+
+/* Format the counters of trace point IDX into BUFFER of SIZE bytes.
+   The times are given in microseconds.  Returns false if IDX is out
+   of range.  */
+int
+agent_trace_stats (int idx, char *buffer, size_t size)
+{
+  if (idx < 0 || idx >= DIM (trace_points))
+    return 0;
+  snprintf (buffer, size, "%s count=%lu total=%lu max=%lu",
+            trace_points[idx].name, trace_points[idx].count,
+            (unsigned long)(trace_points[idx].seconds * 1e6),
+            (unsigned long)(trace_points[idx].max * 1e6));
+  return 1;
+}
@@ -53,6 +53,11 @@ typedef struct trustitem_s trustitem_t;
 /* Malloced table and its allocated size with all trust items. */
 static trustitem_t *trusttable;
 static size_t trusttablesize;
+/* Hash index into TRUSTTABLE.  Each slot holds the index of an item
+   plus one or 0 for an empty slot; the number of slots is a power of
+   two and larger than twice the number of items.  */
+static unsigned int *trusthash;
+static size_t trusthashsize;
 /* A mutex used to protect the table. */
 static npth_mutex_t trusttable_lock;
 
@@ -125,6 +130,69 @@ clear_trusttable (void)
   xfree (trusttable);
   trusttable = NULL;
   trusttablesize = 0;
+  xfree (trusthash);
+  trusthash = NULL;
+  trusthashsize = 0;
+}
+
+
+/* Return the hash slot to start the search for FPR.  The fingerprint
+   is a hash value itself.  */
+static inline size_t
+trusthash_slot (const unsigned char *fpr, size_t hashsize)
+{
+  return (((size_t)fpr[0] << 24 | fpr[1] << 16 | fpr[2] << 8 | fpr[3])
+          & (hashsize - 1));
+}
+
+
+/* Build the hash index for the NITEMS items of TABLE and store it at
+   R_HASH and R_HASHSIZE.  Only the first of several items with the
+   same fingerprint is indexed, so that a lookup finds the same item
+   as a linear search.  */
+static gpg_error_t
+build_trusthash (trustitem_t *table, size_t nitems,
+                 unsigned int **r_hash, size_t *r_hashsize)
+{
+  unsigned int *hash;
+  size_t hashsize, idx, slot;
+
+  for (hashsize = 16; hashsize <= 2 * nitems; hashsize *= 2)
+    ;
+  hash = xtrycalloc (hashsize, sizeof *hash);
+  if (!hash)
+    return gpg_error_from_syserror ();
+
+  for (idx=0; idx < nitems; idx++)
+    {
+      for (slot = trusthash_slot (table[idx].fpr, hashsize);
+           hash[slot]; slot = (slot + 1) & (hashsize - 1))
+        if (!memcmp (table[hash[slot]-1].fpr, table[idx].fpr, 20))
+          break;
+      if (!hash[slot])
+        hash[slot] = idx + 1;
+    }
+
+  *r_hash = hash;
+  *r_hashsize = hashsize;
+  return 0;
+}
+
+
+/* Return the item for the binary fingerprint FPR or NULL.  The
+   trusttable is assumed to be locked.  */
+static trustitem_t *
+find_trustitem (const unsigned char *fpr)
+{
+  size_t slot;
+
+  if (!trusthash)
+    return NULL;
+  for (slot = trusthash_slot (fpr, trusthashsize);
+       trusthash[slot]; slot = (slot + 1) & (trusthashsize - 1))
+    if (!memcmp (trusttable[trusthash[slot]-1].fpr, fpr, 20))
+      return trusttable + trusthash[slot] - 1;
+  return NULL;
 }
 
 
@@ -335,6 +403,8 @@ read_trustfiles (void)
   trustitem_t *table, *ti;
   int tableidx;
   size_t tablesize;
+  unsigned int *hash;
+  size_t hashsize;
   char *fname;
   int allow_include = 1;
 
@@ -362,19 +432,20 @@ read_trustfiles (void)
                             &table, &tablesize, &tableidx);
   xfree (fname);
 
-  if (err)
+  if (gpg_err_code (err) == GPG_ERR_ENOENT)
+    {
+      /* Take a missing trustlist as an empty one.  The empty table
+         is kept so that the file is not looked for on each query.  */
+      tableidx = 0;
+      err = 0;
+    }
+  else if (err)
     {
       xfree (table);
-      if (gpg_err_code (err) == GPG_ERR_ENOENT)
-        {
-          /* Take a missing trustlist as an empty one.  */
-          clear_trusttable ();
-          err = 0;
-        }
       return err;
     }
 
-  /* Fixme: we should drop duplicates and sort the table. */
+  /* Fixme: we should drop duplicates. */
   ti = xtryrealloc (table, (tableidx?tableidx:1) * sizeof *table);
   if (!ti)
     {
@@ -383,10 +454,19 @@ read_trustfiles (void)
       return err;
     }
 
+  err = build_trusthash (ti, tableidx, &hash, &hashsize);
+  if (err)
+    {
+      xfree (ti);
+      return err;
+    }
+
   /* Replace the trusttable.  */
-  xfree (trusttable);
+  clear_trusttable ();
   trusttable = ti;
   trusttablesize = tableidx;
+  trusthash = hash;
+  trusthashsize = hashsize;
   return 0;
 }
 
@@ -401,7 +481,7 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int *r_disabled,
   gpg_error_t err;
   int locked = already_locked;
   trustitem_t *ti;
-  size_t len;
+  int disabled;
   unsigned char fprbin[20];
 
   if (r_disabled)
@@ -429,35 +509,35 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int *r_disabled,
         }
     }
 
-  if (trusttable)
+  ti = find_trustitem (fprbin);
+  if (ti)
     {
-      for (ti=trusttable, len = trusttablesize; len; ti++, len--)
-        if (!memcmp (ti->fpr, fprbin, 20))
-          {
-            if (ti->flags.disabled && r_disabled)
-              *r_disabled = 1;
-
-            /* Print status messages only if we have not been called
-               in a locked state.  */
-            if (already_locked)
-              ;
-            else if (ti->flags.relax)
-              {
-                unlock_trusttable ();
-                locked = 0;
-                err = agent_write_status (ctrl, "TRUSTLISTFLAG", "relax", NULL);
-              }
-            else if (ti->flags.cm)
-              {
-                unlock_trusttable ();
-                locked = 0;
-                err = agent_write_status (ctrl, "TRUSTLISTFLAG", "cm", NULL);
-              }
-
-            if (!err)
-              err = ti->flags.disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
-            goto leave;
-          }
+      /* Take a copy of the flag because the table may be replaced
+         while we are writing the status.  */
+      disabled = ti->flags.disabled;
+      if (disabled && r_disabled)
+        *r_disabled = 1;
+
+      /* Print status messages only if we have not been called in a
+         locked state.  */
+      if (already_locked)
+        ;
+      else if (ti->flags.relax)
+        {
+          unlock_trusttable ();
+          locked = 0;
+          err = agent_write_status (ctrl, "TRUSTLISTFLAG", "relax", NULL);
+        }
+      else if (ti->flags.cm)
+        {
+          unlock_trusttable ();
+          locked = 0;
+          err = agent_write_status (ctrl, "TRUSTLISTFLAG", "cm", NULL);
+        }
+
+      if (!err)
+        err = disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
+      goto leave;
     }
   err = gpg_error (GPG_ERR_NOT_TRUSTED);
 
@@ -0,0 +1,1578 @@
+/* vanityjob.c - Checkpoint, resume and collect vanity key searches
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A vanity search may run for days.  While it runs, its definition
+   and its accounting are written every CHECKPOINT_INTERVAL seconds
+   to the file VANITY_CHECKPOINT in the home directory:
+
+     (vanity-checkpoint
+       (version 1)
+       (job (keyparam (genkey ...)) (algo 22) (pattern "...")
+            [(window "...")] (backward 0))
+       (timestamp <end of the default window>)
+       (iterations <fingerprints computed>)
+       (elapsed <seconds searched>)
+       (cost (cpu-ms <n>) (gpu-ms <n>) (keys <keys generated>)
+             (hashes <n>) (wall-ms <n>))
+       [(result (created <creation time>) (fpr <hexfingerprint>)
+                (private-key ...) (public-key ...))])
+
+   A resumed search derives its Ed25519 keys from a random stream key
+   (see vanity_set_stream_key); its result then holds that key and
+   the position of the found key in the key streams instead of the
+   key parts, which are recreated when the result is collected:
+
+       [(result (created <creation time>) (fpr <hexfingerprint>)
+                (stream-key <key>)
+                (ref (stream <n>) (counter <n>) (index <n>)))])
+
+   The file is removed when the search ends.  If it is still there
+   when the agent starts, the agent was stopped during the search; the
+   search is then resumed in the background with the same windows and
+   its counters continue.  The search is memoryless, thus nothing but
+   the accounting since the last checkpoint is lost by the restart.
+   The cost of all runs is sent to the client with a VANITY_COST
+   status line when the search ends.
+
+   A key found by a resumed search can't be protected because the
+   passphrase is not known; it is kept in the checkpoint until the
+   next GENKEY for the same job collects it and stores it the usual
+   way.  A GENKEY for the same job while the resumed search still
+   runs stops that search and continues it in the foreground.  Only
+   one search at a time is checkpointed.
+
+   A search may also collect several keys, up to a number of hits or
+   until a time budget is used up.  Such a search is not checkpointed
+   because the keys it found before a restart could not be protected.
+   All keys it collected are stored the usual way and recorded in the
+   file VANITY_RESULTS in the home directory so that they can be
+   listed and imported later:
+
+     (vanity-results
+       (result (job <jobid>) (pattern "...") (created <creation time>)
+               (fpr <hexfingerprint>) (keygrip <hexkeygrip>)
+               (item <index of the matched pattern item>)
+               (score <score for a scoring pattern or 0>))
+       ...)
+
+   The job ID is the hex encoded start of the SHA-1 hash of the job
+   definition; it is the same for all keys of one search.
+
+   A search may also be the share of a search distributed over
+   several hosts, which derive their Ed25519 keys from the same job
+   stream key but each from its own range of key streams (see
+   vanity_set_stream_range).  Such a search is neither checkpointed
+   nor uses the key pools, so that no key is checked twice; the
+   client is told the streams used and the keys swept for its
+   accounting.
+
+   With --vanity-pool the keys generated by the searches are kept in
+   a key pool (see vanity/vanity-pool.c) for each curve, the file
+   VANITY_POOL-<curve> in the home directory, and swept first by the
+   next search.  The secrets in the pools are wrapped with a random
+   key kept in VANITY_POOL_KEY; only one search at a time uses them.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <npth.h>
+
+#include "agent.h"
+#include "../vanity/vanity.h"
+
+
+/* The name of the checkpoint file in the home directory.  */
+#define VANITY_CHECKPOINT "vanity-job"
+
+/* The seconds between two checkpoints of a running search.  */
+#define CHECKPOINT_INTERVAL 60
+
+/* The name of the result store in the home directory.  */
+#define VANITY_RESULTS "vanity-results"
+
+/* The largest checkpoint or result store accepted.  */
+#define MAX_FILE_LEN (1024 * 1024)
+
+/* The number of bytes of the job ID.  */
+#define JOBID_LEN 8
+
+/* The prefix of the names of the key pools in the home directory.  */
+#define VANITY_POOL "vanity-pool"
+
+/* The name of the file with the key of the pools.  */
+#define VANITY_POOL_KEY "vanity-pool.key"
+
+
+/* The state of a search which may be checkpointed.  */
+struct search_s
+{
+  ctrl_t ctrl;              /* The client or NULL for a resumed search.  */
+  gcry_sexp_t job;          /* The job definition.  */
+  gcry_sexp_t keyparam;     /* Its key parameters.  */
+  char *pattern;
+  char *window;             /* NULL for the default window.  */
+  int backward;
+  int algo;
+  u32 timestamp;            /* The end of the default window.  */
+  unsigned long long iterations;  /* Of the previous runs.  */
+  unsigned long elapsed;    /* Seconds searched by the previous runs.  */
+  struct vanity_cost_s cost;  /* The resources of the previous runs.  */
+  time_t started;           /* Start of this run.  */
+  time_t written;           /* Time of the last checkpoint.  */
+  int checkpoint;           /* This search owns the checkpoint file.  */
+  unsigned int nhits;       /* The number of keys to collect.  */
+  unsigned long budget;     /* The seconds to search or 0.  */
+  unsigned long long max_iterations;  /* The fingerprints to try or 0.  */
+  unsigned int nworkers;    /* The workers to use or 0 for the default.  */
+  unsigned char *stream_key;  /* In secure memory or NULL.  */
+  int has_ref;              /* REF records the key found.  */
+  struct vanity_hit_ref_s ref;
+  const struct agent_vanity_seeds_s *seeds;  /* The share of a
+                                                distributed search.  */
+  struct agent_vanity_metrics_run_s metrics;
+};
+
+
+/* A search for a subkey running next to the search for its primary
+   key; see agent_vanity_subkey_start.  */
+struct vanity_subkey_s
+{
+  vanity_job_t job;
+  npth_t thread;
+  gpg_error_t err;
+  gcry_sexp_t s_private;
+  gcry_sexp_t s_public;
+  struct agent_vanity_metrics_run_s metrics;
+};
+
+
+/* Set if a search owns the checkpoint file.  */
+static int checkpoint_busy;
+
+/* The state of the resumed search: 0 if there is none, 1 while it
+   runs, 2 when it has ended.  */
+static int resumed_state;
+
+/* Set to stop the resumed search.  */
+static int resumed_stop;
+
+/* The definition of the resumed job.  */
+static gcry_sexp_t resumed_job;
+
+/* Set while the result store is being updated.  */
+static int results_busy;
+
+/* Set while a search uses a key pool.  */
+static int pool_busy;
+
+
+
+/* Store the ID of the job definition JOB as hex string at R_JOBID,
+   which must provide space for 2*JOBID_LEN+1 bytes.  */
+static gpg_error_t
+make_jobid (gcry_sexp_t job, char *r_jobid)
+{
+  unsigned char hash[20];
+  size_t len;
+  char *buf;
+
+  len = gcry_sexp_sprint (job, GCRYSEXP_FMT_CANON, NULL, 0);
+  buf = xtrymalloc (len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  len = gcry_sexp_sprint (job, GCRYSEXP_FMT_CANON, buf, len);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, hash, buf, len);
+  xfree (buf);
+  bin2hex (hash, JOBID_LEN, r_jobid);
+  return 0;
+}
+
+
+static void
+release_search (struct search_s *srch)
+{
+  gcry_sexp_release (srch->job);
+  gcry_sexp_release (srch->keyparam);
+  xfree (srch->pattern);
+  xfree (srch->window);
+  if (srch->stream_key)
+    {
+      wipememory (srch->stream_key, VANITY_STREAM_KEYLEN);
+      xfree (srch->stream_key);
+    }
+  memset (srch, 0, sizeof *srch);
+}
+
+
+/* Build the job definition of SRCH from its parameters.  */
+static gpg_error_t
+build_job (struct search_s *srch)
+{
+  if (srch->window)
+    return gcry_sexp_build (&srch->job, NULL,
+                            "(job(keyparam%S)(algo%d)(pattern%s)"
+                            "(window%s)(backward%d))",
+                            srch->keyparam, srch->algo, srch->pattern,
+                            srch->window, srch->backward);
+  return gcry_sexp_build (&srch->job, NULL,
+                          "(job(keyparam%S)(algo%d)(pattern%s)(backward%d))",
+                          srch->keyparam, srch->algo, srch->pattern,
+                          srch->backward);
+}
+
+
+/* Return the integer value of the list NAME in LIST or 0.  */
+static unsigned long long
+get_number (gcry_sexp_t list, const char *name)
+{
+  gcry_sexp_t l1;
+  char *s;
+  unsigned long long val = 0;
+
+  l1 = gcry_sexp_find_token (list, name, 0);
+  s = l1? gcry_sexp_nth_string (l1, 1) : NULL;
+  if (s)
+    val = strtoull (s, NULL, 10);
+  xfree (s);
+  gcry_sexp_release (l1);
+  return val;
+}
+
+
+/* Build the list of the resources COST at R_COST.  The times are
+   given in milliseconds.  */
+static gpg_error_t
+build_cost (const struct vanity_cost_s *cost, gcry_sexp_t *r_cost)
+{
+  char cpubuf[35], gpubuf[35], keybuf[35], hashbuf[35], wallbuf[35];
+
+  snprintf (cpubuf, sizeof cpubuf, "%.0f", cost->cpu_seconds * 1000);
+  snprintf (gpubuf, sizeof gpubuf, "%.0f", cost->gpu_seconds * 1000);
+  snprintf (keybuf, sizeof keybuf, "%llu", cost->keys);
+  snprintf (hashbuf, sizeof hashbuf, "%llu", cost->hashes);
+  snprintf (wallbuf, sizeof wallbuf, "%.0f", cost->wall_seconds * 1000);
+  return gcry_sexp_build (r_cost, NULL,
+                          "(cost(cpu-ms%s)(gpu-ms%s)(keys%s)(hashes%s)"
+                          "(wall-ms%s))",
+                          cpubuf, gpubuf, keybuf, hashbuf, wallbuf);
+}
+
+
+/* Read the resources of the checkpoint CKPT into R_COST.  An old
+   checkpoint without them yields 0 for all.  */
+static void
+parse_cost (gcry_sexp_t ckpt, struct vanity_cost_s *r_cost)
+{
+  gcry_sexp_t l1;
+
+  memset (r_cost, 0, sizeof *r_cost);
+  l1 = gcry_sexp_find_token (ckpt, "cost", 0);
+  if (!l1)
+    return;
+  r_cost->cpu_seconds = get_number (l1, "cpu-ms") / 1000.0;
+  r_cost->gpu_seconds = get_number (l1, "gpu-ms") / 1000.0;
+  r_cost->keys = get_number (l1, "keys");
+  r_cost->hashes = get_number (l1, "hashes");
+  r_cost->wall_seconds = get_number (l1, "wall-ms") / 1000.0;
+  gcry_sexp_release (l1);
+}
+
+
+/* Send the resources COST used for the job JOBID to CTRL with
+
+     S VANITY_COST <jobid> <cpu-ms> <gpu-ms> <keys> <hashes> <wall-ms>  */
+gpg_error_t
+agent_vanity_write_cost (ctrl_t ctrl, const char *jobid,
+                         const struct vanity_cost_s *cost)
+{
+  char buf[200];
+
+  snprintf (buf, sizeof buf, "%.0f %.0f %llu %llu %.0f",
+            cost->cpu_seconds * 1000, cost->gpu_seconds * 1000,
+            cost->keys, cost->hashes, cost->wall_seconds * 1000);
+  return agent_write_status (ctrl, "VANITY_COST", jobid, buf, NULL);
+}
+
+
+/* Set up SRCH from the job definition JOB, which is consumed.  */
+static gpg_error_t
+parse_job (struct search_s *srch, gcry_sexp_t job)
+{
+  gcry_sexp_t l1;
+
+  srch->job = job;
+  l1 = gcry_sexp_find_token (job, "keyparam", 0);
+  if (l1)
+    srch->keyparam = gcry_sexp_nth (l1, 1);
+  gcry_sexp_release (l1);
+  l1 = gcry_sexp_find_token (job, "pattern", 0);
+  if (l1)
+    srch->pattern = gcry_sexp_nth_string (l1, 1);
+  gcry_sexp_release (l1);
+  l1 = gcry_sexp_find_token (job, "window", 0);
+  if (l1)
+    srch->window = gcry_sexp_nth_string (l1, 1);
+  gcry_sexp_release (l1);
+  srch->algo = get_number (job, "algo");
+  srch->backward = !!get_number (job, "backward");
+  if (!srch->keyparam || !srch->pattern)
+    return gpg_error (GPG_ERR_INV_SEXP);
+  return 0;
+}
+
+
+/* Read the file NAME in the home directory into R_SEXP.  If SECURE
+   is set the file is read into secure memory; only as much as the
+   file needs is taken from that small pool.  Returns GPG_ERR_ENOENT
+   if there is none.  */
+static gpg_error_t
+read_file (const char *name, int secure, gcry_sexp_t *r_sexp)
+{
+  gpg_error_t err;
+  char *fname;
+  estream_t fp;
+  char *buf = NULL;
+  long size = 0;
+  size_t len;
+
+  *r_sexp = NULL;
+  fname = make_filename (opt.homedir, name, NULL);
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) != GPG_ERR_ENOENT)
+        log_error ("can't open '%s': %s\n", fname, gpg_strerror (err));
+      xfree (fname);
+      return err;
+    }
+  if (es_fseek (fp, 0, SEEK_END) || (size = es_ftell (fp)) < 0
+      || es_fseek (fp, 0, SEEK_SET))
+    err = gpg_error_from_syserror ();
+  else if (size > MAX_FILE_LEN)
+    err = gpg_error (GPG_ERR_TOO_LARGE);
+  else if (!(buf = secure? xtrymalloc_secure (size + 1)
+             /**/  : xtrymalloc (size + 1)))
+    err = gpg_error_from_syserror ();
+  else if (es_read (fp, buf, size, &len))
+    err = gpg_error_from_syserror ();
+  else
+    err = gcry_sexp_sscan (r_sexp, NULL, buf, len);
+  es_fclose (fp);
+  if (buf)
+    {
+      wipememory (buf, size + 1);
+      xfree (buf);
+    }
+  if (err)
+    log_error ("error reading '%s': %s\n", fname, gpg_strerror (err));
+  xfree (fname);
+  return err;
+}
+
+
+/* Replace the file NAME in the home directory by the LEN bytes at
+   BUF.  */
+static gpg_error_t
+write_file (const char *name, const char *buf, size_t len)
+{
+  gpg_error_t err = 0;
+  char *fname, *tmpfname;
+  estream_t fp;
+
+  fname = make_filename (opt.homedir, name, NULL);
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = es_fopen (tmpfname, "wb,mode=-rw");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("can't create '%s': %s\n", tmpfname, gpg_strerror (err));
+      goto leave;
+    }
+  if (es_fwrite (buf, len, 1, fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error writing '%s': %s\n", tmpfname, gpg_strerror (err));
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error closing '%s': %s\n", tmpfname, gpg_strerror (err));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+#ifdef HAVE_DOSISH_SYSTEM
+  gnupg_remove (fname);
+#endif
+  if (rename (tmpfname, fname))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("renaming '%s' to '%s' failed: %s\n",
+                 tmpfname, fname, gpg_strerror (err));
+      gnupg_remove (tmpfname);
+    }
+
+ leave:
+  xfree (tmpfname);
+  xfree (fname);
+  return err;
+}
+
+
+/* Write the checkpoint of SRCH.  If S_PRIVATE is not NULL the search
+   has found that key with the creation time CREATED and the
+   fingerprint FPR and S_PUBLIC; it is stored as the result, or only
+   its record if SRCH has one.  */
+static gpg_error_t
+write_checkpoint (struct search_s *srch, gcry_sexp_t s_private,
+                  gcry_sexp_t s_public, u32 created,
+                  const unsigned char *fpr)
+{
+  gpg_error_t err;
+  gcry_sexp_t ckpt, cost;
+  char numbuf[35], ctrbuf[35];
+  char hexfpr[2*VANITY_FPR_LEN+1];
+  char *buf;
+  size_t len;
+  double start = agent_trace_start ();
+
+  err = build_cost (&srch->cost, &cost);
+  if (err)
+    return err;
+  snprintf (numbuf, sizeof numbuf, "%llu", srch->iterations);
+  if (s_private && srch->has_ref)
+    {
+      snprintf (ctrbuf, sizeof ctrbuf, "%llu", srch->ref.counter);
+      bin2hex (fpr, VANITY_FPR_LEN, hexfpr);
+      err = gcry_sexp_build (&ckpt, NULL,
+                             "(vanity-checkpoint(version 1)%S(timestamp%u)"
+                             "(iterations%s)(elapsed%lu)%S"
+                             "(result(created%u)(fpr%s)(stream-key%b)"
+                             "(ref(stream%u)(counter%s)(index%u))))",
+                             srch->job, (unsigned int)srch->timestamp,
+                             numbuf, srch->elapsed, cost,
+                             (unsigned int)created, hexfpr,
+                             VANITY_STREAM_KEYLEN, srch->stream_key,
+                             srch->ref.stream, ctrbuf, srch->ref.index);
+    }
+  else if (s_private)
+    {
+      bin2hex (fpr, VANITY_FPR_LEN, hexfpr);
+      err = gcry_sexp_build (&ckpt, NULL,
+                             "(vanity-checkpoint(version 1)%S(timestamp%u)"
+                             "(iterations%s)(elapsed%lu)%S"
+                             "(result(created%u)(fpr%s)%S%S))",
+                             srch->job, (unsigned int)srch->timestamp,
+                             numbuf, srch->elapsed, cost,
+                             (unsigned int)created, hexfpr,
+                             s_private, s_public);
+    }
+  else
+    err = gcry_sexp_build (&ckpt, NULL,
+                           "(vanity-checkpoint(version 1)%S(timestamp%u)"
+                           "(iterations%s)(elapsed%lu)%S)",
+                           srch->job, (unsigned int)srch->timestamp,
+                           numbuf, srch->elapsed, cost);
+  gcry_sexp_release (cost);
+  if (err)
+    return err;
+
+  len = gcry_sexp_sprint (ckpt, GCRYSEXP_FMT_ADVANCED, NULL, 0);
+  buf = xtrymalloc_secure (len);
+  if (!buf)
+    {
+      err = gpg_error_from_syserror ();
+      gcry_sexp_release (ckpt);
+      return err;
+    }
+  len = gcry_sexp_sprint (ckpt, GCRYSEXP_FMT_ADVANCED, buf, len);
+  gcry_sexp_release (ckpt);
+
+  err = write_file (VANITY_CHECKPOINT, buf, len);
+  wipememory (buf, len);
+  xfree (buf);
+  if (!err)
+    agent_vanity_metrics_checkpoint (start);
+  return err;
+}
+
+
+static void
+remove_checkpoint (void)
+{
+  char *fname;
+
+  fname = make_filename (opt.homedir, VANITY_CHECKPOINT, NULL);
+  if (gnupg_remove (fname) && errno != ENOENT)
+    log_error ("error removing '%s': %s\n", fname, strerror (errno));
+  xfree (fname);
+}
+
+
+/* The progress callback of the searches.  It sends the progress to
+   the client, if there is one, and writes the checkpoint.  An error
+   sending the progress means that the client is gone; this stops the
+   search, so that the search is canceled if the client is killed.  */
+static gpg_error_t
+progress_cb (void *opaque, const struct vanity_progress_s *prog)
+{
+  struct search_s *srch = opaque;
+  unsigned long long iterations = prog->iterations;
+  unsigned long long total = srch->iterations + iterations;
+  time_t now = gnupg_get_time ();
+  unsigned long elapsed;
+  struct vanity_cost_s cost, run;
+  char numbuf[35];
+  char ratebuf[100];
+  gpg_error_t err;
+
+  agent_vanity_metrics_progress (&srch->metrics, prog);
+  if (srch->ctrl)
+    {
+      snprintf (numbuf, sizeof numbuf, "%llu", total);
+      err = agent_write_status (srch->ctrl, "PROGRESS", "vanity", ".",
+                                numbuf, "0", NULL);
+      if (!err)
+        {
+          snprintf (ratebuf, sizeof ratebuf, "%.0f %.0f %llu %.6g %.0f",
+                    prog->key_rate, prog->hash_rate, total,
+                    prog->probability, prog->eta);
+          err = agent_write_status (srch->ctrl, "VANITY_STATS",
+                                    ratebuf, NULL);
+        }
+      if (err)
+        return err;
+    }
+  else if (resumed_stop)
+    return gpg_error (GPG_ERR_CANCELED);
+
+  if (srch->checkpoint && now - srch->written >= CHECKPOINT_INTERVAL)
+    {
+      /* Write the sums without changing the base.  */
+      elapsed = srch->elapsed;
+      cost = srch->cost;
+      memset (&run, 0, sizeof run);
+      run.cpu_seconds = prog->cpu_seconds;
+      run.gpu_seconds = prog->gpu_seconds;
+      run.keys = prog->generated;
+      run.hashes = iterations;
+      run.wall_seconds = now - srch->started;
+      vanity_cost_add (&srch->cost, &run, 1.0);
+      srch->elapsed += now - srch->started;
+      srch->iterations = total;
+      write_checkpoint (srch, NULL, NULL, 0, NULL);
+      srch->iterations = total - iterations;
+      srch->elapsed = elapsed;
+      srch->cost = cost;
+      srch->written = now;
+    }
+  return 0;
+}
+
+
+/* Release the list of search results LIST.  */
+void
+agent_vanity_release_results (struct vanity_result_s *list)
+{
+  struct vanity_result_s *next;
+
+  for (; list; list = next)
+    {
+      next = list->next;
+      gcry_sexp_release (list->s_private);
+      gcry_sexp_release (list->s_public);
+      xfree (list);
+    }
+}
+
+
+/* Build the list of all keys found by the search JOB for SRCH at
+   R_LIST.  The first key has already been taken by vanity_search; its
+   entry has no key parts.  */
+static gpg_error_t
+collect_results (struct search_s *srch, vanity_job_t job,
+                 struct vanity_result_s **r_list)
+{
+  gpg_error_t err;
+  struct vanity_result_s *res, **tail = r_list;
+  unsigned int idx, count;
+  char jobid[2*JOBID_LEN+1];
+
+  *r_list = NULL;
+  err = make_jobid (srch->job, jobid);
+  if (err)
+    return err;
+  count = vanity_get_hit_count (job);
+  for (idx=0; idx < count; idx++)
+    {
+      res = xtrycalloc (1, sizeof *res);
+      if (!res)
+        {
+          err = gpg_error_from_syserror ();
+          agent_vanity_release_results (*r_list);
+          *r_list = NULL;
+          return err;
+        }
+      strcpy (res->jobid, jobid);
+      if (!idx)
+        {
+          res->created = vanity_get_timestamp (job);
+          vanity_get_fingerprint (job, res->fpr);
+          res->match = vanity_get_match (job);
+        }
+      else
+        {
+          err = vanity_take_hit (job, idx, &res->s_private, &res->s_public,
+                                 &res->created, res->fpr, &res->match);
+          if (err)
+            {
+              xfree (res);
+              agent_vanity_release_results (*r_list);
+              *r_list = NULL;
+              return err;
+            }
+        }
+      res->score = vanity_get_score (job, idx);
+      *tail = res;
+      tail = &res->next;
+    }
+  return 0;
+}
+
+
+/* Run the search SRCH.  On success the key found, its creation time
+   and its fingerprint are stored at R_PRIVATE, R_PUBLIC, R_CREATED
+   and R_FPR.  If R_MORE is not NULL the list of all keys collected is
+   stored there; see agent_vanity_search.  */
+static gpg_error_t
+run_search (struct search_s *srch, gcry_sexp_t *r_private,
+            gcry_sexp_t *r_public, u32 *r_created, unsigned char *r_fpr,
+            struct vanity_result_s **r_more)
+{
+  gpg_error_t err;
+  vanity_job_t job;
+  vanity_pool_t pool = NULL;
+  struct vanity_cost_s cost;
+  char numbuf[35], keybuf[35];
+  char jobid[2*JOBID_LEN+1];
+
+  srch->started = srch->written = gnupg_get_time ();
+  err = vanity_job_new (&job, srch->keyparam, srch->algo, srch->timestamp);
+  if (err)
+    return err;
+  vanity_set_workers (job, srch->nworkers? srch->nworkers
+                                          : opt.vanity_workers);
+  vanity_set_gpu (job, opt.vanity_gpu);
+  vanity_set_reseed_interval (job, opt.vanity_reseed);
+  vanity_set_placement (job, ((opt.vanity_pin? VANITY_PLACE_PIN : 0)
+                              | (opt.vanity_no_smt? VANITY_PLACE_NO_SMT : 0)));
+  agent_vanity_set_limits (job);
+  vanity_set_hits (job, srch->nhits, srch->budget);
+  vanity_set_max_iterations (job, srch->max_iterations);
+  vanity_set_progress (job, progress_cb, srch);
+  vanity_set_backward (job, srch->backward);
+  if (!srch->seeds)
+    agent_vanity_open_pool (srch->keyparam, &pool);
+  vanity_set_pool (job, pool, VANITY_POOL_SWEEP | VANITY_POOL_ADD);
+  if (srch->seeds)
+    {
+      err = vanity_set_stream_key (job, srch->seeds->key);
+      if (!err)
+        err = vanity_set_stream_range (job, srch->seeds->first,
+                                       srch->seeds->count);
+    }
+  else
+    err = vanity_set_stream_key (job, srch->stream_key);
+  if (!err)
+    err = vanity_set_pattern (job, srch->pattern);
+  if (err)
+    log_error ("invalid vanity pattern '%s'\n", srch->pattern);
+  else if (srch->window && (err = vanity_set_windows (job, srch->window)))
+    log_error ("invalid vanity window '%s'\n", srch->window);
+  if (!err)
+    {
+      if (srch->checkpoint)
+        write_checkpoint (srch, NULL, NULL, 0, NULL);
+      agent_vanity_metrics_start (&srch->metrics);
+      err = vanity_search (job, r_private, r_public);
+      agent_vanity_metrics_end (&srch->metrics, job, err);
+    }
+  if (!err)
+    {
+      *r_created = vanity_get_timestamp (job);
+      vanity_get_fingerprint (job, r_fpr);
+      srch->has_ref = !vanity_get_hit_ref (job, 0, &srch->ref);
+      if (r_more && (err = collect_results (srch, job, r_more)))
+        {
+          gcry_sexp_release (*r_private);
+          gcry_sexp_release (*r_public);
+          *r_private = *r_public = NULL;
+        }
+    }
+  srch->elapsed += gnupg_get_time () - srch->started;
+  srch->iterations += vanity_get_iterations (job);
+  vanity_get_cost (job, &cost);
+  vanity_cost_add (&srch->cost, &cost, 1.0);
+  if (srch->ctrl && !make_jobid (srch->job, jobid))
+    agent_vanity_write_cost (srch->ctrl, jobid, &srch->cost);
+  if (srch->seeds)
+    {
+      /* Logged as well since the client is gone if it stopped the
+         search by closing the connection.  */
+      log_info ("vanity search used %u key streams from %u and swept"
+                " %llu keys\n",
+                vanity_get_stream_next (job) - srch->seeds->first,
+                srch->seeds->first, vanity_get_keys (job));
+      snprintf (numbuf, sizeof numbuf, "%u %u", srch->seeds->first,
+                vanity_get_stream_next (job));
+      snprintf (keybuf, sizeof keybuf, "%llu", vanity_get_keys (job));
+      if (srch->ctrl)
+        agent_write_status (srch->ctrl, "VANITY_SEEDS", numbuf, keybuf, NULL);
+    }
+  vanity_job_release (job);
+  agent_vanity_close_pool (pool);
+  return err;
+}
+
+
+/* Read the key of the key pools into KEY, which must provide
+   VANITY_POOL_KEYLEN bytes of secure memory.  It is created if it
+   does not yet exist.  */
+static gpg_error_t
+read_pool_key (unsigned char *key)
+{
+  gpg_error_t err;
+  char *fname;
+  estream_t fp;
+  size_t n;
+
+  fname = make_filename (opt.homedir, VANITY_POOL_KEY, NULL);
+  fp = es_fopen (fname, "rb");
+  if (fp)
+    {
+      if (es_read (fp, key, VANITY_POOL_KEYLEN, &n))
+        err = gpg_error_from_syserror ();
+      else if (n != VANITY_POOL_KEYLEN)
+        err = gpg_error (GPG_ERR_INV_LENGTH);
+      else
+        err = 0;
+      es_fclose (fp);
+      if (err)
+        log_error ("error reading '%s': %s\n", fname, gpg_strerror (err));
+    }
+  else
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+        {
+          gcry_randomize (key, VANITY_POOL_KEYLEN, GCRY_VERY_STRONG_RANDOM);
+          err = write_file (VANITY_POOL_KEY, (char*)key, VANITY_POOL_KEYLEN);
+        }
+      else
+        log_error ("can't open '%s': %s\n", fname, gpg_strerror (err));
+    }
+  xfree (fname);
+  return err;
+}
+
+
+/* Apply --vanity-governor, --vanity-max-temperature, the memory
+   limits and --vanity-autotune to JOB.  An invalid schedule is logged
+   and ignored.  */
+void
+agent_vanity_set_limits (struct vanity_job_s *job)
+{
+  if (opt.vanity_governor && vanity_set_governor (job, opt.vanity_governor))
+    log_error ("invalid vanity governor schedule '%s'\n",
+               opt.vanity_governor);
+  vanity_set_temperature_limit (job, opt.vanity_max_temp);
+  vanity_set_memory_limit (job, (size_t)opt.vanity_memory * 1024,
+                           (size_t)opt.vanity_worker_memory * 1024);
+  vanity_set_autotune (job, opt.vanity_autotune);
+}
+
+
+/* Open the key pool for the keys generated from S_KEYPARAM and store
+   it at R_POOL.  NULL is stored if --vanity-pool is not set, another
+   search uses the pools or the pool can't be opened; the search then
+   runs without it.  */
+void
+agent_vanity_open_pool (gcry_sexp_t s_keyparam, struct vanity_pool_s **r_pool)
+{
+  gpg_error_t err;
+  gcry_sexp_t l1;
+  char *curve, *name, *fname;
+  unsigned char *key;
+  char *p, *q;
+
+  *r_pool = NULL;
+  if (!opt.vanity_pool || pool_busy)
+    return;
+
+  /* The name of the curve makes a file name of lowercase letters and
+     digits, e.g. "nistp256" for "NIST P-256".  */
+  l1 = gcry_sexp_find_token (s_keyparam, "curve", 0);
+  curve = l1? gcry_sexp_nth_string (l1, 1) : NULL;
+  gcry_sexp_release (l1);
+  if (!curve)
+    return;
+  for (p = q = curve; *p; p++)
+    if (digitp (p) || (ascii_tolower (*p) >= 'a' && ascii_tolower (*p) <= 'z'))
+      *q++ = ascii_tolower (*p);
+  *q = 0;
+  name = strconcat (VANITY_POOL, "-", curve, NULL);
+  xfree (curve);
+  if (!name)
+    return;
+  fname = make_filename (opt.homedir, name, NULL);
+  xfree (name);
+
+  key = xtrymalloc_secure (VANITY_POOL_KEYLEN);
+  if (!key)
+    err = gpg_error_from_syserror ();
+  else
+    err = read_pool_key (key);
+  if (!err)
+    err = vanity_pool_open (r_pool, fname, key);
+  if (key)
+    {
+      wipememory (key, VANITY_POOL_KEYLEN);
+      xfree (key);
+    }
+  if (err)
+    log_info ("not using the vanity key pool '%s': %s\n",
+              fname, gpg_strerror (err));
+  else
+    pool_busy = 1;
+  xfree (fname);
+}
+
+
+/* Close the key pool POOL opened by agent_vanity_open_pool.  */
+void
+agent_vanity_close_pool (struct vanity_pool_s *pool)
+{
+  if (!pool)
+    return;
+  vanity_pool_close (pool);
+  pool_busy = 0;
+}
+
+
+/* Recreate the key recorded in the checkpoint result RESULT and store
+   it at R_PRIVATE and R_PUBLIC.  */
+static gpg_error_t
+regenerate_result (gcry_sexp_t result, gcry_sexp_t *r_private,
+                   gcry_sexp_t *r_public)
+{
+  gpg_error_t err;
+  gcry_sexp_t l1, ref;
+  struct vanity_hit_ref_s hitref;
+  const char *s;
+  size_t n;
+
+  ref = gcry_sexp_find_token (result, "ref", 0);
+  l1 = gcry_sexp_find_token (result, "stream-key", 0);
+  s = l1? gcry_sexp_nth_data (l1, 1, &n) : NULL;
+  if (!ref || !s || n != VANITY_STREAM_KEYLEN)
+    err = gpg_error (GPG_ERR_INV_SEXP);
+  else
+    {
+      memset (&hitref, 0, sizeof hitref);
+      hitref.stream = get_number (ref, "stream");
+      hitref.counter = get_number (ref, "counter");
+      hitref.index = get_number (ref, "index");
+      err = vanity_regenerate_key ((const unsigned char *)s, &hitref,
+                                   r_private, r_public);
+    }
+  gcry_sexp_release (l1);
+  gcry_sexp_release (ref);
+  return err;
+}
+
+
+/* Take the key found by the resumed search from the checkpoint
+   CKPT.  Returns GPG_ERR_NOT_FOUND if it has none.  */
+static gpg_error_t
+take_result (gcry_sexp_t ckpt, gcry_sexp_t *r_private,
+             gcry_sexp_t *r_public, u32 *r_created, unsigned char *r_fpr)
+{
+  gcry_sexp_t result, l1;
+  const char *s;
+  size_t n;
+
+  result = gcry_sexp_find_token (ckpt, "result", 0);
+  if (!result)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  *r_created = get_number (result, "created");
+  l1 = gcry_sexp_find_token (result, "fpr", 0);
+  s = l1? gcry_sexp_nth_data (l1, 1, &n) : NULL;
+  if (!s || n != 2*VANITY_FPR_LEN || hex2bin (s, r_fpr, VANITY_FPR_LEN) < 0)
+    *r_created = 0;
+  gcry_sexp_release (l1);
+  *r_private = gcry_sexp_find_token (result, "private-key", 0);
+  *r_public = gcry_sexp_find_token (result, "public-key", 0);
+  if (!*r_private && !*r_public
+      && regenerate_result (result, r_private, r_public))
+    *r_created = 0;
+  gcry_sexp_release (result);
+  if (!*r_created || !*r_private || !*r_public)
+    {
+      gcry_sexp_release (*r_private);
+      gcry_sexp_release (*r_public);
+      *r_private = *r_public = NULL;
+      return gpg_error (GPG_ERR_INV_SEXP);
+    }
+  return 0;
+}
+
+
+/* Search for a key generated from S_KEYPARAM with a keyid matching
+   PATTERN in the windows WINDOW on behalf of client CTRL; see
+   agent_genkey for the parameters.  On success the key, its creation
+   time and its fingerprint are stored at R_PRIVATE, R_PUBLIC,
+   R_CREATED and R_FPR.  If the checkpoint is for the same job, its
+   result is returned or the search is continued from it.
+
+   If NHITS is greater than 1 or BUDGET or MAX_ITERATIONS is not 0,
+   the search collects up to NHITS keys or all keys found within
+   BUDGET seconds or MAX_ITERATIONS fingerprints and is not
+   checkpointed; for a scoring pattern these are the NHITS best keys.
+   The list of all keys found is then stored at R_MORE; its first
+   entry describes the key returned at R_PRIVATE and has no key parts
+   of its own.  The caller must release the list with
+   agent_vanity_release_results.
+
+   NWORKERS is the number of workers to use, or 0 for --vanity-workers;
+   a search with its own number of workers shares the CPUs with a
+   subkey search and is not checkpointed either.  If SEEDS is not NULL
+   the search covers only that share of a distributed search; it is
+   not checkpointed and the first and the next key stream as well as
+   the keys swept are sent to the client with a VANITY_SEEDS status
+   line when it ends.  */
+gpg_error_t
+agent_vanity_search (ctrl_t ctrl, gcry_sexp_t s_keyparam,
+                     const char *pattern, const char *window,
+                     int backward, int algo, unsigned int nhits,
+                     unsigned long budget, unsigned long long max_iterations,
+                     unsigned int nworkers,
+                     const struct agent_vanity_seeds_s *seeds,
+                     gcry_sexp_t *r_private, gcry_sexp_t *r_public,
+                     u32 *r_created, unsigned char *r_fpr,
+                     struct vanity_result_s **r_more)
+{
+  gpg_error_t err;
+  struct search_s srch;
+  gcry_sexp_t ckpt = NULL, l1;
+  int collect = nhits > 1 || budget || max_iterations;
+
+  *r_private = *r_public = NULL;
+  *r_more = NULL;
+
+  memset (&srch, 0, sizeof srch);
+  srch.ctrl = ctrl;
+  err = gcry_sexp_build (&srch.keyparam, NULL, "%S", s_keyparam);
+  if (err)
+    return err;
+  srch.pattern = xtrystrdup (pattern);
+  srch.window = window? xtrystrdup (window) : NULL;
+  if (!srch.pattern || (window && !srch.window))
+    {
+      err = gpg_error_from_syserror ();
+      release_search (&srch);
+      return err;
+    }
+  srch.backward = !!backward;
+  srch.algo = algo;
+  srch.nhits = nhits;
+  srch.budget = budget;
+  srch.max_iterations = max_iterations;
+  srch.nworkers = nworkers;
+  srch.seeds = seeds;
+  srch.timestamp = make_timestamp ();
+  err = build_job (&srch);
+  if (err)
+    {
+      release_search (&srch);
+      return err;
+    }
+
+  /* Stop the resumed search for this job and wait until it wrote its
+     final checkpoint.  */
+  if (resumed_state == 1 && same_sexp (resumed_job, srch.job))
+    {
+      log_info ("continuing the resumed vanity search\n");
+      resumed_stop = 1;
+      while (resumed_state == 1)
+        npth_sleep (1);
+    }
+
+  if (!collect && !nworkers && !seeds && !checkpoint_busy
+      && resumed_state != 1)
+    {
+      srch.checkpoint = 1;
+      checkpoint_busy = 1;
+      if (!read_file (VANITY_CHECKPOINT, 1, &ckpt))
+        {
+          l1 = gcry_sexp_find_token (ckpt, "job", 0);
+          if (l1 && same_sexp (l1, srch.job))
+            {
+              err = take_result (ckpt, r_private, r_public, r_created, r_fpr);
+              if (!err)
+                {
+                  log_info ("using the key found by the resumed"
+                            " vanity search\n");
+                  remove_checkpoint ();
+                  gcry_sexp_release (l1);
+                  goto leave;
+                }
+              srch.timestamp = get_number (ckpt, "timestamp");
+              srch.iterations = get_number (ckpt, "iterations");
+              srch.elapsed = get_number (ckpt, "elapsed");
+              parse_cost (ckpt, &srch.cost);
+              log_info ("continuing the vanity search after %llu"
+                        " iterations in %lu seconds\n",
+                        srch.iterations, srch.elapsed);
+            }
+          else
+            log_info ("replacing the checkpoint of another vanity search\n");
+          gcry_sexp_release (l1);
+        }
+    }
+
+  err = run_search (&srch, r_private, r_public, r_created, r_fpr,
+                    collect? r_more : NULL);
+  if (srch.checkpoint)
+    remove_checkpoint ();
+  log_info ("vanity search ended after %llu iterations in %lu seconds"
+            " using %.0f CPU seconds\n",
+            srch.iterations, srch.elapsed, srch.cost.cpu_seconds);
+
+ leave:
+  if (srch.checkpoint)
+    checkpoint_busy = 0;
+  gcry_sexp_release (ckpt);
+  release_search (&srch);
+  return err;
+}
+
+
+/* The thread function of the subkey search ARG.  */
+static void *
+subkey_thread (void *arg)
+{
+  struct vanity_subkey_s *sub = arg;
+
+  agent_vanity_metrics_start (&sub->metrics);
+  sub->err = vanity_search (sub->job, &sub->s_private, &sub->s_public);
+  agent_vanity_metrics_end (&sub->metrics, sub->job, sub->err);
+  return NULL;
+}
+
+
+/* Return the expected number of fingerprints to find a key matching
+   PATTERN, or 0 if that is not known.  */
+static double
+expected_work (const char *pattern)
+{
+  vanity_pattern_t compiled;
+  double p;
+
+  if (vanity_pattern_new (&compiled, pattern))
+    return 0;
+  p = vanity_pattern_probability (compiled);
+  vanity_pattern_release (compiled);
+  return p > 0? 1.0 / p : 0;
+}
+
+
+/* Start the search for a subkey generated from S_KEYPARAM with the
+   OpenPGP algorithm ALGO and a keyid matching PATTERN.  For an ECDH
+   subkey KDF optionally lists the KDF parameters to try with each key
+   (see vanity_set_kdf_params).  It runs in its own thread next to the
+   search for the primary key, which looks for PRIMARY_PATTERN;
+   WINDOW, BACKWARD and BUDGET are those of the primary search.  The vanity workers are divided between both
+   searches so that they are expected to end at about the same time;
+   the number left for the primary search is stored at R_NWORKERS.
+   The search must be ended with agent_vanity_subkey_finish.  */
+gpg_error_t
+agent_vanity_subkey_start (gcry_sexp_t s_keyparam, const char *pattern,
+                           int algo, const char *kdf,
+                           const char *window, int backward,
+                           unsigned long budget, const char *primary_pattern,
+                           struct vanity_subkey_s **r_sub,
+                           unsigned int *r_nworkers)
+{
+  gpg_error_t err;
+  struct vanity_subkey_s *sub;
+  npth_attr_t tattr;
+  unsigned int total, nsub;
+  double work, primary_work;
+  int rc;
+
+  *r_sub = NULL;
+  *r_nworkers = 0;
+  sub = xtrycalloc (1, sizeof *sub);
+  if (!sub)
+    return gpg_error_from_syserror ();
+  err = vanity_job_new (&sub->job, s_keyparam, algo, make_timestamp ());
+  if (err)
+    {
+      xfree (sub);
+      return err;
+    }
+  err = vanity_set_pattern (sub->job, pattern);
+  if (err)
+    log_error ("invalid vanity pattern '%s'\n", pattern);
+  else if (window && (err = vanity_set_windows (sub->job, window)))
+    log_error ("invalid vanity window '%s'\n", window);
+  else if (kdf && (err = vanity_set_kdf_params (sub->job, kdf)))
+    log_error ("invalid vanity KDF parameters '%s'\n", kdf);
+  if (err)
+    {
+      vanity_job_release (sub->job);
+      xfree (sub);
+      return err;
+    }
+
+  /* A scoring primary search runs for its budget anyway.  */
+  total = opt.vanity_workers? opt.vanity_workers : vanity_default_workers ();
+  work = expected_work (pattern);
+  primary_work = expected_work (primary_pattern);
+  if (total < 2)
+    nsub = total;
+  else
+    {
+      if (work > 0 && primary_work > 0)
+        nsub = (unsigned int)(total * work / (work + primary_work) + 0.5);
+      else
+        nsub = total / 2;
+      if (nsub < 1)
+        nsub = 1;
+      else if (nsub > total - 1)
+        nsub = total - 1;
+    }
+  vanity_set_workers (sub->job, nsub);
+  vanity_set_reseed_interval (sub->job, opt.vanity_reseed);
+  vanity_set_placement (sub->job,
+                        ((opt.vanity_pin? VANITY_PLACE_PIN : 0)
+                         | (opt.vanity_no_smt? VANITY_PLACE_NO_SMT : 0)));
+  vanity_set_hits (sub->job, 1, budget);
+  vanity_set_backward (sub->job, backward);
+  agent_vanity_set_limits (sub->job);
+
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      rc = npth_create (&sub->thread, &tattr, subkey_thread, sub);
+      npth_attr_destroy (&tattr);
+    }
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      log_error ("error spawning the vanity subkey search: %s\n",
+                 strerror (rc));
+      vanity_job_release (sub->job);
+      xfree (sub);
+      return err;
+    }
+  npth_setname_np (sub->thread, "vanity-subkey");
+  log_info ("searching the vanity subkey with %u of %u workers\n",
+            nsub, total);
+  *r_sub = sub;
+  *r_nworkers = total > nsub? total - nsub : total;
+  return 0;
+}
+
+
+/* Wait for the subkey search SUB to end and release it.  If CANCEL
+   is set the search is canceled first.  On success the key found,
+   its creation time, its fingerprint and for an ECDH key the KDF
+   parameters it was found with are stored at R_PRIVATE, R_CREATED,
+   R_FPR and R_KDF, which must provide VANITY_KDF_PARAMS_LEN bytes.  */
+gpg_error_t
+agent_vanity_subkey_finish (struct vanity_subkey_s *sub, int cancel,
+                            gcry_sexp_t *r_private, u32 *r_created,
+                            unsigned char *r_fpr, unsigned char *r_kdf)
+{
+  gpg_error_t err;
+
+  *r_private = NULL;
+  if (cancel)
+    vanity_cancel (sub->job);
+  npth_join (sub->thread, NULL);
+  err = sub->err;
+  if (!err)
+    {
+      *r_private = sub->s_private;
+      *r_created = vanity_get_timestamp (sub->job);
+      vanity_get_fingerprint (sub->job, r_fpr);
+      vanity_get_kdf_params (sub->job, 0, r_kdf);
+      log_info ("vanity subkey found after %llu iterations\n",
+                vanity_get_iterations (sub->job));
+    }
+  else
+    gcry_sexp_release (sub->s_private);
+  gcry_sexp_release (sub->s_public);
+  vanity_job_release (sub->job);
+  xfree (sub);
+  return err;
+}
+
+
+/* The thread function of the resumed search SRCH.  */
+static void *
+resume_thread (void *arg)
+{
+  struct search_s *srch = arg;
+  gpg_error_t err;
+  gcry_sexp_t s_private, s_public;
+  u32 created;
+  unsigned char fpr[VANITY_FPR_LEN];
+
+  err = run_search (srch, &s_private, &s_public, &created, fpr, NULL);
+  if (!err)
+    {
+      write_checkpoint (srch, s_private, s_public, created, fpr);
+      log_info ("the resumed vanity search found a key after %llu"
+                " iterations in %lu seconds\n",
+                srch->iterations, srch->elapsed);
+      gcry_sexp_release (s_private);
+      gcry_sexp_release (s_public);
+    }
+  else
+    {
+      /* Keep the checkpoint so that the search can be continued.  */
+      write_checkpoint (srch, NULL, NULL, 0, NULL);
+      if (gpg_err_code (err) != GPG_ERR_CANCELED)
+        log_error ("resumed vanity search failed: %s\n", gpg_strerror (err));
+    }
+
+  release_search (srch);
+  xfree (srch);
+  checkpoint_busy = 0;
+  resumed_state = 2;
+  return NULL;
+}
+
+
+/* Resume the search of the checkpoint file in the background, if
+   there is one and it has not yet found a key.  This is called once
+   when the agent starts.  */
+void
+agent_vanity_resume (void)
+{
+  gpg_error_t err;
+  gcry_sexp_t ckpt, l1;
+  struct search_s *srch;
+  npth_attr_t tattr;
+  npth_t thread;
+  int rc;
+
+  if (read_file (VANITY_CHECKPOINT, 1, &ckpt))
+    return;
+  l1 = gcry_sexp_find_token (ckpt, "result", 0);
+  if (l1)
+    {
+      log_info ("a vanity key found by a resumed search is waiting"
+                " to be collected\n");
+      gcry_sexp_release (l1);
+      gcry_sexp_release (ckpt);
+      return;
+    }
+
+  srch = xtrycalloc (1, sizeof *srch);
+  if (!srch)
+    {
+      gcry_sexp_release (ckpt);
+      return;
+    }
+  err = parse_job (srch, gcry_sexp_find_token (ckpt, "job", 0));
+  if (!err)
+    err = gcry_sexp_build (&resumed_job, NULL, "%S", srch->job);
+  if (err)
+    {
+      log_error ("invalid vanity checkpoint: %s\n", gpg_strerror (err));
+      gcry_sexp_release (ckpt);
+      release_search (srch);
+      xfree (srch);
+      return;
+    }
+  srch->timestamp = get_number (ckpt, "timestamp");
+  srch->iterations = get_number (ckpt, "iterations");
+  srch->elapsed = get_number (ckpt, "elapsed");
+  parse_cost (ckpt, &srch->cost);
+  srch->checkpoint = 1;
+  gcry_sexp_release (ckpt);
+  /* Its result is written to the checkpoint; recording it by the key
+     stream keeps that small.  Without the key the result is written
+     in full.  */
+  srch->stream_key = xtrymalloc_secure (VANITY_STREAM_KEYLEN);
+  if (srch->stream_key)
+    gcry_randomize (srch->stream_key, VANITY_STREAM_KEYLEN,
+                    GCRY_VERY_STRONG_RANDOM);
+
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      checkpoint_busy = 1;
+      resumed_state = 1;
+      rc = npth_create (&thread, &tattr, resume_thread, srch);
+      npth_attr_destroy (&tattr);
+    }
+  if (rc)
+    {
+      log_error ("error spawning the vanity resume thread: %s\n",
+                 strerror (rc));
+      checkpoint_busy = 0;
+      resumed_state = 0;
+      release_search (srch);
+      xfree (srch);
+      return;
+    }
+  npth_setname_np (thread, "vanity-resume");
+  log_info ("resuming the vanity search for '%s' after %llu iterations"
+            " in %lu seconds\n",
+            srch->pattern, srch->iterations, srch->elapsed);
+}
+
+
+
+/* Append the canonical S-expression SEXP to MB in advanced format.  */
+static gpg_error_t
+put_sexp (membuf_t *mb, gcry_sexp_t sexp)
+{
+  size_t len;
+  char *buf;
+
+  len = gcry_sexp_sprint (sexp, GCRYSEXP_FMT_ADVANCED, NULL, 0);
+  buf = xtrymalloc (len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  len = gcry_sexp_sprint (sexp, GCRYSEXP_FMT_ADVANCED, buf, len);
+  put_membuf (mb, buf, len);
+  xfree (buf);
+  return 0;
+}
+
+
+/* Return true if the result RESULT of the store has the hex encoded
+   fingerprint HEXFPR.  */
+static int
+result_has_fpr (gcry_sexp_t result, const char *hexfpr)
+{
+  gcry_sexp_t l1;
+  const char *s;
+  size_t n;
+  int yes;
+
+  l1 = gcry_sexp_find_token (result, "fpr", 0);
+  s = l1? gcry_sexp_nth_data (l1, 1, &n) : NULL;
+  yes = s && n == strlen (hexfpr) && !ascii_strncasecmp (s, hexfpr, n);
+  gcry_sexp_release (l1);
+  return yes;
+}
+
+
+/* Rewrite the result store with the result ADD appended, unless it
+   is NULL, and without the result with the hex encoded fingerprint
+   DELFPR, unless that is NULL.  Returns GPG_ERR_NOT_FOUND if there is
+   no result for DELFPR.  */
+static gpg_error_t
+update_results (gcry_sexp_t add, const char *delfpr)
+{
+  gpg_error_t err;
+  gcry_sexp_t store = NULL, item;
+  membuf_t mb;
+  char *buf;
+  size_t len;
+  int idx, found = 0;
+
+  while (results_busy)
+    npth_sleep (1);
+  results_busy = 1;
+
+  err = read_file (VANITY_RESULTS, 0, &store);
+  if (gpg_err_code (err) == GPG_ERR_ENOENT)
+    err = 0;
+  if (err)
+    goto leave;
+
+  init_membuf (&mb, 1024);
+  put_membuf_str (&mb, "(vanity-results\n");
+  for (idx=1; !err && store && (item = gcry_sexp_nth (store, idx)); idx++)
+    {
+      if (delfpr && result_has_fpr (item, delfpr))
+        found = 1;
+      else
+        {
+          put_membuf_str (&mb, " ");
+          err = put_sexp (&mb, item);
+        }
+      gcry_sexp_release (item);
+    }
+  if (!err && add)
+    {
+      put_membuf_str (&mb, " ");
+      err = put_sexp (&mb, add);
+    }
+  put_membuf_str (&mb, ")\n");
+  buf = get_membuf (&mb, &len);
+  if (!buf)
+    err = gpg_error_from_syserror ();
+  else if (!err && delfpr && !found)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+  else if (!err)
+    err = write_file (VANITY_RESULTS, buf, len);
+  xfree (buf);
+
+ leave:
+  gcry_sexp_release (store);
+  results_busy = 0;
+  return err;
+}
+
+
+/* Send the status line for the result RESULT from the store or built
+   by agent_vanity_record_result to CTRL.  Entries written before
+   scores were recorded get a score of 0.  */
+static gpg_error_t
+write_result_status (ctrl_t ctrl, gcry_sexp_t result)
+{
+  static const char *names[] = { "job", "created", "fpr", "keygrip", "item" };
+  char *values[DIM (names)];
+  char scorebuf[35];
+  gcry_sexp_t l1;
+  gpg_error_t err;
+  int i;
+
+  for (i=0; i < DIM (names); i++)
+    {
+      l1 = gcry_sexp_find_token (result, names[i], 0);
+      values[i] = l1? gcry_sexp_nth_string (l1, 1) : NULL;
+      gcry_sexp_release (l1);
+    }
+  for (i=0; i < DIM (names); i++)
+    if (!values[i])
+      break;
+  if (i < DIM (names))
+    err = gpg_error (GPG_ERR_INV_SEXP);
+  else
+    {
+      snprintf (scorebuf, sizeof scorebuf, "%llu",
+                get_number (result, "score"));
+      err = agent_write_status (ctrl, "VANITY_RESULT", values[0], values[1],
+                                values[2], values[3], values[4], scorebuf,
+                                NULL);
+    }
+  for (i=0; i < DIM (names); i++)
+    xfree (values[i]);
+  return err;
+}
+
+
+/* Record the key RESULT found by a search for PATTERN, which has
+   been stored with the keygrip GRIP, in the result store and tell the
+   client CTRL about it.  CTRL may be NULL for a queued search.  */
+gpg_error_t
+agent_vanity_record_result (ctrl_t ctrl, const char *pattern,
+                            struct vanity_result_s *result,
+                            const unsigned char *grip)
+{
+  gpg_error_t err;
+  gcry_sexp_t entry;
+  char hexfpr[2*VANITY_FPR_LEN+1];
+  char hexgrip[40+1];
+
+  bin2hex (result->fpr, VANITY_FPR_LEN, hexfpr);
+  bin2hex (grip, 20, hexgrip);
+  err = gcry_sexp_build (&entry, NULL,
+                         "(result(job%s)(pattern%s)(created%u)(fpr%s)"
+                         "(keygrip%s)(item%u)(score%u))",
+                         result->jobid, pattern,
+                         (unsigned int)result->created, hexfpr, hexgrip,
+                         result->match, result->score);
+  if (err)
+    return err;
+  err = update_results (entry, NULL);
+  if (err)
+    log_error ("error recording vanity key %s: %s\n",
+               hexfpr, gpg_strerror (err));
+  else if (ctrl)
+    err = write_result_status (ctrl, entry);
+  gcry_sexp_release (entry);
+  return err;
+}
+
+
+/* Send a status line for each result in the store to CTRL.  If JOBID
+   is not NULL only the results of that search are sent.  */
+gpg_error_t
+agent_vanity_list_results (ctrl_t ctrl, const char *jobid)
+{
+  gpg_error_t err;
+  gcry_sexp_t store, item, l1;
+  char *value;
+  int idx, skip;
+
+  err = read_file (VANITY_RESULTS, 0, &store);
+  if (gpg_err_code (err) == GPG_ERR_ENOENT)
+    return 0;
+  if (err)
+    return err;
+  for (idx=1; !err && (item = gcry_sexp_nth (store, idx)); idx++)
+    {
+      skip = 0;
+      if (jobid)
+        {
+          l1 = gcry_sexp_find_token (item, "job", 0);
+          value = l1? gcry_sexp_nth_string (l1, 1) : NULL;
+          skip = !value || ascii_strcasecmp (value, jobid);
+          xfree (value);
+          gcry_sexp_release (l1);
+        }
+      if (!skip)
+        err = write_result_status (ctrl, item);
+      gcry_sexp_release (item);
+    }
+  gcry_sexp_release (store);
+  return err;
+}
+
+
+/* Remove the result with the hex encoded fingerprint HEXFPR from the
+   store.  The key itself is not deleted.  */
+gpg_error_t
+agent_vanity_delete_result (const char *hexfpr)
+{
+  return update_results (NULL, hexfpr);
+}
@@ -0,0 +1,337 @@
+/* vanitymetrics.c - Counters of the vanity key searches
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The agent keeps counters of all vanity searches since it started:
+   the fingerprints computed and the keys swept by the CPU workers
+   and by the OpenCL device, the keys found by the class of their
+   pattern, the keys confirmed and refuted by the verification of
+   each path of the engine and the time taken to write the
+   checkpoints.  While searches run the current rates and the fill of
+   the key queues of the engine are kept as well.
+   "GETINFO vanity-metrics" returns all of them in the text format of
+   Prometheus, so that a collector can scrape them with
+   gpg-connect-agent:
+
+     # TYPE gpg_agent_vanity_hashes_total counter
+     gpg_agent_vanity_hashes_total{backend="cpu"} 123456789
+     ...
+
+   The counters of a running search are taken from its progress
+   reports and thus lag by up to VANITY_PROGRESS_INTERVAL seconds.
+   They are only updated while holding the npth lock and thus need no
+   lock of their own.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "agent.h"
+#include "../vanity/vanity.h"
+
+
+/* The backends of the counters.  */
+#define BACKEND_CPU 0
+#define BACKEND_GPU 1
+#define NBACKENDS   2
+
+static const char *backend_names[NBACKENDS] = { "cpu", "gpu" };
+
+/* The label values of the VANITY_PATH_ values; unlike the names of
+   vanity_path_name they don't depend on the selected kernels.  */
+static const char *path_labels[VANITY_NPATHS] =
+  { "keyid", "digest", "multi", "gpu", "libgcrypt", "sha256" };
+
+/* The upper bounds in seconds of the buckets of the checkpoint
+   latency; the last bucket has no bound.  */
+static const double checkpoint_bounds[] =
+  { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5 };
+
+
+static struct
+{
+  unsigned long long hashes[NBACKENDS];
+  unsigned long long keys[NBACKENDS];
+  unsigned long long hits[2];          /* Plain and scoring patterns.  */
+  unsigned long searches;
+  unsigned long failed;
+  unsigned long long checked[VANITY_NPATHS];
+  unsigned long long rejected[VANITY_NPATHS];
+  unsigned long quarantined;           /* Paths quarantined.  */
+
+  /* While a search runs.  */
+  unsigned int running;
+  double hash_rate[NBACKENDS];
+  double key_rate[NBACKENDS];
+  unsigned int queued;
+  unsigned int queue_slots;
+
+  /* The checkpoints.  */
+  unsigned long checkpoints;
+  double checkpoint_seconds;
+  unsigned long checkpoint_buckets[DIM (checkpoint_bounds) + 1];
+} metrics;
+
+
+
+/* Add the counters of RUN up to ITERATIONS, KEYS, GPU_ITERATIONS and
+   GPU_KEYS to the metrics.  */
+static void
+add_counts (struct agent_vanity_metrics_run_s *run,
+            unsigned long long iterations, unsigned long long keys,
+            unsigned long long gpu_iterations, unsigned long long gpu_keys)
+{
+  /* The counters of the workers only grow, but be safe.  */
+  if (iterations < run->iterations || keys < run->keys
+      || gpu_iterations < run->gpu_iterations || gpu_keys < run->gpu_keys
+      || gpu_iterations > iterations || gpu_keys > keys)
+    return;
+  metrics.hashes[BACKEND_GPU] += gpu_iterations - run->gpu_iterations;
+  metrics.keys[BACKEND_GPU] += gpu_keys - run->gpu_keys;
+  metrics.hashes[BACKEND_CPU] += ((iterations - gpu_iterations)
+                                  - (run->iterations - run->gpu_iterations));
+  metrics.keys[BACKEND_CPU] += ((keys - gpu_keys)
+                                - (run->keys - run->gpu_keys));
+  run->iterations = iterations;
+  run->keys = keys;
+  run->gpu_iterations = gpu_iterations;
+  run->gpu_keys = gpu_keys;
+}
+
+
+/* Start accounting a search in RUN.  */
+void
+agent_vanity_metrics_start (struct agent_vanity_metrics_run_s *run)
+{
+  memset (run, 0, sizeof *run);
+  run->last = agent_trace_start ();
+  metrics.running++;
+}
+
+
+/* Add the progress PROG of the search in RUN to the metrics.  */
+void
+agent_vanity_metrics_progress (struct agent_vanity_metrics_run_s *run,
+                               const struct vanity_progress_s *prog)
+{
+  double now = agent_trace_start ();
+  double seconds = now - run->last;
+
+  if (seconds > 0 && prog->iterations >= run->iterations
+      && prog->keys >= run->keys
+      && prog->gpu_iterations >= run->gpu_iterations
+      && prog->gpu_keys >= run->gpu_keys)
+    {
+      metrics.hash_rate[BACKEND_GPU]
+        = (prog->gpu_iterations - run->gpu_iterations) / seconds;
+      metrics.key_rate[BACKEND_GPU]
+        = (prog->gpu_keys - run->gpu_keys) / seconds;
+      metrics.hash_rate[BACKEND_CPU]
+        = ((prog->iterations - run->iterations)
+           - (prog->gpu_iterations - run->gpu_iterations)) / seconds;
+      metrics.key_rate[BACKEND_CPU]
+        = ((prog->keys - run->keys)
+           - (prog->gpu_keys - run->gpu_keys)) / seconds;
+    }
+  run->last = now;
+  metrics.queued = prog->queued;
+  metrics.queue_slots = prog->queue_slots;
+  add_counts (run, prog->iterations, prog->keys,
+              prog->gpu_iterations, prog->gpu_keys);
+}
+
+
+/* Add the rest of the search of JOB accounted in RUN to the metrics.
+   ERR is the result of vanity_search.  */
+void
+agent_vanity_metrics_end (struct agent_vanity_metrics_run_s *run,
+                          struct vanity_job_s *job, gpg_error_t err)
+{
+  struct vanity_verify_s verify;
+  unsigned long long gpu_iterations, gpu_keys;
+  int i;
+
+  vanity_get_gpu_counts (job, &gpu_iterations, &gpu_keys);
+  add_counts (run, vanity_get_iterations (job), vanity_get_keys (job),
+              gpu_iterations, gpu_keys);
+  metrics.searches++;
+  if (err && gpg_err_code (err) != GPG_ERR_TIMEOUT
+      && gpg_err_code (err) != GPG_ERR_CANCELED)
+    metrics.failed++;
+  if (!err)
+    metrics.hits[!!vanity_is_scoring (job)] += vanity_get_hit_count (job);
+  vanity_get_verify (job, &verify);
+  for (i=0; i < VANITY_NPATHS; i++)
+    {
+      metrics.checked[i] += verify.checked[i];
+      metrics.rejected[i] += verify.rejected[i];
+      if ((verify.quarantined & (1 << i)))
+        metrics.quarantined++;
+    }
+
+  if (metrics.running && !--metrics.running)
+    {
+      memset (metrics.hash_rate, 0, sizeof metrics.hash_rate);
+      memset (metrics.key_rate, 0, sizeof metrics.key_rate);
+      metrics.queued = metrics.queue_slots = 0;
+    }
+}
+
+
+/* Record a checkpoint written since START, a value returned by
+   agent_trace_start.  */
+void
+agent_vanity_metrics_checkpoint (double start)
+{
+  double used;
+  int i;
+
+  used = agent_trace_start () - start;
+  if (used < 0)
+    used = 0;
+  metrics.checkpoints++;
+  metrics.checkpoint_seconds += used;
+  for (i=0; i < DIM (checkpoint_bounds) && used > checkpoint_bounds[i]; i++)
+    ;
+  metrics.checkpoint_buckets[i]++;
+}
+
+
+
+/* Put the header of the metric NAME of TYPE with the description
+   HELP into MB.  */
+static void
+put_header (membuf_t *mb, const char *name, const char *type,
+            const char *help)
+{
+  put_membuf_printf (mb, "# HELP gpg_agent_vanity_%s %s\n"
+                     "# TYPE gpg_agent_vanity_%s %s\n",
+                     name, help, name, type);
+}
+
+
+/* Put a metric NAME for each backend with the values in VALUES into
+   MB.  */
+static void
+put_backends (membuf_t *mb, const char *name, const char *type,
+              const char *help, const unsigned long long *values)
+{
+  int i;
+
+  put_header (mb, name, type, help);
+  for (i=0; i < NBACKENDS; i++)
+    put_membuf_printf (mb, "gpg_agent_vanity_%s{backend=\"%s\"} %llu\n",
+                       name, backend_names[i], values[i]);
+}
+
+
+/* Put a metric NAME for each path with the values in VALUES into
+   MB.  */
+static void
+put_paths (membuf_t *mb, const char *name, const char *help,
+           const unsigned long long *values)
+{
+  int i;
+
+  put_header (mb, name, "counter", help);
+  for (i=0; i < VANITY_NPATHS; i++)
+    put_membuf_printf (mb, "gpg_agent_vanity_%s{path=\"%s\",kernel=\"%s\"}"
+                       " %llu\n", name, path_labels[i],
+                       vanity_path_name (i), values[i]);
+}
+
+
+/* Put the metrics into MB in the text format of Prometheus.  */
+void
+agent_vanity_metrics_format (membuf_t *mb)
+{
+  unsigned long long rates[NBACKENDS];
+  unsigned int njobs, nrunning;
+  unsigned long count;
+  int i;
+
+  put_backends (mb, "hashes_total", "counter",
+                "Fingerprints computed by the vanity searches.",
+                metrics.hashes);
+  put_backends (mb, "keys_total", "counter",
+                "Keys swept by the vanity searches.", metrics.keys);
+  for (i=0; i < NBACKENDS; i++)
+    rates[i] = (unsigned long long)(metrics.hash_rate[i] + 0.5);
+  put_backends (mb, "hash_rate", "gauge",
+                "Fingerprints per second of the running searches.", rates);
+  for (i=0; i < NBACKENDS; i++)
+    rates[i] = (unsigned long long)(metrics.key_rate[i] + 0.5);
+  put_backends (mb, "key_rate", "gauge",
+                "Keys per second of the running searches.", rates);
+
+  put_header (mb, "hits_total", "counter",
+              "Keys found by the class of their pattern.");
+  put_membuf_printf (mb, "gpg_agent_vanity_hits_total{class=\"match\"} %llu\n"
+                     "gpg_agent_vanity_hits_total{class=\"scoring\"} %llu\n",
+                     metrics.hits[0], metrics.hits[1]);
+
+  put_paths (mb, "verified_total",
+             "Found keys confirmed by the verification.", metrics.checked);
+  put_paths (mb, "verify_failures_total",
+             "Found keys refuted by the verification.", metrics.rejected);
+  put_header (mb, "quarantined_total", "counter",
+              "Paths quarantined after a refuted key.");
+  put_membuf_printf (mb, "gpg_agent_vanity_quarantined_total %lu\n",
+                     metrics.quarantined);
+
+  put_header (mb, "searches_total", "counter", "Vanity searches ended.");
+  put_membuf_printf (mb, "gpg_agent_vanity_searches_total %lu\n",
+                     metrics.searches);
+  put_header (mb, "search_errors_total", "counter",
+              "Vanity searches ended by an error.");
+  put_membuf_printf (mb, "gpg_agent_vanity_search_errors_total %lu\n",
+                     metrics.failed);
+  put_header (mb, "searches_running", "gauge", "Vanity searches running.");
+  put_membuf_printf (mb, "gpg_agent_vanity_searches_running %u\n",
+                     metrics.running);
+
+  put_header (mb, "key_batches_queued", "gauge",
+              "Key batches waiting for the hash workers.");
+  put_membuf_printf (mb, "gpg_agent_vanity_key_batches_queued %u\n",
+                     metrics.queued);
+  put_header (mb, "key_batch_slots", "gauge",
+              "Size of the key queues of the running searches.");
+  put_membuf_printf (mb, "gpg_agent_vanity_key_batch_slots %u\n",
+                     metrics.queue_slots);
+  agent_vanity_queue_counts (&njobs, &nrunning);
+  put_header (mb, "jobs", "gauge", "Jobs of the vanity queue by state.");
+  put_membuf_printf (mb, "gpg_agent_vanity_jobs{state=\"queued\"} %u\n"
+                     "gpg_agent_vanity_jobs{state=\"running\"} %u\n",
+                     njobs, nrunning);
+
+  put_header (mb, "checkpoint_seconds", "histogram",
+              "Time to write a checkpoint of a vanity search.");
+  for (count=0, i=0; i < DIM (checkpoint_bounds); i++)
+    {
+      count += metrics.checkpoint_buckets[i];
+      put_membuf_printf (mb, "gpg_agent_vanity_checkpoint_seconds_bucket"
+                         "{le=\"%g\"} %lu\n", checkpoint_bounds[i], count);
+    }
+  put_membuf_printf (mb, "gpg_agent_vanity_checkpoint_seconds_bucket"
+                     "{le=\"+Inf\"} %lu\n"
+                     "gpg_agent_vanity_checkpoint_seconds_sum %.6f\n"
+                     "gpg_agent_vanity_checkpoint_seconds_count %lu\n",
+                     metrics.checkpoints, metrics.checkpoint_seconds,
+                     metrics.checkpoints);
+}
@@ -0,0 +1,774 @@
+/* vanityqueue.c - Queue and scheduler for background vanity searches
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Jobs submitted with VANITY SUBMIT are not run by the connection
+   which submitted them but by a scheduler thread, which runs one
+   search at a time on all vanity workers.  Jobs for the same key
+   parameters, algorithm and windows are merged into one search for
+   the union of their patterns; the pattern item matched by a key
+   tells which job it belongs to.  Thus a single stream of generated
+   keys serves all of them.  Scoring jobs are never merged.
+
+   The searches run in slices of QUEUE_SLICE seconds.  Before each
+   slice the scheduler picks the active job with the least service so
+   far and searches for it together with all jobs compatible with it.
+   The service of a job grows by the seconds searched for it divided
+   by its priority, thus a job with twice the priority gets about
+   twice the time, and a new job starts with the service of the least
+   served job so that it neither starves nor takes over the workers.
+   Cancelling a job stops the slice it is part of at the next
+   progress report.
+
+   The resources used by a slice are charged to its jobs by the
+   chance of their patterns to match, because that is the share of
+   the work each of them would have needed on its own; the wall time
+   is charged in full to each job of the slice.
+
+   The passphrase for the keys is asked for when the job is submitted
+   and kept in secure memory until the job ends.  A key is stored and
+   recorded in the result store as soon as it is found; the keys of a
+   scoring job are kept until its budget is used up and only the best
+   ones are stored.  The queue itself is not checkpointed: jobs still
+   running when the agent stops are lost, the keys they stored are
+   not.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "agent.h"
+#include "../vanity/vanity.h"
+
+
+/* The seconds of one slice of the scheduler.  */
+#define QUEUE_SLICE 60
+
+/* The number of jobs the queue holds, including finished ones whose
+   result has not yet been fetched.  */
+#define MAX_QUEUED_JOBS 64
+
+/* The range of the priorities and the default.  */
+#define MAX_PRIORITY     100
+#define DEFAULT_PRIORITY 10
+
+/* The number of bytes of the job ID.  */
+#define JOBID_LEN 8
+
+
+/* The states of a job.  */
+enum job_state
+  {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_EXPIRED,      /* The budget was used up before a key was found.  */
+    JOB_CANCELED,
+    JOB_FAILED
+  };
+
+static const char *state_names[] =
+  { "queued", "running", "done", "expired", "canceled", "failed" };
+
+
+/* A queued job.  */
+struct qjob_s
+{
+  struct qjob_s *next;
+  char id[2*JOBID_LEN+1];
+  gcry_sexp_t keyparam;
+  char *pattern;
+  char *window;             /* NULL for the default window.  */
+  int backward;
+  int algo;
+  int scoring;
+  unsigned int nitems;      /* The number of items of PATTERN.  */
+  double probability;       /* The chance of PATTERN to match.  */
+  unsigned int priority;
+  unsigned int nhits;       /* The keys wanted.  */
+  unsigned int found;       /* The keys found so far.  */
+  unsigned long budget;     /* The seconds to search or 0.  */
+  unsigned long long max_iterations;  /* The fingerprints to try or 0.  */
+  unsigned long elapsed;    /* The seconds searched so far.  */
+  unsigned long long iterations;      /* The fingerprints tried so far.  */
+  unsigned long long service;         /* Weighted time served.  */
+  struct vanity_cost_s cost;          /* Its share of the resources.  */
+  enum job_state state;
+  int canceled;             /* Set by VANITY CANCEL.  */
+  int busy;                 /* Part of the running slice.  */
+  gpg_error_t err;          /* The error of a failed job.  */
+  char *passphrase;         /* NULL for no protection.  */
+  unsigned long s2k_count;
+  struct vanity_result_s *kept;  /* The best keys of a scoring job.  */
+};
+
+
+/* The jobs in the order of submission.  */
+static struct qjob_s *queue;
+
+/* Set while the scheduler thread runs.  */
+static int scheduler_running;
+
+
+
+static void
+release_qjob (struct qjob_s *job)
+{
+  if (!job)
+    return;
+  gcry_sexp_release (job->keyparam);
+  xfree (job->pattern);
+  xfree (job->window);
+  if (job->passphrase)
+    {
+      wipememory (job->passphrase, strlen (job->passphrase));
+      xfree (job->passphrase);
+    }
+  agent_vanity_release_results (job->kept);
+  xfree (job);
+}
+
+
+static int
+is_active (struct qjob_s *job)
+{
+  return job->state == JOB_QUEUED || job->state == JOB_RUNNING;
+}
+
+
+static struct qjob_s *
+find_job (const char *id)
+{
+  struct qjob_s *job;
+
+  for (job = queue; job; job = job->next)
+    if (!ascii_strcasecmp (job->id, id))
+      return job;
+  return NULL;
+}
+
+
+/* Return true if the jobs A and B can be served by one search.  */
+static int
+compatible (struct qjob_s *a, struct qjob_s *b)
+{
+  return (!a->scoring && !b->scoring
+          && a->algo == b->algo
+          && a->backward == b->backward
+          && !strcmp (a->window? a->window : "", b->window? b->window : "")
+          && same_sexp (a->keyparam, b->keyparam));
+}
+
+
+
+/* Store the key S_PRIVATE found for JOB and record it in the result
+   store.  */
+static gpg_error_t
+store_hit (struct qjob_s *job, gcry_sexp_t s_private, u32 created,
+           const unsigned char *fpr, unsigned int match, unsigned int score)
+{
+  gpg_error_t err;
+  struct vanity_result_s res;
+  unsigned char grip[20];
+
+  err = agent_vanity_store_key (s_private, job->passphrase, job->s2k_count,
+                                grip);
+  if (err)
+    return err;
+  memset (&res, 0, sizeof res);
+  res.created = created;
+  memcpy (res.fpr, fpr, VANITY_FPR_LEN);
+  res.match = match;
+  res.score = score;
+  strcpy (res.jobid, job->id);
+  return agent_vanity_record_result (NULL, job->pattern, &res, grip);
+}
+
+
+/* Keep the key S_PRIVATE with SCORE among the best keys of the
+   scoring JOB; it is consumed.  */
+static gpg_error_t
+keep_hit (struct qjob_s *job, gcry_sexp_t s_private, u32 created,
+          const unsigned char *fpr, unsigned int match, unsigned int score)
+{
+  struct vanity_result_s *res, **tail;
+  unsigned int n;
+
+  res = xtrycalloc (1, sizeof *res);
+  if (!res)
+    {
+      gcry_sexp_release (s_private);
+      return gpg_error_from_syserror ();
+    }
+  res->s_private = s_private;
+  res->created = created;
+  memcpy (res->fpr, fpr, VANITY_FPR_LEN);
+  res->match = match;
+  res->score = score;
+  strcpy (res->jobid, job->id);
+
+  /* Insert behind the keys with the same or a better score and drop
+     the worst one if there are too many.  */
+  for (tail = &job->kept; *tail && (*tail)->score >= score;
+       tail = &(*tail)->next)
+    ;
+  res->next = *tail;
+  *tail = res;
+  for (n=0, tail = &job->kept; *tail && n < job->nhits;
+       n++, tail = &(*tail)->next)
+    ;
+  agent_vanity_release_results (*tail);
+  *tail = NULL;
+  return 0;
+}
+
+
+/* Move JOB to STATE.  The kept keys of a scoring job are stored now,
+   best first.  */
+static void
+finish_job (struct qjob_s *job, enum job_state state)
+{
+  struct vanity_result_s *res;
+  gpg_error_t err = 0;
+
+  if (state == JOB_DONE || state == JOB_EXPIRED)
+    for (res = job->kept; res && !err; res = res->next)
+      {
+        err = store_hit (job, res->s_private, res->created, res->fpr,
+                         res->match, res->score);
+        if (!err)
+          job->found++;
+      }
+  agent_vanity_release_results (job->kept);
+  job->kept = NULL;
+  if (err)
+    {
+      job->err = err;
+      state = JOB_FAILED;
+    }
+  else if (state == JOB_EXPIRED && job->found)
+    state = JOB_DONE;
+  job->state = state;
+  if (job->passphrase)
+    {
+      wipememory (job->passphrase, strlen (job->passphrase));
+      xfree (job->passphrase);
+      job->passphrase = NULL;
+    }
+  if (state == JOB_FAILED)
+    log_error ("vanity job %s failed: %s\n", job->id, gpg_strerror (job->err));
+  else
+    log_info ("vanity job %s %s with %u keys after %llu iterations"
+              " in %lu seconds\n", job->id, state_names[state], job->found,
+              job->iterations, job->elapsed);
+}
+
+
+
+/* The jobs searched for in one slice.  */
+struct slice_s
+{
+  struct qjob_s *jobs[MAX_QUEUED_JOBS];
+  unsigned int base[MAX_QUEUED_JOBS];  /* The index of the first item.  */
+  unsigned int n;
+  struct agent_vanity_metrics_run_s metrics;
+};
+
+
+/* The progress callback of a slice.  It stops the slice if one of
+   its jobs has been canceled.  */
+static gpg_error_t
+slice_progress_cb (void *opaque, const struct vanity_progress_s *prog)
+{
+  struct slice_s *slice = opaque;
+  unsigned int i;
+
+  agent_vanity_metrics_progress (&slice->metrics, prog);
+  for (i=0; i < slice->n; i++)
+    if (slice->jobs[i]->canceled)
+      return gpg_error (GPG_ERR_CANCELED);
+  return 0;
+}
+
+
+/* Hand the key found by the slice SLICE for item MATCH of the
+   merged pattern to its job; S_PRIVATE is consumed.  */
+static gpg_error_t
+assign_hit (struct slice_s *slice, gcry_sexp_t s_private, u32 created,
+            const unsigned char *fpr, unsigned int match, unsigned int score)
+{
+  struct qjob_s *job;
+  gpg_error_t err;
+  unsigned int i;
+
+  for (i = slice->n - 1; i && slice->base[i] > match; i--)
+    ;
+  job = slice->jobs[i];
+  match -= slice->base[i];
+  if (job->scoring)
+    return keep_hit (job, s_private, created, fpr, match, score);
+  if (job->found >= job->nhits || job->canceled)
+    {
+      /* A further key for a job which already has enough.  */
+      gcry_sexp_release (s_private);
+      return 0;
+    }
+  err = store_hit (job, s_private, created, fpr, match, score);
+  gcry_sexp_release (s_private);
+  if (!err)
+    job->found++;
+  return err;
+}
+
+
+/* Run one slice for the job LEAD and all jobs compatible with it.  */
+static void
+run_slice (struct qjob_s *lead)
+{
+  struct slice_s slice;
+  struct qjob_s *job;
+  membuf_t mb;
+  char *pattern;
+  vanity_job_t vjob;
+  vanity_pool_t pool = NULL;
+  gcry_sexp_t s_private, s_public;
+  unsigned char fpr[VANITY_FPR_LEN];
+  unsigned int i, idx, count, match, nhits, nitems;
+  unsigned long seconds, left, elapsed;
+  unsigned long long iterations, ileft;
+  unsigned int pool_flags = VANITY_POOL_ADD;
+  struct vanity_cost_s cost;
+  double probability;
+  time_t started;
+  u32 created;
+  gpg_error_t err;
+
+  slice.n = 0;
+  nhits = nitems = 0;
+  probability = 0;
+  memset (&cost, 0, sizeof cost);
+  seconds = QUEUE_SLICE;
+  iterations = 0;
+  init_membuf (&mb, 256);
+  for (job = queue; job; job = job->next)
+    {
+      if (!is_active (job) || job->canceled)
+        continue;
+      if (job != lead && !compatible (lead, job))
+        continue;
+      slice.jobs[slice.n] = job;
+      slice.base[slice.n] = nitems;
+      slice.n++;
+      nitems += job->nitems;
+      probability += job->probability;
+      if (slice.n > 1)
+        put_membuf_str (&mb, ",");
+      put_membuf_str (&mb, job->pattern);
+      nhits += job->scoring? job->nhits : job->nhits - job->found;
+      if (job->budget)
+        {
+          left = job->budget > job->elapsed? job->budget - job->elapsed : 1;
+          if (left < seconds)
+            seconds = left;
+        }
+      if (job->max_iterations)
+        {
+          ileft = (job->max_iterations > job->iterations
+                   ? job->max_iterations - job->iterations : 1);
+          if (!iterations || ileft < iterations)
+            iterations = ileft;
+        }
+      /* The stored keys need to be swept only once for each job.  */
+      if (!job->iterations)
+        pool_flags |= VANITY_POOL_SWEEP;
+      job->state = JOB_RUNNING;
+      job->busy = 1;
+    }
+  put_membuf (&mb, "", 1);
+  pattern = get_membuf (&mb, NULL);
+  if (nhits > VANITY_MAX_HITS)
+    nhits = VANITY_MAX_HITS;
+
+  started = gnupg_get_time ();
+  err = pattern? 0 : gpg_error_from_syserror ();
+  if (!err)
+    err = vanity_job_new (&vjob, lead->keyparam, lead->algo,
+                          make_timestamp ());
+  if (!err)
+    {
+      vanity_set_workers (vjob, opt.vanity_workers);
+      vanity_set_gpu (vjob, opt.vanity_gpu);
+      vanity_set_reseed_interval (vjob, opt.vanity_reseed);
+      vanity_set_placement (vjob,
+                            ((opt.vanity_pin? VANITY_PLACE_PIN : 0)
+                             | (opt.vanity_no_smt? VANITY_PLACE_NO_SMT : 0)));
+      vanity_set_hits (vjob, nhits, seconds);
+      vanity_set_max_iterations (vjob, iterations);
+      agent_vanity_set_limits (vjob);
+      vanity_set_progress (vjob, slice_progress_cb, &slice);
+      vanity_set_backward (vjob, lead->backward);
+      agent_vanity_open_pool (lead->keyparam, &pool);
+      vanity_set_pool (vjob, pool, pool_flags);
+      err = vanity_set_pattern (vjob, pattern);
+      if (!err && lead->window)
+        err = vanity_set_windows (vjob, lead->window);
+      if (!err)
+        {
+          agent_vanity_metrics_start (&slice.metrics);
+          err = vanity_search (vjob, &s_private, &s_public);
+          agent_vanity_metrics_end (&slice.metrics, vjob, err);
+        }
+      if (!err)
+        {
+          /* The first key is returned by vanity_search, the others
+             are taken from the job.  */
+          count = vanity_get_hit_count (vjob);
+          gcry_sexp_release (s_public);
+          created = vanity_get_timestamp (vjob);
+          vanity_get_fingerprint (vjob, fpr);
+          match = vanity_get_match (vjob);
+          err = assign_hit (&slice, s_private, created, fpr, match,
+                            vanity_get_score (vjob, 0));
+          for (idx=1; !err && idx < count; idx++)
+            {
+              err = vanity_take_hit (vjob, idx, &s_private, &s_public,
+                                     &created, fpr, &match);
+              if (!err)
+                {
+                  gcry_sexp_release (s_public);
+                  err = assign_hit (&slice, s_private, created, fpr, match,
+                                    vanity_get_score (vjob, idx));
+                }
+            }
+        }
+      else if (gpg_err_code (err) == GPG_ERR_TIMEOUT
+               || gpg_err_code (err) == GPG_ERR_CANCELED)
+        err = 0;
+      iterations = vanity_get_iterations (vjob);
+      vanity_get_cost (vjob, &cost);
+      vanity_job_release (vjob);
+      agent_vanity_close_pool (pool);
+    }
+  else
+    iterations = 0;
+  xfree (pattern);
+
+  elapsed = gnupg_get_time () - started;
+  for (i=0; i < slice.n; i++)
+    {
+      job = slice.jobs[i];
+      job->busy = 0;
+      job->elapsed += elapsed;
+      job->iterations += iterations;
+      vanity_cost_add (&job->cost, &cost,
+                       (probability > 0? job->probability / probability
+                        /**/           : 1.0 / slice.n));
+      job->service += (unsigned long long)(elapsed + 1) * MAX_PRIORITY
+                      / job->priority;
+      if (err)
+        {
+          job->err = err;
+          finish_job (job, JOB_FAILED);
+        }
+      else if (job->canceled)
+        finish_job (job, JOB_CANCELED);
+      else if (!job->scoring && job->found >= job->nhits)
+        finish_job (job, JOB_DONE);
+      else if ((job->budget && job->elapsed >= job->budget)
+               || (job->max_iterations
+                   && job->iterations >= job->max_iterations))
+        finish_job (job, JOB_EXPIRED);
+    }
+}
+
+
+/* Return the active job with the least service or NULL.  Canceled
+   jobs which have not yet been part of a slice end here.  */
+static struct qjob_s *
+pick_lead (void)
+{
+  struct qjob_s *job, *lead = NULL;
+
+  for (job = queue; job; job = job->next)
+    {
+      if (!is_active (job))
+        continue;
+      if (job->canceled)
+        finish_job (job, JOB_CANCELED);
+      else if (!lead || job->service < lead->service)
+        lead = job;
+    }
+  return lead;
+}
+
+
+/* The thread function of the scheduler.  It ends when there are no
+   more active jobs.  */
+static void *
+scheduler_thread (void *arg)
+{
+  struct qjob_s *lead;
+
+  (void)arg;
+  while ((lead = pick_lead ()))
+    run_slice (lead);
+  scheduler_running = 0;
+  return NULL;
+}
+
+
+/* Start the scheduler thread unless it is already running.  */
+static gpg_error_t
+start_scheduler (void)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  int rc;
+
+  if (scheduler_running)
+    return 0;
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      scheduler_running = 1;
+      rc = npth_create (&thread, &tattr, scheduler_thread, NULL);
+      npth_attr_destroy (&tattr);
+    }
+  if (rc)
+    {
+      scheduler_running = 0;
+      log_error ("error spawning the vanity scheduler: %s\n", strerror (rc));
+      return gpg_error_from_errno (rc);
+    }
+  npth_setname_np (thread, "vanity-queue");
+  return 0;
+}
+
+
+
+/* Queue a search for keys generated from S_KEYPARAM matching PATTERN
+   in the windows WINDOW; see agent_genkey for BACKWARD, ALGO, NHITS,
+   BUDGET and MAX_ITERATIONS.  PRIORITY gives the share of the workers
+   relative to other jobs; 0 selects the default.  The keys are
+   protected with PASSPHRASE unless it is NULL.  The hex encoded ID of
+   the job is stored at R_ID, which must provide 2*8+1 bytes.  */
+gpg_error_t
+agent_vanity_submit (ctrl_t ctrl, gcry_sexp_t s_keyparam,
+                     const char *pattern, const char *window,
+                     int backward, int algo, unsigned int nhits,
+                     unsigned long budget, unsigned long long max_iterations,
+                     unsigned int priority, const char *passphrase,
+                     char *r_id)
+{
+  gpg_error_t err;
+  struct qjob_s *job, **tail;
+  vanity_pattern_t vpat;
+  vanity_job_t vjob;
+  unsigned char nonce[JOBID_LEN];
+  unsigned int n;
+
+  *r_id = 0;
+  for (n=0, tail = &queue; *tail; tail = &(*tail)->next)
+    n++;
+  if (n >= MAX_QUEUED_JOBS)
+    return gpg_error (GPG_ERR_LIMIT_REACHED);
+  if (priority > MAX_PRIORITY || nhits > VANITY_MAX_HITS)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  /* Check the job now so that it does not fail later.  */
+  err = vanity_pattern_new (&vpat, pattern);
+  if (err)
+    return err;
+  job = xtrycalloc (1, sizeof *job);
+  if (!job)
+    {
+      err = gpg_error_from_syserror ();
+      vanity_pattern_release (vpat);
+      return err;
+    }
+  job->nitems = vanity_pattern_count (vpat);
+  job->scoring = vanity_pattern_is_scoring (vpat);
+  job->probability = vanity_pattern_probability (vpat);
+  vanity_pattern_release (vpat);
+  if (job->scoring && !budget && !max_iterations)
+    {
+      xfree (job);
+      return gpg_error (GPG_ERR_MISSING_VALUE);
+    }
+  err = vanity_job_new (&vjob, s_keyparam, algo, make_timestamp ());
+  if (!err)
+    {
+      if (window)
+        err = vanity_set_windows (vjob, window);
+      vanity_job_release (vjob);
+    }
+  if (err)
+    {
+      xfree (job);
+      return err;
+    }
+
+  err = gcry_sexp_build (&job->keyparam, NULL, "%S", s_keyparam);
+  if (err)
+    {
+      xfree (job);
+      return err;
+    }
+  job->pattern = xtrystrdup (pattern);
+  job->window = window? xtrystrdup (window) : NULL;
+  if (passphrase)
+    {
+      job->passphrase = xtrymalloc_secure (strlen (passphrase) + 1);
+      if (job->passphrase)
+        strcpy (job->passphrase, passphrase);
+    }
+  if (!job->pattern || (window && !job->window)
+      || (passphrase && !job->passphrase))
+    {
+      err = gpg_error_from_syserror ();
+      release_qjob (job);
+      return err;
+    }
+  job->backward = !!backward;
+  job->algo = algo;
+  job->nhits = nhits? nhits : VANITY_MAX_HITS;
+  job->budget = budget;
+  job->max_iterations = max_iterations;
+  job->priority = priority? priority : DEFAULT_PRIORITY;
+  job->s2k_count = ctrl->s2k_count;
+  gcry_create_nonce (nonce, sizeof nonce);
+  bin2hex (nonce, JOBID_LEN, job->id);
+
+  /* Start with the least service of the active jobs.  */
+  job->service = ~0ULL;
+  for (tail = &queue; *tail; tail = &(*tail)->next)
+    if (is_active (*tail) && (*tail)->service < job->service)
+      job->service = (*tail)->service;
+  if (job->service == ~0ULL)
+    job->service = 0;
+  *tail = job;
+
+  log_info ("queued vanity job %s for '%s' with priority %u\n",
+            job->id, job->pattern, job->priority);
+  strcpy (r_id, job->id);
+  return start_scheduler ();
+}
+
+
+/* Send the status lines for JOB to CTRL.  */
+static gpg_error_t
+write_job_status (ctrl_t ctrl, struct qjob_s *job)
+{
+  gpg_error_t err;
+  char buf[200];
+
+  snprintf (buf, sizeof buf, "%s %u %u %u %llu %lu",
+            state_names[job->state], job->priority, job->found, job->nhits,
+            job->iterations, job->elapsed);
+  err = agent_write_status (ctrl, "VANITY_JOB", job->id, buf, NULL);
+  if (!err)
+    err = agent_vanity_write_cost (ctrl, job->id, &job->cost);
+  return err;
+}
+
+
+/* Send a status line for the job ID or, if ID is NULL, for all jobs
+   to CTRL.  */
+gpg_error_t
+agent_vanity_queue_status (ctrl_t ctrl, const char *id)
+{
+  gpg_error_t err = 0;
+  struct qjob_s *job;
+
+  if (id)
+    {
+      job = find_job (id);
+      return job? write_job_status (ctrl, job) : gpg_error (GPG_ERR_NOT_FOUND);
+    }
+  for (job = queue; job && !err; job = job->next)
+    err = write_job_status (ctrl, job);
+  return err;
+}
+
+
+/* Cancel the job ID.  A running search notices this at its next
+   progress report.  */
+gpg_error_t
+agent_vanity_queue_cancel (const char *id)
+{
+  struct qjob_s *job;
+
+  job = find_job (id);
+  if (!job)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  if (!is_active (job))
+    return gpg_error (GPG_ERR_INV_STATE);
+  job->canceled = 1;
+  if (!scheduler_running)
+    finish_job (job, JOB_CANCELED);
+  return 0;
+}
+
+
+/* Send the keys found so far by the job ID to CTRL.  If the job has
+   ended it is removed from the queue; its keys stay in the result
+   store.  */
+gpg_error_t
+agent_vanity_queue_result (ctrl_t ctrl, const char *id)
+{
+  gpg_error_t err;
+  struct qjob_s *job, **prev;
+
+  for (prev = &queue; *prev; prev = &(*prev)->next)
+    if (!ascii_strcasecmp ((*prev)->id, id))
+      break;
+  job = *prev;
+  if (!job)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  err = write_job_status (ctrl, job);
+  if (!err)
+    err = agent_vanity_list_results (ctrl, job->id);
+  if (!err && job->state == JOB_FAILED)
+    err = job->err;
+  if (!is_active (job) && !job->busy)
+    {
+      *prev = job->next;
+      release_qjob (job);
+    }
+  return err;
+}
+
+
+/* Store the number of jobs waiting for their next slice at R_QUEUED
+   and of those searched for at R_RUNNING.  */
+void
+agent_vanity_queue_counts (unsigned int *r_queued, unsigned int *r_running)
+{
+  struct qjob_s *job;
+
+  *r_queued = *r_running = 0;
+  for (job = queue; job; job = job->next)
+    if (job->busy)
+      ++*r_running;
+    else if (is_active (job))
+      ++*r_queued;
+}
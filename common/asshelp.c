@@ -36,6 +36,18 @@
 #ifdef HAVE_LOCALE_H
 #include <locale.h>
 #endif
+#ifndef HAVE_W32_SYSTEM
+# include <sys/select.h>
+# include <time.h>
+#endif
+
+#ifdef WITHOUT_NPTH /* Give the Makefile a chance to build without Pth.  */
+# undef HAVE_NPTH
+# undef USE_NPTH
+#endif
+#ifdef USE_NPTH
+# include <npth.h>
+#endif
 
 #include "i18n.h"
 #include "util.h"
@@ -61,6 +73,14 @@
 # define SECS_TO_WAIT_FOR_DIRMNGR 5
 #endif
 
+/* The flags used to connect to the agent.  The agent accepts file
+   descriptors for the commands with the option --input-fd.  */
+#ifdef HAVE_W32_SYSTEM
+# define AGENT_CONNECT_FLAGS 0
+#else
+# define AGENT_CONNECT_FLAGS ASSUAN_SOCKET_CONNECT_FDPASSING
+#endif
+
 /* A bitfield that specifies the assuan categories to log.  This is
    identical to the default log handler of libassuan.  We need to do
    it ourselves because we use a custom log handler and want to use
@@ -343,6 +363,52 @@ unlock_spawning (lock_spawn_t *lock, const char *name)
     }
 }
 
+/* Wait until the server started by gnupg_spawn_process_detached_ready
+   has closed its standard output, which it does after it started to
+   listen on its socket or if it died, or until SECONDS have passed.
+   READYFD is the read end of that pipe; it will be closed.  */
+static void
+wait_for_server (int readyfd, int seconds)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)seconds;
+  close (readyfd);
+#else
+  time_t end = time (NULL) + seconds;
+  time_t now;
+  struct timeval tv;
+  fd_set rfds;
+  char buffer[256];
+  int n;
+
+  while ((now = time (NULL)) < end)
+    {
+      FD_ZERO (&rfds);
+      FD_SET (readyfd, &rfds);
+      tv.tv_sec = end - now;
+      tv.tv_usec = 0;
+#ifdef USE_NPTH
+      n = npth_select (readyfd + 1, &rfds, NULL, NULL, &tv);
+#else
+      n = select (readyfd + 1, &rfds, NULL, NULL, &tv);
+#endif
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;  /* Error or timeout.  */
+
+      /* Skip what the server prints before it detaches.  */
+      n = read (readyfd, buffer, sizeof buffer);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;  /* EOF - the server is ready.  */
+    }
+  close (readyfd);
+#endif
+}
+
+
 /* Try to connect to the agent via socket or start it if it is not
    running and AUTOSTART is set.  Handle the server's initial
    greeting.  Returns a new assuan context at R_CTX or an error
@@ -375,7 +441,7 @@ start_new_gpg_agent (assuan_context_t *r_ctx,
     }
 
   sockname = make_absfilename (homedir, GPG_AGENT_SOCK_NAME, NULL);
-  err = assuan_socket_connect (ctx, sockname, 0, 0);
+  err = assuan_socket_connect (ctx, sockname, 0, AGENT_CONNECT_FLAGS);
   if (err && autostart)
     {
       char *abs_homedir;
@@ -455,13 +521,31 @@ start_new_gpg_agent (assuan_context_t *r_ctx,
       argv[i++] = NULL;
 
       if (!(err = lock_spawning (&lock, homedir, "agent", verbose))
-          && assuan_socket_connect (ctx, sockname, 0, 0))
+          && assuan_socket_connect (ctx, sockname, 0, AGENT_CONNECT_FLAGS))
         {
-          err = gnupg_spawn_process_detached (program? program : agent_program,
-                                              argv, NULL);
+          int readyfd;
+
+          err = gnupg_spawn_process_detached_ready
+            (program? program : agent_program, argv, NULL, &readyfd);
+          if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+            err = gnupg_spawn_process_detached
+              (program? program : agent_program, argv, NULL);
           if (err)
             log_error ("failed to start agent '%s': %s\n",
                        agent_program, gpg_strerror (err));
+          else if (readyfd != -1)
+            {
+              if (verbose)
+                log_info (_("waiting for the agent to come up ... (%ds)\n"),
+                          SECS_TO_WAIT_FOR_AGENT);
+              wait_for_server (readyfd, SECS_TO_WAIT_FOR_AGENT);
+              err = assuan_socket_connect (ctx, sockname, 0, AGENT_CONNECT_FLAGS);
+              if (!err && verbose)
+                {
+                  log_info (_("connection to agent established\n"));
+                  did_success_msg = 1;
+                }
+            }
           else
             {
               for (i=0; i < SECS_TO_WAIT_FOR_AGENT; i++)
@@ -470,7 +554,7 @@ start_new_gpg_agent (assuan_context_t *r_ctx,
                     log_info (_("waiting for the agent to come up ... (%ds)\n"),
                               SECS_TO_WAIT_FOR_AGENT - i);
                   gnupg_sleep (1);
-                  err = assuan_socket_connect (ctx, sockname, 0, 0);
+                  err = assuan_socket_connect (ctx, sockname, 0, AGENT_CONNECT_FLAGS);
                   if (!err)
                     {
                       if (verbose)
@@ -643,10 +727,30 @@ start_new_dirmngr (assuan_context_t *r_ctx,
       if (!(err = lock_spawning (&lock, homedir, "dirmngr", verbose))
           && assuan_socket_connect (ctx, sockname, 0, 0))
         {
-          err = gnupg_spawn_process_detached (dirmngr_program, argv, NULL);
+          int readyfd;
+
+          err = gnupg_spawn_process_detached_ready (dirmngr_program, argv,
+                                                    NULL, &readyfd);
+          if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+            err = gnupg_spawn_process_detached (dirmngr_program, argv, NULL);
           if (err)
             log_error ("failed to start the dirmngr '%s': %s\n",
                        dirmngr_program, gpg_strerror (err));
+          else if (readyfd != -1)
+            {
+              if (verbose)
+                log_info (_("waiting for the dirmngr "
+                            "to come up ... (%ds)\n"),
+                          SECS_TO_WAIT_FOR_DIRMNGR);
+              wait_for_server (readyfd, SECS_TO_WAIT_FOR_DIRMNGR);
+              err = assuan_socket_connect (ctx, sockname, 0, 0);
+              if (!err && verbose)
+                {
+                  log_info (_("connection to the dirmngr"
+                              " established\n"));
+                  did_success_msg = 1;
+                }
+            }
           else
             {
               int i;
@@ -0,0 +1,290 @@
+/* dns-cache.c - Cache for DNS lookups
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Looking up the CERT and PKA records of a mail address, the SRV
+   records of a keyserver and the addresses of its hosts requires
+   several round trips to the resolver for each request.  The results
+   rarely change, thus they are kept here for the time given by the
+   TTL of the records.  Failed lookups are remembered for a short
+   time so that a missing record is not asked for again and again.
+
+   The cache is not locked; it is only used by the main process or by
+   npth threads which do not yield while calling these functions.  */
+
+#include <config.h>
+#include <sys/types.h>
+#ifdef HAVE_W32_SYSTEM
+# ifdef HAVE_WINSOCK2_H
+#  include <winsock2.h>
+# endif
+# include <windows.h>
+#else
+# include <netdb.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "util.h"
+#include "host2net.h"
+#include "dns-cache.h"
+
+
+/* The number of entries in the cache.  */
+#define MAX_CACHE_ENTRIES 256
+
+/* Upper limit for the TTL of positive entries.  */
+#define MAX_CACHE_TTL 3600
+
+/* The TTL of negative entries.  */
+#define NEGATIVE_CACHE_TTL 60
+
+/* Size of the fixed part of a DNS message header.  */
+#define DNS_HEADER_SIZE 12
+
+
+struct cache_entry_s
+{
+  char *name;              /* Malloced name; NULL for an unused entry.  */
+  int type;                /* The record type.  */
+  time_t expires;          /* The entry is invalid after this time.  */
+  size_t datalen;          /* 0 for a negative entry.  */
+  unsigned char *data;     /* Malloced data.  */
+};
+
+static struct cache_entry_s cache[MAX_CACHE_ENTRIES];
+
+
+
+static void
+release_entry (struct cache_entry_s *ce)
+{
+  xfree (ce->name);
+  xfree (ce->data);
+  memset (ce, 0, sizeof *ce);
+}
+
+
+static struct cache_entry_s *
+find_entry (const char *name, int type)
+{
+  int i;
+
+  for (i=0; i < MAX_CACHE_ENTRIES; i++)
+    if (cache[i].name && cache[i].type == type
+        && !ascii_strcasecmp (cache[i].name, name))
+      return cache + i;
+  return NULL;
+}
+
+
+/* Look up the record of TYPE for NAME.  Returns -1 if nothing valid
+   is cached, 0 if the last lookup did not find anything, or the
+   length of the data which has been copied to BUFFER.  Entries too
+   large for BUFFER are treated as not cached.  */
+int
+dns_cache_lookup (const char *name, int type, void *buffer, size_t size)
+{
+  struct cache_entry_s *ce;
+
+  ce = find_entry (name, type);
+  if (!ce)
+    return -1;
+  if (ce->expires <= time (NULL))
+    {
+      release_entry (ce);
+      return -1;
+    }
+  if (ce->datalen > size || ce->datalen > INT_MAX)
+    return -1;
+  if (ce->datalen)
+    memcpy (buffer, ce->data, ce->datalen);
+  return (int)ce->datalen;
+}
+
+
+/* Store DATA of length DATALEN as the result of the lookup of TYPE
+   for NAME with a lifetime of TTL seconds.  A DATALEN of 0 stores a
+   negative entry; TTL is then ignored.  Errors are not reported; the
+   result is then just not cached.  */
+void
+dns_cache_store (const char *name, int type,
+                 const void *data, size_t datalen, unsigned int ttl)
+{
+  struct cache_entry_s *ce;
+  time_t now = time (NULL);
+  int i;
+
+  if (!datalen)
+    ttl = NEGATIVE_CACHE_TTL;
+  else if (ttl > MAX_CACHE_TTL)
+    ttl = MAX_CACHE_TTL;
+  if (!ttl)
+    return;
+
+  ce = find_entry (name, type);
+  if (ce)
+    release_entry (ce);
+  else
+    {
+      /* Take a free or expired entry or evict the one which would
+         expire first.  */
+      for (i=0; i < MAX_CACHE_ENTRIES; i++)
+        {
+          if (!cache[i].name || cache[i].expires <= now)
+            {
+              ce = cache + i;
+              break;
+            }
+          if (!ce || cache[i].expires < ce->expires)
+            ce = cache + i;
+        }
+      release_entry (ce);
+    }
+
+  ce->name = xtrystrdup (name);
+  if (!ce->name)
+    return;
+  if (datalen)
+    {
+      ce->data = xtrymalloc (datalen);
+      if (!ce->data)
+        {
+          release_entry (ce);
+          return;
+        }
+      memcpy (ce->data, data, datalen);
+    }
+  ce->type = type;
+  ce->datalen = datalen;
+  ce->expires = now + ttl;
+}
+
+
+/* Skip the possibly compressed domain name at P.  Returns the number
+   of bytes used by the name or 0 if it does not end before END.  */
+static size_t
+skip_name (const unsigned char *p, const unsigned char *end)
+{
+  const unsigned char *s = p;
+
+  while (s < end)
+    {
+      if (!*s)
+        return s + 1 - p;
+      if ((*s & 0xc0) == 0xc0)
+        return s + 2 <= end? s + 2 - p : 0;
+      if ((*s & 0xc0))
+        return 0;  /* Unknown label type.  */
+      s += *s + 1;
+    }
+  return 0;
+}
+
+
+/* Return the smallest TTL of the answer records in the DNS message
+   ANSWER of length LEN.  Returns 0 if the message can't be parsed or
+   has no answers.  */
+static unsigned int
+answer_ttl (const unsigned char *answer, size_t len)
+{
+  const unsigned char *p, *end;
+  unsigned int qdcount, ancount, ttl, minttl;
+  size_t n;
+
+  if (len < DNS_HEADER_SIZE)
+    return 0;
+  qdcount = buf16_to_uint (answer + 4);
+  ancount = buf16_to_uint (answer + 6);
+  if (!ancount)
+    return 0;
+
+  p = answer + DNS_HEADER_SIZE;
+  end = answer + len;
+  for (; qdcount; qdcount--)
+    {
+      if (!(n = skip_name (p, end)) || end - p < n + 4)
+        return 0;
+      p += n + 4;  /* Name, type and class.  */
+    }
+
+  minttl = MAX_CACHE_TTL;
+  for (; ancount; ancount--)
+    {
+      if (!(n = skip_name (p, end)) || end - p < n + 10)
+        return 0;
+      p += n + 4;  /* Name, type and class.  */
+      ttl = buf32_to_uint (p);
+      if (ttl < minttl)
+        minttl = ttl;
+      p += 4;
+      n = buf16_to_uint (p);
+      p += 2;
+      if (end - p < n)
+        return 0;
+      p += n;
+    }
+  return minttl;
+}
+
+
+/* Cache the result of a res_query for TYPE and NAME.  ANSWER and
+   ANSWERLEN are the buffer and the return value of res_query; H_ERR
+   is the value of h_errno after a failed query.  Only authoritative
+   failures are cached; a temporary error of the resolver is not.  */
+void
+dns_cache_store_answer (const char *name, int type,
+                        const unsigned char *answer, int answerlen,
+                        int h_err)
+{
+  unsigned int ttl;
+
+  if (answerlen < 0)
+    {
+      if (h_err == HOST_NOT_FOUND || h_err == NO_DATA)
+        dns_cache_store (name, type, NULL, 0, 0);
+      return;
+    }
+
+  ttl = answer_ttl (answer, answerlen);
+  if (ttl)
+    dns_cache_store (name, type, answer, answerlen, ttl);
+}
+
+
+/* Remove all entries from the cache.  */
+void
+dns_cache_flush (void)
+{
+  int i;
+
+  for (i=0; i < MAX_CACHE_ENTRIES; i++)
+    release_entry (cache + i);
+}
@@ -0,0 +1,46 @@
+/* dns-cache.h - Cache for DNS lookups
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_COMMON_DNS_CACHE_H
+#define GNUPG_COMMON_DNS_CACHE_H
+
+/* Pseudo record type used for the results of getaddrinfo.  It is
+   outside the range of the real DNS types.  */
+#define DNS_CACHE_ADDRINFO 0x10000
+
+int  dns_cache_lookup (const char *name, int type,
+                       void *buffer, size_t size);
+void dns_cache_store (const char *name, int type,
+                      const void *data, size_t datalen, unsigned int ttl);
+void dns_cache_store_answer (const char *name, int type,
+                             const unsigned char *answer, int answerlen,
+                             int h_err);
+void dns_cache_flush (void);
+
+#endif /*GNUPG_COMMON_DNS_CACHE_H*/
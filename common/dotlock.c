@@ -93,6 +93,19 @@
    is to check at runtime whether link(2) works for a specific lock
    file.
 
+   Waiting for a lock held by another process is done by polling with
+   growing intervals, which makes concurrent processes sleep much
+   longer than needed.  On local file systems (currently only detected
+   on Linux) each lock thus also has a queue file with the suffix
+   ".lock-queue".  Before taking the lock without a timeout, a process
+   waits for an fcntl lock on that file, and it keeps that fcntl lock
+   until it releases its own lock.  The waiter is woken by the kernel
+   as soon as the previous owner is done, and the hardlink lock then
+   succeeds at the first try.  The hardlink protocol is still what
+   guarantees mutual exclusion, so processes which do not know about
+   the queue and any failure of the fcntl lock do not matter.  On
+   network file systems the queue is not used.
+
 
    How to use:
    ===========
@@ -293,6 +306,9 @@
 # include <sys/types.h>
 # include <sys/stat.h>
 # include <sys/utsname.h>
+# ifdef __linux__
+#  include <sys/vfs.h>
+# endif
 #endif
 #include <sys/types.h>
 #include <sys/time.h>
@@ -407,6 +423,8 @@ struct dotlock_handle
   char *tname;         /* Name of the lockfile template.        */
   size_t nodename_off; /* Offset in TNAME of the nodename part. */
   size_t nodename_len; /* Length of the nodename part.          */
+  int queue_fd;        /* FD of the lock queue file or -1.      */
+  unsigned int in_queue:1; /* We hold the fcntl lock of the queue.  */
 #endif /*!HAVE_DOSISH_SYSTEM */
 };
 
@@ -600,6 +618,42 @@ use_hardlinks_p (const char *tname)
 #endif /*HAVE_POSIX_SYSTEM */
 
 
+/* Return true if the file system storing FNAME is known to be local.
+   Only then the fcntl lock queue is used.  */
+#ifdef HAVE_POSIX_SYSTEM
+static int
+local_fs_p (const char *fname)
+{
+#ifdef __linux__
+  struct statfs sfs;
+
+  if (statfs (fname, &sfs))
+    return 0;
+  switch ((unsigned long)sfs.f_type)
+    {
+    case 0x6969:      /* NFS */
+    case 0x517b:      /* SMB */
+    case 0xff534d42:  /* CIFS */
+    case 0xfe534d42:  /* SMB2 */
+    case 0x73757245:  /* CODA */
+    case 0x5346414f:  /* AFS */
+    case 0x65735546:  /* FUSE */
+    case 0x00c36400:  /* CEPH */
+    case 0x01161970:  /* GFS2 */
+    case 0x7461636f:  /* OCFS2 */
+    case 0x0bd00bd0:  /* Lustre */
+      return 0;
+    default:
+      return 1;
+    }
+#else
+  (void)fname;
+  return 0;
+#endif
+}
+#endif /*HAVE_POSIX_SYSTEM */
+
+
 
 #ifdef  HAVE_POSIX_SYSTEM
 /* Locking core for Unix.  It used a temporary file and the link
@@ -614,7 +668,9 @@ dotlock_create_unix (dotlock_t h, const char *file_to_lock)
   int dirpartlen;
   struct utsname utsbuf;
   size_t tnamelen;
+  int local_fs;
 
+  h->queue_fd = -1;
   snprintf (pidstr, sizeof pidstr, "%10d\n", (int)getpid() );
 
   /* Create a temporary file. */
@@ -686,6 +742,8 @@ dotlock_create_unix (dotlock_t h, const char *file_to_lock)
     }
   fd = -1;
 
+  local_fs = local_fs_p (h->tname);
+
   /* Check whether we support hard links.  */
   switch (use_hardlinks_p (h->tname))
     {
@@ -716,6 +774,26 @@ dotlock_create_unix (dotlock_t h, const char *file_to_lock)
   if (h->use_o_excl)
     my_debug_1 ("locking for '%s' done via O_EXCL\n", h->lockname);
 
+  if (local_fs)
+    {
+      char *qname;
+
+      qname = xtrymalloc (strlen (h->lockname) + 7);
+      if (qname)
+        {
+          strcpy (stpcpy (qname, h->lockname), "-queue");
+          do
+            h->queue_fd = open (qname, O_RDWR|O_CREAT,
+                                S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR);
+          while (h->queue_fd == -1 && errno == EINTR);
+          if (h->queue_fd != -1)
+            fcntl (h->queue_fd, F_SETFD, FD_CLOEXEC);
+          xfree (qname);
+        }
+      /* Without the queue file we wait the old way.  */
+      my_set_errno (0);
+    }
+
   return h;
 
  write_failed:
@@ -890,6 +968,8 @@ dotlock_destroy_unix (dotlock_t h)
   if (h->tname && !h->use_o_excl)
     unlink (h->tname);
   xfree (h->tname);
+  if (h->queue_fd != -1)
+    close (h->queue_fd);  /* This also releases the fcntl lock.  */
 }
 #endif /*HAVE_POSIX_SYSTEM*/
 
@@ -950,10 +1030,51 @@ dotlock_destroy (dotlock_t h)
 
 
 #ifdef HAVE_POSIX_SYSTEM
-/* Unix specific code of make_dotlock.  Returns 0 on success and -1 on
-   error.  */
+/* Wait for the fcntl lock of the lock queue of H.  Errors are ignored
+   because the lock is then taken by polling as usual.  */
+static void
+enter_lock_queue (dotlock_t h)
+{
+  struct flock fl;
+  int rc;
+
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+  if (fcntl (h->queue_fd, F_SETLK, &fl) == -1)
+    {
+      if (errno != EACCES && errno != EAGAIN)
+        return;
+      my_info_1 ("waiting for lock '%s' ...\n", h->lockname);
+      do
+        rc = fcntl (h->queue_fd, F_SETLKW, &fl);
+      while (rc == -1 && errno == EINTR);
+      if (rc == -1)
+        return;  /* For example EDEADLK.  */
+    }
+  h->in_queue = 1;
+}
+
+
+/* Let the next waiting process take the lock of H.  */
+static void
+leave_lock_queue (dotlock_t h)
+{
+  struct flock fl;
+
+  if (!h->in_queue)
+    return;
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = F_UNLCK;
+  fl.l_whence = SEEK_SET;
+  fcntl (h->queue_fd, F_SETLK, &fl);
+  h->in_queue = 0;
+}
+
+
+/* Take the lock file of H.  Returns 0 on success and -1 on error.  */
 static int
-dotlock_take_unix (dotlock_t h, long timeout)
+take_lockfile (dotlock_t h, long timeout)
 {
   int wtime = 0;
   int sumtime = 0;
@@ -1103,6 +1224,26 @@ dotlock_take_unix (dotlock_t h, long timeout)
   my_set_errno (EACCES);
   return -1;
 }
+
+
+/* Unix specific code of make_dotlock.  Returns 0 on success and -1 on
+   error.  */
+static int
+dotlock_take_unix (dotlock_t h, long timeout)
+{
+  int rc;
+
+  if (h->queue_fd != -1 && timeout == -1)
+    enter_lock_queue (h);
+  rc = take_lockfile (h, timeout);
+  if (rc)
+    {
+      int saved_errno = errno;
+      leave_lock_queue (h);
+      my_set_errno (saved_errno);
+    }
+  return rc;
+}
 #endif /*HAVE_POSIX_SYSTEM*/
 
 
@@ -1217,8 +1358,10 @@ dotlock_release_unix (dotlock_t h)
     {
       my_error_1 ("release_dotlock: error removing lockfile '%s'\n",
                   h->lockname);
+      leave_lock_queue (h);
       return -1;
     }
+  leave_lock_queue (h);
   /* Fixme: As an extra check we could check whether the link count is
      now really at 1. */
   return 0;
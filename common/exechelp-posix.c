@@ -47,6 +47,12 @@
 #endif
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#if defined(HAVE_POSIX_SPAWN) \
+    && defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP)
+# include <spawn.h>
+# define USE_POSIX_SPAWN 1
+#endif
 
 #ifdef WITHOUT_NPTH /* Give the Makefile a chance to build without Pth.  */
 #undef HAVE_NPTH
@@ -128,6 +134,64 @@ get_max_fds (void)
 }
 
 
+/* Close the file descriptors starting with FIRST without trying each
+   possible descriptor value; with a high RLIMIT_NOFILE that may take
+   millions of system calls.  EXCEPT is as for close_all_fds.  Returns
+   0 on success or -1 if the caller needs to fall back to the loop.  */
+static int
+close_fds_fast (int first, int *except)
+{
+  DIR *dir;
+  struct dirent *de;
+  int fd, dfd, i;
+
+#ifdef HAVE_CLOSE_RANGE
+  fd = first;
+  if (except)
+    for (i=0; except[i] != -1; i++)
+      {
+        if (except[i] < fd)
+          continue;
+        if (except[i] > fd && close_range (fd, except[i] - 1, 0))
+          return -1;
+        fd = except[i] + 1;
+      }
+  if (!close_range (fd, ~0U, 0))
+    return 0;
+#elif defined(HAVE_CLOSEFROM)
+  for (i=0; except && except[i] != -1; i++)
+    if (except[i] >= first)
+      break;
+  if (!except || except[i] == -1)
+    {
+      closefrom (first);
+      return 0;
+    }
+#endif /*HAVE_CLOSEFROM*/
+
+  /* Only look at the descriptors which are actually open.  */
+  dir = opendir ("/proc/self/fd");
+  if (!dir)
+    return -1;
+  dfd = dirfd (dir);
+  while ((de = readdir (dir)))
+    {
+      if (!(*de->d_name >= '0' && *de->d_name <= '9'))
+        continue;
+      fd = atoi (de->d_name);
+      if (fd < first || fd == dfd)
+        continue;
+      for (i=0; except && except[i] != -1; i++)
+        if (except[i] == fd)
+          break;
+      if (!except || except[i] == -1)
+        close (fd);
+    }
+  closedir (dir);
+  return 0;
+}
+
+
 /* Close all file descriptors starting with descriptor FIRST.  If
    EXCEPT is not NULL, it is expected to be a list of file descriptors
    which shall not be closed.  This list shall be sorted in ascending
@@ -135,9 +199,17 @@ get_max_fds (void)
 void
 close_all_fds (int first, int *except)
 {
-  int max_fd = get_max_fds ();
+  int max_fd;
   int fd, i, except_start;
 
+  if (!close_fds_fast (first, except))
+    {
+      gpg_err_set_errno (0);
+      return;
+    }
+
+  max_fd = get_max_fds ();
+
   if (except)
     {
       except_start = 0;
@@ -278,6 +350,69 @@ do_exec (const char *pgmname, const char *argv[],
 }
 
 
+#ifdef USE_POSIX_SPAWN
+/* Start PGMNAME using posix_spawn which does not need to copy the
+   page tables of the parent process.  FD_IN, FD_OUT and FD_ERR are as
+   for do_exec.  Returns 0 on success or an errno value; the caller
+   should then fall back to fork and do_exec so that a missing program
+   is reported as usual by gnupg_wait_process.  */
+static int
+do_posix_spawn (const char *pgmname, const char *argv[],
+                int fd_in, int fd_out, int fd_err, pid_t *r_pid)
+{
+  extern char **environ;
+  posix_spawn_file_actions_t actions;
+  char **arg_list;
+  int fds[3];
+  int i, j, rc;
+
+  fds[0] = fd_in;
+  fds[1] = fd_out;
+  fds[2] = fd_err;
+
+  i = 0;
+  if (argv)
+    while (argv[i])
+      i++;
+  arg_list = xtrycalloc (i+2, sizeof *arg_list);
+  if (!arg_list)
+    return errno;
+  arg_list[0] = strrchr (pgmname, '/');
+  if (arg_list[0])
+    arg_list[0]++;
+  else
+    arg_list[0] = (char*)pgmname;
+  if (argv)
+    for (i=0,j=1; argv[i]; i++, j++)
+      arg_list[j] = (char*)argv[i];
+
+  rc = posix_spawn_file_actions_init (&actions);
+  if (rc)
+    {
+      xfree (arg_list);
+      return rc;
+    }
+
+  /* Connect the standard files in the same order as do_exec.  */
+  for (i=0; !rc && i <= 2; i++)
+    if (fds[i] != -1)
+      rc = posix_spawn_file_actions_adddup2 (&actions, fds[i], i);
+  for (i=0; !rc && i <= 2; i++)
+    if (fds[i] == -1)
+      rc = posix_spawn_file_actions_addopen (&actions, i, "/dev/null",
+                                             i? O_WRONLY : O_RDONLY, 0);
+  if (!rc)
+    rc = posix_spawn_file_actions_addclosefrom_np (&actions, 3);
+  if (!rc)
+    rc = posix_spawn (r_pid, pgmname, &actions, NULL, arg_list, environ);
+
+  posix_spawn_file_actions_destroy (&actions);
+  xfree (arg_list);
+  return rc;
+}
+#endif /*USE_POSIX_SPAWN*/
+
+
 static gpg_error_t
 do_create_pipe (int filedes[2])
 {
@@ -398,6 +533,11 @@ gnupg_spawn_process (const char *pgmname, const char *argv[],
         }
     }
 
+#ifdef USE_POSIX_SPAWN
+  if (!preexec
+      && !do_posix_spawn (pgmname, argv, infd, outpipe[1], errpipe[1], pid))
+    goto parent;
+#endif /*USE_POSIX_SPAWN*/
 
   *pid = fork ();
   if (*pid == (pid_t)(-1))
@@ -431,6 +571,9 @@ gnupg_spawn_process (const char *pgmname, const char *argv[],
       /*NOTREACHED*/
     }
 
+#ifdef USE_POSIX_SPAWN
+ parent:
+#endif
   /* This is the parent. */
   if (outpipe[1] != -1)
     close (outpipe[1]);
@@ -461,6 +604,11 @@ gnupg_spawn_process_fd (const char *pgmname, const char *argv[],
 {
   gpg_error_t err;
 
+#ifdef USE_POSIX_SPAWN
+  if (!do_posix_spawn (pgmname, argv, infd, outfd, errfd, pid))
+    return 0;
+#endif /*USE_POSIX_SPAWN*/
+
   *pid = fork ();
   if (*pid == (pid_t)(-1))
     {
@@ -548,16 +696,11 @@ gnupg_release_process (pid_t pid)
 }
 
 
-/* Spawn a new process and immediately detach from it.  The name of
-   the program to exec is PGMNAME and its arguments are in ARGV (the
-   programname is automatically passed as first argument).
-   Environment strings in ENVP are set.  An error is returned if
-   pgmname is not executable; to make this work it is necessary to
-   provide an absolute file name.  All standard file descriptors are
-   connected to /dev/null. */
-gpg_error_t
-gnupg_spawn_process_detached (const char *pgmname, const char *argv[],
-                              const char *envp[] )
+/* The core of gnupg_spawn_process_detached.  If OUTFD is not -1 the
+   standard output of the process is connected to it.  */
+static gpg_error_t
+spawn_detached (const char *pgmname, const char *argv[],
+                const char *envp[], int outfd)
 {
   pid_t pid;
   int i;
@@ -592,7 +735,7 @@ gnupg_spawn_process_detached (const char *pgmname, const char *argv[],
         for (i=0; envp[i]; i++)
           putenv (xstrdup (envp[i]));
 
-      do_exec (pgmname, argv, -1, -1, -1, NULL);
+      do_exec (pgmname, argv, -1, outfd, -1, NULL);
 
       /*NOTREACHED*/
     }
@@ -605,6 +748,43 @@ gnupg_spawn_process_detached (const char *pgmname, const char *argv[],
 }
 
 
+/* Spawn a new process and immediately detach from it.  The name of
+   the program to exec is PGMNAME and its arguments are in ARGV (the
+   programname is automatically passed as first argument).
+   Environment strings in ENVP are set.  An error is returned if
+   pgmname is not executable; to make this work it is necessary to
+   provide an absolute file name.  All standard file descriptors are
+   connected to /dev/null. */
+gpg_error_t
+gnupg_spawn_process_detached (const char *pgmname, const char *argv[],
+                              const char *envp[] )
+{
+  return spawn_detached (pgmname, argv, envp, -1);
+}
+
+
+/* See exechelp.h for the description.  */
+gpg_error_t
+gnupg_spawn_process_detached_ready (const char *pgmname, const char *argv[],
+                                    const char *envp[], int *r_readyfd)
+{
+  gpg_error_t err;
+  int fds[2];
+
+  *r_readyfd = -1;
+  err = do_create_pipe (fds);
+  if (err)
+    return err;
+  err = spawn_detached (pgmname, argv, envp, fds[1]);
+  close (fds[1]);
+  if (err)
+    close (fds[0]);
+  else
+    *r_readyfd = fds[0];
+  return err;
+}
+
+
 /* Kill a process; that is send an appropriate signal to the process.
    gnupg_wait_process must be called to actually remove the process
    from the system.  An invalid PID is ignored.  */
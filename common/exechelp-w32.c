@@ -812,6 +812,20 @@ gnupg_spawn_process_detached (const char *pgmname, const char *argv[],
 }
 
 
+/* See exechelp.h for the description.  There is no way to learn the
+   readiness of a server this way on Windows.  */
+gpg_error_t
+gnupg_spawn_process_detached_ready (const char *pgmname, const char *argv[],
+                                    const char *envp[], int *r_readyfd)
+{
+  (void)pgmname;
+  (void)argv;
+  (void)envp;
+  *r_readyfd = -1;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+
 /* Kill a process; that is send an appropriate signal to the process.
    gnupg_wait_process must be called to actually remove the process
    from the system.  An invalid PID is ignored.  */
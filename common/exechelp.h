@@ -164,6 +164,18 @@ gpg_error_t gnupg_spawn_process_detached (const char *pgmname,
                                           const char *argv[],
                                           const char *envp[] );
 
+/* Same as gnupg_spawn_process_detached but connect the standard
+   output of the process to a pipe and return its read end at
+   R_READYFD.  A server started this way signals that it is ready by
+   closing its standard output; the caller may thus wait for EOF on
+   R_READYFD instead of polling the server's socket.  The caller needs
+   to close R_READYFD.  Returns GPG_ERR_NOT_SUPPORTED on platforms
+   where this is not possible.  */
+gpg_error_t gnupg_spawn_process_detached_ready (const char *pgmname,
+                                                const char *argv[],
+                                                const char *envp[],
+                                                int *r_readyfd);
+
 
 
 #endif /*GNUPG_COMMON_EXECHELP_H*/
@@ -43,6 +43,9 @@
   - With HTTP_USE_NTBTLS or HTTP_USE_GNUTLS support for https is
     provided (this also requires estream).
 
+  - With HAVE_ZIP a response body sent with the gzip or deflate
+    content encoding is decoded if requested by HTTP_FLAG_COMPRESS.
+
   - With HTTP_NO_WSASTARTUP the socket initialization is not done
     under Windows.  This is useful if the socket layer has already
     been initialized elsewhere.  This also avoids the installation of
@@ -59,6 +62,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
 
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
@@ -95,9 +99,14 @@
 #endif /*HTTP_USE_GNUTLS*/
 
 
+#ifdef HAVE_ZIP
+# include <zlib.h>
+#endif
+
 #include "util.h"
 #include "i18n.h"
 #include "http.h"
+#include "dns-cache.h"
 #ifdef USE_DNS_SRV
 # include "srv.h"
 #else /*!USE_DNS_SRV*/
@@ -142,6 +151,9 @@ struct srventry
 
 #define HTTP_PROXY_ENV           "http_proxy"
 #define MAX_LINELEN 20000  /* Max. length of a HTTP header line. */
+#define MAX_POOLED_CONNS 16 /* Max. number of idle connections kept.  */
+#define POOL_IDLE_TIMEOUT 30 /* Seconds to keep an idle connection.  */
+#define MAX_TLS_RESUME 16  /* Max. number of saved TLS sessions.  */
 #define VALID_URI_CHARS "abcdefghijklmnopqrstuvwxyz"   \
                         "ABCDEFGHIJKLMNOPQRSTUVWXYZ"   \
                         "01234567890@"                 \
@@ -180,6 +192,7 @@ static gpg_error_t send_request (http_t hd, const char *httphost,
 				 const char *srvtag,strlist_t headers);
 static char *build_rel_path (parsed_uri_t uri);
 static gpg_error_t parse_response (http_t hd);
+static gpg_error_t setup_content_decoding (http_t hd);
 
 static int connect_server (const char *server, unsigned short port,
                            unsigned int flags, const char *srvtag,
@@ -189,6 +202,10 @@ static gpg_error_t write_server (int sock, const char *data, size_t length);
 static ssize_t cookie_read (void *cookie, void *buffer, size_t size);
 static ssize_t cookie_write (void *cookie, const void *buffer, size_t size);
 static int cookie_close (void *cookie);
+#ifdef HAVE_ZIP
+static ssize_t zcookie_read (void *cookie, void *buffer, size_t size);
+static int zcookie_close (void *cookie);
+#endif
 
 
 /* A socket object used to a allow ref counting of sockets.  */
@@ -209,6 +226,32 @@ static es_cookie_io_functions_t cookie_functions =
     cookie_close
   };
 
+#ifdef HAVE_ZIP
+/* Cookie functions of the stream decoding a compressed body.  */
+static es_cookie_io_functions_t zcookie_functions =
+  {
+    zcookie_read,
+    NULL,
+    NULL,
+    zcookie_close
+  };
+
+/* The size of the buffer for the compressed data.  */
+#define ZCOOKIE_BUFSIZE 8192
+
+struct zcookie_s
+{
+  estream_t raw;        /* The stream with the compressed body.  */
+  z_stream zs;
+  int deflate;          /* The content encoding is "deflate".  */
+  unsigned int started:1;
+  unsigned int eof:1;
+  unsigned int failed:1;
+  unsigned char inbuf[ZCOOKIE_BUFSIZE];
+};
+typedef struct zcookie_s *zcookie_t;
+#endif /*HAVE_ZIP*/
+
 struct cookie_s
 {
   /* Socket object or NULL if already closed. */
@@ -224,6 +267,17 @@ struct cookie_s
      the content length.  */
   longcounter_t content_length;
   unsigned int content_length_valid:1;
+
+  /* Set if the connection may be put into the pool after the
+     response has been read.  */
+  unsigned int keep_alive:1;
+
+  /* The number of bytes read from the socket.  */
+  longcounter_t bytes_read;
+
+  /* The host and port used as key for the pool.  */
+  char *pool_host;
+  unsigned short pool_port;
 };
 typedef struct cookie_s *cookie_t;
 
@@ -243,6 +297,7 @@ struct http_session_s
   } verify;
   char *servername; /* Malloced server name.  */
 #endif /*USE_TLS*/
+  int in_pool;      /* The TLS connection of this session is pooled.  */
   /* A callback function to log details of TLS certifciates.  */
   void (*cert_log_cb) (http_session_t, gpg_error_t, const char *,
                        const void **, size_t *);
@@ -277,9 +332,47 @@ struct http_context_s
   size_t buffer_size;
   unsigned int flags;
   header_t headers;      /* Received headers. */
+  char *pool_host;       /* Set if the connection may be pooled.  */
+  unsigned short pool_port;
+  unsigned int reused:1; /* The connection was taken from the pool.  */
 };
 
 
+/* An idle connection kept for further requests to the same server.
+   Only connections opened with HTTP_FLAG_KEEP_ALIVE and not using a
+   proxy are kept.  */
+struct pooled_conn_s
+{
+  struct pooled_conn_s *next;
+  my_socket_t sock;
+  http_session_t session;  /* The TLS session or NULL.  */
+  time_t stamp;            /* The time the connection became idle.  */
+  unsigned short port;
+  char host[1];            /* The name of the server.  */
+};
+typedef struct pooled_conn_s *pooled_conn_t;
+
+/* The pool of idle connections; the most recently used first.  */
+static pooled_conn_t conn_pool;
+
+
+#ifdef HTTP_USE_GNUTLS
+/* Saved TLS session data to resume sessions with a server after its
+   connection has been closed.  */
+struct tls_resume_s
+{
+  struct tls_resume_s *next;
+  gnutls_datum_t data;
+  unsigned short port;
+  char name[1];            /* The server name as used for SNI.  */
+};
+typedef struct tls_resume_s *tls_resume_t;
+
+/* The saved sessions; the most recently used first.  */
+static tls_resume_t tls_resume_list;
+#endif /*HTTP_USE_GNUTLS*/
+
+
 /* The global callback for the verification fucntion.  */
 static gpg_error_t (*tls_callback) (http_t, http_session_t, int);
 
@@ -685,6 +778,279 @@ http_session_set_log_cb (http_session_t sess,
 
 
 
+/* Close the pooled connection CONN and release it.  */
+static void
+pool_release_conn (pooled_conn_t conn)
+{
+  my_socket_unref (conn->sock, NULL, NULL);
+  if (conn->session)
+    {
+      conn->session->in_pool = 0;
+      http_session_unref (conn->session);
+    }
+  xfree (conn);
+}
+
+
+/* Close all pooled connections which have been idle for too long.  */
+static void
+pool_expire (void)
+{
+  pooled_conn_t conn, next, prev;
+  time_t now = time (NULL);
+
+  for (conn = conn_pool, prev = NULL; conn; conn = next)
+    {
+      next = conn->next;
+      if (conn->stamp + POOL_IDLE_TIMEOUT < now || conn->stamp > now)
+        {
+          if (prev)
+            prev->next = next;
+          else
+            conn_pool = next;
+          pool_release_conn (conn);
+        }
+      else
+        prev = conn;
+    }
+}
+
+
+/* Return true if the idle connection CONN can't be used anymore.
+   Nothing is expected from the server; if there is something to read
+   it is either an EOF or garbage.  */
+static int
+pool_conn_is_stale (pooled_conn_t conn)
+{
+  fd_set rfds;
+  struct timeval tv;
+
+#ifdef HTTP_USE_GNUTLS
+  if (conn->session && gnutls_record_check_pending (conn->session->tls_session))
+    return 1;
+#endif /*HTTP_USE_GNUTLS*/
+
+  FD_ZERO (&rfds);
+  FD_SET (conn->sock->fd, &rfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  /* We don't use my_select here because we must not be interrupted
+     while working on the pool.  */
+  return select (conn->sock->fd + 1, &rfds, NULL, NULL, &tv) != 0;
+}
+
+
+/* Take an idle connection to SERVER at PORT from the pool.  For TLS
+   connections SNINAME is the name used for the certificate check.
+   Returns NULL if no usable connection is available.  */
+static pooled_conn_t
+pool_get (const char *server, unsigned short port, int use_tls,
+          const char *sniname)
+{
+  pooled_conn_t conn, next, prev;
+
+  pool_expire ();
+  for (conn = conn_pool, prev = NULL; conn; conn = next)
+    {
+      next = conn->next;
+      if (conn->port != port || !conn->session != !use_tls
+          || strcmp (conn->host, server))
+        {
+          prev = conn;
+          continue;
+        }
+#ifdef USE_TLS
+      if (use_tls && (!conn->session->servername
+                      || strcmp (conn->session->servername, sniname)))
+        {
+          prev = conn;
+          continue;
+        }
+#else
+      (void)sniname;
+#endif /*USE_TLS*/
+
+      if (prev)
+        prev->next = next;
+      else
+        conn_pool = next;
+      if (!pool_conn_is_stale (conn))
+        return conn;
+      pool_release_conn (conn);
+    }
+
+  return NULL;
+}
+
+
+/* Put the connection SOCK to HOST at PORT into the pool.  SESSION is
+   the session of a TLS connection or NULL.  The caller's references
+   to SOCK and SESSION are taken over.  */
+static void
+pool_put (my_socket_t sock, http_session_t session,
+          const char *host, unsigned short port)
+{
+  pooled_conn_t conn, prev;
+  int n;
+
+  conn = xtrymalloc (sizeof *conn + strlen (host));
+  if (!conn)
+    {
+      my_socket_unref (sock, NULL, NULL);
+      http_session_unref (session);
+      return;
+    }
+  conn->sock = sock;
+  conn->session = session;
+  if (session)
+    session->in_pool = 1;
+  conn->stamp = time (NULL);
+  conn->port = port;
+  strcpy (conn->host, host);
+  conn->next = conn_pool;
+  conn_pool = conn;
+
+  /* Close the least recently used connections if there are too
+     many.  */
+  for (n = 1, prev = conn_pool; prev->next; prev = prev->next, n++)
+    if (n == MAX_POOLED_CONNS)
+      {
+        while ((conn = prev->next))
+          {
+            prev->next = conn->next;
+            pool_release_conn (conn);
+          }
+        break;
+      }
+
+  pool_expire ();
+}
+
+
+/* Remove the connection using SESSION from the pool.  This is
+   required before SESSION is used for a new connection.  */
+static void
+pool_drop_session (http_session_t session)
+{
+  pooled_conn_t conn, prev;
+
+  for (conn = conn_pool, prev = NULL; conn; prev = conn, conn = conn->next)
+    if (conn->session == session)
+      {
+        if (prev)
+          prev->next = conn->next;
+        else
+          conn_pool = conn->next;
+        pool_release_conn (conn);
+        break;
+      }
+}
+
+
+#ifdef HTTP_USE_GNUTLS
+/* Prepare SESS for resuming a former session with its server at
+   PORT.  */
+static void
+tls_resume_load (http_session_t sess, unsigned short port)
+{
+  tls_resume_t r;
+  int rc;
+
+  for (r = tls_resume_list; r; r = r->next)
+    if (r->port == port && !strcmp (r->name, sess->servername))
+      {
+        rc = gnutls_session_set_data (sess->tls_session,
+                                      r->data.data, r->data.size);
+        if (rc < 0)
+          log_info ("gnutls_session_set_data failed: %s\n",
+                    gnutls_strerror (rc));
+        break;
+      }
+}
+
+
+/* Save the parameters of the established session SESS with its
+   server at PORT.  */
+static void
+tls_resume_save (http_session_t sess, unsigned short port)
+{
+  tls_resume_t r, prev;
+  gnutls_datum_t data;
+  int n, rc;
+
+  rc = gnutls_session_get_data2 (sess->tls_session, &data);
+  if (rc < 0)
+    return;
+
+  for (r = tls_resume_list, prev = NULL; r; prev = r, r = r->next)
+    if (r->port == port && !strcmp (r->name, sess->servername))
+      break;
+  if (r)
+    {
+      if (prev)
+        prev->next = r->next;
+      else
+        tls_resume_list = r->next;
+      gnutls_free (r->data.data);
+    }
+  else
+    {
+      r = xtrymalloc (sizeof *r + strlen (sess->servername));
+      if (!r)
+        {
+          gnutls_free (data.data);
+          return;
+        }
+      r->port = port;
+      strcpy (r->name, sess->servername);
+    }
+  r->data = data;
+  r->next = tls_resume_list;
+  tls_resume_list = r;
+
+  for (n = 1, prev = tls_resume_list; prev->next; prev = prev->next, n++)
+    if (n == MAX_TLS_RESUME)
+      {
+        while ((r = prev->next))
+          {
+            prev->next = r->next;
+            gnutls_free (r->data.data);
+            xfree (r);
+          }
+        break;
+      }
+}
+#endif /*HTTP_USE_GNUTLS*/
+
+
+/* Close all idle connections and forget the saved TLS sessions.  */
+void
+http_pool_flush (void)
+{
+  pooled_conn_t conn;
+
+  while ((conn = conn_pool))
+    {
+      conn_pool = conn->next;
+      pool_release_conn (conn);
+    }
+
+#ifdef HTTP_USE_GNUTLS
+  {
+    tls_resume_t r;
+
+    while ((r = tls_resume_list))
+      {
+        tls_resume_list = r->next;
+        gnutls_free (r->data.data);
+        xfree (r);
+      }
+  }
+#endif /*HTTP_USE_GNUTLS*/
+}
+
+
+
 
 /* Start a HTTP retrieval and on success store at R_HD a context
    pointer for completing the request and to wait for the response.
@@ -724,6 +1090,7 @@ http_open (http_t *r_hd, http_req_t reqtype, const char *url,
       if (hd->fp_write)
         es_fclose (hd->fp_write);
       http_session_unref (hd->session);
+      xfree (hd->pool_host);
       xfree (hd);
     }
   else
@@ -894,6 +1261,8 @@ http_wait_response (http_t hd)
 
   err = parse_response (hd);
 
+  if (!err)
+    err = setup_content_decoding (hd);
   if (!err)
     err = es_onclose (hd->fp_read, 1, fp_onclose_notification, hd);
 
@@ -954,6 +1323,7 @@ http_close (http_t hd, int keep_read_stream)
       hd->headers = tmp;
     }
   xfree (hd->buffer);
+  xfree (hd->pool_host);
   xfree (hd);
 }
 
@@ -1436,8 +1806,11 @@ send_request (http_t hd, const char *httphost, const char *auth,
   const char *http_proxy = NULL;
   char *proxy_authstr = NULL;
   char *authstr = NULL;
+  const char *accept_encoding = "";
   int sock;
   int hnf;
+  const char *s;
+  pooled_conn_t conn;
 
   if (hd->uri->use_tls && !hd->session)
     {
@@ -1455,6 +1828,37 @@ send_request (http_t hd, const char *httphost, const char *auth,
   server = *hd->uri->host ? hd->uri->host : "localhost";
   port = hd->uri->port ? hd->uri->port : 80;
 
+  /* Look for an idle connection to the server.  Connections through
+     a proxy are not kept.  */
+  if ((hd->flags & HTTP_FLAG_KEEP_ALIVE)
+      && !(proxy && *proxy)
+      && !((hd->flags & HTTP_FLAG_TRY_PROXY)
+           && (s = getenv (HTTP_PROXY_ENV)) && *s))
+    {
+      hd->pool_host = xtrystrdup (server);
+      if (!hd->pool_host)
+        return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+      hd->pool_port = port;
+
+      conn = pool_get (server, port, hd->uri->use_tls,
+                       httphost? httphost : server);
+      if (conn)
+        {
+          hd->sock = conn->sock;
+          if (conn->session)
+            {
+              /* The TLS state lives in the session of the connection;
+                 its server has already been verified.  */
+              conn->session->in_pool = 0;
+              http_session_unref (hd->session);
+              hd->session = conn->session;
+            }
+          xfree (conn);
+          hd->reused = 1;
+          goto connected;
+        }
+    }
+
   /* Try to use SNI.  */
 #ifdef USE_TLS
   if (hd->uri->use_tls)
@@ -1463,6 +1867,10 @@ send_request (http_t hd, const char *httphost, const char *auth,
       int rc;
 # endif
 
+      /* The session can't be used for two connections.  */
+      if (hd->session->in_pool)
+        pool_drop_session (hd->session);
+
       xfree (hd->session->servername);
       hd->session->servername = xtrystrdup (httphost? httphost : server);
       if (!hd->session->servername)
@@ -1615,6 +2023,8 @@ send_request (http_t hd, const char *httphost, const char *auth,
       gnutls_transport_set_push_function (hd->session->tls_session,
                                           my_npth_write);
 #endif
+      if (hd->pool_host)
+        tls_resume_load (hd->session, port);
 
       do
         {
@@ -1654,9 +2064,13 @@ send_request (http_t hd, const char *httphost, const char *auth,
           xfree (proxy_authstr);
           return err;
         }
+
+      if (hd->pool_host)
+        tls_resume_save (hd->session, port);
     }
 #endif /*HTTP_USE_GNUTLS*/
 
+ connected:
   if (auth || hd->uri->auth)
     {
       char *myauth;
@@ -1690,6 +2104,11 @@ send_request (http_t hd, const char *httphost, const char *auth,
         }
     }
 
+#ifdef HAVE_ZIP
+  if ((hd->flags & HTTP_FLAG_COMPRESS) && hd->req_type != HTTP_REQ_HEAD)
+    accept_encoding = "Accept-Encoding: gzip, deflate\r\n";
+#endif
+
   p = build_rel_path (hd->uri);
   if (!p)
     return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
@@ -1697,7 +2116,7 @@ send_request (http_t hd, const char *httphost, const char *auth,
   if (http_proxy && *http_proxy)
     {
       request = es_bsprintf
-        ("%s %s://%s:%hu%s%s HTTP/1.0\r\n%s%s",
+        ("%s %s://%s:%hu%s%s HTTP/1.0\r\n%s%s%s",
          hd->req_type == HTTP_REQ_GET ? "GET" :
          hd->req_type == HTTP_REQ_HEAD ? "HEAD" :
          hd->req_type == HTTP_REQ_POST ? "POST" : "OOPS",
@@ -1705,7 +2124,8 @@ send_request (http_t hd, const char *httphost, const char *auth,
          httphost? httphost : server,
          port, *p == '/' ? "" : "/", p,
          authstr ? authstr : "",
-         proxy_authstr ? proxy_authstr : "");
+         proxy_authstr ? proxy_authstr : "",
+         accept_encoding);
     }
   else
     {
@@ -1717,14 +2137,16 @@ send_request (http_t hd, const char *httphost, const char *auth,
         snprintf (portstr, sizeof portstr, ":%u", port);
 
       request = es_bsprintf
-        ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s",
+        ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s%s%s",
          hd->req_type == HTTP_REQ_GET ? "GET" :
          hd->req_type == HTTP_REQ_HEAD ? "HEAD" :
          hd->req_type == HTTP_REQ_POST ? "POST" : "OOPS",
          *p == '/' ? "" : "/", p,
          httphost? httphost : server,
          portstr,
-         authstr? authstr:"");
+         hd->pool_host? "Connection: keep-alive\r\n" : "",
+         authstr? authstr:"",
+         accept_encoding);
     }
   xfree (p);
   if (!request)
@@ -1997,6 +2419,8 @@ parse_response (http_t hd)
   size_t maxlen, len;
   cookie_t cookie = hd->read_cookie;
   const char *s;
+  longcounter_t hdrlen = 0;
+  longcounter_t buffered;
 
   /* Delete old header lines.  */
   while (hd->headers)
@@ -2017,6 +2441,7 @@ parse_response (http_t hd)
 	return gpg_err_code_from_syserror (); /* Out of core. */
       if (!maxlen)
 	return GPG_ERR_TRUNCATED; /* Line has been truncated. */
+      hdrlen += len;
       if (!len)
 	return GPG_ERR_EOF;
 
@@ -2063,6 +2488,7 @@ parse_response (http_t hd)
       /* Note, that we can silently ignore truncated lines. */
       if (!len)
 	return GPG_ERR_EOF;
+      hdrlen += len;
       /* Trim line endings of empty lines. */
       if ((*line == '\r' && line[1] == '\n') || *line == '\n')
 	*line = 0;
@@ -2089,6 +2515,91 @@ parse_response (http_t hd)
         }
     }
 
+  /* Pooled connections are only useful if the end of the response is
+     known without closing the connection.  */
+  if (hd->pool_host && !cookie->content_length_valid
+      && (hd->status_code == 204 || hd->status_code == 304))
+    {
+      cookie->content_length_valid = 1;
+      cookie->content_length = 0;
+    }
+
+  /* While reading the header lines, the stream may already have read
+     the first bytes of the body.  */
+  if (cookie->content_length_valid)
+    {
+      buffered = cookie->bytes_read - hdrlen;
+      if (buffered > cookie->content_length)
+        {
+          /* More data than announced; don't keep the connection.  */
+          cookie->content_length = 0;
+          xfree (hd->pool_host);
+          hd->pool_host = NULL;
+        }
+      else
+        cookie->content_length -= buffered;
+    }
+
+  if (hd->pool_host && cookie->content_length_valid
+      && !(hd->flags & HTTP_FLAG_SHUTDOWN)
+      && (s = http_get_header (hd, "Connection"))
+      && ascii_memistr (s, strlen (s), "keep-alive"))
+    {
+      cookie->keep_alive = 1;
+      cookie->pool_host = hd->pool_host;
+      cookie->pool_port = hd->pool_port;
+      hd->pool_host = NULL;
+    }
+
+  return 0;
+}
+
+
+/* If the body of the response parsed into HD has been compressed
+   because we asked for it with HTTP_FLAG_COMPRESS, replace the read
+   stream of HD by one which returns the decoded body.  The raw
+   stream still takes care of the content length and the keeping of
+   the connection; it is closed along with the new stream.  */
+static gpg_error_t
+setup_content_decoding (http_t hd)
+{
+#ifdef HAVE_ZIP
+  const char *s;
+  zcookie_t zc;
+  estream_t fp;
+  int deflate;
+
+  if (!(hd->flags & HTTP_FLAG_COMPRESS) || hd->req_type == HTTP_REQ_HEAD)
+    return 0;
+  s = http_get_header (hd, "Content-Encoding");
+  if (!s)
+    return 0;
+  while (spacep (s))
+    s++;
+  if (!ascii_strcasecmp (s, "gzip") || !ascii_strcasecmp (s, "x-gzip"))
+    deflate = 0;
+  else if (!ascii_strcasecmp (s, "deflate"))
+    deflate = 1;
+  else
+    return 0;  /* Identity or something we did not ask for.  */
+
+  zc = xtrycalloc (1, sizeof *zc);
+  if (!zc)
+    return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+  zc->raw = hd->fp_read;
+  zc->deflate = deflate;
+  fp = es_fopencookie (zc, "r", zcookie_functions);
+  if (!fp)
+    {
+      xfree (zc);
+      return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+    }
+  hd->fp_read = fp;
+  if ((hd->flags & HTTP_FLAG_LOG_RESP))
+    log_info ("decoding the %s encoded response\n", deflate? "deflate":"gzip");
+#else
+  (void)hd;
+#endif /*HAVE_ZIP*/
   return 0;
 }
 
@@ -2169,6 +2680,83 @@ start_server ()
 }
 #endif
 
+#ifdef HAVE_GETADDRINFO
+/* The largest number of addresses we try for one host.  */
+#define MAX_HOST_ADDRS 16
+
+/* Time in seconds the addresses of a host are cached.  getaddrinfo
+   does not tell us the TTL of the records.  */
+#define ADDRINFO_CACHE_TTL 300
+
+/* One address of a host as stored in the DNS cache.  */
+struct host_addr_s
+{
+  int family;
+  int socktype;
+  int protocol;
+  socklen_t addrlen;
+  struct sockaddr_storage addr;
+};
+
+
+/* Resolve NAME and PORTSTR and store up to MAX_HOST_ADDRS addresses
+   at ADDRS.  Returns the number of addresses; 0 if the host was not
+   found.  The results are taken from and stored in the DNS cache.  */
+static int
+resolve_host (const char *name, const char *portstr,
+              struct host_addr_s *addrs)
+{
+  struct addrinfo hints, *res, *ai;
+  char *key;
+  int n, ec;
+
+  key = strconcat (name, ":", portstr, NULL);
+  if (key)
+    {
+      n = dns_cache_lookup (key, DNS_CACHE_ADDRINFO,
+                            addrs, MAX_HOST_ADDRS * sizeof *addrs);
+      if (n >= 0)
+        {
+          xfree (key);
+          return n / sizeof *addrs;
+        }
+    }
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_socktype = SOCK_STREAM;
+  ec = getaddrinfo (name, portstr, &hints, &res);
+  n = 0;
+  if (!ec)
+    {
+      for (ai = res; ai && n < MAX_HOST_ADDRS; ai = ai->ai_next)
+        {
+          if (ai->ai_addrlen > sizeof addrs[n].addr)
+            continue;
+          memset (&addrs[n], 0, sizeof *addrs);
+          addrs[n].family   = ai->ai_family;
+          addrs[n].socktype = ai->ai_socktype;
+          addrs[n].protocol = ai->ai_protocol;
+          addrs[n].addrlen  = ai->ai_addrlen;
+          memcpy (&addrs[n].addr, ai->ai_addr, ai->ai_addrlen);
+          n++;
+        }
+      freeaddrinfo (res);
+    }
+
+  /* Do not remember temporary failures of the resolver.  */
+  if (key && (!ec || ec == EAI_NONAME
+#ifdef EAI_NODATA
+              || ec == EAI_NODATA
+#endif
+              ))
+    dns_cache_store (key, DNS_CACHE_ADDRINFO, addrs, n * sizeof *addrs,
+                     ADDRINFO_CACHE_TTL);
+  xfree (key);
+  return n;
+}
+#endif /*HAVE_GETADDRINFO*/
+
+
 /* Actually connect to a server.  Returns the file descriptor or -1 on
    error.  ERRNO is set on error. */
 static int
@@ -2255,43 +2843,42 @@ connect_server (const char *server, unsigned short port,
   connected = 0;
   for (srv=0; srv < srvcount && !connected; srv++)
     {
-      struct addrinfo hints, *res, *ai;
+      struct host_addr_s addrs[MAX_HOST_ADDRS], *ai;
       char portstr[35];
+      int i, naddrs;
 
       snprintf (portstr, sizeof portstr, "%hu", port);
-      memset (&hints, 0, sizeof (hints));
-      hints.ai_socktype = SOCK_STREAM;
-      if (getaddrinfo (serverlist[srv].target, portstr, &hints, &res))
+      naddrs = resolve_host (serverlist[srv].target, portstr, addrs);
+      if (!naddrs)
         continue; /* Not found - try next one. */
       hostfound = 1;
 
-      for (ai = res; ai && !connected; ai = ai->ai_next)
+      for (i = 0; i < naddrs && !connected; i++)
         {
-          if (ai->ai_family == AF_INET && (flags & HTTP_FLAG_IGNORE_IPv4))
+          ai = addrs + i;
+          if (ai->family == AF_INET && (flags & HTTP_FLAG_IGNORE_IPv4))
             continue;
-          if (ai->ai_family == AF_INET6 && (flags & HTTP_FLAG_IGNORE_IPv6))
+          if (ai->family == AF_INET6 && (flags & HTTP_FLAG_IGNORE_IPv6))
             continue;
 
           if (sock != -1)
             sock_close (sock);
-          sock = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+          sock = socket (ai->family, ai->socktype, ai->protocol);
           if (sock == -1)
             {
               int save_errno = errno;
               log_error ("error creating socket: %s\n", strerror (errno));
-              freeaddrinfo (res);
               xfree (serverlist);
               errno = save_errno;
               return -1;
             }
 
           anyhostaddr = 1;
-          if (my_connect (sock, ai->ai_addr, ai->ai_addrlen))
+          if (my_connect (sock, (struct sockaddr *)&ai->addr, ai->addrlen))
             last_errno = errno;
           else
             connected = 1;
         }
-      freeaddrinfo (res);
     }
 #else /* !HAVE_GETADDRINFO */
   connected = 0;
@@ -2505,6 +3092,9 @@ cookie_read (void *cookie, void *buffer, size_t size)
       while (nread == -1 && errno == EINTR);
     }
 
+  if (nread > 0)
+    c->bytes_read += nread;
+
   if (c->content_length_valid && nread > 0)
     {
       if (nread < c->content_length)
@@ -2603,6 +3193,20 @@ cookie_close (void *cookie)
   if (!c)
     return 0;
 
+  /* Keep the connection if the response has been read completely.  */
+  if (c->keep_alive && c->sock && !c->content_length)
+    {
+      if (c->use_tls)
+        {
+          pool_put (c->sock, c->session, c->pool_host, c->pool_port);
+          c->session = NULL;
+        }
+      else
+        pool_put (c->sock, NULL, c->pool_host, c->pool_port);
+      c->sock = NULL;
+    }
+  xfree (c->pool_host);
+
 #ifdef HTTP_USE_GNUTLS
   if (c->use_tls && c->session && c->session->tls_session)
     my_socket_unref (c->sock, send_gnutls_bye, c->session->tls_session);
@@ -2618,6 +3222,116 @@ cookie_close (void *cookie)
 }
 
 
+#ifdef HAVE_ZIP
+/* Start decoding the compressed data in the buffer of ZC.  A
+   "deflate" body should be in the zlib format but some servers send
+   raw deflate data; we tell them apart by the zlib header.  */
+static int
+zcookie_start (zcookie_t zc)
+{
+  const unsigned char *p = zc->zs.next_in;
+  int wbits;
+
+  if (!zc->deflate)
+    wbits = 15 + 16;  /* gzip.  */
+  else if (zc->zs.avail_in >= 2 && (p[0] & 0x0f) == Z_DEFLATED
+           && !(((p[0] << 8) | p[1]) % 31))
+    wbits = 15;
+  else
+    wbits = -15;
+  zc->started = 1;
+  return inflateInit2 (&zc->zs, wbits);
+}
+
+
+/* Read handler for the stream decoding a compressed body.  */
+static ssize_t
+zcookie_read (void *cookie, void *buffer, size_t size)
+{
+  zcookie_t zc = cookie;
+  size_t nread;
+  int rc;
+
+  if (zc->eof || !size)
+    return 0;
+  if (zc->failed)
+    {
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+
+  zc->zs.next_out = buffer;
+  zc->zs.avail_out = size;
+  while (zc->zs.avail_out == size)
+    {
+      if (!zc->zs.avail_in)
+        {
+          if (es_read (zc->raw, zc->inbuf, sizeof zc->inbuf, &nread))
+            return -1;
+          if (!nread)
+            {
+              if (!zc->started)
+                {
+                  /* An empty body.  */
+                  zc->eof = 1;
+                  return 0;
+                }
+              log_info ("compressed HTTP response is truncated\n");
+              zc->failed = 1;
+              gpg_err_set_errno (EIO);
+              return -1;
+            }
+          zc->zs.next_in = zc->inbuf;
+          zc->zs.avail_in = nread;
+        }
+
+      if (!zc->started && zcookie_start (zc) != Z_OK)
+        {
+          log_error ("error initializing the HTTP decoder\n");
+          zc->failed = 1;
+          gpg_err_set_errno (ENOMEM);
+          return -1;
+        }
+
+      rc = inflate (&zc->zs, Z_NO_FLUSH);
+      if (rc == Z_STREAM_END)
+        {
+          zc->eof = 1;
+          break;
+        }
+      if (rc != Z_OK && rc != Z_BUF_ERROR)
+        {
+          log_info ("error decoding the HTTP response: %s\n",
+                    zc->zs.msg? zc->zs.msg : "?");
+          zc->failed = 1;
+          if (zc->zs.avail_out != size)
+            break;  /* Return what we have; fail with the next read.  */
+          gpg_err_set_errno (EIO);
+          return -1;
+        }
+    }
+
+  return size - zc->zs.avail_out;
+}
+
+
+/* Close handler for the stream decoding a compressed body.  */
+static int
+zcookie_close (void *cookie)
+{
+  zcookie_t zc = cookie;
+
+  if (!zc)
+    return 0;
+  if (zc->started)
+    inflateEnd (&zc->zs);
+  es_fclose (zc->raw);
+  xfree (zc);
+  return 0;
+}
+#endif /*HAVE_ZIP*/
+
+
 
 
 /* Verify the credentials of the server.  Returns 0 on success and
@@ -82,7 +82,9 @@ enum
     HTTP_FLAG_FORCE_TLS = 16,    /* Force the use opf TLS.  */
     HTTP_FLAG_IGNORE_CL = 32,    /* Ignore content-length.  */
     HTTP_FLAG_IGNORE_IPv4 = 64,  /* Do not use IPv4.  */
-    HTTP_FLAG_IGNORE_IPv6 = 128  /* Do not use IPv6.  */
+    HTTP_FLAG_IGNORE_IPv6 = 128, /* Do not use IPv6.  */
+    HTTP_FLAG_KEEP_ALIVE = 256,  /* Keep the connection for reuse.  */
+    HTTP_FLAG_COMPRESS = 512     /* Accept and decode a compressed body.  */
   };
 
 
@@ -105,6 +107,8 @@ void http_session_set_log_cb (http_session_t sess,
                                          const char *,
                                          const void **, size_t *));
 
+void http_pool_flush (void);
+
 
 gpg_error_t http_parse_uri (parsed_uri_t *ret_uri, const char *uri,
                             int no_scheme_check);
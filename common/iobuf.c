@@ -35,10 +35,14 @@
 #include <errno.h>
 #include <ctype.h>
 #include <assert.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -63,6 +67,13 @@
    test "armored_key_8192" in armor.test! */
 #define IOBUF_BUFFER_SIZE  8192
 
+/* The size of the buffers used for regular files unless a size has
+   been set with iobuf_set_default_buffer_size.  */
+#define IOBUF_FILE_BUFFER_SIZE  (256*1024)
+
+/* The largest buffer size we accept.  */
+#define IOBUF_MAX_BUFFER_SIZE  (16*1024*1024)
+
 /* To avoid a potential DoS with compression packets we better limit
    the number of filters in a chain.  */
 #define MAX_NESTING_FILTER 64
@@ -92,6 +103,9 @@ typedef struct
   int no_cache;
   int eof_seen;
   int print_only_name; /* Flags indicating that fname is not a real file.  */
+  byte *map;           /* If not NULL the file is read from this mapping */
+  size_t maplen;       /* of MAPLEN bytes, */
+  size_t mapoff;       /* starting at offset MAPOFF.  */
   char fname[1];       /* Name of the file.  */
 } file_filter_ctx_t;
 
@@ -159,8 +173,53 @@ block_filter_ctx_t;
    belong into the iobuf subsystem. */
 static int special_names_enabled;
 
+/* Set by iobuf_enable_mmap to let iobuf_open_mmap map files.  */
+static int mmap_enabled;
+
+/* The buffer size set with iobuf_set_default_buffer_size or 0 to
+   select it depending on the kind of file.  */
+static size_t default_buffer_size;
+
+/* The largest number of different filters for which statistics are
+   kept.  */
+#define MAX_FILTER_STATS 32
+
+/* The statistics of all filters; see iobuf_enable_stats.  */
+static struct
+{
+  int enabled;
+  void (*tick) (void);  /* Called about once a second.  */
+  time_t last_tick;
+  int nfilters;
+  struct
+  {
+    int (*filter) (void *opaque, int control,
+                   iobuf_t chain, byte * buf, size_t * len);
+    struct iobuf_filter_stats_s s;
+  } filters[MAX_FILTER_STATS];
+  /* The bytes and the CPU time used by the filters called by the
+     current one.  */
+  unsigned long long child_bytes;
+  clock_t child_cpu;
+} filter_stats;
+
+/* The memory used by the buffers of all iobufs and by the filters
+   which claim memory with iobuf_claim_memory; see
+   iobuf_set_memory_limit.  */
+static struct
+{
+  size_t limit;   /* 0 for no limit.  */
+  size_t used;
+  size_t peak;
+} buffer_mem;
+
 /* Local prototypes.  */
+static struct iobuf_filter_stats_s *get_filter_stats (iobuf_t a);
+static size_t limit_buffer_size (size_t want, size_t have);
+static void charge_buffer (iobuf_t a);
+static void uncharge_buffer (iobuf_t a);
 static int underflow (iobuf_t a);
+static int call_filter (iobuf_t a, int control, byte *buf, size_t *len);
 static int translate_file_handle (int fd, int for_write);
 
 
@@ -471,6 +530,25 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	  rc = -1;
 	  *ret_len = 0;
 	}
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+      else if (a->map)
+	{
+	  nbytes = a->maplen - a->mapoff;
+	  if (!nbytes)
+	    {
+	      a->eof_seen = 1;
+	      rc = -1;
+	    }
+	  else
+	    {
+	      if (nbytes > size)
+		nbytes = size;
+	      memcpy (buf, a->map + a->mapoff, nbytes);
+	      a->mapoff += nbytes;
+	    }
+	  *ret_len = nbytes;
+	}
+#endif
       else
 	{
 #ifdef HAVE_W32_SYSTEM
@@ -585,6 +663,8 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
       a->eof_seen = 0;
       a->keep_open = 0;
       a->no_cache = 0;
+      a->map = NULL;
+      a->maplen = a->mapoff = 0;
     }
   else if (control == IOBUFCTRL_DESC)
     {
@@ -592,6 +672,11 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FREE)
     {
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+      if (a->map)
+        munmap (a->map, a->maplen);
+      a->map = NULL;
+#endif
       if (f != FD_FOR_STDIN && f != FD_FOR_STDOUT)
 	{
 	  if (DBG_IOBUF)
@@ -1109,12 +1194,15 @@ iobuf_alloc (int use, size_t bufsize)
 
   a = xcalloc (1, sizeof *a);
   a->use = use;
+  if (use != 3)
+    bufsize = limit_buffer_size (bufsize, 0);
   a->d.buf = xmalloc (bufsize);
   a->d.size = bufsize;
   a->no = ++number;
   a->subno = 0;
   a->opaque = NULL;
   a->real_fname = NULL;
+  charge_buffer (a);
   return a;
 }
 
@@ -1143,11 +1231,14 @@ iobuf_close (iobuf_t a)
       if (DBG_IOBUF)
 	log_debug ("iobuf-%d.%d: close '%s'\n", a->no, a->subno,
                    a->desc?a->desc:"?");
-      if (a->filter && (rc = a->filter (a->filter_ov, IOBUFCTRL_FREE,
-					a->chain, NULL, &dummy_len)))
+      if (a->filter && (rc = call_filter (a, IOBUFCTRL_FREE,
+					  NULL, &dummy_len)))
 	log_error ("IOBUFCTRL_FREE failed on close: %s\n", gpg_strerror (rc));
       xfree (a->real_fname);
-      if (a->d.buf)
+      uncharge_buffer (a);
+      if (a->release_buf)
+        a->release_buf (a->release_buf_arg);
+      else if (a->d.buf)
 	{
 	  memset (a->d.buf, 0, a->d.size);	/* erase the buffer */
 	  xfree (a->d.buf);
@@ -1239,6 +1330,35 @@ iobuf_temp_with_content (const char *buffer, size_t length)
   return a;
 }
 
+static void
+release_nothing (void *arg)
+{
+  (void)arg;
+}
+
+
+/* Create a temporary iobuf for reading the LENGTH bytes at BUFFER in
+   place.  BUFFER must stay valid until the iobuf is closed; then
+   RELEASE, if not NULL, is called with RELEASE_ARG.  The iobuf must
+   not be written to and no filters may be pushed on it.  */
+iobuf_t
+iobuf_temp_with_buffer (const void *buffer, size_t length,
+                        void (*release) (void *arg), void *release_arg)
+{
+  iobuf_t a;
+
+  a = iobuf_alloc (3, 1);
+  uncharge_buffer (a);
+  xfree (a->d.buf);
+  a->d.buf = (byte *)buffer;
+  a->d.size = length;
+  a->d.len = length;
+  a->release_buf = release? release : release_nothing;
+  a->release_buf_arg = release_arg;
+
+  return a;
+}
+
 void
 iobuf_enable_special_filenames (int yes)
 {
@@ -1246,6 +1366,99 @@ iobuf_enable_special_filenames (int yes)
 }
 
 
+/* Let iobuf_open_mmap map the files if YES is true.  This is off by
+   default because a mapped file which is truncated while it is being
+   read raises SIGBUS instead of a read error.  */
+void
+iobuf_enable_mmap (int yes)
+{
+  mmap_enabled = yes;
+}
+
+
+/* Set the size of the buffers of iobufs opened from now on to SIZE.
+   With SIZE 0 regular files get large buffers and anything else,
+   like terminals and pipes, the standard size.  Filters pushed on an
+   iobuf use the buffer size of that iobuf.  */
+void
+iobuf_set_default_buffer_size (size_t size)
+{
+  if (size && size < 512)
+    size = 512;
+  else if (size > IOBUF_MAX_BUFFER_SIZE)
+    size = IOBUF_MAX_BUFFER_SIZE;
+  default_buffer_size = size;
+}
+
+
+/* Return the buffer size to use for streams which are not known to
+   be regular files.  */
+static size_t
+standard_buffer_size (void)
+{
+  return default_buffer_size? default_buffer_size : IOBUF_BUFFER_SIZE;
+}
+
+
+/* Return the buffer size to use for the file FP.  */
+static size_t
+buffer_size_for_fd (gnupg_fd_t fp)
+{
+  if (default_buffer_size)
+    return default_buffer_size;
+#ifdef HAVE_W32_SYSTEM
+# ifndef HAVE_W32CE_SYSTEM
+  if (GetFileType (fp) == FILE_TYPE_DISK)
+    return IOBUF_FILE_BUFFER_SIZE;
+# endif
+#else
+  {
+    struct stat st;
+
+    if (!fstat (fp, &st) && S_ISREG (st.st_mode))
+      return IOBUF_FILE_BUFFER_SIZE;
+  }
+#endif
+  return IOBUF_BUFFER_SIZE;
+}
+
+
+/* Return the size of the buffer of A.  */
+size_t
+iobuf_get_buffer_size (iobuf_t a)
+{
+  return a->d.size;
+}
+
+
+/* Change the size of the buffer of A to SIZE.  Filters pushed on A
+   afterwards use the new size as well.  The buffer is not shrunk
+   below the amount of data it currently holds.  */
+void
+iobuf_set_buffer_size (iobuf_t a, size_t size)
+{
+  if (a->directfp || a->use == 3)
+    return;
+  if (size < 512)
+    size = 512;
+  else if (size > IOBUF_MAX_BUFFER_SIZE)
+    size = IOBUF_MAX_BUFFER_SIZE;
+  if (size > a->d.size)
+    size = limit_buffer_size (size, a->d.size);
+  if (size < a->d.len)
+    size = a->d.len;
+  if (size == a->d.size)
+    return;
+
+  if (DBG_IOBUF)
+    log_debug ("iobuf-%d.%d: buffer size %lu -> %lu\n", a->no, a->subno,
+               (ulong)a->d.size, (ulong)size);
+  a->d.buf = xrealloc (a->d.buf, size);
+  a->d.size = size;
+  charge_buffer (a);
+}
+
+
 /* See whether the filename has the form "-&nnnn", where n is a
    non-zero number.  Returns this number or -1 if it is not the
    case.  */
@@ -1318,7 +1531,7 @@ iobuf_open (const char *fname)
     return iobuf_fdopen (translate_file_handle (fd, 0), "rb");
   else if ((fp = fd_cache_open (fname, "rb")) == GNUPG_INVALID_FD)
     return NULL;
-  a = iobuf_alloc (1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (1, buffer_size_for_fd (fp));
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1337,6 +1550,56 @@ iobuf_open (const char *fname)
 }
 
 
+/* Create a head iobuf for reading from the file FNAME like
+   iobuf_open but map the file into memory if it is a regular file and
+   mapping has been enabled with iobuf_enable_mmap.  This saves the
+   read calls and allows iobuf_read_direct to hand out pointers into
+   the page cache.  The mapping is only suitable for files which are
+   not modified while we read them: data appended after the open is
+   not seen and truncating the file kills the process with SIGBUS.
+   For pipes, special files, if not enabled and if the mapping fails
+   the file is read as usual.  */
+iobuf_t
+iobuf_open_mmap (const char *fname)
+{
+  iobuf_t a;
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+  file_filter_ctx_t *fcx;
+  struct stat st;
+  void *map;
+#endif
+
+  a = iobuf_open (fname);
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+  if (!mmap_enabled || !a || a->filter != file_filter)
+    return a;
+  fcx = a->filter_ov;
+  if (fcx->print_only_name
+      || fstat (fcx->fp, &st) || !S_ISREG (st.st_mode) || !st.st_size
+      || (off_t)(size_t)st.st_size != st.st_size)
+    return a;
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fcx->fp, 0);
+  if (map == MAP_FAILED)
+    {
+      if (DBG_IOBUF)
+        log_debug ("iobuf-%d.%d: mmap '%s' failed: %s\n",
+                   a->no, a->subno, fname, strerror (errno));
+      return a;
+    }
+#ifdef HAVE_POSIX_MADVISE
+  posix_madvise (map, st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+  fcx->map = map;
+  fcx->maplen = st.st_size;
+  fcx->mapoff = 0;
+  if (DBG_IOBUF)
+    log_debug ("iobuf-%d.%d: mapped '%s' (%lu bytes)\n",
+               a->no, a->subno, fname, (ulong)fcx->maplen);
+#endif /*HAVE_MMAP*/
+  return a;
+}
+
+
 static iobuf_t
 do_iobuf_fdopen (int fd, const char *mode, int keep_open)
 {
@@ -1347,7 +1610,7 @@ do_iobuf_fdopen (int fd, const char *mode, int keep_open)
 
   fp = INT2FD (fd);
 
-  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, buffer_size_for_fd (fp));
   fcx = xmalloc (sizeof *fcx + 20);
   fcx->fp = fp;
   fcx->print_only_name = 1;
@@ -1387,7 +1650,7 @@ iobuf_esopen (estream_t estream, const char *mode, int keep_open)
   file_es_filter_ctx_t *fcx;
   size_t len;
 
-  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, standard_buffer_size ());
   fcx = xtrymalloc (sizeof *fcx + 30);
   fcx->fp = estream;
   fcx->print_only_name = 1;
@@ -1412,7 +1675,7 @@ iobuf_sockopen (int fd, const char *mode)
   sock_filter_ctx_t *scx;
   size_t len;
 
-  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, standard_buffer_size ());
   scx = xmalloc (sizeof *scx + 25);
   scx->sock = fd;
   scx->print_only_name = 1;
@@ -1454,7 +1717,7 @@ iobuf_create (const char *fname, int mode700)
     return iobuf_fdopen (translate_file_handle (fd, 1), "wb");
   else if ((fp = direct_open (fname, "wb", mode700)) == GNUPG_INVALID_FD)
     return NULL;
-  a = iobuf_alloc (2, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (2, buffer_size_for_fd (fp));
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1641,16 +1904,23 @@ iobuf_push_filter2 (iobuf_t a,
   if (a->use == 2)
     {				/* allocate a fresh buffer for the
                                    original stream */
-      b->d.buf = xmalloc (a->d.size);
+      b->d.size = limit_buffer_size (a->d.size, 0);
+      b->d.buf = xmalloc (b->d.size);
       b->d.len = 0;
       b->d.start = 0;
+      b->charged = 0;
+      b->charged_to = NULL;
+      charge_buffer (b);
     }
   else
     {				/* allocate a fresh buffer for the new
                                    stream */
+      a->d.size = limit_buffer_size (a->d.size, 0);
       a->d.buf = xmalloc (a->d.size);
       a->d.len = 0;
       a->d.start = 0;
+      a->charged = 0;
+      a->charged_to = NULL;
     }
   /* disable nlimit for the new stream */
   a->ntotal = b->ntotal + b->nbytes;
@@ -1667,6 +1937,8 @@ iobuf_push_filter2 (iobuf_t a,
 
   a->subno = b->subno + 1;
   f (ov, IOBUFCTRL_DESC, NULL, (byte *) & a->desc, &dummy_len);
+  if (a->use != 2)
+    charge_buffer (a);
 
   if (DBG_IOBUF)
     {
@@ -1704,6 +1976,7 @@ pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
     {				/* this is simple */
       b = a->chain;
       assert (b);
+      uncharge_buffer (a);
       xfree (a->d.buf);
       xfree (a->real_fname);
       memcpy (a, b, sizeof *a);
@@ -1723,8 +1996,8 @@ pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
       return rc;
     }
   /* and tell the filter to free it self */
-  if (b->filter && (rc = b->filter (b->filter_ov, IOBUFCTRL_FREE, b->chain,
-				    NULL, &dummy_len)))
+  if (b->filter && (rc = call_filter (b, IOBUFCTRL_FREE, NULL,
+				      &dummy_len)))
     {
       log_error ("IOBUFCTRL_FREE failed: %s\n", gpg_strerror (rc));
       return rc;
@@ -1745,6 +2018,7 @@ pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
        * a flush has been done on the to be removed entry
        */
       b = a->chain;
+      uncharge_buffer (a);
       xfree (a->d.buf);
       xfree (a->real_fname);
       memcpy (a, b, sizeof *a);
@@ -1787,6 +2061,7 @@ underflow (iobuf_t a)
 	  if (DBG_IOBUF)
 	    log_debug ("iobuf-%d.%d: pop '%s' in underflow\n",
 		       a->no, a->subno, a->desc?a->desc:"?");
+	  uncharge_buffer (a);
 	  xfree (a->d.buf);
 	  xfree (a->real_fname);
 	  memcpy (a, b, sizeof *a);
@@ -1829,8 +2104,7 @@ underflow (iobuf_t a)
       if (DBG_IOBUF)
 	log_debug ("iobuf-%d.%d: underflow: req=%lu\n",
 		   a->no, a->subno, (ulong) len);
-      rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
-		      a->d.buf, &len);
+      rc = call_filter (a, IOBUFCTRL_UNDERFLOW, a->d.buf, &len);
       if (DBG_IOBUF)
 	{
 	  log_debug ("iobuf-%d.%d: underflow: got=%lu rc=%d\n",
@@ -1843,8 +2117,7 @@ underflow (iobuf_t a)
 	  size_t dummy_len = 0;
 
 	  /* and tell the filter to free itself */
-	  if ((rc = a->filter (a->filter_ov, IOBUFCTRL_FREE, a->chain,
-			       NULL, &dummy_len)))
+	  if ((rc = call_filter (a, IOBUFCTRL_FREE, NULL, &dummy_len)))
 	    log_error ("IOBUFCTRL_FREE failed: %s\n", gpg_strerror (rc));
 	  if (a->filter_ov && a->filter_ov_owner)
 	    {
@@ -1861,6 +2134,7 @@ underflow (iobuf_t a)
 	      if (DBG_IOBUF)
 		log_debug ("iobuf-%d.%d: pop in underflow (!len)\n",
 			   a->no, a->subno);
+	      uncharge_buffer (a);
 	      xfree (a->d.buf);
 	      xfree (a->real_fname);
 	      memcpy (a, b, sizeof *a);
@@ -1913,6 +2187,7 @@ iobuf_flush (iobuf_t a)
       xfree (a->d.buf);
       a->d.buf = newbuf;
       a->d.size = newsize;
+      charge_buffer (a);
       return 0;
     }
   else if (a->use != 2)
@@ -1920,7 +2195,7 @@ iobuf_flush (iobuf_t a)
   else if (!a->filter)
     log_bug ("iobuf_flush: no filter\n");
   len = a->d.len;
-  rc = a->filter (a->filter_ov, IOBUFCTRL_FLUSH, a->chain, a->d.buf, &len);
+  rc = call_filter (a, IOBUFCTRL_FLUSH, a->d.buf, &len);
   if (!rc && len != a->d.len)
     {
       log_info ("iobuf_flush did not write all!\n");
@@ -1934,6 +2209,282 @@ iobuf_flush (iobuf_t a)
 }
 
 
+/* Return the statistics slot for the filter of A or NULL if all
+   slots are in use.  */
+static struct iobuf_filter_stats_s *
+get_filter_stats (iobuf_t a)
+{
+  const char *desc = NULL;
+  size_t dummy_len = 0;
+  int i;
+
+  for (i=0; i < filter_stats.nfilters; i++)
+    if (filter_stats.filters[i].filter == a->filter)
+      return &filter_stats.filters[i].s;
+
+  /* The slot may already have been created by iobuf_claim_memory.  */
+  a->filter (a->filter_ov, IOBUFCTRL_DESC, NULL, (byte *)&desc, &dummy_len);
+  if (!desc)
+    desc = "?";
+  for (i=0; i < filter_stats.nfilters; i++)
+    if (!filter_stats.filters[i].filter
+        && !strcmp (filter_stats.filters[i].s.name, desc))
+      {
+        filter_stats.filters[i].filter = a->filter;
+        return &filter_stats.filters[i].s;
+      }
+  if (i == MAX_FILTER_STATS)
+    return NULL;
+
+  filter_stats.filters[i].filter = a->filter;
+  filter_stats.filters[i].s.name = desc;
+  filter_stats.nfilters++;
+  return &filter_stats.filters[i].s;
+}
+
+
+/* Return the statistics slot with the name NAME, creating it if
+   needed, or NULL if all slots are in use.  */
+static struct iobuf_filter_stats_s *
+get_named_stats (const char *name)
+{
+  int i;
+
+  for (i=0; i < filter_stats.nfilters; i++)
+    if (!strcmp (filter_stats.filters[i].s.name, name))
+      return &filter_stats.filters[i].s;
+  if (i == MAX_FILTER_STATS)
+    return NULL;
+
+  filter_stats.filters[i].filter = NULL;
+  filter_stats.filters[i].s.name = name;
+  filter_stats.nfilters++;
+  return &filter_stats.filters[i].s;
+}
+
+
+/* Count SIZE more bytes of memory as used, also for the filter ST if
+   that is not NULL.  */
+static void
+add_memory (struct iobuf_filter_stats_s *st, size_t size)
+{
+  buffer_mem.used += size;
+  if (buffer_mem.used > buffer_mem.peak)
+    buffer_mem.peak = buffer_mem.used;
+  if (st)
+    {
+      st->mem += size;
+      if (st->mem > st->mem_peak)
+        st->mem_peak = st->mem;
+    }
+}
+
+
+/* Count SIZE bytes of memory as no longer used.  */
+static void
+sub_memory (struct iobuf_filter_stats_s *st, size_t size)
+{
+  buffer_mem.used -= size;
+  if (st)
+    st->mem -= size;
+}
+
+
+/* Return the size to use for a buffer of WANT bytes which replaces a
+   buffer of HAVE bytes, so that all buffers together stay within the
+   limit set with iobuf_set_memory_limit.  A buffer is not made
+   smaller than IOBUF_BUFFER_SIZE, which all filters can work with,
+   even if that exceeds the limit.  */
+static size_t
+limit_buffer_size (size_t want, size_t have)
+{
+  size_t used = buffer_mem.used - have;
+
+  if (!buffer_mem.limit || want <= IOBUF_BUFFER_SIZE
+      || used + want <= buffer_mem.limit)
+    return want;
+  if (used + IOBUF_BUFFER_SIZE >= buffer_mem.limit)
+    return IOBUF_BUFFER_SIZE;
+  return buffer_mem.limit - used;
+}
+
+
+/* Count the buffer of A with its current size as used.  While
+   statistics are enabled it is counted for the filter of A.  */
+static void
+charge_buffer (iobuf_t a)
+{
+  struct iobuf_filter_stats_s *st = NULL;
+
+  uncharge_buffer (a);
+  if (filter_stats.enabled && a->filter)
+    st = get_filter_stats (a);
+  a->charged = a->release_buf? 0 : a->d.size;
+  a->charged_to = st;
+  add_memory (st, a->charged);
+}
+
+
+/* Count the buffer of A as no longer used.  */
+static void
+uncharge_buffer (iobuf_t a)
+{
+  sub_memory (a->charged_to, a->charged);
+  a->charged = 0;
+  a->charged_to = NULL;
+}
+
+
+/* Call the filter of A with CONTROL for the {BUF,LEN} and update its
+   statistics if they are enabled.  A reading filter receives the
+   bytes it asks its chain for and returns its output in BUF; it is
+   the other way round for a writing filter.  The bytes and the time
+   of a filter called by another one are not counted for the
+   latter.  */
+static int
+call_filter (iobuf_t a, int control, byte *buf, size_t *len)
+{
+  struct iobuf_filter_stats_s *st;
+  unsigned long long saved_bytes;
+  clock_t saved_cpu, start, used;
+  size_t n;
+  int rc;
+
+  if (!filter_stats.enabled || !(st = get_filter_stats (a)))
+    return a->filter (a->filter_ov, control, a->chain, buf, len);
+  if (a->charged_to != st)
+    charge_buffer (a);
+
+  saved_bytes = filter_stats.child_bytes;
+  saved_cpu = filter_stats.child_cpu;
+  filter_stats.child_bytes = 0;
+  filter_stats.child_cpu = 0;
+  n = control == IOBUFCTRL_FLUSH? *len : 0;
+  start = clock ();
+
+  rc = a->filter (a->filter_ov, control, a->chain, buf, len);
+
+  used = clock () - start;
+  if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      n = *len;
+      st->bytes_in += filter_stats.child_bytes;
+      st->bytes_out += n;
+    }
+  else
+    {
+      st->bytes_in += n;
+      st->bytes_out += filter_stats.child_bytes;
+    }
+  st->calls++;
+  if (used > filter_stats.child_cpu)
+    st->cpu += (double)(used - filter_stats.child_cpu) / CLOCKS_PER_SEC;
+  filter_stats.child_bytes = saved_bytes + n;
+  filter_stats.child_cpu = saved_cpu + used;
+
+  if (filter_stats.tick && filter_stats.last_tick != time (NULL))
+    {
+      filter_stats.last_tick = time (NULL);
+      filter_stats.tick ();
+    }
+  return rc;
+}
+
+
+/* Enable or disable the collection of statistics for the filters.
+   If TICK is not NULL it is called about once a second while the
+   filters are busy.  */
+void
+iobuf_enable_stats (int yes, void (*tick) (void))
+{
+  filter_stats.enabled = yes;
+  filter_stats.tick = tick;
+  filter_stats.last_tick = time (NULL);
+}
+
+
+/* Return true if filter statistics are being collected.  */
+int
+iobuf_stats_enabled (void)
+{
+  return filter_stats.enabled;
+}
+
+
+/* Return the statistics of the filter with the index IDX or NULL if
+   there is no such filter.  The statistics are kept separately for
+   each filter function with the name it returns for IOBUFCTRL_DESC.
+   That name is mostly the function's name; the file filters add the
+   kind of file.  */
+const struct iobuf_filter_stats_s *
+iobuf_get_filter_stats (int idx)
+{
+  if (idx < 0 || idx >= filter_stats.nfilters)
+    return NULL;
+  return &filter_stats.filters[idx].s;
+}
+
+
+/* Limit the memory used by the buffers of the iobufs opened and the
+   filters pushed from now on to about LIMIT bytes; 0 removes the
+   limit.  Buffers are then made smaller than usual but not smaller
+   than the standard size, thus a long chain of filters may still
+   exceed the limit somewhat.  The memory used does not depend on the
+   length of the data.  */
+void
+iobuf_set_memory_limit (size_t limit)
+{
+  buffer_mem.limit = limit;
+}
+
+
+/* Count memory a filter allocates for itself, like a decompression
+   buffer, in the same way as the buffers of the iobufs.  NAME is the
+   name under which the memory is shown in the statistics of the
+   filters; it must be a static string.  WANT is the number of bytes
+   the filter would like to use and MINIMUM the number of bytes it
+   needs at least.  Returns the number of bytes the filter may use,
+   at least MINIMUM and at most WANT, which is then counted as used.
+   If the return value is 0 no memory has been counted; with MINIMUM
+   0 this tells that the filter should do without.  */
+size_t
+iobuf_claim_memory (const char *name, size_t want, size_t minimum)
+{
+  size_t size = want;
+
+  if (buffer_mem.limit && buffer_mem.used + size > buffer_mem.limit)
+    {
+      size = (buffer_mem.used < buffer_mem.limit
+              ? buffer_mem.limit - buffer_mem.used : 0);
+      if (size < minimum)
+        size = minimum;
+    }
+  add_memory (filter_stats.enabled? get_named_stats (name) : NULL, size);
+  return size;
+}
+
+
+/* Release the SIZE bytes of memory claimed with iobuf_claim_memory
+   for NAME.  */
+void
+iobuf_release_memory (const char *name, size_t size)
+{
+  sub_memory (filter_stats.enabled? get_named_stats (name) : NULL, size);
+}
+
+
+/* Store the number of bytes currently used by the buffers at R_USED,
+   the largest number of bytes used so far at R_PEAK and the limit
+   set with iobuf_set_memory_limit at R_LIMIT.  */
+void
+iobuf_get_memory_usage (size_t *r_used, size_t *r_peak, size_t *r_limit)
+{
+  *r_used = buffer_mem.used;
+  *r_peak = buffer_mem.peak;
+  *r_limit = buffer_mem.limit;
+}
+
+
 /****************
  * Read a byte from the iobuf; returns -1 on EOF
  */
@@ -2015,6 +2566,63 @@ iobuf_read (iobuf_t a, void *buffer, unsigned int buflen)
 }
 
 
+/* Consume up to MAXLEN bytes from A without copying them.  On success
+   the number of bytes is returned and a pointer to them is stored at
+   R_BUF; the pointer is valid until the next operation on A.  Returns
+   -1 on EOF.  If A is a head iobuf created with iobuf_open_mmap the
+   pointer is into the mapped file.  */
+int
+iobuf_read_direct (iobuf_t a, const byte **r_buf, unsigned int maxlen)
+{
+  size_t n;
+
+  if (maxlen > ((unsigned int)-1 >> 1))
+    maxlen = ((unsigned int)-1 >> 1);
+  if (a->nlimit)
+    {
+      if (a->nbytes >= a->nlimit)
+        return -1;  /* Forced EOF.  */
+      if (maxlen > a->nlimit - a->nbytes)
+        maxlen = a->nlimit - a->nbytes;
+    }
+  if (!maxlen)
+    return 0;
+
+  if (a->d.start == a->d.len)
+    {
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+      if (!a->chain && a->filter == file_filter
+          && ((file_filter_ctx_t *)a->filter_ov)->map)
+        {
+          file_filter_ctx_t *fcx = a->filter_ov;
+
+          n = fcx->maplen - fcx->mapoff;
+          if (n)
+            {
+              if (n > maxlen)
+                n = maxlen;
+              *r_buf = fcx->map + fcx->mapoff;
+              fcx->mapoff += n;
+              a->nbytes += n;
+              return n;
+            }
+          /* Let the file filter see the EOF.  */
+        }
+#endif
+      if (underflow (a) == -1)
+        return -1;
+      a->d.start--;  /* Unget the byte returned by underflow.  */
+    }
+
+  n = a->d.len - a->d.start;
+  if (n > maxlen)
+    n = maxlen;
+  *r_buf = a->d.buf + a->d.start;
+  a->d.start += n;
+  a->nbytes += n;
+  return n;
+}
+
 
 /****************
  * Have a look at the iobuf.
@@ -2356,6 +2964,12 @@ iobuf_seek (iobuf_t a, off_t newpos)
 	  log_error ("can't lseek: %s\n", strerror (errno));
 	  return -1;
 	}
+# ifdef HAVE_MMAP
+      if (b->map && newpos >= 0 && (size_t)newpos <= b->maplen)
+        b->mapoff = newpos;
+      else if (b->map)
+        b->mapoff = b->maplen;
+# endif
 #endif
     }
   if (a->use != 3)
@@ -2515,6 +3129,28 @@ iobuf_read_line (iobuf_t a, byte ** addr_of_buffer,
       nbytes++;
       if (c == '\n')
 	break;
+
+      /* Copy the part of the line which is already buffered at once
+         instead of calling iobuf_get for each byte.  */
+      if (!a->nofast && a->d.start < a->d.len && nbytes < length)
+	{
+	  const byte *s = a->d.buf + a->d.start;
+	  const byte *eol;
+	  size_t n = a->d.len - a->d.start;
+
+	  if (n > length - nbytes)
+	    n = length - nbytes;
+	  eol = memchr (s, '\n', n);
+	  if (eol)
+	    n = eol - s + 1;
+	  memcpy (p, s, n);
+	  p += n;
+	  nbytes += n;
+	  a->d.start += n;
+	  a->nbytes += n;
+	  if (eol)
+	    break;
+	}
     }
   *p = 0;			/* make sure the line is a string */
 
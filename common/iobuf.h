@@ -91,6 +91,13 @@ struct iobuf_struct
   void *opaque;			/* Can be used to hold any information
                                    this value is copied to all
                                    instances */
+  void (*release_buf) (void *arg); /* If set, D.BUF is not owned and this
+                                   is called on close instead of
+                                   freeing it.  */
+  void *release_buf_arg;
+  size_t charged;               /* Bytes of D.BUF counted as in use.  */
+  struct iobuf_filter_stats_s *charged_to; /* And the filter they are
+                                   counted for.  */
 };
 
 #ifndef EXTERN_UNLESS_MAIN_MODULE
@@ -102,14 +109,42 @@ struct iobuf_struct
 #endif
 EXTERN_UNLESS_MAIN_MODULE int iobuf_debug_mode;
 
+/* The statistics of a filter; see iobuf_enable_stats.  */
+struct iobuf_filter_stats_s
+{
+  const char *name;
+  unsigned long calls;
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+  double cpu;                   /* CPU seconds used by the filter.  */
+  size_t mem;                   /* Bytes of buffers in use.  */
+  size_t mem_peak;              /* The largest value of MEM.  */
+};
+
+void iobuf_enable_stats (int yes, void (*tick) (void));
+int  iobuf_stats_enabled (void);
+const struct iobuf_filter_stats_s *iobuf_get_filter_stats (int idx);
+
+void   iobuf_set_memory_limit (size_t limit);
+size_t iobuf_claim_memory (const char *name, size_t want, size_t minimum);
+void   iobuf_release_memory (const char *name, size_t size);
+void   iobuf_get_memory_usage (size_t *r_used, size_t *r_peak,
+                               size_t *r_limit);
+
 void iobuf_enable_special_filenames (int yes);
+void iobuf_enable_mmap (int yes);
+void iobuf_set_default_buffer_size (size_t size);
 int  iobuf_is_pipe_filename (const char *fname);
 iobuf_t iobuf_alloc (int use, size_t bufsize);
 iobuf_t iobuf_temp (void);
 iobuf_t iobuf_temp_with_content (const char *buffer, size_t length);
+iobuf_t iobuf_temp_with_buffer (const void *buffer, size_t length,
+                                void (*release) (void *arg),
+                                void *release_arg);
 iobuf_t iobuf_open_fd_or_name (gnupg_fd_t fd, const char *fname,
                                const char *mode);
 iobuf_t iobuf_open (const char *fname);
+iobuf_t iobuf_open_mmap (const char *fname);
 iobuf_t iobuf_fdopen (int fd, const char *mode);
 iobuf_t iobuf_fdopen_nc (int fd, const char *mode);
 iobuf_t iobuf_esopen (estream_t estream, const char *mode, int keep_open);
@@ -118,6 +153,8 @@ iobuf_t iobuf_create (const char *fname, int mode700);
 iobuf_t iobuf_append (const char *fname);
 iobuf_t iobuf_openrw (const char *fname);
 int iobuf_ioctl (iobuf_t a, iobuf_ioctl_t cmd, int intval, void *ptrval);
+size_t iobuf_get_buffer_size (iobuf_t a);
+void iobuf_set_buffer_size (iobuf_t a, size_t size);
 int iobuf_close (iobuf_t iobuf);
 int iobuf_cancel (iobuf_t iobuf);
 
@@ -140,6 +177,7 @@ int iobuf_seek (iobuf_t a, off_t newpos);
 
 int iobuf_readbyte (iobuf_t a);
 int iobuf_read (iobuf_t a, void *buf, unsigned buflen);
+int iobuf_read_direct (iobuf_t a, const byte **r_buf, unsigned int maxlen);
 void iobuf_unread (iobuf_t a, const unsigned char *buf, unsigned int buflen);
 unsigned iobuf_read_line (iobuf_t a, byte ** addr_of_buffer,
 			  unsigned *length_of_buffer, unsigned *max_length);
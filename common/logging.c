@@ -55,6 +55,18 @@
 #include <fcntl.h>
 #include <assert.h>
 
+#ifdef WITHOUT_NPTH /* Give the Makefile a chance to build without Pth.  */
+# undef HAVE_NPTH
+# undef USE_NPTH
+#endif
+#ifdef USE_NPTH
+# include <npth.h>
+#endif
+#if defined(USE_NPTH) && !defined(HAVE_W32_SYSTEM)
+# define USE_ASYNC_LOG 1
+# include <pthread.h>
+#endif
+
 
 #define GNUPG_COMMON_NEED_AFLOCAL 1
 #include "util.h"
@@ -196,7 +208,7 @@ parse_portno (const char *str, unsigned short *r_port)
 
 
 static ssize_t
-fun_writer (void *cookie_arg, const void *buffer, size_t size)
+write_log_data (void *cookie_arg, const void *buffer, size_t size)
 {
   struct fun_cookie_s *cookie = cookie_arg;
 
@@ -419,6 +431,261 @@ fun_writer (void *cookie_arg, const void *buffer, size_t size)
 }
 
 
+#ifdef USE_ASYNC_LOG
+/* With asynchronous logging the log stream only copies the formatted
+   lines into a ring buffer and a writer thread does the actual I/O
+   without holding the npth lock.  Not all logging is done with the
+   npth lock held: some workers log while they run unprotected.  Thus
+   the ring is guarded by a plain pthread mutex, which can be taken
+   with or without the npth lock because no npth function is called
+   while holding it.  Lines not fitting into the ring are dropped and
+   counted.  */
+
+#define ASYNC_RING_SIZE 65536
+
+static struct
+{
+  int enabled;
+  pthread_mutex_t lock; /* Guards the other fields but ENABLED.  */
+  char *ring;
+  size_t head;          /* Start of the queued data.  */
+  size_t used;          /* Number of queued bytes.  */
+  unsigned int dropped; /* Number of lines dropped since the last write. */
+  struct fun_cookie_s *cookie;  /* The cookie the data belongs to.  */
+  int wakeup[2];        /* Pipe to wake up the writer.  */
+  int writer_active;    /* The writer will look at the ring again.  */
+  int busy;             /* The writer is writing without the lock.  */
+} async = { 0, PTHREAD_MUTEX_INITIALIZER };
+
+
+/* Take up to SIZE bytes from the ring and store them at BUFFER.
+   Returns the number of bytes and the number of dropped lines at
+   R_DROPPED.  Called with the lock.  */
+static size_t
+async_take (char *buffer, size_t size, unsigned int *r_dropped)
+{
+  size_t n, n1;
+
+  *r_dropped = async.dropped;
+  async.dropped = 0;
+
+  n = async.used < size? async.used : size;
+  n1 = ASYNC_RING_SIZE - async.head;
+  if (n1 > n)
+    n1 = n;
+  memcpy (buffer, async.ring + async.head, n1);
+  memcpy (buffer + n1, async.ring, n - n1);
+  async.head = (async.head + n) % ASYNC_RING_SIZE;
+  async.used -= n;
+  return n;
+}
+
+
+/* Queue SIZE bytes of BUFFER for the writer thread.  */
+static ssize_t
+async_put (struct fun_cookie_s *cookie,  const void *buffer, size_t size)
+{
+  size_t tail, n1;
+
+  pthread_mutex_lock (&async.lock);
+  if (async.cookie != cookie)
+    {
+      if (async.used || async.busy)
+        {
+          pthread_mutex_unlock (&async.lock);
+          return write_log_data (cookie, buffer, size);
+        }
+      async.cookie = cookie;
+    }
+
+  if (size > ASYNC_RING_SIZE - async.used)
+    async.dropped++;
+  else
+    {
+      tail = (async.head + async.used) % ASYNC_RING_SIZE;
+      n1 = ASYNC_RING_SIZE - tail;
+      if (n1 > size)
+        n1 = size;
+      memcpy (async.ring + tail, buffer, n1);
+      memcpy (async.ring, (const char*)buffer + n1, size - n1);
+      async.used += size;
+    }
+
+  if (!async.writer_active)
+    {
+      /* If the pipe is full the writer is about to wake up anyway.  */
+      async.writer_active = 1;
+      (void)write (async.wakeup[1], "", 1);
+    }
+  pthread_mutex_unlock (&async.lock);
+  return (ssize_t)size;
+}
+
+
+/* Write a note about DROPPED lines to COOKIE.  */
+static void
+async_write_dropped (struct fun_cookie_s *cookie, unsigned int dropped)
+{
+  char line[60];
+
+  snprintf (line, sizeof line, "[%u log lines dropped]\n", dropped);
+  write_log_data (cookie, line, strlen (line));
+}
+
+
+static void *
+async_writer_thread (void *arg)
+{
+  char buffer[4096];
+  struct fun_cookie_s *cookie;
+  unsigned int dropped;
+  size_t n;
+
+  (void)arg;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&async.lock);
+      n = async_take (buffer, sizeof buffer, &dropped);
+      if (!n && !dropped)
+        {
+          async.writer_active = 0;
+          pthread_mutex_unlock (&async.lock);
+          npth_read (async.wakeup[0], buffer, sizeof buffer);
+          continue;
+        }
+      cookie = async.cookie;
+      async.busy = 1;
+      pthread_mutex_unlock (&async.lock);
+
+      npth_unprotect ();
+      if (dropped)
+        async_write_dropped (cookie, dropped);
+      if (n)
+        write_log_data (cookie, buffer, n);
+      npth_protect ();
+
+      pthread_mutex_lock (&async.lock);
+      async.busy = 0;
+      pthread_mutex_unlock (&async.lock);
+    }
+
+  /*NOTREACHED*/
+  return NULL;
+}
+
+
+/* Write all queued log data synchronously.  */
+static void
+async_flush (void)
+{
+  char buffer[4096];
+  unsigned int dropped;
+  size_t n;
+
+  if (!async.ring)
+    return;
+
+  pthread_mutex_lock (&async.lock);
+  while (async.busy)
+    {
+      pthread_mutex_unlock (&async.lock);
+      npth_usleep (1000);
+      pthread_mutex_lock (&async.lock);
+    }
+  while ((n = async_take (buffer, sizeof buffer, &dropped)) || dropped)
+    {
+      if (dropped)
+        async_write_dropped (async.cookie, dropped);
+      if (n)
+        write_log_data (async.cookie, buffer, n);
+    }
+  async.cookie = NULL;
+  pthread_mutex_unlock (&async.lock);
+}
+
+
+static void
+async_atexit (void)
+{
+  async.enabled = 0;
+  async_flush ();
+}
+#endif /*USE_ASYNC_LOG*/
+
+
+static ssize_t
+fun_writer (void *cookie_arg, const void *buffer, size_t size)
+{
+#ifdef USE_ASYNC_LOG
+  if (async.enabled)
+    return async_put (cookie_arg, buffer, size);
+#endif
+  return write_log_data (cookie_arg, buffer, size);
+}
+
+
+/* Switch to asynchronous logging if ENABLE is true.  This is only
+   possible in programs using npth, not on Windows, and must be called
+   after npth_init.
+   Fatal messages and the messages printed before exit are still
+   written before the process terminates.  Returns 0 on success.  */
+int
+log_set_async (int enable)
+{
+#ifdef USE_ASYNC_LOG
+  npth_attr_t tattr;
+  npth_t thread;
+  int rc;
+
+  if (!enable)
+    {
+      async.enabled = 0;
+      async_flush ();
+      return 0;
+    }
+
+  if (!async.ring)
+    {
+      async.ring = xtrymalloc (ASYNC_RING_SIZE);
+      if (!async.ring)
+        return -1;
+      if (pipe (async.wakeup))
+        {
+          xfree (async.ring);
+          async.ring = NULL;
+          return -1;
+        }
+      fcntl (async.wakeup[1], F_SETFL,
+             fcntl (async.wakeup[1], F_GETFL) | O_NONBLOCK);
+
+      npth_attr_init (&tattr);
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      rc = npth_create (&thread, &tattr, async_writer_thread, NULL);
+      npth_attr_destroy (&tattr);
+      if (rc)
+        {
+          close (async.wakeup[0]);
+          close (async.wakeup[1]);
+          xfree (async.ring);
+          async.ring = NULL;
+          gpg_err_set_errno (rc);
+          return -1;
+        }
+      /* The writer thread does not run before we yield.  */
+      async.writer_active = 1;
+      atexit (async_atexit);
+    }
+  async.enabled = 1;
+  return 0;
+#else /*!USE_ASYNC_LOG*/
+  (void)enable;
+  gpg_err_set_errno (ENOSYS);
+  return -1;
+#endif /*!USE_ASYNC_LOG*/
+}
+
+
 static int
 fun_closer (void *cookie_arg)
 {
@@ -445,6 +712,9 @@ set_file_fd (const char *name, int fd)
   struct fun_cookie_s *cookie;
 
   /* Close an open log stream.  */
+#ifdef USE_ASYNC_LOG
+  async_flush ();
+#endif
   if (logstream)
     {
       es_fclose (logstream);
@@ -727,6 +997,10 @@ do_logv (int level, int ignore_arg_ptr, const char *fmt, va_list arg_ptr)
       if (missing_lf)
         es_putc_unlocked ('\n', logstream);
       es_funlockfile (logstream);
+#ifdef USE_ASYNC_LOG
+      async.enabled = 0;
+      async_flush ();
+#endif
       exit (2);
     }
   else if (level == GPGRT_LOG_BUG)
@@ -734,6 +1008,10 @@ do_logv (int level, int ignore_arg_ptr, const char *fmt, va_list arg_ptr)
       if (missing_lf)
         es_putc_unlocked ('\n', logstream );
       es_funlockfile (logstream);
+#ifdef USE_ASYNC_LOG
+      async.enabled = 0;
+      async_flush ();
+#endif
       abort ();
     }
   else
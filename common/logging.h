@@ -47,6 +47,7 @@ const char *log_get_prefix (unsigned int *flags);
 int log_test_fd (int fd);
 int  log_get_fd(void);
 estream_t log_get_stream (void);
+int log_set_async (int enable);
 
 #ifdef GPGRT_GCC_M_FUNCTION
   void bug_at( const char *file, int line, const char *func ) GPGRT_GCC_A_NR;
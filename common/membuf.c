@@ -42,14 +42,92 @@
    create a buffer, put_membuf to append bytes and get_membuf to
    release and return the buffer.  Allocation errors are detected but
    only returned at the final get_membuf(), this helps not to clutter
-   the code with out of core checks.  */
+   the code with out of core checks.  Buffers which are only used
+   for the duration of a request should be given back with
+   release_membuf(); their backing store is then kept in a small pool
+   and reused by the next init_membuf().  */
+
+
+/* The largest number of buffers kept in the pool.  */
+#define MEMBUF_POOL_SIZE 8
+
+/* Larger buffers are not kept in the pool but freed.  */
+#define MEMBUF_POOL_MAXSIZE (256*1024)
+
+/* The pool of backing stores for init_membuf.  A membuf may be used
+   by a thread running without the npth lock, thus the pool is guarded
+   by a spin lock of its own.  The lock is only tried: a thread which
+   finds it taken allocates or frees the buffer directly instead of
+   waiting.  Without the atomic builtins of gcc the pool is not
+   used.  */
+static struct
+{
+  char *buf;
+  size_t size;
+} membuf_pool[MEMBUF_POOL_SIZE];
+static int membuf_pool_count;
+#ifdef __GNUC__
+static volatile int membuf_pool_busy;
+#endif
+
+
+/* Try to take the lock of the pool.  Returns true on success.  */
+static int
+lock_pool (void)
+{
+#ifdef __GNUC__
+  return !__sync_lock_test_and_set (&membuf_pool_busy, 1);
+#else
+  return 0;
+#endif
+}
+
+
+static void
+unlock_pool (void)
+{
+#ifdef __GNUC__
+  __sync_lock_release (&membuf_pool_busy);
+#endif
+}
+
+
+/* Take a buffer of at least SIZE bytes from the pool and store its
+   actual size at R_SIZE.  Returns NULL if no such buffer is
+   available.  */
+static char *
+take_pooled_buffer (size_t size, size_t *r_size)
+{
+  char *p = NULL;
+  int i;
+
+  if (!lock_pool ())
+    return NULL;
+  for (i=membuf_pool_count-1; i >= 0; i--)
+    if (membuf_pool[i].size >= size)
+      {
+        p = membuf_pool[i].buf;
+        *r_size = membuf_pool[i].size;
+        membuf_pool_count--;
+        membuf_pool[i] = membuf_pool[membuf_pool_count];
+        membuf_pool[membuf_pool_count].buf = NULL;
+        break;
+      }
+  unlock_pool ();
+  return p;
+}
+
 
 void
 init_membuf (membuf_t *mb, int initiallen)
 {
   mb->len = 0;
-  mb->size = initiallen;
   mb->out_of_core = 0;
+  mb->secure = 0;
+  mb->buf = take_pooled_buffer (initiallen, &mb->size);
+  if (mb->buf)
+    return;
+  mb->size = initiallen;
   mb->buf = xtrymalloc (initiallen);
   if (!mb->buf)
     mb->out_of_core = errno;
@@ -62,6 +140,7 @@ init_membuf_secure (membuf_t *mb, int initiallen)
   mb->len = 0;
   mb->size = initiallen;
   mb->out_of_core = 0;
+  mb->secure = 1;
   mb->buf = xtrymalloc_secure (initiallen);
   if (!mb->buf)
     mb->out_of_core = errno;
@@ -88,30 +167,73 @@ clear_membuf (membuf_t *mb, size_t amount)
 }
 
 
-void
-put_membuf (membuf_t *mb, const void *buf, size_t len)
+/* Make sure that at least NEEDED more bytes fit into MB without a
+   reallocation.  The buffer is grown geometrically so that appending
+   N bytes in small pieces takes only O(log N) reallocations.  Returns
+   false if we are out of core.  */
+static int
+grow_membuf (membuf_t *mb, size_t needed)
 {
-  if (mb->out_of_core || !len)
-    return;
+  size_t newsize;
+  char *p;
 
-  if (mb->len + len >= mb->size)
-    {
-      char *p;
+  if (mb->len + needed < mb->size)
+    return 1;
 
-      mb->size += len + 1024;
-      p = xtryrealloc (mb->buf, mb->size);
-      if (!p)
+  newsize = mb->size < 1024? 1024 : mb->size;
+  while (newsize <= mb->len + needed)
+    {
+      if (newsize > ((size_t)-1) / 2)
         {
-          mb->out_of_core = errno ? errno : ENOMEM;
-          /* Wipe out what we already accumulated.  This is required
-             in case we are storing sensitive data here.  The membuf
-             API does not provide another way to cleanup after an
-             error. */
-          wipememory (mb->buf, mb->len);
-          return;
+          newsize = mb->len + needed + 1;
+          break;
         }
-      mb->buf = p;
+      newsize *= 2;
+    }
+  if (newsize <= mb->len + needed)
+    {
+      mb->out_of_core = ENOMEM; /* Size overflow.  */
+      wipememory (mb->buf, mb->len);
+      return 0;
+    }
+
+  p = xtryrealloc (mb->buf, newsize);
+  if (!p)
+    {
+      mb->out_of_core = errno ? errno : ENOMEM;
+      /* Wipe out what we already accumulated.  This is required in
+         case we are storing sensitive data here.  The membuf API
+         does not provide another way to cleanup after an error. */
+      wipememory (mb->buf, mb->len);
+      return 0;
     }
+  mb->buf = p;
+  mb->size = newsize;
+  return 1;
+}
+
+
+/* Make room for at least AMOUNT more bytes in MB.  This may be used
+   by callers which know the length of the data in advance, for
+   example from a length header, to avoid the reallocations while
+   the data is put into the buffer.  */
+void
+membuf_reserve (membuf_t *mb, size_t amount)
+{
+  if (mb->out_of_core || !amount)
+    return;
+  grow_membuf (mb, amount);
+}
+
+
+void
+put_membuf (membuf_t *mb, const void *buf, size_t len)
+{
+  if (mb->out_of_core || !len)
+    return;
+
+  if (!grow_membuf (mb, len))
+    return;
   memcpy (mb->buf + mb->len, buf, len);
   mb->len += len;
 }
@@ -195,6 +317,58 @@ get_membuf_shrink (membuf_t *mb, size_t *len)
 }
 
 
+/* Release the membuf MB and its content.  This is the same as
+   xfree (get_membuf (mb, NULL)) but the content is always wiped out
+   and the backing store is kept for reuse by init_membuf.  Buffers
+   in secure memory are not pooled.  */
+void
+release_membuf (membuf_t *mb)
+{
+  char *p;
+  char *victim = NULL;
+  size_t size;
+  int i;
+
+  p = mb->buf;
+  size = mb->size;
+  mb->buf = NULL;
+  mb->out_of_core = ENOMEM; /* Make sure it won't get reused. */
+  if (!p)
+    return;
+
+  wipememory (p, mb->len);
+  if (mb->secure || size > MEMBUF_POOL_MAXSIZE || !lock_pool ())
+    {
+      xfree (p);
+      return;
+    }
+
+  if (membuf_pool_count == MEMBUF_POOL_SIZE)
+    {
+      /* Replace the smallest pooled buffer if this one is larger.  */
+      for (i=0; i < MEMBUF_POOL_SIZE; i++)
+        if (membuf_pool[i].size < size)
+          break;
+      if (i < MEMBUF_POOL_SIZE)
+        {
+          victim = membuf_pool[i].buf;
+          membuf_pool[i].buf = p;
+          membuf_pool[i].size = size;
+        }
+      else
+        victim = p;
+    }
+  else
+    {
+      membuf_pool[membuf_pool_count].buf = p;
+      membuf_pool[membuf_pool_count].size = size;
+      membuf_pool_count++;
+    }
+  unlock_pool ();
+  xfree (victim);
+}
+
+
 /* Peek at the membuf MB.  On success a pointer to the buffer is
    returned which is valid until the next operation on MB.  If LEN is
    not NULL the current LEN of the buffer is stored there.  On error
@@ -40,6 +40,7 @@ struct private_membuf_s
   size_t size;
   char *buf;
   int out_of_core;
+  int secure;
 };
 
 typedef struct private_membuf_s membuf_t;
@@ -47,11 +48,12 @@ typedef struct private_membuf_s membuf_t;
 /* Return the current length of the membuf.  */
 #define get_membuf_len(a)  ((a)->len)
 #define is_membuf_ready(a) ((a)->buf || (a)->out_of_core)
-#define MEMBUF_ZERO        { 0, 0, NULL, 0}
+#define MEMBUF_ZERO        { 0, 0, NULL, 0, 0}
 
 void init_membuf (membuf_t *mb, int initiallen);
 void init_membuf_secure (membuf_t *mb, int initiallen);
 void clear_membuf (membuf_t *mb, size_t amount);
+void membuf_reserve (membuf_t *mb, size_t amount);
 void put_membuf  (membuf_t *mb, const void *buf, size_t len);
 void put_membuf_str (membuf_t *mb, const char *string);
 void put_membuf_printf (membuf_t *mb, const char *format,
@@ -59,5 +61,6 @@ void put_membuf_printf (membuf_t *mb, const char *format,
 void *get_membuf (membuf_t *mb, size_t *len);
 void *get_membuf_shrink (membuf_t *mb, size_t *len);
 const void *peek_membuf (membuf_t *mb, size_t *len);
+void release_membuf (membuf_t *mb);
 
 #endif /*GNUPG_COMMON_MEMBUF_H*/
@@ -262,6 +262,40 @@ cmp_simple_canon_sexp (const unsigned char *a_orig,
 }
 
 
+/* Return true if the S-expressions A and B have the same canonical
+   encoding.  Two NULL S-expressions are the same; false is also
+   returned if we run out of core.  */
+int
+same_sexp (gcry_sexp_t a, gcry_sexp_t b)
+{
+  size_t alen, blen;
+  char *abuf, *bbuf;
+  int same;
+
+  if (!a || !b)
+    return !a && !b;
+
+  /* Note that the size returned for a NULL buffer includes space for
+     a terminating nul which is not counted for the actual output.  */
+  alen = gcry_sexp_sprint (a, GCRYSEXP_FMT_CANON, NULL, 0);
+  blen = gcry_sexp_sprint (b, GCRYSEXP_FMT_CANON, NULL, 0);
+  if (alen != blen)
+    return 0;
+  abuf = xtrymalloc (alen);
+  bbuf = xtrymalloc (blen);
+  same = 0;
+  if (abuf && bbuf)
+    {
+      alen = gcry_sexp_sprint (a, GCRYSEXP_FMT_CANON, abuf, alen);
+      blen = gcry_sexp_sprint (b, GCRYSEXP_FMT_CANON, bbuf, blen);
+      same = (alen && alen == blen && !memcmp (abuf, bbuf, alen));
+    }
+  xfree (abuf);
+  xfree (bbuf);
+  return same;
+}
+
+
 /* Create a simple S-expression from the hex string at LINE.  Returns
    a newly allocated buffer with that canonical encoded S-expression
    or NULL in case of an error.  On return the number of characters
@@ -38,6 +38,7 @@
 #include <netinet/in.h>
 #include <arpa/nameser.h>
 #include <resolv.h>
+#include <netdb.h>
 #endif
 #include <unistd.h>
 #include <stdlib.h>
@@ -50,6 +51,7 @@
 #include "util.h"
 #include "host2net.h"
 #include "srv.h"
+#include "dns-cache.h"
 
 /* Not every installation has gotten around to supporting SRVs
    yet... */
@@ -146,7 +148,14 @@ getsrv (const char *name,struct srventry **list)
     int r;
     u16 dlen;
 
-    r = res_query (name, C_IN, T_SRV, answer, sizeof answer);
+    r = dns_cache_lookup (name, T_SRV, answer, sizeof answer);
+    if (r < 0)
+      {
+        r = res_query (name, C_IN, T_SRV, answer, sizeof answer);
+        dns_cache_store_answer (name, T_SRV, answer, r, h_errno);
+      }
+    else if (!r)
+      return -1;  /* Cached failure.  */
     if (r < sizeof (HEADER) || r > sizeof answer)
       return -1;
     if (header->rcode != NOERROR || !(count=ntohs (header->ancount)))
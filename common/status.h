@@ -79,6 +79,11 @@ enum
     STATUS_GOT_IT,
 
     STATUS_PROGRESS,
+    STATUS_VANITY_STATS,
+    STATUS_VANITY_RESULT,
+    STATUS_VANITY_SEEDS,
+    STATUS_VANITY_COST,
+    STATUS_STATS,
     STATUS_SIG_CREATED,
     STATUS_SESSION_KEY,
     STATUS_NOTATION_NAME,
@@ -0,0 +1,268 @@
+/* t-dns-cache.c - Module test for dns-cache.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_W32_SYSTEM
+# ifdef HAVE_WINSOCK2_H
+#  include <winsock2.h>
+# endif
+# include <windows.h>
+#else
+# include <netdb.h>
+#endif
+
+#include "util.h"
+#include "dns-cache.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     errcount++;                                 \
+                   } while(0)
+
+/* Record types used by the tests.  */
+#define T_A    1
+#define T_SRV 33
+
+static int errcount;
+
+
+/* Stored data is returned for the same type and name, the latter
+   compared case-insensitively.  */
+static void
+test_store (void)
+{
+  char buffer[64];
+  int n;
+
+  dns_cache_flush ();
+  if (dns_cache_lookup ("keys.example.org", T_A, buffer, sizeof buffer) != -1)
+    fail (1);
+
+  dns_cache_store ("keys.example.org", T_A, "\x0a\x00\x00\x01", 4, 300);
+  n = dns_cache_lookup ("Keys.Example.ORG", T_A, buffer, sizeof buffer);
+  if (n != 4 || memcmp (buffer, "\x0a\x00\x00\x01", 4))
+    fail (2);
+  if (dns_cache_lookup ("keys.example.org", T_SRV, buffer,
+                        sizeof buffer) != -1)
+    fail (3);
+  if (dns_cache_lookup ("keys.example.net", T_A, buffer, sizeof buffer) != -1)
+    fail (4);
+
+  /* An entry which does not fit into the buffer is not used.  */
+  if (dns_cache_lookup ("keys.example.org", T_A, buffer, 3) != -1)
+    fail (5);
+
+  /* Storing again replaces the entry.  */
+  dns_cache_store ("keys.example.org", T_A, "\x0a\x00\x00\x02", 4, 300);
+  n = dns_cache_lookup ("keys.example.org", T_A, buffer, sizeof buffer);
+  if (n != 4 || memcmp (buffer, "\x0a\x00\x00\x02", 4))
+    fail (6);
+
+  /* A TTL of 0 is not cached.  */
+  dns_cache_store ("nottl.example.org", T_A, "\x0a\x00\x00\x03", 4, 0);
+  if (dns_cache_lookup ("nottl.example.org", T_A, buffer,
+                        sizeof buffer) != -1)
+    fail (7);
+
+  /* Negative entries.  */
+  dns_cache_store ("missing.example.org", T_SRV, NULL, 0, 0);
+  if (dns_cache_lookup ("missing.example.org", T_SRV, buffer, 0))
+    fail (8);
+
+  dns_cache_flush ();
+  if (dns_cache_lookup ("keys.example.org", T_A, buffer, sizeof buffer) != -1)
+    fail (9);
+  if (dns_cache_lookup ("missing.example.org", T_SRV, buffer, 0) != -1)
+    fail (10);
+}
+
+
+/* A full cache evicts an entry but keeps working.  */
+static void
+test_evict (void)
+{
+  char name[64], buffer[16];
+  int i, n, nfound;
+
+  dns_cache_flush ();
+  for (i=0; i < 1000; i++)
+    {
+      snprintf (name, sizeof name, "h%d.example.org", i);
+      dns_cache_store (name, T_A, &i, sizeof i, 100 + i);
+      n = dns_cache_lookup (name, T_A, buffer, sizeof buffer);
+      if (n != sizeof i || memcmp (buffer, &i, sizeof i))
+        fail (1);
+    }
+  for (nfound=i=0; i < 1000; i++)
+    {
+      snprintf (name, sizeof name, "h%d.example.org", i);
+      n = dns_cache_lookup (name, T_A, buffer, sizeof buffer);
+      if (n == sizeof i)
+        {
+          if (memcmp (buffer, &i, sizeof i))
+            fail (2);
+          nfound++;
+        }
+      else if (n != -1)
+        fail (3);
+    }
+  /* The entries which expire last are kept.  */
+  if (!nfound || nfound > 1000 / 2)
+    fail (4);
+  snprintf (name, sizeof name, "h%d.example.org", 999);
+  if (dns_cache_lookup (name, T_A, buffer, sizeof buffer) != sizeof i)
+    fail (5);
+  dns_cache_flush ();
+}
+
+
+/* Build a reply for foo.example.com with two A records of the TTLs
+   TTL1 and TTL2.  Returns the length of the message.  */
+static int
+make_answer (unsigned char *msg, unsigned int ttl1, unsigned int ttl2)
+{
+  static const unsigned char header[] =
+    { 0x12, 0x34, 0x81, 0x80, 0, 1, 0, 2, 0, 0, 0, 0 };
+  static const unsigned char question[] =
+    "\x03" "foo" "\x07" "example" "\x03" "com" "\x00" "\x00\x01\x00\x01";
+  unsigned int ttls[2];
+  unsigned char *p;
+  int i;
+
+  ttls[0] = ttl1;
+  ttls[1] = ttl2;
+  p = msg;
+  memcpy (p, header, sizeof header);
+  p += sizeof header;
+  memcpy (p, question, sizeof question - 1);
+  p += sizeof question - 1;
+  for (i=0; i < 2; i++)
+    {
+      /* A compressed name pointing to the question.  */
+      *p++ = 0xc0;
+      *p++ = 12;
+      *p++ = 0; *p++ = T_A;
+      *p++ = 0; *p++ = 1;
+      *p++ = ttls[i] >> 24;
+      *p++ = ttls[i] >> 16;
+      *p++ = ttls[i] >> 8;
+      *p++ = ttls[i];
+      *p++ = 0; *p++ = 4;
+      *p++ = 192; *p++ = 0; *p++ = 2; *p++ = 1 + i;
+    }
+  return p - msg;
+}
+
+
+/* Replies of res_query are cached according to their records.  */
+static void
+test_answer (void)
+{
+  unsigned char msg[512], buffer[512];
+  int len, n;
+
+  dns_cache_flush ();
+
+  len = make_answer (msg, 300, 120);
+  dns_cache_store_answer ("foo.example.com", T_A, msg, len, 0);
+  n = dns_cache_lookup ("foo.example.com", T_A, buffer, sizeof buffer);
+  if (n != len || memcmp (buffer, msg, len))
+    fail (1);
+
+  /* A record with a TTL of 0 is not cached.  */
+  len = make_answer (msg, 300, 0);
+  dns_cache_store_answer ("bar.example.com", T_A, msg, len, 0);
+  if (dns_cache_lookup ("bar.example.com", T_A, buffer, sizeof buffer) != -1)
+    fail (2);
+
+  /* Neither is a truncated message.  */
+  len = make_answer (msg, 300, 120);
+  dns_cache_store_answer ("baz.example.com", T_A, msg, len - 3, 0);
+  if (dns_cache_lookup ("baz.example.com", T_A, buffer, sizeof buffer) != -1)
+    fail (3);
+  dns_cache_store_answer ("baz.example.com", T_A, msg, 5, 0);
+  if (dns_cache_lookup ("baz.example.com", T_A, buffer, sizeof buffer) != -1)
+    fail (4);
+
+  /* Authoritative failures are cached, temporary ones are not.  */
+  dns_cache_store_answer ("none.example.com", T_SRV, NULL, -1,
+                          HOST_NOT_FOUND);
+  if (dns_cache_lookup ("none.example.com", T_SRV, buffer, sizeof buffer))
+    fail (5);
+  dns_cache_store_answer ("nodata.example.com", T_SRV, NULL, -1, NO_DATA);
+  if (dns_cache_lookup ("nodata.example.com", T_SRV, buffer, sizeof buffer))
+    fail (6);
+  dns_cache_store_answer ("again.example.com", T_SRV, NULL, -1, TRY_AGAIN);
+  if (dns_cache_lookup ("again.example.com", T_SRV, buffer,
+                        sizeof buffer) != -1)
+    fail (7);
+
+  dns_cache_flush ();
+}
+
+
+/* Entries are dropped when their TTL has passed.  */
+static void
+test_expire (void)
+{
+  char buffer[16];
+
+  dns_cache_flush ();
+  dns_cache_store ("short.example.org", T_A, "\x0a\x00\x00\x01", 4, 1);
+  dns_cache_store ("long.example.org", T_A, "\x0a\x00\x00\x02", 4, 60);
+  if (dns_cache_lookup ("short.example.org", T_A, buffer, sizeof buffer) != 4)
+    fail (1);
+  sleep (2);
+  if (dns_cache_lookup ("short.example.org", T_A, buffer,
+                        sizeof buffer) != -1)
+    fail (2);
+  if (dns_cache_lookup ("long.example.org", T_A, buffer, sizeof buffer) != 4)
+    fail (3);
+  dns_cache_flush ();
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_store ();
+  test_evict ();
+  test_answer ();
+  test_expire ();
+
+  return !!errcount;
+}
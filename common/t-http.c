@@ -41,6 +41,15 @@
 #include "logging.h"
 #include "http.h"
 
+#if defined(HAVE_ZIP) && !defined(HAVE_W32_SYSTEM)
+# define WITH_SELFTEST 1
+# include <errno.h>
+# include <signal.h>
+# include <sys/socket.h>
+# include <sys/wait.h>
+# include <netinet/in.h>
+# include <zlib.h>
+#endif
 
 #if HTTP_USE_NTBTLS
 # include <ntbtls.h>
@@ -117,6 +126,270 @@ my_gnutls_log (int level, const char *text)
 }
 #endif
 
+#ifdef WITH_SELFTEST
+/* A self test of the content decoding against a server on the
+   loopback interface.  The server runs in a child process.  */
+
+#define BODYLEN 100000
+
+static unsigned char *test_body;
+
+/* Return a newly allocated copy of the test body encoded according
+   to KIND, which is "gzip", "deflate", "raw" or "identity".  */
+static unsigned char *
+encode_body (const char *kind, size_t *r_len)
+{
+  z_stream zs;
+  unsigned char *buf;
+  int wbits;
+
+  if (!strcmp (kind, "identity"))
+    {
+      buf = xmalloc (BODYLEN);
+      memcpy (buf, test_body, BODYLEN);
+      *r_len = BODYLEN;
+      return buf;
+    }
+
+  wbits = !strcmp (kind, "gzip")? 15 + 16 : !strcmp (kind, "raw")? -15 : 15;
+  memset (&zs, 0, sizeof zs);
+  if (deflateInit2 (&zs, 6, Z_DEFLATED, wbits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    log_fatal ("deflateInit2 failed\n");
+  *r_len = deflateBound (&zs, BODYLEN);
+  buf = xmalloc (*r_len);
+  zs.next_in = test_body;
+  zs.avail_in = BODYLEN;
+  zs.next_out = buf;
+  zs.avail_out = *r_len;
+  if (deflate (&zs, Z_FINISH) != Z_STREAM_END)
+    log_fatal ("deflate failed\n");
+  *r_len = zs.total_out;
+  deflateEnd (&zs);
+  return buf;
+}
+
+
+/* Serve the requests on the connection FD.  The path of a request
+   selects the encoding of the body; "/truncated" sends only half of a
+   gzip body and "/garbage" sends data which is not gzip at all.  The
+   connection number CONNNO is returned in an X-Conn header.  */
+static void
+serve_connection (int fd, int connno)
+{
+  char req[2048], path[64], hdr[256];
+  unsigned char *body;
+  const char *encoding, *cename;
+  size_t reqlen, len, sendlen;
+  int compress;
+
+  for (;;)
+    {
+      for (reqlen = 0; reqlen < sizeof req - 1; reqlen++)
+        {
+          if (read (fd, req + reqlen, 1) != 1)
+            return;
+          if (reqlen >= 3 && !memcmp (req + reqlen - 3, "\r\n\r\n", 4))
+            break;
+        }
+      req[++reqlen] = 0;
+      if (sscanf (req, "GET %63s ", path) != 1)
+        return;
+      compress = !!strstr (req, "Accept-Encoding: gzip, deflate\r\n");
+
+      encoding = compress? path + 1 : "identity";
+      if (!strcmp (path, "/truncated") || !strcmp (path, "/garbage"))
+        encoding = "gzip";
+      if (!strcmp (path, "/garbage"))
+        {
+          body = (unsigned char *)xstrdup ("This is not gzip data.\n");
+          len = strlen ((char *)body);
+        }
+      else
+        body = encode_body (encoding, &len);
+      sendlen = !strcmp (path, "/truncated")? len / 2 : len;
+
+      /* Raw deflate data is sent as "deflate" like some servers do.  */
+      cename = !strcmp (encoding, "raw")? "deflate" : encoding;
+      if (!strcmp (cename, "identity"))
+        snprintf (hdr, sizeof hdr,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Length: %u\r\n"
+                  "Connection: keep-alive\r\n"
+                  "X-Conn: %d\r\n"
+                  "\r\n", (unsigned int)sendlen, connno);
+      else
+        snprintf (hdr, sizeof hdr,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Length: %u\r\n"
+                  "Connection: keep-alive\r\n"
+                  "Content-Encoding: %s\r\n"
+                  "X-Conn: %d\r\n"
+                  "\r\n", (unsigned int)sendlen, cename, connno);
+      if (write (fd, hdr, strlen (hdr)) != strlen (hdr)
+          || write (fd, body, sendlen) != sendlen)
+        return;
+      xfree (body);
+    }
+}
+
+
+static pid_t
+start_server (unsigned short *r_port)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen;
+  pid_t pid;
+  int fd, conn, connno;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    log_fatal ("socket failed: %s\n", strerror (errno));
+  memset (&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addrlen = sizeof addr;
+  if (bind (fd, (struct sockaddr *)&addr, sizeof addr)
+      || listen (fd, 5)
+      || getsockname (fd, (struct sockaddr *)&addr, &addrlen))
+    log_fatal ("error setting up the server: %s\n", strerror (errno));
+  *r_port = ntohs (addr.sin_port);
+
+  pid = fork ();
+  if (pid == -1)
+    log_fatal ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      /* Each connection gets its own process so that a kept
+         connection does not block the others.  */
+      signal (SIGCHLD, SIG_IGN);
+      for (connno = 1; (conn = accept (fd, NULL, NULL)) != -1; connno++)
+        {
+          if (!fork ())
+            {
+              close (fd);
+              serve_connection (conn, connno);
+              _exit (0);
+            }
+          close (conn);
+        }
+      _exit (0);
+    }
+  close (fd);
+  return pid;
+}
+
+
+/* Fetch PATH from the test server and compare the body with the test
+   body.  Returns 0 if they match, 1 if they don't and -1 on a read
+   error.  The X-Conn header is stored at R_CONNNO.  */
+static int
+fetch (unsigned short port, const char *path, unsigned int flags,
+       int *r_connno)
+{
+  gpg_error_t err;
+  http_t hd;
+  char url[100];
+  const char *s;
+  unsigned char *buf;
+  size_t len, nread;
+  int result;
+
+  snprintf (url, sizeof url, "http://127.0.0.1:%u%s", port, path);
+  err = http_open_document (&hd, url, NULL, flags, NULL, NULL, NULL, NULL);
+  if (err)
+    log_fatal ("can't get '%s': %s\n", url, gpg_strerror (err));
+  if (http_get_status_code (hd) != 200)
+    log_fatal ("'%s': status %u\n", url, http_get_status_code (hd));
+  s = http_get_header (hd, "X-Conn");
+  *r_connno = s? atoi (s) : 0;
+
+  buf = xmalloc (BODYLEN + 1);
+  for (len = 0; len <= BODYLEN; len += nread)
+    {
+      if (es_read (http_get_read_ptr (hd), buf + len, BODYLEN + 1 - len,
+                   &nread))
+        break;
+      if (!nread)
+        break;
+    }
+  if (len <= BODYLEN && es_ferror (http_get_read_ptr (hd)))
+    result = -1;
+  else
+    result = (len != BODYLEN || memcmp (buf, test_body, BODYLEN));
+  xfree (buf);
+  http_close (hd, 0);
+  if (verbose)
+    log_info ("%s: %d\n", url, result);
+  return result;
+}
+
+
+static int
+run_selftest (void)
+{
+  static const char *kinds[] = { "/gzip", "/deflate", "/raw", "/identity" };
+  unsigned short port;
+  pid_t pid;
+  int i, errcount = 0;
+  int conn1, conn2;
+
+  test_body = xmalloc (BODYLEN);
+  for (i=0; i < BODYLEN; i++)
+    test_body[i] = (i % 61 == 60)? '\n' : "0123456789abcdef"[(i * 7) % 16];
+  pid = start_server (&port);
+
+  for (i=0; i < DIM (kinds); i++)
+    {
+      /* Decoded with HTTP_FLAG_COMPRESS ...  */
+      if (fetch (port, kinds[i], HTTP_FLAG_COMPRESS, &conn1))
+        {
+          log_error ("selftest %s failed\n", kinds[i]);
+          errcount++;
+        }
+      /* ... and not asked for without it.  */
+      if (fetch (port, kinds[i], 0, &conn1))
+        {
+          log_error ("selftest %s without compression failed\n", kinds[i]);
+          errcount++;
+        }
+    }
+
+  /* A kept connection can be used after a compressed body.  */
+  if (fetch (port, "/gzip", HTTP_FLAG_COMPRESS|HTTP_FLAG_KEEP_ALIVE, &conn1)
+      || fetch (port, "/gzip", HTTP_FLAG_COMPRESS|HTTP_FLAG_KEEP_ALIVE,
+                &conn2))
+    {
+      log_error ("selftest keep-alive failed\n");
+      errcount++;
+    }
+  else if (conn1 != conn2)
+    {
+      log_error ("selftest keep-alive did not reuse the connection\n");
+      errcount++;
+    }
+
+  /* Truncated and corrupt bodies are read errors.  */
+  if (fetch (port, "/truncated", HTTP_FLAG_COMPRESS, &conn1) != -1)
+    {
+      log_error ("selftest truncated body not detected\n");
+      errcount++;
+    }
+  if (fetch (port, "/garbage", HTTP_FLAG_COMPRESS, &conn1) != -1)
+    {
+      log_error ("selftest corrupt body not detected\n");
+      errcount++;
+    }
+
+  kill (pid, SIGTERM);
+  waitpid (pid, NULL, 0);
+  xfree (test_body);
+  if (!errcount)
+    log_info ("selftest passed\n");
+  return !!errcount;
+}
+#endif /*WITH_SELFTEST*/
+
+
 /* Prepend FNAME with the srcdir environment variable's value and
    return an allocated filename. */
 static char *
@@ -166,7 +439,9 @@ main (int argc, char **argv)
         }
       else if (!strcmp (*argv, "--help"))
         {
-          fputs ("usage: " PGM " URL\n"
+          fputs ("usage: " PGM " [URL]\n"
+                 "Without URL the content decoding is tested against "
+                 "a local server.\n"
                  "Options:\n"
                  "  --verbose         print timings etc.\n"
                  "  --debug           flyswatter\n"
@@ -228,9 +503,18 @@ main (int argc, char **argv)
           exit (1);
         }
     }
+  if (!argc)
+    {
+#ifdef WITH_SELFTEST
+      return run_selftest ();
+#else
+      fprintf (stderr, PGM ": no URL given\n");
+      exit (1);
+#endif
+    }
   if (argc != 1)
     {
-      fprintf (stderr, PGM ": no or too many URLS given\n");
+      fprintf (stderr, PGM ": too many URLS given\n");
       exit (1);
     }
 
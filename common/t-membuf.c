@@ -0,0 +1,234 @@
+/* t-membuf.c - Module tests for membuf.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "util.h"
+#include "membuf.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     errcount++;                                 \
+                   } while(0)
+
+#define NTHREADS 8
+
+static int errcount;
+
+
+/* Appending byte by byte grows the buffer geometrically.  */
+static void
+test_growth (void)
+{
+  membuf_t mb;
+  size_t lastsize, len;
+  unsigned char *p;
+  int i, ngrow = 0;
+
+  init_membuf (&mb, 16);
+  lastsize = mb.size;
+  for (i=0; i < 1000000; i++)
+    {
+      unsigned char c = i;
+
+      put_membuf (&mb, &c, 1);
+      if (mb.size != lastsize)
+        {
+          if (mb.size < 2 * lastsize && lastsize >= 1024)
+            fail (1);
+          lastsize = mb.size;
+          ngrow++;
+        }
+    }
+  /* 16 bytes to 1 MiB in doublings from 1024.  */
+  if (ngrow > 12)
+    fail (2);
+
+  p = get_membuf (&mb, &len);
+  if (!p || len != 1000000)
+    fail (3);
+  else
+    for (i=0; i < 1000000; i++)
+      if (p[i] != (unsigned char)i)
+        {
+          fail (4);
+          break;
+        }
+  xfree (p);
+}
+
+
+/* membuf_reserve avoids the reallocations.  */
+static void
+test_reserve (void)
+{
+  membuf_t mb;
+  char buffer[1000];
+  char *buf;
+  int i;
+
+  memset (buffer, 'x', sizeof buffer);
+  init_membuf (&mb, 16);
+  membuf_reserve (&mb, 100 * sizeof buffer);
+  if (mb.size <= 100 * sizeof buffer)
+    fail (1);
+  buf = mb.buf;
+  for (i=0; i < 100; i++)
+    put_membuf (&mb, buffer, sizeof buffer);
+  if (mb.buf != buf || get_membuf_len (&mb) != 100 * sizeof buffer)
+    fail (2);
+  release_membuf (&mb);
+}
+
+
+/* A released buffer is wiped and handed out again by the next
+   init_membuf which fits into it.  */
+static void
+test_pool (void)
+{
+  membuf_t mb;
+  char *buf;
+  size_t len;
+  int i;
+
+  init_membuf (&mb, 4096);
+  put_membuf_str (&mb, "secret data");
+  buf = mb.buf;
+  release_membuf (&mb);
+  if (mb.buf || is_membuf_ready (&mb) != 1)
+    fail (1);
+
+  init_membuf (&mb, 100);
+  if (mb.buf != buf)
+    fail (2);
+  else if (mb.size < 4096)
+    fail (3);
+  else
+    for (i=0; i < 11; i++)
+      if (buf[i])
+        {
+          fail (4);
+          break;
+        }
+  if (get_membuf_len (&mb))
+    fail (5);
+  put_membuf_str (&mb, "abc");
+  buf = get_membuf_shrink (&mb, &len);
+  if (!buf || len != 3 || memcmp (buf, "abc", 3))
+    fail (6);
+  xfree (buf);
+
+  /* Secure buffers are never pooled.  */
+  init_membuf_secure (&mb, 64);
+  buf = mb.buf;
+  release_membuf (&mb);
+  init_membuf (&mb, 64);
+  if (buf && mb.buf == buf)
+    fail (7);
+  release_membuf (&mb);
+}
+
+
+/* Many threads using membufs without the npth lock must not hand out
+   a pooled buffer twice.  */
+static void *
+thread_main (void *arg)
+{
+  int id = (int)(long)arg;
+  membuf_t mb;
+  char tag[16];
+  const char *p;
+  size_t len;
+  int i, j, nerr = 0;
+
+  npth_unprotect ();
+  snprintf (tag, sizeof tag, "<%d>", id);
+  for (i=0; i < 20000; i++)
+    {
+      init_membuf (&mb, 64 + (i % 7) * 512);
+      for (j=0; j < 20; j++)
+        put_membuf_str (&mb, tag);
+      p = peek_membuf (&mb, &len);
+      if (!p || len != 20 * strlen (tag))
+        nerr++;
+      else
+        for (j=0; j < 20; j++)
+          if (memcmp (p + j * strlen (tag), tag, strlen (tag)))
+            {
+              nerr++;
+              break;
+            }
+      release_membuf (&mb);
+    }
+  npth_protect ();
+  errcount += nerr;
+  return NULL;
+}
+
+
+static void
+test_threads (void)
+{
+  npth_t threads[NTHREADS];
+  int i, n;
+
+  for (n=0; n < NTHREADS; n++)
+    if (npth_create (threads + n, NULL, thread_main, (void*)(long)n))
+      break;
+  for (i=0; i < n; i++)
+    npth_join (threads[i], NULL);
+  if (!n)
+    fail (1);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  if (npth_init ())
+    {
+      fprintf (stderr, "npth_init failed\n");
+      return 1;
+    }
+
+  test_growth ();
+  test_reserve ();
+  test_pool ();
+  test_threads ();
+
+  return !!errcount;
+}
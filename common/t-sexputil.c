@@ -20,6 +20,7 @@
 #include <config.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "util.h"
 
@@ -178,6 +179,46 @@ test_make_canon_sexp_from_rsa_pk (void)
 }
 
 
+static void
+test_same_sexp (void)
+{
+  static struct {
+    const char *a;
+    const char *b;
+    int same;
+  } tests[] = {
+    { "(genkey(rsa(nbits 4:3072)))", "(genkey (rsa (nbits 4:3072)))", 1 },
+    { "(genkey(rsa(nbits 4:3072)))", "(genkey(rsa(nbits 4:2048)))", 0 },
+    { "(genkey(rsa(nbits 4:3072)))", "(genkey(rsa(nbits 4:3072)(x)))", 0 },
+    { "(a \"foo\")", "(a 3:foo)", 1 },
+    { "(a foo)", "(a FOO)", 0 },
+    { "(a)", "(b)", 0 },
+    { NULL }
+  };
+  gcry_sexp_t a, b;
+  int idx;
+
+  for (idx=0; tests[idx].a; idx++)
+    {
+      if (gcry_sexp_sscan (&a, NULL, tests[idx].a, strlen (tests[idx].a))
+          || gcry_sexp_sscan (&b, NULL, tests[idx].b, strlen (tests[idx].b)))
+        fail (idx);
+      if (same_sexp (a, b) != tests[idx].same)
+        fail (idx);
+      if (same_sexp (b, a) != tests[idx].same)
+        fail (idx);
+      if (!same_sexp (a, a))
+        fail (idx);
+      if (same_sexp (a, NULL) || same_sexp (NULL, b))
+        fail (idx);
+      gcry_sexp_release (a);
+      gcry_sexp_release (b);
+    }
+  if (!same_sexp (NULL, NULL))
+    fail (idx);
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -186,6 +227,7 @@ main (int argc, char **argv)
 
   test_hash_algo_from_sigval ();
   test_make_canon_sexp_from_rsa_pk ();
+  test_same_sexp ();
 
   return 0;
 }
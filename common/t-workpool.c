@@ -0,0 +1,313 @@
+/* t-workpool.c - Module tests for workpool.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <npth.h>
+
+#include "util.h"
+#include "workpool.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     errcount++;                                 \
+                   } while(0)
+
+#define NTASKS 200
+
+static int errcount;
+
+
+/* A task which does a bit of work on memory it owns.  */
+struct job
+{
+  unsigned int n;
+  unsigned long result;
+  int *order;        /* For serial groups: where to record N.  */
+  int *next;
+  int done;
+};
+
+static void
+job_task (void *arg)
+{
+  struct job *job = arg;
+  unsigned long x = job->n;
+  int i;
+
+  for (i=0; i < 1000; i++)
+    x = x * 1103515245 + 12345;
+  if (job->order)
+    job->order[(*job->next)++] = job->n;
+  job->result = x;
+}
+
+static unsigned long
+expected (unsigned int n)
+{
+  unsigned long x = n;
+  int i;
+
+  for (i=0; i < 1000; i++)
+    x = x * 1103515245 + 12345;
+  return x;
+}
+
+
+/* A task which takes a while, to keep a worker busy.  */
+static void
+slow_task (void *arg)
+{
+  (void)arg;
+  usleep (20000);
+}
+
+
+static void
+init_jobs (struct job *jobs, int *order, int *next)
+{
+  int i;
+
+  memset (jobs, 0, NTASKS * sizeof *jobs);
+  for (i=0; i < NTASKS; i++)
+    {
+      jobs[i].n = i;
+      jobs[i].order = order;
+      jobs[i].next = next;
+    }
+}
+
+
+/* All tasks of a group have been run when workpool_wait returns.  */
+static void
+test_group (workpool_t pool)
+{
+  static struct job jobs[NTASKS];
+  workpool_group_t group;
+  int i;
+
+  init_jobs (jobs, NULL, NULL);
+  if (workpool_group_new (pool, &group))
+    {
+      fail (0);
+      return;
+    }
+  for (i=0; i < NTASKS; i++)
+    workpool_submit (group, i % WORKPOOL_NPRIO, job_task, jobs + i);
+  workpool_wait (group);
+  if (workpool_pending (group))
+    fail (1);
+  for (i=0; i < NTASKS; i++)
+    if (jobs[i].result != expected (i))
+      fail (2);
+  workpool_group_release (group);
+}
+
+
+/* The tasks of a serial group are run in order and one at a time.  */
+static void
+test_serial (workpool_t pool)
+{
+  static struct job jobs[NTASKS];
+  static int order[NTASKS];
+  workpool_group_t group;
+  int next = 0;
+  int i;
+
+  init_jobs (jobs, order, &next);
+  if (workpool_serial_group_new (pool, &group))
+    {
+      fail (0);
+      return;
+    }
+  for (i=0; i < NTASKS; i++)
+    workpool_submit (group, WORKPOOL_PRIO_NORMAL, job_task, jobs + i);
+  workpool_group_release (group);
+  if (next != NTASKS)
+    fail (1);
+  for (i=0; i < NTASKS && i < next; i++)
+    if (order[i] != i)
+      fail (2);
+}
+
+
+/* The flag of a task is set after it has been run, and waiting for
+   one task does not need to wait for the whole group.  */
+static void
+test_wait_task (workpool_t pool)
+{
+  static struct job jobs[NTASKS];
+  workpool_group_t group;
+  int i;
+
+  init_jobs (jobs, NULL, NULL);
+  if (workpool_group_new (pool, &group))
+    {
+      fail (0);
+      return;
+    }
+  for (i=0; i < NTASKS; i++)
+    workpool_submit_task (group, WORKPOOL_PRIO_NORMAL, job_task, jobs + i,
+                          &jobs[i].done);
+  for (i=NTASKS-1; i >= 0; i -= 7)
+    {
+      workpool_wait_task (group, &jobs[i].done);
+      if (!jobs[i].done || jobs[i].result != expected (i))
+        fail (1);
+    }
+  workpool_wait (group);
+  for (i=0; i < NTASKS; i++)
+    if (!jobs[i].done)
+      fail (2);
+  workpool_group_release (group);
+}
+
+
+/* Every task is either run or dropped by workpool_cancel.  */
+static void
+test_cancel (workpool_t pool)
+{
+  static struct job jobs[NTASKS];
+  workpool_group_t group;
+  unsigned int ndropped;
+  int i, nrun;
+
+  init_jobs (jobs, NULL, NULL);
+  if (workpool_serial_group_new (pool, &group))
+    {
+      fail (0);
+      return;
+    }
+  workpool_submit (group, WORKPOOL_PRIO_NORMAL, slow_task, NULL);
+  for (i=0; i < NTASKS; i++)
+    workpool_submit_task (group, WORKPOOL_PRIO_NORMAL, job_task, jobs + i,
+                          &jobs[i].done);
+  ndropped = workpool_cancel (group);
+  workpool_wait (group);
+  for (nrun=i=0; i < NTASKS; i++)
+    if (jobs[i].done)
+      nrun++;
+  if (nrun + ndropped != NTASKS && nrun + ndropped != NTASKS + 1)
+    fail (1);
+  if (workpool_pending (group))
+    fail (2);
+  workpool_group_release (group);
+}
+
+
+/* A pool without workers runs the tasks in the waiting thread.  */
+static void
+test_no_workers (void)
+{
+  static struct job jobs[NTASKS];
+  workpool_t pool;
+  workpool_group_t group;
+  int i;
+
+  init_jobs (jobs, NULL, NULL);
+  if (workpool_new (&pool, "t-workpool-0", 0, 0))
+    {
+      fail (0);
+      return;
+    }
+  if (workpool_threads (pool))
+    fail (1);
+  test_serial (pool);
+  if (!workpool_group_new (pool, &group))
+    {
+      for (i=0; i < NTASKS; i++)
+        workpool_submit_task (group, WORKPOOL_PRIO_NORMAL, job_task,
+                              jobs + i, &jobs[i].done);
+      workpool_wait_task (group, &jobs[NTASKS-1].done);
+      if (!jobs[NTASKS-1].done)
+        fail (2);
+      workpool_group_release (group);
+      for (i=0; i < NTASKS; i++)
+        if (jobs[i].result != expected (i))
+          fail (3);
+    }
+  workpool_release (pool);
+}
+
+
+/* A bounded queue runs the overflow in the submitter.  */
+static void
+test_bounded (void)
+{
+  workpool_t pool;
+
+  if (workpool_new (&pool, "t-workpool-b", 2, 4))
+    {
+      fail (0);
+      return;
+    }
+  test_group (pool);
+  test_serial (pool);
+  workpool_grow (pool, 3);
+  if (workpool_threads (pool) < 2)
+    fail (1);
+  test_wait_task (pool);
+  workpool_release (pool);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  workpool_t pool;
+
+  (void)argc;
+  (void)argv;
+
+  if (npth_init ())
+    {
+      fprintf (stderr, "npth_init failed\n");
+      return 1;
+    }
+
+  test_no_workers ();
+  test_bounded ();
+
+  if (workpool_new (&pool, "t-workpool", 4, 0))
+    {
+      fprintf (stderr, "workpool_new failed\n");
+      return 1;
+    }
+  test_group (pool);
+  test_serial (pool);
+  test_wait_task (pool);
+  test_cancel (pool);
+  workpool_release (pool);
+
+  return !!errcount;
+}
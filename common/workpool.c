@@ -0,0 +1,571 @@
+/* workpool.c - A pool of worker threads for npth programs
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A work pool runs independent computations on a fixed set of
+   worker threads.  The tasks are submitted in groups; a group is what
+   the submitter waits for and what it may cancel.  The waiting
+   thread does not idle: it runs the queued tasks of its own group
+   itself, thus a pool without workers, or with fewer workers than
+   wanted, still gets all the work done.
+
+   All state of a pool is only touched while holding the npth lock;
+   a task is run without it.  Thus the task function may only use
+   memory it owns, and everything which needs the rest of the program
+   -- logging, iobufs, assuan -- is done by the submitter after
+   workpool_wait returns.  That is the whole handoff back into the
+   npth world.
+
+   The tasks of a serial group are run one after the other in the
+   order they were submitted, which suits a stage of a pipeline whose
+   state carries over from one piece of data to the next.  A task may
+   also be submitted with a flag which is set once the task has been
+   run; the submitter may wait for that single task with
+   workpool_wait_task.  The flag is set while holding the npth lock,
+   thus any npth thread may read it without further locking.
+
+   With the npth lock serializing every queue operation anyway, one
+   shared queue per priority serves as well as per-worker queues
+   would.  A bounded pool does not block the submitter when its queue
+   is full; the submitter runs the task itself instead, which slows
+   it down just as much as the workers are behind.
+
+   npth_init must have been called before a pool is created.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <npth.h>
+
+#include "util.h"
+#include "workpool.h"
+
+
+/* A queued task.  */
+struct task_s
+{
+  struct task_s *next;
+  workpool_group_t group;
+  workpool_fnc_t fnc;
+  void *arg;
+  int *r_done;             /* Set when the task has been run.  */
+};
+
+
+struct workpool_s
+{
+  char name[32];
+  npth_mutex_t lock;
+  npth_cond_t work;        /* Signaled when tasks have been queued.  */
+  npth_cond_t gone;        /* Signaled when a worker ended.  */
+  struct
+  {
+    struct task_s *head;
+    struct task_s *tail;
+  } queue[WORKPOOL_NPRIO];
+  unsigned int nqueued;    /* Number of tasks in all queues.  */
+  unsigned int max_queued; /* 0 for no limit.  */
+  unsigned int nworkers;   /* Number of running workers.  */
+  int stopping;            /* Set by workpool_release.  */
+  struct task_s *unused;   /* Released tasks for reuse.  */
+};
+
+
+struct workpool_group_s
+{
+  workpool_t pool;
+  npth_cond_t done;        /* Signaled when a task finished.  */
+  int serial;              /* Run only one task at a time.  */
+  unsigned int queued;     /* Number of queued tasks of the group.  */
+  unsigned int running;    /* Number of tasks being run.  */
+};
+
+
+
+/* Return true if a task of GROUP may be started now.  */
+static int
+may_start (workpool_group_t group)
+{
+  return group->queued && !(group->serial && group->running);
+}
+
+
+/* Take the first queued task of GROUP, or of any group if GROUP is
+   NULL, off the queue of the highest priority which has one.  With
+   GROUP NULL the tasks of a serial group which has a task running
+   are skipped; a caller passing a group checks that with may_start
+   unless it is going to drop the task.  Returns NULL if there is
+   none.  Called with the lock.  */
+static struct task_s *
+take_task (workpool_t pool, workpool_group_t group)
+{
+  struct task_s *task, *prev;
+  int prio;
+
+  for (prio = WORKPOOL_NPRIO - 1; prio >= 0; prio--)
+    {
+      for (prev = NULL, task = pool->queue[prio].head; task;
+           prev = task, task = task->next)
+        if (group? task->group == group : may_start (task->group))
+          break;
+      if (!task)
+        continue;
+
+      if (prev)
+        prev->next = task->next;
+      else
+        pool->queue[prio].head = task->next;
+      if (pool->queue[prio].tail == task)
+        pool->queue[prio].tail = prev;
+      task->next = NULL;
+      pool->nqueued--;
+      task->group->queued--;
+      return task;
+    }
+  return NULL;
+}
+
+
+/* Put TASK on the list of unused tasks.  Called with the lock.  */
+static void
+drop_task (workpool_t pool, struct task_s *task)
+{
+  task->group = NULL;
+  task->fnc = NULL;
+  task->arg = NULL;
+  task->r_done = NULL;
+  task->next = pool->unused;
+  pool->unused = task;
+}
+
+
+/* Wake up the waiters of GROUP, which wait for the group or for one
+   of its tasks.  Called with the lock.  */
+static void
+check_group_done (workpool_group_t group)
+{
+  npth_cond_broadcast (&group->done);
+}
+
+
+/* Run the task TASK which has been taken off the queue.  Called with
+   the lock, which is released while the task function runs.  */
+static void
+run_task (workpool_t pool, struct task_s *task)
+{
+  workpool_group_t group = task->group;
+  workpool_fnc_t fnc = task->fnc;
+  void *arg = task->arg;
+  int *r_done = task->r_done;
+
+  drop_task (pool, task);
+  group->running++;
+  npth_mutex_unlock (&pool->lock);
+
+  npth_unprotect ();
+  fnc (arg);
+  npth_protect ();
+
+  npth_mutex_lock (&pool->lock);
+  if (r_done)
+    *r_done = 1;
+  group->running--;
+  /* The next task of a serial group may now be started.  */
+  if (group->serial && group->queued)
+    npth_cond_signal (&pool->work);
+  check_group_done (group);
+}
+
+
+static void *
+worker_thread (void *arg)
+{
+  workpool_t pool = arg;
+  struct task_s *task;
+
+  npth_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      task = take_task (pool, NULL);
+      if (task)
+        run_task (pool, task);
+      else if (pool->stopping)
+        break;
+      else
+        npth_cond_wait (&pool->work, &pool->lock);
+    }
+  pool->nworkers--;
+  npth_cond_signal (&pool->gone);
+  npth_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+
+
+/* Return the number of CPUs available or 1 if that is not known.  */
+int
+workpool_cpu_count (void)
+{
+  long n = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+  if (n < 1)
+    n = 1;
+  else if (n > 1024)
+    n = 1024;
+  return (int)n;
+}
+
+
+/* Create a new pool with NTHREADS workers, or one worker for each
+   CPU if NTHREADS is negative, and store it at R_POOL.  NAME is used
+   for the names of the threads and in diagnostics.  If MAX_QUEUED is
+   not 0 at most that many tasks are queued at a time.  A pool
+   without workers is allowed; its tasks are run by those who wait
+   for them.  Failing to start some of the workers is not an error.  */
+gpg_error_t
+workpool_new (workpool_t *r_pool, const char *name, int nthreads,
+              unsigned int max_queued)
+{
+  workpool_t pool;
+  int rc;
+
+  *r_pool = NULL;
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  snprintf (pool->name, sizeof pool->name, "%s", name? name : "workpool");
+  pool->max_queued = max_queued;
+
+  rc = npth_mutex_init (&pool->lock, NULL);
+  if (!rc)
+    {
+      rc = npth_cond_init (&pool->work, NULL);
+      if (!rc)
+        {
+          rc = npth_cond_init (&pool->gone, NULL);
+          if (rc)
+            npth_cond_destroy (&pool->work);
+        }
+      if (rc)
+        npth_mutex_destroy (&pool->lock);
+    }
+  if (rc)
+    {
+      log_error ("error initializing the %s pool: %s\n",
+                 pool->name, strerror (rc));
+      xfree (pool);
+      return gpg_error_from_errno (rc);
+    }
+
+  workpool_grow (pool, nthreads);
+  *r_pool = pool;
+  return 0;
+}
+
+
+/* Start more workers so that POOL has at least NTHREADS of them, or
+   one for each CPU if NTHREADS is negative.  Failing to start some of
+   them is not an error.  */
+void
+workpool_grow (workpool_t pool, int nthreads)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  char tname[48];
+  int rc;
+
+  if (nthreads < 0)
+    nthreads = workpool_cpu_count ();
+  if (nthreads > WORKPOOL_MAX_THREADS)
+    nthreads = WORKPOOL_MAX_THREADS;
+  if (pool->nworkers >= (unsigned int)nthreads)
+    return;
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  npth_mutex_lock (&pool->lock);
+  while (pool->nworkers < (unsigned int)nthreads)
+    {
+      rc = npth_create (&thread, &tattr, worker_thread, pool);
+      if (rc)
+        {
+          log_error ("error spawning %s worker: %s\n",
+                     pool->name, strerror (rc));
+          break;
+        }
+      snprintf (tname, sizeof tname, "%s-%u", pool->name, pool->nworkers);
+      npth_setname_np (thread, tname);
+      pool->nworkers++;
+    }
+  npth_mutex_unlock (&pool->lock);
+  npth_attr_destroy (&tattr);
+}
+
+
+/* Stop the workers of POOL and release it.  All groups of the pool
+   must have been released.  */
+void
+workpool_release (workpool_t pool)
+{
+  struct task_s *task;
+
+  if (!pool)
+    return;
+
+  npth_mutex_lock (&pool->lock);
+  pool->stopping = 1;
+  npth_cond_broadcast (&pool->work);
+  while (pool->nworkers)
+    npth_cond_wait (&pool->gone, &pool->lock);
+  npth_mutex_unlock (&pool->lock);
+
+  while ((task = pool->unused))
+    {
+      pool->unused = task->next;
+      xfree (task);
+    }
+  npth_cond_destroy (&pool->gone);
+  npth_cond_destroy (&pool->work);
+  npth_mutex_destroy (&pool->lock);
+  xfree (pool);
+}
+
+
+/* Return the number of running workers of POOL.  */
+unsigned int
+workpool_threads (workpool_t pool)
+{
+  return pool? pool->nworkers : 0;
+}
+
+
+
+/* Create a new group of tasks for POOL and store it at R_GROUP.  */
+gpg_error_t
+workpool_group_new (workpool_t pool, workpool_group_t *r_group)
+{
+  workpool_group_t group;
+  int rc;
+
+  *r_group = NULL;
+  group = xtrycalloc (1, sizeof *group);
+  if (!group)
+    return gpg_error_from_syserror ();
+  rc = npth_cond_init (&group->done, NULL);
+  if (rc)
+    {
+      xfree (group);
+      return gpg_error_from_errno (rc);
+    }
+  group->pool = pool;
+  *r_group = group;
+  return 0;
+}
+
+
+/* Create a new serial group of tasks for POOL and store it at
+   R_GROUP.  Its tasks are run one at a time in the order they were
+   submitted; all of them must have the same priority.  */
+gpg_error_t
+workpool_serial_group_new (workpool_t pool, workpool_group_t *r_group)
+{
+  gpg_error_t err;
+
+  err = workpool_group_new (pool, r_group);
+  if (!err)
+    (*r_group)->serial = 1;
+  return err;
+}
+
+
+/* Wait for the tasks of GROUP and release it.  Use workpool_cancel
+   before to drop the tasks not yet started.  */
+void
+workpool_group_release (workpool_group_t group)
+{
+  if (!group)
+    return;
+  workpool_wait (group);
+  npth_cond_destroy (&group->done);
+  xfree (group);
+}
+
+
+/* Submit the task FNC (ARG) of priority PRIO to GROUP.  If the queue
+   of the pool is full or no memory is left for the task, FNC is
+   called right away and thus has returned when this function
+   returns; for a serial group that is done after the tasks submitted
+   before have been run.  Either way ARG must stay valid until the
+   group has been waited for.  */
+void
+workpool_submit (workpool_group_t group, int prio,
+                 workpool_fnc_t fnc, void *arg)
+{
+  workpool_submit_task (group, prio, fnc, arg, NULL);
+}
+
+
+/* Like workpool_submit but also clear the flag at R_DONE and set it
+   to true after FNC has returned; see workpool_wait_task.  */
+void
+workpool_submit_task (workpool_group_t group, int prio,
+                      workpool_fnc_t fnc, void *arg, int *r_done)
+{
+  workpool_t pool = group->pool;
+  struct task_s *task = NULL;
+
+  if (r_done)
+    *r_done = 0;
+
+  if (prio < 0)
+    prio = 0;
+  else if (prio >= WORKPOOL_NPRIO)
+    prio = WORKPOOL_NPRIO - 1;
+
+  npth_mutex_lock (&pool->lock);
+  if (!pool->max_queued || pool->nqueued < pool->max_queued)
+    {
+      task = pool->unused;
+      if (task)
+        pool->unused = task->next;
+      else
+        task = xtrymalloc (sizeof *task);
+    }
+  if (!task)
+    {
+      npth_mutex_unlock (&pool->lock);
+      if (group->serial)
+        workpool_wait (group);
+      npth_unprotect ();
+      fnc (arg);
+      npth_protect ();
+      if (r_done)
+        *r_done = 1;
+      return;
+    }
+
+  task->next = NULL;
+  task->group = group;
+  task->fnc = fnc;
+  task->arg = arg;
+  task->r_done = r_done;
+  if (pool->queue[prio].tail)
+    pool->queue[prio].tail->next = task;
+  else
+    pool->queue[prio].head = task;
+  pool->queue[prio].tail = task;
+  pool->nqueued++;
+  group->queued++;
+  npth_cond_signal (&pool->work);
+  npth_mutex_unlock (&pool->lock);
+}
+
+
+/* Drop all tasks of GROUP which have not yet been started.  Returns
+   the number of dropped tasks.  Tasks which are running are not
+   interrupted; workpool_wait still waits for them.  */
+unsigned int
+workpool_cancel (workpool_group_t group)
+{
+  workpool_t pool = group->pool;
+  struct task_s *task;
+  unsigned int n = 0;
+
+  npth_mutex_lock (&pool->lock);
+  while ((task = take_task (pool, group)))
+    {
+      drop_task (pool, task);
+      n++;
+    }
+  check_group_done (group);
+  npth_mutex_unlock (&pool->lock);
+  return n;
+}
+
+
+/* Return after all tasks of GROUP have been run.  The caller runs
+   the queued tasks of the group itself until none is left and then
+   waits for those the workers are running.  */
+void
+workpool_wait (workpool_group_t group)
+{
+  workpool_t pool = group->pool;
+  struct task_s *task;
+
+  npth_mutex_lock (&pool->lock);
+  while (group->queued || group->running)
+    {
+      if (may_start (group) && (task = take_task (pool, group)))
+        run_task (pool, task);
+      else
+        npth_cond_wait (&group->done, &pool->lock);
+    }
+  npth_mutex_unlock (&pool->lock);
+}
+
+
+/* Return after the task of GROUP submitted with the flag R_DONE has
+   been run or dropped by workpool_cancel.  Meanwhile the caller runs
+   queued tasks of the group in their order, which includes the one
+   waited for if it has not yet been started.  */
+void
+workpool_wait_task (workpool_group_t group, int *r_done)
+{
+  workpool_t pool = group->pool;
+  struct task_s *task;
+
+  npth_mutex_lock (&pool->lock);
+  while (!*r_done && (group->queued || group->running))
+    {
+      if (may_start (group) && (task = take_task (pool, group)))
+        run_task (pool, task);
+      else
+        npth_cond_wait (&group->done, &pool->lock);
+    }
+  npth_mutex_unlock (&pool->lock);
+}
+
+
+/* Return the number of tasks of GROUP which are queued or running.  */
+unsigned int
+workpool_pending (workpool_group_t group)
+{
+  workpool_t pool = group->pool;
+  unsigned int n;
+
+  npth_mutex_lock (&pool->lock);
+  n = group->queued + group->running;
+  npth_mutex_unlock (&pool->lock);
+  return n;
+}
@@ -0,0 +1,76 @@
+/* workpool.h - A pool of worker threads for npth programs
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_COMMON_WORKPOOL_H
+#define GNUPG_COMMON_WORKPOOL_H
+
+/* The priorities of a task.  Queued tasks of a higher priority are
+   started first; those of the same priority in the order they were
+   submitted.  */
+#define WORKPOOL_PRIO_LOW     0
+#define WORKPOOL_PRIO_NORMAL  1
+#define WORKPOOL_PRIO_HIGH    2
+#define WORKPOOL_NPRIO        3
+
+/* The most workers of one pool.  */
+#define WORKPOOL_MAX_THREADS 64
+
+/* The function of a task.  It is called without the npth lock and
+   thus may not use anything but the memory it owns.  */
+typedef void (*workpool_fnc_t) (void *arg);
+
+struct workpool_s;
+typedef struct workpool_s *workpool_t;
+
+struct workpool_group_s;
+typedef struct workpool_group_s *workpool_group_t;
+
+int workpool_cpu_count (void);
+
+gpg_error_t workpool_new (workpool_t *r_pool, const char *name,
+                          int nthreads, unsigned int max_queued);
+void workpool_release (workpool_t pool);
+void workpool_grow (workpool_t pool, int nthreads);
+unsigned int workpool_threads (workpool_t pool);
+
+gpg_error_t workpool_group_new (workpool_t pool, workpool_group_t *r_group);
+gpg_error_t workpool_serial_group_new (workpool_t pool,
+                                       workpool_group_t *r_group);
+void workpool_group_release (workpool_group_t group);
+void workpool_submit (workpool_group_t group, int prio,
+                      workpool_fnc_t fnc, void *arg);
+void workpool_submit_task (workpool_group_t group, int prio,
+                           workpool_fnc_t fnc, void *arg, int *r_done);
+unsigned int workpool_cancel (workpool_group_t group);
+void workpool_wait (workpool_group_t group);
+void workpool_wait_task (workpool_group_t group, int *r_done);
+unsigned int workpool_pending (workpool_group_t group);
+
+
+#endif /*GNUPG_COMMON_WORKPOOL_H*/
@@ -68,7 +68,7 @@ struct cdb_make {
   /* private */
   cdbi_t cdb_dpos;		/* data position so far */
   cdbi_t cdb_rcnt;		/* record count so far */
-  char cdb_buf[4096];		/* write buffer */
+  char cdb_buf[16384];		/* write buffer */
   char *cdb_bpos;		/* current buf position */
   struct cdb_rl *cdb_rec[256];	/* list of arrays of record infos */
 };
@@ -24,10 +24,20 @@
 #include <errno.h>
 #include <assert.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+#endif
 #include <npth.h>
 
 #include "dirmngr.h"
+#include "../common/host2net.h"
 #include "misc.h"
 #include "crlfetch.h"
 #include "certcache.h"
@@ -35,6 +45,16 @@
 
 #define MAX_EXTRA_CACHED_CERTS 1000
 
+/* The number of slots of the subject and issuer DN indices.  */
+#define DN_INDEX_SIZE 1024
+
+/* The name of the snapshot of the loaded certificates and the magic
+   it starts with.  See write_snapshot for the format.  */
+#define SNAPSHOT_NAME   "trusted-certs.cache"
+#define SNAPSHOT_MAGIC  "DMcerts1"
+#define SNAPSHOT_HDRLEN (8 + 20 + 4)
+#define SNAPSHOT_RECLEN (1 + 20 + 4 * 4)
+
 /* Constants used to classify search patterns.  */
 enum pattern_class
   {
@@ -60,8 +80,15 @@ enum pattern_class
 struct cert_item_s
 {
   struct cert_item_s *next; /* Next item with the same hash value. */
-  ksba_cert_t cert;         /* The KSBA cert object or NULL is this is
-                               not a valid item.  */
+  struct cert_item_s *next_by_subject; /* Next item in the same slot of
+                                          the subject index.  */
+  struct cert_item_s *next_by_issuer;  /* Next item in the same slot of
+                                          the issuer index.  */
+  ksba_cert_t cert;         /* The KSBA cert object or NULL if this is
+                               not a valid item or not yet parsed.  */
+  const unsigned char *image; /* If CERT is NULL the DER encoded
+                                 certificate in the snapshot.  */
+  size_t imagelen;
   unsigned char fpr[20];    /* The fingerprint of this object. */
   char *issuer_dn;          /* The malloced issuer DN.  */
   ksba_sexp_t sn;           /* The malloced serial number  */
@@ -70,14 +97,25 @@ struct cert_item_s
   {
     unsigned int loaded:1;  /* It has been explicitly loaded.  */
     unsigned int trusted:1; /* This is a trusted root certificate.  */
+    unsigned int indexed:1; /* Linked into the DN indices.  */
+    unsigned int mapped:1;  /* The DNs and SN point into the snapshot.  */
   } flags;
 };
 typedef struct cert_item_s *cert_item_t;
 
+/* True if CI holds a certificate.  */
+#define ITEM_VALID(ci) ((ci)->cert || (ci)->image)
+
 /* The actual cert cache consisting of 256 slots for items indexed by
    the first byte of the fingerprint.  */
 static cert_item_t cert_cache[256];
 
+/* Indices of the valid items by the hash of their subject DN and of
+   their issuer DN.  Without them a lookup by name would need to walk
+   all items of the cache.  */
+static cert_item_t subject_index[DN_INDEX_SIZE];
+static cert_item_t issuer_index[DN_INDEX_SIZE];
+
 /* This is the global cache_lock variable. In general locking is not
    needed but it would take extra efforts to make sure that no
    indirect use of npth functions is done, so we simply lock it
@@ -93,6 +131,11 @@ static int initialization_done;
 static unsigned int total_loaded_certificates;
 static unsigned int total_extra_certificates;
 
+/* The snapshot the loaded certificates were taken from or NULL.  */
+static const unsigned char *snapshot;
+static size_t snapshot_len;
+static int snapshot_is_mapped;
+
 
 
 /* Helper to do the cache locking.  */
@@ -205,6 +248,70 @@ cert_compute_fpr (ksba_cert_t cert, unsigned char *digest)
 }
 
 
+/* Return the slot of the DN indices for the string DN.  */
+static unsigned int
+dn_hash (const char *dn)
+{
+  const unsigned char *s;
+  unsigned int hash = 0;
+
+  for (s = (const unsigned char *)dn; *s; s++)
+    hash = (hash << 5) - hash + *s;
+  return hash % DN_INDEX_SIZE;
+}
+
+
+/* Link the item CI into the DN indices.  */
+static void
+index_cache_slot (cert_item_t ci)
+{
+  unsigned int idx;
+
+  if (ci->subject_dn)
+    {
+      idx = dn_hash (ci->subject_dn);
+      ci->next_by_subject = subject_index[idx];
+      subject_index[idx] = ci;
+    }
+  idx = dn_hash (ci->issuer_dn);
+  ci->next_by_issuer = issuer_index[idx];
+  issuer_index[idx] = ci;
+  ci->flags.indexed = 1;
+}
+
+
+/* Remove the item CI from the DN indices.  */
+static void
+unindex_cache_slot (cert_item_t ci)
+{
+  cert_item_t *pp;
+
+  if (!ci->flags.indexed)
+    return;
+
+  if (ci->subject_dn)
+    {
+      for (pp = &subject_index[dn_hash (ci->subject_dn)]; *pp;
+           pp = &(*pp)->next_by_subject)
+        if (*pp == ci)
+          {
+            *pp = ci->next_by_subject;
+            break;
+          }
+    }
+  for (pp = &issuer_index[dn_hash (ci->issuer_dn)]; *pp;
+       pp = &(*pp)->next_by_issuer)
+    if (*pp == ci)
+      {
+        *pp = ci->next_by_issuer;
+        break;
+      }
+  ci->next_by_subject = NULL;
+  ci->next_by_issuer = NULL;
+  ci->flags.indexed = 0;
+}
+
+
 /* Cleanup one slot.  This releases all resourses but keeps the actual
    slot in the cache marked for reuse. */
 static void
@@ -212,15 +319,21 @@ clean_cache_slot (cert_item_t ci)
 {
   ksba_cert_t cert;
 
-  if (!ci->cert)
+  if (!ITEM_VALID (ci))
     return; /* Already cleaned.  */
 
-  ksba_free (ci->sn);
+  unindex_cache_slot (ci);
+  if (!ci->flags.mapped)
+    {
+      ksba_free (ci->sn);
+      ksba_free (ci->issuer_dn);
+      ksba_free (ci->subject_dn);
+    }
   ci->sn = NULL;
-  ksba_free (ci->issuer_dn);
   ci->issuer_dn = NULL;
-  ksba_free (ci->subject_dn);
   ci->subject_dn = NULL;
+  ci->image = NULL;
+  ci->imagelen = 0;
   cert = ci->cert;
   ci->cert = NULL;
 
@@ -228,6 +341,67 @@ clean_cache_slot (cert_item_t ci)
 }
 
 
+/* Return the KSBA cert object of the valid item CI.  A certificate
+   taken from the snapshot is parsed on first use; if that fails the
+   item is removed and NULL returned.  This may be called with only
+   the read lock held because we do not leave the npth lock here.  */
+static ksba_cert_t
+item_cert (cert_item_t ci)
+{
+  gpg_error_t err;
+  ksba_cert_t cert;
+
+  if (ci->cert)
+    return ci->cert;
+
+  err = ksba_cert_new (&cert);
+  if (!err)
+    err = ksba_cert_init_from_mem (cert, ci->image, ci->imagelen);
+  if (err)
+    {
+      log_error (_("can't parse certificate from '%s': %s\n"),
+                 SNAPSHOT_NAME, gpg_strerror (err));
+      ksba_cert_release (cert);
+      clean_cache_slot (ci);
+      return NULL;
+    }
+  ci->cert = cert;
+  return cert;
+}
+
+
+/* Find an item for a new certificate with the fingerprint FPR and
+   store it at R_CI.  Returns GPG_ERR_DUP_VALUE if that certificate is
+   already cached.  */
+static gpg_error_t
+new_cache_slot (const unsigned char *fpr, cert_item_t *r_ci)
+{
+  cert_item_t ci;
+
+  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
+    if (ITEM_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
+      return gpg_error (GPG_ERR_DUP_VALUE);
+  /* Try to reuse an existing entry.  */
+  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
+    if (!ITEM_VALID (ci))
+      break;
+  if (!ci)
+    { /* No: Create a new entry.  */
+      ci = xtrycalloc (1, sizeof *ci);
+      if (!ci)
+        return gpg_error_from_errno (errno);
+      ci->next = cert_cache[*fpr];
+      cert_cache[*fpr] = ci;
+    }
+  else
+    memset (&ci->flags, 0, sizeof ci->flags);
+
+  memcpy (ci->fpr, fpr, 20);
+  *r_ci = ci;
+  return 0;
+}
+
+
 /* Put the certificate CERT into the cache.  It is assumed that the
    cache is locked while this function is called. If FPR_BUFFER is not
    NULL the fingerprint of the certificate will be stored there.
@@ -237,6 +411,7 @@ clean_cache_slot (cert_item_t ci)
 static gpg_error_t
 put_cert (ksba_cert_t cert, int is_loaded, int is_trusted, void *fpr_buffer)
 {
+  gpg_error_t err;
   unsigned char help_fpr_buffer[20], *fpr;
   cert_item_t ci;
 
@@ -270,7 +445,7 @@ put_cert (ksba_cert_t cert, int is_loaded, int is_trusted, void *fpr_buffer)
         {
           ci_mark = NULL;
           for (ci = cert_cache[i]; ci; ci = ci->next)
-            if (ci->cert && !ci->flags.loaded)
+            if (ITEM_VALID (ci) && !ci->flags.loaded)
               ci_mark = ci;
           if (ci_mark)
             {
@@ -287,27 +462,12 @@ put_cert (ksba_cert_t cert, int is_loaded, int is_trusted, void *fpr_buffer)
     }
 
   cert_compute_fpr (cert, fpr);
-  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (ci->cert && !memcmp (ci->fpr, fpr, 20))
-      return gpg_error (GPG_ERR_DUP_VALUE);
-  /* Try to reuse an existing entry.  */
-  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (!ci->cert)
-      break;
-  if (!ci)
-    { /* No: Create a new entry.  */
-      ci = xtrycalloc (1, sizeof *ci);
-      if (!ci)
-        return gpg_error_from_errno (errno);
-      ci->next = cert_cache[*fpr];
-      cert_cache[*fpr] = ci;
-    }
-  else
-    memset (&ci->flags, 0, sizeof ci->flags);
+  err = new_cache_slot (fpr, &ci);
+  if (err)
+    return err;
 
   ksba_cert_ref (cert);
   ci->cert = cert;
-  memcpy (ci->fpr, fpr, 20);
   ci->sn = ksba_cert_get_serial (cert);
   ci->issuer_dn = ksba_cert_get_issuer (cert, 0);
   if (!ci->issuer_dn || !ci->sn)
@@ -318,6 +478,7 @@ put_cert (ksba_cert_t cert, int is_loaded, int is_trusted, void *fpr_buffer)
   ci->subject_dn = ksba_cert_get_subject (cert, 0);
   ci->flags.loaded  = !!is_loaded;
   ci->flags.trusted = !!is_trusted;
+  index_cache_slot (ci);
 
   if (is_loaded)
     total_loaded_certificates++;
@@ -328,6 +489,20 @@ put_cert (ksba_cert_t cert, int is_loaded, int is_trusted, void *fpr_buffer)
 }
 
 
+/* Return true if the directory entry NAME is a certificate file;
+   that is of the pattern "*.crt" or "*.der" and not hidden.  */
+static int
+is_cert_file_name (const char *name)
+{
+  size_t n;
+
+  if (*name == '.' || !*name)
+    return 0; /* Skip any hidden files and invalid entries.  */
+  n = strlen (name);
+  return !(n < 5 || (strcmp (name+n-4,".crt") && strcmp (name+n-4,".der")));
+}
+
+
 /* Load certificates from the directory DIRNAME.  All certificates
    matching the pattern "*.crt" or "*.der"  are loaded.  We assume that
    certificates are DER encoded and not PEM encapsulated. The cache
@@ -339,7 +514,6 @@ load_certs_from_dir (const char *dirname, int are_trusted)
   DIR *dir;
   struct dirent *ep;
   char *p;
-  size_t n;
   estream_t fp;
   ksba_reader_t reader;
   ksba_cert_t cert;
@@ -357,10 +531,7 @@ load_certs_from_dir (const char *dirname, int are_trusted)
   while ( (ep=readdir (dir)) )
     {
       p = ep->d_name;
-      if (*p == '.' || !*p)
-        continue; /* Skip any hidden files and invalid entries.  */
-      n = strlen (p);
-      if ( n < 5 || (strcmp (p+n-4,".crt") && strcmp (p+n-4,".der")))
+      if (!is_cert_file_name (p))
         continue; /* Not the desired "*.crt" or "*.der" pattern.  */
 
       xfree (fname);
@@ -424,24 +595,437 @@ load_certs_from_dir (const char *dirname, int are_trusted)
 }
 
 
-/* Initialize the certificate cache if not yet done.  */
+/* Hash the listing of the certificate directory DIRNAME into MD;
+   that is the name, size, modification time and inode of each
+   certificate file.  This is all we look at to see whether the
+   snapshot is still current, thus no file needs to be read.  A
+   different order of the entries only leads to a new snapshot.  */
+static void
+hash_cert_dir (gcry_md_hd_t md, const char *dirname)
+{
+  DIR *dir;
+  struct dirent *ep;
+  struct stat st;
+  char *fname;
+  unsigned char buf[12];
+
+  gcry_md_write (md, dirname, strlen (dirname) + 1);
+  dir = opendir (dirname);
+  if (!dir)
+    return;
+  while ( (ep=readdir (dir)) )
+    {
+      if (!is_cert_file_name (ep->d_name))
+        continue;
+      fname = make_filename (dirname, ep->d_name, NULL);
+      if (!stat (fname, &st))
+        {
+          gcry_md_write (md, ep->d_name, strlen (ep->d_name) + 1);
+          ulongtobuf (buf, (unsigned long)st.st_size);
+          ulongtobuf (buf+4, (unsigned long)st.st_mtime);
+          ulongtobuf (buf+8, (unsigned long)st.st_ino);
+          gcry_md_write (md, buf, sizeof buf);
+        }
+      xfree (fname);
+    }
+  closedir (dir);
+}
+
+
+/* Store the digest of the listing of the directories TRUSTED_DIR and
+   EXTRA_DIR at the 20 byte buffer DIGEST.  */
+static void
+compute_listing_digest (const char *trusted_dir, const char *extra_dir,
+                        unsigned char *digest)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (err)
+    log_fatal ("gcry_md_open failed: %s\n", gpg_strerror (err));
+  hash_cert_dir (md, trusted_dir);
+  hash_cert_dir (md, extra_dir);
+  gcry_md_final (md);
+  memcpy (digest, gcry_md_read (md, GCRY_MD_SHA1), 20);
+  gcry_md_close (md);
+}
+
+
+/* Release the snapshot.  The items taken from it need to be cleaned
+   before.  */
+static void
+release_snapshot (void)
+{
+  if (!snapshot)
+    return;
+#ifndef HAVE_W32_SYSTEM
+  if (snapshot_is_mapped)
+    munmap ((void *)snapshot, snapshot_len);
+  else
+#endif
+    xfree ((void *)snapshot);
+  snapshot = NULL;
+  snapshot_len = 0;
+  snapshot_is_mapped = 0;
+}
+
+
+/* Map the snapshot file FNAME into memory or, where we can't map it,
+   read it.  */
+static gpg_error_t
+read_snapshot (const char *fname)
+{
+#ifdef HAVE_W32_SYSTEM
+  gpg_error_t err;
+  estream_t fp;
+  membuf_t mb;
+  char buffer[4096];
+  size_t n;
+  void *buf;
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  init_membuf (&mb, sizeof buffer);
+  while ((n = es_fread (buffer, 1, sizeof buffer, fp)))
+    put_membuf (&mb, buffer, n);
+  err = es_ferror (fp)? gpg_error_from_syserror () : 0;
+  es_fclose (fp);
+  buf = get_membuf (&mb, &n);
+  if (err || !buf)
+    {
+      if (!err)
+        err = gpg_error_from_syserror ();
+      xfree (buf);
+      return err;
+    }
+  snapshot = buf;
+  snapshot_len = n;
+  snapshot_is_mapped = 0;
+  return 0;
+#else /*!HAVE_W32_SYSTEM*/
+  gpg_error_t err;
+  int fd;
+  struct stat st;
+  void *mem;
+
+  fd = open (fname, O_RDONLY);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+  if (fstat (fd, &st))
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+  if (st.st_size < SNAPSHOT_HDRLEN + 20 || (size_t)st.st_size != st.st_size)
+    {
+      close (fd);
+      return gpg_error (GPG_ERR_INV_DATA);
+    }
+  mem = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mem == MAP_FAILED)
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+  close (fd);
+  snapshot = mem;
+  snapshot_len = st.st_size;
+  snapshot_is_mapped = 1;
+  return 0;
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
+/* Check the snapshot record at P which ends at most at END and store
+   the lengths of its DER image, serial number, issuer and subject at
+   LENS.  Returns the start of the next record or NULL if the record
+   is not valid.  */
+static const unsigned char *
+parse_snapshot_record (const unsigned char *p, const unsigned char *end,
+                       size_t *lens)
+{
+  if (end - p < SNAPSHOT_RECLEN)
+    return NULL;
+  lens[0] = buf32_to_size_t (p + 21);
+  lens[1] = buf32_to_size_t (p + 25);
+  lens[2] = buf32_to_size_t (p + 29);
+  lens[3] = buf32_to_size_t (p + 33);
+  p += SNAPSHOT_RECLEN;
+
+  if (!lens[0] || lens[0] > (size_t)(end - p))
+    return NULL;
+  p += lens[0];
+  if (!lens[1] || lens[1] > (size_t)(end - p)
+      || gcry_sexp_canon_len (p, lens[1], NULL, NULL) != lens[1])
+    return NULL;
+  p += lens[1];
+  if (!lens[2] || lens[2] > (size_t)(end - p) || p[lens[2]-1])
+    return NULL;
+  p += lens[2];
+  if (lens[3] > (size_t)(end - p) || (lens[3] && p[lens[3]-1]))
+    return NULL;
+  return p + lens[3];
+}
+
+
+/* Enter the certificates of the snapshot into the cache if it is
+   valid and has been written for the directory listing with the
+   digest DIGEST.  Returns an error if the snapshot can't be used; the
+   cache is then unchanged.  The cache must be locked.  */
+static gpg_error_t
+load_snapshot (const unsigned char *digest)
+{
+  gpg_error_t err;
+  char *fname;
+  const unsigned char *p, *end;
+  unsigned char csum[20];
+  unsigned int count, i;
+  size_t lens[4];
+  cert_item_t ci;
+
+  fname = make_filename (opt.homedir_cache, SNAPSHOT_NAME, NULL);
+  err = read_snapshot (fname);
+  if (err)
+    {
+      if (gpg_err_code (err) != GPG_ERR_ENOENT)
+        log_info (_("can't read '%s': %s\n"), fname, gpg_strerror (err));
+      xfree (fname);
+      return err;
+    }
+
+  if (snapshot_len < SNAPSHOT_HDRLEN + 20
+      || memcmp (snapshot, SNAPSHOT_MAGIC, 8))
+    goto invalid;
+  if (memcmp (snapshot + 8, digest, 20))
+    {
+      if (opt.verbose)
+        log_info (_("certificate directories changed; rebuilding '%s'\n"),
+                  fname);
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+  gcry_md_hash_buffer (GCRY_MD_SHA1, csum, snapshot, snapshot_len - 20);
+  if (memcmp (csum, snapshot + snapshot_len - 20, 20))
+    goto invalid;
+
+  /* Check all records before we use any of them.  */
+  count = buf32_to_uint (snapshot + 28);
+  end = snapshot + snapshot_len - 20;
+  p = snapshot + SNAPSHOT_HDRLEN;
+  for (i=0; i < count && p; i++)
+    p = parse_snapshot_record (p, end, lens);
+  if (p != end)
+    goto invalid;
+
+  p = snapshot + SNAPSHOT_HDRLEN;
+  for (i=0; i < count; i++)
+    {
+      const unsigned char *rec = p;
+
+      p = parse_snapshot_record (rec, end, lens);
+      err = new_cache_slot (rec + 1, &ci);
+      if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
+        continue;
+      if (err)
+        {
+          log_error (_("error loading certificate from '%s': %s\n"),
+                     fname, gpg_strerror (err));
+          for (i=0; i < 256; i++)
+            for (ci=cert_cache[i]; ci; ci = ci->next)
+              if (ci->flags.mapped)
+                clean_cache_slot (ci);
+          total_loaded_certificates = 0;
+          goto leave;
+        }
+      ci->image = rec + SNAPSHOT_RECLEN;
+      ci->imagelen = lens[0];
+      ci->sn = (ksba_sexp_t)(ci->image + lens[0]);
+      ci->issuer_dn = (char *)ci->sn + lens[1];
+      ci->subject_dn = lens[3]? ci->issuer_dn + lens[2] : NULL;
+      ci->flags.loaded = 1;
+      ci->flags.trusted = !!(*rec & 1);
+      ci->flags.mapped = 1;
+      index_cache_slot (ci);
+      total_loaded_certificates++;
+    }
+
+  log_info (_("%u certificates loaded from '%s'\n"), count, fname);
+  xfree (fname);
+  return 0;
+
+ invalid:
+  log_info (_("ignoring invalid certificate snapshot '%s'\n"), fname);
+  err = gpg_error (GPG_ERR_INV_DATA);
+ leave:
+  release_snapshot ();
+  xfree (fname);
+  return err;
+}
+
+
+/* Write the loaded certificates of the cache to the snapshot for the
+   directory listing with the digest DIGEST.  The snapshot starts with
+   the 8 byte SNAPSHOT_MAGIC, DIGEST and the number of records.  Each
+   record is
+
+     1 byte   flags; bit 0 is set for a trusted certificate
+    20 byte   the fingerprint
+     4 byte   the length of the DER image
+     4 byte   the length of the serial number
+     4 byte   the length of the issuer DN including its Nul
+     4 byte   the length of the subject DN including its Nul or 0
+
+   followed by the DER image, the canonical S-expression with the
+   serial number and the DNs.  The file ends with the SHA-1 digest of
+   everything before.  All numbers are big endian.  The cache must be
+   locked.  */
+static void
+write_snapshot (const unsigned char *digest)
+{
+  gpg_error_t err = 0;
+  membuf_t mb;
+  cert_item_t ci;
+  unsigned char buf[SNAPSHOT_RECLEN];
+  unsigned char *image = NULL;
+  const unsigned char *der;
+  size_t derlen, snlen, issuerlen, subjectlen, len;
+  unsigned int count = 0;
+  char *fname, *tmpfname = NULL;
+  estream_t fp = NULL;
+  int i;
+
+  fname = make_filename (opt.homedir_cache, SNAPSHOT_NAME, NULL);
+
+  init_membuf (&mb, 8192);
+  put_membuf (&mb, SNAPSHOT_MAGIC, 8);
+  put_membuf (&mb, digest, 20);
+  put_membuf (&mb, "\0\0\0\0", 4);  /* The count is filled in below.  */
+  for (i=0; i < 256; i++)
+    for (ci=cert_cache[i]; ci; ci = ci->next)
+      {
+        if (!ci->cert || !ci->flags.loaded)
+          continue;
+        der = ksba_cert_get_image (ci->cert, &derlen);
+        snlen = gcry_sexp_canon_len (ci->sn, 0, NULL, NULL);
+        if (!der || !snlen)
+          continue;
+        issuerlen = strlen (ci->issuer_dn) + 1;
+        subjectlen = ci->subject_dn? strlen (ci->subject_dn) + 1 : 0;
+
+        buf[0] = ci->flags.trusted? 1 : 0;
+        memcpy (buf+1, ci->fpr, 20);
+        ulongtobuf (buf+21, (unsigned long)derlen);
+        ulongtobuf (buf+25, (unsigned long)snlen);
+        ulongtobuf (buf+29, (unsigned long)issuerlen);
+        ulongtobuf (buf+33, (unsigned long)subjectlen);
+        put_membuf (&mb, buf, SNAPSHOT_RECLEN);
+        put_membuf (&mb, der, derlen);
+        put_membuf (&mb, ci->sn, snlen);
+        put_membuf (&mb, ci->issuer_dn, issuerlen);
+        if (subjectlen)
+          put_membuf (&mb, ci->subject_dn, subjectlen);
+        count++;
+      }
+  image = get_membuf (&mb, &len);
+  if (!image)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (!count)
+    {
+      /* Nothing to save; do not keep an outdated snapshot.  */
+      gnupg_remove (fname);
+      goto leave;
+    }
+  ulongtobuf (image + 28, (unsigned long)count);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, buf, image, len);
+
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      /* The cache directory may not be writable for us; this is not
+         an error because we can do without a snapshot.  */
+      if (opt.verbose)
+        log_info (_("can't create '%s': %s\n"), tmpfname, strerror (errno));
+      goto leave;
+    }
+  if (es_fwrite (image, len, 1, fp) != 1 || es_fwrite (buf, 20, 1, fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      fp = NULL;
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      fp = NULL;
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  fp = NULL;
+#ifdef HAVE_W32_SYSTEM
+  /* No atomic mv on W32 systems.  */
+  gnupg_remove (fname);
+#endif
+  if (rename (tmpfname, fname))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (opt.verbose)
+    log_info (_("%u certificates saved to '%s'\n"), count, fname);
+
+ leave:
+  if (err)
+    log_error (_("error writing '%s': %s\n"), fname, gpg_strerror (err));
+  xfree (image);
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Initialize the certificate cache if not yet done.  The
+   certificates are taken from the snapshot if the certificate
+   directories did not change since it was written; otherwise they
+   are loaded from the directories and a new snapshot is written.  The
+   listing is hashed before loading, thus a change while loading only
+   leads to yet another snapshot at the next start.  */
 void
 cert_cache_init (void)
 {
-  char *dname;
+  char *trusted_dir, *extra_dir;
+  unsigned char digest[20];
 
   if (initialization_done)
     return;
   init_cache_lock ();
   acquire_cache_write_lock ();
 
-  dname = make_filename (gnupg_sysconfdir (), "trusted-certs", NULL);
-  load_certs_from_dir (dname, 1);
-  xfree (dname);
-
-  dname = make_filename (gnupg_sysconfdir (), "extra-certs", NULL);
-  load_certs_from_dir (dname, 0);
-  xfree (dname);
+  trusted_dir = make_filename (gnupg_sysconfdir (), "trusted-certs", NULL);
+  extra_dir = make_filename (gnupg_sysconfdir (), "extra-certs", NULL);
+  compute_listing_digest (trusted_dir, extra_dir, digest);
+  if (load_snapshot (digest))
+    {
+      load_certs_from_dir (trusted_dir, 1);
+      load_certs_from_dir (extra_dir, 0);
+      write_snapshot (digest);
+    }
+  xfree (trusted_dir);
+  xfree (extra_dir);
 
   initialization_done = 1;
   release_cache_lock ();
@@ -465,6 +1049,7 @@ cert_cache_deinit (int full)
   for (i=0; i < 256; i++)
     for (ci=cert_cache[i]; ci; ci = ci->next)
       clean_cache_slot (ci);
+  release_snapshot ();
 
   if (full)
     {
@@ -478,6 +1063,8 @@ cert_cache_deinit (int full)
           cert_cache[i] = NULL;
         }
     }
+  memset (subject_index, 0, sizeof subject_index);
+  memset (issuer_index, 0, sizeof issuer_index);
 
   total_loaded_certificates = 0;
   total_extra_certificates = 0;
@@ -546,14 +1133,17 @@ ksba_cert_t
 get_cert_byfpr (const unsigned char *fpr)
 {
   cert_item_t ci;
+  ksba_cert_t cert;
 
   acquire_cache_read_lock ();
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (ci->cert && !memcmp (ci->fpr, fpr, 20))
+    if (ITEM_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
       {
-        ksba_cert_ref (ci->cert);
+        cert = item_cert (ci);
+        if (cert)
+          ksba_cert_ref (cert);
         release_cache_lock ();
-        return ci->cert;
+        return cert;
       }
 
   release_cache_lock ();
@@ -606,22 +1196,20 @@ get_cert_byhexfpr (const char *string)
 ksba_cert_t
 get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 {
-  /* Simple and inefficient implementation.   fixme! */
   cert_item_t ci;
-  int i;
+  ksba_cert_t cert;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
-            && !compare_serialno (ci->sn, serialno))
-          {
-            ksba_cert_ref (ci->cert);
-            release_cache_lock ();
-            return ci->cert;
-          }
-    }
+  for (ci=issuer_index[dn_hash (issuer_dn)]; ci; ci = ci->next_by_issuer)
+    if (ITEM_VALID (ci) && !strcmp (ci->issuer_dn, issuer_dn)
+        && !compare_serialno (ci->sn, serialno))
+      {
+        cert = item_cert (ci);
+        if (cert)
+          ksba_cert_ref (cert);
+        release_cache_lock ();
+        return cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -633,22 +1221,20 @@ get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 ksba_cert_t
 get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
+  ksba_cert_t cert;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=issuer_index[dn_hash (issuer_dn)]; ci; ci = ci->next_by_issuer)
+    if (ITEM_VALID (ci) && !strcmp (ci->issuer_dn, issuer_dn))
+      if (!seq--)
+        {
+          cert = item_cert (ci);
+          if (cert)
+            ksba_cert_ref (cert);
+          release_cache_lock ();
+          return cert;
+        }
 
   release_cache_lock ();
   return NULL;
@@ -660,26 +1246,24 @@ get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 ksba_cert_t
 get_cert_bysubject (const char *subject_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
+  ksba_cert_t cert;
 
   if (!subject_dn)
     return NULL;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && ci->subject_dn
-            && !strcmp (ci->subject_dn, subject_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=subject_index[dn_hash (subject_dn)]; ci; ci = ci->next_by_subject)
+    if (ITEM_VALID (ci) && ci->subject_dn
+        && !strcmp (ci->subject_dn, subject_dn))
+      if (!seq--)
+        {
+          cert = item_cert (ci);
+          if (cert)
+            ksba_cert_ref (cert);
+          release_cache_lock ();
+          return cert;
+        }
 
   release_cache_lock ();
   return NULL;
@@ -1119,21 +1703,22 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
     {
       cert_item_t ci;
       cert_ref_t cr;
-      int i;
 
       /* For efficiency reasons we won't use get_cert_bysubject here. */
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && ci->subject_dn
-              && !strcmp (ci->subject_dn, subject_dn))
-            for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
-              if (!memcmp (ci->fpr, cr->fpr, 20))
-                {
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  return ci->cert; /* We use this certificate. */
-                }
+      for (ci=subject_index[dn_hash (subject_dn)]; ci;
+           ci = ci->next_by_subject)
+        if (ITEM_VALID (ci) && ci->subject_dn
+            && !strcmp (ci->subject_dn, subject_dn))
+          for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
+            if (!memcmp (ci->fpr, cr->fpr, 20))
+              {
+                cert = item_cert (ci);
+                if (cert)
+                  ksba_cert_ref (cert);
+                release_cache_lock ();
+                return cert; /* We use this certificate. */
+              }
       release_cache_lock ();
       if (DBG_LOOKUP)
         log_debug ("find_cert_bysubject: certificate not in ocsp_certs\n");
@@ -1281,7 +1866,7 @@ is_trusted_cert (ksba_cert_t cert)
 
   acquire_cache_read_lock ();
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (ci->cert && !memcmp (ci->fpr, fpr, 20))
+    if (ITEM_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
       {
         if (ci->flags.trusted)
           {
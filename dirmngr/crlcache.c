@@ -68,6 +68,8 @@
         Field 9:  AuthorityKeyID.issuer, each Name separated by 0x01
         Field 10: AuthorityKeyID.serial
         Field 11: Hex fingerprint of trust anchor if field 1 is 'u'.
+        Field 12: optional URL of the delta CRL as given by the
+                  freshestCRL extension of the CRL.
 
    2. Layout of the standard CRL Cache DB file:
 
@@ -76,7 +78,9 @@
       n  bytes  Serialnumber (binary) used as key
                 thus there is no need to store the length explicitly with DB2.
       1  byte   Reason for revocation
-                (currently the KSBA reason flags are used)
+                (currently the KSBA reason flags are used).  In the DB
+                of a delta CRL the value 0xff marks an removeFromCRL
+                entry; these are not copied to the merged DB.
       15 bytes  ISO date of revocation (e.g. 19980815T142000)
                 Note that there is no terminating 0 stored.
 
@@ -101,6 +105,7 @@
 #ifndef HAVE_W32_SYSTEM
 #include <sys/utsname.h>
 #endif
+#include <npth.h>
 #ifdef MKDIR_TAKES_ONE_ARG
 #undef mkdir
 #define mkdir(a,b) mkdir(a)
@@ -113,6 +118,8 @@
 #include "crlfetch.h"
 #include "misc.h"
 #include "cdb.h"
+#include "crldelta.h"
+#include "../common/tlv.h"
 
 /* Change this whenever the format changes */
 #define DBDIR_D (opt.system_daemon? "crls.d" : "dirmngr-cache.d")
@@ -122,13 +129,44 @@
 /* The number of DB files we may have open at one time.  We need to
    limit this because there is no guarantee that the number of issuers
    has a upper limit.  We are currently using mmap, so it is a good
-   idea anyway to limit the number of opened cache files. */
-#define MAX_OPEN_DB_FILES 5
+   idea anyway to limit the number of opened cache files.  Reopening
+   a file is not free: it needs to be mapped again and its pages
+   faulted in; thus we keep enough open for the CRLs of the CAs in
+   active use. */
+#define MAX_OPEN_DB_FILES 32
+
+/* With --crl-prefetch a CRL is fetched again when it expires in less
+   than CRL_PREFETCH_TIME plus a random part of CRL_PREFETCH_JITTER
+   seconds.  The jitter keeps the CRLs of many clients from being
+   fetched at the same time.  A CRL is not fetched again within
+   CRL_PREFETCH_RETRY seconds of its last retrieval.  */
+#define CRL_PREFETCH_TIME   (60*60)
+#define CRL_PREFETCH_JITTER (30*60)
+#define CRL_PREFETCH_RETRY  (30*60)
+
+/* Release the npth lock while cdb_make_finish writes the hash
+   tables of a CDB file.  For a large CRL that takes a while but it
+   touches only the cdb_make object and the temporary file.  */
+static int
+cdb_make_finish_unlocked (struct cdb_make *cdb)
+{
+  int rc;
+  int saved_errno;
+
+  npth_unprotect ();
+  rc = cdb_make_finish (cdb);
+  saved_errno = errno;
+  npth_protect ();
+  errno = saved_errno;
+  return rc;
+}
 
 
 static const char oidstr_crlNumber[] = "2.5.29.20";
 static const char oidstr_issuingDistributionPoint[] = "2.5.29.28";
 static const char oidstr_authorityKeyIdentifier[] = "2.5.29.35";
+static const char oidstr_deltaCRLIndicator[] = "2.5.29.27";
+static const char oidstr_freshestCRL[] = "2.5.29.46";
 
 
 /* Definition of one cached item. */
@@ -152,13 +190,15 @@ struct crl_cache_entry_s
   char *crl_number;
   char *authority_issuer;
   char *authority_serialno;
+  char *delta_url;    /* The URL of the delta CRL or NULL.  */
 
   struct cdb *cdb;             /* The cache file handle or NULL if not open. */
 
   unsigned int cdb_use_count;  /* Current use count. */
-  unsigned int cdb_lru_count;  /* Used for LRU purposes. */
+  unsigned int cdb_lru_count;  /* Value of LRU_TICK at the last use. */
   int dbfile_checked;          /* Set to true if the dbfile_hash value has
                                   been checked one. */
+  int dbfile_bad;              /* The check of the dbfile_hash failed.  */
 };
 
 
@@ -170,6 +210,10 @@ struct crl_cache_s
 
 typedef struct crl_cache_s *crl_cache_t;
 
+/* Bumped for each use of a cache file to find the least recently
+   used one.  */
+static unsigned int lru_tick;
+
 
 /* Prototypes.  */
 static crl_cache_entry_t find_entry (crl_cache_entry_t first,
@@ -608,6 +652,10 @@ open_dir (crl_cache_t *r_cache)
                   if (*p)
                     entry->check_trust_anchor = xtrystrdup (p);
                   break;
+                case 12:
+                  if (*p)
+                    entry->delta_url = unpercent_string (p);
+                  break;
                 default:
                   if (*p)
                     log_info (_("extra field detected in crl record of "
@@ -760,6 +808,11 @@ write_dir_line_crl (estream_t fp, crl_cache_entry_t e)
   es_putc (':', fp);
   if (e->check_trust_anchor && e->user_trust_req)
     es_fputs (e->check_trust_anchor, fp);
+  if (e->delta_url)
+    {
+      es_putc (':', fp);
+      write_percented_string (e->delta_url, fp);
+    }
   es_putc ('\n', fp);
 }
 
@@ -1076,6 +1129,7 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   if (entry->cdb)
     {
       entry->cdb_use_count++;
+      entry->cdb_lru_count = ++lru_tick;
       return entry->cdb;
     }
 
@@ -1123,10 +1177,15 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   if (opt.verbose)
     log_info (_("opening cache file '%s'\n"), fname );
 
-  if (!entry->dbfile_checked)
+  if (!entry->dbfile_checked && !entry->dbfile_bad)
     {
+      /* Hashing a large CRL is expensive; thus we check the file only
+         once for this entry.  A bad file is replaced only by loading
+         the CRL again, which creates a new entry.  */
       if (!check_dbfile (fname, entry->dbfile_hash))
         entry->dbfile_checked = 1;
+      else
+        entry->dbfile_bad = 1;
       /* Note, in case of an error we don't print an error here but
          let require the caller to do that check. */
     }
@@ -1160,7 +1219,7 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   xfree (fname);
 
   entry->cdb_use_count = 1;
-  entry->cdb_lru_count = 0;
+  entry->cdb_lru_count = ++lru_tick;
 
   return entry->cdb;
 }
@@ -1176,7 +1235,6 @@ unlock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   else
     {
       entry->cdb_use_count--;
-      entry->cdb_lru_count++;
     }
 
   /* If the entry was marked for deletion in the meantime do it now.
@@ -1624,8 +1682,11 @@ finish_sig_check (ksba_crl_t crl, gcry_md_hd_t md, int algo,
       goto leave;
     }
 
-  /* Pass this on to the signature verification. */
+  /* Pass this on to the signature verification.  This is pure
+     computation; other connections may run meanwhile.  */
+  npth_unprotect ();
   err = gcry_pk_verify (s_sig, s_hash, s_pkey);
+  npth_protect ();
   if (DBG_X509)
     log_debug ("gcry_pk_verify: %s\n", gpg_strerror (err));
 
@@ -1679,6 +1740,7 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
   gcry_md_hd_t md = NULL;
   int algo = 0;
   size_t n;
+  unsigned long nitems = 0;
 
   (void)fname;
 
@@ -1746,7 +1808,10 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
             p = serial_to_buffer (serial, &n);
             if (!p)
               BUG ();
-            record[0] = (reason & 0xff);
+            if ((reason & KSBA_CRLREASON_REMOVE_FROM_CRL))
+              record[0] = CRL_REMOVE_MARK;
+            else
+              record[0] = (reason & 0xff);
             memcpy (record+1, rdate, 15);
             rc = cdb_make_add (cdb, p, n, record, 1+15);
             if (rc)
@@ -1759,6 +1824,11 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
               }
 
             ksba_free (serial);
+
+            /* The old cache file stays in use until we are done;
+               thus other threads may well look up this issuer.  */
+            if (!(++nitems % CRL_YIELD_ITEMS))
+              npth_usleep (0);
           }
           break;
 
@@ -1946,6 +2016,226 @@ get_auth_key_id (ksba_crl_t crl, char **serialno)
 
 
 
+/* Return true if the URL of length LEN may be used to fetch a CRL.  */
+static int
+usable_crl_url_p (const char *url, size_t len)
+{
+  if ((len > 5 && !strncmp (url, "ldap:", 5))
+      || (len > 6 && !strncmp (url, "ldaps:", 6)))
+    return !opt.ignore_ldap_dp;
+  if ((len > 5 && !strncmp (url, "http:", 5))
+      || (len > 6 && !strncmp (url, "https:", 6)))
+    return !opt.ignore_http_dp;
+  return 0;
+}
+
+
+/* Return the first usable URL of the freshestCRL extension of CRL or
+   NULL.  The caller must xfree the result.  */
+static char *
+get_delta_crl_url (ksba_crl_t crl)
+{
+  int idx, crit, class, tag, cons, ndef;
+  const char *oid;
+  const unsigned char *der;
+  size_t derlen, len, nhdr;
+  char *url;
+
+  for (idx=0; !ksba_crl_get_extension (crl, idx, &oid, &crit, &der, &derlen);
+       idx++)
+    {
+      if (strcmp (oid, oidstr_freshestCRL))
+        continue;
+
+      /* The extension has the syntax of CRLDistributionPoints.  We
+         don't need the structure and take the first URI, that is a
+         primitive [6], we come across.  */
+      while (derlen)
+        {
+          if (parse_ber_header (&der, &derlen, &class, &tag, &cons, &ndef,
+                                &len, &nhdr)
+              || ndef || len > derlen)
+            break;
+          if (cons)
+            continue; /* Look into it.  */
+          if (class == CLASS_CONTEXT && tag == 6
+              && usable_crl_url_p ((const char *)der, len))
+            {
+              url = xtrymalloc (len + 1);
+              if (!url)
+                return NULL;
+              memcpy (url, der, len);
+              url[len] = 0;
+              return url;
+            }
+          der += len;
+          derlen -= len;
+        }
+      break;
+    }
+  return NULL;
+}
+
+
+/* If CRL is a delta CRL store the hex encoded number of its base CRL
+   at R_NUMBER and return 0.  Returns GPG_ERR_NOT_FOUND for a complete
+   CRL.  */
+static gpg_error_t
+get_delta_base_number (ksba_crl_t crl, char **r_number)
+{
+  gpg_error_t err;
+  int idx, crit, class, tag, cons, ndef;
+  const char *oid;
+  const unsigned char *der;
+  size_t derlen, len, nhdr;
+
+  *r_number = NULL;
+  for (idx=0; !(err=ksba_crl_get_extension (crl, idx, &oid, &crit,
+                                            &der, &derlen)); idx++)
+    {
+      if (strcmp (oid, oidstr_deltaCRLIndicator))
+        continue;
+
+      err = parse_ber_header (&der, &derlen, &class, &tag, &cons, &ndef,
+                              &len, &nhdr);
+      if (!err && (class != CLASS_UNIVERSAL || tag != TAG_INTEGER
+                   || cons || ndef || !len || len > derlen))
+        err = gpg_error (GPG_ERR_INV_CRL);
+      if (err)
+        return err;
+      *r_number = hexify_data (der, len);
+      return 0;
+    }
+  if (gpg_err_code (err) == GPG_ERR_EOF
+      || gpg_err_code (err) == GPG_ERR_NO_DATA)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+  return err;
+}
+
+
+/* Merge the DB of a delta CRL at FNAME with the DB of the cached
+   complete CRL of the issuer ISSUER_HASH.  BASE_NUMBER is the number
+   of the base CRL the delta refers to and THISUPDATE the time of the
+   delta CRL.  On success the merged DB is stored in a new temporary
+   file whose name is stored at R_FNAME and the entry of the complete
+   CRL at R_BASE.  */
+static gpg_error_t
+merge_delta_crl (crl_cache_t cache, const char *issuer_hash,
+                 const char *base_number, const char *thisupdate,
+                 const char *fname, char **r_fname,
+                 crl_cache_entry_t *r_base)
+{
+  gpg_error_t err;
+  crl_cache_entry_t base;
+  struct cdb *basecdb;
+  struct cdb deltacdb;
+  struct cdb_make cdb;
+  char *newfname;
+  int fd_delta = -1;
+  int fd_cdb = -1;
+
+  *r_fname = NULL;
+  *r_base = NULL;
+
+  /* We need a complete CRL at least as new as the base of the delta;
+     the delta then lists all changes since that CRL.  */
+  base = find_entry (cache->entries, issuer_hash);
+  if (!base || base->invalid || !base->crl_number
+      || crl_compare_numbers (base->crl_number, base_number) < 0
+      || strcmp (base->this_update, thisupdate) > 0)
+    {
+      log_info (_("no suitable base CRL for the delta CRL"
+                  " of issuer id %s\n"), issuer_hash);
+      return gpg_error (GPG_ERR_NO_CRL_KNOWN);
+    }
+
+  basecdb = lock_db_file (cache, base);
+  if (!basecdb)
+    return gpg_error (GPG_ERR_NO_CRL_KNOWN);
+  if (!base->dbfile_checked)
+    {
+      log_error (_("cached CRL for issuer id %s tampered; we need to update\n")
+                 , issuer_hash);
+      unlock_db_file (cache, base);
+      return gpg_error (GPG_ERR_NO_CRL_KNOWN);
+    }
+
+  newfname = strconcat (fname, ".merge", NULL);
+  if (!newfname)
+    {
+      err = gpg_error_from_syserror ();
+      unlock_db_file (cache, base);
+      return err;
+    }
+
+  fd_delta = open (fname, O_RDONLY);
+  if (fd_delta == -1 || cdb_init (&deltacdb, fd_delta))
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error initializing cache file '%s' for reading: %s\n"),
+                 fname, gpg_strerror (err));
+      if (fd_delta != -1)
+        close (fd_delta);
+      fd_delta = -1;
+      goto leave;
+    }
+
+  fd_cdb = open (newfname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_cdb == -1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error creating temporary cache file '%s': %s\n"),
+                 newfname, gpg_strerror (err));
+      goto leave;
+    }
+  cdb_make_start (&cdb, fd_cdb);
+
+  err = crl_delta_merge (&cdb, basecdb, &deltacdb);
+  if (err)
+    {
+      log_error (_("error merging the delta CRL: %s\n"), gpg_strerror (err));
+      cdb_make_finish (&cdb);
+      goto leave;
+    }
+  if (cdb_make_finish_unlocked (&cdb))
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error finishing temporary cache file '%s': %s\n"),
+                 newfname, gpg_strerror (err));
+      goto leave;
+    }
+  if (close (fd_cdb))
+    {
+      fd_cdb = -1;
+      err = gpg_error_from_syserror ();
+      log_error (_("error closing temporary cache file '%s': %s\n"),
+                 newfname, gpg_strerror (err));
+      goto leave;
+    }
+  fd_cdb = -1;
+
+  *r_fname = newfname;
+  newfname = NULL;
+  *r_base = base;
+
+ leave:
+  if (fd_delta != -1)
+    {
+      cdb_free (&deltacdb);
+      close (fd_delta);
+    }
+  if (fd_cdb != -1)
+    close (fd_cdb);
+  if (newfname)
+    {
+      gnupg_remove (newfname);
+      xfree (newfname);
+    }
+  unlock_db_file (cache, base);
+  return err;
+}
+
+
 /* Insert the CRL retrieved using URL into the cache specified by
    CACHE.  The CRL itself will be read from the stream FP and is
    expected in binary format.
@@ -1983,6 +2273,10 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   const char *oid;
   int critical;
   char *trust_anchor = NULL;
+  char *base_number = NULL;
+  crl_cache_entry_t base = NULL;
+  const char *entry_url;
+  char *delta_url = NULL;
 
   /* FIXME: We should acquire a mutex for the URL, so that we don't
      simultaneously enter the same CRL twice.  However this needs to be
@@ -2065,7 +2359,7 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
 
   /* Finish the database. */
-  if (cdb_make_finish (&cdb))
+  if (cdb_make_finish_unlocked (&cdb))
     {
       err = gpg_error_from_errno (errno);
       log_error (_("error finishing temporary cache file '%s': %s\n"),
@@ -2081,6 +2375,36 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   fd_cdb = -1;
 
+  /* Create an hex encoded SHA-1 hash of the issuer DN to be
+     used as the key for the cache. */
+  issuer_hash = hashify_data (issuer, strlen (issuer));
+
+  /* A delta CRL is merged with the cached complete CRL.  From now on
+     the merged DB is handled like the DB of a complete CRL.  */
+  err = get_delta_base_number (crl, &base_number);
+  if (!err)
+    {
+      char *mergedfname;
+
+      err = merge_delta_crl (cache, issuer_hash, base_number, thisupdate,
+                             fname, &mergedfname, &base);
+      if (err)
+        goto leave;
+      gnupg_remove (fname);
+      xfree (fname);
+      fname = mergedfname;
+      if (opt.verbose)
+        log_info (_("delta CRL merged with the CRL number %s\n"),
+                  base->crl_number);
+    }
+  else if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    err = 0;
+  else
+    {
+      log_error (_("error reading CRL extensions: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
 
   /* Create a checksum. */
   {
@@ -2118,7 +2442,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     {
       if (!critical
           || !strcmp (oid, oidstr_authorityKeyIdentifier)
-          || !strcmp (oid, oidstr_crlNumber) )
+          || !strcmp (oid, oidstr_crlNumber)
+          || (base && !strcmp (oid, oidstr_deltaCRLIndicator)))
         continue;
       log_error (_("unknown critical CRL extension %s\n"), oid);
       if (!err2)
@@ -2135,9 +2460,18 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
 
 
-  /* Create an hex encoded SHA-1 hash of the issuer DN to be
-     used as the key for the cache. */
-  issuer_hash = hashify_data (issuer, strlen (issuer));
+  /* The entry of a merged delta CRL keeps the URL of the complete CRL
+     and remembers where the delta came from.  */
+  if (base)
+    {
+      entry_url = base->url;
+      delta_url = xtrystrdup (url);
+    }
+  else
+    {
+      entry_url = url;
+      delta_url = get_delta_crl_url (crl);
+    }
 
   /* Create an ENTRY. */
   entry = xtrycalloc (1, sizeof *entry);
@@ -2148,8 +2482,9 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   entry->release_ptr = xtrymalloc (strlen (issuer_hash) + 1
                                    + strlen (issuer) + 1
-                                   + strlen (url) + 1
-                                   + strlen (checksum) + 1);
+                                   + strlen (entry_url) + 1
+                                   + strlen (checksum) + 1
+                                   + (delta_url? strlen (delta_url) + 1 : 0));
   if (!entry->release_ptr)
     {
       err = gpg_error_from_syserror ();
@@ -2160,8 +2495,14 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   entry->issuer_hash = entry->release_ptr;
   entry->issuer = stpcpy (entry->issuer_hash, issuer_hash) + 1;
   entry->url = stpcpy (entry->issuer, issuer) + 1;
-  entry->dbfile_hash = stpcpy (entry->url, url) + 1;
-  strcpy (entry->dbfile_hash, checksum);
+  entry->dbfile_hash = stpcpy (entry->url, entry_url) + 1;
+  if (delta_url)
+    {
+      entry->delta_url = stpcpy (entry->dbfile_hash, checksum) + 1;
+      strcpy (entry->delta_url, delta_url);
+    }
+  else
+    strcpy (entry->dbfile_hash, checksum);
   gnupg_copy_time (entry->this_update, thisupdate);
   gnupg_copy_time (entry->next_update, nextupdate);
   gnupg_copy_time (entry->last_refresh, current_time);
@@ -2248,6 +2589,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   xfree (issuer_hash);
   xfree (checksum);
   xfree (trust_anchor);
+  xfree (base_number);
+  xfree (delta_url);
   return err ? err : err2;
 }
 
@@ -2347,6 +2690,13 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
         es_fprintf (fp, "%02X", keyrecord[i]);
       es_fputs (":\t reasons( ", fp);
 
+      if (reason == CRL_REMOVE_MARK)
+        {
+          es_fputs ("remove_from_crl ", fp);
+          reason = 0;
+          any = 1;
+        }
+
       if (reason & KSBA_CRLREASON_UNSPECIFIED)
         es_fputs( "unspecified ", fp ), any = 1;
       if (reason & KSBA_CRLREASON_KEY_COMPROMISE )
@@ -2422,6 +2772,60 @@ crl_cache_load (ctrl_t ctrl, const char *filename)
 }
 
 
+/* Fetch the CRL from URL and store it in the cache.  */
+static gpg_error_t
+fetch_crl_into_cache (ctrl_t ctrl, const char *url)
+{
+  gpg_error_t err;
+  ksba_reader_t reader;
+
+  err = crl_fetch (ctrl, url, &reader);
+  if (err)
+    {
+      log_error (_("crl_fetch via DP failed: %s\n"), gpg_strerror (err));
+      return err;
+    }
+  err = crl_cache_insert (ctrl, url, reader);
+  crl_close_reader (reader);
+  if (err)
+    log_error (_("crl_cache_insert via DP failed: %s\n"), gpg_strerror (err));
+  return err;
+}
+
+
+/* If the cached CRL of the issuer of CERT names a delta CRL, fetch
+   that one and merge it into the cache.  */
+static gpg_error_t
+reload_delta_crl (ctrl_t ctrl, ksba_cert_t cert)
+{
+  gpg_error_t err;
+  crl_cache_entry_t entry;
+  char *issuer, *issuer_hash;
+  char *url;
+
+  issuer = ksba_cert_get_issuer (cert, 0);
+  if (!issuer)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  issuer_hash = hashify_data (issuer, strlen (issuer));
+  ksba_free (issuer);
+  entry = find_entry (get_current_cache ()->entries, issuer_hash);
+  xfree (issuer_hash);
+  if (!entry || !entry->delta_url
+      || !usable_crl_url_p (entry->delta_url, strlen (entry->delta_url)))
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  /* The entry may be replaced while we are fetching.  */
+  url = xtrystrdup (entry->delta_url);
+  if (!url)
+    return gpg_error_from_syserror ();
+  if (opt.verbose)
+    log_info ("fetching delta CRL from '%s'\n", url);
+  err = fetch_crl_into_cache (ctrl, url);
+  xfree (url);
+  return err;
+}
+
+
 /* Locate the corresponding CRL for the certificate CERT, read and
    verify the CRL and store it in the cache.  */
 gpg_error_t
@@ -2437,6 +2841,11 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   int any_dist_point = 0;
   int seq;
 
+  /* A delta CRL is usually much smaller than the complete CRL.  If
+     that does not work out we fall back to the complete CRL.  */
+  if (!reload_delta_crl (ctrl, cert))
+    return 0;
+
   /* Loop over all distribution points, get the CRLs and put them into
      the cache. */
   if (opt.verbose)
@@ -2578,3 +2987,84 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   ksba_free (issuer);
   return err;
 }
+
+
+/* Fetch those cached CRLs again which are about to expire.  This is
+   called by the housekeeping thread if --crl-prefetch is used.  CRLs
+   which have not been retrieved from an URL are skipped.  */
+void
+crl_cache_housekeeping (void)
+{
+  gpg_error_t err;
+  crl_cache_entry_t e;
+  gnupg_isotime_t current_time, tmptime;
+  unsigned char rnd[2];
+  strlist_t urls = NULL;
+  strlist_t sl;
+  ctrl_t ctrl;
+
+  if (!current_cache)
+    return;
+
+  gnupg_get_isotime (current_time);
+  for (e = current_cache->entries; e; e = e->next)
+    {
+      if (e->deleted || e->invalid || !*e->next_update || !e->url)
+        continue;
+      if (strncmp (e->url, "http:", 5) && strncmp (e->url, "https:", 6)
+          && strncmp (e->url, "ldap:", 5) && strncmp (e->url, "ldaps:", 6))
+        continue;
+
+      if (*e->last_refresh)
+        {
+          gnupg_copy_time (tmptime, e->last_refresh);
+          add_seconds_to_isotime (tmptime, CRL_PREFETCH_RETRY);
+          if (strcmp (tmptime, current_time) > 0)
+            continue;
+        }
+
+      gcry_create_nonce (rnd, sizeof rnd);
+      gnupg_copy_time (tmptime, current_time);
+      add_seconds_to_isotime (tmptime, (CRL_PREFETCH_TIME
+                                        + ((rnd[0] << 8 | rnd[1])
+                                           % CRL_PREFETCH_JITTER)));
+      if (strcmp (e->next_update, tmptime) < 0)
+        {
+          /* The list is built backwards; thus the delta CRL comes
+             first and the complete CRL is only fetched if the delta
+             could not be used.  */
+          add_to_strlist (&urls, e->url);
+          if (e->delta_url
+              && usable_crl_url_p (e->delta_url, strlen (e->delta_url)))
+            add_to_strlist (&urls, e->delta_url)->flags = 1;
+        }
+    }
+  if (!urls)
+    return;
+
+  /* The entries may be replaced while we fetch the CRLs; thus we
+     work on the copied URLs.  */
+  ctrl = xtrycalloc (1, sizeof *ctrl);
+  if (!ctrl)
+    {
+      log_error ("error allocating control structure: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      free_strlist (urls);
+      return;
+    }
+  dirmngr_init_default_ctrl (ctrl);
+
+  for (sl = urls; sl; sl = sl->next)
+    {
+      if (opt.verbose)
+        log_info ("prefetching %sCRL from '%s'\n",
+                  sl->flags? "delta ":"", sl->d);
+      err = fetch_crl_into_cache (ctrl, sl->d);
+      if (!err && sl->flags && sl->next)
+        sl = sl->next;  /* Skip the complete CRL.  */
+    }
+
+  dirmngr_deinit_default_ctrl (ctrl);
+  xfree (ctrl);
+  free_strlist (urls);
+}
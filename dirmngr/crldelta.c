@@ -0,0 +1,127 @@
+/* crldelta.c - Merging delta CRLs into cached CRLs
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The cache DB of a CRL maps the binary serial numbers of the revoked
+   certificates to a record of 16 bytes: the reason byte followed by
+   the ISO time of the revocation.  A delta CRL lists only the changes
+   since its base CRL; certificates no longer revoked are listed with
+   the removeFromCRL reason, which is stored as CRL_REMOVE_MARK.  The
+   DB of the current CRL is then made up of the records of the delta
+   except for those removals and of the records of the base whose
+   serial number the delta does not list.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "util.h"
+#include "i18n.h"
+#include "crldelta.h"
+
+
+/* Compare the hex encoded CRL numbers A and B.  Returns a value less
+   than, equal to or greater than zero like strcmp.  */
+int
+crl_compare_numbers (const char *a, const char *b)
+{
+  size_t alen, blen;
+
+  while (*a == '0')
+    a++;
+  while (*b == '0')
+    b++;
+  alen = strlen (a);
+  blen = strlen (b);
+  if (alen != blen)
+    return alen < blen? -1 : 1;
+  return ascii_strcasecmp (a, b);
+}
+
+
+/* Add all records of CDB to the DB built at CDBMAKE.  If DELTA is not
+   NULL records whose key is also in DELTA are skipped.  If DELTA is
+   NULL the removeFromCRL records are skipped.  */
+static gpg_error_t
+copy_crl_records (struct cdb_make *cdbmake, struct cdb *cdb,
+                  struct cdb *delta)
+{
+  struct cdb_find cdbfp;
+  unsigned char key[256];
+  unsigned char record[16];
+  cdbi_t keylen;
+  unsigned long count = 0;
+  int rc;
+
+  rc = cdb_findinit (&cdbfp, cdb, NULL, 0);
+  while (!rc && (rc = cdb_findnext (&cdbfp)) > 0)
+    {
+      rc = 0;
+      keylen = cdb_keylen (cdb);
+      if (keylen > sizeof key || cdb_datalen (cdb) != sizeof record)
+        {
+          log_error (_(" WARNING: invalid cache record length\n"));
+          continue;
+        }
+      if (cdb_read (cdb, key, keylen, cdb_keypos (cdb))
+          || cdb_read (cdb, record, sizeof record, cdb_datapos (cdb)))
+        return gpg_error_from_syserror ();
+
+      if (delta)
+        {
+          rc = cdb_find (delta, key, keylen);
+          if (rc < 0)
+            return gpg_error_from_syserror ();
+          if (rc)
+            {
+              rc = 0;
+              continue; /* The delta CRL has the current state.  */
+            }
+        }
+      else if (*record == CRL_REMOVE_MARK)
+        continue;
+
+      if (cdb_make_add (cdbmake, key, keylen, record, sizeof record))
+        return gpg_error_from_syserror ();
+
+      if (!(++count % CRL_YIELD_ITEMS))
+        npth_usleep (0);
+    }
+  if (rc < 0)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Add the records of the DB of a complete CRL, BASECDB, merged with
+   those of the DB of a delta CRL, DELTACDB, to the DB built at
+   CDBMAKE.  */
+gpg_error_t
+crl_delta_merge (struct cdb_make *cdbmake,
+                 struct cdb *basecdb, struct cdb *deltacdb)
+{
+  gpg_error_t err;
+
+  err = copy_crl_records (cdbmake, deltacdb, NULL);
+  if (!err)
+    err = copy_crl_records (cdbmake, basecdb, deltacdb);
+  return err;
+}
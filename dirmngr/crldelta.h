@@ -0,0 +1,37 @@
+/* crldelta.h - Merging delta CRLs into cached CRLs
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIRMNGR_CRLDELTA_H
+#define DIRMNGR_CRLDELTA_H 1
+
+#include "cdb.h"
+
+/* The reason byte of a removeFromCRL entry of a delta CRL.  */
+#define CRL_REMOVE_MARK 0xff
+
+/* Parsing a large CRL takes a long time without giving other threads
+   a chance to run.  Thus we let them run after each bunch of
+   CRL_YIELD_ITEMS items.  */
+#define CRL_YIELD_ITEMS 1000
+
+int crl_compare_numbers (const char *a, const char *b);
+gpg_error_t crl_delta_merge (struct cdb_make *cdbmake,
+                             struct cdb *basecdb, struct cdb *deltacdb);
+
+#endif /*DIRMNGR_CRLDELTA_H*/
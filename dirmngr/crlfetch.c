@@ -197,7 +197,8 @@ crl_fetch (ctrl_t ctrl, const char *url, ksba_reader_t *reader)
       else
         err = http_open_document (&hd, url, NULL,
                                   (opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0)
-                                  |(DBG_LOOKUP? HTTP_FLAG_LOG_RESP:0),
+                                  |(DBG_LOOKUP? HTTP_FLAG_LOG_RESP:0)
+                                  |HTTP_FLAG_KEEP_ALIVE|HTTP_FLAG_COMPRESS,
                                   ctrl->http_proxy, NULL, NULL, NULL);
 
       switch ( err? 99999 : http_get_status_code (hd) )
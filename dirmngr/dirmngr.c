@@ -57,6 +57,10 @@
 
 #include "certcache.h"
 #include "crlcache.h"
+#include "ocsp.h"
+#include "ocsp-cache.h"
+#include "ks-cache.h"
+#include "dns-cache.h"
 #include "crlfetch.h"
 #include "misc.h"
 #if USE_LDAP
@@ -113,11 +117,13 @@ enum cmd_and_opt_values {
   oHomedir,
   oNoDetach,
   oLogFile,
+  oAsyncLog,
   oBatch,
   oDisableHTTP,
   oDisableLDAP,
   oIgnoreLDAPDP,
   oIgnoreHTTPDP,
+  oCRLPrefetch,
   oIgnoreOCSPSvcUrl,
   oHonorHTTPProxy,
   oHTTPProxy,
@@ -125,14 +131,19 @@ enum cmd_and_opt_values {
   oOnlyLDAPProxy,
   oLDAPFile,
   oLDAPTimeout,
+  oLDAPMaxWorkers,
   oLDAPAddServers,
   oOCSPResponder,
   oOCSPSigner,
   oOCSPMaxClockSkew,
   oOCSPMaxPeriod,
   oOCSPCurrentPeriod,
+  oOCSPCacheMaxAge,
+  oOCSPRequireNonce,
   oMaxReplies,
   oHkpCaCert,
+  oKeyserverCacheTTL,
+  oKeyserverCacheSize,
   oFakedSystemTime,
   oForce,
   oAllowOCSP,
@@ -174,6 +185,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oNoDetach, "no-detach", N_("do not detach from the console")),
   ARGPARSE_s_s (oLogFile,  "log-file",
                 N_("|FILE|write server mode logs to FILE")),
+  ARGPARSE_s_n (oAsyncLog, "async-log", "@"),
   ARGPARSE_s_n (oBatch,    "batch",       N_("run without asking a user")),
   ARGPARSE_s_n (oForce,    "force",       N_("force loading of outdated CRLs")),
   ARGPARSE_s_n (oAllowOCSP, "allow-ocsp", N_("allow sending OCSP requests")),
@@ -185,6 +197,7 @@ static ARGPARSE_OPTS opts[] = {
                 N_("ignore LDAP CRL distribution points")),
   ARGPARSE_s_n (oIgnoreOCSPSvcUrl, "ignore-ocsp-service-url",
                 N_("ignore certificate contained OCSP service URLs")),
+  ARGPARSE_s_n (oCRLPrefetch, "crl-prefetch", "@"),
 
   ARGPARSE_s_s (oHTTPProxy,  "http-proxy",
                 N_("|URL|redirect all HTTP requests to URL")),
@@ -200,6 +213,7 @@ static ARGPARSE_OPTS opts[] = {
                    " points to serverlist")),
   ARGPARSE_s_i (oLDAPTimeout, "ldaptimeout",
                 N_("|N|set LDAP timeout to N seconds")),
+  ARGPARSE_s_i (oLDAPMaxWorkers, "ldap-max-workers", "@"),
 
   ARGPARSE_s_s (oOCSPResponder, "ocsp-responder",
                 N_("|URL|use OCSP responder at URL")),
@@ -208,12 +222,16 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_i (oOCSPMaxClockSkew, "ocsp-max-clock-skew", "@"),
   ARGPARSE_s_i (oOCSPMaxPeriod,    "ocsp-max-period", "@"),
   ARGPARSE_s_i (oOCSPCurrentPeriod, "ocsp-current-period", "@"),
+  ARGPARSE_s_i (oOCSPCacheMaxAge, "ocsp-cache-max-age", "@"),
+  ARGPARSE_s_s (oOCSPRequireNonce, "ocsp-require-nonce", "@"),
 
   ARGPARSE_s_i (oMaxReplies, "max-replies",
                 N_("|N|do not return more than N items in one query")),
 
   ARGPARSE_s_s (oHkpCaCert, "hkp-cacert",
                 N_("|FILE|use the CA certificates in FILE for HKP over TLS")),
+  ARGPARSE_s_i (oKeyserverCacheTTL, "keyserver-cache-ttl", "@"),
+  ARGPARSE_s_i (oKeyserverCacheSize, "keyserver-cache-size", "@"),
 
 
   ARGPARSE_s_s (oSocketName, "socket-name", "@"),  /* Only for debugging.  */
@@ -239,6 +257,8 @@ static ARGPARSE_OPTS opts[] = {
 
 #define DEFAULT_MAX_REPLIES 10
 #define DEFAULT_LDAP_TIMEOUT 100 /* arbitrary large timeout */
+#define DEFAULT_LDAP_MAX_WORKERS 4
+#define DEFAULT_KS_CACHE_SIZE 32 /* Megabytes.  */
 
 /* For the cleanup handler we need to keep track of the socket's name.  */
 static const char *socket_name;
@@ -486,13 +506,18 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       opt.only_ldap_proxy = 0;
       opt.ignore_http_dp = 0;
       opt.ignore_ldap_dp = 0;
+      opt.crl_prefetch = 0;
       opt.ignore_ocsp_service_url = 0;
       opt.allow_ocsp = 0;
       opt.ocsp_responder = NULL;
       opt.ocsp_max_clock_skew = 10 * 60;      /* 10 minutes.  */
       opt.ocsp_max_period = 90 * 86400;       /* 90 days.  */
       opt.ocsp_current_period = 3 * 60 * 60;  /* 3 hours. */
+      opt.ocsp_cache_max_age = 0;
+      FREE_STRLIST (opt.ocsp_require_nonce);
       opt.max_replies = DEFAULT_MAX_REPLIES;
+      opt.ks_cache_ttl = 0;
+      opt.ks_cache_size = DEFAULT_KS_CACHE_SIZE;
       while (opt.ocsp_signer)
         {
           fingerprint_list_t tmp = opt.ocsp_signer->next;
@@ -539,6 +564,7 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oLDAPProxy: opt.ldap_proxy = pargs->r.ret_str; break;
     case oOnlyLDAPProxy: opt.only_ldap_proxy = 1; break;
     case oIgnoreHTTPDP: opt.ignore_http_dp = 1; break;
+    case oCRLPrefetch: opt.crl_prefetch = 1; break;
     case oIgnoreLDAPDP: opt.ignore_ldap_dp = 1; break;
     case oIgnoreOCSPSvcUrl: opt.ignore_ocsp_service_url = 1; break;
 
@@ -550,6 +576,10 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oOCSPMaxClockSkew: opt.ocsp_max_clock_skew = pargs->r.ret_int; break;
     case oOCSPMaxPeriod: opt.ocsp_max_period = pargs->r.ret_int; break;
     case oOCSPCurrentPeriod: opt.ocsp_current_period = pargs->r.ret_int; break;
+    case oOCSPCacheMaxAge: opt.ocsp_cache_max_age = pargs->r.ret_int; break;
+    case oOCSPRequireNonce:
+      add_to_strlist (&opt.ocsp_require_nonce, pargs->r.ret_str);
+      break;
 
     case oMaxReplies: opt.max_replies = pargs->r.ret_int; break;
 
@@ -557,6 +587,9 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       http_register_tls_ca (pargs->r.ret_str);
       break;
 
+    case oKeyserverCacheTTL: opt.ks_cache_ttl = pargs->r.ret_int; break;
+    case oKeyserverCacheSize: opt.ks_cache_size = pargs->r.ret_int; break;
+
     case oIgnoreCertExtension:
       add_to_strlist (&opt.ignored_cert_extensions, pargs->r.ret_str);
       break;
@@ -640,6 +673,7 @@ main (int argc, char **argv)
   int greeting = 0;
   int nogreeting = 0;
   int nodetach = 0;
+  int async_log = 0;
   int csh_style = 0;
   char *logfile = NULL;
 #if USE_LDAP
@@ -745,6 +779,7 @@ main (int argc, char **argv)
   /* LDAP defaults.  */
   opt.add_new_ldapservers = 0;
   opt.ldaptimeout = DEFAULT_LDAP_TIMEOUT;
+  opt.ldap_max_workers = DEFAULT_LDAP_MAX_WORKERS;
 
   /* Other defaults.  */
 
@@ -885,6 +920,7 @@ main (int argc, char **argv)
         case oHomedir: /* Ignore this option here. */; break;
         case oNoDetach: nodetach = 1; break;
         case oLogFile: logfile = pargs.r.ret_str; break;
+        case oAsyncLog: async_log = 1; break;
         case oCsh: csh_style = 1; break;
         case oSh: csh_style = 0; break;
 	case oLDAPFile:
@@ -896,6 +932,9 @@ main (int argc, char **argv)
 	case oLDAPTimeout:
 	  opt.ldaptimeout = pargs.r.ret_int;
 	  break;
+	case oLDAPMaxWorkers:
+	  opt.ldap_max_workers = pargs.r.ret_int;
+	  break;
 
         case oFakedSystemTime:
           gnupg_set_time ((time_t)pargs.r.ret_ulong, 0);
@@ -1023,6 +1062,8 @@ main (int argc, char **argv)
 
       cert_cache_init ();
       crl_cache_init ();
+      ocsp_cache_init ();
+      ks_cache_init ();
       start_command_handler (ASSUAN_INVALID_FD);
       shutdown_reaper ();
     }
@@ -1228,6 +1269,11 @@ main (int argc, char **argv)
 
       cert_cache_init ();
       crl_cache_init ();
+      ocsp_cache_init ();
+      ks_cache_init ();
+      if (async_log && log_set_async (1))
+        log_error ("error enabling asynchronous logging: %s\n",
+                   strerror (errno));
 #ifdef USE_W32_SERVICE
       if (opt.system_service)
 	{
@@ -1436,8 +1482,11 @@ main (int argc, char *argv[])
 static void
 cleanup (void)
 {
+  ocsp_cache_deinit ();
+  ks_cache_deinit ();
   crl_cache_deinit ();
   cert_cache_deinit (1);
+  http_pool_flush ();
 
 #if USE_LDAP
   ldapserver_list_free (opt.ldapservers);
@@ -1741,8 +1790,14 @@ dirmngr_sighup_action (void)
   reread_configuration ();
   cert_cache_deinit (0);
   crl_cache_deinit ();
+  ocsp_cache_deinit ();
+  ks_cache_deinit ();
+  http_pool_flush ();
+  dns_cache_flush ();
   cert_cache_init ();
   crl_cache_init ();
+  ocsp_cache_init ();
+  ks_cache_init ();
 }
 
 
@@ -1816,6 +1871,8 @@ housekeeping_thread (void *arg)
     log_info ("starting housekeeping\n");
 
   ks_hkp_housekeeping (curtime);
+  if (opt.crl_prefetch)
+    crl_cache_housekeeping ();
 
   if (opt.verbose)
     log_info ("ready with housekeeping\n");
@@ -104,6 +104,7 @@ struct
   int only_ldap_proxy;    /* Only use the LDAP proxy; no fallback.  */
   int ignore_http_dp;     /* Ignore HTTP CRL distribution points.  */
   int ignore_ldap_dp;     /* Ignore LDAP CRL distribution points.  */
+  int crl_prefetch;       /* Refresh cached CRLs before they expire.  */
   int ignore_ocsp_service_url; /* Ignore OCSP service URLs as given in
                                   the certificate.  */
 
@@ -116,6 +117,9 @@ struct
 
   int max_replies;
   unsigned int ldaptimeout;
+  unsigned int ldap_max_workers;  /* Max. number of persistent LDAP
+                                     workers per server; 0 to start
+                                     a new process for each query.  */
 
   ldap_server_t ldapservers;
   int add_new_ldapservers;
@@ -129,6 +133,17 @@ struct
                                        considered valid after thisUpdate. */
   unsigned int ocsp_current_period; /* Seconds a response is considered
                                        current after nextUpdate. */
+  unsigned int ocsp_cache_max_age;  /* Seconds a response is at maximum
+                                       taken from the cache; 0 disables
+                                       the cache.  */
+  strlist_t ocsp_require_nonce;     /* Responders whose responses are
+                                       never taken from the cache.  */
+
+  unsigned int ks_cache_ttl;   /* Seconds a keyserver response is used
+                                  without asking the keyserver; 0
+                                  disables the cache.  */
+  unsigned int ks_cache_size;  /* Max. size of the keyserver cache in
+                                  megabytes.  */
 } opt;
 
 
@@ -106,6 +106,21 @@ static void npth_protect (void) { }
 
 #define DEFAULT_LDAP_TIMEOUT 100 /* Arbitrary long timeout. */
 
+/* With the paged results control of RFC 2696 the server sends the
+   entries of a search in pages of this size; we write each entry as
+   soon as it arrives, thus the number of entries held in memory is
+   bounded by the page size.  */
+#if defined(LDAP_CONTROL_PAGEDRESULTS) && !defined(HAVE_W32_SYSTEM)
+# define USE_PAGED_SEARCH 1
+#endif
+#define DEFAULT_LDAP_PAGE_SIZE 100
+
+/* The number of bound connections kept in server mode.  */
+#define MAX_LDAP_CONNS 8
+
+/* The maximum size of a request in server mode.  */
+#define MAX_REQUEST_SIZE 65536
+
 
 /* Constants for the options.  */
 enum
@@ -124,9 +139,11 @@ enum
     oDN,
     oFilter,
     oAttr,
+    oPageSize,
 
     oOnlySearchTimeout,
-    oLogWithPID
+    oLogWithPID,
+    oServer
   };
 
 
@@ -148,8 +165,10 @@ static ARGPARSE_OPTS opts[] = {
   { oDN,       "dn",        2, N_("|STRING|query DN STRING")},
   { oFilter,   "filter",    2, N_("|STRING|use STRING as filter expression")},
   { oAttr,     "attr",      2, N_("|STRING|return the attribute STRING")},
+  { oPageSize, "page-size", 1, N_("|N|fetch the results in pages of N")},
   { oOnlySearchTimeout, "only-search-timeout", 0, "@"},
   { oLogWithPID,"log-with-pid", 0, "@"},
+  { oServer,   "server",    0, "@"},
   { 0, NULL, 0, NULL }
 };
 
@@ -164,6 +183,7 @@ struct my_opt_s
   my_ldap_timeval_t timeout;/* Timeout for the LDAP search functions.  */
   unsigned int alarm_timeout; /* And for the alarm based timeout.  */
   int multi;
+  int page_size;          /* 0 for no paged search.  */
 
   estream_t outstream;    /* Send output to thsi stream.  */
 
@@ -177,15 +197,38 @@ struct my_opt_s
   char *dn;    /* Override DN.  */
   char *filter;/* Override filter.  */
   char *attr;  /* Override attribute.  */
+
+  char *proxy_buffer;  /* Malloced copy of PROXY.  */
 };
 typedef struct my_opt_s *my_opt_t;
 
 
+#ifdef USE_LDAPWRAPPER
+/* Set if we are running as a persistent worker for dirmngr.  */
+static int server_mode;
+
+/* In server mode we keep the bound connections for later requests.  */
+struct ldap_conn_s
+{
+  struct ldap_conn_s *next;
+  char *host;
+  int port;
+  char *user;
+  char *pass;
+  LDAP *ld;
+};
+static struct ldap_conn_s *conn_list;
+#endif /*USE_LDAPWRAPPER*/
+
+
 /* Prototypes.  */
 #ifndef HAVE_W32_SYSTEM
 static void catch_alarm (int dummy);
 #endif
 static int process_url (my_opt_t myopt, const char *url);
+#ifdef USE_LDAPWRAPPER
+static int run_server (void);
+#endif
 
 
 
@@ -221,53 +264,28 @@ my_strusage (int level)
 #endif /*!USE_LDAPWRAPPER*/
 
 
-int
-#ifdef USE_LDAPWRAPPER
-main (int argc, char **argv)
-#else
-ldap_wrapper_main (char **argv, estream_t outstream)
-#endif
+/* Set the default values of MYOPT.  */
+static void
+set_defaults (my_opt_t myopt)
 {
-#ifndef USE_LDAPWRAPPER
-  int argc;
-#endif
-  ARGPARSE_ARGS pargs;
-  int any_err = 0;
-  char *p;
-  int only_search_timeout = 0;
-  struct my_opt_s my_opt_buffer;
-  my_opt_t myopt = &my_opt_buffer;
-  char *malloced_buffer1 = NULL;
-
-  memset (&my_opt_buffer, 0, sizeof my_opt_buffer);
-
-  early_system_init ();
-
-#ifdef USE_LDAPWRAPPER
-  set_strusage (my_strusage);
-  log_set_prefix ("dirmngr_ldap", GPGRT_LOG_WITH_PREFIX);
-
-  /* Setup I18N and common subsystems. */
-  i18n_init();
-
-  init_common_subsystems (&argc, &argv);
-
-  es_set_binary (es_stdout);
-  myopt->outstream = es_stdout;
-#else /*!USE_LDAPWRAPPER*/
-  myopt->outstream = outstream;
-  for (argc=0; argv[argc]; argc++)
-    ;
-#endif /*!USE_LDAPWRAPPER*/
-
-  /* LDAP defaults */
   myopt->timeout.tv_sec = DEFAULT_LDAP_TIMEOUT;
   myopt->timeout.tv_usec = 0;
   myopt->alarm_timeout = 0;
+  myopt->page_size = DEFAULT_LDAP_PAGE_SIZE;
+}
 
-  /* Parse the command line.  */
-  pargs.argc = &argc;
-  pargs.argv = &argv;
+
+/* Parse the options from ARGC and ARGV into MYOPT.  On return ARGC
+   and ARGV describe the remaining arguments.  Returns 0 on success.  */
+static int
+parse_options (my_opt_t myopt, int *argc, char ***argv)
+{
+  ARGPARSE_ARGS pargs;
+  char *p;
+  int only_search_timeout = 0;
+
+  pargs.argc = argc;
+  pargs.argv = argv;
   pargs.flags= 1;  /* Do not remove the args. */
   while (arg_parse (&pargs, opts) )
     {
@@ -293,6 +311,9 @@ ldap_wrapper_main (char **argv, estream_t outstream)
         case oDN:   myopt->dn = pargs.r.ret_str; break;
         case oFilter: myopt->filter = pargs.r.ret_str; break;
         case oAttr: myopt->attr = pargs.r.ret_str; break;
+        case oPageSize:
+          myopt->page_size = pargs.r.ret_int > 0? pargs.r.ret_int : 0;
+          break;
         case oLogWithPID:
           {
             unsigned int oldflags;
@@ -300,10 +321,13 @@ ldap_wrapper_main (char **argv, estream_t outstream)
             log_set_prefix (NULL, oldflags | GPGRT_LOG_WITH_PID);
           }
           break;
+#ifdef USE_LDAPWRAPPER
+        case oServer: server_mode = 1; break;
+#endif
 
         default :
 #ifdef USE_LDAPWRAPPER
-          pargs.err = ARGPARSE_PRINT_ERROR;
+          pargs.err = server_mode? ARGPARSE_PRINT_WARNING : ARGPARSE_PRINT_ERROR;
 #else
           pargs.err = ARGPARSE_PRINT_WARNING;  /* No exit() please.  */
 #endif
@@ -316,13 +340,13 @@ ldap_wrapper_main (char **argv, estream_t outstream)
 
   if (myopt->proxy)
     {
-      malloced_buffer1 = xtrystrdup (myopt->proxy);
-      if (!malloced_buffer1)
+      myopt->proxy_buffer = xtrystrdup (myopt->proxy);
+      if (!myopt->proxy_buffer)
         {
           log_error ("error copying string: %s\n", strerror (errno));
-          return 1;
+          return -1;
         }
-      myopt->host = malloced_buffer1;
+      myopt->host = myopt->proxy_buffer;
       p = strchr (myopt->host, ':');
       if (p)
         {
@@ -336,10 +360,56 @@ ldap_wrapper_main (char **argv, estream_t outstream)
   if (myopt->port < 0 || myopt->port > 65535)
     log_error (_("invalid port number %d\n"), myopt->port);
 
+  return 0;
+}
+
+
+int
+#ifdef USE_LDAPWRAPPER
+main (int argc, char **argv)
+#else
+ldap_wrapper_main (char **argv, estream_t outstream)
+#endif
+{
+#ifndef USE_LDAPWRAPPER
+  int argc;
+#endif
+  int any_err = 0;
+  struct my_opt_s my_opt_buffer;
+  my_opt_t myopt = &my_opt_buffer;
+
+  memset (&my_opt_buffer, 0, sizeof my_opt_buffer);
+
+  early_system_init ();
+
+#ifdef USE_LDAPWRAPPER
+  set_strusage (my_strusage);
+  log_set_prefix ("dirmngr_ldap", GPGRT_LOG_WITH_PREFIX);
+
+  /* Setup I18N and common subsystems. */
+  i18n_init();
+
+  init_common_subsystems (&argc, &argv);
+
+  es_set_binary (es_stdout);
+  myopt->outstream = es_stdout;
+#else /*!USE_LDAPWRAPPER*/
+  myopt->outstream = outstream;
+  for (argc=0; argv[argc]; argc++)
+    ;
+#endif /*!USE_LDAPWRAPPER*/
+
+  /* LDAP defaults */
+  set_defaults (myopt);
+
+  /* Parse the command line.  */
+  if (parse_options (myopt, &argc, &argv))
+    return 1;
+
 #ifdef USE_LDAPWRAPPER
   if (log_get_errorcount (0))
     exit (2);
-  if (argc < 1)
+  if (argc < 1 && !server_mode)
     usage (1);
 #else
   /* All passed arguments should be fine in this case.  */
@@ -347,7 +417,7 @@ ldap_wrapper_main (char **argv, estream_t outstream)
 #endif
 
 #ifdef USE_LDAPWRAPPER
-  if (myopt->alarm_timeout)
+  if (myopt->alarm_timeout || server_mode)
     {
 #ifndef HAVE_W32_SYSTEM
 # if defined(HAVE_SIGACTION) && defined(HAVE_STRUCT_SIGACTION)
@@ -363,13 +433,16 @@ ldap_wrapper_main (char **argv, estream_t outstream)
           log_fatal ("unable to register timeout handler\n");
 #endif
     }
+
+  if (server_mode)
+    return run_server ();
 #endif /*USE_LDAPWRAPPER*/
 
   for (; argc; argc--, argv++)
     if (process_url (myopt, *argv))
       any_err = 1;
 
-  xfree (malloced_buffer1);
+  xfree (myopt->proxy_buffer);
   return any_err;
 }
 
@@ -395,9 +468,11 @@ set_timeout (my_opt_t myopt)
 }
 
 
-/* Helper for fetch_ldap().  */
+/* Helper for fetch_ldap().  Print the entries of MSG and set R_ANY
+   if something has been printed.  Returns -1 on a write error.  */
 static int
-print_ldap_entries (my_opt_t myopt, LDAP *ld, LDAPMessage *msg, char *want_attr)
+print_ldap_entries (my_opt_t myopt, LDAP *ld, LDAPMessage *msg,
+                    char *want_attr, int *r_any)
 {
   LDAPMessage *item;
   int any = 0;
@@ -559,21 +634,288 @@ print_ldap_entries (my_opt_t myopt, LDAP *ld, LDAPMessage *msg, char *want_attr)
   if (myopt->verbose > 1 && any)
     log_info ("result has been printed\n");
 
-  return any?0:-1;
+  if (any)
+    *r_any = 1;
+  return 0;
+}
+
+
+#ifdef USE_PAGED_SEARCH
+/* Helper for fetch_ldap().  Run the search described by DN, SCOPE,
+   FILTER and ATTRS as a paged search and print each entry as it
+   arrives.  R_ANY is set if something has been printed, R_NENTRIES
+   receives the number of entries seen and R_WRITEERR is set on a
+   write error.  Returns an LDAP result code.  A server which does
+   not know the control ignores it because it is not critical; the
+   whole result is then the first page.  */
+static int
+paged_search (my_opt_t myopt, LDAP *ld, char *dn, int scope, char *filter,
+              char **attrs, char *want_attr,
+              int *r_any, unsigned int *r_nentries, int *r_writeerr)
+{
+  struct berval cookie = { 0, NULL };
+  LDAPControl *ctrls[2], **rctrls, *ctrl;
+  LDAPMessage *msg;
+  ber_int_t estimate;
+  int rc, err, msgid, type;
+
+  *r_nentries = 0;
+  *r_writeerr = 0;
+  for (;;)
+    {
+      rc = ldap_create_page_control (ld, myopt->page_size,
+                                     cookie.bv_val? &cookie : NULL,
+                                     0, &ctrls[0]);
+      if (rc)
+        break;
+      ctrls[1] = NULL;
+
+      set_timeout (myopt);
+      npth_unprotect ();
+      rc = ldap_search_ext (ld, dn, scope, filter, attrs, 0, ctrls, NULL,
+                            &myopt->timeout, LDAP_NO_LIMIT, &msgid);
+      npth_protect ();
+      ldap_control_free (ctrls[0]);
+      if (rc)
+        break;
+
+      /* Take the messages one by one until the result.  */
+      for (;;)
+        {
+          set_timeout (myopt);
+          npth_unprotect ();
+          type = ldap_result (ld, msgid, LDAP_MSG_ONE, &myopt->timeout, &msg);
+          npth_protect ();
+          if (type == -1)
+            {
+              ldap_get_option (ld, LDAP_OPT_RESULT_CODE, &rc);
+              if (!rc)
+                rc = LDAP_OTHER;
+              goto leave;
+            }
+          if (!type)
+            {
+              ldap_abandon_ext (ld, msgid, NULL, NULL);
+              rc = LDAP_TIMEOUT;
+              goto leave;
+            }
+          if (type == LDAP_RES_SEARCH_RESULT)
+            break;
+          if (type == LDAP_RES_SEARCH_ENTRY)
+            {
+              ++*r_nentries;
+              if (print_ldap_entries (myopt, ld, msg, want_attr, r_any))
+                {
+                  ldap_msgfree (msg);
+                  ldap_abandon_ext (ld, msgid, NULL, NULL);
+                  *r_writeerr = 1;
+                  rc = LDAP_OTHER;
+                  goto leave;
+                }
+            }
+          ldap_msgfree (msg);
+        }
+
+      rctrls = NULL;
+      rc = ldap_parse_result (ld, msg, &err, NULL, NULL, NULL, &rctrls, 1);
+      if (!rc)
+        rc = err;
+      ber_memfree (cookie.bv_val);
+      cookie.bv_val = NULL;
+      cookie.bv_len = 0;
+      if (rctrls)
+        {
+          ctrl = ldap_control_find (LDAP_CONTROL_PAGEDRESULTS, rctrls, NULL);
+          if (ctrl)
+            ldap_parse_pageresponse_control (ld, ctrl, &estimate, &cookie);
+          ldap_controls_free (rctrls);
+        }
+      if (rc || !cookie.bv_val || !cookie.bv_len)
+        break;
+
+      if (myopt->verbose > 1)
+        log_info ("fetching the next page after %u entries\n", *r_nentries);
+      /* Let the reader have the page.  */
+      es_fflush (myopt->outstream);
+    }
+
+ leave:
+  ber_memfree (cookie.bv_val);
+  return rc;
+}
+#endif /*USE_PAGED_SEARCH*/
+
+
+#ifdef USE_LDAPWRAPPER
+/* Return true if the strings A and B, which may be NULL, are equal.  */
+static int
+same_string (const char *a, const char *b)
+{
+  if (!a || !b)
+    return a == b;
+  return !strcmp (a, b);
+}
+
+
+/* Release CONN but not its LDAP handle.  */
+static void
+free_conn (struct ldap_conn_s *conn)
+{
+  xfree (conn->host);
+  xfree (conn->user);
+  if (conn->pass)
+    wipememory (conn->pass, strlen (conn->pass));
+  xfree (conn->pass);
+  xfree (conn);
+}
+#endif /*USE_LDAPWRAPPER*/
+
+
+/* Return a connection to HOST:PORT bound with the credentials from
+   MYOPT.  In server mode a connection kept from an earlier request
+   is returned and R_REUSED set if there is one.  Returns NULL on
+   error.  */
+static LDAP *
+connect_ldap (my_opt_t myopt, char *host, int port, int *r_reused)
+{
+  LDAP *ld;
+  int ret;
+#ifdef USE_LDAPWRAPPER
+  struct ldap_conn_s *conn, *prev;
+  int n;
+#endif
+
+  *r_reused = 0;
+
+#ifdef USE_LDAPWRAPPER
+  for (conn = conn_list; conn; conn = conn->next)
+    if (conn->port == port && !strcmp (conn->host, host)
+        && same_string (conn->user, myopt->user)
+        && same_string (conn->pass, myopt->pass))
+      {
+        if (myopt->verbose > 1)
+          log_info ("reusing connection to '%s:%d'\n", host, port);
+        *r_reused = 1;
+        return conn->ld;
+      }
+#endif /*USE_LDAPWRAPPER*/
+
+  set_timeout (myopt);
+  npth_unprotect ();
+  ld = my_ldap_init (host, port);
+  npth_protect ();
+  if (!ld)
+    {
+      log_error (_("LDAP init to '%s:%d' failed: %s\n"),
+                 host, port, strerror (errno));
+      return NULL;
+    }
+  npth_unprotect ();
+  /* Fixme:  Can we use MYOPT->user or is it shared with other theeads?.  */
+  ret = my_ldap_simple_bind_s (ld, myopt->user, myopt->pass);
+  npth_protect ();
+  if (ret)
+    {
+      log_error (_("binding to '%s:%d' failed: %s\n"),
+                 host, port, strerror (errno));
+      ldap_unbind (ld);
+      return NULL;
+    }
+
+#ifdef USE_LDAPWRAPPER
+  if (!server_mode)
+    return ld;
+
+  /* Keep the connection; if there are too many, the one used least
+     recently goes.  */
+  for (n=0, prev=NULL, conn=conn_list; conn && conn->next;
+       prev=conn, conn=conn->next)
+    n++;
+  if (conn && n + 1 >= MAX_LDAP_CONNS)
+    {
+      if (prev)
+        prev->next = NULL;
+      else
+        conn_list = NULL;
+      ldap_unbind (conn->ld);
+      free_conn (conn);
+    }
+
+  conn = xtrycalloc (1, sizeof *conn);
+  if (conn)
+    {
+      conn->host = xtrystrdup (host);
+      conn->user = myopt->user? xtrystrdup (myopt->user) : NULL;
+      conn->pass = myopt->pass? xtrystrdup (myopt->pass) : NULL;
+      if (!conn->host || (myopt->user && !conn->user)
+          || (myopt->pass && !conn->pass))
+        free_conn (conn);
+      else
+        {
+          conn->port = port;
+          conn->ld = ld;
+          conn->next = conn_list;
+          conn_list = conn;
+        }
+    }
+#endif /*USE_LDAPWRAPPER*/
+
+  return ld;
 }
 
 
+/* Release the connection LD returned by connect_ldap.  A connection
+   kept for later requests is only closed if DROP is set.  */
+static void
+release_connection (LDAP *ld, int drop)
+{
+#ifdef USE_LDAPWRAPPER
+  struct ldap_conn_s *conn, *prev;
+
+  for (prev=NULL, conn=conn_list; conn; prev=conn, conn=conn->next)
+    if (conn->ld == ld)
+      break;
+  if (conn)
+    {
+      if (!drop)
+        {
+          /* Move it to the front so that it is kept longer.  */
+          if (prev)
+            {
+              prev->next = conn->next;
+              conn->next = conn_list;
+              conn_list = conn;
+            }
+          return;
+        }
+      if (prev)
+        prev->next = conn->next;
+      else
+        conn_list = conn->next;
+      free_conn (conn);
+    }
+#else
+  (void)drop;
+#endif /*USE_LDAPWRAPPER*/
+
+  ldap_unbind (ld);
+}
+
 
 /* Helper for the URL based LDAP query. */
 static int
 fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
 {
   LDAP *ld;
-  LDAPMessage *msg;
+  LDAPMessage *msg = NULL;
   int rc = 0;
   char *host, *dn, *filter, *attrs[2], *attr;
+  char **attrlist;
   int port;
-  int ret;
+  int reused;
+  int any = 0;
+  unsigned int nentries = 0;
+  int writeerr = 0;
 
   host     = myopt->host?   myopt->host   : ludp->lud_host;
   port     = myopt->port?   myopt->port   : ludp->lud_port;
@@ -627,41 +969,51 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
     log_info (_("WARNING: using first attribute only\n"));
 
 
-  set_timeout (myopt);
-  npth_unprotect ();
-  ld = my_ldap_init (host, port);
-  npth_protect ();
+  attrlist = (myopt->multi && !myopt->attr && ludp->lud_attrs?
+              ludp->lud_attrs : attrs);
+
+  ld = connect_ldap (myopt, host, port, &reused);
   if (!ld)
+    return -1;
+
+ again:
+#ifdef USE_PAGED_SEARCH
+  if (myopt->page_size)
+    rc = paged_search (myopt, ld, dn, ludp->lud_scope, filter, attrlist,
+                       myopt->multi? NULL:attr, &any, &nentries, &writeerr);
+  else
+#endif /*USE_PAGED_SEARCH*/
     {
-      log_error (_("LDAP init to '%s:%d' failed: %s\n"),
-                 host, port, strerror (errno));
-      return -1;
+      set_timeout (myopt);
+      npth_unprotect ();
+      rc = my_ldap_search_st (ld, dn, ludp->lud_scope, filter, attrlist, 0,
+                              &myopt->timeout, &msg);
+      npth_protect ();
     }
-  npth_unprotect ();
-  /* Fixme:  Can we use MYOPT->user or is it shared with other theeads?.  */
-  ret = my_ldap_simple_bind_s (ld, myopt->user, myopt->pass);
-  npth_protect ();
-  if (ret)
+  if (writeerr)
     {
-      log_error (_("binding to '%s:%d' failed: %s\n"),
-                 host, port, strerror (errno));
-      ldap_unbind (ld);
+      release_connection (ld, 1);
       return -1;
     }
-
-  set_timeout (myopt);
-  npth_unprotect ();
-  rc = my_ldap_search_st (ld, dn, ludp->lud_scope, filter,
-                          myopt->multi && !myopt->attr && ludp->lud_attrs?
-                          ludp->lud_attrs:attrs,
-                          0,
-                          &myopt->timeout, &msg);
-  npth_protect ();
+  if (rc == LDAP_SERVER_DOWN && reused && !nentries)
+    {
+      /* The server closed the connection we kept from an earlier
+         request.  Try again with a new one.  */
+      if (msg)
+        ldap_msgfree (msg);
+      msg = NULL;
+      release_connection (ld, 1);
+      ld = connect_ldap (myopt, host, port, &reused);
+      if (!ld)
+        return -1;
+      goto again;
+    }
   if (rc == LDAP_SIZELIMIT_EXCEEDED && myopt->multi)
     {
       if (es_fwrite ("E\0\0\0\x09truncated", 14, 1, myopt->outstream) != 1)
         {
           log_error (_("error writing to stdout: %s\n"), strerror (errno));
+          release_connection (ld, 1);
           return -1;
         }
     }
@@ -675,17 +1027,22 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
 #endif
       if (rc != LDAP_NO_SUCH_OBJECT)
         {
-          /* FIXME: Need deinit (ld)?  */
-          /* Hmmm: Do we need to released MSG in case of an error? */
+          if (msg)
+            ldap_msgfree (msg);
+          release_connection (ld, 1);
           return -1;
         }
     }
 
-  rc = print_ldap_entries (myopt, ld, msg, myopt->multi? NULL:attr);
-
-  ldap_msgfree (msg);
-  ldap_unbind (ld);
-  return rc;
+  if (msg)
+    {
+      rc = print_ldap_entries (myopt, ld, msg, myopt->multi? NULL:attr, &any);
+      ldap_msgfree (msg);
+    }
+  else
+    rc = 0;
+  release_connection (ld, 0);
+  return (rc || !any)? -1 : 0;
 }
 
 
@@ -717,3 +1074,170 @@ process_url (my_opt_t myopt, const char *url)
   ldap_free_urldesc (ludp);
   return rc;
 }
+
+
+
+#ifdef USE_LDAPWRAPPER
+/* Read the next request of dirmngr from stdin.  A request is a list
+   of arguments like those of the command line, each given as the
+   letter 'A' followed by the Nul terminated string, and ends with a
+   single Nul.  The arguments are stored at R_ARGV with a program name
+   as first item; they point into the buffer stored at R_BUFFER.
+   Returns 0 on success, -1 on EOF before a request and 1 on error.  */
+static int
+read_request (char **r_buffer, char ***r_argv)
+{
+  char *buffer = NULL;
+  char *tmp, *p;
+  char **argv;
+  size_t size = 0;
+  size_t len = 0;
+  int c, i, nargs = 0;
+  int in_arg = 0;
+
+  for (;;)
+    {
+      c = es_getc (es_stdin);
+      if (c == EOF)
+        {
+          if (len || in_arg || nargs)
+            log_error ("incomplete request\n");
+          xfree (buffer);
+          return (len || in_arg || nargs)? 1 : -1;
+        }
+      if (!in_arg)
+        {
+          if (!c)
+            break;  /* End of the request.  */
+          if (c != 'A')
+            {
+              log_error ("invalid request\n");
+              xfree (buffer);
+              return 1;
+            }
+          in_arg = 1;
+          nargs++;
+          continue;
+        }
+      if (len == size)
+        {
+          if (size >= MAX_REQUEST_SIZE)
+            {
+              log_error ("request too large\n");
+              xfree (buffer);
+              return 1;
+            }
+          size += 1024;
+          tmp = xtryrealloc (buffer, size);
+          if (!tmp)
+            {
+              log_error ("error allocating memory: %s\n", strerror (errno));
+              xfree (buffer);
+              return 1;
+            }
+          buffer = tmp;
+        }
+      buffer[len++] = c;
+      if (!c)
+        in_arg = 0;
+    }
+
+  argv = xtrycalloc (nargs + 2, sizeof *argv);
+  if (!argv)
+    {
+      log_error ("error allocating memory: %s\n", strerror (errno));
+      xfree (buffer);
+      return 1;
+    }
+  argv[0] = (char *)"dirmngr_ldap";
+  for (p = buffer, i = 1; i <= nargs; p += strlen (p) + 1, i++)
+    argv[i] = p;
+
+  *r_buffer = buffer;
+  *r_argv = argv;
+  return 0;
+}
+
+
+/* The writer for the output stream in server mode.  The data is sent
+   to stdout in chunks, each prefixed by its length as a 4 byte big
+   endian number.  A chunk of length 0 ends the response.  */
+static ssize_t
+chunk_writer (void *cookie, const void *buffer, size_t size)
+{
+  unsigned char hdr[4];
+
+  (void)cookie;
+
+  if (!size)
+    return 0;
+  hdr[0] = size >> 24;
+  hdr[1] = size >> 16;
+  hdr[2] = size >> 8;
+  hdr[3] = size;
+  if (es_fwrite (hdr, 4, 1, es_stdout) != 1
+      || es_fwrite (buffer, size, 1, es_stdout) != 1)
+    return -1;
+  return size;
+}
+
+
+/* Run as a persistent worker: Read requests from dirmngr on stdin and
+   write the results to stdout until stdin is closed.  Connections to
+   the LDAP servers are kept between the requests.  */
+static int
+run_server (void)
+{
+  es_cookie_io_functions_t chunk_func;
+  struct my_opt_s my_opt_buffer;
+  my_opt_t myopt = &my_opt_buffer;
+  char *buffer;
+  char **argv, **args;
+  int argc, rc;
+
+  memset (&chunk_func, 0, sizeof chunk_func);
+  chunk_func.func_write = chunk_writer;
+
+  while (!(rc = read_request (&buffer, &argv)))
+    {
+      memset (&my_opt_buffer, 0, sizeof my_opt_buffer);
+      set_defaults (myopt);
+      myopt->outstream = es_fopencookie (NULL, "wb", chunk_func);
+      if (!myopt->outstream)
+        {
+          log_error ("error creating output stream: %s\n", strerror (errno));
+          rc = 1;
+        }
+      else
+        {
+          for (argc=0; argv[argc]; argc++)
+            ;
+          args = argv;
+          if (!parse_options (myopt, &argc, &args))
+            for (; argc; argc--, args++)
+              process_url (myopt, *args);
+          if (es_fclose (myopt->outstream))
+            rc = 1;
+#ifndef HAVE_W32_SYSTEM
+          alarm (0);
+#endif
+          if (rc || es_fwrite ("\0\0\0\0", 4, 1, es_stdout) != 1
+              || es_fflush (es_stdout))
+            {
+              log_error (_("error writing to stdout: %s\n"), strerror (errno));
+              rc = 1;
+            }
+        }
+      xfree (myopt->proxy_buffer);
+      xfree (argv);
+      xfree (buffer);
+      if (rc)
+        break;
+    }
+
+  while (conn_list)
+    release_connection (conn_list->ld, 1);
+
+  return rc > 0? 2 : 0;
+}
+#endif /*USE_LDAPWRAPPER*/
@@ -39,6 +39,7 @@
 #  include <netinet/in.h>
 #  include <arpa/nameser.h>
 #  include <resolv.h>
+#  include <netdb.h>
 # endif
 # include <string.h>
 #endif
@@ -48,6 +49,7 @@
 
 #include "util.h"
 #include "host2net.h"
+#include "dns-cache.h"
 #include "dns-cert.h"
 
 /* Not every installation has gotten around to supporting CERTs
@@ -219,7 +221,14 @@ get_dns_cert (const char *name, int want_certtype,
 
   err = gpg_err_make (default_errsource, GPG_ERR_NOT_FOUND);
 
-  r = res_query (name, C_IN, T_CERT, answer, 65536);
+  r = dns_cache_lookup (name, T_CERT, answer, 65536);
+  if (r < 0)
+    {
+      r = res_query (name, C_IN, T_CERT, answer, 65536);
+      dns_cache_store_answer (name, T_CERT, answer, r, h_errno);
+    }
+  else if (!r)
+    r = -1;  /* Cached failure.  */
   /* Not too big, not too small, no errors and at least 1 answer. */
   if (r >= sizeof (HEADER) && r <= 65536
       && (((HEADER *) answer)->rcode) == NOERROR
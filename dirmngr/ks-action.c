@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "misc.h"
@@ -34,6 +35,33 @@
 # include "ldap-parse-uri.h"
 #endif
 
+/* The number of keys fetched at the same time from one HKP
+   keyserver.  */
+#define MAX_KS_GET_THREADS 4
+
+
+/* A key fetched by a ks_get_worker.  */
+struct ks_get_result_s
+{
+  struct ks_get_result_s *next;
+  gpg_error_t err;
+  estream_t infp;
+};
+
+/* The state shared by the workers of ks_get_parallel.  */
+struct ks_get_parm_s
+{
+  struct server_control_s ctrl;  /* Copy of the caller's control.  */
+  parsed_uri_t uri;
+  npth_mutex_t lock;
+  npth_cond_t cond;             /* Signaled when a result is queued.  */
+  strlist_t next_pattern;       /* The next pattern to fetch.  */
+  int running;                  /* Number of running workers.  */
+  struct ks_get_result_s *results;        /* Queued results.  */
+  struct ks_get_result_s **results_tail;
+};
+
+
 /* Called by the engine's help functions to print the actual help.  */
 gpg_error_t
 ks_print_help (ctrl_t ctrl, const char *text)
@@ -192,6 +220,155 @@ ks_action_search (ctrl_t ctrl, uri_item_t keyservers,
 }
 
 
+/* Fetch the keys of the patterns handed out by the ks_get_parm_s
+   object ARG until none is left.  */
+static void *
+ks_get_worker (void *arg)
+{
+  struct ks_get_parm_s *parm = arg;
+  struct ks_get_result_s *res;
+  strlist_t sl;
+  gpg_error_t err;
+  estream_t infp;
+
+  for (;;)
+    {
+      npth_mutex_lock (&parm->lock);
+      sl = parm->next_pattern;
+      if (sl)
+        parm->next_pattern = sl->next;
+      npth_mutex_unlock (&parm->lock);
+      if (!sl)
+        break;
+
+      infp = NULL;
+      err = ks_hkp_get (&parm->ctrl, parm->uri, sl->d, &infp);
+      res = xtrycalloc (1, sizeof *res);
+      if (!res)
+        {
+          err = gpg_error_from_syserror ();
+          es_fclose (infp);
+          log_error ("error queuing a fetched key: %s\n", gpg_strerror (err));
+          continue;
+        }
+      res->err = err;
+      res->infp = infp;
+
+      npth_mutex_lock (&parm->lock);
+      *parm->results_tail = res;
+      parm->results_tail = &res->next;
+      npth_cond_signal (&parm->cond);
+      npth_mutex_unlock (&parm->lock);
+    }
+
+  npth_mutex_lock (&parm->lock);
+  parm->running--;
+  npth_cond_signal (&parm->cond);
+  npth_mutex_unlock (&parm->lock);
+  return NULL;
+}
+
+
+/* Fetch the keys matching PATTERNS from the HKP keyserver URI using
+   several connections at once and write them to OUTFP in the order
+   they arrive.  The workers use a copy of CTRL without the assuan
+   context so that only this thread talks to the client.  Errors
+   from the keyserver are stored at R_FIRST_ERR like ks_action_get
+   does; only a failure to write the output is returned.  R_ANY_DATA
+   is set if a key has been written.  */
+static gpg_error_t
+ks_get_parallel (ctrl_t ctrl, parsed_uri_t uri, strlist_t patterns,
+                 estream_t outfp, gpg_error_t *r_first_err, int *r_any_data)
+{
+  gpg_error_t err = 0;
+  struct ks_get_parm_s parm;
+  struct ks_get_result_s *res;
+  npth_attr_t tattr;
+  npth_t thread;
+  strlist_t sl;
+  int i, n, rc;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctrl = *ctrl;
+  parm.ctrl.server_local = NULL;
+  parm.uri = uri;
+  parm.next_pattern = patterns;
+  parm.results_tail = &parm.results;
+
+  for (n=0, sl = patterns; sl && n < MAX_KS_GET_THREADS; sl = sl->next)
+    n++;
+
+  rc = npth_mutex_init (&parm.lock, NULL);
+  if (!rc)
+    {
+      rc = npth_cond_init (&parm.cond, NULL);
+      if (rc)
+        npth_mutex_destroy (&parm.lock);
+    }
+  if (rc)
+    return gpg_error_from_errno (rc);
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  npth_mutex_lock (&parm.lock);
+  for (i=0; i < n; i++)
+    {
+      rc = npth_create (&thread, &tattr, ks_get_worker, &parm);
+      if (rc)
+        {
+          log_error ("error spawning keyserver fetch: %s\n", strerror (rc));
+          break;
+        }
+      parm.running++;
+    }
+  npth_attr_destroy (&tattr);
+  if (!parm.running)
+    {
+      npth_mutex_unlock (&parm.lock);
+      npth_cond_destroy (&parm.cond);
+      npth_mutex_destroy (&parm.lock);
+      return gpg_error_from_errno (rc);
+    }
+
+  while (parm.results || parm.running)
+    {
+      if (!parm.results)
+        {
+          npth_cond_wait (&parm.cond, &parm.lock);
+          continue;
+        }
+      res = parm.results;
+      parm.results = res->next;
+      if (!parm.results)
+        parm.results_tail = &parm.results;
+      npth_mutex_unlock (&parm.lock);
+
+      if (res->err)
+        {
+          /* Same as in ks_action_get we only remember the error.  */
+          *r_first_err = res->err;
+        }
+      else if (!err)
+        {
+          err = copy_stream (res->infp, outfp);
+          if (!err)
+            *r_any_data = 1;
+        }
+      es_fclose (res->infp);
+      xfree (res);
+
+      npth_mutex_lock (&parm.lock);
+      if (err)
+        parm.next_pattern = NULL;  /* Don't start any new fetches.  */
+    }
+  npth_mutex_unlock (&parm.lock);
+
+  npth_cond_destroy (&parm.cond);
+  npth_mutex_destroy (&parm.lock);
+  return err;
+}
+
+
 /* Get the requested keys (matching PATTERNS) using all configured
    keyservers and write the result to the provided output stream.  */
 gpg_error_t
@@ -226,7 +403,13 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
 		 || strcmp (uri->parsed_uri->scheme, "ldapi") == 0);
 #endif
 
-      if (is_http || is_ldap)
+      if (is_http && patterns->next)
+        {
+          any_server = 1;
+          err = ks_get_parallel (ctrl, uri->parsed_uri, patterns, outfp,
+                                 &first_err, &any_data);
+        }
+      else if (is_http || is_ldap)
         {
           any_server = 1;
           for (sl = patterns; !err && sl; sl = sl->next)
@@ -0,0 +1,593 @@
+/* ks-cache.c - Cache of keyserver responses
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The responses of keyservers to get and search requests are stored
+   in the directory "ks-cache.d" below the cache directory so that all
+   clients of this dirmngr share them.  Each response is stored in a
+   file named by the uppercase hex encoded SHA-1 hash of the server
+   and the query, separated by a LF.  The file starts with header
+   lines:
+
+     server:<the scheme, host and port as configured>
+     query:<the normalized query>
+     expires:<when the response needs to be revalidated (seconds
+              since epoch)>
+     etag:<the ETag of the response>                 (optional)
+     last-modified:<the Last-Modified of the response> (optional)
+
+   An empty line terminates the header; the response follows.  An
+   expired response is not deleted because the keyserver may tell us
+   by a conditional request that it is still current.  If the files
+   take up more than --keyserver-cache-size megabytes, the least
+   recently used are removed.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#ifdef MKDIR_TAKES_ONE_ARG
+#undef mkdir
+#define mkdir(a,b) mkdir(a)
+#endif
+
+#include "dirmngr.h"
+#include "misc.h"
+#include "ks-cache.h"
+
+
+#define KS_CACHE_DIR "ks-cache.d"
+
+/* Responses larger than this fraction of the cache size are not
+   cached.  */
+#define MAX_ITEM_FRACTION 8
+
+/* An entry of the in-core index of the cache directory.  */
+struct ks_cache_item_s
+{
+  struct ks_cache_item_s *next;
+  char name[41];      /* The name of the file.  */
+  unsigned long size; /* The size of the file.  */
+  time_t lastused;    /* The time the response was last used.  */
+};
+typedef struct ks_cache_item_s *ks_cache_item_t;
+
+/* The index and the total size of the files.  */
+static ks_cache_item_t ks_cache;
+static unsigned long ks_cache_total;
+static int ks_cache_loaded;
+
+
+
+/* Return the maximum size of the cache in bytes.  */
+static unsigned long
+max_cache_size (void)
+{
+  return (unsigned long)opt.ks_cache_size * 1024 * 1024;
+}
+
+
+/* Compute the name of the cache file for QUERY sent to SERVER.
+   BUFFER must provide space for 41 bytes.  */
+static char *
+make_item_name (const char *server, const char *query, char *buffer)
+{
+  unsigned char hash[20];
+  char *tmp;
+
+  tmp = strconcat (server, "\n", query, NULL);
+  if (!tmp)
+    return NULL;
+  gcry_md_hash_buffer (GCRY_MD_SHA1, hash, tmp, strlen (tmp));
+  xfree (tmp);
+  return bin2hex (hash, 20, buffer);
+}
+
+
+static char *
+item_filename (const char *name)
+{
+  return make_filename (opt.homedir_cache, KS_CACHE_DIR, name, NULL);
+}
+
+
+static ks_cache_item_t
+find_item (const char *name)
+{
+  ks_cache_item_t item;
+
+  for (item = ks_cache; item; item = item->next)
+    if (!strcmp (item->name, name))
+      return item;
+  return NULL;
+}
+
+
+/* Remove the item NAME from the index and delete its file.  */
+static void
+remove_item (const char *name)
+{
+  ks_cache_item_t item, prev;
+  char *fname;
+
+  for (item = ks_cache, prev = NULL; item; prev = item, item = item->next)
+    if (!strcmp (item->name, name))
+      {
+        if (prev)
+          prev->next = item->next;
+        else
+          ks_cache = item->next;
+        ks_cache_total -= item->size;
+        xfree (item);
+        break;
+      }
+
+  fname = item_filename (name);
+  if (fname && gnupg_remove (fname) && errno != ENOENT)
+    log_error (_("error removing '%s': %s\n"), fname, strerror (errno));
+  xfree (fname);
+}
+
+
+/* Remove the least recently used responses until the cache is not
+   larger than its maximum size.  */
+static void
+shrink_cache (void)
+{
+  ks_cache_item_t item, oldest;
+  unsigned long limit = max_cache_size ();
+
+  while (ks_cache && ks_cache_total > limit)
+    {
+      for (oldest = item = ks_cache; item; item = item->next)
+        if (item->lastused < oldest->lastused)
+          oldest = item;
+      if (DBG_CACHE)
+        log_debug ("ks-cache: removing %s\n", oldest->name);
+      remove_item (oldest->name);
+    }
+}
+
+
+/* Read the index of the cache directory.  */
+void
+ks_cache_init (void)
+{
+  char *dname;
+  DIR *dir;
+  struct dirent *de;
+  struct stat sb;
+  char *fname;
+  ks_cache_item_t item;
+  int count = 0;
+
+  if (ks_cache_loaded || !opt.ks_cache_ttl || !opt.ks_cache_size)
+    return;
+  ks_cache_loaded = 1;
+
+  dname = make_filename (opt.homedir_cache, KS_CACHE_DIR, NULL);
+  dir = opendir (dname);
+  if (!dir)
+    {
+      if (errno == ENOENT)
+        {
+          if (mkdir (dname, S_IRUSR|S_IWUSR|S_IXUSR))
+            log_error (_("error creating directory '%s': %s\n"),
+                       dname, strerror (errno));
+        }
+      else
+        log_error (_("error opening '%s': %s\n"), dname, strerror (errno));
+      xfree (dname);
+      return;
+    }
+
+  while ((de = readdir (dir)))
+    {
+      if (strlen (de->d_name) != 40
+          || strspn (de->d_name, "0123456789ABCDEF") != 40)
+        continue;
+      fname = make_filename (dname, de->d_name, NULL);
+      if (stat (fname, &sb))
+        {
+          xfree (fname);
+          continue;
+        }
+      xfree (fname);
+
+      item = xtrycalloc (1, sizeof *item);
+      if (!item)
+        {
+          log_error (_("error allocating memory: %s\n"), strerror (errno));
+          break;
+        }
+      strcpy (item->name, de->d_name);
+      item->size = sb.st_size;
+      item->lastused = sb.st_mtime;
+      item->next = ks_cache;
+      ks_cache = item;
+      ks_cache_total += item->size;
+      count++;
+    }
+  closedir (dir);
+  xfree (dname);
+
+  shrink_cache ();
+  if (opt.verbose)
+    log_info ("%d cached keyserver responses found\n", count);
+}
+
+
+/* Release the index.  The files are kept.  */
+void
+ks_cache_deinit (void)
+{
+  ks_cache_item_t item;
+
+  while ((item = ks_cache))
+    {
+      ks_cache = item->next;
+      xfree (item);
+    }
+  ks_cache_total = 0;
+  ks_cache_loaded = 0;
+}
+
+
+/* Open the cache file NAME and check that it belongs to QUERY sent
+   to SERVER.  On success the stream is positioned at the start of
+   the response and the header values are stored at the provided
+   addresses.  */
+static gpg_error_t
+open_item (const char *name, const char *server, const char *query,
+           estream_t *r_fp, time_t *r_expires,
+           char **r_etag, char **r_lastmod)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  estream_t fp;
+  char *line = NULL;
+  size_t linelen = 0;
+  ssize_t n;
+  int any_server = 0, any_query = 0;
+
+  *r_fp = NULL;
+  *r_expires = 0;
+  if (r_etag)
+    *r_etag = NULL;
+  if (r_lastmod)
+    *r_lastmod = NULL;
+
+  fname = item_filename (name);
+  if (!fname)
+    return gpg_error_from_syserror ();
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) != GPG_ERR_ENOENT)
+        log_error (_("error opening '%s': %s\n"), fname, gpg_strerror (err));
+      xfree (fname);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
+  while ((n = es_read_line (fp, &line, &linelen, NULL)) > 0)
+    {
+      if (line[n-1] == '\n')
+        line[--n] = 0;
+      if (!*line)
+        break;
+      if (!strncmp (line, "server:", 7))
+        any_server = !strcmp (line+7, server);
+      else if (!strncmp (line, "query:", 6))
+        any_query = !strcmp (line+6, query);
+      else if (!strncmp (line, "expires:", 8))
+        *r_expires = (time_t)strtoul (line+8, NULL, 10);
+      else if (!strncmp (line, "etag:", 5) && r_etag && !*r_etag)
+        *r_etag = xtrystrdup (line+5);
+      else if (!strncmp (line, "last-modified:", 14) && r_lastmod
+               && !*r_lastmod)
+        *r_lastmod = xtrystrdup (line+14);
+    }
+
+  if (n <= 0 || !any_server || !any_query || !*r_expires)
+    {
+      log_info ("invalid keyserver cache file '%s' ignored\n", fname);
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      es_fclose (fp);
+      if (r_etag)
+        {
+          xfree (*r_etag);
+          *r_etag = NULL;
+        }
+      if (r_lastmod)
+        {
+          xfree (*r_lastmod);
+          *r_lastmod = NULL;
+        }
+    }
+  else
+    *r_fp = fp;
+
+  es_free (line);
+  xfree (fname);
+  return err;
+}
+
+
+/* Copy the rest of the stream FP to a new memory stream and return
+   it at R_FP.  The size of the data is stored at R_LEN.  */
+static gpg_error_t
+copy_to_memory (estream_t fp, estream_t *r_fp, size_t *r_len)
+{
+  gpg_error_t err = 0;
+  estream_t memfp;
+  char buffer[4096];
+  size_t nread, total = 0;
+
+  *r_fp = NULL;
+  memfp = es_fopenmem (0, "rwb");
+  if (!memfp)
+    return gpg_error_from_syserror ();
+
+  while (!es_read (fp, buffer, sizeof buffer, &nread) && nread)
+    {
+      if (es_write (memfp, buffer, nread, NULL))
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      total += nread;
+    }
+  if (!err && es_ferror (fp))
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      es_fclose (memfp);
+      return err;
+    }
+
+  es_rewind (memfp);
+  *r_fp = memfp;
+  *r_len = total;
+  return 0;
+}
+
+
+/* Write the response in MEMFP for QUERY sent to SERVER to the cache
+   file NAME and update the index.  */
+static void
+write_item (const char *name, const char *server, const char *query,
+            const char *etag, const char *lastmod, estream_t memfp,
+            size_t datalen)
+{
+  char *fname, *tmpfname;
+  estream_t fp;
+  ks_cache_item_t item;
+  char buffer[4096];
+  size_t nread;
+  off_t size;
+
+  fname = item_filename (name);
+  tmpfname = fname? strconcat (fname, ".tmp", NULL) : NULL;
+  if (!tmpfname)
+    {
+      log_error (_("error allocating memory: %s\n"), strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      log_error (_("error creating '%s': %s\n"), tmpfname, strerror (errno));
+      goto leave;
+    }
+  es_fprintf (fp, "server:%s\nquery:%s\nexpires:%lu\n",
+              server, query,
+              (unsigned long)(time (NULL) + opt.ks_cache_ttl));
+  if (etag)
+    es_fprintf (fp, "etag:%s\n", etag);
+  if (lastmod)
+    es_fprintf (fp, "last-modified:%s\n", lastmod);
+  es_putc ('\n', fp);
+  while (!es_read (memfp, buffer, sizeof buffer, &nread) && nread)
+    es_write (fp, buffer, nread, NULL);
+  es_rewind (memfp);
+  size = es_ftello (fp);
+  if (es_fclose (fp) || size < (off_t)datalen)
+    {
+      log_error (_("error writing '%s': %s\n"), tmpfname, strerror (errno));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+#ifdef HAVE_W32_SYSTEM
+  /* No atomic mv on W32 systems.  */
+  gnupg_remove (fname);
+#endif
+  if (rename (tmpfname, fname))
+    {
+      log_error (_("error renaming '%s' to '%s': %s\n"),
+                 tmpfname, fname, strerror (errno));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  item = find_item (name);
+  if (!item)
+    {
+      item = xtrycalloc (1, sizeof *item);
+      if (!item)
+        {
+          /* Without an index entry the file would not be accounted.  */
+          gnupg_remove (fname);
+          goto leave;
+        }
+      strcpy (item->name, name);
+      item->next = ks_cache;
+      ks_cache = item;
+    }
+  else
+    ks_cache_total -= item->size;
+  item->size = size;
+  item->lastused = time (NULL);
+  ks_cache_total += item->size;
+  shrink_cache ();
+
+ leave:
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Return true if responses for QUERY sent to SERVER may be cached.  */
+static int
+cache_enabled (const char *server, const char *query)
+{
+  if (!opt.ks_cache_ttl || !opt.ks_cache_size || !ks_cache_loaded)
+    return 0;
+  /* A LF would break the header lines.  */
+  return !strchr (server, '\n') && !strchr (query, '\n');
+}
+
+
+/* Look up the response to QUERY sent to SERVER.  If a current response
+   is cached, a stream with it is stored at R_FP and 0 is returned.
+   Otherwise GPG_ERR_NOT_FOUND is returned; if an expired response
+   with validators is cached, they are stored as malloced strings at
+   R_ETAG and R_LASTMOD and may be used for a conditional request.  */
+gpg_error_t
+ks_cache_get (const char *server, const char *query,
+              estream_t *r_fp, char **r_etag, char **r_lastmod)
+{
+  gpg_error_t err;
+  char name[41];
+  ks_cache_item_t item;
+  estream_t fp, memfp;
+  time_t expires;
+  size_t len;
+
+  *r_fp = NULL;
+  *r_etag = NULL;
+  *r_lastmod = NULL;
+
+  if (!cache_enabled (server, query)
+      || !make_item_name (server, query, name)
+      || !(item = find_item (name)))
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  err = open_item (name, server, query, &fp, &expires, r_etag, r_lastmod);
+  if (err)
+    {
+      remove_item (name);
+      return err;
+    }
+
+  if (expires < time (NULL))
+    {
+      if (DBG_CACHE)
+        log_debug ("ks-cache: response for '%s' has expired\n", query);
+      es_fclose (fp);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
+  xfree (*r_etag);
+  *r_etag = NULL;
+  xfree (*r_lastmod);
+  *r_lastmod = NULL;
+
+  err = copy_to_memory (fp, &memfp, &len);
+  es_fclose (fp);
+  if (err)
+    return err;
+
+  item->lastused = time (NULL);
+  if (DBG_CACHE)
+    log_debug ("ks-cache: using cached response for '%s'\n", query);
+  *r_fp = memfp;
+  return 0;
+}
+
+
+/* The keyserver told us that the cached response for QUERY sent to
+   SERVER is still current.  Renew it and return a stream with it at
+   R_FP.  */
+gpg_error_t
+ks_cache_refresh (const char *server, const char *query, estream_t *r_fp)
+{
+  gpg_error_t err;
+  char name[41];
+  estream_t fp, memfp;
+  time_t expires;
+  char *etag, *lastmod;
+  size_t len;
+
+  *r_fp = NULL;
+
+  if (!cache_enabled (server, query) || !make_item_name (server, query, name))
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  err = open_item (name, server, query, &fp, &expires, &etag, &lastmod);
+  if (err)
+    return err;
+  err = copy_to_memory (fp, &memfp, &len);
+  es_fclose (fp);
+  if (!err)
+    {
+      if (DBG_CACHE)
+        log_debug ("ks-cache: cached response for '%s' revalidated\n", query);
+      write_item (name, server, query, etag, lastmod, memfp, len);
+      *r_fp = memfp;
+    }
+  xfree (etag);
+  xfree (lastmod);
+  return err;
+}
+
+
+/* Store the response to QUERY sent to SERVER which can be read from
+   *R_FP.  ETAG and LASTMOD are the validators of the response or
+   NULL.  The stream at R_FP is replaced by a stream with the same
+   data; the original stream is closed.  */
+gpg_error_t
+ks_cache_store (const char *server, const char *query,
+                const char *etag, const char *lastmod, estream_t *r_fp)
+{
+  gpg_error_t err;
+  char name[41];
+  estream_t memfp;
+  size_t len;
+
+  if (!cache_enabled (server, query) || !make_item_name (server, query, name))
+    return 0;
+
+  err = copy_to_memory (*r_fp, &memfp, &len);
+  if (err)
+    return err;
+  es_fclose (*r_fp);
+  *r_fp = memfp;
+
+  if (len && len <= max_cache_size () / MAX_ITEM_FRACTION)
+    write_item (name, server, query, etag, lastmod, memfp, len);
+  return 0;
+}
@@ -0,0 +1,34 @@
+/* ks-cache.h - Cache of keyserver responses
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIRMNGR_KS_CACHE_H
+#define DIRMNGR_KS_CACHE_H 1
+
+void ks_cache_init (void);
+void ks_cache_deinit (void);
+
+gpg_error_t ks_cache_get (const char *server, const char *query,
+                          estream_t *r_fp, char **r_etag, char **r_lastmod);
+gpg_error_t ks_cache_refresh (const char *server, const char *query,
+                              estream_t *r_fp);
+gpg_error_t ks_cache_store (const char *server, const char *query,
+                            const char *etag, const char *lastmod,
+                            estream_t *r_fp);
+
+#endif /*DIRMNGR_KS_CACHE_H*/
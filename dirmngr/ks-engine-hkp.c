@@ -34,11 +34,13 @@
 # include <sys/socket.h>
 # include <netdb.h>
 #endif /*!HAVE_W32_SYSTEM*/
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "misc.h"
 #include "userids.h"
 #include "ks-engine.h"
+#include "ks-cache.h"
 
 /* Substitutes for missing Mingw macro.  The EAI_SYSTEM mechanism
    seems not to be available (probably because there is only one set
@@ -66,6 +68,17 @@
 /* Number of retries done for a dead host etc.  */
 #define SEND_REQUEST_RETRIES 3
 
+/* The weight of a new sample in the moving averages of the response
+   time and the error rate as a shift count: 3 gives a weight of 1/8.  */
+#define HOSTSTAT_SHIFT 3
+
+/* Per mille of selections from a pool which pick a random host so
+   that the statistics of the other hosts are updated.  */
+#define EXPLORE_PERMILLE 100
+
+/* An error rate in per mille above which a host is not preferred.  */
+#define MAX_GOOD_ERRRATE 500
+
 /* Objects used to maintain information about hosts.  */
 struct hostinfo_s;
 typedef struct hostinfo_s *hostinfo_t;
@@ -82,6 +95,10 @@ struct hostinfo_s
   unsigned int dead:1; /* Host is currently unresponsive.  */
   time_t died_at;    /* The time the host was marked dead.  If this is
                         0 the host has been manually marked dead.  */
+  unsigned int rtt;  /* Moving average of the response time in
+                        milliseconds or 0 if not yet known.  */
+  unsigned int errrate; /* Moving average of the error rate in per
+                           mille.  */
   char *cname;       /* Canonical name of the host.  Only set if this
                         is a pool.  */
   char *v4addr;      /* A string with the v4 IP address of the host.
@@ -125,6 +142,8 @@ create_new_hostinfo (const char *name)
   hi->v6 = 0;
   hi->dead = 0;
   hi->died_at = 0;
+  hi->rtt = 0;
+  hi->errrate = 0;
   hi->cname = NULL;
   hi->v4addr = NULL;
   hi->v6addr = NULL;
@@ -198,15 +217,49 @@ host_in_pool_p (int *pool, int tblidx)
 }
 
 
-/* Select a random host.  Consult TABLE which indices into the global
+/* Return a value to compare the speed of the host HI; lower is
+   better.  The response time is weighted with the error rate.
+   Returns 0 if nothing is known about the host.  */
+static unsigned long
+host_score (hostinfo_t hi)
+{
+  return (unsigned long)hi->rtt * (1000 + 4 * hi->errrate) / 1000;
+}
+
+
+/* Return the best score of the alive hosts in TABLE which indices
+   into the global hosttable or 0 if none is known.  */
+static unsigned long
+best_host_score (int *table)
+{
+  unsigned long score, best = 0;
+  int pidx, idx;
+
+  for (idx=0; (pidx = table[idx]) != -1; idx++)
+    if (hosttable[pidx] && !hosttable[pidx]->dead && hosttable[pidx]->rtt
+        && hosttable[pidx]->errrate <= MAX_GOOD_ERRRATE)
+      {
+        score = host_score (hosttable[pidx]);
+        if (!best || score < best)
+          best = score;
+      }
+  return best;
+}
+
+
+/* Select a host.  Consult TABLE which indices into the global
    hosttable.  Returns index into TABLE or -1 if no host could be
-   selected.  */
+   selected.  Hosts which responded fast are preferred; there is no
+   fixed order between hosts of about the same speed so that the load
+   is spread.  Now and then a random host is selected to learn about
+   changes in the speed of the other hosts.  */
 static int
-select_random_host (int *table)
+select_host (int *table)
 {
   int *tbl;
-  size_t tblsize;
+  size_t tblsize, nfast;
   int pidx, idx;
+  unsigned long best;
 
   /* We create a new table so that we randomly select only from
      currently alive hosts.  */
@@ -223,6 +276,29 @@ select_random_host (int *table)
     if (hosttable[pidx] && !hosttable[pidx]->dead)
       tbl[tblsize++] = pidx;
 
+  best = 0;
+  if (tblsize > 1 && get_uint_nonce () % 1000 >= EXPLORE_PERMILLE)
+    best = best_host_score (table);
+  if (best)
+    {
+      /* Move the hosts which are at most 50% slower than the best to
+         the front.  */
+      for (idx=0, nfast=0; idx < tblsize; idx++)
+        {
+          hostinfo_t hi = hosttable[tbl[idx]];
+
+          if (hi->rtt && hi->errrate <= MAX_GOOD_ERRRATE
+              && host_score (hi) <= best + best / 2)
+            {
+              pidx = tbl[nfast];
+              tbl[nfast++] = tbl[idx];
+              tbl[idx] = pidx;
+            }
+        }
+      if (nfast)
+        tblsize = nfast;
+    }
+
   if (tblsize == 1)  /* Save a get_uint_nonce.  */
     pidx = tbl[0];
   else
@@ -540,7 +616,7 @@ map_host (ctrl_t ctrl, const char *name, int force_reselect,
       /* Select a host if needed.  */
       if (hi->poolidx == -1)
         {
-          hi->poolidx = select_random_host (hi->pool);
+          hi->poolidx = select_host (hi->pool);
           if (hi->poolidx == -1)
             {
               log_error ("no alive host found in pool '%s'\n", name);
@@ -597,16 +673,15 @@ map_host (ctrl_t ctrl, const char *name, int force_reselect,
 }
 
 
-/* Mark the host NAME as dead.  NAME may be given as an URL.  Returns
-   true if a host was really marked as dead or was already marked dead
-   (e.g. by a concurrent session).  */
+/* Return the index into the hosttable for the host NAME or -1 if not
+   found.  NAME may be given as an URL.  */
 static int
-mark_host_dead (const char *name)
+find_hostinfo_by_url (const char *name)
 {
   const char *host;
   char *host_buffer = NULL;
   parsed_uri_t parsed_uri = NULL;
-  int done = 0;
+  int idx = -1;
 
   if (name && *name && !http_parse_uri (&parsed_uri, name, 1))
     {
@@ -614,7 +689,7 @@ mark_host_dead (const char *name)
         {
           host_buffer = strconcat ("[", parsed_uri->host, "]", NULL);
           if (!host_buffer)
-            log_error ("out of core in mark_host_dead");
+            log_error ("out of core in find_hostinfo_by_url");
           host = host_buffer;
         }
       else
@@ -624,27 +699,97 @@ mark_host_dead (const char *name)
     host = name;
 
   if (host && *host && strcmp (host, "localhost"))
-    {
-      hostinfo_t hi;
-      int idx;
-
-      idx = find_hostinfo (host);
-      if (idx != -1)
-        {
-          hi = hosttable[idx];
-          log_info ("marking host '%s' as dead%s\n",
-                    hi->name, hi->dead? " (again)":"");
-          hi->dead = 1;
-          hi->died_at = gnupg_get_time ();
-          if (!hi->died_at)
-            hi->died_at = 1;
-          done = 1;
-        }
-    }
+    idx = find_hostinfo (host);
 
   http_release_parsed_uri (parsed_uri);
   xfree (host_buffer);
-  return done;
+  return idx;
+}
+
+
+/* Update the statistics of the host of the URL REQUEST with a request
+   which took MSECS milliseconds and failed if FAILED is true.  If the
+   host has become much slower than other hosts of a pool it is
+   currently selected for, a new host will be selected for the next
+   request.  */
+static void
+update_host_stats (const char *request, unsigned long msecs, int failed)
+{
+  hostinfo_t hi;
+  int idx, idx2;
+  unsigned long best;
+
+  idx = find_hostinfo_by_url (request);
+  if (idx == -1)
+    return;
+  hi = hosttable[idx];
+
+  if (failed)
+    hi->errrate += (1000 - hi->errrate) >> HOSTSTAT_SHIFT;
+  else
+    {
+      hi->errrate -= hi->errrate >> HOSTSTAT_SHIFT;
+      if (!msecs)
+        msecs = 1;
+      if (!hi->rtt)
+        hi->rtt = msecs;
+      else if (msecs > hi->rtt)
+        hi->rtt += (msecs - hi->rtt) >> HOSTSTAT_SHIFT;
+      else
+        hi->rtt -= (hi->rtt - msecs) >> HOSTSTAT_SHIFT;
+      if (!hi->rtt)
+        hi->rtt = 1;
+    }
+
+  for (idx2=0; idx2 < hosttable_size; idx2++)
+    if (hosttable[idx2] && hosttable[idx2]->pool
+        && hosttable[idx2]->poolidx == idx)
+      {
+        best = best_host_score (hosttable[idx2]->pool);
+        if (best && (host_score (hi) > 2 * best
+                     || hi->errrate > MAX_GOOD_ERRRATE))
+          {
+            if (opt.verbose)
+              log_info ("host '%s' is slow - selecting another host"
+                        " from '%s'\n", hi->name, hosttable[idx2]->name);
+            hosttable[idx2]->poolidx = -1;
+          }
+      }
+}
+
+
+/* Return the current time in milliseconds.  */
+static unsigned long
+get_msecs (void)
+{
+  struct timespec ts;
+
+  npth_clock_gettime (&ts);
+  return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* Mark the host NAME as dead.  NAME may be given as an URL.  Returns
+   true if a host was really marked as dead or was already marked dead
+   (e.g. by a concurrent session).  */
+static int
+mark_host_dead (const char *name)
+{
+  hostinfo_t hi;
+  int idx;
+
+  idx = find_hostinfo_by_url (name);
+  if (idx == -1)
+    return 0;
+
+  hi = hosttable[idx];
+  log_info ("marking host '%s' as dead%s\n",
+            hi->name, hi->dead? " (again)":"");
+  hi->dead = 1;
+  hi->died_at = gnupg_get_time ();
+  if (!hi->died_at)
+    hi->died_at = 1;
+  return 1;
 }
 
 
@@ -765,6 +910,12 @@ ks_hkp_print_hosttable (ctrl_t ctrl)
         if (err)
           return err;
 
+        if (hi->rtt || hi->errrate)
+          err = ks_printf_help (ctrl, "  .       rtt=%ums errors=%u.%u%%",
+                                hi->rtt, hi->errrate / 10, hi->errrate % 10);
+        if (err)
+          return err;
+
         if (hi->cname)
           err = ks_printf_help (ctrl, "  .       %s", hi->cname);
         if (err)
@@ -934,16 +1085,42 @@ ks_hkp_housekeeping (time_t curtime)
 }
 
 
+/* Return a malloced string identifying the keyserver URI for the
+   cache.  This is the configured name and not the selected host of
+   a pool.  */
+static char *
+cache_server_name (parsed_uri_t uri)
+{
+  char portstr[10];
+
+  snprintf (portstr, sizeof portstr, "%hu", uri->port);
+  return strconcat (uri->scheme, "://", uri->host, ":", portstr, NULL);
+}
+
+
+/* The validators of a cached response for a conditional request.  */
+struct revalidate_s
+{
+  char *etag;        /* The ETag or NULL.  */
+  char *lastmod;     /* The Last-Modified date or NULL.  */
+  int not_modified;  /* The server said the response is unchanged.  */
+};
+
+
 /* Send an HTTP request.  On success returns an estream object at
    R_FP.  HOSTPORTSTR is only used for diagnostics.  If HTTPHOST is
    not NULL it will be used as HTTP "Host" header.  If POST_CB is not
    NULL a post request is used and that callback is called to allow
-   writing the post data.  */
+   writing the post data.  If REVAL is not NULL and has validators, a
+   conditional request is sent; if the server answers that the cached
+   response is still current, NOT_MODIFIED is set and NULL is stored
+   at R_FP.  Otherwise the validators of a successful response are
+   stored in REVAL.  */
 static gpg_error_t
 send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
               const char *httphost, unsigned int httpflags,
               gpg_error_t (*post_cb)(void *, http_t), void *post_cb_value,
-              estream_t *r_fp)
+              struct revalidate_s *reval, estream_t *r_fp)
 {
   gpg_error_t err;
   http_session_t session = NULL;
@@ -951,6 +1128,7 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
   int redirects_left = MAX_REDIRECTS;
   estream_t fp = NULL;
   char *request_buffer = NULL;
+  unsigned long started;
 
   *r_fp = NULL;
 
@@ -960,12 +1138,14 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
   http_session_set_log_cb (session, cert_log_cb);
 
  once_more:
+  started = get_msecs ();
   err = http_open (&http,
                    post_cb? HTTP_REQ_POST : HTTP_REQ_GET,
                    request,
                    httphost,
                    /* fixme: AUTH */ NULL,
-                   (httpflags | (opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0)),
+                   (httpflags | HTTP_FLAG_KEEP_ALIVE | HTTP_FLAG_COMPRESS
+                    | (opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0)),
                    ctrl->http_proxy,
                    session,
                    NULL,
@@ -978,6 +1158,10 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
          we're good with both HTTP 1.0 and 1.1.  */
       es_fputs ("Pragma: no-cache\r\n"
                 "Cache-Control: no-cache\r\n", fp);
+      if (reval && reval->etag)
+        es_fprintf (fp, "If-None-Match: %s\r\n", reval->etag);
+      if (reval && reval->lastmod)
+        es_fprintf (fp, "If-Modified-Since: %s\r\n", reval->lastmod);
       if (post_cb)
         err = post_cb (post_cb_value, http);
       if (!err)
@@ -992,12 +1176,14 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
       /* Fixme: After a redirection we show the old host name.  */
       log_error (_("error connecting to '%s': %s\n"),
                  hostportstr, gpg_strerror (err));
+      update_host_stats (request, 0, 1);
       goto leave;
     }
 
   /* Wait for the response.  */
   dirmngr_tick (ctrl);
   err = http_wait_response (http);
+  update_host_stats (request, get_msecs () - started, !!err);
   if (err)
     {
       log_error (_("error reading HTTP response for '%s': %s\n"),
@@ -1016,8 +1202,31 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
     {
     case 200:
       err = 0;
+      if (reval)
+        {
+          const char *s;
+
+          xfree (reval->etag);
+          s = http_get_header (http, "ETag");
+          reval->etag = s? xtrystrdup (s) : NULL;
+          xfree (reval->lastmod);
+          s = http_get_header (http, "Last-Modified");
+          reval->lastmod = s? xtrystrdup (s) : NULL;
+        }
       break; /* Success.  */
 
+    case 304:
+      if (reval && (reval->etag || reval->lastmod))
+        {
+          reval->not_modified = 1;
+          err = 0;
+          goto leave;
+        }
+      log_error (_("error accessing '%s': http status %u\n"),
+                 request, http_get_status_code (http));
+      err = gpg_error (GPG_ERR_NO_DATA);
+      goto leave;
+
     case 301:
     case 302:
     case 307:
@@ -1131,6 +1340,10 @@ ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
   unsigned int httpflags;
   char *httphost = NULL;
   unsigned int tries = SEND_REQUEST_RETRIES;
+  char *server = NULL;
+  char *query = NULL;
+  struct revalidate_s reval = { NULL, NULL, 0 };
+  int cached = 0;
 
   *r_fp = NULL;
 
@@ -1171,6 +1384,20 @@ ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
       return gpg_error (GPG_ERR_INV_USER_ID);
     }
 
+  /* Look into the cache.  */
+  server = cache_server_name (uri);
+  query = server? strconcat ("search ", pattern, NULL) : NULL;
+  if (!query)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (!ks_cache_get (server, query, &fp, &reval.etag, &reval.lastmod))
+    {
+      cached = 1;
+      goto use_fp;
+    }
+
   /* Build the request string.  */
   reselect = 0;
  again:
@@ -1206,16 +1433,22 @@ ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 
   /* Send the request.  */
   err = send_request (ctrl, request, hostport, httphost, httpflags,
-                      NULL, NULL, &fp);
+                      NULL, NULL, &reval, &fp);
   if (handle_send_request_error (err, request, &tries))
     {
       reselect = 1;
       goto again;
     }
+  if (!err && reval.not_modified)
+    {
+      err = ks_cache_refresh (server, query, &fp);
+      cached = 1;
+    }
   if (err)
     goto leave;
 
-  err = dirmngr_status (ctrl, "SOURCE", hostport, NULL);
+ use_fp:
+  err = dirmngr_status (ctrl, "SOURCE", hostport? hostport : server, NULL);
   if (err)
     goto leave;
 
@@ -1238,6 +1471,13 @@ ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
     es_ungetc (c, fp);
   }
 
+  if (!cached)
+    {
+      err = ks_cache_store (server, query, reval.etag, reval.lastmod, &fp);
+      if (err)
+        goto leave;
+    }
+
   /* Return the read stream.  */
   *r_fp = fp;
   fp = NULL;
@@ -1247,6 +1487,10 @@ ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
   xfree (request);
   xfree (hostport);
   xfree (httphost);
+  xfree (server);
+  xfree (query);
+  xfree (reval.etag);
+  xfree (reval.lastmod);
   return err;
 }
 
@@ -1270,6 +1514,9 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
   char *httphost = NULL;
   unsigned int httpflags;
   unsigned int tries = SEND_REQUEST_RETRIES;
+  char *server = NULL;
+  char *query = NULL;
+  struct revalidate_s reval = { NULL, NULL, 0 };
 
   *r_fp = NULL;
 
@@ -1315,6 +1562,21 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
       goto leave;
     }
 
+  /* Look into the cache.  */
+  server = cache_server_name (uri);
+  query = server? strconcat ("get ", searchkey,
+                             exactname? " exact" : "", NULL) : NULL;
+  if (!query)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (!ks_cache_get (server, query, &fp, &reval.etag, &reval.lastmod))
+    {
+      err = dirmngr_status (ctrl, "SOURCE", server, NULL);
+      goto return_fp;
+    }
+
   reselect = 0;
  again:
   /* Build the request string.  */
@@ -1339,7 +1601,7 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
 
   /* Send the request.  */
   err = send_request (ctrl, request, hostport, httphost, httpflags,
-                      NULL, NULL, &fp);
+                      NULL, NULL, &reval, &fp);
   if (handle_send_request_error (err, request, &tries))
     {
       reselect = 1;
@@ -1348,7 +1610,16 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
   if (err)
     goto leave;
 
+  if (reval.not_modified)
+    err = ks_cache_refresh (server, query, &fp);
+  else
+    err = ks_cache_store (server, query, reval.etag, reval.lastmod, &fp);
+  if (err)
+    goto leave;
+
   err = dirmngr_status (ctrl, "SOURCE", hostport, NULL);
+
+ return_fp:
   if (err)
     goto leave;
 
@@ -1362,6 +1633,10 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
   xfree (hostport);
   xfree (httphost);
   xfree (searchkey);
+  xfree (server);
+  xfree (query);
+  xfree (reval.etag);
+  xfree (reval.lastmod);
   return err;
 }
 
@@ -1447,7 +1722,7 @@ ks_hkp_put (ctrl_t ctrl, parsed_uri_t uri, const void *data, size_t datalen)
 
   /* Send the request.  */
   err = send_request (ctrl, request, hostport, httphost, 0,
-                      put_post_cb, &parm, &fp);
+                      put_post_cb, &parm, NULL, &fp);
   if (handle_send_request_error (err, request, &tries))
     {
       reselect = 1;
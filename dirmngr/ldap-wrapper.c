@@ -39,6 +39,17 @@
    4. Given that we are going out to the network and usually get back
       a long response, the fork/exec overhead is acceptable.
 
+   To avoid starting a process, connecting and binding for each query,
+   the wrapper processes are kept running by default (see
+   --ldap-max-workers).  Such a persistent worker runs dirmngr_ldap
+   with --server and reads one request after the other from its stdin,
+   each being the list of arguments for a query.  The response on
+   stdout is sent in chunks, each prefixed by its length as a 4 byte
+   big endian number; a chunk of length 0 ends the response.  The
+   bound LDAP connections are kept by the worker between requests.
+   Idle workers are terminated after IDLE_TIMEOUT seconds by closing
+   their stdin.
+
    Note that under WindowsCE the number of processes is strongly
    limited (32 processes including the kernel processes) and thus we
    don't use the process approach but implement a different wrapper in
@@ -60,6 +71,7 @@
 #include "dirmngr.h"
 #include "exechelp.h"
 #include "misc.h"
+#include "host2net.h"
 #include "ldap-wrapper.h"
 
 
@@ -84,6 +96,8 @@
 
 #define TIMERTICK_INTERVAL 2
 
+#define IDLE_TIMEOUT 120  /* seconds */
+
 /* To keep track of the LDAP wrapper state we use this structure.  */
 struct wrapper_context_s
 {
@@ -103,6 +117,17 @@ struct wrapper_context_s
   size_t linesize;/* Allocated size of LINE.  */
   size_t linelen; /* Use size of LINE.  */
   time_t stamp;   /* The last time we noticed ativity.  */
+
+  /* The remaining fields are used by persistent workers.  */
+  int in_fd;      /* Connected with stdin of the worker or -1 if this is
+                     not a persistent worker.  */
+  char *server;   /* The server this worker is used for (malloced).  */
+  int idle;       /* The worker waits for a request.  */
+  int retired;    /* The worker will not be used again.  */
+  int eof;        /* The end of the response has been read.  */
+  unsigned char hdr[4]; /* The chunk header being read.  */
+  size_t hdrlen;        /* Number of bytes in HDR.  */
+  size_t chunk_left;    /* Bytes of the current chunk not yet read.  */
 };
 
 
@@ -115,6 +140,10 @@ static struct wrapper_context_s *wrapper_list;
 /* We need to know whether we are shutting down the process.  */
 static int shutting_down;
 
+/* Signaled when a persistent worker becomes idle or terminates.  */
+static npth_mutex_t pool_lock;
+static npth_cond_t pool_cond;
+
 /* Close the pth file descriptor FD and set it to -1.  */
 #define SAFE_CLOSE(fd) \
   do { int _fd = fd; if (_fd != -1) { close (_fd); fd = -1;} } while (0)
@@ -153,11 +182,42 @@ destroy_wrapper (struct wrapper_context_s *ctx)
   ksba_reader_release (ctx->reader);
   SAFE_CLOSE (ctx->fd);
   SAFE_CLOSE (ctx->log_fd);
+  SAFE_CLOSE (ctx->in_fd);
+  xfree (ctx->server);
   xfree (ctx->line);
   xfree (ctx);
 }
 
 
+/* Wake up all threads waiting for a persistent worker.  */
+static void
+wake_waiters (void)
+{
+  npth_mutex_lock (&pool_lock);
+  npth_cond_broadcast (&pool_cond);
+  npth_mutex_unlock (&pool_lock);
+}
+
+
+/* Make sure that the persistent worker CTX is not used again.  The
+   worker terminates when it sees its stdin closed; if the response
+   has not been read completely, it is killed.  */
+static void
+retire_worker (struct wrapper_context_s *ctx)
+{
+  ctx->idle = 0;
+  ctx->retired = 1;
+  SAFE_CLOSE (ctx->in_fd);
+  if (!ctx->eof)
+    {
+      SAFE_CLOSE (ctx->fd);
+      if (ctx->pid != (pid_t)(-1))
+        gnupg_kill_process (ctx->pid);
+    }
+  wake_waiters ();
+}
+
+
 /* Print the content of LINE to thye log stream but make sure to only
    print complete lines.  Using NULL for LINE will flush any pending
    output.  LINE may be modified by this fucntion. */
@@ -262,23 +322,10 @@ ldap_wrapper_thread (void *dummy)
   int saved_errno;
   fd_set fdset, read_fdset;
   int ret;
-  time_t exptime;
+  time_t exptime, idle_exptime;
 
   (void)dummy;
 
-  FD_ZERO (&fdset);
-  nfds = -1;
-  for (ctx = wrapper_list; ctx; ctx = ctx->next)
-    {
-      if (ctx->log_fd != -1)
-	{
-	  FD_SET (ctx->log_fd, &fdset);
-	  if (ctx->log_fd > nfds)
-	    nfds = ctx->log_fd;
-	}
-    }
-  nfds++;
-
   npth_clock_gettime (&abstime);
   abstime.tv_sec += TIMERTICK_INTERVAL;
 
@@ -286,6 +333,21 @@ ldap_wrapper_thread (void *dummy)
     {
       int any_action = 0;
 
+      /* The list of wrappers changes; thus we need to set up the
+         descriptors each time.  */
+      FD_ZERO (&fdset);
+      nfds = -1;
+      for (ctx = wrapper_list; ctx; ctx = ctx->next)
+        {
+          if (ctx->log_fd != -1)
+            {
+              FD_SET (ctx->log_fd, &fdset);
+              if (ctx->log_fd > nfds)
+                nfds = ctx->log_fd;
+            }
+        }
+      nfds++;
+
       /* POSIX says that fd_set should be implemented as a structure,
          thus a simple assignment is fine to copy the entire set.  */
       read_fdset = fdset;
@@ -313,15 +375,22 @@ ldap_wrapper_thread (void *dummy)
           continue;
 	}
 
-      if (ret <= 0)
-	/* Interrupt or timeout.  Will be handled when calculating the
-	   next timeout.  */
+      if (ret < 0)
+	/* Interrupt.  Will be handled when calculating the next
+	   timeout.  */
 	continue;
 
+      /* On a timeout we still need to look after the processes.  */
+      if (!ret)
+        FD_ZERO (&read_fdset);
+
       /* All timestamps before exptime should be considered expired.  */
       exptime = time (NULL);
+      idle_exptime = exptime;
       if (exptime > INACTIVITY_TIMEOUT)
         exptime -= INACTIVITY_TIMEOUT;
+      if (idle_exptime > IDLE_TIMEOUT)
+        idle_exptime -= IDLE_TIMEOUT;
 
       /* Note that there is no need to lock the list because we always
          add entries at the head (with a pending event status) and
@@ -351,6 +420,13 @@ ldap_wrapper_thread (void *dummy)
                   ctx->ready = 1;
 		  gnupg_release_process (ctx->pid);
                   ctx->pid = (pid_t)(-1);
+                  if (ctx->server)
+                    {
+                      /* A persistent worker can't be used anymore.  */
+                      ctx->idle = 0;
+                      ctx->retired = 1;
+                      wake_waiters ();
+                    }
                   any_action = 1;
                 }
               else if (gpg_err_code (err) == GPG_ERR_GENERAL)
@@ -364,6 +440,13 @@ ldap_wrapper_thread (void *dummy)
                   ctx->ready = 1;
 		  gnupg_release_process (ctx->pid);
                   ctx->pid = (pid_t)(-1);
+                  if (ctx->server)
+                    {
+                      /* A persistent worker can't be used anymore.  */
+                      ctx->idle = 0;
+                      ctx->retired = 1;
+                      wake_waiters ();
+                    }
                   any_action = 1;
                 }
               else if (gpg_err_code (err) != GPG_ERR_TIMEOUT)
@@ -374,8 +457,19 @@ ldap_wrapper_thread (void *dummy)
                 }
             }
 
+          /* Let an idle worker terminate after some time.  */
+          if (ctx->idle && ctx->pid != (pid_t)(-1)
+              && ctx->stamp < idle_exptime)
+            {
+              if (opt.verbose)
+                log_info ("ldap wrapper %d idle - terminating\n",
+                          (int)ctx->pid);
+              retire_worker (ctx);
+              any_action = 1;
+            }
+
           /* Check whether we should terminate the process. */
-          if (ctx->pid != (pid_t)(-1)
+          if (ctx->pid != (pid_t)(-1) && !ctx->idle
               && ctx->stamp != (time_t)(-1) && ctx->stamp < exptime)
             {
               gnupg_kill_process (ctx->pid);
@@ -396,12 +490,14 @@ ldap_wrapper_thread (void *dummy)
         {
           log_info ("ldap worker stati:\n");
           for (ctx = wrapper_list; ctx; ctx = ctx->next)
-            log_info ("  c=%p pid=%d/%d rdr=%p ctrl=%p/%d la=%lu rdy=%d\n",
+            log_info ("  c=%p pid=%d/%d rdr=%p ctrl=%p/%d la=%lu rdy=%d"
+                      " idle=%d srv=%s\n",
                       ctx,
                       (int)ctx->pid, (int)ctx->printable_pid,
                       ctx->reader,
                       ctx->ctrl, ctx->ctrl? ctx->ctrl->refcount:0,
-                      (unsigned long)ctx->stamp, ctx->ready);
+                      (unsigned long)ctx->stamp, ctx->ready,
+                      ctx->idle, ctx->server? ctx->server : "-");
         }
 
 
@@ -442,6 +538,16 @@ ldap_wrapper_launch_thread (void)
     return;
   done = 1;
 
+  err = npth_mutex_init (&pool_lock, NULL);
+  if (!err)
+    err = npth_cond_init (&pool_cond, NULL);
+  if (err)
+    {
+      log_error ("error initializing the ldap worker pool: %s\n",
+                 strerror (err));
+      dirmngr_exit (1);
+    }
+
   npth_attr_init (&tattr);
   npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
 
@@ -465,7 +571,18 @@ ldap_wrapper_launch_thread (void)
 void
 ldap_wrapper_wait_connections ()
 {
+  struct wrapper_context_s *ctx;
+
   shutting_down = 1;
+  /* Tell the persistent workers to terminate.  */
+  for (ctx = wrapper_list; ctx; ctx = ctx->next)
+    if (ctx->in_fd != -1)
+      {
+        ctx->idle = 0;
+        ctx->retired = 1;
+        SAFE_CLOSE (ctx->in_fd);
+      }
+  wake_waiters ();
   /* FIXME: This is a busy wait.  */
   while (wrapper_list)
     npth_usleep (200);
@@ -493,7 +610,6 @@ ldap_wrapper_release_context (ksba_reader_t reader)
                     ctx->ctrl, ctx->ctrl? ctx->ctrl->refcount:0);
 
         ctx->reader = NULL;
-        SAFE_CLOSE (ctx->fd);
         if (ctx->ctrl)
           {
             ctx->ctrl->refcount--;
@@ -502,6 +618,19 @@ ldap_wrapper_release_context (ksba_reader_t reader)
         if (ctx->fd_error)
           log_info (_("reading from ldap wrapper %d failed: %s\n"),
                     ctx->printable_pid, gpg_strerror (ctx->fd_error));
+        if (ctx->in_fd == -1)
+          SAFE_CLOSE (ctx->fd);
+        else if (ctx->eof && !ctx->fd_error && !ctx->retired
+                 && !ctx->ready && !shutting_down)
+          {
+            /* The response has been read; the worker may be used for
+               the next request.  */
+            ctx->idle = 1;
+            ctx->stamp = time (NULL);
+            wake_waiters ();
+          }
+        else
+          retire_worker (ctx);
         break;
       }
 }
@@ -518,7 +647,12 @@ ldap_wrapper_connection_cleanup (ctrl_t ctrl)
       {
         ctx->ctrl->refcount--;
         ctx->ctrl = NULL;
-        if (ctx->pid != (pid_t)(-1))
+        if (ctx->server)
+          {
+            ctx->eof = 0;  /* Make sure it gets killed.  */
+            retire_worker (ctx);
+          }
+        else if (ctx->pid != (pid_t)(-1))
           gnupg_kill_process (ctx->pid);
         if (ctx->fd_error)
           log_info (_("reading from ldap wrapper %d failed: %s\n"),
@@ -527,54 +661,32 @@ ldap_wrapper_connection_cleanup (ctrl_t ctrl)
 }
 
 
-/* This is the callback used by the ldap wrapper to feed the ksba
-   reader with the wrappers stdout.  See the description of
-   ksba_reader_set_cb for details.  */
+/* Read up to COUNT bytes of the wrapper's stdout into BUFFER and
+   wait until data is available.  ABSTIME is the time of the next
+   tick of the connection.  Returns the number of bytes read, 0 on
+   EOF and -1 on error; in the latter case the error has been stored
+   in CTX.  */
 static int
-reader_callback (void *cb_value, char *buffer, size_t count,  size_t *nread)
+read_output (struct wrapper_context_s *ctx, char *buffer, size_t count,
+             struct timespec *abstime)
 {
-  struct wrapper_context_s *ctx = cb_value;
-  size_t nleft = count;
   int nfds;
-  struct timespec abstime;
   struct timespec curtime;
   struct timespec timeout;
   int saved_errno;
   fd_set fdset, read_fdset;
   int ret;
-
-  /* FIXME: We might want to add some internal buffering because the
-     ksba code does not do any buffering for itself (because a ksba
-     reader may be detached from another stream to read other data and
-     the it would be cumbersome to get back already buffered
-     stuff).  */
-
-  if (!buffer && !count && !nread)
-    return -1; /* Rewind is not supported. */
-
-  /* If we ever encountered a read error don't allow to continue and
-     possible overwrite the last error cause.  Bail out also if the
-     file descriptor has been closed. */
-  if (ctx->fd_error || ctx->fd == -1)
-    {
-      *nread = 0;
-      return -1;
-    }
+  int n;
+  gpg_error_t err;
 
   FD_ZERO (&fdset);
   FD_SET (ctx->fd, &fdset);
   nfds = ctx->fd + 1;
 
-  npth_clock_gettime (&abstime);
-  abstime.tv_sec += TIMERTICK_INTERVAL;
-
-  while (nleft > 0)
+  for (;;)
     {
-      int n;
-      gpg_error_t err;
-
       npth_clock_gettime (&curtime);
-      if (!(npth_timercmp (&curtime, &abstime, <)))
+      if (!(npth_timercmp (&curtime, abstime, <)))
 	{
 	  err = dirmngr_tick (ctx->ctrl);
           if (err)
@@ -583,10 +695,10 @@ reader_callback (void *cb_value, char *buffer, size_t count,  size_t *nread)
               SAFE_CLOSE (ctx->fd);
               return -1;
             }
-	  npth_clock_gettime (&abstime);
-	  abstime.tv_sec += TIMERTICK_INTERVAL;
+	  npth_clock_gettime (abstime);
+	  abstime->tv_sec += TIMERTICK_INTERVAL;
 	}
-      npth_timersub (&abstime, &curtime, &timeout);
+      npth_timersub (abstime, &curtime, &timeout);
 
       read_fdset = fdset;
       ret = npth_pselect (nfds, &read_fdset, NULL, NULL, &timeout, NULL);
@@ -607,101 +719,183 @@ reader_callback (void *cb_value, char *buffer, size_t count,  size_t *nread)
 	 (and it is slightly dangerous in the sense that a concurrent
 	 thread might (accidentially?) change the status of ctx->fd
 	 before we read.  FIXME: Set ctx->fd to nonblocking?  */
-      n = read (ctx->fd, buffer, nleft);
+      n = read (ctx->fd, buffer, count);
       if (n < 0)
         {
           ctx->fd_error = gpg_error_from_errno (errno);
           SAFE_CLOSE (ctx->fd);
           return -1;
         }
-      else if (!n)
-        {
-          if (nleft == count)
-	    return -1; /* EOF. */
-          break;
-        }
-      nleft -= n;
-      buffer += n;
       if (n > 0 && ctx->stamp != (time_t)(-1))
         ctx->stamp = time (NULL);
+      return n;
+    }
+}
+
+
+/* This is the callback used by the ldap wrapper to feed the ksba
+   reader with the wrappers stdout.  See the description of
+   ksba_reader_set_cb for details.  For a persistent worker the
+   chunks of the response are returned up to the end of the
+   response.  */
+static int
+reader_callback (void *cb_value, char *buffer, size_t count,  size_t *nread)
+{
+  struct wrapper_context_s *ctx = cb_value;
+  size_t nleft = count;
+  size_t n;
+  struct timespec abstime;
+  int ret;
+
+  /* FIXME: We might want to add some internal buffering because the
+     ksba code does not do any buffering for itself (because a ksba
+     reader may be detached from another stream to read other data and
+     the it would be cumbersome to get back already buffered
+     stuff).  */
+
+  if (!buffer && !count && !nread)
+    return -1; /* Rewind is not supported. */
+
+  /* If we ever encountered a read error don't allow to continue and
+     possible overwrite the last error cause.  Bail out also if the
+     file descriptor has been closed. */
+  if (ctx->fd_error || ctx->fd == -1)
+    {
+      *nread = 0;
+      return -1;
+    }
+
+  npth_clock_gettime (&abstime);
+  abstime.tv_sec += TIMERTICK_INTERVAL;
+
+  while (nleft > 0 && !ctx->eof)
+    {
+      if (ctx->in_fd != -1 && !ctx->chunk_left)
+        {
+          /* Read the header of the next chunk.  */
+          ret = read_output (ctx, (char *)ctx->hdr + ctx->hdrlen,
+                             sizeof ctx->hdr - ctx->hdrlen, &abstime);
+          if (ret < 0)
+            return -1;
+          if (!ret)
+            break;  /* The worker terminated.  */
+          ctx->hdrlen += ret;
+          if (ctx->hdrlen < sizeof ctx->hdr)
+            continue;
+          ctx->hdrlen = 0;
+          ctx->chunk_left = buf32_to_size_t (ctx->hdr);
+          if (!ctx->chunk_left)
+            ctx->eof = 1;  /* End of the response.  */
+          continue;
+        }
+
+      n = nleft;
+      if (ctx->in_fd != -1 && n > ctx->chunk_left)
+        n = ctx->chunk_left;
+      ret = read_output (ctx, buffer, n, &abstime);
+      if (ret < 0)
+        return -1;
+      if (!ret)
+        break;  /* EOF.  */
+      if (ctx->in_fd != -1)
+        ctx->chunk_left -= ret;
+      nleft -= ret;
+      buffer += ret;
     }
+  if (nleft == count)
+    return -1; /* EOF. */
   *nread = count - nleft;
 
   return 0;
 }
 
-/* Fork and exec the LDAP wrapper and return a new libksba reader
-   object at READER.  ARGV is a NULL terminated list of arguments for
-   the wrapper.  The function returns 0 on success or an error code.
 
-   Special hack to avoid passing a password through the command line
-   which is globally visible: If the first element of ARGV is "--pass"
-   it will be removed and instead the environment variable
-   DIRMNGR_LDAP_PASS will be set to the next value of ARGV.  On modern
-   OSes the environment is not visible to other users.  For those old
-   systems where it can't be avoided, we don't want to go into the
-   hassle of passing the password via stdin; it's just too complicated
-   and an LDAP password used for public directory lookups should not
-   be that confidential.  */
-gpg_error_t
-ldap_wrapper (ctrl_t ctrl, ksba_reader_t *reader, const char *argv[])
+/* Return a malloced string identifying the LDAP server used by the
+   request ARGV.  The number of persistent workers is limited per
+   server.  Returns NULL on error.  */
+static char *
+server_of_request (const char *argv[])
+{
+  const char *host = NULL;
+  const char *port = NULL;
+  const char *url = NULL;
+  const char *s;
+  char *p;
+  size_t n;
+  int i;
+
+  for (i=0; argv[i]; i++)
+    {
+      if (*argv[i] != '-')
+        {
+          if (!url)
+            url = argv[i];
+        }
+      else if (!argv[i+1])
+        ;
+      else if (!strcmp (argv[i], "--proxy"))
+        return xtrystrdup (argv[i+1]);
+      else if (!strcmp (argv[i], "--host"))
+        host = argv[++i];
+      else if (!strcmp (argv[i], "--port"))
+        port = argv[++i];
+      else if (!strcmp (argv[i], "--pass") || !strcmp (argv[i], "--user")
+               || !strcmp (argv[i], "--dn") || !strcmp (argv[i], "--filter")
+               || !strcmp (argv[i], "--attr")
+               || !strcmp (argv[i], "--timeout"))
+        i++;
+    }
+
+  if (host)
+    return strconcat (host, ":", port? port : "", NULL);
+
+  /* Take the host and port from the URL.  */
+  if (url && (s = strstr (url, "://")))
+    {
+      s += 3;
+      n = strcspn (s, "/?");
+      p = xtrymalloc (n + 1);
+      if (p)
+        {
+          memcpy (p, s, n);
+          p[n] = 0;
+        }
+      return p;
+    }
+  return xtrystrdup ("");
+}
+
+
+/* Start the wrapper program with the arguments ARG_LIST and store a
+   new context for it at R_CTX.  If PERSISTENT is set, a pipe to the
+   stdin of the process is created.  */
+static gpg_error_t
+spawn_wrapper (const char **arg_list, int persistent,
+               struct wrapper_context_s **r_ctx)
 {
   gpg_error_t err;
   pid_t pid;
   struct wrapper_context_s *ctx;
-  int i;
-  int j;
-  const char **arg_list;
   const char *pgmname;
-  int outpipe[2], errpipe[2];
+  int outpipe[2], errpipe[2], inpipe[2];
 
-  /* It would be too simple to connect stderr just to our logging
-     stream.  The problem is that if we are running multi-threaded
-     everything gets intermixed.  Clearly we don't want this.  So the
-     only viable solutions are either to have another thread
-     responsible for logging the messages or to add an option to the
-     wrapper module to do the logging on its own.  Given that we anyway
-     need a way to rip the child process and this is best done using a
-     general ripping thread, that thread can do the logging too. */
-
-  *reader = NULL;
+  *r_ctx = NULL;
 
-  /* Files: We need to prepare stdin and stdout.  We get stderr from
-     the function.  */
   if (!opt.ldap_wrapper_program || !*opt.ldap_wrapper_program)
     pgmname = gnupg_module_name (GNUPG_MODULE_NAME_DIRMNGR_LDAP);
   else
     pgmname = opt.ldap_wrapper_program;
 
-  /* Create command line argument array.  */
-  for (i = 0; argv[i]; i++)
-    ;
-  arg_list = xtrycalloc (i + 2, sizeof *arg_list);
-  if (!arg_list)
-    {
-      err = gpg_error_from_syserror ();
-      log_error (_("error allocating memory: %s\n"), strerror (errno));
-      return err;
-    }
-  for (i = j = 0; argv[i]; i++, j++)
-    if (!i && argv[i + 1] && !strcmp (*argv, "--pass"))
-      {
-	arg_list[j] = "--env-pass";
-	setenv ("DIRMNGR_LDAP_PASS", argv[1], 1);
-	i++;
-      }
-    else
-      arg_list[j] = (char*) argv[i];
-
   ctx = xtrycalloc (1, sizeof *ctx);
   if (!ctx)
     {
       err = gpg_error_from_syserror ();
       log_error (_("error allocating memory: %s\n"), strerror (errno));
-      xfree (arg_list);
       return err;
     }
+  ctx->in_fd = -1;
 
+  inpipe[0] = inpipe[1] = -1;
   err = gnupg_create_inbound_pipe (outpipe);
   if (!err)
     {
@@ -712,23 +906,36 @@ ldap_wrapper (ctrl_t ctrl, ksba_reader_t *reader, const char *argv[])
           close (outpipe[1]);
         }
     }
+  if (!err && persistent)
+    {
+      err = gnupg_create_outbound_pipe (inpipe);
+      if (err)
+        {
+          close (outpipe[0]);
+          close (outpipe[1]);
+          close (errpipe[0]);
+          close (errpipe[1]);
+        }
+    }
   if (err)
     {
       log_error (_("error creating a pipe: %s\n"), gpg_strerror (err));
-      xfree (arg_list);
       xfree (ctx);
       return err;
     }
 
   err = gnupg_spawn_process_fd (pgmname, arg_list,
-                                -1, outpipe[1], errpipe[1], &pid);
-  xfree (arg_list);
+                                inpipe[0], outpipe[1], errpipe[1], &pid);
   close (outpipe[1]);
   close (errpipe[1]);
+  if (inpipe[0] != -1)
+    close (inpipe[0]);
   if (err)
     {
       close (outpipe[0]);
       close (errpipe[0]);
+      if (inpipe[1] != -1)
+        close (inpipe[1]);
       xfree (ctx);
       return err;
     }
@@ -737,9 +944,219 @@ ldap_wrapper (ctrl_t ctrl, ksba_reader_t *reader, const char *argv[])
   ctx->printable_pid = (int) pid;
   ctx->fd = outpipe[0];
   ctx->log_fd = errpipe[0];
+  ctx->in_fd = inpipe[1];
+  ctx->stamp = time (NULL);
+  *r_ctx = ctx;
+  return 0;
+}
+
+
+/* Send the request ARGV to the persistent worker CTX.  See
+   dirmngr_ldap.c for the format.  */
+static gpg_error_t
+send_request (struct wrapper_context_s *ctx, const char *argv[])
+{
+  gpg_error_t err = 0;
+  membuf_t mb;
+  char *buffer, *p;
+  size_t len, buflen;
+  int i, n;
+
+  init_membuf (&mb, 512);
+  for (i=0; argv[i]; i++)
+    {
+      put_membuf (&mb, "A", 1);
+      put_membuf (&mb, argv[i], strlen (argv[i]) + 1);
+    }
+  put_membuf (&mb, "", 1);
+  buffer = get_membuf (&mb, &buflen);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+
+  for (p = buffer, len = buflen; len; p += n, len -= n)
+    {
+      n = npth_write (ctx->in_fd, p, len);
+      if (n < 0 && errno == EINTR)
+        n = 0;
+      else if (n <= 0)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("error sending request to ldap wrapper %d: %s\n",
+                     ctx->printable_pid, strerror (errno));
+          break;
+        }
+    }
+
+  /* The request may include a password.  */
+  wipememory (buffer, buflen);
+  xfree (buffer);
+  return err;
+}
+
+
+/* Find an idle persistent worker for the request ARGV, or start a
+   new one, and send the request to it.  If the maximum number of
+   workers for the server of the request are all busy, wait for one
+   of them.  On success the worker is stored at R_CTX.  */
+static gpg_error_t
+run_persistent_worker (const char *argv[], struct wrapper_context_s **r_ctx)
+{
+  static const char *worker_args[] = { "--server", "--log-with-pid", NULL };
+  gpg_error_t err;
+  struct wrapper_context_s *ctx;
+  char *server;
+  unsigned int count;
+  int tries;
+
+  *r_ctx = NULL;
+
+  server = server_of_request (argv);
+  if (!server)
+    return gpg_error_from_syserror ();
+
+  for (tries=0; ; tries++)
+    {
+      for (;;)
+        {
+          if (shutting_down)
+            {
+              err = gpg_error (GPG_ERR_CANCELED);
+              goto leave;
+            }
+          count = 0;
+          for (ctx = wrapper_list; ctx; ctx = ctx->next)
+            if (ctx->server && !ctx->retired && !ctx->ready
+                && ctx->pid != (pid_t)(-1) && !strcmp (ctx->server, server))
+              {
+                if (ctx->idle)
+                  break;
+                count++;
+              }
+          if (ctx)
+            break;  /* Found an idle worker.  */
+
+          if (count < opt.ldap_max_workers)
+            {
+              err = spawn_wrapper (worker_args, 1, &ctx);
+              if (err)
+                goto leave;
+              ctx->server = xtrystrdup (server);
+              if (!ctx->server)
+                {
+                  err = gpg_error_from_syserror ();
+                  destroy_wrapper (ctx);
+                  goto leave;
+                }
+              ctx->next = wrapper_list;
+              wrapper_list = ctx;
+              if (opt.verbose)
+                log_info ("ldap wrapper %d started for '%s'\n",
+                          (int)ctx->pid, server);
+              break;
+            }
+
+          npth_mutex_lock (&pool_lock);
+          npth_cond_wait (&pool_cond, &pool_lock);
+          npth_mutex_unlock (&pool_lock);
+        }
+
+      ctx->idle = 0;
+      ctx->eof = 0;
+      ctx->hdrlen = 0;
+      ctx->chunk_left = 0;
+      ctx->fd_error = 0;
+      ctx->stamp = time (NULL);
+
+      err = send_request (ctx, argv);
+      if (!err)
+        break;
+      /* The worker might just have terminated; try another one.  */
+      retire_worker (ctx);
+      if (tries)
+        goto leave;
+    }
+
+  *r_ctx = ctx;
+
+ leave:
+  xfree (server);
+  return err;
+}
+
+
+/* Run the LDAP wrapper for the query ARGV and return a new libksba
+   reader object at READER.  ARGV is a NULL terminated list of
+   arguments for the wrapper.  The function returns 0 on success or
+   an error code.  The query is run by a persistent worker unless
+   --ldap-max-workers is 0; in that case a new wrapper process is
+   started.
+
+   Special hack to avoid passing a password through the command line
+   which is globally visible: If the first element of ARGV is "--pass"
+   it will be removed and instead the environment variable
+   DIRMNGR_LDAP_PASS will be set to the next value of ARGV.  On modern
+   OSes the environment is not visible to other users.  For those old
+   systems where it can't be avoided, we don't want to go into the
+   hassle of passing the password via stdin; it's just too complicated
+   and an LDAP password used for public directory lookups should not
+   be that confidential.  Persistent workers get the password along
+   with the request on their stdin.  */
+gpg_error_t
+ldap_wrapper (ctrl_t ctrl, ksba_reader_t *reader, const char *argv[])
+{
+  gpg_error_t err;
+  struct wrapper_context_s *ctx;
+  int i;
+  int j;
+  const char **arg_list;
+
+  /* It would be too simple to connect stderr just to our logging
+     stream.  The problem is that if we are running multi-threaded
+     everything gets intermixed.  Clearly we don't want this.  So the
+     only viable solutions are either to have another thread
+     responsible for logging the messages or to add an option to the
+     wrapper module to do the logging on its own.  Given that we anyway
+     need a way to rip the child process and this is best done using a
+     general ripping thread, that thread can do the logging too. */
+
+  *reader = NULL;
+
+  if (opt.ldap_max_workers)
+    {
+      err = run_persistent_worker (argv, &ctx);
+      if (err)
+        return err;
+    }
+  else
+    {
+      /* Create command line argument array.  */
+      for (i = 0; argv[i]; i++)
+        ;
+      arg_list = xtrycalloc (i + 2, sizeof *arg_list);
+      if (!arg_list)
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("error allocating memory: %s\n"), strerror (errno));
+          return err;
+        }
+      for (i = j = 0; argv[i]; i++, j++)
+        if (!i && argv[i + 1] && !strcmp (*argv, "--pass"))
+          {
+            arg_list[j] = "--env-pass";
+            setenv ("DIRMNGR_LDAP_PASS", argv[1], 1);
+            i++;
+          }
+        else
+          arg_list[j] = (char*) argv[i];
+
+      err = spawn_wrapper (arg_list, 0, &ctx);
+      xfree (arg_list);
+      if (err)
+        return err;
+    }
+
   ctx->ctrl = ctrl;
   ctrl->refcount++;
-  ctx->stamp = time (NULL);
 
   err = ksba_reader_new (reader);
   if (!err)
@@ -748,16 +1165,26 @@ ldap_wrapper (ctrl_t ctrl, ksba_reader_t *reader, const char *argv[])
     {
       log_error (_("error initializing reader object: %s\n"),
                  gpg_strerror (err));
-      destroy_wrapper (ctx);
       ksba_reader_release (*reader);
       *reader = NULL;
+      if (ctx->server)
+        {
+          ctx->ctrl->refcount--;
+          ctx->ctrl = NULL;
+          retire_worker (ctx);
+        }
+      else
+        destroy_wrapper (ctx);
       return err;
     }
 
   /* Hook the context into our list of running wrappers.  */
   ctx->reader = *reader;
-  ctx->next = wrapper_list;
-  wrapper_list = ctx;
+  if (!ctx->server)
+    {
+      ctx->next = wrapper_list;
+      wrapper_list = ctx;
+    }
   if (opt.verbose)
     log_info ("ldap wrapper %d started (reader %p)\n",
               (int)ctx->pid, ctx->reader);
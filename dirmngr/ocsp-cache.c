@@ -0,0 +1,313 @@
+/* ocsp-cache.c - Cache of OCSP status
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The file OCSP_CACHE_FILE in the cache directory has one line for
+   each cached status; lines starting with '#' are comments.  The
+   fields are separated by a space:
+
+     <hex encoded key> <stored_at> <g|r> <reason> <this_update>
+     <next_update> <revocation_time> <valid_if>
+
+   STORED_AT is given in seconds since the epoch, the times in ISO
+   format and an empty field as "-".  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dirmngr.h"
+#include "ocsp-cache.h"
+
+
+/* The number of hash buckets of the response cache.  */
+#define OCSP_CACHE_BUCKETS 256
+
+/* The maximum number of certificates we keep a status for.  */
+#define MAX_OCSP_CACHE_ITEMS 4096
+
+/* The file in the cache directory used to keep the cached status
+   across restarts.  */
+#define OCSP_CACHE_FILE "ocsp-cache.txt"
+
+static ocsp_cache_item_t ocsp_cache[OCSP_CACHE_BUCKETS];
+static unsigned int ocsp_cache_count;
+static int ocsp_cache_dirty;   /* The cache needs to be written to disk.  */
+
+
+/* Return true if the cached ITEM may still be used at NOW, which is
+   also given as CURRENT_TIME.  */
+static int
+cache_item_is_current (ocsp_cache_item_t item, time_t now,
+                       const ksba_isotime_t current_time)
+{
+  if (now < item->stored_at
+      || (unsigned long)(now - item->stored_at) > opt.ocsp_cache_max_age)
+    return 0;
+  if (*item->next_update && strcmp (item->next_update, current_time) < 0)
+    return 0;
+  return 1;
+}
+
+
+/* Remove all items which may not be used anymore from the cache.  */
+static void
+ocsp_cache_purge (void)
+{
+  ocsp_cache_item_t item, *itemp;
+  ksba_isotime_t current_time;
+  time_t now;
+  int i;
+
+  now = gnupg_get_time ();
+  gnupg_get_isotime (current_time);
+  for (i=0; i < OCSP_CACHE_BUCKETS; i++)
+    for (itemp = &ocsp_cache[i]; (item = *itemp); )
+      {
+        if (cache_item_is_current (item, now, current_time))
+          itemp = &item->next;
+        else
+          {
+            *itemp = item->next;
+            xfree (item);
+            ocsp_cache_count--;
+            ocsp_cache_dirty = 1;
+          }
+      }
+}
+
+
+/* Return the cached status for KEY or NULL if there is none which
+   may still be used.  */
+ocsp_cache_item_t
+ocsp_cache_lookup (const unsigned char *key)
+{
+  ocsp_cache_item_t item, *itemp;
+  ksba_isotime_t current_time;
+
+  for (itemp = &ocsp_cache[*key]; (item = *itemp); itemp = &item->next)
+    if (!memcmp (item->key, key, 20))
+      break;
+  if (!item)
+    return NULL;
+
+  gnupg_get_isotime (current_time);
+  if (cache_item_is_current (item, gnupg_get_time (), current_time))
+    return item;
+
+  *itemp = item->next;
+  xfree (item);
+  ocsp_cache_count--;
+  ocsp_cache_dirty = 1;
+  return NULL;
+}
+
+
+/* Store a copy of RESULT, the status taken from a validated response,
+   in the cache.  An older status of the same certificate is
+   replaced.  If the cache is full and no item has expired, RESULT is
+   not stored.  */
+void
+ocsp_cache_put (const struct ocsp_cache_item_s *result)
+{
+  ocsp_cache_item_t item, next;
+
+  if (!opt.ocsp_cache_max_age)
+    return;
+  if (result->status != KSBA_STATUS_GOOD
+      && result->status != KSBA_STATUS_REVOKED)
+    return;
+
+  for (item = ocsp_cache[*result->key]; item; item = item->next)
+    if (!memcmp (item->key, result->key, 20))
+      break;
+  if (!item)
+    {
+      if (ocsp_cache_count >= MAX_OCSP_CACHE_ITEMS)
+        ocsp_cache_purge ();
+      if (ocsp_cache_count >= MAX_OCSP_CACHE_ITEMS)
+        return;
+      item = xtrymalloc (sizeof *item);
+      if (!item)
+        return;
+      item->next = ocsp_cache[*result->key];
+      ocsp_cache[*result->key] = item;
+      ocsp_cache_count++;
+    }
+  next = item->next;
+  *item = *result;
+  item->next = next;
+  ocsp_cache_dirty = 1;
+}
+
+
+/* Return an empty string for "-" and STRING otherwise.  */
+static const char *
+cache_field (const char *string)
+{
+  return strcmp (string, "-")? string : "";
+}
+
+
+/* Read the cached status saved by a previous run.  Failing to do so
+   is not an error.  */
+void
+ocsp_cache_init (void)
+{
+  char *fname;
+  estream_t fp;
+  char line[256];
+  char keyhex[41], status[2], this_update[16], next_update[16];
+  char revocation_time[16], valid_if[41];
+  unsigned long stored_at;
+  int reason;
+  struct ocsp_cache_item_s result;
+
+  if (!opt.ocsp_cache_max_age)
+    return;
+
+  fname = make_filename (opt.homedir_cache, OCSP_CACHE_FILE, NULL);
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        log_error (_("error opening '%s': %s\n"), fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  while (es_fgets (line, sizeof line, fp))
+    {
+      if (*line == '#')
+        continue;
+      if (sscanf (line, "%40s %lu %1s %d %15s %15s %15s %40s",
+                  keyhex, &stored_at, status, &reason, this_update,
+                  next_update, revocation_time, valid_if) != 8
+          || hex2bin (keyhex, result.key, 20) != 40
+          || (*status != 'g' && *status != 'r'))
+        {
+          log_info (_("invalid line in '%s' ignored\n"), fname);
+          continue;
+        }
+      result.stored_at = stored_at;
+      result.status = *status == 'g'? KSBA_STATUS_GOOD : KSBA_STATUS_REVOKED;
+      result.reason = reason;
+      strcpy (result.this_update, cache_field (this_update));
+      strcpy (result.next_update, cache_field (next_update));
+      strcpy (result.revocation_time, cache_field (revocation_time));
+      strcpy (result.valid_if, cache_field (valid_if));
+      ocsp_cache_put (&result);
+    }
+  if (es_ferror (fp))
+    log_error (_("error reading '%s': %s\n"), fname, strerror (errno));
+  es_fclose (fp);
+  xfree (fname);
+
+  ocsp_cache_purge ();
+  ocsp_cache_dirty = 0;
+  if (opt.verbose)
+    log_info (_("%u cached OCSP status entries loaded\n"), ocsp_cache_count);
+}
+
+
+/* Write the cache to disk.  */
+static void
+ocsp_cache_save (void)
+{
+  char *fname, *tmpfname;
+  estream_t fp;
+  ocsp_cache_item_t item;
+  char keyhex[41];
+  int i;
+
+  fname = make_filename (opt.homedir_cache, OCSP_CACHE_FILE, NULL);
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      log_error (_("error writing '%s': %s\n"), fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    {
+      log_error (_("error creating '%s': %s\n"), tmpfname, strerror (errno));
+      goto leave;
+    }
+
+  es_fputs ("# Cached OCSP status - created by dirmngr\n"
+            "# Do not edit this file.\n", fp);
+  for (i=0; i < OCSP_CACHE_BUCKETS; i++)
+    for (item = ocsp_cache[i]; item; item = item->next)
+      es_fprintf (fp, "%s %lu %c %d %s %s %s %s\n",
+                  bin2hex (item->key, 20, keyhex),
+                  (unsigned long)item->stored_at,
+                  item->status == KSBA_STATUS_GOOD? 'g':'r',
+                  (int)item->reason,
+                  *item->this_update? item->this_update : "-",
+                  *item->next_update? item->next_update : "-",
+                  *item->revocation_time? item->revocation_time : "-",
+                  *item->valid_if? item->valid_if : "-");
+
+  if (es_fclose (fp))
+    {
+      log_error (_("error writing '%s': %s\n"), tmpfname, strerror (errno));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+#ifdef HAVE_W32_SYSTEM
+  /* No atomic mv on W32 systems.  */
+  gnupg_remove (fname);
+#endif
+  if (rename (tmpfname, fname))
+    log_error (_("error renaming '%s' to '%s': %s\n"),
+               tmpfname, fname, strerror (errno));
+  else
+    ocsp_cache_dirty = 0;
+
+ leave:
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Save the cache to disk if it has been changed and release it.  */
+void
+ocsp_cache_deinit (void)
+{
+  ocsp_cache_item_t item;
+  int i;
+
+  if (ocsp_cache_dirty)
+    {
+      ocsp_cache_purge ();
+      ocsp_cache_save ();
+    }
+
+  for (i=0; i < OCSP_CACHE_BUCKETS; i++)
+    while ((item = ocsp_cache[i]))
+      {
+        ocsp_cache[i] = item->next;
+        xfree (item);
+      }
+  ocsp_cache_count = 0;
+  ocsp_cache_dirty = 0;
+}
@@ -0,0 +1,53 @@
+/* ocsp-cache.h - Cache of OCSP status
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIRMNGR_OCSP_CACHE_H
+#define DIRMNGR_OCSP_CACHE_H 1
+
+/* The status of a certificate as taken from a validated OCSP
+   response.  With --ocsp-cache-max-age these are kept in a hash
+   table, keyed by the issuer's key and the serial number (see
+   make_cache_key in ocsp.c), so that checking the same certificate
+   again does not need another request.  */
+struct ocsp_cache_item_s
+{
+  struct ocsp_cache_item_s *next;
+  unsigned char key[20];
+  time_t stored_at;                /* When we got the response.  */
+  ksba_status_t status;
+  ksba_crl_reason_t reason;
+  ksba_isotime_t this_update;
+  ksba_isotime_t next_update;
+  ksba_isotime_t revocation_time;
+  char valid_if[41];               /* If not empty, the status is only
+                                      valid if the responder certificate
+                                      with this fingerprint is valid.  */
+};
+typedef struct ocsp_cache_item_s *ocsp_cache_item_t;
+
+
+/* Look up and store the status of a certificate.  */
+ocsp_cache_item_t ocsp_cache_lookup (const unsigned char *key);
+void ocsp_cache_put (const struct ocsp_cache_item_s *result);
+
+/* Load and save the OCSP response cache.  */
+void ocsp_cache_init (void);
+void ocsp_cache_deinit (void);
+
+#endif /*DIRMNGR_OCSP_CACHE_H*/
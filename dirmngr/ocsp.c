@@ -21,6 +21,7 @@
 #include <config.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <assert.h>
 
@@ -30,6 +31,7 @@
 #include "validate.h"
 #include "certcache.h"
 #include "ocsp.h"
+#include "ocsp-cache.h"
 
 /* The maximum size we allow as a response from an OCSP reponder. */
 #define MAX_RESPONSE_SIZE 65536
@@ -47,8 +49,6 @@ static const char oidstr_ocsp[] = "1.3.6.1.5.5.7.48.1";
 static const char oidstr_certHash[] = "1.3.36.8.3.13";
 
 
-
-
 /* Read from FP and return a newly allocated buffer in R_BUFFER with the
    entire data read from FP. */
 static gpg_error_t
@@ -114,6 +114,60 @@ read_response (estream_t fp, unsigned char **r_buffer, size_t *r_buflen)
 }
 
 
+/* Parse the OCSP RESPONSE of RESPONSELEN bytes received from URL into
+   the OCSP context and hash it using MD.  */
+static gpg_error_t
+parse_response (ksba_ocsp_t ocsp, gcry_md_hd_t md,
+                const unsigned char *response, size_t responselen,
+                const char *url)
+{
+  gpg_error_t err;
+  ksba_ocsp_response_status_t response_status;
+  const char *t;
+
+  err = ksba_ocsp_parse_response (ocsp, response, responselen,
+                                  &response_status);
+  if (err)
+    {
+      log_error (_("error parsing OCSP response for '%s': %s\n"),
+                 url, gpg_strerror (err));
+      return err;
+    }
+
+  switch (response_status)
+    {
+    case KSBA_OCSP_RSPSTATUS_SUCCESS:      t = "success"; break;
+    case KSBA_OCSP_RSPSTATUS_MALFORMED:    t = "malformed"; break;
+    case KSBA_OCSP_RSPSTATUS_INTERNAL:     t = "internal error"; break;
+    case KSBA_OCSP_RSPSTATUS_TRYLATER:     t = "try later"; break;
+    case KSBA_OCSP_RSPSTATUS_SIGREQUIRED:  t = "must sign request"; break;
+    case KSBA_OCSP_RSPSTATUS_UNAUTHORIZED: t = "unauthorized"; break;
+    case KSBA_OCSP_RSPSTATUS_REPLAYED:     t = "replay detected"; break;
+    case KSBA_OCSP_RSPSTATUS_OTHER:        t = "other (unknown)"; break;
+    case KSBA_OCSP_RSPSTATUS_NONE:         t = "no status"; break;
+    default:                               t = "[unknown status]"; break;
+    }
+  if (response_status == KSBA_OCSP_RSPSTATUS_SUCCESS)
+    {
+      if (opt.verbose)
+        log_info (_("OCSP responder at '%s' status: %s\n"), url, t);
+
+      err = ksba_ocsp_hash_response (ocsp, response, responselen,
+                                     HASH_FNC, md);
+      if (err)
+        log_error (_("hashing the OCSP response for '%s' failed: %s\n"),
+                   url, gpg_strerror (err));
+    }
+  else
+    {
+      log_error (_("OCSP responder at '%s' status: %s\n"), url, t);
+      err = gpg_error (GPG_ERR_GENERAL);
+    }
+
+  return err;
+}
+
+
 /* Construct an OCSP request, send it to the configured OCSP responder
    and parse the response. On success the OCSP context may be used to
    further process the reponse. */
@@ -125,8 +179,6 @@ do_ocsp_request (ctrl_t ctrl, ksba_ocsp_t ocsp, gcry_md_hd_t md,
   unsigned char *request, *response;
   size_t requestlen, responselen;
   http_t http;
-  ksba_ocsp_response_status_t response_status;
-  const char *t;
   int redirects_left = 2;
   char *free_this = NULL;
 
@@ -165,7 +217,8 @@ do_ocsp_request (ctrl_t ctrl, ksba_ocsp_t ocsp, gcry_md_hd_t md,
 
  once_more:
   err = http_open (&http, HTTP_REQ_POST, url, NULL, NULL,
-                   (opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0),
+                   (HTTP_FLAG_KEEP_ALIVE
+                    | (opt.honor_http_proxy? HTTP_FLAG_TRY_PROXY:0)),
                    ctrl->http_proxy, NULL, NULL, NULL);
   if (err)
     {
@@ -249,47 +302,7 @@ do_ocsp_request (ctrl_t ctrl, ksba_ocsp_t ocsp, gcry_md_hd_t md,
       return err;
     }
 
-  err = ksba_ocsp_parse_response (ocsp, response, responselen,
-                                  &response_status);
-  if (err)
-    {
-      log_error (_("error parsing OCSP response for '%s': %s\n"),
-                 url, gpg_strerror (err));
-      xfree (response);
-      xfree (free_this);
-      return err;
-    }
-
-  switch (response_status)
-    {
-    case KSBA_OCSP_RSPSTATUS_SUCCESS:      t = "success"; break;
-    case KSBA_OCSP_RSPSTATUS_MALFORMED:    t = "malformed"; break;
-    case KSBA_OCSP_RSPSTATUS_INTERNAL:     t = "internal error"; break;
-    case KSBA_OCSP_RSPSTATUS_TRYLATER:     t = "try later"; break;
-    case KSBA_OCSP_RSPSTATUS_SIGREQUIRED:  t = "must sign request"; break;
-    case KSBA_OCSP_RSPSTATUS_UNAUTHORIZED: t = "unauthorized"; break;
-    case KSBA_OCSP_RSPSTATUS_REPLAYED:     t = "replay detected"; break;
-    case KSBA_OCSP_RSPSTATUS_OTHER:        t = "other (unknown)"; break;
-    case KSBA_OCSP_RSPSTATUS_NONE:         t = "no status"; break;
-    default:                               t = "[unknown status]"; break;
-    }
-  if (response_status == KSBA_OCSP_RSPSTATUS_SUCCESS)
-    {
-      if (opt.verbose)
-        log_info (_("OCSP responder at '%s' status: %s\n"), url, t);
-
-      err = ksba_ocsp_hash_response (ocsp, response, responselen,
-                                     HASH_FNC, md);
-      if (err)
-        log_error (_("hashing the OCSP response for '%s' failed: %s\n"),
-                   url, gpg_strerror (err));
-    }
-  else
-    {
-      log_error (_("OCSP responder at '%s' status: %s\n"), url, t);
-      err = gpg_error (GPG_ERR_GENERAL);
-    }
-
+  err = parse_response (ocsp, md, response, responselen, url);
   xfree (response);
   xfree (free_this);
   return err;
@@ -298,14 +311,19 @@ do_ocsp_request (ctrl_t ctrl, ksba_ocsp_t ocsp, gcry_md_hd_t md,
 
 /* Validate that CERT is indeed valid to sign an OCSP response. If
    SIGNER_FPR_LIST is not NULL we simply check that CERT matches one
-   of the fingerprints in this list. */
+   of the fingerprints in this list.  If the validity of CERT is left
+   to the client, its fingerprint is stored at R_VALID_IF, a buffer of
+   41 bytes; otherwise an empty string is stored there. */
 static gpg_error_t
 validate_responder_cert (ctrl_t ctrl, ksba_cert_t cert,
-                         fingerprint_list_t signer_fpr_list)
+                         fingerprint_list_t signer_fpr_list,
+                         char *r_valid_if)
 {
   gpg_error_t err;
   char *fpr;
 
+  *r_valid_if = 0;
+
   if (signer_fpr_list)
     {
       fpr = get_fingerprint_hexstring (cert);
@@ -345,6 +363,8 @@ validate_responder_cert (ctrl_t ctrl, ksba_cert_t cert,
          all. */
       fpr = get_fingerprint_hexstring (cert);
       dirmngr_status (ctrl, "ONLY_VALID_IF_CERT_VALID", fpr, NULL);
+      if (strlen (fpr) < 41)
+        strcpy (r_valid_if, fpr);
       xfree (fpr);
       err = 0;
     }
@@ -356,7 +376,8 @@ validate_responder_cert (ctrl_t ctrl, ksba_cert_t cert,
 /* Helper for check_signature. */
 static int
 check_signature_core (ctrl_t ctrl, ksba_cert_t cert, gcry_sexp_t s_sig,
-                      gcry_sexp_t s_hash, fingerprint_list_t signer_fpr_list)
+                      gcry_sexp_t s_hash, fingerprint_list_t signer_fpr_list,
+                      char *r_valid_if)
 {
   gpg_error_t err;
   ksba_sexp_t pubkey;
@@ -371,7 +392,7 @@ check_signature_core (ctrl_t ctrl, ksba_cert_t cert, gcry_sexp_t s_sig,
   if (!err)
     err = gcry_pk_verify (s_sig, s_hash, s_pkey);
   if (!err)
-    err = validate_responder_cert (ctrl, cert, signer_fpr_list);
+    err = validate_responder_cert (ctrl, cert, signer_fpr_list, r_valid_if);
   if (!err)
     {
       gcry_sexp_release (s_pkey);
@@ -389,11 +410,11 @@ check_signature_core (ctrl_t ctrl, ksba_cert_t cert, gcry_sexp_t s_sig,
    the response.  This function automagically finds the correct public
    key.  If SIGNER_FPR_LIST is not NULL, the default OCSP reponder has been
    used and thus the certificate is one of those identified by
-   the fingerprints. */
+   the fingerprints.  R_VALID_IF is described at validate_responder_cert. */
 static gpg_error_t
 check_signature (ctrl_t ctrl,
                  ksba_ocsp_t ocsp, gcry_sexp_t s_sig, gcry_md_hd_t md,
-                 fingerprint_list_t signer_fpr_list)
+                 fingerprint_list_t signer_fpr_list, char *r_valid_if)
 {
   gpg_error_t err;
   int algo, cert_idx;
@@ -431,7 +452,7 @@ check_signature (ctrl_t ctrl,
       if (cert)
         {
           err = check_signature_core (ctrl, cert, s_sig, s_hash,
-                                      signer_fpr_list);
+                                      signer_fpr_list, r_valid_if);
           ksba_cert_release (cert);
           cert = NULL;
           if (!err)
@@ -495,7 +516,7 @@ check_signature (ctrl_t ctrl,
       if (cert)
         {
           err = check_signature_core (ctrl, cert, s_sig, s_hash,
-                                      signer_fpr_list);
+                                      signer_fpr_list, r_valid_if);
           ksba_cert_release (cert);
           if (!err)
             {
@@ -511,10 +532,229 @@ check_signature (ctrl_t ctrl,
 }
 
 
+/* Compute the key of the cached status of CERT issued by ISSUER_CERT
+   and store it at KEY which must provide 20 bytes.  The key is the
+   SHA-1 hash of the keygrip of the issuer's public key and of the
+   serial number of CERT; it thus identifies the certificate the same
+   way the CertID of an OCSP request does.  */
+static gpg_error_t
+make_cache_key (ksba_cert_t cert, ksba_cert_t issuer_cert,
+                unsigned char *key)
+{
+  gpg_error_t err;
+  ksba_sexp_t pubkey, serial;
+  gcry_sexp_t s_pkey = NULL;
+  unsigned char grip[20];
+  gcry_md_hd_t md;
+  size_t n;
+
+  pubkey = ksba_cert_get_public_key (issuer_cert);
+  if (!pubkey)
+    return gpg_error (GPG_ERR_INV_OBJ);
+  err = canon_sexp_to_gcry (pubkey, &s_pkey);
+  xfree (pubkey);
+  if (!err && !gcry_pk_get_keygrip (s_pkey, grip))
+    err = gpg_error (GPG_ERR_INV_OBJ);
+  gcry_sexp_release (s_pkey);
+  if (err)
+    return err;
+
+  serial = ksba_cert_get_serial (cert);
+  n = serial? gcry_sexp_canon_len (serial, 0, NULL, NULL) : 0;
+  if (!n)
+    err = gpg_error (GPG_ERR_INV_CERT_OBJ);
+  else
+    err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (!err)
+    {
+      gcry_md_write (md, grip, sizeof grip);
+      gcry_md_write (md, serial, n);
+      memcpy (key, gcry_md_read (md, GCRY_MD_SHA1), 20);
+      gcry_md_close (md);
+    }
+  ksba_free (serial);
+  return err;
+}
+
+
+/* Return true if a cached status may be used instead of asking the
+   responder at URL.  A cached response is not bound to a nonce of the
+   current request; responders listed with --ocsp-require-nonce are
+   thus always asked.  */
+static int
+cache_allowed_for (const char *url)
+{
+  strlist_t sl;
+
+  if (!opt.ocsp_cache_max_age)
+    return 0;
+  for (sl = opt.ocsp_require_nonce; sl; sl = sl->next)
+    if (!strcmp (sl->d, url))
+      return 0;
+  return 1;
+}
+
+
+/* Check the signature of the response in OCSP which has been hashed
+   into MD and store the status of CERT at RESULT.  DEFAULT_SIGNER is
+   the list of the default responder's signers or NULL.  */
+static gpg_error_t
+check_response (ctrl_t ctrl, ksba_ocsp_t ocsp, gcry_md_hd_t md,
+                ksba_cert_t cert, fingerprint_list_t default_signer,
+                ocsp_cache_item_t result)
+{
+  gpg_error_t err;
+  ksba_sexp_t sigval;
+  gcry_sexp_t s_sig = NULL;
+  ksba_isotime_t produced_at;
+
+  /* We got a useful answer, check that the answer has a valid signature. */
+  sigval = ksba_ocsp_get_sig_val (ocsp, produced_at);
+  if (!sigval || !*produced_at)
+    {
+      xfree (sigval);
+      return gpg_error (GPG_ERR_INV_OBJ);
+    }
+  err = canon_sexp_to_gcry (sigval, &s_sig);
+  xfree (sigval);
+  if (!err)
+    err = check_signature (ctrl, ocsp, s_sig, md, default_signer,
+                           result->valid_if);
+  gcry_sexp_release (s_sig);
+  if (err)
+    return err;
+
+  /* We only support one certificate per request.  Check that the
+     answer matches the right certificate. */
+  err = ksba_ocsp_get_status (ocsp, cert,
+                              &result->status, result->this_update,
+                              result->next_update, result->revocation_time,
+                              &result->reason);
+  if (err)
+    log_error (_("error getting OCSP status for target certificate: %s\n"),
+               gpg_strerror (err));
+  return err;
+}
+
+
+/* Return the validity of CERT according to the OCSP status RESULT,
+   which is either fresh or taken from the cache.  */
+static gpg_error_t
+evaluate_status (ksba_cert_t cert, ocsp_cache_item_t result)
+{
+  gpg_error_t err = 0;
+  ksba_isotime_t current_time;
+  ksba_isotime_t tmp_time;
+  ksba_status_t status = result->status;
+  ksba_crl_reason_t reason = result->reason;
+
+  /* In case the certificate has been revoked, we better invalidate
+     our cached validation status. */
+  if (status == KSBA_STATUS_REVOKED)
+    {
+      time_t validated_at = 0; /* That is: No cached validation available. */
+      err = ksba_cert_set_user_data (cert, "validated_at",
+                                     &validated_at, sizeof (validated_at));
+      if (err)
+        {
+          log_error ("set_user_data(validated_at) failed: %s\n",
+                     gpg_strerror (err));
+          err = 0; /* The certificate is anyway revoked, and that is a
+                      more important message than the failure of our
+                      cache. */
+        }
+    }
+
+
+  if (opt.verbose)
+    {
+      log_info (_("certificate status is: %s  (this=%s  next=%s)\n"),
+                status == KSBA_STATUS_GOOD? _("good"):
+                status == KSBA_STATUS_REVOKED? _("revoked"):
+                status == KSBA_STATUS_UNKNOWN? _("unknown"):
+                status == KSBA_STATUS_NONE? _("none"): "?",
+                result->this_update, result->next_update);
+      if (status == KSBA_STATUS_REVOKED)
+        log_info (_("certificate has been revoked at: %s due to: %s\n"),
+                  result->revocation_time,
+                  reason == KSBA_CRLREASON_UNSPECIFIED?   "unspecified":
+                  reason == KSBA_CRLREASON_KEY_COMPROMISE? "key compromise":
+                  reason == KSBA_CRLREASON_CA_COMPROMISE?   "CA compromise":
+                  reason == KSBA_CRLREASON_AFFILIATION_CHANGED?
+                                                      "affiliation changed":
+                  reason == KSBA_CRLREASON_SUPERSEDED?   "superseeded":
+                  reason == KSBA_CRLREASON_CESSATION_OF_OPERATION?
+                                                  "cessation of operation":
+                  reason == KSBA_CRLREASON_CERTIFICATE_HOLD?
+                                                  "certificate on hold":
+                  reason == KSBA_CRLREASON_REMOVE_FROM_CRL?
+                                                  "removed from CRL":
+                  reason == KSBA_CRLREASON_PRIVILEGE_WITHDRAWN?
+                                                  "privilege withdrawn":
+                  reason == KSBA_CRLREASON_AA_COMPROMISE? "AA compromise":
+                  reason == KSBA_CRLREASON_OTHER?   "other":"?");
+
+    }
+
+
+  if (status == KSBA_STATUS_REVOKED)
+    err = gpg_error (GPG_ERR_CERT_REVOKED);
+  else if (status == KSBA_STATUS_UNKNOWN)
+    err = gpg_error (GPG_ERR_NO_DATA);
+  else if (status != KSBA_STATUS_GOOD)
+    err = gpg_error (GPG_ERR_GENERAL);
+
+  /* Allow for some clock skew. */
+  gnupg_get_isotime (current_time);
+  add_seconds_to_isotime (current_time, opt.ocsp_max_clock_skew);
+
+  if (strcmp (result->this_update, current_time) > 0 )
+    {
+      log_error (_("OCSP responder returned a status in the future\n"));
+      log_info ("used now: %s  this_update: %s\n",
+                current_time, result->this_update);
+      if (!err)
+        err = gpg_error (GPG_ERR_TIME_CONFLICT);
+    }
+
+  /* Check that THIS_UPDATE is not too far back in the past. */
+  gnupg_copy_time (tmp_time, result->this_update);
+  add_seconds_to_isotime (tmp_time,
+                          opt.ocsp_max_period+opt.ocsp_max_clock_skew);
+  if (!*tmp_time || strcmp (tmp_time, current_time) < 0 )
+    {
+      log_error (_("OCSP responder returned a non-current status\n"));
+      log_info ("used now: %s  this_update: %s\n",
+                current_time, result->this_update);
+      if (!err)
+        err = gpg_error (GPG_ERR_TIME_CONFLICT);
+    }
+
+  /* Check that we are not beyound NEXT_UPDATE  (plus some extra time). */
+  if (*result->next_update)
+    {
+      gnupg_copy_time (tmp_time, result->next_update);
+      add_seconds_to_isotime (tmp_time,
+                              opt.ocsp_current_period+opt.ocsp_max_clock_skew);
+      if (!*tmp_time && strcmp (tmp_time, current_time) < 0 )
+        {
+          log_error (_("OCSP responder returned an too old status\n"));
+          log_info ("used now: %s  next_update: %s\n",
+                    current_time, result->next_update);
+          if (!err)
+            err = gpg_error (GPG_ERR_TIME_CONFLICT);
+        }
+    }
+
+  return err;
+}
+
+
 /* Check whether the certificate either given by fingerprint CERT_FPR
    or directly through the CERT object is valid by running an OCSP
    transaction.  With FORCE_DEFAULT_RESPONDER set only the configured
-   default responder is used. */
+   default responder is used.  If the response cache is enabled, a
+   cached status is used instead of asking the responder. */
 gpg_error_t
 ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
               int force_default_responder)
@@ -522,13 +762,9 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   gpg_error_t err;
   ksba_ocsp_t ocsp = NULL;
   ksba_cert_t issuer_cert = NULL;
-  ksba_sexp_t sigval = NULL;
-  gcry_sexp_t s_sig = NULL;
-  ksba_isotime_t current_time;
-  ksba_isotime_t this_update, next_update, revocation_time, produced_at;
-  ksba_isotime_t tmp_time;
-  ksba_status_t status;
-  ksba_crl_reason_t reason;
+  struct ocsp_cache_item_s result;
+  ocsp_cache_item_t item;
+  int use_cache = 0;
   char *url_buffer = NULL;
   const char *url;
   gcry_md_hd_t md = NULL;
@@ -537,6 +773,8 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   ksba_name_t name;
   fingerprint_list_t default_signer = NULL;
 
+  memset (&result, 0, sizeof result);
+
   /* Get the certificate.  */
   if (cert)
     {
@@ -634,6 +872,25 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
         log_info (_("using OCSP responder '%s'\n"), url);
     }
 
+  /* Use the cached status unless the responder insists on a nonce.  */
+  if (cache_allowed_for (url)
+      && !make_cache_key (cert, issuer_cert, result.key))
+    {
+      use_cache = 1;
+      item = ocsp_cache_lookup (result.key);
+      if (item)
+        {
+          result = *item;
+          if (opt.verbose)
+            log_info (_("using cached OCSP status\n"));
+          if (*result.valid_if)
+            dirmngr_status (ctrl, "ONLY_VALID_IF_CERT_VALID",
+                            result.valid_if, NULL);
+          err = evaluate_status (cert, &result);
+          goto leave;
+        }
+    }
+
   /* Ask the OCSP responder. */
   err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
   if (err)
@@ -646,139 +903,107 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   if (err)
     goto leave;
 
-  /* We got a useful answer, check that the answer has a valid signature. */
-  sigval = ksba_ocsp_get_sig_val (ocsp, produced_at);
-  if (!sigval || !*produced_at)
-    {
-      err = gpg_error (GPG_ERR_INV_OBJ);
-      goto leave;
-    }
-  if ( (err = canon_sexp_to_gcry (sigval, &s_sig)) )
-    goto leave;
-  xfree (sigval);
-  sigval = NULL;
-  err = check_signature (ctrl, ocsp, s_sig, md, default_signer);
+  err = check_response (ctrl, ocsp, md, cert, default_signer, &result);
   if (err)
     goto leave;
 
-  /* We only support one certificate per request.  Check that the
-     answer matches the right certificate. */
-  err = ksba_ocsp_get_status (ocsp, cert,
-                              &status, this_update, next_update,
-                              revocation_time, &reason);
-  if (err)
-    {
-      log_error (_("error getting OCSP status for target certificate: %s\n"),
-                 gpg_strerror (err));
-      goto leave;
-    }
-
-  /* In case the certificate has been revoked, we better invalidate
-     our cached validation status. */
-  if (status == KSBA_STATUS_REVOKED)
+  err = evaluate_status (cert, &result);
+  if (use_cache && (!err || gpg_err_code (err) == GPG_ERR_CERT_REVOKED))
     {
-      time_t validated_at = 0; /* That is: No cached validation available. */
-      err = ksba_cert_set_user_data (cert, "validated_at",
-                                     &validated_at, sizeof (validated_at));
-      if (err)
-        {
-          log_error ("set_user_data(validated_at) failed: %s\n",
-                     gpg_strerror (err));
-          err = 0; /* The certificate is anyway revoked, and that is a
-                      more important message than the failure of our
-                      cache. */
-        }
+      result.stored_at = gnupg_get_time ();
+      ocsp_cache_put (&result);
     }
 
+ leave:
+  gcry_md_close (md);
+  ksba_cert_release (issuer_cert);
+  ksba_cert_release (cert);
+  ksba_ocsp_release (ocsp);
+  xfree (url_buffer);
+  return err;
+}
 
-  if (opt.verbose)
-    {
-      log_info (_("certificate status is: %s  (this=%s  next=%s)\n"),
-                status == KSBA_STATUS_GOOD? _("good"):
-                status == KSBA_STATUS_REVOKED? _("revoked"):
-                status == KSBA_STATUS_UNKNOWN? _("unknown"):
-                status == KSBA_STATUS_NONE? _("none"): "?",
-                this_update, next_update);
-      if (status == KSBA_STATUS_REVOKED)
-        log_info (_("certificate has been revoked at: %s due to: %s\n"),
-                  revocation_time,
-                  reason == KSBA_CRLREASON_UNSPECIFIED?   "unspecified":
-                  reason == KSBA_CRLREASON_KEY_COMPROMISE? "key compromise":
-                  reason == KSBA_CRLREASON_CA_COMPROMISE?   "CA compromise":
-                  reason == KSBA_CRLREASON_AFFILIATION_CHANGED?
-                                                      "affiliation changed":
-                  reason == KSBA_CRLREASON_SUPERSEDED?   "superseeded":
-                  reason == KSBA_CRLREASON_CESSATION_OF_OPERATION?
-                                                  "cessation of operation":
-                  reason == KSBA_CRLREASON_CERTIFICATE_HOLD?
-                                                  "certificate on hold":
-                  reason == KSBA_CRLREASON_REMOVE_FROM_CRL?
-                                                  "removed from CRL":
-                  reason == KSBA_CRLREASON_PRIVILEGE_WITHDRAWN?
-                                                  "privilege withdrawn":
-                  reason == KSBA_CRLREASON_AA_COMPROMISE? "AA compromise":
-                  reason == KSBA_CRLREASON_OTHER?   "other":"?");
 
-    }
+/* Check the OCSP RESPONSE of RESPONSELEN bytes for CERT and insert
+   the status into the cache.  This is used for responses obtained by
+   other means than asking the responder ourselves, for example a
+   response stapled to a TLS handshake or one fetched in advance.  The
+   response is checked like any other response but it is not bound to
+   a nonce.  Returns the validity of CERT like ocsp_isvalid does.  */
+gpg_error_t
+ocsp_cache_put_response (ctrl_t ctrl, ksba_cert_t cert,
+                         const unsigned char *response, size_t responselen)
+{
+  gpg_error_t err;
+  ksba_ocsp_t ocsp = NULL;
+  ksba_cert_t issuer_cert = NULL;
+  struct ocsp_cache_item_s result;
+  unsigned char *request;
+  size_t requestlen;
+  gcry_md_hd_t md = NULL;
 
+  memset (&result, 0, sizeof result);
 
-  if (status == KSBA_STATUS_REVOKED)
-    err = gpg_error (GPG_ERR_CERT_REVOKED);
-  else if (status == KSBA_STATUS_UNKNOWN)
-    err = gpg_error (GPG_ERR_NO_DATA);
-  else if (status != KSBA_STATUS_GOOD)
-    err = gpg_error (GPG_ERR_GENERAL);
+  if (!opt.ocsp_cache_max_age)
+    return gpg_error (GPG_ERR_NOT_ENABLED);
 
-  /* Allow for some clock skew. */
-  gnupg_get_isotime (current_time);
-  add_seconds_to_isotime (current_time, opt.ocsp_max_clock_skew);
+  err = find_issuing_cert (ctrl, cert, &issuer_cert);
+  if (err)
+    {
+      log_error (_("issuer certificate not found: %s\n"),
+                 gpg_strerror (err));
+      goto leave;
+    }
+  err = make_cache_key (cert, issuer_cert, result.key);
+  if (err)
+    goto leave;
 
-  if (strcmp (this_update, current_time) > 0 )
+  err = ksba_ocsp_new (&ocsp);
+  if (err)
     {
-      log_error (_("OCSP responder returned a status in the future\n"));
-      log_info ("used now: %s  this_update: %s\n", current_time, this_update);
-      if (!err)
-        err = gpg_error (GPG_ERR_TIME_CONFLICT);
+      log_error (_("failed to allocate OCSP context: %s\n"),
+                 gpg_strerror (err));
+      goto leave;
     }
 
-  /* Check that THIS_UPDATE is not too far back in the past. */
-  gnupg_copy_time (tmp_time, this_update);
-  add_seconds_to_isotime (tmp_time,
-                          opt.ocsp_max_period+opt.ocsp_max_clock_skew);
-  if (!*tmp_time || strcmp (tmp_time, current_time) < 0 )
+  /* The response is matched against the targets of a request; thus
+     we build one without sending it.  */
+  err = ksba_ocsp_add_target (ocsp, cert, issuer_cert);
+  if (!err)
+    err = ksba_ocsp_build_request (ocsp, &request, &requestlen);
+  if (err)
     {
-      log_error (_("OCSP responder returned a non-current status\n"));
-      log_info ("used now: %s  this_update: %s\n",
-                current_time, this_update);
-      if (!err)
-        err = gpg_error (GPG_ERR_TIME_CONFLICT);
+      log_error (_("error building OCSP request: %s\n"), gpg_strerror (err));
+      goto leave;
     }
+  xfree (request);
 
-  /* Check that we are not beyound NEXT_UPDATE  (plus some extra time). */
-  if (*next_update)
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (err)
     {
-      gnupg_copy_time (tmp_time, next_update);
-      add_seconds_to_isotime (tmp_time,
-                              opt.ocsp_current_period+opt.ocsp_max_clock_skew);
-      if (!*tmp_time && strcmp (tmp_time, current_time) < 0 )
-        {
-          log_error (_("OCSP responder returned an too old status\n"));
-          log_info ("used now: %s  next_update: %s\n",
-                    current_time, next_update);
-          if (!err)
-            err = gpg_error (GPG_ERR_TIME_CONFLICT);
-        }
+      log_error (_("failed to establish a hashing context for OCSP: %s\n"),
+                 gpg_strerror (err));
+      goto leave;
     }
+  err = parse_response (ocsp, md, response, responselen, "[stapled]");
+  if (err)
+    goto leave;
+
+  err = check_response (ctrl, ocsp, md, cert, NULL, &result);
+  if (err)
+    goto leave;
 
+  err = evaluate_status (cert, &result);
+  if (!err || gpg_err_code (err) == GPG_ERR_CERT_REVOKED)
+    {
+      result.stored_at = gnupg_get_time ();
+      ocsp_cache_put (&result);
+    }
 
  leave:
   gcry_md_close (md);
-  gcry_sexp_release (s_sig);
-  xfree (sigval);
   ksba_cert_release (issuer_cert);
-  ksba_cert_release (cert);
   ksba_ocsp_release (ocsp);
-  xfree (url_buffer);
   return err;
 }
 
@@ -25,6 +25,11 @@
 gpg_error_t ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
                           int force_default_responder);
 
+/* Insert the status from an OCSP response obtained elsewhere.  */
+gpg_error_t ocsp_cache_put_response (ctrl_t ctrl, ksba_cert_t cert,
+                                     const unsigned char *response,
+                                     size_t responselen);
+
 /* Release the list of OCSP certificates hold in the CTRL object. */
 void release_ctrl_ocsp_certs (ctrl_t ctrl);
 
@@ -62,6 +62,9 @@
    with a lot of signatures (e.g. 0x5b0358a2).  */
 #define MAX_KEYBLOCK_LENGTH (512*1024)
 
+/* OCSP responses are limited like those we request ourselves.  */
+#define MAX_OCSP_RESPONSE_LENGTH (64*1024)
+
 
 #define PARM_ERROR(t) assuan_set_error (ctx, \
                                         gpg_error (GPG_ERR_ASS_PARAMETER), (t))
@@ -1113,6 +1116,75 @@ cmd_checkocsp (assuan_context_t ctx, char *line)
 
 
 
+static const char hlp_cacheocsp[] =
+  "CACHEOCSP\n"
+  "\n"
+  "Put the status of a certificate from an OCSP response obtained by\n"
+  "other means, for example stapled to a TLS handshake, into the OCSP\n"
+  "response cache.  The certificate and the DER encoded response are\n"
+  "inquired using\n"
+  "\n"
+  "  INQUIRE TARGETCERT\n"
+  "  INQUIRE OCSPRESPONSE\n"
+  "\n"
+  "The response is checked like one received from a responder.  The\n"
+  "return value is the validity of the certificate as with CHECKOCSP;\n"
+  "the command fails if the response cache has not been enabled.";
+static gpg_error_t
+cmd_cacheocsp (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  ksba_cert_t cert = NULL;
+  unsigned char *value = NULL;
+  size_t valuelen;
+
+  (void)line;
+
+  err = assuan_inquire (ctrl->server_local->assuan_ctx, "TARGETCERT",
+                       &value, &valuelen, MAX_CERT_LENGTH);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  if (!valuelen) /* No data returned; return a comprehensible error. */
+    err = gpg_error (GPG_ERR_MISSING_CERT);
+  else
+    {
+      err = ksba_cert_new (&cert);
+      if (!err)
+        err = ksba_cert_init_from_mem (cert, value, valuelen);
+    }
+  xfree (value);
+  value = NULL;
+  if(err)
+    goto leave;
+
+  err = assuan_inquire (ctrl->server_local->assuan_ctx, "OCSPRESPONSE",
+                       &value, &valuelen, MAX_OCSP_RESPONSE_LENGTH);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  if (!valuelen)
+    err = gpg_error (GPG_ERR_NO_DATA);
+  else if (!opt.allow_ocsp)
+    err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+  else
+    err = ocsp_cache_put_response (ctrl, cert, value, valuelen);
+  xfree (value);
+
+ leave:
+  ksba_cert_release (cert);
+  return leave_cmd (ctx, err);
+}
+
+
+
 static int
 lookup_cert_by_url (assuan_context_t ctx, const char *url)
 {
@@ -2085,6 +2157,7 @@ register_commands (assuan_context_t ctx)
     { "ISVALID",    cmd_isvalid,    hlp_isvalid },
     { "CHECKCRL",   cmd_checkcrl,   hlp_checkcrl },
     { "CHECKOCSP",  cmd_checkocsp,  hlp_checkocsp },
+    { "CACHEOCSP",  cmd_cacheocsp,  hlp_cacheocsp },
     { "LOOKUP",     cmd_lookup,     hlp_lookup },
     { "LOADCRL",    cmd_loadcrl,    hlp_loadcrl },
     { "LISTCRLS",   cmd_listcrls,   hlp_listcrls },
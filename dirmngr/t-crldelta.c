@@ -0,0 +1,301 @@
+/* t-crldelta.c - Module test for crldelta.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <npth.h>
+
+#include "util.h"
+#include "crldelta.h"
+
+#define PGM "t-crldelta"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     errcount++;                                 \
+                   } while(0)
+
+/* More than CRL_YIELD_ITEMS so that the merge yields.  */
+#define NBASE 3000
+
+static int errcount;
+static const char *tmpdir;
+
+
+static void
+test_compare_numbers (void)
+{
+  static struct {
+    const char *a, *b;
+    int result;
+  } tests[] = {
+    { "1", "1", 0 },
+    { "01", "1", 0 },
+    { "0A", "a", 0 },
+    { "", "0", 0 },
+    { "FF", "100", -1 },
+    { "00ff", "FE", 1 },
+    { "1234", "1235", -1 },
+    { "0000", "1", -1 }
+  };
+  int tidx, r;
+
+  for (tidx=0; tidx < DIM (tests); tidx++)
+    {
+      r = crl_compare_numbers (tests[tidx].a, tests[tidx].b);
+      if ((r < 0? -1 : r > 0) != tests[tidx].result)
+        fail (tidx);
+      r = crl_compare_numbers (tests[tidx].b, tests[tidx].a);
+      if ((r < 0? 1 : r > 0? -1 : 0) != tests[tidx].result)
+        fail (tidx);
+    }
+}
+
+
+/* Put a record for the serial number N with REASON into the DB.  */
+static void
+put_item (struct cdb_make *cdbm, unsigned int n, int reason)
+{
+  unsigned char key[2];
+  unsigned char record[16];
+
+  key[0] = n >> 8;
+  key[1] = n;
+  record[0] = reason;
+  memcpy (record+1, "20260101T000000", 15);
+  if (cdb_make_add (cdbm, key, 2, record, 16))
+    fail (0);
+}
+
+
+/* Return the reason byte stored for serial number N or -1 if it is
+   not in the DB.  */
+static int
+get_item (struct cdb *cdb, unsigned int n)
+{
+  unsigned char key[2];
+  unsigned char record[16];
+  int rc;
+
+  key[0] = n >> 8;
+  key[1] = n;
+  rc = cdb_find (cdb, key, 2);
+  if (rc < 0)
+    fail (0);
+  if (rc <= 0)
+    return -1;
+  if (cdb_datalen (cdb) != 16
+      || cdb_read (cdb, record, 16, cdb_datapos (cdb)))
+    {
+      fail (0);
+      return -1;
+    }
+  return record[0];
+}
+
+
+static char *
+make_db_fname (const char *name)
+{
+  char *fname;
+
+  fname = xmalloc (strlen (tmpdir) + 40);
+  snprintf (fname, strlen (tmpdir) + 40, "%s/" PGM "-%d-%s.db",
+            tmpdir, (int)getpid (), name);
+  return fname;
+}
+
+
+static int
+open_db (const char *fname, struct cdb *cdb)
+{
+  int fd;
+
+  fd = open (fname, O_RDONLY);
+  if (fd == -1 || cdb_init (cdb, fd))
+    {
+      fprintf (stderr, PGM ": error opening '%s'\n", fname);
+      exit (1);
+    }
+  return fd;
+}
+
+
+/* Merging a delta into its base gives the items of the current
+   CRL.  */
+static void
+test_merge (void)
+{
+  char *basefname, *deltafname, *newfname;
+  struct cdb_make cdbm;
+  struct cdb basecdb, deltacdb, newcdb;
+  struct cdb_find cdbfp;
+  int fd, fd_base, fd_delta;
+  unsigned int n, count;
+  int reason, rc;
+
+  basefname = make_db_fname ("base");
+  deltafname = make_db_fname ("delta");
+  newfname = make_db_fname ("new");
+
+  /* The base CRL lists the serial numbers 1 to NBASE.  */
+  fd = open (basefname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    exit (1);
+  cdb_make_start (&cdbm, fd);
+  for (n=1; n <= NBASE; n++)
+    put_item (&cdbm, n, 1);
+  if (cdb_make_finish (&cdbm) || close (fd))
+    fail (1);
+
+  /* The delta changes the reason of 10, removes 20, adds 5000 and
+     has a removal of 6000 which was not in the base.  */
+  fd = open (deltafname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    exit (1);
+  cdb_make_start (&cdbm, fd);
+  put_item (&cdbm, 10, 6);
+  put_item (&cdbm, 20, CRL_REMOVE_MARK);
+  put_item (&cdbm, 5000, 3);
+  put_item (&cdbm, 6000, CRL_REMOVE_MARK);
+  if (cdb_make_finish (&cdbm) || close (fd))
+    fail (2);
+
+  fd_base = open_db (basefname, &basecdb);
+  fd_delta = open_db (deltafname, &deltacdb);
+  fd = open (newfname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    exit (1);
+  cdb_make_start (&cdbm, fd);
+  if (crl_delta_merge (&cdbm, &basecdb, &deltacdb))
+    fail (3);
+  if (cdb_make_finish (&cdbm) || close (fd))
+    fail (4);
+  cdb_free (&basecdb);
+  close (fd_base);
+  cdb_free (&deltacdb);
+  close (fd_delta);
+
+  fd = open_db (newfname, &newcdb);
+  for (n=1; n <= NBASE; n++)
+    {
+      reason = get_item (&newcdb, n);
+      if (n == 10)
+        {
+          if (reason != 6)
+            fail (5);
+        }
+      else if (n == 20)
+        {
+          if (reason != -1)
+            fail (6);
+        }
+      else if (reason != 1)
+        {
+          fail (7);
+          break;
+        }
+    }
+  if (get_item (&newcdb, 5000) != 3)
+    fail (8);
+  if (get_item (&newcdb, 6000) != -1)
+    fail (9);
+  if (get_item (&newcdb, NBASE + 1) != -1)
+    fail (10);
+
+  /* Each serial number is there only once; one has been removed and
+     one added.  */
+  count = 0;
+  rc = cdb_findinit (&cdbfp, &newcdb, NULL, 0);
+  while (!rc && (rc = cdb_findnext (&cdbfp)) > 0)
+    {
+      rc = 0;
+      count++;
+    }
+  if (rc < 0 || count != NBASE)
+    fail (11);
+  cdb_free (&newcdb);
+  close (fd);
+
+  /* An empty delta gives the base without changes.  */
+  fd = open (deltafname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    exit (1);
+  cdb_make_start (&cdbm, fd);
+  if (cdb_make_finish (&cdbm) || close (fd))
+    fail (12);
+  fd_base = open_db (basefname, &basecdb);
+  fd_delta = open_db (deltafname, &deltacdb);
+  fd = open (newfname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    exit (1);
+  cdb_make_start (&cdbm, fd);
+  if (crl_delta_merge (&cdbm, &basecdb, &deltacdb))
+    fail (13);
+  if (cdb_make_finish (&cdbm) || close (fd))
+    fail (14);
+  cdb_free (&basecdb);
+  close (fd_base);
+  cdb_free (&deltacdb);
+  close (fd_delta);
+  fd = open_db (newfname, &newcdb);
+  for (n=1; n <= NBASE; n++)
+    if (get_item (&newcdb, n) != 1)
+      {
+        fail (15);
+        break;
+      }
+  cdb_free (&newcdb);
+  close (fd);
+
+  remove (basefname);
+  remove (deltafname);
+  remove (newfname);
+  xfree (basefname);
+  xfree (deltafname);
+  xfree (newfname);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  if (npth_init ())
+    {
+      fprintf (stderr, "npth_init failed\n");
+      return 1;
+    }
+
+  tmpdir = getenv ("TMPDIR");
+  if (!tmpdir || !*tmpdir)
+    tmpdir = "/tmp";
+
+  test_compare_numbers ();
+  test_merge ();
+
+  return !!errcount;
+}
@@ -0,0 +1,313 @@
+/* t-ocsp-cache.c - Module test for ocsp-cache.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dirmngr.h"
+#include "ocsp-cache.h"
+
+#define PGM "t-ocsp-cache"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     errcount++;                                 \
+                   } while(0)
+
+/* As in ocsp-cache.c.  */
+#define MAX_OCSP_CACHE_ITEMS 4096
+
+static int errcount;
+static char *cachefname;
+
+
+/* Make the item for key number N, which is put into bucket N % 256,
+   with status STATUS stored DELTA seconds from now and a next update
+   NEXT seconds from now.  */
+static void
+make_item (struct ocsp_cache_item_s *item, unsigned int n,
+           ksba_status_t status, int delta, int next)
+{
+  time_t now = gnupg_get_time ();
+
+  memset (item, 0, sizeof *item);
+  item->key[0] = n;
+  item->key[1] = n >> 8;
+  item->key[2] = n >> 16;
+  memset (item->key + 3, 0xa5, 17);
+  item->stored_at = now + delta;
+  item->status = status;
+  epoch2isotime (item->this_update, now + delta);
+  if (next)
+    epoch2isotime (item->next_update, now + next);
+  if (status == KSBA_STATUS_REVOKED)
+    {
+      item->reason = KSBA_CRLREASON_KEY_COMPROMISE;
+      epoch2isotime (item->revocation_time, now - 86400);
+    }
+}
+
+
+static int
+same_item (ocsp_cache_item_t a, const struct ocsp_cache_item_s *b)
+{
+  return (a
+          && !memcmp (a->key, b->key, 20)
+          && a->stored_at == b->stored_at
+          && a->status == b->status
+          && a->reason == b->reason
+          && !strcmp (a->this_update, b->this_update)
+          && !strcmp (a->next_update, b->next_update)
+          && !strcmp (a->revocation_time, b->revocation_time)
+          && !strcmp (a->valid_if, b->valid_if));
+}
+
+
+static void
+test_lookup (void)
+{
+  struct ocsp_cache_item_s good, revoked, other, item;
+
+  make_item (&good, 1, KSBA_STATUS_GOOD, 0, 3600);
+  make_item (&revoked, 2, KSBA_STATUS_REVOKED, 0, 0);
+  strcpy (revoked.valid_if, "0123456789ABCDEF0123456789ABCDEF01234567");
+  ocsp_cache_put (&good);
+  ocsp_cache_put (&revoked);
+  if (!same_item (ocsp_cache_lookup (good.key), &good))
+    fail (1);
+  if (!same_item (ocsp_cache_lookup (revoked.key), &revoked))
+    fail (2);
+
+  /* An item in the same bucket.  */
+  make_item (&other, 1 + 256, KSBA_STATUS_GOOD, 0, 0);
+  if (ocsp_cache_lookup (other.key))
+    fail (3);
+  ocsp_cache_put (&other);
+  if (!same_item (ocsp_cache_lookup (other.key), &other)
+      || !same_item (ocsp_cache_lookup (good.key), &good))
+    fail (4);
+
+  /* A newer status replaces the old one.  */
+  make_item (&item, 1, KSBA_STATUS_REVOKED, 0, 0);
+  ocsp_cache_put (&item);
+  if (!same_item (ocsp_cache_lookup (good.key), &item))
+    fail (5);
+
+  /* Only good and revoked are cached.  */
+  make_item (&item, 3, KSBA_STATUS_UNKNOWN, 0, 0);
+  ocsp_cache_put (&item);
+  if (ocsp_cache_lookup (item.key))
+    fail (6);
+
+  /* Items older than --ocsp-cache-max-age, past their next update or
+     from the future are not used.  */
+  make_item (&item, 4, KSBA_STATUS_GOOD, -(int)opt.ocsp_cache_max_age - 10, 0);
+  ocsp_cache_put (&item);
+  if (ocsp_cache_lookup (item.key))
+    fail (7);
+  make_item (&item, 5, KSBA_STATUS_GOOD, -20, -10);
+  ocsp_cache_put (&item);
+  if (ocsp_cache_lookup (item.key))
+    fail (8);
+  make_item (&item, 6, KSBA_STATUS_GOOD, 600, 0);
+  ocsp_cache_put (&item);
+  if (ocsp_cache_lookup (item.key))
+    fail (9);
+
+  ocsp_cache_deinit ();
+  if (ocsp_cache_lookup (good.key) || ocsp_cache_lookup (revoked.key))
+    fail (10);
+}
+
+
+/* A full cache takes no new items unless some have expired.  */
+static void
+test_full (void)
+{
+  struct ocsp_cache_item_s item;
+  unsigned int n, count;
+
+  for (n=0; n < MAX_OCSP_CACHE_ITEMS + 10; n++)
+    {
+      make_item (&item, n, KSBA_STATUS_GOOD, 0, 0);
+      ocsp_cache_put (&item);
+    }
+  for (count=n=0; n < MAX_OCSP_CACHE_ITEMS + 10; n++)
+    {
+      make_item (&item, n, KSBA_STATUS_GOOD, 0, 0);
+      if (ocsp_cache_lookup (item.key))
+        count++;
+    }
+  if (count != MAX_OCSP_CACHE_ITEMS)
+    fail (1);
+  ocsp_cache_deinit ();
+
+  /* With one expired item there is room for one more.  */
+  for (n=0; n < MAX_OCSP_CACHE_ITEMS; n++)
+    {
+      make_item (&item, n, KSBA_STATUS_GOOD, n? 0 : -20, n? 0 : -10);
+      ocsp_cache_put (&item);
+    }
+  make_item (&item, MAX_OCSP_CACHE_ITEMS, KSBA_STATUS_GOOD, 0, 0);
+  ocsp_cache_put (&item);
+  if (!ocsp_cache_lookup (item.key))
+    fail (2);
+  ocsp_cache_deinit ();
+}
+
+
+/* Return true if the file FNAME has a line starting with PREFIX.
+   Store the number of lines not starting with '#' at R_COUNT.  */
+static int
+find_line (const char *prefix, int *r_count)
+{
+  FILE *fp;
+  char line[512];
+  int found = 0;
+
+  *r_count = 0;
+  fp = fopen (cachefname, "r");
+  if (!fp)
+    return 0;
+  while (fgets (line, sizeof line, fp))
+    {
+      if (*line != '#')
+        ++*r_count;
+      if (!strncmp (line, prefix, strlen (prefix)))
+        found = 1;
+    }
+  fclose (fp);
+  return found;
+}
+
+
+/* The cache is written to disk by ocsp_cache_deinit and read back by
+   ocsp_cache_init.  */
+static void
+test_file (void)
+{
+  struct ocsp_cache_item_s good, revoked, expired;
+  char keyhex[41], line[512];
+  int count;
+  FILE *fp;
+
+  make_item (&good, 7, KSBA_STATUS_GOOD, -5, 3600);
+  make_item (&revoked, 8, KSBA_STATUS_REVOKED, -5, 0);
+  strcpy (revoked.valid_if, "0123456789ABCDEF0123456789ABCDEF01234567");
+  make_item (&expired, 9, KSBA_STATUS_GOOD, -5, 2);
+  ocsp_cache_put (&good);
+  ocsp_cache_put (&revoked);
+  ocsp_cache_put (&expired);
+  ocsp_cache_deinit ();
+
+  /* Check the format of the records.  */
+  snprintf (line, sizeof line, "%s %lu g 0 %s %s - -\n",
+            bin2hex (good.key, 20, keyhex), (unsigned long)good.stored_at,
+            good.this_update, good.next_update);
+  if (!find_line (line, &count))
+    fail (1);
+  if (count != 3)
+    fail (2);
+  snprintf (line, sizeof line, "%s %lu r %d %s - %s %s\n",
+            bin2hex (revoked.key, 20, keyhex),
+            (unsigned long)revoked.stored_at, (int)revoked.reason,
+            revoked.this_update, revoked.revocation_time, revoked.valid_if);
+  if (!find_line (line, &count))
+    fail (3);
+
+  /* Invalid lines are skipped.  */
+  fp = fopen (cachefname, "a");
+  if (!fp)
+    {
+      fail (4);
+      return;
+    }
+  fputs ("garbage\n", fp);
+  fprintf (fp, "%s 0 x 0 - - - -\n", keyhex);
+  fputs ("0123 0 g 0 - - - -\n", fp);
+  fclose (fp);
+
+  /* The expired item is dropped when loading.  */
+  sleep (3);
+  ocsp_cache_init ();
+  if (!same_item (ocsp_cache_lookup (good.key), &good))
+    fail (5);
+  if (!same_item (ocsp_cache_lookup (revoked.key), &revoked))
+    fail (6);
+  if (ocsp_cache_lookup (expired.key))
+    fail (7);
+
+  /* An unchanged cache is not written again.  */
+  if (remove (cachefname))
+    fail (8);
+  ocsp_cache_deinit ();
+  if (!access (cachefname, F_OK))
+    fail (9);
+
+  /* Nothing is cached or loaded if the cache is disabled.  */
+  ocsp_cache_put (&good);
+  ocsp_cache_deinit ();
+  opt.ocsp_cache_max_age = 0;
+  ocsp_cache_init ();
+  if (ocsp_cache_lookup (good.key))
+    fail (10);
+  ocsp_cache_put (&good);
+  if (ocsp_cache_lookup (good.key))
+    fail (11);
+  ocsp_cache_deinit ();
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *tmpdir;
+  char *dirname;
+
+  (void)argc;
+  (void)argv;
+
+  tmpdir = getenv ("TMPDIR");
+  if (!tmpdir || !*tmpdir)
+    tmpdir = "/tmp";
+  dirname = strconcat (tmpdir, "/" PGM "-XXXXXX", NULL);
+  if (!dirname || !gnupg_mkdtemp (dirname))
+    {
+      fprintf (stderr, PGM ": error creating a directory\n");
+      return 1;
+    }
+  cachefname = make_filename (dirname, "ocsp-cache.txt", NULL);
+
+  opt.homedir_cache = dirname;
+  opt.ocsp_cache_max_age = 3600;
+
+  test_lookup ();
+  test_full ();
+  test_file ();
+
+  remove (cachefname);
+  rmdir (dirname);
+  xfree (cachefname);
+  xfree (dirname);
+  return !!errcount;
+}
@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <ctype.h>
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "certcache.h"
@@ -987,7 +988,10 @@ check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert)
 
     }
 
+  /* Other connections may run while we compute.  */
+  npth_unprotect ();
   err = gcry_pk_verify (s_sig, s_hash, s_pkey);
+  npth_protect ();
   if (DBG_X509)
     log_debug ("gcry_pk_verify: %s\n", gpg_strerror (err));
   gcry_md_close (md);
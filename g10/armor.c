@@ -36,16 +36,11 @@
 #include "main.h"
 #include "status.h"
 #include "i18n.h"
+#include "crc24.h"
 
 #define MAX_LINELEN 20000
 
-#define CRCINIT 0xB704CE
-#define CRCPOLY 0X864CFB
-#define CRCUPDATE(a,c) do {						    \
-			a = ((a) << 8) ^ crc_table[((a)&0xff >> 16) ^ (c)]; \
-			a &= 0x00ffffff;				    \
-		    } while(0)
-static u32 crc_table[256];
+#define CRCINIT CRC24_INIT
 static byte bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
 			 "abcdefghijklmnopqrstuvwxyz"
 			 "0123456789+/";
@@ -163,25 +158,11 @@ push_armor_filter (armor_filter_context_t *afx, iobuf_t iobuf)
 static void
 initialize(void)
 {
-    int i, j;
-    u32 t;
+    int i;
     byte *s;
 
-    /* init the crc lookup table */
-    crc_table[0] = 0;
-    for(i=j=0; j < 128; j++ ) {
-	t = crc_table[j];
-	if( t & 0x00800000 ) {
-	    t <<= 1;
-	    crc_table[i++] = t ^ CRCPOLY;
-	    crc_table[i++] = t;
-	}
-	else {
-	    t <<= 1;
-	    crc_table[i++] = t;
-	    crc_table[i++] = t ^ CRCPOLY;
-	}
-    }
+    /* init the crc lookup tables */
+    crc24_init ();
     /* build the helptable for radix64 to bin conversion */
     for(i=0; i < 256; i++ )
 	asctobin[i] = 255; /* used to detect invalid characters */
@@ -191,6 +172,19 @@ initialize(void)
     is_initialized=1;
 }
 
+/* Write the radix64 encoding of the 3 bytes at DATA to P and return
+   the new end of P.  */
+static inline byte *
+radix64_encode_group (byte *p, const byte *data)
+{
+    p[0] = bintoasc[(data[0] >> 2) & 077];
+    p[1] = bintoasc[(((data[0] <<4)&060)|((data[1] >> 4)&017))&077];
+    p[2] = bintoasc[(((data[1]<<2)&074)|((data[2]>>6)&03))&077];
+    p[3] = bintoasc[data[2]&077];
+    return p + 4;
+}
+
+
 /****************
  * Check whether this is an armored file or not See also
  * parse-packet.c for details on this code For unknown historic
@@ -751,7 +745,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     int checkcrc=0;
     int rc = 0;
     size_t n = 0;
-    int  idx, i, onlypad=0;
+    int  idx, onlypad=0;
     u32 crc;
 
     crc = afx->crc;
@@ -759,6 +753,29 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     val = afx->radbuf[0];
     for( n=0; n < size; ) {
 
+	if( !idx && afx->buffer_pos + 4 <= afx->buffer_len ) {
+	    /* Decode runs of complete groups without looking at each
+	     * character; anything else is left to the code below.  */
+	    const byte *p = afx->buffer + afx->buffer_pos;
+	    const byte *end = afx->buffer + afx->buffer_len;
+	    byte c0, c1, c2, c3;
+
+	    for( ; p + 4 <= end && n + 3 <= size; p += 4 ) {
+		c0 = asctobin[p[0]];
+		c1 = asctobin[p[1]];
+		c2 = asctobin[p[2]];
+		c3 = asctobin[p[3]];
+		if( (c0 | c1 | c2 | c3) & 0xc0 )
+		    break;
+		buf[n++] = (c0 << 2) | (c1 >> 4);
+		buf[n++] = (c1 << 4) | (c2 >> 2);
+		buf[n++] = (c2 << 6) | c3;
+	    }
+	    afx->buffer_pos = p - afx->buffer;
+	    if( n == size )
+		break;
+	}
+
 	if( afx->buffer_pos < afx->buffer_len )
 	    c = afx->buffer[afx->buffer_pos++];
 	else { /* read the next line */
@@ -817,9 +834,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	idx = (idx+1) % 4;
     }
 
-    for(i=0; i < n; i++ )
-	crc = (crc << 8) ^ crc_table[((crc >> 16)&0xff) ^ buf[i]];
-    crc &= 0x00ffffff;
+    crc = crc24_update (crc, buf, n);
     afx->crc = crc;
     afx->idx = idx;
     afx->radbuf[0] = val;
@@ -944,6 +959,8 @@ armor_filter( void *opaque, int control,
     armor_filter_context_t *afx = opaque;
     int rc=0, i, c;
     byte radbuf[3];
+    byte outbuf[1024], *p;
+    size_t eollen;
     int  idx, idx2;
     size_t n=0;
     u32 crc;
@@ -1130,29 +1147,38 @@ armor_filter( void *opaque, int control,
 	for(i=0; i < idx; i++ )
 	    radbuf[i] = afx->radbuf[i];
 
-	for(i=0; i < size; i++ )
-	    crc = (crc << 8) ^ crc_table[((crc >> 16)&0xff) ^ buf[i]];
-	crc &= 0x00ffffff;
+	crc = crc24_update (crc, buf, size);
 
-	for( ; size; buf++, size-- ) {
-	    radbuf[idx++] = *buf;
-	    if( idx > 2 ) {
+	/* Encode into OUTBUF and write it out in large chunks.  */
+	eollen = strlen (afx->eol);
+	p = outbuf;
+	while( size ) {
+	    if( !idx && size >= 3 ) {
+		p = radix64_encode_group (p, buf);
+		buf += 3;
+		size -= 3;
+	    }
+	    else {
+		radbuf[idx++] = *buf++;
+		size--;
+		if( idx < 3 )
+		    continue;
 		idx = 0;
-		c = bintoasc[(*radbuf >> 2) & 077];
-		iobuf_put(a, c);
-		c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
-		iobuf_put(a, c);
-		c = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-		iobuf_put(a, c);
-		c = bintoasc[radbuf[2]&077];
-		iobuf_put(a, c);
-		if( ++idx2 >= (64/4) )
-		  { /* pgp doesn't like 72 here */
-		    iobuf_writestr(a,afx->eol);
-		    idx2=0;
-		  }
+		p = radix64_encode_group (p, radbuf);
+	    }
+	    if( ++idx2 >= (64/4) )
+	      { /* pgp doesn't like 72 here */
+		memcpy (p, afx->eol, eollen);
+		p += eollen;
+		idx2=0;
+	      }
+	    if( (size_t)(p - outbuf) > sizeof outbuf - 4 - sizeof afx->eol ) {
+		iobuf_write (a, outbuf, p - outbuf);
+		p = outbuf;
 	    }
 	}
+	if( p != outbuf )
+	    iobuf_write (a, outbuf, p - outbuf);
 	for(i=0; i < idx; i++ )
 	    afx->radbuf[i] = radbuf[i];
 	afx->idx = idx;
@@ -1494,8 +1520,9 @@ unarmor_pump (UnarmorPump x, int c)
     }
 
     if ( !(rval & ~255) ) { /* compute the CRC */
-        x->crc = (x->crc << 8) ^ crc_table[((x->crc >> 16)&0xff) ^ rval];
-        x->crc &= 0x00ffffff;
+        byte b = rval;
+
+        x->crc = crc24_update (x->crc, &b, 1);
     }
 
     return rval;
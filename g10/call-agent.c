@@ -25,7 +25,11 @@
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/time.h>
 #include <assert.h>
+#ifdef HAVE_MEMFD_CREATE
+# include <sys/mman.h>
+#endif
 #ifdef HAVE_LOCALE_H
 #include <locale.h>
 #endif
@@ -49,6 +53,19 @@
 static assuan_context_t agent_ctx = NULL;
 static int did_early_card_test;
 
+/* The key wrapping key for imports of this session.  */
+static unsigned char *import_kek;
+static size_t import_keklen;
+
+/* The number of requests sent to the agent and the time spent waiting
+   for their results; see agent_get_stats.  */
+static struct
+{
+  unsigned long count;
+  double seconds;
+  double max;
+} agent_stats;
+
 struct default_inq_parm_s
 {
   ctrl_t ctrl;
@@ -82,11 +99,30 @@ struct writekey_parm_s
   size_t keydatalen;
 };
 
+struct pksign_batch_parm_s
+{
+  struct default_inq_parm_s *dflt;
+  unsigned char **digests;
+  size_t digestlen;
+  int digestalgo;
+  unsigned int ndigests;
+};
+
 struct genkey_parm_s
 {
   struct default_inq_parm_s *dflt;
   const char *keyparms;
+  const char *subkey_keyparms;
   const char *passphrase;
+  const char *seed_key;
+};
+
+struct vanity_job_parm_s
+{
+  char *jobid;              /* Receives the job ID of VANITY_JOB.  */
+  char state[10];           /* The state of the job or empty.  */
+  struct agent_vanity_parm_s *vanity;  /* Receives the first key.  */
+  char *hexgrip;            /* Receives its keygrip.  */
 };
 
 struct import_key_parm_s
@@ -96,13 +132,45 @@ struct import_key_parm_s
   size_t keylen;
 };
 
+struct import_keys_parm_s
+{
+  struct cache_nonce_parm_s *cn_parm;
+  unsigned int nkeys;
+  gpg_error_t *r_errs;
+};
+
 
 struct cache_nonce_parm_s
 {
   char **cache_nonce_addr;
   char **passwd_nonce_addr;
+  struct agent_vanity_parm_s *vanity;
+  membuf_t *data;   /* The data received so far if results are streamed.  */
+};
+
+
+/* The results of batched KEYINFO requests.  Secret keys are probed
+   once per keyblock and the results for its subkeys are taken from
+   here; see agent_probe_any_secret_key.  */
+struct keyinfo_cache_s
+{
+  struct keyinfo_cache_s *next;
+  unsigned char grip[20];
+  int available;     /* The agent has this secret key.  */
+  char *serialno;    /* The serial number of the card or NULL.  */
 };
 
+/* The cache hashed by the first byte of the keygrip.  */
+static struct keyinfo_cache_s *keyinfo_cache[256];
+
+/* 1 if the agent supports KEYINFO --multi, -1 if not, 0 if not yet
+   known.  */
+static int keyinfo_multi_supported;
+
+/* Blobs of at least this size are passed to the agent in a file
+   instead of being inquired.  */
+#define INPUT_FD_THRESHOLD 1024
+
 
 struct scd_genkey_parm_s
 {
@@ -112,6 +180,115 @@ struct scd_genkey_parm_s
 
 
 static gpg_error_t learn_status_cb (void *opaque, const char *line);
+static gpg_error_t keyinfo_status_cb (void *opaque, const char *line);
+
+
+
+/* Return the current time in seconds with the precision of
+   gettimeofday.  */
+static double
+timer_now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* Same as assuan_transact but also record the time the agent took to
+   answer.  This includes the time spent in a pinentry and thus shows
+   the round trip as seen by gpg.  */
+static gpg_error_t
+agent_transact (assuan_context_t ctx, const char *command,
+                gpg_error_t (*data_cb)(void *, const void *, size_t),
+                void *data_cb_arg,
+                gpg_error_t (*inquire_cb)(void*, const char *),
+                void *inquire_cb_arg,
+                gpg_error_t (*status_cb)(void*, const char *),
+                void *status_cb_arg)
+{
+  gpg_error_t err;
+  double start, used;
+
+  if (!opt.debug_stats)
+    return assuan_transact (ctx, command, data_cb, data_cb_arg,
+                            inquire_cb, inquire_cb_arg,
+                            status_cb, status_cb_arg);
+
+  start = timer_now ();
+  err = assuan_transact (ctx, command, data_cb, data_cb_arg,
+                         inquire_cb, inquire_cb_arg,
+                         status_cb, status_cb_arg);
+  used = timer_now () - start;
+  agent_stats.count++;
+  agent_stats.seconds += used;
+  if (used > agent_stats.max)
+    agent_stats.max = used;
+  return err;
+}
+
+
+/* Store the number of requests sent to the agent, their total time
+   and the time of the slowest one at R_COUNT, R_SECONDS and R_MAX.
+   Only recorded with --debug-stats.  */
+void
+agent_get_stats (unsigned long *r_count, double *r_seconds, double *r_max)
+{
+  *r_count = agent_stats.count;
+  *r_seconds = agent_stats.seconds;
+  *r_max = agent_stats.max;
+}
+
+
+
+/* Flush the cache of batched KEYINFO results.  Called before any
+   request which may add or remove secret keys.  */
+static void
+keyinfo_cache_flush (void)
+{
+  struct keyinfo_cache_s *ki;
+  int i;
+
+  for (i=0; i < DIM (keyinfo_cache); i++)
+    while ((ki = keyinfo_cache[i]))
+      {
+        keyinfo_cache[i] = ki->next;
+        xfree (ki->serialno);
+        xfree (ki);
+      }
+}
+
+
+/* Return the cache entry for the keygrip GRIP or NULL.  */
+static struct keyinfo_cache_s *
+keyinfo_cache_find (const unsigned char *grip)
+{
+  struct keyinfo_cache_s *ki;
+
+  for (ki = keyinfo_cache[grip[0]]; ki; ki = ki->next)
+    if (!memcmp (ki->grip, grip, 20))
+      return ki;
+  return NULL;
+}
+
+
+/* Add an entry for GRIP to the cache and return it.  */
+static struct keyinfo_cache_s *
+keyinfo_cache_add (const unsigned char *grip)
+{
+  struct keyinfo_cache_s *ki;
+
+  ki = keyinfo_cache_find (grip);
+  if (!ki)
+    {
+      ki = xcalloc (1, sizeof *ki);
+      memcpy (ki->grip, grip, 20);
+      ki->next = keyinfo_cache[grip[0]];
+      keyinfo_cache[grip[0]] = ki;
+    }
+  return ki;
+}
 
 
 
@@ -209,7 +386,7 @@ check_hijacking (assuan_context_t ctx)
 
   /* AGENT_ID is a command implemented by gnome-keyring-daemon.  It
      does not return any data but an OK line with a remark.  */
-  if (assuan_transact (ctx, "AGENT_ID",
+  if (agent_transact (ctx, "AGENT_ID",
                        membuf_data_cb, &mb, NULL, NULL, NULL, NULL))
     {
       xfree (get_membuf (&mb, NULL));
@@ -248,7 +425,7 @@ check_hijacking (assuan_context_t ctx)
 
               memset (&dfltparm, 0, sizeof dfltparm);
               dfltparm.ctx = ctx;
-              assuan_transact (ctx, cmd, NULL, NULL,
+              agent_transact (ctx, cmd, NULL, NULL,
                                default_inq_cb, &dfltparm,
                                NULL, NULL);
               xfree (cmd);
@@ -299,18 +476,18 @@ start_agent (ctrl_t ctrl, int for_card)
           /* Tell the agent that we support Pinentry notifications.
              No error checking so that it will work also with older
              agents.  */
-          assuan_transact (agent_ctx, "OPTION allow-pinentry-notify",
+          agent_transact (agent_ctx, "OPTION allow-pinentry-notify",
                            NULL, NULL, NULL, NULL, NULL, NULL);
           /* Tell the agent about what version we are aware.  This is
              here used to indirectly enable GPG_ERR_FULLY_CANCELED.  */
-          assuan_transact (agent_ctx, "OPTION agent-awareness=2.1.0",
+          agent_transact (agent_ctx, "OPTION agent-awareness=2.1.0",
                            NULL, NULL, NULL, NULL, NULL, NULL);
           /* Pass on the pinentry mode.  */
           if (opt.pinentry_mode)
             {
               char *tmp = xasprintf ("OPTION pinentry-mode=%s",
                                      str_pinentry_mode (opt.pinentry_mode));
-              rc = assuan_transact (agent_ctx, tmp,
+              rc = agent_transact (agent_ctx, tmp,
                                NULL, NULL, NULL, NULL, NULL, NULL);
               xfree (tmp);
               if (rc)
@@ -329,7 +506,7 @@ start_agent (ctrl_t ctrl, int for_card)
       struct agent_card_info_s info;
 
       memset (&info, 0, sizeof info);
-      rc = assuan_transact (agent_ctx, "SCD SERIALNO openpgp",
+      rc = agent_transact (agent_ctx, "SCD SERIALNO openpgp",
                             NULL, NULL, NULL, NULL,
                             learn_status_cb, &info);
       if (rc)
@@ -680,6 +857,7 @@ agent_scd_learn (struct agent_card_info_s *info, int force)
   memset (info, 0, sizeof *info);
   memset (&parm, 0, sizeof parm);
 
+  keyinfo_cache_flush ();
   rc = start_agent (NULL, 1);
   if (rc)
     return rc;
@@ -691,13 +869,13 @@ agent_scd_learn (struct agent_card_info_s *info, int force)
      "l" command in --card-edit can be used to show ta newly inserted
      card.  We request the openpgp card because that is what we
      expect. */
-  rc = assuan_transact (agent_ctx, "SCD SERIALNO openpgp",
+  rc = agent_transact (agent_ctx, "SCD SERIALNO openpgp",
                         NULL, NULL, NULL, NULL, NULL, NULL);
   if (rc)
     return rc;
 
   parm.ctx = agent_ctx;
-  rc = assuan_transact (agent_ctx,
+  rc = agent_transact (agent_ctx,
                         force ? "LEARN --sendinfo --force" : "LEARN --sendinfo",
                         dummy_data_cb, NULL, default_inq_cb, &parm,
                         learn_status_cb, info);
@@ -729,13 +907,13 @@ agent_scd_apdu (const char *hexapdu, unsigned int *r_sw)
 
   if (!hexapdu)
     {
-      err = assuan_transact (agent_ctx, "SCD RESET",
+      err = agent_transact (agent_ctx, "SCD RESET",
                              NULL, NULL, NULL, NULL, NULL, NULL);
 
     }
   else if (!strcmp (hexapdu, "undefined"))
     {
-      err = assuan_transact (agent_ctx, "SCD SERIALNO undefined",
+      err = agent_transact (agent_ctx, "SCD SERIALNO undefined",
                              NULL, NULL, NULL, NULL, NULL, NULL);
     }
   else
@@ -748,7 +926,7 @@ agent_scd_apdu (const char *hexapdu, unsigned int *r_sw)
       init_membuf (&mb, 256);
 
       snprintf (line, DIM(line)-1, "SCD APDU %s", hexapdu);
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                              membuf_data_cb, &mb, NULL, NULL, NULL, NULL);
       if (!err)
         {
@@ -784,11 +962,12 @@ agent_keytocard (const char *hexgrip, int keyno, int force,
             force?"--force ": "", hexgrip, serialno, keyno, timestamp);
   line[DIM(line)-1] = 0;
 
+  keyinfo_cache_flush ();
   rc = start_agent (NULL, 1);
   if (rc)
     return rc;
 
-  rc = assuan_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
+  rc = agent_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
                         NULL, NULL);
   if (rc)
     return rc;
@@ -821,7 +1000,7 @@ agent_scd_getattr (const char *name, struct agent_card_info_s *info)
     return rc;
 
   parm.ctx = agent_ctx;
-  rc = assuan_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
+  rc = agent_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
                         learn_status_cb, info);
 
   return rc;
@@ -874,7 +1053,7 @@ agent_scd_setattr (const char *name,
   if (!rc)
     {
       parm.ctx = agent_ctx;
-      rc = assuan_transact (agent_ctx, line, NULL, NULL,
+      rc = agent_transact (agent_ctx, line, NULL, NULL,
                             default_inq_cb, &parm, NULL, NULL);
     }
 
@@ -930,7 +1109,7 @@ agent_scd_writecert (const char *certidstr,
   parms.certdata = certdata;
   parms.certdatalen = certdatalen;
 
-  rc = assuan_transact (agent_ctx, line, NULL, NULL,
+  rc = agent_transact (agent_ctx, line, NULL, NULL,
                         inq_writecert_parms, &parms, NULL, NULL);
 
   return rc;
@@ -971,6 +1150,7 @@ agent_scd_writekey (int keyno, const char *serialno,
 
   (void)serialno;
 
+  keyinfo_cache_flush ();
   rc = start_agent (NULL, 1);
   if (rc)
     return rc;
@@ -984,7 +1164,7 @@ agent_scd_writekey (int keyno, const char *serialno,
   parms.keydata = keydata;
   parms.keydatalen = keydatalen;
 
-  rc = assuan_transact (agent_ctx, line, NULL, NULL,
+  rc = agent_transact (agent_ctx, line, NULL, NULL,
                         inq_writekey_parms, &parms, NULL, NULL);
 
   status_sc_op_failure (rc);
@@ -1114,6 +1294,7 @@ agent_scd_genkey (struct agent_card_genkey_s *info, int keyno, int force,
   memset (&parms, 0, sizeof parms);
   parms.cgk = info;
 
+  keyinfo_cache_flush ();
   rc = start_agent (NULL, 1);
   if (rc)
     return rc;
@@ -1131,7 +1312,7 @@ agent_scd_genkey (struct agent_card_genkey_s *info, int keyno, int force,
 
   dfltparm.ctx = agent_ctx;
   memset (info, 0, sizeof *info);
-  rc = assuan_transact (agent_ctx, line,
+  rc = agent_transact (agent_ctx, line,
                         NULL, NULL, default_inq_cb, &dfltparm,
                         scd_genkey_cb, &parms);
 
@@ -1161,7 +1342,7 @@ select_openpgp (const char *serialno)
      sue of a pinentry prompt with a cancel option we use it here in a
      boolean sense.  */
   if (!serialno || opt.limit_card_insert_tries == 1)
-    err = assuan_transact (agent_ctx, "SCD SERIALNO openpgp",
+    err = agent_transact (agent_ctx, "SCD SERIALNO openpgp",
                            NULL, NULL, NULL, NULL, NULL, NULL);
   else
     {
@@ -1181,7 +1362,7 @@ select_openpgp (const char *serialno)
       do
         {
           ask = 0;
-          err = assuan_transact (agent_ctx, "SCD SERIALNO openpgp",
+          err = agent_transact (agent_ctx, "SCD SERIALNO openpgp",
                                  NULL, NULL, NULL, NULL,
                                  get_serialno_cb, &this_sn);
           if (gpg_err_code (err) == GPG_ERR_CARD_NOT_PRESENT)
@@ -1260,7 +1441,7 @@ agent_scd_readcert (const char *certidstr,
 
   snprintf (line, DIM(line)-1, "SCD READCERT %s", certidstr);
   line[DIM(line)-1] = 0;
-  rc = assuan_transact (agent_ctx, line,
+  rc = agent_transact (agent_ctx, line,
                         membuf_data_cb, &data,
                         default_inq_cb, &dfltparm,
                         NULL, NULL);
@@ -1311,7 +1492,7 @@ agent_scd_change_pin (int chvno, const char *serialno)
 
   snprintf (line, DIM(line)-1, "SCD PASSWD %s %d", reset, chvno);
   line[DIM(line)-1] = 0;
-  rc = assuan_transact (agent_ctx, line,
+  rc = agent_transact (agent_ctx, line,
                         NULL, NULL,
                         default_inq_cb, &dfltparm,
                         NULL, NULL);
@@ -1339,7 +1520,7 @@ agent_scd_checkpin  (const char *serialno)
 
   snprintf (line, DIM(line)-1, "SCD CHECKPIN %s", serialno);
   line[DIM(line)-1] = 0;
-  rc = assuan_transact (agent_ctx, line,
+  rc = agent_transact (agent_ctx, line,
                         NULL, NULL,
                         default_inq_cb, &dfltparm,
                         NULL, NULL);
@@ -1390,7 +1571,7 @@ agent_get_passphrase (const char *cache_id,
   dfltparm.ctx = agent_ctx;
 
   /* Check that the gpg-agent understands the repeat option.  */
-  if (assuan_transact (agent_ctx,
+  if (agent_transact (agent_ctx,
                        "GETINFO cmd_has_option GET_PASSPHRASE repeat",
                        NULL, NULL, NULL, NULL, NULL, NULL))
     return gpg_error (GPG_ERR_NOT_SUPPORTED);
@@ -1423,7 +1604,7 @@ agent_get_passphrase (const char *cache_id,
   xfree (arg4);
 
   init_membuf_secure (&data, 64);
-  rc = assuan_transact (agent_ctx, line,
+  rc = agent_transact (agent_ctx, line,
                         membuf_data_cb, &data,
                         default_inq_cb, &dfltparm,
                         NULL, NULL);
@@ -1467,7 +1648,7 @@ agent_clear_passphrase (const char *cache_id)
 
   snprintf (line, DIM(line)-1, "CLEAR_PASSPHRASE %s", cache_id);
   line[DIM(line)-1] = 0;
-  return assuan_transact (agent_ctx, line,
+  return agent_transact (agent_ctx, line,
                           NULL, NULL,
                           default_inq_cb, &dfltparm,
                           NULL, NULL);
@@ -1498,7 +1679,7 @@ gpg_agent_get_confirmation (const char *desc)
   line[DIM(line)-1] = 0;
   xfree (tmp);
 
-  rc = assuan_transact (agent_ctx, line,
+  rc = agent_transact (agent_ctx, line,
                         NULL, NULL,
                         default_inq_cb, &dfltparm,
                         NULL, NULL);
@@ -1521,7 +1702,7 @@ agent_get_s2k_count (unsigned long *r_count)
     return err;
 
   init_membuf (&data, 32);
-  err = assuan_transact (agent_ctx, "GETINFO s2k_count",
+  err = agent_transact (agent_ctx, "GETINFO s2k_count",
                         membuf_data_cb, &data,
                         NULL, NULL, NULL, NULL);
   if (err)
@@ -1543,6 +1724,95 @@ agent_get_s2k_count (unsigned long *r_count)
 
 
 
+/* Status callback for keyinfo_cache_fill.  */
+static gpg_error_t
+keyinfo_multi_status_cb (void *opaque, const char *line)
+{
+  const char *s;
+  unsigned char grip[20];
+  struct keyinfo_cache_s *ki;
+  char *serialno = NULL;
+
+  (void)opaque;
+
+  if (!(s = has_leading_keyword (line, "KEYINFO"))
+      || hex2bin (s, grip, 20) < 0
+      || !(ki = keyinfo_cache_find (grip)))
+    return 0;
+
+  keyinfo_status_cb (&serialno, line);
+  if (serialno && strpbrk (serialno, ":\n\r"))
+    {
+      /* Sanity check for bad characters.  */
+      xfree (serialno);
+      serialno = NULL;
+    }
+  ki->available = 1;
+  xfree (ki->serialno);
+  ki->serialno = serialno;
+  return 0;
+}
+
+
+/* Ask the agent about all keys of KEYBLOCK with as few requests as
+   possible and store the results in the cache.  Returns an error if
+   the agent does not support this.  */
+static gpg_error_t
+keyinfo_cache_fill (kbnode_t keyblock)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  char *p;
+  kbnode_t kbctx, node;
+  int nkeys;
+  unsigned char grip[20];
+
+  if (!keyinfo_multi_supported)
+    keyinfo_multi_supported = agent_transact (agent_ctx,
+                                   "GETINFO cmd_has_option KEYINFO multi",
+                                   NULL, NULL, NULL, NULL, NULL, NULL)? -1:1;
+  if (keyinfo_multi_supported < 0)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  err = 0;
+  p = stpcpy (line, "KEYINFO --multi");
+  for (kbctx=NULL, nkeys=0; (node = walk_kbnode (keyblock, &kbctx, 0)); )
+    if (node->pkt->pkttype == PKT_PUBLIC_KEY
+        || node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+        || node->pkt->pkttype == PKT_SECRET_KEY
+        || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+      {
+        if (keygrip_from_pk (node->pkt->pkt.public_key, grip)
+            || keyinfo_cache_find (grip))
+          continue;
+
+        if (nkeys && ((p - line) + 41) > (ASSUAN_LINELENGTH - 2))
+          {
+            err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                                  keyinfo_multi_status_cb, NULL);
+            if (err)
+              break;
+            p = stpcpy (line, "KEYINFO --multi");
+            nkeys = 0;
+          }
+
+        /* Assume the key is missing until the agent tells otherwise.  */
+        keyinfo_cache_add (grip);
+        *p++ = ' ';
+        bin2hex (grip, 20, p);
+        p += 40;
+        nkeys++;
+      }
+
+  if (!err && nkeys)
+    err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                          keyinfo_multi_status_cb, NULL);
+  if (err)
+    keyinfo_cache_flush ();
+  return err;
+}
+
+
 /* Ask the agent whether a secret key for the given public key is
    available.  Returns 0 if available.  */
 gpg_error_t
@@ -1552,10 +1822,16 @@ agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk)
   char line[ASSUAN_LINELENGTH];
   char *hexgrip;
 
+  unsigned char grip[20];
+  struct keyinfo_cache_s *ki;
+
   err = start_agent (ctrl, 0);
   if (err)
     return err;
 
+  if (!keygrip_from_pk (pk, grip) && (ki = keyinfo_cache_find (grip)))
+    return ki->available? 0 : gpg_error (GPG_ERR_NO_SECKEY);
+
   err = hexkeygrip_from_pk (pk, &hexgrip);
   if (err)
     return err;
@@ -1563,7 +1839,7 @@ agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk)
   snprintf (line, sizeof line, "HAVEKEY %s", hexgrip);
   xfree (hexgrip);
 
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
   return err;
 }
 
@@ -1579,10 +1855,27 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
   int nkeys;
   unsigned char grip[20];
 
+  struct keyinfo_cache_s *ki;
+
   err = start_agent (ctrl, 0);
   if (err)
     return err;
 
+  /* Ask for all keys at once, which also answers the following
+     queries for the subkeys.  */
+  if (!keyinfo_cache_fill (keyblock))
+    {
+      for (kbctx=NULL; (node = walk_kbnode (keyblock, &kbctx, 0)); )
+        if ((node->pkt->pkttype == PKT_PUBLIC_KEY
+             || node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+             || node->pkt->pkttype == PKT_SECRET_KEY
+             || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+            && !keygrip_from_pk (node->pkt->pkt.public_key, grip)
+            && (ki = keyinfo_cache_find (grip)) && ki->available)
+          return 0;
+      return gpg_error (GPG_ERR_NO_SECKEY);
+    }
+
   err = gpg_error (GPG_ERR_NO_SECKEY); /* Just in case no key was
                                           found in KEYBLOCK.  */
   p = stpcpy (line, "HAVEKEY");
@@ -1594,7 +1887,7 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
       {
         if (nkeys && ((p - line) + 41) > (ASSUAN_LINELENGTH - 2))
           {
-            err = assuan_transact (agent_ctx, line,
+            err = agent_transact (agent_ctx, line,
                                    NULL, NULL, NULL, NULL, NULL, NULL);
             if (err != gpg_err_code (GPG_ERR_NO_SECKEY))
               break; /* Seckey available or unexpected error - ready.  */
@@ -1612,7 +1905,7 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
       }
 
   if (!err && nkeys)
-    err = assuan_transact (agent_ctx, line,
+    err = agent_transact (agent_ctx, line,
                            NULL, NULL, NULL, NULL, NULL, NULL);
 
   return err;
@@ -1657,6 +1950,8 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip, char **r_serialno)
   gpg_error_t err;
   char line[ASSUAN_LINELENGTH];
   char *serialno = NULL;
+  unsigned char grip[20];
+  struct keyinfo_cache_s *ki;
 
   *r_serialno = NULL;
 
@@ -1667,10 +1962,19 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip, char **r_serialno)
   if (!hexkeygrip || strlen (hexkeygrip) != 40)
     return gpg_error (GPG_ERR_INV_VALUE);
 
+  if (hex2bin (hexkeygrip, grip, 20) >= 0 && (ki = keyinfo_cache_find (grip)))
+    {
+      if (!ki->available)
+        return gpg_error (GPG_ERR_NOT_FOUND);
+      if (ki->serialno && !(*r_serialno = xtrystrdup (ki->serialno)))
+        return gpg_error_from_syserror ();
+      return 0;
+    }
+
   snprintf (line, DIM(line)-1, "KEYINFO %s", hexkeygrip);
   line[DIM(line)-1] = 0;
 
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
                          keyinfo_status_cb, &serialno);
   if (!err && serialno)
     {
@@ -1686,6 +1990,60 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip, char **r_serialno)
 }
 
 
+/* Take the data received before the VANITY_RESULT status LINE as the
+   public key of that result and pass it to the result callback.  The
+   line has the job ID, the creation time, the fingerprint and the
+   keygrip.  */
+static gpg_error_t
+vanity_result_cb (struct cache_nonce_parm_s *parm, const char *line)
+{
+  gpg_error_t err;
+  const void *buf;
+  size_t len;
+  gcry_sexp_t s_pubkey;
+  char fpr[20];
+  char hexgrip[41];
+  unsigned long ts;
+  const char *s;
+  char *endp;
+
+  buf = peek_membuf (parm->data, &len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  if (!len)
+    return gpg_error (GPG_ERR_NO_DATA);
+  err = gcry_sexp_sscan (&s_pubkey, NULL, buf, len);
+  clear_membuf (parm->data, len);
+  if (err)
+    return err;
+
+  for (s = line; *s && !spacep (s); s++)
+    ;
+  while (spacep (s))
+    s++;
+  ts = strtoul (s, &endp, 10);
+  while (spacep (endp))
+    endp++;
+  if (endp == s || hex2bin (endp, fpr, 20) != 40)
+    {
+      gcry_sexp_release (s_pubkey);
+      return gpg_error (GPG_ERR_INV_RESPONSE);
+    }
+  endp += 40;
+  while (spacep (endp))
+    endp++;
+  if (hex2bin (endp, NULL, 20) != 40)
+    {
+      gcry_sexp_release (s_pubkey);
+      return gpg_error (GPG_ERR_INV_RESPONSE);
+    }
+  mem2str (hexgrip, endp, 41);
+
+  return parm->vanity->result_cb (parm->vanity->result_cb_value, ts,
+                                  fpr, hexgrip, s_pubkey);
+}
+
+
 /* Status callback for agent_import_key, agent_export_key and
    agent_genkey.  */
 static gpg_error_t
@@ -1716,6 +2074,77 @@ cache_nonce_status_cb (void *opaque, const char *line)
           *parm->passwd_nonce_addr = xtrystrdup (line);
         }
     }
+  else if (keywordlen == 10 && !memcmp (keyword, "VANITY_KEY", keywordlen))
+    {
+      /* The line has the creation time and the fingerprint of the
+         key found by a vanity search.  */
+      if (parm->vanity)
+        {
+          char *endp;
+          unsigned long ts;
+
+          ts = strtoul (line, &endp, 10);
+          while (spacep (endp))
+            endp++;
+          if (endp != line
+              && hex2bin (endp, parm->vanity->fpr, 20) == 40)
+            parm->vanity->timestamp = ts;
+        }
+    }
+  else if (keywordlen == 13 && !memcmp (keyword, "VANITY_SUBKEY", keywordlen))
+    {
+      /* The line has the creation time, the fingerprint and the
+         keygrip of the subkey found next to the primary key.  */
+      if (parm->vanity)
+        {
+          char *endp;
+          unsigned long ts;
+          unsigned char grip[20];
+
+          ts = strtoul (line, &endp, 10);
+          while (spacep (endp))
+            endp++;
+          if (endp != line
+              && hex2bin (endp, parm->vanity->subkey_fpr, 20) == 40)
+            {
+              endp += 40;
+              while (spacep (endp))
+                endp++;
+              if (hex2bin (endp, grip, 20) == 40)
+                {
+                  mem2str (parm->vanity->subkey_grip, endp, 41);
+                  parm->vanity->subkey_timestamp = ts;
+                  endp += 40;
+                  while (spacep (endp))
+                    endp++;
+                  parm->vanity->has_subkey_kdfparm
+                    = (hex2bin (endp, parm->vanity->subkey_kdfparm, 4) == 8);
+                }
+            }
+        }
+    }
+  else if (keywordlen == 8 && !memcmp (keyword, "PROGRESS", keywordlen))
+    {
+      write_status_text (STATUS_PROGRESS, line);
+    }
+  else if (keywordlen == 12 && !memcmp (keyword, "VANITY_STATS", keywordlen))
+    {
+      write_status_text (STATUS_VANITY_STATS, line);
+    }
+  else if (keywordlen == 13 && !memcmp (keyword, "VANITY_RESULT", keywordlen))
+    {
+      write_status_text (STATUS_VANITY_RESULT, line);
+      if (parm->vanity && parm->vanity->result_cb && parm->data)
+        return vanity_result_cb (parm, line);
+    }
+  else if (keywordlen == 12 && !memcmp (keyword, "VANITY_SEEDS", keywordlen))
+    {
+      write_status_text (STATUS_VANITY_SEEDS, line);
+    }
+  else if (keywordlen == 11 && !memcmp (keyword, "VANITY_COST", keywordlen))
+    {
+      write_status_text (STATUS_VANITY_COST, line);
+    }
 
   return 0;
 }
@@ -1735,11 +2164,21 @@ inq_genkey_parms (void *opaque, const char *line)
       err = assuan_send_data (parm->dflt->ctx,
                               parm->keyparms, strlen (parm->keyparms));
     }
+  else if (has_leading_keyword (line, "SUBKEYPARAM") && parm->subkey_keyparms)
+    {
+      err = assuan_send_data (parm->dflt->ctx, parm->subkey_keyparms,
+                              strlen (parm->subkey_keyparms));
+    }
   else if (has_leading_keyword (line, "NEWPASSWD") && parm->passphrase)
     {
       err = assuan_send_data (parm->dflt->ctx,
                               parm->passphrase,  strlen (parm->passphrase));
     }
+  else if (has_leading_keyword (line, "SEEDKEY") && parm->seed_key)
+    {
+      err = assuan_send_data (parm->dflt->ctx,
+                              parm->seed_key, strlen (parm->seed_key));
+    }
   else
     err = default_inq_cb (parm->dflt, line);
 
@@ -1752,11 +2191,27 @@ inq_genkey_parms (void *opaque, const char *line)
    gcry_pk_genkey.  If NO_PROTECTION is true the agent is advised not
    to protect the generated key.  If NO_PROTECTION is not set and
    PASSPHRASE is not NULL the agent is requested to protect the key
-   with that passphrase instead of asking for one.  */
+   with that passphrase instead of asking for one.  If VANITY is not
+   NULL the agent searches for a key with a keyid matching its
+   pattern; the creation time and the fingerprint of the key it found
+   are then stored in VANITY.  The creation time is set to 0 if the
+   agent did not report them.  If the search collects several keys,
+   only the first is returned; all of them are announced with a
+   VANITY_RESULT status line.  If the agent supports it, the public
+   keys of all of them are also passed to the RESULT_CB of VANITY
+   while the command is running.  If the SUBKEY_PATTERN of VANITY is not
+   NULL the agent also generates a subkey from its SUBKEY_KEYPARMS
+   with a keyid matching that pattern; its creation time, fingerprint
+   and keygrip are then stored in VANITY as well, and the KDF
+   parameters of an ECDH subkey searched with SUBKEY_KDF.  If the
+   SEED_KEY of VANITY is not NULL the agent searches only the
+   SEED_COUNT key streams starting at SEED_FIRST of that job key and
+   reports them with a VANITY_SEEDS status line.  */
 gpg_error_t
 agent_genkey (ctrl_t ctrl, char **cache_nonce_addr,
               const char *keyparms, int no_protection,
-              const char *passphrase, gcry_sexp_t *r_pubkey)
+              const char *passphrase, struct agent_vanity_parm_s *vanity,
+              gcry_sexp_t *r_pubkey)
 {
   gpg_error_t err;
   struct genkey_parm_s gk_parm;
@@ -1766,34 +2221,101 @@ agent_genkey (ctrl_t ctrl, char **cache_nonce_addr,
   size_t len;
   unsigned char *buf;
   char line[ASSUAN_LINELENGTH];
+  char vanityopt[ASSUAN_LINELENGTH/2];
+  const char *s;
+  char *p;
 
   memset (&dfltparm, 0, sizeof dfltparm);
   dfltparm.ctrl = ctrl;
 
   *r_pubkey = NULL;
+
+  /* The items of the pattern and the windows are passed comma
+     separated so that each is a single word on the command line.  */
+  *vanityopt = 0;
+  if (vanity)
+    {
+      vanity->timestamp = 0;
+      vanity->subkey_timestamp = 0;
+      vanity->has_subkey_kdfparm = 0;
+      *vanity->subkey_grip = 0;
+      if (strlen (vanity->pattern) + 10
+          + (vanity->window? strlen (vanity->window) + 10 : 0)
+          + (vanity->subkey_pattern? strlen (vanity->subkey_pattern) + 35 : 0)
+          + (vanity->subkey_kdf? strlen (vanity->subkey_kdf) + 15 : 0)
+          + 12 + 12 + 40 + 35 + 35 + 10 > sizeof vanityopt)
+        return gpg_error (GPG_ERR_TOO_LARGE);
+      p = vanityopt + sprintf (vanityopt, " --algo=%d", vanity->algo);
+      p = stpcpy (p, " --vanity=");
+      for (s = vanity->pattern; *s; s++)
+        *p++ = spacep (s)? ',' : *s;
+      if (vanity->window)
+        {
+          p = stpcpy (p, " --window=");
+          for (s = vanity->window; *s; s++)
+            *p++ = spacep (s)? ',' : *s;
+        }
+      if (vanity->backward)
+        p = stpcpy (p, " --backward");
+      if (vanity->hits != 1 || vanity->budget)
+        p += sprintf (p, " --hits=%u --budget=%lu",
+                      vanity->hits, vanity->budget);
+      if (vanity->iterations)
+        p += sprintf (p, " --iterations=%llu", vanity->iterations);
+      if (vanity->seed_key)
+        p += sprintf (p, " --seed-range=%u,%u",
+                      vanity->seed_first, vanity->seed_count);
+      if (vanity->subkey_pattern)
+        {
+          p += sprintf (p, " --subkey-algo=%d", vanity->subkey_algo);
+          p = stpcpy (p, " --subkey-vanity=");
+          for (s = vanity->subkey_pattern; *s; s++)
+            *p++ = spacep (s)? ',' : *s;
+          if (vanity->subkey_kdf)
+            {
+              p = stpcpy (p, " --subkey-kdf=");
+              for (s = vanity->subkey_kdf; *s; s++)
+                *p++ = spacep (s)? ',' : *s;
+            }
+        }
+      *p = 0;
+    }
+  keyinfo_cache_flush ();
   err = start_agent (ctrl, 0);
   if (err)
     return err;
   dfltparm.ctx = agent_ctx;
 
-  err = assuan_transact (agent_ctx, "RESET",
+  err = agent_transact (agent_ctx, "RESET",
                          NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
+  /* Older agents do not know --stream; without it only the key
+     returned is built.  */
+  if (vanity && vanity->result_cb
+      && !agent_transact (agent_ctx, "GETINFO cmd_has_option GENKEY stream",
+                          NULL, NULL, NULL, NULL, NULL, NULL))
+    strcat (vanityopt, " --stream");
+
   init_membuf (&data, 1024);
   gk_parm.dflt     = &dfltparm;
   gk_parm.keyparms = keyparms;
+  gk_parm.subkey_keyparms = vanity? vanity->subkey_keyparms : NULL;
   gk_parm.passphrase = passphrase;
-  snprintf (line, sizeof line, "GENKEY%s%s%s",
+  gk_parm.seed_key = vanity? vanity->seed_key : NULL;
+  snprintf (line, sizeof line, "GENKEY%s%s%s%s",
             no_protection? " --no-protection" :
             passphrase   ? " --inq-passwd" :
             /*          */ "",
+            vanityopt,
             cache_nonce_addr && *cache_nonce_addr? " ":"",
             cache_nonce_addr && *cache_nonce_addr? *cache_nonce_addr:"");
   cn_parm.cache_nonce_addr = cache_nonce_addr;
   cn_parm.passwd_nonce_addr = NULL;
-  err = assuan_transact (agent_ctx, line,
+  cn_parm.vanity = vanity;
+  cn_parm.data = strstr (vanityopt, " --stream")? &data : NULL;
+  err = agent_transact (agent_ctx, line,
                          membuf_data_cb, &data,
                          inq_genkey_parms, &gk_parm,
                          cache_nonce_status_cb, &cn_parm);
@@ -1815,46 +2337,228 @@ agent_genkey (ctrl_t ctrl, char **cache_nonce_addr,
 }
 
 
-
-/* Call the agent to read the public key part for a given keygrip.  If
-   FROMCARD is true, the key is directly read from the current
-   smartcard. In this case HEXKEYGRIP should be the keyID
-   (e.g. OPENPGP.3). */
+/* Status callback for the VANITY commands.  */
+static gpg_error_t
+vanity_job_status_cb (void *opaque, const char *line)
+{
+  struct vanity_job_parm_s *parm = opaque;
+  const char *keyword = line;
+  int keywordlen;
+  const char *s;
+  char *endp;
+  unsigned long ts;
+  size_t n;
+
+  for (keywordlen=0; *line && !spacep (line); line++, keywordlen++)
+    ;
+  while (spacep (line))
+    line++;
+
+  if (keywordlen == 10 && !memcmp (keyword, "VANITY_JOB", keywordlen))
+    {
+      /* The line has the job ID and the state of the job.  */
+      for (s = line; *s && !spacep (s); s++)
+        ;
+      if (parm->jobid && s - line == 16)
+        mem2str (parm->jobid, line, 17);
+      while (spacep (s))
+        s++;
+      for (n=0; s[n] && !spacep (s+n); n++)
+        ;
+      if (n < sizeof parm->state)
+        mem2str (parm->state, s, n+1);
+    }
+  else if (keywordlen == 13 && !memcmp (keyword, "VANITY_RESULT", keywordlen))
+    {
+      write_status_text (STATUS_VANITY_RESULT, line);
+      /* Only the first key of the job is taken.  */
+      if (parm->vanity && !parm->vanity->timestamp)
+        {
+          for (s = line; *s && !spacep (s); s++)
+            ;
+          while (spacep (s))
+            s++;
+          ts = strtoul (s, &endp, 10);
+          while (spacep (endp))
+            endp++;
+          if (endp == s || !ts || hex2bin (endp, parm->vanity->fpr, 20) != 40)
+            return gpg_error (GPG_ERR_INV_RESPONSE);
+          endp += 40;
+          while (spacep (endp))
+            endp++;
+          if (hex2bin (endp, NULL, 20) != 40)
+            return gpg_error (GPG_ERR_INV_RESPONSE);
+          mem2str (parm->hexgrip, endp, 41);
+          parm->vanity->timestamp = ts;
+        }
+    }
+  else if (keywordlen == 11 && !memcmp (keyword, "VANITY_COST", keywordlen))
+    {
+      /* Not while polling the state.  */
+      if (parm->vanity)
+        write_status_text (STATUS_VANITY_COST, line);
+    }
+
+  return 0;
+}
+
+
+/* Queue a vanity search for a key with the parameters KEYPARMS in
+   the background queue of the agent.  NO_PROTECTION and PASSPHRASE
+   are as with agent_genkey; the PATTERN, WINDOW, BACKWARD, ALGO and
+   HITS of VANITY are used.  On success the ID of the job is stored
+   at R_JOBID, which must have room for 17 bytes.  */
 gpg_error_t
-agent_readkey (ctrl_t ctrl, int fromcard, const char *hexkeygrip,
-               unsigned char **r_pubkey)
+agent_vanity_submit (ctrl_t ctrl, const char *keyparms, int no_protection,
+                     const char *passphrase,
+                     struct agent_vanity_parm_s *vanity, char *r_jobid)
 {
   gpg_error_t err;
-  membuf_t data;
-  size_t len;
-  unsigned char *buf;
-  char line[ASSUAN_LINELENGTH];
+  struct genkey_parm_s gk_parm;
+  struct vanity_job_parm_s vj_parm;
   struct default_inq_parm_s dfltparm;
+  char line[ASSUAN_LINELENGTH];
+  const char *s;
+  char *p;
 
   memset (&dfltparm, 0, sizeof dfltparm);
   dfltparm.ctrl = ctrl;
+  *r_jobid = 0;
+
+  if (strlen (vanity->pattern)
+      + (vanity->window? strlen (vanity->window) : 0) + 100 > sizeof line)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  p = stpcpy (line, "VANITY SUBMIT");
+  if (no_protection)
+    p = stpcpy (p, " --no-protection");
+  else if (passphrase)
+    p = stpcpy (p, " --inq-passwd");
+  p += sprintf (p, " --algo=%d --hits=%u", vanity->algo, vanity->hits);
+  p = stpcpy (p, " --vanity=");
+  for (s = vanity->pattern; *s; s++)
+    *p++ = spacep (s)? ',' : *s;
+  if (vanity->window)
+    {
+      p = stpcpy (p, " --window=");
+      for (s = vanity->window; *s; s++)
+        *p++ = spacep (s)? ',' : *s;
+    }
+  if (vanity->backward)
+    p = stpcpy (p, " --backward");
+  *p = 0;
 
-  *r_pubkey = NULL;
   err = start_agent (ctrl, 0);
   if (err)
     return err;
   dfltparm.ctx = agent_ctx;
 
-  err = assuan_transact (agent_ctx, "RESET",NULL, NULL, NULL, NULL, NULL, NULL);
+  memset (&gk_parm, 0, sizeof gk_parm);
+  gk_parm.dflt = &dfltparm;
+  gk_parm.keyparms = keyparms;
+  gk_parm.passphrase = passphrase;
+  memset (&vj_parm, 0, sizeof vj_parm);
+  vj_parm.jobid = r_jobid;
+  err = agent_transact (agent_ctx, line, NULL, NULL,
+                         inq_genkey_parms, &gk_parm,
+                         vanity_job_status_cb, &vj_parm);
+  if (!err && !*r_jobid)
+    err = gpg_error (GPG_ERR_INV_RESPONSE);
   if (err)
-    return err;
+    *r_jobid = 0;
+  return err;
+}
 
-  snprintf (line, DIM(line)-1, "%sREADKEY %s", fromcard? "SCD ":"", hexkeygrip);
 
-  init_membuf (&data, 1024);
-  err = assuan_transact (agent_ctx, line,
-                         membuf_data_cb, &data,
-                         default_inq_cb, &dfltparm,
-                         NULL, NULL);
+/* Wait until the vanity search JOBID queued with agent_vanity_submit
+   has ended.  If it found a key, its creation time and fingerprint
+   are stored in VANITY and its keygrip as a hex string at R_HEXGRIP,
+   which must have room for 41 bytes.  The job is then removed from
+   the queue of the agent.  Returns GPG_ERR_NOT_FOUND if the job ended
+   without a key.  */
+gpg_error_t
+agent_vanity_wait (ctrl_t ctrl, const char *jobid,
+                   struct agent_vanity_parm_s *vanity, char *r_hexgrip)
+{
+  gpg_error_t err;
+  struct vanity_job_parm_s vj_parm;
+  char line[ASSUAN_LINELENGTH];
+
+  vanity->timestamp = 0;
+  *r_hexgrip = 0;
+
+  err = start_agent (ctrl, 0);
   if (err)
+    return err;
+
+  /* The agent has no command to wait for a job, thus its state is
+     polled.  */
+  snprintf (line, sizeof line, "VANITY STATUS %s", jobid);
+  for (;;)
     {
-      xfree (get_membuf (&data, &len));
-      return err;
+      memset (&vj_parm, 0, sizeof vj_parm);
+      err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                             vanity_job_status_cb, &vj_parm);
+      if (err)
+        return err;
+      if (!*vj_parm.state)
+        return gpg_error (GPG_ERR_INV_RESPONSE);
+      if (strcmp (vj_parm.state, "queued") && strcmp (vj_parm.state, "running"))
+        break;
+      gnupg_sleep (1);
+    }
+
+  snprintf (line, sizeof line, "VANITY RESULT %s", jobid);
+  memset (&vj_parm, 0, sizeof vj_parm);
+  vj_parm.vanity = vanity;
+  vj_parm.hexgrip = r_hexgrip;
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                         vanity_job_status_cb, &vj_parm);
+  if (!err && !vanity->timestamp)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+  return err;
+}
+
+
+
+/* Call the agent to read the public key part for a given keygrip.  If
+   FROMCARD is true, the key is directly read from the current
+   smartcard. In this case HEXKEYGRIP should be the keyID
+   (e.g. OPENPGP.3). */
+gpg_error_t
+agent_readkey (ctrl_t ctrl, int fromcard, const char *hexkeygrip,
+               unsigned char **r_pubkey)
+{
+  gpg_error_t err;
+  membuf_t data;
+  size_t len;
+  unsigned char *buf;
+  char line[ASSUAN_LINELENGTH];
+  struct default_inq_parm_s dfltparm;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+
+  *r_pubkey = NULL;
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  err = agent_transact (agent_ctx, "RESET",NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  snprintf (line, DIM(line)-1, "%sREADKEY %s", fromcard? "SCD ":"", hexkeygrip);
+
+  init_membuf (&data, 1024);
+  err = agent_transact (agent_ctx, line,
+                         membuf_data_cb, &data,
+                         default_inq_cb, &dfltparm,
+                         NULL, NULL);
+  if (err)
+    {
+      xfree (get_membuf (&data, &len));
+      return err;
     }
   buf = get_membuf (&data, &len);
   if (!buf)
@@ -1903,14 +2607,14 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
   if (digestlen*2 + 50 > DIM(line))
     return gpg_error (GPG_ERR_GENERAL);
 
-  err = assuan_transact (agent_ctx, "RESET",
+  err = agent_transact (agent_ctx, "RESET",
                          NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
   snprintf (line, DIM(line)-1, "SIGKEY %s", keygrip);
   line[DIM(line)-1] = 0;
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
@@ -1918,7 +2622,7 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
     {
       snprintf (line, DIM(line)-1, "SETKEYDESC %s", desc);
       line[DIM(line)-1] = 0;
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                             NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
@@ -1926,7 +2630,7 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
 
   snprintf (line, sizeof line, "SETHASH %d ", digestalgo);
   bin2hex (digest, digestlen, line + strlen (line));
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
@@ -1935,7 +2639,7 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
   snprintf (line, sizeof line, "PKSIGN%s%s",
             cache_nonce? " -- ":"",
             cache_nonce? cache_nonce:"");
-  err = assuan_transact (agent_ctx, line,
+  err = agent_transact (agent_ctx, line,
                          membuf_data_cb, &data,
                          default_inq_cb, &dfltparm,
                          NULL, NULL);
@@ -1959,16 +2663,148 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
 }
 
 
+
+/* Handle a DIGESTS inquiry by sending one line for each digest.  */
+static gpg_error_t
+inq_pksign_batch_digests (void *opaque, const char *line)
+{
+  struct pksign_batch_parm_s *parm = opaque;
+  char buf[ASSUAN_LINELENGTH];
+  unsigned int i;
+  gpg_error_t err = 0;
+
+  if (!has_leading_keyword (line, "DIGESTS"))
+    return default_inq_cb (parm->dflt, line);
+
+  for (i=0; !err && i < parm->ndigests; i++)
+    {
+      snprintf (buf, sizeof buf, "%d ", parm->digestalgo);
+      bin2hex (parm->digests[i], parm->digestlen, buf + strlen (buf));
+      strcat (buf, "\n");
+      err = assuan_send_data (parm->dflt->ctx, buf, strlen (buf));
+    }
+  return err;
+}
+
+
+/* Sign the NDIGESTS digests at DIGESTS, each of DIGESTLEN bytes and
+   with the algorithm DIGESTALGO, using the key KEYGRIP.  The key is
+   unprotected only once.  On success the signatures are stored at
+   R_SIGVALS, which must have space for NDIGESTS items.  Returns
+   GPG_ERR_ASS_UNKNOWN_CMD if the agent can't do that; the caller may
+   then use agent_pksign for each digest.  */
+gpg_error_t
+agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                    const char *keygrip, const char *desc,
+                    u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                    unsigned char **digests, size_t digestlen,
+                    int digestalgo, unsigned int ndigests,
+                    gcry_sexp_t *r_sigvals)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  membuf_t data;
+  struct default_inq_parm_s dfltparm;
+  struct pksign_batch_parm_s parm;
+  unsigned char *buf;
+  size_t len, off, n;
+  unsigned int i;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+  dfltparm.keyinfo.keyid       = keyid;
+  dfltparm.keyinfo.mainkeyid   = mainkeyid;
+  dfltparm.keyinfo.pubkey_algo = pubkey_algo;
+
+  for (i=0; i < ndigests; i++)
+    r_sigvals[i] = NULL;
+  if (digestlen*2 + 50 > DIM(line))
+    return gpg_error (GPG_ERR_GENERAL);
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  err = agent_transact (agent_ctx, "RESET",
+                         NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  snprintf (line, DIM(line)-1, "SIGKEY %s", keygrip);
+  line[DIM(line)-1] = 0;
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  if (desc)
+    {
+      snprintf (line, DIM(line)-1, "SETKEYDESC %s", desc);
+      line[DIM(line)-1] = 0;
+      err = agent_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        return err;
+    }
+
+  memset (&parm, 0, sizeof parm);
+  parm.dflt = &dfltparm;
+  parm.digests = digests;
+  parm.digestlen = digestlen;
+  parm.digestalgo = digestalgo;
+  parm.ndigests = ndigests;
+
+  init_membuf (&data, 1024);
+
+  snprintf (line, sizeof line, "PKSIGN_BATCH%s%s",
+            cache_nonce? " -- ":"",
+            cache_nonce? cache_nonce:"");
+  err = agent_transact (agent_ctx, line,
+                         membuf_data_cb, &data,
+                         inq_pksign_batch_digests, &parm,
+                         NULL, NULL);
+  if (err)
+    {
+      xfree (get_membuf (&data, NULL));
+      return err;
+    }
+  buf = get_membuf (&data, &len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+
+  /* The signatures are canonical S-expressions, one after the
+     other.  */
+  for (off=0, i=0; !err && i < ndigests; i++, off += n)
+    {
+      n = gcry_sexp_canon_len (buf + off, len - off, NULL, &err);
+      if (!n)
+        break;
+      err = gcry_sexp_sscan (&r_sigvals[i], NULL, (char*)buf + off, n);
+    }
+  if (!err && (i < ndigests || off != len))
+    err = gpg_error (GPG_ERR_INV_RESPONSE);
+  xfree (buf);
+  if (err)
+    for (i=0; i < ndigests; i++)
+      {
+        gcry_sexp_release (r_sigvals[i]);
+        r_sigvals[i] = NULL;
+      }
+  return err;
+}
+
+
 
-/* Handle a CIPHERTEXT inquiry.  Note, we only send the data,
-   assuan_transact takes care of flushing and writing the END. */
+/* Handle a CIPHERTEXT or CIPHERTEXTS inquiry.  Note, we only send
+   the data, assuan_transact takes care of flushing and writing the
+   END. */
 static gpg_error_t
 inq_ciphertext_cb (void *opaque, const char *line)
 {
   struct cipher_parm_s *parm = opaque;
   int rc;
 
-  if (has_leading_keyword (line, "CIPHERTEXT"))
+  if (has_leading_keyword (line, "CIPHERTEXT")
+      || has_leading_keyword (line, "CIPHERTEXTS"))
     {
       assuan_begin_confidential (parm->ctx);
       rc = assuan_send_data (parm->dflt->ctx,
@@ -1998,6 +2834,84 @@ padding_info_cb (void *opaque, const char *line)
 }
 
 
+/* Return true if the agent supports the option --input-fd for CMD and
+   the data of DATALEN bytes is worth passing that way.  */
+static int
+want_input_fd (const char *cmd, size_t datalen)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)cmd;
+  (void)datalen;
+  return 0;
+#else
+  char line[ASSUAN_LINELENGTH];
+
+  if (datalen < INPUT_FD_THRESHOLD)
+    return 0;
+  snprintf (line, sizeof line, "GETINFO cmd_has_option %s input-fd", cmd);
+  return !agent_transact (agent_ctx, line,
+                          NULL, NULL, NULL, NULL, NULL, NULL);
+#endif
+}
+
+
+/* Write DATA of DATALEN bytes to an anonymous file and pass it to the
+   agent as the input file of the next command.  With memfd_create the
+   data never touches the disk; the fallback is a temporary file which
+   is already unlinked.  */
+static gpg_error_t
+send_input_fd (const void *data, size_t datalen)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)data;
+  (void)datalen;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#else
+  gpg_error_t err;
+  int fd;
+  size_t nleft;
+  ssize_t n;
+  const char *p;
+
+#ifdef HAVE_MEMFD_CREATE
+  fd = memfd_create ("gpg-input", 0);
+#else
+  {
+    FILE *fp = tmpfile ();
+
+    fd = fp? dup (fileno (fp)) : -1;
+    if (fp)
+      fclose (fp);
+  }
+#endif
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+
+  err = 0;
+  for (p = data, nleft = datalen; nleft; p += n, nleft -= n)
+    {
+      n = write (fd, p, nleft);
+      if (n < 0 && errno == EINTR)
+        n = 0;
+      else if (n < 0)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+    }
+  if (!err && lseek (fd, 0, SEEK_SET) == (off_t)(-1))
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = assuan_sendfd (agent_ctx, fd);
+  if (!err)
+    err = agent_transact (agent_ctx, "INPUT FD",
+                          NULL, NULL, NULL, NULL, NULL, NULL);
+  close (fd);
+  return err;
+#endif
+}
+
+
 /* Call the agent to do a decrypt operation using the key identified
    by the hex string KEYGRIP and the input data S_CIPHERTEXT.  On the
    success the decoded value is stored verbatim at R_BUF and its
@@ -2036,13 +2950,13 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
     return err;
   dfltparm.ctx = agent_ctx;
 
-  err = assuan_transact (agent_ctx, "RESET",
+  err = agent_transact (agent_ctx, "RESET",
                          NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
   snprintf (line, sizeof line, "SETKEY %s", keygrip);
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
@@ -2050,7 +2964,7 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
     {
       snprintf (line, DIM(line)-1, "SETKEYDESC %s", desc);
       line[DIM(line)-1] = 0;
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                             NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
@@ -2059,16 +2973,22 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
   init_membuf_secure (&data, 1024);
   {
     struct cipher_parm_s parm;
+    int use_fd;
 
     parm.dflt = &dfltparm;
     parm.ctx = agent_ctx;
     err = make_canon_sexp (s_ciphertext, &parm.ciphertext, &parm.ciphertextlen);
     if (err)
       return err;
-    err = assuan_transact (agent_ctx, "PKDECRYPT",
-                           membuf_data_cb, &data,
-                           inq_ciphertext_cb, &parm,
-                           padding_info_cb, r_padding);
+    use_fd = want_input_fd ("PKDECRYPT", parm.ciphertextlen);
+    if (use_fd)
+      err = send_input_fd (parm.ciphertext, parm.ciphertextlen);
+    if (!err)
+      err = agent_transact (agent_ctx, use_fd? "PKDECRYPT --input-fd"
+                                             : "PKDECRYPT",
+                            membuf_data_cb, &data,
+                            inq_ciphertext_cb, &parm,
+                            padding_info_cb, r_padding);
     xfree (parm.ciphertext);
   }
   if (err)
@@ -2118,6 +3038,178 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
 }
 
 
+/* Parse the result of one ciphertext of PKDECRYPT_BATCH, the
+   canonical S-expression of LEN bytes at BUF, and store the decoded
+   value at R_BUF and its length at R_BUFLEN.  */
+static gpg_error_t
+parse_batch_plain (const char *buf, size_t len,
+                   unsigned char **r_buf, size_t *r_buflen)
+{
+  const char *p;
+  char *endp;
+  unsigned long n;
+  int is_error;
+
+  *r_buf = NULL;
+  if (len < 12 || buf[len-1] != ')')
+    return gpg_error (GPG_ERR_INV_SEXP);
+  if (!memcmp (buf, "(5:value", 8))
+    is_error = 0;
+  else if (!memcmp (buf, "(5:error", 8))
+    is_error = 1;
+  else
+    return gpg_error (GPG_ERR_INV_SEXP);
+  p = buf + 8;
+  n = strtoul (p, &endp, 10);
+  if (!n || *endp != ':' || (endp + 1 - buf) + n + 1 != len)
+    return gpg_error (GPG_ERR_INV_SEXP);
+  endp++;
+
+  if (is_error)
+    {
+      char numbuf[35];
+
+      if (n >= sizeof numbuf)
+        return gpg_error (GPG_ERR_INV_SEXP);
+      memcpy (numbuf, endp, n);
+      numbuf[n] = 0;
+      n = strtoul (numbuf, NULL, 10);
+      return n? (gpg_error_t)n : gpg_error (GPG_ERR_INV_SEXP);
+    }
+
+  *r_buf = xtrymalloc_secure (n);
+  if (!*r_buf)
+    return gpg_error_from_syserror ();
+  memcpy (*r_buf, endp, n);
+  *r_buflen = n;
+  return 0;
+}
+
+
+/* Decrypt the NCIPHERTEXTS ciphertexts S_CIPHERTEXTS with the key
+   identified by the hex string KEYGRIP in one go, so that the agent
+   unprotects the key only once.  For ciphertext I the decoded value
+   and its length are stored at R_BUFS[I] and R_BUFLENS[I] as with
+   agent_pkdecrypt, with the padding not known, or the error at
+   R_ERRS[I]; the caller needs to release the values.  Returns
+   GPG_ERR_ASS_UNKNOWN_CMD if the agent can't do that and
+   GPG_ERR_NOT_SUPPORTED if the key is on a smartcard; the caller may
+   then use agent_pkdecrypt for each ciphertext.  */
+gpg_error_t
+agent_pkdecrypt_batch (ctrl_t ctrl, const char *keygrip, const char *desc,
+                       u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                       gcry_sexp_t *s_ciphertexts, unsigned int nciphertexts,
+                       unsigned char **r_bufs, size_t *r_buflens,
+                       gpg_error_t *r_errs)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  membuf_t data, cipherbuf;
+  struct default_inq_parm_s dfltparm;
+  struct cipher_parm_s parm;
+  unsigned char *buf, *one;
+  size_t len, onelen, off, n;
+  unsigned int i;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+  dfltparm.keyinfo.keyid       = keyid;
+  dfltparm.keyinfo.mainkeyid   = mainkeyid;
+  dfltparm.keyinfo.pubkey_algo = pubkey_algo;
+
+  for (i=0; i < nciphertexts; i++)
+    {
+      r_bufs[i] = NULL;
+      r_errs[i] = gpg_error (GPG_ERR_INV_RESPONSE);
+    }
+  if (!keygrip || strlen(keygrip) != 40)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  err = agent_transact (agent_ctx, "RESET",
+                         NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  snprintf (line, sizeof line, "SETKEY %s", keygrip);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  if (desc)
+    {
+      snprintf (line, DIM(line)-1, "SETKEYDESC %s", desc);
+      line[DIM(line)-1] = 0;
+      err = agent_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        return err;
+    }
+
+  /* The ciphertexts are sent one after the other.  */
+  init_membuf (&cipherbuf, 4096);
+  for (i=0; !err && i < nciphertexts; i++)
+    {
+      err = make_canon_sexp (s_ciphertexts[i], &one, &onelen);
+      if (!err)
+        {
+          put_membuf (&cipherbuf, one, onelen);
+          xfree (one);
+        }
+    }
+  parm.dflt = &dfltparm;
+  parm.ctx = agent_ctx;
+  parm.ciphertext = get_membuf (&cipherbuf, &parm.ciphertextlen);
+  if (err)
+    {
+      xfree (parm.ciphertext);
+      return err;
+    }
+  if (!parm.ciphertext)
+    return gpg_error_from_syserror ();
+
+  init_membuf_secure (&data, 1024);
+  err = agent_transact (agent_ctx, "PKDECRYPT_BATCH",
+                        membuf_data_cb, &data,
+                        inq_ciphertext_cb, &parm,
+                        NULL, NULL);
+  xfree (parm.ciphertext);
+  if (err)
+    {
+      xfree (get_membuf (&data, NULL));
+      return err;
+    }
+  buf = get_membuf (&data, &len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+
+  /* The results are canonical S-expressions, one after the other.  */
+  for (off=0, i=0; !err && i < nciphertexts; i++, off += n)
+    {
+      n = gcry_sexp_canon_len (buf + off, len - off, NULL, &err);
+      if (!n)
+        break;
+      r_errs[i] = parse_batch_plain ((char*)buf + off, n,
+                                     &r_bufs[i], &r_buflens[i]);
+    }
+  if (!err && (i < nciphertexts || off != len))
+    err = gpg_error (GPG_ERR_INV_RESPONSE);
+  wipememory (buf, len);
+  xfree (buf);
+  if (err)
+    for (i=0; i < nciphertexts; i++)
+      {
+        xfree (r_bufs[i]);
+        r_bufs[i] = NULL;
+      }
+  return err;
+}
+
+
 
 /* Retrieve a key encryption key from the agent.  With FOREXPORT true
    the key shall be used for export, with false for import.  On success
@@ -2141,11 +3233,24 @@ agent_keywrap_key (ctrl_t ctrl, int forexport, void **r_kek, size_t *r_keklen)
     return err;
   dfltparm.ctx = agent_ctx;
 
+  /* The agent keeps the import key for the session, thus a new one
+     would only cost it strong random bytes.  */
+  if (!forexport && import_kek)
+    {
+      buf = xtrymalloc_secure (import_keklen);
+      if (!buf)
+        return gpg_error_from_syserror ();
+      memcpy (buf, import_kek, import_keklen);
+      *r_kek = buf;
+      *r_keklen = import_keklen;
+      return 0;
+    }
+
   snprintf (line, DIM(line)-1, "KEYWRAP_KEY %s",
             forexport? "--export":"--import");
 
   init_membuf_secure (&data, 64);
-  err = assuan_transact (agent_ctx, line,
+  err = agent_transact (agent_ctx, line,
                          membuf_data_cb, &data,
                          default_inq_cb, &dfltparm,
                          NULL, NULL);
@@ -2157,6 +3262,11 @@ agent_keywrap_key (ctrl_t ctrl, int forexport, void **r_kek, size_t *r_keklen)
   buf = get_membuf (&data, &len);
   if (!buf)
     return gpg_error_from_syserror ();
+  if (!forexport && (import_kek = xtrymalloc_secure (len)))
+    {
+      memcpy (import_kek, buf, len);
+      import_keklen = len;
+    }
   *r_kek = buf;
   *r_keklen = len;
   return 0;
@@ -2192,10 +3302,12 @@ agent_import_key (ctrl_t ctrl, const char *desc, char **cache_nonce_addr,
   struct cache_nonce_parm_s cn_parm;
   char line[ASSUAN_LINELENGTH];
   struct default_inq_parm_s dfltparm;
+  int use_fd;
 
   memset (&dfltparm, 0, sizeof dfltparm);
   dfltparm.ctrl = ctrl;
 
+  keyinfo_cache_flush ();
   err = start_agent (ctrl, 0);
   if (err)
     return err;
@@ -2205,7 +3317,7 @@ agent_import_key (ctrl_t ctrl, const char *desc, char **cache_nonce_addr,
     {
       snprintf (line, DIM(line)-1, "SETKEYDESC %s", desc);
       line[DIM(line)-1] = 0;
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                             NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
@@ -2215,13 +3327,24 @@ agent_import_key (ctrl_t ctrl, const char *desc, char **cache_nonce_addr,
   parm.key    = key;
   parm.keylen = keylen;
 
-  snprintf (line, sizeof line, "IMPORT_KEY%s%s%s",
+  use_fd = want_input_fd ("IMPORT_KEY", keylen);
+  if (use_fd)
+    {
+      err = send_input_fd (key, keylen);
+      if (err)
+        return err;
+    }
+
+  snprintf (line, sizeof line, "IMPORT_KEY%s%s%s%s",
             unattended? " --unattended":"",
+            use_fd? " --input-fd":"",
             cache_nonce_addr && *cache_nonce_addr? " ":"",
             cache_nonce_addr && *cache_nonce_addr? *cache_nonce_addr:"");
   cn_parm.cache_nonce_addr = cache_nonce_addr;
   cn_parm.passwd_nonce_addr = NULL;
-  err = assuan_transact (agent_ctx, line,
+  cn_parm.vanity = NULL;
+  cn_parm.data = NULL;
+  err = agent_transact (agent_ctx, line,
                          NULL, NULL,
                          inq_import_key_parms, &parm,
                          cache_nonce_status_cb, &cn_parm);
@@ -2229,6 +3352,102 @@ agent_import_key (ctrl_t ctrl, const char *desc, char **cache_nonce_addr,
 }
 
 
+/* Status callback for agent_import_keys.  */
+static gpg_error_t
+import_keys_status_cb (void *opaque, const char *line)
+{
+  struct import_keys_parm_s *parm = opaque;
+  const char *s;
+  char *endp;
+  unsigned long idx;
+
+  if ((s = has_leading_keyword (line, "IMPORT_RESULT")))
+    {
+      idx = strtoul (s, &endp, 10);
+      if (endp != s && idx < parm->nkeys)
+        parm->r_errs[idx] = strtoul (endp, NULL, 10);
+      return 0;
+    }
+  return cache_nonce_status_cb (parm->cn_parm, line);
+}
+
+
+/* Call the agent to import the NKEYS wrapped keys KEYS, with the
+   lengths KEYLENS, in one go.  DESC is the prompt for a passphrase;
+   the agent tries that passphrase for all keys.  The result of key I
+   is stored at R_ERRS[I].  Returns GPG_ERR_ASS_UNKNOWN_CMD if the
+   agent can't do that; the caller may then use agent_import_key for
+   each key.  */
+gpg_error_t
+agent_import_keys (ctrl_t ctrl, const char *desc, char **cache_nonce_addr,
+                   unsigned char **keys, size_t *keylens,
+                   unsigned int nkeys, int unattended, gpg_error_t *r_errs)
+{
+  gpg_error_t err;
+  struct import_key_parm_s parm;
+  struct import_keys_parm_s ikparm;
+  struct cache_nonce_parm_s cn_parm;
+  char line[ASSUAN_LINELENGTH];
+  struct default_inq_parm_s dfltparm;
+  membuf_t data;
+  unsigned int i;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+
+  for (i=0; i < nkeys; i++)
+    r_errs[i] = gpg_error (GPG_ERR_INV_RESPONSE);
+  keyinfo_cache_flush ();
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  if (desc)
+    {
+      snprintf (line, DIM(line)-1, "SETKEYDESC %s", desc);
+      line[DIM(line)-1] = 0;
+      err = agent_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        return err;
+    }
+
+  /* The keys are sent as one canonical S-expression.  */
+  init_membuf (&data, 4096);
+  put_membuf_str (&data, "(12:wrapped-keys");
+  for (i=0; i < nkeys; i++)
+    {
+      snprintf (line, sizeof line, "%u:", (unsigned int)keylens[i]);
+      put_membuf_str (&data, line);
+      put_membuf (&data, keys[i], keylens[i]);
+    }
+  put_membuf_str (&data, ")");
+  parm.dflt = &dfltparm;
+  parm.key = get_membuf (&data, &parm.keylen);
+  if (!parm.key)
+    return gpg_error_from_syserror ();
+
+  snprintf (line, sizeof line, "IMPORT_KEY_BATCH%s%s%s",
+            unattended? " --unattended":"",
+            cache_nonce_addr && *cache_nonce_addr? " ":"",
+            cache_nonce_addr && *cache_nonce_addr? *cache_nonce_addr:"");
+  cn_parm.cache_nonce_addr = cache_nonce_addr;
+  cn_parm.passwd_nonce_addr = NULL;
+  cn_parm.vanity = NULL;
+  cn_parm.data = NULL;
+  ikparm.cn_parm = &cn_parm;
+  ikparm.nkeys = nkeys;
+  ikparm.r_errs = r_errs;
+  err = agent_transact (agent_ctx, line,
+                         NULL, NULL,
+                         inq_import_key_parms, &parm,
+                         import_keys_status_cb, &ikparm);
+  xfree ((void*)parm.key);
+  return err;
+}
+
+
 
 /* Receive a secret key from the agent.  HEXKEYGRIP is the hexified
    keygrip, DESC a prompt to be displayed with the agent's passphrase
@@ -2262,7 +3481,7 @@ agent_export_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
   if (desc)
     {
       snprintf (line, DIM(line)-1, "SETKEYDESC %s", desc);
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                              NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
@@ -2276,7 +3495,9 @@ agent_export_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
   init_membuf_secure (&data, 1024);
   cn_parm.cache_nonce_addr = cache_nonce_addr;
   cn_parm.passwd_nonce_addr = NULL;
-  err = assuan_transact (agent_ctx, line,
+  cn_parm.vanity = NULL;
+  cn_parm.data = NULL;
+  err = agent_transact (agent_ctx, line,
                          membuf_data_cb, &data,
                          default_inq_cb, &dfltparm,
                          cache_nonce_status_cb, &cn_parm);
@@ -2308,6 +3529,7 @@ agent_delete_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc)
   memset (&dfltparm, 0, sizeof dfltparm);
   dfltparm.ctrl = ctrl;
 
+  keyinfo_cache_flush ();
   err = start_agent (ctrl, 0);
   if (err)
     return err;
@@ -2318,14 +3540,14 @@ agent_delete_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc)
   if (desc)
     {
       snprintf (line, DIM(line)-1, "SETKEYDESC %s", desc);
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                              NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
     }
 
   snprintf (line, DIM(line)-1, "DELETE_KEY %s", hexkeygrip);
-  err = assuan_transact (agent_ctx, line, NULL, NULL,
+  err = agent_transact (agent_ctx, line, NULL, NULL,
                          default_inq_cb, &dfltparm,
                          NULL, NULL);
   return err;
@@ -2363,7 +3585,7 @@ agent_passwd (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
   if (desc)
     {
       snprintf (line, DIM(line)-1, "SETKEYDESC %s", desc);
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                              NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
@@ -2377,7 +3599,9 @@ agent_passwd (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
             hexkeygrip);
   cn_parm.cache_nonce_addr = cache_nonce_addr;
   cn_parm.passwd_nonce_addr = passwd_nonce_addr;
-  err = assuan_transact (agent_ctx, line, NULL, NULL,
+  cn_parm.vanity = NULL;
+  cn_parm.data = NULL;
+  err = agent_transact (agent_ctx, line, NULL, NULL,
                          default_inq_cb, &dfltparm,
                          cache_nonce_status_cb, &cn_parm);
   return err;
@@ -2395,7 +3619,7 @@ agent_get_version (ctrl_t ctrl, char **r_version)
     return err;
 
   init_membuf (&data, 64);
-  err = assuan_transact (agent_ctx, "GETINFO version",
+  err = agent_transact (agent_ctx, "GETINFO version",
                         membuf_data_cb, &data,
                         NULL, NULL, NULL, NULL);
   if (err)
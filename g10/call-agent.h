@@ -72,6 +72,47 @@ struct agent_card_genkey_s {
   gcry_mpi_t e;
 };
 
+/* Parameters and result of a vanity key search done by the agent.  */
+struct agent_vanity_parm_s
+{
+  const char *pattern;  /* The keyids searched for.  */
+  const char *window;   /* NULL or the creation times to try as comma
+                           separated START/END pairs of seconds since
+                           Epoch.  */
+  int backward;         /* Sweep the windows from their end.  */
+  int algo;             /* The OpenPGP algorithm of the key.  */
+  unsigned int hits;    /* The number of keys to collect or 0 for
+                           as many as BUDGET allows.  */
+  unsigned long budget; /* The seconds to search or 0 for no limit.  */
+  unsigned long long iterations;  /* The fingerprints to try or 0 for
+                                     no limit.  */
+  const char *seed_key; /* NULL or the job key of a distributed search
+                           as 64 hex digits.  */
+  unsigned int seed_first;  /* The key streams of this host.  */
+  unsigned int seed_count;
+  u32 timestamp;        /* Creation time of the key found or 0.  */
+  char fpr[20];         /* Its fingerprint.  */
+  const char *subkey_pattern;  /* NULL or the keyids of a subkey
+                                  searched at the same time.  */
+  const char *subkey_keyparms; /* The S-expression for that subkey.  */
+  int subkey_algo;             /* Its OpenPGP algorithm.  */
+  u32 subkey_timestamp;        /* Creation time of the subkey or 0.  */
+  char subkey_fpr[20];         /* Its fingerprint.  */
+  char subkey_grip[41];        /* Its keygrip as a hex string.  */
+  const char *subkey_kdf;      /* NULL or the list of ECDH KDF
+                                  parameters to try for the subkey.  */
+  int has_subkey_kdfparm;      /* The agent returned the KDF parameters
+                                  of the subkey in SUBKEY_KDFPARM.  */
+  unsigned char subkey_kdfparm[4];
+  /* If not NULL and the agent supports it, the public keys of all
+     keys collected are streamed and passed to this function with
+     their creation time, fingerprint and keygrip as they arrive.  The
+     function takes ownership of S_PUBKEY.  */
+  gpg_error_t (*result_cb) (void *opaque, u32 created, const char *fpr,
+                            const char *hexgrip, gcry_sexp_t s_pubkey);
+  void *result_cb_value;
+};
+
 
 /* Release the card info structure. */
 void agent_release_card_info (struct agent_card_info_s *info);
@@ -155,8 +196,20 @@ gpg_error_t agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
 gpg_error_t agent_genkey (ctrl_t ctrl, char **cache_nonce_addr,
                           const char *keyparms, int no_protection,
                           const char *passphrase,
+                          struct agent_vanity_parm_s *vanity,
                           gcry_sexp_t *r_pubkey);
 
+/* Queue a vanity search in the agent.  */
+gpg_error_t agent_vanity_submit (ctrl_t ctrl, const char *keyparms,
+                                 int no_protection, const char *passphrase,
+                                 struct agent_vanity_parm_s *vanity,
+                                 char *r_jobid);
+
+/* Wait for a queued vanity search and take its key.  */
+gpg_error_t agent_vanity_wait (ctrl_t ctrl, const char *jobid,
+                               struct agent_vanity_parm_s *vanity,
+                               char *r_hexgrip);
+
 /* Read a public key.  */
 gpg_error_t agent_readkey (ctrl_t ctrl, int fromcard, const char *hexkeygrip,
                            unsigned char **r_pubkey);
@@ -169,6 +222,14 @@ gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           int digestalgo,
                           gcry_sexp_t *r_sigval);
 
+/* Create signatures for many digests with one key.  */
+gpg_error_t agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                                const char *hexkeygrip, const char *desc,
+                                u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                                unsigned char **digests, size_t digestlen,
+                                int digestalgo, unsigned int ndigests,
+                                gcry_sexp_t *r_sigvals);
+
 /* Decrypt a ciphertext.  */
 gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
                              u32 *keyid, u32 *mainkeyid, int pubkey_algo,
@@ -176,6 +237,15 @@ gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
                              unsigned char **r_buf, size_t *r_buflen,
                              int *r_padding);
 
+/* Decrypt many ciphertexts to the same key.  */
+gpg_error_t agent_pkdecrypt_batch (ctrl_t ctrl, const char *keygrip,
+                                   const char *desc, u32 *keyid,
+                                   u32 *mainkeyid, int pubkey_algo,
+                                   gcry_sexp_t *s_ciphertexts,
+                                   unsigned int nciphertexts,
+                                   unsigned char **r_bufs, size_t *r_buflens,
+                                   gpg_error_t *r_errs);
+
 /* Retrieve a key encryption key.  */
 gpg_error_t agent_keywrap_key (ctrl_t ctrl, int forexport,
                                void **r_kek, size_t *r_keklen);
@@ -185,6 +255,13 @@ gpg_error_t agent_import_key (ctrl_t ctrl, const char *desc,
                               char **cache_nonce_addr,
                               const void *key, size_t keylen, int unattended);
 
+/* Send several keys to the agent in one go.  */
+gpg_error_t agent_import_keys (ctrl_t ctrl, const char *desc,
+                               char **cache_nonce_addr,
+                               unsigned char **keys, size_t *keylens,
+                               unsigned int nkeys, int unattended,
+                               gpg_error_t *r_errs);
+
 /* Receive a key from the agent.  */
 gpg_error_t agent_export_key (ctrl_t ctrl, const char *keygrip,
                               const char *desc, char **cache_nonce_addr,
@@ -200,5 +277,9 @@ gpg_error_t agent_passwd (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
 /* Get the version reported by gpg-agent.  */
 gpg_error_t agent_get_version (ctrl_t ctrl, char **r_version);
 
+/* Return the statistics of the requests sent to the agent.  */
+void agent_get_stats (unsigned long *r_count, double *r_seconds,
+                      double *r_max);
+
 
 #endif /*GNUPG_G10_CALL_AGENT_H*/
@@ -0,0 +1,368 @@
+/* cipher-pipe.c - Run the bulk cipher and the MDC hash on threads
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* With --cipher-pipeline the cipher filter and the decode filters
+   pass their data through a pipeline: the main thread does the I/O
+   and copies the data to a ring of buffers, the cipher and the MDC
+   hash run over the buffers in turn as two serial groups on the
+   shared pool of workers.  For encryption the plaintext is hashed
+   while it is encrypted to a second buffer; for decryption a buffer
+   is handed to the hash once it has been decrypted and is handed out
+   while it is still being hashed.  The stages work on different
+   buffers at the same time, and the main thread may read ahead or
+   write out while they are busy; when it waits it runs the next task
+   of the stage itself.  The buffers are allocated once and then reused.  If they
+   do not fit into the limit set with --max-buffer-memory the data is
+   processed without the pipeline.
+
+   The iobufs are not thread safe, so all reading and writing is done
+   by the main thread.  The cipher and hash handles must not be used
+   by the caller until the pipeline has been flushed or released.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpg.h"
+#include "util.h"
+#include "iobuf.h"
+#include "filter.h"
+#include "options.h"
+#include "main.h"
+#include "workpool.h"
+
+
+/* The size of one buffer of the ring.  */
+#define PIPE_BUFFER_SIZE (256*1024)
+
+/* The number of buffers in the ring.  */
+#define PIPE_BUFFERS 6
+
+/* The memory used by the ring.  For encryption each buffer has a
+   second one for the ciphertext.  */
+#define PIPE_MEMORY(decrypt) \
+  (((decrypt)? 1 : 2) * PIPE_BUFFERS * PIPE_BUFFER_SIZE)
+
+
+struct pipe_buffer
+{
+  cipher_pipe_t pipe;
+  byte *data;
+  byte *out;          /* The ciphertext for encryption.  */
+  size_t len;
+  int ciphered;       /* Set by the pool when the cipher is done.  */
+  int hashed;         /* Set by the pool when the hash is done.  */
+};
+
+struct cipher_pipe_s
+{
+  gcry_cipher_hd_t cipher_hd;
+  gcry_md_hd_t md;
+  int decrypt;
+  size_t memory;              /* The claimed buffer memory.  */
+  workpool_group_t cipher_group;  /* The stages, which run the buffers */
+  workpool_group_t hash_group;    /* in order.  */
+
+  struct pipe_buffer bufs[PIPE_BUFFERS];
+
+  /* The buffers are processed in order, thus counters describe their
+     state.  Buffer N is at index N % PIPE_BUFFERS.  */
+  unsigned long nqueued;      /* Buffers handed to the cipher.  */
+  unsigned long nhashq;       /* Decrypted buffers handed to the hash.  */
+  unsigned long ndone;        /* Buffers written or read by the caller.  */
+  unsigned long nfree;        /* Buffers which may be reused.  */
+  size_t offset;              /* Bytes of buffer NDONE already read.  */
+  int eof;                    /* The fill function returned 0.  */
+};
+
+
+
+/* Run the cipher over the buffer ARG.  Called by the pool without
+   the npth lock.  */
+static void
+cipher_task (void *arg)
+{
+  struct pipe_buffer *buf = arg;
+  cipher_pipe_t p = buf->pipe;
+
+  if (p->decrypt)
+    gcry_cipher_decrypt (p->cipher_hd, buf->data, buf->len, NULL, 0);
+  else
+    gcry_cipher_encrypt (p->cipher_hd, buf->out, buf->len,
+                         buf->data, buf->len);
+}
+
+
+/* Run the hash over the buffer ARG.  Called by the pool without the
+   npth lock.  */
+static void
+hash_task (void *arg)
+{
+  struct pipe_buffer *buf = arg;
+
+  gcry_md_write (buf->pipe->md, buf->data, buf->len);
+}
+
+
+/* Create a pipeline for CIPHER_HD and the optional MD.  With DECRYPT
+   set the data is decrypted and then hashed, else the plaintext is
+   hashed while it is encrypted.  Returns NULL if --cipher-pipeline
+   has not been given or no workers are available; the caller then
+   works as usual.  */
+cipher_pipe_t
+cipher_pipe_new (gcry_cipher_hd_t cipher_hd, gcry_md_hd_t md, int decrypt)
+{
+  cipher_pipe_t p;
+  workpool_t pool;
+  size_t n;
+  int i;
+
+  if (!opt.cipher_pipeline || !(pool = gpg_get_workers (md? 3 : 2)))
+    return NULL;
+  n = iobuf_claim_memory ("cipher pipeline", PIPE_MEMORY (decrypt), 0);
+  if (n < PIPE_MEMORY (decrypt))
+    {
+      iobuf_release_memory ("cipher pipeline", n);
+      if (opt.verbose)
+        log_info ("not using the cipher pipeline due to the memory limit\n");
+      return NULL;
+    }
+
+  p = xmalloc_clear (sizeof *p);
+  p->cipher_hd = cipher_hd;
+  p->md = md;
+  p->decrypt = decrypt;
+  p->memory = n;
+  if (workpool_serial_group_new (pool, &p->cipher_group)
+      || (md && workpool_serial_group_new (pool, &p->hash_group)))
+    {
+      log_error ("error initializing the cipher pipeline\n");
+      cipher_pipe_release (p);
+      return NULL;
+    }
+
+  for (i=0; i < PIPE_BUFFERS; i++)
+    {
+      p->bufs[i].pipe = p;
+      p->bufs[i].data = xmalloc (PIPE_BUFFER_SIZE);
+      if (!decrypt)
+        p->bufs[i].out = xmalloc (PIPE_BUFFER_SIZE);
+    }
+  return p;
+}
+
+
+/* Hand the decrypted buffers to the hash.  */
+static void
+queue_hashes (cipher_pipe_t p)
+{
+  struct pipe_buffer *buf;
+
+  if (!p->hash_group)
+    return;
+  for (; p->nhashq < p->nqueued; p->nhashq++)
+    {
+      buf = p->bufs + (p->nhashq % PIPE_BUFFERS);
+      if (!buf->ciphered)
+        break;
+      workpool_submit_task (p->hash_group, WORKPOOL_PRIO_NORMAL,
+                            hash_task, buf, &buf->hashed);
+    }
+}
+
+
+/* Release P.  Buffers still in the pipeline are processed first, so
+   that the handles are consistent afterwards.  */
+void
+cipher_pipe_release (cipher_pipe_t p)
+{
+  int i;
+
+  if (!p)
+    return;
+
+  workpool_group_release (p->cipher_group);
+  if (p->decrypt)
+    queue_hashes (p);
+  workpool_group_release (p->hash_group);
+
+  for (i=0; i < PIPE_BUFFERS; i++)
+    {
+      if (p->bufs[i].data)
+        wipememory (p->bufs[i].data, PIPE_BUFFER_SIZE);
+      xfree (p->bufs[i].data);
+      xfree (p->bufs[i].out);
+    }
+  iobuf_release_memory ("cipher pipeline", p->memory);
+  xfree (p);
+}
+
+
+/* Queue the buffer being filled.  */
+static void
+queue_buffer (cipher_pipe_t p)
+{
+  struct pipe_buffer *buf = p->bufs + (p->nqueued % PIPE_BUFFERS);
+
+  buf->hashed = !p->md;
+  workpool_submit_task (p->cipher_group, WORKPOOL_PRIO_NORMAL,
+                        cipher_task, buf, &buf->ciphered);
+  if (p->md && !p->decrypt)
+    workpool_submit_task (p->hash_group, WORKPOOL_PRIO_NORMAL,
+                          hash_task, buf, &buf->hashed);
+  p->nqueued++;
+}
+
+
+/* Write the oldest finished buffer to A.  If WAIT is set wait until
+   it is finished.  Returns -1 if there is no such buffer.  */
+static int
+write_buffer (cipher_pipe_t p, iobuf_t a, int wait)
+{
+  struct pipe_buffer *buf;
+  size_t len;
+
+  if (p->ndone == p->nqueued)
+    return -1;
+  buf = p->bufs + (p->ndone % PIPE_BUFFERS);
+  if (wait)
+    {
+      workpool_wait_task (p->cipher_group, &buf->ciphered);
+      if (!buf->hashed)
+        workpool_wait_task (p->hash_group, &buf->hashed);
+    }
+  if (!buf->ciphered || !buf->hashed)
+    return -1;
+
+  len = buf->len;
+  buf->len = 0;
+  p->ndone++;
+  return iobuf_write (a, buf->out, len);
+}
+
+
+/* Encrypt the SIZE bytes at DATA and write them to A.  */
+int
+cipher_pipe_write (cipher_pipe_t p, const byte *data, size_t size,
+                   iobuf_t a)
+{
+  struct pipe_buffer *buf;
+  size_t n;
+  int rc;
+
+  while (size)
+    {
+      while (p->nqueued - p->ndone >= PIPE_BUFFERS)
+        if ((rc = write_buffer (p, a, 1)) > 0)
+          return rc;
+
+      buf = p->bufs + (p->nqueued % PIPE_BUFFERS);
+      n = PIPE_BUFFER_SIZE - buf->len;
+      if (n > size)
+        n = size;
+      memcpy (buf->data + buf->len, data, n);
+      buf->len += n;
+      data += n;
+      size -= n;
+      if (buf->len == PIPE_BUFFER_SIZE)
+        queue_buffer (p);
+    }
+
+  while (!(rc = write_buffer (p, a, 0)))
+    ;
+  return rc > 0? rc : 0;
+}
+
+
+/* Encrypt the rest of the data and write everything to A.  */
+int
+cipher_pipe_flush (cipher_pipe_t p, iobuf_t a)
+{
+  struct pipe_buffer *buf;
+  int rc;
+
+  buf = p->bufs + (p->nqueued % PIPE_BUFFERS);
+  if (buf->len)
+    queue_buffer (p);
+  while (!(rc = write_buffer (p, a, 1)))
+    ;
+  return rc > 0? rc : 0;
+}
+
+
+/* Read up to SIZE bytes of decrypted data into DATA.  FILL is called
+   with FILL_ARG and A to read the input into free buffers; it returns
+   the number of bytes read or 0 on EOF.  Returns the number of bytes
+   stored at DATA or 0 on EOF.  */
+size_t
+cipher_pipe_read (cipher_pipe_t p, byte *data, size_t size,
+                  size_t (*fill) (void *arg, iobuf_t a,
+                                  byte *buf, size_t size),
+                  void *fill_arg, iobuf_t a)
+{
+  struct pipe_buffer *buf;
+  size_t n;
+
+  for (;;)
+    {
+      /* Read ahead into all free buffers.  A buffer is free once it
+         has been read by the caller and hashed.  */
+      while (!p->eof)
+        {
+          queue_hashes (p);
+          while (p->nfree < p->ndone
+                 && p->bufs[p->nfree % PIPE_BUFFERS].hashed)
+            p->nfree++;
+          if (p->nqueued - p->nfree >= PIPE_BUFFERS)
+            break;
+          buf = p->bufs + (p->nqueued % PIPE_BUFFERS);
+          buf->len = fill (fill_arg, a, buf->data, PIPE_BUFFER_SIZE);
+          if (!buf->len)
+            p->eof = 1;
+          else
+            queue_buffer (p);
+        }
+      if (p->ndone < p->nqueued)
+        break;
+      if (p->eof)
+        return 0;
+
+      /* All buffers have been read but are still being hashed.  */
+      workpool_wait_task (p->hash_group,
+                          &p->bufs[p->nfree % PIPE_BUFFERS].hashed);
+    }
+
+  buf = p->bufs + (p->ndone % PIPE_BUFFERS);
+  if (!buf->ciphered)
+    workpool_wait_task (p->cipher_group, &buf->ciphered);
+  queue_hashes (p);
+
+  n = buf->len - p->offset;
+  if (n > size)
+    n = size;
+  memcpy (data, buf->data + p->offset, n);
+  p->offset += n;
+  if (p->offset == buf->len)
+    {
+      p->offset = 0;
+      p->ndone++;
+    }
+  return n;
+}
@@ -126,13 +126,24 @@ cipher_filter( void *opaque, int control,
 	assert(a);
 	if( !cfx->header ) {
 	    write_header( cfx, a );
+	    cfx->pipe = cipher_pipe_new (cfx->cipher_hd, cfx->mdc_hash, 0);
+	}
+	if (cfx->pipe)
+	    rc = cipher_pipe_write (cfx->pipe, buf, size, a);
+	else {
+	    if (cfx->mdc_hash)
+		gcry_md_write (cfx->mdc_hash, buf, size);
+	    gcry_cipher_encrypt (cfx->cipher_hd, buf, size, NULL, 0);
+	    rc = iobuf_write( a, buf, size );
 	}
-	if (cfx->mdc_hash)
-	    gcry_md_write (cfx->mdc_hash, buf, size);
-	gcry_cipher_encrypt (cfx->cipher_hd, buf, size, NULL, 0);
-	rc = iobuf_write( a, buf, size );
     }
     else if( control == IOBUFCTRL_FREE ) {
+	if( cfx->pipe ) {
+	    if( cipher_pipe_flush (cfx->pipe, a) )
+		log_error("writing encrypted data failed\n" );
+	    cipher_pipe_release (cfx->pipe);
+	    cfx->pipe = NULL;
+	}
 	if( cfx->mdc_hash ) {
 	    byte *hash;
 	    int hashlen = gcry_md_get_algo_dlen (gcry_md_get_algo
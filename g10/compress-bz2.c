@@ -36,7 +36,7 @@
    #ifdefs and if(algo) -dshaw */
 
 static void
-init_compress( compress_filter_context_t *zfx, bz_stream *bzs )
+init_compress( compress_filter_context_t *zfx, bz_stream *bzs, IOBUF a )
 {
   int rc;
   int level;
@@ -54,7 +54,7 @@ init_compress( compress_filter_context_t *zfx, bz_stream *bzs )
   if((rc=BZ2_bzCompressInit(bzs,level,0,0))!=BZ_OK)
     log_fatal("bz2lib problem: %d\n",rc);
 
-  zfx->outbufsize = 8192;
+  zfx->outbufsize = compress_buffer_size (a, 0);
   zfx->outbuf = xmalloc( zfx->outbufsize );
 }
 
@@ -97,14 +97,14 @@ do_compress(compress_filter_context_t *zfx, bz_stream *bzs, int flush, IOBUF a)
 }
 
 static void
-init_uncompress( compress_filter_context_t *zfx, bz_stream *bzs )
+init_uncompress( compress_filter_context_t *zfx, bz_stream *bzs, IOBUF a )
 {
   int rc;
 
   if((rc=BZ2_bzDecompressInit(bzs,0,opt.bz2_decompress_lowmem))!=BZ_OK)
     log_fatal("bz2lib problem: %d\n",rc);
 
-  zfx->inbufsize = 2048;
+  zfx->inbufsize = compress_buffer_size (a, 1);
   zfx->inbuf = xmalloc( zfx->inbufsize );
   bzs->avail_in = 0;
 }
@@ -190,7 +190,7 @@ compress_filter_bz2( void *opaque, int control,
       if( !zfx->status )
 	{
 	  bzs = zfx->opaque = xmalloc_clear( sizeof *bzs );
-	  init_uncompress( zfx, bzs );
+	  init_uncompress( zfx, bzs, a );
 	  zfx->status = 1;
 	}
 
@@ -217,7 +217,7 @@ compress_filter_bz2( void *opaque, int control,
 	  if( build_packet( a, &pkt ))
 	    log_bug("build_packet(PKT_COMPRESSED) failed\n");
 	  bzs = zfx->opaque = xmalloc_clear( sizeof *bzs );
-	  init_compress( zfx, bzs );
+	  init_compress( zfx, bzs, a );
 	  zfx->status = 2;
 	}
 
@@ -232,7 +232,8 @@ compress_filter_bz2( void *opaque, int control,
 	  BZ2_bzDecompressEnd(bzs);
 	  xfree(bzs);
 	  zfx->opaque = NULL;
-	  xfree(zfx->outbuf); zfx->outbuf = NULL;
+	  xfree(zfx->inbuf); zfx->inbuf = NULL;
+	  iobuf_release_memory ("compress_filter", zfx->inbufsize);
 	}
       else if( zfx->status == 2 )
 	{
@@ -243,6 +244,7 @@ compress_filter_bz2( void *opaque, int control,
 	  xfree(bzs);
 	  zfx->opaque = NULL;
 	  xfree(zfx->outbuf); zfx->outbuf = NULL;
+	  iobuf_release_memory ("compress_filter", zfx->outbufsize);
 	}
       if (zfx->release)
 	zfx->release (zfx);
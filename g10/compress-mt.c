@@ -0,0 +1,439 @@
+/* compress-mt.c - Compress large plaintexts on a pool of threads
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* With --compress-threads the compress filter hands its input to the
+   functions here.  The input is cut into chunks which are deflated
+   independently by the workers, using the end of the preceding chunk
+   as the dictionary.  All but the last chunk are ended with a sync
+   flush, which aligns the output to a byte boundary without ending
+   the deflate stream.  Thus writing the results in order yields a
+   single raw deflate stream; for ZLIB the main thread adds the header
+   and the combined Adler-32 checksum.  The output is a standard
+   compressed packet which can be read by any OpenPGP implementation.
+
+   If the first chunks do not compress, the remaining chunks are
+   stored instead; this saves the time spent on encrypted or already
+   compressed data.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_ZIP
+# include <zlib.h>
+#endif
+
+#include "gpg.h"
+#include "util.h"
+#include "packet.h"
+#include "filter.h"
+#include "main.h"
+#include "options.h"
+#include "workpool.h"
+
+#ifdef HAVE_ZIP
+
+#ifdef __riscos__
+#define BYTEF_CAST(a) ((Bytef *)(a))
+#else
+#define BYTEF_CAST(a) (a)
+#endif
+
+/* The size of the chunks compressed by one worker.  */
+#define MT_CHUNK_SIZE (128*1024)
+
+/* The largest number of compression threads.  */
+#define MT_MAX_THREADS 64
+
+/* The number of chunks which are looked at to decide whether the
+   data compresses.  */
+#define MT_SAMPLE_CHUNKS 4
+
+/* The data is stored if compression saves less than 1/MT_MIN_SAVINGS
+   of the sampled chunks.  */
+#define MT_MIN_SAVINGS 50
+
+struct mt_chunk
+{
+  int done;           /* Set by the pool when it has been compressed.  */
+  int wbits;          /* The window bits for deflateInit2.  */
+  int level;          /* The compression level.  */
+  int last;           /* Finish the deflate stream with this chunk.  */
+  byte *in;           /* The input of MT_CHUNK_SIZE bytes, */
+  size_t inlen;       /* of which INLEN are used.  */
+  byte *dict;         /* The end of the preceding input.  */
+  size_t dictlen;
+  byte *out;          /* The output buffer.  */
+  size_t outsize;
+  size_t outlen;
+  uLong adler;        /* Adler-32 of the input.  */
+  int zrc;            /* The deflate result.  */
+  z_stream zs;        /* The stream of this slot, */
+  int zs_wbits;       /* set up for these window bits or 0, */
+  int zs_level;       /* and this level.  */
+};
+
+struct compress_mt_s
+{
+  int algo;
+  int wbits;
+  int level;
+  int store;                  /* Don't compress the following chunks.  */
+  unsigned long sample_in;
+  unsigned long sample_out;
+  uLong adler;                /* The Adler-32 of the written chunks.  */
+  workpool_group_t group;     /* The chunks handed to the workers.  */
+  unsigned int nslots;
+  struct mt_chunk *slots;
+  unsigned long nqueued;      /* Number of chunks handed to the pool;
+                                 this is also the chunk being filled.  */
+  unsigned long nwritten;     /* Number of chunks written.  */
+  byte *dict;                 /* The end of the last queued chunk.  */
+  size_t dictlen;
+};
+
+
+
+/* Return the number of threads to use for compression.  A value of 1
+   selects the single stream compressor.  */
+static int
+compress_threads (void)
+{
+  long n;
+
+  n = opt.compress_threads;
+  if (n < 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      n = sysconf (_SC_NPROCESSORS_ONLN);
+#else
+      n = 1;
+#endif
+    }
+  if (n < 1)
+    n = 1;
+  else if (n > MT_MAX_THREADS)
+    n = MT_MAX_THREADS;
+  return (int)n;
+}
+
+
+/* Return the space needed to deflate LEN bytes to one chunk.  This
+   is the bound used by zlib's deflateBound with room for the flush
+   marker.  */
+static size_t
+chunk_bound (size_t len)
+{
+  return len + ((len + 7) >> 3) + ((len + 63) >> 6) + 5 + 16;
+}
+
+
+/* Compress the chunk ARG with the stream of its slot, which is set
+   up on first use.  This is the task run by the workers and thus
+   called without the npth lock.  */
+static void
+deflate_task (void *arg)
+{
+  struct mt_chunk *chunk = arg;
+  z_stream *zs = &chunk->zs;
+  int zrc = Z_OK;
+
+  if (chunk->zs_wbits != chunk->wbits)
+    {
+      if (chunk->zs_wbits)
+        deflateEnd (zs);
+      memset (zs, 0, sizeof *zs);
+      chunk->zs_wbits = 0;
+      zrc = deflateInit2 (zs, chunk->level, Z_DEFLATED, chunk->wbits,
+                          8, Z_DEFAULT_STRATEGY);
+      if (zrc == Z_OK)
+        {
+          chunk->zs_wbits = chunk->wbits;
+          chunk->zs_level = chunk->level;
+        }
+    }
+  if (zrc == Z_OK)
+    zrc = deflateReset (zs);
+  if (zrc == Z_OK && chunk->zs_level != chunk->level)
+    {
+      zrc = deflateParams (zs, chunk->level, Z_DEFAULT_STRATEGY);
+      if (zrc == Z_OK)
+        chunk->zs_level = chunk->level;
+    }
+  if (zrc == Z_OK && chunk->dictlen)
+    zrc = deflateSetDictionary (zs, BYTEF_CAST (chunk->dict),
+                                chunk->dictlen);
+  if (zrc == Z_OK)
+    {
+      zs->next_in = BYTEF_CAST (chunk->in);
+      zs->avail_in = chunk->inlen;
+      zs->next_out = BYTEF_CAST (chunk->out);
+      zs->avail_out = chunk->outsize;
+      zrc = deflate (zs, chunk->last? Z_FINISH : Z_SYNC_FLUSH);
+      if (chunk->last)
+        zrc = zrc == Z_STREAM_END? Z_OK : Z_BUF_ERROR;
+      else if (zrc == Z_OK && (zs->avail_in || !zs->avail_out))
+        zrc = Z_BUF_ERROR;
+      chunk->outlen = chunk->outsize - zs->avail_out;
+    }
+  chunk->adler = adler32 (adler32 (0L, Z_NULL, 0),
+                          BYTEF_CAST (chunk->in), chunk->inlen);
+  chunk->zrc = zrc;
+}
+
+
+
+/* Create a parallel compressor for ALGO (ZIP or ZLIB) at LEVEL.
+   Returns NULL if --compress-threads has not been used or if no
+   workers could be started; the caller then uses a single deflate
+   stream.  */
+struct compress_mt_s *
+compress_mt_new (int algo, int level)
+{
+  struct compress_mt_s *mt;
+  workpool_t pool;
+  int nthreads;
+  unsigned int i;
+
+  nthreads = compress_threads ();
+  if (nthreads < 2 || !(pool = gpg_get_workers (nthreads)))
+    return NULL;
+
+  mt = xmalloc_clear (sizeof *mt);
+  if (workpool_group_new (pool, &mt->group))
+    {
+      xfree (mt);
+      return NULL;
+    }
+  mt->algo = algo;
+  /* See init_compress for the window size of ZIP.  */
+  mt->wbits = algo == COMPRESS_ALGO_ZIP? -13 : -15;
+  mt->level = level;
+  mt->adler = adler32 (0L, Z_NULL, 0);
+  mt->nslots = 2 * nthreads;
+  mt->slots = xcalloc (mt->nslots, sizeof *mt->slots);
+  for (i=0; i < mt->nslots; i++)
+    {
+      mt->slots[i].in = xmalloc (MT_CHUNK_SIZE);
+      mt->slots[i].dict = xmalloc (1 << -mt->wbits);
+      mt->slots[i].outsize = chunk_bound (MT_CHUNK_SIZE);
+      mt->slots[i].out = xmalloc (mt->slots[i].outsize);
+    }
+  mt->dict = xmalloc (1 << -mt->wbits);
+
+  if (DBG_MEMSTAT)
+    log_debug ("compressing on %u worker threads\n",
+               workpool_threads (pool));
+  return mt;
+}
+
+
+void
+compress_mt_release (struct compress_mt_s *mt)
+{
+  unsigned int i;
+
+  if (!mt)
+    return;
+
+  /* Wait for chunks still being compressed after a write error.  */
+  workpool_group_release (mt->group);
+
+  for (i=0; i < mt->nslots; i++)
+    {
+      if (mt->slots[i].zs_wbits)
+        deflateEnd (&mt->slots[i].zs);
+      xfree (mt->slots[i].in);
+      xfree (mt->slots[i].dict);
+      xfree (mt->slots[i].out);
+    }
+  xfree (mt->slots);
+  xfree (mt->dict);
+  xfree (mt);
+}
+
+
+/* Write the oldest queued chunk to A.  If WAIT is not set, only do
+   this if it is ready.  Returns -1 if there is nothing to write.  */
+static int
+write_chunk (struct compress_mt_s *mt, IOBUF a, int wait)
+{
+  struct mt_chunk *chunk;
+  byte header[2];
+  unsigned int head;
+  int level;
+  int rc;
+
+  if (mt->nwritten == mt->nqueued)
+    return -1;
+  chunk = mt->slots + (mt->nwritten % mt->nslots);
+
+  if (wait && !chunk->done)
+    workpool_wait_task (mt->group, &chunk->done);
+  if (!chunk->done)
+    return -1;
+
+  if (chunk->zrc != Z_OK)
+    log_fatal ("zlib deflate problem: rc=%d\n", chunk->zrc);
+
+  if (!mt->nwritten && mt->algo == COMPRESS_ALGO_ZLIB)
+    {
+      /* The header of RFC-1950 for a 32 KiB window.  The level
+         flags are computed as done by zlib.  */
+      level = mt->level == Z_DEFAULT_COMPRESSION? 6 : mt->level;
+      head = 0x78 << 8;
+      if (level < 2)
+        head |= 0 << 6;
+      else if (level < 6)
+        head |= 1 << 6;
+      else if (level == 6)
+        head |= 2 << 6;
+      else
+        head |= 3 << 6;
+      head += 31 - (head % 31);
+      header[0] = head >> 8;
+      header[1] = head;
+      if ((rc = iobuf_write (a, header, 2)))
+        return rc;
+    }
+
+  if (mt->nwritten < MT_SAMPLE_CHUNKS)
+    {
+      mt->sample_in += chunk->inlen;
+      mt->sample_out += chunk->outlen;
+      if (mt->nwritten + 1 == MT_SAMPLE_CHUNKS && mt->level
+          && (mt->sample_out + mt->sample_in / MT_MIN_SAVINGS
+              > mt->sample_in))
+        {
+          if (DBG_FILTER)
+            log_debug ("compress-mt: data does not compress;"
+                       " storing the rest\n");
+          mt->store = 1;
+        }
+    }
+
+  mt->adler = adler32_combine (mt->adler, chunk->adler, chunk->inlen);
+  rc = iobuf_write (a, chunk->out, chunk->outlen);
+  chunk->done = 0;
+  chunk->inlen = 0;
+  mt->nwritten++;
+  return rc;
+}
+
+
+/* Hand the chunk being filled to the workers and make sure that the
+   next slot is free.  */
+static int
+queue_chunk (struct compress_mt_s *mt, IOBUF a, int last)
+{
+  struct mt_chunk *chunk = mt->slots + (mt->nqueued % mt->nslots);
+  size_t window = 1 << -mt->wbits;
+  size_t n;
+  int rc;
+
+  chunk->wbits = mt->wbits;
+  chunk->level = mt->store? 0 : mt->level;
+  chunk->last = last;
+  memcpy (chunk->dict, mt->dict, mt->dictlen);
+  chunk->dictlen = mt->dictlen;
+
+  /* Keep the end of the data as dictionary for the next chunk.  */
+  if (chunk->inlen >= window)
+    {
+      memcpy (mt->dict, chunk->in + chunk->inlen - window, window);
+      mt->dictlen = window;
+    }
+  else
+    {
+      n = mt->dictlen + chunk->inlen > window
+          ? mt->dictlen + chunk->inlen - window : 0;
+      memmove (mt->dict, mt->dict + n, mt->dictlen - n);
+      memcpy (mt->dict + mt->dictlen - n, chunk->in, chunk->inlen);
+      mt->dictlen += chunk->inlen - n;
+    }
+
+  mt->nqueued++;
+  workpool_submit_task (mt->group, WORKPOOL_PRIO_NORMAL,
+                        deflate_task, chunk, &chunk->done);
+
+  while (mt->nqueued - mt->nwritten >= mt->nslots)
+    if ((rc = write_chunk (mt, a, 1)) > 0)
+      return rc;
+  return 0;
+}
+
+
+/* Compress the SIZE bytes at BUF and write the output to A.  */
+int
+compress_mt_write (struct compress_mt_s *mt, const byte *buf, size_t size,
+                   IOBUF a)
+{
+  struct mt_chunk *chunk;
+  size_t n;
+  int rc;
+
+  while (size)
+    {
+      chunk = mt->slots + (mt->nqueued % mt->nslots);
+      n = MT_CHUNK_SIZE - chunk->inlen;
+      if (n > size)
+        n = size;
+      memcpy (chunk->in + chunk->inlen, buf, n);
+      chunk->inlen += n;
+      buf += n;
+      size -= n;
+      if (chunk->inlen == MT_CHUNK_SIZE && (rc = queue_chunk (mt, a, 0)))
+        return rc;
+    }
+
+  /* Write what is ready without waiting.  */
+  while (!(rc = write_chunk (mt, a, 0)))
+    ;
+  return rc > 0? rc : 0;
+}
+
+
+/* Compress the remaining data, end the stream and write everything
+   to A.  */
+int
+compress_mt_finish (struct compress_mt_s *mt, IOBUF a)
+{
+  byte trailer[4];
+  int rc;
+
+  if ((rc = queue_chunk (mt, a, 1)))
+    return rc;
+  while (!(rc = write_chunk (mt, a, 1)))
+    ;
+  if (rc > 0)
+    return rc;
+
+  if (mt->algo == COMPRESS_ALGO_ZLIB)
+    {
+      trailer[0] = mt->adler >> 24;
+      trailer[1] = mt->adler >> 16;
+      trailer[2] = mt->adler >> 8;
+      trailer[3] = mt->adler;
+      return iobuf_write (a, trailer, 4);
+    }
+  return 0;
+}
+
+#endif /*HAVE_ZIP*/
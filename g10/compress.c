@@ -57,9 +57,45 @@
 int compress_filter_bz2( void *opaque, int control,
 			 IOBUF a, byte *buf, size_t *ret_len);
 
+/* Return the size of the output buffer (or with FOR_INPUT set of the
+   input buffer) of a compress filter working on the chain A.  The
+   sizes follow the iobuf's buffer size so that large buffers result
+   in fewer calls to the compression library and to the chain.  The
+   buffer is counted with iobuf_claim_memory and may thus be smaller
+   under a memory limit; the caller releases it with
+   iobuf_release_memory.  */
+size_t
+compress_buffer_size (iobuf_t a, int for_input)
+{
+  size_t size = iobuf_get_buffer_size (a);
+
+  if (size < 8192)
+    size = 8192;
+  else if (size > 1024*1024)
+    size = 1024*1024;
+  if (for_input)
+    return iobuf_claim_memory ("compress_filter", size / 4, 8192 / 4);
+  return iobuf_claim_memory ("compress_filter", size, 8192);
+}
+
+
 #ifdef HAVE_ZIP
+/* Return the zlib compression level to use.  */
+static int
+zlib_compress_level (void)
+{
+    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
+	return opt.compress_level;
+    else if( opt.compress_level == -1 )
+	return Z_DEFAULT_COMPRESSION;
+    else {
+	log_error("invalid compression level; using default level\n");
+	return Z_DEFAULT_COMPRESSION;
+    }
+}
+
 static void
-init_compress( compress_filter_context_t *zfx, z_stream *zs )
+init_compress( compress_filter_context_t *zfx, z_stream *zs, IOBUF a )
 {
     int rc;
     int level;
@@ -71,14 +107,7 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
         zlib_initialized = riscos_load_module("ZLib", zlib_path, 1);
 #endif
 
-    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
-	level = opt.compress_level;
-    else if( opt.compress_level == -1 )
-	level = Z_DEFAULT_COMPRESSION;
-    else {
-	log_error("invalid compression level; using default level\n");
-	level = Z_DEFAULT_COMPRESSION;
-    }
+    level = zlib_compress_level ();
 
     if( (rc = zfx->algo == 1? deflateInit2( zs, level, Z_DEFLATED,
 					    -13, 8, Z_DEFAULT_STRATEGY)
@@ -90,7 +119,7 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
 						       "unknown error" );
     }
 
-    zfx->outbufsize = 8192;
+    zfx->outbufsize = compress_buffer_size (a, 0);
     zfx->outbuf = xmalloc( zfx->outbufsize );
 }
 
@@ -132,7 +161,7 @@ do_compress( compress_filter_context_t *zfx, z_stream *zs, int flush, IOBUF a )
 }
 
 static void
-init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
+init_uncompress( compress_filter_context_t *zfx, z_stream *zs, IOBUF a )
 {
     int rc;
 
@@ -154,7 +183,7 @@ init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 						       "unknown error" );
     }
 
-    zfx->inbufsize = 2048;
+    zfx->inbufsize = compress_buffer_size (a, 1);
     zfx->inbuf = xmalloc( zfx->inbufsize );
     zs->avail_in = 0;
 }
@@ -232,7 +261,7 @@ compress_filter( void *opaque, int control,
     if( control == IOBUFCTRL_UNDERFLOW ) {
 	if( !zfx->status ) {
 	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_uncompress( zfx, zs );
+	    init_uncompress( zfx, zs, a );
 	    zfx->status = 1;
 	}
 
@@ -259,21 +288,34 @@ compress_filter( void *opaque, int control,
 	    pkt.pkt.compressed = &cd;
 	    if( build_packet( a, &pkt ))
 		log_bug("build_packet(PKT_COMPRESSED) failed\n");
-	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_compress( zfx, zs );
+	    zfx->mt = compress_mt_new (zfx->algo, zlib_compress_level ());
+	    if( !zfx->mt ) {
+		zs = zfx->opaque = xmalloc_clear( sizeof *zs );
+		init_compress( zfx, zs, a );
+	    }
 	    zfx->status = 2;
 	}
 
-	zs->next_in = BYTEF_CAST (buf);
-	zs->avail_in = size;
-	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	if( zfx->mt )
+	    rc = compress_mt_write (zfx->mt, buf, size, a);
+	else {
+	    zs->next_in = BYTEF_CAST (buf);
+	    zs->avail_in = size;
+	    rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	}
     }
     else if( control == IOBUFCTRL_FREE ) {
 	if( zfx->status == 1 ) {
 	    inflateEnd(zs);
 	    xfree(zs);
 	    zfx->opaque = NULL;
-	    xfree(zfx->outbuf); zfx->outbuf = NULL;
+	    xfree(zfx->inbuf); zfx->inbuf = NULL;
+	    iobuf_release_memory ("compress_filter", zfx->inbufsize);
+	}
+	else if( zfx->status == 2 && zfx->mt ) {
+	    compress_mt_finish (zfx->mt, a);
+	    compress_mt_release (zfx->mt);
+	    zfx->mt = NULL;
 	}
 	else if( zfx->status == 2 ) {
 	    zs->next_in = BYTEF_CAST (buf);
@@ -283,6 +325,7 @@ compress_filter( void *opaque, int control,
 	    xfree(zs);
 	    zfx->opaque = NULL;
 	    xfree(zfx->outbuf); zfx->outbuf = NULL;
+	    iobuf_release_memory ("compress_filter", zfx->outbufsize);
 	}
         if (zfx->release)
           zfx->release (zfx);
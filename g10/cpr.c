@@ -43,6 +43,9 @@
    this is NULL.  */
 static estream_t statusfp;
 
+/* The file descriptor of STATUSFP or -1.  */
+static int status_last_fd = -1;
+
 
 static void
 progress_cb (void *ctx, const char *what, int printchar,
@@ -96,14 +99,13 @@ status_currently_allowed (int no)
 void
 set_status_fd (int fd)
 {
-  static int last_fd = -1;
-
-  if (fd != -1 && last_fd == fd)
+  if (fd != -1 && status_last_fd == fd)
     return;
 
   if (statusfp && statusfp != es_stdout && statusfp != es_stderr )
     es_fclose (statusfp);
   statusfp = NULL;
+  status_last_fd = -1;
   if (fd == -1)
     return;
 
@@ -118,12 +120,26 @@ set_status_fd (int fd)
       log_fatal ("can't open fd %d for status output: %s\n",
                  fd, strerror (errno));
     }
-  last_fd = fd;
+  status_last_fd = fd;
 
   gcry_set_progress_handler (progress_cb, NULL);
 }
 
 
+/* Write the status output to FP instead of a file descriptor.  This
+   is used by the server to pass the status lines to its client.  FP
+   is closed by the next call of this function or set_status_fd; NULL
+   disables the status output.  */
+void
+set_status_stream (estream_t fp)
+{
+  set_status_fd (-1);
+  statusfp = fp;
+  if (fp)
+    gcry_set_progress_handler (progress_cb, NULL);
+}
+
+
 int
 is_status_enabled ()
 {
@@ -0,0 +1,100 @@
+/* crc24.c - The CRC used by the OpenPGP armor
+ * Copyright (C) 1998, 1999, 2000, 2001, 2002, 2003, 2004, 2005, 2006,
+ *               2007 Free Software Foundation, Inc.
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This is the CRC-24 of RFC-4880, section 6.1.  It has been taken
+   out of armor.c so that it can be tested on its own.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../common/types.h"
+#include "crc24.h"
+
+#define CRCPOLY 0X864CFB
+
+/* Tables to process 8 bytes at once; the CRC is kept in the high 24
+   bits of a word so that the tables are those of a 32 bit CRC.  */
+static u32 crc_slice[8][256];
+static int initialized;
+
+
+/* Build the lookup tables.  This needs to be called before the first
+   use of crc24_update.  */
+void
+crc24_init (void)
+{
+  u32 crc_table[256];
+  u32 t;
+  int i, j;
+
+  if (initialized)
+    return;
+
+  crc_table[0] = 0;
+  for (i=j=0; j < 128; j++)
+    {
+      t = crc_table[j];
+      if (t & 0x00800000)
+        {
+          t <<= 1;
+          crc_table[i++] = t ^ CRCPOLY;
+          crc_table[i++] = t;
+        }
+      else
+        {
+          t <<= 1;
+          crc_table[i++] = t;
+          crc_table[i++] = t ^ CRCPOLY;
+        }
+    }
+  for (i=0; i < 256; i++)
+    crc_slice[0][i] = crc_table[i] << 8;
+  for (j=1; j < 8; j++)
+    for (i=0; i < 256; i++)
+      {
+        t = crc_slice[j-1][i];
+        crc_slice[j][i] = (t << 8) ^ crc_slice[0][t >> 24];
+      }
+
+  initialized = 1;
+}
+
+
+/* Update the 24 bit CRC with the LEN bytes at BUF.  */
+u32
+crc24_update (u32 crc, const byte *buf, size_t len)
+{
+  u32 c = crc << 8;
+
+  for (; len >= 8; buf += 8, len -= 8)
+    {
+      c ^= ((u32)buf[0] << 24) | ((u32)buf[1] << 16)
+           | ((u32)buf[2] << 8) | buf[3];
+      c = (crc_slice[7][c >> 24] ^ crc_slice[6][(c >> 16) & 0xff]
+           ^ crc_slice[5][(c >> 8) & 0xff] ^ crc_slice[4][c & 0xff]
+           ^ crc_slice[3][buf[4]] ^ crc_slice[2][buf[5]]
+           ^ crc_slice[1][buf[6]] ^ crc_slice[0][buf[7]]);
+    }
+  for (; len; buf++, len--)
+    c = (c << 8) ^ crc_slice[0][(c >> 24) ^ *buf];
+  return (c >> 8) & 0x00ffffff;
+}
@@ -0,0 +1,27 @@
+/* crc24.h - The CRC used by the OpenPGP armor
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef G10_CRC24_H
+#define G10_CRC24_H
+
+#define CRC24_INIT 0xB704CE
+
+void crc24_init (void);
+u32 crc24_update (u32 crc, const byte *buf, size_t len);
+
+#endif /*G10_CRC24_H*/
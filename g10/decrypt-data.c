@@ -30,6 +30,7 @@
 #include "options.h"
 #include "i18n.h"
 #include "status.h"
+#include "filter.h"
 
 
 static int mdc_decode_filter ( void *opaque, int control, IOBUF a,
@@ -41,6 +42,7 @@ typedef struct decode_filter_context_s
 {
   gcry_cipher_hd_t cipher_hd;
   gcry_md_hd_t mdc_hash;
+  cipher_pipe_t pipe;  /* The cipher pipeline or NULL.  */
   char defer[22];
   int  defer_filled;
   int  eof_seen;
@@ -60,6 +62,8 @@ release_dfx_context (decode_filter_ctx_t dfx)
   assert (dfx->refcount);
   if ( !--dfx->refcount )
     {
+      cipher_pipe_release (dfx->pipe);
+      dfx->pipe = NULL;
       gcry_cipher_close (dfx->cipher_hd);
       dfx->cipher_hd = NULL;
       gcry_md_close (dfx->mdc_hash);
@@ -216,6 +220,7 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
   dfx->refcount++;
   dfx->partial = ed->is_partial;
   dfx->length = ed->len;
+  dfx->pipe = cipher_pipe_new (dfx->cipher_hd, dfx->mdc_hash, 1);
   if ( ed->mdc_method )
     iobuf_push_filter ( ed->buf, mdc_decode_filter, dfx );
   else
@@ -242,6 +247,10 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
          bytes are appended.  */
       int datalen = gcry_md_get_algo_dlen (ed->mdc_method);
 
+      /* Let the pipeline finish with the handles.  */
+      cipher_pipe_release (dfx->pipe);
+      dfx->pipe = NULL;
+
       assert (dfx->cipher_hd);
       assert (dfx->mdc_hash);
       gcry_cipher_decrypt (dfx->cipher_hd, dfx->defer, 22, NULL, 0);
@@ -265,13 +274,16 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
 
 
 
-static int
-mdc_decode_filter (void *opaque, int control, IOBUF a,
-                   byte *buf, size_t *ret_len)
+/* Read the next ciphertext of the MDC protected packet into BUF which
+   has a size of SIZE bytes.  The last 22 bytes of the packet are kept
+   back in the defer buffer.  Returns the number of bytes stored at
+   BUF; 0 means EOF.  */
+static size_t
+mdc_fill (void *opaque, IOBUF a, byte *buf, size_t size)
 {
   decode_filter_ctx_t dfx = opaque;
-  size_t n, size = *ret_len;
-  int rc = 0;
+  size_t n, count;
+  int nread;
   int c;
 
   /* Note: We need to distinguish between a partial and a fixed length
@@ -282,98 +294,115 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
      packet is not followed by other data.  This used to be a long
      standing bug which was fixed on 2009-10-02.  */
 
-  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
+  if (dfx->eof_seen)
+    return 0;
+
+  assert (a);
+  assert (size > 44); /* Our code requires at least this size.  */
+
+  /* Get at least 22 bytes and put it ahead in the buffer.  */
+  if (dfx->partial)
     {
-      *ret_len = 0;
-      rc = -1;
+      for (n=22; n < 44; n++)
+        {
+          if ( (c = iobuf_get(a)) == -1 )
+            break;
+          buf[n] = c;
+        }
     }
-  else if( control == IOBUFCTRL_UNDERFLOW )
+  else
     {
-      assert (a);
-      assert (size > 44); /* Our code requires at least this size.  */
-
-      /* Get at least 22 bytes and put it ahead in the buffer.  */
-      if (dfx->partial)
+      for (n=22; n < 44 && dfx->length; n++, dfx->length--)
         {
-          for (n=22; n < 44; n++)
-            {
-              if ( (c = iobuf_get(a)) == -1 )
-                break;
-              buf[n] = c;
-            }
+          c = iobuf_get (a);
+          if (c == -1)
+            break; /* Premature EOF.  */
+          buf[n] = c;
         }
-      else
+    }
+  if (n == 44)
+    {
+      /* We have enough stuff - flush the deferred stuff.  */
+      if ( !dfx->defer_filled )  /* First time. */
         {
-          for (n=22; n < 44 && dfx->length; n++, dfx->length--)
-            {
-              c = iobuf_get (a);
-              if (c == -1)
-                break; /* Premature EOF.  */
-              buf[n] = c;
-            }
+          memcpy (buf, buf+22, 22);
+          n = 22;
         }
-      if (n == 44)
+      else
         {
-          /* We have enough stuff - flush the deferred stuff.  */
-          if ( !dfx->defer_filled )  /* First time. */
-            {
-              memcpy (buf, buf+22, 22);
-              n = 22;
-	    }
-          else
-            {
-              memcpy (buf, dfx->defer, 22);
-	    }
-          /* Fill up the buffer. */
-          if (dfx->partial)
-            {
-              for (; n < size; n++ )
-                {
-                  if ( (c = iobuf_get(a)) == -1 )
-                    {
-                      dfx->eof_seen = 1; /* Normal EOF. */
-                      break;
-                    }
-                  buf[n] = c;
-                }
-            }
-          else
-            {
-              for (; n < size && dfx->length; n++, dfx->length--)
-                {
-                  c = iobuf_get(a);
-                  if (c == -1)
-                    {
-                      dfx->eof_seen = 3; /* Premature EOF. */
-                      break;
-                    }
-                  buf[n] = c;
-                }
-              if (!dfx->length)
-                dfx->eof_seen = 1; /* Normal EOF.  */
-            }
-
-          /* Move the trailing 22 bytes back to the defer buffer.  We
-             have at least 44 bytes thus a memmove is not needed.  */
-          n -= 22;
-          memcpy (dfx->defer, buf+n, 22 );
-          dfx->defer_filled = 1;
-	}
-      else if ( !dfx->defer_filled )  /* EOF seen but empty defer buffer. */
+          memcpy (buf, dfx->defer, 22);
+        }
+      /* Fill up the buffer. */
+      if (dfx->partial)
         {
-          /* This is bad because it means an incomplete hash. */
-          n -= 22;
-          memcpy (buf, buf+22, n );
-          dfx->eof_seen = 2; /* EOF with incomplete hash.  */
-	}
-      else  /* EOF seen (i.e. read less than 22 bytes). */
+          nread = iobuf_read (a, buf + n, size - n);
+          if (nread == -1)
+            nread = 0;
+          n += nread;
+          if (n < size)
+            dfx->eof_seen = 1; /* Normal EOF. */
+        }
+      else
         {
-          memcpy (buf, dfx->defer, 22 );
-          n -= 22;
-          memcpy (dfx->defer, buf+n, 22 );
-          dfx->eof_seen = 1; /* Normal EOF. */
-	}
+          count = size - n;
+          if (count > dfx->length)
+            count = dfx->length;
+          nread = count? iobuf_read (a, buf + n, count) : 0;
+          if (nread == -1)
+            nread = 0;
+          n += nread;
+          dfx->length -= nread;
+          if (nread < count)
+            dfx->eof_seen = 3; /* Premature EOF. */
+          else if (!dfx->length)
+            dfx->eof_seen = 1; /* Normal EOF.  */
+        }
+
+      /* Move the trailing 22 bytes back to the defer buffer.  We
+         have at least 44 bytes thus a memmove is not needed.  */
+      n -= 22;
+      memcpy (dfx->defer, buf+n, 22 );
+      dfx->defer_filled = 1;
+    }
+  else if ( !dfx->defer_filled )  /* EOF seen but empty defer buffer. */
+    {
+      /* This is bad because it means an incomplete hash. */
+      n -= 22;
+      memcpy (buf, buf+22, n );
+      dfx->eof_seen = 2; /* EOF with incomplete hash.  */
+    }
+  else  /* EOF seen (i.e. read less than 22 bytes). */
+    {
+      memcpy (buf, dfx->defer, 22 );
+      n -= 22;
+      memcpy (dfx->defer, buf+n, 22 );
+      dfx->eof_seen = 1; /* Normal EOF. */
+    }
+
+  if (!n)
+    assert ( dfx->eof_seen );
+  return n;
+}
+
+
+static int
+mdc_decode_filter (void *opaque, int control, IOBUF a,
+                   byte *buf, size_t *ret_len)
+{
+  decode_filter_ctx_t dfx = opaque;
+  size_t n, size = *ret_len;
+  int rc = 0;
 
+  if ( control == IOBUFCTRL_UNDERFLOW && dfx->pipe )
+    {
+      n = cipher_pipe_read (dfx->pipe, buf, size, mdc_fill, dfx, a);
+      if (!n)
+        rc = -1; /* Return EOF.  */
+      *ret_len = n;
+    }
+  else if ( control == IOBUFCTRL_UNDERFLOW )
+    {
+      n = mdc_fill (dfx, a, buf, size);
       if ( n )
         {
           if ( dfx->cipher_hd )
@@ -382,10 +411,7 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
             gcry_md_write (dfx->mdc_hash, buf, n);
 	}
       else
-        {
-          assert ( dfx->eof_seen );
-          rc = -1; /* Return EOF.  */
-	}
+        rc = -1; /* Return EOF.  */
       *ret_len = n;
     }
   else if ( control == IOBUFCTRL_FREE )
@@ -400,63 +426,76 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
 }
 
 
+/* Read the next ciphertext of the packet into BUF which has a size of
+   SIZE bytes.  Returns the number of bytes stored at BUF; 0 means
+   EOF.  */
+static size_t
+decode_fill (void *opaque, IOBUF a, byte *buf, size_t size)
+{
+  decode_filter_ctx_t fc = opaque;
+  size_t n, count;
+  int nread;
+
+  if (fc->eof_seen)
+    return 0;
+
+  assert(a);
+
+  if (fc->partial)
+    {
+      nread = iobuf_read (a, buf, size);
+      if (nread == -1)
+        nread = 0;
+      n = nread;
+      if (n < size)
+        fc->eof_seen = 1; /* Normal EOF. */
+    }
+  else
+    {
+      count = size;
+      if (count > fc->length)
+        count = fc->length;
+      nread = count? iobuf_read (a, buf, count) : 0;
+      if (nread == -1)
+        nread = 0;
+      n = nread;
+      fc->length -= nread;
+      if (nread < count)
+        fc->eof_seen = 3; /* Premature EOF. */
+      else if (!fc->length)
+        fc->eof_seen = 1; /* Normal EOF.  */
+    }
+  if (!n && !fc->eof_seen)
+    fc->eof_seen = 1;
+  return n;
+}
+
+
 static int
 decode_filter( void *opaque, int control, IOBUF a, byte *buf, size_t *ret_len)
 {
   decode_filter_ctx_t fc = opaque;
   size_t size = *ret_len;
   size_t n;
-  int c, rc = 0;
-
+  int rc = 0;
 
-  if ( control == IOBUFCTRL_UNDERFLOW && fc->eof_seen )
+  if ( control == IOBUFCTRL_UNDERFLOW && fc->pipe )
     {
-      *ret_len = 0;
-      rc = -1;
+      n = cipher_pipe_read (fc->pipe, buf, size, decode_fill, fc, a);
+      if (!n)
+        rc = -1; /* Return EOF. */
+      *ret_len = n;
     }
   else if ( control == IOBUFCTRL_UNDERFLOW )
     {
-      assert(a);
-
-      if (fc->partial)
-        {
-          for (n=0; n < size; n++ )
-            {
-              c = iobuf_get(a);
-              if (c == -1)
-                {
-                  fc->eof_seen = 1; /* Normal EOF. */
-                  break;
-                }
-              buf[n] = c;
-            }
-        }
-      else
-        {
-          for (n=0; n < size && fc->length; n++, fc->length--)
-            {
-              c = iobuf_get(a);
-              if (c == -1)
-                {
-                  fc->eof_seen = 3; /* Premature EOF. */
-                  break;
-                }
-              buf[n] = c;
-            }
-          if (!fc->length)
-            fc->eof_seen = 1; /* Normal EOF.  */
-        }
+      n = decode_fill (fc, a, buf, size);
       if (n)
         {
           if (fc->cipher_hd)
             gcry_cipher_decrypt (fc->cipher_hd, buf, n, NULL, 0);
         }
       else
-        {
-          if (!fc->eof_seen)
-            fc->eof_seen = 1;
-          rc = -1; /* Return EOF. */
-        }
+        rc = -1; /* Return EOF. */
       *ret_len = n;
     }
   else if ( control == IOBUFCTRL_FREE )
@@ -177,6 +177,102 @@ decrypt_message_fd (ctrl_t ctrl, int input_fd, int output_fd)
 }
 
 
+/* The most files of --decrypt-files whose session keys are asked
+   for in one go.  */
+#define MAX_PREFETCH_FILES 128
+
+/* The most public key encrypted packets read from one file for
+   that.  */
+#define MAX_PREFETCH_PER_FILE 8
+
+
+/* Read the public key encrypted session key packets at the start of
+   the file FILENAME and append them to the NENCS packets at ENCS,
+   which has room for MAXENCS packets.  Errors are ignored; the file
+   is read again for its decryption anyway.  */
+static void
+read_pubkey_enc (const char *filename, PKT_pubkey_enc **encs,
+                 unsigned int *nencs, unsigned int maxencs)
+{
+  IOBUF fp;
+  armor_filter_context_t *afx = NULL;
+  PACKET *pkt;
+  unsigned int n = 0;
+
+  if (iobuf_is_pipe_filename (filename))
+    return;
+  fp = iobuf_open (filename);
+  if (!fp)
+    return;
+  iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+  if (is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      return;
+    }
+  if (!opt.no_armor && use_armor_filter (fp))
+    {
+      afx = new_armor_context ();
+      push_armor_filter (afx, fp);
+    }
+
+  pkt = xmalloc (sizeof *pkt);
+  init_packet (pkt);
+  while (*nencs < maxencs && n < MAX_PREFETCH_PER_FILE
+         && !parse_packet (fp, pkt))
+    {
+      if (pkt->pkttype == PKT_PUBKEY_ENC)
+        {
+          encs[(*nencs)++] = pkt->pkt.pubkey_enc;
+          n++;
+          init_packet (pkt);
+        }
+      else if (pkt->pkttype == PKT_MARKER)
+        free_packet (pkt);
+      else
+        break;
+    }
+  free_packet (pkt);
+  xfree (pkt);
+  iobuf_close (fp);
+  release_armor_context (afx);
+}
+
+
+/* Return the next file name for decrypt_messages in a new string or
+   NULL if there are no more.  */
+static char *
+next_message_name (int use_stdin, int *nfiles, char ***files,
+                   unsigned int *lno)
+{
+  char line[2048];
+  char *filename = NULL;
+
+  if (use_stdin)
+    {
+      if (fgets (line, DIM(line), stdin))
+        {
+          (*lno)++;
+          if (!*line || line[strlen(line)-1] != '\n')
+            log_error("input line %u too long or missing LF\n", *lno);
+          else
+            {
+              line[strlen(line)-1] = '\0';
+              filename = line;
+            }
+        }
+    }
+  else if (*nfiles)
+    {
+      filename = **files;
+      (*nfiles)--;
+      (*files)++;
+    }
+
+  return filename? xstrdup (filename) : NULL;
+}
+
+
 void
 decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
 {
@@ -186,6 +282,10 @@ decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
   char *p, *output = NULL;
   int rc=0,use_stdin=0;
   unsigned int lno=0;
+  char *names[MAX_PREFETCH_FILES];
+  PKT_pubkey_enc *encs[MAX_PREFETCH_FILES];
+  unsigned int nnames, nencs, i;
+  int last = 0;
 
   if (opt.outfile)
     {
@@ -198,81 +298,86 @@ decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
   if(!nfiles)
     use_stdin=1;
 
-  for(;;)
+  while (!last)
     {
-      char line[2048];
-      char *filename=NULL;
-
-      if(use_stdin)
-	{
-	  if(fgets(line, DIM(line), stdin))
-	    {
-	      lno++;
-	      if (!*line || line[strlen(line)-1] != '\n')
-		log_error("input line %u too long or missing LF\n", lno);
-	      else
-		{
-		  line[strlen(line)-1] = '\0';
-		  filename=line;
-		}
-	    }
-	}
-      else
-	{
-	  if(nfiles)
-	    {
-	      filename=*files;
-	      nfiles--;
-	      files++;
-	    }
-	}
-
-      if(filename==NULL)
-	break;
-
-      print_file_status(STATUS_FILE_START, filename, 3);
-      output = make_outfile_name(filename);
-      if (!output)
-        goto next_file;
-      fp = iobuf_open(filename);
-      if (fp)
-        iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
-      if (fp && is_secured_file (iobuf_get_fd (fp)))
+      /* Take several file names at once so that the session keys of
+         all of them can be asked for in one go.  Names read from
+         stdin are only read ahead in batch mode, because a caller
+         may wait for FILE_DONE before writing the next name.  */
+      for (nnames=0; nnames < DIM (names); nnames++)
         {
-          iobuf_close (fp);
-          fp = NULL;
-          gpg_err_set_errno (EPERM);
+          names[nnames] = next_message_name (use_stdin, &nfiles, &files,
+                                             &lno);
+          if (!names[nnames])
+            {
+              last = 1;
+              break;
+            }
+          if (use_stdin && !opt.batch)
+            {
+              nnames++;
+              break;
+            }
         }
-      if (!fp)
+      if (nnames > 1)
         {
-          log_error(_("can't open '%s'\n"), print_fname_stdin(filename));
-          goto next_file;
+          for (nencs=i=0; i < nnames; i++)
+            read_pubkey_enc (names[i], encs, &nencs, DIM (encs));
+          prefetch_session_keys (ctrl, encs, nencs);
+          for (i=0; i < nencs; i++)
+            free_pubkey_enc (encs[i]);
         }
 
-      handle_progress (pfx, fp, filename);
-
-      if (!opt.no_armor)
+      for (i=0; i < nnames; i++)
         {
-          if (use_armor_filter(fp))
+          char *filename = names[i];
+
+          print_file_status(STATUS_FILE_START, filename, 3);
+          output = make_outfile_name(filename);
+          if (!output)
+            goto next_file;
+          fp = iobuf_open(filename);
+          if (fp)
+            iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+          if (fp && is_secured_file (iobuf_get_fd (fp)))
+            {
+              iobuf_close (fp);
+              fp = NULL;
+              gpg_err_set_errno (EPERM);
+            }
+          if (!fp)
+            {
+              log_error(_("can't open '%s'\n"), print_fname_stdin(filename));
+              goto next_file;
+            }
+
+          handle_progress (pfx, fp, filename);
+
+          if (!opt.no_armor)
             {
-              afx = new_armor_context ();
-              push_armor_filter ( afx, fp );
+              if (use_armor_filter(fp))
+                {
+                  afx = new_armor_context ();
+                  push_armor_filter ( afx, fp );
+                }
             }
+          rc = proc_packets (ctrl,NULL, fp);
+          iobuf_close(fp);
+          if (rc)
+            log_error("%s: decryption failed: %s\n",
+                      print_fname_stdin(filename), gpg_strerror (rc));
+          p = get_last_passphrase();
+          set_next_passphrase(p);
+          xfree (p);
+
+        next_file:
+          /* Note that we emit file_done even after an error. */
+          write_status( STATUS_FILE_DONE );
+          xfree(output);
+          reset_literals_seen();
+          xfree (filename);
         }
-      rc = proc_packets (ctrl,NULL, fp);
-      iobuf_close(fp);
-      if (rc)
-        log_error("%s: decryption failed: %s\n", print_fname_stdin(filename),
-                  gpg_strerror (rc));
-      p = get_last_passphrase();
-      set_next_passphrase(p);
-      xfree (p);
-
-    next_file:
-      /* Note that we emit file_done even after an error. */
-      write_status( STATUS_FILE_DONE );
-      xfree(output);
-      reset_literals_seen();
+      release_prefetched_session_keys ();
     }
 
   set_next_passphrase(NULL);
@@ -926,10 +926,18 @@ write_pubkey_enc_from_list (PK_LIST pk_list, DEK *dek, iobuf_t out)
 }
 
 
+/* Encrypt each of the NFILES FILES, or each file named on a line of
+   stdin if NFILES is 0, to the recipients REMUSR.  The recipients are
+   looked up and checked only once; each file still gets its own
+   session key.  The files are encrypted one after the other; the
+   iobufs, the keydb and the status output may only be used by the
+   main thread.  The workers are used within each file by
+   --compress-threads and --cipher-pipeline.  */
 void
 encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
 {
   int rc = 0;
+  PK_LIST pk_list;
 
   if (opt.outfile)
     {
@@ -937,6 +945,12 @@ encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
       return;
     }
 
+  if ((rc = build_pk_list (ctrl, remusr, &pk_list, PUBKEY_USAGE_ENC)))
+    {
+      log_error ("no usable recipients: %s\n", gpg_strerror (rc));
+      return;
+    }
+
   if (!nfiles)
     {
       char line[2048];
@@ -947,11 +961,11 @@ encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
           if (!*line || line[strlen(line)-1] != '\n')
             {
               log_error("input line %u too long or missing LF\n", lno);
-              return;
+              break;
             }
           line[strlen(line)-1] = '\0';
           print_file_status(STATUS_FILE_START, line, 2);
-          rc = encrypt_crypt (ctrl, -1, line, remusr, 0, NULL, -1);
+          rc = encrypt_crypt (ctrl, -1, line, remusr, 0, pk_list, -1);
           if (rc)
             log_error ("encryption of '%s' failed: %s\n",
                        print_fname_stdin(line), gpg_strerror (rc) );
@@ -963,11 +977,13 @@ encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
       while (nfiles--)
         {
           print_file_status(STATUS_FILE_START, *files, 2);
-          if ( (rc = encrypt_crypt (ctrl, -1, *files, remusr, 0, NULL, -1)) )
+          if ( (rc = encrypt_crypt (ctrl, -1, *files, remusr, 0, pk_list, -1)) )
             log_error("encryption of '%s' failed: %s\n",
                       print_fname_stdin(*files), gpg_strerror (rc) );
           write_status( STATUS_FILE_DONE );
           files++;
         }
     }
+
+  release_pk_list (pk_list);
 }
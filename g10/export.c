@@ -334,6 +334,50 @@ exact_subkey_match_p (KEYDB_SEARCH_DESC *desc, KBNODE node)
 }
 
 
+/* Return true if the public key export of do_export_stream would
+   write every packet of KEYBLOCK unchanged.  This must match the
+   filters of its export loop.  */
+static int
+keyblock_exported_unchanged_p (kbnode_t keyblock, unsigned int options)
+{
+  kbnode_t node;
+  PKT_signature *sig;
+  int i;
+
+  for (node = keyblock; node; node = node->next)
+    {
+      switch (node->pkt->pkttype)
+        {
+        case PKT_COMMENT:
+        case PKT_RING_TRUST:
+          return 0;
+
+        case PKT_SIGNATURE:
+          sig = node->pkt->pkt.signature;
+          if (!(options&EXPORT_LOCAL_SIGS) && !sig->flags.exportable)
+            return 0;
+          if (!(options&EXPORT_SENSITIVE_REVKEYS) && sig->revkey)
+            {
+              for (i=0; i < sig->numrevkeys; i++)
+                if ((sig->revkey[i]->class & 0x40))
+                  return 0;
+            }
+          break;
+
+        case PKT_USER_ID:
+          if (!(options&EXPORT_ATTRIBUTES)
+              && node->pkt->pkt.user_id->attrib_data)
+            return 0;
+          break;
+
+        default:
+          break;
+        }
+    }
+  return 1;
+}
+
+
 /* Return a canonicalized public key algoithms.  This is used to
    compare different flavors of algorithms (e.g. ELG and ELG_E are
    considered the same).  */
@@ -778,6 +822,8 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
   int indent = 0;
   gcry_cipher_hd_t cipherhd = NULL;
   char *cache_nonce = NULL;
+  iobuf_t image = NULL;
+  int raw_ok;
 
   *any = 0;
   init_packet (&pkt);
@@ -860,10 +906,19 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       if (!users)
         desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
 
-      /* Read the keyblock. */
+      /* Read the keyblock.  Unless the packets need to be changed
+         first we ask for the image of the keyblock, so that it can be
+         copied to the output as is.  */
       release_kbnode (keyblock);
       keyblock = NULL;
-      err = keydb_get_keyblock (kdbhd, &keyblock);
+      iobuf_close (image);
+      image = NULL;
+      raw_ok = (!secret && !desc[descindex].exact
+                && !(options & (EXPORT_SEXP_FORMAT|EXPORT_CLEAN)));
+      if (raw_ok)
+        err = keydb_get_keyblock_image (kdbhd, &keyblock, &image);
+      else
+        err = keydb_get_keyblock (kdbhd, &keyblock);
       if (err)
         {
           log_error (_("error reading keyblock: %s\n"), gpg_strerror (err));
@@ -916,6 +971,25 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       if ((options & EXPORT_CLEAN))
         clean_key (keyblock, opt.verbose, (options&EXPORT_MINIMAL), NULL, NULL);
 
+      /* A keyblock which passes all filters unchanged is written from
+         its image without building the packets again.  */
+      if (image && keyblock_exported_unchanged_p (keyblock, options))
+        {
+          err = iobuf_write_temp (out, image);
+          if (err)
+            {
+              log_error ("error writing keyblock: %s\n", gpg_strerror (err));
+              goto leave;
+            }
+          *any = 1;
+          if (keyblock_out)
+            {
+              *keyblock_out = keyblock;
+              break;
+            }
+          continue;
+        }
+
       /* And write it. */
       xfree (cache_nonce);
       cache_nonce = NULL;
@@ -1245,6 +1319,7 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
     err = 0;
 
  leave:
+  iobuf_close (image);
   gcry_cipher_close (cipherhd);
   release_subkey_list (subkey_list);
   xfree(desc);
@@ -83,11 +83,15 @@ struct compress_filter_context_s {
     int algo;	 /* compress algo */
     int algo1hack;
     int new_ctb;
+    struct compress_mt_s *mt; /* The parallel compressor or NULL.  */
     void (*release)(struct compress_filter_context_s*);
 };
 typedef struct compress_filter_context_s compress_filter_context_t;
 
 
+struct cipher_pipe_s;
+typedef struct cipher_pipe_s *cipher_pipe_t;
+
 typedef struct {
     DEK *dek;
     u32 datalen;
@@ -96,6 +100,7 @@ typedef struct {
     gcry_md_hd_t mdc_hash;
     byte enchash[20];
     int create_mdc; /* flag will be set by the cipher filter */
+    cipher_pipe_t pipe; /* The cipher pipeline or NULL.  */
 } cipher_filter_context_t;
 
 
@@ -142,11 +147,31 @@ int         unarmor_pump (UnarmorPump x, int c);
 void push_compress_filter(iobuf_t out,compress_filter_context_t *zfx,int algo);
 void push_compress_filter2(iobuf_t out,compress_filter_context_t *zfx,
 			   int algo,int rel);
+size_t compress_buffer_size (iobuf_t a, int for_input);
+
+/*-- compress-mt.c --*/
+struct compress_mt_s *compress_mt_new (int algo, int level);
+void compress_mt_release (struct compress_mt_s *mt);
+int compress_mt_write (struct compress_mt_s *mt, const byte *buf,
+                       size_t size, iobuf_t a);
+int compress_mt_finish (struct compress_mt_s *mt, iobuf_t a);
 
 /*-- cipher.c --*/
 int cipher_filter( void *opaque, int control,
 		   iobuf_t chain, byte *buf, size_t *ret_len);
 
+/*-- cipher-pipe.c --*/
+cipher_pipe_t cipher_pipe_new (gcry_cipher_hd_t cipher_hd, gcry_md_hd_t md,
+                               int decrypt);
+void cipher_pipe_release (cipher_pipe_t p);
+int cipher_pipe_write (cipher_pipe_t p, const byte *data, size_t size,
+                       iobuf_t a);
+int cipher_pipe_flush (cipher_pipe_t p, iobuf_t a);
+size_t cipher_pipe_read (cipher_pipe_t p, byte *data, size_t size,
+                         size_t (*fill) (void *arg, iobuf_t a,
+                                         byte *buf, size_t size),
+                         void *fill_arg, iobuf_t a);
+
 /*-- textfilter.c --*/
 int text_filter( void *opaque, int control,
 		 iobuf_t chain, byte *buf, size_t *ret_len);
@@ -26,11 +26,129 @@
 
 #include "gpg.h"
 #include "util.h"
+#include "../common/init.h"
 #include "packet.h"
 #include "../common/iobuf.h"
 #include "options.h"
 
 
+/* Parsing and releasing keyblocks allocates and frees a very large
+   number of signature and key structures and of PACKETs to hold
+   them.  Released ones are kept on these lists for reuse, in the same
+   way kbnode.c keeps unused nodes.  The first word of a listed struct
+   links to the next one.  */
+#define MAX_UNUSED_STRUCTS 512
+
+struct unused_structs_s
+{
+  void *head;
+  unsigned int count;
+};
+
+static struct unused_structs_s unused_sigs;
+static struct unused_structs_s unused_pks;
+static struct unused_structs_s unused_packets;
+static int cleanup_registered;
+
+
+static void
+release_unused_list (struct unused_structs_s *list)
+{
+  void *p;
+
+  while ((p = list->head))
+    {
+      list->head = *(void **)p;
+      xfree (p);
+    }
+  list->count = 0;
+}
+
+
+static void
+release_unused_structs (void)
+{
+  release_unused_list (&unused_sigs);
+  release_unused_list (&unused_pks);
+  release_unused_list (&unused_packets);
+}
+
+
+/* Return a cleared struct of SIZE bytes from LIST or the heap.  */
+static void *
+alloc_struct (struct unused_structs_s *list, size_t size)
+{
+  void *p;
+
+  p = list->head;
+  if (!p)
+    return xmalloc_clear (size);
+  list->head = *(void **)p;
+  list->count--;
+  memset (p, 0, size);
+  return p;
+}
+
+
+/* Put the heap allocated struct P on LIST or free it.  */
+static void
+recycle_struct (struct unused_structs_s *list, void *p)
+{
+  if (list->count >= MAX_UNUSED_STRUCTS)
+    {
+      xfree (p);
+      return;
+    }
+  if (!cleanup_registered)
+    {
+      cleanup_registered = 1;
+      register_mem_cleanup_func (release_unused_structs);
+    }
+  *(void **)p = list->head;
+  list->head = p;
+  list->count++;
+}
+
+
+/* Allocate a cleared signature structure.  This and the next
+   functions are meant for the places creating many short-lived
+   objects; the objects are released with the usual functions.  */
+PKT_signature *
+alloc_signature (void)
+{
+  return alloc_struct (&unused_sigs, sizeof (PKT_signature));
+}
+
+
+/* Allocate a cleared public key structure.  */
+PKT_public_key *
+alloc_public_key (void)
+{
+  return alloc_struct (&unused_pks, sizeof (PKT_public_key));
+}
+
+
+/* Allocate an initialized PACKET.  Release it with release_packet.  */
+PACKET *
+alloc_packet (void)
+{
+  return alloc_struct (&unused_packets, sizeof (PACKET));
+}
+
+
+/* Free the content of PKT and PKT itself, which must have been
+   allocated from the heap.  */
+void
+release_packet (PACKET *pkt)
+{
+  if (pkt)
+    {
+      free_packet (pkt);
+      recycle_struct (&unused_packets, pkt);
+    }
+}
+
+
 /* This is mpi_copy with a fix for opaque MPIs which store a NULL
    pointer.  This will also be fixed in Libggcrypt 1.7.0.  */
 static gcry_mpi_t
@@ -84,7 +202,7 @@ free_seckey_enc( PKT_signature *sig )
       xfree (sig->pka_info);
     }
 
-  xfree(sig);
+  recycle_struct (&unused_sigs, sig);
 }
 
 
@@ -130,6 +248,8 @@ release_public_key_parts (PKT_public_key *pk)
       xfree (pk->serialno);
       pk->serialno = NULL;
     }
+  pk->flags.keygrip_valid = 0;
+  pk->fprlen = 0;
 }
 
 
@@ -141,7 +261,7 @@ free_public_key (PKT_public_key *pk)
   if (pk)
     {
       release_public_key_parts (pk);
-      xfree(pk);
+      recycle_struct (&unused_pks, pk);
     }
 }
 
@@ -188,7 +308,8 @@ copy_prefs (const prefitem_t *prefs)
 
 /* Copy the public key S to D.  If D is NULL allocate a new public key
    structure.  If S has seckret key infos, only the public stuff is
-   copied.  */
+   copied.  The cached fingerprint is copied along with the public key
+   material it was computed from.  */
 PKT_public_key *
 copy_public_key (PKT_public_key *d, PKT_public_key *s)
 {
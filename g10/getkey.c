@@ -75,37 +75,63 @@ static struct
 typedef struct keyid_list
 {
   struct keyid_list *next;
+  struct keyid_list *next_kid;  /* Next in the keyid hash bucket.  */
+  struct keyid_list *next_fpr;  /* Next in the fingerprint hash bucket.  */
+  struct user_id_db *uid;       /* The user ID entry of this key.  */
   char fpr[MAX_FINGERPRINT_LEN];
   u32 keyid[2];
 } *keyid_list_t;
 
 
+/* The public key cache.  Entries are found through a hash table on
+   the low word of the keyid and are also kept on a list in most
+   recently used order; if the cache is full the least recently used
+   entry is dropped.  An entry without a key records that there is no
+   key with that keyid, which saves repeated searches for the issuers
+   of signatures.  */
 #if MAX_PK_CACHE_ENTRIES
 typedef struct pk_cache_entry
 {
-  struct pk_cache_entry *next;
+  struct pk_cache_entry *next;      /* Next in the hash bucket.  */
+  struct pk_cache_entry *lru_prev;  /* Next more recently used entry.  */
+  struct pk_cache_entry *lru_next;  /* Next less recently used entry.  */
   u32 keyid[2];
-  PKT_public_key *pk;
+  PKT_public_key *pk;               /* NULL if there is no such key.  */
 } *pk_cache_entry_t;
-static pk_cache_entry_t pk_cache;
+static pk_cache_entry_t *pk_cache;      /* The hash table.  */
+static unsigned int pk_cache_buckets;   /* Its size.  */
+static pk_cache_entry_t pk_cache_mru;   /* The most recently used entry.  */
+static pk_cache_entry_t pk_cache_lru;   /* The least recently used entry.  */
 static int pk_cache_entries;	/* Number of entries in pk cache.  */
 static int pk_cache_disabled;
 #endif
 
+/* The user ID cache is organized the same way; each of its entries
+   may be found by the keyids and fingerprints of all keys of the
+   keyblock.  */
 #if MAX_UID_CACHE_ENTRIES < 5
 #error we really need the userid cache
 #endif
 typedef struct user_id_db
 {
-  struct user_id_db *next;
+  struct user_id_db *lru_prev;
+  struct user_id_db *lru_next;
   keyid_list_t keyids;
   int len;
   char name[1];
 } *user_id_db_t;
-static user_id_db_t user_id_db;
+static keyid_list_t *uid_cache_kid;     /* The hash table by keyid.  */
+static keyid_list_t *uid_cache_fpr;     /* The hash table by fingerprint. */
+static unsigned int uid_cache_buckets;  /* The size of both tables.  */
+static user_id_db_t uid_cache_mru;
+static user_id_db_t uid_cache_lru;
 static int uid_cache_entries;	/* Number of entries in uid cache. */
 
+/* Set by merge_selfsigs_main if its result depends on other keys.  */
+static int merge_used_other_keys;
+
 static void merge_selfsigs (kbnode_t keyblock);
+static void merge_selfsigs_cached (kbnode_t keyblock, const byte *digest);
 static int lookup (getkey_ctx_t ctx, kbnode_t *ret_keyblock, int want_secret);
 
 #if 0
@@ -126,11 +152,159 @@ print_stats ()
 #endif
 
 
+/* Return the maximum number of entries of the pk and the uid cache.  */
+static int
+key_cache_limit (void)
+{
+  int n = opt.key_cache_size;
+
+  if (n <= 0)
+    n = MAX_PK_CACHE_ENTRIES;
+  return n < 5? 5 : n;
+}
+
+
+/* Return the number of hash buckets for a cache of up to LIMIT
+   entries: the smallest power of two not below half of LIMIT.  */
+static unsigned int
+key_cache_buckets (int limit)
+{
+  unsigned int n;
+
+  for (n = 16; n < (unsigned int)limit / 2; n <<= 1)
+    ;
+  return n;
+}
+
+
+/* The hash functions of the caches.  The low word of the keyid is
+   random enough; for the fingerprint we may not use the last bytes
+   because the fingerprints of v3 keys are padded with zeroes.  */
+#define KEYID_HASH(k,n)  ((k)[1] & ((n) - 1))
+#define FPR_HASH(f,n)    (buf32_to_u32 ((const byte *)(f) + 12) & ((n) - 1))
+
+
+#if MAX_PK_CACHE_ENTRIES
+static void
+pk_cache_unlink_lru (pk_cache_entry_t ce)
+{
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache_mru = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache_lru = ce->lru_prev;
+}
+
+
+static void
+pk_cache_push_lru (pk_cache_entry_t ce)
+{
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache_mru;
+  if (pk_cache_mru)
+    pk_cache_mru->lru_prev = ce;
+  else
+    pk_cache_lru = ce;
+  pk_cache_mru = ce;
+}
+
+
+/* Return the pk cache entry for KEYID and make it the most recently
+   used one.  Returns NULL if KEYID is not cached.  */
+static pk_cache_entry_t
+pk_cache_lookup (const u32 *keyid)
+{
+  pk_cache_entry_t ce;
+
+  if (!pk_cache)
+    return NULL;
+
+  for (ce = pk_cache[KEYID_HASH (keyid, pk_cache_buckets)]; ce; ce = ce->next)
+    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
+      {
+        pk_cache_unlink_lru (ce);
+        pk_cache_push_lru (ce);
+        return ce;
+      }
+  return NULL;
+}
+
+
+/* Remove CE from the pk cache and release it.  */
+static void
+pk_cache_drop (pk_cache_entry_t ce)
+{
+  pk_cache_entry_t *cep;
+
+  for (cep = &pk_cache[KEYID_HASH (ce->keyid, pk_cache_buckets)];
+       *cep != ce; cep = &(*cep)->next)
+    ;
+  *cep = ce->next;
+  pk_cache_unlink_lru (ce);
+  if (ce->pk)
+    free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache_entries--;
+}
+
+
+/* Store a copy of PK under KEYID in the pk cache.  With PK given as
+   NULL record that there is no such key.  */
+static void
+pk_cache_put (const u32 *keyid, PKT_public_key *pk)
+{
+  pk_cache_entry_t ce;
+  int limit;
+
+  if (pk_cache_disabled)
+    return;
+
+  ce = pk_cache_lookup (keyid);
+  if (ce)
+    {
+      if (ce->pk || !pk)
+        {
+          if (DBG_CACHE)
+            log_debug ("cache_public_key: already in cache\n");
+        }
+      else
+        ce->pk = copy_public_key (NULL, pk);  /* The key now exists.  */
+      return;
+    }
+
+  limit = key_cache_limit ();
+  if (!pk_cache)
+    {
+      pk_cache_buckets = key_cache_buckets (limit);
+      pk_cache = xtrycalloc (pk_cache_buckets, sizeof *pk_cache);
+      if (!pk_cache)
+        return;
+    }
+
+  while (pk_cache_entries >= limit)
+    pk_cache_drop (pk_cache_lru);
+
+  ce = xtrymalloc (sizeof *ce);
+  if (!ce)
+    return;
+  ce->keyid[0] = keyid[0];
+  ce->keyid[1] = keyid[1];
+  ce->pk = pk? copy_public_key (NULL, pk) : NULL;
+  ce->next = pk_cache[KEYID_HASH (keyid, pk_cache_buckets)];
+  pk_cache[KEYID_HASH (keyid, pk_cache_buckets)] = ce;
+  pk_cache_push_lru (ce);
+  pk_cache_entries++;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
+
+
 void
 cache_public_key (PKT_public_key * pk)
 {
 #if MAX_PK_CACHE_ENTRIES
-  pk_cache_entry_t ce, ce2;
   u32 keyid[2];
 
   if (pk_cache_disabled)
@@ -151,43 +325,7 @@ cache_public_key (PKT_public_key * pk)
   else
     return; /* Don't know how to get the keyid.  */
 
-  for (ce = pk_cache; ce; ce = ce->next)
-    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-      {
-	if (DBG_CACHE)
-	  log_debug ("cache_public_key: already in cache\n");
-	return;
-      }
-
-  if (pk_cache_entries >= MAX_PK_CACHE_ENTRIES)
-    {
-      int n;
-
-      /* Remove the last 50% of the entries.  */
-      for (ce = pk_cache, n = 0; ce && n < pk_cache_entries/2; n++)
-        ce = ce->next;
-      if (ce != pk_cache && ce->next)
-        {
-          ce2 = ce->next;
-          ce->next = NULL;
-          ce = ce2;
-          for (; ce; ce = ce2)
-            {
-              ce2 = ce->next;
-              free_public_key (ce->pk);
-              xfree (ce);
-              pk_cache_entries--;
-            }
-        }
-      assert (pk_cache_entries < MAX_PK_CACHE_ENTRIES);
-    }
-  pk_cache_entries++;
-  ce = xmalloc (sizeof *ce);
-  ce->next = pk_cache;
-  pk_cache = ce;
-  ce->pk = copy_public_key (NULL, pk);
-  ce->keyid[0] = keyid[0];
-  ce->keyid[1] = keyid[1];
+  pk_cache_put (keyid, pk);
 #endif
 }
 
@@ -244,6 +382,92 @@ release_keyid_list (keyid_list_t k)
     }
 }
 
+static void
+uid_cache_unlink_lru (user_id_db_t r)
+{
+  if (r->lru_prev)
+    r->lru_prev->lru_next = r->lru_next;
+  else
+    uid_cache_mru = r->lru_next;
+  if (r->lru_next)
+    r->lru_next->lru_prev = r->lru_prev;
+  else
+    uid_cache_lru = r->lru_prev;
+}
+
+
+static void
+uid_cache_push_lru (user_id_db_t r)
+{
+  r->lru_prev = NULL;
+  r->lru_next = uid_cache_mru;
+  if (uid_cache_mru)
+    uid_cache_mru->lru_prev = r;
+  else
+    uid_cache_lru = r;
+  uid_cache_mru = r;
+}
+
+
+/* Return the key of the uid cache with KEYID or, if KEYID is NULL,
+   with the fingerprint FPR.  Its user ID entry becomes the most
+   recently used one.  Returns NULL if the key is not cached.  */
+static keyid_list_t
+uid_cache_lookup (const u32 *keyid, const char *fpr)
+{
+  keyid_list_t a;
+
+  if (!uid_cache_kid)
+    return NULL;
+
+  if (keyid)
+    {
+      for (a = uid_cache_kid[KEYID_HASH (keyid, uid_cache_buckets)];
+           a; a = a->next_kid)
+        if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
+          break;
+    }
+  else
+    {
+      for (a = uid_cache_fpr[FPR_HASH (fpr, uid_cache_buckets)];
+           a; a = a->next_fpr)
+        if (!memcmp (a->fpr, fpr, MAX_FINGERPRINT_LEN))
+          break;
+    }
+
+  if (a)
+    {
+      uid_cache_unlink_lru (a->uid);
+      uid_cache_push_lru (a->uid);
+    }
+  return a;
+}
+
+
+/* Remove the user ID entry R from the uid cache and release it.  */
+static void
+uid_cache_drop (user_id_db_t r)
+{
+  keyid_list_t a, *ap;
+
+  for (a = r->keyids; a; a = a->next)
+    {
+      for (ap = &uid_cache_kid[KEYID_HASH (a->keyid, uid_cache_buckets)];
+           *ap != a; ap = &(*ap)->next_kid)
+        ;
+      *ap = a->next_kid;
+      for (ap = &uid_cache_fpr[FPR_HASH (a->fpr, uid_cache_buckets)];
+           *ap != a; ap = &(*ap)->next_fpr)
+        ;
+      *ap = a->next_fpr;
+    }
+  uid_cache_unlink_lru (r);
+  release_keyid_list (r->keyids);
+  xfree (r);
+  uid_cache_entries--;
+}
+
+
 /****************
  * Store the association of keyid and userid
  * Feed only public keys to this function.
@@ -255,33 +479,36 @@ cache_user_id (KBNODE keyblock)
   const char *uid;
   size_t uidlen;
   keyid_list_t keyids = NULL;
+  keyid_list_t a;
   KBNODE k;
+  int limit;
+
+  limit = key_cache_limit ();
+  if (!uid_cache_kid)
+    {
+      uid_cache_buckets = key_cache_buckets (limit);
+      uid_cache_kid = xcalloc (uid_cache_buckets, sizeof *uid_cache_kid);
+      uid_cache_fpr = xcalloc (uid_cache_buckets, sizeof *uid_cache_fpr);
+    }
 
   for (k = keyblock; k; k = k->next)
     {
       if (k->pkt->pkttype == PKT_PUBLIC_KEY
 	  || k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
 	{
-	  keyid_list_t a = xmalloc_clear (sizeof *a);
+	  a = xmalloc_clear (sizeof *a);
 	  /* Hmmm: For a long list of keyids it might be an advantage
 	   * to append the keys.  */
           fingerprint_from_pk (k->pkt->pkt.public_key, a->fpr, NULL);
 	  keyid_from_pk (k->pkt->pkt.public_key, a->keyid);
 	  /* First check for duplicates.  */
-	  for (r = user_id_db; r; r = r->next)
+	  if (uid_cache_lookup (NULL, a->fpr))
 	    {
-	      keyid_list_t b = r->keyids;
-	      for (b = r->keyids; b; b = b->next)
-		{
-		  if (!memcmp (b->fpr, a->fpr, MAX_FINGERPRINT_LEN))
-		    {
-		      if (DBG_CACHE)
-			log_debug ("cache_user_id: already in cache\n");
-		      release_keyid_list (keyids);
-		      xfree (a);
-		      return;
-		    }
-		}
+	      if (DBG_CACHE)
+	        log_debug ("cache_user_id: already in cache\n");
+	      release_keyid_list (keyids);
+	      xfree (a);
+	      return;
 	    }
 	  /* Now put it into the cache.  */
 	  a->next = keyids;
@@ -294,21 +521,22 @@ cache_user_id (KBNODE keyblock)
 
   uid = get_primary_uid (keyblock, &uidlen);
 
-  if (uid_cache_entries >= MAX_UID_CACHE_ENTRIES)
-    {
-      /* fixme: use another algorithm to free some cache slots */
-      r = user_id_db;
-      user_id_db = r->next;
-      release_keyid_list (r->keyids);
-      xfree (r);
-      uid_cache_entries--;
-    }
+  while (uid_cache_entries >= limit)
+    uid_cache_drop (uid_cache_lru);
+
   r = xmalloc (sizeof *r + uidlen - 1);
   r->keyids = keyids;
   r->len = uidlen;
   memcpy (r->name, uid, r->len);
-  r->next = user_id_db;
-  user_id_db = r;
+  for (a = keyids; a; a = a->next)
+    {
+      a->uid = r;
+      a->next_kid = uid_cache_kid[KEYID_HASH (a->keyid, uid_cache_buckets)];
+      uid_cache_kid[KEYID_HASH (a->keyid, uid_cache_buckets)] = a;
+      a->next_fpr = uid_cache_fpr[FPR_HASH (a->fpr, uid_cache_buckets)];
+      uid_cache_fpr[FPR_HASH (a->fpr, uid_cache_buckets)] = a;
+    }
+  uid_cache_push_lru (r);
   uid_cache_entries++;
 }
 
@@ -317,19 +545,12 @@ void
 getkey_disable_caches ()
 {
 #if MAX_PK_CACHE_ENTRIES
-  {
-    pk_cache_entry_t ce, ce2;
-
-    for (ce = pk_cache; ce; ce = ce2)
-      {
-	ce2 = ce->next;
-	free_public_key (ce->pk);
-	xfree (ce);
-      }
-    pk_cache_disabled = 1;
-    pk_cache_entries = 0;
-    pk_cache = NULL;
-  }
+  /* This also forgets about keys which did not exist.  */
+  while (pk_cache_lru)
+    pk_cache_drop (pk_cache_lru);
+  xfree (pk_cache);
+  pk_cache = NULL;
+  pk_cache_disabled = 1;
 #endif
   /* fixme: disable user id cache ? */
 }
@@ -356,21 +577,20 @@ get_pubkey (PKT_public_key * pk, u32 * keyid)
   int rc = 0;
 
 #if MAX_PK_CACHE_ENTRIES
-  if (pk)
-    {
-      /* Try to get it from the cache.  We don't do this when pk is
-         NULL as it does not guarantee that the user IDs are
-         cached. */
-      pk_cache_entry_t ce;
-      for (ce = pk_cache; ce; ce = ce->next)
-	{
-	  if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	    {
-	      copy_public_key (pk, ce->pk);
-	      return 0;
-	    }
-	}
-    }
+  {
+    /* Try to get it from the cache.  We don't do this when pk is
+       NULL as it does not guarantee that the user IDs are cached;
+       a key known not to exist is also not there in that case.  */
+    pk_cache_entry_t ce = pk_cache_lookup (keyid);
+
+    if (ce && !ce->pk)
+      return GPG_ERR_NO_PUBKEY;
+    if (ce && pk)
+      {
+        copy_public_key (pk, ce->pk);
+        return 0;
+      }
+  }
 #endif
   /* More init stuff.  */
   if (!pk)
@@ -399,6 +619,11 @@ get_pubkey (PKT_public_key * pk, u32 * keyid)
       {
 	pk_from_block (&ctx, pk, kb);
       }
+#if MAX_PK_CACHE_ENTRIES
+    else if (gpg_err_code (rc) == GPG_ERR_NO_PUBKEY
+             && !ctx.req_algo && !ctx.req_usage)
+      pk_cache_put (keyid, NULL);  /* Don't search for it again.  */
+#endif
     get_pubkey_end (&ctx);
     release_kbnode (kb);
   }
@@ -432,16 +657,14 @@ get_pubkey_fast (PKT_public_key * pk, u32 * keyid)
 #if MAX_PK_CACHE_ENTRIES
   {
     /* Try to get it from the cache */
-    pk_cache_entry_t ce;
+    pk_cache_entry_t ce = pk_cache_lookup (keyid);
 
-    for (ce = pk_cache; ce; ce = ce->next)
+    if (ce)
       {
-	if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	  {
-	    if (pk)
-	      copy_public_key (pk, ce->pk);
-	    return 0;
-	  }
+        if (!ce->pk)
+          return GPG_ERR_NO_PUBKEY;
+        copy_public_key (pk, ce->pk);
+        return 0;
       }
   }
 #endif
@@ -451,6 +674,9 @@ get_pubkey_fast (PKT_public_key * pk, u32 * keyid)
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     {
       keydb_release (hd);
+#if MAX_PK_CACHE_ENTRIES
+      pk_cache_put (keyid, NULL);
+#endif
       return GPG_ERR_NO_PUBKEY;
     }
   rc = keydb_get_keyblock (hd, &keyblock);
@@ -1719,6 +1945,10 @@ merge_selfsigs_main (KBNODE keyblock, int *r_revoked,
 	  }
       }
 
+  /* Whether revoked or not depends on the keys of the revokers.  */
+  if (pk->revkey)
+    merge_used_other_keys = 1;
+
   /* Second pass: Look at the self-signature of all user IDs.  */
   signode = uidnode = NULL;
   sigdate = 0; /* Helper variable to find the latest signature in one UID. */
@@ -1819,6 +2049,7 @@ merge_selfsigs_main (KBNODE keyblock, int *r_revoked,
 		}
 	    }
 	}
+      merge_used_other_keys = 1;
     }
 
   /* Record the highest selfsig version so we know if this is a v3
@@ -2318,6 +2549,461 @@ merge_selfsigs (KBNODE keyblock)
 }
 
 
+
+/* The merge cache keeps the results of merge_selfsigs for recently
+   merged keyblocks, so that a keyblock read again, e.g. after it has
+   been dropped from the pk cache, is not merged again.  An entry is
+   found by the SHA-1 digest of the image the keyblock has been read
+   from (see keydb_get_keyblock_digest) and thus only used for a
+   keyblock with exactly the same packets.  Entries are kept in most
+   recently used order like those of the pk cache.
+
+   The result of a merge depends on the current time; an entry is
+   only used until the next of the creation and expiration dates in
+   the keyblock, when this may change it.  A result which depends on
+   other keys, i.e. on a designated revoker or an ultimately trusted
+   signer, is not cached.  */
+struct merged_key_s
+{
+  u32 expiredate;
+  u32 has_expired;
+  u32 main_keyid[2];
+  struct revoke_info revoked;
+  byte selfsigversion;
+  byte pubkey_usage;
+  unsigned int mdc:1;
+  unsigned int revoked_flag:2;
+  unsigned int maybe_revoked:1;
+  unsigned int valid:1;
+  unsigned int backsig:2;
+  prefitem_t *prefs;
+  struct revocation_key *revkey;
+  int numrevkeys;
+};
+
+struct merged_uid_s
+{
+  int help_key_usage;
+  u32 help_key_expire;
+  int is_primary;
+  int is_revoked;
+  int is_expired;
+  u32 expiredate;
+  u32 created;
+  byte selfsigversion;
+  unsigned int mdc:1;
+  unsigned int ks_modify:1;
+  prefitem_t *prefs;
+};
+
+/* The values of the NODES array of an entry: the kind of the node in
+   the high nibble and for signatures their flags in the low one.  */
+#define MERGED_OTHER     0x00
+#define MERGED_KEY       0x10
+#define MERGED_UID       0x20
+#define MERGED_SIG       0x30
+#define MERGED_CHECKED   0x01
+#define MERGED_VALID     0x02
+#define MERGED_CHOSEN    0x04
+
+typedef struct merge_cache_entry
+{
+  struct merge_cache_entry *next;      /* Next in the hash bucket.  */
+  struct merge_cache_entry *lru_prev;
+  struct merge_cache_entry *lru_next;
+  byte digest[20];
+  u32 valid_until;                     /* 0 for no limit.  */
+  unsigned int nnodes, nkeys, nuids;
+  byte *nodes;
+  struct merged_key_s *keys;
+  struct merged_uid_s *uids;
+} *merge_cache_entry_t;
+static merge_cache_entry_t *merge_cache;     /* The hash table.  */
+static unsigned int merge_cache_buckets;
+static merge_cache_entry_t merge_cache_mru;
+static merge_cache_entry_t merge_cache_lru;
+static int merge_cache_entries;
+
+#define DIGEST_HASH(d,n) (buf32_to_u32 (d) & ((n) - 1))
+
+
+static void
+merge_cache_unlink_lru (merge_cache_entry_t ce)
+{
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    merge_cache_mru = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    merge_cache_lru = ce->lru_prev;
+}
+
+
+static void
+merge_cache_push_lru (merge_cache_entry_t ce)
+{
+  ce->lru_prev = NULL;
+  ce->lru_next = merge_cache_mru;
+  if (merge_cache_mru)
+    merge_cache_mru->lru_prev = ce;
+  else
+    merge_cache_lru = ce;
+  merge_cache_mru = ce;
+}
+
+
+/* Release the entry CE which is not in the merge cache.  */
+static void
+merge_cache_release (merge_cache_entry_t ce)
+{
+  unsigned int i;
+
+  if (!ce)
+    return;
+  if (ce->keys)
+    for (i=0; i < ce->nkeys; i++)
+      {
+        xfree (ce->keys[i].prefs);
+        xfree (ce->keys[i].revkey);
+      }
+  if (ce->uids)
+    for (i=0; i < ce->nuids; i++)
+      xfree (ce->uids[i].prefs);
+  xfree (ce->nodes);
+  xfree (ce->keys);
+  xfree (ce->uids);
+  xfree (ce);
+}
+
+
+/* Remove CE from the merge cache and release it.  */
+static void
+merge_cache_drop (merge_cache_entry_t ce)
+{
+  merge_cache_entry_t *cep;
+
+  for (cep = &merge_cache[DIGEST_HASH (ce->digest, merge_cache_buckets)];
+       *cep != ce; cep = &(*cep)->next)
+    ;
+  *cep = ce->next;
+  merge_cache_unlink_lru (ce);
+  merge_cache_release (ce);
+  merge_cache_entries--;
+}
+
+
+/* Return the merge cache entry for DIGEST if it may be used at the
+   time NOW and make it the most recently used one.  */
+static merge_cache_entry_t
+merge_cache_lookup (const byte *digest, u32 now)
+{
+  merge_cache_entry_t ce;
+
+  if (!merge_cache)
+    return NULL;
+
+  for (ce = merge_cache[DIGEST_HASH (digest, merge_cache_buckets)];
+       ce; ce = ce->next)
+    if (!memcmp (ce->digest, digest, 20))
+      {
+        if (ce->valid_until && now >= ce->valid_until)
+          {
+            merge_cache_drop (ce);
+            return NULL;
+          }
+        merge_cache_unlink_lru (ce);
+        merge_cache_push_lru (ce);
+        return ce;
+      }
+  return NULL;
+}
+
+
+/* Lower *LIMIT to the time T if that is after NOW.  */
+static void
+merge_cache_limit (u32 *limit, u32 t, u32 now)
+{
+  if (t > now && (!*limit || t < *limit))
+    *limit = t;
+}
+
+
+/* Return a new merge cache entry for the merged KEYBLOCK which has
+   been read from an image with DIGEST at the time NOW, or NULL if
+   the result may not be cached.  */
+static merge_cache_entry_t
+merge_cache_new (kbnode_t keyblock, const byte *digest, u32 now)
+{
+  merge_cache_entry_t ce;
+  kbnode_t k;
+  unsigned int n;
+
+  ce = xtrycalloc (1, sizeof *ce);
+  if (!ce)
+    return NULL;
+  memcpy (ce->digest, digest, 20);
+  for (k = keyblock; k; k = k->next)
+    {
+      ce->nnodes++;
+      if (k->pkt->pkttype == PKT_PUBLIC_KEY
+          || k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        ce->nkeys++;
+      else if (k->pkt->pkttype == PKT_USER_ID)
+        ce->nuids++;
+    }
+  ce->nodes = xtrymalloc (ce->nnodes);
+  ce->keys = xtrycalloc (ce->nkeys + 1, sizeof *ce->keys);
+  ce->uids = xtrycalloc (ce->nuids + 1, sizeof *ce->uids);
+  if (!ce->nodes || !ce->keys || !ce->uids)
+    goto fail;
+
+  ce->nkeys = ce->nuids = 0;
+  for (k = keyblock, n = 0; k; k = k->next, n++)
+    {
+      if (k->pkt->pkttype == PKT_PUBLIC_KEY
+          || k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        {
+          PKT_public_key *pk = k->pkt->pkt.public_key;
+          struct merged_key_s *mk = ce->keys + ce->nkeys++;
+
+          if (pk->flags.dont_cache)
+            goto fail;
+          mk->expiredate = pk->expiredate;
+          mk->has_expired = pk->has_expired;
+          mk->main_keyid[0] = pk->main_keyid[0];
+          mk->main_keyid[1] = pk->main_keyid[1];
+          mk->revoked = pk->revoked;
+          mk->selfsigversion = pk->selfsigversion;
+          mk->pubkey_usage = pk->pubkey_usage;
+          mk->mdc = pk->flags.mdc;
+          mk->revoked_flag = pk->flags.revoked;
+          mk->maybe_revoked = pk->flags.maybe_revoked;
+          mk->valid = pk->flags.valid;
+          mk->backsig = pk->flags.backsig;
+          mk->prefs = copy_prefs (pk->prefs);
+          if (pk->numrevkeys)
+            {
+              mk->revkey = xtrymalloc (pk->numrevkeys * sizeof *pk->revkey);
+              if (!mk->revkey)
+                goto fail;
+              memcpy (mk->revkey, pk->revkey,
+                      pk->numrevkeys * sizeof *pk->revkey);
+              mk->numrevkeys = pk->numrevkeys;
+            }
+          merge_cache_limit (&ce->valid_until, pk->timestamp, now);
+          merge_cache_limit (&ce->valid_until, pk->expiredate, now);
+          ce->nodes[n] = MERGED_KEY;
+        }
+      else if (k->pkt->pkttype == PKT_USER_ID)
+        {
+          PKT_user_id *uid = k->pkt->pkt.user_id;
+          struct merged_uid_s *mu = ce->uids + ce->nuids++;
+
+          mu->help_key_usage = uid->help_key_usage;
+          mu->help_key_expire = uid->help_key_expire;
+          mu->is_primary = uid->is_primary;
+          mu->is_revoked = uid->is_revoked;
+          mu->is_expired = uid->is_expired;
+          mu->expiredate = uid->expiredate;
+          mu->created = uid->created;
+          mu->selfsigversion = uid->selfsigversion;
+          mu->mdc = uid->flags.mdc;
+          mu->ks_modify = uid->flags.ks_modify;
+          mu->prefs = copy_prefs (uid->prefs);
+          merge_cache_limit (&ce->valid_until, uid->expiredate, now);
+          merge_cache_limit (&ce->valid_until, uid->help_key_expire, now);
+          ce->nodes[n] = MERGED_UID;
+        }
+      else if (k->pkt->pkttype == PKT_SIGNATURE)
+        {
+          PKT_signature *sig = k->pkt->pkt.signature;
+
+          ce->nodes[n] = (MERGED_SIG
+                          | (sig->flags.checked? MERGED_CHECKED : 0)
+                          | (sig->flags.valid? MERGED_VALID : 0)
+                          | (sig->flags.chosen_selfsig? MERGED_CHOSEN : 0));
+          merge_cache_limit (&ce->valid_until, sig->timestamp, now);
+          merge_cache_limit (&ce->valid_until, sig->expiredate, now);
+        }
+      else
+        ce->nodes[n] = MERGED_OTHER;
+    }
+  return ce;
+
+ fail:
+  merge_cache_release (ce);
+  return NULL;
+}
+
+
+/* Store the new entry CE in the merge cache.  */
+static void
+merge_cache_put (merge_cache_entry_t ce)
+{
+  int limit;
+
+  limit = key_cache_limit ();
+  if (!merge_cache)
+    {
+      merge_cache_buckets = key_cache_buckets (limit);
+      merge_cache = xtrycalloc (merge_cache_buckets, sizeof *merge_cache);
+      if (!merge_cache)
+        {
+          merge_cache_release (ce);
+          return;
+        }
+    }
+
+  while (merge_cache_entries >= limit)
+    merge_cache_drop (merge_cache_lru);
+
+  ce->next = merge_cache[DIGEST_HASH (ce->digest, merge_cache_buckets)];
+  merge_cache[DIGEST_HASH (ce->digest, merge_cache_buckets)] = ce;
+  merge_cache_push_lru (ce);
+  merge_cache_entries++;
+}
+
+
+/* Set the fields of the freshly read KEYBLOCK to the merge results
+   in CE.  Returns false and leaves KEYBLOCK alone if CE does not fit
+   its packets.  */
+static int
+merge_cache_apply (merge_cache_entry_t ce, kbnode_t keyblock)
+{
+  kbnode_t k;
+  unsigned int n, nkeys, nuids;
+  int kind;
+
+  for (k = keyblock, n = 0; k; k = k->next, n++)
+    {
+      if (n == ce->nnodes)
+        return 0;
+      switch (k->pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+        case PKT_PUBLIC_SUBKEY: kind = MERGED_KEY; break;
+        case PKT_USER_ID:       kind = MERGED_UID; break;
+        case PKT_SIGNATURE:     kind = MERGED_SIG; break;
+        default:                kind = MERGED_OTHER; break;
+        }
+      if ((ce->nodes[n] & 0xf0) != kind)
+        return 0;
+    }
+  if (n != ce->nnodes)
+    return 0;
+
+  nkeys = nuids = 0;
+  for (k = keyblock, n = 0; k; k = k->next, n++)
+    {
+      switch (ce->nodes[n] & 0xf0)
+        {
+        case MERGED_KEY:
+          {
+            PKT_public_key *pk = k->pkt->pkt.public_key;
+            struct merged_key_s *mk = ce->keys + nkeys++;
+
+            pk->expiredate = mk->expiredate;
+            pk->has_expired = mk->has_expired;
+            pk->main_keyid[0] = mk->main_keyid[0];
+            pk->main_keyid[1] = mk->main_keyid[1];
+            pk->revoked = mk->revoked;
+            pk->selfsigversion = mk->selfsigversion;
+            pk->pubkey_usage = mk->pubkey_usage;
+            pk->flags.mdc = mk->mdc;
+            pk->flags.revoked = mk->revoked_flag;
+            pk->flags.maybe_revoked = mk->maybe_revoked;
+            pk->flags.valid = mk->valid;
+            pk->flags.backsig = mk->backsig;
+            xfree (pk->prefs);
+            pk->prefs = copy_prefs (mk->prefs);
+            xfree (pk->revkey);
+            pk->revkey = NULL;
+            pk->numrevkeys = 0;
+            if (mk->numrevkeys)
+              {
+                pk->revkey = xmalloc (mk->numrevkeys * sizeof *pk->revkey);
+                memcpy (pk->revkey, mk->revkey,
+                        mk->numrevkeys * sizeof *pk->revkey);
+                pk->numrevkeys = mk->numrevkeys;
+              }
+          }
+          break;
+
+        case MERGED_UID:
+          {
+            PKT_user_id *uid = k->pkt->pkt.user_id;
+            struct merged_uid_s *mu = ce->uids + nuids++;
+
+            uid->help_key_usage = mu->help_key_usage;
+            uid->help_key_expire = mu->help_key_expire;
+            uid->is_primary = mu->is_primary;
+            uid->is_revoked = mu->is_revoked;
+            uid->is_expired = mu->is_expired;
+            uid->expiredate = mu->expiredate;
+            uid->created = mu->created;
+            uid->selfsigversion = mu->selfsigversion;
+            uid->flags.mdc = mu->mdc;
+            uid->flags.ks_modify = mu->ks_modify;
+            xfree (uid->prefs);
+            uid->prefs = copy_prefs (mu->prefs);
+          }
+          break;
+
+        case MERGED_SIG:
+          {
+            PKT_signature *sig = k->pkt->pkt.signature;
+
+            sig->flags.checked = !!(ce->nodes[n] & MERGED_CHECKED);
+            sig->flags.valid = !!(ce->nodes[n] & MERGED_VALID);
+            sig->flags.chosen_selfsig = !!(ce->nodes[n] & MERGED_CHOSEN);
+          }
+          break;
+        }
+    }
+  return 1;
+}
+
+
+/* Same as merge_selfsigs for a KEYBLOCK just read from the key
+   database, but use and fill the merge cache if the DIGEST of its
+   image is given.  */
+static void
+merge_selfsigs_cached (kbnode_t keyblock, const byte *digest)
+{
+  merge_cache_entry_t ce;
+  u32 now;
+
+  if (!digest || opt.no_sig_cache
+      || keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    {
+      merge_selfsigs (keyblock);
+      return;
+    }
+
+  now = make_timestamp ();
+  ce = merge_cache_lookup (digest, now);
+  if (ce && merge_cache_apply (ce, keyblock))
+    {
+      if (DBG_CACHE)
+        log_debug ("merge_selfsigs: using cached result\n");
+      return;
+    }
+  if (ce)
+    merge_cache_drop (ce);
+
+  merge_used_other_keys = 0;
+  merge_selfsigs (keyblock);
+  if (merge_used_other_keys)
+    return;
+  ce = merge_cache_new (keyblock, digest, now);
+  if (ce)
+    merge_cache_put (ce);
+}
+
+
+
 
 /* See whether the key fits our requirements and in case we do not
  * request the primary key, select a suitable subkey.
@@ -2572,6 +3258,7 @@ lookup (getkey_ctx_t ctx, kbnode_t *ret_keyblock, int want_secret)
 {
   int rc;
   int no_suitable_key = 0;
+  byte digest[20];
 
   for (;;)
     {
@@ -2608,7 +3295,18 @@ lookup (getkey_ctx_t ctx, kbnode_t *ret_keyblock, int want_secret)
       /* Warning: node flag bits 0 and 1 should be preserved by
        * merge_selfsigs.  For secret keys, premerge did tranfer the
        * keys to the keyblock.  */
-      merge_selfsigs (ctx->keyblock);
+      merge_selfsigs_cached (ctx->keyblock,
+                             keydb_get_keyblock_digest (ctx->kr_handle,
+                                                        digest)? digest : NULL);
+
+      /* Store the results of the self-signature checks so that they
+         need not be verified again the next time the key is used.  */
+      rc = keydb_store_sigstatus (ctx->kr_handle, ctx->keyblock);
+      if (rc && DBG_LOOKUP)
+        log_debug ("storing the signature status failed: %s\n",
+                   gpg_strerror (rc));
+      rc = 0;
+
       if (finish_lookup (ctx))
 	{
 	  no_suitable_key = 0;
@@ -2780,39 +3478,35 @@ get_user_id_string (u32 * keyid, int mode, size_t *r_len)
   /* Try it two times; second pass reads from key resources.  */
   do
     {
-      for (r = user_id_db; r; r = r->next)
-	{
-	  for (a = r->keyids; a; a = a->next)
-	    {
-	      if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
-		{
-                  if (mode == 2)
-                    {
-                      /* An empty string as user id is possible.  Make
-                         sure that the malloc allocates one byte and
-                         does not bail out.  */
-                      p = xmalloc (r->len? r->len : 1);
-                      memcpy (p, r->name, r->len);
-                      if (r_len)
-                        *r_len = r->len;
-                    }
-                  else
-                    {
-                      if (mode)
-                        p = xasprintf ("%08lX%08lX %.*s",
-                                       (ulong) keyid[0], (ulong) keyid[1],
-                                       r->len, r->name);
-                      else
-                        p = xasprintf ("%s %.*s", keystr (keyid),
-                                       r->len, r->name);
-                      if (r_len)
-                        *r_len = strlen (p);
-                    }
+      a = uid_cache_lookup (keyid, NULL);
+      if (a)
+        {
+          r = a->uid;
+          if (mode == 2)
+            {
+              /* An empty string as user id is possible.  Make sure
+                 that the malloc allocates one byte and does not bail
+                 out.  */
+              p = xmalloc (r->len? r->len : 1);
+              memcpy (p, r->name, r->len);
+              if (r_len)
+                *r_len = r->len;
+            }
+          else
+            {
+              if (mode)
+                p = xasprintf ("%08lX%08lX %.*s",
+                               (ulong) keyid[0], (ulong) keyid[1],
+                               r->len, r->name);
+              else
+                p = xasprintf ("%s %.*s", keystr (keyid),
+                               r->len, r->name);
+              if (r_len)
+                *r_len = strlen (p);
+            }
 
-                  return p;
-		}
-	    }
-	}
+          return p;
+        }
     }
   while (++pass < 2 && !get_pubkey (NULL, keyid));
 
@@ -2878,23 +3572,18 @@ get_user_id_byfpr (const byte *fpr, size_t *rn)
   /* Try it two times; second pass reads from key resources.  */
   do
     {
-      for (r = user_id_db; r; r = r->next)
-	{
-	  keyid_list_t a;
-	  for (a = r->keyids; a; a = a->next)
-	    {
-	      if (!memcmp (a->fpr, fpr, MAX_FINGERPRINT_LEN))
-		{
-                  /* An empty string as user id is possible.  Make
-                     sure that the malloc allocates one byte and does
-                     not bail out.  */
-		  p = xmalloc (r->len? r->len : 1);
-		  memcpy (p, r->name, r->len);
-		  *rn = r->len;
-		  return p;
-		}
-	    }
-	}
+      keyid_list_t a = uid_cache_lookup (NULL, (const char *)fpr);
+
+      if (a)
+        {
+          r = a->uid;
+          /* An empty string as user id is possible.  Make sure that
+             the malloc allocates one byte and does not bail out.  */
+          p = xmalloc (r->len? r->len : 1);
+          memcpy (p, r->name, r->len);
+          *rn = r->len;
+          return p;
+        }
     }
   while (++pass < 2 && !get_pubkey_byfpr (NULL, fpr));
   p = xstrdup (user_id_not_found_utf8 ());
@@ -116,6 +116,8 @@ enum cmd_and_opt_values
     aLSignKey,
     aQuickSignKey,
     aQuickLSignKey,
+    aQuickSignKeys,
+    aQuickLSignKeys,
     aQuickAddUid,
     aListConfig,
     aListGcryptConfig,
@@ -130,6 +132,7 @@ enum cmd_and_opt_values
     aFastImport,
     aVerify,
     aVerifyFiles,
+    aVerifyDetachedFiles,
     aListSigs,
     aSendKeys,
     aRecvKeys,
@@ -198,6 +201,7 @@ enum cmd_and_opt_values
     oDebugLevel,
     oDebugAll,
     oDebugIOLBF,
+    oDebugStats,
     oStatusFD,
     oStatusFile,
     oAttributeFD,
@@ -207,6 +211,15 @@ enum cmd_and_opt_values
     oCompletesNeeded,
     oMarginalsNeeded,
     oMaxCertDepth,
+    oKeyblockCacheSize,
+    oKeyCacheSize,
+    oSigCheckThreads,
+    oTrustdbMmap,
+    oMmapInput,
+    oIOBufSize,
+    oCompressThreads,
+    oCipherPipeline,
+    oMaxBufferMemory,
     oLoadExtension,
     oGnuPG,
     oRFC2440,
@@ -405,6 +418,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_c (aDecryptFiles, "decrypt-files", "@"),
   ARGPARSE_c (aVerify, "verify"   , N_("verify a signature")),
   ARGPARSE_c (aVerifyFiles, "verify-files" , "@" ),
+  ARGPARSE_c (aVerifyDetachedFiles, "verify-detached-files" , "@" ),
   ARGPARSE_c (aListKeys, "list-keys", N_("list keys")),
   ARGPARSE_c (aListKeys, "list-public-keys", "@" ),
   ARGPARSE_c (aListSigs, "list-sigs", N_("list keys and signatures")),
@@ -428,6 +442,8 @@ static ARGPARSE_OPTS opts[] = {
               N_("quickly sign a key")),
   ARGPARSE_c (aQuickLSignKey, "quick-lsign-key",
               N_("quickly sign a key locally")),
+  ARGPARSE_c (aQuickSignKeys,  "quick-sign-keys", "@"),
+  ARGPARSE_c (aQuickLSignKeys, "quick-lsign-keys", "@"),
   ARGPARSE_c (aSignKey,  "sign-key"   ,N_("sign a key")),
   ARGPARSE_c (aLSignKey, "lsign-key"  ,N_("sign a key locally")),
   ARGPARSE_c (aEditKey,  "edit-key"   ,N_("sign or edit a key")),
@@ -561,6 +577,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_s (oDebugLevel, "debug-level", "@"),
   ARGPARSE_s_n (oDebugAll, "debug-all", "@"),
   ARGPARSE_s_n (oDebugIOLBF, "debug-iolbf", "@"),
+  ARGPARSE_s_n (oDebugStats, "debug-stats", "@"),
   ARGPARSE_s_i (oStatusFD, "status-fd", "@"),
   ARGPARSE_s_s (oStatusFile, "status-file", "@"),
   ARGPARSE_s_i (oAttributeFD, "attribute-fd", "@"),
@@ -569,6 +586,15 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_i (oCompletesNeeded, "completes-needed", "@"),
   ARGPARSE_s_i (oMarginalsNeeded, "marginals-needed", "@"),
   ARGPARSE_s_i (oMaxCertDepth,	"max-cert-depth", "@" ),
+  ARGPARSE_s_i (oKeyblockCacheSize, "keyblock-cache-size", "@"),
+  ARGPARSE_s_i (oKeyCacheSize, "key-cache-size", "@"),
+  ARGPARSE_s_i (oSigCheckThreads, "sig-check-threads", "@"),
+  ARGPARSE_s_n (oTrustdbMmap, "trustdb-mmap", "@"),
+  ARGPARSE_s_n (oMmapInput, "mmap-input", "@"),
+  ARGPARSE_s_i (oIOBufSize, "iobuf-size", "@"),
+  ARGPARSE_s_i (oCompressThreads, "compress-threads", "@"),
+  ARGPARSE_s_n (oCipherPipeline, "cipher-pipeline", "@"),
+  ARGPARSE_s_u (oMaxBufferMemory, "max-buffer-memory", "@"),
   ARGPARSE_s_s (oTrustedKey, "trusted-key", "@"),
 
   ARGPARSE_s_s (oLoadExtension, "load-extension", "@"),  /* Dummy.  */
@@ -2125,6 +2151,7 @@ main (int argc, char **argv)
     opt.completes_needed = 1;
     opt.marginals_needed = 3;
     opt.max_cert_depth = 5;
+    opt.keyblock_cache_size = DEFAULT_KEYBLOCK_CACHE_SIZE;
     opt.escape_from = 1;
     opt.flags.require_cross_cert = 1;
     opt.import_options = 0;
@@ -2326,6 +2353,8 @@ main (int argc, char **argv)
 	  case aSign:
 	  case aQuickSignKey:
 	  case aQuickLSignKey:
+	  case aQuickSignKeys:
+	  case aQuickLSignKeys:
 	  case aSignKey:
 	  case aLSignKey:
 	  case aStore:
@@ -2359,6 +2388,8 @@ main (int argc, char **argv)
 	  case aVerifyFiles: multifile=1; /* fall through */
 	  case aVerify: set_cmd( &cmd, aVerify); break;
 
+	  case aVerifyDetachedFiles: set_cmd (&cmd, aVerifyDetachedFiles); break;
+
           case aServer:
             set_cmd (&cmd, pargs.r_opt);
             opt.batch = 1;
@@ -2426,6 +2457,7 @@ main (int argc, char **argv)
           case oDebugLevel: debug_level = pargs.r.ret_str; break;
 
           case oDebugIOLBF: break; /* Already set in pre-parse step.  */
+          case oDebugStats: opt.debug_stats = 1; break;
 
 	  case oStatusFD:
             set_status_fd ( translate_sys2libc_fd_int (pargs.r.ret_int, 1) );
@@ -2494,6 +2526,26 @@ main (int argc, char **argv)
 	  case oCompletesNeeded: opt.completes_needed = pargs.r.ret_int; break;
 	  case oMarginalsNeeded: opt.marginals_needed = pargs.r.ret_int; break;
 	  case oMaxCertDepth: opt.max_cert_depth = pargs.r.ret_int; break;
+	  case oKeyblockCacheSize:
+            opt.keyblock_cache_size = pargs.r.ret_int;
+            break;
+	  case oKeyCacheSize: opt.key_cache_size = pargs.r.ret_int; break;
+	  case oSigCheckThreads:
+            opt.sig_check_threads = pargs.r.ret_int;
+            break;
+	  case oTrustdbMmap: opt.trustdb_mmap = 1; break;
+	  case oMmapInput: iobuf_enable_mmap (1); break;
+	  case oIOBufSize:
+            iobuf_set_default_buffer_size (pargs.r.ret_int > 0
+                                           ? pargs.r.ret_int : 0);
+            break;
+	  case oCompressThreads:
+            opt.compress_threads = pargs.r.ret_int? pargs.r.ret_int : -1;
+            break;
+	  case oCipherPipeline: opt.cipher_pipeline = 1; break;
+	  case oMaxBufferMemory:
+            iobuf_set_memory_limit (pargs.r.ret_ulong);
+            break;
 
 #ifndef NO_TRUST_MODELS
 	  case oTrustDBName: trustdb_name = pargs.r.ret_str; break;
@@ -3300,6 +3352,8 @@ main (int argc, char **argv)
     set_debug (debug_level);
     if (DBG_CLOCK)
       log_clock ("start");
+    if (opt.debug_stats)
+      stats_init ();
 
     /* Do these after the switch(), so they can override settings. */
     if(PGP6)
@@ -3404,7 +3458,7 @@ main (int argc, char **argv)
 	switch(cmd)
 	  {
 	  case aSign:
-	    cmdname="--sign";
+	    cmdname = detached_sig? NULL : "--sign";
 	    break;
 	  case aClearsign:
 	    cmdname="--clearsign";
@@ -3528,6 +3582,11 @@ main (int argc, char **argv)
                                 KEYDB_RESOURCE_FLAG_DEFAULT);
 	for (sl = nrings; sl; sl = sl->next )
           keydb_add_resource (sl->d, sl->flags);
+        /* The keyrings are only opened when they are first used.
+           Under SELinux they must be registered as secured files
+           right away.  */
+        if (ALWAYS_ADD_KEYRINGS)
+          keydb_open_resources ();
       }
     FREE_STRLIST(nrings);
 
@@ -3686,6 +3745,11 @@ main (int argc, char **argv)
 
       case aSign: /* sign the given file */
 	sl = NULL;
+	if (multifile && detached_sig) /* one signature file per file */
+	  {
+	    sign_files (ctrl, argc, argv, locusr);
+	    break;
+	  }
 	if( detached_sig ) { /* sign all files */
 	    for( ; argc; argc--, argv++ )
 		add_to_strlist( &sl, *argv );
@@ -3698,7 +3762,8 @@ main (int argc, char **argv)
 		strcpy(sl->d, fname);
 	    }
 	}
-	if( (rc = sign_file (ctrl, sl, detached_sig, locusr, 0, NULL, NULL)) )
+	if( (rc = sign_file (ctrl, sl, detached_sig, locusr, 0, NULL, NULL,
+			     -1, -1)) )
 	    log_error("signing failed: %s\n", gpg_strerror (rc) );
 	free_strlist(sl);
 	break;
@@ -3712,7 +3777,8 @@ main (int argc, char **argv)
 	}
 	else
 	    sl = NULL;
-	if ((rc = sign_file (ctrl, sl, detached_sig, locusr, 1, remusr, NULL)))
+	if ((rc = sign_file (ctrl, sl, detached_sig, locusr, 1, remusr, NULL,
+			     -1, -1)))
 	    log_error("%s: sign+encrypt failed: %s\n",
 		      print_fname_stdin(fname), gpg_strerror (rc) );
 	free_strlist(sl);
@@ -3737,7 +3803,7 @@ main (int argc, char **argv)
 	    else
 	      sl = NULL;
 	    if ((rc = sign_file (ctrl, sl, detached_sig, locusr,
-                                 2, remusr, NULL)))
+                                 2, remusr, NULL, -1, -1)))
 	      log_error("%s: symmetric+sign+encrypt failed: %s\n",
 			print_fname_stdin(fname), gpg_strerror (rc) );
 	    free_strlist(sl);
@@ -3774,6 +3840,11 @@ main (int argc, char **argv)
 	  }
 	break;
 
+      case aVerifyDetachedFiles:
+        if ((rc = verify_detached_files (ctrl, argc, argv)))
+          log_error ("verify files failed: %s\n", gpg_strerror (rc));
+        break;
+
       case aDecrypt:
         if (multifile)
 	  decrypt_messages (ctrl, argc, argv);
@@ -3802,6 +3873,14 @@ main (int argc, char **argv)
         }
 	break;
 
+      case aQuickSignKeys:
+      case aQuickLSignKeys:
+        if (argc > 1)
+          wrong_args ("--quick-[l]sign-keys [file]");
+        keyedit_quick_sign_keys (ctrl, argc? *argv : NULL, locusr,
+                                 (cmd == aQuickLSignKeys));
+	break;
+
       case aSignKey:
 	if( argc != 1 )
 	  wrong_args(_("--sign-key user-id"));
@@ -4328,8 +4407,10 @@ g10_exit( int rc )
   gcry_control (GCRYCTL_UPDATE_RANDOM_SEED_FILE);
   if (DBG_CLOCK)
     log_clock ("stop");
+  stats_dump ();
   if ( (opt.debug & DBG_MEMSTAT_VALUE) )
     {
+      keydb_dump_stats ();
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
@@ -4455,25 +4536,18 @@ print_hashline( gcry_md_hd_t md, int algo, const char *fname )
 static void
 print_mds( const char *fname, int algo )
 {
-  estream_t fp;
-  char buf[1024];
-  size_t n;
+  iobuf_t fp;
+  const byte *buf;
+  int n;
   gcry_md_hd_t md;
 
-  if (!fname)
+  /* A regular file is mapped so that we hash it without copying.  */
+  fp = iobuf_open_mmap (fname);
+  if (fp && is_secured_file (iobuf_get_fd (fp)))
     {
-      fp = es_stdin;
-      es_set_binary (fp);
-    }
-  else
-    {
-      fp = es_fopen (fname, "rb" );
-      if (fp && is_secured_file (es_fileno (fp)))
-        {
-          es_fclose (fp);
-          fp = NULL;
-          gpg_err_set_errno (EPERM);
-        }
+      iobuf_close (fp);
+      fp = NULL;
+      gpg_err_set_errno (EPERM);
     }
   if (!fp)
     {
@@ -4501,11 +4575,12 @@ print_mds( const char *fname, int algo )
         gcry_md_enable (md, GCRY_MD_SHA512);
     }
 
-  while ((n=es_fread (buf, 1, DIM(buf), fp)))
+  while ((n = iobuf_read_direct (fp, &buf, 65536)) != -1)
     gcry_md_write (md, buf, n);
 
-  if (es_ferror(fp))
-    log_error ("%s: %s\n", fname?fname:"[stdin]", strerror(errno));
+  if (iobuf_error (fp))
+    log_error ("%s: %s\n", fname?fname:"[stdin]",
+               gpg_strerror (iobuf_error (fp)));
   else
     {
       gcry_md_final (md);
@@ -4554,8 +4629,7 @@ print_mds( const char *fname, int algo )
     }
   gcry_md_close (md);
 
-  if (fp != es_stdin)
-    es_fclose (fp);
+  iobuf_close (fp);
 }
 
 
@@ -165,6 +165,7 @@ main( int argc, char **argv )
   opt.keyserver_options.options |= KEYSERVER_AUTO_KEY_RETRIEVE;
   opt.trust_model = TM_ALWAYS;
   opt.batch = 1;
+  opt.keyblock_cache_size = DEFAULT_KEYBLOCK_CACHE_SIZE;
 
   opt.homedir = default_homedir ();
 
@@ -591,3 +592,79 @@ gpg_dirmngr_get_pka (ctrl_t ctrl, const char *userid,
     *r_url = NULL;
   return gpg_error (GPG_ERR_NOT_FOUND);
 }
+
+int
+sig_queue_threads (void)
+{
+  return 1;
+}
+
+sig_queue_t
+sig_queue_new (void)
+{
+  return NULL;
+}
+
+void
+sig_queue_release (sig_queue_t queue)
+{
+  (void)queue;
+}
+
+void
+sig_queue_add_keyblock (sig_queue_t queue, kbnode_t keyblock)
+{
+  (void)queue;
+  (void)keyblock;
+}
+
+void
+sig_queue_run (sig_queue_t queue)
+{
+  (void)queue;
+}
+
+void
+hash_datafiles_parallel (struct datafile_hash_s *jobs, int njobs,
+                         int nthreads)
+{
+  int i;
+
+  (void)nthreads;
+  for (i=0; i < njobs; i++)
+    if (jobs[i].inp)
+      hash_datafile_job (&jobs[i]);
+}
+
+struct compress_mt_s *
+compress_mt_new (int algo, int level)
+{
+  (void)algo;
+  (void)level;
+  return NULL;
+}
+
+void
+compress_mt_release (struct compress_mt_s *mt)
+{
+  (void)mt;
+}
+
+int
+compress_mt_write (struct compress_mt_s *mt, const byte *buf, size_t size,
+                   iobuf_t a)
+{
+  (void)mt;
+  (void)buf;
+  (void)size;
+  (void)a;
+  return 0;
+}
+
+int
+compress_mt_finish (struct compress_mt_s *mt, iobuf_t a)
+{
+  (void)mt;
+  (void)a;
+  return 0;
+}
@@ -40,6 +40,15 @@
 #include "call-agent.h"
 #include "../common/membuf.h"
 
+/* The number of keyblocks read ahead to check their self-signatures
+   in parallel and, with the bulk-import option, to look them up in
+   one search.  */
+#define IMPORT_BATCH_SIZE 64
+
+/* We stop reading ahead once the batch has this many packets; this
+   bounds the memory used for dumps with huge keyblocks.  */
+#define IMPORT_BATCH_MAX_PACKETS 100000
+
 struct stats_s
 {
   ulong count;
@@ -72,7 +81,8 @@ static int import_one (ctrl_t ctrl,
                        const char *fname, kbnode_t keyblock,struct stats_s *stats,
                        unsigned char **fpr, size_t *fpr_len,
                        unsigned int options, int from_sk, int silent,
-                       import_screener_t screener, void *screener_arg);
+                       import_screener_t screener, void *screener_arg,
+                       KEYDB_HANDLE bulk_hd, int known_new);
 static int import_secret_one (ctrl_t ctrl, const char *fname, kbnode_t keyblock,
                               struct stats_s *stats, int batch,
                               unsigned int options, int for_migration,
@@ -121,6 +131,9 @@ parse_import_options(char *str,unsigned int *options,int noisy)
       {"import-minimal",IMPORT_MINIMAL|IMPORT_CLEAN,NULL,
        N_("remove as much as possible from key after import")},
 
+      {"bulk-import",IMPORT_BULK,NULL,
+       N_("lock the keyring once and look up keys in batches")},
+
       /* Aliases for backward compatibility */
       {"allow-local-sigs",IMPORT_LOCAL_SIGS,NULL,NULL},
       {"repair-hkp-subkey-bug",IMPORT_REPAIR_PKS_SUBKEY_BUG,NULL,NULL},
@@ -298,6 +311,88 @@ import_keys_es_stream (ctrl_t ctrl, estream_t fp, void *stats_handle,
 }
 
 
+/* Find out which of the NBATCH public keyblocks in BATCH are not yet
+   in the keydb with a single search using HD.  IS_NEW[i] is set for
+   such a keyblock unless another one in the batch has a key with the
+   same fingerprint; these need the regular lookup because an earlier
+   keyblock may have been imported in the meantime.  On error no key
+   is marked as new.  */
+static void
+lookup_batch (KEYDB_HANDLE hd, kbnode_t *batch, int nbatch, int *is_new)
+{
+  KEYDB_SEARCH_DESC desc[IMPORT_BATCH_SIZE];
+  int map[IMPORT_BATCH_SIZE];
+  byte (*fprs)[MAX_FINGERPRINT_LEN] = NULL;
+  int nfprs = 0;
+  int maxfprs = 0;
+  kbnode_t node;
+  size_t an, descindex;
+  int i, j, k, ndesc;
+  gpg_error_t err;
+
+  /* Collect the fingerprints of all keys in the batch.  */
+  for (i=0; i < nbatch; i++)
+    {
+      is_new[i] = 0;
+      if (batch[i]->pkt->pkttype != PKT_PUBLIC_KEY)
+        continue;
+      for (node = batch[i]; node; node = node->next)
+        {
+          if (node->pkt->pkttype != PKT_PUBLIC_KEY
+              && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+            continue;
+          if (nfprs == maxfprs)
+            {
+              maxfprs = maxfprs? 2 * maxfprs : 4 * IMPORT_BATCH_SIZE;
+              fprs = xrealloc (fprs, maxfprs * sizeof *fprs);
+            }
+          fingerprint_from_pk (node->pkt->pkt.public_key, fprs[nfprs], &an);
+          for (; an < MAX_FINGERPRINT_LEN; an++)
+            fprs[nfprs][an] = 0;
+          nfprs++;
+        }
+    }
+
+  /* Build a search for each primary key whose fingerprint is unique
+     in the batch.  */
+  for (i=k=ndesc=0; i < nbatch; i++)
+    {
+      if (batch[i]->pkt->pkttype != PKT_PUBLIC_KEY)
+        continue;
+      memset (&desc[ndesc], 0, sizeof *desc);
+      desc[ndesc].mode = KEYDB_SEARCH_MODE_FPR;
+      memcpy (desc[ndesc].u.fpr, fprs[k], MAX_FINGERPRINT_LEN);
+      for (j=0; j < nfprs; j++)
+        if (j != k && !memcmp (fprs[j], fprs[k], MAX_FINGERPRINT_LEN))
+          break;
+      if (j == nfprs)
+        {
+          is_new[i] = 1;
+          map[ndesc++] = i;
+        }
+      /* Skip to the primary key of the next keyblock.  */
+      for (node = batch[i]; node; node = node->next)
+        if (node->pkt->pkttype == PKT_PUBLIC_KEY
+            || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+          k++;
+    }
+  xfree (fprs);
+
+  if (!ndesc)
+    return;
+  err = keydb_search_reset (hd);
+  while (!err && !(err = keydb_search (hd, desc, ndesc, &descindex)))
+    if (descindex < ndesc)
+      is_new[map[descindex]] = 0;
+  if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    {
+      log_error ("batch lookup failed: %s\n", gpg_strerror (err));
+      for (i=0; i < nbatch; i++)
+        is_new[i] = 0;
+    }
+}
+
+
 static int
 import (ctrl_t ctrl, IOBUF inp, const char* fname,struct stats_s *stats,
 	unsigned char **fpr,size_t *fpr_len, unsigned int options,
@@ -307,8 +402,17 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct stats_s *stats,
   kbnode_t keyblock = NULL;  /* Need to initialize because gcc can't
                                 grasp the return semantics of
                                 read_block. */
+  kbnode_t batch[IMPORT_BATCH_SIZE];
+  int batch_v3keys[IMPORT_BATCH_SIZE];
+  int batch_new[IMPORT_BATCH_SIZE];
+  int nbatch, nread, npackets, i;
+  kbnode_t node;
+  sig_queue_t queue = NULL;
+  KEYDB_HANDLE bulk_hd = NULL;
   int rc = 0;
-  int v3keys;
+  int readrc = 0;
+  int v3keys = 0;
+  int read_v3keys = 0;
 
   getkey_disable_caches ();
 
@@ -322,41 +426,105 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct stats_s *stats,
       release_armor_context (afx);
     }
 
-  while (!(rc = read_block (inp, &pending_pkt, &keyblock, &v3keys)))
-    {
-      stats->v3keys += v3keys;
-      if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
-        rc = import_one (ctrl, fname, keyblock,
-                         stats, fpr, fpr_len, options, 0, 0,
-                         screener, screener_arg);
-      else if (keyblock->pkt->pkttype == PKT_SECRET_KEY)
-        rc = import_secret_one (ctrl, fname, keyblock, stats,
-                                opt.batch, options, 0,
-                                screener, screener_arg);
-      else if (keyblock->pkt->pkttype == PKT_SIGNATURE
-               && keyblock->pkt->pkt.signature->sig_class == 0x20 )
-        rc = import_revoke_cert( fname, keyblock, stats );
-      else
+  /* With several threads we read a batch of keyblocks ahead and check
+     their self-signatures together.  Repairing the PKS subkey bug
+     moves signatures around and the interactive mode lists the key
+     first; both need the plain serial checks.  */
+  if (sig_queue_threads () > 1 && !opt.no_sig_cache && !opt.interactive
+      && !(options & IMPORT_REPAIR_PKS_SUBKEY_BUG))
+    queue = sig_queue_new ();
+
+  /* For a bulk import all keys are looked up and written with one
+     handle, which keeps the keyrings locked until the end.  */
+  if ((options & IMPORT_BULK) && !opt.dry_run)
+    {
+      bulk_hd = keydb_new ();
+      keydb_disable_caching (bulk_hd);
+      rc = keydb_lock (bulk_hd);
+      if (rc)
         {
-          log_info (_("skipping block of type %d\n"), keyblock->pkt->pkttype);
-	}
-      release_kbnode (keyblock);
+          log_error (_("can't lock the keyring for a bulk import: %s\n"),
+                     gpg_strerror (rc));
+          keydb_release (bulk_hd);
+          return rc;
+        }
+    }
+  nbatch = (queue || bulk_hd)? IMPORT_BATCH_SIZE : 1;
 
-      /* fixme: we should increment the not imported counter but
-         this does only make sense if we keep on going despite of
-         errors.  For now we do this only if the imported key is too
-         large. */
-      if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
-            && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
+  do
+    {
+      npackets = 0;
+      for (nread=0; nread < nbatch && npackets < IMPORT_BATCH_MAX_PACKETS;
+           nread++)
         {
-          stats->not_imported++;
-          rc = 0;
+          readrc = read_block (inp, &pending_pkt, &keyblock, &read_v3keys);
+          if (readrc)
+            break;
+          batch[nread] = keyblock;
+          batch_v3keys[nread] = read_v3keys;
+          for (node = keyblock; node; node = node->next)
+            npackets++;
+          if (queue)
+            sig_queue_add_keyblock (queue, keyblock);
         }
-      else if (rc)
-        break;
+      if (queue)
+        sig_queue_run (queue);
+      if (bulk_hd)
+        lookup_batch (bulk_hd, batch, nread, batch_new);
+      else
+        memset (batch_new, 0, sizeof batch_new);
+
+      for (i=0; i < nread && !rc; i++)
+        {
+          keyblock = batch[i];
+          v3keys = batch_v3keys[i];
+          stats->v3keys += v3keys;
+          if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
+            rc = import_one (ctrl, fname, keyblock,
+                             stats, fpr, fpr_len, options, 0, 0,
+                             screener, screener_arg, bulk_hd, batch_new[i]);
+          else if (keyblock->pkt->pkttype == PKT_SECRET_KEY)
+            rc = import_secret_one (ctrl, fname, keyblock, stats,
+                                    opt.batch, options, 0,
+                                    screener, screener_arg);
+          else if (keyblock->pkt->pkttype == PKT_SIGNATURE
+                   && keyblock->pkt->pkt.signature->sig_class == 0x20 )
+            rc = import_revoke_cert( fname, keyblock, stats );
+          else
+            {
+              log_info (_("skipping block of type %d\n"),
+                        keyblock->pkt->pkttype);
+            }
+          release_kbnode (keyblock);
+
+          /* fixme: we should increment the not imported counter but
+             this does only make sense if we keep on going despite of
+             errors.  For now we do this only if the imported key is too
+             large. */
+          if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
+              && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
+            {
+              stats->not_imported++;
+              rc = 0;
+            }
+          else if (rc)
+            break;
+
+          if (!(++stats->count % 100) && !opt.quiet)
+            log_info (_("%lu keys processed so far\n"), stats->count );
+        }
+      /* Release what we read ahead of an error.  */
+      for (i++; i < nread; i++)
+        release_kbnode (batch[i]);
+    }
+  while (!rc && !readrc);
 
-      if (!(++stats->count % 100) && !opt.quiet)
-        log_info (_("%lu keys processed so far\n"), stats->count );
+  sig_queue_release (queue);
+  keydb_release (bulk_hd);
+  if (!rc)
+    {
+      rc = readrc;
+      v3keys = read_v3keys;
     }
   stats->v3keys += v3keys;
   if (rc == -1)
@@ -539,8 +707,7 @@ read_block( IOBUF a, PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
   else
     in_cert = 0;
 
-  pkt = xmalloc (sizeof *pkt);
-  init_packet (pkt);
+  pkt = alloc_packet ();
   in_v3key = 0;
   while ((rc=parse_packet(a, pkt)) != -1)
     {
@@ -629,7 +796,7 @@ read_block( IOBUF a, PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
                   root = new_kbnode (pkt);
 		else
                   add_kbnode (root, new_kbnode (pkt));
-		pkt = xmalloc (sizeof *pkt);
+		pkt = alloc_packet ();
               }
 	    init_packet(pkt);
 	    break;
@@ -644,8 +811,7 @@ read_block( IOBUF a, PACKET **pending_pkt, kbnode_t *ret_root, int *r_v3keys)
     release_kbnode( root );
   else
     *ret_root = root;
-  free_packet( pkt );
-  xfree( pkt );
+  release_packet (pkt);
   return rc;
 }
 
@@ -935,7 +1101,8 @@ import_one (ctrl_t ctrl,
             const char *fname, kbnode_t keyblock, struct stats_s *stats,
 	    unsigned char **fpr, size_t *fpr_len, unsigned int options,
 	    int from_sk, int silent,
-            import_screener_t screener, void *screener_arg)
+            import_screener_t screener, void *screener_arg,
+            KEYDB_HANDLE bulk_hd, int known_new)
 {
   PKT_public_key *pk;
   PKT_public_key *pk_orig;
@@ -1054,7 +1221,10 @@ import_one (ctrl_t ctrl,
 
   /* Do we have this key already in one of our pubrings ? */
   pk_orig = xmalloc_clear( sizeof *pk_orig );
-  rc = get_pubkey_byfprint_fast (pk_orig, fpr2, fpr2len);
+  if (known_new)
+    rc = GPG_ERR_NO_PUBKEY;  /* Our caller already looked it up.  */
+  else
+    rc = get_pubkey_byfprint_fast (pk_orig, fpr2, fpr2len);
   if (rc && gpg_err_code (rc) != GPG_ERR_NO_PUBKEY
       && gpg_err_code (rc) != GPG_ERR_UNUSABLE_PUBKEY )
     {
@@ -1071,13 +1241,14 @@ import_one (ctrl_t ctrl,
     }
   else if (rc )  /* Insert this key. */
     {
-      KEYDB_HANDLE hd = keydb_new ();
+      KEYDB_HANDLE hd = bulk_hd? bulk_hd : keydb_new ();
 
       rc = keydb_locate_writable (hd, NULL);
       if (rc)
         {
           log_error (_("no writable keyring found: %s\n"), gpg_strerror (rc));
-          keydb_release (hd);
+          if (hd != bulk_hd)
+            keydb_release (hd);
           return GPG_ERR_GENERAL;
 	}
       if (opt.verbose > 1 )
@@ -1097,9 +1268,10 @@ import_one (ctrl_t ctrl,
 
           clear_ownertrusts (pk);
           if (non_self)
-            revalidation_mark ();
+            revalidation_mark_key (pk);
         }
-      keydb_release (hd);
+      if (hd != bulk_hd)
+        keydb_release (hd);
 
       /* We are ready.  */
       if (!opt.quiet && !silent)
@@ -1135,14 +1307,23 @@ import_one (ctrl_t ctrl,
 
       /* Now read the original keyblock again so that we can use
          that handle for updating the keyblock.  */
-      hd = keydb_new ();
-      keydb_disable_caching (hd);
+      if (bulk_hd)
+        {
+          hd = bulk_hd;
+          keydb_search_reset (hd);
+        }
+      else
+        {
+          hd = keydb_new ();
+          keydb_disable_caching (hd);
+        }
       rc = keydb_search_fpr (hd, fpr2);
       if (rc )
         {
           log_error (_("key %s: can't locate original keyblock: %s\n"),
                      keystr(keyid), gpg_strerror (rc));
-          keydb_release (hd);
+          if (hd != bulk_hd)
+            keydb_release (hd);
           goto leave;
         }
       rc = keydb_get_keyblock (hd, &keyblock_orig);
@@ -1150,7 +1331,8 @@ import_one (ctrl_t ctrl,
         {
           log_error (_("key %s: can't read original keyblock: %s\n"),
                      keystr(keyid), gpg_strerror (rc));
-          keydb_release (hd);
+          if (hd != bulk_hd)
+            keydb_release (hd);
           goto leave;
         }
 
@@ -1167,7 +1349,8 @@ import_one (ctrl_t ctrl,
                          keyid, &n_uids, &n_sigs, &n_subk );
       if (rc )
         {
-          keydb_release (hd);
+          if (hd != bulk_hd)
+            keydb_release (hd);
           goto leave;
         }
 
@@ -1184,7 +1367,7 @@ import_one (ctrl_t ctrl,
             log_error (_("error writing keyring '%s': %s\n"),
                        keydb_get_resource_name (hd), gpg_strerror (rc) );
           else if (non_self)
-            revalidation_mark ();
+            revalidation_mark_key (pk);
 
           /* We are ready.  */
           if (!opt.quiet && !silent)
@@ -1248,7 +1431,9 @@ import_one (ctrl_t ctrl,
           stats->unchanged++;
         }
 
-      keydb_release (hd); hd = NULL;
+      if (hd != bulk_hd)
+        keydb_release (hd);
+      hd = NULL;
     }
 
   leave:
@@ -1304,6 +1489,90 @@ import_one (ctrl_t ctrl,
 }
 
 
+/* The most keys sent to the agent in one go; this is the limit of
+   its IMPORT_KEY_BATCH command.  */
+#define MAX_TRANSFER_BATCH 64
+
+/* Send the NKEYS wrapped keys WRAPPEDKEYS of the secret keys PKS of
+   the keyblock with the primary key MAIN_PK to the gpg-agent and
+   print the result of each key.  If the agent can do so the keys are
+   sent in one go; it then asks only once for a passphrase protecting
+   more than one key.  Returns the error of the last key not already
+   present or a cancel error.  */
+static gpg_error_t
+send_secret_keys (ctrl_t ctrl, struct stats_s *stats, PKT_public_key *main_pk,
+                  PKT_public_key **pks, unsigned char **wrappedkeys,
+                  size_t *wrappedkeylens, unsigned int nkeys,
+                  char **cache_nonce_addr, int batch)
+{
+  static int no_import_batch;  /* The agent lacks IMPORT_KEY_BATCH.  */
+  gpg_error_t err = 0;
+  gpg_error_t errs[MAX_TRANSFER_BATCH];
+  PKT_public_key *pk;
+  char *desc;
+  int single;
+  unsigned int i;
+
+  single = (nkeys < 2 || no_import_batch);
+  if (!single)
+    {
+      desc = gpg_format_keydesc (main_pk, FORMAT_KEYDESC_IMPORT, 1);
+      err = agent_import_keys (ctrl, desc, cache_nonce_addr,
+                               wrappedkeys, wrappedkeylens, nkeys,
+                               batch, errs);
+      xfree (desc);
+      if (gpg_err_code (err) == GPG_ERR_ASS_UNKNOWN_CMD)
+        {
+          /* An old agent: Send one key after the other.  */
+          no_import_batch = 1;
+          single = 1;
+        }
+      else if (err)
+        for (i=0; i < nkeys; i++)
+          errs[i] = err;
+    }
+
+  for (i=0; i < nkeys; i++)
+    {
+      pk = pks[i];
+      if (single)
+        {
+          desc = gpg_format_keydesc (pk, FORMAT_KEYDESC_IMPORT, 1);
+          errs[i] = agent_import_key (ctrl, desc, cache_nonce_addr,
+                                      wrappedkeys[i], wrappedkeylens[i],
+                                      batch);
+          xfree (desc);
+        }
+      err = errs[i];
+      if (!err)
+        {
+          if (opt.verbose)
+            log_info (_("key %s: secret key imported\n"),
+                      keystr_from_pk_with_sub (main_pk, pk));
+          stats->secret_imported++;
+        }
+      else if ( gpg_err_code (err) == GPG_ERR_EEXIST )
+        {
+          if (opt.verbose)
+            log_info (_("key %s: secret key already exists\n"),
+                      keystr_from_pk_with_sub (main_pk, pk));
+          err = 0;
+          stats->secret_dups++;
+        }
+      else
+        {
+          log_error (_("key %s: error sending to agent: %s\n"),
+                     keystr_from_pk_with_sub (main_pk, pk),
+                     gpg_strerror (err));
+          if (gpg_err_code (err) == GPG_ERR_CANCELED
+              || gpg_err_code (err) == GPG_ERR_FULLY_CANCELED)
+            break; /* Don't try the other subkeys.  */
+        }
+    }
+  return err;
+}
+
+
 /* Transfer all the secret keys in SEC_KEYBLOCK to the gpg-agent.  The
    function prints diagnostics and returns an error code.  If BATCH is
    true the secret keys are stored by gpg-agent in the transfer format
@@ -1313,6 +1582,7 @@ transfer_secret_keys (ctrl_t ctrl, struct stats_s *stats, kbnode_t sec_keyblock,
                       int batch)
 {
   gpg_error_t err = 0;
+  gpg_error_t err2;
   void *kek = NULL;
   size_t keklen;
   kbnode_t ctx = NULL;
@@ -1331,6 +1601,11 @@ transfer_secret_keys (ctrl_t ctrl, struct stats_s *stats, kbnode_t sec_keyblock,
   unsigned char *wrappedkey = NULL;
   size_t wrappedkeylen;
   char *cache_nonce = NULL;
+  PKT_public_key *pks[MAX_TRANSFER_BATCH];
+  unsigned char *wrappedkeys[MAX_TRANSFER_BATCH];
+  size_t wrappedkeylens[MAX_TRANSFER_BATCH];
+  unsigned int nkeys = 0;
+  unsigned int k;
 
   /* Get the current KEK.  */
   err = agent_keywrap_key (ctrl, 0, &kek, &keklen);
@@ -1533,40 +1808,35 @@ transfer_secret_keys (ctrl_t ctrl, struct stats_s *stats, kbnode_t sec_keyblock,
       xfree (transferkey);
       transferkey = NULL;
 
-      /* Send the wrapped key to the agent.  */
-      {
-        char *desc = gpg_format_keydesc (pk, FORMAT_KEYDESC_IMPORT, 1);
-        err = agent_import_key (ctrl, desc, &cache_nonce,
-                                wrappedkey, wrappedkeylen, batch);
-        xfree (desc);
-      }
-      if (!err)
-        {
-          if (opt.verbose)
-            log_info (_("key %s: secret key imported\n"),
-                      keystr_from_pk_with_sub (main_pk, pk));
-          stats->secret_imported++;
-        }
-      else if ( gpg_err_code (err) == GPG_ERR_EEXIST )
+      /* Collect the wrapped keys to send them in one go.  */
+      if (nkeys == MAX_TRANSFER_BATCH)
         {
-          if (opt.verbose)
-            log_info (_("key %s: secret key already exists\n"),
-                      keystr_from_pk_with_sub (main_pk, pk));
-          err = 0;
-          stats->secret_dups++;
-        }
-      else
-        {
-          log_error (_("key %s: error sending to agent: %s\n"),
-                     keystr_from_pk_with_sub (main_pk, pk),
-                     gpg_strerror (err));
+          err = send_secret_keys (ctrl, stats, main_pk, pks, wrappedkeys,
+                                  wrappedkeylens, nkeys, &cache_nonce, batch);
+          for (k=0; k < nkeys; k++)
+            xfree (wrappedkeys[k]);
+          nkeys = 0;
           if (gpg_err_code (err) == GPG_ERR_CANCELED
               || gpg_err_code (err) == GPG_ERR_FULLY_CANCELED)
-            break; /* Don't try the other subkeys.  */
+            goto leave;
         }
+      pks[nkeys] = pk;
+      wrappedkeys[nkeys] = wrappedkey;
+      wrappedkeylens[nkeys++] = wrappedkeylen;
+      wrappedkey = NULL;
     }
 
  leave:
+  /* Keys collected before an error are still sent.  */
+  if (nkeys)
+    {
+      err2 = send_secret_keys (ctrl, stats, main_pk, pks, wrappedkeys,
+                               wrappedkeylens, nkeys, &cache_nonce, batch);
+      if (!err)
+        err = err2;
+      for (k=0; k < nkeys; k++)
+        xfree (wrappedkeys[k]);
+    }
   gcry_sexp_release (curve);
   xfree (cache_nonce);
   xfree (wrappedkey);
@@ -1734,7 +2004,7 @@ import_secret_one (ctrl_t ctrl, const char *fname, kbnode_t keyblock,
 	 the secret keys.  FIXME?  */
       import_one (ctrl, fname, pub_keyblock, stats,
 		  NULL, NULL, options, 1, for_migration,
-                  screener, screener_arg);
+                  screener, screener_arg, NULL, 0);
 
       /* Fixme: We should check for an invalid keyblock and
 	 cancel the secret key import in this case.  */
@@ -1891,7 +2161,7 @@ import_revoke_cert( const char *fname, kbnode_t node, struct stats_s *stats )
   if(get_ownertrust(pk)==TRUST_ULTIMATE)
     clear_ownertrusts(pk);
 
-  revalidation_mark ();
+  revalidation_mark_key (pk);
 
  leave:
   keydb_release (hd);
@@ -117,10 +117,8 @@ release_kbnode( KBNODE n )
 
     while( n ) {
 	n2 = n->next;
-	if( !is_cloned_kbnode(n) ) {
-	    free_packet( n->pkt );
-	    xfree( n->pkt );
-	}
+	if( !is_cloned_kbnode(n) )
+	    release_packet (n->pkt);
 	free_node( n );
 	n = n2;
     }
@@ -288,10 +286,8 @@ commit_kbnode( KBNODE *root )
 		*root = nl = n->next;
 	    else
 		nl->next = n->next;
-	    if( !is_cloned_kbnode(n) ) {
-		free_packet( n->pkt );
-		xfree( n->pkt );
-	    }
+	    if( !is_cloned_kbnode(n) )
+		release_packet (n->pkt);
 	    free_node( n );
 	    changed = 1;
 	}
@@ -312,10 +308,8 @@ remove_kbnode( KBNODE *root, KBNODE node )
 		*root = nl = n->next;
 	    else
 		nl->next = n->next;
-	    if( !is_cloned_kbnode(n) ) {
-		free_packet( n->pkt );
-		xfree( n->pkt );
-	    }
+	    if( !is_cloned_kbnode(n) )
+		release_packet (n->pkt);
 	    free_node( n );
 	}
 	else
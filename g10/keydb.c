@@ -39,6 +39,7 @@
 #include "i18n.h"
 
 static int active_handles;
+static int kept_locks;  /* Number of handles with keep_lock set.  */
 
 typedef enum
   {
@@ -56,44 +57,74 @@ struct resource_item
     KEYBOX_HANDLE kb;
   } u;
   void *token;
+  int read_only;  /* Only used for keyboxes.  */
 };
 
 static struct resource_item all_resources[MAX_KEYDB_RESOURCES];
 static int used_resources;
+
+/* The resources added with keydb_add_resource which are registered
+   when the first handle is created.  The flags of each item are the
+   KEYDB_RESOURCE_FLAG_ values.  */
+static strlist_t pending_resources;
 static void *primary_keyring=NULL;
 
+/* Incremented whenever this process changes the set of keys; see
+   keydb_change_count.  */
+static unsigned int change_count;
+
+/* The states of the keyblock cache with respect to a handle.  */
+enum keyblock_cache_states {
+  KEYBLOCK_CACHE_EMPTY,     /* Nothing cached for the last search.  */
+  KEYBLOCK_CACHE_PREPARED,  /* Cache the keyblock once it is read.  */
+  KEYBLOCK_CACHE_FILLED     /* The last search has been answered from
+                               the cache; FOUND is not valid.  */
+};
+
 struct keydb_handle
 {
   int locked;
+  int keep_lock;  /* Set by keydb_lock; released by keydb_release.  */
   int found;
   int saved_found;
   unsigned long skipped_long_blobs;
   int no_caching;
+  enum keyblock_cache_states cache_state;
+  byte cache_fpr[MAX_FINGERPRINT_LEN];  /* Fingerprint of the last search. */
+  int image_digest_valid;
+  byte image_digest[20];  /* See keydb_get_keyblock_digest.  */
   int current;
   int used;   /* Number of items in ACTIVE. */
   struct resource_item active[MAX_KEYDB_RESOURCES];
 };
 
 
-/* This is a simple cache used to return the last result of a
-   successful fingerprint search.  This works only for keybox resources
-   because (due to lack of a copy_keyblock function) we need to store
-   an image of the keyblock which is fortunately instantly available
-   for keyboxes.  */
-enum keyblock_cache_states {
-  KEYBLOCK_CACHE_EMPTY,
-  KEYBLOCK_CACHE_PREPARED,
-  KEYBLOCK_CACHE_FILLED
-};
-
-struct {
-  enum keyblock_cache_states state;
+/* This is a simple cache used to return the results of recent
+   successful fingerprint searches.  This works only for keybox
+   resources because (due to lack of a copy_keyblock function) we need
+   to store an image of the keyblock which is fortunately instantly
+   available for keyboxes.  The entries are kept in most recently used
+   order and there are at most opt.keyblock_cache_size of them.  */
+typedef struct keyblock_cache_entry
+{
+  struct keyblock_cache_entry *next;
   byte fpr[MAX_FINGERPRINT_LEN];
   iobuf_t iobuf; /* Image of the keyblock.  */
+  byte digest[20];  /* SHA-1 of the image.  */
   u32 *sigstatus;
+  unsigned char *keygrips;  /* See keybox_get_keygrips.  */
+  unsigned int nkeygrips;
   int pk_no;
   int uid_no;
-} keyblock_cache;
+} *keyblock_cache_entry_t;
+
+static keyblock_cache_entry_t keyblock_cache;
+static int keyblock_cache_entries;  /* Number of entries in the cache.  */
+static unsigned long keyblock_cache_hits;
+static unsigned long keyblock_cache_misses;
+
+/* Number of calls to keydb_search.  */
+static unsigned long keydb_searches;
 
 
 static int lock_all (KEYDB_HANDLE hd);
@@ -101,13 +132,158 @@ static void unlock_all (KEYDB_HANDLE hd);
 
 
 static void
-keyblock_cache_clear (void)
+keyblock_cache_release_entry (keyblock_cache_entry_t ce)
+{
+  xfree (ce->sigstatus);
+  xfree (ce->keygrips);
+  iobuf_close (ce->iobuf);
+  xfree (ce);
+}
+
+
+/* Remove all entries from the keyblock cache.  This is required
+   after each change of the key resources.  */
+static void
+keyblock_cache_flush (void)
+{
+  keyblock_cache_entry_t ce;
+
+  while ((ce = keyblock_cache))
+    {
+      keyblock_cache = ce->next;
+      keyblock_cache_release_entry (ce);
+    }
+  keyblock_cache_entries = 0;
+}
+
+
+/* Return the cache entry for FPR and make it the most recently used
+   one.  Returns NULL if FPR is not cached.  */
+static keyblock_cache_entry_t
+keyblock_cache_lookup (const byte *fpr)
+{
+  keyblock_cache_entry_t ce, prev;
+
+  for (prev = NULL, ce = keyblock_cache; ce; prev = ce, ce = ce->next)
+    if (!memcmp (ce->fpr, fpr, 20))
+      {
+        if (prev)
+          {
+            prev->next = ce->next;
+            ce->next = keyblock_cache;
+            keyblock_cache = ce;
+          }
+        return ce;
+      }
+  return NULL;
+}
+
+
+/* Remove the entry for FPR from the keyblock cache.  */
+static void
+keyblock_cache_remove (const byte *fpr)
+{
+  keyblock_cache_entry_t ce;
+
+  ce = keyblock_cache_lookup (fpr);
+  if (ce)
+    {
+      keyblock_cache = ce->next;
+      keyblock_cache_entries--;
+      keyblock_cache_release_entry (ce);
+    }
+}
+
+
+/* Store the keyblock image IOBUF with its SHA-1 DIGEST and its
+   SIGSTATUS under FPR.  The cache takes ownership of IOBUF and
+   SIGSTATUS.  If the cache is full the least recently used entry is
+   dropped.  */
+static void
+keyblock_cache_put (const byte *fpr, iobuf_t iobuf, const byte *digest,
+                    u32 *sigstatus,
+                    unsigned char *keygrips, unsigned int nkeygrips,
+                    int pk_no, int uid_no)
 {
-  keyblock_cache.state = KEYBLOCK_CACHE_EMPTY;
-  xfree (keyblock_cache.sigstatus);
-  keyblock_cache.sigstatus = NULL;
-  iobuf_close (keyblock_cache.iobuf);
-  keyblock_cache.iobuf = NULL;
+  keyblock_cache_entry_t ce, *cep;
+
+  keyblock_cache_remove (fpr);
+  if (opt.keyblock_cache_size < 1
+      || !(ce = xtrymalloc (sizeof *ce)))
+    {
+      xfree (sigstatus);
+      xfree (keygrips);
+      iobuf_close (iobuf);
+      return;
+    }
+  memcpy (ce->fpr, fpr, MAX_FINGERPRINT_LEN);
+  ce->iobuf     = iobuf;
+  memcpy (ce->digest, digest, 20);
+  ce->sigstatus = sigstatus;
+  ce->keygrips  = keygrips;
+  ce->nkeygrips = nkeygrips;
+  ce->pk_no     = pk_no;
+  ce->uid_no    = uid_no;
+  ce->next = keyblock_cache;
+  keyblock_cache = ce;
+  keyblock_cache_entries++;
+
+  if (keyblock_cache_entries > opt.keyblock_cache_size)
+    {
+      for (cep = &keyblock_cache; (*cep)->next; cep = &(*cep)->next)
+        ;
+      keyblock_cache_release_entry (*cep);
+      *cep = NULL;
+      keyblock_cache_entries--;
+    }
+}
+
+
+/* If the last search on HD has been answered from the keyblock cache,
+   repeat it on the resources so that HD gets a found state which may
+   be used to continue the search or to change the keyblock.  */
+static gpg_error_t
+keyblock_cache_unfold (KEYDB_HANDLE hd)
+{
+  gpg_error_t err;
+  KEYDB_SEARCH_DESC desc;
+  int no_caching;
+
+  if (hd->cache_state != KEYBLOCK_CACHE_FILLED)
+    return 0;
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FPR;
+  memcpy (desc.u.fpr, hd->cache_fpr, MAX_FINGERPRINT_LEN);
+
+  no_caching = hd->no_caching;
+  hd->no_caching = 1;
+  err = keydb_search_reset (hd);
+  if (!err)
+    err = keydb_search (hd, &desc, 1, NULL);
+  hd->no_caching = no_caching;
+  return err;
+}
+
+
+/* Store the number of searches and the number of searches answered
+   from the keyblock cache at R_SEARCHES and R_HITS.  */
+void
+keydb_get_stats (unsigned long *r_searches, unsigned long *r_hits)
+{
+  *r_searches = keydb_searches;
+  *r_hits = keyblock_cache_hits;
+}
+
+
+/* Print the statistics of the keyblock cache.  */
+void
+keydb_dump_stats (void)
+{
+  if (keyblock_cache_hits || keyblock_cache_misses)
+    log_info ("keyblock cache: %d entries, %lu hits, %lu misses\n",
+              keyblock_cache_entries,
+              keyblock_cache_hits, keyblock_cache_misses);
 }
 
 
@@ -323,14 +499,10 @@ rt_from_file (const char *filename, int *r_found, int *r_openpgp)
 }
 
 
-/*
- * Register a resource (keyring or aeybox).  The first keyring or
- * keybox which is added by this function is created if it does not
- * exist.  FLAGS are a combination of the KEYDB_RESOURCE_FLAG_
- * constants as defined in keydb.h.
- */
-gpg_error_t
-keydb_add_resource (const char *url, unsigned int flags)
+/* Register the resource URL with the KEYDB_RESOURCE_FLAG_ values
+   FLAGS.  See keydb_add_resource.  */
+static gpg_error_t
+register_resource (const char *url, unsigned int flags)
 {
   static int any_registered;
   const char *resname = url;
@@ -493,6 +665,7 @@ keydb_add_resource (const char *url, unsigned int flags)
                 all_resources[used_resources].type = rt;
                 all_resources[used_resources].u.kb = NULL; /* Not used here */
                 all_resources[used_resources].token = token;
+                all_resources[used_resources].read_only = read_only;
 
                 /* FIXME: Do a compress run if needed and no other
                    user is currently using the keybox. */
@@ -529,6 +702,54 @@ keydb_add_resource (const char *url, unsigned int flags)
 }
 
 
+/*
+ * Add a resource (keyring or keybox).  The first keyring or keybox
+ * which is added by this function is created if it does not exist.
+ * FLAGS are a combination of the KEYDB_RESOURCE_FLAG_ constants as
+ * defined in keydb.h.
+ *
+ * The resources are only looked at, and if needed created, when the
+ * first keydb handle is created or keydb_open_resources is called.
+ * Thus commands which do not use the keyring do not touch the files.
+ */
+gpg_error_t
+keydb_add_resource (const char *url, unsigned int flags)
+{
+  strlist_t sl;
+
+  sl = append_to_strlist (&pending_resources, url);
+  sl->flags = flags;
+  return 0;
+}
+
+
+/* Register all resources added by keydb_add_resource so far.  */
+void
+keydb_open_resources (void)
+{
+  strlist_t sl, list;
+
+  /* Take the list first so that we don't recurse.  */
+  list = pending_resources;
+  pending_resources = NULL;
+  for (sl = list; sl; sl = sl->next)
+    register_resource (sl->d, sl->flags);
+  if (list)
+    change_count++;
+  free_strlist (list);
+}
+
+
+/* Return a counter which changes whenever a keyblock is inserted,
+   updated or deleted or a resource is registered by this process.
+   Caches of lookup results use it to detect stale entries.  */
+unsigned int
+keydb_change_count (void)
+{
+  return change_count;
+}
+
+
 
 
 KEYDB_HANDLE
@@ -540,6 +761,8 @@ keydb_new (void)
   if (DBG_CLOCK)
     log_clock ("keydb_new");
 
+  keydb_open_resources ();
+
   hd = xmalloc_clear (sizeof *hd);
   hd->found = -1;
   hd->saved_found = -1;
@@ -564,12 +787,19 @@ keydb_new (void)
         case KEYDB_RESOURCE_TYPE_KEYBOX:
           hd->active[j].type   = all_resources[i].type;
           hd->active[j].token  = all_resources[i].token;
+          hd->active[j].read_only = all_resources[i].read_only;
           hd->active[j].u.kb   = keybox_new_openpgp (all_resources[i].token, 0);
           if (!hd->active[j].u.kb)
             {
               xfree (hd);
               return NULL; /* fixme: release all previously allocated handles*/
             }
+          /* Read the blobs in place; this fails only if mmap is not
+             available.  Searches which can't use the index then
+             scan the file on the signature check threads.  */
+          if (!keybox_set_mmap (hd->active[j].u.kb, 1))
+            keybox_set_parallel (hd->active[j].u.kb, gpg_run_parallel,
+                                 sig_queue_threads ());
           j++;
           break;
         }
@@ -591,6 +821,11 @@ keydb_release (KEYDB_HANDLE hd)
   assert (active_handles > 0);
   active_handles--;
 
+  if (hd->keep_lock)
+    {
+      hd->keep_lock = 0;
+      kept_locks--;
+    }
   unlock_all (hd);
   for (i=0; i < hd->used; i++)
     {
@@ -716,14 +951,43 @@ lock_all (KEYDB_HANDLE hd)
 }
 
 
+/* Lock all resources of HD until it is released.  Used to write
+   several keyblocks as one transaction; the inserts and updates done
+   with HD then don't release the lock.  */
+gpg_error_t
+keydb_lock (KEYDB_HANDLE hd)
+{
+  gpg_error_t err;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  err = lock_all (hd);
+  if (!err && !hd->keep_lock)
+    {
+      hd->keep_lock = 1;
+      kept_locks++;
+    }
+  return err;
+}
+
+
 static void
 unlock_all (KEYDB_HANDLE hd)
 {
   int i;
 
-  if (!hd->locked)
+  if (!hd->locked || hd->keep_lock)
     return;
 
+  /* The locks are shared by all handles; while a handle keeps them
+     for a transaction they must not be released.  */
+  if (kept_locks)
+    {
+      hd->locked = 0;
+      return;
+    }
+
   for (i=hd->used-1; i >= 0; i--)
     {
       switch (hd->active[i].type)
@@ -750,6 +1014,7 @@ keydb_push_found_state (KEYDB_HANDLE hd)
   if (!hd)
     return;
 
+  keyblock_cache_unfold (hd);
   if (hd->found < 0 || hd->found >= hd->used)
     {
       hd->saved_found = -1;
@@ -799,10 +1064,56 @@ keydb_pop_found_state (KEYDB_HANDLE hd)
 }
 
 
+/* Store the keygrips KEYGRIPS of the NKEYGRIPS keys as returned by
+   keybox_get_keygrips in the keys of KEYBLOCK.  A keygrip is taken
+   only for the key with the same fingerprint.  */
+static void
+set_keygrips (kbnode_t keyblock, const unsigned char *keygrips,
+              unsigned int nkeygrips)
+{
+  static const unsigned char nogrip[20];
+  kbnode_t node;
+  PKT_public_key *pk;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  const unsigned char *k;
+  unsigned int n;
+
+  if (!keygrips)
+    return;
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY
+          && node->pkt->pkttype != PKT_SECRET_KEY
+          && node->pkt->pkttype != PKT_SECRET_SUBKEY)
+        continue;
+      pk = node->pkt->pkt.public_key;
+      fingerprint_from_pk (pk, fpr, &fprlen);
+      if (fprlen > 20)
+        continue;
+      /* A shorter fingerprint is stored right aligned.  */
+      for (n=0, k = keygrips; n < nkeygrips; n++, k += 40)
+        if (!memcmp (k, nogrip, 20 - fprlen)
+            && !memcmp (k + 20 - fprlen, fpr, fprlen))
+          break;
+      if (n < nkeygrips && memcmp (k + 20, nogrip, 20))
+        {
+          memcpy (pk->keygrip, k + 20, 20);
+          pk->flags.keygrip_valid = 1;
+        }
+    }
+}
+
+
 
+/* Parse the keyblock image IOBUF into a keyblock stored at
+   R_KEYBLOCK.  If R_SKIPPED is not NULL the number of packets of the
+   image which are not in the keyblock is stored there.  */
 static gpg_error_t
 parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
-                      const u32 *sigstatus, kbnode_t *r_keyblock)
+                      const u32 *sigstatus, kbnode_t *r_keyblock,
+                      int *r_skipped)
 {
   gpg_error_t err;
   PACKET *pkt;
@@ -811,13 +1122,11 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
   int in_cert, save_mode;
   u32 n_sigs;
   int pk_count, uid_count;
+  int skipped = 0;
 
   *r_keyblock = NULL;
 
-  pkt = xtrymalloc (sizeof *pkt);
-  if (!pkt)
-    return gpg_error_from_syserror ();
-  init_packet (pkt);
+  pkt = alloc_packet ();
   save_mode = set_packet_list_mode (0);
   in_cert = 0;
   n_sigs = 0;
@@ -827,6 +1136,10 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
     {
       if (gpg_err_code (err) == GPG_ERR_UNKNOWN_PACKET)
         {
+          /* This may be a skipped signature; keep SIGSTATUS in step.  */
+          if (pkt->pkttype == PKT_SIGNATURE)
+            n_sigs++;
+          skipped++;
           free_packet (pkt);
           init_packet (pkt);
           continue;
@@ -856,6 +1169,7 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
              the other GPG specific packets don't make sense either.  */
           log_error ("skipped packet of type %d in keybox\n",
                      (int)pkt->pkttype);
+          skipped++;
           free_packet(pkt);
           init_packet(pkt);
           continue;
@@ -935,13 +1249,7 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
       else
         *tail = node;
       tail = &node->next;
-      pkt = xtrymalloc (sizeof *pkt);
-      if (!pkt)
-        {
-          err = gpg_error_from_syserror ();
-          break;
-        }
-      init_packet (pkt);
+      pkt = alloc_packet ();
     }
   set_packet_list_mode (save_mode);
 
@@ -958,8 +1266,9 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
     release_kbnode (keyblock);
   else
     *r_keyblock = keyblock;
-  free_packet (pkt);
-  xfree (pkt);
+  if (r_skipped)
+    *r_skipped = skipped;
+  release_packet (pkt);
   return err;
 }
 
@@ -979,18 +1288,31 @@ keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
+  hd->image_digest_valid = 0;
 
-  if (keyblock_cache.state == KEYBLOCK_CACHE_FILLED)
+  if (hd->cache_state == KEYBLOCK_CACHE_FILLED)
     {
-      iobuf_seek (keyblock_cache.iobuf, 0);
-      err = parse_keyblock_image (keyblock_cache.iobuf,
-                                  keyblock_cache.pk_no,
-                                  keyblock_cache.uid_no,
-                                  keyblock_cache.sigstatus,
-                                  ret_kb);
+      keyblock_cache_entry_t ce = keyblock_cache_lookup (hd->cache_fpr);
+
+      if (ce)
+        {
+          iobuf_seek (ce->iobuf, 0);
+          err = parse_keyblock_image (ce->iobuf, ce->pk_no, ce->uid_no,
+                                      ce->sigstatus, ret_kb, NULL);
+          if (err)
+            keyblock_cache_remove (hd->cache_fpr);
+          else
+            {
+              set_keygrips (*ret_kb, ce->keygrips, ce->nkeygrips);
+              memcpy (hd->image_digest, ce->digest, 20);
+              hd->image_digest_valid = 1;
+            }
+          return err;
+        }
+      /* The entry has been dropped meanwhile.  */
+      err = keyblock_cache_unfold (hd);
       if (err)
-        keyblock_cache_clear ();
-      return err;
+        return err;
     }
 
   if (hd->found < 0 || hd->found >= hd->used)
@@ -1009,24 +1331,36 @@ keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
         iobuf_t iobuf;
         u32 *sigstatus;
         int pk_no, uid_no;
+        unsigned char *keygrips = NULL;
+        unsigned int nkeygrips = 0;
 
         err = keybox_get_keyblock (hd->active[hd->found].u.kb,
                                    &iobuf, &pk_no, &uid_no, &sigstatus);
         if (!err)
           {
             err = parse_keyblock_image (iobuf, pk_no, uid_no, sigstatus,
-                                        ret_kb);
-            if (!err && keyblock_cache.state == KEYBLOCK_CACHE_PREPARED)
+                                        ret_kb, NULL);
+            /* Without the stored keygrips they are computed when
+               needed; thus errors are ignored.  */
+            if (!err)
+              keybox_get_keygrips (hd->active[hd->found].u.kb,
+                                   &keygrips, &nkeygrips);
+            if (!err)
               {
-                keyblock_cache.state     = KEYBLOCK_CACHE_FILLED;
-                keyblock_cache.sigstatus = sigstatus;
-                keyblock_cache.iobuf     = iobuf;
-                keyblock_cache.pk_no     = pk_no;
-                keyblock_cache.uid_no    = uid_no;
+                set_keygrips (*ret_kb, keygrips, nkeygrips);
+                gcry_md_hash_buffer (GCRY_MD_SHA1, hd->image_digest,
+                                     iobuf_get_temp_buffer (iobuf),
+                                     iobuf_get_temp_length (iobuf));
+                hd->image_digest_valid = 1;
               }
+            if (!err && hd->cache_state == KEYBLOCK_CACHE_PREPARED)
+              keyblock_cache_put (hd->cache_fpr, iobuf, hd->image_digest,
+                                  sigstatus, keygrips, nkeygrips,
+                                  pk_no, uid_no);
             else
               {
                 xfree (sigstatus);
+                xfree (keygrips);
                 iobuf_close (iobuf);
               }
           }
@@ -1034,28 +1368,183 @@ keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
       break;
     }
 
-  if (keyblock_cache.state != KEYBLOCK_CACHE_FILLED)
-    keyblock_cache_clear ();
+  hd->cache_state = KEYBLOCK_CACHE_EMPTY;
 
   return err;
 }
 
 
+/* Store the SHA-1 digest of the image the keyblock last returned by
+   keydb_get_keyblock has been parsed from at DIGEST, which must
+   provide 20 bytes.  Two keyblocks with the same digest consist of
+   the same packets.  Returns false if there is no such digest; this
+   is the case for keyrings.  Note the signature status stored with
+   the keyblock is not covered by the digest.  */
+int
+keydb_get_keyblock_digest (KEYDB_HANDLE hd, byte *digest)
+{
+  if (!hd || !hd->image_digest_valid)
+    return 0;
+  memcpy (digest, hd->image_digest, 20);
+  return 1;
+}
+
+
+/* Same as keydb_get_keyblock but also store the image the keyblock
+   has been parsed from at R_IMAGE.  The image is only returned if it
+   comes from a keybox and holds exactly the packets of the keyblock;
+   otherwise NULL is stored there.  The caller must close it.  */
+gpg_error_t
+keydb_get_keyblock_image (KEYDB_HANDLE hd, kbnode_t *ret_kb, iobuf_t *r_image)
+{
+  gpg_error_t err;
+  iobuf_t iobuf;
+  u32 *sigstatus;
+  int pk_no, uid_no, skipped;
+
+  *ret_kb = NULL;
+  *r_image = NULL;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_ARG);
+  hd->image_digest_valid = 0;
+
+  if (hd->cache_state == KEYBLOCK_CACHE_FILLED
+      || hd->found < 0 || hd->found >= hd->used
+      || hd->active[hd->found].type != KEYDB_RESOURCE_TYPE_KEYBOX)
+    return keydb_get_keyblock (hd, ret_kb);
+
+  hd->cache_state = KEYBLOCK_CACHE_EMPTY;
+  err = keybox_get_keyblock (hd->active[hd->found].u.kb,
+                             &iobuf, &pk_no, &uid_no, &sigstatus);
+  if (err)
+    return err;
+
+  err = parse_keyblock_image (iobuf, pk_no, uid_no, sigstatus,
+                              ret_kb, &skipped);
+  xfree (sigstatus);
+  if (!err && !skipped)
+    {
+      iobuf_seek (iobuf, 0);
+      *r_image = iobuf;
+    }
+  else
+    iobuf_close (iobuf);
+  return err;
+}
+
+
+/* Return the value stored in the keybox for the cached check result
+   of SIG; see parse_keyblock_image for the reverse mapping.  */
+static u32
+sig_status_value (PKT_signature *sig)
+{
+  /* Fixme: Detect the "missing key" status.  */
+  if (!sig->flags.checked)
+    return 0;
+  if (!sig->flags.valid)
+    return 0x00000002; /* Bad signature.  */
+  if (!sig->expiredate)
+    return 0xffffffff;
+  if (sig->expiredate < 0x1000000)
+    return 0x10000000;
+  return sig->expiredate;
+}
+
+
+/* Release the key and user ID lists of INFO as built by
+   build_keyblock_image but not INFO itself.  */
+static void
+release_keyblock_info (keybox_openpgp_info_t info)
+{
+  struct _keybox_openpgp_key_info *k, *k2;
+  struct _keybox_openpgp_uid_info *u, *u2;
+
+  for (k = info->subkeys.next; k; k = k2)
+    {
+      k2 = k->next;
+      xfree (k);
+    }
+  for (u = info->uids.next; u; u = u2)
+    {
+      u2 = u->next;
+      xfree (u);
+    }
+  memset (info, 0, sizeof *info);
+}
+
+
+/* Fill KI with the keyid, fingerprint and keygrip of PK for the
+   keybox.  Returns false if the keybox would not take that key.  */
+static int
+keyblock_info_from_pk (PKT_public_key *pk,
+                       struct _keybox_openpgp_key_info *ki)
+{
+  size_t fprlen;
+  u32 kid[2];
+  int i;
+
+  switch (pk->pubkey_algo)
+    {
+    case PUBKEY_ALGO_RSA:
+    case PUBKEY_ALGO_RSA_E:
+    case PUBKEY_ALGO_RSA_S:
+    case PUBKEY_ALGO_ELGAMAL_E:
+    case PUBKEY_ALGO_ELGAMAL:
+    case PUBKEY_ALGO_DSA:
+    case PUBKEY_ALGO_ECDH:
+    case PUBKEY_ALGO_ECDSA:
+    case PUBKEY_ALGO_EDDSA:
+      break;
+    default:
+      return 0;
+    }
+
+  ki->algo = pk->pubkey_algo;
+  fingerprint_from_pk (pk, ki->fpr, &fprlen);
+  if (fprlen != 20)
+    return 0;
+  ki->fprlen = 20;
+  keyid_from_pk (pk, kid);
+  for (i=0; i < 4; i++)
+    {
+      ki->keyid[i]   = kid[0] >> (24 - 8*i);
+      ki->keyid[4+i] = kid[1] >> (24 - 8*i);
+    }
+  ki->have_grip = !keygrip_from_pk (pk, ki->grip);
+  return 1;
+}
+
+
 /* Build a keyblock image from KEYBLOCK.  Returns 0 on success and
    only then stores a new iobuf object at R_IOBUF and a signature
-   status vecotor at R_SIGSTATUS.  */
+   status vecotor at R_SIGSTATUS.  If R_INFO is not NULL, the keys,
+   user IDs and signatures of the image are also described there for
+   the keybox so that it need not parse the image again.  R_INFO is
+   cleared, and thus its primary fprlen is 0, if the keybox shall
+   better parse the image itself, which is the case for v3 keys.  The
+   caller must release it with release_keyblock_info.  */
 static gpg_error_t
-build_keyblock_image (kbnode_t keyblock, iobuf_t *r_iobuf, u32 **r_sigstatus)
+build_keyblock_image (kbnode_t keyblock, iobuf_t *r_iobuf, u32 **r_sigstatus,
+                      keybox_openpgp_info_t r_info)
 {
   gpg_error_t err;
   iobuf_t iobuf;
   kbnode_t kbctx, node;
   u32 n_sigs;
   u32 *sigstatus;
+  int use_info = !!r_info;
+  struct _keybox_openpgp_key_info *k, **ktail = NULL;
+  struct _keybox_openpgp_uid_info *u, **utail = NULL;
+  PKT_public_key *pk;
+  PKT_user_id *uid;
+  size_t len;
 
   *r_iobuf = NULL;
   if (r_sigstatus)
     *r_sigstatus = NULL;
+  if (r_info)
+    memset (r_info, 0, sizeof *r_info);
 
   /* Allocate a vector for the signature cache.  This is an array of
      u32 values with the first value giving the number of elements to
@@ -1093,10 +1582,7 @@ build_keyblock_image (kbnode_t keyblock, iobuf_t *r_iobuf, u32 **r_sigstatus)
 
       err = build_packet (iobuf, node->pkt);
       if (err)
-        {
-          iobuf_close (iobuf);
-          return err;
-        }
+        goto leave;
 
       /* Build signature status vector.  */
       if (node->pkt->pkttype == PKT_SIGNATURE)
@@ -1104,30 +1590,103 @@ build_keyblock_image (kbnode_t keyblock, iobuf_t *r_iobuf, u32 **r_sigstatus)
           PKT_signature *sig = node->pkt->pkt.signature;
 
           n_sigs++;
-          /* Fixme: Detect the "missing key" status.  */
-          if (sig->flags.checked && sigstatus)
+          if (sigstatus)
+            sigstatus[n_sigs] = sig_status_value (sig);
+        }
+
+      if (!use_info)
+        continue;
+
+      /* Describe the packet as _keybox_parse_openpgp would.  */
+      switch (node->pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+          pk = node->pkt->pkt.public_key;
+          if (node != keyblock || pk->version < 4
+              || !keyblock_info_from_pk (pk, &r_info->primary))
+            use_info = 0;
+          ktail = NULL;
+          break;
+
+        case PKT_PUBLIC_SUBKEY:
+          /* The keybox ignores subkeys of algorithms it does not
+             know.  */
+          pk = node->pkt->pkt.public_key;
+          if (pk->version < 4)
+            use_info = 0;
+          else if (!ktail)
+            {
+              if (keyblock_info_from_pk (pk, &r_info->subkeys))
+                {
+                  r_info->nsubkeys++;
+                  ktail = &r_info->subkeys.next;
+                }
+            }
+          else
             {
-              if (sig->flags.valid)
+              k = xtrycalloc (1, sizeof *k);
+              if (!k)
                 {
-                  if (!sig->expiredate)
-                    sigstatus[n_sigs] = 0xffffffff;
-                  else if (sig->expiredate < 0x1000000)
-                    sigstatus[n_sigs] = 0x10000000;
-                  else
-                    sigstatus[n_sigs] = sig->expiredate;
+                  err = gpg_error_from_syserror ();
+                  goto leave;
+                }
+              if (keyblock_info_from_pk (pk, k))
+                {
+                  r_info->nsubkeys++;
+                  *ktail = k;
+                  ktail = &k->next;
                 }
               else
-                sigstatus[n_sigs] = 0x00000002; /* Bad signature.  */
+                xfree (k);
             }
+          break;
+
+        case PKT_USER_ID:
+          /* The data of the packet is at its end.  */
+          uid = node->pkt->pkt.user_id;
+          len = uid->attrib_data? uid->attrib_len : uid->len;
+          if (!r_info->nuids)
+            u = &r_info->uids;
+          else
+            {
+              u = xtrycalloc (1, sizeof *u);
+              if (!u)
+                {
+                  err = gpg_error_from_syserror ();
+                  goto leave;
+                }
+              *utail = u;
+            }
+          u->off = iobuf_get_temp_length (iobuf) - len;
+          u->len = len;
+          utail = &u->next;
+          r_info->nuids++;
+          break;
+
+        default:
+          break;
         }
     }
   if (sigstatus)
     sigstatus[0] = n_sigs;
+  if (r_info)
+    {
+      r_info->nsigs = n_sigs;
+      if (!use_info)
+        release_keyblock_info (r_info);
+    }
 
   *r_iobuf = iobuf;
   if (r_sigstatus)
     *r_sigstatus = sigstatus;
   return 0;
+
+ leave:
+  iobuf_close (iobuf);
+  xfree (sigstatus);
+  if (r_info)
+    release_keyblock_info (r_info);
+  return err;
 }
 
 
@@ -1142,7 +1701,11 @@ keydb_update_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
-  keyblock_cache_clear ();
+  err = keyblock_cache_unfold (hd);
+  keyblock_cache_flush ();
+  change_count++;
+  if (err)
+    return err;
 
   if (hd->found < 0 || hd->found >= hd->used)
     return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
@@ -1165,13 +1728,19 @@ keydb_update_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
     case KEYDB_RESOURCE_TYPE_KEYBOX:
       {
         iobuf_t iobuf;
+        u32 *sigstatus;
+        struct _keybox_openpgp_info info;
 
-        err = build_keyblock_image (kb, &iobuf, NULL);
+        err = build_keyblock_image (kb, &iobuf, &sigstatus, &info);
         if (!err)
           {
             err = keybox_update_keyblock (hd->active[hd->found].u.kb,
                                           iobuf_get_temp_buffer (iobuf),
-                                          iobuf_get_temp_length (iobuf));
+                                          iobuf_get_temp_length (iobuf),
+                                          sigstatus,
+                                          info.primary.fprlen? &info : NULL);
+            release_keyblock_info (&info);
+            xfree (sigstatus);
             iobuf_close (iobuf);
           }
       }
@@ -1183,6 +1752,66 @@ keydb_update_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
 }
 
 
+/* Store the signature check results cached in the signature packets
+   of KB with the keyblock last found by HD, so that the signatures
+   need not be verified again when the keyblock is read the next time.
+   KB must have been read from HD by keydb_get_keyblock and its
+   packets must not have been changed since.  Nothing is written if
+   the results are the same as those read with the keyblock or if the
+   keyblock does not come from a writable keybox.  Other than
+   keydb_update_keyblock this does not count as a change of the
+   keys.  */
+gpg_error_t
+keydb_store_sigstatus (KEYDB_HANDLE hd, kbnode_t kb)
+{
+  gpg_error_t err;
+  kbnode_t kbctx, node;
+  keyblock_cache_entry_t ce;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 *sigstatus;
+  unsigned int n_sigs;
+
+  if (!hd || !kb)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  if (opt.dry_run || opt.no_sig_cache
+      || hd->cache_state == KEYBLOCK_CACHE_FILLED
+      || hd->found < 0 || hd->found >= hd->used
+      || hd->active[hd->found].type != KEYDB_RESOURCE_TYPE_KEYBOX
+      || hd->active[hd->found].read_only
+      || kb->pkt->pkttype != PKT_PUBLIC_KEY)
+    return 0;
+
+  for (kbctx = NULL, n_sigs = 0; (node = walk_kbnode (kb, &kbctx, 0));)
+    if (node->pkt->pkttype == PKT_SIGNATURE)
+      n_sigs++;
+  sigstatus = xtrycalloc (1+n_sigs, sizeof *sigstatus);
+  if (!sigstatus)
+    return gpg_error_from_syserror ();
+  sigstatus[0] = n_sigs;
+  for (kbctx = NULL, n_sigs = 0; (node = walk_kbnode (kb, &kbctx, 0));)
+    if (node->pkt->pkttype == PKT_SIGNATURE)
+      sigstatus[++n_sigs] = sig_status_value (node->pkt->pkt.signature);
+
+  err = lock_all (hd);
+  if (!err)
+    {
+      err = keybox_set_sigstatus (hd->active[hd->found].u.kb, sigstatus);
+      unlock_all (hd);
+    }
+
+  /* A cached image of the keyblock shall return the new results.  */
+  fingerprint_from_pk (kb->pkt->pkt.public_key, fpr, &fprlen);
+  if (!err && fprlen == 20 && (ce = keyblock_cache_lookup (fpr))
+      && ce->sigstatus && ce->sigstatus[0] == sigstatus[0])
+    memcpy (ce->sigstatus, sigstatus, (1+n_sigs) * sizeof *sigstatus);
+
+  xfree (sigstatus);
+  return err;
+}
+
+
 /*
  * Insert a new KB into one of the resources.
  */
@@ -1195,7 +1824,11 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
-  keyblock_cache_clear ();
+  err = keyblock_cache_unfold (hd);
+  keyblock_cache_flush ();
+  change_count++;
+  if (err)
+    return err;
 
   if (opt.dry_run)
     return 0;
@@ -1226,14 +1859,17 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
            kludge to have the caller pass the image.  */
         iobuf_t iobuf;
         u32 *sigstatus;
+        struct _keybox_openpgp_info info;
 
-        err = build_keyblock_image (kb, &iobuf, &sigstatus);
+        err = build_keyblock_image (kb, &iobuf, &sigstatus, &info);
         if (!err)
           {
             err = keybox_insert_keyblock (hd->active[idx].u.kb,
                                           iobuf_get_temp_buffer (iobuf),
                                           iobuf_get_temp_length (iobuf),
-                                          sigstatus);
+                                          sigstatus,
+                                          info.primary.fprlen? &info : NULL);
+            release_keyblock_info (&info);
             xfree (sigstatus);
             iobuf_close (iobuf);
           }
@@ -1257,7 +1893,11 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
-  keyblock_cache_clear ();
+  rc = keyblock_cache_unfold (hd);
+  keyblock_cache_flush ();
+  change_count++;
+  if (rc)
+    return rc;
 
   if (hd->found < 0 || hd->found >= hd->used)
     return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
@@ -1355,7 +1995,8 @@ keydb_rebuild_caches (int noisy)
 {
   int i, rc;
 
-  keyblock_cache_clear ();
+  keyblock_cache_flush ();
+  keydb_open_resources ();
 
   for (i=0; i < used_resources; i++)
     {
@@ -1399,7 +2040,7 @@ keydb_search_reset (KEYDB_HANDLE hd)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
-  keyblock_cache_clear ();
+  hd->cache_state = KEYBLOCK_CACHE_EMPTY;
 
   if (DBG_CLOCK)
     log_clock ("keydb_search_reset");
@@ -1494,26 +2135,41 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  keydb_searches++;
+
   if (DBG_CLOCK)
     log_clock ("keydb_search enter");
 
   if (DBG_CACHE)
     dump_search_desc (hd, "keydb_search", desc, ndesc);
 
+  /* A search continuing after a cached result needs the position of
+     that result.  */
+  rc = keyblock_cache_unfold (hd);
+  if (rc)
+    return rc;
+
   /* NB: If one of the exact search modes below is used in a loop to
      walk over all keys (with the same fingerprint) the caching must
-     have been disabled for the handle.  */
+     have been disabled for the handle.  The cache only answers
+     searches starting at the beginning.  */
   if (!hd->no_caching
       && ndesc == 1
       && (desc[0].mode == KEYDB_SEARCH_MODE_FPR20
           || desc[0].mode == KEYDB_SEARCH_MODE_FPR)
-      && keyblock_cache.state  == KEYBLOCK_CACHE_FILLED
-      && !memcmp (keyblock_cache.fpr, desc[0].u.fpr, 20))
+      && hd->current == 0 && hd->found < 0)
     {
-      /* (DESCINDEX is already set).  */
-      if (DBG_CLOCK)
-        log_clock ("keydb_search leave (cached)");
-      return 0;
+      if (keyblock_cache_lookup (desc[0].u.fpr))
+        {
+          keyblock_cache_hits++;
+          hd->cache_state = KEYBLOCK_CACHE_FILLED;
+          memcpy (hd->cache_fpr, desc[0].u.fpr, MAX_FINGERPRINT_LEN);
+          /* (DESCINDEX is already set).  */
+          if (DBG_CLOCK)
+            log_clock ("keydb_search leave (cached)");
+          return 0;
+        }
+      keyblock_cache_misses++;
     }
 
   rc = -1;
@@ -1548,14 +2204,14 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
         ? gpg_error (GPG_ERR_NOT_FOUND)
         : rc);
 
-  keyblock_cache_clear ();
+  hd->cache_state = KEYBLOCK_CACHE_EMPTY;
   if (!hd->no_caching
       && !rc
       && ndesc == 1 && (desc[0].mode == KEYDB_SEARCH_MODE_FPR20
                         || desc[0].mode == KEYDB_SEARCH_MODE_FPR))
     {
-      keyblock_cache.state = KEYBLOCK_CACHE_PREPARED;
-      memcpy (keyblock_cache.fpr, desc[0].u.fpr, 20);
+      hd->cache_state = KEYBLOCK_CACHE_PREPARED;
+      memcpy (hd->cache_fpr, desc[0].u.fpr, MAX_FINGERPRINT_LEN);
     }
 
   if (DBG_CLOCK)
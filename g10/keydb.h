@@ -131,7 +131,11 @@ union pref_hint
 #define KEYDB_RESOURCE_FLAG_DEFAULT  4  /* The default one.  */
 #define KEYDB_RESOURCE_FLAG_READONLY 8  /* Open in read only mode.  */
 
+/* The default number of keyblocks kept in the keyblock cache.  */
+#define DEFAULT_KEYBLOCK_CACHE_SIZE 64
+
 gpg_error_t keydb_add_resource (const char *url, unsigned int flags);
+void keydb_open_resources (void);
 
 KEYDB_HANDLE keydb_new (void);
 void keydb_release (KEYDB_HANDLE hd);
@@ -139,12 +143,20 @@ void keydb_disable_caching (KEYDB_HANDLE hd);
 void keydb_push_found_state (KEYDB_HANDLE hd);
 void keydb_pop_found_state (KEYDB_HANDLE hd);
 const char *keydb_get_resource_name (KEYDB_HANDLE hd);
+gpg_error_t keydb_lock (KEYDB_HANDLE hd);
 gpg_error_t keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb);
+int keydb_get_keyblock_digest (KEYDB_HANDLE hd, byte *digest);
+gpg_error_t keydb_get_keyblock_image (KEYDB_HANDLE hd, kbnode_t *ret_kb,
+                                      iobuf_t *r_image);
 gpg_error_t keydb_update_keyblock (KEYDB_HANDLE hd, kbnode_t kb);
+gpg_error_t keydb_store_sigstatus (KEYDB_HANDLE hd, kbnode_t kb);
 gpg_error_t keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb);
 gpg_error_t keydb_delete_keyblock (KEYDB_HANDLE hd);
+unsigned int keydb_change_count (void);
 gpg_error_t keydb_locate_writable (KEYDB_HANDLE hd, const char *reserved);
 void keydb_rebuild_caches (int noisy);
+void keydb_get_stats (unsigned long *r_searches, unsigned long *r_hits);
+void keydb_dump_stats (void);
 unsigned long keydb_get_skipped_counter (KEYDB_HANDLE hd);
 gpg_error_t keydb_search_reset (KEYDB_HANDLE hd);
 gpg_error_t keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
@@ -269,6 +281,7 @@ int parse_auto_key_locate(char *options);
 int pubkey_letter( int algo );
 char *pubkey_string (PKT_public_key *pk, char *buffer, size_t bufsize);
 #define PUBKEY_STRING_SIZE 32
+void forget_fingerprint (PKT_public_key *pk);
 u32 v3_keyid (gcry_mpi_t a, u32 *ki);
 void hash_public_key( gcry_md_hd_t md, PKT_public_key *pk );
 size_t keystrlen(void);
@@ -103,6 +103,7 @@ static int update_trust = 0;
 #define NODFLG_SELUID (1<<8)	/* Indicate the selected userid. */
 #define NODFLG_SELKEY (1<<9)	/* Indicate the selected key.  */
 #define NODFLG_SELSIG (1<<10)	/* Indicate a selected signature.  */
+#define NODFLG_PENDING (1<<11)	/* Signature waits for a batch.  */
 
 struct sign_attrib
 {
@@ -505,13 +506,17 @@ trustsig_prompt (byte * trust_value, byte * trust_depth, char **regexp)
  * Loop over all LOCUSR and and sign the uids after asking.  If no
  * user id is marked, all user ids will be signed; if some user_ids
  * are marked only those will be signed.  If QUICK is true the
- * function won't ask the user and use sensible defaults.
+ * function won't ask the user and use sensible defaults.  If SIGNERS
+ * is not NULL these keys are used instead of those given by LOCUSR.
+ * If BATCH is not NULL the signatures are only added to BATCH and
+ * their nodes are flagged with NODFLG_PENDING; they are created by
+ * keysig_batch_flush.
  */
 static int
 sign_uids (estream_t fp,
            kbnode_t keyblock, strlist_t locusr, int *ret_modified,
 	   int local, int nonrevocable, int trust, int interactive,
-           int quick)
+           int quick, SK_LIST signers, keysig_batch_t batch)
 {
   int rc = 0;
   SK_LIST sk_list = NULL;
@@ -528,9 +533,14 @@ sign_uids (estream_t fp,
    * why to sign keys using a subkey.  Implementation of USAGE_CERT
    * is just a hack in getkey.c and does not mean that a subkey
    * marked as certification capable will be used. */
-  rc = build_sk_list (locusr, &sk_list, PUBKEY_USAGE_CERT);
-  if (rc)
-    goto leave;
+  if (signers)
+    sk_list = signers;
+  else
+    {
+      rc = build_sk_list (locusr, &sk_list, PUBKEY_USAGE_CERT);
+      if (rc)
+        goto leave;
+    }
 
   /* Loop over all signators.  */
   for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
@@ -1005,6 +1015,7 @@ sign_uids (estream_t fp,
 	    {
 	      PACKET *pkt;
 	      PKT_signature *sig;
+	      kbnode_t sig_node;
 	      struct sign_attrib attrib;
 
 	      assert (primary_pk);
@@ -1021,7 +1032,15 @@ sign_uids (estream_t fp,
 	       * subpacket with v3 keys and the signature becomes
 	       * exportable.  */
 
-	      if (selfsig)
+	      if (selfsig && batch)
+		rc = make_keysig_packet_batch (batch, &sig, primary_pk,
+					       node->pkt->pkt.user_id,
+					       NULL,
+					       pk,
+					       0x13, 0, 0, 0,
+					       keygen_add_std_prefs,
+					       primary_pk);
+	      else if (selfsig)
 		rc = make_keysig_packet (&sig, primary_pk,
 					 node->pkt->pkt.user_id,
 					 NULL,
@@ -1029,6 +1048,14 @@ sign_uids (estream_t fp,
 					 0x13, 0, 0, 0,
 					 keygen_add_std_prefs, primary_pk,
                                          NULL);
+	      else if (batch)
+		rc = make_keysig_packet_batch (batch, &sig, primary_pk,
+					       node->pkt->pkt.user_id,
+					       NULL,
+					       pk,
+					       class, 0,
+					       timestamp, duration,
+					       sign_mk_attrib, &attrib);
 	      else
 		rc = make_keysig_packet (&sig, primary_pk,
 					 node->pkt->pkt.user_id,
@@ -1050,7 +1077,10 @@ sign_uids (estream_t fp,
 	      pkt = xmalloc_clear (sizeof *pkt);
 	      pkt->pkttype = PKT_SIGNATURE;
 	      pkt->pkt.signature = sig;
-	      insert_kbnode (node, new_kbnode (pkt), PKT_SIGNATURE);
+	      sig_node = new_kbnode (pkt);
+	      if (batch)
+		sig_node->flag |= NODFLG_PENDING;
+	      insert_kbnode (node, sig_node, PKT_SIGNATURE);
 	      goto reloop;
 	    }
 	}
@@ -1062,7 +1092,8 @@ sign_uids (estream_t fp,
     } /* End loop over signators.  */
 
  leave:
-  release_sk_list (sk_list);
+  if (sk_list != signers)
+    release_sk_list (sk_list);
   return rc;
 }
 
@@ -1730,7 +1761,8 @@ keyedit_menu (ctrl_t ctrl, const char *username, strlist_t locusr,
 	      }
 
 	    sign_uids (NULL, keyblock, locusr, &modified,
-		       localsig, nonrevokesig, trustsig, interactive, 0);
+		       localsig, nonrevokesig, trustsig, interactive, 0,
+		       NULL, NULL);
 	  }
 	  break;
 
@@ -2234,7 +2266,7 @@ keyedit_menu (ctrl_t ctrl, const char *username, strlist_t locusr,
 
 	  if (update_trust)
 	    {
-	      revalidation_mark ();
+	      revalidation_mark_key (keyblock->pkt->pkt.public_key);
 	      update_trust = 0;
 	    }
 	  goto leave;
@@ -2365,7 +2397,7 @@ keyedit_quick_adduid (ctrl_t ctrl, const char *username, const char *newuid)
         }
 
       if (update_trust)
-        revalidation_mark ();
+        revalidation_mark_key (keyblock->pkt->pkt.public_key);
     }
 
  leave:
@@ -2375,6 +2407,33 @@ keyedit_quick_adduid (ctrl_t ctrl, const char *username, const char *newuid)
 }
 
 
+/* Return true if DESC describes the primary fingerprint of
+   KEYBLOCK.  */
+static int
+is_primary_fpr (kbnode_t keyblock, KEYDB_SEARCH_DESC *desc)
+{
+  byte fprbin[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+
+  fingerprint_from_pk (keyblock->pkt->pkt.public_key, fprbin, &fprlen);
+  if (fprlen == 16 && desc->mode == KEYDB_SEARCH_MODE_FPR16
+      && !memcmp (fprbin, desc->u.fpr, 16))
+    return 1;
+  else if (fprlen == 16 && desc->mode == KEYDB_SEARCH_MODE_FPR
+           && !memcmp (fprbin, desc->u.fpr, 16)
+           && !desc->u.fpr[16]
+           && !desc->u.fpr[17]
+           && !desc->u.fpr[18]
+           && !desc->u.fpr[19])
+    return 1;
+  else if (fprlen == 20 && (desc->mode == KEYDB_SEARCH_MODE_FPR20
+                            || desc->mode == KEYDB_SEARCH_MODE_FPR)
+           && !memcmp (fprbin, desc->u.fpr, 20))
+    return 1;
+  return 0;
+}
+
+
 /* Unattended key signing function.  If the key specifified by FPR is
    availabale and FPR is the primary fingerprint all user ids of the
    user ids of the key are signed using the default signing key.  If
@@ -2420,31 +2479,11 @@ keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
     }
 
   /* Check that the primary fingerprint has been given. */
-  {
-    byte fprbin[MAX_FINGERPRINT_LEN];
-    size_t fprlen;
-
-    fingerprint_from_pk (keyblock->pkt->pkt.public_key, fprbin, &fprlen);
-    if (fprlen == 16 && desc.mode == KEYDB_SEARCH_MODE_FPR16
-        && !memcmp (fprbin, desc.u.fpr, 16))
-      ;
-    else if (fprlen == 16 && desc.mode == KEYDB_SEARCH_MODE_FPR
-             && !memcmp (fprbin, desc.u.fpr, 16)
-             && !desc.u.fpr[16]
-             && !desc.u.fpr[17]
-             && !desc.u.fpr[18]
-             && !desc.u.fpr[19])
-      ;
-    else if (fprlen == 20 && (desc.mode == KEYDB_SEARCH_MODE_FPR20
-                              || desc.mode == KEYDB_SEARCH_MODE_FPR)
-             && !memcmp (fprbin, desc.u.fpr, 20))
-      ;
-    else
-      {
-        log_error (_("\"%s\" is not the primary fingerprint\n"), fpr);
-        goto leave;
-      }
-  }
+  if (!is_primary_fpr (keyblock, &desc))
+    {
+      log_error (_("\"%s\" is not the primary fingerprint\n"), fpr);
+      goto leave;
+    }
 
   if (fix_keyblock (&keyblock))
     modified++;
@@ -2500,7 +2539,8 @@ keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
     }
 
   /* Sign. */
-  sign_uids (es_stdout, keyblock, locusr, &modified, local, 0, 0, 0, 1);
+  sign_uids (es_stdout, keyblock, locusr, &modified, local, 0, 0, 0, 1,
+             NULL, NULL);
   es_fflush (es_stdout);
 
   if (modified)
@@ -2516,7 +2556,7 @@ keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
     log_info (_("Key not changed so no update needed.\n"));
 
   if (update_trust)
-    revalidation_mark ();
+    revalidation_mark_key (keyblock->pkt->pkt.public_key);
 
 
  leave:
@@ -2524,6 +2564,233 @@ keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
   keydb_release (kdbhd);
 }
 
+/* The number of keys signed by keyedit_quick_sign_keys before their
+   signatures are created and the keys are written back.  */
+#define QUICK_SIGN_BATCH 64
+
+
+/* Create the signatures of BATCH for the NKEYS keyblocks at
+   KEYBLOCKS and write each keyblock which got all of its new
+   signatures using HD.  The keyblocks are released.  Returns the
+   number of keys written.  */
+static int
+quick_sign_commit (KEYDB_HANDLE hd, keysig_batch_t batch,
+                   kbnode_t *keyblocks, int nkeys)
+{
+  gpg_error_t err;
+  KEYDB_SEARCH_DESC desc;
+  PKT_public_key *pk;
+  kbnode_t node;
+  size_t fprlen;
+  int i, failed, count;
+
+  /* The error has already been printed; the keys with a missing
+     signature are found below.  */
+  keysig_batch_flush (batch);
+
+  for (count=i=0; i < nkeys; i++)
+    {
+      pk = keyblocks[i]->pkt->pkt.public_key;
+      failed = 0;
+      for (node = keyblocks[i]; node; node = node->next)
+        if ((node->flag & NODFLG_PENDING))
+          {
+            node->flag &= ~NODFLG_PENDING;
+            if (!node->pkt->pkt.signature->data[0])
+              failed = 1;
+          }
+      if (failed)
+        {
+          log_error (_("key %s: not all signatures could be created;"
+                       " key not changed\n"), keystr_from_pk (pk));
+          goto next;
+        }
+
+      memset (&desc, 0, sizeof desc);
+      fingerprint_from_pk (pk, desc.u.fpr, &fprlen);
+      desc.mode = (fprlen == 16
+                   ? KEYDB_SEARCH_MODE_FPR16 : KEYDB_SEARCH_MODE_FPR20);
+      err = keydb_search_reset (hd);
+      if (!err)
+        err = keydb_search (hd, &desc, 1, NULL);
+      if (!err)
+        err = keydb_update_keyblock (hd, keyblocks[i]);
+      if (err)
+        log_error (_("key %s: update failed: %s\n"),
+                   keystr_from_pk (pk), gpg_strerror (err));
+      else
+        count++;
+
+    next:
+      release_kbnode (keyblocks[i]);
+      keyblocks[i] = NULL;
+    }
+  return count;
+}
+
+
+/* Unattended signing of many keys.  FNAME is a file, or stdin if it
+   is NULL or "-", with one primary fingerprint per line; empty lines
+   and lines starting with a '#' are ignored.  All useful user ids of
+   these keys are signed with the keys given by LOCUSR or the default
+   key, as with keyedit_quick_sign.  The signatures are requested
+   from the agent in batches and the keys are written with one keydb
+   handle which keeps the keyrings locked until all keys are done;
+   the trustdb is marked for an update only once at the end.  */
+void
+keyedit_quick_sign_keys (ctrl_t ctrl, const char *fname,
+                         strlist_t locusr, int local)
+{
+  gpg_error_t err;
+  estream_t fp;
+  char line[256];
+  char *fpr;
+  size_t n;
+  KEYDB_HANDLE hd = NULL;
+  KEYDB_SEARCH_DESC desc;
+  SK_LIST sk_list = NULL;
+  keysig_batch_t batch = NULL;
+  kbnode_t keyblocks[QUICK_SIGN_BATCH];
+  kbnode_t keyblock;
+  int nkeys = 0;
+  int modified;
+  unsigned long lnr = 0;
+  unsigned long nsigned = 0;
+
+  (void)ctrl;
+
+#ifdef HAVE_W32_SYSTEM
+  /* See keyedit_menu for why we need this.  */
+  check_trustdb_stale ();
+#endif
+
+  if (!fname || !strcmp (fname, "-"))
+    {
+      fp = es_stdin;
+      fname = "[stdin]";
+    }
+  else if (!(fp = es_fopen (fname, "r")))
+    {
+      log_error (_("can't open '%s': %s\n"), fname, strerror (errno));
+      return;
+    }
+  if (is_secured_file (es_fileno (fp)))
+    {
+      if (fp != es_stdin)
+        es_fclose (fp);
+      gpg_err_set_errno (EPERM);
+      log_error (_("can't open '%s': %s\n"), fname, strerror (errno));
+      return;
+    }
+
+  err = build_sk_list (locusr, &sk_list, PUBKEY_USAGE_CERT);
+  if (err)
+    goto leave;
+  hd = keydb_new ();
+  err = keydb_lock (hd);
+  if (err)
+    {
+      log_error (_("error locking keyring: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+  batch = keysig_batch_new ();
+
+  while (es_fgets (line, DIM(line)-1, fp))
+    {
+      lnr++;
+      n = strlen (line);
+      if (!n || line[n-1] != '\n')
+        {
+          int c;
+
+          if (n == DIM(line)-2)
+            {
+              log_error ("%s:%lu: %s\n", fname, lnr, _("line too long"));
+              /* Skip the rest of the line.  */
+              while ((c = es_getc (fp)) != EOF && c != '\n')
+                ;
+              continue;
+            }
+          /* The last line without a LF.  */
+        }
+      fpr = trim_spaces (line);
+      if (!*fpr || *fpr == '#')
+        continue;
+
+      /* As with keyedit_quick_sign we require the fingerprint of the
+         primary key.  */
+      if (classify_user_id (fpr, &desc, 1)
+          || !(desc.mode == KEYDB_SEARCH_MODE_FPR
+               || desc.mode == KEYDB_SEARCH_MODE_FPR16
+               || desc.mode == KEYDB_SEARCH_MODE_FPR20))
+        {
+          log_error (_("\"%s\" is not a fingerprint\n"), fpr);
+          continue;
+        }
+      err = get_keyblock_byfprint (&keyblock, desc.u.fpr,
+                                   desc.mode == KEYDB_SEARCH_MODE_FPR16
+                                   ? 16 : 20);
+      if (err)
+        {
+          log_error (_("key \"%s\" not found: %s\n"),
+                     fpr, gpg_strerror (err));
+          continue;
+        }
+      if (!is_primary_fpr (keyblock, &desc))
+        {
+          log_error (_("\"%s\" is not the primary fingerprint\n"), fpr);
+          release_kbnode (keyblock);
+          continue;
+        }
+
+      modified = fix_keyblock (&keyblock);
+      if (keyblock->pkt->pkt.public_key->flags.revoked)
+        {
+          show_key_with_all_names (es_stdout, keyblock, 0, 0, 0, 0, 0, 1);
+          log_error ("%s%s", _("Key is revoked."), _("  Unable to sign.\n"));
+          release_kbnode (keyblock);
+          continue;
+        }
+
+      menu_select_uid (keyblock, 0);
+      err = sign_uids (es_stdout, keyblock, locusr, &modified, local,
+                       0, 0, 0, 1, sk_list, batch);
+      es_fflush (es_stdout);
+      if (err || !modified)
+        {
+          release_kbnode (keyblock);
+          if (err)
+            break;
+          continue;
+        }
+
+      keyblocks[nkeys++] = keyblock;
+      if (nkeys == QUICK_SIGN_BATCH)
+        {
+          nsigned += quick_sign_commit (hd, batch, keyblocks, nkeys);
+          nkeys = 0;
+        }
+    }
+  if (es_ferror (fp))
+    log_error (_("error reading '%s': %s\n"), fname, strerror (errno));
+
+  if (nkeys)
+    nsigned += quick_sign_commit (hd, batch, keyblocks, nkeys);
+
+  if (!opt.quiet)
+    log_info (_("%lu keys changed\n"), nsigned);
+
+  if (update_trust)
+    revalidation_mark ();
+
+ leave:
+  keysig_batch_release (batch);
+  keydb_release (hd);
+  release_sk_list (sk_list);
+  if (fp != es_stdin)
+    es_fclose (fp);
+}
+
 
 
 static void
@@ -45,6 +45,7 @@
 #include "../common/shareddefs.h"
 #include "host2net.h"
 #include "mbox-util.h"
+#include "../vanity/vanity.h"
 
 
 /* The default algorithms.  If you change them remember to change them
@@ -89,7 +90,19 @@ enum para_name {
   pSERIALNO,
   pCARDBACKUPKEY,
   pHANDLE,
-  pKEYSERVER
+  pKEYSERVER,
+  pVANITYPATTERN,
+  pVANITYWINDOW,
+  pVANITYTIMES,   /* Same as START/END pairs in seconds since epoch.  */
+  pVANITYDIRECTION,
+  pVANITYHITS,
+  pVANITYBUDGET,
+  pVANITYITERATIONS,
+  pVANITYSEEDKEY,
+  pVANITYSEEDRANGE,
+  pSUBVANITYPATTERN,
+  pSUBVANITYKDF,
+  pKEYGRIP
 };
 
 struct para_data_s {
@@ -111,6 +124,10 @@ struct output_control_s
   int dryrun;
   unsigned int keygen_flags;
   int use_files;
+  int bulk;            /* Write all keys under one keyring lock.  */
+  KEYDB_HANDLE pub_hd; /* The locked keyring of a bulk write or NULL.  */
+  int parallel;        /* Run the vanity searches of the file at once.  */
+  struct pending_key_s *pending;  /* The blocks held back by PARALLEL.  */
   struct {
     char  *fname;
     char  *newfname;
@@ -120,6 +137,16 @@ struct output_control_s
 };
 
 
+/* A checked parameter block of a batch file whose key is created
+   when the searches queued before it have ended.  */
+struct pending_key_s
+{
+  struct pending_key_s *next;
+  struct para_data_s *para;
+  char jobid[17];      /* The queued vanity search or empty.  */
+};
+
+
 struct opaque_data_usage_and_pk {
     unsigned int usage;
     PKT_public_key *pk;
@@ -135,6 +162,26 @@ static byte zip_prefs[MAX_PREFS];
 static int nzip_prefs;
 static int mdc_available,ks_modify;
 
+/* A key collected by a vanity search.  The agent sends its public key
+   along with its VANITY_RESULT status line; do_create_from_keygrip
+   takes it from here instead of reading it back.  */
+struct vanity_hit_s
+{
+  struct vanity_hit_s *next;
+  u32 created;
+  char fpr[20];
+  char hexgrip[41];
+  gcry_sexp_t s_pubkey;  /* NULL once it has been used.  */
+};
+
+/* The keys received during the current vanity search in the order
+   they arrived.  */
+static struct vanity_hit_s *vanity_hits;
+static struct vanity_hit_s **vanity_hits_tail = &vanity_hits;
+
+/* The cache nonce used for the keyblocks of the received keys.  */
+static const char *vanity_hits_cache_nonce;
+
 static void do_generate_keypair( struct para_data_s *para,
 				 struct output_control_s *outctrl, int card );
 static int write_keyblock (iobuf_t out, kbnode_t node);
@@ -1196,6 +1243,49 @@ key_from_sexp (gcry_mpi_t *array, gcry_sexp_t sexp,
 }
 
 
+/* Result callback of agent_genkey collecting the keys of a vanity
+   search.  */
+static gpg_error_t
+collect_vanity_hit (void *opaque, u32 created, const char *fpr,
+                    const char *hexgrip, gcry_sexp_t s_pubkey)
+{
+  gpg_error_t err;
+  struct vanity_hit_s *hit;
+
+  (void)opaque;
+
+  hit = xtrycalloc (1, sizeof *hit);
+  if (!hit)
+    {
+      err = gpg_error_from_syserror ();
+      gcry_sexp_release (s_pubkey);
+      return err;
+    }
+  hit->created = created;
+  memcpy (hit->fpr, fpr, 20);
+  strcpy (hit->hexgrip, hexgrip);
+  hit->s_pubkey = s_pubkey;
+  *vanity_hits_tail = hit;
+  vanity_hits_tail = &hit->next;
+  return 0;
+}
+
+
+static void
+release_vanity_hits (void)
+{
+  struct vanity_hit_s *hit;
+
+  while ((hit = vanity_hits))
+    {
+      vanity_hits = hit->next;
+      gcry_sexp_release (hit->s_pubkey);
+      xfree (hit);
+    }
+  vanity_hits_tail = &vanity_hits;
+}
+
+
 /* Create a keyblock using the given KEYGRIP.  ALGO is the OpenPGP
    algorithm of that keygrip.  */
 static int
@@ -1208,6 +1298,7 @@ do_create_from_keygrip (ctrl_t ctrl, int algo, const char *hexkeygrip,
   PKT_public_key *pk;
   gcry_sexp_t s_key;
   const char *algoelem;
+  struct vanity_hit_s *hit;
 
   if (hexkeygrip[0] == '&')
     hexkeygrip++;
@@ -1224,19 +1315,29 @@ do_create_from_keygrip (ctrl_t ctrl, int algo, const char *hexkeygrip,
     }
 
 
-  /* Ask the agent for the public key matching HEXKEYGRIP.  */
-  {
-    unsigned char *public;
+  /* Take a key received from a vanity search or ask the agent for
+     the public key matching HEXKEYGRIP.  */
+  for (hit = vanity_hits; hit; hit = hit->next)
+    if (hit->s_pubkey && !ascii_strcasecmp (hit->hexgrip, hexkeygrip))
+      break;
+  if (hit)
+    {
+      s_key = hit->s_pubkey;
+      hit->s_pubkey = NULL;
+    }
+  else
+    {
+      unsigned char *public;
 
-    err = agent_readkey (ctrl, 0, hexkeygrip, &public);
-    if (err)
-      return err;
-    err = gcry_sexp_sscan (&s_key, NULL,
-                           public, gcry_sexp_canon_len (public, 0, NULL, NULL));
-    xfree (public);
-    if (err)
-      return err;
-  }
+      err = agent_readkey (ctrl, 0, hexkeygrip, &public);
+      if (err)
+        return err;
+      err = gcry_sexp_sscan (&s_key, NULL, public,
+                             gcry_sexp_canon_len (public, 0, NULL, NULL));
+      xfree (public);
+      if (err)
+        return err;
+    }
 
   /* Build a public key packet.  */
   pk = xtrycalloc (1, sizeof *pk);
@@ -1268,6 +1369,20 @@ do_create_from_keygrip (ctrl_t ctrl, int algo, const char *hexkeygrip,
     }
   gcry_sexp_release (s_key);
 
+  if (hit)
+    {
+      unsigned char fpr[MAX_FINGERPRINT_LEN];
+      size_t fprlen;
+
+      fingerprint_from_pk (pk, fpr, &fprlen);
+      if (fprlen != 20 || memcmp (fpr, hit->fpr, 20))
+        {
+          log_error ("fingerprint of the vanity key does not match\n");
+          free_public_key (pk);
+          return gpg_error (GPG_ERR_BAD_PUBKEY);
+        }
+    }
+
   pkt = xtrycalloc (1, sizeof *pkt);
   if (!pkt)
     {
@@ -1284,29 +1399,24 @@ do_create_from_keygrip (ctrl_t ctrl, int algo, const char *hexkeygrip,
 }
 
 
-/* Common code for the key generation fucntion gen_xxx.  */
+/* Common code for the key generation fucntion gen_xxx.  If
+   VANITY is not NULL the agent is asked for a key with a keyid
+   matching its pattern; the creation time of that key is the one
+   reported by the agent and not TIMESTAMP.  */
 static int
 common_gen (const char *keyparms, int algo, const char *algoelem,
             kbnode_t pub_root, u32 timestamp, u32 expireval, int is_subkey,
-            int keygen_flags, const char *passphrase, char **cache_nonce_addr)
+            int keygen_flags, const char *passphrase, char **cache_nonce_addr,
+            struct agent_vanity_parm_s *vanity)
 {
   int err;
   PACKET *pkt;
   PKT_public_key *pk;
   gcry_sexp_t s_key;
-  // EDITED FOR VANITY
-  // Set up fingerprint and timestamp-ranging for bruteforcing keyid.
-  u32 lowertime = timestamp - 2000000;
-  byte *fp;
-  u32 keyid;
-
-  fp = xmalloc (MAX_FINGERPRINT_LEN);
-  // VANITY EDITS END
 
   err = agent_genkey (NULL, cache_nonce_addr, keyparms,
                       !!(keygen_flags & KEYGEN_FLAG_NO_PROTECTION),
-                      passphrase,
-                      &s_key);
+                      passphrase, vanity, &s_key);
   if (err)
     {
       log_error ("agent_genkey failed: %s\n", gpg_strerror (err) );
@@ -1321,42 +1431,52 @@ common_gen (const char *keyparms, int algo, const char *algoelem,
       return err;
     }
 
-  // EDITED FOR VANITY
-  // Version, algorithm, and public key material don't change.
+  pk->timestamp = timestamp;
   pk->version = 4;
   pk->pubkey_algo = algo;
-  // However, range over timestamp to bruteforce the timestamp found by agent.
-  for (; lowertime <= timestamp; ++lowertime) {
-    pk->timestamp = lowertime;
-    if (expireval)
-      pk->expiredate = pk->timestamp + expireval;
-
-    // algo should always only be PUBKEY_ALGO_EDDSA for this.
-    if (algo == PUBKEY_ALGO_EDDSA) {
-      err = ecckey_from_sexp (pk->pkey, s_key, algo);
-    } else {
-      log_debug("ONLY USE THIS WITH EDDSA!\n");
-      BUG();
-    }
-    if (err)
-      {
-        log_error ("key_from_sexp failed: %s\n", gpg_strerror (err) );
-        gcry_sexp_release (s_key);
-        free_public_key (pk);
-        return err;
-      }
-    fp = fingerprint_from_pk(pk, fp, NULL);
-    keyid = keyid_from_pk(pk, NULL);
-    /*if ((keyid & 0xFFFF) == 0xCAFE ||
-        (keyid & 0xFFFF000) == 0xF00D000 {*/
-    if (keyid == 0xF00DF00D ||
-        keyid == 0xDEADBEEF) {
-      break;
+
+  if (algo == PUBKEY_ALGO_ECDSA
+      || algo == PUBKEY_ALGO_EDDSA
+      || algo == PUBKEY_ALGO_ECDH )
+    err = ecckey_from_sexp (pk->pkey, s_key, algo);
+  else
+    err = key_from_sexp (pk->pkey, s_key, "public-key", algoelem);
+  if (err)
+    {
+      log_error ("key_from_sexp failed: %s\n", gpg_strerror (err) );
+      gcry_sexp_release (s_key);
+      free_public_key (pk);
+      return err;
     }
-  }
-  // VANITY EDITS END
   gcry_sexp_release (s_key);
 
+  if (vanity)
+    {
+      unsigned char fpr[MAX_FINGERPRINT_LEN];
+      size_t fprlen;
+
+      /* Use the creation time the agent found and make sure that it
+         yields the fingerprint the agent computed.  */
+      if (!vanity->timestamp)
+        {
+          log_error ("agent did not return the creation time"
+                     " of the vanity key\n");
+          free_public_key (pk);
+          return gpg_error (GPG_ERR_NO_DATA);
+        }
+      pk->timestamp = vanity->timestamp;
+      forget_fingerprint (pk);
+      fingerprint_from_pk (pk, fpr, &fprlen);
+      if (fprlen != 20 || memcmp (fpr, vanity->fpr, 20))
+        {
+          log_error ("fingerprint of the vanity key does not match\n");
+          free_public_key (pk);
+          return gpg_error (GPG_ERR_BAD_PUBKEY);
+        }
+    }
+  if (expireval)
+    pk->expiredate = pk->timestamp + expireval;
+
   pkt = xtrycalloc (1, sizeof *pkt);
   if (!pkt)
     {
@@ -1420,7 +1540,7 @@ gen_elg (int algo, unsigned int nbits, KBNODE pub_root,
     {
       err = common_gen (keyparms, algo, "pgy",
                         pub_root, timestamp, expireval, is_subkey,
-                        keygen_flags, passphrase, cache_nonce_addr);
+                        keygen_flags, passphrase, cache_nonce_addr, NULL);
       xfree (keyparms);
     }
 
@@ -1507,7 +1627,7 @@ gen_dsa (unsigned int nbits, KBNODE pub_root,
     {
       err = common_gen (keyparms, PUBKEY_ALGO_DSA, "pqgy",
                         pub_root, timestamp, expireval, is_subkey,
-                        keygen_flags, passphrase, cache_nonce_addr);
+                        keygen_flags, passphrase, cache_nonce_addr, NULL);
       xfree (keyparms);
     }
 
@@ -1516,24 +1636,13 @@ gen_dsa (unsigned int nbits, KBNODE pub_root,
 
 
 
-/*
- * Generate an ECC key
- */
-static gpg_error_t
-gen_ecc (int algo, const char *curve, kbnode_t pub_root,
-         u32 timestamp, u32 expireval, int is_subkey,
-         int keygen_flags, const char *passphrase, char **cache_nonce_addr)
+/* Return the S-expression for gpg-agent to generate an ECC key of
+   type ALGO on CURVE, or NULL on error.  The caller must xfree it.  */
+static char *
+ecc_keyparms (int algo, const char *curve, int keygen_flags)
 {
-  gpg_error_t err;
   char *keyparms;
 
-  assert (algo == PUBKEY_ALGO_ECDSA
-          || algo == PUBKEY_ALGO_EDDSA
-          || algo == PUBKEY_ALGO_ECDH);
-
-  if (!curve || !*curve)
-    return gpg_error (GPG_ERR_UNKNOWN_CURVE);
-
   /* Note that we use the "comp" flag with EdDSA to request the use of
      a 0x40 compression prefix octet.  */
   if (algo == PUBKEY_ALGO_EDDSA)
@@ -1550,14 +1659,38 @@ gen_ecc (int algo, const char *curve, kbnode_t pub_root,
        (((keygen_flags & KEYGEN_FLAG_TRANSIENT_KEY)
          && (keygen_flags & KEYGEN_FLAG_NO_PROTECTION))?
         " transient-key" : ""));
+  return keyparms;
+}
+
 
+/*
+ * Generate an ECC key
+ */
+static gpg_error_t
+gen_ecc (int algo, const char *curve, kbnode_t pub_root,
+         u32 timestamp, u32 expireval, int is_subkey,
+         int keygen_flags, const char *passphrase, char **cache_nonce_addr,
+         struct agent_vanity_parm_s *vanity)
+{
+  gpg_error_t err;
+  char *keyparms;
+
+  assert (algo == PUBKEY_ALGO_ECDSA
+          || algo == PUBKEY_ALGO_EDDSA
+          || algo == PUBKEY_ALGO_ECDH);
+
+  if (!curve || !*curve)
+    return gpg_error (GPG_ERR_UNKNOWN_CURVE);
+
+  keyparms = ecc_keyparms (algo, curve, keygen_flags);
   if (!keyparms)
     err = gpg_error_from_syserror ();
   else
     {
       err = common_gen (keyparms, algo, "",
                         pub_root, timestamp, expireval, is_subkey,
-                        keygen_flags, passphrase, cache_nonce_addr);
+                        keygen_flags, passphrase, cache_nonce_addr,
+                        vanity);
       xfree (keyparms);
     }
 
@@ -1565,21 +1698,16 @@ gen_ecc (int algo, const char *curve, kbnode_t pub_root,
 }
 
 
-/*
- * Generate an RSA key.
- */
-static int
-gen_rsa (int algo, unsigned int nbits, KBNODE pub_root,
-         u32 timestamp, u32 expireval, int is_subkey,
-         int keygen_flags, const char *passphrase, char **cache_nonce_addr)
+/* Return the S-expression for gpg-agent to generate an RSA key of
+   *R_NBITS bits, or NULL on error.  An invalid size is first fixed
+   and stored back at R_NBITS.  The caller must xfree the result.  */
+static char *
+rsa_keyparms (unsigned int *r_nbits, int keygen_flags)
 {
-  int err;
-  char *keyparms;
+  unsigned int nbits = *r_nbits;
   char nbitsstr[35];
   const unsigned maxsize = (opt.flags.large_rsa ? 8192 : 4096);
 
-  assert (is_RSA(algo));
-
   if (!nbits)
     nbits = DEFAULT_STD_KEYSIZE;
 
@@ -1600,19 +1728,38 @@ gen_rsa (int algo, unsigned int nbits, KBNODE pub_root,
       log_info (_("keysize rounded up to %u bits\n"), nbits );
     }
 
+  *r_nbits = nbits;
   snprintf (nbitsstr, sizeof nbitsstr, "%u", nbits);
-  keyparms = xtryasprintf ("(genkey(rsa(nbits %zu:%s)%s))",
-                           strlen (nbitsstr), nbitsstr,
-                           ((keygen_flags & KEYGEN_FLAG_TRANSIENT_KEY)
-                            && (keygen_flags & KEYGEN_FLAG_NO_PROTECTION))?
-                           "(transient-key)" : "" );
+  return xtryasprintf ("(genkey(rsa(nbits %zu:%s)%s))",
+                       strlen (nbitsstr), nbitsstr,
+                       ((keygen_flags & KEYGEN_FLAG_TRANSIENT_KEY)
+                        && (keygen_flags & KEYGEN_FLAG_NO_PROTECTION))?
+                       "(transient-key)" : "" );
+}
+
+
+/*
+ * Generate an RSA key.
+ */
+static int
+gen_rsa (int algo, unsigned int nbits, KBNODE pub_root,
+         u32 timestamp, u32 expireval, int is_subkey,
+         int keygen_flags, const char *passphrase, char **cache_nonce_addr,
+         struct agent_vanity_parm_s *vanity)
+{
+  int err;
+  char *keyparms;
+
+  assert (is_RSA(algo));
+
+  keyparms = rsa_keyparms (&nbits, keygen_flags);
   if (!keyparms)
     err = gpg_error_from_syserror ();
   else
     {
       err = common_gen (keyparms, algo, "ne",
                         pub_root, timestamp, expireval, is_subkey,
-                        keygen_flags, passphrase, cache_nonce_addr);
+                        keygen_flags, passphrase, cache_nonce_addr, vanity);
       xfree (keyparms);
     }
 
@@ -2336,6 +2483,60 @@ parse_creation_string (const char *string)
 }
 
 
+/* Parse a Vanity-Window string, which is a list of windows separated
+   by white space or commas.  A window is either "START/END" or just
+   "START", in which case it ends now; START and END are in the format
+   of a Creation-Date.  Windows ending in the future are not allowed.
+   Returns a new pVANITYTIMES parameter or NULL on error. */
+static struct para_data_s *
+parse_vanity_window (const char *string)
+{
+  struct para_data_s *r;
+  u32 start[VANITY_MAX_WINDOWS], end[VANITY_MAX_WINDOWS];
+  u32 curtime = make_timestamp ();
+  char buffer[40];
+  const char *s;
+  char *slash;
+  unsigned int nwindows = 0;
+  unsigned int i;
+  size_t n;
+  char *p;
+
+  for (s = string; *s; s += n)
+    {
+      while (*s == ',' || spacep (s))
+        s++;
+      if (!*s)
+        break;
+      for (n=0; s[n] && s[n] != ',' && !spacep (s+n); n++)
+        ;
+      if (n >= sizeof buffer || nwindows == VANITY_MAX_WINDOWS)
+        return NULL;
+      memcpy (buffer, s, n);
+      buffer[n] = 0;
+      slash = strchr (buffer, '/');
+      if (slash)
+        *slash++ = 0;
+      start[nwindows] = parse_creation_string (buffer);
+      end[nwindows] = slash? parse_creation_string (slash) : curtime;
+      if (!start[nwindows] || !end[nwindows]
+          || start[nwindows] > end[nwindows] || end[nwindows] > curtime)
+        return NULL;
+      nwindows++;
+    }
+  if (!nwindows)
+    return NULL;
+
+  r = xmalloc_clear (sizeof *r + nwindows * 22);
+  r->key = pVANITYTIMES;
+  p = r->u.value;
+  for (i=0; i < nwindows; i++)
+    p += sprintf (p, "%s%lu/%lu", i? ",":"",
+                  (unsigned long)start[i], (unsigned long)end[i]);
+  return r;
+}
+
+
 /* object == 0 for a key, and 1 for a sig */
 u32
 ask_expire_interval(int object,const char *def_expire)
@@ -2762,11 +2963,13 @@ do_ask_passphrase (STRING2KEY **ret_s2k, int mode, int *r_canceled)
 
 
 /* Basic key generation.  Here we divert to the actual generation
-   routines based on the requested algorithm.  */
+   routines based on the requested algorithm.  VANITY is only
+   supported for ECC and RSA keys.  */
 static int
 do_create (int algo, unsigned int nbits, const char *curve, KBNODE pub_root,
            u32 timestamp, u32 expiredate, int is_subkey,
-           int keygen_flags, const char *passphrase, char **cache_nonce_addr)
+           int keygen_flags, const char *passphrase, char **cache_nonce_addr,
+           struct agent_vanity_parm_s *vanity)
 {
   gpg_error_t err;
 
@@ -2779,7 +2982,13 @@ do_create (int algo, unsigned int nbits, const char *curve, KBNODE pub_root,
 "disks) during the prime generation; this gives the random number\n"
 "generator a better chance to gain enough entropy.\n") );
 
-  if (algo == PUBKEY_ALGO_ELGAMAL_E)
+  if (vanity)
+    vanity->algo = algo;
+
+  if (vanity && algo != PUBKEY_ALGO_EDDSA && algo != PUBKEY_ALGO_ECDSA
+      && algo != PUBKEY_ALGO_ECDH && algo != PUBKEY_ALGO_RSA)
+    err = gpg_error (GPG_ERR_PUBKEY_ALGO);
+  else if (algo == PUBKEY_ALGO_ELGAMAL_E)
     err = gen_elg (algo, nbits, pub_root, timestamp, expiredate, is_subkey,
                    keygen_flags, passphrase, cache_nonce_addr);
   else if (algo == PUBKEY_ALGO_DSA)
@@ -2789,10 +2998,11 @@ do_create (int algo, unsigned int nbits, const char *curve, KBNODE pub_root,
            || algo == PUBKEY_ALGO_EDDSA
            || algo == PUBKEY_ALGO_ECDH)
     err = gen_ecc (algo, curve, pub_root, timestamp, expiredate, is_subkey,
-                   keygen_flags, passphrase, cache_nonce_addr);
+                   keygen_flags, passphrase, cache_nonce_addr,
+                   vanity);
   else if (algo == PUBKEY_ALGO_RSA)
     err = gen_rsa (algo, nbits, pub_root, timestamp, expiredate, is_subkey,
-                   keygen_flags, passphrase, cache_nonce_addr);
+                   keygen_flags, passphrase, cache_nonce_addr, vanity);
   else
     BUG();
 
@@ -3046,9 +3256,11 @@ get_parameter_revkey( struct para_data_s *para, enum para_name key )
     return r? &r->u.revkey : NULL;
 }
 
+/* Check the parameters PARA of a key and convert them for
+   do_generate_keypair.  Returns -1 on error.  */
 static int
-proc_parameter_file( struct para_data_s *para, const char *fname,
-                     struct output_control_s *outctrl, int card )
+check_parameter_file (struct para_data_s *para, const char *fname,
+                      struct output_control_s *outctrl)
 {
   struct para_data_s *r;
   const char *s1, *s2, *s3;
@@ -3191,6 +3403,199 @@ proc_parameter_file( struct para_data_s *para, const char *fname,
 	}
     }
 
+  /* Check the vanity pattern, if any.  */
+  r = get_parameter (para, pVANITYPATTERN);
+  if (r)
+    {
+      vanity_pattern_t pattern;
+
+      algo = get_parameter_algo (para, pKEYTYPE, NULL);
+      if (algo != PUBKEY_ALGO_EDDSA && algo != PUBKEY_ALGO_ECDSA
+          && algo != PUBKEY_ALGO_RSA)
+        {
+          log_error ("%s:%d: vanity keys must be of type EDDSA, ECDSA"
+                     " or RSA\n",
+                     fname, r->lnr);
+          return -1;
+        }
+      if (vanity_pattern_new (&pattern, r->u.value))
+        {
+          log_error ("%s:%d: invalid vanity pattern\n", fname, r->lnr);
+          return -1;
+        }
+      /* A search for the best score has no end of its own.  */
+      if (vanity_pattern_is_scoring (pattern)
+          && !get_parameter (para, pVANITYBUDGET)
+          && !get_parameter (para, pVANITYITERATIONS))
+        {
+          log_error ("%s:%d: a scoring vanity pattern needs"
+                     " Vanity-Budget or Vanity-Iterations\n",
+                     fname, r->lnr);
+          vanity_pattern_release (pattern);
+          return -1;
+        }
+      vanity_pattern_release (pattern);
+    }
+  else if ((r = get_parameter (para, pVANITYWINDOW))
+           || (r = get_parameter (para, pSUBVANITYPATTERN))
+           || (r = get_parameter (para, pVANITYDIRECTION))
+           || (r = get_parameter (para, pVANITYHITS))
+           || (r = get_parameter (para, pVANITYBUDGET))
+           || (r = get_parameter (para, pVANITYITERATIONS))
+           || (r = get_parameter (para, pVANITYSEEDKEY))
+           || (r = get_parameter (para, pVANITYSEEDRANGE)))
+    {
+      log_error ("%s:%d: no Vanity-Pattern given\n", fname, r->lnr);
+      return -1;
+    }
+
+  /* The share of a search distributed over several hosts.  Only the
+     seeds of Ed25519 keys are taken from the job key.  */
+  if ((r = get_parameter (para, pVANITYSEEDKEY))
+      || (r = get_parameter (para, pVANITYSEEDRANGE)))
+    {
+      const char *s;
+      char *endp;
+
+      if (!get_parameter (para, pVANITYSEEDKEY)
+          || !get_parameter (para, pVANITYSEEDRANGE))
+        {
+          log_error ("%s:%d: Vanity-Seed-Key and Vanity-Seed-Range must be"
+                     " given together\n", fname, r->lnr);
+          return -1;
+        }
+      if (get_parameter_algo (para, pKEYTYPE, NULL) != PUBKEY_ALGO_EDDSA
+          || get_parameter (para, pSUBVANITYPATTERN))
+        {
+          log_error ("%s:%d: a distributed vanity search is only possible"
+                     " for an EDDSA key without a vanity subkey\n",
+                     fname, r->lnr);
+          return -1;
+        }
+      r = get_parameter (para, pVANITYSEEDKEY);
+      if (strlen (r->u.value) != 64
+          || strspn (r->u.value, "0123456789abcdefABCDEF") != 64)
+        {
+          log_error ("%s:%d: invalid Vanity-Seed-Key\n", fname, r->lnr);
+          return -1;
+        }
+      r = get_parameter (para, pVANITYSEEDRANGE);
+      s = r->u.value;
+      if (!digitp (s) || (strtoul (s, &endp, 10), *endp != ' ')
+          || !digitp (endp+1) || !strtoul (endp+1, NULL, 10))
+        {
+          log_error ("%s:%d: invalid Vanity-Seed-Range\n", fname, r->lnr);
+          return -1;
+        }
+    }
+
+  /* The subkey is searched at the same time as the primary key.  */
+  r = get_parameter (para, pSUBVANITYPATTERN);
+  if (r)
+    {
+      vanity_pattern_t pattern;
+
+      algo = get_parameter_algo (para, pSUBKEYTYPE, NULL);
+      if (algo != PUBKEY_ALGO_EDDSA && algo != PUBKEY_ALGO_ECDSA
+          && algo != PUBKEY_ALGO_ECDH)
+        {
+          log_error ("%s:%d: vanity subkeys must be of type EDDSA, ECDSA"
+                     " or ECDH\n", fname, r->lnr);
+          return -1;
+        }
+      if (!get_parameter_value (para, pSUBKEYCURVE))
+        {
+          log_error ("%s:%d: no Subkey-Curve given\n", fname, r->lnr);
+          return -1;
+        }
+      if (vanity_pattern_new (&pattern, r->u.value))
+        {
+          log_error ("%s:%d: invalid vanity pattern\n", fname, r->lnr);
+          return -1;
+        }
+      if (vanity_pattern_is_scoring (pattern))
+        {
+          log_error ("%s:%d: a vanity subkey can't be searched by score\n",
+                     fname, r->lnr);
+          vanity_pattern_release (pattern);
+          return -1;
+        }
+      vanity_pattern_release (pattern);
+      r = get_parameter (para, pSUBVANITYKDF);
+      if (r && algo != PUBKEY_ALGO_ECDH)
+        {
+          log_error ("%s:%d: Subkey-Vanity-KDF needs a subkey of type"
+                     " ECDH\n", fname, r->lnr);
+          return -1;
+        }
+    }
+  else if ((r = get_parameter (para, pSUBVANITYKDF)))
+    {
+      log_error ("%s:%d: no Subkey-Vanity-Pattern given\n", fname, r->lnr);
+      return -1;
+    }
+
+  if (((r = get_parameter (para, pVANITYHITS))
+       && (!digitp (r->u.value)
+           || strtoul (r->u.value, NULL, 10) > VANITY_MAX_HITS))
+      || ((r = get_parameter (para, pVANITYBUDGET)) && !digitp (r->u.value))
+      || ((r = get_parameter (para, pVANITYITERATIONS))
+          && !digitp (r->u.value)))
+    {
+      log_error ("%s:%d: invalid number\n", fname, r->lnr);
+      return -1;
+    }
+
+  /* A search would hold the keyring lock of a bulk write.  */
+  if (outctrl->bulk && (r = get_parameter (para, pVANITYPATTERN)))
+    {
+      log_error ("%s:%d: Vanity-Pattern can't be used with %%bulk\n",
+                 fname, r->lnr);
+      return -1;
+    }
+
+  /* A key collected by a vanity search is taken from the agent.  */
+  r = get_parameter (para, pKEYGRIP);
+  if (r)
+    {
+      if (get_parameter (para, pVANITYPATTERN))
+        {
+          log_error ("%s:%d: Key-Grip can't be used with Vanity-Pattern\n",
+                     fname, r->lnr);
+          return -1;
+        }
+      if (strlen (r->u.value) != 40
+          || strspn (r->u.value, "0123456789abcdefABCDEF") != 40)
+        {
+          log_error ("%s:%d: invalid keygrip\n", fname, r->lnr);
+          return -1;
+        }
+    }
+
+  /* Make VANITYTIMES from Vanity-Window.  */
+  r = get_parameter (para, pVANITYWINDOW);
+  if (r)
+    {
+      struct para_data_s *r2;
+
+      r2 = parse_vanity_window (r->u.value);
+      if (!r2)
+        {
+          log_error ("%s:%d: invalid vanity window\n", fname, r->lnr);
+          return -1;
+        }
+      r2->lnr = r->lnr;
+      append_to_parameter (para, r2);
+    }
+
+  r = get_parameter (para, pVANITYDIRECTION);
+  if (r && ascii_strcasecmp (r->u.value, "forward")
+      && ascii_strcasecmp (r->u.value, "backward"))
+    {
+      log_error ("%s:%d: invalid vanity direction\n", fname, r->lnr);
+      return -1;
+    }
+
   /* Set revoker, if any. */
   if (parse_revocation_key (fname, para, pREVOKER))
     return -1;
@@ -3233,11 +3638,163 @@ proc_parameter_file( struct para_data_s *para, const char *fname,
       append_to_parameter (para, r);
     }
 
+  return 0;
+}
+
+
+static int
+proc_parameter_file( struct para_data_s *para, const char *fname,
+                     struct output_control_s *outctrl, int card )
+{
+  if (check_parameter_file (para, fname, outctrl))
+    return -1;
   do_generate_keypair( para, outctrl, card );
   return 0;
 }
 
 
+/* Queue the vanity search for the checked parameters PARA in the
+   agent and store the ID of the job at JOBID.  JOBID is left empty
+   if the search is instead run when the key is created; this is the
+   case for searches collecting several keys or a subkey, for a
+   distributed search and if the agent can't queue it.  */
+static void
+submit_vanity_search (struct para_data_s *para,
+                      struct output_control_s *outctrl, char *jobid)
+{
+  gpg_error_t err;
+  struct agent_vanity_parm_s vanity;
+  char *keyparms;
+  unsigned int nbits;
+  const char *s;
+
+  *jobid = 0;
+  memset (&vanity, 0, sizeof vanity);
+  vanity.pattern = get_parameter_value (para, pVANITYPATTERN);
+  if (!vanity.pattern || outctrl->dryrun
+      || get_parameter (para, pSUBVANITYPATTERN)
+      || get_parameter (para, pVANITYSEEDKEY)
+      || get_parameter (para, pVANITYBUDGET)
+      || get_parameter (para, pVANITYITERATIONS)
+      || (get_parameter (para, pVANITYHITS)
+          && get_parameter_uint (para, pVANITYHITS) != 1))
+    return;
+  vanity.window = get_parameter_value (para, pVANITYTIMES);
+  s = get_parameter_value (para, pVANITYDIRECTION);
+  vanity.backward = s && !ascii_strcasecmp (s, "backward");
+  vanity.hits = 1;
+  vanity.algo = get_parameter_algo (para, pKEYTYPE, NULL);
+
+  if (vanity.algo == PUBKEY_ALGO_RSA)
+    {
+      nbits = get_parameter_uint (para, pKEYLENGTH);
+      keyparms = rsa_keyparms (&nbits, outctrl->keygen_flags);
+    }
+  else if ((s = get_parameter_value (para, pKEYCURVE)) && *s)
+    keyparms = ecc_keyparms (vanity.algo, s, outctrl->keygen_flags);
+  else
+    return;  /* Reported by do_create.  */
+  if (!keyparms)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      err = agent_vanity_submit (NULL, keyparms,
+                                 !!(outctrl->keygen_flags
+                                    & KEYGEN_FLAG_NO_PROTECTION),
+                                 get_parameter_passphrase (para),
+                                 &vanity, jobid);
+      xfree (keyparms);
+    }
+  if (err)
+    log_info ("error queuing the vanity search: %s\n", gpg_strerror (err));
+  else if (opt.verbose)
+    log_info ("vanity search queued as job %s\n", jobid);
+}
+
+
+/* Process the parameter block PARA of the batch file FNAME and
+   release it.  With %parallel the block is only checked and its
+   vanity search queued; the key is created by flush_pending_keys.  */
+static void
+commit_parameter_block (struct para_data_s *para, const char *fname,
+                        struct output_control_s *outctrl)
+{
+  struct pending_key_s *pending, **tail;
+
+  if (!outctrl->parallel)
+    {
+      if (proc_parameter_file (para, fname, outctrl, 0))
+        print_status_key_not_created (get_parameter_value (para, pHANDLE));
+      release_parameter_list (para);
+      return;
+    }
+
+  if (check_parameter_file (para, fname, outctrl))
+    {
+      print_status_key_not_created (get_parameter_value (para, pHANDLE));
+      release_parameter_list (para);
+      return;
+    }
+  pending = xmalloc_clear (sizeof *pending);
+  pending->para = para;
+  submit_vanity_search (para, outctrl, pending->jobid);
+  for (tail = &outctrl->pending; *tail; tail = &(*tail)->next)
+    ;
+  *tail = pending;
+}
+
+
+/* Create the keys of the blocks held back by %parallel in the order
+   of the batch file.  A key whose search was queued is created from
+   the keygrip and with the creation time of the key the agent found,
+   as in generate_streamed_keys.  The other keys are generated here
+   one by one; we have only one connection to the agent and it would
+   run parallel GENKEY requests on the same workers anyway.  */
+static void
+flush_pending_keys (struct output_control_s *outctrl)
+{
+  gpg_error_t err;
+  struct pending_key_s *pending;
+  struct agent_vanity_parm_s vanity;
+  struct para_data_s *r_grip, *r_created;
+
+  while ((pending = outctrl->pending))
+    {
+      outctrl->pending = pending->next;
+      if (!*pending->jobid)
+        do_generate_keypair (pending->para, outctrl, 0);
+      else
+        {
+          memset (&vanity, 0, sizeof vanity);
+          r_grip = xmalloc_clear (sizeof *r_grip + 40);
+          r_grip->key = pKEYGRIP;
+          err = agent_vanity_wait (NULL, pending->jobid, &vanity,
+                                   r_grip->u.value);
+          if (err)
+            {
+              log_error ("vanity search %s failed: %s\n",
+                         pending->jobid, gpg_strerror (err));
+              print_status_key_not_created
+                (get_parameter_value (pending->para, pHANDLE));
+            }
+          else
+            {
+              r_created = xmalloc_clear (sizeof *r_created);
+              r_created->key = pKEYCREATIONDATE;
+              r_created->u.creation = vanity.timestamp;
+              r_grip->next = r_created;
+              r_created->next = pending->para;
+              do_generate_keypair (r_grip, outctrl, 0);
+              xfree (r_created);
+            }
+          xfree (r_grip);
+        }
+      release_parameter_list (pending->para);
+      xfree (pending);
+    }
+}
+
+
 /****************
  * Kludge to allow non interactive key generation controlled
  * by a parameter file.
@@ -3267,6 +3824,17 @@ read_parameter_file( const char *fname )
 	{ "Revoker",        pREVOKER },
         { "Handle",         pHANDLE },
 	{ "Keyserver",      pKEYSERVER },
+	{ "Vanity-Pattern", pVANITYPATTERN },
+	{ "Vanity-Window",  pVANITYWINDOW },
+	{ "Vanity-Direction", pVANITYDIRECTION },
+	{ "Vanity-Hits",    pVANITYHITS },
+	{ "Vanity-Budget",  pVANITYBUDGET },
+	{ "Vanity-Iterations", pVANITYITERATIONS },
+	{ "Vanity-Seed-Key", pVANITYSEEDKEY },
+	{ "Vanity-Seed-Range", pVANITYSEEDRANGE },
+	{ "Subkey-Vanity-Pattern", pSUBVANITYPATTERN },
+	{ "Subkey-Vanity-KDF", pSUBVANITYKDF },
+	{ "Key-Grip",       pKEYGRIP },
 	{ NULL, 0 }
     };
     IOBUF fp;
@@ -3325,6 +3893,11 @@ read_parameter_file( const char *fname )
 		;
 	    value = p;
 	    trim_trailing_ws( value, strlen(value) );
+            /* The held back keys are created with the settings they
+               were given with.  */
+            if (outctrl.pending && ascii_strcasecmp (keyword, "%echo")
+                && ascii_strcasecmp (keyword, "%commit"))
+              flush_pending_keys (&outctrl);
 	    if( !ascii_strcasecmp( keyword, "%echo" ) )
 		log_info("%s\n", value );
 	    else if( !ascii_strcasecmp( keyword, "%dry-run" ) )
@@ -3337,12 +3910,13 @@ read_parameter_file( const char *fname )
                 outctrl.keygen_flags |= KEYGEN_FLAG_NO_PROTECTION;
 	    else if( !ascii_strcasecmp( keyword, "%transient-key" ) )
                 outctrl.keygen_flags |= KEYGEN_FLAG_TRANSIENT_KEY;
+	    else if( !ascii_strcasecmp( keyword, "%bulk" ) )
+		outctrl.bulk = 1;
+	    else if( !ascii_strcasecmp( keyword, "%parallel" ) )
+		outctrl.parallel = 1;
 	    else if( !ascii_strcasecmp( keyword, "%commit" ) ) {
 		outctrl.lnr = lnr;
-		if (proc_parameter_file( para, fname, &outctrl, 0 ))
-                  print_status_key_not_created
-                    (get_parameter_value (para, pHANDLE));
-		release_parameter_list( para );
+		commit_parameter_block (para, fname, &outctrl);
 		para = NULL;
 	    }
 	    else if( !ascii_strcasecmp( keyword, "%pubring" ) ) {
@@ -3395,10 +3969,7 @@ read_parameter_file( const char *fname )
 
 	if( keywords[i].key == pKEYTYPE && para ) {
 	    outctrl.lnr = lnr;
-	    if (proc_parameter_file( para, fname, &outctrl, 0 ))
-              print_status_key_not_created
-                (get_parameter_value (para, pHANDLE));
-	    release_parameter_list( para );
+	    commit_parameter_block (para, fname, &outctrl);
 	    para = NULL;
 	}
 	else {
@@ -3425,9 +3996,10 @@ read_parameter_file( const char *fname )
     }
     else if( para ) {
 	outctrl.lnr = lnr;
-	if (proc_parameter_file( para, fname, &outctrl, 0 ))
-          print_status_key_not_created (get_parameter_value (para, pHANDLE));
+	commit_parameter_block (para, fname, &outctrl);
+	para = NULL;
     }
+    flush_pending_keys (&outctrl);
 
     if( outctrl.use_files ) { /* close open streams */
 	iobuf_close( outctrl.pub.stream );
@@ -3440,6 +4012,7 @@ read_parameter_file( const char *fname )
 	xfree( outctrl.pub.fname );
 	xfree( outctrl.pub.newfname );
     }
+    keydb_release (outctrl.pub_hd);
 
     release_parameter_list( para );
     iobuf_close (fp);
@@ -3968,6 +4541,81 @@ start_tree(KBNODE *tree)
 }
 
 
+/* Create a keyblock with the parameters PARA for each key received
+   from a vanity search except for the one with the fingerprint FPR,
+   which has already been created.  All keyblocks are written under
+   one keyring lock and CACHE_NONCE is used for them so that the
+   passphrase is not asked for again.  The received keys are then
+   released.  */
+static void
+generate_streamed_keys (struct para_data_s *para,
+                        struct output_control_s *outctrl,
+                        const char *fpr, const char *cache_nonce)
+{
+  gpg_error_t err = 0;
+  struct vanity_hit_s *hit;
+  struct para_data_s *r_grip, *r_created;
+  KEYDB_HANDLE pub_hd = NULL;
+
+  for (hit = vanity_hits; hit; hit = hit->next)
+    if (memcmp (hit->fpr, fpr, 20))
+      break;
+  if (!hit)
+    goto leave;
+
+  /* Like a bulk write, keep the keyring located and locked for the
+     first key for all further keys.  */
+  if (!outctrl->use_files && !outctrl->pub_hd)
+    {
+      pub_hd = keydb_new ();
+      err = keydb_locate_writable (pub_hd, NULL);
+      if (err)
+        log_error (_("no writable public keyring found: %s\n"),
+                   gpg_strerror (err));
+      else if ((err = keydb_lock (pub_hd)))
+        log_error ("error locking the keyring: %s\n", gpg_strerror (err));
+      if (err)
+        {
+          keydb_release (pub_hd);
+          goto leave;
+        }
+      outctrl->pub_hd = pub_hd;
+    }
+
+  /* The keys are created from their keygrips with the creation time
+     the agent found; these parameters take precedence over those of
+     PARA.  */
+  r_grip = xmalloc_clear (sizeof *r_grip + 40);
+  r_grip->key = pKEYGRIP;
+  r_created = xmalloc_clear (sizeof *r_created);
+  r_created->key = pKEYCREATIONDATE;
+  r_grip->next = r_created;
+  r_created->next = para;
+
+  vanity_hits_cache_nonce = cache_nonce;
+  for (hit = vanity_hits; hit; hit = hit->next)
+    {
+      if (!memcmp (hit->fpr, fpr, 20))
+        continue;
+      strcpy (r_grip->u.value, hit->hexgrip);
+      r_created->u.creation = hit->created;
+      do_generate_keypair (r_grip, outctrl, 0);
+    }
+  vanity_hits_cache_nonce = NULL;
+  xfree (r_grip);
+  xfree (r_created);
+
+  if (pub_hd)
+    {
+      outctrl->pub_hd = NULL;
+      keydb_release (pub_hd);
+    }
+
+ leave:
+  release_vanity_hits ();
+}
+
+
 static void
 do_generate_keypair (struct para_data_s *para,
 		     struct output_control_s *outctrl, int card)
@@ -3981,6 +4629,8 @@ do_generate_keypair (struct para_data_s *para,
   int did_sub = 0;
   u32 timestamp;
   char *cache_nonce = NULL;
+  struct agent_vanity_parm_s vanity_parm;
+  char *subkey_keyparms = NULL;
 
   if (outctrl->dryrun)
     {
@@ -4037,6 +4687,56 @@ do_generate_keypair (struct para_data_s *para,
   if (!timestamp)
     timestamp = make_timestamp ();
 
+  memset (&vanity_parm, 0, sizeof vanity_parm);
+  vanity_parm.pattern = get_parameter_value (para, pVANITYPATTERN);
+  vanity_parm.window = get_parameter_value (para, pVANITYTIMES);
+  s = get_parameter_value (para, pVANITYDIRECTION);
+  vanity_parm.backward = s && !ascii_strcasecmp (s, "backward");
+  vanity_parm.hits = (get_parameter (para, pVANITYHITS)
+                      ? get_parameter_uint (para, pVANITYHITS) : 1);
+  vanity_parm.budget = get_parameter_u32 (para, pVANITYBUDGET);
+  s = get_parameter_value (para, pVANITYITERATIONS);
+  vanity_parm.iterations = s? strtoull (s, NULL, 10) : 0;
+  vanity_parm.seed_key = get_parameter_value (para, pVANITYSEEDKEY);
+  s = get_parameter_value (para, pVANITYSEEDRANGE);
+  if (s)
+    {
+      char *endp;
+
+      vanity_parm.seed_first = strtoul (s, &endp, 10);
+      vanity_parm.seed_count = strtoul (endp, NULL, 10);
+    }
+  vanity_parm.subkey_pattern = get_parameter_value (para, pSUBVANITYPATTERN);
+  if (vanity_parm.subkey_pattern)
+    {
+      vanity_parm.subkey_algo = get_parameter_algo (para, pSUBKEYTYPE, NULL);
+      subkey_keyparms = ecc_keyparms (vanity_parm.subkey_algo,
+                                      get_parameter_value (para, pSUBKEYCURVE),
+                                      outctrl->keygen_flags);
+      if (!subkey_keyparms)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("key generation failed: %s\n", gpg_strerror (err));
+          release_kbnode (pub_root);
+          return;
+        }
+      vanity_parm.subkey_keyparms = subkey_keyparms;
+      vanity_parm.subkey_kdf = get_parameter_value (para, pSUBVANITYKDF);
+    }
+  /* Have the agent send all keys it collects so that the keyblocks
+     for them are created right away.  The single subkey searched
+     along with the primary key can only go with one of them.  */
+  if (vanity_parm.pattern && !card && !vanity_parm.subkey_pattern
+      && !get_parameter (para, pKEYGRIP)
+      && (vanity_parm.hits != 1 || vanity_parm.budget
+          || vanity_parm.iterations))
+    {
+      release_vanity_hits ();
+      vanity_parm.result_cb = collect_vanity_hit;
+    }
+  if (vanity_hits_cache_nonce)
+    cache_nonce = xstrdup (vanity_hits_cache_nonce);
+
   /* Note that, depending on the backend (i.e. the used scdaemon
      version), the card key generation may update TIMESTAMP for each
      key.  Thus we need to pass TIMESTAMP to all signing function to
@@ -4046,7 +4746,12 @@ do_generate_keypair (struct para_data_s *para,
      node of the subkey but that is more work than just to pass the
      current timestamp.  */
 
-  if (!card)
+  if (!card && (s = get_parameter_value (para, pKEYGRIP)))
+    err = do_create_from_keygrip (NULL, get_parameter_algo (para, pKEYTYPE,
+                                                            NULL),
+                                  s, pub_root, timestamp,
+                                  get_parameter_u32 (para, pKEYEXPIRE), 0);
+  else if (!card)
     err = do_create (get_parameter_algo( para, pKEYTYPE, NULL ),
                      get_parameter_uint( para, pKEYLENGTH ),
                      get_parameter_value (para, pKEYCURVE),
@@ -4055,7 +4760,8 @@ do_generate_keypair (struct para_data_s *para,
                      get_parameter_u32( para, pKEYEXPIRE ), 0,
                      outctrl->keygen_flags,
                      get_parameter_passphrase (para),
-                     &cache_nonce);
+                     &cache_nonce,
+                     vanity_parm.pattern? &vanity_parm : NULL);
   else
     err = gen_card_key (PUBKEY_ALGO_RSA, 1, 1, pub_root,
                         &timestamp,
@@ -4066,10 +4772,9 @@ do_generate_keypair (struct para_data_s *para,
     {
       pri_psk = pub_root->next->pkt->pkt.public_key;
       assert (pri_psk);
-      // EDITED FOR VANITY
-      // Retrieve bruteforced timestamp from key packet.
+      /* The creation time of a vanity key differs from the one we
+         asked for.  */
       timestamp = pri_psk->timestamp;
-      // VANITY EDITS END
     }
 
   if (!err && (revkey = get_parameter_revkey (para, pREVOKER)))
@@ -4102,8 +4807,62 @@ do_generate_keypair (struct para_data_s *para,
 
   if (!err && get_parameter (para, pSUBKEYTYPE))
     {
+      u32 subkey_timestamp = timestamp;
+
       sub_psk = NULL;
-      if (!card)
+      if (!card && vanity_parm.subkey_pattern)
+        {
+          unsigned char fpr[MAX_FINGERPRINT_LEN];
+          size_t fprlen;
+
+          /* The agent has already stored the subkey found along with
+             the primary key; build the packet from its keygrip and
+             make sure that it has the fingerprint the agent found.  */
+          if (!vanity_parm.subkey_timestamp)
+            {
+              log_error ("agent did not return the vanity subkey\n");
+              err = gpg_error (GPG_ERR_NO_DATA);
+            }
+          else
+            {
+              subkey_timestamp = vanity_parm.subkey_timestamp;
+              err = do_create_from_keygrip (NULL, vanity_parm.subkey_algo,
+                                            vanity_parm.subkey_grip,
+                                            pub_root, subkey_timestamp,
+                                            get_parameter_u32
+                                            (para, pSUBKEYEXPIRE), 1);
+            }
+          if (!err)
+            {
+              kbnode_t node;
+
+              for (node = pub_root; node; node = node->next)
+                if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+                  sub_psk = node->pkt->pkt.public_key;
+              assert (sub_psk);
+              /* The agent may have found the subkey with other than
+                 the default KDF parameters.  */
+              if (vanity_parm.has_subkey_kdfparm
+                  && vanity_parm.subkey_algo == PUBKEY_ALGO_ECDH)
+                {
+                  byte *kek_params = xmalloc (4);
+
+                  memcpy (kek_params, vanity_parm.subkey_kdfparm, 4);
+                  gcry_mpi_release (sub_psk->pkey[2]);
+                  sub_psk->pkey[2] = gcry_mpi_set_opaque (NULL, kek_params,
+                                                          4 * 8);
+                  forget_fingerprint (sub_psk);
+                }
+              fingerprint_from_pk (sub_psk, fpr, &fprlen);
+              if (fprlen != 20 || memcmp (fpr, vanity_parm.subkey_fpr, 20))
+                {
+                  log_error ("fingerprint of the vanity subkey does not"
+                             " match\n");
+                  err = gpg_error (GPG_ERR_BAD_PUBKEY);
+                }
+            }
+        }
+      else if (!card)
         {
           err = do_create (get_parameter_algo (para, pSUBKEYTYPE, NULL),
                            get_parameter_uint (para, pSUBKEYLENGTH),
@@ -4113,7 +4872,7 @@ do_generate_keypair (struct para_data_s *para,
                            get_parameter_u32 (para, pSUBKEYEXPIRE), 1,
                            outctrl->keygen_flags,
                            get_parameter_passphrase (para),
-                           &cache_nonce);
+                           &cache_nonce, NULL);
           /* Get the pointer to the generated public subkey packet.  */
           if (!err)
             {
@@ -4144,10 +4903,14 @@ do_generate_keypair (struct para_data_s *para,
             }
         }
 
+      /* The binding signature may not be older than a vanity
+         subkey created after the primary key.  */
       if (!err)
         err = write_keybinding (pub_root, pri_psk, sub_psk,
                                 get_parameter_uint (para, pSUBKEYUSAGE),
-                                timestamp, cache_nonce);
+                                (subkey_timestamp > timestamp
+                                 ? subkey_timestamp : timestamp),
+                                cache_nonce);
       did_sub = 1;
     }
 
@@ -4159,12 +4922,27 @@ do_generate_keypair (struct para_data_s *para,
     }
   else if (!err) /* Write to the standard keyrings.  */
     {
-      KEYDB_HANDLE pub_hd = keydb_new ();
+      KEYDB_HANDLE pub_hd = outctrl->pub_hd;
 
-      err = keydb_locate_writable (pub_hd, NULL);
-      if (err)
-        log_error (_("no writable public keyring found: %s\n"),
-                   gpg_strerror (err));
+      /* In bulk mode the keyring located and locked for the first key
+         is kept for all further keys of the parameter file.  */
+      if (!pub_hd)
+        {
+          pub_hd = keydb_new ();
+          err = keydb_locate_writable (pub_hd, NULL);
+          if (err)
+            log_error (_("no writable public keyring found: %s\n"),
+                       gpg_strerror (err));
+          else if (outctrl->bulk)
+            {
+              err = keydb_lock (pub_hd);
+              if (err)
+                log_error ("error locking the keyring: %s\n",
+                           gpg_strerror (err));
+              else
+                outctrl->pub_hd = pub_hd;
+            }
+        }
 
       if (!err && opt.verbose)
         {
@@ -4180,7 +4958,8 @@ do_generate_keypair (struct para_data_s *para,
                        keydb_get_resource_name (pub_hd), gpg_strerror (err));
         }
 
-      keydb_release (pub_hd);
+      if (pub_hd != outctrl->pub_hd)
+        keydb_release (pub_hd);
 
       if (!err)
         {
@@ -4242,7 +5021,14 @@ do_generate_keypair (struct para_data_s *para,
     }
 
   release_kbnode (pub_root);
+  if (vanity_parm.result_cb)
+    {
+      if (!err)
+        generate_streamed_keys (para, outctrl, vanity_parm.fpr, cache_nonce);
+      release_vanity_hits ();
+    }
   xfree (cache_nonce);
+  xfree (subkey_keyparms);
 }
 
 
@@ -4336,7 +5122,7 @@ generate_subkeypair (ctrl_t ctrl, kbnode_t keyblock)
                                   keyblock, cur_time, expire, 1);
   else
     err = do_create (algo, nbits, curve,
-                     keyblock, cur_time, expire, 1, 0, NULL, NULL);
+                     keyblock, cur_time, expire, 1, 0, NULL, NULL, NULL);
   if (err)
     goto leave;
 
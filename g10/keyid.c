@@ -136,68 +136,69 @@ pubkey_string (PKT_public_key *pk, char *buffer, size_t bufsize)
 }
 
 
+/* The size of the stack buffer used by hash_public_key.  This covers
+   MPIs of up to 16384 bits; larger ones are printed into a temporary
+   buffer.  */
+#define HASH_MPI_BUFSIZE (2 + 16384/8)
+
+
+/* Return the number of bytes the MPI A adds to the hashed key and
+   store a pointer to them at R_P if A is an opaque MPI.  */
+static unsigned int
+hashed_mpi_len (gcry_mpi_t a, const void **r_p)
+{
+  unsigned int nbits;
+  size_t nbytes;
+
+  *r_p = NULL;
+  if (!a)
+    {
+      /* This case may only happen if the parsing of the MPI failed
+         but the key was anyway created.  May happen during "gpg
+         KEYFILE".  */
+      return 0;
+    }
+  if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+    {
+      *r_p = gcry_mpi_get_opaque (a, &nbits);
+      return *r_p? (nbits+7)/8 : 0;
+    }
+  if (gcry_mpi_print (GCRYMPI_FMT_PGP, NULL, 0, &nbytes, a))
+    BUG ();
+  return nbytes;
+}
+
+
 /* Hash a public key.  This function is useful for v4 fingerprints and
-   for v3 or v4 key signing. */
+   for v3 or v4 key signing.  The MPIs are hashed directly from the
+   key or from a stack buffer; only very large MPIs need a temporary
+   buffer.  */
 void
 hash_public_key (gcry_md_hd_t md, PKT_public_key *pk)
 {
   unsigned int n = 6;
   unsigned int nn[PUBKEY_MAX_NPKEY];
-  byte *pp[PUBKEY_MAX_NPKEY];
+  const void *pp[PUBKEY_MAX_NPKEY];
+  byte buffer[HASH_MPI_BUFSIZE];
+  byte *tmp;
   int i;
-  unsigned int nbits;
   size_t nbytes;
   int npkey = pubkey_get_npkey (pk->pubkey_algo);
 
-  /* FIXME: We can avoid the extra malloc by calling only the first
-     mpi_print here which computes the required length and calling the
-     real mpi_print only at the end.  The speed advantage would only be
-     for ECC (opaque MPIs) or if we could implement an mpi_print
-     variant with a callback handler to do the hashing.  */
   if (npkey==0 && pk->pkey[0]
       && gcry_mpi_get_flag (pk->pkey[0], GCRYMPI_FLAG_OPAQUE))
     {
-      pp[0] = gcry_mpi_get_opaque (pk->pkey[0], &nbits);
-      nn[0] = (nbits+7)/8;
-      n+=nn[0];
+      /* An unknown algorithm stored as one opaque MPI.  */
+      nn[0] = hashed_mpi_len (pk->pkey[0], &pp[0]);
+      n += nn[0];
+      npkey = 1;
     }
   else
     {
       for (i=0; i < npkey; i++ )
         {
-          if (!pk->pkey[i])
-            {
-              /* This case may only happen if the parsing of the MPI
-                 failed but the key was anyway created.  May happen
-                 during "gpg KEYFILE".  */
-              pp[i] = NULL;
-              nn[i] = 0;
-            }
-          else if (gcry_mpi_get_flag (pk->pkey[i], GCRYMPI_FLAG_OPAQUE))
-            {
-              const void *p;
-
-              p = gcry_mpi_get_opaque (pk->pkey[i], &nbits);
-              pp[i] = xmalloc ((nbits+7)/8);
-              if (p)
-                memcpy (pp[i], p, (nbits+7)/8);
-              else
-                pp[i] = NULL;
-              nn[i] = (nbits+7)/8;
-              n += nn[i];
-            }
-          else
-            {
-              if (gcry_mpi_print (GCRYMPI_FMT_PGP, NULL, 0,
-                                  &nbytes, pk->pkey[i]))
-                BUG ();
-              pp[i] = xmalloc (nbytes);
-              if (gcry_mpi_print (GCRYMPI_FMT_PGP, pp[i], nbytes,
-                                  &nbytes, pk->pkey[i]))
-                BUG ();
-              nn[i] = nbytes;
-              n += nn[i];
-            }
+          nn[i] = hashed_mpi_len (pk->pkey[i], &pp[i]);
+          n += nn[i];
         }
     }
 
@@ -214,24 +215,31 @@ hash_public_key (gcry_md_hd_t md, PKT_public_key *pk)
 
   gcry_md_putc ( md, pk->pubkey_algo );
 
-  if(npkey==0 && pk->pkey[0]
-     && gcry_mpi_get_flag (pk->pkey[0], GCRYMPI_FLAG_OPAQUE))
-    {
-      if (pp[0])
-        gcry_md_write (md, pp[0], nn[0]);
-    }
-  else
+  for (i=0; i < npkey; i++ )
     {
-      for(i=0; i < npkey; i++ )
+      if (!nn[i])
+        ;
+      else if (pp[i])
+        gcry_md_write (md, pp[i], nn[i]);
+      else if (nn[i] <= sizeof buffer)
+        {
+          if (gcry_mpi_print (GCRYMPI_FMT_PGP, buffer, sizeof buffer,
+                              &nbytes, pk->pkey[i]))
+            BUG ();
+          gcry_md_write (md, buffer, nbytes);
+        }
+      else
         {
-          if (pp[i])
-            gcry_md_write ( md, pp[i], nn[i] );
-          xfree(pp[i]);
+          tmp = xmalloc (nn[i]);
+          if (gcry_mpi_print (GCRYMPI_FMT_PGP, tmp, nn[i],
+                              &nbytes, pk->pkey[i]))
+            BUG ();
+          gcry_md_write (md, tmp, nbytes);
+          xfree (tmp);
         }
     }
 }
 
-
 static gcry_md_hd_t
 do_fingerprint_md( PKT_public_key *pk )
 {
@@ -246,6 +254,41 @@ do_fingerprint_md( PKT_public_key *pk )
 }
 
 
+/* Compute the fingerprint of PK unless it has already been done and
+   cache it along with the keyid in PK.  */
+static void
+cache_fingerprint (PKT_public_key *pk)
+{
+  const byte *dp;
+  gcry_md_hd_t md;
+  size_t len;
+
+  if (pk->fprlen)
+    return;
+
+  md = do_fingerprint_md (pk);
+  dp = gcry_md_read (md, 0);
+  len = gcry_md_get_algo_dlen (gcry_md_get_algo (md));
+  assert (len <= MAX_FINGERPRINT_LEN);
+  memcpy (pk->fpr, dp, len);
+  pk->fprlen = len;
+  pk->keyid[0] = buf32_to_u32 (dp+12);
+  pk->keyid[1] = buf32_to_u32 (dp+16);
+  gcry_md_close (md);
+}
+
+
+/* Forget the fingerprint and keyid cached in PK.  This must be
+   called whenever the key material, the creation time, the version or
+   the algorithm of PK are changed after it has been used.  */
+void
+forget_fingerprint (PKT_public_key *pk)
+{
+  pk->fprlen = 0;
+  pk->keyid[0] = pk->keyid[1] = 0;
+}
+
+
 /* fixme: Check whether we can replace this function or if not
    describe why we need it.  */
 u32
@@ -422,22 +465,10 @@ keyid_from_pk (PKT_public_key *pk, u32 *keyid)
     }
   else
     {
-      const byte *dp;
-      gcry_md_hd_t md;
-
-      md = do_fingerprint_md(pk);
-      if(md)
-	{
-	  dp = gcry_md_read ( md, 0 );
-	  keyid[0] = buf32_to_u32 (dp+12);
-	  keyid[1] = buf32_to_u32 (dp+16);
-	  lowbits = keyid[1];
-	  gcry_md_close (md);
-	  pk->keyid[0] = keyid[0];
-	  pk->keyid[1] = keyid[1];
-	}
-      else
-	pk->keyid[0]=pk->keyid[1]=keyid[0]=keyid[1]=lowbits=0xFFFFFFFF;
+      cache_fingerprint (pk);
+      keyid[0] = pk->keyid[0];
+      keyid[1] = pk->keyid[1];
+      lowbits = keyid[1];
     }
 
   return lowbits;
@@ -682,23 +713,13 @@ colon_expirestr_from_sig (PKT_signature *sig)
 byte *
 fingerprint_from_pk (PKT_public_key *pk, byte *array, size_t *ret_len)
 {
-  const byte *dp;
-  size_t len;
-  gcry_md_hd_t md;
-
-  md = do_fingerprint_md(pk);
-  dp = gcry_md_read( md, 0 );
-  len = gcry_md_get_algo_dlen (gcry_md_get_algo (md));
-  assert( len <= MAX_FINGERPRINT_LEN );
+  cache_fingerprint (pk);
   if (!array)
-    array = xmalloc ( len );
-  memcpy (array, dp, len );
-  pk->keyid[0] = buf32_to_u32 (dp+12);
-  pk->keyid[1] = buf32_to_u32 (dp+16);
-  gcry_md_close( md);
+    array = xmalloc (pk->fprlen);
+  memcpy (array, pk->fpr, pk->fprlen);
 
   if (ret_len)
-    *ret_len = len;
+    *ret_len = pk->fprlen;
   return array;
 }
 
@@ -722,13 +743,21 @@ hexfingerprint (PKT_public_key *pk)
 
 /* Return the so called KEYGRIP which is the SHA-1 hash of the public
    key parameters expressed as an canoncial encoded S-Exp.  ARRAY must
-   be 20 bytes long.  Returns 0 on sucess or an error code.  */
+   be 20 bytes long.  Returns 0 on sucess or an error code.  The
+   keygrip is cached in PK; a key read from a keybox may come with it
+   already.  */
 gpg_error_t
 keygrip_from_pk (PKT_public_key *pk, unsigned char *array)
 {
   gpg_error_t err;
   gcry_sexp_t s_pkey;
 
+  if (pk->flags.keygrip_valid)
+    {
+      memcpy (array, pk->keygrip, 20);
+      return 0;
+    }
+
   if (DBG_PACKET)
     log_debug ("get_keygrip for public key\n");
 
@@ -793,7 +822,8 @@ keygrip_from_pk (PKT_public_key *pk, unsigned char *array)
     {
       if (DBG_PACKET)
         log_printhex ("keygrip=", array, 20);
-      /* FIXME: Save the keygrip in PK.  */
+      memcpy (pk->keygrip, array, 20);
+      pk->flags.keygrip_valid = 1;
     }
   gcry_sexp_release (s_pkey);
 
@@ -467,11 +467,19 @@ list_all (int secret, int mark_secret)
   int any_secret;
   const char *lastresname, *resname;
   struct keylist_context listctx;
+  int skip_certs = 0;
 
   memset (&listctx, 0, sizeof (listctx));
   if (opt.check_sigs)
     listctx.check_sigs = 1;
 
+  /* A fast colon listing neither prints the certifications of other
+     keys nor computes the validity for which they are needed; thus
+     the parser can skip them.  */
+  if (opt.with_colons && opt.fast_list_mode
+      && !opt.list_sigs && !opt.check_sigs)
+    skip_certs = 1;
+
   hd = keydb_new ();
   if (!hd)
     rc = gpg_error (GPG_ERR_GENERAL);
@@ -485,6 +493,8 @@ list_all (int secret, int mark_secret)
     }
 
   lastresname = NULL;
+  if (skip_certs)
+    set_packet_skip_foreign_certs (1);
   do
     {
       rc = keydb_get_keyblock (hd, &keyblock);
@@ -522,6 +532,9 @@ list_all (int secret, int mark_secret)
           merge_keys_and_selfsig (keyblock);
           list_keyblock (keyblock, secret, any_secret, opt.fingerprint,
                          &listctx);
+          /* Keep the results for the next listing.  */
+          if (opt.check_sigs)
+            keydb_store_sigstatus (hd, keyblock);
         }
       release_kbnode (keyblock);
       keyblock = NULL;
@@ -538,6 +551,8 @@ list_all (int secret, int mark_secret)
     print_signature_stats (&listctx);
 
  leave:
+  if (skip_certs)
+    set_packet_skip_foreign_certs (0);
   keylist_context_release (&listctx);
   release_kbnode (keyblock);
   keydb_release (hd);
@@ -1387,8 +1402,13 @@ list_keyblock_colon (KBNODE keyblock, int secret, int has_secret, int fpr)
 	    es_fprintf (es_stdout, "%s:r::::", str);
 	  else if (uid->is_expired)
 	    es_fprintf (es_stdout, "%s:e::::", str);
-	  else if (opt.no_expensive_trust_checks)
-	    es_fprintf (es_stdout, "%s:::::", str);
+	  else if (opt.fast_list_mode || opt.no_expensive_trust_checks)
+	    {
+	      /* Not supported in fast list mode: a stale trustdb would
+	         be updated from keyblocks read without the foreign
+	         certifications.  */
+	      es_fprintf (es_stdout, "%s:::::", str);
+	    }
 	  else
 	    {
 	      int uid_validity;
@@ -1675,6 +1695,14 @@ list_keyblock (KBNODE keyblock, int secret, int has_secret, int fpr,
                struct keylist_context *listctx)
 {
   reorder_keyblock (keyblock);
+  if (opt.check_sigs && !opt.print_pka_records && sig_queue_threads () > 1)
+    {
+      sig_queue_t queue = sig_queue_new ();
+
+      sig_queue_add_keyblock (queue, keyblock);
+      sig_queue_run (queue);
+      sig_queue_release (queue);
+    }
   if (opt.print_pka_records)
     list_keyblock_pka (keyblock);
   else if (opt.with_colons)
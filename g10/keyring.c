@@ -36,19 +36,31 @@
 #include "options.h"
 #include "main.h" /*for check_key_signature()*/
 #include "i18n.h"
+#include "host2net.h"
 
 /* off_item is a funny named for an object used to keep track of known
- * keys.  The idea was to use the offset to seek to the known keyblock, but
- * this is not possible if more than one process is using the keyring.
+ * keys.  OFF is the offset of the first keyblock in the keyring
+ * holding a key with that keyid.  Because another process may change
+ * the keyring, the table is only trusted as long as the file still
+ * matches the size, mtime and inode recorded along with the table.
  */
 struct off_item {
   struct off_item *next;
   u32 kid[2];
-  /*off_t off;*/
+  off_t off;
 };
 
 typedef struct off_item **OffsetHashTable;
 
+/* What we remember of a keyring file to detect changes done by
+   other processes.  */
+struct file_version
+{
+  off_t size;
+  u32 mtime;
+  u32 ino;
+};
+
 
 typedef struct keyring_name *KR_NAME;
 struct keyring_name
@@ -57,7 +69,10 @@ struct keyring_name
   int read_only;
   dotlock_t lockhd;
   int is_locked;
-  int did_full_scan;
+  OffsetHashTable offtbl;
+  int did_full_scan;             /* OFFTBL lists all keys of the file. */
+  unsigned int offtbl_serial;    /* Incremented when OFFTBL is reset.  */
+  struct file_version offtbl_version;  /* The file described by OFFTBL. */
   char fname[1];
 };
 typedef struct keyring_name const * CONST_KR_NAME;
@@ -65,9 +80,6 @@ typedef struct keyring_name const * CONST_KR_NAME;
 static KR_NAME kr_names;
 static int active_handles;
 
-static OffsetHashTable kr_offtbl;
-static int kr_offtbl_ready;
-
 
 struct keyring_handle
 {
@@ -77,6 +89,7 @@ struct keyring_handle
     IOBUF iobuf;
     int eof;
     int error;
+    unsigned int offtbl_serial; /* Serial of the table when opened.  */
   } current;
   struct {
     CONST_KR_NAME kr;
@@ -92,6 +105,29 @@ struct keyring_handle
 };
 
 
+/* The offset table of a keyring is also stored in a file with this
+   suffix appended to the name of the keyring.  It starts with a 32
+   byte header:
+
+     byte[4]  magic "GKot"
+     byte     version (1)
+     byte[3]  RFU
+     u32      high word of the keyring's size
+     u32      low word of the keyring's size
+     u32      mtime of the keyring
+     u32      inode of the keyring
+     u32      number of items
+     u32      RFU
+
+   followed by one 16 byte item per keyid holding the two words of
+   the keyid and the high and the low word of the offset.  All
+   numbers are big endian.  */
+#define OFFTBL_SUFFIX    ".offtbl"
+#define OFFTBL_MAGIC     "GKot"
+#define OFFTBL_VERSION   1
+#define OFFTBL_HDRLEN    32
+#define OFFTBL_ITEMLEN   16
+
 
 static int do_copy (int mode, const char *fname, KBNODE root,
                     off_t start_offset, unsigned int n_packets );
@@ -107,7 +143,6 @@ new_offset_item (void)
   return k;
 }
 
-#if 0
 static void
 release_offset_items (struct off_item *k)
 {
@@ -119,7 +154,6 @@ release_offset_items (struct off_item *k)
       xfree (k);
     }
 }
-#endif
 
 static OffsetHashTable
 new_offset_hash_table (void)
@@ -130,19 +164,18 @@ new_offset_hash_table (void)
   return tbl;
 }
 
-#if 0
+/* Remove all items from TBL.  */
 static void
-release_offset_hash_table (OffsetHashTable tbl)
+clear_offset_hash_table (OffsetHashTable tbl)
 {
   int i;
 
-  if (!tbl)
-    return;
   for (i=0; i < 2048; i++)
-    release_offset_items (tbl[i]);
-  xfree (tbl);
+    {
+      release_offset_items (tbl[i]);
+      tbl[i] = NULL;
+    }
 }
-#endif
 
 static struct off_item *
 lookup_offset_hash_table (OffsetHashTable tbl, u32 *kid)
@@ -155,18 +188,19 @@ lookup_offset_hash_table (OffsetHashTable tbl, u32 *kid)
   return NULL;
 }
 
+/* Record that a keyblock at OFF holds the key KID.  If a key is
+   stored in several keyblocks we keep the first one.  */
 static void
 update_offset_hash_table (OffsetHashTable tbl, u32 *kid, off_t off)
 {
   struct off_item *k;
 
-  (void)off;
-
   for (k = tbl[(kid[1] & 0x07ff)]; k; k = k->next)
     {
       if (k->kid[0] == kid[0] && k->kid[1] == kid[1])
         {
-          /*k->off = off;*/
+          if (off < k->off)
+            k->off = off;
           return;
         }
     }
@@ -174,7 +208,7 @@ update_offset_hash_table (OffsetHashTable tbl, u32 *kid, off_t off)
   k = new_offset_item ();
   k->kid[0] = kid[0];
   k->kid[1] = kid[1];
-  /*k->off = off;*/
+  k->off = off;
   k->next = tbl[(kid[1] & 0x07ff)];
   tbl[(kid[1] & 0x07ff)] = k;
 }
@@ -194,6 +228,266 @@ update_offset_hash_table_from_kb (OffsetHashTable tbl, KBNODE node, off_t off)
     }
 }
 
+
+/* Return the non-const object for KR.  */
+static KR_NAME
+writable_kr_name (CONST_KR_NAME kr)
+{
+  KR_NAME r;
+
+  for (r=kr_names; r; r = r->next)
+    if (r == kr)
+      return r;
+  BUG ();
+  return NULL;
+}
+
+
+static void
+file_version_from_stat (struct file_version *ver, const struct stat *st)
+{
+  ver->size = st->st_size;
+  ver->mtime = (u32)st->st_mtime;
+  ver->ino = (u32)st->st_ino;
+}
+
+static int
+same_file_version (const struct file_version *a,
+                   const struct file_version *b)
+{
+  return (a->size == b->size && a->mtime == b->mtime && a->ino == b->ino);
+}
+
+/* Store the current version of the file FNAME at VER.  Returns 0 on
+   success.  */
+static int
+get_file_version (const char *fname, struct file_version *ver)
+{
+  struct stat st;
+
+  if (stat (fname, &st))
+    return -1;
+  file_version_from_stat (ver, &st);
+  return 0;
+}
+
+
+/* Forget everything we know about the keys in KR.  Handles still
+   reading the old file use the serial to notice that.  */
+static void
+offtbl_reset (KR_NAME kr)
+{
+  clear_offset_hash_table (kr->offtbl);
+  kr->did_full_scan = 0;
+  kr->offtbl_serial++;
+  memset (&kr->offtbl_version, 0, sizeof kr->offtbl_version);
+}
+
+
+static char *
+offtbl_filename (KR_NAME kr)
+{
+  return xstrconcat (kr->fname, OFFTBL_SUFFIX, NULL);
+}
+
+
+static void
+put_u32 (byte *p, u32 a)
+{
+  p[0] = a >> 24;
+  p[1] = a >> 16;
+  p[2] = a >>  8;
+  p[3] = a;
+}
+
+/* Splitting a possibly 32 bit off_t into two words.  */
+#define OFF_HI(a)  ((u32)((((a) >> 16) >> 16) & 0xffffffff))
+#define OFF_LO(a)  ((u32)((a) & 0xffffffff))
+#define OFF_MAKE(h,l)  (((((off_t)(h)) << 16) << 16) | (off_t)(l))
+
+
+/* Load the offset table of KR from its file.  This is only done if
+   the file describes the current version of the keyring; if so, the
+   table is complete.  Errors are not fatal; we will then build the
+   table by scanning the keyring.  */
+static void
+offtbl_load (KR_NAME kr)
+{
+  char *fname;
+  FILE *fp;
+  struct stat st;
+  struct file_version ver;
+  byte hdr[OFFTBL_HDRLEN];
+  byte item[OFFTBL_ITEMLEN];
+  u32 n, nitems, kid[2];
+  off_t off;
+
+  if (get_file_version (kr->fname, &kr->offtbl_version))
+    return;
+
+  fname = offtbl_filename (kr);
+  fp = fopen (fname, "rb");
+  xfree (fname);
+  if (!fp)
+    return;
+
+  if (fstat (fileno (fp), &st)
+      || fread (hdr, OFFTBL_HDRLEN, 1, fp) != 1
+      || memcmp (hdr, OFFTBL_MAGIC, 4)
+      || hdr[4] != OFFTBL_VERSION)
+    goto leave;
+
+  ver.size = OFF_MAKE (buf32_to_u32 (hdr+8), buf32_to_u32 (hdr+12));
+  ver.mtime = buf32_to_u32 (hdr+16);
+  ver.ino = buf32_to_u32 (hdr+20);
+  nitems = buf32_to_u32 (hdr+24);
+  if (!same_file_version (&ver, &kr->offtbl_version)
+      || (st.st_size - OFFTBL_HDRLEN) / OFFTBL_ITEMLEN != nitems
+      || (st.st_size - OFFTBL_HDRLEN) % OFFTBL_ITEMLEN)
+    goto leave;
+
+  for (n=0; n < nitems; n++)
+    {
+      if (fread (item, OFFTBL_ITEMLEN, 1, fp) != 1)
+        break;
+      kid[0] = buf32_to_u32 (item);
+      kid[1] = buf32_to_u32 (item+4);
+      off = OFF_MAKE (buf32_to_u32 (item+8), buf32_to_u32 (item+12));
+      if (off < 0 || off >= ver.size)
+        break;
+      update_offset_hash_table (kr->offtbl, kid, off);
+    }
+  if (n == nitems)
+    {
+      kr->did_full_scan = 1;
+      if (DBG_LOOKUP)
+        log_debug ("loaded %u keyids for '%s'\n", (unsigned int)nitems,
+                   kr->fname);
+    }
+  else
+    {
+      clear_offset_hash_table (kr->offtbl);
+      kr->offtbl_serial++;
+    }
+
+ leave:
+  fclose (fp);
+}
+
+
+/* Write the complete offset table of KR to its file.  This is merely
+   an optimization; thus errors are only logged.  The file is written
+   under a temporary name and then renamed so that readers never see
+   a partial table.  */
+static void
+offtbl_save (KR_NAME kr)
+{
+  char *fname, *tmpfname;
+  FILE *fp;
+  byte buf[OFFTBL_HDRLEN];
+  struct off_item *k;
+  u32 nitems;
+  int i, rc;
+
+  if (!kr->did_full_scan || kr->read_only || opt.dry_run)
+    return;
+
+  nitems = 0;
+  for (i=0; i < 2048; i++)
+    for (k = kr->offtbl[i]; k; k = k->next)
+      nitems++;
+
+  fname = offtbl_filename (kr);
+  tmpfname = xstrconcat (fname, EXTSEP_S "tmp", NULL);
+  fp = fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      if (DBG_LOOKUP)
+        log_debug ("can't create '%s': %s\n", tmpfname, strerror (errno));
+      goto leave;
+    }
+
+  memset (buf, 0, OFFTBL_HDRLEN);
+  memcpy (buf, OFFTBL_MAGIC, 4);
+  buf[4] = OFFTBL_VERSION;
+  put_u32 (buf+8, OFF_HI (kr->offtbl_version.size));
+  put_u32 (buf+12, OFF_LO (kr->offtbl_version.size));
+  put_u32 (buf+16, kr->offtbl_version.mtime);
+  put_u32 (buf+20, kr->offtbl_version.ino);
+  put_u32 (buf+24, nitems);
+  rc = fwrite (buf, OFFTBL_HDRLEN, 1, fp) != 1;
+
+  for (i=0; i < 2048 && !rc; i++)
+    for (k = kr->offtbl[i]; k && !rc; k = k->next)
+      {
+        put_u32 (buf, k->kid[0]);
+        put_u32 (buf+4, k->kid[1]);
+        put_u32 (buf+8, OFF_HI (k->off));
+        put_u32 (buf+12, OFF_LO (k->off));
+        rc = fwrite (buf, OFFTBL_ITEMLEN, 1, fp) != 1;
+      }
+
+  if (fclose (fp))
+    rc = 1;
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__riscos__)
+  if (!rc)
+    gnupg_remove (fname);
+#endif
+  if (rc || rename (tmpfname, fname))
+    {
+      log_info ("error writing '%s': %s\n", fname, strerror (errno));
+      gnupg_remove (tmpfname);
+    }
+
+ leave:
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Adjust the offset table of KR after the keyblock at OFF has been
+   replaced by KB.  For an insert OFF is the old size of the file.
+   OLDVER is the version of the file before the change.  If we can't
+   adjust the table or KB is NULL (i.e. the keyblock was deleted), we
+   forget the table and remove its file.  */
+static void
+offtbl_update (KR_NAME kr, const struct file_version *oldver,
+               off_t off, KBNODE kb)
+{
+  struct file_version ver;
+  struct off_item *k;
+  off_t delta;
+  int i;
+
+  if (!kb || !kr->did_full_scan
+      || !same_file_version (oldver, &kr->offtbl_version)
+      || get_file_version (kr->fname, &ver))
+    {
+      char *fname;
+
+      offtbl_reset (kr);
+      fname = offtbl_filename (kr);
+      if (!access (fname, F_OK))
+        gnupg_remove (fname);
+      xfree (fname);
+      return;
+    }
+
+  delta = ver.size - oldver->size;
+  if (delta)
+    for (i=0; i < 2048; i++)
+      for (k = kr->offtbl[i]; k; k = k->next)
+        if (k->off > off)
+          k->off += delta;
+  update_offset_hash_table_from_kb (kr->offtbl, kb, off);
+  kr->offtbl_version = ver;
+  /* Handles which opened the file before the change can't use the
+     offsets anymore.  */
+  kr->offtbl_serial++;
+  offtbl_save (kr);
+}
+
+
 /*
  * Register a filename for plain keyring files.  ptr is set to a
  * pointer to be used to create a handles etc, or the already-issued
@@ -220,19 +514,19 @@ keyring_register_filename (const char *fname, int read_only, void **ptr)
 	  }
       }
 
-    kr = xmalloc (sizeof *kr + strlen (fname));
+    kr = xmalloc_clear (sizeof *kr + strlen (fname));
     strcpy (kr->fname, fname);
     kr->read_only = read_only;
     kr->lockhd = NULL;
     kr->is_locked = 0;
     kr->did_full_scan = 0;
+    kr->offtbl = new_offset_hash_table ();
     /* keep a list of all issued pointers */
     kr->next = kr_names;
     kr_names = kr;
 
-    /* create the offset table the first time a function here is used */
-    if (!kr_offtbl)
-      kr_offtbl = new_offset_hash_table ();
+    /* A table saved by an earlier run saves us the first full scan.  */
+    offtbl_load (kr);
 
     *ptr=kr;
 
@@ -406,8 +700,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
 	return GPG_ERR_KEYRING_OPEN;
     }
 
-    pkt = xmalloc (sizeof *pkt);
-    init_packet (pkt);
+    pkt = alloc_packet ();
     hd->found.n_packets = 0;;
     lastnode = NULL;
     save_mode = set_packet_list_mode(0);
@@ -416,6 +709,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
         if (gpg_err_code (rc) == GPG_ERR_UNKNOWN_PACKET) {
 	    free_packet (pkt);
 	    init_packet (pkt);
+            lastnode = NULL; /* Don't apply its ring trust.  */
 	    continue;
 	}
         if (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY)
@@ -506,8 +800,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
             break;
           }
 
-        pkt = xmalloc (sizeof *pkt);
-        init_packet(pkt);
+        pkt = alloc_packet ();
     }
     set_packet_list_mode(save_mode);
 
@@ -528,8 +821,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
         }
 	*ret_kb = keyblock;
     }
-    free_packet (pkt);
-    xfree (pkt);
+    release_packet (pkt);
     iobuf_close(a);
 
     /* Make sure that future search operations fail immediately when
@@ -545,6 +837,8 @@ int
 keyring_update_keyblock (KEYRING_HANDLE hd, KBNODE kb)
 {
     int rc;
+    KR_NAME kr;
+    struct file_version oldver;
 
     if (!hd->found.kr)
         return -1; /* no successful prior search */
@@ -570,13 +864,13 @@ keyring_update_keyblock (KEYRING_HANDLE hd, KBNODE kb)
     hd->current.iobuf = NULL;
 
     /* do the update */
-    rc = do_copy (3, hd->found.kr->fname, kb,
+    kr = writable_kr_name (hd->found.kr);
+    if (get_file_version (kr->fname, &oldver))
+      memset (&oldver, 0, sizeof oldver);
+    rc = do_copy (3, kr->fname, kb,
                   hd->found.offset, hd->found.n_packets );
     if (!rc) {
-      if (kr_offtbl)
-        {
-          update_offset_hash_table_from_kb (kr_offtbl, kb, 0);
-        }
+      offtbl_update (kr, &oldver, hd->found.offset, kb);
       /* better reset the found info */
       hd->found.kr = NULL;
       hd->found.offset = 0;
@@ -588,27 +882,30 @@ int
 keyring_insert_keyblock (KEYRING_HANDLE hd, KBNODE kb)
 {
     int rc;
-    const char *fname;
+    CONST_KR_NAME ckr;
+    KR_NAME kr;
+    struct file_version oldver;
 
     if (!hd)
-        fname = NULL;
+        ckr = NULL;
     else if (hd->found.kr)
       {
-        fname = hd->found.kr->fname;
-        if (hd->found.kr->read_only)
+        ckr = hd->found.kr;
+        if (ckr->read_only)
           return gpg_error (GPG_ERR_EACCES);
       }
     else if (hd->current.kr)
       {
-        fname = hd->current.kr->fname;
-        if (hd->current.kr->read_only)
+        ckr = hd->current.kr;
+        if (ckr->read_only)
           return gpg_error (GPG_ERR_EACCES);
       }
     else
-        fname = hd->resource? hd->resource->fname:NULL;
+        ckr = hd->resource;
 
-    if (!fname)
+    if (!ckr)
         return GPG_ERR_GENERAL;
+    kr = writable_kr_name (ckr);
 
     /* Close this one otherwise we will lose the position for
      * a next search.  Fixme: it would be better to adjust the position
@@ -617,12 +914,12 @@ keyring_insert_keyblock (KEYRING_HANDLE hd, KBNODE kb)
     iobuf_close (hd->current.iobuf);
     hd->current.iobuf = NULL;
 
-    /* do the insert */
-    rc = do_copy (1, fname, kb, 0, 0 );
-    if (!rc && kr_offtbl)
-      {
-        update_offset_hash_table_from_kb (kr_offtbl, kb, 0);
-      }
+    /* do the insert; the keyblock is appended to the file */
+    if (get_file_version (kr->fname, &oldver))
+      memset (&oldver, 0, sizeof oldver);
+    rc = do_copy (1, kr->fname, kb, 0, 0 );
+    if (!rc)
+      offtbl_update (kr, &oldver, oldver.size, kb);
 
     return rc;
 }
@@ -661,11 +958,12 @@ keyring_delete_keyblock (KEYRING_HANDLE hd)
     rc = do_copy (2, hd->found.kr->fname, NULL,
                   hd->found.offset, hd->found.n_packets );
     if (!rc) {
+        /* Delete is a rare operation, so we simply start over with
+         * the offset table.  */
+        offtbl_update (writable_kr_name (hd->found.kr), NULL, 0, NULL);
         /* better reset the found info */
         hd->found.kr = NULL;
         hd->found.offset = 0;
-        /* Delete is a rare operations, so we don't remove the keys
-         * from the offset table */
     }
     return rc;
 }
@@ -738,6 +1036,28 @@ prepare_search (KEYRING_HANDLE hd)
         return hd->current.error;
       }
 
+    /* Check that the offset table still describes the file we are
+       going to read; another process may have changed it.  */
+    {
+      KR_NAME kr = writable_kr_name (hd->current.kr);
+      struct stat st;
+      struct file_version ver;
+      int fd = iobuf_get_fd (hd->current.iobuf);
+
+      if (fd == -1 || fstat (fd, &st))
+        offtbl_reset (kr);
+      else
+        {
+          file_version_from_stat (&ver, &st);
+          if (!same_file_version (&ver, &kr->offtbl_version))
+            {
+              offtbl_reset (kr);
+              kr->offtbl_version = ver;
+            }
+        }
+      hd->current.offtbl_serial = kr->offtbl_serial;
+    }
+
     return 0;
 }
 
@@ -943,7 +1263,8 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   int need_uid, need_words, need_keyid, need_fpr, any_skip;
   int pk_no, uid_no;
   int initial_skip;
-  int use_offtbl;
+  KR_NAME kr;
+  int build_offtbl;
   PKT_user_id *uid = NULL;
   PKT_public_key *pk = NULL;
   u32 aki[2];
@@ -991,27 +1312,33 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   if (rc)
     return rc;
 
-  use_offtbl = !!kr_offtbl;
-  if (!use_offtbl)
-    ;
-  else if (!kr_offtbl_ready)
+  /* A table with all keys of the file lets us answer a key ID
+     search without a scan, or at least skip to the right keyblock.
+     The table has been validated by prepare_search when the file was
+     opened.  */
+  kr = writable_kr_name (hd->current.kr);
+  build_offtbl = (!kr->did_full_scan
+                  && hd->current.offtbl_serial == kr->offtbl_serial);
+  if (!kr->did_full_scan)
     need_keyid = 1;
-  else if (ndesc == 1 && desc[0].mode == KEYDB_SEARCH_MODE_LONG_KID)
+  else if (ndesc == 1 && desc[0].mode == KEYDB_SEARCH_MODE_LONG_KID
+           && hd->current.offtbl_serial == kr->offtbl_serial)
     {
       struct off_item *oi;
 
-      oi = lookup_offset_hash_table (kr_offtbl, desc[0].u.kid);
+      oi = lookup_offset_hash_table (kr->offtbl, desc[0].u.kid);
       if (!oi)
         { /* We know that we don't have this key */
           hd->found.kr = NULL;
           hd->current.eof = 1;
           return -1;
         }
-      /* We could now create a positive search status and return.
-       * However the problem is that another instance of gpg may
-       * have changed the keyring so that the offsets are not valid
-       * anymore - therefore we don't do it
-       */
+      if (iobuf_tell (hd->current.iobuf) < oi->off
+          && iobuf_seek (hd->current.iobuf, oi->off))
+        {
+          hd->current.error = gpg_error (GPG_ERR_GENERAL);
+          return hd->current.error;
+        }
     }
 
   if (need_words)
@@ -1080,8 +1407,8 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
           if (need_keyid)
             keyid_from_pk (pk, aki);
 
-          if (use_offtbl && !kr_offtbl_ready)
-            update_offset_hash_table (kr_offtbl, aki, main_offset);
+          if (build_offtbl)
+            update_offset_hash_table (kr->offtbl, aki, main_offset);
         }
       else if (pkt.pkttype == PKT_USER_ID)
         {
@@ -1166,30 +1493,13 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   else if (rc == -1)
     {
       hd->current.eof = 1;
-      /* if we scanned all keyrings, we are sure that
-       * all known key IDs are in our offtbl, mark that. */
-      if (use_offtbl && !kr_offtbl_ready)
+      /* If we scanned the entire keyring, we are sure that all its
+         key IDs are in the offtbl; mark that and store the table so
+         that the next process does not need to scan.  */
+      if (build_offtbl)
         {
-          KR_NAME kr;
-
-          /* First set the did_full_scan flag for this keyring.  */
-          for (kr=kr_names; kr; kr = kr->next)
-            {
-              if (hd->resource == kr)
-                {
-                  kr->did_full_scan = 1;
-                  break;
-                }
-            }
-          /* Then check whether all flags are set and if so, mark the
-             offtbl ready */
-          for (kr=kr_names; kr; kr = kr->next)
-            {
-              if (!kr->did_full_scan)
-                break;
-            }
-          if (!kr)
-            kr_offtbl_ready = 1;
+          kr->did_full_scan = 1;
+          offtbl_save (kr);
         }
     }
   else
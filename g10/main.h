@@ -178,6 +178,7 @@ unsigned int ecdsa_qbits_from_Q (unsigned int qbits);
 
 /*-- status.c --*/
 void set_status_fd ( int fd );
+void set_status_stream (estream_t fp);
 int  is_status_enabled ( void );
 void write_status ( int no );
 void write_status_error (const char *where, gpg_error_t err);
@@ -227,7 +228,9 @@ int encrypt_filter (void *opaque, int control,
 int complete_sig (PKT_signature *sig, PKT_public_key *pksk, gcry_md_hd_t md,
                   const char *cache_nonce);
 int sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
-	       int do_encrypt, strlist_t remusr, const char *outfile );
+	       int do_encrypt, strlist_t remusr, const char *outfile,
+               int filefd, int outputfd);
+void sign_files (ctrl_t ctrl, int nfiles, char **files, strlist_t locusr);
 int clearsign_file( const char *fname, strlist_t locusr, const char *outfile );
 int sign_symencrypt_file (const char *fname, strlist_t locusr);
 
@@ -239,6 +242,25 @@ int check_key_signature( KBNODE root, KBNODE node, int *is_selfsig );
 int check_key_signature2( KBNODE root, KBNODE node, PKT_public_key *check_pk,
 			  PKT_public_key *ret_pk, int *is_selfsig,
 			  u32 *r_expiredate, int *r_expired );
+void cache_sig_result (PKT_signature *sig, int result);
+gcry_mpi_t key_signature_hash (KBNODE root, KBNODE node);
+
+/*-- sig-queue.c --*/
+struct sig_queue_s;
+typedef struct sig_queue_s *sig_queue_t;
+struct datafile_hash_s;
+struct workpool_s;
+sig_queue_t sig_queue_new (void);
+void sig_queue_release (sig_queue_t queue);
+void sig_queue_add_keyblock (sig_queue_t queue, kbnode_t keyblock);
+void sig_queue_run (sig_queue_t queue);
+int sig_queue_threads (void);
+int gpg_npth_init (void);
+struct workpool_s *gpg_get_workers (int nthreads);
+void gpg_run_parallel (void (*fnc) (void *arg, unsigned int idx), void *arg,
+                       unsigned int n);
+void hash_datafiles_parallel (struct datafile_hash_s *jobs, int njobs,
+                              int nthreads);
 
 /*-- delkey.c --*/
 gpg_error_t delete_keys (strlist_t names, int secret, int allow_both);
@@ -251,6 +273,8 @@ void keyedit_quick_adduid (ctrl_t ctrl, const char *username,
                            const char *newuid);
 void keyedit_quick_sign (ctrl_t ctrl, const char *fpr,
                          strlist_t uids, strlist_t locusr, int local);
+void keyedit_quick_sign_keys (ctrl_t ctrl, const char *fname,
+                              strlist_t locusr, int local);
 void show_basic_key_info (KBNODE keyblock);
 
 /*-- keygen.c --*/
@@ -365,6 +389,7 @@ void print_card_key_info (estream_t fp, KBNODE keyblock);
 void print_file_status( int status, const char *name, int what );
 int verify_signatures (ctrl_t ctrl, int nfiles, char **files );
 int verify_files (ctrl_t ctrl, int nfiles, char **files );
+int verify_detached_files (ctrl_t ctrl, int nfiles, char **files);
 int gpg_verify (ctrl_t ctrl, int sig_fd, int data_fd, estream_t out_fp);
 
 /*-- decrypt.c --*/
@@ -377,6 +402,13 @@ int hash_datafiles( gcry_md_hd_t md, gcry_md_hd_t md2,
 		    strlist_t files, const char *sigfilename, int textmode);
 int hash_datafile_by_fd ( gcry_md_hd_t md, gcry_md_hd_t md2, int data_fd,
                           int textmode );
+/* A file to be hashed by hash_datafile_job.  */
+struct datafile_hash_s
+{
+  IOBUF inp;           /* The opened file or NULL.  */
+  gcry_md_hd_t md;     /* The hash context to update.  */
+};
+void hash_datafile_job (struct datafile_hash_s *job);
 PKT_plaintext *setup_plaintext_name(const char *filename,IOBUF iobuf);
 
 /*-- signal.c --*/
@@ -403,5 +435,9 @@ int  card_store_subkey (KBNODE node, int use);
 /*-- migrate.c --*/
 void migrate_secring (ctrl_t ctrl);
 
+/*-- stats.c --*/
+void stats_init (void);
+void stats_dump (void);
+
 
 #endif /*G10_MAIN_H*/
@@ -87,6 +87,10 @@ struct mainproc_context
     /* Flag to indicated that either one of the next previous fields
        is used.  This is only needed for better readability. */
     int used;
+    /* If not NULL the hash over the data files computed in advance.
+       It is used instead of reading the files for a binary detached
+       signature with one of its digest algorithms.  */
+    gcry_md_hd_t prehashed;
   } signed_data;
 
   DEK *dek;
@@ -1173,6 +1177,18 @@ proc_packets (ctrl_t ctrl, void *anchor, iobuf_t a )
 int
 proc_signature_packets (ctrl_t ctrl, void *anchor, iobuf_t a,
 			strlist_t signedfiles, const char *sigfilename )
+{
+  return proc_signature_packets_prehashed (ctrl, anchor, a, signedfiles,
+                                           NULL, sigfilename);
+}
+
+
+/* Same as proc_signature_packets but with DATAHASH holding the hash
+   over SIGNEDFILES if it is not NULL.  DATAHASH is not changed.  */
+int
+proc_signature_packets_prehashed (ctrl_t ctrl, void *anchor, iobuf_t a,
+                                  strlist_t signedfiles, gcry_md_hd_t datahash,
+                                  const char *sigfilename)
 {
   CTX c = xmalloc_clear (sizeof *c);
   int rc;
@@ -1184,6 +1200,7 @@ proc_signature_packets (ctrl_t ctrl, void *anchor, iobuf_t a,
   c->signed_data.data_fd = -1;
   c->signed_data.data_names = signedfiles;
   c->signed_data.used = !!signedfiles;
+  c->signed_data.prehashed = signedfiles? datahash : NULL;
 
   c->sigfilename = sigfilename;
   rc = do_proc_packets ( c, a );
@@ -2275,7 +2292,18 @@ proc_tree (CTX c, kbnode_t node)
                 gcry_md_debug (c->mfx.md2, "verify2");
             }
 
-          if (c->sigs_only)
+          if (c->sigs_only && c->signed_data.prehashed && !c->mfx.md2
+              && sig->sig_class == 0x00
+              && gcry_md_is_enabled (c->signed_data.prehashed,
+                                     sig->digest_algo))
+            {
+              /* The data has already been hashed; use a copy of
+                 that hash.  */
+              gcry_md_close (c->mfx.md);
+              c->mfx.md = NULL;
+              rc = gcry_md_copy (&c->mfx.md, c->signed_data.prehashed);
+            }
+          else if (c->sigs_only)
             {
               if (c->signed_data.used && c->signed_data.data_fd != -1)
                 rc = hash_datafile_by_fd (c->mfx.md, c->mfx.md2,
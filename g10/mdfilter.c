@@ -41,17 +41,21 @@ md_filter( void *opaque, int control,
 {
     size_t size = *ret_len;
     md_filter_context_t *mfx = opaque;
+    const byte *p;
     int i, rc=0;
 
     if( control == IOBUFCTRL_UNDERFLOW ) {
 	if( mfx->maxbuf_size && size > mfx->maxbuf_size )
 	    size = mfx->maxbuf_size;
-	i = iobuf_read( a, buf, size );
+	/* Hash the data in the buffer of the chain (or the mapped
+	 * file) before we copy it to our buffer.  */
+	i = iobuf_read_direct( a, &p, size );
 	if( i == -1 ) i = 0;
 	if( i ) {
-	    gcry_md_write(mfx->md, buf, i );
+	    gcry_md_write(mfx->md, p, i );
 	    if( mfx->md2 )
-		gcry_md_write(mfx->md2, buf, i );
+		gcry_md_write(mfx->md2, p, i );
+	    memcpy( buf, p, i );
 	}
 	else
 	    rc = -1; /* eof */
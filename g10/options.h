@@ -48,6 +48,7 @@ struct
   int verbose;
   int quiet;
   unsigned debug;
+  int debug_stats;  /* Collect and print throughput statistics.  */
   int armor;
   char *outfile;
   estream_t outfp;  /* Hack, sometimes used in place of outfile.  */
@@ -101,6 +102,12 @@ struct
   int marginals_needed;
   int completes_needed;
   int max_cert_depth;
+  int keyblock_cache_size;
+  int key_cache_size;     /* 0 = use the configured default.  */
+  int sig_check_threads;  /* 0 = one for each CPU.  */
+  int trustdb_mmap;       /* Map the trustdb for lookups.  */
+  int compress_threads;   /* < 2 = one deflate stream, -1 = per CPU.  */
+  int cipher_pipeline;    /* Run the cipher and the MDC on threads.  */
   const char *homedir;
   const char *agent_program;
   const char *dirmngr_program;
@@ -327,6 +334,7 @@ EXTERN_UNLESS_MAIN_MODULE int memory_stat_debug_mode;
 #define IMPORT_CLEAN                     (1<<6)
 #define IMPORT_NO_SECKEY                 (1<<7)
 #define IMPORT_KEEP_OWNERTTRUST          (1<<8)
+#define IMPORT_BULK                      (1<<9)
 
 #define EXPORT_LOCAL_SIGS                (1<<0)
 #define EXPORT_ATTRIBUTES                (1<<1)
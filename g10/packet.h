@@ -276,6 +276,11 @@ typedef struct
   u32     has_expired;    /* set to the expiration date if expired */
   u32     main_keyid[2];  /* keyid of the primary key */
   u32     keyid[2];	    /* calculated by keyid_from_pk() */
+  byte    fprlen;         /* length of the cached fingerprint or 0 */
+  byte    fpr[MAX_FINGERPRINT_LEN]; /* cached by fingerprint_from_pk();
+                                       see forget_fingerprint() */
+  byte    keygrip[20];    /* cached by keygrip_from_pk(); see
+                             flags.keygrip_valid */
   prefitem_t *prefs;      /* list of preferences (may be NULL) */
   struct
   {
@@ -293,6 +298,7 @@ typedef struct
     unsigned int dont_cache:1;    /* Do not cache this key.  */
     unsigned int backsig:2;       /* 0=none, 1=bad, 2=good.  */
     unsigned int serialno_valid:1;/* SERIALNO below is valid.  */
+    unsigned int keygrip_valid:1; /* KEYGRIP above is valid.  */
   } flags;
   PKT_user_id *user_id;   /* If != NULL: found by that uid. */
   struct revocation_key *revkey;
@@ -411,6 +417,10 @@ void reset_literals_seen(void);
 int proc_packets (ctrl_t ctrl, void *ctx, iobuf_t a );
 int proc_signature_packets (ctrl_t ctrl, void *ctx, iobuf_t a,
 			    strlist_t signedfiles, const char *sigfile );
+int proc_signature_packets_prehashed (ctrl_t ctrl, void *ctx, iobuf_t a,
+                                      strlist_t signedfiles,
+                                      gcry_md_hd_t datahash,
+                                      const char *sigfile);
 int proc_signature_packets_by_fd (ctrl_t ctrl,
                                   void *anchor, IOBUF a, int signed_data_fd );
 int proc_encryption_packets (ctrl_t ctrl, void *ctx, iobuf_t a);
@@ -418,6 +428,7 @@ int list_packets( iobuf_t a );
 
 /*-- parse-packet.c --*/
 int set_packet_list_mode( int mode );
+int set_packet_skip_foreign_certs (int yes);
 
 #if DEBUG_PARSE_PACKET
 int dbg_search_packet( iobuf_t inp, PACKET *pkt, off_t *retpos, int with_uid,
@@ -484,6 +495,10 @@ struct notation *sig_to_notation(PKT_signature *sig);
 void free_notation(struct notation *notation);
 
 /*-- free-packet.c --*/
+PKT_signature *alloc_signature (void);
+PKT_public_key *alloc_public_key (void);
+PACKET *alloc_packet (void);
+void release_packet (PACKET *pkt);
 void free_symkey_enc( PKT_symkey_enc *enc );
 void free_pubkey_enc( PKT_pubkey_enc *enc );
 void free_seckey_enc( PKT_signature *enc );
@@ -512,6 +527,9 @@ int signature_check2( PKT_signature *sig, gcry_md_hd_t digest, u32 *r_expiredate
 /*-- pubkey-enc.c --*/
 gpg_error_t get_session_key (PKT_pubkey_enc *k, DEK *dek);
 gpg_error_t get_override_session_key (DEK *dek, const char *string);
+void prefetch_session_keys (ctrl_t ctrl, PKT_pubkey_enc **encs,
+                            unsigned int nencs);
+void release_prefetched_session_keys (void);
 
 /*-- compress.c --*/
 int handle_compressed (ctrl_t ctrl, void *ctx, PKT_compressed *cd,
@@ -534,6 +552,17 @@ int make_keysig_packet( PKT_signature **ret_sig, PKT_public_key *pk,
 			int (*mksubpkt)(PKT_signature *, void *),
 			void *opaque,
                         const char *cache_nonce);
+typedef struct keysig_batch_s *keysig_batch_t;
+keysig_batch_t keysig_batch_new (void);
+void keysig_batch_release (keysig_batch_t batch);
+int make_keysig_packet_batch (keysig_batch_t batch, PKT_signature **ret_sig,
+                              PKT_public_key *pk, PKT_user_id *uid,
+                              PKT_public_key *subpk, PKT_public_key *pksk,
+                              int sigclass, int digest_algo,
+                              u32 timestamp, u32 duration,
+                              int (*mksubpkt)(PKT_signature *, void *),
+                              void *opaque);
+gpg_error_t keysig_batch_flush (keysig_batch_t batch);
 int update_keysig_packet( PKT_signature **ret_sig,
                       PKT_signature *orig_sig,
                       PKT_public_key *pk,
@@ -48,6 +48,12 @@ static int mpi_print_mode;
 static int list_mode;
 static estream_t listfp;
 
+/* If set, user ID certifications and their revocations which have not
+   been issued by the last parsed primary key are skipped.  See
+   set_packet_skip_foreign_certs.  */
+static int skip_foreign_certs;
+static u32 skip_certs_keyid[2];
+
 static int parse (IOBUF inp, PACKET * pkt, int onlykeypkts,
 		  off_t * retpos, int *skip, IOBUF out, int do_skip
 #ifdef DEBUG_PARSE_PACKET
@@ -117,7 +123,7 @@ read_32 (IOBUF inp)
 static gcry_mpi_t
 mpi_read (iobuf_t inp, unsigned int *ret_nread, int secure)
 {
-  int c, c1, c2, i;
+  int c, c1, c2, n;
   unsigned int nmax = *ret_nread;
   unsigned int nbits, nbytes;
   size_t nread = 0;
@@ -148,13 +154,14 @@ mpi_read (iobuf_t inp, unsigned int *ret_nread, int secure)
   p = buf;
   p[0] = c1;
   p[1] = c2;
-  for (i = 0; i < nbytes; i++)
-    {
-      p[i + 2] = iobuf_get (inp) & 0xff;
-      if (nread == nmax)
-        goto overflow;
-      nread++;
-    }
+  /* Read the body in one go; this is a plain memcpy when the packet
+     comes from a memory buffer.  */
+  n = nbytes < nmax - nread ? nbytes : nmax - nread;
+  if (n && iobuf_read (inp, p + 2, n) != n)
+    goto leave;
+  nread += n;
+  if (n < nbytes)
+    goto overflow;
 
   if (gcry_mpi_scan (&a, GCRYMPI_FMT_PGP, buf, nread, &nread))
     a = NULL;
@@ -172,6 +179,23 @@ mpi_read (iobuf_t inp, unsigned int *ret_nread, int secure)
 }
 
 
+/* Let parse_packet skip the user ID certifications made by other keys
+   than the primary key of the keyblock they are parsed from, as if
+   they were unknown packets.  The signature data of these packets is
+   not read, which makes parsing a keyblock with many foreign
+   certifications faster where they are not needed anyway.  YES
+   switches this on or off; the former state is returned.  */
+int
+set_packet_skip_foreign_certs (int yes)
+{
+  int old = skip_foreign_certs;
+
+  skip_foreign_certs = yes;
+  skip_certs_keyid[0] = skip_certs_keyid[1] = 0;
+  return old;
+}
+
+
 int
 set_packet_list_mode (int mode)
 {
@@ -621,8 +645,11 @@ parse (IOBUF inp, PACKET * pkt, int onlykeypkts, off_t * retpos,
     case PKT_PUBLIC_SUBKEY:
     case PKT_SECRET_KEY:
     case PKT_SECRET_SUBKEY:
-      pkt->pkt.public_key = xmalloc_clear (sizeof *pkt->pkt.public_key);
+      pkt->pkt.public_key = alloc_public_key ();
       rc = parse_key (inp, pkttype, pktlen, hdr, hdrlen, pkt);
+      if (!rc && skip_foreign_certs
+          && (pkttype == PKT_PUBLIC_KEY || pkttype == PKT_SECRET_KEY))
+        keyid_from_pk (pkt->pkt.public_key, skip_certs_keyid);
       break;
     case PKT_SYMKEY_ENC:
       rc = parse_symkeyenc (inp, pkttype, pktlen, pkt);
@@ -631,7 +658,7 @@ parse (IOBUF inp, PACKET * pkt, int onlykeypkts, off_t * retpos,
       rc = parse_pubkeyenc (inp, pkttype, pktlen, pkt);
       break;
     case PKT_SIGNATURE:
-      pkt->pkt.signature = xmalloc_clear (sizeof *pkt->pkt.signature);
+      pkt->pkt.signature = alloc_signature ();
       rc = parse_signature (inp, pkttype, pktlen, pkt->pkt.signature);
       break;
     case PKT_ONEPASS_SIG:
@@ -784,8 +811,7 @@ skip_packet (IOBUF inp, int pkttype, unsigned long pktlen, int partial)
 static void *
 read_rest (IOBUF inp, size_t pktlen)
 {
-  int c;
-  byte *buf, *p;
+  byte *buf;
 
   buf = xtrymalloc (pktlen);
   if (!buf)
@@ -794,16 +820,11 @@ read_rest (IOBUF inp, size_t pktlen)
       log_error ("error reading rest of packet: %s\n", gpg_strerror (err));
       return NULL;
     }
-  for (p = buf; pktlen; pktlen--)
+  if (pktlen && iobuf_read (inp, buf, pktlen) != pktlen)
     {
-      c = iobuf_get (inp);
-      if (c == -1)
-        {
-          log_error ("premature eof while reading rest of packet\n");
-          xfree (buf);
-          return NULL;
-        }
-      *p++ = c;
+      log_error ("premature eof while reading rest of packet\n");
+      xfree (buf);
+      return NULL;
     }
 
   return buf;
@@ -841,14 +862,11 @@ read_size_body (iobuf_t inp, int pktlen, size_t *r_nread,
 
   buffer[0] = nbytes;
 
-  for (i = 0; i < nbytes; i++)
-    {
-      c = iobuf_get (inp);
-      if (c < 0)
-        return gpg_error (GPG_ERR_INV_PACKET);
-      ++*r_nread;
-      buffer[1+i] = c;
-    }
+  i = iobuf_read (inp, buffer + 1, nbytes);
+  if (i > 0)
+    *r_nread += i;
+  if (i != nbytes)
+    return gpg_error (GPG_ERR_INV_PACKET);
 
   tmpbuf = xtrymalloc (1 + nbytes);
   if (!tmpbuf)
@@ -1817,6 +1835,15 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	parse_revkeys (sig);
     }
 
+  if (skip_foreign_certs && !list_mode
+      && ((sig->sig_class & ~3) == 0x10 || sig->sig_class == 0x30)
+      && (sig->keyid[0] != skip_certs_keyid[0]
+          || sig->keyid[1] != skip_certs_keyid[1]))
+    {
+      rc = GPG_ERR_UNKNOWN_PACKET;
+      goto leave;
+    }
+
   if (list_mode)
     {
       es_fprintf (listfp, ":signature packet: algo %d, keyid %08lX%08lX\n"
@@ -2482,9 +2509,16 @@ parse_user_id (IOBUF inp, int pkttype, unsigned long pktlen, PACKET * packet)
   packet->pkt.user_id->ref = 1;
 
   p = packet->pkt.user_id->name;
-  for (; pktlen; pktlen--, p++)
-    *p = iobuf_get_noeof (inp);
-  *p = 0;
+  if (pktlen && iobuf_read (inp, p, pktlen) != pktlen)
+    {
+      log_error ("premature eof while reading user ID\n");
+      if (list_mode)
+        es_fprintf (listfp, ":user ID packet: [premature eof]\n");
+      free_user_id (packet->pkt.user_id);
+      packet->pkt.user_id = NULL;
+      return GPG_ERR_INV_PACKET;
+    }
+  p[pktlen] = 0;
 
   if (list_mode)
     {
@@ -2566,8 +2600,15 @@ parse_attribute (IOBUF inp, int pkttype, unsigned long pktlen,
   packet->pkt.user_id->attrib_len = pktlen;
 
   p = packet->pkt.user_id->attrib_data;
-  for (; pktlen; pktlen--, p++)
-    *p = iobuf_get_noeof (inp);
+  if (pktlen && iobuf_read (inp, p, pktlen) != pktlen)
+    {
+      log_error ("premature eof while reading attribute\n");
+      if (list_mode)
+        es_fprintf (listfp, ":attribute packet: [premature eof]\n");
+      free_user_id (packet->pkt.user_id);
+      packet->pkt.user_id = NULL;
+      return GPG_ERR_INV_PACKET;
+    }
 
   /* Now parse out the individual attribute subpackets.  This is
      somewhat pointless since there is only one currently defined
@@ -40,6 +40,26 @@
 
 #define CONTROL_D ('D' - 'A' + 1)
 
+/* The number of recipients remembered by find_and_check_key.  */
+#define RECP_CACHE_SIZE 16
+
+/* A recipient key looked up by find_and_check_key.  The entry is
+   valid as long as neither the keys nor the trust database have been
+   changed since the lookup.  */
+struct recp_cache_item_s
+{
+  struct recp_cache_item_s *next;
+  unsigned int use;            /* The requested usage.  */
+  unsigned int keydb_changes;  /* keydb_change_count of the lookup.  */
+  unsigned int trust_changes;  /* trust_change_count of the lookup.  */
+  PKT_public_key *pk;          /* The key found.  */
+  unsigned int trustlevel;     /* Its validity.  */
+  char name[1];                /* The user id as given.  */
+};
+typedef struct recp_cache_item_s *recp_cache_item_t;
+
+static recp_cache_item_t recp_cache;
+
 static void
 send_status_inv_recp (int reason, const char *name)
 {
@@ -778,6 +798,73 @@ expand_group(strlist_t input)
 }
 
 
+/* Return a copy of the key found for NAME and USE by a previous call
+   of find_and_check_key and store its validity at R_TRUSTLEVEL.
+   Returns NULL if there is no such key or if it may have changed.  */
+static PKT_public_key *
+recp_cache_get (const char *name, unsigned int use,
+                unsigned int *r_trustlevel)
+{
+  recp_cache_item_t r, *rp;
+  u32 now = make_timestamp ();
+
+  for (rp = &recp_cache; (r = *rp); rp = &r->next)
+    {
+      if (r->use != use || strcmp (r->name, name))
+        continue;
+
+      *rp = r->next;
+      if (r->keydb_changes != keydb_change_count ()
+          || r->trust_changes != trust_change_count ()
+          || (r->pk->expiredate && r->pk->expiredate <= now))
+        {
+          free_public_key (r->pk);
+          xfree (r);
+          return NULL;
+        }
+
+      /* Move it to the front.  */
+      r->next = recp_cache;
+      recp_cache = r;
+      *r_trustlevel = r->trustlevel;
+      return copy_public_key (NULL, r->pk);
+    }
+  return NULL;
+}
+
+
+/* Remember PK with validity TRUSTLEVEL as the key for NAME and USE.  */
+static void
+recp_cache_put (const char *name, unsigned int use,
+                PKT_public_key *pk, unsigned int trustlevel)
+{
+  recp_cache_item_t r, *rp;
+  int n;
+
+  r = xtrymalloc (sizeof *r + strlen (name));
+  if (!r)
+    return;
+  strcpy (r->name, name);
+  r->use = use;
+  r->keydb_changes = keydb_change_count ();
+  r->trust_changes = trust_change_count ();
+  r->pk = copy_public_key (NULL, pk);
+  r->trustlevel = trustlevel;
+  r->next = recp_cache;
+  recp_cache = r;
+
+  /* Drop the least recently used entries.  */
+  for (n=0, rp = &recp_cache; *rp && n < RECP_CACHE_SIZE; rp = &(*rp)->next)
+    n++;
+  while ((r = *rp))
+    {
+      *rp = r->next;
+      free_public_key (r->pk);
+      xfree (r);
+    }
+}
+
+
 /* Helper for build_pk_list to find and check one key.  This helper is
    also used directly in server mode by the RECIPIENTS command.  On
    success the new key is added to PK_LIST_ADDR.  NAME is the user id
@@ -789,11 +876,19 @@ find_and_check_key (ctrl_t ctrl, const char *name, unsigned int use,
 {
   int rc;
   PKT_public_key *pk;
-  int trustlevel;
+  unsigned int trustlevel;
 
   if (!name || !*name)
     return gpg_error (GPG_ERR_INV_USER_ID);
 
+  /* The same recipients are often used again in server mode or when
+     encrypting many files.  Unless the keys or the trust database
+     have changed we take the key and its validity from the cache;
+     the checks below are done in any case.  */
+  pk = recp_cache_get (name, use, &trustlevel);
+  if (pk)
+    goto check_validity;
+
   pk = xtrycalloc (1, sizeof *pk);
   if (!pk)
     return gpg_error_from_syserror ();
@@ -830,6 +925,9 @@ find_and_check_key (ctrl_t ctrl, const char *name, unsigned int use,
 
   /* Key found and usable.  Check validity. */
   trustlevel = get_validity (pk, pk->user_id);
+  recp_cache_put (name, use, pk, trustlevel);
+
+ check_validity:
   if ( (trustlevel & TRUST_FLAG_DISABLED) )
     {
       /* Key has been disabled. */
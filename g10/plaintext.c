@@ -40,6 +40,10 @@
 #include "i18n.h"
 
 
+/* The number of bytes hashed in one go by hash_datafile_job.  */
+#define DATAFILE_HASH_CHUNK (1024*1024)
+
+
 /* Handle a plaintext packet.  If MFX is not NULL, update the MDs
  * Note: We should have used the filter stuff here, but we have to add
  * some easy mimic to set a read limit, so we calculate only the bytes
@@ -519,10 +523,15 @@ do_hash (gcry_md_hd_t md, gcry_md_hd_t md2, IOBUF fp, int textmode)
     }
   else
     {
-      while ((c = iobuf_get (fp)) != -1)
+      const byte *p;
+      int n;
+
+      /* Hash the data where it is; for a mapped file this is the
+         page cache.  */
+      while ((n = iobuf_read_direct (fp, &p, 65536)) != -1)
 	{
 	  if (md)
-	    gcry_md_putc (md, c);
+	    gcry_md_write (md, p, n);
 	}
     }
 }
@@ -645,7 +654,7 @@ hash_datafiles (gcry_md_hd_t md, gcry_md_hd_t md2, strlist_t files,
 
   for (sl = files; sl; sl = sl->next)
     {
-      fp = iobuf_open (sl->d);
+      fp = iobuf_open_mmap (sl->d);
       if (fp && is_secured_file (iobuf_get_fd (fp)))
 	{
 	  iobuf_close (fp);
@@ -707,6 +716,20 @@ hash_datafile_by_fd (gcry_md_hd_t md, gcry_md_hd_t md2, int data_fd,
 }
 
 
+/* Hash the data of the file opened at JOB.  Apart from reading the
+   file, this does not touch anything but JOB and may thus be run by
+   a thread without the npth lock.  */
+void
+hash_datafile_job (struct datafile_hash_s *job)
+{
+  const byte *p;
+  int n;
+
+  while ((n = iobuf_read_direct (job->inp, &p, DATAFILE_HASH_CHUNK)) != -1)
+    gcry_md_write (job->md, p, n);
+}
+
+
 /* Set up a plaintext packet with the appropriate filename.  If there
    is a --set-filename, use it (it's already UTF8).  If there is a
    regular filename, UTF8-ize it if necessary.  If there is no
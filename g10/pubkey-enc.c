@@ -42,6 +42,20 @@ static gpg_error_t get_it (PKT_pubkey_enc *k,
                            DEK *dek, PKT_public_key *sk, u32 *keyid);
 
 
+/* The most packets decrypted by one PKDECRYPT_BATCH.  */
+#define MAX_PREFETCH 128
+
+/* A DEK frame decrypted ahead by prefetch_session_keys.  */
+struct prefetched_frame_s
+{
+  struct prefetched_frame_s *next;
+  byte digest[20];   /* SHA-1 of the keygrip and the ciphertext.  */
+  size_t nframe;
+  byte frame[1];
+};
+static struct prefetched_frame_s *prefetched_frames;
+
+
 /* Check that the given algo is mentioned in one of the valid user-ids. */
 static int
 is_algo_in_prefs (kbnode_t keyblock, preftype_t type, int algo)
@@ -138,37 +152,21 @@ leave:
 }
 
 
+/* Store the ciphertext of ENC for the secret key SK as S-expression
+   at R_DATA.  */
 static gpg_error_t
-get_it (PKT_pubkey_enc *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
+build_enc_data (PKT_pubkey_enc *enc, PKT_public_key *sk, gcry_sexp_t *r_data)
 {
   gpg_error_t err;
-  byte *frame = NULL;
-  unsigned int n;
-  size_t nframe;
-  u16 csum, csum2;
-  int padding;
-  gcry_sexp_t s_data;
-  char *desc;
-  char *keygrip;
-  byte fp[MAX_FINGERPRINT_LEN];
-  size_t fpn;
-
-  if (DBG_CLOCK)
-    log_clock ("decryption start");
-
-  /* Get the keygrip.  */
-  err = hexkeygrip_from_pk (sk, &keygrip);
-  if (err)
-    goto leave;
 
-  /* Convert the data to an S-expression.  */
+  *r_data = NULL;
   if (sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL
       || sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL_E)
     {
       if (!enc->data[0] || !enc->data[1])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(elg(a%m)(b%m)))",
+        err = gcry_sexp_build (r_data, NULL, "(enc-val(elg(a%m)(b%m)))",
                                enc->data[0], enc->data[1]);
     }
   else if (sk->pubkey_algo == PUBKEY_ALGO_RSA
@@ -177,7 +175,7 @@ get_it (PKT_pubkey_enc *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
       if (!enc->data[0])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(rsa(a%m)))",
+        err = gcry_sexp_build (r_data, NULL, "(enc-val(rsa(a%m)))",
                                enc->data[0]);
     }
   else if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
@@ -185,12 +183,227 @@ get_it (PKT_pubkey_enc *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
       if (!enc->data[0] || !enc->data[1])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(ecdh(s%m)(e%m)))",
+        err = gcry_sexp_build (r_data, NULL, "(enc-val(ecdh(s%m)(e%m)))",
                                enc->data[1], enc->data[0]);
     }
   else
     err = gpg_error (GPG_ERR_BUG);
 
+  return err;
+}
+
+
+/* Store at DIGEST the SHA-1 of the hex KEYGRIP and the ciphertext
+   S_DATA under which a prefetched frame is kept.  */
+static gpg_error_t
+frame_digest (const char *keygrip, gcry_sexp_t s_data, byte *digest)
+{
+  gpg_error_t err;
+  unsigned char *buf;
+  size_t len;
+  gcry_md_hd_t md;
+
+  err = make_canon_sexp (s_data, &buf, &len);
+  if (err)
+    return err;
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (!err)
+    {
+      gcry_md_write (md, keygrip, strlen (keygrip));
+      gcry_md_write (md, buf, len);
+      memcpy (digest, gcry_md_read (md, GCRY_MD_SHA1), 20);
+      gcry_md_close (md);
+    }
+  xfree (buf);
+  return err;
+}
+
+
+/* If the frame for the hex KEYGRIP and the ciphertext S_DATA has been
+   prefetched, remove it from the list and store a copy at R_FRAME and
+   its length at R_NFRAME.  Returns true in this case.  */
+static int
+take_prefetched_frame (const char *keygrip, gcry_sexp_t s_data,
+                       byte **r_frame, size_t *r_nframe)
+{
+  struct prefetched_frame_s *pf, **pfp;
+  byte digest[20];
+
+  if (!prefetched_frames || frame_digest (keygrip, s_data, digest))
+    return 0;
+  for (pfp = &prefetched_frames; (pf = *pfp); pfp = &pf->next)
+    if (!memcmp (pf->digest, digest, 20))
+      break;
+  if (!pf)
+    return 0;
+  *r_frame = xtrymalloc_secure (pf->nframe);
+  if (!*r_frame)
+    return 0;
+  memcpy (*r_frame, pf->frame, pf->nframe);
+  *r_nframe = pf->nframe;
+  *pfp = pf->next;
+  wipememory (pf->frame, pf->nframe);
+  xfree (pf);
+  return 1;
+}
+
+
+/* Decrypt the packets GROUP, all to the keyid GROUP[0]->keyid, with
+   one request to the agent and keep the frames.  */
+static void
+prefetch_for_key (ctrl_t ctrl, PKT_pubkey_enc **group, unsigned int ngroup)
+{
+  gpg_error_t err;
+  PKT_public_key *sk;
+  char *keygrip = NULL;
+  char *desc;
+  gcry_sexp_t s_data[MAX_PREFETCH];
+  byte *frames[MAX_PREFETCH];
+  size_t nframes[MAX_PREFETCH];
+  gpg_error_t errs[MAX_PREFETCH];
+  struct prefetched_frame_s *pf;
+  unsigned int i, n;
+
+  sk = xmalloc_clear (sizeof *sk);
+  sk->pubkey_algo = group[0]->pubkey_algo;
+  err = get_seckey (sk, group[0]->keyid);
+  if (!err)
+    err = hexkeygrip_from_pk (sk, &keygrip);
+  if (err)
+    goto leave;
+
+  for (i=n=0; i < ngroup; i++)
+    if (!build_enc_data (group[i], sk, &s_data[n]))
+      n++;
+  if (n < 2)
+    {
+      for (i=0; i < n; i++)
+        gcry_sexp_release (s_data[i]);
+      goto leave;
+    }
+
+  desc = gpg_format_keydesc (sk, FORMAT_KEYDESC_NORMAL, 1);
+  err = agent_pkdecrypt_batch (ctrl, keygrip, desc, sk->keyid, sk->main_keyid,
+                               sk->pubkey_algo, s_data, n,
+                               frames, nframes, errs);
+  xfree (desc);
+  if (err && opt.verbose)
+    log_info ("decrypting %u session keys in one go failed: %s\n",
+              n, gpg_strerror (err));
+
+  for (i=0; i < n; i++)
+    {
+      if (!err && !errs[i]
+          && (pf = xtrymalloc_secure (sizeof *pf + nframes[i])))
+        {
+          if (frame_digest (keygrip, s_data[i], pf->digest))
+            xfree (pf);
+          else
+            {
+              memcpy (pf->frame, frames[i], nframes[i]);
+              pf->nframe = nframes[i];
+              pf->next = prefetched_frames;
+              prefetched_frames = pf;
+            }
+        }
+      if (!err)
+        xfree (frames[i]);
+      gcry_sexp_release (s_data[i]);
+    }
+
+ leave:
+  xfree (keygrip);
+  free_public_key (sk);
+}
+
+
+/* Ask the agent for the session keys of the NENCS public key
+   encrypted packets ENCS ahead of their decryption, with one request
+   for all packets to the same secret key.  get_session_key then takes
+   the session keys from here.  This is used by --decrypt-files so
+   that each key is unprotected only once for many files.  Packets to
+   anonymous recipients are skipped.  */
+void
+prefetch_session_keys (ctrl_t ctrl, PKT_pubkey_enc **encs, unsigned int nencs)
+{
+  PKT_pubkey_enc *group[MAX_PREFETCH];
+  unsigned int ngroup;
+  char *done;
+  unsigned int i, k;
+
+  if (opt.try_all_secrets)
+    return;
+  done = xtrycalloc (nencs, 1);
+  if (!done)
+    return;
+
+  for (i=0; i < nencs; i++)
+    {
+      if (done[i])
+        continue;
+      done[i] = 1;
+      if (!(encs[i]->keyid[0] || encs[i]->keyid[1])
+          || openpgp_pk_test_algo2 (encs[i]->pubkey_algo, PUBKEY_USAGE_ENC))
+        continue;
+
+      group[0] = encs[i];
+      ngroup = 1;
+      for (k=i+1; k < nencs && ngroup < MAX_PREFETCH; k++)
+        if (!done[k]
+            && encs[k]->keyid[0] == encs[i]->keyid[0]
+            && encs[k]->keyid[1] == encs[i]->keyid[1]
+            && encs[k]->pubkey_algo == encs[i]->pubkey_algo)
+          {
+            group[ngroup++] = encs[k];
+            done[k] = 1;
+          }
+      if (ngroup > 1)
+        prefetch_for_key (ctrl, group, ngroup);
+    }
+  xfree (done);
+}
+
+
+/* Drop the session keys prefetch_session_keys kept.  */
+void
+release_prefetched_session_keys (void)
+{
+  struct prefetched_frame_s *pf;
+
+  while ((pf = prefetched_frames))
+    {
+      prefetched_frames = pf->next;
+      wipememory (pf->frame, pf->nframe);
+      xfree (pf);
+    }
+}
+
+
+static gpg_error_t
+get_it (PKT_pubkey_enc *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
+{
+  gpg_error_t err;
+  byte *frame = NULL;
+  unsigned int n;
+  size_t nframe;
+  u16 csum, csum2;
+  int padding;
+  gcry_sexp_t s_data;
+  char *desc;
+  char *keygrip;
+  byte fp[MAX_FINGERPRINT_LEN];
+  size_t fpn;
+
+  if (DBG_CLOCK)
+    log_clock ("decryption start");
+
+  /* Get the keygrip.  */
+  err = hexkeygrip_from_pk (sk, &keygrip);
+  if (err)
+    goto leave;
+
+  /* Convert the data to an S-expression.  */
+  err = build_enc_data (enc, sk, &s_data);
   if (err)
     goto leave;
 
@@ -201,11 +414,16 @@ get_it (PKT_pubkey_enc *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
     }
 
   /* Decrypt. */
-  desc = gpg_format_keydesc (sk, FORMAT_KEYDESC_NORMAL, 1);
-  err = agent_pkdecrypt (NULL, keygrip,
-                         desc, sk->keyid, sk->main_keyid, sk->pubkey_algo,
-                         s_data, &frame, &nframe, &padding);
-  xfree (desc);
+  if (take_prefetched_frame (keygrip, s_data, &frame, &nframe))
+    padding = -1;
+  else
+    {
+      desc = gpg_format_keydesc (sk, FORMAT_KEYDESC_NORMAL, 1);
+      err = agent_pkdecrypt (NULL, keygrip,
+                             desc, sk->keyid, sk->main_keyid, sk->pubkey_algo,
+                             s_data, &frame, &nframe, &padding);
+      xfree (desc);
+    }
   gcry_sexp_release (s_data);
   if (err)
     goto leave;
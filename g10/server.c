@@ -34,6 +34,9 @@
 #include "options.h"
 #include "../common/sysutils.h"
 #include "status.h"
+#include "iobuf.h"
+#include "keydb.h"
+#include "main.h"
 
 
 #define set_error(e,t) assuan_set_error (ctx, gpg_error (e), (t))
@@ -50,6 +53,13 @@ struct server_local_s
   /* List of prepared recipients.  */
   pk_list_t recplist;
 
+  /* List of signers as given to the SIGNER commands.  */
+  strlist_t signerlist;
+
+  /* The status line currently being passed to the client.  */
+  char statusline[ASSUAN_LINELENGTH];
+  size_t statuslen;
+
   /* Set if pinentry notifications should be passed back to the
      client. */
   int allow_pinentry_notify;
@@ -57,6 +67,19 @@ struct server_local_s
 
 
 
+/* Cookie for the stream which passes our status lines to the client.  */
+static ssize_t status_cookie_write (void *cookie,
+                                    const void *buffer, size_t size);
+static es_cookie_io_functions_t status_cookie_functions =
+  {
+    NULL,
+    status_cookie_write,
+    NULL,
+    NULL
+  };
+
+
+
 /* Helper to close the message fd if it is open. */
 static void
 close_message_fd (ctrl_t ctrl)
@@ -103,6 +126,50 @@ has_option (const char *line, const char *name)
 
 
 
+/* Send the status line collected in the server state of CTRL to the
+   client.  The "[GNUPG:] " prefix used for the status fd is removed.  */
+static void
+send_status_line (ctrl_t ctrl)
+{
+  struct server_local_s *sl = ctrl->server_local;
+  char *keyword, *args;
+
+  sl->statusline[sl->statuslen] = 0;
+  sl->statuslen = 0;
+  keyword = sl->statusline;
+  if (!strncmp (keyword, "[GNUPG:] ", 9))
+    keyword += 9;
+  args = strchr (keyword, ' ');
+  if (args)
+    *args++ = 0;
+  if (*keyword)
+    assuan_write_status (sl->assuan_ctx, keyword, args? args : "");
+}
+
+
+/* Write function for the status stream.  The status functions write
+   a line in several pieces; thus the line is collected until its LF
+   has been seen.  */
+static ssize_t
+status_cookie_write (void *cookie, const void *buffer, size_t size)
+{
+  ctrl_t ctrl = cookie;
+  struct server_local_s *sl = ctrl->server_local;
+  const char *p = buffer;
+  size_t n;
+
+  for (n=0; n < size; n++)
+    {
+      if (p[n] == '\n')
+        send_status_line (ctrl);
+      else if (sl->statuslen < sizeof sl->statusline - 1)
+        sl->statusline[sl->statuslen++] = p[n];
+    }
+  return size;
+}
+
+
+
 /* Called by libassuan for Assuan options.  See the Assuan manual for
    details. */
 static gpg_error_t
@@ -159,6 +226,8 @@ reset_notify (assuan_context_t ctx, char *line)
 
   release_pk_list (ctrl->server_local->recplist);
   ctrl->server_local->recplist = NULL;
+  free_strlist (ctrl->server_local->signerlist);
+  ctrl->server_local->signerlist = NULL;
 
   close_message_fd (ctrl);
   assuan_close_input_fd (ctx);
@@ -265,9 +334,27 @@ cmd_recipient (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_signer (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  strlist_t sl = NULL;
+  SK_LIST sk_list = NULL;
+
+  line = skip_options (line);
+  if (!*line)
+    return set_error (GPG_ERR_ASS_PARAMETER, "no user ID given");
+
+  /* Check the key now so that the client learns about an unusable
+     key right here and not only with the SIGN command.  */
+  add_to_strlist (&sl, line);
+  err = build_sk_list (sl, &sk_list, PUBKEY_USAGE_SIG);
+  release_sk_list (sk_list);
+  free_strlist (sl);
+  if (!err)
+    append_to_strlist (&ctrl->server_local->signerlist, line);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "SIGNER", gpg_strerror (err));
+  return err;
 }
 
 
@@ -433,9 +520,6 @@ cmd_verify (assuan_context_t ctx, char *line)
         return set_error (gpg_err_code_from_syserror (), "fdopen() failed");
     }
 
-  log_debug ("WARNING: The server mode is WORK "
-             "IN PROGRESS and not ready for use\n");
-
   rc = gpg_verify (ctrl, fd, ctrl->server_local->message_fd, out_fp);
 
   es_fclose (out_fp);
@@ -459,9 +543,32 @@ cmd_verify (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_sign (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int inp_fd, out_fd;
+  int detached;
+
+  detached = has_option (line, "--detached");
+
+  inp_fd = translate_sys2libc_fd (assuan_get_input_fd (ctx), 0);
+  if (inp_fd == -1)
+    return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+  out_fd = translate_sys2libc_fd (assuan_get_output_fd (ctx), 1);
+  if (out_fd == -1)
+    return set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+
+  /* Without a SIGNER command the default key is used.  */
+  err = sign_file (ctrl, NULL, detached, ctrl->server_local->signerlist,
+                   0, NULL, NULL, inp_fd, out_fd);
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "SIGN", gpg_strerror (err));
+  return err;
 }
 
 
@@ -473,9 +580,39 @@ cmd_sign (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_import (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int inp_fd;
+  iobuf_t inp;
+  void *stats;
+
+  (void)line; /* LINE is not used.  */
+
+  inp_fd = translate_sys2libc_fd (assuan_get_input_fd (ctx), 0);
+  if (inp_fd == -1)
+    return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+
+  inp = iobuf_fdopen_nc (inp_fd, "rb");
+  if (!inp)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      stats = import_new_stats_handle ();
+      err = import_keys_stream (ctrl, inp, stats, NULL, NULL,
+                                opt.import_options);
+      import_print_stats (stats);
+      import_release_stats_handle (stats);
+      iobuf_close (inp);
+    }
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "IMPORT", gpg_strerror (err));
+  return err;
 }
 
 
@@ -687,6 +824,7 @@ gpg_server (ctrl_t ctrl)
   int filedes[2];
 #endif
   assuan_context_t ctx = NULL;
+  estream_t statusfp;
   static const char hello[] = ("GNU Privacy Guard's OpenPGP server "
                                VERSION " ready");
 
@@ -757,6 +895,15 @@ gpg_server (ctrl_t ctrl)
   ctrl->server_local->assuan_ctx = ctx;
   ctrl->server_local->message_fd = GNUPG_INVALID_FD;
 
+  /* The client gets our status lines as Assuan status lines.  */
+  statusfp = es_fopencookie (ctrl, "w", status_cookie_functions);
+  if (!statusfp)
+    {
+      rc = gpg_error_from_syserror ();
+      goto leave;
+    }
+  set_status_stream (statusfp);
+
   for (;;)
     {
       rc = assuan_accept (ctx);
@@ -780,9 +927,11 @@ gpg_server (ctrl_t ctrl)
     }
 
  leave:
+  set_status_stream (NULL);
   if (ctrl->server_local)
     {
       release_pk_list (ctrl->server_local->recplist);
+      free_strlist (ctrl->server_local->signerlist);
 
       xfree (ctrl->server_local);
       ctrl->server_local = NULL;
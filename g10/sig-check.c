@@ -258,28 +258,14 @@ do_check_messages( PKT_public_key *pk, PKT_signature *sig,
 }
 
 
-static int
-do_check( PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
-	  int *r_expired, int *r_revoked, PKT_public_key *ret_pk )
+/* Hash the trailer of SIG into DIGEST and finalize it.  */
+static void
+complete_sig_digest (PKT_signature *sig, gcry_md_hd_t digest)
 {
-    gcry_mpi_t result = NULL;
-    int rc = 0;
-
-    if( (rc=do_check_messages(pk,sig,r_expired,r_revoked)) )
-        return rc;
-
-    if (sig->digest_algo == GCRY_MD_MD5
-        && !opt.flags.allow_weak_digest_algos)
-      {
-        print_md5_rejected_note ();
-        return GPG_ERR_DIGEST_ALGO;
-      }
-
     /* Make sure the digest algo is enabled (in case of a detached
        signature).  */
     gcry_md_enable (digest, sig->digest_algo);
 
-    /* Complete the digest. */
     if( sig->version >= 4 )
 	gcry_md_putc( digest, sig->version );
     gcry_md_putc( digest, sig->sig_class );
@@ -319,6 +305,27 @@ do_check( PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
 	gcry_md_write( digest, buf, 6 );
     }
     gcry_md_final( digest );
+}
+
+
+static int
+do_check( PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
+	  int *r_expired, int *r_revoked, PKT_public_key *ret_pk )
+{
+    gcry_mpi_t result = NULL;
+    int rc = 0;
+
+    if( (rc=do_check_messages(pk,sig,r_expired,r_revoked)) )
+        return rc;
+
+    if (sig->digest_algo == GCRY_MD_MD5
+        && !opt.flags.allow_weak_digest_algos)
+      {
+        print_md5_rejected_note ();
+        return GPG_ERR_DIGEST_ALGO;
+      }
+
+    complete_sig_digest (sig, digest);
 
     result = encode_md_value (pk, digest, sig->digest_algo );
     if (!result)
@@ -373,7 +380,7 @@ hash_uid_node( KBNODE unode, gcry_md_hd_t md, PKT_signature *sig )
     }
 }
 
-static void
+void
 cache_sig_result ( PKT_signature *sig, int result )
 {
     if ( !result ) {
@@ -670,3 +677,96 @@ check_key_signature2( KBNODE root, KBNODE node, PKT_public_key *check_pk,
 
     return rc;
 }
+
+
+/* Return true if encode_md_value can encode a digest of HASH_ALGO
+   for PK.  This does the checks of encode_md_value but without
+   printing an error.  */
+static int
+digest_fits_key (PKT_public_key *pk, int hash_algo)
+{
+  size_t qbits;
+
+  if (pk->pubkey_algo != PUBKEY_ALGO_DSA
+      && pk->pubkey_algo != PUBKEY_ALGO_ECDSA)
+    return 1;
+
+  qbits = gcry_mpi_get_nbits (pk->pkey[1]);
+  if (pk->pubkey_algo == PUBKEY_ALGO_ECDSA)
+    qbits = ecdsa_qbits_from_Q (qbits);
+  if ((qbits%8) || qbits < 160)
+    return 0;
+  if (pk->pubkey_algo == PUBKEY_ALGO_ECDSA && qbits > 512)
+    qbits = 512;
+  return gcry_md_get_algo_dlen (hash_algo) >= qbits/8;
+}
+
+
+/* Prepare the check of the self-signature NODE of ROOT to be done
+   elsewhere.  If check_key_signature would verify NODE with the
+   primary key of ROOT and without printing anything, the hash value
+   to verify the signature with is returned; the caller shall then
+   pass the result of pk_verify to cache_sig_result.  NULL is
+   returned for all other signatures, which includes those already
+   having a cached result.  */
+gcry_mpi_t
+key_signature_hash (KBNODE root, KBNODE node)
+{
+  PKT_public_key *pk;
+  PKT_signature *sig;
+  KBNODE snode = NULL;
+  KBNODE unode = NULL;
+  gcry_md_hd_t md;
+  gcry_mpi_t result;
+  u32 keyid[2];
+
+  assert (node->pkt->pkttype == PKT_SIGNATURE);
+  assert (root->pkt->pkttype == PKT_PUBLIC_KEY);
+
+  pk = root->pkt->pkt.public_key;
+  sig = node->pkt->pkt.signature;
+
+  if (opt.no_sig_cache || sig->flags.checked)
+    return NULL;
+  keyid_from_pk (pk, keyid);
+  if (keyid[0] != sig->keyid[0] || keyid[1] != sig->keyid[1])
+    return NULL;
+  if (openpgp_pk_test_algo (sig->pubkey_algo)
+      || openpgp_md_test_algo (sig->digest_algo))
+    return NULL;
+
+  /* Leave everything which do_check reports to the regular check.  */
+  if (pk->timestamp > sig->timestamp
+      || pk->timestamp > make_timestamp ()
+      || (sig->digest_algo == GCRY_MD_MD5
+          && !opt.flags.allow_weak_digest_algos)
+      || sig->flags.unknown_critical
+      || !digest_fits_key (pk, sig->digest_algo))
+    return NULL;
+
+  if (sig->sig_class == 0x18 || sig->sig_class == 0x28)
+    {
+      snode = find_prev_kbnode (root, node, PKT_PUBLIC_SUBKEY);
+      if (!snode)
+        return NULL;
+    }
+  else if (sig->sig_class != 0x20 && sig->sig_class != 0x1f)
+    {
+      unode = find_prev_kbnode (root, node, PKT_USER_ID);
+      if (!unode)
+        return NULL;
+    }
+
+  if (gcry_md_open (&md, sig->digest_algo, 0))
+    BUG ();
+  hash_public_key (md, pk);
+  if (snode)
+    hash_public_key (md, snode->pkt->pkt.public_key);
+  if (unode)
+    hash_uid_node (unode, md, sig);
+  complete_sig_digest (sig, md);
+  result = encode_md_value (pk, md, sig->digest_algo);
+  gcry_md_close (md);
+
+  return result;
+}
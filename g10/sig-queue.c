@@ -0,0 +1,382 @@
+/* sig-queue.c - Check self-signatures on a pool of threads
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Importing many keys spends most of its time in the public key
+   operations of the self-signature checks.  These operations do not
+   depend on each other; a queue collects them from one or more
+   keyblocks and runs them on a pool of threads.  Everything else,
+   that is selecting the signatures, hashing the signed data and
+   storing the results with cache_sig_result, is done by the main
+   thread in keyblock order.  check_key_signature then finds the
+   cached results; thus, apart from being faster, checking the
+   signatures in turn has the same effect as before.
+
+   gpg is not a threaded program.  The workers, a work pool shared
+   with the parallel keybox scans and the hashing of data files, are
+   only started when first needed and they run nothing but the
+   computations handed to them, without holding the npth lock.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <npth.h>
+
+#include "gpg.h"
+#include "util.h"
+#include "packet.h"
+#include "options.h"
+#include "main.h"
+#include "pkglue.h"
+#include "workpool.h"
+
+
+/* The largest number of threads we use.  */
+#define MAX_SIG_THREADS 64
+
+/* The smallest number of tasks worth handing to the workers.  */
+#define MIN_PARALLEL_TASKS 2
+
+/* One public key operation.  */
+struct sig_task
+{
+  PKT_public_key *pk;
+  PKT_signature *sig;
+  gcry_mpi_t hash;
+  int rc;
+};
+
+struct sig_queue_s
+{
+  unsigned int ntasks;
+  unsigned int size;
+  struct sig_task *tasks;
+};
+
+
+/* The pool of workers shared by all parallel work of gpg.  */
+static workpool_t workers;
+
+/* We tried to start the workers.  */
+static int workers_started;
+
+
+
+/* Initialize npth unless this has already been done by another user
+   of threads.  Returns 0 on success or an errno value.  */
+int
+gpg_npth_init (void)
+{
+  static int done;
+  static int rc;
+
+  if (!done)
+    {
+      done = 1;
+      rc = npth_init ();
+    }
+  return rc;
+}
+
+
+/* Return the number of threads to use for checking signatures.  */
+int
+sig_queue_threads (void)
+{
+  long n;
+
+  n = opt.sig_check_threads;
+  if (n < 1)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      n = sysconf (_SC_NPROCESSORS_ONLN);
+#else
+      n = 1;
+#endif
+    }
+  if (n < 1)
+    n = 1;
+  else if (n > MAX_SIG_THREADS)
+    n = MAX_SIG_THREADS;
+  return (int)n;
+}
+
+
+/* Return the pool of workers, which is started on the first call,
+   or NULL if we have no threads.  The pool is grown to NTHREADS - 1
+   workers; the main thread does its share of the work.  The workers
+   are used for the signature checks, the parallel scans of the
+   keybox, the hashing of data files, the parallel compression and
+   the cipher pipeline.  */
+workpool_t
+gpg_get_workers (int nthreads)
+{
+  gpg_error_t err;
+  int n, rc;
+
+  n = nthreads - 1;
+  if (workers_started)
+    {
+      if (workers && n > 0)
+        workpool_grow (workers, n);
+      return workers;
+    }
+  if (n < 1)
+    return NULL;
+  workers_started = 1;
+
+  rc = gpg_npth_init ();
+  if (rc)
+    {
+      log_error ("error initializing npth: %s\n", strerror (rc));
+      return NULL;
+    }
+  err = workpool_new (&workers, "gpg-worker", n, 0);
+  if (err)
+    {
+      log_error ("error starting the worker threads: %s\n",
+                 gpg_strerror (err));
+      return NULL;
+    }
+  if (!workpool_threads (workers))
+    {
+      workpool_release (workers);
+      workers = NULL;
+      return NULL;
+    }
+
+  if (DBG_MEMSTAT)
+    log_debug ("started %u worker threads\n", workpool_threads (workers));
+  return workers;
+}
+
+
+/* Create a group of tasks for the workers at R_GROUP.  Returns false
+   if the work shall be done by the main thread alone.  */
+static int
+new_work_group (workpool_group_t *r_group)
+{
+  workpool_t pool = gpg_get_workers (sig_queue_threads ());
+
+  *r_group = NULL;
+  return pool && !workpool_group_new (pool, r_group);
+}
+
+
+/* Run the signature check ARG.  Called without the npth lock.  */
+static void
+verify_task (void *arg)
+{
+  struct sig_task *task = arg;
+
+  task->rc = pk_verify (task->pk->pubkey_algo, task->hash,
+                        task->sig->data, task->pk->pkey);
+}
+
+
+
+sig_queue_t
+sig_queue_new (void)
+{
+  return xmalloc_clear (sizeof (struct sig_queue_s));
+}
+
+
+static void
+release_tasks (sig_queue_t queue)
+{
+  unsigned int i;
+
+  for (i=0; i < queue->ntasks; i++)
+    gcry_mpi_release (queue->tasks[i].hash);
+  queue->ntasks = 0;
+}
+
+
+void
+sig_queue_release (sig_queue_t queue)
+{
+  if (!queue)
+    return;
+  release_tasks (queue);
+  xfree (queue->tasks);
+  xfree (queue);
+}
+
+
+/* Queue the checks of those self-signatures of KEYBLOCK which would
+   be verified with its primary key.  KEYBLOCK must not be changed or
+   released before the queue has been run.  */
+void
+sig_queue_add_keyblock (sig_queue_t queue, kbnode_t keyblock)
+{
+  kbnode_t node;
+  gcry_mpi_t hash;
+
+  if (opt.no_sig_cache || keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return;
+
+  for (node=keyblock->next; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      hash = key_signature_hash (keyblock, node);
+      if (!hash)
+        continue;
+
+      if (queue->ntasks == queue->size)
+        {
+          queue->size = queue->size? 2 * queue->size : 64;
+          queue->tasks = xrealloc (queue->tasks,
+                                   queue->size * sizeof *queue->tasks);
+        }
+      queue->tasks[queue->ntasks].pk = keyblock->pkt->pkt.public_key;
+      queue->tasks[queue->ntasks].sig = node->pkt->pkt.signature;
+      queue->tasks[queue->ntasks].hash = hash;
+      queue->tasks[queue->ntasks].rc = 0;
+      queue->ntasks++;
+    }
+}
+
+
+/* Run all tasks of QUEUE and store their results in the order they
+   were queued.  The queue is empty afterwards.  */
+void
+sig_queue_run (sig_queue_t queue)
+{
+  workpool_group_t group;
+  unsigned int i;
+
+  if (queue->ntasks < MIN_PARALLEL_TASKS || !new_work_group (&group))
+    {
+      for (i=0; i < queue->ntasks; i++)
+        verify_task (queue->tasks + i);
+    }
+  else
+    {
+      for (i=0; i < queue->ntasks; i++)
+        workpool_submit (group, WORKPOOL_PRIO_NORMAL,
+                         verify_task, queue->tasks + i);
+      workpool_group_release (group);
+    }
+
+  for (i=0; i < queue->ntasks; i++)
+    cache_sig_result (queue->tasks[i].sig, queue->tasks[i].rc);
+  release_tasks (queue);
+}
+
+
+
+/* One call of the function given to gpg_run_parallel.  */
+struct parallel_call_s
+{
+  void (*fnc) (void *arg, unsigned int idx);
+  void *arg;
+  unsigned int idx;
+};
+
+
+static void
+parallel_call_task (void *arg)
+{
+  struct parallel_call_s *call = arg;
+
+  call->fnc (call->arg, call->idx);
+}
+
+
+/* Call FNC (ARG, IDX) for each IDX below N on the workers and return
+   after the last call.  FNC is run without the npth lock and thus
+   may not use anything but memory it owns.  This is the hook for the
+   parallel scans of the keybox.  */
+void
+gpg_run_parallel (void (*fnc) (void *arg, unsigned int idx), void *arg,
+                  unsigned int n)
+{
+  struct parallel_call_s *calls = NULL;
+  workpool_group_t group;
+  unsigned int i;
+
+  if (n > 1 && new_work_group (&group))
+    {
+      calls = xtrycalloc (n, sizeof *calls);
+      if (!calls)
+        workpool_group_release (group);
+    }
+  if (!calls)
+    {
+      for (i=0; i < n; i++)
+        fnc (arg, i);
+      return;
+    }
+
+  for (i=0; i < n; i++)
+    {
+      calls[i].fnc = fnc;
+      calls[i].arg = arg;
+      calls[i].idx = i;
+      workpool_submit (group, WORKPOOL_PRIO_NORMAL,
+                       parallel_call_task, calls + i);
+    }
+  workpool_group_release (group);
+  xfree (calls);
+}
+
+
+
+/* Hash the data file ARG.  Called without the npth lock.  */
+static void
+datafile_hash_task (void *arg)
+{
+  hash_datafile_job (arg);
+}
+
+
+/* Hash the opened files of JOBS[0..NJOBS-1] on the workers unless
+   NTHREADS is less than 2; jobs without a file are skipped.  The
+   files must have been opened by the main thread and must not have
+   filters which are not safe to run without the npth lock.  The main
+   thread takes its share of the files and everything is hashed by it
+   alone if no threads can be used.  */
+void
+hash_datafiles_parallel (struct datafile_hash_s *jobs, int njobs,
+                         int nthreads)
+{
+  workpool_group_t group;
+  int i;
+
+  /* The filter statistics are not kept per thread.  */
+  if (iobuf_stats_enabled ())
+    nthreads = 1;
+
+  if (nthreads < 2 || njobs < 2 || !new_work_group (&group))
+    {
+      for (i=0; i < njobs; i++)
+        if (jobs[i].inp)
+          hash_datafile_job (&jobs[i]);
+      return;
+    }
+
+  for (i=0; i < njobs; i++)
+    if (jobs[i].inp)
+      workpool_submit (group, WORKPOOL_PRIO_NORMAL,
+                       datafile_hash_task, &jobs[i]);
+  workpool_group_release (group);
+}
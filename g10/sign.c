@@ -222,16 +222,14 @@ hash_sigversion_to_magic (gcry_md_hd_t md, const PKT_signature *sig)
 }
 
 
-/* Perform the sign operation.  If CACHE_NONCE is given the agent is
-   advised to use that cached passphrase fro the key.  */
+/* Check that PKSK may make the signature SIG over the finalized MD
+   with MDALGO and fill in the digest fields of SIG.  This is the
+   first part of a sign operation.  */
 static int
-do_sign (PKT_public_key *pksk, PKT_signature *sig,
-	 gcry_md_hd_t md, int mdalgo, const char *cache_nonce)
+begin_sign (PKT_public_key *pksk, PKT_signature *sig,
+            gcry_md_hd_t md, int mdalgo)
 {
-  gpg_error_t err;
-  gcry_mpi_t frame;
   byte *dp;
-  char *hexgrip;
 
   if (pksk->timestamp > sig->timestamp )
     {
@@ -257,40 +255,38 @@ do_sign (PKT_public_key *pksk, PKT_signature *sig,
   sig->digest_start[1] = dp[1];
   sig->data[0] = NULL;
   sig->data[1] = NULL;
+  return 0;
+}
 
 
-  err = hexkeygrip_from_pk (pksk, &hexgrip);
-  if (!err)
+/* Store the signature S_SIGVAL returned by the agent for PKSK in
+   SIG.  */
+static void
+sigval_to_sig (PKT_public_key *pksk, PKT_signature *sig, gcry_sexp_t s_sigval)
+{
+  if (pksk->pubkey_algo == GCRY_PK_RSA
+      || pksk->pubkey_algo == GCRY_PK_RSA_S)
+    sig->data[0] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
+  else if (openpgp_oid_is_ed25519 (pksk->pkey[0]))
     {
-      char *desc;
-      gcry_sexp_t s_sigval;
-
-      desc = gpg_format_keydesc (pksk, FORMAT_KEYDESC_NORMAL, 1);
-      err = agent_pksign (NULL/*ctrl*/, cache_nonce, hexgrip, desc,
-                          pksk->keyid, pksk->main_keyid, pksk->pubkey_algo,
-                          dp, gcry_md_get_algo_dlen (mdalgo), mdalgo,
-                          &s_sigval);
-      xfree (desc);
+      sig->data[0] = get_mpi_from_sexp (s_sigval, "r", GCRYMPI_FMT_OPAQUE);
+      sig->data[1] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_OPAQUE);
+    }
+  else
+    {
+      sig->data[0] = get_mpi_from_sexp (s_sigval, "r", GCRYMPI_FMT_USG);
+      sig->data[1] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
+    }
+}
 
-      if (err)
-        ;
-      else if (pksk->pubkey_algo == GCRY_PK_RSA
-               || pksk->pubkey_algo == GCRY_PK_RSA_S)
-        sig->data[0] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
-      else if (openpgp_oid_is_ed25519 (pksk->pkey[0]))
-        {
-          sig->data[0] = get_mpi_from_sexp (s_sigval, "r", GCRYMPI_FMT_OPAQUE);
-          sig->data[1] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_OPAQUE);
-        }
-      else
-        {
-          sig->data[0] = get_mpi_from_sexp (s_sigval, "r", GCRYMPI_FMT_USG);
-          sig->data[1] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
-        }
 
-      gcry_sexp_release (s_sigval);
-    }
-  xfree (hexgrip);
+/* Finish the sign operation of PKSK for SIG over MD which ended
+   with ERR.  */
+static int
+end_sign (PKT_public_key *pksk, PKT_signature *sig, gcry_md_hd_t md,
+          gpg_error_t err)
+{
+  gcry_mpi_t frame;
 
   /* Check that the signature verification worked and nothing is
    * fooling us e.g. by a bug in the signature create code or by
@@ -334,6 +330,46 @@ do_sign (PKT_public_key *pksk, PKT_signature *sig,
 }
 
 
+/* Perform the sign operation.  If CACHE_NONCE is given the agent is
+   advised to use that cached passphrase fro the key.  */
+static int
+do_sign (PKT_public_key *pksk, PKT_signature *sig,
+	 gcry_md_hd_t md, int mdalgo, const char *cache_nonce)
+{
+  gpg_error_t err;
+  byte *dp;
+  char *hexgrip;
+
+  err = begin_sign (pksk, sig, md, mdalgo);
+  if (err)
+    return err;
+  mdalgo = sig->digest_algo;
+  dp = gcry_md_read (md, mdalgo);
+
+  err = hexkeygrip_from_pk (pksk, &hexgrip);
+  if (!err)
+    {
+      char *desc;
+      gcry_sexp_t s_sigval;
+
+      desc = gpg_format_keydesc (pksk, FORMAT_KEYDESC_NORMAL, 1);
+      err = agent_pksign (NULL/*ctrl*/, cache_nonce, hexgrip, desc,
+                          pksk->keyid, pksk->main_keyid, pksk->pubkey_algo,
+                          dp, gcry_md_get_algo_dlen (mdalgo), mdalgo,
+                          &s_sigval);
+      xfree (desc);
+
+      if (!err)
+        sigval_to_sig (pksk, sig, s_sigval);
+
+      gcry_sexp_release (s_sigval);
+    }
+  xfree (hexgrip);
+
+  return end_sign (pksk, sig, md, err);
+}
+
+
 int
 complete_sig (PKT_signature *sig, PKT_public_key *pksk, gcry_md_hd_t md,
               const char *cache_nonce)
@@ -657,6 +693,76 @@ write_plaintext_packet (IOBUF out, IOBUF inp, const char *fname, int ptmode)
     return rc;
 }
 
+/*
+ * Build the signature packet of class SIGCLASS for PK over the data
+ * hashed into HASH and store a finalized copy of HASH which covers
+ * the packet at R_MD.  TIMESTAMP and DURATION are used as with
+ * write_signature_packets.
+ */
+static PKT_signature *
+build_data_sig (PKT_public_key *pk, gcry_md_hd_t hash, int sigclass,
+                u32 timestamp, u32 duration, gcry_md_hd_t *r_md)
+{
+  PKT_signature *sig;
+  gcry_md_hd_t md;
+
+  sig = xmalloc_clear (sizeof *sig);
+  if (duration || opt.sig_policy_url
+      || opt.sig_notations || opt.sig_keyserver_url)
+    sig->version = 4;
+  else
+    sig->version = pk->version;
+
+  keyid_from_pk (pk, sig->keyid);
+  sig->digest_algo = hash_for (pk);
+  sig->pubkey_algo = pk->pubkey_algo;
+  if (timestamp)
+    sig->timestamp = timestamp;
+  else
+    sig->timestamp = make_timestamp();
+  if (duration)
+    sig->expiredate = sig->timestamp + duration;
+  sig->sig_class = sigclass;
+
+  if (gcry_md_copy (&md, hash))
+    BUG ();
+
+  if (sig->version >= 4)
+    {
+      build_sig_subpkt_from_sig (sig);
+      mk_notation_policy_etc (sig, NULL, pk);
+    }
+
+  hash_sigversion_to_magic (md, sig);
+  gcry_md_final (md);
+  *r_md = md;
+  return sig;
+}
+
+
+/*
+ * Write the signature SIG made by PK to OUT.
+ */
+static int
+write_sig_packet (PKT_public_key *pk, PKT_signature *sig, IOBUF out,
+                  int status_letter)
+{
+  PACKET pkt;
+  int rc;
+
+  init_packet (&pkt);
+  pkt.pkttype = PKT_SIGNATURE;
+  pkt.pkt.signature = sig;
+  rc = build_packet (out, &pkt);
+  if (!rc && is_status_enabled())
+    print_status_sig_created (pk, sig, status_letter);
+  free_packet (&pkt);
+  if (rc)
+    log_error ("build signature packet failed: %s\n", gpg_strerror (rc));
+  return rc;
+}
+
+
 /*
  * Write the signatures from the SK_LIST to OUT. HASH must be a non-finalized
  * hash which will not be changes here.
@@ -679,53 +785,14 @@ write_signature_packets (SK_LIST sk_list, IOBUF out, gcry_md_hd_t hash,
       pk = sk_rover->pk;
 
       /* Build the signature packet.  */
-      sig = xmalloc_clear (sizeof *sig);
-      if (duration || opt.sig_policy_url
-          || opt.sig_notations || opt.sig_keyserver_url)
-        sig->version = 4;
-      else
-        sig->version = pk->version;
-
-      keyid_from_pk (pk, sig->keyid);
-      sig->digest_algo = hash_for (pk);
-      sig->pubkey_algo = pk->pubkey_algo;
-      if (timestamp)
-        sig->timestamp = timestamp;
-      else
-        sig->timestamp = make_timestamp();
-      if (duration)
-        sig->expiredate = sig->timestamp + duration;
-      sig->sig_class = sigclass;
-
-      if (gcry_md_copy (&md, hash))
-        BUG ();
-
-      if (sig->version >= 4)
-        {
-          build_sig_subpkt_from_sig (sig);
-          mk_notation_policy_etc (sig, NULL, pk);
-        }
-
-      hash_sigversion_to_magic (md, sig);
-      gcry_md_final (md);
+      sig = build_data_sig (pk, hash, sigclass, timestamp, duration, &md);
 
       rc = do_sign (pk, sig, md, hash_for (pk), cache_nonce);
       gcry_md_close (md);
       if (!rc)
-        {
-          /* Write the packet.  */
-          PACKET pkt;
-
-          init_packet (&pkt);
-          pkt.pkttype = PKT_SIGNATURE;
-          pkt.pkt.signature = sig;
-          rc = build_packet (out, &pkt);
-          if (!rc && is_status_enabled())
-            print_status_sig_created (pk, sig, status_letter);
-          free_packet (&pkt);
-          if (rc)
-            log_error ("build signature packet failed: %s\n", gpg_strerror (rc));
-	}
+        rc = write_sig_packet (pk, sig, out, status_letter);
+      else
+        free_seckey_enc (sig);
       if (rc)
         return rc;
     }
@@ -745,10 +812,15 @@ write_signature_packets (SK_LIST sk_list, IOBUF out, gcry_md_hd_t hash,
  * If OUTFILE is not NULL; this file is used for output and the function
  * does not ask for overwrite permission; output is then always
  * uncompressed, non-armored and in binary mode.
+ * If FILEFD is not -1 the data is read from that file descriptor
+ * instead of a file; FILENAMES must then be NULL.  If OUTPUTFD is
+ * not -1 and OUTFILE is NULL the output is written to that file
+ * descriptor.  Neither descriptor is closed.
  */
 int
 sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
-	   int encryptflag, strlist_t remusr, const char *outfile )
+	   int encryptflag, strlist_t remusr, const char *outfile,
+           int filefd, int outputfd)
 {
     const char *fname;
     armor_filter_context_t *afx;
@@ -783,6 +855,12 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
     if( fname && filenames->next && (!detached || encryptflag) )
 	log_bug("multiple files can only be detached signed");
 
+    if (filefd != -1 && fname)
+      {
+        rc = gpg_error (GPG_ERR_INV_ARG);  /* Both given.  */
+        goto leave;
+      }
+
     if(encryptflag==2
        && (rc=setup_symkey(&efx.symkey_s2k,&efx.symkey_dek)))
       goto leave;
@@ -805,7 +883,10 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
     if( multifile )  /* have list of filenames */
 	inp = NULL; /* we do it later */
     else {
-      inp = iobuf_open(fname);
+      if (filefd != -1)
+        inp = iobuf_open_fd_or_name (filefd, NULL, "rb");
+      else
+        inp = iobuf_open_mmap(fname);
       if (inp && is_secured_file (iobuf_get_fd (inp)))
         {
           iobuf_close (inp);
@@ -839,7 +920,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	else if( opt.verbose )
 	    log_info(_("writing to '%s'\n"), outfile );
     }
-    else if( (rc = open_outfile (-1, fname,
+    else if( (rc = open_outfile (outputfd, fname,
                                  opt.armor? 1: detached? 2:0, 0, &out)))
 	goto leave;
 
@@ -1005,7 +1086,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	    /* must walk reverse trough this list */
 	    for( sl = strlist_last(filenames); sl;
 			sl = strlist_prev( filenames, sl ) ) {
-                inp = iobuf_open(sl->d);
+                inp = iobuf_open_mmap(sl->d);
                 if (inp && is_secured_file (iobuf_get_fd (inp)))
                   {
                     iobuf_close (inp);
@@ -1028,8 +1109,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 		    iobuf_push_filter( inp, text_filter, &tfx );
 		  }
 		iobuf_push_filter( inp, md_filter, &mfx );
-		while( iobuf_get(inp) != -1 )
-		    ;
+		iobuf_skip_rest (inp, 0, 1);
 		iobuf_close(inp); inp = NULL;
 	    }
 	    if( opt.verbose )
@@ -1037,8 +1117,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	}
 	else {
 	    /* read, so that the filter can calculate the digest */
-	    while( iobuf_get(inp) != -1 )
-		;
+	    iobuf_skip_rest (inp, 0, 1);
 	}
     }
     else {
@@ -1078,6 +1157,369 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 
 
 
+/* The number of files hashed before their signatures are requested
+   from the agent with one command.  */
+#define SIGN_FILES_BATCH 64
+
+/* Information about one file of sign_files.  */
+struct sign_files_item_s
+{
+  char *fname;           /* The name of the file.  */
+  IOBUF inp;             /* The file while it is being hashed.  */
+  text_filter_context_t tfx;
+  gcry_md_hd_t hash;     /* The hash over the file or NULL on error.  */
+  PKT_signature **sigs;  /* The signatures, one for each key.  */
+};
+
+
+/* Ask the agent for the signatures with PK over the N DIGESTS of
+   algorithm MDALGO and store them at SIGVALS.  All signatures are
+   requested with one command so that the agent needs to unprotect the
+   key only once; an agent without that command is asked for one
+   signature after the other.  */
+static gpg_error_t
+pksign_digests (PKT_public_key *pk, unsigned char **digests, int mdalgo,
+                int n, gcry_sexp_t *sigvals)
+{
+  gpg_error_t err;
+  char *hexgrip, *desc;
+  int i;
+
+  err = hexkeygrip_from_pk (pk, &hexgrip);
+  if (err)
+    return err;
+
+  desc = gpg_format_keydesc (pk, FORMAT_KEYDESC_NORMAL, 1);
+  err = agent_pksign_batch (NULL/*ctrl*/, NULL, hexgrip, desc,
+                            pk->keyid, pk->main_keyid, pk->pubkey_algo,
+                            digests, gcry_md_get_algo_dlen (mdalgo),
+                            mdalgo, n, sigvals);
+  if (gpg_err_code (err) == GPG_ERR_ASS_UNKNOWN_CMD)
+    {
+      /* An old agent: Ask for one signature after the other.  */
+      for (i=0; i < n; i++)
+        sigvals[i] = NULL;
+      for (err=0, i=0; !err && i < n; i++)
+        err = agent_pksign (NULL/*ctrl*/, NULL, hexgrip, desc,
+                            pk->keyid, pk->main_keyid, pk->pubkey_algo,
+                            digests[i], gcry_md_get_algo_dlen (mdalgo),
+                            mdalgo, &sigvals[i]);
+      if (err)
+        {
+          while (i--)
+            gcry_sexp_release (sigvals[i]);
+        }
+    }
+  xfree (desc);
+  xfree (hexgrip);
+  return err;
+}
+
+
+/* Sign the NITEMS hashed files at ITEMS with the key PK, which is
+   the KEYNO'th key of the list.  All signatures are requested with
+   one command so that the agent needs to unprotect the key only
+   once.  */
+static void
+sign_files_with_key (PKT_public_key *pk, int keyno, u32 duration,
+                     struct sign_files_item_s *items, int nitems)
+{
+  gpg_error_t err;
+  gcry_md_hd_t mds[SIGN_FILES_BATCH];
+  unsigned char *digests[SIGN_FILES_BATCH];
+  gcry_sexp_t sigvals[SIGN_FILES_BATCH];
+  int idx[SIGN_FILES_BATCH];
+  int mdalgo = hash_for (pk);
+  int i, n;
+
+  for (n=i=0; i < nitems; i++)
+    {
+      PKT_signature *sig;
+
+      if (!items[i].hash)
+        continue;
+      sig = build_data_sig (pk, items[i].hash, opt.textmode? 0x01 : 0x00,
+                            0, duration, &mds[n]);
+      if (begin_sign (pk, sig, mds[n], mdalgo))
+        {
+          gcry_md_close (mds[n]);
+          free_seckey_enc (sig);
+          continue;
+        }
+      items[i].sigs[keyno] = sig;
+      digests[n] = gcry_md_read (mds[n], mdalgo);
+      idx[n++] = i;
+    }
+  if (!n)
+    return;
+
+  err = pksign_digests (pk, digests, mdalgo, n, sigvals);
+
+  for (i=0; i < n; i++)
+    {
+      PKT_signature **sigp = &items[idx[i]].sigs[keyno];
+
+      if (!err)
+        sigval_to_sig (pk, *sigp, sigvals[i]);
+      if (err || end_sign (pk, *sigp, mds[i], 0))
+        {
+          free_seckey_enc (*sigp);
+          *sigp = NULL;
+        }
+      if (!err)
+        gcry_sexp_release (sigvals[i]);
+      gcry_md_close (mds[i]);
+    }
+  if (err)
+    log_error (_("signing failed: %s\n"), gpg_strerror (err));
+}
+
+
+/* Open the file of ITEM and prepare the hash for the keys of
+   SK_LIST.  */
+static int
+sign_files_open (struct sign_files_item_s *item, SK_LIST sk_list)
+{
+  SK_LIST sk_rover;
+  IOBUF inp;
+
+  inp = iobuf_open_mmap (item->fname);
+  if (inp && is_secured_file (iobuf_get_fd (inp)))
+    {
+      iobuf_close (inp);
+      inp = NULL;
+      gpg_err_set_errno (EPERM);
+    }
+  if (!inp)
+    {
+      int rc = gpg_error_from_syserror ();
+      log_error (_("can't open '%s': %s\n"), item->fname, strerror (errno));
+      return rc;
+    }
+
+  if (gcry_md_open (&item->hash, 0, 0))
+    BUG ();
+  if (DBG_HASHING)
+    gcry_md_debug (item->hash, "sign");
+  for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
+    gcry_md_enable (item->hash, hash_for (sk_rover->pk));
+
+  if (opt.textmode)
+    {
+      memset (&item->tfx, 0, sizeof item->tfx);
+      iobuf_push_filter (inp, text_filter, &item->tfx);
+    }
+  item->inp = inp;
+  return 0;
+}
+
+
+/* Close the file of ITEM.  On a read error the hash is released.  */
+static int
+sign_files_close (struct sign_files_item_s *item)
+{
+  int rc;
+
+  rc = iobuf_error (item->inp);
+  if (rc)
+    {
+      log_error (_("error reading '%s': %s\n"),
+                 item->fname, gpg_strerror (rc));
+      gcry_md_close (item->hash);
+      item->hash = NULL;
+    }
+  iobuf_close (item->inp);
+  item->inp = NULL;
+  return rc;
+}
+
+
+/* Write the signatures of ITEM made with the NKEYS keys of SK_LIST to
+   a detached signature file.  */
+static int
+sign_files_write (struct sign_files_item_s *item, SK_LIST sk_list, int nkeys)
+{
+  armor_filter_context_t *afx;
+  SK_LIST sk_rover;
+  IOBUF out;
+  int rc, i;
+
+  for (i=0; i < nkeys; i++)
+    if (!item->sigs[i])
+      return gpg_error (GPG_ERR_GENERAL);
+
+  rc = open_outfile (-1, item->fname, opt.armor? 1 : 2, 0, &out);
+  if (rc)
+    return rc;
+
+  afx = new_armor_context ();
+  if (opt.armor)
+    {
+      afx->what = 2;
+      push_armor_filter (afx, out);
+    }
+
+  for (sk_rover = sk_list, i=0; !rc && sk_rover;
+       sk_rover = sk_rover->next, i++)
+    {
+      rc = write_sig_packet (sk_rover->pk, item->sigs[i], out, 'D');
+      item->sigs[i] = NULL;
+    }
+  if (rc)
+    iobuf_cancel (out);
+  else
+    iobuf_close (out);
+  release_armor_context (afx);
+  return rc;
+}
+
+
+/* Create detached signatures for the files ITEMS[0..NITEMS-1] with
+   the NKEYS keys of SK_LIST.  */
+static void
+sign_files_batch (struct sign_files_item_s *items, int nitems,
+                  SK_LIST sk_list, int nkeys, u32 duration)
+{
+  SK_LIST sk_rover;
+  struct datafile_hash_s jobs[SIGN_FILES_BATCH];
+  int i, rc;
+
+  /* The files are opened and closed by the main thread; only reading
+     and hashing them is done in parallel.  The text filter is not
+     prepared for that.  */
+  for (i=0; i < nitems; i++)
+    {
+      sign_files_open (&items[i], sk_list);
+      jobs[i].inp = items[i].inp;
+      jobs[i].md = items[i].hash;
+    }
+  hash_datafiles_parallel (jobs, nitems,
+                           opt.textmode? 1 : sig_queue_threads ());
+  for (i=0; i < nitems; i++)
+    if (items[i].inp)
+      sign_files_close (&items[i]);
+
+  for (sk_rover = sk_list, i=0; sk_rover; sk_rover = sk_rover->next, i++)
+    sign_files_with_key (sk_rover->pk, i, duration, items, nitems);
+
+  for (i=0; i < nitems; i++)
+    {
+      print_file_status (STATUS_FILE_START, items[i].fname, 4);
+      if (!items[i].hash)
+        rc = gpg_error (GPG_ERR_GENERAL);
+      else
+        rc = sign_files_write (&items[i], sk_list, nkeys);
+      if (rc)
+        log_error ("signing of '%s' failed: %s\n",
+                   print_fname_stdin (items[i].fname), gpg_strerror (rc));
+      write_status (STATUS_FILE_DONE);
+    }
+}
+
+
+/* Release the NITEMS files at ITEMS.  */
+static void
+sign_files_release (struct sign_files_item_s *items, int nitems, int nkeys)
+{
+  int i, k;
+
+  for (i=0; i < nitems; i++)
+    {
+      for (k=0; k < nkeys; k++)
+        if (items[i].sigs[k])
+          free_seckey_enc (items[i].sigs[k]);
+      xfree (items[i].sigs);
+      gcry_md_close (items[i].hash);
+      xfree (items[i].fname);
+    }
+}
+
+
+/****************
+ * Make a detached signature for each of the NFILES files at FILES.
+ * If NFILES is 0 the names are read from stdin, one per line.  Unlike
+ * sign_file with several files this creates one signature file for
+ * each file.  The signatures are requested from the agent in batches
+ * so that each key is unprotected only once per batch.
+ */
+void
+sign_files (ctrl_t ctrl, int nfiles, char **files, strlist_t locusr)
+{
+  struct sign_files_item_s *items;
+  SK_LIST sk_list = NULL;
+  SK_LIST sk_rover;
+  int nitems = 0;
+  int nkeys = 0;
+  u32 duration;
+  char line[2048];
+  unsigned int lno = 0;
+  int use_stdin = !nfiles;
+
+  (void)ctrl;
+
+  if (opt.outfile)
+    {
+      log_error(_("--output doesn't work for this command\n"));
+      return;
+    }
+
+  if (opt.ask_sig_expire && !opt.batch)
+    duration = ask_expire_interval (1, opt.def_sig_expire);
+  else
+    duration = parse_expire_string (opt.def_sig_expire);
+
+  if (build_sk_list (locusr, &sk_list, PUBKEY_USAGE_SIG))
+    return;
+  for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
+    nkeys++;
+
+  items = xcalloc (SIGN_FILES_BATCH, sizeof *items);
+  for (;;)
+    {
+      const char *fname;
+
+      if (nfiles)
+        {
+          fname = *files++;
+          nfiles--;
+        }
+      else if (use_stdin && fgets (line, DIM(line), stdin))
+        {
+          lno++;
+          if (!*line || line[strlen(line)-1] != '\n')
+            {
+              log_error("input line %u too long or missing LF\n", lno);
+              break;
+            }
+          line[strlen(line)-1] = '\0';
+          fname = line;
+        }
+      else
+        break;
+
+      items[nitems].fname = xstrdup (fname);
+      items[nitems].sigs = xcalloc (nkeys, sizeof *items[nitems].sigs);
+      nitems++;
+      if (nitems == SIGN_FILES_BATCH)
+        {
+          sign_files_batch (items, nitems, sk_list, nkeys, duration);
+          sign_files_release (items, nitems, nkeys);
+          memset (items, 0, SIGN_FILES_BATCH * sizeof *items);
+          nitems = 0;
+        }
+    }
+  if (nitems)
+    {
+      sign_files_batch (items, nitems, sk_list, nkeys, duration);
+      sign_files_release (items, nitems, nkeys);
+    }
+
+  xfree (items);
+  release_sk_list (sk_list);
+}
+
+
+
 /****************
  * make a clear signature. note that opt.armor is not needed
  */
@@ -1378,23 +1820,15 @@ sign_symencrypt_file (const char *fname, strlist_t locusr)
 }
 
 
-/****************
- * Create a signature packet for the given public key certificate and
- * the user id and return it in ret_sig. User signature class SIGCLASS
- * user-id is not used (and may be NULL if sigclass is 0x20) If
- * DIGEST_ALGO is 0 the function selects an appropriate one.
- * SIGVERSION gives the minimal required signature packet version;
- * this is needed so that special properties like local sign are not
- * applied (actually: dropped) when a v3 key is used.  TIMESTAMP is
- * the timestamp to use for the signature. 0 means "now" */
-int
-make_keysig_packet (PKT_signature **ret_sig, PKT_public_key *pk,
-		    PKT_user_id *uid, PKT_public_key *subpk,
-		    PKT_public_key *pksk,
-		    int sigclass, int digest_algo,
-                    u32 timestamp, u32 duration,
-		    int (*mksubpkt)(PKT_signature *, void *), void *opaque,
-                    const char *cache_nonce)
+/* The part of make_keysig_packet before the signature is created:
+   Build the signature packet and the final hash over the data to
+   sign and return them at R_SIG and R_MD.  */
+static int
+prepare_keysig (PKT_signature **r_sig, gcry_md_hd_t *r_md,
+                PKT_public_key *pk, PKT_user_id *uid, PKT_public_key *subpk,
+                PKT_public_key *pksk, int sigclass, int digest_algo,
+                u32 timestamp, u32 duration,
+                int (*mksubpkt)(PKT_signature *, void *), void *opaque)
 {
     PKT_signature *sig;
     int rc=0;
@@ -1477,13 +1911,48 @@ make_keysig_packet (PKT_signature **ret_sig, PKT_public_key *pk,
     if (mksubpkt)
 	rc = (*mksubpkt)( sig, opaque );
 
-    if( !rc ) {
-        hash_sigversion_to_magic (md, sig);
-	gcry_md_final (md);
-
-	rc = complete_sig (sig, pksk, md, cache_nonce);
+    if( rc ) {
+	gcry_md_close (md);
+	free_seckey_enc( sig );
+	return rc;
     }
 
+    hash_sigversion_to_magic (md, sig);
+    gcry_md_final (md);
+    *r_sig = sig;
+    *r_md = md;
+    return 0;
+}
+
+
+/****************
+ * Create a signature packet for the given public key certificate and
+ * the user id and return it in ret_sig. User signature class SIGCLASS
+ * user-id is not used (and may be NULL if sigclass is 0x20) If
+ * DIGEST_ALGO is 0 the function selects an appropriate one.
+ * SIGVERSION gives the minimal required signature packet version;
+ * this is needed so that special properties like local sign are not
+ * applied (actually: dropped) when a v3 key is used.  TIMESTAMP is
+ * the timestamp to use for the signature. 0 means "now" */
+int
+make_keysig_packet (PKT_signature **ret_sig, PKT_public_key *pk,
+		    PKT_user_id *uid, PKT_public_key *subpk,
+		    PKT_public_key *pksk,
+		    int sigclass, int digest_algo,
+                    u32 timestamp, u32 duration,
+		    int (*mksubpkt)(PKT_signature *, void *), void *opaque,
+                    const char *cache_nonce)
+{
+    PKT_signature *sig;
+    gcry_md_hd_t md;
+    int rc;
+
+    rc = prepare_keysig (&sig, &md, pk, uid, subpk, pksk, sigclass,
+                         digest_algo, timestamp, duration, mksubpkt, opaque);
+    if (rc)
+      return rc;
+
+    rc = complete_sig (sig, pksk, md, cache_nonce);
     gcry_md_close (md);
     if( rc )
 	free_seckey_enc( sig );
@@ -1493,6 +1962,194 @@ make_keysig_packet (PKT_signature **ret_sig, PKT_public_key *pk,
 }
 
 
+/* The number of key signatures requested from the agent with one
+   command by keysig_batch_flush.  */
+#define KEYSIG_BATCH 64
+
+/* A key signature waiting for keysig_batch_flush.  */
+struct keysig_batch_item_s
+{
+  PKT_signature *sig;
+  gcry_md_hd_t md;
+  int signer;           /* Index into the signers of the batch.  */
+};
+
+/* Key signatures to be created together.  */
+struct keysig_batch_s
+{
+  PKT_public_key **signers;  /* Copies of the signing keys.  */
+  int nsigners;
+  struct keysig_batch_item_s *items;
+  int nitems;
+  int maxitems;
+};
+
+
+/* Create an empty batch of key signatures.  */
+keysig_batch_t
+keysig_batch_new (void)
+{
+  return xcalloc (1, sizeof (struct keysig_batch_s));
+}
+
+
+/* Release BATCH.  Signatures not yet flushed are not created; they
+   stay without signature values.  */
+void
+keysig_batch_release (keysig_batch_t batch)
+{
+  int i;
+
+  if (!batch)
+    return;
+  for (i=0; i < batch->nitems; i++)
+    gcry_md_close (batch->items[i].md);
+  for (i=0; i < batch->nsigners; i++)
+    free_public_key (batch->signers[i]);
+  xfree (batch->signers);
+  xfree (batch->items);
+  xfree (batch);
+}
+
+
+/* Like make_keysig_packet but the signature is only created by the
+   next keysig_batch_flush of BATCH, along with the other signatures
+   of the batch.  The signature packet returned at RET_SIG may be
+   inserted into its keyblock right away but must not be written or
+   checked before the flush.  */
+int
+make_keysig_packet_batch (keysig_batch_t batch, PKT_signature **ret_sig,
+                          PKT_public_key *pk, PKT_user_id *uid,
+                          PKT_public_key *subpk, PKT_public_key *pksk,
+                          int sigclass, int digest_algo,
+                          u32 timestamp, u32 duration,
+                          int (*mksubpkt)(PKT_signature *, void *),
+                          void *opaque)
+{
+  PKT_signature *sig = NULL;
+  gcry_md_hd_t md;
+  u32 keyid[2], signer_keyid[2];
+  int i, rc;
+
+  rc = prepare_keysig (&sig, &md, pk, uid, subpk, pksk, sigclass,
+                       digest_algo, timestamp, duration, mksubpkt, opaque);
+  if (!rc)
+    rc = begin_sign (pksk, sig, md, 0);
+  if (rc)
+    {
+      if (sig)
+        {
+          gcry_md_close (md);
+          free_seckey_enc (sig);
+        }
+      return rc;
+    }
+
+  keyid_from_pk (pksk, keyid);
+  for (i=0; i < batch->nsigners; i++)
+    {
+      keyid_from_pk (batch->signers[i], signer_keyid);
+      if (signer_keyid[0] == keyid[0] && signer_keyid[1] == keyid[1])
+        break;
+    }
+  if (i == batch->nsigners)
+    {
+      batch->signers = xrealloc (batch->signers,
+                                 (i + 1) * sizeof *batch->signers);
+      batch->signers[i] = copy_public_key (NULL, pksk);
+      batch->nsigners++;
+    }
+
+  if (batch->nitems == batch->maxitems)
+    {
+      batch->maxitems = batch->maxitems? 2 * batch->maxitems : KEYSIG_BATCH;
+      batch->items = xrealloc (batch->items,
+                               batch->maxitems * sizeof *batch->items);
+    }
+  batch->items[batch->nitems].sig = sig;
+  batch->items[batch->nitems].md = md;
+  batch->items[batch->nitems].signer = i;
+  batch->nitems++;
+
+  *ret_sig = sig;
+  return 0;
+}
+
+
+/* Create all signatures of BATCH.  The signatures of one key and
+   hash algorithm are requested from the agent KEYSIG_BATCH at a time,
+   so that the agent needs to unprotect each key only once.  A
+   signature which could not be created is left without signature
+   values, that is with DATA[0] set to NULL.  Returns 0 if all
+   signatures have been created or the error of the first which has
+   not; the batch is empty afterwards.  */
+gpg_error_t
+keysig_batch_flush (keysig_batch_t batch)
+{
+  gpg_error_t firsterr = 0;
+  gpg_error_t err;
+  struct keysig_batch_item_s *item;
+  unsigned char *digests[KEYSIG_BATCH];
+  gcry_sexp_t sigvals[KEYSIG_BATCH];
+  int idx[KEYSIG_BATCH];
+  PKT_public_key *pk;
+  int i, n, start, mdalgo;
+  char *done;
+
+  if (!batch->nitems)
+    return 0;
+
+  done = xcalloc (batch->nitems, 1);
+  for (start=0; start < batch->nitems; start++)
+    {
+      if (done[start])
+        continue;
+
+      /* Collect the items of the same key and algorithm.  */
+      pk = batch->signers[batch->items[start].signer];
+      mdalgo = batch->items[start].sig->digest_algo;
+      for (n=0, i=start; i < batch->nitems && n < KEYSIG_BATCH; i++)
+        {
+          item = batch->items + i;
+          if (done[i] || item->signer != batch->items[start].signer
+              || item->sig->digest_algo != mdalgo)
+            continue;
+          digests[n] = gcry_md_read (item->md, mdalgo);
+          idx[n++] = i;
+          done[i] = 1;
+        }
+
+      err = pksign_digests (pk, digests, mdalgo, n, sigvals);
+      if (err)
+        log_error (_("signing failed: %s\n"), gpg_strerror (err));
+      for (i=0; i < n; i++)
+        {
+          item = batch->items + idx[i];
+          if (!err)
+            {
+              sigval_to_sig (pk, item->sig, sigvals[i]);
+              gcry_sexp_release (sigvals[i]);
+            }
+          if (err || end_sign (pk, item->sig, item->md, 0))
+            {
+              gcry_mpi_release (item->sig->data[0]);
+              gcry_mpi_release (item->sig->data[1]);
+              item->sig->data[0] = NULL;
+              item->sig->data[1] = NULL;
+              if (!firsterr)
+                firsterr = err? err : gpg_error (GPG_ERR_BAD_SIGNATURE);
+            }
+        }
+    }
+  xfree (done);
+
+  for (i=0; i < batch->nitems; i++)
+    gcry_md_close (batch->items[i].md);
+  batch->nitems = 0;
+  return firsterr;
+}
+
+
 
 /****************
  * Create a new signature packet based on an existing one.
@@ -0,0 +1,129 @@
+/* stats.c - Report the throughput of the processing stages
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* With --debug-stats the iobuf layer counts the bytes, the CPU time
+   and the buffer memory of each filter, call-agent.c times the
+   requests to the agent and keydb.c counts its searches.  This module prints these
+   counters as STATS status lines while gpg is working and as a
+   summary at exit.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpg.h"
+#include "iobuf.h"
+#include "status.h"
+#include "util.h"
+#include "options.h"
+#include "main.h"
+#include "keydb.h"
+#include "call-agent.h"
+
+
+/* Print all counters as status lines if WANT_STATUS is set and to the
+   log if WANT_LOG is set.  */
+static void
+print_stats (int want_status, int want_log)
+{
+  const struct iobuf_filter_stats_s *st;
+  unsigned long count, hits;
+  double seconds, max;
+  size_t used, peak, limit;
+  char line[120];
+  int i;
+
+  for (i=0; (st = iobuf_get_filter_stats (i)); i++)
+    {
+      if (want_status)
+        {
+          snprintf (line, sizeof line, "filter %.40s %lu %llu %llu %lu %lu",
+                    st->name, st->calls, st->bytes_in, st->bytes_out,
+                    (unsigned long)(st->cpu * 1000),
+                    (unsigned long)st->mem_peak);
+          write_status_text (STATUS_STATS, line);
+        }
+      if (want_log)
+        log_info ("stats: %-24s %8lu calls %12llu in %12llu out %8.3fs cpu"
+                  " %8lu KiB peak\n",
+                  st->name, st->calls, st->bytes_in, st->bytes_out, st->cpu,
+                  (unsigned long)((st->mem_peak + 1023) / 1024));
+    }
+
+  iobuf_get_memory_usage (&used, &peak, &limit);
+  if (want_status)
+    {
+      snprintf (line, sizeof line, "memory %lu %lu %lu",
+                (unsigned long)used, (unsigned long)peak,
+                (unsigned long)limit);
+      write_status_text (STATUS_STATS, line);
+    }
+  if (want_log)
+    log_info ("stats: buffers: %lu KiB peak, %lu KiB limit\n",
+              (unsigned long)((peak + 1023) / 1024),
+              (unsigned long)((limit + 1023) / 1024));
+
+  agent_get_stats (&count, &seconds, &max);
+  if (want_status)
+    {
+      snprintf (line, sizeof line, "agent %lu %lu %lu", count,
+                (unsigned long)(seconds * 1000), (unsigned long)(max * 1000));
+      write_status_text (STATUS_STATS, line);
+    }
+  if (want_log && count)
+    log_info ("stats: gpg-agent: %lu requests, %.3fs total, %.3fs max\n",
+              count, seconds, max);
+
+  keydb_get_stats (&count, &hits);
+  if (want_status)
+    {
+      snprintf (line, sizeof line, "keydb %lu %lu", count, hits);
+      write_status_text (STATUS_STATS, line);
+    }
+  if (want_log && count)
+    log_info ("stats: keydb: %lu searches, %lu cache hits\n", count, hits);
+}
+
+
+/* Called by the iobuf layer about once a second.  */
+static void
+stats_tick (void)
+{
+  print_stats (1, 0);
+}
+
+
+/* Start collecting the statistics.  Called after option parsing if
+   --debug-stats has been given.  */
+void
+stats_init (void)
+{
+  iobuf_enable_stats (1, is_status_enabled ()? stats_tick : NULL);
+}
+
+
+/* Print the final statistics.  */
+void
+stats_dump (void)
+{
+  if (!opt.debug_stats)
+    return;
+  print_stats (is_status_enabled (), 1);
+}
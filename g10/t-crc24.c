@@ -0,0 +1,113 @@
+/* t-crc24.c - Module test for crc24.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/types.h"
+#include "crc24.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                       exit (1);                                 \
+                    } while(0)
+
+
+/* The bitwise implementation from RFC-4880, section 6.1.  */
+static u32
+reference_crc (u32 crc, const byte *buf, size_t len)
+{
+  int i;
+
+  while (len--)
+    {
+      crc ^= (u32)*buf++ << 16;
+      for (i=0; i < 8; i++)
+        {
+          crc <<= 1;
+          if (crc & 0x1000000)
+            crc ^= 0x1864CFB;
+        }
+    }
+  return crc & 0xffffff;
+}
+
+
+static void
+test_known (void)
+{
+  const char *s = "123456789";
+
+  if (crc24_update (CRC24_INIT, (const byte *)s, 0) != CRC24_INIT)
+    fail (1);
+  if (crc24_update (CRC24_INIT, (const byte *)s, strlen (s)) != 0x21CF02)
+    fail (2);
+  if (reference_crc (CRC24_INIT, (const byte *)s, strlen (s)) != 0x21CF02)
+    fail (3);
+}
+
+
+/* Compare against the reference for random data with random lengths
+   and alignments, in one piece and split into two updates.  */
+static void
+test_random (void)
+{
+  static byte buffer[1024 + 8];
+  size_t off, len, split;
+  u32 expect, crc;
+  int i;
+
+  srand (4880);
+  for (i=0; i < sizeof buffer; i++)
+    buffer[i] = rand ();
+
+  for (i=0; i < 20000; i++)
+    {
+      off = rand () % 8;
+      len = rand () % (i < 1000? 40 : 1025);
+      expect = reference_crc (CRC24_INIT, buffer + off, len);
+
+      crc = crc24_update (CRC24_INIT, buffer + off, len);
+      if (crc != expect)
+        fail (1);
+
+      split = len? rand () % len : 0;
+      crc = crc24_update (CRC24_INIT, buffer + off, split);
+      crc = crc24_update (crc, buffer + off + split, len - split);
+      if (crc != expect)
+        fail (2);
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  crc24_init ();
+  test_known ();
+  test_random ();
+
+  return 0;
+}
@@ -27,6 +27,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "gpg.h"
 #include "status.h"
@@ -57,13 +60,19 @@
 #endif
 
 /****************
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The record cache.  Written records are kept here until the next
+ * sync and records read from the file are kept as well, so that a
+ * walk over the trustdb reads each record only once.  The entries
+ * are indexed by a hash table on the record number.  Their number is
+ * bounded by CACHE_LIMIT, which scales with the size of the trustdb;
+ * in a transaction the cache may grow further, because writes are
+ * delayed until tdbio_end_transaction.  Dirty records are written in
+ * ascending order so that adjacent records need just one write.
  */
 typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct {
-    CACHE_CTRL next;
+    CACHE_CTRL next;	/* list of all entries */
+    CACHE_CTRL hnext;	/* next in the hash bucket or the free list */
     struct {
 	unsigned used:1;
 	unsigned dirty:1;
@@ -74,8 +83,16 @@ struct cache_ctrl_struct {
 
 #define MAX_CACHE_ENTRIES_SOFT	200    /* may be increased while in a */
 #define MAX_CACHE_ENTRIES_HARD	10000  /* transaction to this one */
+#define MAX_CACHE_ENTRIES_LIMIT 262144 /* upper bound for big trustdbs */
+#define MAX_WRITE_RECORDS	64     /* adjacent records written at once */
 static CACHE_CTRL cache_list;
+static CACHE_CTRL cache_free;
+static CACHE_CTRL *cache_table;
+static unsigned int cache_table_size; /* a power of 2 */
+static int cache_allocated;
 static int cache_entries;
+static int cache_dirty_entries;
+static int cache_limit = MAX_CACHE_ENTRIES_SOFT;
 static int cache_is_dirty;
 
 /* a type used to pass infomation to cmp_krec_fpr */
@@ -97,15 +114,36 @@ static dotlock_t lockhandle;
 static int is_locked;
 static int  db_fd = -1;
 static int in_transaction;
+static unsigned int change_count; /* Number of records written.  */
+#ifdef HAVE_MMAP
+static const char *db_map;  /* read-only mapping used for lookups */
+static size_t db_map_len;
+#endif
 
 static void open_db(void);
+static int upd_hashtable_level( ulong table, int level, const byte *key,
+                                int keylen, ulong newrecnum );
+
 
 
-
 /*************************************
  ************* record cache **********
  *************************************/
 
+static CACHE_CTRL
+lookup_cache( ulong recno )
+{
+    CACHE_CTRL r;
+
+    if( !cache_table )
+	return NULL;
+    for( r = cache_table[recno & (cache_table_size-1)]; r; r = r->hnext ) {
+	if( r->recno == recno )
+	    return r;
+    }
+    return NULL;
+}
+
 /****************
  * Get the data from therecord cache and return a
  * pointer into that cache.  Caller should copy
@@ -113,183 +151,281 @@ static void open_db(void);
  */
 static const char *
 get_record_from_cache( ulong recno )
+{
+    CACHE_CTRL r = lookup_cache( recno );
+
+    return r? r->data : NULL;
+}
+
+
+static void
+resize_cache_table( unsigned int size )
 {
     CACHE_CTRL r;
+    unsigned int i;
 
+    xfree( cache_table );
+    cache_table = xcalloc( size, sizeof *cache_table );
+    cache_table_size = size;
     for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->recno == recno )
-	    return r->data;
+	if( r->flags.used ) {
+	    i = r->recno & (size-1);
+	    r->hnext = cache_table[i];
+	    cache_table[i] = r;
+	}
     }
-    return NULL;
+}
+
+
+/****************
+ * Scale the cache to a trustdb of NRECORDS records.
+ */
+static void
+set_cache_limit( ulong nrecords )
+{
+    ulong limit = nrecords + nrecords / 4;
+    unsigned int size;
+
+    if( limit < MAX_CACHE_ENTRIES_SOFT )
+	limit = MAX_CACHE_ENTRIES_SOFT;
+    else if( limit > MAX_CACHE_ENTRIES_LIMIT )
+	limit = MAX_CACHE_ENTRIES_LIMIT;
+    cache_limit = limit;
+
+    for( size = 256; size < limit; size <<= 1 )
+	;
+    if( size > cache_table_size )
+	resize_cache_table( size );
+    if( DBG_CACHE )
+	log_debug("tdbio: cache limit is %d records\n", cache_limit );
+}
+
+
+static void
+drop_cache_entry( CACHE_CTRL r )
+{
+    CACHE_CTRL *rp;
+
+    for( rp = &cache_table[r->recno & (cache_table_size-1)];
+	 *rp != r; rp = &(*rp)->hnext )
+	;
+    *rp = r->hnext;
+    if( r->flags.dirty )
+	cache_dirty_entries--;
+    r->flags.used = 0;
+    r->flags.dirty = 0;
+    r->hnext = cache_free;
+    cache_free = r;
+    cache_entries--;
+}
+
+
+/****************
+ * Discard a third of the clean entries.  Returns false if there are
+ * no clean entries.
+ */
+static int
+discard_clean_entries(void)
+{
+    static CACHE_CTRL hand;
+    CACHE_CTRL r;
+    int i, n;
+
+    n = cache_entries - cache_dirty_entries;
+    if( !n )
+	return 0;
+    n /= 3;
+    if( !n )
+	n = 1;
+    for( i = 0; n && i < cache_allocated; i++ ) {
+	if( !hand )
+	    hand = cache_list;
+	r = hand;
+	hand = hand->next;
+	if( r->flags.used && !r->flags.dirty ) {
+	    drop_cache_entry( r );
+	    n--;
+	}
+    }
+    return 1;
 }
 
 
 static int
-write_cache_item( CACHE_CTRL r )
+write_records( ulong recno, const char *data, int nrecs )
 {
     gpg_error_t err;
     int n;
 
-    if( lseek( db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET ) == -1 ) {
+    if( lseek( db_fd, recno * TRUST_RECORD_LEN, SEEK_SET ) == -1 ) {
         err = gpg_error_from_syserror ();
 	log_error(_("trustdb rec %lu: lseek failed: %s\n"),
-					    r->recno, strerror(errno) );
+					    recno, strerror(errno) );
 	return err;
     }
-    n = write( db_fd, r->data, TRUST_RECORD_LEN);
-    if( n != TRUST_RECORD_LEN ) {
+    n = write( db_fd, data, nrecs * TRUST_RECORD_LEN);
+    if( n != nrecs * TRUST_RECORD_LEN ) {
         err = gpg_error_from_syserror ();
 	log_error(_("trustdb rec %lu: write failed (n=%d): %s\n"),
-					    r->recno, n, strerror(errno) );
+					    recno, n, strerror(errno) );
 	return err;
     }
-    r->flags.dirty = 0;
     return 0;
 }
 
+
+static int
+cmp_cache_recno( const void *a, const void *b )
+{
+    ulong ra = (*(const CACHE_CTRL *)a)->recno;
+    ulong rb = (*(const CACHE_CTRL *)b)->recno;
+
+    return ra < rb? -1 : ra > rb;
+}
+
 /****************
- * Put data into the cache.  This function may flush the
- * some cache entries if there is not enough space available.
+ * Write all dirty entries.  The caller must hold the lock.
  */
-int
-put_record_into_cache( ulong recno, const char *data )
+static int
+write_dirty_entries(void)
 {
-    CACHE_CTRL r, unused;
-    int dirty_count = 0;
-    int clean_count = 0;
+    char buf[MAX_WRITE_RECORDS * TRUST_RECORD_LEN];
+    CACHE_CTRL r, *vec;
+    int i, j, n, nvec;
+    int rc = 0;
 
-    /* see whether we already cached this one */
-    for( unused = NULL, r = cache_list; r; r = r->next ) {
-	if( !r->flags.used ) {
-	    if( !unused )
-		unused = r;
-	}
-	else if( r->recno == recno ) {
-	    if( !r->flags.dirty ) {
-		/* Hmmm: should we use a a copy and compare? */
-		if( memcmp(r->data, data, TRUST_RECORD_LEN ) ) {
-		    r->flags.dirty = 1;
-		    cache_is_dirty = 1;
-		}
-	    }
-	    memcpy( r->data, data, TRUST_RECORD_LEN );
-	    return 0;
-	}
-	if( r->flags.used ) {
-	    if( r->flags.dirty )
-		dirty_count++;
-	    else
-		clean_count++;
+    if( !cache_dirty_entries )
+	return 0;
+
+    vec = xmalloc( cache_dirty_entries * sizeof *vec );
+    for( nvec = 0, r = cache_list; r; r = r->next ) {
+	if( r->flags.used && r->flags.dirty )
+	    vec[nvec++] = r;
+    }
+    assert( nvec == cache_dirty_entries );
+    qsort( vec, nvec, sizeof *vec, cmp_cache_recno );
+
+    for( i = 0; i < nvec && !rc; i = j ) {
+	for( j = i + 1; j < nvec && j - i < MAX_WRITE_RECORDS
+		 && vec[j]->recno == vec[j-1]->recno + 1; j++ )
+	    ;
+	for( n = i; n < j; n++ )
+	    memcpy( buf + (n - i) * TRUST_RECORD_LEN, vec[n]->data,
+		    TRUST_RECORD_LEN );
+	rc = write_records( vec[i]->recno, buf, j - i );
+	if( !rc ) {
+	    for( n = i; n < j; n++ )
+		vec[n]->flags.dirty = 0;
+	    cache_dirty_entries -= j - i;
 	}
     }
-    /* not in the cache: add a new entry */
-    if( unused ) { /* reuse this entry */
-	r = unused;
-	r->flags.used = 1;
-	r->recno = recno;
-	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	cache_is_dirty = 1;
-	cache_entries++;
-	return 0;
+    xfree( vec );
+    return rc;
+}
+
+
+static int
+flush_cache(void)
+{
+    int did_lock = 0;
+    int rc;
+
+    if( !is_locked ) {
+	if( dotlock_take( lockhandle, -1 ) )
+	    log_fatal("can't acquire lock - giving up\n");
+	else
+	    is_locked = 1;
+	did_lock = 1;
     }
-    /* see whether we reached the limit */
-    if( cache_entries < MAX_CACHE_ENTRIES_SOFT ) { /* no */
-	r = xmalloc( sizeof *r );
-	r->flags.used = 1;
-	r->recno = recno;
-	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	r->next = cache_list;
-	cache_list = r;
-	cache_is_dirty = 1;
-	cache_entries++;
-	return 0;
+    rc = write_dirty_entries();
+    if( !rc )
+	cache_is_dirty = 0;
+    if( did_lock && !opt.lock_once ) {
+	if( !dotlock_release (lockhandle) )
+	    is_locked = 0;
     }
-    /* cache is full: discard some clean entries */
-    if( clean_count ) {
-	int n = clean_count / 3; /* discard a third of the clean entries */
-	if( !n )
-	    n = 1;
-	for( unused = NULL, r = cache_list; r; r = r->next ) {
-	    if( r->flags.used && !r->flags.dirty ) {
-		if( !unused )
-		    unused = r;
-		r->flags.used = 0;
-		cache_entries--;
-		if( !--n )
-		    break;
+    return rc;
+}
+
+
+/****************
+ * Put data into the cache; DIRTY tells whether it still needs to be
+ * written.  This function may flush the cache if there is not enough
+ * space available.  Clean records are not cached in that case.
+ */
+static int
+cache_record( ulong recno, const char *data, int dirty )
+{
+    CACHE_CTRL r;
+    int limit, rc;
+
+    /* see whether we already cached this one */
+    r = lookup_cache( recno );
+    if( r ) {
+	if( !dirty )
+	    return 0;
+	if( !r->flags.dirty ) {
+	    /* Hmmm: should we use a a copy and compare? */
+	    if( memcmp(r->data, data, TRUST_RECORD_LEN ) ) {
+		r->flags.dirty = 1;
+		cache_dirty_entries++;
+		cache_is_dirty = 1;
 	    }
 	}
-	assert( unused );
-	r = unused;
-	r->flags.used = 1;
-	r->recno = recno;
 	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	cache_is_dirty = 1;
-	cache_entries++;
 	return 0;
     }
-    /* no clean entries: have to flush some dirty entries */
-    if( in_transaction ) {
-	/* but we can't do this while in a transaction
-	 * we increase the cache size instead */
-	if( cache_entries < MAX_CACHE_ENTRIES_HARD ) { /* no */
-	    if( opt.debug && !(cache_entries % 100) )
-		log_debug("increasing tdbio cache size\n");
-	    r = xmalloc( sizeof *r );
-	    r->flags.used = 1;
-	    r->recno = recno;
-	    memcpy( r->data, data, TRUST_RECORD_LEN );
-	    r->flags.dirty = 1;
-	    r->next = cache_list;
-	    cache_list = r;
-	    cache_is_dirty = 1;
-	    cache_entries++;
+
+    /* see whether we reached the limit */
+    limit = cache_limit;
+    if( in_transaction && limit < MAX_CACHE_ENTRIES_HARD )
+	limit = MAX_CACHE_ENTRIES_HARD;
+    if( cache_entries >= limit && !discard_clean_entries() ) {
+	/* no clean entries: have to flush the dirty entries */
+	if( !dirty )
 	    return 0;
-	}
-	log_info(_("trustdb transaction too large\n"));
-	return GPG_ERR_RESOURCE_LIMIT;
+	if( in_transaction && opt.debug )
+	    log_debug("tdbio: transaction too large; writing early\n");
+	rc = flush_cache();
+	if( rc )
+	    return rc;
+	discard_clean_entries();
     }
-    if( dirty_count ) {
-	int n = dirty_count / 5; /* discard some dirty entries */
-	if( !n )
-	    n = 1;
-	if( !is_locked ) {
-	    if( dotlock_take( lockhandle, -1 ) )
-		log_fatal("can't acquire lock - giving up\n");
-	    else
-		is_locked = 1;
-	}
-	for( unused = NULL, r = cache_list; r; r = r->next ) {
-	    if( r->flags.used && r->flags.dirty ) {
-		int rc = write_cache_item( r );
-		if( rc )
-		    return rc;
-		if( !unused )
-		    unused = r;
-		r->flags.used = 0;
-		cache_entries--;
-		if( !--n )
-		    break;
-	    }
-	}
-	if( !opt.lock_once ) {
-	    if( !dotlock_release( lockhandle ) )
-		is_locked = 0;
-	}
-	assert( unused );
-	r = unused;
-	r->flags.used = 1;
-	r->recno = recno;
-	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
+
+    /* not in the cache: add a new entry */
+    if( !cache_table )
+	resize_cache_table( 256 );
+    if( cache_free ) { /* reuse this entry */
+	r = cache_free;
+	cache_free = r->hnext;
+    }
+    else {
+	r = xmalloc( sizeof *r );
+	r->next = cache_list;
+	cache_list = r;
+	cache_allocated++;
+    }
+    r->flags.used = 1;
+    r->flags.dirty = !!dirty;
+    r->recno = recno;
+    memcpy( r->data, data, TRUST_RECORD_LEN );
+    r->hnext = cache_table[recno & (cache_table_size-1)];
+    cache_table[recno & (cache_table_size-1)] = r;
+    cache_entries++;
+    if( dirty ) {
+	cache_dirty_entries++;
 	cache_is_dirty = 1;
-	cache_entries++;
-	return 0;
     }
-    BUG();
+    if( cache_entries > 2 * cache_table_size )
+	resize_cache_table( 2 * cache_table_size );
+    return 0;
+}
+
+
+int
+put_record_into_cache( ulong recno, const char *data )
+{
+    return cache_record( recno, data, 1 );
 }
 
 
@@ -301,54 +437,30 @@ tdbio_is_dirty()
 
 
 /****************
- * Flush the cache.  This cannot be used while in a transaction.
+ * Flush the cache.  While in a transaction this is delayed until
+ * the transaction ends.
  */
 int
 tdbio_sync()
 {
-    CACHE_CTRL r;
-    int did_lock = 0;
-
     if( db_fd == -1 )
 	open_db();
     if( in_transaction )
-	log_bug("tdbio: syncing while in transaction\n");
+	return 0;
 
     if( !cache_is_dirty )
 	return 0;
 
-    if( !is_locked ) {
-	if( dotlock_take( lockhandle, -1 ) )
-	    log_fatal("can't acquire lock - giving up\n");
-	else
-	    is_locked = 1;
-	did_lock = 1;
-    }
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
-    }
-    cache_is_dirty = 0;
-    if( did_lock && !opt.lock_once ) {
-	if( !dotlock_release (lockhandle) )
-	    is_locked = 0;
-    }
-
-    return 0;
+    return flush_cache();
 }
 
-#if 0
-/* The transaction code is disabled in the 1.2.x branch, as it is not
-   yet used.  It will be enabled in 1.3.x. */
 
 /****************
  * Simple transactions system:
  * Everything between begin_transaction and end/cancel_transaction
  * is not immediatly written but at the time of end_transaction.
- *
+ * Only if the changes do not fit into the cache, some of them are
+ * written before; those can't be cancelled.
  */
 int
 tdbio_begin_transaction()
@@ -378,10 +490,8 @@ tdbio_end_transaction()
 	else
 	    is_locked = 1;
     }
-    block_all_signals();
     in_transaction = 0;
     rc = tdbio_sync();
-    unblock_all_signals();
     if( !opt.lock_once ) {
 	if( !dotlock_release (lockhandle) )
 	    is_locked = 0;
@@ -401,10 +511,8 @@ tdbio_cancel_transaction()
      * are read back the next time */
     if( cache_is_dirty ) {
 	for( r = cache_list; r; r = r->next ) {
-	    if( r->flags.used && r->flags.dirty ) {
-		r->flags.used = 0;
-		cache_entries--;
-	    }
+	    if( r->flags.used && r->flags.dirty )
+		drop_cache_entry( r );
 	}
 	cache_is_dirty = 0;
     }
@@ -412,13 +520,45 @@ tdbio_cancel_transaction()
     in_transaction = 0;
     return 0;
 }
-#endif
 
-
+
 /********************************************************
  **************** cached I/O functions ******************
  ********************************************************/
 
+#ifdef HAVE_MMAP
+/****************
+ * Map the trustdb for lookups if this has been requested and the
+ * file grew since it was mapped.  Records beyond the mapping are read
+ * the usual way.
+ */
+static void
+update_db_map(void)
+{
+    struct stat st;
+    void *p;
+
+    if( !opt.trustdb_mmap || fstat( db_fd, &st )
+	|| st.st_size <= (off_t)db_map_len )
+	return;
+
+    if( db_map ) {
+	munmap( (void *)db_map, db_map_len );
+	db_map = NULL;
+	db_map_len = 0;
+    }
+    p = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, db_fd, 0 );
+    if( p == MAP_FAILED ) {
+	log_info("trustdb: mmap failed: %s\n", strerror(errno) );
+	opt.trustdb_mmap = 0;
+	return;
+    }
+    db_map = p;
+    db_map_len = st.st_size;
+}
+#endif /*HAVE_MMAP*/
+
+
 static void
 cleanup(void)
 {
@@ -656,6 +796,16 @@ open_db()
 #endif /*!HAVE_W32CE_SYSTEM*/
   register_secured_file (db_name);
 
+  {
+    struct stat st;
+
+    if (!fstat (db_fd, &st))
+      set_cache_limit (st.st_size / TRUST_RECORD_LEN);
+  }
+#ifdef HAVE_MMAP
+  update_db_map ();
+#endif
+
   /* Read the version record. */
   if (tdbio_read_record (0, &rec, RECTYPE_VER ) )
     log_fatal( _("%s: invalid trustdb\n"), db_name );
@@ -663,12 +813,16 @@ open_db()
 
 
 /****************
- * Make a hashtable: type 0 = trust hash
+ * Append the records of an empty hashtable to the trustdb and return
+ * the number of its first record.  The records are at once reserved
+ * in the file so that tdbio_new_recnum does not hand them out while
+ * they are still in the cache.
  */
-static void
-create_hashtable( TRUSTREC *vr, int type )
+static ulong
+new_hashtable(void)
 {
     TRUSTREC rec;
+    char zero[TRUST_RECORD_LEN];
     off_t offset;
     ulong recnum;
     int i, n, rc;
@@ -679,20 +833,40 @@ create_hashtable( TRUSTREC *vr, int type )
     recnum = offset / TRUST_RECORD_LEN;
     assert(recnum); /* this is will never be the first record */
 
-    if( !type )
-	vr->r.ver.trusthashtbl = recnum;
+    n = (256+ITEMS_PER_HTBL_RECORD-1) / ITEMS_PER_HTBL_RECORD;
+    memset( zero, 0, sizeof zero );
+    rc = 0;
+    if( lseek( db_fd, (recnum + n - 1) * TRUST_RECORD_LEN, SEEK_SET ) == -1
+	|| write( db_fd, zero, TRUST_RECORD_LEN ) != TRUST_RECORD_LEN )
+	rc = gpg_error_from_syserror ();
 
     /* Now write the records */
-    n = (256+ITEMS_PER_HTBL_RECORD-1) / ITEMS_PER_HTBL_RECORD;
-    for(i=0; i < n; i++, recnum++ ) {
+    for(i=0; !rc && i < n; i++ ) {
 	 memset( &rec, 0, sizeof rec );
 	 rec.rectype = RECTYPE_HTBL;
-	 rec.recnum = recnum;
+	 rec.recnum = recnum + i;
 	 rc = tdbio_write_record( &rec );
-	 if( rc )
-	     log_fatal( _("%s: failed to create hashtable: %s\n"),
-					db_name, gpg_strerror (rc));
     }
+    if( rc )
+	log_fatal( _("%s: failed to create hashtable: %s\n"),
+		   db_name, gpg_strerror (rc));
+    return recnum;
+}
+
+
+/****************
+ * Make a hashtable: type 0 = trust hash
+ */
+static void
+create_hashtable( TRUSTREC *vr, int type )
+{
+    ulong recnum;
+    int rc;
+
+    recnum = new_hashtable();
+    if( !type )
+	vr->r.ver.trusthashtbl = recnum;
+
     /* update the version record */
     rc = tdbio_write_record( vr );
     if( !rc )
@@ -808,18 +982,73 @@ get_trusthashrec(void)
 
 
 
+/****************
+ * Replace the hash list starting at record LISTREC, which is item
+ * SLOT of the hashtable record HTREC at LEVEL, by a new hashtable on
+ * the next byte of the keys.  The keys are the fingerprints of the
+ * trust records in the list.
+ */
+static int
+split_hashlist( TRUSTREC *htrec, int slot, ulong listrec, int level )
+{
+    TRUSTREC rec, tmp;
+    ulong table, next;
+    int i, rc;
+
+    table = new_hashtable();
+    for( ; listrec; listrec = next ) {
+	rc = tdbio_read_record( listrec, &rec, RECTYPE_HLST );
+	if( rc )
+	    return rc;
+	next = rec.r.hlst.next;
+	for(i=0; i < ITEMS_PER_HLST_RECORD; i++ ) {
+	    if( !rec.r.hlst.rnum[i] )
+		continue;
+	    rc = tdbio_read_record( rec.r.hlst.rnum[i], &tmp, RECTYPE_TRUST );
+	    if( !rc )
+		rc = upd_hashtable_level( table, level+1,
+					  tmp.r.trust.fingerprint, 20,
+					  tmp.recnum );
+	    if( rc )
+		return rc;
+	}
+	rc = tdbio_delete_record( listrec );
+	if( rc )
+	    return rc;
+    }
+
+    htrec->r.htbl.item[slot] = table;
+    rc = tdbio_write_record( htrec );
+    if( rc )
+	log_error("split_hashlist: update htbl failed: %s\n",
+		  gpg_strerror (rc));
+    return rc;
+}
+
+
 /****************
  * Update a hashtable.
  * table gives the start of the table, key and keylen is the key,
- * newrecnum is the record number to insert.
+ * newrecnum is the record number to insert.  A hash list is not
+ * extended beyond one record but replaced by a hashtable on the next
+ * byte of the key so that the lists stay short however many keys
+ * there are.
  */
 static int
 upd_hashtable( ulong table, byte *key, int keylen, ulong newrecnum )
+{
+    return upd_hashtable_level( table, 0, key, keylen, newrecnum );
+}
+
+
+/* Same as upd_hashtable for the sub-table TABLE at LEVEL.  */
+static int
+upd_hashtable_level( ulong table, int level, const byte *key, int keylen,
+		     ulong newrecnum )
 {
     TRUSTREC lastrec, rec;
     ulong hashrec, item;
     int msb;
-    int level=0;
     int rc, i;
 
     hashrec = table;
@@ -852,7 +1081,7 @@ upd_hashtable( ulong table, byte *key, int keylen, ulong newrecnum )
 	}
 
 	if( rec.rectype == RECTYPE_HTBL ) {
-	    hashrec = item;
+	    hashrec = table = item;
 	    level++;
 	    if( level >= keylen ) {
 		log_error( "hashtable has invalid indirections.\n");
@@ -901,6 +1130,15 @@ upd_hashtable( ulong table, byte *key, int keylen, ulong newrecnum )
 			return rc;
 		    }
 		}
+		else if( level + 1 < keylen ) {
+		    /* Turn the full list into a hashtable.  */
+		    rc = split_hashlist( &lastrec, msb % ITEMS_PER_HTBL_RECORD,
+					 item, level );
+		    if( !rc )
+			rc = upd_hashtable_level( table, level, key, keylen,
+						  newrecnum );
+		    return rc;
+		}
 		else { /* add a new list record */
 		    rec.r.hlst.next = item = tdbio_new_recnum();
 		    rc = tdbio_write_record( &rec );
@@ -1128,6 +1366,72 @@ lookup_hashtable( ulong table, const byte *key, size_t keylen,
 }
 
 
+/****************
+ * Split the hash lists of the hashtable TABLE at LEVEL and of its
+ * sub-tables which take more than one record, as written by older
+ * versions.  The number of split lists is added to R_COUNT.
+ */
+static int
+split_long_hashlists( ulong table, int level, unsigned int *r_count )
+{
+    TRUSTREC rec, tmp;
+    ulong item;
+    int i, j, n, rc;
+
+    n = (256+ITEMS_PER_HTBL_RECORD-1) / ITEMS_PER_HTBL_RECORD;
+    for(i=0; i < n; i++ ) {
+	rc = tdbio_read_record( table + i, &rec, RECTYPE_HTBL );
+	if( rc )
+	    return rc;
+	for(j=0; j < ITEMS_PER_HTBL_RECORD; j++ ) {
+	    item = rec.r.htbl.item[j];
+	    if( !item )
+		continue;
+	    rc = tdbio_read_record( item, &tmp, 0 );
+	    if( rc )
+		return rc;
+	    if( tmp.rectype == RECTYPE_HTBL && level + 1 < 20 )
+		rc = split_long_hashlists( item, level+1, r_count );
+	    else if( tmp.rectype == RECTYPE_HLST && tmp.r.hlst.next
+		     && level + 1 < 20 ) {
+		/* The lists of the new table are split as needed
+		   while it is filled.  */
+		rc = split_hashlist( &rec, j, item, level );
+		++*r_count;
+	    }
+	    if( rc )
+		return rc;
+	}
+    }
+    return 0;
+}
+
+
+/****************
+ * Bring the trust hashtable to the layout upd_hashtable maintains:
+ * each hash list which takes more than one record is replaced by a
+ * hashtable on the next byte of the fingerprint.  Older versions
+ * understand these tables as well.  This is done by --check-trustdb
+ * and --update-trustdb.
+ */
+int
+tdbio_split_hashlists (void)
+{
+    unsigned int count = 0;
+    int rc;
+
+    rc = split_long_hashlists( get_trusthashrec(), 0, &count );
+    if( !rc )
+	rc = tdbio_sync();
+    if( rc )
+	log_error( _("%s: error reorganizing the hashtable: %s\n"),
+		   db_name, gpg_strerror (rc));
+    else if( count && opt.verbose )
+	log_info( _("%s: split %u long hash lists\n"), db_name, count );
+    return rc;
+}
+
+
 /****************
  * Update the trust hashtbl or create the table if it does not exist
  */
@@ -1154,7 +1458,8 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
 	break;
       case RECTYPE_VER:
         es_fprintf (fp,
-         "version, td=%lu, f=%lu, m/c/d=%d/%d/%d tm=%d mcl=%d nc=%lu (%s)\n",
+         "version, td=%lu, f=%lu, m/c/d=%d/%d/%d tm=%d mcl=%d nc=%lu (%s)"
+         " ch=%lu\n",
                 rec->r.ver.trusthashtbl,
                 rec->r.ver.firstfree,
                 rec->r.ver.marginals,
@@ -1163,7 +1468,8 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
                 rec->r.ver.trust_model,
                 rec->r.ver.min_cert_level,
                 rec->r.ver.nextcheck,
-                strtimestamp(rec->r.ver.nextcheck)
+                strtimestamp(rec->r.ver.nextcheck),
+                rec->r.ver.nchanged
                 );
 	break;
       case RECTYPE_FREE:
@@ -1185,8 +1491,10 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
 	es_fprintf (fp, "trust ");
 	for(i=0; i < 20; i++ )
 	    es_fprintf (fp, "%02X", rec->r.trust.fingerprint[i] );
-        es_fprintf (fp, ", ot=%d, d=%d, vl=%lu\n", rec->r.trust.ownertrust,
-                    rec->r.trust.depth, rec->r.trust.validlist);
+        es_fprintf (fp, ", ot=%d, d=%d, vl=%lu, f=%d, sd=%d\n",
+                    rec->r.trust.ownertrust, rec->r.trust.depth,
+                    rec->r.trust.validlist, rec->r.trust.flags,
+                    rec->r.trust.signer_depth);
 	break;
       case RECTYPE_VALID:
 	es_fprintf (fp, "valid ");
@@ -1216,6 +1524,10 @@ tdbio_read_record( ulong recnum, TRUSTREC *rec, int expected )
     if( db_fd == -1 )
 	open_db();
     buf = get_record_from_cache( recnum );
+#ifdef HAVE_MMAP
+    if( !buf && db_map && (recnum + 1) * TRUST_RECORD_LEN <= db_map_len )
+	buf = db_map + recnum * TRUST_RECORD_LEN;
+#endif
     if( !buf ) {
 	if( lseek( db_fd, recnum * TRUST_RECORD_LEN, SEEK_SET ) == -1 ) {
             err = gpg_error_from_syserror ();
@@ -1233,6 +1545,10 @@ tdbio_read_record( ulong recnum, TRUSTREC *rec, int expected )
 	    return err;
 	}
 	buf = readbuf;
+	cache_record( recnum, buf, 0 );
+#ifdef HAVE_MMAP
+	update_db_map();
+#endif
     }
     rec->recnum = recnum;
     rec->dirty = 0;
@@ -1262,8 +1578,8 @@ tdbio_read_record( ulong recnum, TRUSTREC *rec, int expected )
 	p += 2;
 	rec->r.ver.created  = buf32_to_ulong(p); p += 4;
 	rec->r.ver.nextcheck = buf32_to_ulong(p); p += 4;
-	p += 4;
-	p += 4;
+	rec->r.ver.utkhash = buf32_to_ulong(p); p += 4;
+	rec->r.ver.nchanged = buf32_to_ulong(p); p += 4;
 	rec->r.ver.firstfree =buf32_to_ulong(p); p += 4;
 	p += 4;
 	rec->r.ver.trusthashtbl =buf32_to_ulong(p); p += 4;
@@ -1299,6 +1615,10 @@ tdbio_read_record( ulong recnum, TRUSTREC *rec, int expected )
         rec->r.trust.min_ownertrust = *p++;
         p++;
 	rec->r.trust.validlist = buf32_to_ulong(p); p += 4;
+        rec->r.trust.flags = *p++;
+        rec->r.trust.signer_depth = *p++;
+        rec->r.trust.trust_depth = *p++;
+        rec->r.trust.trust_value = *p++;
 	break;
       case RECTYPE_VALID:
 	memcpy( rec->r.valid.namehash, p, 20); p+=20;
@@ -1331,6 +1651,7 @@ tdbio_write_record( TRUSTREC *rec )
     if( db_fd == -1 )
 	open_db();
 
+    change_count++;
     memset(buf, 0, TRUST_RECORD_LEN);
     p = buf;
     *p++ = rec->rectype; p++;
@@ -1350,8 +1671,8 @@ tdbio_write_record( TRUSTREC *rec )
 	p += 2;
 	ulongtobuf(p, rec->r.ver.created); p += 4;
 	ulongtobuf(p, rec->r.ver.nextcheck); p += 4;
-	p += 4;
-	p += 4;
+	ulongtobuf(p, rec->r.ver.utkhash); p += 4;
+	ulongtobuf(p, rec->r.ver.nchanged); p += 4;
 	ulongtobuf(p, rec->r.ver.firstfree ); p += 4;
 	p += 4;
 	ulongtobuf(p, rec->r.ver.trusthashtbl ); p += 4;
@@ -1382,6 +1703,10 @@ tdbio_write_record( TRUSTREC *rec )
 	*p++ = rec->r.trust.min_ownertrust;
         p++;
 	ulongtobuf( p, rec->r.trust.validlist); p += 4;
+	*p++ = rec->r.trust.flags;
+	*p++ = rec->r.trust.signer_depth;
+	*p++ = rec->r.trust.trust_depth;
+	*p++ = rec->r.trust.trust_value;
 	break;
 
       case RECTYPE_VALID:
@@ -1439,6 +1764,15 @@ tdbio_delete_record( ulong recnum )
     return rc;
 }
 
+/****************
+ * Return a counter which changes whenever a record is written.
+ */
+unsigned int
+tdbio_change_count (void)
+{
+    return change_count;
+}
+
 /****************
  * create a new record and return its record number
  */
@@ -40,6 +40,10 @@
 #define RECTYPE_VALID 13
 #define RECTYPE_FREE 254
 
+/* Flags of a trust record.  */
+#define TRUST_RECFLAG_CHANGED 1  /* Key changed since the last check.  */
+#define TRUST_RECFLAG_REGEXP  2  /* It certified with a trust regexp.  */
+
 
 struct trust_record {
     int  rectype;
@@ -57,8 +61,8 @@ struct trust_record {
 	    byte  min_cert_level;
 	    ulong created;   /* timestamp of trustdb creation  */
 	    ulong nextcheck; /* timestamp of next scheduled check */
-	    ulong reserved;
-	    ulong reserved2;
+	    ulong utkhash;   /* hash of the UTKs of the last full check */
+	    ulong nchanged;  /* keys changed since the last check */
 	    ulong firstfree;
 	    ulong reserved3;
             ulong trusthashtbl;
@@ -79,6 +83,10 @@ struct trust_record {
         byte depth;
         ulong validlist;
 	byte min_ownertrust;
+        byte flags;          /* TRUST_RECFLAG_* */
+        byte signer_depth;   /* 1 + depth at which the key certified others */
+        byte trust_depth;    /* trust sig values it certified with */
+        byte trust_value;
       } trust;
       struct {
         byte namehash[20];
@@ -108,9 +116,11 @@ int tdbio_begin_transaction(void);
 int tdbio_end_transaction(void);
 int tdbio_cancel_transaction(void);
 int tdbio_delete_record( ulong recnum );
+unsigned int tdbio_change_count (void);
 ulong tdbio_new_recnum(void);
 int tdbio_search_trust_byfpr(const byte *fingerprint, TRUSTREC *rec );
 int tdbio_search_trust_bypk(PKT_public_key *pk, TRUSTREC *rec );
+int tdbio_split_hashlists (void);
 
 void tdbio_how_to_fix (void);
 void tdbio_invalid(void);
@@ -33,6 +33,7 @@
 #include "main.h"
 #include "i18n.h"
 #include "trustdb.h"
+#include "tdbio.h"
 #include "host2net.h"
 
 
@@ -50,6 +51,19 @@ cache_disabled_value (PKT_public_key *pk)
 }
 
 
+/* Return a counter which changes whenever the trust database is
+   changed by this process.  */
+unsigned int
+trust_change_count (void)
+{
+#ifdef NO_TRUST_MODELS
+  return 0;
+#else
+  return tdbio_change_count ();
+#endif
+}
+
+
 void
 register_trusted_keyid (u32 *keyid)
 {
@@ -274,6 +288,18 @@ revalidation_mark (void)
 }
 
 
+/* Same as revalidation_mark but only the key PK has been changed.  */
+void
+revalidation_mark_key (PKT_public_key *pk)
+{
+#ifndef NO_TRUST_MODELS
+  tdb_revalidation_mark_key (pk);
+#else
+  (void)pk;
+#endif
+}
+
+
 void
 check_trustdb_stale (void)
 {
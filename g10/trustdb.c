@@ -71,6 +71,7 @@ static struct key_item *utk_list;      /* all ultimately trusted keys */
 static int pending_check_trustdb;
 
 static int validate_keys (int interactive);
+static int read_trust_record (PKT_public_key *pk, TRUSTREC *rec);
 
 
 /**********************************************
@@ -472,6 +473,18 @@ init_trustdb ()
 }
 
 
+/* Return the number of keys flagged as changed since the last
+   check.  */
+static ulong
+changed_key_count (void)
+{
+  TRUSTREC vr;
+
+  read_record (0, &vr, RECTYPE_VER);
+  return vr.r.ver.nchanged;
+}
+
+
 /****************
  * Recreate the WoT but do not ask for new ownertrusts.  Special
  * feature: In batch mode and without a forced yes, this is only done
@@ -488,13 +501,13 @@ check_trustdb ()
 	  ulong scheduled;
 
 	  scheduled = tdbio_read_nextcheck ();
-	  if (!scheduled)
+	  if (!scheduled && !changed_key_count ())
 	    {
 	      log_info (_("no need for a trustdb check\n"));
 	      return;
 	    }
 
-	  if (scheduled > make_timestamp ())
+	  if (scheduled > make_timestamp () && !changed_key_count ())
 	    {
 	      log_info (_("next trustdb check due at %s\n"),
 			strtimestamp (scheduled));
@@ -502,6 +515,7 @@ check_trustdb ()
 	    }
 	}
 
+      tdbio_split_hashlists ();
       validate_keys (0);
     }
   else
@@ -518,7 +532,10 @@ update_trustdb()
 {
   init_trustdb();
   if(opt.trust_model==TM_PGP || opt.trust_model==TM_CLASSIC)
-    validate_keys (1);
+    {
+      tdbio_split_hashlists ();
+      validate_keys (1);
+    }
   else
     log_info (_("no need for a trustdb update with '%s' trust model\n"),
 	      trust_model_string());
@@ -538,6 +555,55 @@ tdb_revalidation_mark (void)
   pending_check_trustdb = 1;
 }
 
+/* Note that only the key PK has been changed.  Unless a full check
+   is already scheduled, the key is flagged in its trust record so
+   that the next check may be restricted to the changed keys.  PK
+   should be a primary key.  */
+void
+tdb_revalidation_mark_key (PKT_public_key *pk)
+{
+  TRUSTREC vr, rec;
+  int rc;
+
+  init_trustdb();
+  if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
+    return;
+
+  read_record (0, &vr, RECTYPE_VER);
+  if (vr.r.ver.nextcheck == 1)
+    {
+      pending_check_trustdb = 1;
+      return;  /* A full check is due anyway.  */
+    }
+
+  rc = read_trust_record (pk, &rec);
+  if (rc && rc != -1)
+    {
+      tdbio_invalid ();
+      return;
+    }
+  if (rc == -1) /* no record yet - create a new one */
+    {
+      size_t dummy;
+
+      memset (&rec, 0, sizeof rec);
+      rec.recnum = tdbio_new_recnum ();
+      rec.rectype = RECTYPE_TRUST;
+      fingerprint_from_pk (pk, rec.r.trust.fingerprint, &dummy);
+    }
+
+  if (rc == -1 || !(rec.r.trust.flags & TRUST_RECFLAG_CHANGED))
+    {
+      rec.r.trust.flags |= TRUST_RECFLAG_CHANGED;
+      write_record (&rec);
+      read_record (0, &vr, RECTYPE_VER);
+      vr.r.ver.nchanged++;
+      write_record (&vr);
+      do_sync ();
+    }
+  pending_check_trustdb = 1;
+}
+
 int
 trustdb_pending_check(void)
 {
@@ -688,7 +754,7 @@ tdb_update_ownertrust (PKT_public_key *pk, unsigned int new_trust )
         {
           rec.r.trust.ownertrust = new_trust;
           write_record( &rec );
-          tdb_revalidation_mark ();
+          tdb_revalidation_mark_key (pk);
           do_sync ();
         }
     }
@@ -705,7 +771,7 @@ tdb_update_ownertrust (PKT_public_key *pk, unsigned int new_trust )
       fingerprint_from_pk (pk, rec.r.trust.fingerprint, &dummy);
       rec.r.trust.ownertrust = new_trust;
       write_record (&rec);
-      tdb_revalidation_mark ();
+      tdb_revalidation_mark_key (pk);
       do_sync ();
       rc = 0;
     }
@@ -801,7 +867,7 @@ tdb_clear_ownertrusts (PKT_public_key *pk)
           rec.r.trust.ownertrust = 0;
           rec.r.trust.min_ownertrust = 0;
           write_record( &rec );
-          tdb_revalidation_mark ();
+          tdb_revalidation_mark_key (pk);
           do_sync ();
           return 1;
         }
@@ -933,7 +999,7 @@ tdb_check_trustdb_stale (void)
       did_nextcheck = 1;
       scheduled = tdbio_read_nextcheck ();
       if ((scheduled && scheduled <= make_timestamp ())
-	  || pending_check_trustdb)
+	  || pending_check_trustdb || changed_key_count ())
         {
           if (opt.no_auto_check_trustdb)
             {
@@ -1692,9 +1758,13 @@ reset_trust_records(void)
       if(rec.rectype==RECTYPE_TRUST)
 	{
 	  count++;
-	  if(rec.r.trust.min_ownertrust)
+	  if(rec.r.trust.min_ownertrust || rec.r.trust.flags
+	     || rec.r.trust.signer_depth)
 	    {
 	      rec.r.trust.min_ownertrust=0;
+	      rec.r.trust.flags=0;
+	      rec.r.trust.signer_depth=0;
+	      rec.r.trust.trust_depth=rec.r.trust.trust_value=0;
 	      write_record(&rec);
 	    }
 
@@ -1717,6 +1787,367 @@ reset_trust_records(void)
 	      count, nreset);
 }
 
+/* Return a hash of the ultimately trusted keys.  A full check stores
+   it in the version record; the signer information of the trust
+   records is only used if the set of UTKs did not change since.  */
+static ulong
+utk_list_hash (void)
+{
+  struct key_item *k;
+  ulong hash = 0;
+
+  for (k=utk_list; k; k = k->next)
+    hash += ((ulong)k->kid[0] * 0x9e3779b1UL) ^ k->kid[1];
+  hash &= 0xffffffff;
+  return hash? hash : 1;
+}
+
+
+/* Remember in the trust record of PK that the key is used to certify
+   other keys at DEPTH.  Caller must sync.  */
+static void
+store_signer_info (PKT_public_key *pk, int depth)
+{
+  TRUSTREC rec;
+
+  if (read_trust_record (pk, &rec))
+    return;
+  rec.r.trust.signer_depth = depth < 254? depth + 1 : 255;
+  rec.r.trust.trust_depth = pk->trust_depth;
+  rec.r.trust.trust_value = pk->trust_value;
+  if (pk->trust_regexp)
+    rec.r.trust.flags |= TRUST_RECFLAG_REGEXP;
+  write_record (&rec);
+}
+
+
+/* Clear the validity values stored for the key of the trust record
+   REC.  Caller must sync.  */
+static void
+clear_validity (TRUSTREC *rec)
+{
+  TRUSTREC vrec;
+  ulong recno;
+
+  for (recno = rec->r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+      if ((vrec.r.valid.validity & TRUST_MASK)
+          || vrec.r.valid.marginal_count || vrec.r.valid.full_count)
+        {
+          vrec.r.valid.validity &= ~TRUST_MASK;
+          vrec.r.valid.marginal_count = vrec.r.valid.full_count = 0;
+          write_record (&vrec);
+        }
+    }
+  if (rec->r.trust.min_ownertrust)
+    {
+      rec->r.trust.min_ownertrust = 0;
+      write_record (rec);
+    }
+}
+
+
+/* Read the keyblock with the fingerprint FPR and prepare it the way
+   validate_key_list does.  */
+static gpg_error_t
+read_changed_keyblock (KEYDB_HANDLE hd, const byte *fpr, KBNODE *r_keyblock)
+{
+  gpg_error_t err;
+
+  *r_keyblock = NULL;
+  err = keydb_search_reset (hd);
+  if (!err)
+    err = keydb_search_fpr (hd, fpr);
+  if (!err)
+    err = keydb_get_keyblock (hd, r_keyblock);
+  if (err)
+    return err;
+
+  if ((*r_keyblock)->pkt->pkttype != PKT_PUBLIC_KEY)
+    {
+      release_kbnode (*r_keyblock);
+      *r_keyblock = NULL;
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+  merge_keys_and_selfsig (*r_keyblock);
+  clear_kbnode_flags (*r_keyblock);
+  return 0;
+}
+
+
+/* Add the key KID to the list of the depth at which it certified
+   other keys during the last full check.  KLISTS has one list per
+   depth.  Returns -1 if the signer information does not suffice to
+   rebuild the key_item.  */
+static int
+add_changed_key_signer (struct key_item **klists, int *maxdepth, u32 *kid)
+{
+  struct key_item *k, *u;
+  PKT_public_key *pk;
+  TRUSTREC rec;
+  int depth, min, rc;
+
+  for (u=utk_list; u; u = u->next)
+    if (u->kid[0] == kid[0] && u->kid[1] == kid[1])
+      break;
+
+  if (u)
+    {
+      depth = 0;
+      k = new_key_item ();
+      *k = *u;
+      if (u->trust_regexp)
+        k->trust_regexp = xstrdup (u->trust_regexp);
+    }
+  else
+    {
+      pk = xmalloc_clear (sizeof *pk);
+      if (get_pubkey (pk, kid))
+        {
+          free_public_key (pk);
+          return 0;
+        }
+      rc = read_trust_record (pk, &rec);
+      if (rc && rc != -1)
+        tdbio_invalid ();
+      if (rc || !rec.r.trust.signer_depth
+          || rec.r.trust.signer_depth - 1 >= opt.max_cert_depth)
+        {
+          free_public_key (pk);
+          return 0;
+        }
+      if ((rec.r.trust.flags & TRUST_RECFLAG_REGEXP)
+          || rec.r.trust.signer_depth == 255)
+        {
+          free_public_key (pk);
+          return -1;
+        }
+
+      depth = rec.r.trust.signer_depth - 1;
+      k = new_key_item ();
+      k->kid[0] = kid[0];
+      k->kid[1] = kid[1];
+      k->ownertrust = tdb_get_ownertrust (pk) & TRUST_MASK;
+      k->min_ownertrust = tdb_get_min_ownertrust (pk);
+      k->trust_depth = rec.r.trust.trust_depth;
+      k->trust_value = rec.r.trust.trust_value;
+      free_public_key (pk);
+    }
+
+  /* Same as in validate_keys.  */
+  min = 0;
+  if (k->trust_value >= 120)
+    min = TRUST_FULLY;
+  else if (k->trust_value >= 60)
+    min = TRUST_MARGINAL;
+  if (k->ownertrust < min)
+    k->ownertrust = min;
+
+  k->next = klists[depth];
+  klists[depth] = k;
+  if (depth > *maxdepth)
+    *maxdepth = depth;
+  return 0;
+}
+
+
+/* Recompute the validity of the changed key with the trust record
+   REC.  Returns -1 if the key certified other keys during the last
+   full check or would do so now; only a full check can handle
+   this.  */
+static int
+validate_changed_key (KEYDB_HANDLE hd, TRUSTREC *rec, KeyHashTable stored,
+                      u32 curtime, u32 *next_expire)
+{
+  struct key_item **klists, *k;
+  KeyHashTable signers;
+  KBNODE keyblock = NULL;
+  KBNODE node;
+  PKT_public_key *pk;
+  PKT_signature *sig;
+  gpg_error_t err;
+  u32 kid[2];
+  int depth, maxdepth, rc = 0;
+
+  if (rec->r.trust.signer_depth)
+    return -1;
+
+  clear_validity (rec);
+
+  err = read_changed_keyblock (hd, rec->r.trust.fingerprint, &keyblock);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    return 0;  /* The key has been deleted.  */
+  if (err)
+    {
+      log_error ("reading changed key failed: %s\n", gpg_strerror (err));
+      return -1;
+    }
+
+  keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+  for (k=utk_list; k; k = k->next)
+    if (k->kid[0] == kid[0] && k->kid[1] == kid[1])
+      {
+        release_kbnode (keyblock);
+        return -1;
+      }
+
+  /* Collect the keys which certified other keys during the last full
+     check and have signed this key, by depth.  */
+  klists = xcalloc (opt.max_cert_depth, sizeof *klists);
+  signers = new_key_hash_table ();
+  maxdepth = 0;
+  for (node=keyblock; node && !rc; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if ((sig->keyid[0] == kid[0] && sig->keyid[1] == kid[1])
+          || test_key_hash_table (signers, sig->keyid))
+        continue;
+      add_key_hash_table (signers, sig->keyid);
+      rc = add_changed_key_signer (klists, &maxdepth, sig->keyid);
+    }
+  release_key_hash_table (signers);
+
+  /* Now do what the depth loop of validate_keys does with the key.  */
+  for (depth=0; depth <= maxdepth && !rc; depth++)
+    {
+      if (depth)
+        {
+          release_kbnode (keyblock);
+          err = read_changed_keyblock (hd, rec->r.trust.fingerprint,
+                                       &keyblock);
+          if (err)
+            {
+              rc = -1;
+              break;
+            }
+        }
+
+      pk = keyblock->pkt->pkt.public_key;
+      if (pk->has_expired || pk->flags.revoked)
+        break;
+      if (!validate_one_keyblock (keyblock, klists[depth],
+                                  curtime, next_expire))
+        continue;
+
+      if (pk->expiredate && pk->expiredate >= curtime
+          && pk->expiredate < *next_expire)
+        *next_expire = pk->expiredate;
+
+      for (node=keyblock; node; node = node->next)
+        if (node->pkt->pkttype == PKT_USER_ID && (node->flag & 4))
+          break;
+      if (node)
+        rc = -1;  /* Fully valid keys certify other keys.  */
+      else
+        store_validation_status (depth, keyblock, stored);
+    }
+
+  release_kbnode (keyblock);
+  for (depth=0; depth < opt.max_cert_depth; depth++)
+    release_key_items (klists[depth]);
+  xfree (klists);
+  return rc;
+}
+
+
+/*
+ * Bring the trustdb up to date by revalidating only the keys flagged
+ * as changed.
+ *
+ * A changed key which did not certify other keys during the last full
+ * check and which does not get full validity now cannot change the
+ * validity of any other key.  Its own validity depends only on the
+ * signatures of keys which certified at some depth during the last
+ * full check; validate_keys stores this depth in their trust records.
+ * Anything else, that is a changed UTK or certifying key, a changed
+ * key becoming fully valid, changed options or a due check, requires
+ * a full check.  Returns 0 if the trustdb is up to date or -1 if a
+ * full check is needed.
+ */
+static int
+validate_changed_keys (void)
+{
+  TRUSTREC vr, rec;
+  ulong recnum, *changed = NULL;
+  size_t nchanged = 0, maxchanged = 0, n;
+  KEYDB_HANDLE kdb;
+  KeyHashTable stored;
+  u32 start_time, next_expire;
+  ulong scheduled;
+  int rc = 0;
+
+  start_time = make_timestamp ();
+  read_record (0, &vr, RECTYPE_VER);
+  if (!vr.r.ver.nchanged
+      || (vr.r.ver.nextcheck && vr.r.ver.nextcheck <= start_time)
+      || !utk_list || vr.r.ver.utkhash != utk_list_hash ()
+      || !tdbio_db_matches_options ())
+    return -1;
+
+  for (recnum=1; !tdbio_read_record (recnum, &rec, 0); recnum++)
+    if (rec.rectype == RECTYPE_TRUST
+        && (rec.r.trust.flags & TRUST_RECFLAG_CHANGED))
+      {
+        if (nchanged == maxchanged)
+          {
+            maxchanged += 64;
+            changed = xrealloc (changed, maxchanged * sizeof *changed);
+          }
+        changed[nchanged++] = recnum;
+      }
+
+  next_expire = 0xffffffff; /* set next expire to the year 2106 */
+  stored = new_key_hash_table ();
+  kdb = keydb_new ();
+  if (tdbio_begin_transaction ())
+    tdbio_invalid ();
+  for (n=0; n < nchanged && !rc; n++)
+    {
+      read_record (changed[n], &rec, RECTYPE_TRUST);
+      rc = validate_changed_key (kdb, &rec, stored, start_time, &next_expire);
+      if (!rc)
+        {
+          read_record (changed[n], &rec, RECTYPE_TRUST);
+          rec.r.trust.flags &= ~TRUST_RECFLAG_CHANGED;
+          write_record (&rec);
+        }
+    }
+  keydb_release (kdb);
+  release_key_hash_table (stored);
+  xfree (changed);
+  if (rc)
+    {
+      if (tdbio_end_transaction ())
+        tdbio_invalid ();
+      if (opt.verbose)
+        log_info (_("changed keys affect other keys;"
+                    " doing a full trustdb check\n"));
+      return -1;
+    }
+
+  scheduled = vr.r.ver.nextcheck;
+  if (next_expire != 0xffffffff && next_expire >= start_time
+      && (!scheduled || next_expire < scheduled))
+    scheduled = next_expire;
+  tdbio_write_nextcheck (scheduled);
+  read_record (0, &vr, RECTYPE_VER);
+  vr.r.ver.nchanged = 0;
+  write_record (&vr);
+  if (tdbio_end_transaction ())
+    tdbio_invalid ();
+
+  if (opt.verbose)
+    log_info (_("%lu changed keys revalidated\n"), (ulong)nchanged);
+  if (scheduled)
+    log_info (_("next trustdb check due at %s\n"), strtimestamp (scheduled));
+  pending_check_trustdb = 0;
+  return 0;
+}
+
+
 /*
  * Run the key validation procedure.
  *
@@ -1756,6 +2187,25 @@ validate_keys (int interactive)
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable stored,used,full_trust;
   u32 start_time, next_expire;
+  TRUSTREC vr;
+
+  /* Try to get along with revalidating the changed keys first.  */
+  if (!interactive && !validate_changed_keys ())
+    return 0;
+
+  /* The signer information in the trust records is rebuilt below;
+     until that has been done it must not be used.  */
+  read_record (0, &vr, RECTYPE_VER);
+  if (vr.r.ver.utkhash)
+    {
+      vr.r.ver.utkhash = 0;
+      write_record (&vr);
+      do_sync ();
+    }
+
+  /* Write the trust records in one go when done.  */
+  if (tdbio_begin_transaction ())
+    tdbio_invalid ();
 
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectual re-thinking, as it is agonizingly slow.
@@ -1945,6 +2395,8 @@ validate_keys (int interactive)
 				   pkt.public_key->trust_regexp);
 		      k->next = klist;
 		      klist = k;
+		      store_signer_info (kar->keyblock->pkt->pkt.public_key,
+					 depth+1);
 		      break;
 		    }
 		}
@@ -1974,6 +2426,11 @@ validate_keys (int interactive)
                     strtimestamp (next_expire));
         }
 
+      read_record (0, &vr, RECTYPE_VER);
+      vr.r.ver.utkhash = utk_list? utk_list_hash () : 0;
+      vr.r.ver.nchanged = 0;
+      write_record (&vr);
+
       if(tdbio_update_version_record()!=0)
 	{
 	  log_error(_("unable to update trustdb version record: "
@@ -1981,9 +2438,10 @@ validate_keys (int interactive)
 	  tdbio_invalid();
 	}
 
-      do_sync ();
       pending_check_trustdb = 0;
     }
+  if (tdbio_end_transaction ())
+    tdbio_invalid ();
 
   return rc;
 }
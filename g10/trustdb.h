@@ -71,6 +71,7 @@ is_in_klist (struct key_item *k, PKT_signature *sig)
 
 /*-- trust.c --*/
 int cache_disabled_value (PKT_public_key *pk);
+unsigned int trust_change_count (void);
 void register_trusted_keyid (u32 *keyid);
 void register_trusted_key (const char *string);
 
@@ -83,6 +84,7 @@ void update_ownertrust (PKT_public_key *pk, unsigned int new_trust);
 int clear_ownertrusts (PKT_public_key *pk);
 
 void revalidation_mark (void);
+void revalidation_mark_key (PKT_public_key *pk);
 void check_trustdb_stale (void);
 void check_or_update_trustdb (void);
 
@@ -114,6 +116,7 @@ void tdb_check_trustdb_stale (void);
 void sync_trustdb( void );
 
 void tdb_revalidation_mark (void);
+void tdb_revalidation_mark_key (PKT_public_key *pk);
 int trustdb_pending_check(void);
 void tdb_check_or_update (void);
 
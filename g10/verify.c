@@ -222,6 +222,260 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
 
 
 
+/* The number of signature and data file pairs which are hashed
+   together by verify_detached_files.  */
+#define VERIFY_FILES_BATCH 64
+
+/* A detached signature and its data file.  */
+struct verify_files_item_s
+{
+  char *sigfile;
+  char *datafile;
+  IOBUF inp;            /* The data file while it is being hashed.  */
+  gcry_md_hd_t hash;    /* The hash over the data file or NULL.  */
+};
+
+
+/* Open the signature file SIGFILE and push an armor filter if
+   required.  The armor context is stored at R_AFX.  Returns NULL on
+   error.  */
+static IOBUF
+open_detached_sig (const char *sigfile, armor_filter_context_t **r_afx)
+{
+  IOBUF fp;
+
+  *r_afx = NULL;
+  fp = iobuf_open (sigfile);
+  if (fp && is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      fp = NULL;
+      gpg_err_set_errno (EPERM);
+    }
+  if (!fp)
+    {
+      log_error (_("can't open '%s': %s\n"),
+                 print_fname_stdin (sigfile), strerror (errno));
+      return NULL;
+    }
+  if (!opt.no_armor && use_armor_filter (fp))
+    {
+      *r_afx = new_armor_context ();
+      push_armor_filter (*r_afx, fp);
+    }
+  return fp;
+}
+
+
+/* Open the data file of ITEM for hashing it in advance.  This is
+   only done if the signature file holds nothing but binary
+   signatures; their digest algorithms are enabled in the new hash
+   context.  For everything else the data is hashed as usual while
+   the signature is checked.  */
+static void
+verify_files_open (struct verify_files_item_s *item)
+{
+  armor_filter_context_t *afx;
+  IOBUF fp, inp;
+  PACKET pkt;
+  gcry_md_hd_t md;
+  int rc, nsigs = 0;
+
+  fp = open_detached_sig (item->sigfile, &afx);
+  if (!fp)
+    return;
+
+  if (gcry_md_open (&md, 0, 0))
+    BUG ();
+  init_packet (&pkt);
+  while ((rc = parse_packet (fp, &pkt)) != -1)
+    {
+      if (rc || pkt.pkttype != PKT_SIGNATURE
+          || pkt.pkt.signature->sig_class != 0x00)
+        {
+          free_packet (&pkt);
+          nsigs = 0;
+          break;
+        }
+      gcry_md_enable (md, pkt.pkt.signature->digest_algo);
+      nsigs++;
+      free_packet (&pkt);
+    }
+  iobuf_close (fp);
+  release_armor_context (afx);
+  if (!nsigs)
+    {
+      gcry_md_close (md);
+      return;
+    }
+
+  inp = iobuf_open_mmap (item->datafile);
+  if (inp && is_secured_file (iobuf_get_fd (inp)))
+    {
+      iobuf_close (inp);
+      inp = NULL;
+    }
+  if (!inp)
+    {
+      /* The error is reported when the signature is checked.  */
+      gcry_md_close (md);
+      return;
+    }
+  if (DBG_HASHING)
+    gcry_md_debug (md, "verify");
+  item->inp = inp;
+  item->hash = md;
+}
+
+
+/* Close the data file of ITEM.  On a read error the hash is dropped,
+   so that the file is read again when checking the signature.  */
+static void
+verify_files_close (struct verify_files_item_s *item)
+{
+  if (iobuf_error (item->inp))
+    {
+      gcry_md_close (item->hash);
+      item->hash = NULL;
+    }
+  iobuf_close (item->inp);
+  item->inp = NULL;
+}
+
+
+/* Check the detached signature of ITEM using its hash if there is
+   one.  */
+static int
+verify_files_check (ctrl_t ctrl, struct verify_files_item_s *item)
+{
+  armor_filter_context_t *afx;
+  IOBUF fp;
+  strlist_t sl = NULL;
+  int rc;
+
+  print_file_status (STATUS_FILE_START, item->sigfile, 1);
+  fp = open_detached_sig (item->sigfile, &afx);
+  if (!fp)
+    {
+      rc = gpg_error_from_syserror ();
+      print_file_status (STATUS_FILE_ERROR, item->sigfile, 1);
+      return rc;
+    }
+
+  add_to_strlist (&sl, item->datafile);
+  rc = proc_signature_packets_prehashed (ctrl, NULL, fp, sl, item->hash,
+                                         item->sigfile);
+  free_strlist (sl);
+  iobuf_close (fp);
+  release_armor_context (afx);
+  write_status (STATUS_FILE_DONE);
+  return rc;
+}
+
+
+/* Verify the NITEMS pairs at ITEMS.  The data files are hashed by
+   several threads first; the signatures are then checked in the
+   order of ITEMS.  */
+static void
+verify_files_batch (ctrl_t ctrl, struct verify_files_item_s *items,
+                    int nitems)
+{
+  struct datafile_hash_s jobs[VERIFY_FILES_BATCH];
+  int i;
+
+  for (i=0; i < nitems; i++)
+    {
+      verify_files_open (&items[i]);
+      jobs[i].inp = items[i].inp;
+      jobs[i].md = items[i].hash;
+    }
+  hash_datafiles_parallel (jobs, nitems, sig_queue_threads ());
+  for (i=0; i < nitems; i++)
+    {
+      if (items[i].inp)
+        verify_files_close (&items[i]);
+      verify_files_check (ctrl, &items[i]);
+      gcry_md_close (items[i].hash);
+      xfree (items[i].sigfile);
+      xfree (items[i].datafile);
+    }
+  memset (items, 0, nitems * sizeof *items);
+}
+
+
+/****************
+ * Verify detached signatures.  FILES holds NFILES names, each
+ * detached signature followed by its data file.  If NFILES is 0 the
+ * pairs are read from stdin, one per line with the names separated
+ * by a TAB.  The data files are hashed on several threads; the
+ * status lines are written in the order of the pairs.
+ */
+int
+verify_detached_files (ctrl_t ctrl, int nfiles, char **files)
+{
+  struct verify_files_item_s *items;
+  int nitems = 0;
+  char line[4096];
+  unsigned int lno = 0;
+  int use_stdin = !nfiles;
+  char *p;
+  int rc = 0;
+
+  if ((nfiles % 2))
+    {
+      log_error (_("each signature file needs a data file\n"));
+      return gpg_error (GPG_ERR_INV_ARG);
+    }
+
+  items = xcalloc (VERIFY_FILES_BATCH, sizeof *items);
+  for (;;)
+    {
+      if (nfiles)
+        {
+          items[nitems].sigfile = xstrdup (files[0]);
+          items[nitems].datafile = xstrdup (files[1]);
+          files += 2;
+          nfiles -= 2;
+        }
+      else if (use_stdin && fgets (line, DIM(line), stdin))
+        {
+          lno++;
+          if (!*line || line[strlen(line)-1] != '\n')
+            {
+              log_error (_("input line %u too long or missing LF\n"), lno);
+              rc = gpg_error (GPG_ERR_GENERAL);
+              break;
+            }
+          line[strlen(line)-1] = 0;
+          p = strchr (line, '\t');
+          if (!p || p == line || !p[1])
+            {
+              log_error (_("input line %u: not a signature and a data"
+                           " file\n"), lno);
+              rc = gpg_error (GPG_ERR_GENERAL);
+              break;
+            }
+          *p++ = 0;
+          items[nitems].sigfile = xstrdup (line);
+          items[nitems].datafile = xstrdup (p);
+        }
+      else
+        break;
+
+      if (++nitems == VERIFY_FILES_BATCH)
+        {
+          verify_files_batch (ctrl, items, nitems);
+          nitems = 0;
+        }
+    }
+  if (nitems)
+    verify_files_batch (ctrl, items, nitems);
+
+  xfree (items);
+  return rc;
+}
+
+
 
 /* Perform a verify operation.  To verify detached signatures, DATA_FD
    shall be the descriptor of the signed data; for regular signatures
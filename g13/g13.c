@@ -724,13 +724,22 @@ main ( int argc, char **argv)
 
     case aMount: /* Mount a container. */
       {
-        if (argc != 1 && argc != 2 )
-          wrong_args ("--mount filename [mountpoint]");
+        /* More than one pair of a filename and a mountpoint mounts
+           all of these containers at the same time.  */
+        if (argc < 1 || (argc > 2 && (argc % 2)))
+          wrong_args ("--mount filename [mountpoint]"
+                      " | --mount {filename mountpoint}");
         start_idle_task ();
-        err = g13_mount_container (&ctrl, argv[0], argc == 2?argv[1]:NULL);
-        if (err)
-          log_error ("error mounting container '%s': %s <%s>\n",
-                     *argv, gpg_strerror (err), gpg_strsource (err));
+        if (argc > 2)
+          err = g13_mount_containers (&ctrl, argv, argc / 2);
+        else
+          {
+            err = g13_mount_container (&ctrl, argv[0],
+                                       argc == 2? argv[1]:NULL);
+            if (err)
+              log_error ("error mounting container '%s': %s <%s>\n",
+                         *argv, gpg_strerror (err), gpg_strsource (err));
+          }
       }
       break;
 
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <npth.h>
 
 #include "g13.h"
 #include "i18n.h"
@@ -40,6 +41,29 @@
 #include "host2net.h"
 
 
+/* The largest number of containers mounted at the same time.  */
+#define MAX_MOUNT_THREADS 8
+
+
+/* One container to mount for g13_mount_containers.  */
+struct mount_job_s
+{
+  const char *filename;
+  const char *mountpoint;
+};
+
+/* The containers shared by the mount threads.  */
+struct mount_pool_s
+{
+  ctrl_t ctrl;
+  npth_mutex_t lock;
+  struct mount_job_s *jobs;
+  int njobs;
+  int next;          /* The next job to take.  */
+  gpg_error_t err;   /* The first error.  */
+};
+
+
 /* Parse the header prefix and return the length of the entire header.  */
 static gpg_error_t
 parse_header (const char *filename,
@@ -365,6 +389,84 @@ g13_mount_container (ctrl_t ctrl, const char *filename, const char *mountpoint)
 }
 
 
+static void *
+mount_thread (void *arg)
+{
+  struct mount_pool_s *pool = arg;
+  struct mount_job_s *job;
+  gpg_error_t err;
+
+  npth_mutex_lock (&pool->lock);
+  while (pool->next < pool->njobs)
+    {
+      job = pool->jobs + pool->next++;
+      npth_mutex_unlock (&pool->lock);
+      err = g13_mount_container (pool->ctrl, job->filename, job->mountpoint);
+      if (err)
+        log_error ("error mounting container '%s': %s <%s>\n",
+                   job->filename, gpg_strerror (err), gpg_strsource (err));
+      npth_mutex_lock (&pool->lock);
+      if (err && !pool->err)
+        pool->err = err;
+    }
+  npth_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+
+/* Mount COUNT containers at once.  NAMES has the filename and the
+   mountpoint of each container in turn.  Most of the time of a mount
+   is spent waiting for gpg to decrypt the keyblob and for the backend
+   to start; thus they are mounted by several threads.  An error is
+   logged for each container which could not be mounted and the first
+   one is returned.  */
+gpg_error_t
+g13_mount_containers (ctrl_t ctrl, char **names, int count)
+{
+  struct mount_pool_s pool;
+  npth_t threads[MAX_MOUNT_THREADS];
+  int i, n, nthreads, ret;
+
+  memset (&pool, 0, sizeof pool);
+  pool.jobs = xtrycalloc (count, sizeof *pool.jobs);
+  if (!pool.jobs)
+    return gpg_error_from_syserror ();
+  for (i=0; i < count; i++)
+    {
+      pool.jobs[i].filename = names[2*i];
+      pool.jobs[i].mountpoint = names[2*i+1];
+    }
+  pool.ctrl = ctrl;
+  pool.njobs = count;
+
+  ret = npth_mutex_init (&pool.lock, NULL);
+  if (ret)
+    {
+      xfree (pool.jobs);
+      return gpg_error_from_errno (ret);
+    }
+
+  nthreads = count < MAX_MOUNT_THREADS? count : MAX_MOUNT_THREADS;
+  for (n=0; n < nthreads - 1; n++)
+    {
+      ret = npth_create (&threads[n], NULL, mount_thread, &pool);
+      if (ret)
+        {
+          log_error ("error spawning mount thread: %s\n", strerror (ret));
+          break;
+        }
+      npth_setname_np (threads[n], "mounter");
+    }
+  mount_thread (&pool);
+  for (i=0; i < n; i++)
+    npth_join (threads[i], NULL);
+
+  npth_mutex_destroy (&pool.lock);
+  xfree (pool.jobs);
+  return pool.err;
+}
+
+
 /* Unmount the container with name FILENAME or the one mounted at
    MOUNTPOINT.  If both are given the FILENAME takes precedence.  */
 gpg_error_t
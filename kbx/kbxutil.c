@@ -33,6 +33,7 @@
 #include "../common/argparse.h"
 #include "../common/stringhelp.h"
 #include "../common/utf8conv.h"
+#include "../common/dotlock.h"
 #include "i18n.h"
 #include "keybox-defs.h"
 #include "../common/init.h"
@@ -55,6 +56,7 @@ enum cmd_and_opt_values {
   aImportOpenPGP,
   aFindDups,
   aCut,
+  aCompact,
 
   oDebug,
   oDebugAll,
@@ -77,6 +79,7 @@ static ARGPARSE_OPTS opts[] = {
   { aImportOpenPGP, "import-openpgp", 0, "import OpenPGP keyblocks"},
   { aFindDups,    "find-dups",   0, "find duplicates" },
   { aCut,         "cut",         0, "export records" },
+  { aCompact,     "compact",     0, "compact and sort the keybox" },
 
   { 301, NULL, 0, N_("@\nOptions:\n ") },
 
@@ -442,6 +445,62 @@ import_openpgp (const char *filename, int dryrun)
 
 
 
+/* Rewrite the keybox FILENAME with only its live blobs, sorted by
+   fingerprint.  */
+static void
+compact_keybox (const char *filename, int dryrun)
+{
+  gpg_error_t err;
+  dotlock_t lockhd;
+  void *token;
+  KEYBOX_HANDLE hd;
+  struct stat st;
+  unsigned long nblobs;
+  off_t oldsize;
+
+  if (stat (filename, &st))
+    {
+      log_error ("can't stat '%s': %s\n", filename, strerror (errno));
+      return;
+    }
+  oldsize = st.st_size;
+  if (dryrun)
+    {
+      printf ("%s: %lu bytes\n", filename, (unsigned long)oldsize);
+      return;
+    }
+
+  /* Use the same lock as gpg and gpgsm.  */
+  lockhd = dotlock_create (filename, 0);
+  if (!lockhd || dotlock_take (lockhd, -1))
+    {
+      log_error ("can't lock '%s'\n", filename);
+      dotlock_destroy (lockhd);
+      return;
+    }
+
+  /* An X.509 handle does not touch the OpenPGP flag of the header.  */
+  token = keybox_register_file (filename, 0);
+  hd = token? keybox_new_x509 (token, 0) : NULL;
+  if (!hd)
+    err = gpg_error (GPG_ERR_GENERAL);
+  else
+    err = keybox_compact (hd, &nblobs);
+  keybox_release (hd);
+  dotlock_release (lockhd);
+  dotlock_destroy (lockhd);
+
+  if (err)
+    log_error ("%s: compacting failed: %s\n", filename, gpg_strerror (err));
+  else if (stat (filename, &st))
+    log_error ("can't stat '%s': %s\n", filename, strerror (errno));
+  else
+    printf ("%s: %lu blobs, %lu bytes (was %lu)\n", filename, nblobs,
+            (unsigned long)st.st_size, (unsigned long)oldsize);
+}
+
+
+
 
 int
 main( int argc, char **argv )
@@ -502,6 +561,7 @@ main( int argc, char **argv )
         case aImportOpenPGP:
         case aFindDups:
         case aCut:
+        case aCompact:
           cmd = pargs.r_opt;
           break;
 
@@ -573,6 +633,13 @@ main( int argc, char **argv )
             import_openpgp (*argv, dry_run);
         }
     }
+  else if (cmd == aCompact)
+    {
+      if (!argc)
+        log_error ("no keybox given\n");
+      for (; argc; argc--, argv++)
+        compact_keybox (*argv, dry_run);
+    }
 #if 0
   else if ( cmd == aFindByFpr )
     {
@@ -46,11 +46,14 @@
           bit 0 - RFU
           bit 1 - Is being or has been used for OpenPGP blobs
    - b4   Magic 'KBXf'
-   - u32  RFU
+   - u32  Generation counter; incremented by each change of the
+          file's blobs or their offsets (see keybox-index.c)
    - u32  file_created_at
    - u32  last_maintenance_run
-   - u32  RFU
-   - u32  RFU
+   - u32  Number of bytes taken by blobs flagged as deleted since the
+          last maintenance run
+   - u32  Length of the file after the last update, modulo 2^32.  A
+          mismatch reveals a torn append (see keybox-update.c).
 
 ** The OpenPGP and X.509 blobs
 
@@ -79,6 +82,8 @@
       - u16  Key flags
              bit 0 = qualified signature (not yet implemented}
       - u16  RFU
+      - b20  [OpenPGP only, if the size is at least 48] The keygrip of
+             the key or all zeroes if not known.
       - bN   Optional filler up to the specified length of this
              structure.
    - u16  Size of the serial number (may be zero)
@@ -179,6 +184,7 @@ struct keyboxblob_key {
   u32    off_kid;
   ulong  off_kid_addr;
   u16    flags;
+  char   grip[20];  /* All zeroes if not known.  */
 };
 struct keyboxblob_uid {
   u32    off;
@@ -206,6 +212,7 @@ struct keyboxblob {
   byte *blob;
   size_t bloblen;
   off_t fileoffset;
+  keybox_map_t map;  /* If set BLOB points into this mapping.  */
 
   /* stuff used only by keybox_create_blob */
   unsigned char *serialbuf;
@@ -393,6 +400,10 @@ pgp_create_key_part_single (KEYBOXBLOB blob, int n,
   else
     blob->keys[n].off_kid = 0; /* Will be fixed up later */
   blob->keys[n].flags = 0;
+  if (kinfo->have_grip)
+    memcpy (blob->keys[n].grip, kinfo->grip, 20);
+  else
+    memset (blob->keys[n].grip, 0, 20);
   return 0;
 }
 
@@ -547,7 +558,10 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral)
   put32 ( a, 0 ); /* length of the raw data, needs fixup */
 
   put16 ( a, blob->nkeys );
-  put16 ( a, 20 + 4 + 2 + 2 );  /* size of key info */
+  if (blobtype == KEYBOX_BLOBTYPE_PGP)
+    put16 ( a, 20 + 4 + 2 + 2 + 20 );  /* size of key info */
+  else
+    put16 ( a, 20 + 4 + 2 + 2 );  /* size of key info */
   for ( i=0; i < blob->nkeys; i++ )
     {
       put_membuf (a, blob->keys[i].fpr, 20);
@@ -555,6 +569,8 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral)
       put32 ( a, 0 ); /* offset to keyid, fixed up later */
       put16 ( a, blob->keys[i].flags );
       put16 ( a, 0 ); /* reserved */
+      if (blobtype == KEYBOX_BLOBTYPE_PGP)
+        put_membuf (a, blob->keys[i].grip, 20);
     }
 
   put16 (a, blob->seriallen); /*fixme: check that it fits into 16 bits*/
@@ -994,6 +1010,45 @@ _keybox_new_blob (KEYBOXBLOB *r_blob,
 }
 
 
+/* Create a blob for the IMAGELEN bytes at IMAGE inside of MAP.  The
+   blob takes a reference to MAP.  */
+int
+_keybox_new_mapped_blob (KEYBOXBLOB *r_blob, keybox_map_t map,
+                         const unsigned char *image, size_t imagelen,
+                         off_t off)
+{
+  KEYBOXBLOB blob;
+
+  *r_blob = NULL;
+  blob = xtrycalloc (1, sizeof *blob);
+  if (!blob)
+    return gpg_error_from_syserror ();
+
+  blob->blob = (byte *)image;
+  blob->bloblen = imagelen;
+  blob->fileoffset = off;
+  blob->map = map;
+  _keybox_map_ref (map);
+  *r_blob = blob;
+  return 0;
+}
+
+
+/* Make the mapped BLOB describe the IMAGELEN bytes at IMAGE of its
+   mapping instead.  A parallel scan uses this to look at the blobs
+   of a range without allocating memory or touching the reference
+   count of the mapping.  */
+void
+_keybox_set_blob_image (KEYBOXBLOB blob, const unsigned char *image,
+                        size_t imagelen, off_t off)
+{
+  assert (blob->map);
+  blob->blob = (byte *)image;
+  blob->bloblen = imagelen;
+  blob->fileoffset = off;
+}
+
+
 void
 _keybox_release_blob (KEYBOXBLOB blob)
 {
@@ -1007,7 +1062,10 @@ _keybox_release_blob (KEYBOXBLOB blob)
     xfree (blob->uids[i].name);
   xfree (blob->uids );
   xfree (blob->sigs );
-  xfree (blob->blob );
+  if (blob->map)
+    _keybox_map_unref (blob->map);
+  else
+    xfree (blob->blob );
   xfree (blob );
 }
 
@@ -1026,6 +1084,14 @@ _keybox_get_blob_fileoffset (KEYBOXBLOB blob)
   return blob->fileoffset;
 }
 
+/* Return the mapping the image of BLOB lives in or NULL if it has
+   been read into memory.  */
+keybox_map_t
+_keybox_get_blob_map (KEYBOXBLOB blob)
+{
+  return blob->map;
+}
+
 
 
 void
@@ -1041,6 +1107,17 @@ _keybox_update_header_blob (KEYBOXBLOB blob, int for_openpgp)
       blob->blob[20+2] = (val >>  8);
       blob->blob[20+3] = (val      );
 
+      /* The blobs are about to be moved; bump the generation.  */
+      val = (((u32)blob->blob[12] << 24) | (blob->blob[12+1] << 16)
+             | (blob->blob[12+2] << 8) | blob->blob[12+3]) + 1;
+      blob->blob[12]   = (val >> 24);
+      blob->blob[12+1] = (val >> 16);
+      blob->blob[12+2] = (val >>  8);
+      blob->blob[12+3] = (val      );
+
+      /* The deleted blobs are not copied.  */
+      memset (blob->blob+24, 0, 4);
+
       if (for_openpgp)
         blob->blob[7] |= 0x02;  /* OpenPGP data may be available.  */
     }
@@ -28,6 +28,7 @@
 # define GPG_ERR_SOURCE_DEFAULT  GPG_ERR_SOURCE_KEYBOX
 #endif
 #include <gpg-error.h>
+#include <gcrypt.h>
 #define map_assuan_err(a) \
         map_assuan_err_with_source (GPG_ERR_SOURCE_DEFAULT, (a))
 
@@ -44,8 +45,18 @@
 #include "keybox.h"
 
 
+/* The maximum length of a blob we are willing to read.  */
+#define IMAGELEN_LIMIT (5*1024*1024)
+
+
 typedef struct keyboxblob *KEYBOXBLOB;
 
+typedef struct keybox_index_s *keybox_index_t;
+
+typedef struct keybox_map_s *keybox_map_t;
+
+typedef struct keybox_scan_s *keybox_scan_t;
+
 
 typedef struct keybox_name *KB_NAME;
 typedef struct keybox_name const *CONST_KB_NAME;
@@ -100,44 +111,16 @@ struct keybox_handle {
     char *name;
     char *pattern;
   } word_match;
+  keybox_index_t index;   /* The index of the open file or NULL.  */
+  int no_index;           /* Don't try to open or build an index.  */
+  int use_mmap;           /* Read blobs from a mapping of FP.  */
+  keybox_map_t map;       /* The current mapping of FP or NULL.  */
+  keybox_parallel_t parallel;  /* Runs a parallel scan or NULL.  */
+  unsigned int parallel_threads;
+  keybox_scan_t scan;     /* Results of a parallel scan or NULL.  */
 };
 
 
-/* Openpgp helper structures. */
-struct _keybox_openpgp_key_info
-{
-  struct _keybox_openpgp_key_info *next;
-  int algo;
-  unsigned char keyid[8];
-  int fprlen;  /* Either 16 or 20 */
-  unsigned char fpr[20];
-};
-
-struct _keybox_openpgp_uid_info
-{
-  struct _keybox_openpgp_uid_info *next;
-  size_t off;
-  size_t len;
-};
-
-struct _keybox_openpgp_info
-{
-  int is_secret;        /* True if this is a secret key. */
-  unsigned int nsubkeys;/* Total number of subkeys.  */
-  unsigned int nuids;   /* Total number of user IDs in the keyblock. */
-  unsigned int nsigs;   /* Total number of signatures in the keyblock. */
-
-  /* Note, we use 2 structs here to better cope with the most common
-     use of having one primary and one subkey - this allows us to
-     statically allocate this structure and only malloc stuff for more
-     than one subkey. */
-  struct _keybox_openpgp_key_info primary;
-  struct _keybox_openpgp_key_info subkeys;
-  struct _keybox_openpgp_uid_info uids;
-};
-typedef struct _keybox_openpgp_info *keybox_openpgp_info_t;
-
-
 /* Don't know whether this is needed: */
 /*  static struct { */
 /*    const char *homedir; */
@@ -166,6 +149,12 @@ int _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
 int  _keybox_new_blob (KEYBOXBLOB *r_blob,
                        unsigned char *image, size_t imagelen,
                        off_t off);
+int  _keybox_new_mapped_blob (KEYBOXBLOB *r_blob, keybox_map_t map,
+                              const unsigned char *image, size_t imagelen,
+                              off_t off);
+keybox_map_t _keybox_get_blob_map (KEYBOXBLOB blob);
+void _keybox_set_blob_image (KEYBOXBLOB blob, const unsigned char *image,
+                             size_t imagelen, off_t off);
 void _keybox_release_blob (KEYBOXBLOB blob);
 const unsigned char *_keybox_get_blob_image (KEYBOXBLOB blob, size_t *n);
 off_t _keybox_get_blob_fileoffset (KEYBOXBLOB blob);
@@ -182,12 +171,59 @@ void _keybox_destroy_openpgp_info (keybox_openpgp_info_t info);
 int _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp);
 int _keybox_read_blob2 (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted);
 int _keybox_write_blob (KEYBOXBLOB blob, FILE *fp);
+gpg_error_t _keybox_read_generation (FILE *fp, u32 *r_generation,
+                                     off_t *r_size);
+int _keybox_read_blob_hd (KEYBOX_HANDLE hd, KEYBOXBLOB *r_blob);
+void _keybox_map_ref (keybox_map_t map);
+void _keybox_map_unref (keybox_map_t map);
+keybox_map_t _keybox_map_file (KEYBOX_HANDLE hd,
+                               const unsigned char **r_image,
+                               size_t *r_length);
+
+/*-- keybox-search.c --*/
+void _keybox_release_scan (KEYBOX_HANDLE hd);
+
+/*-- keybox-index.c --*/
+/* Types of the keys in an index.  */
+#define KEYBOX_INDEX_FPR      1
+#define KEYBOX_INDEX_LONGKID  2
+#define KEYBOX_INDEX_KEYGRIP  3
+#define KEYBOX_INDEX_MAIL     4
+#define KEYBOX_INDEX_ISSUER   5
+#define KEYBOX_INDEX_ISSUER_SN 6
+#define KEYBOX_INDEX_SUBJECT  7
+
+gpg_error_t _keybox_index_make_key (unsigned char *key, int type,
+                                    const void *value, size_t valuelen);
+gpg_error_t _keybox_index_make_issuer_sn_key (unsigned char *key,
+                                              const void *issuer,
+                                              size_t issuerlen,
+                                              const unsigned char *sn,
+                                              size_t snlen);
+gpg_error_t _keybox_index_open (keybox_index_t *r_index, const char *fname,
+                                u32 generation, off_t size);
+gpg_error_t _keybox_index_build (keybox_index_t *r_index, const char *fname,
+                                 u32 generation, off_t size);
+void _keybox_index_release (keybox_index_t index);
+int _keybox_index_find (keybox_index_t index, int type,
+                        const unsigned char *key, off_t start, off_t *r_off);
+void _keybox_index_update (const char *fname, u32 generation, off_t size,
+                           off_t off, off_t oldlen, KEYBOXBLOB blob);
+void _keybox_index_append (const char *fname, u32 generation, off_t size,
+                           KEYBOXBLOB *blobs, int nblobs);
+void _keybox_index_remove (const char *fname);
 
 /*-- keybox-search.c --*/
 gpg_err_code_t _keybox_get_flag_location (const unsigned char *buffer,
                                           size_t length,
                                           int what,
                                           size_t *flag_off, size_t *flag_size);
+int _keybox_extract_mailbox (const unsigned char *uid, size_t uidlen, int x509,
+                             size_t *r_off, size_t *r_len);
+#ifdef KEYBOX_WITH_X509
+gpg_error_t _keybox_get_x509_keygrip (const unsigned char *buffer,
+                                      size_t length, unsigned char *grip);
+#endif /*KEYBOX_WITH_X509*/
 
 static inline int
 blob_get_type (KEYBOXBLOB blob)
@@ -223,6 +259,12 @@ void  _keybox_free (void *p);
 #define xfree(a)         _keybox_free ((a))
 
 
+/*-- ../common/openpgp-oid.c --*/
+/* We can't include ../common/util.h; this must match the prototype
+   there.  */
+char *openpgp_oid_to_str (gcry_mpi_t a);
+
+
 #define DIM(v) (sizeof(v)/sizeof((v)[0]))
 #define DIMof(type,member)   DIM(((type *)0)->member)
 #ifndef STR
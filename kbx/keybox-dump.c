@@ -277,6 +277,13 @@ _keybox_dump_blob (KEYBOXBLOB blob, FILE *fp)
         fprintf (fp, "%02X", buffer[kidoff+i] );
       kflags = get16 (p + 24 );
       fprintf( fp, "\nKey-Flags[%lu]: %04lX\n", n, kflags);
+      if (type == KEYBOX_BLOBTYPE_PGP && keyinfolen >= 48)
+        {
+          fprintf (fp, "Key-Grip[%lu]: ", n );
+          for (i=0; i < 20; i++ )
+            fprintf (fp, "%02X", p[28+i]);
+          putc ('\n', fp);
+        }
     }
 
   /* serial number */
@@ -23,11 +23,24 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "keybox-defs.h"
+#include "../common/host2net.h"
 
 
-#define IMAGELEN_LIMIT (5*1024*1024)
+/* A read-only mapping of a keybox file.  Blobs read in mmap mode
+   point into it and hold a reference.  */
+struct keybox_map_s
+{
+  unsigned int refcount;
+  unsigned char *image;
+  size_t length;
+};
 
 
 #if !defined(HAVE_FTELLO) && !defined(ftello)
@@ -43,6 +56,36 @@ ftello (FILE *stream)
 }
 #endif /* !defined(HAVE_FTELLO) && !defined(ftello) */
 
+#if defined(HAVE_MMAP) && !defined(HAVE_FSEEKO) && !defined(fseeko)
+
+#ifdef HAVE_LIMITS_H
+# include <limits.h>
+#endif
+#ifndef LONG_MAX
+# define LONG_MAX ((long) ((unsigned long) -1 >> 1))
+#endif
+#ifndef LONG_MIN
+# define LONG_MIN (-1 - LONG_MAX)
+#endif
+
+/****************
+ * A substitute for fseeko, for hosts that don't have it.
+ */
+static int
+fseeko (FILE * stream, off_t newpos, int whence)
+{
+  while (newpos != (long) newpos)
+    {
+      long pos = newpos < 0 ? LONG_MIN : LONG_MAX;
+      if (fseek (stream, pos, whence) != 0)
+	return -1;
+      newpos -= pos;
+      whence = SEEK_CUR;
+    }
+  return fseek (stream, (long) newpos, whence);
+}
+#endif /* HAVE_MMAP && !defined(HAVE_FSEEKO) && !defined(fseeko) */
+
 
 
 /* Read a block at the current postion and return it in r_blob.
@@ -125,6 +168,141 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp)
 }
 
 
+void
+_keybox_map_ref (keybox_map_t map)
+{
+  map->refcount++;
+}
+
+
+void
+_keybox_map_unref (keybox_map_t map)
+{
+  if (!map || --map->refcount)
+    return;
+#ifdef HAVE_MMAP
+  munmap (map->image, map->length);
+#endif
+  xfree (map);
+}
+
+
+#ifdef HAVE_MMAP
+/* Replace the mapping of the file of HD by a new one if the file
+   has grown beyond it.  Returns 0 if there is a new mapping.  */
+static int
+remap_file (KEYBOX_HANDLE hd)
+{
+  struct stat st;
+  keybox_map_t map;
+  void *image;
+
+  if (fstat (fileno (hd->fp), &st))
+    return -1;
+  if (!st.st_size || (size_t)st.st_size != st.st_size)
+    return -1;  /* Empty or too large for our address space.  */
+  if (hd->map && (size_t)st.st_size <= hd->map->length)
+    return -1;  /* Nothing new to map.  */
+
+  image = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fileno (hd->fp), 0);
+  if (image == MAP_FAILED)
+    return -1;
+  map = xtrycalloc (1, sizeof *map);
+  if (!map)
+    {
+      munmap (image, st.st_size);
+      return -1;
+    }
+  map->refcount = 1;
+  map->image = image;
+  map->length = st.st_size;
+
+  _keybox_map_unref (hd->map);
+  hd->map = map;
+  return 0;
+}
+
+
+/* Return true if the LEN bytes at OFF of the file of HD are mapped;
+   try a new mapping if they are not.  */
+static int
+map_covers (KEYBOX_HANDLE hd, off_t off, size_t len)
+{
+  if (hd->map && off + len <= hd->map->length)
+    return 1;
+  return !remap_file (hd) && off + len <= hd->map->length;
+}
+#endif /*HAVE_MMAP*/
+
+
+/* Map the entire file of HD and return the mapping along with its
+   address at R_IMAGE and its length at R_LENGTH.  The mapping is
+   owned by HD.  Returns NULL if HD is not in mmap mode or the file
+   can't be mapped.  */
+keybox_map_t
+_keybox_map_file (KEYBOX_HANDLE hd, const unsigned char **r_image,
+                  size_t *r_length)
+{
+#ifdef HAVE_MMAP
+  if (!hd->use_mmap || !hd->fp)
+    return NULL;
+  remap_file (hd);
+  if (!hd->map)
+    return NULL;
+  *r_image = hd->map->image;
+  *r_length = hd->map->length;
+  return hd->map;
+#else /*!HAVE_MMAP*/
+  (void)hd;
+  (void)r_image;
+  (void)r_length;
+  return NULL;
+#endif /*!HAVE_MMAP*/
+}
+
+
+/* Read the blob at the current position of the file of HD like
+   _keybox_read_blob does.  In mmap mode the blob references the
+   mapping of the file instead of a copy.  Everything out of the
+   ordinary, like a truncated blob, is left to _keybox_read_blob.  */
+int
+_keybox_read_blob_hd (KEYBOX_HANDLE hd, KEYBOXBLOB *r_blob)
+{
+#ifdef HAVE_MMAP
+  off_t off;
+  const unsigned char *image;
+  size_t imagelen;
+
+  if (!hd->use_mmap)
+    return _keybox_read_blob (r_blob, hd->fp);
+
+ again:
+  *r_blob = NULL;
+  off = ftello (hd->fp);
+  if (off == (off_t)-1)
+    return gpg_error_from_syserror ();
+  if (!map_covers (hd, off, 5))
+    return _keybox_read_blob (r_blob, hd->fp);
+  image = hd->map->image + off;
+  imagelen = buf32_to_size_t (image);
+  if (imagelen < 5 || !map_covers (hd, off, imagelen))
+    return _keybox_read_blob (r_blob, hd->fp);
+  image = hd->map->image + off;  /* The map may have changed.  */
+
+  if (fseeko (hd->fp, off + imagelen, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (!image[4])
+    goto again;  /* Skip empty blobs.  */
+  if (imagelen > IMAGELEN_LIMIT)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  return _keybox_new_mapped_blob (r_blob, hd->map, image, imagelen, off);
+#else /*!HAVE_MMAP*/
+  return _keybox_read_blob (r_blob, hd->fp);
+#endif /*!HAVE_MMAP*/
+}
+
+
 /* Write the block to the current file position */
 int
 _keybox_write_blob (KEYBOXBLOB blob, FILE *fp)
@@ -175,3 +353,30 @@ _keybox_write_header_blob (FILE *fp, int for_openpgp)
     return gpg_error_from_syserror ();
   return 0;
 }
+
+
+/* Read the header blob at the current position of FP, which must be
+   the start of the file, and store its generation counter at
+   R_GENERATION and the length of the file at R_SIZE.  Returns
+   GPG_ERR_NO_DATA if the file does not start with a header blob.  */
+gpg_error_t
+_keybox_read_generation (FILE *fp, u32 *r_generation, off_t *r_size)
+{
+  unsigned char image[32];
+  struct stat st;
+
+  if (fread (image, sizeof image, 1, fp) != 1)
+    {
+      if (ferror (fp))
+        return gpg_error_from_syserror ();
+      return gpg_error (GPG_ERR_NO_DATA);
+    }
+  if (image[4] != KEYBOX_BLOBTYPE_HEADER || memcmp (image+8, "KBXf", 4))
+    return gpg_error (GPG_ERR_NO_DATA);
+  if (fstat (fileno (fp), &st))
+    return gpg_error_from_syserror ();
+
+  *r_generation = buf32_to_u32 (image+12);
+  *r_size = st.st_size;
+  return 0;
+}
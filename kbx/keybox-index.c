@@ -0,0 +1,842 @@
+/* keybox-index.c - Sidecar index for keybox searches
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The index file "<keybox>.idx" maps search keys to the offsets of
+   the blobs carrying them so that searching a large keybox for a
+   fingerprint, a long key id, a keygrip or a mail address does not
+   need to read the entire file.  The index is only a hint: the
+   search code checks every blob it reads through the index against
+   the search description, and the index is ignored unless it has
+   been made for the current generation and length of the keybox.
+
+   The index starts with a 32 byte header:
+
+   - b4   Magic 'KBXi'
+   - byte Version number (2)
+   - b3   RFU
+   - u32  Generation counter of the keybox (see keybox-blob.c)
+   - u32  Length of the keybox file (high 32 bits)
+   - u32  Length of the keybox file (low 32 bits)
+   - u32  Number of entries
+   - b8   RFU
+
+   The header is followed by the entries, each 32 bytes long:
+
+   - byte Key type (KEYBOX_INDEX_FPR, ...)
+   - b3   RFU
+   - b20  The key.  Long key ids are padded with zeroes; mail
+          addresses are mapped to lowercase and hashed with SHA-1.
+          The issuer and subject DNs of X.509 certificates are
+          hashed as stored in the blob; the key for issuer and
+          serial number is the SHA-1 hash of the length of the
+          serial number as u16, the serial number and the issuer.
+   - u32  Offset of the blob (high 32 bits)
+   - u32  Offset of the blob (low 32 bits)
+
+   The entries are sorted by comparing them as a whole with memcmp
+   and thus the offsets for one key are in ascending order.  The
+   layout allows binary searching the mmapped file directly.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#include "keybox-defs.h"
+#include <gcrypt.h>
+#include "../common/sysutils.h"
+#include "../common/stringhelp.h"
+#include "../common/host2net.h"
+
+#define INDEX_HEADER_LEN 32
+#define INDEX_ENTRY_LEN  32
+#define INDEX_KEY_LEN    24  /* The part of an entry without the offset.  */
+
+/* Keyboxes smaller than this are scanned faster than an index could
+   be built and opened.  */
+#define INDEX_MIN_KEYBOX_SIZE (256*1024)
+
+#define get16(a) buf16_to_ulong ((a))
+#define get32(a) buf32_to_ulong ((a))
+
+
+struct keybox_index_s
+{
+  unsigned char *image;  /* The entire index file.  */
+  size_t imagelen;
+  int mapped;            /* IMAGE has been mmapped.  */
+  size_t nentries;
+};
+
+
+/* A growable list of entries.  The first slot is reserved for the
+   header so that the list can be written out as is.  */
+struct entry_list_s
+{
+  unsigned char *image;
+  size_t nentries;
+  size_t size;
+};
+
+
+static void
+put32 (unsigned char *p, u32 val)
+{
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >>  8;
+  p[3] = val;
+}
+
+
+static void
+put_offset (unsigned char *p, off_t off)
+{
+  /* Shifting twice keeps this correct for a 32 bit off_t.  */
+  put32 (p, (off >> 16) >> 16);
+  put32 (p+4, off);
+}
+
+
+static off_t
+get_offset (const unsigned char *p)
+{
+  off_t hi = buf32_to_u32 (p);
+
+  return ((hi << 16) << 16) | buf32_to_u32 (p+4);
+}
+
+
+/* Return a malloced string with the name of the index for the
+   keybox FNAME with SUFFIX appended.  */
+static char *
+index_fname (const char *fname, const char *suffix)
+{
+  char *name;
+
+  name = xtrymalloc (strlen (fname) + 4 + strlen (suffix) + 1);
+  if (name)
+    strcpy (stpcpy (stpcpy (name, fname), ".idx"), suffix);
+  return name;
+}
+
+
+static void
+make_header (unsigned char *image, u32 generation, off_t size,
+             size_t nentries)
+{
+  memset (image, 0, INDEX_HEADER_LEN);
+  memcpy (image, "KBXi", 4);
+  image[4] = 2; /* Version; 1 had no keys for the X.509 DNs.  */
+  put32 (image+8, generation);
+  put_offset (image+12, size);
+  put32 (image+20, nentries);
+}
+
+
+/* Store the 20 byte key for a VALUE of length VALUELEN and the given
+   TYPE at KEY.  */
+gpg_error_t
+_keybox_index_make_key (unsigned char *key, int type,
+                        const void *value, size_t valuelen)
+{
+  const unsigned char *s = value;
+
+  if (type == KEYBOX_INDEX_MAIL)
+    {
+      unsigned char *buffer;
+      size_t n;
+
+      buffer = xtrymalloc (valuelen + 1);
+      if (!buffer)
+        return gpg_error_from_syserror ();
+      for (n=0; n < valuelen; n++)
+        buffer[n] = ascii_tolower (s[n]);
+      gcry_md_hash_buffer (GCRY_MD_SHA1, key, buffer, valuelen);
+      xfree (buffer);
+    }
+  else if (type == KEYBOX_INDEX_ISSUER || type == KEYBOX_INDEX_SUBJECT)
+    gcry_md_hash_buffer (GCRY_MD_SHA1, key, value, valuelen);
+  else
+    {
+      if (valuelen > 20)
+        valuelen = 20;
+      memset (key, 0, 20);
+      memcpy (key, s, valuelen);
+    }
+  return 0;
+}
+
+
+/* Store the key for the X.509 ISSUER of length ISSUERLEN and the
+   serial number SN of length SNLEN at KEY.  */
+gpg_error_t
+_keybox_index_make_issuer_sn_key (unsigned char *key,
+                                  const void *issuer, size_t issuerlen,
+                                  const unsigned char *sn, size_t snlen)
+{
+  unsigned char *buffer;
+
+  if (snlen > 0xffff)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  buffer = xtrymalloc (2 + snlen + issuerlen);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+  buffer[0] = snlen >> 8;
+  buffer[1] = snlen;
+  memcpy (buffer+2, sn, snlen);
+  memcpy (buffer+2+snlen, issuer, issuerlen);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, key, buffer, 2 + snlen + issuerlen);
+  xfree (buffer);
+  return 0;
+}
+
+
+static void
+make_entry (unsigned char *entry, int type, const unsigned char *key,
+            off_t off)
+{
+  memset (entry, 0, INDEX_ENTRY_LEN);
+  entry[0] = type;
+  memcpy (entry+4, key, 20);
+  put_offset (entry+INDEX_KEY_LEN, off);
+}
+
+
+/* Add an entry for the 20 byte KEY of TYPE to LIST.  */
+static gpg_error_t
+add_key_entry (struct entry_list_s *list, int type, const unsigned char *key,
+               off_t off)
+{
+  if (list->nentries == list->size)
+    {
+      size_t newsize = list->size? 2 * list->size : 256;
+      unsigned char *p;
+
+      p = xtryrealloc (list->image, newsize * INDEX_ENTRY_LEN);
+      if (!p)
+        return gpg_error_from_syserror ();
+      list->image = p;
+      list->size = newsize;
+    }
+
+  make_entry (list->image + list->nentries * INDEX_ENTRY_LEN, type, key, off);
+  list->nentries++;
+  return 0;
+}
+
+
+static gpg_error_t
+add_entry (struct entry_list_s *list, int type,
+           const void *value, size_t valuelen, off_t off)
+{
+  gpg_error_t err;
+  unsigned char key[20];
+
+  err = _keybox_index_make_key (key, type, value, valuelen);
+  if (err)
+    return err;
+  return add_key_entry (list, type, key, off);
+}
+
+
+/* Add the entries for the OpenPGP or X.509 blob BLOB stored at file
+   offset OFF to LIST.  Other blobs and blobs we can't parse are
+   silently ignored; the search would not find them anyway.  */
+static gpg_error_t
+add_blob_entries (struct entry_list_s *list, KEYBOXBLOB blob, off_t off)
+{
+  gpg_error_t err;
+  const unsigned char *buffer;
+  size_t length, pos, uidoff, uidlen, mboff, mblen;
+  size_t nkeys, keyinfolen, nserial, serialoff, nuids, uidinfolen;
+  size_t idx;
+  int x509;
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (length < 40)
+    return 0;
+  if (buffer[4] == KEYBOX_BLOBTYPE_PGP)
+    x509 = 0;
+  else if (buffer[4] == KEYBOX_BLOBTYPE_X509)
+    x509 = 1;
+  else
+    return 0;
+
+  /* The fingerprints and the long key ids taken from them.  */
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18);
+  if (keyinfolen < 28)
+    return 0;
+  pos = 20;
+  if (pos + keyinfolen*nkeys > length)
+    return 0;
+  for (idx=0; idx < nkeys; idx++, pos += keyinfolen)
+    {
+      err = add_entry (list, KEYBOX_INDEX_FPR, buffer+pos, 20, off);
+      if (!err)
+        err = add_entry (list, KEYBOX_INDEX_LONGKID, buffer+pos+12, 8, off);
+      if (err)
+        return err;
+    }
+
+#ifdef KEYBOX_WITH_X509
+  if (x509)
+    {
+      unsigned char grip[20];
+
+      if (!_keybox_get_x509_keygrip (buffer, length, grip))
+        {
+          err = add_entry (list, KEYBOX_INDEX_KEYGRIP, grip, 20, off);
+          if (err)
+            return err;
+        }
+    }
+#endif /*KEYBOX_WITH_X509*/
+
+  /* The mail addresses.  */
+  if (pos+2 > length)
+    return 0;
+  nserial = get16 (buffer+pos);
+  serialoff = pos + 2;
+  pos += 2 + nserial;
+  if (pos+4 > length)
+    return 0;
+  nuids = get16 (buffer + pos);  pos += 2;
+  uidinfolen = get16 (buffer + pos);  pos += 2;
+  if (uidinfolen < 12)
+    return 0;
+  if (pos + uidinfolen*nuids > length)
+    return 0;
+
+  /* The issuer, the issuer with the serial number and the subject of
+     a certificate.  */
+  for (idx=0; x509 && idx < 2 && idx < nuids; idx++)
+    {
+      uidoff = get32 (buffer + pos + idx*uidinfolen);
+      uidlen = get32 (buffer + pos + idx*uidinfolen + 4);
+      if (uidoff+uidlen > length || !uidlen)
+        continue;
+      if (!idx)
+        {
+          unsigned char key[20];
+
+          err = add_entry (list, KEYBOX_INDEX_ISSUER,
+                           buffer+uidoff, uidlen, off);
+          if (!err)
+            err = _keybox_index_make_issuer_sn_key (key, buffer+uidoff, uidlen,
+                                                    buffer+serialoff, nserial);
+          if (!err)
+            err = add_key_entry (list, KEYBOX_INDEX_ISSUER_SN, key, off);
+        }
+      else
+        err = add_entry (list, KEYBOX_INDEX_SUBJECT,
+                         buffer+uidoff, uidlen, off);
+      if (err)
+        return err;
+    }
+  /* As with the search, index 0 of an X.509 blob is the issuer.  */
+  for (idx=x509; idx < nuids; idx++)
+    {
+      uidoff = get32 (buffer + pos + idx*uidinfolen);
+      uidlen = get32 (buffer + pos + idx*uidinfolen + 4);
+      if (uidoff+uidlen > length)
+        break;
+      if (!_keybox_extract_mailbox (buffer+uidoff, uidlen, x509,
+                                    &mboff, &mblen))
+        continue;
+      err = add_entry (list, KEYBOX_INDEX_MAIL,
+                       buffer+uidoff+mboff, mblen, off);
+      if (err)
+        return err;
+    }
+
+  return 0;
+}
+
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  return memcmp (a, b, INDEX_ENTRY_LEN);
+}
+
+
+/* Write IMAGE to the index file of the keybox FNAME.  With RECHECK
+   set the new index is only put into place if the keybox is still at
+   GENERATION and SIZE.  */
+static gpg_error_t
+write_index (const char *fname, const unsigned char *image, size_t imagelen,
+             int recheck, u32 generation, off_t size)
+{
+  gpg_error_t err = 0;
+  char *idxname, *tmpname;
+  FILE *fp;
+
+  idxname = index_fname (fname, "");
+  tmpname = index_fname (fname, ".tmp");
+  if (!idxname || !tmpname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  fp = fopen (tmpname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (fwrite (image, imagelen, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+
+  if (!err && recheck)
+    {
+      u32 curgen;
+      off_t cursize;
+
+      fp = fopen (fname, "rb");
+      if (!fp)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = _keybox_read_generation (fp, &curgen, &cursize);
+          if (!err && (curgen != generation || cursize != size))
+            err = gpg_error (GPG_ERR_EAGAIN);
+          fclose (fp);
+        }
+    }
+
+  if (!err)
+    {
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__riscos__)
+      gnupg_remove (idxname);
+#endif
+      if (rename (tmpname, idxname))
+        err = gpg_error_from_syserror ();
+    }
+  if (err)
+    gnupg_remove (tmpname);
+
+ leave:
+  xfree (idxname);
+  xfree (tmpname);
+  return err;
+}
+
+
+/* Open the index of the keybox FNAME and store it at R_INDEX.
+   GENERATION and SIZE describe the current state of the keybox.
+   Returns GPG_ERR_NOT_FOUND if there is no index or if it does not
+   belong to that state.  */
+gpg_error_t
+_keybox_index_open (keybox_index_t *r_index, const char *fname,
+                    u32 generation, off_t size)
+{
+  gpg_error_t err;
+  char *idxname;
+  FILE *fp;
+  struct stat st;
+  unsigned char header[INDEX_HEADER_LEN];
+  keybox_index_t index = NULL;
+  size_t nentries;
+
+  *r_index = NULL;
+
+  idxname = index_fname (fname, "");
+  if (!idxname)
+    return gpg_error_from_syserror ();
+  fp = fopen (idxname, "rb");
+  xfree (idxname);
+  if (!fp)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  if (fstat (fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (fread (header, sizeof header, 1, fp) != 1
+      || memcmp (header, "KBXi", 4) || header[4] != 2
+      || buf32_to_u32 (header+8) != generation
+      || get_offset (header+12) != size)
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+  nentries = buf32_to_size_t (header+20);
+  if ((size_t)((st.st_size - INDEX_HEADER_LEN) / INDEX_ENTRY_LEN) < nentries)
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND); /* Truncated.  */
+      goto leave;
+    }
+
+  index = xtrycalloc (1, sizeof *index);
+  if (!index)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  index->nentries = nentries;
+  index->imagelen = INDEX_HEADER_LEN + nentries * INDEX_ENTRY_LEN;
+#ifdef HAVE_MMAP
+  index->image = mmap (NULL, index->imagelen, PROT_READ, MAP_PRIVATE,
+                       fileno (fp), 0);
+  if (index->image != MAP_FAILED)
+    index->mapped = 1;
+  else
+    index->image = NULL;
+#endif /*HAVE_MMAP*/
+  if (!index->mapped)
+    {
+      index->image = xtrymalloc (index->imagelen);
+      if (!index->image)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      memcpy (index->image, header, INDEX_HEADER_LEN);
+      if (nentries
+          && fread (index->image + INDEX_HEADER_LEN,
+                    nentries * INDEX_ENTRY_LEN, 1, fp) != 1)
+        {
+          err = gpg_error (GPG_ERR_NOT_FOUND);
+          goto leave;
+        }
+    }
+  err = 0;
+
+ leave:
+  fclose (fp);
+  if (err)
+    _keybox_index_release (index);
+  else
+    *r_index = index;
+  return err;
+}
+
+
+void
+_keybox_index_release (keybox_index_t index)
+{
+  if (!index)
+    return;
+#ifdef HAVE_MMAP
+  if (index->mapped)
+    munmap (index->image, index->imagelen);
+  else
+#endif /*HAVE_MMAP*/
+    xfree (index->image);
+  xfree (index);
+}
+
+
+/* Build the index for the keybox FNAME which is expected to be at
+   GENERATION and SIZE, write it to disk and store it at R_INDEX.
+   Failing to write the index is not an error.  Returns
+   GPG_ERR_TOO_SHORT for keyboxes too small to be worth an index.  */
+gpg_error_t
+_keybox_index_build (keybox_index_t *r_index, const char *fname,
+                     u32 generation, off_t size)
+{
+  gpg_error_t err;
+  FILE *fp;
+  struct entry_list_s list;
+  KEYBOXBLOB blob;
+  u32 curgen;
+  off_t cursize;
+  keybox_index_t index;
+
+  *r_index = NULL;
+  if (size < INDEX_MIN_KEYBOX_SIZE)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  fp = fopen (fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  err = _keybox_read_generation (fp, &curgen, &cursize);
+  if (!err && (curgen != generation || cursize != size))
+    err = gpg_error (GPG_ERR_EAGAIN);
+  if (err)
+    {
+      fclose (fp);
+      return err;
+    }
+  rewind (fp);
+
+  memset (&list, 0, sizeof list);
+  err = add_entry (&list, 0, "", 0, 0);  /* Room for the header.  */
+  while (!err)
+    {
+      int rc = _keybox_read_blob (&blob, fp);
+
+      if (rc == -1)
+        break;
+      if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
+          && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
+        continue;  /* The search skips them too.  */
+      if (rc)
+        err = rc;
+      else
+        {
+          err = add_blob_entries (&list, blob,
+                                  _keybox_get_blob_fileoffset (blob));
+          _keybox_release_blob (blob);
+        }
+    }
+  fclose (fp);
+  if (err)
+    {
+      xfree (list.image);
+      return err;
+    }
+
+  qsort (list.image + INDEX_ENTRY_LEN, list.nentries - 1, INDEX_ENTRY_LEN,
+         compare_entries);
+  make_header (list.image, generation, size, list.nentries - 1);
+  write_index (fname, list.image, list.nentries * INDEX_ENTRY_LEN,
+               1, generation, size);
+
+  index = xtrycalloc (1, sizeof *index);
+  if (!index)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (list.image);
+      return err;
+    }
+  index->image = list.image;
+  index->imagelen = list.nentries * INDEX_ENTRY_LEN;
+  index->nentries = list.nentries - 1;
+  *r_index = index;
+  return 0;
+}
+
+
+/* Look up the 20 byte KEY of TYPE in INDEX and store the lowest
+   offset of a blob carrying it which is not below START at R_OFF.
+   Returns -1 if there is no such blob.  */
+int
+_keybox_index_find (keybox_index_t index, int type, const unsigned char *key,
+                    off_t start, off_t *r_off)
+{
+  const unsigned char *entries = index->image + INDEX_HEADER_LEN;
+  unsigned char probe[INDEX_ENTRY_LEN];
+  size_t lo, hi, mid;
+
+  make_entry (probe, type, key, start);
+  lo = 0;
+  hi = index->nentries;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (memcmp (entries + mid * INDEX_ENTRY_LEN, probe, INDEX_ENTRY_LEN) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo == index->nentries
+      || memcmp (entries + lo * INDEX_ENTRY_LEN, probe, INDEX_KEY_LEN))
+    return -1;
+  *r_off = get_offset (entries + lo * INDEX_ENTRY_LEN + INDEX_KEY_LEN);
+  return 0;
+}
+
+
+/* Patch the header of the index of FNAME to GENERATION and SIZE.  */
+static gpg_error_t
+update_index_header (const char *fname, u32 generation, off_t size)
+{
+  gpg_error_t err = 0;
+  char *idxname;
+  unsigned char header[INDEX_HEADER_LEN];
+  FILE *fp;
+
+  idxname = index_fname (fname, "");
+  if (!idxname)
+    return gpg_error_from_syserror ();
+  fp = fopen (idxname, "r+b");
+  xfree (idxname);
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  make_header (header, generation, size, 0);
+  if (fseek (fp, 8, SEEK_SET)
+      || fwrite (header+8, 12, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  return err;
+}
+
+
+/* Update the index of the keybox FNAME after the keybox went from
+   GENERATION and SIZE to the next generation by replacing the OLDLEN
+   bytes at OFF by the NBLOBS blobs BLOBS.  See _keybox_index_update
+   and _keybox_index_append.  */
+static void
+update_index (const char *fname, u32 generation, off_t size,
+              off_t off, off_t oldlen, KEYBOXBLOB *blobs, int nblobs)
+{
+  gpg_error_t err = 0;
+  keybox_index_t index;
+  struct entry_list_s list;
+  size_t bloblen;
+  off_t newsize, delta, o;
+  unsigned char *image = NULL;
+  unsigned char *out;
+  const unsigned char *old, *new;
+  unsigned char cur[INDEX_ENTRY_LEN];
+  int have_cur;
+  size_t i, j, n;
+  int k;
+
+  memset (&list, 0, sizeof list);
+  delta = -oldlen;
+  for (k=0; k < nblobs; k++)
+    {
+      _keybox_get_blob_image (blobs[k], &bloblen);
+      delta += (off_t)bloblen;
+    }
+  newsize = size + delta;
+
+  err = _keybox_index_open (&index, fname, generation, size);
+  if (err)
+    goto leave;
+
+  if (!nblobs && !oldlen)
+    {
+      err = update_index_header (fname, generation + 1, newsize);
+      goto leave;
+    }
+
+  if (nblobs)
+    {
+      for (o = off, k=0; !err && k < nblobs; o += (off_t)bloblen, k++)
+        {
+          _keybox_get_blob_image (blobs[k], &bloblen);
+          err = add_blob_entries (&list, blobs[k], o);
+        }
+      if (err)
+        goto leave;
+      qsort (list.image, list.nentries, INDEX_ENTRY_LEN, compare_entries);
+    }
+
+  image = xtrymalloc (INDEX_HEADER_LEN
+                      + (index->nentries + list.nentries) * INDEX_ENTRY_LEN);
+  if (!image)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Merge the old entries with those of the new blob.  Entries of the
+     replaced blob are dropped and those behind it are moved by
+     DELTA, which does not change their order.  */
+  old = index->image + INDEX_HEADER_LEN;
+  new = list.image;
+  out = image + INDEX_HEADER_LEN;
+  i = j = n = 0;
+  have_cur = 0;
+  for (;;)
+    {
+      while (!have_cur && i < index->nentries)
+        {
+          const unsigned char *e = old + i++ * INDEX_ENTRY_LEN;
+
+          o = get_offset (e + INDEX_KEY_LEN);
+          if (o >= off && o < off + oldlen)
+            continue;
+          memcpy (cur, e, INDEX_ENTRY_LEN);
+          if (o >= off + oldlen)
+            put_offset (cur + INDEX_KEY_LEN, o + delta);
+          have_cur = 1;
+        }
+      if (have_cur
+          && (j == list.nentries
+              || memcmp (cur, new + j * INDEX_ENTRY_LEN, INDEX_ENTRY_LEN) <= 0))
+        {
+          memcpy (out + n++ * INDEX_ENTRY_LEN, cur, INDEX_ENTRY_LEN);
+          have_cur = 0;
+        }
+      else if (j < list.nentries)
+        memcpy (out + n++ * INDEX_ENTRY_LEN, new + j++ * INDEX_ENTRY_LEN,
+                INDEX_ENTRY_LEN);
+      else
+        break;
+    }
+  make_header (image, generation + 1, newsize, n);
+  err = write_index (fname, image, INDEX_HEADER_LEN + n * INDEX_ENTRY_LEN,
+                     0, 0, 0);
+
+ leave:
+  _keybox_index_release (index);
+  xfree (list.image);
+  xfree (image);
+  if (err)
+    _keybox_index_remove (fname);
+}
+
+
+/* Update the index of the keybox FNAME after the keybox went from
+   GENERATION and SIZE to the next generation by replacing the OLDLEN
+   bytes at OFF by BLOB.  BLOB may be NULL if nothing is inserted; an
+   OLDLEN of 0 and an OFF equal to SIZE describe an insertion at the
+   end.  With neither BLOB nor OLDLEN the keybox has only been
+   changed in place, e.g. by flagging a blob as deleted.  If the index
+   can't be updated it is removed so that the next search rebuilds
+   it.  */
+void
+_keybox_index_update (const char *fname, u32 generation, off_t size,
+                      off_t off, off_t oldlen, KEYBOXBLOB blob)
+{
+  update_index (fname, generation, size, off, oldlen, &blob, blob? 1 : 0);
+}
+
+
+/* Update the index of the keybox FNAME after the NBLOBS blobs BLOBS
+   have been appended to it in one go, which took it from GENERATION
+   and SIZE to the next generation.  The index is rewritten only
+   once.  */
+void
+_keybox_index_append (const char *fname, u32 generation, off_t size,
+                      KEYBOXBLOB *blobs, int nblobs)
+{
+  update_index (fname, generation, size, size, 0, blobs, nblobs);
+}
+
+
+/* Remove the index of the keybox FNAME.  */
+void
+_keybox_index_remove (const char *fname)
+{
+  char *idxname;
+
+  idxname = index_fname (fname, "");
+  if (idxname)
+    gnupg_remove (idxname);
+  xfree (idxname);
+}
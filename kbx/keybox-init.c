@@ -174,6 +174,9 @@ keybox_release (KEYBOX_HANDLE hd)
       fclose (hd->fp);
       hd->fp = NULL;
     }
+  _keybox_release_scan (hd);
+  _keybox_index_release (hd->index);
+  _keybox_map_unref (hd->map);
   xfree (hd->word_match.name);
   xfree (hd->word_match.pattern);
   xfree (hd);
@@ -227,6 +230,44 @@ keybox_set_ephemeral (KEYBOX_HANDLE hd, int yes)
 }
 
 
+/* Switch HD to read blobs from a mapping of the file instead of
+   copying them into memory.  The mapping follows the file when it
+   grows and is replaced when the file is opened again, e.g. after an
+   update.  */
+int
+keybox_set_mmap (KEYBOX_HANDLE hd, int yes)
+{
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+#ifdef HAVE_MMAP
+  hd->use_mmap = yes;
+  return 0;
+#else
+  (void)yes;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+}
+
+
+/* Let HD scan the file on several threads if a search can't use the
+   index.  FNC is called by the search with a function, its argument
+   and a number N; it shall call the function for each index below N
+   on up to NTHREADS threads and return after all calls finished.
+   The function only reads memory and does not need any locks.  This
+   needs mmap mode.  */
+int
+keybox_set_parallel (KEYBOX_HANDLE hd, keybox_parallel_t fnc,
+                     unsigned int nthreads)
+{
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  _keybox_release_scan (hd);
+  hd->parallel = nthreads > 1? fnc : NULL;
+  hd->parallel_threads = nthreads;
+  return 0;
+}
+
+
 /* Close the file of the resource identified by HD.  For consistent
    results this fucntion closes the files of all handles pointing to
    the resource identified by HD.  */
@@ -242,11 +283,16 @@ _keybox_close_file (KEYBOX_HANDLE hd)
   for (idx=0; idx < hd->kb->handle_table_size; idx++)
     if ((roverhd = hd->kb->handle_table[idx]))
       {
+        _keybox_release_scan (roverhd);
         if (roverhd->fp)
           {
             fclose (roverhd->fp);
             roverhd->fp = NULL;
           }
+        _keybox_index_release (roverhd->index);
+        roverhd->index = NULL;
+        _keybox_map_unref (roverhd->map);
+        roverhd->map = NULL;
       }
   assert (!hd->fp);
 }
@@ -159,6 +159,92 @@ next_packet (unsigned char const **bufptr, size_t *buflen,
 }
 
 
+/* Compute the keygrip of the public key with the OpenPGP algorithm
+   ALGO whose NPKEY parameters start at DATA and store it at GRIP.  The
+   parameters have already been checked by the caller.  The
+   S-expressions are the same gpg's keygrip_from_pk uses, so that the
+   keygrips match.  */
+static gpg_error_t
+keygrip_from_keyparm (int algo, const unsigned char *data, int npkey,
+                      unsigned char *grip)
+{
+  gpg_error_t err = 0;
+  gcry_mpi_t mpis[4] = { NULL, NULL, NULL, NULL };
+  gcry_sexp_t s_pkey = NULL;
+  char *curve = NULL;
+  int is_ecc;
+  unsigned int nbytes;
+  int i;
+
+  is_ecc = (algo == PUBKEY_ALGO_ECDH || algo == PUBKEY_ALGO_ECDSA
+            || algo == PUBKEY_ALGO_EDDSA);
+  for (i=0; !err && i < npkey && i < 4; i++)
+    {
+      if (is_ecc && (i == 0 || i == 2))
+        {
+          /* The curve OID or the KDF parameters.  */
+          nbytes = data[0] + 1;
+          if (!i)
+            mpis[0] = gcry_mpi_set_opaque_copy (NULL, data, nbytes*8);
+        }
+      else
+        {
+          nbytes = (((data[0]<<8)|(data[1])) + 7) / 8;
+          data += 2;
+          err = gcry_mpi_scan (&mpis[i], GCRYMPI_FMT_USG, data, nbytes, NULL);
+        }
+      data += nbytes;
+    }
+  if (err)
+    goto leave;
+
+  switch (algo)
+    {
+    case PUBKEY_ALGO_DSA:
+      err = gcry_sexp_build (&s_pkey, NULL,
+                             "(public-key(dsa(p%m)(q%m)(g%m)(y%m)))",
+                             mpis[0], mpis[1], mpis[2], mpis[3]);
+      break;
+
+    case PUBKEY_ALGO_ELGAMAL:
+    case PUBKEY_ALGO_ELGAMAL_E:
+      err = gcry_sexp_build (&s_pkey, NULL,
+                             "(public-key(elg(p%m)(g%m)(y%m)))",
+                             mpis[0], mpis[1], mpis[2]);
+      break;
+
+    case PUBKEY_ALGO_RSA:
+    case PUBKEY_ALGO_RSA_S:
+    case PUBKEY_ALGO_RSA_E:
+      err = gcry_sexp_build (&s_pkey, NULL,
+                             "(public-key(rsa(n%m)(e%m)))",
+                             mpis[0], mpis[1]);
+      break;
+
+    default: /* ECC */
+      curve = mpis[0]? openpgp_oid_to_str (mpis[0]) : NULL;
+      if (!curve)
+        err = gpg_error_from_syserror ();
+      else
+        err = gcry_sexp_build (&s_pkey, NULL,
+                               algo == PUBKEY_ALGO_EDDSA ?
+                               "(public-key(ecc(curve%s)(flags eddsa)(q%m)))"
+                               : "(public-key(ecc(curve%s)(q%m)))",
+                               curve, mpis[1]);
+      break;
+    }
+  if (!err && !gcry_pk_get_keygrip (s_pkey, grip))
+    err = gpg_error (GPG_ERR_INTERNAL);
+
+ leave:
+  gcry_free (curve);
+  gcry_sexp_release (s_pkey);
+  for (i=0; i < 4; i++)
+    gcry_mpi_release (mpis[i]);
+  return err;
+}
+
+
 /* Parse a key packet and store the information in KI. */
 static gpg_error_t
 parse_key (const unsigned char *data, size_t datalen,
@@ -169,6 +255,7 @@ parse_key (const unsigned char *data, size_t datalen,
   int i, version, algorithm;
   size_t n;
   int npkey;
+  const unsigned char *keyparm;
   unsigned char hashbuffer[768];
   const unsigned char *mpi_n = NULL;
   size_t mpi_n_len = 0, mpi_e_len = 0;
@@ -223,6 +310,7 @@ parse_key (const unsigned char *data, size_t datalen,
     }
 
   ki->algo = algorithm;
+  keyparm = data;
 
   for (i=0; i < npkey; i++ )
     {
@@ -263,6 +351,10 @@ parse_key (const unsigned char *data, size_t datalen,
     }
   n = data - data_start;
 
+  /* A key of an algorithm Libgcrypt can't handle is still stored;
+     only its keygrip is not known.  */
+  ki->have_grip = !keygrip_from_keyparm (algorithm, keyparm, npkey, ki->grip);
+
   if (version < 4)
     {
       /* We do not support any other algorithm than RSA in v3
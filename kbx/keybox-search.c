@@ -32,6 +32,50 @@
 #include "host2net.h"
 #include "mbox-util.h"
 
+#if !defined(HAVE_FSEEKO) && !defined(fseeko)
+
+#ifdef HAVE_LIMITS_H
+# include <limits.h>
+#endif
+#ifndef LONG_MAX
+# define LONG_MAX ((long) ((unsigned long) -1 >> 1))
+#endif
+#ifndef LONG_MIN
+# define LONG_MIN (-1 - LONG_MAX)
+#endif
+
+/****************
+ * A substitute for fseeko, for hosts that don't have it.
+ */
+static int
+fseeko (FILE * stream, off_t newpos, int whence)
+{
+  while (newpos != (long) newpos)
+    {
+      long pos = newpos < 0 ? LONG_MIN : LONG_MAX;
+      if (fseek (stream, pos, whence) != 0)
+	return -1;
+      newpos -= pos;
+      whence = SEEK_CUR;
+    }
+  return fseek (stream, (long) newpos, whence);
+}
+#endif /* !defined(HAVE_FSEEKO) && !defined(fseeko) */
+
+#if !defined(HAVE_FTELLO) && !defined(ftello)
+static off_t
+ftello (FILE *stream)
+{
+  long int off;
+
+  off = ftell (stream);
+  if (off == -1)
+    return (off_t)-1;
+  return off;
+}
+#endif /* !defined(HAVE_FTELLO) && !defined(ftello) */
+
+
 #define xtoi_1(p)   (*(p) <= '9'? (*(p)- '0'): \
                      *(p) <= 'F'? (*(p)-'A'+10):(*(p)-'a'+10))
 #define xtoi_2(p)   ((xtoi_1(p) * 16) + xtoi_1((p)+1))
@@ -43,10 +87,112 @@ struct sn_array_s {
 };
 
 
+/* A search description translated into a key of the index.  */
+struct index_key_s {
+    int type;
+    unsigned char key[20];
+};
+
+
 #define get32(a) buf32_to_ulong ((a))
 #define get16(a) buf16_to_ulong ((a))
 
 
+/* The smallest part of a keybox worth a parallel scan.  */
+#define MIN_PARALLEL_SCAN (1024*1024)
+
+/* The number of ranges a parallel scan uses per thread and the
+   largest number of ranges.  More ranges than threads even out the
+   work if the matches are not spread evenly.  */
+#define SCAN_RANGES_PER_THREAD 4
+#define MAX_SCAN_RANGES 256
+
+
+/* A blob found by a parallel scan.  */
+struct scan_hit_s
+{
+  size_t off;           /* Offset of the blob in the file.  */
+  size_t len;           /* Length of the blob.  */
+  size_t descidx;       /* The search description it matched.  */
+  int pk_no;
+  int uid_no;
+};
+
+/* The results of a parallel scan, which are returned one by one by
+   the following calls of keybox_search.  */
+struct keybox_scan_s
+{
+  KEYBOX_SEARCH_DESC *desc;  /* The search this scan is for.  */
+  size_t ndesc;
+  keybox_blobtype_t want_blobtype;
+  keybox_map_t map;          /* The mapping the offsets refer to.  */
+  const unsigned char *image;
+  size_t end;                /* End of the scanned part of the file.  */
+  struct scan_hit_s *hits;   /* The matches in file order.  */
+  size_t nhits;
+  size_t next;               /* The next hit to return.  */
+};
+
+/* The part of a parallel scan done by one call of the worker.  */
+struct scan_range_s
+{
+  size_t start, end;
+  KEYBOXBLOB blob;           /* Cycled over the blobs of the range.  */
+  struct scan_hit_s *hits;
+  size_t nhits, size;
+  int failed;                /* Out of core.  */
+};
+
+/* The arguments of the worker.  */
+struct scan_job_s
+{
+  KEYBOX_SEARCH_DESC *desc;
+  size_t ndesc;
+  struct sn_array_s *sn_array;
+  keybox_blobtype_t want_blobtype;
+  int ephemeral;
+  const unsigned char *image;
+  struct scan_range_s *ranges;
+};
+
+
+/* Case insensitive search for the ASCII string {NEEDLE,NNEEDLE} in
+   {HAYSTACK,NHAYSTACK} like ascii_memcasemem.  Instead of comparing
+   at every position, memchr, which the C library implements with
+   vector instructions, looks for the first character in both ways
+   of writing it.  */
+static const unsigned char *
+find_substr (const unsigned char *haystack, size_t nhaystack,
+             const char *needle, size_t nneedle)
+{
+  const unsigned char *end, *p, *lower, *upper;
+  int c1, c2;
+
+  if (!nneedle)
+    return haystack;
+  if (nneedle > nhaystack)
+    return NULL;
+
+  /* A match starts before END.  */
+  end = haystack + nhaystack - nneedle + 1;
+  c1 = ascii_tolower (*(const unsigned char *)needle);
+  c2 = ascii_toupper (*(const unsigned char *)needle);
+  lower = memchr (haystack, c1, end - haystack);
+  upper = c1 == c2? NULL : memchr (haystack, c2, end - haystack);
+  while (lower || upper)
+    {
+      p = (!upper || (lower && lower < upper))? lower : upper;
+      if (!ascii_memcasecmp (p+1, needle+1, nneedle-1))
+        return p;
+      if (p == lower)
+        lower = memchr (p+1, c1, end - (p+1));
+      else
+        upper = memchr (p+1, c2, end - (p+1));
+    }
+  return NULL;
+}
+
+
 static inline unsigned int
 blob_get_blob_flags (KEYBOXBLOB blob)
 {
@@ -348,7 +494,7 @@ blob_cmp_name (KEYBOXBLOB blob, int idx,
             continue; /* empty name */
           if (substr)
             {
-              if (ascii_memcasemem (buffer+off, len, name, namelen))
+              if (find_substr (buffer+off, len, name, namelen))
                 return idx+1; /* found */
             }
           else
@@ -372,7 +518,7 @@ blob_cmp_name (KEYBOXBLOB blob, int idx,
 
       if (substr)
         {
-          if (ascii_memcasemem (buffer+off, len, name, namelen))
+          if (find_substr (buffer+off, len, name, namelen))
             return idx+1; /* found */
         }
       else
@@ -385,6 +531,59 @@ blob_cmp_name (KEYBOXBLOB blob, int idx,
 }
 
 
+/* Locate the mail address in the user id {UID,UIDLEN} of a blob.
+   With X509 set the user id is an X.509 mail address which is stored
+   in angle brackets; an OpenPGP user id has the address in angle
+   brackets or consists of just the address.  On success true is
+   returned and the offset and length of the address relative to UID
+   are stored at R_OFF and R_LEN.  */
+int
+_keybox_extract_mailbox (const unsigned char *uid, size_t uidlen, int x509,
+                         size_t *r_off, size_t *r_len)
+{
+  size_t off, len, pos;
+
+  if (x509)
+    {
+      if (uidlen < 2 || uid[0] != '<')
+        return 0; /* empty name or trailing 0 not stored */
+      len = uidlen - 1; /* one back */
+      if ( len < 3 || uid[len] != '>')
+        return 0; /* not a proper email address */
+      *r_off = 1;
+      *r_len = len - 1;
+      return 1;
+    }
+
+  /* We need to forward to the mailbox part.  */
+  for (off=0, len=uidlen; len && uid[off] != '<'; len--, off++)
+    ;
+  if (len < 2 || uid[off] != '<')
+    {
+      /* Mailbox not explicitly given or too short.  Check whether the
+         entire string resembles a mailbox without the angle
+         brackets.  */
+      if (!is_valid_mailbox_mem (uid, uidlen))
+        return 0; /* Not a mail address. */
+      *r_off = 0;
+      *r_len = uidlen;
+      return 1;
+    }
+
+  /* Seems to be standard user id with mail address.  */
+  off++; /* Point to first char of the mail address.  */
+  len--;
+  /* Search closing '>'.  */
+  for (pos=off; len && uid[pos] != '>'; len--, pos++)
+    ;
+  if (!len || uid[pos] != '>' || off == pos)
+    return 0; /* Not a proper mail address.  */
+  *r_off = off;
+  *r_len = pos - off;
+  return 1;
+}
+
+
 /* Compare all email addresses of the subject.  With SUBSTR given as
    True a substring search is done in the mail address.  The X509 flag
    indicated whether the search is done on an X.509 blob.  */
@@ -436,57 +635,21 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
   for (idx=!!x509 ;idx < nuids; idx++)
     {
       size_t mypos = pos;
-      size_t mylen;
+      size_t mboff, mblen;
 
       mypos += idx*uidinfolen;
       off = get32 (buffer+mypos);
       len = get32 (buffer+mypos+4);
       if (off+len > length)
         return 0; /* error: better stop here - out of bounds */
-      if (x509)
-        {
-          if (len < 2 || buffer[off] != '<')
-            continue; /* empty name or trailing 0 not stored */
-          len--; /* one back */
-          if ( len < 3 || buffer[off+len] != '>')
-            continue; /* not a proper email address */
-          off++;
-          len--;
-        }
-      else /* OpenPGP.  */
-        {
-          /* We need to forward to the mailbox part.  */
-          mypos = off;
-          mylen = len;
-          for ( ; len && buffer[off] != '<'; len--, off++)
-            ;
-          if (len < 2 || buffer[off] != '<')
-            {
-              /* Mailbox not explicitly given or too short.  Restore
-                 OFF and LEN and check whether the entire string
-                 resembles a mailbox without the angle brackets.  */
-              off = mypos;
-              len = mylen;
-              if (!is_valid_mailbox_mem (buffer+off, len))
-                continue; /* Not a mail address. */
-            }
-          else /* Seems to be standard user id with mail address.  */
-            {
-              off++; /* Point to first char of the mail address.  */
-              len--;
-              /* Search closing '>'.  */
-              for (mypos=off; len && buffer[mypos] != '>'; len--, mypos++)
-                ;
-              if (!len || buffer[mypos] != '>' || off == mypos)
-                continue; /* Not a proper mail address.  */
-              len = mypos - off;
-            }
-
-        }
+      if (!_keybox_extract_mailbox (buffer+off, len, x509, &mboff, &mblen))
+        continue;
+      off += mboff;
+      len = mblen;
 
       if (substr)
         {
-          if (ascii_memcasemem (buffer+off, len, name, namelen))
+          if (find_substr (buffer+off, len, name, namelen))
             return idx+1; /* found */
         }
       else
@@ -500,71 +663,83 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
 
 
 #ifdef KEYBOX_WITH_X509
-/* Return true if the key in BLOB matches the 20 bytes keygrip GRIP.
-   We don't have the keygrips as meta data, thus we need to parse the
-   certificate. Fixme: We might want to return proper error codes
-   instead of failing a search for invalid certificates etc.  */
-static int
-blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
+/* Compute the keygrip of the certificate in the X.509 blob
+   {BUFFER,LENGTH} and store it at GRIP.  We don't have the keygrips
+   as meta data, thus we need to parse the certificate.  */
+gpg_error_t
+_keybox_get_x509_keygrip (const unsigned char *buffer, size_t length,
+                          unsigned char *grip)
 {
-  int rc;
-  const unsigned char *buffer;
-  size_t length;
+  gpg_error_t rc;
   size_t cert_off, cert_len;
   ksba_reader_t reader = NULL;
   ksba_cert_t cert = NULL;
   ksba_sexp_t p = NULL;
   gcry_sexp_t s_pkey;
-  unsigned char array[20];
   unsigned char *rcp;
   size_t n;
 
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 40)
-    return 0; /* Too short. */
+    return gpg_error (GPG_ERR_TOO_SHORT);
   cert_off = get32 (buffer+8);
   cert_len = get32 (buffer+12);
   if (cert_off+cert_len > length)
-    return 0; /* Too short.  */
+    return gpg_error (GPG_ERR_TOO_SHORT);
 
   rc = ksba_reader_new (&reader);
   if (rc)
-    return 0; /* Problem with ksba. */
+    return rc; /* Problem with ksba. */
   rc = ksba_reader_set_mem (reader, buffer+cert_off, cert_len);
   if (rc)
-    goto failed;
+    goto leave;
   rc = ksba_cert_new (&cert);
   if (rc)
-    goto failed;
+    goto leave;
   rc = ksba_cert_read_der (cert, reader);
   if (rc)
-    goto failed;
+    goto leave;
   p = ksba_cert_get_public_key (cert);
   if (!p)
-    goto failed;
+    {
+      rc = gpg_error (GPG_ERR_NO_PUBKEY);
+      goto leave;
+    }
   n = gcry_sexp_canon_len (p, 0, NULL, NULL);
   if (!n)
-    goto failed;
-  rc = gcry_sexp_sscan (&s_pkey, NULL, (char*)p, n);
-  if (rc)
     {
-      gcry_sexp_release (s_pkey);
-      goto failed;
+      rc = gpg_error (GPG_ERR_INV_SEXP);
+      goto leave;
     }
-  rcp = gcry_pk_get_keygrip (s_pkey, array);
+  rc = gcry_sexp_sscan (&s_pkey, NULL, (char*)p, n);
+  if (rc)
+    goto leave;
+  rcp = gcry_pk_get_keygrip (s_pkey, grip);
   gcry_sexp_release (s_pkey);
   if (!rcp)
-    goto failed; /* Can't calculate keygrip. */
+    rc = gpg_error (GPG_ERR_PUBKEY_ALGO); /* Can't calculate keygrip. */
 
+ leave:
   xfree (p);
   ksba_cert_release (cert);
   ksba_reader_release (reader);
+  return rc;
+}
+
+
+/* Return true if the key in BLOB matches the 20 bytes keygrip GRIP.
+   Fixme: We might want to return proper error codes instead of
+   failing a search for invalid certificates etc.  */
+static int
+blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
+{
+  const unsigned char *buffer;
+  size_t length;
+  unsigned char array[20];
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (_keybox_get_x509_keygrip (buffer, length, array))
+    return 0;
   return !memcmp (array, grip, 20);
- failed:
-  xfree (p);
-  ksba_cert_release (cert);
-  ksba_reader_release (reader);
-  return 0;
 }
 #endif /*KEYBOX_WITH_X509*/
 
@@ -725,6 +900,579 @@ release_sn_array (struct sn_array_s *array, size_t size)
 }
 
 
+/* Translate DESC into the key IK to look up in the index.  SN and
+   SNLEN are the binary serial number for an issuer and serial number
+   search.  Returns GPG_ERR_NOT_SUPPORTED if the index can't be used
+   for DESC.  */
+static gpg_error_t
+make_index_key (KEYBOX_SEARCH_DESC *desc,
+                const unsigned char *sn, size_t snlen,
+                struct index_key_s *ik)
+{
+  unsigned char buf[8];
+  const char *name;
+  size_t namelen;
+
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      buf[0] = desc->u.kid[0] >> 24;
+      buf[1] = desc->u.kid[0] >> 16;
+      buf[2] = desc->u.kid[0] >> 8;
+      buf[3] = desc->u.kid[0];
+      buf[4] = desc->u.kid[1] >> 24;
+      buf[5] = desc->u.kid[1] >> 16;
+      buf[6] = desc->u.kid[1] >> 8;
+      buf[7] = desc->u.kid[1];
+      ik->type = KEYBOX_INDEX_LONGKID;
+      return _keybox_index_make_key (ik->key, ik->type, buf, 8);
+
+    case KEYDB_SEARCH_MODE_FPR:
+    case KEYDB_SEARCH_MODE_FPR20:
+      ik->type = KEYBOX_INDEX_FPR;
+      return _keybox_index_make_key (ik->key, ik->type, desc->u.fpr, 20);
+
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      ik->type = KEYBOX_INDEX_KEYGRIP;
+      return _keybox_index_make_key (ik->key, ik->type, desc->u.grip, 20);
+
+    case KEYDB_SEARCH_MODE_MAIL:
+      /* Normalize the name the way has_mail does.  */
+      name = desc->u.name;
+      if (!name)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      if (*name == '<')
+        name++;
+      namelen = strlen (name);
+      if (namelen && name[namelen-1] == '>')
+        namelen--;
+      ik->type = KEYBOX_INDEX_MAIL;
+      return _keybox_index_make_key (ik->key, ik->type, name, namelen);
+
+    case KEYDB_SEARCH_MODE_ISSUER:
+    case KEYDB_SEARCH_MODE_SUBJECT:
+      if (!desc->u.name)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      ik->type = (desc->mode == KEYDB_SEARCH_MODE_ISSUER
+                  ? KEYBOX_INDEX_ISSUER : KEYBOX_INDEX_SUBJECT);
+      return _keybox_index_make_key (ik->key, ik->type,
+                                     desc->u.name, strlen (desc->u.name));
+
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+      if (!desc->u.name || !sn)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      ik->type = KEYBOX_INDEX_ISSUER_SN;
+      return _keybox_index_make_issuer_sn_key (ik->key, desc->u.name,
+                                               strlen (desc->u.name),
+                                               sn, snlen);
+
+    default:
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+}
+
+
+/* Make sure that HD has an index for its open file, building it if
+   needed.  If there is no usable index HD->NO_INDEX is set so that we
+   don't try again; a keybox which is still too small or which changed
+   while building the index is looked at again by the next search.
+   Only errors repositioning the file are returned.  */
+static gpg_error_t
+open_index (KEYBOX_HANDLE hd)
+{
+  gpg_error_t err;
+  off_t pos, size;
+  u32 generation;
+
+  if (hd->index || hd->no_index)
+    return 0;
+
+  pos = ftello (hd->fp);
+  if (pos == (off_t)-1)
+    return gpg_error_from_syserror ();
+  if (fseeko (hd->fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  err = _keybox_read_generation (hd->fp, &generation, &size);
+  if (fseeko (hd->fp, pos, SEEK_SET))
+    return gpg_error_from_syserror ();
+
+  if (!err)
+    err = _keybox_index_open (&hd->index, hd->kb->fname, generation, size);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    err = _keybox_index_build (&hd->index, hd->kb->fname, generation, size);
+  if (err && gpg_err_code (err) != GPG_ERR_TOO_SHORT
+      && gpg_err_code (err) != GPG_ERR_EAGAIN)
+    hd->no_index = 1;
+  return 0;
+}
+
+
+/* Read the next blob at or behind the current file position which
+   the index lists for one of the NKEYS keys in KEYS.  Returns -1 if
+   there is no such blob.  */
+static int
+read_indexed_blob (KEYBOX_HANDLE hd, struct index_key_s *keys, size_t nkeys,
+                   KEYBOXBLOB *r_blob)
+{
+  off_t start, off, cand;
+  size_t n;
+  int rc;
+
+  *r_blob = NULL;
+  start = ftello (hd->fp);
+  if (start == (off_t)-1)
+    return gpg_error_from_syserror ();
+
+  for (;;)
+    {
+      cand = -1;
+      for (n=0; n < nkeys; n++)
+        if (!_keybox_index_find (hd->index, keys[n].type, keys[n].key,
+                                 start, &off)
+            && (cand == -1 || off < cand))
+          cand = off;
+      if (cand == -1)
+        return -1;
+
+      if (fseeko (hd->fp, cand, SEEK_SET))
+        return gpg_error_from_syserror ();
+      rc = _keybox_read_blob_hd (hd, r_blob);
+      if (rc)
+        return rc;
+      if (_keybox_get_blob_fileoffset (*r_blob) == cand)
+        return 0;
+
+      /* The blob has been flagged as deleted and we got the next one.  */
+      _keybox_release_blob (*r_blob);
+      *r_blob = NULL;
+      start = cand + 1;
+    }
+}
+
+
+/* Return true if BLOB is a candidate for a search for blobs of type
+   WANT_BLOBTYPE.  */
+static int
+blob_wanted_p (KEYBOXBLOB blob, keybox_blobtype_t want_blobtype,
+               int ephemeral)
+{
+  int blobtype;
+
+  blobtype = blob_get_type (blob);
+  if (blobtype == KEYBOX_BLOBTYPE_HEADER)
+    return 0;
+  if (want_blobtype && blobtype != want_blobtype)
+    return 0;
+  if (!ephemeral && (blob_get_blob_flags (blob) & 2))
+    return 0; /* Not in ephemeral mode but blob is flagged ephemeral.  */
+  return 1;
+}
+
+
+/* Match BLOB against the NDESC search descriptions in DESC.  Returns
+   true if one of them matches and stores its index at R_N and the
+   number of the matching key or user id at R_PK_NO or R_UID_NO.  An
+   invalid mode counts as a match with an error stored at R_RC.  */
+static int
+match_blob (KEYBOXBLOB blob, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+            struct sn_array_s *sn_array,
+            size_t *r_n, int *r_pk_no, int *r_uid_no, int *r_rc)
+{
+  size_t n;
+  int pk_no = 0;
+  int uid_no = 0;
+
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_NONE:
+          never_reached ();
+          break;
+        case KEYDB_SEARCH_MODE_EXACT:
+          uid_no = has_username (blob, desc[n].u.name, 0);
+          if (uid_no)
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_MAIL:
+          uid_no = has_mail (blob, desc[n].u.name, 0);
+          if (uid_no)
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_MAILSUB:
+          uid_no = has_mail (blob, desc[n].u.name, 1);
+          if (uid_no)
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_SUBSTR:
+          uid_no =  has_username (blob, desc[n].u.name, 1);
+          if (uid_no)
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_MAILEND:
+        case KEYDB_SEARCH_MODE_WORDS:
+          /* not yet implemented */
+          break;
+        case KEYDB_SEARCH_MODE_ISSUER:
+          if (has_issuer (blob, desc[n].u.name))
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_ISSUER_SN:
+          if (has_issuer_sn (blob, desc[n].u.name,
+                             sn_array? sn_array[n].sn : desc[n].sn,
+                             sn_array? sn_array[n].snlen : desc[n].snlen))
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_SN:
+          if (has_sn (blob, sn_array? sn_array[n].sn : desc[n].sn,
+                            sn_array? sn_array[n].snlen : desc[n].snlen))
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_SUBJECT:
+          if (has_subject (blob, desc[n].u.name))
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+          pk_no = has_short_kid (blob, desc[n].u.kid[1]);
+          if (pk_no)
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          pk_no = has_long_kid (blob, desc[n].u.kid[0], desc[n].u.kid[1]);
+          if (pk_no)
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_FPR:
+        case KEYDB_SEARCH_MODE_FPR20:
+          pk_no = has_fingerprint (blob, desc[n].u.fpr);
+          if (pk_no)
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          if (has_keygrip (blob, desc[n].u.grip))
+            goto found;
+          break;
+        case KEYDB_SEARCH_MODE_FIRST:
+          goto found;
+          break;
+        case KEYDB_SEARCH_MODE_NEXT:
+          goto found;
+          break;
+        default:
+          *r_rc = gpg_error (GPG_ERR_INV_VALUE);
+          goto found;
+        }
+    }
+  return 0;
+
+ found:
+  *r_n = n;
+  *r_pk_no = pk_no;
+  *r_uid_no = uid_no;
+  return 1;
+}
+
+
+/* Return true if one of the skip functions of the NDESC search
+   descriptions in DESC rejects BLOB.  */
+static int
+skip_blob_p (KEYBOXBLOB blob, KEYBOX_SEARCH_DESC *desc, size_t ndesc)
+{
+  size_t n;
+  u32 kid[2];
+
+  for (n=0; n < ndesc; n++)
+    if (desc[n].skipfnc
+        && blob_get_first_keyid (blob, kid)
+        && desc[n].skipfnc (desc[n].skipfncvalue, kid, NULL))
+      return 1;
+  return 0;
+}
+
+
+
+/*
+
+  Parallel scans
+
+  A search which can't use the index has to look at every blob.  If
+  the application provided a way to run code on several threads
+  (keybox_set_parallel) and the file is mapped, this is done by
+  splitting the rest of the file into ranges of whole blobs which are
+  matched on the threads.  The matches are then returned in file
+  order by keybox_search as if it had found them one after the
+  other.  The skip functions are called only then, because they call
+  back into the application.
+
+  The workers exclusively read the mapping.  Each range has its own
+  blob object which is pointed to the blobs of the range in turn;
+  this avoids allocating memory or changing the reference count of
+  the map on the threads.  Only searches for names and addresses are
+  done in parallel; all the other searches use the index anyway.
+
+*/
+
+
+/* Return true if a parallel scan is worth it for the NDESC search
+   descriptions in DESC and is able to do them.  */
+static int
+parallel_scan_p (KEYBOX_SEARCH_DESC *desc, size_t ndesc)
+{
+  size_t n;
+  int any_substr = 0;
+
+  for (n=0; n < ndesc; n++)
+    switch (desc[n].mode)
+      {
+      case KEYDB_SEARCH_MODE_SUBSTR:
+      case KEYDB_SEARCH_MODE_MAILSUB:
+        any_substr = 1;
+        break;
+      case KEYDB_SEARCH_MODE_EXACT:
+      case KEYDB_SEARCH_MODE_MAIL:
+      case KEYDB_SEARCH_MODE_SUBJECT:
+      case KEYDB_SEARCH_MODE_ISSUER:
+      case KEYDB_SEARCH_MODE_ISSUER_SN:
+      case KEYDB_SEARCH_MODE_SN:
+      case KEYDB_SEARCH_MODE_SHORT_KID:
+      case KEYDB_SEARCH_MODE_LONG_KID:
+      case KEYDB_SEARCH_MODE_FPR:
+      case KEYDB_SEARCH_MODE_FPR20:
+        break;
+      default:
+        return 0;
+      }
+  return any_substr;
+}
+
+
+/* Match the blobs of range IDX of the parallel scan described by
+   ARG.  This runs on a thread of the application.  */
+static void
+scan_range (void *arg, unsigned int idx)
+{
+  struct scan_job_s *job = arg;
+  struct scan_range_s *range = job->ranges + idx;
+  const unsigned char *image;
+  size_t pos, imagelen, n;
+  int pk_no, uid_no, rc;
+
+  for (pos = range->start; pos < range->end; pos += imagelen)
+    {
+      image = job->image + pos;
+      imagelen = buf32_to_size_t (image);
+      if (!image[4] || imagelen > IMAGELEN_LIMIT)
+        continue;  /* Empty or too large.  */
+
+      _keybox_set_blob_image (range->blob, image, imagelen, pos);
+      if (!blob_wanted_p (range->blob, job->want_blobtype, job->ephemeral))
+        continue;
+      rc = 0;
+      if (!match_blob (range->blob, job->desc, job->ndesc, job->sn_array,
+                       &n, &pk_no, &uid_no, &rc))
+        continue;
+
+      if (range->nhits == range->size)
+        {
+          struct scan_hit_s *tmp;
+
+          range->size = range->size? 2 * range->size : 16;
+          tmp = xtryrealloc (range->hits, range->size * sizeof *tmp);
+          if (!tmp)
+            {
+              range->failed = 1;
+              return;
+            }
+          range->hits = tmp;
+        }
+      range->hits[range->nhits].off = pos;
+      range->hits[range->nhits].len = imagelen;
+      range->hits[range->nhits].descidx = n;
+      range->hits[range->nhits].pk_no = pk_no;
+      range->hits[range->nhits].uid_no = uid_no;
+      range->nhits++;
+    }
+}
+
+
+/* Release the results of a parallel scan of HD.  */
+void
+_keybox_release_scan (KEYBOX_HANDLE hd)
+{
+  if (!hd->scan)
+    return;
+  _keybox_map_unref (hd->scan->map);
+  xfree (hd->scan->hits);
+  xfree (hd->scan);
+  hd->scan = NULL;
+}
+
+
+/* Scan the rest of the file of HD for the NDESC search descriptions
+   in DESC using the parallel hook.  On success the results are
+   stored at HD->SCAN; on failure nothing is changed and the caller
+   continues with the usual search.  The number of blobs skipped
+   because they are too large is added to R_SKIPPED.  */
+static void
+start_parallel_scan (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                     keybox_blobtype_t want_blobtype,
+                     struct sn_array_s *sn_array, unsigned long *r_skipped)
+{
+  keybox_map_t map;
+  const unsigned char *image;
+  size_t length, start, pos, imagelen, chunk;
+  off_t off;
+  struct scan_range_s *ranges;
+  unsigned int nranges, maxranges, i;
+  unsigned long skipped = 0;
+  struct scan_job_s job;
+  struct keybox_scan_s *scan;
+  size_t nhits;
+  int failed = 0;
+
+  off = ftello (hd->fp);
+  if (off == (off_t)-1)
+    return;
+  map = _keybox_map_file (hd, &image, &length);
+  if (!map || (size_t)off != off || (size_t)off > length
+      || length - off < MIN_PARALLEL_SCAN)
+    return;
+  start = off;
+
+  maxranges = hd->parallel_threads * SCAN_RANGES_PER_THREAD;
+  if (maxranges > MAX_SCAN_RANGES)
+    maxranges = MAX_SCAN_RANGES;
+  ranges = xtrycalloc (maxranges, sizeof *ranges);
+  if (!ranges)
+    return;
+  chunk = (length - start) / maxranges + 1;
+
+  /* Split the file at blob boundaries.  This walks the chain of blob
+     lengths and stops at anything out of the ordinary, which is
+     left to the usual code.  */
+  nranges = 0;
+  ranges[0].start = start;
+  for (pos = start; length - pos >= 5; pos += imagelen)
+    {
+      imagelen = buf32_to_size_t (image + pos);
+      if (imagelen < 5 || imagelen > length - pos)
+        break;
+      if (image[pos+4] && imagelen > IMAGELEN_LIMIT)
+        skipped++;
+      if (pos - ranges[nranges].start >= chunk && nranges + 1 < maxranges)
+        {
+          ranges[nranges].end = pos;
+          ranges[++nranges].start = pos;
+        }
+    }
+  ranges[nranges++].end = pos;
+
+  for (i=0; i < nranges; i++)
+    if (_keybox_new_mapped_blob (&ranges[i].blob, map, image, 5, 0))
+      {
+        failed = 1;
+        break;
+      }
+
+  if (!failed)
+    {
+      job.desc = desc;
+      job.ndesc = ndesc;
+      job.sn_array = sn_array;
+      job.want_blobtype = want_blobtype;
+      job.ephemeral = hd->ephemeral;
+      job.image = image;
+      job.ranges = ranges;
+      hd->parallel (scan_range, &job, nranges);
+    }
+
+  /* Merge the results in file order.  */
+  nhits = 0;
+  for (i=0; i < nranges; i++)
+    {
+      if (ranges[i].failed)
+        failed = 1;
+      nhits += ranges[i].nhits;
+    }
+  scan = failed? NULL : xtrycalloc (1, sizeof *scan);
+  if (scan)
+    {
+      scan->hits = xtrymalloc ((nhits? nhits : 1) * sizeof *scan->hits);
+      if (!scan->hits)
+        {
+          xfree (scan);
+          scan = NULL;
+        }
+    }
+  if (scan)
+    {
+      for (i=0; i < nranges; i++)
+        {
+          if (ranges[i].nhits)
+            memcpy (scan->hits + scan->nhits, ranges[i].hits,
+                    ranges[i].nhits * sizeof *scan->hits);
+          scan->nhits += ranges[i].nhits;
+        }
+      scan->desc = desc;
+      scan->ndesc = ndesc;
+      scan->want_blobtype = want_blobtype;
+      _keybox_map_ref (map);
+      scan->map = map;
+      scan->image = image;
+      scan->end = pos;
+      hd->scan = scan;
+      *r_skipped += skipped;
+    }
+
+  for (i=0; i < nranges; i++)
+    {
+      _keybox_release_blob (ranges[i].blob);
+      xfree (ranges[i].hits);
+    }
+  xfree (ranges);
+}
+
+
+/* Return the next blob found by the parallel scan of HD at R_BLOB
+   along with the index of the matching description and the numbers
+   of the matching key or user id.  The file position is set behind
+   the blob.  If there are no more hits the scan is released, the
+   file position is set to the end of the scanned part and -1 is
+   returned.  */
+static int
+next_scan_hit (KEYBOX_HANDLE hd, KEYBOXBLOB *r_blob,
+               size_t *r_n, int *r_pk_no, int *r_uid_no)
+{
+  struct keybox_scan_s *scan = hd->scan;
+  struct scan_hit_s *hit;
+  off_t end;
+  int rc;
+
+  *r_blob = NULL;
+  if (scan->next == scan->nhits)
+    {
+      end = scan->end;
+      _keybox_release_scan (hd);
+      if (fseeko (hd->fp, end, SEEK_SET))
+        return gpg_error_from_syserror ();
+      return -1;
+    }
+
+  hit = scan->hits + scan->next++;
+  if (fseeko (hd->fp, hit->off + hit->len, SEEK_SET))
+    return gpg_error_from_syserror ();
+  rc = _keybox_new_mapped_blob (r_blob, scan->map, scan->image + hit->off,
+                                hit->len, hit->off);
+  if (rc)
+    return rc;
+  *r_n = hit->descidx;
+  *r_pk_no = hit->pk_no;
+  *r_uid_no = hit->uid_no;
+  return 0;
+}
+
+
+
 /*
 
   The search API
@@ -743,11 +1491,16 @@ keybox_search_reset (KEYBOX_HANDLE hd)
       hd->found.blob = NULL;
     }
 
+  _keybox_release_scan (hd);
   if (hd->fp)
     {
       fclose (hd->fp);
       hd->fp = NULL;
     }
+  _keybox_index_release (hd->index);
+  hd->index = NULL;
+  _keybox_map_unref (hd->map);
+  hd->map = NULL;
   hd->error = 0;
   hd->eof = 0;
   return 0;
@@ -769,6 +1522,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
   int need_words, any_skip;
   KEYBOXBLOB blob = NULL;
   struct sn_array_s *sn_array = NULL;
+  struct index_key_s *index_keys = NULL;
   int pk_no, uid_no;
 
   if (!hd)
@@ -885,15 +1639,75 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         }
     }
 
+  /* Use the index if all search descriptions can be looked up there.
+     The blobs it yields are matched like all others, thus a stale
+     entry does no harm.  */
+  if (ndesc && !hd->no_index)
+    {
+      index_keys = xtrycalloc (ndesc, sizeof *index_keys);
+      for (n=0; index_keys && n < ndesc; n++)
+        if (make_index_key (desc + n,
+                            sn_array? sn_array[n].sn : desc[n].sn,
+                            sn_array? sn_array[n].snlen : desc[n].snlen,
+                            index_keys + n))
+          break;
+      if (index_keys && n == ndesc)
+        {
+          rc = open_index (hd);
+          if (rc)
+            {
+              hd->error = rc;
+              xfree (index_keys);
+              if (sn_array)
+                release_sn_array (sn_array, ndesc);
+              return rc;
+            }
+        }
+      if (!hd->index || n < ndesc)
+        {
+          xfree (index_keys);
+          index_keys = NULL;
+        }
+    }
+
 
   pk_no = uid_no = 0;
-  for (;;)
+
+  /* Return the results of a parallel scan of this search; anything
+     else ends the scan but continues behind the last blob
+     returned.  */
+  if (hd->scan && (hd->scan->desc != desc || hd->scan->ndesc != ndesc
+                   || hd->scan->want_blobtype != want_blobtype))
+    _keybox_release_scan (hd);
+  if (!hd->scan && !index_keys && hd->parallel
+      && parallel_scan_p (desc, ndesc))
+    start_parallel_scan (hd, desc, ndesc, want_blobtype, sn_array,
+                         r_skipped);
+  while (hd->scan)
     {
-      unsigned int blobflags;
-      int blobtype;
+      rc = next_scan_hit (hd, &blob, &n, &pk_no, &uid_no);
+      if (rc == -1)
+        break;  /* Look at the rest of the file as usual.  */
+      if (rc)
+        goto leave;
+      if (!any_skip || !skip_blob_p (blob, desc, ndesc))
+        {
+          if (r_descindex)
+            *r_descindex = n;
+          goto leave;
+        }
+      _keybox_release_blob (blob);
+      blob = NULL;
+    }
+  rc = 0;
 
+  for (;;)
+    {
       _keybox_release_blob (blob); blob = NULL;
-      rc = _keybox_read_blob (&blob, hd->fp);
+      if (index_keys)
+        rc = read_indexed_blob (hd, index_keys, ndesc, &blob);
+      else
+        rc = _keybox_read_blob_hd (hd, &blob);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
         {
@@ -904,116 +1718,22 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       if (rc)
         break;
 
-      blobtype = blob_get_type (blob);
-      if (blobtype == KEYBOX_BLOBTYPE_HEADER)
-        continue;
-      if (want_blobtype && blobtype != want_blobtype)
+      if (!blob_wanted_p (blob, want_blobtype, hd->ephemeral))
         continue;
 
-      blobflags = blob_get_blob_flags (blob);
-      if (!hd->ephemeral && (blobflags & 2))
-        continue; /* Not in ephemeral mode but blob is flagged ephemeral.  */
+      if (!match_blob (blob, desc, ndesc, sn_array,
+                       &n, &pk_no, &uid_no, &rc))
+        continue;
 
-      for (n=0; n < ndesc; n++)
-        {
-          switch (desc[n].mode)
-            {
-            case KEYDB_SEARCH_MODE_NONE:
-              never_reached ();
-              break;
-            case KEYDB_SEARCH_MODE_EXACT:
-              uid_no = has_username (blob, desc[n].u.name, 0);
-              if (uid_no)
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_MAIL:
-              uid_no = has_mail (blob, desc[n].u.name, 0);
-              if (uid_no)
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_MAILSUB:
-              uid_no = has_mail (blob, desc[n].u.name, 1);
-              if (uid_no)
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_SUBSTR:
-              uid_no =  has_username (blob, desc[n].u.name, 1);
-              if (uid_no)
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_MAILEND:
-            case KEYDB_SEARCH_MODE_WORDS:
-              /* not yet implemented */
-              break;
-            case KEYDB_SEARCH_MODE_ISSUER:
-              if (has_issuer (blob, desc[n].u.name))
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_ISSUER_SN:
-              if (has_issuer_sn (blob, desc[n].u.name,
-                                 sn_array? sn_array[n].sn : desc[n].sn,
-                                 sn_array? sn_array[n].snlen : desc[n].snlen))
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_SN:
-              if (has_sn (blob, sn_array? sn_array[n].sn : desc[n].sn,
-                                sn_array? sn_array[n].snlen : desc[n].snlen))
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_SUBJECT:
-              if (has_subject (blob, desc[n].u.name))
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_SHORT_KID:
-              pk_no = has_short_kid (blob, desc[n].u.kid[1]);
-              if (pk_no)
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_LONG_KID:
-              pk_no = has_long_kid (blob, desc[n].u.kid[0], desc[n].u.kid[1]);
-              if (pk_no)
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_FPR:
-            case KEYDB_SEARCH_MODE_FPR20:
-              pk_no = has_fingerprint (blob, desc[n].u.fpr);
-              if (pk_no)
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_KEYGRIP:
-              if (has_keygrip (blob, desc[n].u.grip))
-                goto found;
-              break;
-            case KEYDB_SEARCH_MODE_FIRST:
-              goto found;
-              break;
-            case KEYDB_SEARCH_MODE_NEXT:
-              goto found;
-              break;
-            default:
-              rc = gpg_error (GPG_ERR_INV_VALUE);
-              goto found;
-            }
-	}
-      continue;
-    found:
       /* Record which DESC we matched on.  Note this value is only
 	 meaningful if this function returns with no errors. */
       if(r_descindex)
 	*r_descindex = n;
-      for (n=any_skip?0:ndesc; n < ndesc; n++)
-        {
-          u32 kid[2];
-
-          if (desc[n].skipfnc
-              && blob_get_first_keyid (blob, kid)
-              && desc[n].skipfnc (desc[n].skipfncvalue, kid, NULL))
-            break;
-        }
-      if (n == ndesc)
+      if (!any_skip || !skip_blob_p (blob, desc, ndesc))
         break; /* got it */
     }
 
+ leave:
   if (!rc)
     {
       hd->found.blob = blob;
@@ -1033,6 +1753,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 
   if (sn_array)
     release_sn_array (sn_array, ndesc);
+  xfree (index_keys);
 
   return rc;
 }
@@ -1046,6 +1767,14 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 */
 
 
+/* Release callback for iobufs created by keybox_get_keyblock.  */
+static void
+release_map (void *arg)
+{
+  _keybox_map_unref (arg);
+}
+
+
 /* Return the last found keyblock.  Returns 0 on success and stores a
    new iobuf at R_IOBUF and a signature status vector at R_SIGSTATUS
    in that case.  R_UID_NO and R_PK_NO are used to retun the number of
@@ -1061,6 +1790,7 @@ keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
   size_t image_off, image_len;
   size_t siginfo_off, siginfo_len;
   u32 *sigstatus, n, n_sigs, sigilen;
+  keybox_map_t map;
 
   *r_iobuf = NULL;
   *r_sigstatus = NULL;
@@ -1098,7 +1828,64 @@ keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
   *r_pk_no  = hd->found.pk_no;
   *r_uid_no = hd->found.uid_no;
   *r_sigstatus = sigstatus;
-  *r_iobuf = iobuf_temp_with_content (buffer+image_off, image_len);
+  map = _keybox_get_blob_map (hd->found.blob);
+  if (map)
+    {
+      /* The keyblock is read right from the mapping which thus has to
+         stay until the iobuf is closed.  */
+      _keybox_map_ref (map);
+      *r_iobuf = iobuf_temp_with_buffer (buffer+image_off, image_len,
+                                         release_map, map);
+    }
+  else
+    *r_iobuf = iobuf_temp_with_content (buffer+image_off, image_len);
+  return 0;
+}
+
+
+/* Return the keygrips stored with the last found keyblock.  On
+   success a new array with 40 bytes for each key, the fingerprint as
+   stored in the blob followed by the keygrip or all zeroes if that is
+   not known, is stored at R_GRIPS and the number of keys at R_NKEYS.
+   If the blob has no keygrips NULL is stored at R_GRIPS.  */
+gpg_error_t
+keybox_get_keygrips (KEYBOX_HANDLE hd, unsigned char **r_grips,
+                     unsigned int *r_nkeys)
+{
+  const unsigned char *buffer;
+  size_t length, nkeys, keyinfolen, n;
+  unsigned char *grips;
+
+  *r_grips = NULL;
+  *r_nkeys = 0;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!hd->found.blob)
+    return gpg_error (GPG_ERR_NOTHING_FOUND);
+  if (blob_get_type (hd->found.blob) != KEYBOX_BLOBTYPE_PGP)
+    return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  if (length < 20)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18);
+  if (keyinfolen < 48 || !nkeys)
+    return 0;  /* Written without keygrips.  */
+  if (20 + keyinfolen*nkeys > length)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  grips = xtrymalloc (40 * nkeys);
+  if (!grips)
+    return gpg_error_from_syserror ();
+  for (n=0; n < nkeys; n++)
+    {
+      memcpy (grips + 40*n, buffer + 20 + keyinfolen*n, 20);
+      memcpy (grips + 40*n + 20, buffer + 20 + keyinfolen*n + 28, 20);
+    }
+  *r_grips = grips;
+  *r_nkeys = nkeys;
   return 0;
 }
 
@@ -25,6 +25,8 @@
 #include <time.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "keybox-defs.h"
 #include "../common/sysutils.h"
@@ -36,6 +38,12 @@
 #define FILECOPY_DELETE 2
 #define FILECOPY_UPDATE 3
 
+/* Blobs flagged as deleted may take up this share of the file, in
+   percent, before an update compresses the keybox ... */
+#define GARBAGE_PERCENT 25
+/* ... but only if they take up at least that many bytes.  */
+#define GARBAGE_MIN     (64*1024)
+
 
 #if !defined(HAVE_FSEEKO) && !defined(fseeko)
 
@@ -67,6 +75,19 @@ fseeko (FILE * stream, off_t newpos, int whence)
 }
 #endif /* !defined(HAVE_FSEEKO) && !defined(fseeko) */
 
+#if !defined(HAVE_FTELLO) && !defined(ftello)
+static off_t
+ftello (FILE *stream)
+{
+  long int off;
+
+  off = ftell (stream);
+  if (off == -1)
+    return (off_t)-1;
+  return off;
+}
+#endif /* !defined(HAVE_FTELLO) && !defined(ftello) */
+
 
 
 static int
@@ -212,6 +233,330 @@ rename_tmp_file (const char *bakfname, const char *tmpfname,
 
 
 
+/* Increment the generation counter of the keybox whose first NREAD
+   bytes are in BUFFER.  Returns true and stores the old counter at
+   R_GENERATION if the keybox starts with a header blob.  */
+static int
+bump_generation (char *buffer, size_t nread, u32 *r_generation)
+{
+  unsigned char *p = (unsigned char *)buffer;
+  u32 val;
+
+  if (nread < 32 || p[4] != KEYBOX_BLOBTYPE_HEADER || memcmp (p+8, "KBXf", 4))
+    return 0;
+
+  val = buf32_to_u32 (p+12);
+  *r_generation = val;
+  val++;
+  p[12] = (val >> 24);
+  p[13] = (val >> 16);
+  p[14] = (val >>  8);
+  p[15] = (val      );
+  return 1;
+}
+
+
+/* Store VAL in network byte order at P.  */
+static void
+set_u32 (unsigned char *p, u32 val)
+{
+  p[0] = (val >> 24);
+  p[1] = (val >> 16);
+  p[2] = (val >>  8);
+  p[3] = (val      );
+}
+
+
+/* Return true if the GARBAGE bytes of deleted blobs in a keybox of
+   SIZE bytes call for a compress run.  */
+static int
+too_much_garbage (u32 garbage, off_t size)
+{
+  return (garbage >= GARBAGE_MIN
+          && (off_t)garbage > size / 100 * GARBAGE_PERCENT);
+}
+
+
+/* Flush FP and make sure that its data has reached the disk.  */
+static gpg_error_t
+sync_file (FILE *fp)
+{
+  if (fflush (fp))
+    return gpg_error_from_syserror ();
+#ifdef HAVE_FSYNC
+  if (fsync (fileno (fp)))
+    return gpg_error_from_syserror ();
+#endif
+  return 0;
+}
+
+
+/* Record the length of the keybox NEWFP, which has just been written
+   and starts with a header blob, in the header.  */
+static gpg_error_t
+record_file_length (FILE *newfp)
+{
+  unsigned char tmp[4];
+  off_t size;
+
+  size = ftello (newfp);
+  if (size == (off_t)-1)
+    return gpg_error_from_syserror ();
+  set_u32 (tmp, (u32)size);
+  if (fseeko (newfp, 28, SEEK_SET)
+      || fwrite (tmp, 4, 1, newfp) != 1
+      || fseeko (newfp, 0, SEEK_END))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Replace the keybox FNAME, which is open as *R_FP, by a copy of its
+   first END bytes and open that one instead.  This cuts off a torn
+   append.  The file is not truncated in place because other processes
+   may have it mapped; touching the mapped pages past the new end would
+   kill them with SIGBUS.  They keep reading the old file, which is
+   still complete up to END.  */
+static gpg_error_t
+cut_torn_append (const char *fname, FILE **r_fp, off_t end)
+{
+  gpg_error_t err;
+  FILE *fp = *r_fp;
+  FILE *newfp;
+  char *bakfname = NULL;
+  char *tmpfname = NULL;
+  char buffer[4096];
+  size_t n;
+  off_t pos;
+
+  err = create_tmp_file (fname, &bakfname, &tmpfname, &newfp);
+  if (err)
+    return err;
+  if (fseeko (fp, 0, SEEK_SET))
+    err = gpg_error_from_syserror ();
+  for (pos = 0; !err && pos < end; pos += n)
+    {
+      n = sizeof buffer;
+      if (end - pos < (off_t)n)
+        n = end - pos;
+      if (fread (buffer, n, 1, fp) != 1 || fwrite (buffer, n, 1, newfp) != 1)
+        err = gpg_error_from_syserror ();
+    }
+  if (!err)
+    err = sync_file (newfp);
+  if (fclose (newfp) && !err)
+    err = gpg_error_from_syserror ();
+  /* The blobs cut off are flagged as deleted, thus no backup is
+     needed; without one the file is replaced atomically.  */
+  if (!err)
+    err = rename_tmp_file (bakfname, tmpfname, fname, 1);
+  if (err)
+    gnupg_remove (tmpfname);
+  else
+    {
+      fclose (fp);
+      *r_fp = fopen (fname, "r+b");
+      if (!*r_fp)
+        err = gpg_error_from_syserror ();
+    }
+  xfree (bakfname);
+  xfree (tmpfname);
+  return err;
+}
+
+
+/* Append the NBLOBS blobs BLOBS to the keybox FNAME in place.  If
+   OLD_OFFSET is not -1 the only blob replaces the one at that offset,
+   which is then flagged as deleted.  Returns GPG_ERR_NOT_SUPPORTED
+   without changing anything if the file needs to be copied instead.
+   On success R_COMPRESS is set if the deleted blobs have grown too
+   large.
+
+   The writes are ordered so that a crash leaves a usable keybox:
+   The new blobs are first written flagged as deleted and only after
+   they reached the disk they get their real type.  The old blob is
+   flagged as deleted after that, thus at worst both versions
+   survive.  Finally the header gets the new generation and file
+   length; blobs beyond the recorded length are a torn append and
+   cut off by the next call.  */
+static gpg_error_t
+append_blobs (const char *fname, KEYBOXBLOB *blobs, int nblobs,
+              off_t old_offset, int for_openpgp, int *r_compress)
+{
+  gpg_error_t err = 0;
+  FILE *fp;
+  unsigned char header[32];
+  unsigned char tmp[5];
+  const unsigned char *image;
+  size_t imagelen;
+  struct stat st;
+  off_t size, end, pos, total;
+  u32 generation = 0;
+  u32 garbage = 0;
+  u32 oldlen = 0;
+  int i;
+
+  *r_compress = 0;
+  if (nblobs < 1 || (old_offset != -1 && nblobs != 1))
+    return gpg_error (GPG_ERR_BUG);
+  total = 0;
+  for (i=0; i < nblobs; i++)
+    {
+      _keybox_get_blob_image (blobs[i], &imagelen);
+      if (imagelen < 5)
+        return gpg_error (GPG_ERR_BUG);
+      total += imagelen;
+    }
+
+  fp = fopen (fname, "r+b");
+  if (!fp && errno == ENOENT)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);  /* Let filecopy create it. */
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  if (fread (header, sizeof header, 1, fp) != 1)
+    {
+      if (ferror (fp))
+        err = gpg_error_from_syserror ();
+      else
+        err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+  if (header[4] != KEYBOX_BLOBTYPE_HEADER || memcmp (header+8, "KBXf", 4))
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+  if (fstat (fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  size = st.st_size;
+
+  /* Check that the file ends where the last update left it.  If not,
+     it is either a torn append, which are blobs flagged as deleted up
+     to the end of the file, or the file has been changed by an older
+     version; the latter gets copied, which also records the
+     length.  */
+  end = size - (u32)((u32)size - buf32_to_u32 (header+28));
+  if (end != size)
+    {
+      size_t taillen;
+
+      if (end < (off_t)sizeof header)
+        {
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+          goto leave;
+        }
+      for (pos = end; pos < size; pos += taillen)
+        if (fseeko (fp, pos, SEEK_SET)
+            || fread (tmp, 5, 1, fp) != 1
+            || tmp[4]
+            || (taillen = buf32_to_size_t (tmp)) > IMAGELEN_LIMIT
+            || taillen < 5)
+          {
+            err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+            goto leave;
+          }
+      err = cut_torn_append (fname, &fp, end);
+      if (err)
+        {
+          if (!fp)
+            return err;
+          goto leave;
+        }
+      /* The index may cover the torn blobs; let it be rebuilt.  */
+      _keybox_index_remove (fname);
+      size = end;
+    }
+
+  if (old_offset != -1)
+    {
+      if (fseeko (fp, old_offset, SEEK_SET) || fread (tmp, 5, 1, fp) != 1)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (!tmp[4])
+        {
+          err = gpg_error (GPG_ERR_NOTHING_FOUND);
+          goto leave;
+        }
+      oldlen = buf32_to_u32 (tmp);
+    }
+
+  /* Append the blobs flagged as deleted and make them visible only
+     after they have been written completely.  */
+  if (fseeko (fp, size, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (i=0; i < nblobs; i++)
+    {
+      image = _keybox_get_blob_image (blobs[i], &imagelen);
+      if (fwrite (image, 4, 1, fp) != 1
+          || putc (0, fp) == EOF
+          || fwrite (image+5, imagelen-5, 1, fp) != 1)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+  err = sync_file (fp);
+  if (err)
+    goto leave;
+  for (pos = size, i=0; i < nblobs; pos += imagelen, i++)
+    {
+      image = _keybox_get_blob_image (blobs[i], &imagelen);
+      if (fseeko (fp, pos+4, SEEK_SET) || putc (image[4], fp) == EOF)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+  err = sync_file (fp);
+  if (err)
+    goto leave;
+
+  garbage = buf32_to_u32 (header+24);
+  if (old_offset != -1)
+    {
+      if (fseeko (fp, old_offset+4, SEEK_SET) || putc (0, fp) == EOF)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      garbage = garbage + oldlen < garbage? (u32)-1 : garbage + oldlen;
+    }
+
+  generation = buf32_to_u32 (header+12);
+  set_u32 (header+12, generation + 1);
+  set_u32 (header+24, garbage);
+  set_u32 (header+28, (u32)(size + total));
+  if (for_openpgp)
+    header[7] |= 0x02;  /* OpenPGP data may be available.  */
+  if (fseeko (fp, 0, SEEK_SET) || fwrite (header, sizeof header, 1, fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+ leave:
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err)
+    {
+      /* The entries of the old blob stay in the index; searches skip
+         them because the blob is flagged as deleted.  */
+      _keybox_index_append (fname, generation, size, blobs, nblobs);
+      *r_compress = too_much_garbage (garbage, size + total);
+    }
+  return err;
+}
+
+
 /* Perform insert/delete/update operation.  MODE is one of
    FILECOPY_INSERT, FILECOPY_DELETE, FILECOPY_UPDATE.  FOR_OPENPGP
    indicates that this is called due to an OpenPGP keyblock change.  */
@@ -225,6 +570,10 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
   char *tmpfname = NULL;
   char buffer[4096];  /* (Must be at least 32 bytes) */
   int nread, nbytes;
+  struct stat st;
+  off_t oldsize, oldlen = 0;
+  u32 generation;
+  int have_generation = 0;
 
   /* Open the source file. Because we do a rename, we have to check the
      permissions of the file */
@@ -248,6 +597,8 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
         }
 
       rc = _keybox_write_blob (blob, newfp);
+      if (!rc)
+        rc = record_file_length (newfp);
       if (rc)
         {
           fclose (newfp);
@@ -257,6 +608,9 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
       if ( fclose (newfp) )
         return gpg_error_from_syserror ();
 
+      /* Don't let an index of a former keybox get in the way.  */
+      _keybox_index_remove (fname);
+
 /*        if (chmod( fname, S_IRUSR | S_IWUSR )) */
 /*          { */
 /*            log_debug ("%s: chmod failed: %s\n", fname, strerror(errno) ); */
@@ -270,6 +624,13 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
       rc = gpg_error_from_syserror ();
       goto leave;
     }
+  if (fstat (fileno (fp), &st))
+    {
+      rc = gpg_error_from_syserror ();
+      fclose (fp);
+      goto leave;
+    }
+  oldsize = st.st_size;
 
   /* Create the new file. */
   rc = create_tmp_file (fname, &bakfname, &tmpfname, &newfp);
@@ -290,11 +651,12 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
          failsafe the blob type.) */
       while ( (nread = fread (buffer, 1, DIM(buffer), fp)) > 0 )
         {
-          if (first_record && for_openpgp
-              && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+          if (first_record)
             {
               first_record = 0;
-              buffer[7] |= 0x02; /* OpenPGP data may be available.  */
+              if (for_openpgp && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+                buffer[7] |= 0x02; /* OpenPGP data may be available.  */
+              have_generation = bump_generation (buffer, nread, &generation);
             }
 
           if (fwrite (buffer, nread, 1, newfp) != 1)
@@ -328,6 +690,8 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
           nread = fread (buffer, 1, nbytes, fp);
           if (!nread)
             break;
+          if (!current)
+            have_generation = bump_generation (buffer, nread, &generation);
           current += nread;
 
           if (fwrite (buffer, nread, 1, newfp) != 1)
@@ -346,14 +710,22 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
           goto leave;
         }
 
-      /* Skip this blob. */
-      rc = _keybox_read_blob (NULL, fp);
-      if (rc)
-        {
-          fclose (fp);
-          fclose (newfp);
-          return rc;
-        }
+      /* Skip this blob but remember its length for the index. */
+      {
+        KEYBOXBLOB oldblob;
+        size_t length;
+
+        rc = _keybox_read_blob (&oldblob, fp);
+        if (rc)
+          {
+            fclose (fp);
+            fclose (newfp);
+            return rc;
+          }
+        _keybox_get_blob_image (oldblob, &length);
+        oldlen = length;
+        _keybox_release_blob (oldblob);
+      }
     }
 
   /* Do an insert or update. */
@@ -390,6 +762,17 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
         }
     }
 
+  if (have_generation)
+    {
+      rc = record_file_length (newfp);
+      if (rc)
+        {
+          fclose (fp);
+          fclose (newfp);
+          goto leave;
+        }
+    }
+
   /* Close both files. */
   if (fclose(fp))
     {
@@ -405,6 +788,14 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
 
   rc = rename_tmp_file (bakfname, tmpfname, fname, secret);
 
+  /* Inserts append the blob; the others replace the blob at
+     START_OFFSET.  */
+  if (!rc && have_generation)
+    _keybox_index_update (fname, generation, oldsize,
+                          mode == FILECOPY_INSERT? oldsize : start_offset,
+                          oldlen,
+                          mode == FILECOPY_DELETE? NULL : blob);
+
  leave:
   xfree(bakfname);
   xfree(tmpfname);
@@ -412,18 +803,51 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
 }
 
 
+static int compress_keybox (KEYBOX_HANDLE hd, int force);
+
+
+/* Store BLOB in the keybox of HD.  If OLD_OFFSET is not -1 the blob
+   replaces the one at that offset.  The blob is appended in place if
+   possible; the entire file is only copied if it lacks a header blob
+   or has been changed by an older version.  */
+static gpg_error_t
+store_blob (KEYBOX_HANDLE hd, KEYBOXBLOB blob, off_t old_offset,
+            int for_openpgp)
+{
+  gpg_error_t err;
+  int compress;
+
+  err = append_blobs (hd->kb->fname, &blob, 1, old_offset, for_openpgp,
+                      &compress);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    {
+      if (old_offset == -1)
+        err = blob_filecopy (FILECOPY_INSERT, hd->kb->fname, blob,
+                             hd->secret, for_openpgp, 0);
+      else
+        err = blob_filecopy (FILECOPY_UPDATE, hd->kb->fname, blob,
+                             hd->secret, for_openpgp, old_offset);
+    }
+  else if (!err && compress)
+    compress_keybox (hd, 1);  /* The update is done; failing is okay.  */
+  return err;
+}
+
+
 /* Insert the OpenPGP keyblock {IMAGE,IMAGELEN} into HD.  SIGSTATUS is
    a vector describing the status of the signatures; its first element
-   gives the number of following elements.  */
+   gives the number of following elements.  If INFO is not NULL it
+   describes IMAGE as _keybox_parse_openpgp would do; the image is then
+   not parsed again.  */
 gpg_error_t
 keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen,
-                        u32 *sigstatus)
+                        u32 *sigstatus, keybox_openpgp_info_t info)
 {
   gpg_error_t err;
   const char *fname;
   KEYBOXBLOB blob;
   size_t nparsed;
-  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_info parsed;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -439,16 +863,22 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen,
      the write operation.  */
   _keybox_close_file (hd);
 
-  err = _keybox_parse_openpgp (image, imagelen, &nparsed, &info);
-  if (err)
-    return err;
-  assert (nparsed <= imagelen);
-  err = _keybox_create_openpgp_blob (&blob, &info, image, imagelen,
-                                     sigstatus, hd->ephemeral);
-  _keybox_destroy_openpgp_info (&info);
+  if (info)
+    err = _keybox_create_openpgp_blob (&blob, info, image, imagelen,
+                                       sigstatus, hd->ephemeral);
+  else
+    {
+      err = _keybox_parse_openpgp (image, imagelen, &nparsed, &parsed);
+      if (err)
+        return err;
+      assert (nparsed <= imagelen);
+      err = _keybox_create_openpgp_blob (&blob, &parsed, image, imagelen,
+                                         sigstatus, hd->ephemeral);
+      _keybox_destroy_openpgp_info (&parsed);
+    }
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      err = store_blob (hd, blob, -1, 1);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -460,16 +890,18 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen,
 
 
 /* Update the current key at HD with the given OpenPGP keyblock in
-   {IMAGE,IMAGELEN}.  */
+   {IMAGE,IMAGELEN}.  SIGSTATUS and INFO have the same meaning as for
+   keybox_insert_keyblock and may be NULL.  */
 gpg_error_t
-keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
+keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen,
+                        u32 *sigstatus, keybox_openpgp_info_t info)
 {
   gpg_error_t err;
   const char *fname;
   off_t off;
   KEYBOXBLOB blob;
   size_t nparsed;
-  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_info parsed;
 
   if (!hd || !image || !imagelen)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -490,18 +922,24 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   _keybox_close_file (hd);
 
   /* Build a new blob.  */
-  err = _keybox_parse_openpgp (image, imagelen, &nparsed, &info);
-  if (err)
-    return err;
-  assert (nparsed <= imagelen);
-  err = _keybox_create_openpgp_blob (&blob, &info, image, imagelen,
-                                     NULL, hd->ephemeral);
-  _keybox_destroy_openpgp_info (&info);
+  if (info)
+    err = _keybox_create_openpgp_blob (&blob, info, image, imagelen,
+                                       sigstatus, hd->ephemeral);
+  else
+    {
+      err = _keybox_parse_openpgp (image, imagelen, &nparsed, &parsed);
+      if (err)
+        return err;
+      assert (nparsed <= imagelen);
+      err = _keybox_create_openpgp_blob (&blob, &parsed, image, imagelen,
+                                         sigstatus, hd->ephemeral);
+      _keybox_destroy_openpgp_info (&parsed);
+    }
 
   /* Update the keyblock.  */
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret, 1, off);
+      err = store_blob (hd, blob, off, 1);
       _keybox_release_blob (blob);
     }
   return err;
@@ -534,7 +972,7 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
     {
-      rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+      rc = store_blob (hd, blob, -1, 0);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -544,6 +982,61 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   return rc;
 }
 
+/* Insert the NCERTS certificates CERTS into HD with one update of
+   the file.  SHA1_DIGESTS holds their 20 byte SHA-1 fingerprints one
+   after the other.  */
+gpg_error_t
+keybox_insert_certs (KEYBOX_HANDLE hd, ksba_cert_t *certs,
+                     unsigned char *sha1_digests, int ncerts)
+{
+  gpg_error_t err = 0;
+  const char *fname;
+  KEYBOXBLOB *blobs;
+  int i, compress = 0;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (!hd->kb)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  fname = hd->kb->fname;
+  if (!fname)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (ncerts < 1)
+    return 0;
+
+  /* Close this one otherwise we will mess up the position for a next
+     search.  */
+  _keybox_close_file (hd);
+
+  blobs = xtrycalloc (ncerts, sizeof *blobs);
+  if (!blobs)
+    return gpg_error_from_syserror ();
+  for (i=0; i < ncerts && !err; i++)
+    err = _keybox_create_x509_blob (blobs + i, certs[i],
+                                    sha1_digests + 20 * i, hd->ephemeral);
+  if (!err)
+    err = append_blobs (fname, blobs, ncerts, -1, 0, &compress);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    {
+      /* The file needs to be copied; do this with the first blob only,
+         which also gives the file a header, and append the others.  */
+      err = store_blob (hd, blobs[0], -1, 0);
+      if (!err && ncerts > 1)
+        err = append_blobs (fname, blobs + 1, ncerts - 1, -1, 0, &compress);
+      if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+        for (err = 0, i=1; !err && i < ncerts; i++)
+          err = store_blob (hd, blobs[i], -1, 0);
+    }
+  if (!err && compress)
+    compress_keybox (hd, 1);  /* The update is done; failing is okay.  */
+
+  for (i=0; i < ncerts; i++)
+    _keybox_release_blob (blobs[i]);
+  xfree (blobs);
+  return err;
+}
+
+
 int
 keybox_update_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
                     unsigned char *sha1_digest)
@@ -637,14 +1130,101 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
 }
 
 
+/* Replace the signature status values of the current OpenPGP blob at
+   HD by those in SIGSTATUS.  SIGSTATUS[0] must be the number of
+   signatures of the blob and is followed by one value for each of
+   them as described for keybox_insert_keyblock.  The values are
+   written in place and only if they differ from the stored ones.  */
+gpg_error_t
+keybox_set_sigstatus (KEYBOX_HANDLE hd, const u32 *sigstatus)
+{
+  off_t off;
+  FILE *fp;
+  gpg_err_code_t ec;
+  size_t pos, size, nsigs, siginfolen, n;
+  const unsigned char *buffer;
+  size_t length;
+  unsigned char *tmp;
+
+  if (!hd || !sigstatus)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!hd->found.blob)
+    return gpg_error (GPG_ERR_NOTHING_FOUND);
+  if (blob_get_type (hd->found.blob) != KEYBOX_BLOBTYPE_PGP)
+    return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+  if (!hd->kb)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+
+  off = _keybox_get_blob_fileoffset (hd->found.blob);
+  if (off == (off_t)-1)
+    return gpg_error (GPG_ERR_GENERAL);
+
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  ec = _keybox_get_flag_location (buffer, length, KEYBOX_FLAG_SIG_INFO,
+                                  &pos, &size);
+  if (ec)
+    return gpg_error (ec);
+  nsigs = buf16_to_uint (buffer + pos);
+  siginfolen = buf16_to_uint (buffer + pos + 2);
+  if (nsigs != sigstatus[0] || siginfolen != 4)
+    return gpg_error (GPG_ERR_INV_OBJ);
+  pos += 4;
+
+  for (n=0; n < nsigs; n++)
+    if (buf32_to_u32 (buffer + pos + 4*n) != sigstatus[n+1])
+      break;
+  if (n == nsigs)
+    return 0;  /* Nothing changed.  */
+
+  tmp = xtrymalloc (4*nsigs);
+  if (!tmp)
+    return gpg_error_from_syserror ();
+  for (n=0; n < nsigs; n++)
+    {
+      tmp[4*n]   = sigstatus[n+1] >> 24;
+      tmp[4*n+1] = sigstatus[n+1] >> 16;
+      tmp[4*n+2] = sigstatus[n+1] >>  8;
+      tmp[4*n+3] = sigstatus[n+1];
+    }
+
+  _keybox_close_file (hd);
+  fp = fopen (hd->kb->fname, "r+b");
+  if (!fp)
+    {
+      ec = gpg_err_code_from_syserror ();
+      xfree (tmp);
+      return gpg_error (ec);
+    }
+
+  ec = 0;
+  if (fseeko (fp, off + pos, SEEK_SET))
+    ec = gpg_err_code_from_syserror ();
+  else if (fwrite (tmp, 4*nsigs, 1, fp) != 1)
+    ec = gpg_err_code_from_syserror ();
+  xfree (tmp);
+
+  if (fclose (fp))
+    {
+      if (!ec)
+        ec = gpg_err_code_from_syserror ();
+    }
+
+  return gpg_error (ec);
+}
+
+
 
 int
 keybox_delete (KEYBOX_HANDLE hd)
 {
-  off_t off;
+  off_t off, size;
   const char *fname;
   FILE *fp;
   int rc;
+  u32 generation;
+  u32 garbage = 0;
+  int have_generation;
+  size_t bloblen;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -660,12 +1240,34 @@ keybox_delete (KEYBOX_HANDLE hd)
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
   off += 4;
+  _keybox_get_blob_image (hd->found.blob, &bloblen);
 
   _keybox_close_file (hd);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
 
+  /* The blob stays in place, but searches through the index need to
+     notice the change; thus bump the generation.  The blob now counts
+     as garbage for the next compress run.  */
+  have_generation = !_keybox_read_generation (fp, &generation, &size);
+  if (have_generation)
+    {
+      unsigned char tmp[16];
+
+      if (fseeko (fp, 12, SEEK_SET) || fread (tmp, 16, 1, fp) != 1)
+        have_generation = 0;
+      else
+        {
+          garbage = buf32_to_u32 (tmp+12);
+          garbage = garbage + bloblen < garbage? (u32)-1 : garbage + bloblen;
+          set_u32 (tmp, generation + 1);
+          set_u32 (tmp+12, garbage);
+          if (fseeko (fp, 12, SEEK_SET) || fwrite (tmp, 16, 1, fp) != 1)
+            have_generation = 0;
+        }
+    }
+
   if (fseeko (fp, off, SEEK_SET))
     rc = gpg_error_from_syserror ();
   else if (putc (0, fp) == EOF)
@@ -679,14 +1281,54 @@ keybox_delete (KEYBOX_HANDLE hd)
         rc = gpg_error_from_syserror ();
     }
 
+  if (!rc && have_generation)
+    {
+      _keybox_index_update (fname, generation, size, 0, 0, NULL);
+      if (too_much_garbage (garbage, size))
+        compress_keybox (hd, 1);  /* Failing is okay.  */
+    }
+
   return rc;
 }
 
 
-/* Compress the keybox file.  This should be run with the file
-   locked. */
-int
-keybox_compress (KEYBOX_HANDLE hd)
+/* Return 1 if the blob in BUFFER of LENGTH bytes is to be kept by
+   a compress run, 0 if it is an ephemeral blob created before
+   CUT_TIME and -1 if the blob is corrupt.  */
+static int
+keep_blob (const unsigned char *buffer, size_t length, u32 cut_time)
+{
+  unsigned int blobflags;
+  size_t pos, size;
+  u32 created_at;
+
+  if (_keybox_get_flag_location (buffer, length,
+                                 KEYBOX_FLAG_BLOB, &pos, &size)
+      || size != 2)
+    return -1;
+  blobflags = buf16_to_uint (buffer+pos);
+  if ((blobflags & KEYBOX_FLAG_BLOB_EPHEMERAL))
+    {
+      /* This is an ephemeral blob. */
+      if (_keybox_get_flag_location (buffer, length,
+                                     KEYBOX_FLAG_CREATED_AT, &pos, &size)
+          || size != 4)
+        created_at = 0; /* oops. */
+      else
+        created_at = buf32_to_u32 (buffer+pos);
+
+      if (created_at && created_at < cut_time)
+        return 0;
+    }
+  return 1;
+}
+
+
+/* Compress the keybox file.  Unless FORCE is set this is only done
+   if the last run is some time ago or deleted blobs take up too much
+   space.  This should be run with the file locked. */
+static int
+compress_keybox (KEYBOX_HANDLE hd, int force)
 {
   int read_rc, rc;
   const char *fname;
@@ -726,18 +1368,23 @@ keybox_compress (KEYBOX_HANDLE hd)
     }
 
   /* A quick test to see if we need to compress the file at all.  We
-     schedule a compress run after 3 hours. */
-  if ( !_keybox_read_blob (&blob, fp) )
+     schedule a compress run after 3 hours or if too much space is
+     wasted. */
+  if ( !force && !_keybox_read_blob (&blob, fp) )
     {
       const unsigned char *buffer;
       size_t length;
+      struct stat st;
 
       buffer = _keybox_get_blob_image (blob, &length);
-      if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+      if (length >= 32 && buffer[4] == KEYBOX_BLOBTYPE_HEADER
+          && !fstat (fileno (fp), &st))
         {
           u32 last_maint = buf32_to_u32 (buffer+20);
+          u32 garbage = buf32_to_u32 (buffer+24);
 
-          if ( (last_maint + 3*3600) > time (NULL) )
+          if ( (last_maint + 3*3600) > time (NULL)
+               && !too_much_garbage (garbage, st.st_size) )
             {
               fclose (fp);
               _keybox_release_blob (blob);
@@ -768,10 +1415,9 @@ keybox_compress (KEYBOX_HANDLE hd)
   for (rc=0; !(read_rc = _keybox_read_blob2 (&blob, fp, &skipped_deleted));
        _keybox_release_blob (blob), blob = NULL )
     {
-      unsigned int blobflags;
       const unsigned char *buffer;
-      size_t length, pos, size;
-      u32 created_at;
+      size_t length;
+      int keep;
 
       if (skipped_deleted)
         any_changes = 1;
@@ -804,29 +1450,16 @@ keybox_compress (KEYBOX_HANDLE hd)
           continue;
         }
 
-      if (_keybox_get_flag_location (buffer, length,
-                                     KEYBOX_FLAG_BLOB, &pos, &size)
-          || size != 2)
+      keep = keep_blob (buffer, length, cut_time);
+      if (keep < 0)
         {
           rc = gpg_error (GPG_ERR_BUG);
           break;
         }
-      blobflags = buf16_to_uint (buffer+pos);
-      if ((blobflags & KEYBOX_FLAG_BLOB_EPHEMERAL))
-        {
-          /* This is an ephemeral blob. */
-          if (_keybox_get_flag_location (buffer, length,
-                                         KEYBOX_FLAG_CREATED_AT, &pos, &size)
-              || size != 4)
-            created_at = 0; /* oops. */
-          else
-            created_at = buf32_to_u32 (buffer+pos);
-
-          if (created_at && created_at < cut_time)
-            {
-              any_changes = 1;
-              continue; /* Skip this blob. */
-            }
+      if (!keep)
+        {
+          any_changes = 1;
+          continue; /* Skip this blob. */
         }
 
       rc = _keybox_write_blob (blob, newfp);
@@ -840,6 +1473,8 @@ keybox_compress (KEYBOX_HANDLE hd)
     rc = 0;
   else if (!rc)
     rc = read_rc;
+  if (!rc && any_changes)
+    rc = record_file_length (newfp);
 
   /* Close both files. */
   if (fclose(fp) && !rc)
@@ -847,13 +1482,226 @@ keybox_compress (KEYBOX_HANDLE hd)
   if (fclose(newfp) && !rc)
     rc = gpg_error_from_syserror ();
 
-  /* Rename or remove the temporary file. */
+  /* Rename or remove the temporary file.  The blobs have moved, thus
+     the index is dropped; the next search builds a new one.  */
   if (rc || !any_changes)
     gnupg_remove (tmpfname);
   else
-    rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+    {
+      rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+      if (!rc)
+        _keybox_index_remove (fname);
+    }
 
   xfree(bakfname);
   xfree(tmpfname);
   return rc;
 }
+
+
+/* Compress the keybox file if needed.  This should be run with the
+   file locked. */
+int
+keybox_compress (KEYBOX_HANDLE hd)
+{
+  return compress_keybox (hd, 0);
+}
+
+
+
+/* A live blob found by keybox_compact.  */
+struct compact_entry_s
+{
+  unsigned char fpr[20];  /* Fingerprint of the primary key or zero.  */
+  off_t off;              /* Offset of the blob in the old file.  */
+};
+
+
+static int
+compare_compact_entries (const void *a, const void *b)
+{
+  const struct compact_entry_s *x = a;
+  const struct compact_entry_s *y = b;
+  int cmp;
+
+  cmp = memcmp (x->fpr, y->fpr, 20);
+  if (cmp)
+    return cmp;
+  return x->off < y->off? -1 : x->off > y->off;
+}
+
+
+/* Rewrite the keybox of HD with only the live blobs, ordered by the
+   fingerprint of their primary key, and build a new index for it.
+   Unlike keybox_compress this is always done and also moves blobs
+   which keep their place otherwise; blobs of the same key end up
+   next to each other and a scan reads the file in index order.  The
+   flags and signature status stored in the blobs are copied
+   unchanged.  The new file is put into place with a rename and the
+   index is then written for exactly that file; a reader which sees
+   the new keybox before its index ignores the old index because it
+   does not match the generation.  If R_NBLOBS is not NULL the number
+   of blobs written is stored there.  This should be run with the
+   file locked.  */
+gpg_error_t
+keybox_compact (KEYBOX_HANDLE hd, unsigned long *r_nblobs)
+{
+  gpg_error_t err;
+  int read_rc;
+  const char *fname;
+  FILE *fp, *newfp;
+  char *bakfname = NULL;
+  char *tmpfname = NULL;
+  KEYBOXBLOB blob = NULL;
+  KEYBOXBLOB header = NULL;
+  struct compact_entry_s *table = NULL;
+  size_t tablesize = 0, nentries = 0, n;
+  u32 cut_time, generation;
+  off_t size;
+  keybox_index_t index;
+
+  if (r_nblobs)
+    *r_nblobs = 0;
+  if (!hd || !hd->kb)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (hd->secret)
+    return gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+  fname = hd->kb->fname;
+  if (!fname)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+
+  _keybox_close_file (hd);
+
+  if (access (fname, W_OK))
+    return gpg_error_from_syserror ();
+  fp = fopen (fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  /* Collect the live blobs.  */
+  cut_time = time (NULL) - 86400;
+  err = 0;
+  while (!(read_rc = _keybox_read_blob (&blob, fp)))
+    {
+      const unsigned char *buffer;
+      size_t length;
+      int keep;
+
+      buffer = _keybox_get_blob_image (blob, &length);
+      if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+        {
+          /* Only the first header blob is kept.  */
+          if (!header && !nentries)
+            header = blob;
+          else
+            _keybox_release_blob (blob);
+          blob = NULL;
+          continue;
+        }
+
+      keep = keep_blob (buffer, length, cut_time);
+      if (keep < 0)
+        {
+          err = gpg_error (GPG_ERR_BUG);
+          break;
+        }
+      if (keep)
+        {
+          if (nentries == tablesize)
+            {
+              struct compact_entry_s *tmp;
+
+              tablesize = tablesize? 2 * tablesize : 1024;
+              tmp = xtryrealloc (table, tablesize * sizeof *table);
+              if (!tmp)
+                {
+                  err = gpg_error_from_syserror ();
+                  break;
+                }
+              table = tmp;
+            }
+          /* The key info of a version 1 blob starts at offset 20
+             with the fingerprint of the primary key.  */
+          memset (table[nentries].fpr, 0, 20);
+          if (length >= 40 && buffer[5] == 1 && buf16_to_uint (buffer+16))
+            memcpy (table[nentries].fpr, buffer+20, 20);
+          table[nentries].off = _keybox_get_blob_fileoffset (blob);
+          nentries++;
+        }
+      _keybox_release_blob (blob);
+      blob = NULL;
+    }
+  _keybox_release_blob (blob);
+  blob = NULL;
+  if (!err && read_rc != -1)
+    err = read_rc;
+  if (err)
+    goto leave;
+
+  qsort (table, nentries, sizeof *table, compare_compact_entries);
+
+  /* Write the new file with the blobs in fingerprint order.  */
+  err = create_tmp_file (fname, &bakfname, &tmpfname, &newfp);
+  if (err)
+    goto leave;
+  if (header)
+    {
+      _keybox_update_header_blob (header, hd->for_openpgp);
+      err = _keybox_write_blob (header, newfp);
+    }
+  else
+    err = _keybox_write_header_blob (newfp, hd->for_openpgp);
+  for (n=0; !err && n < nentries; n++)
+    {
+      if (fseeko (fp, table[n].off, SEEK_SET))
+        err = gpg_error_from_syserror ();
+      else if ((read_rc = _keybox_read_blob (&blob, fp)))
+        err = read_rc == -1? gpg_error (GPG_ERR_BUG) : read_rc;
+      else
+        {
+          err = _keybox_write_blob (blob, newfp);
+          _keybox_release_blob (blob);
+          blob = NULL;
+        }
+    }
+  if (!err)
+    err = record_file_length (newfp);
+  if (!err)
+    err = sync_file (newfp);
+  if (fclose (newfp) && !err)
+    err = gpg_error_from_syserror ();
+  fclose (fp);
+  fp = NULL;
+  if (err)
+    {
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  err = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+  if (err)
+    goto leave;
+  if (r_nblobs)
+    *r_nblobs = nentries;
+
+  /* Build the index for the new file.  Failing to do so only costs
+   * the next search some time.  */
+  _keybox_index_remove (fname);
+  fp = fopen (fname, "rb");
+  if (fp && !_keybox_read_generation (fp, &generation, &size))
+    {
+      fclose (fp);
+      fp = NULL;
+      if (!_keybox_index_build (&index, fname, generation, size))
+        _keybox_index_release (index);
+    }
+
+ leave:
+  if (fp)
+    fclose (fp);
+  _keybox_release_blob (header);
+  xfree (table);
+  xfree (bakfname);
+  xfree (tmpfname);
+  return err;
+}
@@ -56,6 +56,45 @@ typedef enum
 #define KEYBOX_FLAG_BLOB_SECRET     1
 #define KEYBOX_FLAG_BLOB_EPHEMERAL  2
 
+/* Openpgp helper structures.  They describe an OpenPGP keyblock
+   image; the keybox code fills them by parsing the image, but the
+   creator of an image may also pass them along with it.  */
+struct _keybox_openpgp_key_info
+{
+  struct _keybox_openpgp_key_info *next;
+  int algo;
+  unsigned char keyid[8];
+  int fprlen;  /* Either 16 or 20 */
+  unsigned char fpr[20];
+  int have_grip;  /* GRIP is valid.  */
+  unsigned char grip[20];
+};
+
+struct _keybox_openpgp_uid_info
+{
+  struct _keybox_openpgp_uid_info *next;
+  size_t off;   /* Offset of the user ID data in the image.  */
+  size_t len;
+};
+
+struct _keybox_openpgp_info
+{
+  int is_secret;        /* True if this is a secret key. */
+  unsigned int nsubkeys;/* Total number of subkeys.  */
+  unsigned int nuids;   /* Total number of user IDs in the keyblock. */
+  unsigned int nsigs;   /* Total number of signatures in the keyblock. */
+
+  /* Note, we use 2 structs here to better cope with the most common
+     use of having one primary and one subkey - this allows us to
+     statically allocate this structure and only malloc stuff for more
+     than one subkey. */
+  struct _keybox_openpgp_key_info primary;
+  struct _keybox_openpgp_key_info subkeys;
+  struct _keybox_openpgp_uid_info uids;
+};
+typedef struct _keybox_openpgp_info *keybox_openpgp_info_t;
+
+
 /* The keybox blob types.  */
 typedef enum
   {
@@ -77,6 +116,11 @@ void keybox_push_found_state (KEYBOX_HANDLE hd);
 void keybox_pop_found_state (KEYBOX_HANDLE hd);
 const char *keybox_get_resource_name (KEYBOX_HANDLE hd);
 int keybox_set_ephemeral (KEYBOX_HANDLE hd, int yes);
+int keybox_set_mmap (KEYBOX_HANDLE hd, int yes);
+typedef void (*keybox_parallel_t) (void (*fnc) (void *arg, unsigned int idx),
+                                   void *arg, unsigned int n);
+int keybox_set_parallel (KEYBOX_HANDLE hd, keybox_parallel_t fnc,
+                         unsigned int nthreads);
 
 int keybox_lock (KEYBOX_HANDLE hd, int yes);
 
@@ -88,6 +132,8 @@ int _keybox_write_header_blob (FILE *fp, int openpgp_flag);
 /*-- keybox-search.c --*/
 gpg_error_t keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
                                  int *r_uid_no, int *r_pk_no, u32 **sigstatus);
+gpg_error_t keybox_get_keygrips (KEYBOX_HANDLE hd, unsigned char **r_grips,
+                                 unsigned int *r_nkeys);
 #ifdef KEYBOX_WITH_X509
 int keybox_get_cert (KEYBOX_HANDLE hd, ksba_cert_t *ret_cert);
 #endif /*KEYBOX_WITH_X509*/
@@ -102,20 +148,27 @@ int keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 /*-- keybox-update.c --*/
 gpg_error_t keybox_insert_keyblock (KEYBOX_HANDLE hd,
                                     const void *image, size_t imagelen,
-                                    u32 *sigstatus);
+                                    u32 *sigstatus,
+                                    keybox_openpgp_info_t info);
 gpg_error_t keybox_update_keyblock (KEYBOX_HANDLE hd,
-                                    const void *image, size_t imagelen);
+                                    const void *image, size_t imagelen,
+                                    u32 *sigstatus,
+                                    keybox_openpgp_info_t info);
+gpg_error_t keybox_set_sigstatus (KEYBOX_HANDLE hd, const u32 *sigstatus);
 
 #ifdef KEYBOX_WITH_X509
 int keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
                         unsigned char *sha1_digest);
 int keybox_update_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
                         unsigned char *sha1_digest);
+gpg_error_t keybox_insert_certs (KEYBOX_HANDLE hd, ksba_cert_t *certs,
+                                 unsigned char *sha1_digests, int ncerts);
 #endif /*KEYBOX_WITH_X509*/
 int keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value);
 
 int keybox_delete (KEYBOX_HANDLE hd);
 int keybox_compress (KEYBOX_HANDLE hd);
+gpg_error_t keybox_compact (KEYBOX_HANDLE hd, unsigned long *r_nblobs);
 
 
 /*--  --*/
@@ -0,0 +1,580 @@
+/* t-keybox.c - Module tests for the keybox
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include <gcrypt.h>
+#include "../common/host2net.h"
+
+#define PGM "t-keybox"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+/* Enough keys to get a keybox which is large enough for an index.  */
+#define NKEYS 1000
+
+static char *fname;
+static char *idxfname;
+
+
+/* A keyblock made up by the test: a v4 RSA public key packet and a
+   user ID packet.  */
+struct testkey_s
+{
+  unsigned char image[512];
+  size_t imagelen;
+  unsigned char fpr[20];
+  char mail[32];
+};
+static struct testkey_s testkeys[NKEYS + 50];
+
+
+/* Append the header of a new format packet of TYPE and LEN to P.  */
+static unsigned char *
+put_packet_header (unsigned char *p, int type, size_t len)
+{
+  *p++ = 0xc0 | type;
+  if (len < 192)
+    *p++ = len;
+  else
+    {
+      *p++ = ((len - 192) >> 8) + 192;
+      *p++ = (len - 192);
+    }
+  return p;
+}
+
+
+/* Make the test key number N with the mail address "keyN@example.org"
+   or, if MAILNO is not -1, "keyMAILNO@example.org".  */
+static void
+make_key (struct testkey_s *k, int n, int mailno)
+{
+  unsigned char body[300], *p;
+  char uid[80];
+  size_t bodylen, uidlen;
+  unsigned char *hashbuf;
+
+  p = body;
+  *p++ = 4;                              /* Version.  */
+  *p++ = 0x55; *p++ = 0x00; *p++ = n >> 8; *p++ = n;  /* Created.  */
+  *p++ = 1;                              /* RSA.  */
+  *p++ = 2048 >> 8; *p++ = 2048 & 0xff;  /* MPI n.  */
+  gcry_create_nonce (p, 256);
+  p[0] |= 0x80;
+  p[255] = n;
+  p += 256;
+  *p++ = 0; *p++ = 17;                   /* MPI e.  */
+  *p++ = 1; *p++ = 0; *p++ = 1;
+  bodylen = p - body;
+
+  snprintf (k->mail, sizeof k->mail, "key%d@example.org",
+            mailno == -1? n : mailno);
+  snprintf (uid, sizeof uid, "Test key %d <%s>", n, k->mail);
+  uidlen = strlen (uid);
+
+  p = put_packet_header (k->image, 6, bodylen);
+  memcpy (p, body, bodylen);
+  p += bodylen;
+  p = put_packet_header (p, 13, uidlen);
+  memcpy (p, uid, uidlen);
+  p += uidlen;
+  k->imagelen = p - k->image;
+
+  hashbuf = xtrymalloc (bodylen + 3);
+  if (!hashbuf)
+    fail (0);
+  hashbuf[0] = 0x99;
+  hashbuf[1] = bodylen >> 8;
+  hashbuf[2] = bodylen;
+  memcpy (hashbuf + 3, body, bodylen);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, k->fpr, hashbuf, bodylen + 3);
+  xfree (hashbuf);
+}
+
+
+static KEYBOX_HANDLE
+open_keybox (int use_mmap)
+{
+  static void *token;
+  KEYBOX_HANDLE hd;
+
+  if (!token)
+    token = keybox_register_file (fname, 0);
+  if (!token)
+    fail (0);
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (0);
+  if (use_mmap)
+    keybox_set_mmap (hd, 1);
+  return hd;
+}
+
+
+static void
+insert_key (KEYBOX_HANDLE hd, struct testkey_s *k)
+{
+  gpg_error_t err;
+
+  err = keybox_insert_keyblock (hd, k->image, k->imagelen, NULL, NULL);
+  if (err)
+    {
+      fprintf (stderr, PGM ": error inserting a key: %s\n",
+               gpg_strerror (err));
+      fail (0);
+    }
+}
+
+
+/* Search for test key K by fingerprint (MODE 0), long key id (MODE 1)
+   or mail address (MODE 2).  Returns true if it is found; the found
+   blob must then be K.  */
+static int
+find_key (KEYBOX_HANDLE hd, struct testkey_s *k, int mode)
+{
+  KEYBOX_SEARCH_DESC desc;
+  iobuf_t iobuf;
+  int rc, pk_no, uid_no;
+  u32 *sigstatus;
+
+  memset (&desc, 0, sizeof desc);
+  switch (mode)
+    {
+    case 0:
+      desc.mode = KEYDB_SEARCH_MODE_FPR20;
+      memcpy (desc.u.fpr, k->fpr, 20);
+      break;
+    case 1:
+      desc.mode = KEYDB_SEARCH_MODE_LONG_KID;
+      desc.u.kid[0] = buf32_to_u32 (k->fpr + 12);
+      desc.u.kid[1] = buf32_to_u32 (k->fpr + 16);
+      break;
+    default:
+      desc.mode = KEYDB_SEARCH_MODE_MAIL;
+      desc.u.name = k->mail;
+      break;
+    }
+
+  keybox_search_reset (hd);
+  rc = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  if (rc == -1)
+    return 0;
+  if (rc)
+    fail (mode);
+  if (keybox_get_keyblock (hd, &iobuf, &pk_no, &uid_no, &sigstatus))
+    fail (mode);
+  xfree (sigstatus);
+  if (iobuf_get_temp_length (iobuf) != k->imagelen
+      || memcmp (iobuf_get_temp_buffer (iobuf), k->image, k->imagelen))
+    fail (mode);
+  iobuf_close (iobuf);
+  return 1;
+}
+
+
+/* Check that the keys FIRST to LAST are found with every search
+   mode.  Key NKEYS shares its mail address with key 5 and is thus
+   not looked up by mail.  */
+static void
+check_keys (KEYBOX_HANDLE hd, int first, int last)
+{
+  int i;
+
+  for (i=first; i <= last; i++)
+    if (!find_key (hd, testkeys + i, 0)
+        || !find_key (hd, testkeys + i, 1)
+        || (i != NKEYS && !find_key (hd, testkeys + i, 2)))
+      {
+        fprintf (stderr, PGM ": key %d not found\n", i);
+        fail (0);
+      }
+}
+
+
+static int
+file_exists (const char *name)
+{
+  struct stat st;
+
+  return !stat (name, &st);
+}
+
+
+/* Searches use the index once the keybox is large enough and give
+   the same results as a scan, also after updates and deletes.  */
+static void
+test_index (void)
+{
+  KEYBOX_HANDLE hd;
+  struct testkey_s other;
+  KEYBOX_SEARCH_DESC desc;
+  int i, nfound;
+
+  hd = open_keybox (0);
+  for (i=0; i < 20; i++)
+    insert_key (hd, testkeys + i);
+  check_keys (hd, 0, 19);
+  /* Too small for an index.  */
+  if (file_exists (idxfname))
+    fail (1);
+
+  for (; i < NKEYS; i++)
+    insert_key (hd, testkeys + i);
+  check_keys (hd, 0, NKEYS - 1);
+  if (!file_exists (idxfname))
+    fail (2);
+
+  /* A key which is not there.  */
+  make_key (&other, NKEYS + 49, -1);
+  for (i=0; i < 3; i++)
+    if (find_key (hd, &other, i))
+      fail (3);
+
+  /* A second key with the mail address of key 5; both are found.  */
+  make_key (testkeys + NKEYS, NKEYS, 5);
+  insert_key (hd, testkeys + NKEYS);
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_MAIL;
+  desc.u.name = "KEY5@example.org";
+  keybox_search_reset (hd);
+  for (nfound=0; !keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP,
+                                 NULL, NULL); nfound++)
+    ;
+  if (nfound != 2)
+    fail (4);
+  if (!find_key (hd, testkeys + NKEYS, 0))
+    fail (5);
+
+  /* Update key 7 with a new user ID.  */
+  if (!find_key (hd, testkeys + 7, 0))
+    fail (6);
+  other = testkeys[7];
+  make_key (testkeys + 7, 7, 7777);
+  memcpy (testkeys[7].image, other.image, 3 + 269);  /* Same key.  */
+  memcpy (testkeys[7].fpr, other.fpr, 20);
+  if (keybox_update_keyblock (hd, testkeys[7].image, testkeys[7].imagelen,
+                              NULL, NULL))
+    fail (7);
+  if (!find_key (hd, testkeys + 7, 0) || !find_key (hd, testkeys + 7, 2))
+    fail (8);
+  if (find_key (hd, &other, 2))
+    fail (9);
+
+  /* Delete key 9.  */
+  if (!find_key (hd, testkeys + 9, 1))
+    fail (10);
+  if (keybox_delete (hd))
+    fail (11);
+  for (i=0; i < 3; i++)
+    if (find_key (hd, testkeys + 9, i))
+      fail (12);
+  check_keys (hd, 10, NKEYS);
+  keybox_release (hd);
+
+  /* A new handle and one with a mapping see the same.  */
+  hd = open_keybox (1);
+  check_keys (hd, 0, 8);
+  check_keys (hd, 10, NKEYS);
+  keybox_release (hd);
+}
+
+
+/* An index which does not belong to the current keybox is not used;
+   a fresh one is built instead.  */
+static void
+test_stale_index (void)
+{
+  KEYBOX_HANDLE hd;
+  char *savename;
+  char cmd[1024];
+  int i;
+
+  savename = xtrymalloc (strlen (idxfname) + 6);
+  if (!savename)
+    fail (0);
+  strcpy (stpcpy (savename, idxfname), ".save");
+  snprintf (cmd, sizeof cmd, "cp '%s' '%s'", idxfname, savename);
+  if (system (cmd))
+    fail (1);
+
+  hd = open_keybox (0);
+  for (i=NKEYS + 1; i < NKEYS + 20; i++)
+    {
+      make_key (testkeys + i, i, -1);
+      insert_key (hd, testkeys + i);
+    }
+  keybox_release (hd);
+
+  /* Put back the index of an older generation.  */
+  if (rename (savename, idxfname))
+    fail (2);
+  hd = open_keybox (0);
+  check_keys (hd, NKEYS + 1, NKEYS + 19);
+  check_keys (hd, 10, 100);
+  keybox_release (hd);
+
+  /* A truncated index is not used either.  */
+  if (truncate (idxfname, 40))
+    fail (3);
+  hd = open_keybox (1);
+  check_keys (hd, NKEYS + 1, NKEYS + 19);
+  keybox_release (hd);
+
+  /* Nor is one vanished; the next search builds a new one.  */
+  remove (idxfname);
+  hd = open_keybox (0);
+  check_keys (hd, NKEYS + 1, NKEYS + 19);
+  if (!file_exists (idxfname))
+    fail (4);
+  keybox_release (hd);
+
+  /* Compressing the keybox removes the index.  */
+  hd = open_keybox (0);
+  if (keybox_compress (hd))
+    fail (5);
+  keybox_release (hd);
+  hd = open_keybox (0);
+  check_keys (hd, 0, 8);
+  check_keys (hd, 10, NKEYS + 19);
+  keybox_release (hd);
+
+  xfree (savename);
+}
+
+
+/* Read the garbage counter and the recorded file length from the
+   header blob.  */
+static void
+read_header (u32 *r_garbage, u32 *r_length)
+{
+  unsigned char header[32];
+  FILE *fp;
+
+  fp = fopen (fname, "rb");
+  if (!fp || fread (header, sizeof header, 1, fp) != 1)
+    fail (0);
+  fclose (fp);
+  *r_garbage = buf32_to_u32 (header+24);
+  *r_length = buf32_to_u32 (header+28);
+}
+
+
+static off_t
+file_size (struct stat *r_st)
+{
+  if (stat (fname, r_st))
+    fail (0);
+  return r_st->st_size;
+}
+
+
+/* Read the 5 bytes of the blob at OFF into BUF.  */
+static void
+read_blob_head (off_t off, unsigned char *buf)
+{
+  FILE *fp;
+
+  fp = fopen (fname, "rb");
+  if (!fp || fseeko (fp, off, SEEK_SET) || fread (buf, 5, 1, fp) != 1)
+    fail (0);
+  fclose (fp);
+}
+
+
+static void
+append_to_file (const void *buf, size_t len)
+{
+  FILE *fp;
+
+  fp = fopen (fname, "ab");
+  if (!fp || fwrite (buf, len, 1, fp) != 1 || fclose (fp))
+    fail (0);
+}
+
+
+/* Updates are appended in place.  A torn append left behind by a
+   crash is cut off by the next update without disturbing a reader
+   which has the file mapped; blobs appended by an older version are
+   kept.  */
+static void
+test_append (void)
+{
+  KEYBOX_HANDLE hd, hd2;
+  struct testkey_s other;
+  struct stat st;
+  unsigned char tail[40], *blob;
+  unsigned char head[5];
+  u32 garbage, garbage2, length;
+  off_t size, size2, bloblen;
+  ino_t ino;
+  FILE *fp;
+
+  hd = open_keybox (0);
+  make_key (testkeys + NKEYS + 20, NKEYS + 20, -1);
+  size = file_size (&st);
+  ino = st.st_ino;
+  insert_key (hd, testkeys + NKEYS + 20);
+  read_header (&garbage, &length);
+  size2 = file_size (&st);
+  if (st.st_ino != ino || size2 <= size)
+    fail (1);  /* Not appended in place.  */
+  if (length != (u32)size2)
+    fail (2);
+  check_keys (hd, NKEYS + 20, NKEYS + 20);
+
+  /* Replacing key 11 adds its old blob to the garbage.  */
+  if (!find_key (hd, testkeys + 11, 0))
+    fail (3);
+  other = testkeys[11];
+  make_key (testkeys + 11, 11, 1111);
+  memcpy (testkeys[11].image, other.image, 3 + 269);
+  memcpy (testkeys[11].fpr, other.fpr, 20);
+  if (keybox_update_keyblock (hd, testkeys[11].image, testkeys[11].imagelen,
+                              NULL, NULL))
+    fail (4);
+  read_header (&garbage2, &length);
+  size = file_size (&st);
+  if (st.st_ino != ino || length != (u32)size)
+    fail (5);
+  if (garbage2 <= garbage)
+    fail (6);
+  if (!find_key (hd, testkeys + 11, 0) || !find_key (hd, testkeys + 11, 2)
+      || find_key (hd, &other, 2))
+    fail (7);
+
+  /* A reader which has the file mapped.  */
+  hd2 = open_keybox (1);
+  check_keys (hd2, 0, 8);
+
+  /* A torn append: a blob still flagged as deleted past the recorded
+     length.  */
+  memset (tail, 0, sizeof tail);
+  tail[3] = sizeof tail;
+  append_to_file (tail, sizeof tail);
+  make_key (testkeys + NKEYS + 21, NKEYS + 21, -1);
+  insert_key (hd, testkeys + NKEYS + 21);
+  read_header (&garbage, &length);
+  size2 = file_size (&st);
+  if (length != (u32)size2)
+    fail (8);
+  /* The torn blob is gone and the new one took its place.  */
+  read_blob_head (size, head);
+  if (head[4] != KEYBOX_BLOBTYPE_PGP || size + buf32_to_u32 (head) != size2)
+    fail (9);
+  /* The file has been replaced instead of truncated.  */
+  if (st.st_ino == ino)
+    fail (10);
+  check_keys (hd, NKEYS + 20, NKEYS + 21);
+  check_keys (hd2, 0, 8);
+  keybox_release (hd2);
+
+  /* A live blob past the recorded length, as appended by an older
+     version; here a second copy of the last one.  The file is copied
+     with that blob.  */
+  bloblen = buf32_to_u32 (head);
+  blob = xtrymalloc (bloblen);
+  fp = fopen (fname, "rb");
+  if (!blob || !fp || fseeko (fp, size, SEEK_SET)
+      || fread (blob, bloblen, 1, fp) != 1)
+    fail (11);
+  fclose (fp);
+  append_to_file (blob, bloblen);
+  xfree (blob);
+  size = file_size (&st);
+  make_key (testkeys + NKEYS + 22, NKEYS + 22, -1);
+  insert_key (hd, testkeys + NKEYS + 22);
+  read_header (&garbage, &length);
+  size2 = file_size (&st);
+  if (length != (u32)size2)
+    fail (12);
+  read_blob_head (size - bloblen, head);
+  if (head[4] != KEYBOX_BLOBTYPE_PGP || buf32_to_u32 (head) != bloblen)
+    fail (13);
+  read_blob_head (size, head);
+  if (head[4] != KEYBOX_BLOBTYPE_PGP || size + buf32_to_u32 (head) != size2)
+    fail (14);
+  check_keys (hd, NKEYS + 20, NKEYS + 22);
+  check_keys (hd, 0, 8);
+  keybox_release (hd);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *tmpdir;
+  char *bakname;
+  FILE *fp;
+  int i;
+
+  (void)argc;
+  (void)argv;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  tmpdir = getenv ("TMPDIR");
+  if (!tmpdir || !*tmpdir)
+    tmpdir = "/tmp";
+  fname = xtrymalloc (strlen (tmpdir) + 40);
+  idxfname = xtrymalloc (strlen (tmpdir) + 44);
+  if (!fname || !idxfname)
+    fail (0);
+  snprintf (fname, strlen (tmpdir) + 40, "%s/" PGM "-%d.kbx",
+            tmpdir, (int)getpid ());
+  strcpy (stpcpy (idxfname, fname), ".idx");
+  remove (idxfname);
+  fp = fopen (fname, "wb");
+  if (!fp || _keybox_write_header_blob (fp, 1) || fclose (fp))
+    {
+      fprintf (stderr, PGM ": error creating '%s'\n", fname);
+      return 1;
+    }
+
+  for (i=0; i < NKEYS; i++)
+    make_key (testkeys + i, i, -1);
+
+  test_index ();
+  test_stale_index ();
+  test_append ();
+
+  bakname = xtrymalloc (strlen (fname) + 2);
+  if (bakname)
+    {
+      strcpy (stpcpy (bakname, fname), "~");
+      remove (bakname);
+      xfree (bakname);
+    }
+  remove (fname);
+  remove (idxfname);
+  xfree (fname);
+  xfree (idxfname);
+  return 0;
+}
@@ -78,6 +78,11 @@
 
 #define MAX_READER 4 /* Number of readers we support concurrently. */
 
+/* The time in milliseconds a status watcher waits before it checks
+   whether it shall terminate and waits again.  Waits which can be
+   cancelled use an infinite timeout.  */
+#define STATUS_WATCH_TIMEOUT 5000
+
 
 #if defined(_WIN32) || defined(__CYGWIN__)
 #define DLSTDCALL __stdcall
@@ -111,6 +116,9 @@ struct reader_table_s {
   int (*set_progress_cb)(int, gcry_handler_progress_t, void*);
   int (*pinpad_verify)(int, int, int, int, int, pininfo_t *);
   int (*pinpad_modify)(int, int, int, int, int, pininfo_t *);
+  int (*wait_status_change)(int, int *);
+  void (*cancel_wait)(int);
+  void (*get_ext_limits)(int, unsigned int *, unsigned int *);
 
   struct {
     ccid_driver_t handle;
@@ -123,6 +131,9 @@ struct reader_table_s {
     pcsc_dword_t modify_ioctl;
     int pinmin;
     int pinmax;
+    int wait_context_valid;
+    long wait_context;      /* Context used by the status watcher.  */
+    pcsc_dword_t wait_state;
 #ifdef NEED_PCSC_WRAPPER
     int req_fd;
     int rsp_fd;
@@ -151,6 +162,13 @@ struct reader_table_s {
 #ifdef USE_NPTH
   int lock_initialized;
   npth_mutex_t lock;
+  struct {
+    int running;       /* A thread has been started.  */
+    int stop;          /* Request the thread to terminate.  */
+    int failed;        /* The thread gave up due to an error.  */
+    npth_t thread;
+    void (*notify)(void);
+  } watch;
 #endif
 };
 typedef struct reader_table_s *reader_table_t;
@@ -347,6 +365,7 @@ long (* DLSTDCALL pcsc_transmit) (long card,
                                   pcsc_dword_t *recv_len);
 long (* DLSTDCALL pcsc_set_timeout) (long context,
                                      pcsc_dword_t timeout);
+long (* DLSTDCALL pcsc_cancel) (long context);
 long (* DLSTDCALL pcsc_control) (long card,
                                  pcsc_dword_t control_code,
                                  const void *send_buffer,
@@ -470,6 +489,14 @@ new_reader_slot (void)
   reader_table[reader].set_progress_cb = NULL;
   reader_table[reader].pinpad_verify = pcsc_pinpad_verify;
   reader_table[reader].pinpad_modify = pcsc_pinpad_modify;
+  reader_table[reader].wait_status_change = NULL;
+  reader_table[reader].cancel_wait = NULL;
+  reader_table[reader].get_ext_limits = NULL;
+#ifdef USE_NPTH
+  reader_table[reader].watch.running = 0;
+  reader_table[reader].watch.stop = 0;
+  reader_table[reader].watch.failed = 0;
+#endif
 
   reader_table[reader].used = 1;
   reader_table[reader].any_status = 0;
@@ -486,6 +513,7 @@ new_reader_slot (void)
   reader_table[reader].pcsc.modify_ioctl = 0;
   reader_table[reader].pcsc.pinmin = -1;
   reader_table[reader].pcsc.pinmax = -1;
+  reader_table[reader].pcsc.wait_context_valid = 0;
 
   return reader;
 }
@@ -1006,6 +1034,70 @@ pcsc_get_status_direct (int slot, unsigned int *status)
 #endif /*!NEED_PCSC_WRAPPER*/
 
 
+#if defined(USE_NPTH) && !defined(NEED_PCSC_WRAPPER)
+/* Wait for a change of the status of the reader in SLOT and set
+   R_CHANGED if there was one.  The status watcher uses its own
+   context so that it does not block the other users of the reader
+   while it is waiting.  */
+static int
+pcsc_wait_status_direct (int slot, int *r_changed)
+{
+  reader_table_t slotp = reader_table + slot;
+  struct pcsc_readerstate_s rdrstates[1];
+  long err;
+
+  *r_changed = 0;
+  if (!slotp->pcsc.wait_context_valid)
+    {
+      err = pcsc_establish_context (PCSC_SCOPE_SYSTEM, NULL, NULL,
+                                    &slotp->pcsc.wait_context);
+      if (err)
+        {
+          log_error ("pcsc_establish_context failed: %s (0x%lx)\n",
+                     pcsc_error_string (err), err);
+          return pcsc_error_to_sw (err);
+        }
+      slotp->pcsc.wait_context_valid = 1;
+      slotp->pcsc.wait_state = PCSC_STATE_UNAWARE;
+    }
+
+  memset (rdrstates, 0, sizeof *rdrstates);
+  rdrstates[0].reader = slotp->rdrname;
+  rdrstates[0].current_state = slotp->pcsc.wait_state;
+  npth_unprotect ();
+  err = pcsc_get_status_change (slotp->pcsc.wait_context,
+                                pcsc_cancel? 0xffffffff /*INFINITE*/
+                                /*       */: STATUS_WATCH_TIMEOUT,
+                                rdrstates, 1);
+  npth_protect ();
+  if (err == PCSC_E_TIMEOUT)
+    return 0;
+  if (err)
+    return pcsc_error_to_sw (err);
+
+  if ((rdrstates[0].event_state & PCSC_STATE_CHANGED))
+    {
+      /* The first call with an unaware state always reports a
+         change which does no harm.  The upper bits of the event
+         state are a counter and need to be passed back.  */
+      slotp->pcsc.wait_state = (rdrstates[0].event_state
+                                & ~PCSC_STATE_CHANGED);
+      *r_changed = 1;
+    }
+  return 0;
+}
+
+
+/* Make the status watcher of SLOT return from its wait.  */
+static void
+pcsc_cancel_wait_direct (int slot)
+{
+  if (pcsc_cancel && reader_table[slot].pcsc.wait_context_valid)
+    pcsc_cancel (reader_table[slot].pcsc.wait_context);
+}
+#endif /*USE_NPTH && !NEED_PCSC_WRAPPER*/
+
+
 #ifdef NEED_PCSC_WRAPPER
 static int
 pcsc_get_status_wrapped (int slot, unsigned int *status)
@@ -1116,6 +1208,18 @@ pcsc_get_status_wrapped (int slot, unsigned int *status)
 #endif /*NEED_PCSC_WRAPPER*/
 
 
+/* The PC/SC drivers are expected to handle extended length APDUs
+   with T=1.  */
+static void
+get_ext_limits_pcsc (int slot,
+                     unsigned int *r_max_cmd, unsigned int *r_max_rsp)
+{
+  (void)slot;
+  *r_max_cmd = 65535;
+  *r_max_rsp = 65535;
+}
+
+
 static int
 pcsc_get_status (int slot, unsigned int *status)
 {
@@ -1450,6 +1554,11 @@ control_pcsc (int slot, pcsc_dword_t ioctl_code,
 static int
 close_pcsc_reader_direct (int slot)
 {
+  if (reader_table[slot].pcsc.wait_context_valid)
+    {
+      pcsc_release_context (reader_table[slot].pcsc.wait_context);
+      reader_table[slot].pcsc.wait_context_valid = 0;
+    }
   pcsc_release_context (reader_table[slot].pcsc.context);
   xfree (reader_table[slot].rdrname);
   reader_table[slot].rdrname = NULL;
@@ -2001,7 +2110,12 @@ open_pcsc_reader_direct (const char *portstr)
   reader_table[slot].reset_reader = reset_pcsc_reader;
   reader_table[slot].get_status_reader = pcsc_get_status;
   reader_table[slot].send_apdu_reader = pcsc_send_apdu;
+  reader_table[slot].get_ext_limits = get_ext_limits_pcsc;
   reader_table[slot].dump_status_reader = dump_pcsc_reader_status;
+#ifdef USE_NPTH
+  reader_table[slot].wait_status_change = pcsc_wait_status_direct;
+  reader_table[slot].cancel_wait = pcsc_cancel_wait_direct;
+#endif
 
   dump_reader_status (slot);
   unlock_slot (slot);
@@ -2200,6 +2314,7 @@ open_pcsc_reader_wrapped (const char *portstr)
   reader_table[slot].reset_reader = reset_pcsc_reader;
   reader_table[slot].get_status_reader = pcsc_get_status;
   reader_table[slot].send_apdu_reader = pcsc_send_apdu;
+  reader_table[slot].get_ext_limits = get_ext_limits_pcsc;
   reader_table[slot].dump_status_reader = dump_pcsc_reader_status;
 
   pcsc_vendor_specific_init (slot);
@@ -2513,6 +2628,24 @@ get_status_ccid (int slot, unsigned int *status)
 }
 
 
+#ifdef USE_NPTH
+static int
+wait_status_ccid (int slot, int *r_changed)
+{
+  return ccid_wait_slot_change (reader_table[slot].ccid.handle,
+                                STATUS_WATCH_TIMEOUT, r_changed);
+}
+#endif /*USE_NPTH*/
+
+
+static void
+get_ext_limits_ccid (int slot,
+                     unsigned int *r_max_cmd, unsigned int *r_max_rsp)
+{
+  ccid_get_apdu_limits (reader_table[slot].ccid.handle, r_max_cmd, r_max_rsp);
+}
+
+
 /* Actually send the APDU of length APDULEN to SLOT and return a
    maximum of *BUFLEN data in BUFFER, the actual returned size will be
    set to BUFLEN.  Returns: Internal CCID driver error code. */
@@ -2637,6 +2770,10 @@ open_ccid_reader (const char *portstr)
   reader_table[slot].set_progress_cb = set_progress_cb_ccid_reader;
   reader_table[slot].pinpad_verify = ccid_pinpad_operation;
   reader_table[slot].pinpad_modify = ccid_pinpad_operation;
+  reader_table[slot].get_ext_limits = get_ext_limits_ccid;
+#ifdef USE_NPTH
+  reader_table[slot].wait_status_change = wait_status_ccid;
+#endif
   /* Our CCID reader code does not support T=0 at all, thus reset the
      flag.  */
   reader_table[slot].is_t0 = 0;
@@ -2951,6 +3088,128 @@ open_rapdu_reader (int portno,
 
 
 
+/* Store the largest data lengths of command and response APDUs
+   which can be exchanged with extended length APDUs using the reader
+   in SLOT at R_MAX_CMD and R_MAX_RSP.  Both are set to 0 if extended
+   length APDUs can't be used; we don't try them with T=0 or with
+   drivers which do not tell us their limits.  */
+void
+apdu_get_ext_limits (int slot,
+                     unsigned int *r_max_cmd, unsigned int *r_max_rsp)
+{
+  *r_max_cmd = 0;
+  *r_max_rsp = 0;
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used)
+    return;
+  if (reader_table[slot].is_t0)
+    return;
+
+  if (reader_table[slot].get_ext_limits)
+    reader_table[slot].get_ext_limits (slot, r_max_cmd, r_max_rsp);
+}
+
+
+
+/*
+       Status watcher
+ */
+
+#ifdef USE_NPTH
+/* The thread waiting for status changes of the reader in SLOT.  The
+   wait is done by the backend without holding the npth lock.  */
+static void *
+status_watcher_thread (void *arg)
+{
+  int slot = (int)(long)arg;
+  reader_table_t slotp = reader_table + slot;
+  int sw, changed;
+
+  while (!slotp->watch.stop)
+    {
+      sw = slotp->wait_status_change (slot, &changed);
+      if (slotp->watch.stop)
+        break;
+      if (sw)
+        {
+          /* Let the caller poll the status from now on; it will also
+             notice if the reader has been removed.  */
+          log_info ("reader slot %d: not watching the status anymore: %s\n",
+                    slot, apdu_strerror (sw));
+          slotp->watch.failed = 1;
+          slotp->watch.notify ();
+          break;
+        }
+      if (changed)
+        slotp->watch.notify ();
+    }
+  return NULL;
+}
+
+
+/* Terminate the status watcher of SLOT, if any.  */
+static void
+stop_status_watch (int slot)
+{
+  reader_table_t slotp = reader_table + slot;
+
+  if (!slotp->watch.running)
+    return;
+  slotp->watch.stop = 1;
+  if (slotp->cancel_wait)
+    slotp->cancel_wait (slot);
+  npth_join (slotp->watch.thread, NULL);
+  slotp->watch.running = 0;
+}
+#endif /*USE_NPTH*/
+
+
+/* Start a thread which calls NOTIFY whenever the status of the card
+   in SLOT may have changed.  NOTIFY is called with the npth lock held
+   and must not block; it is expected to make the caller check the
+   status with apdu_get_status.  Returns 0 if such a thread is
+   running; if not the caller needs to poll the status.  Calling this
+   again for a slot with a running thread does nothing.  */
+int
+apdu_watch_status (int slot, void (*notify)(void))
+{
+#ifdef USE_NPTH
+  reader_table_t slotp;
+  int err;
+
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used)
+    return SW_HOST_NO_DRIVER;
+  slotp = reader_table + slot;
+
+  if (slotp->watch.failed)
+    return SW_HOST_GENERAL_ERROR;
+  if (slotp->watch.running)
+    return 0;
+  if (!slotp->wait_status_change)
+    return SW_HOST_NOT_SUPPORTED;
+
+  slotp->watch.stop = 0;
+  slotp->watch.notify = notify;
+  err = npth_create (&slotp->watch.thread, NULL,
+                     status_watcher_thread, (void*)(long)slot);
+  if (err)
+    {
+      log_error ("error spawning status watcher: %s\n", strerror (err));
+      slotp->watch.failed = 1;
+      return SW_HOST_GENERAL_ERROR;
+    }
+  slotp->watch.running = 1;
+  if (DBG_READER)
+    log_debug ("reader slot %d: watching the status\n", slot);
+  return 0;
+#else /*!USE_NPTH*/
+  (void)slot;
+  (void)notify;
+  return SW_HOST_NOT_SUPPORTED;
+#endif /*!USE_NPTH*/
+}
+
+
+
 /*
        Driver Access
  */
@@ -3088,6 +3347,7 @@ apdu_open_reader (const char *portstr)
       pcsc_transmit          = dlsym (handle, "SCardTransmit");
       pcsc_set_timeout       = dlsym (handle, "SCardSetTimeout");
       pcsc_control           = dlsym (handle, "SCardControl");
+      pcsc_cancel            = dlsym (handle, "SCardCancel");
 
       if (!pcsc_establish_context
           || !pcsc_release_context
@@ -3194,6 +3454,9 @@ apdu_close_reader (int slot)
         log_debug ("leave: apdu_close_reader => SW_HOST_NO_DRIVER\n");
       return SW_HOST_NO_DRIVER;
     }
+#ifdef USE_NPTH
+  stop_status_watch (slot);
+#endif
   sw = apdu_disconnect (slot);
   if (sw)
     {
@@ -3230,6 +3493,9 @@ apdu_prepare_exit (void)
       for (slot = 0; slot < MAX_READER; slot++)
         if (reader_table[slot].used)
           {
+#ifdef USE_NPTH
+            stop_status_watch (slot);
+#endif
             apdu_disconnect (slot);
             if (reader_table[slot].close_reader)
               reader_table[slot].close_reader (slot);
@@ -3257,6 +3523,9 @@ apdu_shutdown_reader (int slot)
         log_debug ("leave: apdu_shutdown_reader => SW_HOST_NO_DRIVER\n");
       return SW_HOST_NO_DRIVER;
     }
+#ifdef USE_NPTH
+  stop_status_watch (slot);
+#endif
   sw = apdu_disconnect (slot);
   if (sw)
     {
@@ -115,6 +115,9 @@ int apdu_set_progress_cb (int slot, gcry_handler_progress_t cb, void *cb_arg);
 int apdu_reset (int slot);
 int apdu_get_status (int slot, int hang,
                      unsigned int *status, unsigned int *changed);
+int apdu_watch_status (int slot, void (*notify)(void));
+void apdu_get_ext_limits (int slot,
+                          unsigned int *r_max_cmd, unsigned int *r_max_rsp);
 int apdu_check_pinpad (int slot, int command, pininfo_t *pininfo);
 int apdu_pinpad_verify (int slot, int class, int ins, int p0, int p1,
 			pininfo_t *pininfo);
@@ -71,6 +71,8 @@ struct app_ctx_s {
   unsigned int force_chv1:1;   /* True if the card does not cache CHV1. */
   unsigned int did_chv2:1;
   unsigned int did_chv3:1;
+  unsigned int max_cmd_data;   /* The largest command and response data */
+  unsigned int max_rsp_data;   /* used with extended length APDUs or 0.  */
   struct app_local_s *app_local;  /* Local to the application. */
   struct {
     void (*deinit) (app_t app);
@@ -146,6 +148,7 @@ size_t app_help_read_length_of_cert (int slot, int fid, size_t *r_certoff);
 
 /*-- app.c --*/
 void app_dump_state (void);
+int app_reader_busy (int slot);
 void application_notify_card_reset (int slot);
 gpg_error_t check_application_conflict (ctrl_t ctrl, int slot,
                                         const char *name);
@@ -182,6 +182,12 @@ struct app_local_s {
 
   unsigned char status_indicator; /* The card status indicator.  */
 
+  /* The digital signature counter as last read from the card and
+     incremented for each signature created since then.  Reading it
+     needs an extra APDU for each signature otherwise.  */
+  unsigned long sig_counter;
+  unsigned int sig_counter_valid:1;
+
   unsigned int manufacturer:16;   /* Manufacturer ID from the s/n.  */
 
   /* Keep track of the ISO card capabilities.  */
@@ -292,6 +298,22 @@ do_deinit (app_t app)
 }
 
 
+/* Return true if command data of DATALEN bytes shall be sent using
+   an extended length APDU.  If the data does not fit into a short
+   APDU but exceeds what the card and the reader can take in one go,
+   command chaining is preferred.  */
+static int
+use_ext_length (app_t app, size_t datalen)
+{
+  if (!app->app_local->cardcap.ext_lc_le || datalen <= 254)
+    return 0;
+  if (datalen > app->app_local->extcap.max_cmd_data
+      && app->app_local->cardcap.cmd_chaining)
+    return 0;
+  return 1;
+}
+
+
 /* Wrapper around iso7816_get_data which first tries to get the data
    from the cache.  With GET_IMMEDIATE passed as true, the cache is
    bypassed.  With TRY_EXTLEN extended lengths APDUs are use if
@@ -762,6 +784,9 @@ store_fpr (app_t app, int keynumber, u32 timestamp, unsigned char *fpr,
   unsigned int n, nbits;
   unsigned char *buffer, *p;
   int tag, tag2;
+
+  /* Creating a new key resets the signature counter.  */
+  app->app_local->sig_counter_valid = 0;
   int rc;
   const unsigned char *m[MAX_ARGS_STORE_FPR];
   size_t mlen[MAX_ARGS_STORE_FPR];
@@ -1300,6 +1325,170 @@ get_curve_name (int curve)
 }
 
 
+/* The public keys are also kept in a file per card below the home
+   directory so that they need not be read again from the card by the
+   next session or after a reset; reading them is the slowest part of
+   learning a card.  Each line of the file has the key number, the
+   fingerprint of the key as stored on the card and the canonical
+   S-expression of the key, all in hex.  An entry is only used if the
+   fingerprint still matches; thus generating or writing a key on the
+   card makes the old entry invalid.  */
+#if GNUPG_MAJOR_VERSION > 1
+
+/* The longest line we accept in a key cache file.  */
+#define PKCACHE_MAXLINE 8192
+
+/* Return the malloced name of the key cache file for APP or NULL.  */
+static char *
+pkcache_filename (app_t app)
+{
+  char *hexsn, *fname;
+
+  if (!app->serialno || !app->serialnolen)
+    return NULL;
+  hexsn = xtrymalloc (2 * app->serialnolen + 1);
+  if (!hexsn)
+    return NULL;
+  bin2hex (app->serialno, app->serialnolen, hexsn);
+  fname = make_filename (opt.homedir, "scd-cache.d", hexsn, NULL);
+  xfree (hexsn);
+  return fname;
+}
+
+
+/* Try to take the public key for KEYNO (0..2) with the fingerprint
+   FPR (in hex) from the key cache.  Returns true on success.  */
+static int
+pkcache_get (app_t app, int keyno, const char *fpr)
+{
+  char *fname, *line, *p;
+  FILE *fp;
+  size_t n;
+  unsigned char *key;
+  int found = 0;
+
+  fname = pkcache_filename (app);
+  if (!fname)
+    return 0;
+  fp = fopen (fname, "r");
+  xfree (fname);
+  if (!fp)
+    return 0;
+
+  line = xtrymalloc (PKCACHE_MAXLINE);
+  while (line && !found && fgets (line, PKCACHE_MAXLINE, fp))
+    {
+      if (line[0] != '1' + keyno || line[1] != ' '
+          || strncmp (line+2, fpr, 40) || line[42] != ' ')
+        continue;
+      p = line + 43;
+      trim_trailing_spaces (p);
+      n = strlen (p);
+      if (!n || (n & 1))
+        continue;
+      n /= 2;
+      key = xtrymalloc (n + 1);
+      if (!key)
+        break;
+      if (hex2bin (p, key, n) < 0 || !gcry_sexp_canon_len (key, n, NULL, NULL))
+        {
+          xfree (key);
+          continue;
+        }
+      key[n] = 0;
+      app->app_local->pk[keyno].key = key;
+      app->app_local->pk[keyno].keylen = n;
+      found = 1;
+    }
+  xfree (line);
+  fclose (fp);
+  if (found && DBG_CARD_IO)
+    log_debug ("public key %d taken from the key cache\n", keyno+1);
+  return found;
+}
+
+
+/* Store the public key for KEYNO (0..2) with the fingerprint FPR (in
+   hex) in the key cache.  Errors are not fatal and only logged.  */
+static void
+pkcache_put (app_t app, int keyno, const char *fpr)
+{
+  char *fname = NULL, *tmpname = NULL, *line = NULL, *hexkey = NULL;
+  FILE *fp = NULL, *fpout = NULL;
+  const unsigned char *key = app->app_local->pk[keyno].key;
+  size_t keylen = app->app_local->pk[keyno].keylen;
+
+  if (!key || !keylen || 2 * keylen + 44 >= PKCACHE_MAXLINE)
+    return;
+
+  fname = pkcache_filename (app);
+  if (!fname)
+    return;
+  tmpname = strconcat (fname, ".tmp", NULL);
+  line = xtrymalloc (PKCACHE_MAXLINE);
+  hexkey = xtrymalloc (2 * keylen + 1);
+  if (!tmpname || !line || !hexkey)
+    goto leave;
+
+  fpout = fopen (tmpname, "w");
+  if (!fpout && errno == ENOENT)
+    {
+      /* Create the directory on first use.  */
+      char *dname = make_filename (opt.homedir, "scd-cache.d", NULL);
+
+      if (!gnupg_mkdir (dname, "-rwx"))
+        fpout = fopen (tmpname, "w");
+      xfree (dname);
+    }
+  if (!fpout)
+    {
+      log_info ("can't create '%s': %s\n", tmpname, strerror (errno));
+      goto leave;
+    }
+
+  /* Copy the entries of the other keys.  */
+  fp = fopen (fname, "r");
+  while (fp && fgets (line, PKCACHE_MAXLINE, fp))
+    if (line[0] != '1' + keyno && strchr (line, '\n'))
+      fputs (line, fpout);
+
+  fprintf (fpout, "%d %s %s\n",
+           keyno + 1, fpr, bin2hex (key, keylen, hexkey));
+  if (fp)
+    {
+      fclose (fp);
+      fp = NULL;
+    }
+  if (fclose (fpout))
+    {
+      fpout = NULL;
+      log_info ("error writing '%s': %s\n", tmpname, strerror (errno));
+      gnupg_remove (tmpname);
+      goto leave;
+    }
+  fpout = NULL;
+#ifdef HAVE_W32_SYSTEM
+  gnupg_remove (fname);
+#endif
+  if (rename (tmpname, fname))
+    {
+      log_info ("error renaming '%s': %s\n", tmpname, strerror (errno));
+      gnupg_remove (tmpname);
+    }
+
+ leave:
+  if (fp)
+    fclose (fp);
+  if (fpout)
+    fclose (fpout);
+  xfree (hexkey);
+  xfree (line);
+  xfree (tmpname);
+  xfree (fname);
+}
+#endif /*GNUPG_MAJOR_VERSION > 1*/
+
+
 /* Get the public key for KEYNO and store it as an S-expresion with
    the APP handle.  On error that field gets cleared.  If we already
    know about the public key we will just return.  Note that this does
@@ -1325,6 +1514,7 @@ get_public_key (app_t app, int keyno)
   char *keybuf = NULL;
   gcry_sexp_t s_pkey;
   size_t len;
+  char fpr[41];
 
   if (keyno < 1 || keyno > 3)
     return gpg_error (GPG_ERR_INV_ID);
@@ -1338,6 +1528,17 @@ get_public_key (app_t app, int keyno)
   app->app_local->pk[keyno].key = NULL;
   app->app_local->pk[keyno].keylen = 0;
 
+  /* Look into the key cache unless there is no key.  */
+  if (retrieve_fpr_from_card (app, keyno, fpr))
+    *fpr = 0;
+  else if (strspn (fpr, "0") == 40)
+    *fpr = 0;
+  else if (pkcache_get (app, keyno, fpr))
+    {
+      app->app_local->pk[keyno].read_done = 1;
+      return 0;
+    }
+
   m = e = NULL; /* (avoid cc warning) */
 
   if (app->card_version > 0x0100)
@@ -1415,7 +1616,6 @@ get_public_key (app_t app, int keyno)
 	 The helper we use here is gpg itself, which should know about
 	 the key in any case.  */
 
-      char fpr[41];
       char *hexkeyid;
       char *command = NULL;
       FILE *fp;
@@ -1423,9 +1623,9 @@ get_public_key (app_t app, int keyno)
 
       buffer = NULL; /* We don't need buffer.  */
 
-      err = retrieve_fpr_from_card (app, keyno, fpr);
-      if (err)
+      if (!*fpr)
 	{
+	  err = gpg_error (GPG_ERR_NOT_FOUND);
 	  log_error ("error while retrieving fpr from card: %s\n",
 		     gpg_strerror (err));
 	  goto leave;
@@ -1565,6 +1765,8 @@ get_public_key (app_t app, int keyno)
 
   app->app_local->pk[keyno].key = (unsigned char*)keybuf;
   app->app_local->pk[keyno].keylen = len - 1; /* Decrement for trailing '\0' */
+  if (*fpr)
+    pkcache_put (app, keyno, fpr);
 
  leave:
   /* Set a flag to indicate that we tried to read the key.  */
@@ -2152,7 +2354,7 @@ do_setattr (app_t app, const char *name,
      errors (e.g. data truncated by the card). */
   flush_cache_item (app, table[idx].tag);
 
-  if (app->app_local->cardcap.ext_lc_le && valuelen > 254)
+  if (use_ext_length (app, valuelen))
     exmode = 1;    /* Use extended length w/o a limit.  */
   else if (app->app_local->cardcap.cmd_chaining && valuelen > 254)
     exmode = -254; /* Command chaining with max. 254 bytes.  */
@@ -3129,7 +3331,7 @@ rsa_writekey (app_t app, gpg_error_t (*pincb)(void*, const char *, char **),
         goto leave;
 
       /* Store the key. */
-      if (app->app_local->cardcap.ext_lc_le && template_len > 254)
+      if (use_ext_length (app, template_len))
         exmode = 1;    /* Use extended length w/o a limit.  */
       else if (app->app_local->cardcap.cmd_chaining && template_len > 254)
         exmode = -254;
@@ -3364,7 +3566,7 @@ ecc_writekey (app_t app, gpg_error_t (*pincb)(void*, const char *, char **),
         goto leave;
 
       /* Store the key. */
-      if (app->app_local->cardcap.ext_lc_le && template_len > 254)
+      if (use_ext_length (app, template_len))
         exmode = 1;    /* Use extended length w/o a limit.  */
       else if (app->app_local->cardcap.cmd_chaining && template_len > 254)
         exmode = -254;
@@ -3639,11 +3841,16 @@ get_sig_counter (app_t app)
   size_t valuelen;
   unsigned long ul;
 
+  if (app->app_local->sig_counter_valid)
+    return app->app_local->sig_counter;
+
   relptr = get_one_do (app, 0x0093, &value, &valuelen, NULL);
   if (!relptr)
     return 0;
   ul = convert_sig_counter_value (value, valuelen);
   xfree (relptr);
+  app->app_local->sig_counter = ul;
+  app->app_local->sig_counter_valid = 1;
   return ul;
 }
 
@@ -3760,6 +3967,7 @@ do_sign (app_t app, const char *keyidstr, int hashalgo,
   int n;
   const char *fpr = NULL;
   unsigned long sigcount;
+  int skipped_verify;
   int use_auth = 0;
   int exmode, le_value;
 
@@ -3878,7 +4086,13 @@ do_sign (app_t app, const char *keyidstr, int hashalgo,
   sigcount = get_sig_counter (app);
   log_info (_("signatures created so far: %lu\n"), sigcount);
 
-  /* Check CHV if needed.  */
+  /* Check CHV if needed.  If PW1 stays valid for several signatures
+     and we verified it before, we don't ask for the PIN again but
+     rely on the card still knowing that.  Should the card have lost
+     that state behind our back, the signature fails with a security
+     status error and we come back here to verify again.  */
+  skipped_verify = 0;
+ retry:
   if (!app->did_chv1 || app->force_chv1 )
     {
       char *pinvalue;
@@ -3910,6 +4124,8 @@ do_sign (app_t app, const char *keyidstr, int hashalgo,
         }
       xfree (pinvalue);
     }
+  else
+    skipped_verify = 1;
 
 
   if (app->app_local->cardcap.ext_lc_le)
@@ -3924,6 +4140,17 @@ do_sign (app_t app, const char *keyidstr, int hashalgo,
     }
   rc = iso7816_compute_ds (app->slot, exmode, data, datalen, le_value,
                            outdata, outdatalen);
+  if (gpg_err_code (rc) == GPG_ERR_BAD_PIN && skipped_verify == 1)
+    {
+      log_info ("card has forgotten the PIN verification - retrying\n");
+      app->did_chv1 = 0;
+      skipped_verify = 2;
+      goto retry;
+    }
+  if (!rc)
+    app->app_local->sig_counter++;
+  else
+    app->app_local->sig_counter_valid = 0;
   return rc;
 }
 
@@ -4150,7 +4377,7 @@ do_decipher (app_t app, const char *keyidstr,
   else
     return gpg_error (GPG_ERR_INV_VALUE);
 
-  if (app->app_local->cardcap.ext_lc_le && indatalen > 254 )
+  if (use_ext_length (app, indatalen))
     {
       exmode = 1;    /* Extended length w/o a limit.  */
       le_value = app->app_local->extcap.max_rsp_data;
@@ -4369,6 +4596,39 @@ parse_ecc_curve (const unsigned char *buffer, size_t buflen)
 }
 
 
+/* Decide whether extended length APDUs are used and with which
+   sizes.  The card tells us in its historical bytes whether it
+   supports them and the extended capabilities give the sizes; both
+   are limited by what the reader is able to transfer.  For cards
+   which do not give the sizes we use the reader's limits.  */
+static void
+negotiate_ext_length (app_t app)
+{
+  struct app_local_s *apploc = app->app_local;
+  unsigned int max_cmd, max_rsp;
+
+  app->max_cmd_data = app->max_rsp_data = 0;
+  if (!apploc->cardcap.ext_lc_le)
+    return;
+
+  apdu_get_ext_limits (app->slot, &max_cmd, &max_rsp);
+  if (!max_cmd || !max_rsp)
+    {
+      log_info ("reader does not support extended length APDUs\n");
+      apploc->cardcap.ext_lc_le = 0;
+      return;
+    }
+
+  if (!apploc->extcap.max_cmd_data || apploc->extcap.max_cmd_data > max_cmd)
+    apploc->extcap.max_cmd_data = max_cmd;
+  if (!apploc->extcap.max_rsp_data || apploc->extcap.max_rsp_data > max_rsp)
+    apploc->extcap.max_rsp_data = max_rsp;
+
+  app->max_cmd_data = apploc->extcap.max_cmd_data;
+  app->max_rsp_data = apploc->extcap.max_rsp_data;
+}
+
+
 /* Parse and optionally show the algorithm attributes for KEYNO.
    KEYNO must be in the range 0..2.  */
 static void
@@ -43,6 +43,12 @@
 #include "apdu.h" /* fixme: we should move the card detection to a
                      separate file */
 
+/* The most directory files we keep in the directory cache.  */
+#define P15CACHE_MAXFILES 8
+
+/* The longest line we accept in a directory cache file.  */
+#define P15CACHE_MAXLINE 65536
+
 /* Types of cards we know and which needs special treatment. */
 typedef enum
   {
@@ -317,6 +323,24 @@ struct app_local_s
   /* Information on all authentication objects. */
   aodf_object_t auth_object_info;
 
+  /* Set once the directory files have been read and parsed.  */
+  int dirs_read;
+
+  /* The lastUpdate of EF(TokenInfo) in hex or NULL if the card does
+     not tell.  It is the change indicator of the directory cache.
+     Malloced.  */
+  char *last_update;
+
+  /* The contents of the directory files while they are read, either
+     taken from the directory cache or read from the card.  */
+  struct
+  {
+    unsigned short fid;
+    unsigned char *buffer;
+    size_t buflen;
+  } dirfile[P15CACHE_MAXFILES];
+  unsigned int ndirfiles;
+  int dirfiles_from_card;   /* At least one was read from the card.  */
 };
 
 
@@ -392,6 +416,9 @@ do_deinit (app_t app)
       release_prkdflist (app->app_local->private_key_info);
       release_aodflist (app->app_local->auth_object_info);
       xfree (app->app_local->serialno);
+      xfree (app->app_local->last_update);
+      while (app->app_local->ndirfiles)
+        xfree (app->app_local->dirfile[--app->app_local->ndirfiles].buffer);
       xfree (app->app_local);
       app->app_local = NULL;
     }
@@ -427,6 +454,49 @@ select_and_read_binary (int slot, unsigned short efid, const char *efid_desc,
 }
 
 
+/* Read the directory file FID like select_and_read_binary but take
+   it from the directory cache if it is there.  A file read from the
+   card is remembered for storing it in the cache.  */
+static gpg_error_t
+read_dir_file (app_t app, unsigned short fid, const char *efid_desc,
+               unsigned char **buffer, size_t *buflen)
+{
+  struct app_local_s *loc = app->app_local;
+  gpg_error_t err;
+  unsigned int i;
+
+  for (i=0; i < loc->ndirfiles; i++)
+    if (loc->dirfile[i].fid == fid)
+      {
+        *buffer = xtrymalloc (loc->dirfile[i].buflen + 1);
+        if (!*buffer)
+          return gpg_error_from_syserror ();
+        memcpy (*buffer, loc->dirfile[i].buffer, loc->dirfile[i].buflen);
+        *buflen = loc->dirfile[i].buflen;
+        if (DBG_CARD_IO)
+          log_debug ("%s (0x%04X) taken from the directory cache\n",
+                     efid_desc, fid);
+        return 0;
+      }
+
+  err = select_and_read_binary (app->slot, fid, efid_desc, buffer, buflen);
+  if (err || loc->ndirfiles == P15CACHE_MAXFILES)
+    return err;
+
+  i = loc->ndirfiles;
+  loc->dirfile[i].buffer = xtrymalloc (*buflen + 1);
+  if (loc->dirfile[i].buffer)
+    {
+      memcpy (loc->dirfile[i].buffer, *buffer, *buflen);
+      loc->dirfile[i].buflen = *buflen;
+      loc->dirfile[i].fid = fid;
+      loc->ndirfiles++;
+      loc->dirfiles_from_card = 1;
+    }
+  return 0;
+}
+
+
 /* This function calls select file to read a file using a complete
    path which may or may not start at the master file (MF). */
 static gpg_error_t
@@ -828,7 +898,7 @@ read_ef_prkdf (app_t app, unsigned short fid, prkdf_object_t *result)
   if (!fid)
     return gpg_error (GPG_ERR_NO_DATA); /* No private keys. */
 
-  err = select_and_read_binary (app->slot, fid, "PrKDF", &buffer, &buflen);
+  err = read_dir_file (app, fid, "PrKDF", &buffer, &buflen);
   if (err)
     return err;
 
@@ -1284,7 +1354,7 @@ read_ef_cdf (app_t app, unsigned short fid, cdf_object_t *result)
   if (!fid)
     return gpg_error (GPG_ERR_NO_DATA); /* No certificates. */
 
-  err = select_and_read_binary (app->slot, fid, "CDF", &buffer, &buflen);
+  err = read_dir_file (app, fid, "CDF", &buffer, &buflen);
   if (err)
     return err;
 
@@ -1557,7 +1627,7 @@ read_ef_aodf (app_t app, unsigned short fid, aodf_object_t *result)
   if (!fid)
     return gpg_error (GPG_ERR_NO_DATA); /* No authentication objects. */
 
-  err = select_and_read_binary (app->slot, fid, "AODF", &buffer, &buflen);
+  err = read_dir_file (app, fid, "AODF", &buffer, &buflen);
   if (err)
     return err;
 
@@ -2278,6 +2348,30 @@ read_ef_tokeninfo (app_t app)
   memcpy (app->app_local->serialno, p, objlen);
   app->app_local->serialnolen = objlen;
   log_printhex ("Serialnumber from EF(TokenInfo) is:", p, objlen);
+  p += objlen;
+  n -= objlen;
+
+  /* Skip the optional elements up to lastUpdate, which is [5].  We
+     keep it as the change indicator for the directory cache; a
+     parse error here is not fatal.  */
+  xfree (app->app_local->last_update);
+  app->app_local->last_update = NULL;
+  while (n)
+    {
+      if (parse_ber_header (&p, &n, &class, &tag, &constructed,
+                            &ndef, &objlen, &hdrlen)
+          || objlen > n)
+        break;
+      if (class == CLASS_CONTEXT && tag == 5 && objlen)
+        {
+          app->app_local->last_update = xtrymalloc (2 * objlen + 1);
+          if (app->app_local->last_update)
+            bin2hex (p, objlen, app->app_local->last_update);
+          break;
+        }
+      p += objlen;
+      n -= objlen;
+    }
 
  leave:
   xfree (buffer);
@@ -2285,36 +2379,191 @@ read_ef_tokeninfo (app_t app)
 }
 
 
-/* Get all the basic information from the pkcs#15 card, check the
-   structure and initialize our local context.  This is used once at
-   application initialization. */
-static gpg_error_t
-read_p15_info (app_t app)
+/* The parsed directory files of a card are not kept but their
+   contents are: like the public keys of an OpenPGP card they are
+   stored in a file per card below HOMEDIR/scd-cache.d, which is
+   named after the serial number with the suffix ".p15".  The first
+   line of the file has the lastUpdate of EF(TokenInfo), the other
+   lines the FID and the contents of a directory file, all in hex.
+   The file is only used if lastUpdate is unchanged; cards which do
+   not tell when they were last updated are never served from the
+   cache.  */
+
+/* Return the malloced name of the directory cache file for APP or
+   NULL.  */
+static char *
+dircache_filename (app_t app)
 {
-  gpg_error_t err;
+  char *hexsn, *fname;
+
+  if (!app->serialno || !app->serialnolen)
+    return NULL;
+  hexsn = xtrymalloc (2 * app->serialnolen + 4 + 1);
+  if (!hexsn)
+    return NULL;
+  bin2hex (app->serialno, app->serialnolen, hexsn);
+  strcat (hexsn, ".p15");
+  fname = make_filename (opt.homedir, "scd-cache.d", hexsn, NULL);
+  xfree (hexsn);
+  return fname;
+}
 
-  if (!read_ef_tokeninfo (app))
+
+/* Release the contents of the directory files kept with APP.  */
+static void
+dircache_release (app_t app)
+{
+  struct app_local_s *loc = app->app_local;
+  unsigned int i;
+
+  for (i=0; i < loc->ndirfiles; i++)
+    xfree (loc->dirfile[i].buffer);
+  memset (loc->dirfile, 0, sizeof loc->dirfile);
+  loc->ndirfiles = 0;
+  loc->dirfiles_from_card = 0;
+}
+
+
+/* Load the directory files of APP from the cache file if it matches
+   the card.  */
+static void
+dircache_load (app_t app)
+{
+  struct app_local_s *loc = app->app_local;
+  char *fname, *line, *p;
+  FILE *fp;
+  size_t n;
+  unsigned int i;
+
+  if (!loc->last_update)
+    return;
+  fname = dircache_filename (app);
+  if (!fname)
+    return;
+  fp = fopen (fname, "r");
+  xfree (fname);
+  if (!fp)
+    return;
+
+  line = xtrymalloc (P15CACHE_MAXLINE);
+  if (!line || !fgets (line, P15CACHE_MAXLINE, fp)
+      || strncmp (line, "P15 ", 4))
+    goto leave;
+  trim_trailing_spaces (line);
+  if (strcmp (line+4, loc->last_update))
+    goto leave;  /* The card has been changed.  */
+
+  while (loc->ndirfiles < P15CACHE_MAXFILES
+         && fgets (line, P15CACHE_MAXLINE, fp))
     {
-      /* If we don't have a serial number yet but the TokenInfo provides
-         one, use that. */
-      if (!app->serialno && app->app_local->serialno)
+      if (!strchr (line, '\n') || !hexdigitp (line) || !hexdigitp (line+1)
+          || !hexdigitp (line+2) || !hexdigitp (line+3) || line[4] != ' ')
+        break;  /* Truncated or corrupted.  */
+      p = line + 5;
+      trim_trailing_spaces (p);
+      n = strlen (p);
+      if (!n || (n & 1))
+        break;
+      n /= 2;
+      i = loc->ndirfiles;
+      loc->dirfile[i].buffer = xtrymalloc (n + 1);
+      if (!loc->dirfile[i].buffer)
+        break;
+      if (hex2bin (p, loc->dirfile[i].buffer, n) < 0)
         {
-          app->serialno = app->app_local->serialno;
-          app->serialnolen = app->app_local->serialnolen;
-          app->app_local->serialno = NULL;
-          app->app_local->serialnolen = 0;
-          err = app_munge_serialno (app);
-          if (err)
-            return err;
+          xfree (loc->dirfile[i].buffer);
+          loc->dirfile[i].buffer = NULL;
+          break;
         }
+      loc->dirfile[i].buflen = n;
+      loc->dirfile[i].fid = xtoi_2 (line) << 8 | xtoi_2 (line+2);
+      loc->ndirfiles++;
     }
 
-  /* Read the ODF so that we know the location of all directory
-     files. */
-  /* Fixme: We might need to get a non-standard ODF FID from TokenInfo. */
-  err = read_ef_odf (app, 0x5031);
-  if (err)
-    return err;
+ leave:
+  xfree (line);
+  fclose (fp);
+}
+
+
+/* Store the directory files kept with APP in the cache file.  Errors
+   are not fatal and only logged.  */
+static void
+dircache_store (app_t app)
+{
+  struct app_local_s *loc = app->app_local;
+  char *fname = NULL, *tmpname = NULL, *hex = NULL;
+  FILE *fp = NULL;
+  unsigned int i;
+  size_t maxlen = 0;
+
+  if (!loc->last_update || !loc->ndirfiles)
+    return;
+  for (i=0; i < loc->ndirfiles; i++)
+    if (loc->dirfile[i].buflen > maxlen)
+      maxlen = loc->dirfile[i].buflen;
+  if (2 * maxlen + 7 >= P15CACHE_MAXLINE
+      || strlen (loc->last_update) + 6 >= P15CACHE_MAXLINE)
+    return;
+
+  fname = dircache_filename (app);
+  if (!fname)
+    return;
+  tmpname = strconcat (fname, ".tmp", NULL);
+  hex = xtrymalloc (2 * maxlen + 1);
+  if (!tmpname || !hex)
+    goto leave;
+
+  fp = fopen (tmpname, "w");
+  if (!fp && errno == ENOENT)
+    {
+      /* Create the directory on first use.  */
+      char *dname = make_filename (opt.homedir, "scd-cache.d", NULL);
+
+      if (!gnupg_mkdir (dname, "-rwx"))
+        fp = fopen (tmpname, "w");
+      xfree (dname);
+    }
+  if (!fp)
+    {
+      log_info ("can't create '%s': %s\n", tmpname, strerror (errno));
+      goto leave;
+    }
+
+  fprintf (fp, "P15 %s\n", loc->last_update);
+  for (i=0; i < loc->ndirfiles; i++)
+    fprintf (fp, "%04X %s\n", loc->dirfile[i].fid,
+             bin2hex (loc->dirfile[i].buffer, loc->dirfile[i].buflen, hex));
+  if (fclose (fp))
+    {
+      log_info ("error writing '%s': %s\n", tmpname, strerror (errno));
+      gnupg_remove (tmpname);
+      goto leave;
+    }
+#ifdef HAVE_W32_SYSTEM
+  gnupg_remove (fname);
+#endif
+  if (rename (tmpname, fname))
+    {
+      log_info ("error renaming '%s': %s\n", tmpname, strerror (errno));
+      gnupg_remove (tmpname);
+    }
+
+ leave:
+  xfree (hex);
+  xfree (tmpname);
+  xfree (fname);
+}
+
+
+/* Read and parse all directory files.  They are taken from the
+   directory cache if it matches the card.  */
+static gpg_error_t
+do_read_p15_dirs (app_t app)
+{
+  gpg_error_t err;
+
+  dircache_load (app);
 
   /* Read certificate information. */
   assert (!app->app_local->certificate_info);
@@ -2349,6 +2598,103 @@ read_p15_info (app_t app)
   if (gpg_err_code (err) == GPG_ERR_NO_DATA)
     err = 0;
 
+  if (!err && app->app_local->dirfiles_from_card)
+    dircache_store (app);
+  return err;
+}
+
+
+/* Make sure that the directory files have been read.  Returns an
+   error if they could not be read; the next call tries again.  */
+static gpg_error_t
+read_p15_dirs (app_t app)
+{
+  struct app_local_s *loc = app->app_local;
+  gpg_error_t err = 0;
+  unsigned short path[1];
+
+  if (loc->dirs_read)
+    return 0;
+
+  /* The directory files are referenced relative to the home DF but
+     other commands may have selected another DF meanwhile.  */
+  if (loc->home_df)
+    {
+      path[0] = loc->home_df;
+      if (loc->direct_path_selection)
+        err = iso7816_select_path (app->slot, path, 1, NULL, NULL);
+      else
+        {
+          err = iso7816_select_file (app->slot, 0x3f00, 1, NULL, NULL);
+          if (!err)
+            err = iso7816_select_file (app->slot, loc->home_df, 1,
+                                       NULL, NULL);
+        }
+      if (err)
+        {
+          log_error ("error selecting the home DF 0x%04hX: %s\n",
+                     loc->home_df, gpg_strerror (err));
+          return err;
+        }
+    }
+
+  err = do_read_p15_dirs (app);
+  dircache_release (app);
+  if (err)
+    {
+      release_cdflist (loc->certificate_info);
+      loc->certificate_info = NULL;
+      release_cdflist (loc->trusted_certificate_info);
+      loc->trusted_certificate_info = NULL;
+      release_cdflist (loc->useful_certificate_info);
+      loc->useful_certificate_info = NULL;
+      release_prkdflist (loc->private_key_info);
+      loc->private_key_info = NULL;
+      release_aodflist (loc->auth_object_info);
+      loc->auth_object_info = NULL;
+      return err;
+    }
+  loc->dirs_read = 1;
+  return 0;
+}
+
+
+/* Get all the basic information from the pkcs#15 card, check the
+   structure and initialize our local context.  This is used once at
+   application initialization.  The directory files are only read by
+   read_p15_dirs when first needed.  */
+static gpg_error_t
+read_p15_info (app_t app)
+{
+  gpg_error_t err;
+
+  if (!read_ef_tokeninfo (app))
+    {
+      /* If we don't have a serial number yet but the TokenInfo provides
+         one, use that. */
+      if (!app->serialno && app->app_local->serialno)
+        {
+          app->serialno = app->app_local->serialno;
+          app->serialnolen = app->app_local->serialnolen;
+          app->app_local->serialno = NULL;
+          app->app_local->serialnolen = 0;
+          err = app_munge_serialno (app);
+          if (err)
+            return err;
+        }
+    }
+
+  /* Read the ODF so that we know the location of all directory
+     files. */
+  /* Fixme: We might need to get a non-standard ODF FID from TokenInfo. */
+  err = read_ef_odf (app, 0x5031);
+  if (err)
+    return err;
+
+  /* Without a home DF we could not select the directory files again
+     later; thus read them right now.  */
+  if (!app->app_local->home_df)
+    err = read_p15_dirs (app);
 
   return err;
 }
@@ -2499,6 +2845,10 @@ do_learn_status (app_t app, ctrl_t ctrl, unsigned int flags)
 {
   gpg_error_t err;
 
+  err = read_p15_dirs (app);
+  if (err)
+    return err;
+
   if ((flags & 1))
     err = 0;
   else
@@ -2655,7 +3005,9 @@ do_readcert (app_t app, const char *certid,
 
   *r_cert = NULL;
   *r_certlen = 0;
-  err = cdf_object_from_certid (app, certid, &cdf);
+  err = read_p15_dirs (app);
+  if (!err)
+    err = cdf_object_from_certid (app, certid, &cdf);
   if (!err)
     err = readcert_by_cdf (app, cdf, r_cert, r_certlen);
   return err;
@@ -2675,6 +3027,10 @@ do_getattr (app_t app, ctrl_t ctrl, const char *name)
       char *buf, *p;
       prkdf_object_t prkdf;
 
+      err = read_p15_dirs (app);
+      if (err)
+        return err;
+
       /* We return the ID of the first private keycapable of
          signing. */
       for (prkdf = app->app_local->private_key_info; prkdf;
@@ -2876,6 +3232,9 @@ do_sign (app_t app, const char *keyidstr, int hashalgo,
   if (indatalen != 20 && indatalen != 16 && indatalen != 35 && indatalen != 36)
     return gpg_error (GPG_ERR_INV_VALUE);
 
+  err = read_p15_dirs (app);
+  if (err)
+    return err;
   err = prkdf_object_from_keyidstr (app, keyidstr, &prkdf);
   if (err)
     return err;
@@ -3213,6 +3572,9 @@ do_auth (app_t app, const char *keyidstr,
   if (!keyidstr || !*keyidstr)
     return gpg_error (GPG_ERR_INV_VALUE);
 
+  err = read_p15_dirs (app);
+  if (err)
+    return err;
   err = prkdf_object_from_keyidstr (app, keyidstr, &prkdf);
   if (err)
     return err;
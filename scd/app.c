@@ -122,6 +122,21 @@ unlock_reader (int slot)
 }
 
 
+/* Return true if another connection is currently working with the
+   reader SLOT.  This is only a hint used to spread the work over
+   several readers; the state may change right after returning.  */
+int
+app_reader_busy (int slot)
+{
+  if (slot < 0 || slot >= DIM (lock_table) || !lock_table[slot].initialized)
+    return 0;
+  if (npth_mutex_trylock (&lock_table[slot].lock))
+    return 1;
+  npth_mutex_unlock (&lock_table[slot].lock);
+  return 0;
+}
+
+
 /* This function may be called to print information pertaining to the
    current state of this module to the log. */
 void
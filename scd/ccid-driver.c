@@ -1101,8 +1101,9 @@ find_endpoint (struct usb_interface_descriptor *ifcdesc, int mode)
                && (ep->bEndpointAddress & 0x80) == want_bulk_in)
         return (ep->bEndpointAddress & 0x0f);
     }
-  /* Should never happen.  */
-  return mode == 2? 0x83 : mode == 1? 0x82 :1;
+  /* Should never happen.  Note that the interrupt endpoint is
+     optional; we return -1 to indicate that there is none.  */
+  return mode == 2? -1 : mode == 1? 0x82 :1;
 }
 
 
@@ -1844,6 +1845,9 @@ bulk_out (ccid_driver_t handle, unsigned char *msg, size_t msglen,
           int no_debug)
 {
   int rc;
+#ifdef USE_NPTH
+  int err;
+#endif
 
   /* No need to continue and clutter the log with USB write error
      messages after we got the first ENODEV.  */
@@ -1904,10 +1908,18 @@ bulk_out (ccid_driver_t handle, unsigned char *msg, size_t msglen,
 
   if (handle->idev)
     {
+#ifdef USE_NPTH
+      npth_unprotect ();
+#endif
       rc = usb_bulk_write (handle->idev,
                            handle->ep_bulk_out,
                            (char*)msg, msglen,
                            5000 /* ms timeout */);
+#ifdef USE_NPTH
+      err = errno;
+      npth_protect ();
+      errno = err;
+#endif
       if (rc == msglen)
         return 0;
 #ifdef ENODEV
@@ -1936,7 +1948,15 @@ bulk_out (ccid_driver_t handle, unsigned char *msg, size_t msglen,
     }
   else
     {
+#ifdef USE_NPTH
+      npth_unprotect ();
+#endif
       rc = writen (handle->dev_fd, msg, msglen);
+#ifdef USE_NPTH
+      err = errno;
+      npth_protect ();
+      errno = err;
+#endif
       if (!rc)
         return 0;
       DEBUGOUT_2 ("writen to %d failed: %s\n",
@@ -1953,7 +1973,10 @@ bulk_out (ccid_driver_t handle, unsigned char *msg, size_t msglen,
    the type of message we expect. Does checks on the ccid
    header. TIMEOUT is the timeout value in ms. NO_DEBUG may be set to
    avoid debug messages in case of no error; this can be overriden
-   with a glibal debug level of at least 3. Returns 0 on success. */
+   with a glibal debug level of at least 3. Returns 0 on success.
+   With npth the transfers, which may take seconds while the card
+   computes, are done without holding the npth lock; the reader
+   itself is locked by apdu.c.  */
 static int
 bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
          size_t *nread, int expected_type, int seqno, int timeout,
@@ -1962,6 +1985,9 @@ bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
   int rc;
   size_t msglen;
   int eagain_retries = 0;
+#ifdef USE_NPTH
+  int err;
+#endif
 
   /* Fixme: The next line for the current Valgrind without support
      for USB IOCTLs. */
@@ -1969,10 +1995,18 @@ bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
  retry:
   if (handle->idev)
     {
+#ifdef USE_NPTH
+      npth_unprotect ();
+#endif
       rc = usb_bulk_read (handle->idev,
                           handle->ep_bulk_in,
                           (char*)buffer, length,
                           timeout);
+#ifdef USE_NPTH
+      err = errno;
+      npth_protect ();
+      errno = err;
+#endif
       if (rc < 0)
         {
           rc = errno;
@@ -1988,7 +2022,15 @@ bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
     }
   else
     {
+#ifdef USE_NPTH
+      npth_unprotect ();
+#endif
       rc = read (handle->dev_fd, buffer, length);
+#ifdef USE_NPTH
+      err = errno;
+      npth_protect ();
+      errno = err;
+#endif
       if (rc < 0)
         {
           rc = errno;
@@ -2269,7 +2311,7 @@ ccid_poll (ccid_driver_t handle)
   size_t msglen;
   int i, j;
 
-  if (handle->idev)
+  if (handle->idev && handle->ep_intr != -1)
     {
       rc = usb_bulk_read (handle->idev,
                           handle->ep_intr,
@@ -2320,6 +2362,58 @@ ccid_poll (ccid_driver_t handle)
 }
 
 
+/* Wait up to TIMEOUT milliseconds for a message on the interrupt
+   endpoint of the reader.  On success R_CHANGED is set if the reader
+   reported an insertion or removal of the card; it is not set if the
+   time ran out.  Returns CCID_DRIVER_ERR_NOT_SUPPORTED if the reader
+   has no interrupt endpoint.  With npth other threads may run while
+   we are waiting; the libusb functions used for the concurrent bulk
+   transfers may be called from several threads.  */
+int
+ccid_wait_slot_change (ccid_driver_t handle, int timeout, int *r_changed)
+{
+  int rc, err;
+  unsigned char msg[10];
+
+  *r_changed = 0;
+  if (!handle->idev || handle->ep_intr == -1)
+    return CCID_DRIVER_ERR_NOT_SUPPORTED;
+
+#ifdef USE_NPTH
+  npth_unprotect ();
+#endif
+  rc = usb_interrupt_read (handle->idev, handle->ep_intr,
+                           (char*)msg, sizeof msg, timeout);
+  err = errno;
+#ifdef USE_NPTH
+  npth_protect ();
+#endif
+
+  if (rc == -ETIMEDOUT || (rc < 0 && err == ETIMEDOUT))
+    return 0;
+  if (rc < 0)
+    {
+      DEBUGOUT_1 ("usb_interrupt_read error: %s\n",
+                  strerror (rc == -1? err : -rc));
+      if (rc == -ENODEV || err == ENODEV)
+        {
+          handle->enodev_seen = 1;
+          return CCID_DRIVER_ERR_NO_READER;
+        }
+      return CCID_DRIVER_ERR_CARD_IO_ERROR;
+    }
+
+  if (rc >= 1 && msg[0] == RDR_to_PC_NotifySlotChange)
+    *r_changed = 1;
+  else if (rc >= 1 && msg[0] == RDR_to_PC_HardwareError)
+    {
+      DEBUGOUT ("hardware error occured\n");
+      *r_changed = 1;
+    }
+  return 0;
+}
+
+
 /* Note that this function won't return the error codes NO_CARD or
    CARD_INACTIVE */
 int
@@ -2904,6 +2998,41 @@ ccid_transceive_apdu_level (ccid_driver_t handle,
 
 
 
+/* Return the largest data lengths of command and response APDUs
+   which can be exchanged with extended length APDUs using the reader
+   of HANDLE.  Zero is returned if the reader does not support
+   extended length APDUs.  */
+void
+ccid_get_apdu_limits (ccid_driver_t handle,
+                      unsigned int *r_max_cmd, unsigned int *r_max_rsp)
+{
+  if (handle->apdu_level == 2)
+    {
+      /* The command needs to fit into one CCID message; the response
+         may be chained.  Reserve space for the header and the 3 byte
+         Lc and the 2 byte Le fields.  */
+      *r_max_cmd = CCID_MAX_BUF - 10 - 4 - 3 - 2;
+      *r_max_rsp = 65535;
+    }
+  else if (!handle->apdu_level
+           || handle->id_vendor == VENDOR_OMNIKEY
+           || (!handle->idev && handle->id_product == TRANSPORT_CM4040))
+    {
+      /* We do the T=1 chaining ourself; for the Omnikey readers
+         and the CM4040 by means of the escape command.  */
+      *r_max_cmd = 65535;
+      *r_max_rsp = 65535;
+    }
+  else
+    {
+      /* Short APDU level exchange only.  */
+      *r_max_cmd = 0;
+      *r_max_rsp = 0;
+    }
+}
+
+
+
 /*
   Protocol T=1 overview
 
@@ -120,6 +120,9 @@ int ccid_close_reader (ccid_driver_t handle);
 int ccid_get_atr (ccid_driver_t handle,
                   unsigned char *atr, size_t maxatrlen, size_t *atrlen);
 int ccid_slot_status (ccid_driver_t handle, int *statusbits);
+int ccid_wait_slot_change (ccid_driver_t handle, int timeout, int *r_changed);
+void ccid_get_apdu_limits (ccid_driver_t handle,
+                           unsigned int *r_max_cmd, unsigned int *r_max_rsp);
 int ccid_transceive (ccid_driver_t handle,
                      const unsigned char *apdu, size_t apdulen,
                      unsigned char *resp, size_t maxresplen, size_t *nresp);
@@ -95,6 +95,10 @@ struct vreader_s
                  tracking for the slot has been initialized.  */
   unsigned int status;  /* Last status of the reader. */
   unsigned int changed; /* Last change counter of the reader. */
+
+  int keys_known;       /* The keygrips below are valid.  */
+  unsigned char keygrip[3][20];  /* Keygrips of the keys of an OpenPGP
+                                    card; all zero for no key.  */
 };
 
 
@@ -160,7 +164,7 @@ static npth_mutex_t status_file_update_lock;
 
 
 /*-- Local prototypes --*/
-static void update_reader_status_file (int set_card_removed_flag);
+static int update_reader_status_file (int set_card_removed_flag);
 
 
 
@@ -418,18 +422,36 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 }
 
 
-/* Return the index of the current reader or open the reader if no
-   other sessions are using that reader.  If it is not possible to
-   open the reader -1 is returned.  Note, that we currently support
-   only one reader but most of the code (except for this function)
-   should be able to cope with several readers.  */
+/* Return the number of virtual readers.  There is one for each
+   --reader-port option but at least one.  */
 static int
-get_current_reader (void)
+count_vreaders (void)
+{
+  strlist_t sl;
+  int n;
+
+  for (n=0, sl=opt.reader_ports; sl; sl = sl->next)
+    n++;
+  if (n > DIM (vreader_table))
+    n = DIM (vreader_table);
+  return n? n : 1;
+}
+
+
+/* Return the index of the virtual reader VRDR or open the reader if
+   no other sessions are using that reader.  VRDR uses the reader
+   port given by the VRDR-th --reader-port option.  If it is not
+   possible to open the reader -1 is returned.  */
+static int
+open_vreader (int vrdr)
 {
   struct vreader_s *vr;
+  strlist_t sl;
+  int i;
 
-  /* We only support one reader for now.  */
-  vr = &vreader_table[0];
+  if (vrdr < 0 || vrdr >= count_vreaders ())
+    return -1;
+  vr = &vreader_table[vrdr];
 
   /* Initialize the vreader item if not yet done. */
   if (!vr->valid)
@@ -441,7 +463,10 @@ get_current_reader (void)
   /* Try to open the reader. */
   if (vr->slot == -1)
     {
-      vr->slot = apdu_open_reader (opt.reader_port);
+      for (i=0, sl=opt.reader_ports; sl && i < vrdr; sl = sl->next)
+        i++;
+      vr->slot = apdu_open_reader (sl? sl->d : NULL);
+      vr->keys_known = 0;
 
       /* If we still don't have a slot, we have no readers.
 	 Invalidate for now until a reader is attached. */
@@ -449,10 +474,55 @@ get_current_reader (void)
 	{
 	  vr->valid = 0;
 	}
+      else
+        scd_kick_the_loop (); /* Start watching the new reader.  */
     }
 
   /* Return the vreader index or -1.  */
-  return vr->valid ? 0 : -1;
+  return vr->valid ? vrdr : -1;
+}
+
+
+/* Make the virtual reader VRDR the reader of the session CTRL.  The
+   application context used with the former reader is released.  */
+static void
+switch_vreader (ctrl_t ctrl, int vrdr)
+{
+  if (ctrl->server_local->vreader_idx == vrdr)
+    return;
+
+  if (ctrl->app_ctx)
+    {
+      release_application (ctrl->app_ctx);
+      ctrl->app_ctx = NULL;
+    }
+  ctrl->server_local->app_ctx_marked_for_release = 0;
+  ctrl->server_local->card_removed = 0;
+  ctrl->server_local->vreader_idx = vrdr;
+}
+
+
+/* Forget the keygrips of the card used by the session CTRL; called
+   after the keys of the card may have been changed.  */
+static void
+forget_vreader_keys (ctrl_t ctrl)
+{
+  int vrdr = ctrl->server_local->vreader_idx;
+
+  if (vrdr >= 0 && vrdr < DIM (vreader_table))
+    vreader_table[vrdr].keys_known = 0;
+}
+
+
+/* Return true if a session other than CTRL has locked the virtual
+   reader VRDR.  */
+static int
+vreader_locked_by_other (ctrl_t ctrl, int vrdr)
+{
+  return (locked_session
+          && locked_session != ctrl->server_local
+          && locked_session->ctrl_backlink
+          && locked_session->ctrl_backlink->server_local->vreader_idx == vrdr);
 }
 
 
@@ -495,7 +565,7 @@ open_card (ctrl_t ctrl, const char *apptype)
   if (ctrl->server_local->vreader_idx != -1)
     vrdr = ctrl->server_local->vreader_idx;
   else
-    vrdr = get_current_reader ();
+    vrdr = open_vreader (0);
   ctrl->server_local->vreader_idx = vrdr;
   if (vrdr == -1)
     err = gpg_error (GPG_ERR_CARD);
@@ -526,12 +596,144 @@ open_card (ctrl_t ctrl, const char *apptype)
 }
 
 
+/* Switch the session CTRL to the virtual reader with the card having
+   the serial number WANT_SN.  The readers are tried in turn starting
+   with the current one.  If there is no such card, the session is
+   left at its former reader.  */
+static void
+demand_card (ctrl_t ctrl, const char *want_sn, const char *apptype)
+{
+  int orig_vrdr = ctrl->server_local->vreader_idx;
+  int orig_removed = ctrl->server_local->card_removed;
+  int n = count_vreaders ();
+  int i, vrdr, found;
+  char *serial;
+  time_t stamp;
+
+  for (i=0; i < n; i++)
+    {
+      vrdr = ((orig_vrdr == -1? 0 : orig_vrdr) + i) % n;
+      if (vreader_locked_by_other (ctrl, vrdr) || open_vreader (vrdr) == -1)
+        continue;
+      switch_vreader (ctrl, vrdr);
+      if (open_card (ctrl, apptype)
+          || app_get_serial_and_stamp (ctrl->app_ctx, &serial, &stamp))
+        continue;
+      found = !ascii_strcasecmp (serial, want_sn);
+      xfree (serial);
+      if (found)
+        return;
+    }
+
+  switch_vreader (ctrl, orig_vrdr);
+  ctrl->server_local->card_removed = orig_removed;
+}
+
+
+/* Read the keygrips of the keys on the card in the virtual reader
+   VRDR into the vreader table.  This switches the session CTRL to
+   that reader.  */
+static void
+load_vreader_keys (ctrl_t ctrl, int vrdr)
+{
+  struct vreader_s *vr = vreader_table + vrdr;
+  unsigned char *pk;
+  size_t pklen;
+  char keyref[20];
+  int keyno;
+
+  switch_vreader (ctrl, vrdr);
+  if (open_card (ctrl, NULL))
+    return;
+
+  memset (vr->keygrip, 0, sizeof vr->keygrip);
+  if (ctrl->app_ctx->apptype && !strcmp (ctrl->app_ctx->apptype, "OPENPGP"))
+    for (keyno=0; keyno < 3; keyno++)
+      {
+        snprintf (keyref, sizeof keyref, "OPENPGP.%d", keyno+1);
+        if (app_readkey (ctrl->app_ctx, keyref, &pk, &pklen))
+          continue;
+        if (keygrip_from_canon_sexp (pk, pklen, vr->keygrip[keyno]))
+          memset (vr->keygrip[keyno], 0, sizeof vr->keygrip[keyno]);
+        xfree (pk);
+      }
+  vr->keys_known = 1;
+}
+
+
+/* Switch the session CTRL to a card holding the key with the keygrip
+   HEXGRIP and store the reference of that key at KEYREF, which needs
+   to have space for 20 characters.  If several cards hold the key
+   they are used in turn, preferring those not in use by another
+   session; thus concurrent sessions are spread over the readers.  */
+static gpg_error_t
+route_to_keygrip (ctrl_t ctrl, const char *hexgrip, char *keyref)
+{
+  static int next_vrdr;
+  unsigned char grip[20];
+  int n = count_vreaders ();
+  int ntry, start, i, vrdr, keyno;
+  int found = -1, found_keyno = 0;
+
+  if (hex2bin (hexgrip, grip, sizeof grip) < 0 || hexgrip[40])
+    return gpg_error (GPG_ERR_INV_ID);
+
+  /* A session holding the lock sticks to its card.  */
+  if (locked_session && locked_session == ctrl->server_local
+      && ctrl->server_local->vreader_idx != -1)
+    {
+      start = ctrl->server_local->vreader_idx;
+      ntry = 1;
+    }
+  else
+    {
+      start = next_vrdr % n;
+      ntry = n;
+    }
+
+  for (i=0; i < ntry; i++)
+    {
+      vrdr = (start + i) % n;
+      if (vreader_locked_by_other (ctrl, vrdr) || open_vreader (vrdr) == -1)
+        continue;
+      if (!vreader_table[vrdr].keys_known)
+        load_vreader_keys (ctrl, vrdr);
+      for (keyno=0; keyno < 3; keyno++)
+        if (!memcmp (vreader_table[vrdr].keygrip[keyno], grip, sizeof grip))
+          break;
+      if (keyno == 3)
+        continue;
+      if (found == -1 || !app_reader_busy (vreader_slot (vrdr)))
+        {
+          found = vrdr;
+          found_keyno = keyno;
+          if (!app_reader_busy (vreader_slot (vrdr)))
+            break;
+        }
+    }
+
+  if (found == -1)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+  next_vrdr = found + 1;
+
+  if (DBG_READER)
+    log_debug ("key %s routed to reader %d\n", hexgrip, found);
+  switch_vreader (ctrl, found);
+  snprintf (keyref, 20, "OPENPGP.%d", found_keyno+1);
+  return open_card (ctrl, NULL);
+}
+
+
 static const char hlp_serialno[] =
-  "SERIALNO [<apptype>]\n"
+  "SERIALNO [--demand=<serialno>] [<apptype>]\n"
   "\n"
   "Return the serial number of the card using a status reponse.  This\n"
   "function should be used to check for the presence of a card.\n"
   "\n"
+  "With --demand the card with the given serial number is used if it\n"
+  "is inserted into any of the readers.  Otherwise the command works\n"
+  "as if the option had not been given.\n"
+  "\n"
   "If APPTYPE is given, an application of that type is selected and an\n"
   "error is returned if the application is not supported or available.\n"
   "The default is to auto-select the application using a hardwired\n"
@@ -553,6 +755,30 @@ cmd_serialno (assuan_context_t ctx, char *line)
   char *serial;
   time_t stamp;
   int retries = 0;
+  const char *demand;
+  char *want_sn = NULL;
+  size_t n;
+
+  if ((demand = has_option_name (line, "--demand")))
+    {
+      if (*demand != '=')
+        return set_error (GPG_ERR_ASS_PARAMETER, "missing value for option");
+      demand++;
+      for (n=0; demand[n] && !spacep (demand+n); n++)
+        ;
+      want_sn = xtrymalloc (n+1);
+      if (!want_sn)
+        return out_of_core ();
+      memcpy (want_sn, demand, n);
+      want_sn[n] = 0;
+    }
+  line = skip_options (line);
+
+  if (want_sn)
+    {
+      demand_card (ctrl, want_sn, *line? line:NULL);
+      xfree (want_sn);
+    }
 
   /* Clear the remove flag so that the open_card is able to reread it.  */
  retry:
@@ -958,7 +1184,11 @@ pin_cb (void *opaque, const char *info, char **retstr)
 static const char hlp_pksign[] =
   "PKSIGN [--hash=[rmd160|sha{1,224,256,384,512}|md5]] <hexified_id>\n"
   "\n"
-  "The --hash option is optional; the default is SHA1.";
+  "The --hash option is optional; the default is SHA1.\n"
+  "\n"
+  "If the ID is given as an ampersand followed by a keygrip, any card\n"
+  "holding the key is used.  If there are several such cards they are\n"
+  "used in turn.";
 static gpg_error_t
 cmd_pksign (assuan_context_t ctx, char *line)
 {
@@ -968,6 +1198,7 @@ cmd_pksign (assuan_context_t ctx, char *line)
   size_t outdatalen;
   char *keyidstr;
   int hash_algo;
+  char keyref[20];
 
   if (has_option (line, "--hash=rmd160"))
     hash_algo = GCRY_MD_RMD160;
@@ -990,6 +1221,13 @@ cmd_pksign (assuan_context_t ctx, char *line)
 
   line = skip_options (line);
 
+  if (*line == '&')
+    {
+      if ((rc = route_to_keygrip (ctrl, line+1, keyref)))
+        return rc;
+      line = keyref;
+    }
+
   if ( IS_LOCKED (ctrl) )
     return gpg_error (GPG_ERR_LOCKED);
 
@@ -1028,7 +1266,10 @@ cmd_pksign (assuan_context_t ctx, char *line)
 
 
 static const char hlp_pkauth[] =
-  "PKAUTH <hexified_id>";
+  "PKAUTH <hexified_id>\n"
+  "\n"
+  "The ID may also be given as an ampersand followed by a keygrip;\n"
+  "see PKSIGN.";
 static gpg_error_t
 cmd_pkauth (assuan_context_t ctx, char *line)
 {
@@ -1037,6 +1278,14 @@ cmd_pkauth (assuan_context_t ctx, char *line)
   unsigned char *outdata;
   size_t outdatalen;
   char *keyidstr;
+  char keyref[20];
+
+  if (*line == '&')
+    {
+      if ((rc = route_to_keygrip (ctrl, line+1, keyref)))
+        return rc;
+      line = keyref;
+    }
 
   if ( IS_LOCKED (ctrl) )
     return gpg_error (GPG_ERR_LOCKED);
@@ -1344,6 +1593,7 @@ cmd_writekey (assuan_context_t ctx, char *line)
                      pin_cb, ctx, keydata, keydatalen);
   xfree (keyid);
   xfree (keydata);
+  forget_vreader_keys (ctrl);
 
   TEST_CARD_REMOVAL (ctrl, rc);
   return rc;
@@ -1422,6 +1672,7 @@ cmd_genkey (assuan_context_t ctx, char *line)
   rc = app_genkey (ctrl->app_ctx, ctrl, keyno, force? 1:0,
                    timestamp, pin_cb, ctx);
   xfree (keyno);
+  forget_vreader_keys (ctrl);
 
   TEST_CARD_REMOVAL (ctrl, rc);
   return rc;
@@ -1688,7 +1939,12 @@ static const char hlp_getinfo[] =
   "\n"
   "app_list    - Return a list of supported applications.  One\n"
   "              application per line, fields delimited by colons,\n"
-  "              first field is the name.";
+  "              first field is the name.\n"
+  "\n"
+  "apdu_limits - Return the largest command and response data sizes\n"
+  "              of extended length APDUs as supported by the reader\n"
+  "              and as used with the current application; 0 means\n"
+  "              that only short APDUs are used.";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -1750,6 +2006,20 @@ cmd_getinfo (assuan_context_t ctx, char *line)
     }
   else if (!strcmp (line, "deny_admin"))
     rc = opt.allow_admin? gpg_error (GPG_ERR_GENERAL) : 0;
+  else if (!strcmp (line, "apdu_limits"))
+    {
+      ctrl_t ctrl = assuan_get_pointer (ctx);
+      unsigned int max_cmd, max_rsp;
+      char tmp[100];
+
+      apdu_get_ext_limits (vreader_slot (ctrl->server_local->vreader_idx),
+                           &max_cmd, &max_rsp);
+      snprintf (tmp, sizeof tmp, "rdr_cmd=%u rdr_rsp=%u app_cmd=%u app_rsp=%u",
+                max_cmd, max_rsp,
+                ctrl->app_ctx? ctrl->app_ctx->max_cmd_data : 0,
+                ctrl->app_ctx? ctrl->app_ctx->max_rsp_data : 0);
+      rc = assuan_send_data (ctx, tmp, strlen (tmp));
+    }
   else if (!strcmp (line, "app_list"))
     {
       char *s = get_supported_applications ();
@@ -2068,11 +2338,15 @@ scd_command_handler (ctrl_t ctrl, int fd)
   ctrl->server_local->assuan_ctx = ctx;
   ctrl->server_local->vreader_idx = -1;
 
-  /* We open the reader right at startup so that the ticker is able to
-     update the status file. */
+  /* We open the readers right at startup so that the ticker is able
+     to update the status files. */
   if (ctrl->server_local->vreader_idx == -1)
     {
-      ctrl->server_local->vreader_idx = get_current_reader ();
+      int vrdr;
+
+      for (vrdr=1; vrdr < count_vreaders (); vrdr++)
+        open_vreader (vrdr);
+      ctrl->server_local->vreader_idx = open_vreader (0);
     }
 
   /* Command processing loop. */
@@ -2267,12 +2541,14 @@ send_client_notifications (void)
 
 
 /* This is the core of scd_update_reader_status_file but the caller
-   needs to take care of the locking.  */
-static void
+   needs to take care of the locking.  Returns true if the status of
+   a reader needs to be polled.  */
+static int
 update_reader_status_file (int set_card_removed_flag)
 {
   int idx;
   unsigned int status, changed;
+  int need_poll = 0;
 
   /* Note, that we only try to get the status, because it does not
      make sense to wait here for a operation to complete.  If we are
@@ -2300,8 +2576,11 @@ update_reader_status_file (int set_card_removed_flag)
       else if (sw_apdu)
         {
           /* Get status failed.  Ignore that.  */
+          need_poll = 1;
           continue;
         }
+      else if (apdu_watch_status (vr->slot, scd_kick_the_loop))
+        need_poll = 1;
 
       if (!vr->any || vr->status != status || vr->changed != changed )
         {
@@ -2313,6 +2592,7 @@ update_reader_status_file (int set_card_removed_flag)
                     idx, vr->slot, vr->status, status, vr->changed, changed);
           vr->status = status;
           vr->changed = changed;
+          vr->keys_known = 0;
 
 	  /* FIXME: Should this be IDX instead of vr->slot?  This
 	     depends on how client sessions will associate the reader
@@ -2384,6 +2664,7 @@ update_reader_status_file (int set_card_removed_flag)
       /* Check whether a disconnect is pending.  */
       if (opt.card_timeout)
         {
+          need_poll = 1;
           for (sl=session_list; sl; sl = sl->next_session)
             if (!sl->disconnect_allowed)
               break;
@@ -2398,21 +2679,29 @@ update_reader_status_file (int set_card_removed_flag)
         }
 
     }
+
+  return need_poll;
 }
 
 /* This function is called by the ticker thread to check for changes
    of the reader stati.  It updates the reader status files and if
-   requested by the caller also send a signal to the caller.  */
-void
+   requested by the caller also send a signal to the caller.  Returns
+   true if the ticker still needs to poll the readers; that is not
+   the case if no reader is open or the status of all readers is
+   watched.  */
+int
 scd_update_reader_status_file (void)
 {
   int err;
+  int need_poll;
+
   err = npth_mutex_lock (&status_file_update_lock);
   if (err)
-    return; /* locked - give up. */
-  update_reader_status_file (1);
+    return 1; /* locked - give up. */
+  need_poll = update_reader_status_file (1);
   err = npth_mutex_unlock (&status_file_update_lock);
   if (err)
     log_error ("failed to release status_file_update lock: %s\n",
 	       strerror (err));
+  return need_poll;
 }
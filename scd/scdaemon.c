@@ -175,13 +175,11 @@ static ARGPARSE_OPTS opts[] = {
 /* The timer tick used for housekeeping stuff.  We poll every 500ms to
    let the user immediately know a status change.
 
-   This is not too good for power saving but given that there is no
-   easy way to block on card status changes it is the best we can do.
-   For PC/SC we could in theory use an extra thread to wait for status
-   changes but that requires a native thread because there is no way
-   to make the underlying PC/SC card change function block using a Npth
-   mechanism.  Given that a native thread could only be used under W32
-   we don't do that at all.  */
+   This is not too good for power saving.  Thus, if the status of all
+   open readers is watched by a thread of apdu.c, which waits on the
+   interrupt endpoint of a CCID reader or in SCardGetStatusChange for
+   PC/SC, we do not poll at all; the watcher wakes up the connection
+   loop using a pipe.  Polling is only used as a fallback.  */
 #define TIMERTICK_INTERVAL_SEC     (0)
 #define TIMERTICK_INTERVAL_USEC    (500000)
 
@@ -222,6 +220,11 @@ ASSUAN_SYSTEM_NPTH_IMPL;
 
 static int active_connections;
 
+#ifndef HAVE_W32_SYSTEM
+/* A pipe to wake up the connection handler loop.  */
+static int wakeup_pipe[2] = { -1, -1 };
+#endif
+
 
 static char *
 make_libversion (const char *libname, const char *(*getfnc)(const char*))
@@ -578,7 +581,10 @@ main (int argc, char **argv )
         case oMultiServer: pipe_server = 1; multi_server = 1; break;
         case oDaemon: is_daemon = 1; break;
 
-        case oReaderPort: opt.reader_port = pargs.r.ret_str; break;
+        case oReaderPort:
+          opt.reader_port = pargs.r.ret_str;
+          append_to_strlist (&opt.reader_ports, pargs.r.ret_str);
+          break;
         case octapiDriver: opt.ctapi_driver = pargs.r.ret_str; break;
         case opcscDriver: opt.pcsc_driver = pargs.r.ret_str; break;
         case oDisableCCID: opt.disable_ccid = 1; break;
@@ -1013,11 +1019,38 @@ handle_signal (int signo)
 #endif /*!HAVE_W32_SYSTEM*/
 
 
-static void
+/* Run the ticker actions.  Returns true if the ticker is still
+   needed for polling.  */
+static int
 handle_tick (void)
 {
+  int need_poll = 1;
+
   if (!ticker_disabled)
-    scd_update_reader_status_file ();
+    need_poll = scd_update_reader_status_file ();
+#ifdef HAVE_W32_SYSTEM
+  need_poll = 1;  /* We can't be woken up by the status watchers.  */
+#endif
+  if (shutdown_pending)
+    need_poll = 1;
+  return need_poll;
+}
+
+
+/* Wake up the connection handler loop to run the ticker actions
+   right away.  This may be called from any npth thread.  */
+void
+scd_kick_the_loop (void)
+{
+#ifndef HAVE_W32_SYSTEM
+  if (wakeup_pipe[1] != -1)
+    {
+      /* A full pipe is not an error; the loop will wake up anyway.  */
+      if (write (wakeup_pipe[1], "", 1) < 0 && errno != EAGAIN)
+        log_error ("error writing to the wakeup pipe: %s\n",
+                   strerror (errno));
+    }
+#endif
 }
 
 
@@ -1163,7 +1196,10 @@ start_connection_thread (void *arg)
      happen.  */
   if (scd_command_handler (ctrl, FD2INT(ctrl->thread_startup.fd))
       && pipe_server)
-    shutdown_pending = 1;
+    {
+      shutdown_pending = 1;
+      scd_kick_the_loop ();
+    }
 
   if (opt.verbose)
     log_info (_("handler for fd %d terminated\n"),
@@ -1193,8 +1229,10 @@ handle_connections (int listen_fd)
   struct timespec curtime;
   struct timespec timeout;
   int saved_errno;
+  int need_tick = 1;
 #ifndef HAVE_W32_SYSTEM
   int signo;
+  char buf[16];
 #endif
 
   ret = npth_attr_init(&tattr);
@@ -1219,6 +1257,24 @@ handle_connections (int listen_fd)
       nfd = listen_fd;
     }
 
+#ifndef HAVE_W32_SYSTEM
+  if (pipe (wakeup_pipe))
+    {
+      log_error ("error creating the wakeup pipe: %s\n", strerror (errno));
+      wakeup_pipe[0] = wakeup_pipe[1] = -1;
+    }
+  else
+    {
+      fcntl (wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+      fcntl (wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+      fcntl (wakeup_pipe[0], F_SETFD, FD_CLOEXEC);
+      fcntl (wakeup_pipe[1], F_SETFD, FD_CLOEXEC);
+      FD_SET (wakeup_pipe[0], &fdset);
+      if (wakeup_pipe[0] > nfd)
+        nfd = wakeup_pipe[0];
+    }
+#endif
+
   npth_clock_gettime (&curtime);
   timeout.tv_sec = TIMERTICK_INTERVAL_SEC;
   timeout.tv_nsec = TIMERTICK_INTERVAL_USEC * 1000;
@@ -1238,13 +1294,14 @@ handle_connections (int listen_fd)
              used to just wait on a signal or timeout event. */
           FD_ZERO (&fdset);
           listen_fd = -1;
+          need_tick = 1;
 	}
 
       npth_clock_gettime (&curtime);
       if (!(npth_timercmp (&curtime, &abstime, <)))
 	{
 	  /* Timeout.  */
-	  handle_tick ();
+	  need_tick = handle_tick ();
 	  timeout.tv_sec = TIMERTICK_INTERVAL_SEC;
 	  timeout.tv_nsec = TIMERTICK_INTERVAL_USEC * 1000;
 	  npth_timeradd (&curtime, &timeout, &abstime);
@@ -1256,7 +1313,8 @@ handle_connections (int listen_fd)
       read_fdset = fdset;
 
 #ifndef HAVE_W32_SYSTEM
-      ret = npth_pselect (nfd+1, &read_fdset, NULL, NULL, &timeout, npth_sigev_sigmask());
+      ret = npth_pselect (nfd+1, &read_fdset, NULL, NULL,
+                          need_tick? &timeout : NULL, npth_sigev_sigmask());
       saved_errno = errno;
 
       while (npth_sigev_get_pending(&signo))
@@ -1278,6 +1336,19 @@ handle_connections (int listen_fd)
 	/* Timeout.  Will be handled when calculating the next timeout.  */
 	continue;
 
+#ifndef HAVE_W32_SYSTEM
+      if (wakeup_pipe[0] != -1 && FD_ISSET (wakeup_pipe[0], &read_fdset))
+        {
+          while (read (wakeup_pipe[0], buf, sizeof buf) > 0)
+            ;
+          need_tick = handle_tick ();
+          npth_clock_gettime (&curtime);
+          timeout.tv_sec = TIMERTICK_INTERVAL_SEC;
+          timeout.tv_nsec = TIMERTICK_INTERVAL_USEC * 1000;
+          npth_timeradd (&curtime, &timeout, &abstime);
+        }
+#endif
+
       if (listen_fd != -1 && FD_ISSET (listen_fd, &read_fdset))
 	{
           ctrl_t ctrl;
@@ -55,6 +55,7 @@ struct
   const char *ctapi_driver; /* Library to access the ctAPI. */
   const char *pcsc_driver;  /* Library to access the PC/SC system. */
   const char *reader_port;  /* NULL or reder port to use. */
+  strlist_t reader_ports;   /* All given reader ports in order.  */
   int disable_ccid;    /* Disable the use of the internal CCID driver. */
   int disable_pinpad;  /* Do not use a pinpad. */
   int enable_pinpad_varlen;  /* Use variable length input for pinpad. */
@@ -119,6 +120,7 @@ typedef struct app_ctx_s *app_t;
 /*-- scdaemon.c --*/
 void scd_exit (int rc);
 const char *scd_get_socket_name (void);
+void scd_kick_the_loop (void);
 
 /*-- command.c --*/
 void initialize_module_command (void);
@@ -126,7 +128,7 @@ int  scd_command_handler (ctrl_t, int);
 void send_status_info (ctrl_t ctrl, const char *keyword, ...)
      GNUPG_GCC_A_SENTINEL(1);
 void send_status_direct (ctrl_t ctrl, const char *keyword, const char *args);
-void scd_update_reader_status_file (void);
+int  scd_update_reader_status_file (void);
 
 
 #endif /*SCDAEMON_H*/
@@ -967,6 +967,10 @@ gpgsm_dirmngr_run_command (ctrl_t ctrl, const char *command,
   if (rc)
     return rc;
 
+  /* The command may change CRLs or other data used to validate a
+     certificate chain.  */
+  gpgsm_flush_chain_cache ();
+
   parm.ctx = dirmngr_ctx;
 
   len = strlen (command) + 1;
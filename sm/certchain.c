@@ -58,6 +58,31 @@ struct chain_item_s
 typedef struct chain_item_s *chain_item_t;
 
 
+/* The number of validated chains remembered in server mode.  */
+#define CHAIN_CACHE_SIZE 256
+
+/* The number of seconds a validated chain is used without validating
+   it again.  This bounds the time a revoked certificate or a change
+   of the trustlist goes unnoticed.  */
+#define CHAIN_CACHE_TTL  (10*60)
+
+/* A successfully validated certificate chain.  */
+struct chain_cache_item_s
+{
+  int used;
+  unsigned char fpr[20];    /* Fingerprint of the target certificate.  */
+  unsigned int flags;       /* The VALIDATE_FLAG_ values used.  */
+  int use_ocsp;             /* The OCSP setting used.  */
+  ksba_isotime_t checktime; /* The checktime used in chain model.  */
+  unsigned int retflags;    /* The flags returned by the validation.  */
+  ksba_isotime_t exptime;   /* The earliest expiration in the chain.  */
+  time_t validated;         /* The time the chain has been validated.  */
+  unsigned int keydb_change_count;
+  int is_qualified;         /* -1 if not set for the certificate.  */
+};
+static struct chain_cache_item_s chain_cache[CHAIN_CACHE_SIZE];
+
+
 static int is_root_cert (ksba_cert_t cert,
                          const char *issuerdn, const char *subjectdn);
 static int get_regtp_ca_info (ctrl_t ctrl, ksba_cert_t cert, int *chainlen);
@@ -1854,6 +1879,91 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
 }
 
 
+/* Forget all validated chains.  This is required after changes which
+   may invalidate them, for example a CRL update.  */
+void
+gpgsm_flush_chain_cache (void)
+{
+  memset (chain_cache, 0, sizeof chain_cache);
+}
+
+
+/* Return the cached validation of CERT with FLAGS and CHECKTIME or
+   NULL if there is none which may still be used.  */
+static struct chain_cache_item_s *
+chain_cache_lookup (ctrl_t ctrl, const unsigned char *fpr,
+                    ksba_isotime_t checktime, unsigned int flags)
+{
+  struct chain_cache_item_s *ci;
+  ksba_isotime_t current_time;
+  time_t now = gnupg_get_time ();
+  int i;
+
+  for (i=0, ci = chain_cache; i < CHAIN_CACHE_SIZE; i++, ci++)
+    {
+      if (!ci->used || memcmp (ci->fpr, fpr, 20)
+          || ci->flags != flags || ci->use_ocsp != !!ctrl->use_ocsp
+          || ((flags & VALIDATE_FLAG_CHAIN_MODEL)
+              && strcmp (ci->checktime, checktime)))
+        continue;
+
+      gnupg_get_isotime (current_time);
+      if (now < ci->validated || now - ci->validated > CHAIN_CACHE_TTL
+          || ci->keydb_change_count != keydb_change_count ()
+          || (*ci->exptime && strcmp (current_time, ci->exptime) > 0))
+        {
+          ci->used = 0;
+          return NULL;
+        }
+      return ci;
+    }
+  return NULL;
+}
+
+
+/* Remember the successful validation of CERT with the given
+   parameters.  The oldest entry is replaced if the cache is full.  */
+static void
+chain_cache_put (ctrl_t ctrl, ksba_cert_t cert, const unsigned char *fpr,
+                 ksba_isotime_t checktime, unsigned int flags,
+                 unsigned int retflags, ksba_isotime_t exptime)
+{
+  struct chain_cache_item_s *ci, *oldest;
+  char buf[1];
+  size_t buflen;
+  int i;
+
+  for (i=0, ci = oldest = chain_cache; i < CHAIN_CACHE_SIZE; i++, ci++)
+    {
+      if (!ci->used)
+        {
+          oldest = ci;
+          break;
+        }
+      if (ci->validated < oldest->validated)
+        oldest = ci;
+    }
+  ci = oldest;
+
+  memset (ci, 0, sizeof *ci);
+  memcpy (ci->fpr, fpr, 20);
+  ci->flags = flags;
+  ci->use_ocsp = !!ctrl->use_ocsp;
+  if ((flags & VALIDATE_FLAG_CHAIN_MODEL))
+    gnupg_copy_time (ci->checktime, checktime);
+  ci->retflags = retflags;
+  gnupg_copy_time (ci->exptime, exptime);
+  ci->validated = gnupg_get_time ();
+  ci->keydb_change_count = keydb_change_count ();
+  if (!ksba_cert_get_user_data (cert, "is_qualified", buf, sizeof buf, &buflen)
+      && buflen)
+    ci->is_qualified = *buf;
+  else
+    ci->is_qualified = -1;
+  ci->used = 1;
+}
+
+
 /* Validate a certificate chain.  For a description see
    do_validate_chain.  This function is a wrapper to handle a root
    certificate with the chain_model flag set.  If RETFLAGS is not
@@ -1875,6 +1985,11 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
   int rc;
   struct rootca_flags_s rootca_flags;
   unsigned int dummy_retflags;
+  unsigned int orig_flags;
+  ksba_isotime_t exptime;
+  unsigned char fpr[20];
+  struct chain_cache_item_s *ci;
+  int use_cache;
 
   if (!retflags)
     retflags = &dummy_retflags;
@@ -1885,15 +2000,43 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
     flags |= VALIDATE_FLAG_CHAIN_MODEL;
   else if (ctrl->validation_model == 2)
     flags |= VALIDATE_FLAG_STEED;
+  orig_flags = flags;
 
   /* If the chain model was forced, set this immediately into
      RETFLAGS.  */
   *retflags = (flags & VALIDATE_FLAG_CHAIN_MODEL);
 
+  /* A server often sees the same certificates again; the result of a
+     previous validation is used unless the chain may have changed.
+     Listings and audit logs need to see the actual chain.  */
+  use_cache = (ctrl->server_local && !listmode && !ctrl->audit
+               && !opt.no_chain_validation);
+  if (use_cache)
+    {
+      gpgsm_get_fingerprint (cert, GCRY_MD_SHA1, fpr, NULL);
+      ci = chain_cache_lookup (ctrl, fpr, checktime, flags);
+      if (ci)
+        {
+          if (DBG_X509)
+            log_debug ("validate_chain: using cached result\n");
+          if (ci->is_qualified != -1)
+            {
+              char buf[1];
+
+              *buf = ci->is_qualified;
+              ksba_cert_set_user_data (cert, "is_qualified", buf, 1);
+            }
+          if (r_exptime)
+            gnupg_copy_time (r_exptime, ci->exptime);
+          *retflags = ci->retflags;
+          return 0;
+        }
+    }
+
   memset (&rootca_flags, 0, sizeof rootca_flags);
 
   rc = do_validate_chain (ctrl, cert, checktime,
-                          r_exptime, listmode, listfp, flags,
+                          exptime, listmode, listfp, flags,
                           &rootca_flags);
   if (!rc && (flags & VALIDATE_FLAG_STEED))
     {
@@ -1905,12 +2048,18 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
     {
       do_list (0, listmode, listfp, _("switching to chain model"));
       rc = do_validate_chain (ctrl, cert, checktime,
-                              r_exptime, listmode, listfp,
+                              exptime, listmode, listfp,
                               (flags |= VALIDATE_FLAG_CHAIN_MODEL),
                               &rootca_flags);
       *retflags |= VALIDATE_FLAG_CHAIN_MODEL;
     }
 
+  if (r_exptime)
+    gnupg_copy_time (r_exptime, exptime);
+  if (!rc && use_cache)
+    chain_cache_put (ctrl, cert, fpr, checktime, orig_flags, *retflags,
+                     exptime);
+
   if (opt.verbose)
     do_list (0, listmode, listfp, _("validation model used: %s"),
              (*retflags & VALIDATE_FLAG_STEED)?
@@ -42,6 +42,27 @@ static const char oid_kp_emailProtection[]= "1.3.6.1.5.5.7.3.4";
 static const char oid_kp_timeStamping[]   = "1.3.6.1.5.5.7.3.8";
 static const char oid_kp_ocspSigning[]    = "1.3.6.1.5.5.7.3.9";
 
+/* The number of recipients remembered in server mode.  */
+#define RECP_CACHE_SIZE 128
+
+/* The number of seconds a recipient is used without looking it up
+   again.  This bounds the time a certificate stored by another
+   process goes unnoticed.  */
+#define RECP_CACHE_TTL  (10*60)
+
+/* The certificate found for a recipient.  Only the lookup is
+   remembered; the validation of the certificate is left to the cache
+   of gpgsm_validate_chain.  */
+struct recp_cache_item_s
+{
+  char *name;               /* The user id as given or NULL if unused.  */
+  ksba_cert_t cert;         /* The certificate chosen for it.  */
+  unsigned char fpr[20];    /* Its fingerprint.  */
+  time_t looked_up;         /* The time of the lookup.  */
+  unsigned int keydb_change_count;
+};
+static struct recp_cache_item_s recp_cache[RECP_CACHE_SIZE];
+
 /* Return 0 if the cert is usable for encryption.  A MODE of 0 checks
    for signing a MODE of 1 checks for encryption, a MODE of 2 checks
    for verification and a MODE of 3 for decryption (just for
@@ -303,10 +324,138 @@ gpgsm_add_cert_to_certlist (ctrl_t ctrl, ksba_cert_t cert,
    return 0;
 }
 
+/* Drop the recipient cache item CI.  */
+static void
+recp_cache_drop (struct recp_cache_item_s *ci)
+{
+  xfree (ci->name);
+  ksba_cert_release (ci->cert);
+  memset (ci, 0, sizeof *ci);
+}
+
+
+/* Return the certificate remembered for the recipient NAME or NULL.
+   The caller must release it.  */
+static ksba_cert_t
+recp_cache_get (const char *name)
+{
+  struct recp_cache_item_s *ci;
+  time_t now = gnupg_get_time ();
+  int i;
+
+  for (i=0, ci = recp_cache; i < RECP_CACHE_SIZE; i++, ci++)
+    {
+      if (!ci->name || strcmp (ci->name, name))
+        continue;
+      if (now < ci->looked_up || now - ci->looked_up > RECP_CACHE_TTL
+          || ci->keydb_change_count != keydb_change_count ())
+        {
+          recp_cache_drop (ci);
+          return NULL;
+        }
+      if (DBG_X509)
+        {
+          char *fpr = bin2hex (ci->fpr, 20, NULL);
+          log_debug ("add_to_certlist: using cached certificate %s for '%s'\n",
+                     fpr? fpr : "?", name);
+          xfree (fpr);
+        }
+      ksba_cert_ref (ci->cert);
+      return ci->cert;
+    }
+  return NULL;
+}
+
+
+/* Remember CERT as the certificate for the recipient NAME.  The oldest
+   entry is replaced if the cache is full.  */
+static void
+recp_cache_put (const char *name, ksba_cert_t cert)
+{
+  struct recp_cache_item_s *ci, *oldest;
+  char *namecopy;
+  int i;
+
+  namecopy = xtrystrdup (name);
+  if (!namecopy)
+    return;  /* The cache is only an optimization.  */
+
+  for (i=0, ci = oldest = recp_cache; i < RECP_CACHE_SIZE; i++, ci++)
+    {
+      if (!ci->name || !strcmp (ci->name, name))
+        {
+          oldest = ci;
+          break;
+        }
+      if (ci->looked_up < oldest->looked_up)
+        oldest = ci;
+    }
+  ci = oldest;
+
+  recp_cache_drop (ci);
+  ci->name = namecopy;
+  ksba_cert_ref (cert);
+  ci->cert = cert;
+  gpgsm_get_fingerprint (cert, GCRY_MD_SHA1, ci->fpr, NULL);
+  ci->looked_up = gnupg_get_time ();
+  ci->keydb_change_count = keydb_change_count ();
+}
+
+
+/* Add the certificate at R_CERT found for a user id to LISTADDR
+   unless it is already listed.  The certificate is validated and, with
+   SECRET set, a secret key must be available for it.  On success
+   the list takes over the certificate and R_CERT is set to NULL.  */
+static int
+validate_and_add (ctrl_t ctrl, ksba_cert_t *r_cert, int secret,
+                  certlist_t *listaddr, int is_encrypt_to)
+{
+  ksba_cert_t cert = *r_cert;
+  certlist_t cl;
+  int rc = 0;
+
+  if (is_cert_in_certlist (cert, *listaddr))
+    return 0;
+
+  if (secret)
+    {
+      char *p;
+
+      rc = gpg_error (GPG_ERR_NO_SECKEY);
+      p = gpgsm_get_keygrip_hexstring (cert);
+      if (p)
+        {
+          if (!gpgsm_agent_havekey (ctrl, p))
+            rc = 0;
+          xfree (p);
+        }
+    }
+  if (!rc)
+    rc = gpgsm_validate_chain (ctrl, cert, "", NULL, 0, NULL, 0, NULL);
+  if (!rc)
+    {
+      cl = xtrycalloc (1, sizeof *cl);
+      if (!cl)
+        rc = out_of_core ();
+      else
+        {
+          cl->cert = cert; *r_cert = NULL;
+          cl->next = *listaddr;
+          cl->is_encrypt_to = is_encrypt_to;
+          *listaddr = cl;
+        }
+    }
+  return rc;
+}
+
+
 /* Add a certificate to a list of certificate and make sure that it is
    a valid certificate.  With SECRET set to true a secret key must be
    available for the certificate. IS_ENCRYPT_TO sets the corresponding
-   flag in the new create LISTADDR item.  */
+   flag in the new create LISTADDR item.
+
+   A server often encrypts to the same recipients again; it then
+   takes the certificate found the last time for NAME.  */
 int
 gpgsm_add_to_certlist (ctrl_t ctrl, const char *name, int secret,
                        certlist_t *listaddr, int is_encrypt_to)
@@ -315,6 +464,14 @@ gpgsm_add_to_certlist (ctrl_t ctrl, const char *name, int secret,
   KEYDB_SEARCH_DESC desc;
   KEYDB_HANDLE kh = NULL;
   ksba_cert_t cert = NULL;
+  int use_cache = (!secret && ctrl->server_local);
+
+  if (use_cache && (cert = recp_cache_get (name)))
+    {
+      rc = validate_and_add (ctrl, &cert, 0, listaddr, is_encrypt_to);
+      ksba_cert_release (cert);
+      return rc;
+    }
 
   rc = classify_user_id (name, &desc, 0);
   if (!rc)
@@ -429,38 +586,11 @@ gpgsm_add_to_certlist (ctrl_t ctrl, const char *name, int secret,
           first_subject = NULL;
           first_issuer = NULL;
 
-          if (!rc && !is_cert_in_certlist (cert, *listaddr))
-            {
-              if (!rc && secret)
-                {
-                  char *p;
-
-                  rc = gpg_error (GPG_ERR_NO_SECKEY);
-                  p = gpgsm_get_keygrip_hexstring (cert);
-                  if (p)
-                    {
-                      if (!gpgsm_agent_havekey (ctrl, p))
-                        rc = 0;
-                      xfree (p);
-                    }
-                }
-              if (!rc)
-                rc = gpgsm_validate_chain (ctrl, cert, "", NULL,
-                                           0, NULL, 0, NULL);
-              if (!rc)
-                {
-                  certlist_t cl = xtrycalloc (1, sizeof *cl);
-                  if (!cl)
-                    rc = out_of_core ();
-                  else
-                    {
-                      cl->cert = cert; cert = NULL;
-                      cl->next = *listaddr;
-                      cl->is_encrypt_to = is_encrypt_to;
-                      *listaddr = cl;
-                    }
-                }
-            }
+          if (!rc && use_cache)
+            recp_cache_put (name, cert);
+          if (!rc)
+            rc = validate_and_add (ctrl, &cert, secret, listaddr,
+                                   is_encrypt_to);
         }
     }
 
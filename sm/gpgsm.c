@@ -102,6 +102,7 @@ enum cmd_and_opt_values {
   oFixedPassphrase,
   oLogFile,
   oNoLogFile,
+  oSocketName,
   oAuditLog,
   oHtmlAuditLog,
 
@@ -296,6 +297,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_s (oLogFile, "log-file",
                 N_("|FILE|write a server mode log to FILE")),
   ARGPARSE_s_n (oNoLogFile, "no-log-file", "@"),
+  ARGPARSE_s_s (oSocketName, "socket-name", "@"),
   ARGPARSE_s_i (oLoggerFD, "logger-fd", "@"),
 
   ARGPARSE_s_s (oAuditLog, "audit-log",
@@ -888,6 +890,7 @@ main ( int argc, char **argv)
   int default_config =1;
   int default_keyring = 1;
   char *logfile = NULL;
+  char *socket_name = NULL;
   char *auditlog = NULL;
   char *htmlauditlog = NULL;
   int greeting = 0;
@@ -1228,6 +1231,7 @@ main ( int argc, char **argv)
 
         case oLogFile: logfile = pargs.r.ret_str; break;
         case oNoLogFile: logfile = NULL; break;
+        case oSocketName: socket_name = pargs.r.ret_str; break;
 
         case oAuditLog: auditlog = pargs.r.ret_str; break;
         case oHtmlAuditLog: htmlauditlog = pargs.r.ret_str; break;
@@ -1720,7 +1724,10 @@ main ( int argc, char **argv)
           gnupg_sleep (debug_wait);
           log_debug ("... okay\n");
          }
-      gpgsm_server (recplist);
+      if (socket_name)
+        gpgsm_socket_server (recplist, socket_name);
+      else
+        gpgsm_server (recplist);
       break;
 
     case aCallDirmngr:
@@ -41,6 +41,9 @@
 /* The arbitrary limit of one PKCS#12 object.  */
 #define MAX_P12OBJ_SIZE 128 /*kb*/
 
+/* The most certificates stored with one update of the keybox.  */
+#define MAX_PENDING_CERTS 4096
+
 
 struct stats_s {
   unsigned long count;
@@ -50,6 +53,17 @@ struct stats_s {
   unsigned long secret_read;
   unsigned long secret_imported;
   unsigned long secret_dups;
+  /* The KEK used to wrap the keys of all PKCS#12 objects of this
+     import run; it is only requested once from the agent.  Each key
+     is still sent with an IMPORT_KEY of its own because the agent
+     has no command to import several keys at once.  */
+  void *kek;
+  size_t keklen;
+  /* Certificates which passed the checks but have not yet been
+     stored; see flush_pending.  */
+  ksba_cert_t *pending;
+  unsigned int npending;
+  unsigned int pending_size;
  };
 
 
@@ -117,6 +131,17 @@ print_import_problem (ctrl_t ctrl, ksba_cert_t cert, int reason)
 }
 
 
+/* Wipe and release the KEK kept in STATS.  */
+static void
+release_kek (struct stats_s *stats)
+{
+  if (stats->kek)
+    wipememory (stats->kek, stats->keklen);
+  xfree (stats->kek);
+  stats->kek = NULL;
+}
+
+
 void
 print_imported_summary (ctrl_t ctrl, struct stats_s *stats)
 {
@@ -163,6 +188,171 @@ print_imported_summary (ctrl_t ctrl, struct stats_s *stats)
 
 
 
+static void check_and_store (ctrl_t ctrl, struct stats_s *stats,
+                             ksba_cert_t cert, int depth);
+
+
+/* Report that CERT has been stored or, with EXISTED set, had already
+   been stored, and walk up its chain.  */
+static void
+report_stored (ctrl_t ctrl, struct stats_s *stats, ksba_cert_t cert,
+               int depth, int existed)
+{
+  ksba_cert_t next = NULL;
+
+  if (!existed)
+    {
+      print_imported_status (ctrl, cert, 1);
+      if (stats)
+        stats->imported++;
+    }
+  else
+    {
+      print_imported_status (ctrl, cert, 0);
+      if (stats)
+        stats->unchanged++;
+    }
+
+  if (opt.verbose > 1 && existed)
+    {
+      if (depth)
+        log_info ("issuer certificate already in DB\n");
+      else
+        log_info ("certificate already in DB\n");
+    }
+  else if (opt.verbose && !existed)
+    {
+      if (depth)
+        log_info ("issuer certificate imported\n");
+      else
+        log_info ("certificate imported\n");
+    }
+
+  /* Now lets walk up the chain and import all certificates up the
+     chain.  This is required in case we already stored parent
+     certificates in the ephemeral keybox.  Do not update the
+     statistics, though. */
+  if (!gpgsm_walk_cert_chain (ctrl, cert, &next))
+    {
+      check_and_store (ctrl, NULL, next, depth+1);
+      ksba_cert_release (next);
+    }
+}
+
+
+/* Store the pending certificates of STATS with one update of the
+   keybox and report the results in the order the certificates have
+   been read.  */
+static void
+flush_pending (ctrl_t ctrl, struct stats_s *stats)
+{
+  gpg_error_t err;
+  int *existed;
+  unsigned int i;
+
+  if (!stats->npending)
+    return;
+
+  existed = xtrycalloc (stats->npending, sizeof *existed);
+  if (!existed)
+    err = gpg_error_from_syserror ();
+  else
+    err = keydb_store_certs (stats->pending, stats->npending, existed);
+  for (i=0; i < stats->npending; i++)
+    {
+      if (!err)
+        report_stored (ctrl, stats, stats->pending[i], 0, existed[i]);
+      else
+        {
+          log_error (_("error storing certificate\n"));
+          stats->not_imported++;
+          print_import_problem (ctrl, stats->pending[i], 4);
+        }
+      ksba_cert_release (stats->pending[i]);
+      stats->pending[i] = NULL;
+    }
+  stats->npending = 0;
+  xfree (existed);
+}
+
+
+/* Add CERT to the pending certificates of STATS.  Returns false if
+   that is not possible and CERT needs to be stored right away.  */
+static int
+add_pending (ctrl_t ctrl, struct stats_s *stats, ksba_cert_t cert)
+{
+  if (stats->npending == stats->pending_size)
+    {
+      ksba_cert_t *tmp;
+      unsigned int n;
+
+      if (stats->pending_size >= MAX_PENDING_CERTS)
+        {
+          flush_pending (ctrl, stats);
+          return add_pending (ctrl, stats, cert);
+        }
+      n = stats->pending_size? 2 * stats->pending_size : 64;
+      if (n > MAX_PENDING_CERTS)
+        n = MAX_PENDING_CERTS;
+      tmp = xtryrealloc (stats->pending, n * sizeof *tmp);
+      if (!tmp)
+        return 0;
+      stats->pending = tmp;
+      stats->pending_size = n;
+    }
+  ksba_cert_ref (cert);
+  stats->pending[stats->npending++] = cert;
+  return 1;
+}
+
+
+/* The basic checks of CERT failed with RC because its issuer is not
+   in the keyDB.  If the issuer is one of the pending certificates of
+   STATS, check the signature of CERT as if they had been stored
+   already.  Returns 0 if the signature is good and RC if no issuer is
+   pending.  */
+static gpg_error_t
+check_pending_issuer (struct stats_s *stats, ksba_cert_t cert,
+                      gpg_error_t rc)
+{
+  char *issuer, *subject;
+  unsigned int i;
+  int found = 0;
+
+  issuer = ksba_cert_get_issuer (cert, 0);
+  if (!issuer)
+    return rc;
+  for (i=0; i < stats->npending; i++)
+    {
+      subject = ksba_cert_get_subject (stats->pending[i], 0);
+      if (subject && !strcmp (subject, issuer))
+        {
+          found = 1;
+          if (!gpgsm_check_cert_sig (stats->pending[i], cert))
+            {
+              ksba_free (subject);
+              ksba_free (issuer);
+              if (opt.verbose)
+                log_info (_("certificate is good\n"));
+              return 0;
+            }
+        }
+      ksba_free (subject);
+    }
+  ksba_free (issuer);
+  if (found)
+    {
+      log_error ("certificate has a BAD signature\n");
+      return gpg_error (GPG_ERR_BAD_CERT);
+    }
+  return rc;
+}
+
+
+/* Check CERT and store it.  If STATS is given and we do not do a full
+   validation it is only added to the pending certificates, which are
+   all stored at once by flush_pending, so that importing a large
+   bundle does not update the keybox for each certificate.  */
 static void
 check_and_store (ctrl_t ctrl, struct stats_s *stats,
                  ksba_cert_t cert, int depth)
@@ -193,54 +383,19 @@ check_and_store (ctrl_t ctrl, struct stats_s *stats,
   rc = gpgsm_basic_cert_check (ctrl, cert);
   if (!rc && ctrl->with_validation)
     rc = gpgsm_validate_chain (ctrl, cert, "", NULL, 0, NULL, 0, NULL);
+  if (stats && !ctrl->with_validation
+      && gpg_err_code (rc) == GPG_ERR_MISSING_ISSUER_CERT)
+    rc = check_pending_issuer (stats, cert, rc);
   if (!rc || (!ctrl->with_validation
               && (gpg_err_code (rc) == GPG_ERR_MISSING_CERT
                   || gpg_err_code (rc) == GPG_ERR_MISSING_ISSUER_CERT)))
     {
       int existed;
 
+      if (stats && !ctrl->with_validation && add_pending (ctrl, stats, cert))
+        return;  /* Stored by flush_pending.  */
       if (!keydb_store_cert (cert, 0, &existed))
-        {
-          ksba_cert_t next = NULL;
-
-          if (!existed)
-            {
-              print_imported_status (ctrl, cert, 1);
-              if (stats)
-                stats->imported++;
-            }
-          else
-            {
-              print_imported_status (ctrl, cert, 0);
-              if (stats)
-                stats->unchanged++;
-            }
-
-          if (opt.verbose > 1 && existed)
-            {
-              if (depth)
-                log_info ("issuer certificate already in DB\n");
-              else
-                log_info ("certificate already in DB\n");
-            }
-          else if (opt.verbose && !existed)
-            {
-              if (depth)
-                log_info ("issuer certificate imported\n");
-              else
-                log_info ("certificate imported\n");
-            }
-
-          /* Now lets walk up the chain and import all certificates up
-             the chain.  This is required in case we already stored
-             parent certificates in the ephemeral keybox.  Do not
-             update the statistics, though. */
-          if (!gpgsm_walk_cert_chain (ctrl, cert, &next))
-            {
-              check_and_store (ctrl, NULL, next, depth+1);
-              ksba_cert_release (next);
-            }
-        }
+        report_stored (ctrl, stats, cert, depth, existed);
       else
         {
           log_error (_("error storing certificate\n"));
@@ -518,7 +673,10 @@ gpgsm_import (ctrl_t ctrl, int in_fd, int reimport_mode)
     rc = reimport_one (ctrl, &stats, in_fd);
   else
     rc = import_one (ctrl, &stats, in_fd);
+  flush_pending (ctrl, &stats);
   print_imported_summary (ctrl, &stats);
+  xfree (stats.pending);
+  release_kek (&stats);
   /* If we never printed an error message do it now so that a command
      line invocation will return with an error (log_error keeps a
      global errorcount) */
@@ -550,7 +708,10 @@ gpgsm_import_files (ctrl_t ctrl, int nfiles, char **files,
             rc = 0;
         }
     }
+  flush_pending (ctrl, &stats);
   print_imported_summary (ctrl, &stats);
+  xfree (stats.pending);
+  release_kek (&stats);
   /* If we never printed an error message do it now so that a command
      line invocation will return with an error (log_error keeps a
      global errorcount) */
@@ -704,8 +865,6 @@ parse_p12 (ctrl_t ctrl, ksba_reader_t reader, struct stats_s *stats)
   char *passphrase = NULL;
   unsigned char *key = NULL;
   size_t keylen;
-  void *kek = NULL;
-  size_t keklen;
   unsigned char *wrappedkey = NULL;
   size_t wrappedkeylen;
   gcry_cipher_hd_t cipherhd = NULL;
@@ -845,11 +1004,14 @@ parse_p12 (ctrl_t ctrl, ksba_reader_t reader, struct stats_s *stats)
   s_key = NULL;
 
   /* Get the current KEK.  */
-  err = gpgsm_agent_keywrap_key (ctrl, 0, &kek, &keklen);
-  if (err)
+  if (!stats->kek)
     {
-      log_error ("error getting the KEK: %s\n", gpg_strerror (err));
-      goto leave;
+      err = gpgsm_agent_keywrap_key (ctrl, 0, &stats->kek, &stats->keklen);
+      if (err)
+        {
+          log_error ("error getting the KEK: %s\n", gpg_strerror (err));
+          goto leave;
+        }
     }
 
   /* Wrap the key.  */
@@ -857,11 +1019,9 @@ parse_p12 (ctrl_t ctrl, ksba_reader_t reader, struct stats_s *stats)
                           GCRY_CIPHER_MODE_AESWRAP, 0);
   if (err)
     goto leave;
-  err = gcry_cipher_setkey (cipherhd, kek, keklen);
+  err = gcry_cipher_setkey (cipherhd, stats->kek, stats->keklen);
   if (err)
     goto leave;
-  xfree (kek);
-  kek = NULL;
 
   wrappedkeylen = keylen + 8;
   wrappedkey = xtrymalloc (wrappedkeylen);
@@ -915,7 +1075,6 @@ parse_p12 (ctrl_t ctrl, ksba_reader_t reader, struct stats_s *stats)
   xfree (passphrase);
   gcry_cipher_close (cipherhd);
   xfree (wrappedkey);
-  xfree (kek);
   xfree (get_membuf (&p12mbuf, NULL));
   xfree (p12buffer);
 
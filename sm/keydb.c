@@ -65,6 +65,11 @@ struct keydb_handle {
 };
 
 
+/* Incremented whenever this process changes a certificate store; see
+   keydb_change_count.  */
+static unsigned int change_count;
+
+
 static int lock_all (KEYDB_HANDLE hd);
 static void unlock_all (KEYDB_HANDLE hd);
 
@@ -726,6 +731,7 @@ keydb_set_flags (KEYDB_HANDLE hd, int which, int idx, unsigned int value)
   if (!hd->locked)
     return gpg_error (GPG_ERR_NOT_LOCKED);
 
+  change_count++;
   switch (hd->active[hd->found].type)
     {
     case KEYDB_RESOURCE_TYPE_NONE:
@@ -739,6 +745,15 @@ keydb_set_flags (KEYDB_HANDLE hd, int which, int idx, unsigned int value)
   return err;
 }
 
+/* Return a number which changes whenever this process changes a
+   certificate or its flags.  */
+unsigned int
+keydb_change_count (void)
+{
+  return change_count;
+}
+
+
 /*
  * Insert a new Certificate into one of the resources.
  */
@@ -755,6 +770,8 @@ keydb_insert_cert (KEYDB_HANDLE hd, ksba_cert_t cert)
   if (opt.dry_run)
     return 0;
 
+  change_count++;
+
   if ( hd->found >= 0 && hd->found < hd->used)
     idx = hd->found;
   else if ( hd->current >= 0 && hd->current < hd->used)
@@ -783,6 +800,50 @@ keydb_insert_cert (KEYDB_HANDLE hd, ksba_cert_t cert)
 
 
 
+/* Insert the NCERTS certificates CERTS with the SHA-1 fingerprints
+   DIGESTS, 20 bytes each, into the resource of HD found by
+   keydb_locate_writable with one update of it.  */
+gpg_error_t
+keydb_insert_certs (KEYDB_HANDLE hd, ksba_cert_t *certs,
+                    unsigned char *digests, int ncerts)
+{
+  gpg_error_t err = -1;
+  int idx;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  if (opt.dry_run)
+    return 0;
+
+  change_count++;
+
+  if ( hd->found >= 0 && hd->found < hd->used)
+    idx = hd->found;
+  else if ( hd->current >= 0 && hd->current < hd->used)
+    idx = hd->current;
+  else
+    return gpg_error (GPG_ERR_GENERAL);
+
+  if (!hd->locked)
+    return gpg_error (GPG_ERR_NOT_LOCKED);
+
+  switch (hd->active[idx].type)
+    {
+    case KEYDB_RESOURCE_TYPE_NONE:
+      err = gpg_error (GPG_ERR_GENERAL);
+      break;
+    case KEYDB_RESOURCE_TYPE_KEYBOX:
+      err = keybox_insert_certs (hd->active[idx].u.kr, certs, digests, ncerts);
+      break;
+    }
+
+  unlock_all (hd);
+  return err;
+}
+
+
+
 /* Update the current keyblock with KB.  */
 int
 keydb_update_cert (KEYDB_HANDLE hd, ksba_cert_t cert)
@@ -799,6 +860,8 @@ keydb_update_cert (KEYDB_HANDLE hd, ksba_cert_t cert)
   if (opt.dry_run)
     return 0;
 
+  change_count++;
+
   rc = lock_all (hd);
   if (rc)
     return rc;
@@ -837,6 +900,8 @@ keydb_delete (KEYDB_HANDLE hd, int unlock)
   if( opt.dry_run )
     return 0;
 
+  change_count++;
+
   if (!hd->locked)
     return gpg_error (GPG_ERR_NOT_LOCKED);
 
@@ -1152,6 +1217,133 @@ keydb_store_cert (ksba_cert_t cert, int ephemeral, int *existed)
 }
 
 
+/* An item of the table sorted by keydb_store_certs.  */
+struct store_item_s
+{
+  unsigned char fpr[20];
+  int idx;                /* The index into the certificates.  */
+};
+
+static int
+compare_store_items (const void *a, const void *b)
+{
+  const struct store_item_s *aa = a;
+  const struct store_item_s *bb = b;
+  int cmp;
+
+  cmp = memcmp (aa->fpr, bb->fpr, 20);
+  if (cmp)
+    return cmp;
+  return aa->idx < bb->idx? -1 : aa->idx > bb->idx;
+}
+
+
+/* Store the NCERTS certificates CERTS like keydb_store_cert does for
+   each of them, but under one lock and with one update of the keybox
+   for all new certificates.  A certificate given twice is stored
+   only once.  EXISTED is an array of NCERTS ints which receives for
+   each certificate whether it was already stored, which is also the
+   case for a repetition.  On error nothing has been stored.  */
+gpg_error_t
+keydb_store_certs (ksba_cert_t *certs, int ncerts, int *existed)
+{
+  gpg_error_t err;
+  KEYDB_HANDLE kh;
+  struct store_item_s *items;
+  ksba_cert_t *newcerts = NULL;
+  unsigned char *newfprs = NULL;
+  int i, nnew;
+
+  if (ncerts < 1)
+    return 0;
+
+  items = xtrycalloc (ncerts, sizeof *items);
+  if (!items)
+    return gpg_error_from_syserror ();
+  for (i=0; i < ncerts; i++)
+    {
+      existed[i] = 0;
+      items[i].idx = i;
+      if (!gpgsm_get_fingerprint (certs[i], 0, items[i].fpr, NULL))
+        {
+          log_error (_("failed to get the fingerprint\n"));
+          xfree (items);
+          return gpg_error (GPG_ERR_GENERAL);
+        }
+    }
+  /* Sort by fingerprint to detect repetitions.  Among equal ones the
+     first given is stored.  */
+  qsort (items, ncerts, sizeof *items, compare_store_items);
+
+  kh = NULL;
+  newcerts = xtrycalloc (ncerts, sizeof *newcerts);
+  newfprs = xtrymalloc (ncerts * 20);
+  if (!newcerts || !newfprs)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  kh = keydb_new (0);
+  if (!kh)
+    {
+      log_error (_("failed to allocate keyDB handle\n"));
+      err = gpg_error (GPG_ERR_ENOMEM);
+      goto leave;
+    }
+
+  err = lock_all (kh);
+  if (err)
+    goto leave;
+
+  nnew = 0;
+  for (i=0; i < ncerts; i++)
+    {
+      if (i && !memcmp (items[i].fpr, items[i-1].fpr, 20))
+        {
+          existed[items[i].idx] = 1;
+          continue;
+        }
+      keydb_search_reset (kh);
+      err = keydb_search_fpr (kh, items[i].fpr);
+      if (!err)
+        {
+          existed[items[i].idx] = 1;
+          continue;
+        }
+      if (err != -1)
+        {
+          log_error (_("problem looking for existing certificate: %s\n"),
+                     gpg_strerror (err));
+          goto leave;
+        }
+      newcerts[nnew] = certs[items[i].idx];
+      memcpy (newfprs + 20 * nnew, items[i].fpr, 20);
+      nnew++;
+    }
+  err = 0;
+  if (!nnew)
+    goto leave;
+
+  err = keydb_locate_writable (kh, 0);
+  if (err)
+    {
+      log_error (_("error finding writable keyDB: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  err = keydb_insert_certs (kh, newcerts, newfprs, nnew);
+  if (err)
+    log_error (_("error storing certificate: %s\n"), gpg_strerror (err));
+
+ leave:
+  keydb_release (kh);
+  xfree (newfprs);
+  xfree (newcerts);
+  xfree (items);
+  return err;
+}
+
+
 /* This is basically keydb_set_flags but it implements a complete
    transaction by locating the certificate in the DB and updating the
    flags. */
@@ -48,8 +48,11 @@ void keydb_pop_found_state (KEYDB_HANDLE hd);
 int keydb_get_cert (KEYDB_HANDLE hd, ksba_cert_t *r_cert);
 int keydb_insert_cert (KEYDB_HANDLE hd, ksba_cert_t cert);
 int keydb_update_cert (KEYDB_HANDLE hd, ksba_cert_t cert);
+gpg_error_t keydb_insert_certs (KEYDB_HANDLE hd, ksba_cert_t *certs,
+                                unsigned char *digests, int ncerts);
 
 int keydb_delete (KEYDB_HANDLE hd, int unlock);
+unsigned int keydb_change_count (void);
 
 int keydb_locate_writable (KEYDB_HANDLE hd, const char *reserved);
 void keydb_rebuild_caches (void);
@@ -66,6 +69,7 @@ int keydb_search_issuer_sn (KEYDB_HANDLE hd,
 int keydb_search_subject (KEYDB_HANDLE hd, const char *issuer);
 
 int keydb_store_cert (ksba_cert_t cert, int ephemeral, int *existed);
+gpg_error_t keydb_store_certs (ksba_cert_t *certs, int ncerts, int *existed);
 gpg_error_t keydb_set_cert_flags (ksba_cert_t cert, int ephemeral,
                                   int which, int idx,
                                   unsigned int mask, unsigned int value);
@@ -576,6 +576,7 @@ decrypt_block (const void *ciphertext, unsigned char *plaintext, size_t length,
   int charsetidx = 0;
   char *convertedpw = NULL;   /* Malloced and converted password or NULL.  */
   size_t convertedpwsize = 0; /* Allocated length.  */
+  char *lastpw = NULL;        /* The last converted password tried.  */
 
   for (charsetidx=0; charsets[charsetidx]; charsetidx++)
     {
@@ -593,7 +594,7 @@ decrypt_block (const void *ciphertext, unsigned char *plaintext, size_t length,
                  passphrase; the result will actually be shorter
                  then.  */
               convertedpwsize = strlen (pw) + 1;
-              convertedpw = gcry_malloc_secure (convertedpwsize);
+              convertedpw = gcry_malloc_secure (2 * convertedpwsize);
               if (!convertedpw)
                 {
                   log_info ("out of secure memory while"
@@ -618,6 +619,14 @@ decrypt_block (const void *ciphertext, unsigned char *plaintext, size_t length,
             }
           *outptr = 0;
           jnlib_iconv_close (cd);
+          /* Most passphrases are plain ASCII and thus don't change
+             with the conversion.  Each try runs the key derivation
+             again; thus we skip those we already tried.  */
+          if (!strcmp (convertedpw, pw)
+              || (lastpw && !strcmp (convertedpw, lastpw)))
+            continue;
+          lastpw = convertedpw + convertedpwsize;
+          strcpy (lastpw, convertedpw);
           log_info ("decryption failed; trying charset '%s'\n",
                     charsets[charsetidx]);
         }
@@ -26,10 +26,15 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <unistd.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif
 
 #include "gpgsm.h"
 #include <assuan.h>
 #include "sysutils.h"
+#include "i18n.h"
 
 #define set_error(e,t) assuan_set_error (ctx, gpg_error (e), (t))
 
@@ -1246,15 +1251,14 @@ register_commands (assuan_context_t ctx)
   return 0;
 }
 
-/* Startup the server. DEFAULT_RECPLIST is the list of recipients as
-   set from the command line or config file.  We only require those
-   marked as encrypt-to. */
-void
-gpgsm_server (certlist_t default_recplist)
+/* Run one Assuan session on the initialized server context CTX and
+   release CTX.  Each session gets its own control structure; the
+   keydb, the connections to the agent and the dirmngr and the chain
+   cache are kept for the whole process.  */
+static void
+run_session (assuan_context_t ctx, certlist_t default_recplist)
 {
   int rc;
-  assuan_fd_t filedes[2];
-  assuan_context_t ctx;
   struct server_control_s ctrl;
   static const char hello[] = ("GNU Privacy Guard's S/M server "
                                VERSION " ready");
@@ -1262,33 +1266,6 @@ gpgsm_server (certlist_t default_recplist)
   memset (&ctrl, 0, sizeof ctrl);
   gpgsm_init_default_ctrl (&ctrl);
 
-  /* We use a pipe based server so that we can work from scripts.
-     assuan_init_pipe_server will automagically detect when we are
-     called with a socketpair and ignore FILEDES in this case. */
-#ifdef HAVE_W32CE_SYSTEM
-  #define SERVER_STDIN es_fileno(es_stdin)
-  #define SERVER_STDOUT es_fileno(es_stdout)
-#else
-#define SERVER_STDIN 0
-#define SERVER_STDOUT 1
-#endif
-  filedes[0] = assuan_fdopen (SERVER_STDIN);
-  filedes[1] = assuan_fdopen (SERVER_STDOUT);
-  rc = assuan_new (&ctx);
-  if (rc)
-    {
-      log_error ("failed to allocate assuan context: %s\n",
-                 gpg_strerror (rc));
-      gpgsm_exit (2);
-    }
-
-  rc = assuan_init_pipe_server (ctx, filedes);
-  if (rc)
-    {
-      log_error ("failed to initialize the server: %s\n",
-                 gpg_strerror (rc));
-      gpgsm_exit (2);
-    }
   rc = register_commands (ctx);
   if (rc)
     {
@@ -1367,6 +1344,166 @@ gpgsm_server (certlist_t default_recplist)
 }
 
 
+/* Startup the server. DEFAULT_RECPLIST is the list of recipients as
+   set from the command line or config file.  We only require those
+   marked as encrypt-to. */
+void
+gpgsm_server (certlist_t default_recplist)
+{
+  int rc;
+  assuan_fd_t filedes[2];
+  assuan_context_t ctx;
+
+  /* We use a pipe based server so that we can work from scripts.
+     assuan_init_pipe_server will automagically detect when we are
+     called with a socketpair and ignore FILEDES in this case. */
+#ifdef HAVE_W32CE_SYSTEM
+  #define SERVER_STDIN es_fileno(es_stdin)
+  #define SERVER_STDOUT es_fileno(es_stdout)
+#else
+#define SERVER_STDIN 0
+#define SERVER_STDOUT 1
+#endif
+  filedes[0] = assuan_fdopen (SERVER_STDIN);
+  filedes[1] = assuan_fdopen (SERVER_STDOUT);
+  rc = assuan_new (&ctx);
+  if (rc)
+    {
+      log_error ("failed to allocate assuan context: %s\n",
+                 gpg_strerror (rc));
+      gpgsm_exit (2);
+    }
+
+  rc = assuan_init_pipe_server (ctx, filedes);
+  if (rc)
+    {
+      log_error ("failed to initialize the server: %s\n",
+                 gpg_strerror (rc));
+      gpgsm_exit (2);
+    }
+  run_session (ctx, default_recplist);
+}
+
+
+#ifndef HAVE_W32_SYSTEM
+/* Create a listening socket with the file name NAME.  */
+static assuan_fd_t
+create_server_socket (const char *name)
+{
+  struct sockaddr_un serv_addr;
+  socklen_t len;
+  assuan_fd_t fd;
+  int rc;
+
+  fd = assuan_sock_new (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
+    {
+      log_error (_("can't create socket: %s\n"), strerror (errno));
+      gpgsm_exit (2);
+    }
+
+  memset (&serv_addr, 0, sizeof serv_addr);
+  serv_addr.sun_family = AF_UNIX;
+  if (strlen (name)+1 >= sizeof serv_addr.sun_path)
+    {
+      log_error (_("socket name '%s' is too long\n"), name);
+      gpgsm_exit (2);
+    }
+  strcpy (serv_addr.sun_path, name);
+  len = SUN_LEN (&serv_addr);
+
+  rc = assuan_sock_bind (fd, (struct sockaddr*)&serv_addr, len);
+  if (rc == -1 && errno == EADDRINUSE)
+    {
+      /* A previous instance did not remove its socket.  */
+      gnupg_remove (name);
+      rc = assuan_sock_bind (fd, (struct sockaddr*)&serv_addr, len);
+    }
+  if (rc == -1)
+    {
+      log_error (_("error binding socket to '%s': %s\n"),
+                 name, gpg_strerror (gpg_error_from_syserror ()));
+      assuan_sock_close (fd);
+      gpgsm_exit (2);
+    }
+
+  if (listen (FD2INT (fd), 5) == -1)
+    {
+      log_error (_("listen() failed: %s\n"), strerror (errno));
+      assuan_sock_close (fd);
+      gnupg_remove (name);
+      gpgsm_exit (2);
+    }
+
+  if (opt.verbose)
+    log_info (_("listening on socket '%s'\n"), name);
+  return fd;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+/* Startup the server on the socket SOCKET_NAME and serve the clients
+   one after the other until we are killed.  This is the same as
+   gpgsm_server but saves the startup cost of gpgsm, the opening of
+   the keyboxes and the connections to the agent and the dirmngr for
+   all but the first client.  A client connecting while another one is
+   served waits in the listen queue; the keydb handles, the agent and
+   dirmngr contexts and the caches of gpgsm are static and not meant
+   to be used by several sessions at once.  */
+void
+gpgsm_socket_server (certlist_t default_recplist, const char *socket_name)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)default_recplist;
+  log_error ("--socket-name is not supported on this platform\n");
+  gpgsm_exit (2);
+#else
+  int rc;
+  assuan_fd_t listen_fd;
+  int fd;
+  assuan_context_t ctx;
+
+  listen_fd = create_server_socket (socket_name);
+
+  for (;;)
+    {
+      fd = accept (FD2INT (listen_fd), NULL, NULL);
+      if (fd == -1)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          log_error ("accept failed: %s\n", strerror (errno));
+          break;
+        }
+
+      ctx = NULL;
+      rc = assuan_new (&ctx);
+      if (!rc)
+        rc = assuan_init_socket_server (ctx, INT2FD (fd),
+                                        ASSUAN_SOCKET_SERVER_ACCEPTED);
+      if (rc)
+        {
+          log_error ("failed to initialize the server: %s\n",
+                     gpg_strerror (rc));
+          if (ctx)
+            assuan_release (ctx);
+          close (fd);
+          continue;
+        }
+      if (DBG_IPC)
+        log_debug ("handler for fd %d started\n", fd);
+      /* Releasing the context closes FD.  */
+      run_session (ctx, default_recplist);
+      if (DBG_IPC)
+        log_debug ("handler for fd %d terminated\n", fd);
+    }
+
+  assuan_sock_close (listen_fd);
+  gnupg_remove (socket_name);
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
 
 gpg_error_t
 gpgsm_status2 (ctrl_t ctrl, int no, ...)
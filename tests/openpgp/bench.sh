@@ -0,0 +1,270 @@
+#!/bin/sh
+# Performance regression benchmarks for gpg
+# Copyright (C) 2026 The gnupg-vanity authors
+# This file is free software; as a special exception the author gives
+# unlimited permission to copy and/or distribute it, with or without
+# modifications, as long as this notice is preserved.  This file is
+# distributed in the hope that it will be useful, but WITHOUT ANY
+# WARRANTY, to the extent permitted by law; without even the implied
+# warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+# This script is run by "make bench" and not by "make check".  It
+# creates synthetic keyrings and payloads below bench.d, times the
+# main gpg operations on them and writes the results as JSON.  The
+# sizes are taken from these variables:
+#
+#   BENCH_KEYS    Number of keys of the keyrings; default "1000".
+#                 Use "1000 100000 1000000" for the full suite.  The
+#                 keyrings are kept in bench.d because creating the
+#                 large ones takes a long time.
+#   BENCH_SIZES   Sizes of the payloads in bytes; default "1024
+#                 1048576 104857600".  The full suite adds 10737418240,
+#                 which needs about four times that much disk space.
+#   BENCH_RUNS    Number of timed runs of each operation; default 3.
+#   BENCH_OUTPUT  Name of the result file; default bench-results.json.
+#
+# Each operation is timed with warm caches, that is after an untimed
+# run with a running agent, and with cold caches, that is after the
+# agent has been stopped and, if we are allowed to do so, the page
+# cache has been dropped.  Whether the page cache was dropped is
+# recorded in the results as "dropped".
+
+pgmname=`basename $0`
+
+if [ -z "$top_builddir" ]; then
+    echo "$pgmname: top_builddir not set - use \"make bench\"" >&2
+    exit 1
+fi
+
+GPG_BIN="$top_builddir/g10/gpg2"
+GPG_AGENT="$top_builddir/agent/gpg-agent"
+GPG_CONNECT_AGENT="$top_builddir/tools/gpg-connect-agent"
+MKTDATA="$top_builddir/tools/mk-tdata"
+GPG="$GPG_BIN --no-permission-warning --batch --no-tty"
+
+keys=${BENCH_KEYS:-"1000"}
+sizes=${BENCH_SIZES:-"1024 1048576 104857600"}
+runs=${BENCH_RUNS:-3}
+output=${BENCH_OUTPUT:-bench-results.json}
+workdir="`/bin/pwd`/bench.d"
+
+unset GPG_AGENT_INFO
+LC_ALL=C
+export LC_ALL
+
+info () {
+    echo "$pgmname: $*" >&2
+}
+
+fatal () {
+    echo "$pgmname: fatal: $*" >&2
+    exit 1
+}
+
+# Print the current time in seconds.  The fraction is only available
+# with GNU date.
+now () {
+    t=`date +%s.%N`
+    case "$t" in
+      *N) echo "${t%.*}.0" ;;
+      *)  echo "$t" ;;
+    esac
+}
+
+# Prepare the home directory $1 for gpg.
+make_home () {
+    mkdir -p "$1" || fatal "can't create $1"
+    chmod 700 "$1"
+    cat >"$1/gpg.conf" <<EOF
+no-greeting
+no-secmem-warning
+no-auto-check-trustdb
+trust-model always
+agent-program $GPG_AGENT|--debug-quick-random
+EOF
+    : >"$1/gpg-agent.conf"
+}
+
+# Stop the agent of the home directory $1.
+stop_agent () {
+    GNUPGHOME="$1" $GPG_CONNECT_AGENT killagent /bye >/dev/null 2>&1
+}
+
+# Try to empty the page cache.  Sets DROPPED to true or false.
+drop_caches () {
+    sync
+    if (echo 3 >/proc/sys/vm/drop_caches) 2>/dev/null; then
+        dropped=true
+    else
+        dropped=false
+    fi
+}
+
+# Create the keyring with $1 keys in the home directory $2 unless it
+# already exists.  All keys have an Ed25519 primary key and a
+# Curve25519 subkey.  The first key, bench-1@example.org, is used for
+# the payload operations.  An export of all keys is stored as
+# keys-$1.gpg for the import benchmark.
+make_keyring () {
+    [ -f "$workdir/keys-$1.gpg" ] && return 0
+    info "creating keyring with $1 keys"
+    rm -rf "$2"
+    make_home "$2"
+    awk -v n="$1" 'BEGIN {
+        print "%no-protection";
+        print "%bulk";
+        for (i=1; i <= n; i++) {
+            print "Key-Type: eddsa";
+            print "Key-Curve: Ed25519";
+            print "Key-Usage: sign";
+            print "Subkey-Type: ecdh";
+            print "Subkey-Curve: Curve25519";
+            print "Subkey-Usage: encrypt";
+            print "Name-Real: Bench " i;
+            print "Name-Email: bench-" i "@example.org";
+            print "Expire-Date: 0";
+            print "%commit";
+        }
+    }' | GNUPGHOME="$2" $GPG --gen-key \
+        || fatal "creating keyring with $1 keys failed"
+    GNUPGHOME="$2" $GPG --export >"$workdir/keys-$1.gpg.tmp" \
+        || fatal "exporting keyring with $1 keys failed"
+    mv "$workdir/keys-$1.gpg.tmp" "$workdir/keys-$1.gpg"
+    stop_agent "$2"
+}
+
+# Create a payload of $1 bytes unless it already exists.  mk-tdata
+# can't count beyond an int and thus larger payloads are put
+# together from blocks of 1 MiB.
+make_payload () {
+    f="$workdir/data-$1"
+    [ -f "$f" ] && return 0
+    info "creating payload of $1 bytes"
+    if [ "$1" -le 1048576 ]; then
+        $MKTDATA "$1" >"$f.tmp" || fatal "mk-tdata failed"
+    else
+        $MKTDATA 1048576 >"$workdir/block" || fatal "mk-tdata failed"
+        blocks=`expr "$1" / 1048576`
+        rest=`expr "$1" % 1048576`
+        : >"$f.tmp"
+        i=0
+        while [ $i -lt $blocks ]; do
+            cat "$workdir/block" >>"$f.tmp" || fatal "writing $f failed"
+            i=`expr $i + 1`
+        done
+        [ $rest -gt 0 ] && $MKTDATA "$rest" >>"$f.tmp"
+        rm -f "$workdir/block"
+    fi
+    mv "$f.tmp" "$f"
+}
+
+# Run the command given after $1 with GNUPGHOME set to $1.  All
+# output is discarded.
+run_in () {
+    (GNUPGHOME="$1"; export GNUPGHOME; shift; eval "$*") >/dev/null 2>&1
+}
+
+first_result=yes
+
+# Time the command given after the arguments OP KEYS BYTES CACHE HOME
+# and append its result to the output.  The command is run by the
+# shell with GNUPGHOME set to HOME.  If the variable SETUP is not
+# empty it is evaluated before each run and not timed.
+bench () {
+    op=$1 nkeys=$2 bytes=$3 cache=$4 home=$5
+    shift 5
+    dropped=false
+    times=
+    best=
+    if [ "$cache" = warm ]; then
+        [ -n "$setup" ] && eval "$setup"
+        run_in "$home" "$@" || fatal "$op failed"
+    fi
+    r=0
+    while [ $r -lt $runs ]; do
+        [ -n "$setup" ] && eval "$setup"
+        if [ "$cache" = cold ]; then
+            stop_agent "$home"
+            drop_caches
+        fi
+        start=`now`
+        run_in "$home" "$@" || fatal "$op failed"
+        end=`now`
+        t=`awk -v a="$start" -v b="$end" 'BEGIN { printf "%.6f", b - a }'`
+        times="${times:+$times, }$t"
+        best=`awk -v a="$best" -v b="$t" \
+                  'BEGIN { print (a == "" || b + 0 < a + 0)? b : a }'`
+        r=`expr $r + 1`
+    done
+    info "$op keys=$nkeys bytes=$bytes $cache: $best s"
+    [ $first_result = yes ] || echo "," >>"$output.tmp"
+    first_result=no
+    printf '    {"op": "%s", "keys": %s, "bytes": %s, "cache": "%s",\n'\
+'     "dropped": %s, "runs": [%s], "best": %s}' \
+           "$op" "$nkeys" "$bytes" "$cache" "$dropped" "$times" "$best" \
+           >>"$output.tmp"
+}
+
+
+[ -x "$GPG_BIN" ] || fatal "$GPG_BIN not found"
+mkdir -p "$workdir" || fatal "can't create $workdir"
+
+version=`$GPG_BIN --version | sed -n '1s/.* //p'`
+cat >"$output.tmp" <<EOF
+{
+  "program": "gpg",
+  "version": "$version",
+  "date": "`date -u +%Y-%m-%dT%H:%M:%SZ`",
+  "host": "`uname -n`",
+  "system": "`uname -s -r -m`",
+  "runs": $runs,
+  "results": [
+EOF
+
+for size in $sizes; do
+    make_payload $size
+done
+
+for n in $keys; do
+    home="$workdir/home-$n"
+    make_keyring $n "$home"
+
+    for cache in warm cold; do
+        setup=
+        bench list-keys $n 0 $cache "$home" \
+            $GPG --list-keys
+
+        imphome="$workdir/import"
+        setup="stop_agent '$imphome'; rm -rf '$imphome'; make_home '$imphome'"
+        bench import $n `wc -c <"$workdir/keys-$n.gpg"` $cache "$imphome" \
+            $GPG --import "'$workdir/keys-$n.gpg'"
+        stop_agent "$imphome"
+        rm -rf "$imphome"
+
+        setup=
+        for size in $sizes; do
+            data="$workdir/data-$size"
+            bench encrypt $n $size $cache "$home" \
+                $GPG --yes -o "'$workdir/x'" -r bench-1@example.org \
+                -e "'$data'"
+            bench decrypt $n $size $cache "$home" \
+                $GPG --yes -o "'$workdir/y'" -d "'$workdir/x'"
+            bench sign $n $size $cache "$home" \
+                $GPG --yes -o "'$workdir/x'" -u bench-1@example.org \
+                -s "'$data'"
+            bench verify $n $size $cache "$home" \
+                $GPG --verify "'$workdir/x'"
+            rm -f "$workdir/x" "$workdir/y"
+        done
+    done
+    stop_agent "$home"
+done
+
+cat >>"$output.tmp" <<EOF
+
+  ]
+}
+EOF
+mv "$output.tmp" "$output"
+info "results written to $output"
+exit 0
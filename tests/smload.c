@@ -0,0 +1,994 @@
+/* smload.c - Load generator for gpgsm and dirmngr
+ *	Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This program replays certificate checks against gpgsm or dirmngr
+   running in server mode, or signing requests against gpg-agent, and
+   reports the throughput and the latency of the requests.  Like
+   asschk it talks the Assuan protocol itself and thus does not depend
+   on any library.
+
+   Usage: smload [options] OPERATION
+
+   The operation is one of
+
+     validate  Send "LISTKEYS PATTERN" to gpgsm with validation
+               enabled; thus every request checks the entire chain
+               and, unless disabled, the CRLs using the dirmngr.
+     crl       Send "CHECKCRL" to dirmngr.
+     ocsp      Send "CHECKOCSP" to dirmngr.
+     loadcrl   Send "LOADCRL FILE" to dirmngr.
+     pksign    Send "PKSIGN" to gpg-agent after SIGKEY and SETHASH.
+               The key must not be protected so that no pinentry is
+               needed.
+
+   The options are
+
+     --jobs N       Number of servers running at the same time (4).
+     --count N      Number of requests sent to each server (100).
+     --server PGM   The server program; defaults to ../sm/gpgsm for
+                    validate, to ../agent/gpg-agent for pksign and to
+                    ../dirmngr/dirmngr otherwise.
+     --socket NAME  Connect to the running server at socket NAME
+                    instead of starting a server for each job.
+     --homedir DIR  Passed to the server.
+     --cert FILE    The certificate sent for INQUIRE TARGETCERT.
+     --issuer FILE  The certificate sent when the server asks for
+                    a certificate with SENDCERT, SENDCERT_SKI or
+                    SENDISSUERCERT.
+     --trust        Answer ISTRUSTED inquiries with yes.
+     --pattern STR  The pattern for validate.
+     --crl FILE     The CRL for loadcrl.
+     --keygrip HEX  The key for pksign.
+     --setup CMD    Send CMD to each server before the timed
+                    requests; may be given several times.
+     --histogram    Also print a histogram of the latencies.
+     --stats        Print the result of "GETINFO stats" after the
+                    run; needs --socket.
+     --verbose      Show the server's diagnostics.
+
+   The certificates may be given in DER or PEM format.  Each job forks
+   its own server or opens its own connection to the server given by
+   --socket; the latter is how gpg-agent is used in practice.  The
+   connections are established and set up first; the
+   timed requests of all jobs start at the same time.  A request which
+   ends with ERR is counted as failed but its latency is still
+   recorded.  The result is printed as one line to stdout.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#if __GNUC__ > 2 || (__GNUC__ == 2 && __GNUC_MINOR__ >= 5 )
+# define ATTR_PRINTF(f,a)  __attribute__ ((format (printf,f,a)))
+#else
+# define ATTR_PRINTF(f,a)
+#endif
+
+#define MAX_LINELEN 2048
+#define MAX_SETUP   16
+#define MAX_JOBS    256
+
+typedef enum {
+  LINE_OK = 0,
+  LINE_ERR,
+  LINE_STAT,
+  LINE_DATA,
+  LINE_END,
+  LINE_INQUIRE,
+  LINE_COMMENT
+} LINETYPE;
+
+
+/* A running server.  */
+struct server_s
+{
+  pid_t pid;
+  int send_fd;
+  int recv_fd;
+  char pending[MAX_LINELEN];
+  size_t pending_len;
+  char line[MAX_LINELEN];
+  LINETYPE type;
+  int print_data;       /* Print the D lines to stdout.  */
+};
+typedef struct server_s *server_t;
+
+
+/* What a job reports at its end.  It is followed by COUNT latencies
+   in seconds.  */
+struct job_result_s
+{
+  unsigned int count;
+  unsigned int failed;
+  double end;
+};
+
+
+static void die (const char *format, ...)  ATTR_PRINTF(1,2);
+
+
+/* Name of this program to be printed in error messages. */
+static const char *invocation_name;
+
+static int opt_verbose;
+static int opt_trust;
+static int opt_jobs = 4;
+static int opt_count = 100;
+static const char *opt_server;
+static const char *opt_socket;
+static const char *opt_keygrip;
+static int opt_histogram;
+static int opt_stats;
+static const char *opt_homedir;
+static const char *opt_pattern;
+static const char *opt_crl;
+static const char *opt_setup[MAX_SETUP];
+static int opt_nsetup;
+
+/* The certificates used to answer inquiries.  */
+static unsigned char *target_cert;
+static size_t target_certlen;
+static unsigned char *issuer_cert;
+static size_t issuer_certlen;
+
+
+static void
+die (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  fflush (stdout);
+  fprintf (stderr, "%s: ", invocation_name);
+
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  putc ('\n', stderr);
+
+  exit (1);
+}
+
+
+static void *
+xmalloc (size_t n)
+{
+  void *p = malloc (n? n : 1);
+  if (!p)
+    die ("out of core");
+  return p;
+}
+
+
+static void *
+xrealloc (void *a, size_t n)
+{
+  void *p = realloc (a, n);
+  if (!p)
+    die ("out of core");
+  return p;
+}
+
+
+/* Return the current time in seconds.  The monotonic clock is the
+   same for all processes and thus the times of the jobs can be
+   compared.  */
+static double
+now (void)
+{
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts))
+    die ("clock_gettime failed: %s", strerror (errno));
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Write LENGTH bytes from BUFFER to FD. */
+static int
+writen (int fd, const void *buffer, size_t length)
+{
+  const char *p = buffer;
+
+  while (length)
+    {
+      ssize_t nwritten = write (fd, p, length);
+
+      if (nwritten < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1; /* write error */
+        }
+      length -= nwritten;
+      p += nwritten;
+    }
+  return 0;  /* okay */
+}
+
+
+/* Read exactly LENGTH bytes from FD into BUFFER.  Returns 0 on
+   success.  */
+static int
+readn (int fd, void *buffer, size_t length)
+{
+  char *p = buffer;
+
+  while (length)
+    {
+      ssize_t nread = read (fd, p, length);
+
+      if (nread < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      if (!nread)
+        return -1; /* Premature EOF.  */
+      length -= nread;
+      p += nread;
+    }
+  return 0;
+}
+
+
+static int
+b64value (int c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+')
+    return 62;
+  if (c == '/')
+    return 63;
+  return -1;
+}
+
+
+/* Read the certificate or CRL from FNAME and return it in DER
+   format.  PEM is detected by its BEGIN line; only the first object
+   of a PEM file is used.  */
+static unsigned char *
+read_der_file (const char *fname, size_t *r_len)
+{
+  FILE *fp;
+  unsigned char *buf = NULL;
+  size_t size = 0, len = 0;
+  size_t n;
+  char *begin, *p, *end;
+  unsigned char *out;
+  unsigned int acc = 0;
+  int nbits = 0;
+  int v;
+
+  fp = fopen (fname, "rb");
+  if (!fp)
+    die ("can't open '%s': %s", fname, strerror (errno));
+  do
+    {
+      if (len + 4096 + 1 > size)
+        {
+          size = 2 * size + 4096 + 1;
+          buf = xrealloc (buf, size);
+        }
+      n = fread (buf + len, 1, 4096, fp);
+      len += n;
+    }
+  while (n);
+  if (ferror (fp))
+    die ("error reading '%s': %s", fname, strerror (errno));
+  fclose (fp);
+  buf[len] = 0;
+
+  begin = (len > 11 && !memcmp (buf, "-----BEGIN ", 11))? (char*)buf : NULL;
+  if (!begin)
+    {
+      *r_len = len;
+      return buf;
+    }
+
+  /* Decode the base64 part of the PEM object.  */
+  p = strchr (begin, '\n');
+  end = p? strstr (p, "-----END ") : NULL;
+  if (!end)
+    die ("invalid PEM file '%s'", fname);
+  out = xmalloc (end - p);
+  for (len = 0; p < end; p++)
+    {
+      v = b64value (*(unsigned char *)p);
+      if (*p == '=')
+        break;
+      if (v < 0)
+        continue;
+      acc = (acc << 6) | v;
+      nbits += 6;
+      if (nbits >= 8)
+        {
+          nbits -= 8;
+          out[len++] = (acc >> nbits) & 0xff;
+        }
+    }
+  free (buf);
+  *r_len = len;
+  return out;
+}
+
+
+
+/* Assuan specific stuff.  */
+
+/* Read a line from SERVER into its line buffer and set its type.
+   Returns a pointer to the arguments of the line.  The function
+   terminates on a communication error.  */
+static char *
+read_line (server_t server)
+{
+  size_t nleft = sizeof server->line;
+  char *buf = server->line;
+  char *p;
+  ssize_t n;
+
+  while (nleft > 0)
+    {
+      if (server->pending_len)
+        {
+          if (server->pending_len >= nleft)
+            die ("received line too large");
+          memcpy (buf, server->pending, server->pending_len);
+          n = server->pending_len;
+          server->pending_len = 0;
+        }
+      else
+        {
+          do
+            n = read (server->recv_fd, buf, nleft);
+          while (n < 0 && errno == EINTR);
+        }
+      if (n < 0)
+        die ("reading from the server failed: %s", strerror (errno));
+      else if (!n)
+        die ("server terminated unexpectedly");
+
+      p = buf;
+      nleft -= n;
+      buf += n;
+      for (; n && *p != '\n'; n--, p++)
+        ;
+      if (n)
+        {
+          if (n > 1)
+            {
+              n--;
+              memcpy (server->pending, p + 1, n);
+              server->pending_len = n;
+            }
+          *p = 0;
+          break;
+        }
+    }
+  if (!nleft)
+    die ("received line too large");
+
+  p = server->line;
+  if (p[0] == 'O' && p[1] == 'K' && (p[2] == ' ' || !p[2]))
+    server->type = LINE_OK;
+  else if (p[0] == 'E' && p[1] == 'R' && p[2] == 'R'
+           && (p[3] == ' ' || !p[3]))
+    server->type = LINE_ERR;
+  else if (p[0] == 'S' && (p[1] == ' ' || !p[1]))
+    server->type = LINE_STAT;
+  else if (p[0] == 'D' && p[1] == ' ')
+    server->type = LINE_DATA;
+  else if (p[0] == 'E' && p[1] == 'N' &&  p[2] == 'D' && !p[3])
+    server->type = LINE_END;
+  else if (!strncmp (p, "INQUIRE ", 8))
+    server->type = LINE_INQUIRE;
+  else if (p[0] == '#')
+    server->type = LINE_COMMENT;
+  else
+    die ("invalid line type (%.5s)", p);
+
+  for (; *p && *p != ' '; p++)
+    ;
+  for (; *p == ' '; p++)
+    ;
+  return p;
+}
+
+
+/* Write the N bytes of LINE followed by a linefeed to SERVER.  */
+static void
+write_linen (server_t server, const char *line, size_t n)
+{
+  char buffer[1026];
+
+  if (n > 1000)
+    die ("line too long for Assuan protocol");
+  memcpy (buffer, line, n);
+  buffer[n++] = '\n';
+  if (writen (server->send_fd, buffer, n))
+    die ("sending line to the server failed: %s", strerror (errno));
+}
+
+
+static void
+write_line (server_t server, const char *line)
+{
+  write_linen (server, line, strlen (line));
+}
+
+
+/* Send BUFFER of LENGTH bytes as D lines followed by END.  The data
+   may contain Nul bytes.  */
+static void
+send_data (server_t server, const unsigned char *buffer, size_t length)
+{
+  char line[1026];
+  size_t n;
+
+  while (length)
+    {
+      line[0] = 'D';
+      line[1] = ' ';
+      for (n = 2; length && n < 990; buffer++, length--)
+        {
+          if (*buffer == '%' || *buffer == '\r' || *buffer == '\n')
+            {
+              sprintf (line + n, "%%%02X", *buffer);
+              n += 3;
+            }
+          else
+            line[n++] = *buffer;
+        }
+      write_linen (server, line, n);
+    }
+  write_line (server, "END");
+}
+
+
+/* Answer the inquiry given by KEYWORD.  */
+static void
+answer_inquiry (server_t server, const char *keyword)
+{
+  size_t n = strcspn (keyword, " ");
+
+  if (n == 10 && !strncmp (keyword, "TARGETCERT", n) && target_cert)
+    send_data (server, target_cert, target_certlen);
+  else if (((n == 8 && !strncmp (keyword, "SENDCERT", n))
+            || (n == 12 && !strncmp (keyword, "SENDCERT_SKI", n))
+            || (n == 14 && !strncmp (keyword, "SENDISSUERCERT", n)))
+           && issuer_cert)
+    send_data (server, issuer_cert, issuer_certlen);
+  else if (n == 9 && !strncmp (keyword, "ISTRUSTED", n))
+    send_data (server, (const unsigned char *)(opt_trust? "1":""),
+               opt_trust? 1 : 0);
+  else
+    write_line (server, "CAN");
+}
+
+
+/* Send the command LINE to SERVER and process the responses up to
+   the final OK or ERR.  Returns 0 for OK.  */
+static int
+transact (server_t server, const char *line)
+{
+  char *p;
+
+  write_line (server, line);
+  for (;;)
+    {
+      p = read_line (server);
+      switch (server->type)
+        {
+        case LINE_OK:
+          return 0;
+        case LINE_ERR:
+          if (opt_verbose)
+            fprintf (stderr, "%s: %s: ERR %s\n", invocation_name, line, p);
+          return 1;
+        case LINE_INQUIRE:
+          answer_inquiry (server, p);
+          break;
+        case LINE_DATA:
+          for (; server->print_data && *p; p++)
+            {
+              if (*p == '%' && p[1] && p[2])
+                {
+                  char hex[3];
+
+                  hex[0] = p[1];
+                  hex[1] = p[2];
+                  hex[2] = 0;
+                  putchar ((int)strtoul (hex, NULL, 16));
+                  p += 2;
+                }
+              else
+                putchar (*p);
+            }
+          break;
+        default:
+          break;
+        }
+    }
+}
+
+
+/* Start the server program PGMNAME and perform the initial
+   handshake.  */
+static server_t
+start_server (const char *pgmname)
+{
+  int rp[2];
+  int wp[2];
+  server_t server;
+  pid_t pid;
+
+  if (pipe (rp) < 0 || pipe (wp) < 0)
+    die ("pipe creation failed: %s", strerror (errno));
+
+  fflush (stdout);
+  fflush (stderr);
+  pid = fork ();
+  if (pid < 0)
+    die ("fork failed: %s", strerror (errno));
+
+  if (!pid)
+    {
+      const char *arg0;
+
+      arg0 = strrchr (pgmname, '/');
+      if (arg0)
+        arg0++;
+      else
+        arg0 = pgmname;
+
+      if (dup2 (wp[0], STDIN_FILENO) == -1
+          || dup2 (rp[1], STDOUT_FILENO) == -1)
+        die ("dup2 failed in child: %s", strerror (errno));
+      if (!opt_verbose)
+        {
+	  int fd = open ("/dev/null", O_WRONLY);
+	  if (fd == -1)
+	    die ("can't open '/dev/null': %s", strerror (errno));
+          if (dup2 (fd, STDERR_FILENO) == -1)
+            die ("dup2 failed in child: %s", strerror (errno));
+	  close (fd);
+        }
+      close (wp[0]);
+      close (wp[1]);
+      close (rp[0]);
+      close (rp[1]);
+      if (opt_homedir)
+        execl (pgmname, arg0, "--server", "--homedir", opt_homedir, NULL);
+      else
+        execl (pgmname, arg0, "--server", NULL);
+      die ("exec failed for '%s': %s", pgmname, strerror (errno));
+    }
+  close (wp[0]);
+  close (rp[1]);
+
+  server = xmalloc (sizeof *server);
+  server->pid = pid;
+  server->send_fd = wp[1];
+  server->recv_fd = rp[0];
+  server->pending_len = 0;
+  server->print_data = 0;
+
+  read_line (server);
+  if (server->type != LINE_OK)
+    die ("no greeting message from '%s'", pgmname);
+  return server;
+}
+
+
+/* Connect to the server listening at the socket NAME and perform
+   the initial handshake.  */
+static server_t
+connect_server (const char *name)
+{
+  struct sockaddr_un addr;
+  server_t server;
+  int fd;
+
+  if (strlen (name) >= sizeof addr.sun_path)
+    die ("socket name '%s' too long", name);
+  memset (&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, name);
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    die ("can't create socket: %s", strerror (errno));
+  if (connect (fd, (struct sockaddr *)&addr, sizeof addr) == -1)
+    die ("can't connect to '%s': %s", name, strerror (errno));
+
+  server = xmalloc (sizeof *server);
+  server->pid = 0;
+  server->send_fd = fd;
+  server->recv_fd = fd;
+  server->pending_len = 0;
+  server->print_data = 0;
+
+  read_line (server);
+  if (server->type != LINE_OK)
+    die ("no greeting message from '%s'", name);
+  return server;
+}
+
+
+static server_t
+open_server (void)
+{
+  return opt_socket? connect_server (opt_socket) : start_server (opt_server);
+}
+
+
+static void
+stop_server (server_t server)
+{
+  write_line (server, "BYE");
+  close (server->send_fd);
+  if (server->recv_fd != server->send_fd)
+    close (server->recv_fd);
+  if (server->pid)
+    waitpid (server->pid, NULL, 0);
+  free (server);
+}
+
+
+
+/* Run one job.  It writes a byte to RESULT_FD when its server is
+   ready, waits for EOF on GO_FD and then sends COUNT times the
+   command LINE.  The results are written to RESULT_FD.  */
+static void
+run_job (const char *line, int go_fd, int result_fd)
+{
+  struct job_result_s result;
+  server_t server;
+  double *latency;
+  double start;
+  char c;
+  int i;
+
+  server = open_server ();
+  for (i=0; i < opt_nsetup; i++)
+    if (transact (server, opt_setup[i]))
+      die ("setup command '%s' failed: %s", opt_setup[i], server->line);
+
+  c = 'r';
+  if (writen (result_fd, &c, 1))
+    die ("error writing result: %s", strerror (errno));
+  while (read (go_fd, &c, 1) < 0 && errno == EINTR)
+    ;
+
+  latency = xmalloc (opt_count * sizeof *latency);
+  result.count = opt_count;
+  result.failed = 0;
+  for (i=0; i < opt_count; i++)
+    {
+      start = now ();
+      if (transact (server, line))
+        result.failed++;
+      latency[i] = now () - start;
+    }
+  result.end = now ();
+
+  if (writen (result_fd, &result, sizeof result)
+      || writen (result_fd, latency, opt_count * sizeof *latency))
+    die ("error writing result: %s", strerror (errno));
+  stop_server (server);
+  free (latency);
+}
+
+
+static int
+cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Return the Q quantile of the sorted array A with N elements.  */
+static double
+quantile (const double *a, size_t n, double q)
+{
+  size_t i;
+
+  if (!n)
+    return 0.0;
+  i = (size_t)(q * n + 0.999999);
+  if (i < 1)
+    i = 1;
+  if (i > n)
+    i = n;
+  return a[i-1];
+}
+
+
+/* Print a histogram of the sorted latencies A with N elements.  The
+   buckets are powers of two in microseconds.  */
+static void
+print_histogram (const double *a, size_t n)
+{
+  unsigned long limit, count, max = 0;
+  size_t i, j;
+  int k;
+
+  for (i=0, limit=1; i < n; limit *= 2)
+    {
+      for (j=i; j < n && a[j] * 1e6 <= limit; j++)
+        ;
+      if (j - i > max)
+        max = j - i;
+      i = j;
+    }
+  for (i=0, limit=1; i < n; limit *= 2)
+    {
+      for (j=i; j < n && a[j] * 1e6 <= limit; j++)
+        ;
+      count = j - i;
+      if (count || i)
+        {
+          printf ("%10luus %8lu ", limit, count);
+          for (k=0; k < (int)(50 * count / max); k++)
+            putchar ('#');
+          putchar ('\n');
+        }
+      i = j;
+    }
+}
+
+
+static void
+usage (void)
+{
+  die ("usage: smload [--jobs N] [--count N] [--server PGM] "
+       "[--homedir DIR]\n"
+       "              [--cert FILE] [--issuer FILE] [--trust] "
+       "[--pattern STR]\n"
+       "              [--crl FILE] [--socket NAME] [--keygrip HEX]\n"
+       "              [--setup CMD] [--histogram] [--stats] [--verbose]\n"
+       "              validate|crl|ocsp|loadcrl|pksign");
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int go[2];
+  int result_fds[MAX_JOBS];
+  pid_t pids[MAX_JOBS];
+  struct job_result_s result;
+  const char *operation;
+  char line[1000];
+  char sigkey[100];
+  double *latency;
+  size_t nlatency = 0;
+  unsigned long failed = 0;
+  double start, end;
+  char *p, c;
+  int i, rp[2];
+  int status, rc = 0;
+
+  if (!argc)
+    invocation_name = "smload";
+  else
+    {
+      invocation_name = *argv++;
+      argc--;
+      p = strrchr (invocation_name, '/');
+      if (p)
+        invocation_name = p+1;
+    }
+
+  for (; argc; argc--, argv++)
+    {
+      p = *argv;
+      if (*p != '-')
+        break;
+      if (!strcmp (p, "--verbose"))
+        opt_verbose++;
+      else if (!strcmp (p, "--trust"))
+        opt_trust = 1;
+      else if (!strcmp (p, "--histogram"))
+        opt_histogram = 1;
+      else if (!strcmp (p, "--stats"))
+        opt_stats = 1;
+      else if (!strcmp (p, "--") )
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (argc < 2)
+        usage ();
+      else
+        {
+          argc--; argv++;
+          if (!strcmp (p, "--jobs"))
+            opt_jobs = atoi (*argv);
+          else if (!strcmp (p, "--count"))
+            opt_count = atoi (*argv);
+          else if (!strcmp (p, "--server"))
+            opt_server = *argv;
+          else if (!strcmp (p, "--socket"))
+            opt_socket = *argv;
+          else if (!strcmp (p, "--keygrip"))
+            opt_keygrip = *argv;
+          else if (!strcmp (p, "--homedir"))
+            opt_homedir = *argv;
+          else if (!strcmp (p, "--cert"))
+            target_cert = read_der_file (*argv, &target_certlen);
+          else if (!strcmp (p, "--issuer"))
+            issuer_cert = read_der_file (*argv, &issuer_certlen);
+          else if (!strcmp (p, "--pattern"))
+            opt_pattern = *argv;
+          else if (!strcmp (p, "--crl"))
+            opt_crl = *argv;
+          else if (!strcmp (p, "--setup"))
+            {
+              if (opt_nsetup == MAX_SETUP)
+                die ("too many setup commands");
+              opt_setup[opt_nsetup++] = *argv;
+            }
+          else
+            usage ();
+        }
+    }
+  if (argc != 1)
+    usage ();
+  if (opt_jobs < 1 || opt_jobs > MAX_JOBS)
+    die ("the number of jobs must be between 1 and %d", MAX_JOBS);
+  if (opt_count < 1)
+    die ("the number of requests must be positive");
+  if (opt_stats && !opt_socket)
+    die ("--stats needs --socket");
+
+  operation = *argv;
+  if (!strcmp (operation, "validate"))
+    {
+      if (!opt_pattern)
+        die ("validate needs --pattern");
+      if (opt_nsetup == MAX_SETUP)
+        die ("too many setup commands");
+      opt_setup[opt_nsetup++] = "OPTION with-validation=1";
+      snprintf (line, sizeof line, "LISTKEYS %s", opt_pattern);
+      if (!opt_server)
+        opt_server = "../sm/gpgsm";
+    }
+  else if (!strcmp (operation, "crl") || !strcmp (operation, "ocsp"))
+    {
+      if (!target_cert)
+        die ("%s needs --cert", operation);
+      strcpy (line, *operation == 'c'? "CHECKCRL" : "CHECKOCSP");
+    }
+  else if (!strcmp (operation, "loadcrl"))
+    {
+      if (!opt_crl)
+        die ("loadcrl needs --crl");
+      snprintf (line, sizeof line, "LOADCRL %s", opt_crl);
+    }
+  else if (!strcmp (operation, "pksign"))
+    {
+      if (!opt_keygrip || strlen (opt_keygrip) != 40)
+        die ("pksign needs --keygrip");
+      if (opt_nsetup + 2 > MAX_SETUP)
+        die ("too many setup commands");
+      snprintf (sigkey, sizeof sigkey, "SIGKEY %s", opt_keygrip);
+      opt_setup[opt_nsetup++] = sigkey;
+      /* The SHA-256 hash of the empty string.  */
+      opt_setup[opt_nsetup++] = "SETHASH --hash=sha256 "
+        "E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855";
+      strcpy (line, "PKSIGN");
+      if (!opt_server)
+        opt_server = "../agent/gpg-agent";
+    }
+  else
+    usage ();
+  if (!opt_server)
+    opt_server = "../dirmngr/dirmngr";
+
+  if (pipe (go) < 0)
+    die ("pipe creation failed: %s", strerror (errno));
+  for (i=0; i < opt_jobs; i++)
+    {
+      if (pipe (rp) < 0)
+        die ("pipe creation failed: %s", strerror (errno));
+      fflush (stdout);
+      fflush (stderr);
+      pids[i] = fork ();
+      if (pids[i] < 0)
+        die ("fork failed: %s", strerror (errno));
+      if (!pids[i])
+        {
+          close (go[1]);
+          close (rp[0]);
+          run_job (line, go[0], rp[1]);
+          exit (0);
+        }
+      close (rp[1]);
+      result_fds[i] = rp[0];
+    }
+  close (go[0]);
+
+  /* Start all jobs at the same time.  */
+  for (i=0; i < opt_jobs; i++)
+    if (readn (result_fds[i], &c, 1))
+      die ("job %d failed to start", i);
+  start = now ();
+  close (go[1]);
+
+  latency = xmalloc ((size_t)opt_jobs * opt_count * sizeof *latency);
+  end = start;
+  for (i=0; i < opt_jobs; i++)
+    {
+      if (readn (result_fds[i], &result, sizeof result)
+          || result.count != (unsigned int)opt_count
+          || readn (result_fds[i], latency + nlatency,
+                    result.count * sizeof *latency))
+        die ("job %d did not return its results", i);
+      nlatency += result.count;
+      failed += result.failed;
+      if (result.end > end)
+        end = result.end;
+      close (result_fds[i]);
+    }
+  for (i=0; i < opt_jobs; i++)
+    if (waitpid (pids[i], &status, 0) < 0
+        || !WIFEXITED (status) || WEXITSTATUS (status))
+      rc = 1;
+
+  qsort (latency, nlatency, sizeof *latency, cmp_double);
+  printf ("%s jobs=%d requests=%lu failed=%lu seconds=%.3f rate=%.1f"
+          " p50=%.3fms p99=%.3fms max=%.3fms\n",
+          operation, opt_jobs, (unsigned long)nlatency, failed, end - start,
+          end > start? nlatency / (end - start) : 0.0,
+          1000 * quantile (latency, nlatency, 0.50),
+          1000 * quantile (latency, nlatency, 0.99),
+          1000 * quantile (latency, nlatency, 1.0));
+  if (opt_histogram)
+    print_histogram (latency, nlatency);
+  free (latency);
+
+  if (opt_stats)
+    {
+      server_t server = connect_server (opt_socket);
+
+      server->print_data = 1;
+      if (transact (server, "GETINFO stats"))
+        rc = 1;
+      stop_server (server);
+    }
+  return rc;
+}
@@ -28,6 +28,7 @@
 #include <assuan.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/time.h>
 
 #include "i18n.h"
 #include "../common/util.h"
@@ -66,6 +67,8 @@ enum cmd_and_opt_values
     oDirmngr,
     oUIServer,
     oNoAutostart,
+    oPipeline,
+    oStats
 
   };
 
@@ -97,6 +100,8 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_s (oHomedir, "homedir", "@" ),
   ARGPARSE_s_s (oAgentProgram, "agent-program", "@"),
   ARGPARSE_s_s (oDirmngrProgram, "dirmngr-program", "@"),
+  ARGPARSE_s_i (oPipeline, "pipeline", N_("|N|send up to N commands ahead")),
+  ARGPARSE_s_n (oStats, "stats", N_("print the latency of the commands")),
 
   ARGPARSE_end ()
 };
@@ -121,9 +126,45 @@ struct
   unsigned int connect_flags;    /* Flags used for connecting. */
   int enable_varsubst;  /* Set if variable substitution is enabled.  */
   int trim_leading_spaces;
+  int pipeline;         /* Number of commands to send ahead.  */
+  int stats;            /* Print latency statistics at exit.  */
 } opt;
 
 
+/* The largest number of commands sent ahead of their responses.  */
+#define MAX_PIPELINE 256
+
+/* The commands sent to the server and waiting for their response, as
+   a ring buffer.  */
+static struct
+{
+  char name[32];        /* The command's name for the statistics.  */
+  int withhash;         /* Print comment lines of the response.  */
+  double start;         /* The time the command was sent.  */
+} pending_cmds[MAX_PIPELINE];
+static int pending_head;  /* Index of the oldest command.  */
+static int pending_count; /* Number of commands waiting.  */
+
+
+/* The number of histogram buckets for the statistics.  Bucket N
+   counts the latencies below 0.1ms * 2^N; the last bucket all
+   others.  */
+#define STATS_BUCKETS 18
+
+/* The latency statistics of one command.  */
+struct cmdstats_s
+{
+  struct cmdstats_s *next;
+  unsigned long count;
+  double total;
+  double max;
+  unsigned long hist[STATS_BUCKETS];
+  char name[1];
+};
+typedef struct cmdstats_s *cmdstats_t;
+static cmdstats_t cmdstats_list;
+
+
 
 /* Definitions for /definq commands and a global linked list with all
    the definitions. */
@@ -179,6 +220,7 @@ static struct
 
 
 /*-- local prototypes --*/
+static double timer_now (void);
 static char *substitute_line_copy (const char *buffer);
 static int read_and_print_response (assuan_context_t ctx, int withhash,
                                     int *r_goterr);
@@ -1142,6 +1184,112 @@ help_cmd_p (const char *line)
 }
 
 
+/* Return the current time in seconds with the precision of
+   gettimeofday.  */
+static double
+timer_now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* Record that the command NAME took SECONDS.  */
+static void
+stats_record (const char *name, double seconds)
+{
+  cmdstats_t st;
+  double limit;
+  int i;
+
+  for (st = cmdstats_list; st; st = st->next)
+    if (!strcmp (st->name, name))
+      break;
+  if (!st)
+    {
+      st = xcalloc (1, sizeof *st + strlen (name));
+      strcpy (st->name, name);
+      st->next = cmdstats_list;
+      cmdstats_list = st;
+    }
+
+  st->count++;
+  st->total += seconds;
+  if (seconds > st->max)
+    st->max = seconds;
+  for (i=0, limit = 0.0001; i < STATS_BUCKETS-1 && seconds >= limit; i++)
+    limit *= 2;
+  st->hist[i]++;
+}
+
+
+/* Print the statistics of all commands.  */
+static void
+stats_print (void)
+{
+  cmdstats_t st;
+  double limit;
+  int i;
+
+  for (st = cmdstats_list; st; st = st->next)
+    {
+      log_info ("stats: %s: %lu commands, %.3fms avg, %.3fms max\n",
+                st->name, st->count, st->total * 1000 / st->count,
+                st->max * 1000);
+      for (i=0, limit = 0.1; i < STATS_BUCKETS; i++, limit *= 2)
+        if (st->hist[i])
+          {
+            if (i < STATS_BUCKETS-1)
+              log_info ("stats: %s:   < %9.1fms %8lu\n",
+                        st->name, limit, st->hist[i]);
+            else
+              log_info ("stats: %s:  >= %9.1fms %8lu\n",
+                        st->name, limit / 2, st->hist[i]);
+          }
+    }
+}
+
+
+/* Remember that the command LINE has been sent.  */
+static void
+push_pending (const char *line, int withhash)
+{
+  int idx;
+  size_t n;
+
+  assert (pending_count < MAX_PIPELINE);
+  idx = (pending_head + pending_count++) % MAX_PIPELINE;
+  for (n=0; line[n] && !spacep (line+n) && n < sizeof pending_cmds[0].name-1;
+       n++)
+    pending_cmds[idx].name[n] = toupper (((const unsigned char*)line)[n]);
+  pending_cmds[idx].name[n] = 0;
+  pending_cmds[idx].withhash = withhash;
+  pending_cmds[idx].start = opt.stats? timer_now () : 0;
+}
+
+
+/* Read and print the response to the oldest command sent.  Returns
+   an assuan error code and sets R_GOTERR as read_and_print_response
+   does.  */
+static int
+read_pending_response (assuan_context_t ctx, int *r_goterr)
+{
+  int idx = pending_head;
+  int rc;
+
+  assert (pending_count);
+  rc = read_and_print_response (ctx, pending_cmds[idx].withhash, r_goterr);
+  if (!rc && opt.stats)
+    stats_record (pending_cmds[idx].name,
+                  timer_now () - pending_cmds[idx].start);
+  pending_head = (pending_head + 1) % MAX_PIPELINE;
+  pending_count--;
+  return rc;
+}
+
+
 /* gpg-connect-agent's entry point. */
 int
 main (int argc, char **argv)
@@ -1209,6 +1357,8 @@ main (int argc, char **argv)
         case oExec:      opt.exec = 1; break;
         case oNoExtConnect: opt.connect_flags &= ~(1); break;
         case oRun:       opt_run = pargs.r.ret_str; break;
+        case oPipeline:  opt.pipeline = pargs.r.ret_int; break;
+        case oStats:     opt.stats = 1; break;
         case oSubst:
           opt.enable_varsubst = 1;
           opt.trim_leading_spaces = 1;
@@ -1253,6 +1403,12 @@ main (int argc, char **argv)
   else if (argc)
     cmdline_commands = argv;
 
+  /* Sending ahead makes no sense for a human at the terminal.  */
+  if (opt.pipeline < 1 || (use_tty && !opt_run && !cmdline_commands))
+    opt.pipeline = 1;
+  else if (opt.pipeline > MAX_PIPELINE)
+    opt.pipeline = MAX_PIPELINE;
+
   if (opt.exec && opt.raw_socket)
     {
       opt.raw_socket = NULL;
@@ -1501,6 +1657,23 @@ main (int argc, char **argv)
           loopidx++;
         }
 
+      if (*line == '/' && pending_count)
+        {
+          /* Control commands may depend on the results of the
+             commands sent ahead; thus wait for them.  */
+          while (pending_count)
+            {
+              rc = read_pending_response (ctx, &cmderr);
+              if (rc)
+                break;
+            }
+          if (rc)
+            {
+              log_info (_("receiving line failed: %s\n"), gpg_strerror (rc));
+              break;
+            }
+        }
+
       if (*line == '/')
         {
           /* Handle control commands. */
@@ -1859,7 +2032,13 @@ main (int argc, char **argv)
       if (*line == '#' || !*line)
         continue; /* Don't expect a response for a comment line. */
 
-      rc = read_and_print_response (ctx, help_cmd_p (line), &cmderr);
+      /* With --pipeline the responses are read only when the window
+         of commands sent ahead is full.  */
+      push_pending (line, help_cmd_p (line));
+      if (pending_count < opt.pipeline)
+        continue;
+
+      rc = read_pending_response (ctx, &cmderr);
       if (rc)
         log_info (_("receiving line failed: %s\n"), gpg_strerror (rc) );
       if ((rc || cmderr) && script_fp)
@@ -1868,6 +2047,8 @@ main (int argc, char **argv)
           fclose (script_fp);
           script_fp = NULL;
         }
+      if (rc && pending_count)
+        break;  /* The remaining responses can't be matched.  */
 
 
       /* FIXME: If the last command was BYE or the server died for
@@ -1877,6 +2058,19 @@ main (int argc, char **argv)
 	 early.  */
     }
 
+  while (pending_count)
+    {
+      rc = read_pending_response (ctx, &cmderr);
+      if (rc)
+        {
+          log_info (_("receiving line failed: %s\n"), gpg_strerror (rc));
+          break;
+        }
+    }
+
+  if (opt.stats)
+    stats_print ();
+
   if (opt.verbose)
     log_info ("closing connection to agent\n");
 
@@ -2171,6 +2365,14 @@ read_and_print_response (assuan_context_t ctx, int withhash, int *r_goterr)
                   fwrite (line, linelen, 1, stdout);
                   putchar ('\n');
                 }
+              if (pending_count > 1)
+                {
+                  /* The server would take our next command as the
+                     answer.  */
+                  log_error ("can't answer an inquiry"
+                             " with commands sent ahead\n");
+                  return gpg_error (GPG_ERR_ASS_INV_RESPONSE);
+                }
               if (!handle_inquire (ctx, line))
                 assuan_write_line (ctx, "CANCEL");
             }
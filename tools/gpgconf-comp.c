@@ -27,6 +27,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include <errno.h>
 #include <time.h>
@@ -47,6 +48,7 @@
 #include "util.h"
 #include "i18n.h"
 #include "exechelp.h"
+#include "membuf.h"
 
 #include "gc-opt-flags.h"
 #include "gpgconf.h"
@@ -1922,36 +1924,319 @@ get_config_filename (gc_component_t component, gc_backend_t backend)
 }
 
 
-/* Retrieve the options for the component COMPONENT from backend
-   BACKEND, which we already know is a program-type backend.  */
+/* The output of "--gpgconf-list" of the program backends.  The
+   output depends only on the program and the home directory; thus it
+   is cached in a file in the home directory and the programs are only
+   run if they have been changed since.  */
+static struct
+{
+  char *text;          /* The output or NULL if not yet known.  */
+  size_t textlen;
+  int cacheable;       /* The program has been stat-ed.  */
+  unsigned long mtime; /* Modification time and size of the program.  */
+  unsigned long size;
+} program_listing[GC_BACKEND_NR];
+
+/* The name of the cache file in the home directory.  */
+#define LISTING_CACHE_NAME GPGCONF_NAME ".cache"
+
+
+static const char *
+backend_program_name (gc_backend_t backend)
+{
+  return (gc_backend[backend].module_name
+          ? gnupg_module_name (gc_backend[backend].module_name)
+          : gc_backend[backend].program );
+}
+
+
+/* Mark the program backends of COMPONENT in WANTED.  */
 static void
-retrieve_options_from_program (gc_component_t component, gc_backend_t backend)
+mark_program_backends (gc_component_t component, int *wanted)
+{
+  gc_option_t *option;
+
+  if (component == GC_COMPONENT_PINENTRY)
+    return; /* Dummy module for now.  */
+
+  for (option = gc_component[component].options;
+       option && option->name; option++)
+    if (!(option->flags & GC_OPT_FLAG_GROUP)
+        && option->backend != GC_BACKEND_ANY
+        && gc_backend[option->backend].program)
+      wanted[option->backend] = 1;
+}
+
+
+/* Read the cached listings of the programs marked in WANTED for which
+   PROGRAM_LISTING says that the program is unchanged.  */
+static void
+load_listing_cache (const int *wanted)
+{
+  char *fname;
+  estream_t fp;
+  char *line = NULL;
+  size_t line_len = 0;
+  ssize_t length;
+  gc_backend_t backend;
+  unsigned long mtime, size, nlines;
+  char *p, *end;
+  membuf_t mb;
+  int use;
+
+  fname = make_filename (default_homedir (), LISTING_CACHE_NAME, NULL);
+  fp = es_fopen (fname, "r");
+  xfree (fname);
+  if (!fp)
+    return;
+
+  while ((length = es_read_line (fp, &line, &line_len, NULL)) > 0)
+    {
+      if (*line == '#')
+        continue;
+
+      /* A record is "PGMNAME:MTIME:SIZE:NLINES" followed by NLINES
+         lines of output.  */
+      p = strchr (line, ':');
+      if (!p)
+        break;
+      *p++ = 0;
+      mtime = strtoul (p, &end, 10);
+      if (*end != ':')
+        break;
+      size = strtoul (end+1, &end, 10);
+      if (*end != ':')
+        break;
+      nlines = strtoul (end+1, &end, 10);
+      if (*end != '\n')
+        break;
+
+      use = 0;
+      for (backend = 0; backend < GC_BACKEND_NR; backend++)
+        if (wanted[backend] && !program_listing[backend].text
+            && program_listing[backend].cacheable
+            && program_listing[backend].mtime == mtime
+            && program_listing[backend].size == size
+            && !strcmp (line,
+                        gc_percent_escape (backend_program_name (backend))))
+          {
+            use = 1;
+            break;
+          }
+
+      init_membuf (&mb, 1024);
+      for (; nlines; nlines--)
+        {
+          length = es_read_line (fp, &line, &line_len, NULL);
+          if (length <= 0 || line[length-1] != '\n')
+            break;
+          if (use)
+            put_membuf (&mb, line, length);
+        }
+      if (nlines)
+        {
+          xfree (get_membuf (&mb, NULL));
+          break;  /* Truncated cache file.  */
+        }
+      put_membuf (&mb, "", 1);
+      p = get_membuf (&mb, NULL);
+      if (!p)
+        gc_error (1, errno, "error reading the cache");
+      if (use)
+        {
+          program_listing[backend].text = p;
+          program_listing[backend].textlen = strlen (p);
+        }
+      else
+        xfree (p);
+    }
+  es_fclose (fp);
+  xfree (line);
+}
+
+
+/* Write all cacheable listings to the cache file.  Errors are
+   ignored; the listings are just retrieved again next time.  */
+static void
+save_listing_cache (void)
+{
+  char *fname, *tmpfname;
+  estream_t fp;
+  gc_backend_t backend;
+  unsigned long nlines;
+  const char *p;
+  int rc;
+
+  fname = make_filename (default_homedir (), LISTING_CACHE_NAME, NULL);
+  tmpfname = xasprintf ("%s.tmp", fname);
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    goto leave;
+
+  es_fputs ("# " GPGCONF_NAME " cache - do not edit\n", fp);
+  for (backend = 0; backend < GC_BACKEND_NR; backend++)
+    {
+      if (!program_listing[backend].text || !program_listing[backend].cacheable)
+        continue;
+      for (nlines=0, p=program_listing[backend].text; *p; p++)
+        if (*p == '\n')
+          nlines++;
+      es_fprintf (fp, "%s:%lu:%lu:%lu\n",
+                  gc_percent_escape (backend_program_name (backend)),
+                  program_listing[backend].mtime,
+                  program_listing[backend].size, nlines);
+      es_fputs (program_listing[backend].text, fp);
+    }
+  rc = es_ferror (fp);
+  if (es_fclose (fp) || rc)
+    {
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+#ifdef HAVE_DOSISH_SYSTEM
+  gnupg_remove (fname);
+#endif
+  if (rename (tmpfname, fname))
+    gnupg_remove (tmpfname);
+
+ leave:
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Make sure that PROGRAM_LISTING has the output of all programs
+   marked in WANTED.  Programs not found in the cache are run
+   concurrently.  If any program has to be run, all other programs
+   with an outdated cache entry are run as well to renew the entire
+   cache; their failures are not fatal.  */
+static void
+get_program_listings (const int *wanted)
 {
   gpg_error_t err;
-  const char *pgmname;
+  int all[GC_BACKEND_NR];
+  estream_t outfp[GC_BACKEND_NR];
+  pid_t pid[GC_BACKEND_NR];
   const char *argv[2];
-  estream_t outfp;
-  int exitcode;
-  pid_t pid;
+  const char *pgmname;
+  gc_backend_t backend;
+  gc_component_t component;
+  struct stat sbuf;
   char *line = NULL;
   size_t line_len = 0;
   ssize_t length;
-  estream_t config;
-  char *config_filename;
+  membuf_t mb;
+  int exitcode;
+  int missing = 0;
 
-  pgmname = (gc_backend[backend].module_name
-             ? gnupg_module_name (gc_backend[backend].module_name)
-             : gc_backend[backend].program );
+  for (backend = 0; backend < GC_BACKEND_NR; backend++)
+    {
+      all[backend] = 0;
+      outfp[backend] = NULL;
+      pid[backend] = (pid_t)(-1);
+    }
+  for (component = 0; component < GC_COMPONENT_NR; component++)
+    mark_program_backends (component, all);
+
+  for (backend = 0; backend < GC_BACKEND_NR; backend++)
+    if (all[backend] && !program_listing[backend].cacheable
+        && !stat (backend_program_name (backend), &sbuf))
+      {
+        program_listing[backend].cacheable = 1;
+        program_listing[backend].mtime = (unsigned long)sbuf.st_mtime;
+        program_listing[backend].size = (unsigned long)sbuf.st_size;
+      }
+
+  load_listing_cache (all);
+
+  for (backend = 0; backend < GC_BACKEND_NR; backend++)
+    if (wanted[backend] && !program_listing[backend].text)
+      missing = 1;
+  if (!missing)
+    return;
+
+  /* Start all programs before reading the first output; their output
+   * is small enough to fit into the pipes.  */
   argv[0] = "--gpgconf-list";
   argv[1] = NULL;
+  for (backend = 0; backend < GC_BACKEND_NR; backend++)
+    {
+      if (!all[backend] || program_listing[backend].text)
+        continue;
+      pgmname = backend_program_name (backend);
+      err = gnupg_spawn_process (pgmname, argv, GPG_ERR_SOURCE_DEFAULT,
+                                 NULL, 0, NULL, &outfp[backend], NULL,
+                                 &pid[backend]);
+      if (err)
+        {
+          if (wanted[backend])
+            gc_error (1, 0, "could not gather active options from '%s': %s",
+                      pgmname, gpg_strerror (err));
+          outfp[backend] = NULL;
+        }
+    }
 
-  err = gnupg_spawn_process (pgmname, argv, GPG_ERR_SOURCE_DEFAULT, NULL, 0,
-                             NULL, &outfp, NULL, &pid);
-  if (err)
+  for (backend = 0; backend < GC_BACKEND_NR; backend++)
     {
-      gc_error (1, 0, "could not gather active options from '%s': %s",
-                pgmname, gpg_strerror (err));
+      if (!outfp[backend])
+        continue;
+      pgmname = backend_program_name (backend);
+
+      init_membuf (&mb, 1024);
+      while ((length = es_read_line (outfp[backend], &line, &line_len,
+                                     NULL)) > 0)
+        {
+          put_membuf (&mb, line, length);
+          if (line[length-1] != '\n')
+            put_membuf (&mb, "\n", 1);
+        }
+      put_membuf (&mb, "", 1);
+      if (length < 0 || es_ferror (outfp[backend]))
+        gc_error (1, errno, "error reading from %s", pgmname);
+      if (es_fclose (outfp[backend]))
+        gc_error (1, errno, "error closing %s", pgmname);
+
+      err = gnupg_wait_process (pgmname, pid[backend], 1, &exitcode);
+      gnupg_release_process (pid[backend]);
+      if (err)
+        {
+          if (wanted[backend])
+            gc_error (1, 0, "running %s failed (exitcode=%d): %s",
+                      pgmname, exitcode, gpg_strerror (err));
+          xfree (get_membuf (&mb, NULL));
+          continue;
+        }
+      program_listing[backend].text = get_membuf (&mb, NULL);
+      if (!program_listing[backend].text)
+        gc_error (1, errno, "error reading from %s", pgmname);
+      program_listing[backend].textlen = strlen (program_listing[backend].text);
     }
+  xfree (line);
+
+  save_listing_cache ();
+}
+
+
+/* Retrieve the options for the component COMPONENT from backend
+   BACKEND, which we already know is a program-type backend.  The
+   output of the program must already be in PROGRAM_LISTING.  */
+static void
+retrieve_options_from_program (gc_component_t component, gc_backend_t backend)
+{
+  const char *pgmname;
+  estream_t outfp;
+  char *line = NULL;
+  size_t line_len = 0;
+  ssize_t length;
+  estream_t config;
+  char *config_filename;
+
+  pgmname = backend_program_name (backend);
+  assert (program_listing[backend].text);
+  outfp = es_fopenmem_init (0, "r", program_listing[backend].text,
+                            program_listing[backend].textlen);
+  if (!outfp)
+    gc_error (1, errno, "error reading from %s", pgmname);
 
   while ((length = es_read_line (outfp, &line, &line_len, NULL)) > 0)
     {
@@ -2024,14 +2309,7 @@ retrieve_options_from_program (gc_component_t component, gc_backend_t backend)
     }
   if (length < 0 || es_ferror (outfp))
     gc_error (1, errno, "error reading from %s", pgmname);
-  if (es_fclose (outfp))
-    gc_error (1, errno, "error closing %s", pgmname);
-
-  err = gnupg_wait_process (pgmname, pid, 1, &exitcode);
-  if (err)
-    gc_error (1, 0, "running %s failed (exitcode=%d): %s",
-              pgmname, exitcode, gpg_strerror (err));
-  gnupg_release_process (pid);
+  es_fclose (outfp);
 
 
   /* At this point, we can parse the configuration file.  */
@@ -2220,6 +2498,7 @@ gc_component_retrieve_options (int component)
 {
   int process_all = 0;
   int backend_seen[GC_BACKEND_NR];
+  int wanted[GC_BACKEND_NR];
   gc_backend_t backend;
   gc_option_t *option;
 
@@ -2227,14 +2506,23 @@ gc_component_retrieve_options (int component)
     return; /* Dummy module for now.  */
 
   for (backend = 0; backend < GC_BACKEND_NR; backend++)
-    backend_seen[backend] = 0;
+    {
+      backend_seen[backend] = 0;
+      wanted[backend] = 0;
+    }
 
   if (component == -1)
     {
       process_all = 1;
       component = 0;
       assert (component < GC_COMPONENT_NR);
+      for (; component < GC_COMPONENT_NR; component++)
+        mark_program_backends (component, wanted);
+      component = 0;
     }
+  else
+    mark_program_backends (component, wanted);
+  get_program_listings (wanted);
 
   do
     {
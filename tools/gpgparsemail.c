@@ -606,37 +606,105 @@ message_cb (void *opaque, rfc822parse_event_t event, rfc822parse_t msg)
 }
 
 
+/* The size of the input buffer; longer lines are split.  */
+#define READ_BUFFER_SIZE 65536
+
+/* The state of read_line.  */
+struct reader_s
+{
+  FILE *fp;
+  char *buffer;     /* READ_BUFFER_SIZE + 1 bytes.  */
+  size_t start;     /* Offset of the next line.  */
+  size_t len;       /* End of the data in BUFFER.  */
+  int eof;
+};
+
+
+/* Return the next line of RD or NULL at the end of the input.  The
+   line is returned in place and valid until the next call.  Its
+   length without the LF is stored at R_LENGTH and R_TERMINATED is
+   set if there was a LF.  The LF is replaced by a Nul but the line
+   may contain Nuls itself.  Lines are found with memchr which is
+   much faster than reading them with fgets.  */
+static char *
+read_line (struct reader_s *rd, size_t *r_length, int *r_terminated)
+{
+  char *line, *eol;
+  size_t n;
+
+  for (;;)
+    {
+      eol = memchr (rd->buffer + rd->start, '\n', rd->len - rd->start);
+      if (eol)
+        break;
+
+      /* No complete line left; move the rest to the front and fill
+         up the buffer.  */
+      if (rd->start)
+        {
+          memmove (rd->buffer, rd->buffer + rd->start, rd->len - rd->start);
+          rd->len -= rd->start;
+          rd->start = 0;
+        }
+      if (rd->eof || rd->len == READ_BUFFER_SIZE)
+        {
+          /* Return a too long or not terminated line as is.  */
+          if (!rd->len)
+            return NULL;
+          eol = rd->buffer + rd->len;
+          break;
+        }
+      n = fread (rd->buffer + rd->len, 1, READ_BUFFER_SIZE - rd->len, rd->fp);
+      if (!n)
+        {
+          if (ferror (rd->fp))
+            die ("error reading input: %s", strerror (errno));
+          rd->eof = 1;
+        }
+      rd->len += n;
+    }
+
+  line = rd->buffer + rd->start;
+  *r_length = eol - line;
+  *r_terminated = (eol < rd->buffer + rd->len);
+  rd->start += *r_length + *r_terminated;
+  *eol = 0;  /* The buffer has room for it after the last byte.  */
+  return line;
+}
+
+
 /* Read a message from FP and process it according to the global
    options. */
 static void
 parse_message (FILE *fp)
 {
-  char line[5000];
+  struct reader_s reader;
+  char *line;
   size_t length;
+  int terminated;
   rfc822parse_t msg;
   unsigned int lineno = 0;
   int no_cr_reported = 0;
   struct parse_info_s info;
 
   memset (&info, 0, sizeof info);
+  memset (&reader, 0, sizeof reader);
+  reader.fp = fp;
+  reader.buffer = xmalloc (READ_BUFFER_SIZE + 1);
 
   msg = rfc822parse_open (message_cb, &info);
   if (!msg)
     die ("can't open parser: %s", strerror (errno));
 
-  /* Fixme: We should not use fgets becuase it can't cope with
-     embedded nul characters. */
-  while (fgets (line, sizeof (line), fp))
+  while ((line = read_line (&reader, &length, &terminated)))
     {
       lineno++;
-      if (lineno == 1 && !strncmp (line, "From ", 5))
+      if (lineno == 1 && length >= 5 && !memcmp (line, "From ", 5))
         continue;  /* We better ignore a leading From line. */
 
-      length = strlen (line);
-      if (length && line[length - 1] == '\n')
-	line[--length] = 0;
-      else
+      if (!terminated)
         err ("line number %u too long or last line not terminated", lineno);
+
       if (length && line[length - 1] == '\r')
 	line[--length] = 0;
       else if (verbose && !no_cr_reported)
@@ -659,7 +727,7 @@ parse_message (FILE *fp)
             {
               if (info.hashing == 2)
                 fputs ("\r\n", info.hash_file);
-              fputs (line, info.hash_file);
+              fwrite (line, length, 1, info.hash_file);
               if (ferror (info.hash_file))
                 die ("error writing to temporary file: %s", strerror (errno));
             }
@@ -683,7 +751,7 @@ parse_message (FILE *fp)
             }
           else
             {
-              fputs (line, info.sig_file);
+              fwrite (line, length, 1, info.sig_file);
               fputs ("\r\n", info.sig_file);
               if (ferror (info.sig_file))
                 die ("error writing to temporary file: %s", strerror (errno));
@@ -724,6 +792,7 @@ parse_message (FILE *fp)
     }
 
   rfc822parse_close (msg);
+  free (reader.buffer);
 }
 
 
@@ -26,6 +26,10 @@
 #include <unistd.h>
 #include <assert.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 #ifdef HAVE_DOSISH_SYSTEM
 # include <fcntl.h> /* for setmode() */
 #endif
@@ -48,6 +52,8 @@ static const char *opt_prefix = "";
 static int opt_uncompress;
 static int opt_secret_to_public;
 static int opt_no_split;
+static int opt_mmap;
+static int opt_index;
 
 static void g10_exit( int rc );
 static void split_packets (const char *fname);
@@ -60,6 +66,8 @@ enum cmd_and_opt_values {
   oUncompress   = 500,
   oSecretToPublic,
   oNoSplit,
+  oMmap,
+  oIndex,
 
   aTest
 };
@@ -74,6 +82,8 @@ static ARGPARSE_OPTS opts[] = {
     { oUncompress, "uncompress", 0, "uncompress a packet"},
     { oSecretToPublic, "secret-to-public", 0, "convert secret keys to public keys"},
     { oNoSplit, "no-split", 0, "write to stdout and don't actually split"},
+    { oMmap, "mmap", 0, "map the input into memory"},
+    { oIndex, "index", 0, "list offset, length and type of the packets"},
 {0} };
 
 
@@ -129,6 +139,8 @@ main (int argc, char **argv)
         case oUncompress: opt_uncompress = 1; break;
         case oSecretToPublic: opt_secret_to_public = 1; break;
         case oNoSplit: opt_no_split = 1; break;
+        case oMmap: opt_mmap = 1; break;
+        case oIndex: opt_index = 1; break;
         default : pargs.err = 2; break;
 	}
     }
@@ -136,6 +148,14 @@ main (int argc, char **argv)
   if (log_get_errorcount(0))
     g10_exit (2);
 
+  /* The packets are copied verbatim from the mapping.  */
+  if (opt_mmap && !opt_index && (opt_uncompress || opt_secret_to_public))
+    {
+      log_info ("note: --mmap is not used with --uncompress"
+                " or --secret-to-public\n");
+      opt_mmap = 0;
+    }
+
   if (!argc)
     split_packets (NULL);
   else
@@ -859,6 +879,217 @@ do_split (FILE *fp)
 }
 
 
+/* Return the length of the packet at BUF, of which BUFLEN bytes are
+   available, including its header and all chunks of a partial length
+   body.  Its type is stored at R_PKTTYPE.  Returns 0 if the packet is
+   truncated; R_PKTTYPE is then -1 if its CTB is invalid.  */
+static size_t
+packet_extent (const unsigned char *buf, size_t buflen, int *r_pkttype)
+{
+  size_t off, len;
+  int ctb, c, lenbytes;
+
+  *r_pkttype = -1;
+  ctb = buf[0];
+  if (!(ctb & 0x80))
+    return 0;
+  off = 1;
+  if ( (ctb & 0x40) )
+    { /* new CTB */
+      *r_pkttype = (ctb & 0x3f);
+      for (;;)
+        {
+          if (off >= buflen)
+            return 0;
+          c = buf[off++];
+          if (c < 192)
+            len = c;
+          else if (c < 224)
+            {
+              if (off >= buflen)
+                return 0;
+              len = (c - 192) * 256 + buf[off++] + 192;
+            }
+          else if (c == 255)
+            {
+              if (buflen - off < 4)
+                return 0;
+              len = ((size_t)buf[off] << 24 | buf[off+1] << 16
+                     | buf[off+2] << 8 | buf[off+3]);
+              off += 4;
+            }
+          else
+            { /* partial body length: a chunk and another length */
+              len = (size_t)1 << (c & 0x1f);
+              if (buflen - off < len)
+                return 0;
+              off += len;
+              continue;
+            }
+          break;
+        }
+    }
+  else
+    {
+      *r_pkttype = (ctb>>2)&0xf;
+      lenbytes = ((ctb&3)==3)? 0 : (1<<(ctb & 3));
+      if (!lenbytes)
+        {
+          if (*r_pkttype == PKT_COMPRESSED)
+            return buflen; /* runs to the end of the input */
+
+          /* The old GnuPG partial length encoding.  */
+          for (;;)
+            {
+              if (buflen - off < 2)
+                return 0;
+              len = (buf[off] << 8) | buf[off+1];
+              off += 2;
+              if (!len)
+                return off;
+              if (buflen - off < len)
+                return 0;
+              off += len;
+            }
+        }
+      if (buflen - off < lenbytes)
+        return 0;
+      for (len=0; lenbytes; lenbytes--)
+        len = (len << 8) | buf[off++];
+    }
+
+  if (buflen - off < len)
+    return 0;
+  return off + len;
+}
+
+
+/* Write the packet of type PKTTYPE at BUF of LEN bytes to its own
+   file, or to stdout with --no-split.  */
+static int
+write_packet (const unsigned char *buf, size_t len, int pkttype)
+{
+  FILE *fpout;
+  const char *outname = create_filename (pkttype);
+
+  if (opt_no_split)
+    fpout = stdout;
+  else
+    {
+      if (opt_verbose)
+        log_info ("writing '%s'\n", outname);
+      fpout = fopen (outname, "wb");
+      if (!fpout)
+        {
+          log_error ("error creating '%s': %s\n", outname, strerror(errno));
+          /* stop right now, otherwise we would mess up the sequence
+             of the part numbers */
+          g10_exit (1);
+        }
+    }
+
+  if (fwrite (buf, len, 1, fpout) != 1)
+    {
+      log_error ("error writing '%s': %s\n", outname, strerror (errno));
+      if (!opt_no_split)
+        fclose (fpout);
+      return 2;
+    }
+  if ( !opt_no_split && fclose (fpout) )
+    log_error ("error closing '%s': %s\n", outname, strerror (errno));
+  return 0;
+}
+
+
+/* Split the file FP with name FNAME by parsing the packet headers in
+   memory.  A regular file is mapped; other input is read into memory.
+   Each packet is written with one call or, with --index, listed with
+   its offset, length and type.  This is the same as the stdio based
+   splitting but much faster for large files.  */
+static void
+split_mapped (const char *fname, FILE *fp)
+{
+  unsigned char *buf = NULL;
+  size_t buflen = 0;
+  size_t off, len, n, size;
+  int mapped = 0;
+  int pkttype;
+
+#ifdef HAVE_MMAP
+  {
+    struct stat st;
+    void *p;
+
+    if (!fstat (fileno (fp), &st) && S_ISREG (st.st_mode) && st.st_size > 0
+        && (off_t)(size_t)st.st_size == st.st_size)
+      {
+        p = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fileno (fp), 0);
+        if (p != MAP_FAILED)
+          {
+            buf = p;
+            buflen = st.st_size;
+            mapped = 1;
+#ifdef HAVE_POSIX_MADVISE
+            posix_madvise (p, buflen, POSIX_MADV_SEQUENTIAL);
+#endif
+          }
+        else if (opt_verbose)
+          log_info ("mmap of '%s' failed: %s\n", fname, strerror (errno));
+      }
+  }
+#endif /*HAVE_MMAP*/
+
+  if (!mapped)
+    {
+      for (size = 0;;)
+        {
+          if (buflen == size)
+            {
+              size = size? 2 * size : 65536;
+              buf = xrealloc (buf, size);
+            }
+          n = fread (buf + buflen, 1, size - buflen, fp);
+          if (!n)
+            break;
+          buflen += n;
+        }
+      if (ferror (fp))
+        {
+          log_error ("error reading '%s': %s\n", fname, strerror (errno));
+          xfree (buf);
+          return;
+        }
+    }
+
+  for (off = 0; off < buflen; off += len)
+    {
+      len = packet_extent (buf + off, buflen - off, &pkttype);
+      if (!len)
+        {
+          if (pkttype == -1)
+            log_error ("invalid CTB %02x\n", buf[off]);
+          else
+            log_error ("premature EOF while reading '%s'\n", fname);
+          break;
+        }
+      if (opt_index)
+        printf ("%llu %llu %d\n", (unsigned long long)off,
+                (unsigned long long)len, pkttype);
+      else if (write_packet (buf + off, len, pkttype))
+        break;
+    }
+  if (opt_index && fflush (stdout))
+    log_error ("error writing the index: %s\n", strerror (errno));
+
+#ifdef HAVE_MMAP
+  if (mapped)
+    munmap (buf, buflen);
+  else
+#endif
+    xfree (buf);
+}
+
+
 static void
 split_packets (const char *fname)
 {
@@ -876,6 +1107,14 @@ split_packets (const char *fname)
       return;
     }
 
+  if (opt_mmap || opt_index)
+    {
+      split_mapped (fname, fp);
+      if ( fp != stdin )
+        fclose (fp);
+      return;
+    }
+
   while ( !(rc = do_split (fp)) )
     ;
   if ( rc > 0 )
@@ -25,6 +25,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
 #ifdef HAVE_W32_SYSTEM
 # define WIN32_LEAN_AND_MEAN
 # include <windows.h>
@@ -34,15 +35,42 @@
 # include <grp.h>
 #endif /*!HAVE_W32_SYSTEM*/
 #include <assert.h>
+#include <npth.h>
 
 #include "i18n.h"
 #include "../common/sysutils.h"
 #include "gpgtar.h"
+#include "../common/workpool.h"
 
 #ifndef HAVE_LSTAT
 #define lstat(a,b) stat ((a), (b))
 #endif
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* The largest number of threads used to stat and read files.  */
+#define MAX_IO_THREADS 8
+
+/* The smallest number of directory entries worth stat-ing in
+   parallel.  */
+#define MIN_PARALLEL_STATS 16
+
+/* The number of parts a large directory is split into.  */
+#define STAT_JOBS 64
+
+/* Regular files up to this size are read ahead by the worker
+   threads.  Larger files are read by the main thread while writing
+   them.  */
+#define PREFETCH_MAX_FILE (256*1024)
+
+/* The largest amount of memory used for read ahead file data.  */
+#define PREFETCH_BUDGET (32*1024*1024)
+
+/* The size of the buffer of the output stream.  */
+#define OUTPUT_BUFSIZE (256*1024)
+
 
 /* Object to control the file scanning.  */
 struct scanctrl_s;
@@ -55,6 +83,91 @@ struct scanctrl_s
 };
 
 
+/* A file read ahead by the workers.  */
+struct prefetch_job_s
+{
+  tar_header_t hdr;
+  int state;           /* 0 = not yet handed to the workers, 1 = handed
+                          to the workers, 3 = taken by the writer.  */
+  int done;            /* Set by the pool when the file has been read.  */
+  int ok;              /* The file has been read as announced by the
+                          header; else the writer reads it again.  */
+  char *data;          /* The content of the file.  */
+};
+
+/* The control object for the read ahead.  The memory is only
+   accounted by the main thread.  */
+struct prefetch_s
+{
+  workpool_group_t group;
+  struct prefetch_job_s *jobs;
+  int njobs;
+  int next;            /* The next job to hand to the workers.  */
+  size_t buffered;     /* The memory held by the handed out jobs.  */
+};
+typedef struct prefetch_s *prefetch_t;
+
+
+
+/* Return the number of threads to use for file I/O.  This is 1 if
+   threads are not to be used.  */
+static int
+io_threads (void)
+{
+  static int nthreads;
+  long n;
+
+  if (nthreads)
+    return nthreads;
+
+  n = opt.threads;
+  if (n < 1)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      n = sysconf (_SC_NPROCESSORS_ONLN);
+#else
+      n = 1;
+#endif
+    }
+  if (n < 1)
+    n = 1;
+  else if (n > MAX_IO_THREADS)
+    n = MAX_IO_THREADS;
+
+  if (n > 1 && npth_init ())
+    {
+      log_info ("error initializing threads - using just one\n");
+      n = 1;
+    }
+  nthreads = (int)n;
+  return nthreads;
+}
+
+
+/* Return the pool of workers for file I/O, which is started on the
+   first call, or NULL if threads are not to be used.  */
+static workpool_t
+io_workers (void)
+{
+  static int tried;
+  static workpool_t pool;
+
+  if (tried)
+    return pool;
+  tried = 1;
+  if (io_threads () < 2)
+    return NULL;
+  if (workpool_new (&pool, "gpgtar-io", io_threads (), 0))
+    pool = NULL;
+  else if (!workpool_threads (pool))
+    {
+      workpool_release (pool);
+      pool = NULL;
+    }
+  return pool;
+}
+
+
 
 
 /* Given a fresh header object HDR with only the name field set, try
@@ -131,7 +244,9 @@ fillup_entry_w32 (tar_header_t hdr)
 
 
 /* Given a fresh header object HDR with only the name field set, try
-   to gather all available info.  This is the POSIX version.  */
+   to gather all available info.  This is the POSIX version.  It is
+   also run by the worker threads; thus it does not print a
+   diagnostic but leaves this to the caller.  */
 #ifndef HAVE_W32_SYSTEM
 static gpg_error_t
 fillup_entry_posix (tar_header_t hdr)
@@ -142,7 +257,6 @@ fillup_entry_posix (tar_header_t hdr)
   if (lstat (hdr->name, &sbuf))
     {
       err = gpg_error_from_syserror ();
-      log_error ("error stat-ing '%s': %s\n", hdr->name, gpg_strerror (err));
       return err;
     }
 
@@ -211,14 +325,12 @@ fillup_entry_posix (tar_header_t hdr)
 #endif /*!HAVE_W32_SYSTEM*/
 
 
-/* Add a new entry.  The name of a director entry is ENTRYNAME; if
-   that is NULL, DNAME is the name of the directory itself.  Under
-   Windows ENTRYNAME shall have backslashes replaced by standard
-   slashes.  */
-static gpg_error_t
-add_entry (const char *dname, const char *entryname, scanctrl_t scanctrl)
+/* Create a new entry with only the name set.  The name of a director
+   entry is ENTRYNAME; if that is NULL, DNAME is the name of the
+   directory itself.  Returns NULL on error with ERRNO set.  */
+static tar_header_t
+new_entry (const char *dname, const char *entryname)
 {
-  gpg_error_t err;
   tar_header_t hdr;
   char *p;
   size_t dnamelen = strlen (dname);
@@ -228,7 +340,7 @@ add_entry (const char *dname, const char *entryname, scanctrl_t scanctrl)
   hdr = xtrycalloc (1, sizeof *hdr + dnamelen + 1
                     + (entryname? strlen (entryname) : 0) + 1);
   if (!hdr)
-    return gpg_error_from_syserror ();
+    return NULL;
 
   p = stpcpy (hdr->name, dname);
   if (entryname)
@@ -242,23 +354,105 @@ add_entry (const char *dname, const char *entryname, scanctrl_t scanctrl)
       if (hdr->name[dnamelen-1] == '/')
         hdr->name[dnamelen-1] = 0;
     }
+  return hdr;
+}
+
+
+/* Append the filled up entry HDR to the list of SCANCTRL.  */
+static void
+link_entry (tar_header_t hdr, scanctrl_t scanctrl)
+{
+  if (opt.verbose)
+    gpgtar_print_header (hdr, log_get_stream ());
+  *scanctrl->flist_tail = hdr;
+  scanctrl->flist_tail = &hdr->next;
+}
+
+
+/* Add a new entry.  The name of a director entry is ENTRYNAME; if
+   that is NULL, DNAME is the name of the directory itself.  Under
+   Windows ENTRYNAME shall have backslashes replaced by standard
+   slashes.  */
+static gpg_error_t
+add_entry (const char *dname, const char *entryname, scanctrl_t scanctrl)
+{
+  gpg_error_t err;
+  tar_header_t hdr;
+
+  hdr = new_entry (dname, entryname);
+  if (!hdr)
+    return gpg_error_from_syserror ();
+
 #ifdef HAVE_DOSISH_SYSTEM
   err = fillup_entry_w32 (hdr);
 #else
   err = fillup_entry_posix (hdr);
+  if (err)
+    log_error ("error stat-ing '%s': %s\n", hdr->name, gpg_strerror (err));
 #endif
   if (err)
     xfree (hdr);
   else
+    link_entry (hdr, scanctrl);
+
+  return 0;
+}
+
+
+#ifndef HAVE_W32_SYSTEM
+/* A part of the entries of one directory to be stat-ed by a worker.  */
+struct stat_job_s
+{
+  tar_header_t *hdrs;
+  gpg_error_t *errs;
+  int nhdrs;
+};
+
+
+/* Fill up the entries of the job ARG.  Called by the pool without
+   the npth lock.  */
+static void
+stat_task (void *arg)
+{
+  struct stat_job_s *job = arg;
+  int i;
+
+  for (i=0; i < job->nhdrs; i++)
+    job->errs[i] = fillup_entry_posix (job->hdrs[i]);
+}
+
+
+/* Fill up the NHDRS entries of HDRS and store the results at ERRS.
+   Large directories are split into parts for the workers, which
+   keeps more than one stat request in flight.  */
+static void
+fillup_entries (tar_header_t *hdrs, gpg_error_t *errs, int nhdrs)
+{
+  struct stat_job_s jobs[STAT_JOBS];
+  workpool_t pool;
+  workpool_group_t group;
+  int i, n, per;
+
+  if (nhdrs < MIN_PARALLEL_STATS || !(pool = io_workers ())
+      || workpool_group_new (pool, &group))
     {
-      if (opt.verbose)
-        gpgtar_print_header (hdr, log_get_stream ());
-      *scanctrl->flist_tail = hdr;
-      scanctrl->flist_tail = &hdr->next;
+      for (i=0; i < nhdrs; i++)
+        errs[i] = fillup_entry_posix (hdrs[i]);
+      return;
     }
 
-  return 0;
+  per = (nhdrs + STAT_JOBS - 1) / STAT_JOBS;
+  for (i=n=0; i < nhdrs; i += per, n++)
+    {
+      jobs[n].hdrs = hdrs + i;
+      jobs[n].errs = errs + i;
+      jobs[n].nhdrs = nhdrs - i < per? nhdrs - i : per;
+      workpool_submit (group, WORKPOOL_PRIO_NORMAL, stat_task, jobs + n);
+    }
+  /* This waits for the jobs and runs some of them ourselves.  */
+  workpool_group_release (group);
 }
+#endif /*!HAVE_W32_SYSTEM*/
 
 
 static gpg_error_t
@@ -358,6 +552,9 @@ scan_directory (const char *dname, scanctrl_t scanctrl)
 #else /*!HAVE_W32_SYSTEM*/
   DIR *dir;
   struct dirent *de;
+  tar_header_t *hdrs = NULL;
+  gpg_error_t *errs = NULL;
+  int i, nhdrs = 0, size = 0;
 
   if (!*dname)
     return 0;  /* An empty directory name has no entries.  */
@@ -371,17 +568,60 @@ scan_directory (const char *dname, scanctrl_t scanctrl)
       return err;
     }
 
+  /* First collect the names so that the entries can be stat-ed in
+     parallel.  */
   while ((de = readdir (dir)))
     {
       if (!strcmp (de->d_name, "." ) || !strcmp (de->d_name, ".."))
         continue; /* Skip self and parent dir entry.  */
 
-      err = add_entry (dname, de->d_name, scanctrl);
-      if (err)
-        goto leave;
+      if (nhdrs == size)
+        {
+          tar_header_t *tmp;
+
+          size = size? 2 * size : 64;
+          tmp = xtryrealloc (hdrs, size * sizeof *hdrs);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          hdrs = tmp;
+        }
+      hdrs[nhdrs] = new_entry (dname, de->d_name);
+      if (!hdrs[nhdrs])
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      nhdrs++;
      }
 
+  errs = xtrycalloc (nhdrs? nhdrs : 1, sizeof *errs);
+  if (!errs)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fillup_entries (hdrs, errs, nhdrs);
+  for (i=0; i < nhdrs; i++)
+    {
+      if (errs[i])
+        {
+          log_error ("error stat-ing '%s': %s\n",
+                     hdrs[i]->name, gpg_strerror (errs[i]));
+          xfree (hdrs[i]);
+        }
+      else
+        link_entry (hdrs[i], scanctrl);
+      hdrs[i] = NULL;
+    }
+
  leave:
+  for (i=0; i < nhdrs; i++)
+    xfree (hdrs[i]);
+  xfree (hdrs);
+  xfree (errs);
   closedir (dir);
 #endif /*!HAVE_W32_SYSTEM*/
   return err;
@@ -645,8 +885,209 @@ build_header (void *record, tar_header_t hdr)
 }
 
 
+/* Read the entire file of JOB into the buffer already allocated for
+   it.  Called without the npth lock.  Returns false if the file could
+   not be read or has not the size recorded in the header.  */
+static int
+prefetch_file (struct prefetch_job_s *job)
+{
+  size_t want = job->hdr->size + 1;
+  size_t have = 0;
+  ssize_t n;
+  int fd;
+
+  fd = open (job->hdr->name, O_RDONLY | O_BINARY);
+  if (fd == -1)
+    return 0;
+  while (have < want)
+    {
+      n = read (fd, job->data + have, want - have);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      have += n;
+    }
+  close (fd);
+  return have == job->hdr->size;
+}
+
+
+/* Read the file of the job ARG.  Called by the pool without the npth
+   lock.  */
+static void
+prefetch_task (void *arg)
+{
+  struct prefetch_job_s *job = arg;
+
+  job->ok = prefetch_file (job);
+}
+
+
+/* Hand more files to the workers as long as the memory budget
+   allows.  */
+static void
+prefetch_more (prefetch_t pf)
+{
+  struct prefetch_job_s *job;
+  size_t size;
+
+  for (; pf->next < pf->njobs; pf->next++)
+    {
+      job = pf->jobs + pf->next;
+      if (job->state
+          || job->hdr->typeflag != TF_REGULAR
+          || job->hdr->size > PREFETCH_MAX_FILE)
+        continue;
+      size = job->hdr->size;
+      if (pf->buffered && pf->buffered + size > PREFETCH_BUDGET)
+        break;  /* Wait until the writer has released some memory.  */
+      job->data = xtrymalloc (size + 1);
+      if (!job->data)
+        break;  /* The writer will read the remaining files.  */
+      job->state = 1;
+      pf->buffered += size;
+      workpool_submit_task (pf->group, WORKPOOL_PRIO_NORMAL,
+                            prefetch_task, job, &job->done);
+    }
+}
+
+
+/* Start reading ahead the small regular files of the list FLIST.
+   Returns NULL if no read ahead is done.  */
+static prefetch_t
+start_prefetch (tar_header_t flist)
+{
+  prefetch_t pf;
+  workpool_t pool;
+  tar_header_t hdr;
+  int n;
+
+  if (!(pool = io_workers ()))
+    return NULL;
+
+  pf = xtrycalloc (1, sizeof *pf);
+  if (!pf)
+    return NULL;
+  for (hdr = flist; hdr; hdr = hdr->next)
+    pf->njobs++;
+  pf->jobs = xtrycalloc (pf->njobs? pf->njobs : 1, sizeof *pf->jobs);
+  if (!pf->jobs || workpool_group_new (pool, &pf->group))
+    {
+      xfree (pf->jobs);
+      xfree (pf);
+      return NULL;
+    }
+  for (n=0, hdr = flist; hdr; hdr = hdr->next)
+    pf->jobs[n++].hdr = hdr;
+
+  prefetch_more (pf);
+  return pf;
+}
+
+
+/* Stop the read ahead and release PF.  */
+static void
+stop_prefetch (prefetch_t pf)
+{
+  int i;
+
+  if (!pf)
+    return;
+
+  workpool_cancel (pf->group);
+  workpool_group_release (pf->group);
+  for (i=0; i < pf->njobs; i++)
+    xfree (pf->jobs[i].data);
+  xfree (pf->jobs);
+  xfree (pf);
+}
+
+
+/* Take job number IDX from PF.  Waits for a worker to finish reading
+   it and returns the data read ahead or NULL if the writer has to
+   read the file itself.  */
+static char *
+prefetch_take (prefetch_t pf, int idx)
+{
+  struct prefetch_job_s *job;
+
+  if (!pf)
+    return NULL;
+
+  job = pf->jobs + idx;
+  if (!job->state)
+    {
+      job->state = 3;
+      return NULL;
+    }
+  workpool_wait_task (pf->group, &job->done);
+  if (!job->ok)
+    {
+      pf->buffered -= job->hdr->size;
+      xfree (job->data);
+      job->data = NULL;
+      job->state = 3;
+      prefetch_more (pf);
+    }
+  return job->data;
+}
+
+
+/* Release the memory of job number IDX of PF.  */
+static void
+prefetch_done (prefetch_t pf, int idx)
+{
+  struct prefetch_job_s *job;
+
+  if (!pf)
+    return;
+
+  job = pf->jobs + idx;
+  if (job->state == 1)
+    {
+      pf->buffered -= job->hdr->size;
+      xfree (job->data);
+      job->data = NULL;
+      job->state = 3;
+      prefetch_more (pf);
+    }
+}
+
+
+/* Write the content of a regular file from the buffer DATA which
+   holds HDR->SIZE bytes.  */
+static gpg_error_t
+write_data (estream_t stream, tar_header_t hdr, const char *data)
+{
+  gpg_error_t err;
+  char record[RECORDSIZE];
+  size_t n;
+
+  n = hdr->size - (hdr->size % RECORDSIZE);
+  if (n && es_write (stream, data, n, NULL))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error writing '%s': %s\n",
+                 es_fname_get (stream), gpg_strerror (err));
+      return err;
+    }
+  if (hdr->size % RECORDSIZE)
+    {
+      memset (record, 0, sizeof record);
+      memcpy (record, data + n, hdr->size % RECORDSIZE);
+      return write_record (stream, record);
+    }
+  return 0;
+}
+
+
+/* Write the file described by HDR to STREAM.  If DATA is not NULL it
+   is the content of the file as read ahead.  The number of records
+   written is stored at R_NRECORDS.  */
 static gpg_error_t
-write_file (estream_t stream, tar_header_t hdr)
+write_file (estream_t stream, tar_header_t hdr, const char *data,
+            unsigned long long *r_nrecords)
 {
   gpg_error_t err;
   char record[RECORDSIZE];
@@ -654,6 +1095,7 @@ write_file (estream_t stream, tar_header_t hdr)
   size_t nread, nbytes;
   int any;
 
+  *r_nrecords = 0;
   err = build_header (record, hdr);
   if (err)
     {
@@ -665,6 +1107,16 @@ write_file (estream_t stream, tar_header_t hdr)
       return err;
     }
 
+  if (hdr->typeflag == TF_REGULAR && data)
+    {
+      err = write_record (stream, record);
+      if (!err)
+        err = write_data (stream, hdr, data);
+      if (!err)
+        *r_nrecords = 1 + (hdr->size + RECORDSIZE-1)/RECORDSIZE;
+      return err;
+    }
+
   if (hdr->typeflag == TF_REGULAR)
     {
       infp = es_fopen (hdr->name, "rb");
@@ -709,7 +1161,9 @@ write_file (estream_t stream, tar_header_t hdr)
       nread = es_fread (record, 1, 1, infp);
       if (nread)
         log_info ("note: file '%s' has grown\n", hdr->name);
+      *r_nrecords = (hdr->size + RECORDSIZE-1)/RECORDSIZE;
     }
+  *r_nrecords += 1;
 
  leave:
   if (err)
@@ -721,6 +1175,33 @@ write_file (estream_t stream, tar_header_t hdr)
 }
 
 
+/* Write the line for the member HDR starting at record OFFSET of the
+   archive to the index INDEXFP.  The index is a text file with one
+   line "OFFSET:NAME" per member; colons and linefeeds in NAME are
+   percent escaped.  */
+static gpg_error_t
+write_index_entry (estream_t indexfp, tar_header_t hdr,
+                   unsigned long long offset)
+{
+  gpg_error_t err;
+  char *name;
+
+  name = try_percent_escape (hdr->name, "\n\r");
+  if (!name)
+    return gpg_error_from_syserror ();
+  if (es_fprintf (indexfp, "%llu:%s\n", offset * RECORDSIZE, name) < 0)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error writing '%s': %s\n",
+                 opt.index_file, gpg_strerror (err));
+    }
+  else
+    err = 0;
+  xfree (name);
+  return err;
+}
+
+
 static gpg_error_t
 write_eof_mark (estream_t stream)
 {
@@ -747,6 +1228,10 @@ gpgtar_create (char **inpattern)
   scanctrl_t scanctrl = &scanctrl_buffer;
   tar_header_t hdr, *start_tail;
   estream_t outstream = NULL;
+  estream_t indexfp = NULL;
+  prefetch_t prefetch = NULL;
+  unsigned long long offset, nrecords;
+  int idx;
   int eof_seen = 0;
 
   if (!inpattern)
@@ -863,15 +1348,39 @@ gpgtar_create (char **inpattern)
   if (outstream == es_stdout)
     es_set_binary (es_stdout);
 
-  for (hdr = scanctrl->flist; hdr; hdr = hdr->next)
+  /* Records are written one at a time; a large buffer saves most of
+     the write calls to the pipe or file.  */
+  es_setvbuf (outstream, NULL, _IOFBF, OUTPUT_BUFSIZE);
+
+  if (opt.index_file)
     {
-      err = write_file (outstream, hdr);
+      indexfp = es_fopen (opt.index_file, "w");
+      if (!indexfp)
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("can't create '%s': %s\n"),
+                     opt.index_file, gpg_strerror (err));
+          goto leave;
+        }
+    }
+
+  prefetch = start_prefetch (scanctrl->flist);
+  offset = 0;
+  for (idx=0, hdr = scanctrl->flist; hdr; idx++, hdr = hdr->next)
+    {
+      err = write_file (outstream, hdr, prefetch_take (prefetch, idx),
+                        &nrecords);
+      prefetch_done (prefetch, idx);
+      if (!err && indexfp && nrecords)
+        err = write_index_entry (indexfp, hdr, offset);
       if (err)
         goto leave;
+      offset += nrecords;
     }
   err = write_eof_mark (outstream);
 
  leave:
+  stop_prefetch (prefetch);
   if (!err)
     {
       if (outstream != es_stdout)
@@ -889,6 +1398,18 @@ gpgtar_create (char **inpattern)
       if (opt.outfile)
         gnupg_remove (opt.outfile);
     }
+  if (indexfp)
+    {
+      if (es_fclose (indexfp))
+        {
+          if (!err)
+            log_error ("error closing '%s': %s\n", opt.index_file,
+                       gpg_strerror (gpg_error_from_syserror ()));
+          err = gpg_error (GPG_ERR_GENERAL);
+        }
+      if (err)
+        gnupg_remove (opt.index_file);
+    }
   scanctrl->flist_tail = NULL;
   while ( (hdr = scanctrl->flist) )
     {
@@ -32,6 +32,29 @@
 #include "gpgtar.h"
 
 
+/* Create the parent directories of FNAME below the first PREFIXLEN
+   bytes of FNAME, which are the name of the extract directory.
+   Returns 0 on success or an errno value.  */
+static int
+create_parents (char *fname, size_t prefixlen)
+{
+  char *p;
+  int rc = 0;
+
+  for (p = fname+prefixlen; (p = strchr (p, '/')); p++)
+    {
+      *p = 0;
+      rc = gnupg_mkdir (fname, "-rwx------");
+      if (rc && errno == EEXIST)
+        rc = 0;
+      *p = '/';
+      if (rc)
+        break;
+    }
+  return rc? errno : 0;
+}
+
+
 static gpg_error_t
 extract_regular (estream_t stream, const char *dirname,
                  tar_header_t hdr)
@@ -53,6 +76,13 @@ extract_regular (estream_t stream, const char *dirname,
     err = 0;
 
   outfp = es_fopen (fname, "wb");
+  if (!outfp && errno == ENOENT)
+    {
+      /* When extracting only some members the directories of the
+         archive may not have been created.  */
+      if (!create_parents (fname, strlen (dirname) + 1))
+        outfp = es_fopen (fname, "wb");
+    }
   if (!outfp)
     {
       err = gpg_error_from_syserror ();
@@ -126,18 +156,8 @@ extract_directory (const char *dirname, tar_header_t hdr)
         {
           /* Try to create the directory with parents but keep the
              original error code in case of a failure.  */
-          char *p;
-          int rc = 0;
-
-          for (p = fname+prefixlen; (p = strchr (p, '/')); p++)
-            {
-              *p = 0;
-              rc = gnupg_mkdir (fname, "-rwx------");
-              *p = '/';
-              if (rc)
-                break;
-            }
-          if (!rc && !gnupg_mkdir (fname, "-rwx------"))
+          if (!create_parents (fname, prefixlen)
+              && !gnupg_mkdir (fname, "-rwx------"))
             err = 0;
         }
       if (err)
@@ -264,8 +284,118 @@ create_directory (const char *dirprefix)
 
 
 
+/* Return true if the member NAME shall be extracted.  This is the
+   case if no NAMES are given or if NAME is one of NAMES or a file
+   below one of them.  */
+static int
+wanted_p (char **names, const char *name)
+{
+  size_t n;
+
+  if (!names || !*names)
+    return 1;
+  for (; *names; names++)
+    {
+      n = strlen (*names);
+      while (n > 1 && (*names)[n-1] == '/')
+        n--;
+      if (!strncmp (name, *names, n) && (!name[n] || name[n] == '/'))
+        return 1;
+    }
+  return 0;
+}
+
+
+/* Extract the members listed in NAMES from the archive STREAM into
+   DIRNAME by seeking to the offsets stored in the index file.  */
+static gpg_error_t
+extract_using_index (estream_t stream, const char *dirname, char **names)
+{
+  gpg_error_t err = 0;
+  estream_t indexfp;
+  char line[5000];
+  char *name, *endp;
+  unsigned long long offset;
+  tar_header_t header = NULL;
+  unsigned int lnr = 0;
+  size_t n;
+
+  indexfp = es_fopen (opt.index_file, "r");
+  if (!indexfp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error opening '%s': %s\n",
+                 opt.index_file, gpg_strerror (err));
+      return err;
+    }
+
+  while (es_fgets (line, sizeof line, indexfp))
+    {
+      lnr++;
+      n = strlen (line);
+      if (!n || line[n-1] != '\n')
+        {
+          err = gpg_error (es_feof (indexfp)? GPG_ERR_INCOMPLETE_LINE
+                           : GPG_ERR_LINE_TOO_LONG);
+          break;
+        }
+      line[--n] = 0;
+      offset = strtoull (line, &endp, 10);
+      if (endp == line || *endp != ':' || (offset % RECORDSIZE))
+        {
+          err = gpg_error (GPG_ERR_INV_VALUE);
+          break;
+        }
+      name = endp + 1;
+      percent_unescape_inplace (name, 0);
+      if (!wanted_p (names, name))
+        continue;
+
+      if (es_fseeko (stream, (off_t)offset, SEEK_SET))
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("error seeking in '%s': %s\n",
+                     es_fname_get (stream), gpg_strerror (err));
+          goto leave;
+        }
+      header = gpgtar_read_header (stream);
+      if (!header)
+        {
+          err = gpg_error (GPG_ERR_GENERAL);
+          goto leave;
+        }
+      if (strcmp (header->name, name))
+        {
+          log_error ("index '%s' does not match the archive\n",
+                     opt.index_file);
+          err = gpg_error (GPG_ERR_INV_INDEX);
+          goto leave;
+        }
+      err = extract (stream, dirname, header);
+      if (err)
+        goto leave;
+      xfree (header);
+      header = NULL;
+    }
+  if (!err && es_ferror (indexfp))
+    err = gpg_error_from_syserror ();
+  if (err)
+    log_error ("error reading '%s', line %u: %s\n",
+               opt.index_file, lnr, gpg_strerror (err));
+
+ leave:
+  xfree (header);
+  es_fclose (indexfp);
+  return err;
+}
+
+
+/* Extract the archive FILENAME or, if FILENAME is NULL, the archive
+   read from stdin.  If NAMES is not NULL and not empty only the
+   members listed there are extracted; an index given with --index is
+   then used to seek directly to them.  */
 void
-gpgtar_extract (const char *filename)
+gpgtar_extract (const char *filename, char **names)
 {
   gpg_error_t err;
   estream_t stream;
@@ -322,13 +452,26 @@ gpgtar_extract (const char *filename)
   if (opt.verbose)
     log_info ("extracting to '%s/'\n", dirname);
 
+  if (opt.index_file && names && *names && stream != es_stdin)
+    {
+      extract_using_index (stream, dirname, names);
+      goto leave;
+    }
+  else if (opt.index_file)
+    log_info ("note: ignoring option --index\n");
+
   for (;;)
     {
       header = gpgtar_read_header (stream);
       if (!header)
         goto leave;
 
-      if (extract (stream, dirname, header))
+      if (!wanted_p (names, header->name))
+        {
+          if (gpgtar_skip_data (stream, header))
+            goto leave;
+        }
+      else if (extract (stream, dirname, header))
         goto leave;
       xfree (header);
       header = NULL;
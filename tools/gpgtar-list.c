@@ -208,13 +208,22 @@ read_header (estream_t stream)
 
 
 /* Skip the data records according to HEADER.  Prints an error message
-   on error and return -1. */
+   on error and return -1.  The records of an archive read from a file
+   are not read but skipped by seeking.  */
 static int
 skip_data (estream_t stream, tar_header_t header)
 {
   char record[RECORDSIZE];
   unsigned long long n;
 
+  if (!header->nrecords)
+    return 0;
+  if (stream != es_stdin
+      && header->nrecords < ((unsigned long long)1 << 50)
+      && !es_fseeko (stream, (off_t)(header->nrecords * RECORDSIZE),
+                     SEEK_CUR))
+    return 0;
+
   for (n=0; n < header->nrecords; n++)
     {
       if (read_record (stream, record))
@@ -321,6 +330,12 @@ gpgtar_read_header (estream_t stream)
   return read_header (stream);
 }
 
+gpg_error_t
+gpgtar_skip_data (estream_t stream, tar_header_t header)
+{
+  return skip_data (stream, header)? gpg_error (GPG_ERR_GENERAL) : 0;
+}
+
 void
 gpgtar_print_header (tar_header_t header, estream_t out)
 {
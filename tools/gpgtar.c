@@ -65,7 +65,9 @@ enum cmd_and_opt_values
     oOpenPGP,
     oCMS,
     oSetFilename,
-    oNull
+    oNull,
+    oThreads,
+    oIndex
   };
 
 
@@ -92,6 +94,8 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_s (oFilesFrom, "files-from",
                 N_("|FILE|get names to create from FILE")),
   ARGPARSE_s_n (oNull, "null", N_("-T reads null-terminated names")),
+  ARGPARSE_s_i (oThreads, "threads", N_("|N|use N threads to read files")),
+  ARGPARSE_s_s (oIndex, "index", N_("|FILE|write or use an index in FILE")),
   ARGPARSE_s_n (oOpenPGP, "openpgp", "@"),
   ARGPARSE_s_n (oCMS, "cms", "@"),
 
@@ -195,6 +199,8 @@ main (int argc, char **argv)
         case oNoVerbose: opt.verbose = 0; break;
         case oFilesFrom: files_from = pargs.r.ret_str; break;
         case oNull: null_names = 1; break;
+        case oThreads: opt.threads = pargs.r.ret_int; break;
+        case oIndex: opt.index_file = pargs.r.ret_str; break;
 
 	case aList:
         case aDecrypt:
@@ -247,6 +253,8 @@ main (int argc, char **argv)
         log_info ("note: ignoring option --set-filename\n");
       if (files_from)
         log_info ("note: ignoring option --files-from\n");
+      if (opt.index_file)
+        log_info ("note: ignoring option --index\n");
       if (skip_crypto)
         gpgtar_list (fname);
       else
@@ -266,7 +274,9 @@ main (int argc, char **argv)
       break;
 
     case aDecrypt:
-      if (argc != 1)
+      /* Names of members to extract are only supported for plain
+         archives.  */
+      if (argc < 1 || (argc > 1 && !skip_crypto))
         usage (1);
       if (opt.outfile)
         log_info ("note: ignoring option --output\n");
@@ -274,7 +284,7 @@ main (int argc, char **argv)
         log_info ("note: ignoring option --files-from\n");
       fname = argc ? *argv : NULL;
       if (skip_crypto)
-        gpgtar_extract (fname);
+        gpgtar_extract (fname, argv + 1);
       else
         decrypt_and_untar (fname);
       break;
@@ -30,6 +30,8 @@ struct
   const char *outfile;
   int symmetric;
   const char *filename;
+  int threads;   /* Number of threads to read files; 0 for auto.  */
+  const char *index_file;  /* Name of the index of the archive.  */
 } opt;
 
 
@@ -114,11 +116,12 @@ gpg_error_t write_record (estream_t stream, const void *record);
 void gpgtar_create (char **inpattern);
 
 /*-- gpgtar-extract.c --*/
-void gpgtar_extract (const char *filename);
+void gpgtar_extract (const char *filename, char **names);
 
 /*-- gpgtar-list.c --*/
 void gpgtar_list (const char *filename);
 tar_header_t gpgtar_read_header (estream_t stream);
+gpg_error_t gpgtar_skip_data (estream_t stream, tar_header_t header);
 void gpgtar_print_header (tar_header_t header, estream_t out);
 
 
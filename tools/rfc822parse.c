@@ -94,6 +94,7 @@ struct rfc822parse_context
   part_t parts;         /* The tree of parts. */
   part_t current_part;  /* Whom we are processing (points into parts). */
   const char *boundary; /* Current boundary. */
+  size_t boundary_len;  /* Its length.  */
 };
 
 static HDR_LINE find_header (rfc822parse_t msg, const char *name,
@@ -103,22 +104,9 @@ static HDR_LINE find_header (rfc822parse_t msg, const char *name,
 static size_t
 length_sans_trailing_ws (const unsigned char *line, size_t len)
 {
-  const unsigned char *p, *mark;
-  size_t n;
-
-  for (mark=NULL, p=line, n=0; n < len; n++, p++)
-    {
-      if (strchr (" \t\r\n", *p ))
-        {
-          if( !mark )
-            mark = p;
-        }
-      else
-        mark = NULL;
-    }
-
-  if (mark)
-    return mark - line;
+  while (len && (line[len-1] == ' ' || line[len-1] == '\t'
+                 || line[len-1] == '\r' || line[len-1] == '\n'))
+    len--;
   return len;
 }
 
@@ -224,6 +212,7 @@ release_handle_data (rfc822parse_t msg)
   msg->parts = NULL;
   msg->current_part = NULL;
   msg->boundary = NULL;
+  msg->boundary_len = 0;
 }
 
 
@@ -323,6 +312,7 @@ set_current_part_to_parent (rfc822parse_t msg)
 
   parent = find_parent (msg->parts, parent);
   msg->boundary = parent? parent->boundary: NULL;
+  msg->boundary_len = msg->boundary? strlen (msg->boundary) : 0;
 }
 
 
@@ -362,6 +352,7 @@ transition_to_body (rfc822parse_t msg)
 
                       strcpy (msg->current_part->boundary, s);
                       msg->boundary = msg->current_part->boundary;
+                      msg->boundary_len = strlen (msg->boundary);
                       part = new_part ();
                       if (!part)
                         {
@@ -430,7 +421,7 @@ insert_header (rfc822parse_t msg, const unsigned char *line, size_t length)
   hdr->line[length] = 0; /* Make it a string. */
 
   /* Transform a field name into canonical format. */
-  if (!hdr->cont && strchr (line, ':'))
+  if (!hdr->cont && memchr (hdr->line, ':', length))
      capitalize_header_name (hdr->line);
 
   *msg->current_part->hdr_lines_tail = hdr;
@@ -446,15 +437,17 @@ insert_header (rfc822parse_t msg, const unsigned char *line, size_t length)
 
 /****************
  * Note: We handle the body transparent to allow binary zeroes in it.
+ * Most body lines are rejected as boundaries by their length or
+ * their first two bytes.
  */
 static int
 insert_body (rfc822parse_t msg, const unsigned char *line, size_t length)
 {
   int rc = 0;
 
-  if (length > 2 && *line == '-' && line[1] == '-' && msg->boundary)
+  if (msg->boundary && length > 2 && *line == '-' && line[1] == '-')
     {
-      size_t blen = strlen (msg->boundary);
+      size_t blen = msg->boundary_len;
 
       if (length == blen + 2
           && !memcmp (line+2, msg->boundary, blen))
@@ -471,6 +464,7 @@ insert_body (rfc822parse_t msg, const unsigned char *line, size_t length)
         {
           rc = do_callback (msg, RFC822PARSE_LAST_BOUNDARY);
           msg->boundary = NULL; /* No current boundary anymore. */
+          msg->boundary_len = 0;
           set_current_part_to_parent (msg);
 
           /* Fixme: The next should actually be send right before the
@@ -485,8 +479,10 @@ insert_body (rfc822parse_t msg, const unsigned char *line, size_t length)
   return rc;
 }
 
-/* Insert the next line into the parser. Return 0 on success or true
-   on error with errno set appropriately. */
+/* Insert the next line into the parser.  LINE has LENGTH bytes
+   without the line ending and needs not be a string; thus the caller
+   may pass lines right from its input buffer.  Return 0 on success
+   or true on error with errno set appropriately. */
 int
 rfc822parse_insert (rfc822parse_t msg, const unsigned char *line, size_t length)
 {
@@ -0,0 +1,202 @@
+#!/bin/sh
+# coordinate.sh - Run one vanity key search on several hosts
+# Copyright (C) 2026 The gnupg-vanity authors
+#
+# This file is part of GnuPG.
+#
+# GnuPG is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# GnuPG is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+# Each line of HOSTFILE names a host reachable with ssh, optionally
+# followed by the GnuPG home directory to use there.  The search
+# described by BATCHPARAMS is started on all hosts at once; every
+# host generates its own random keys, so no two hosts ever try the
+# same key.  The progress reported by the agents is shown every few
+# seconds.  As soon as one host has found a key, the others are
+# stopped and the secret key is exported from the winning host; it
+# is still protected by the passphrase from BATCHPARAMS and travels
+# over ssh.
+#
+# With --seed-range N the Ed25519 keys of all hosts are derived from
+# one job key instead, and host number I (counting the host lines
+# from 1) gets the N key streams starting at SEED-BASE + (I-1)*N;
+# each stream is searched by one thread, so N must be at least the
+# number of threads of the largest host.  No key is then checked
+# twice and the keys swept by each host are known exactly from its
+# VANITY_SEEDS line or, if it was stopped, from its agent's log.
+# The job key and the next free stream are printed at the start; a
+# host added to a running job is started with the same --seed-key
+# and a --seed-base beyond all ranges handed out.
+
+PGM=coordinate.sh
+gpg=gpg2
+interval=10
+seed_range=
+seed_key=
+seed_base=
+
+usage ()
+{
+    cat <<EOF
+usage: $PGM [options] HOSTFILE BATCHPARAMS
+Options:
+  --gpg PROGRAM   run PROGRAM on the hosts instead of gpg2
+  --interval N    show the progress every N seconds
+  --seed-range N  give each host N key streams of one job key
+  --seed-key HEX  use this job key instead of a new one
+  --seed-base N   the first key stream of the first host
+EOF
+    exit $1
+}
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --gpg) gpg="$2"; shift 2 ;;
+        --interval) interval="$2"; shift 2 ;;
+        --seed-range) seed_range="$2"; shift 2 ;;
+        --seed-key) seed_key="$2"; shift 2 ;;
+        --seed-base) seed_base="$2"; shift 2 ;;
+        --help|-h) usage 0 ;;
+        -*) usage 1 >&2 ;;
+        *) break ;;
+    esac
+done
+[ $# -eq 2 ] || usage 1 >&2
+hostfile="$1"
+params="$2"
+[ -r "$hostfile" ] || { echo "$PGM: can't read $hostfile" >&2; exit 1; }
+[ -r "$params" ] || { echo "$PGM: can't read $params" >&2; exit 1; }
+
+if [ -n "$seed_range" ]; then
+    [ -n "$seed_key" ] || \
+        seed_key=$(od -An -tx1 -N32 /dev/urandom | tr -d ' \n')
+    seed_base=${seed_base:-0}
+    hosts=$(grep -v '^[ 	]*#' "$hostfile" | grep -c '[^ 	]')
+    echo "$PGM: job key $seed_key, next free stream" \
+         $((seed_base + hosts * seed_range))
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/vanity.XXXXXX") || exit 1
+pids=""
+stop_all ()
+{
+    for pid in $pids; do
+        kill $pid 2>/dev/null
+    done
+}
+trap 'stop_all; rm -rf "$work"; exit 1' INT TERM HUP
+
+# Start the search on all hosts.  Closing the ssh connection makes gpg
+# fail on its next status line, which in turn makes the agent cancel
+# the search.
+n=0
+while read host homedir; do
+    case "$host" in ''|'#'*) continue ;; esac
+    n=$((n + 1))
+    echo "$host" > "$work/host.$n"
+    echo "${homedir:-}" > "$work/home.$n"
+    opts="--batch --status-fd 1"
+    [ -n "$homedir" ] && opts="$opts --homedir '$homedir'"
+    if [ -n "$seed_range" ]; then
+        # Give the host its share right after the Key-Type line.
+        awk -v key="$seed_key" \
+            -v first=$((seed_base + (n - 1) * seed_range)) \
+            -v count="$seed_range" '
+            { print }
+            /^[ \t]*Key-Type:/ {
+                print "Vanity-Seed-Key: " key
+                print "Vanity-Seed-Range: " first " " count
+            }' "$params" > "$work/params.$n"
+    else
+        cp "$params" "$work/params.$n"
+    fi
+    ssh -o BatchMode=yes "$host" "$gpg $opts --gen-key" \
+        < "$work/params.$n" > "$work/log.$n" 2>&1 &
+    echo $! > "$work/pid.$n"
+    pids="$pids $!"
+done < "$hostfile"
+[ $n -gt 0 ] || { echo "$PGM: no hosts given" >&2; rm -rf "$work"; exit 1; }
+echo "$PGM: searching on $n hosts"
+
+# Wait for the first key, showing the progress meanwhile.
+winner=
+while [ -z "$winner" ]; do
+    sleep $interval
+    total=0
+    rate=0
+    running=0
+    i=1
+    while [ $i -le $n ]; do
+        if grep -q '^\[GNUPG:\] KEY_CREATED ' "$work/log.$i"; then
+            winner=$i
+            break
+        fi
+        if kill -0 $(cat "$work/pid.$i") 2>/dev/null; then
+            running=$((running + 1))
+        elif [ ! -f "$work/failed.$i" ]; then
+            touch "$work/failed.$i"
+            echo "$PGM: search on $(cat "$work/host.$i") failed:" >&2
+            grep -v '^\[GNUPG:\]' "$work/log.$i" | tail -3 >&2
+        fi
+        cur=$(sed -n 's/^\[GNUPG:\] PROGRESS vanity [^ ]* \([0-9]*\).*/\1/p' \
+                  "$work/log.$i" | tail -1)
+        total=$((total + ${cur:-0}))
+        if [ ! -f "$work/failed.$i" ]; then
+            cur=$(sed -n 's/^\[GNUPG:\] VANITY_STATS [0-9]* \([0-9]*\).*/\1/p' \
+                      "$work/log.$i" | tail -1)
+            rate=$((rate + ${cur:-0}))
+        fi
+        i=$((i + 1))
+    done
+    if [ -z "$winner" ]; then
+        if [ $running -eq 0 ]; then
+            echo "$PGM: all searches failed" >&2
+            rm -rf "$work"
+            exit 1
+        fi
+        echo "$PGM: $running hosts running, $total fingerprints so far," \
+             "$rate per second"
+    fi
+done
+stop_all
+wait 2>/dev/null
+
+if [ -n "$seed_range" ]; then
+    i=1
+    while [ $i -le $n ]; do
+        line=$(sed -n 's/^\[GNUPG:\] VANITY_SEEDS //p' "$work/log.$i")
+        echo "$PGM: $(cat "$work/host.$i"):" \
+             "${line:-stopped, see the log of its agent}"
+        i=$((i + 1))
+    done
+fi
+
+host=$(cat "$work/host.$winner")
+homedir=$(cat "$work/home.$winner")
+fpr=$(sed -n 's/^\[GNUPG:\] KEY_CREATED [^ ]* \([0-9A-F]*\).*/\1/p' \
+          "$work/log.$winner" | tail -1)
+echo "$PGM: $host found key $fpr"
+opts="--batch"
+[ -n "$homedir" ] && opts="$opts --homedir '$homedir'"
+if ssh -o BatchMode=yes "$host" \
+       "$gpg $opts --armor --export-secret-keys $fpr" > "$fpr.asc" \
+   && [ -s "$fpr.asc" ]; then
+    echo "$PGM: secret key written to $fpr.asc"
+    rc=0
+else
+    echo "$PGM: exporting the key from $host failed" >&2
+    rm -f "$fpr.asc"
+    rc=1
+fi
+rm -rf "$work"
+exit $rc
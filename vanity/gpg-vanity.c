@@ -0,0 +1,1682 @@
+/* gpg-vanity.c - Standalone vanity key search
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This program runs the search engine in its own process instead of
+   in gpg-agent, so that neither the agent nor a passphrase prompt is
+   involved until a key has been found.  The keys found are then
+   wrapped with the key wrapping key of the agent and handed to it
+   with IMPORT_KEY, the command gpg uses to import secret keys.
+
+   The OpenPGP key itself is created by gpg from the keygrip of the
+   imported key with the creation time of the hit, which gives the
+   fingerprint found by the search; gpg then exports the public
+   keyblock.  Thus the keyblock is built and signed by the same code
+   as every other key.
+
+   With --worker the program is a stateless search worker for short
+   lived machines: it needs no home directory and no agent, reads its
+   job on stdin and writes the keys it finds, encrypted to the key of
+   its coordinator, and its counters on stdout.  The job descriptor
+   is a line per setting, using the names of the options, and ends
+   with "start":
+
+     recipient HEX    The canonical public key of the coordinator in
+                      hex, as printed by --gen-coordinator-key.
+     pattern ITEMS    The pattern; this one is required as well.
+     curve NAME, window LIST, backward, autotune, hits N, workers N, gpu
+                      As the options.
+
+   Each following line "assign ID ITERATIONS SECONDS" runs one search
+   of at most ITERATIONS fingerprints and SECONDS seconds (0 for no
+   limit); ID is an arbitrary word echoed in the records.  The keys
+   are generated from the worker's own random stream, thus workers
+   never repeat each other's work and an assignment is only an amount
+   of work.  "quit" or the end of the input ends the worker.  The
+   records written are:
+
+     ready                                   After the descriptor.
+     progress ID ITERATIONS KEYS SECONDS RATE  Every 10 seconds.
+     hit ID FPR CREATED ITEM SCORE SEALED    For each key found; SEALED
+                                             is the hex record of
+                                             vanity_seal_key.
+     done ID ITERATIONS HITS ERRCODE         At the end of an assignment.
+
+   --open-hits reads such hit records on stdin, opens them with the
+   coordinator key and imports the keys like a search of its own; it
+   needs the --curve given to the workers.
+
+   --finalize makes the OpenPGP keys of keys the agent already holds,
+   those listed in its result store by VANITY_RESULTS, optionally only
+   of the job IDs given as arguments.  All of them are created by one
+   gpg run with a parameter file of one block per key and "%bulk", so
+   that gpg writes them to the keyring as one transaction, and
+   exported by one more; their results are then deleted from the
+   store.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assuan.h>
+#include <npth.h>
+
+#include "i18n.h"
+#include "../common/util.h"
+#include "../common/init.h"
+#include "../common/asshelp.h"
+#include "../common/membuf.h"
+#include "../common/exechelp.h"
+#include "../common/sysutils.h"
+#include "../common/openpgpdefs.h"
+#include "vanity.h"
+
+
+#define PGM "gpg-vanity"
+
+/* The curve used if none is given.  */
+#define DEFAULT_CURVE "Ed25519"
+
+
+enum cmd_and_opt_values
+  {
+    aNull = 0,
+    oQuiet      = 'q',
+    oVerbose	= 'v',
+    oOutput     = 'o',
+    oArmor      = 'a',
+
+    oNoVerbose	= 500,
+    oHomedir,
+    oAgentProgram,
+    oGpgProgram,
+    oCurve,
+    oWindow,
+    oBackward,
+    oAutotune,
+    oWorkers,
+    oGpu,
+    oPinWorkers,
+    oNoSmt,
+    oReseed,
+    oGovernor,
+    oMaxTemp,
+    oMemoryLimit,
+    oWorkerMemory,
+    oHits,
+    oBudget,
+    oIterations,
+    oNameReal,
+    oNameEmail,
+    oNameComment,
+    oExpireDate,
+    oPassphraseFile,
+    oNoProtection,
+    oNoKeyblock,
+    oEstimate,
+    oNodes,
+    oWorker,
+    oGenCoordKey,
+    oOpenHits,
+    oFinalize
+  };
+
+
+static ARGPARSE_OPTS opts[] = {
+  ARGPARSE_group (301, N_("@\nOptions:\n ")),
+
+  ARGPARSE_s_n (oVerbose, "verbose", N_("verbose")),
+  ARGPARSE_s_n (oQuiet,   "quiet",   N_("be somewhat more quiet")),
+  ARGPARSE_s_s (oCurve,   "curve",   N_("|NAME|generate keys on curve NAME")),
+  ARGPARSE_s_s (oWindow,  "window",
+                N_("|LIST|try the creation times of LIST")),
+  ARGPARSE_s_n (oBackward, "backward", N_("sweep the windows backward")),
+  ARGPARSE_s_n (oAutotune, "autotune",
+                N_("shrink the default window to what the host needs")),
+  ARGPARSE_s_u (oWorkers, "workers", N_("|N|use N search threads")),
+  ARGPARSE_s_n (oGpu,     "gpu",     N_("use an OpenCL device")),
+  ARGPARSE_s_n (oPinWorkers, "pin-workers",
+                N_("bind the search threads to the CPUs")),
+  ARGPARSE_s_n (oNoSmt,   "no-smt",  N_("use one search thread per CPU core")),
+  ARGPARSE_s_u (oReseed,  "reseed-interval",
+                N_("|N|reseed the key generation every N KiB")),
+  ARGPARSE_s_s (oGovernor, "governor",
+                N_("|SCHEDULE|limit the workers by the hour of the day")),
+  ARGPARSE_s_u (oMaxTemp, "max-temperature",
+                N_("|N|slow down while the CPU is hotter than N C")),
+  ARGPARSE_s_u (oMemoryLimit, "memory-limit",
+                N_("|N|use at most N KiB for the search")),
+  ARGPARSE_s_u (oWorkerMemory, "worker-memory",
+                N_("|N|use at most N KiB for each worker")),
+  ARGPARSE_s_u (oHits,    "hits",    N_("|N|collect N keys")),
+  ARGPARSE_s_u (oBudget,  "budget",  N_("|N|stop after N seconds")),
+  ARGPARSE_s_s (oIterations, "iterations",
+                N_("|N|stop after N fingerprints")),
+  ARGPARSE_s_n (oEstimate, "estimate",
+                N_("only estimate the time the search takes")),
+  ARGPARSE_s_u (oNodes,   "nodes",
+                N_("|N|estimate also for N hosts")),
+  ARGPARSE_s_n (oWorker,  "worker",
+                N_("run as a worker of a coordinator")),
+  ARGPARSE_s_s (oGenCoordKey, "gen-coordinator-key",
+                N_("|FILE|create a coordinator key in FILE")),
+  ARGPARSE_s_s (oOpenHits, "open-hits",
+                N_("|FILE|import the hits of workers with the key in FILE")),
+  ARGPARSE_s_n (oFinalize, "finalize",
+                N_("make the OpenPGP keys of the stored vanity keys")),
+  ARGPARSE_s_s (oNameReal, "name-real",
+                N_("|NAME|use NAME for the user ID")),
+  ARGPARSE_s_s (oNameEmail, "name-email",
+                N_("|ADDR|use ADDR for the user ID")),
+  ARGPARSE_s_s (oNameComment, "name-comment", "@"),
+  ARGPARSE_s_s (oExpireDate, "expire-date",
+                N_("|ISO|let the key expire at ISO")),
+  ARGPARSE_s_s (oPassphraseFile, "passphrase-file",
+                N_("|FILE|protect the keys with the passphrase in FILE")),
+  ARGPARSE_s_n (oNoProtection, "no-protection",
+                N_("store the keys without a passphrase")),
+  ARGPARSE_s_n (oNoKeyblock, "no-keyblock",
+                N_("only import the keys into the agent")),
+  ARGPARSE_s_s (oOutput,  "output",
+                N_("|FILE|write the public keyblock to FILE")),
+  ARGPARSE_s_n (oArmor,   "armor",   N_("create ascii armored output")),
+  ARGPARSE_s_s (oHomedir, "homedir", "@"),
+  ARGPARSE_s_s (oAgentProgram, "agent-program", "@"),
+  ARGPARSE_s_s (oGpgProgram,   "gpg-program", "@"),
+
+  ARGPARSE_end ()
+};
+
+
+/* We keep all global options in the structure OPT.  */
+static struct
+{
+  int verbose;
+  int quiet;
+  const char *homedir;
+  const char *agent_program;
+  const char *gpg_program;
+  const char *curve;
+  const char *window;
+  int backward;
+  int autotune;
+  unsigned int workers;
+  int gpu;
+  unsigned int placement;
+  unsigned int reseed;
+  const char *governor;
+  unsigned int max_temperature;
+  unsigned long memory_limit;
+  unsigned long worker_memory;
+  unsigned int hits;
+  unsigned long budget;
+  unsigned long long iterations;
+  const char *name_real;
+  const char *name_email;
+  const char *name_comment;
+  const char *expire_date;
+  const char *passphrase_file;
+  int no_protection;
+  int no_keyblock;
+  int estimate;
+  unsigned int nodes;
+  int worker;
+  const char *gen_coordinator_key;
+  const char *open_hits;
+  int finalize;
+  const char *output;
+  int armor;
+} opt;
+
+
+/* A key to hand to the agent.  */
+struct found_key_s
+{
+  gcry_sexp_t s_private;
+  u32 created;              /* Its creation time.  */
+  unsigned char fpr[VANITY_FPR_LEN];
+  unsigned int match;       /* The index of the pattern item.  */
+  unsigned int score;
+};
+
+/* A key held by the agent of which gpg is to make an OpenPGP key.  */
+struct stored_key_s
+{
+  int algo;
+  u32 created;
+  char hexgrip[2*20+1];
+  char hexfpr[2*VANITY_FPR_LEN+1];
+};
+
+/* The longest line of the worker protocol.  */
+#define MAX_LINE_LEN 4096
+
+
+/* The parameters of the IMPORT_KEY inquiries.  */
+struct import_parm_s
+{
+  assuan_context_t ctx;
+  const void *key;          /* The wrapped key.  */
+  size_t keylen;
+  const char *passphrase;   /* NULL to let the agent ask.  */
+};
+
+
+
+static const char *
+my_strusage (int level)
+{
+  const char *p;
+
+  switch (level)
+    {
+    case 11: p = "@GPG@-vanity (@GNUPG@)";
+      break;
+    case 13: p = VERSION; break;
+    case 17: p = PRINTABLE_OS_NAME; break;
+    case 19: p = _("Please report bugs to <@EMAIL@>.\n"); break;
+
+    case 1:
+    case 40: p = _("Usage: @GPG@-vanity [options] PATTERN (-h for help)");
+      break;
+    case 41:
+      p = _("Syntax: @GPG@-vanity [options] PATTERN\n"
+            "Search for a key with a fingerprint matching PATTERN\n");
+      break;
+    case 31: p = "\nHome: "; break;
+    case 32: p = opt.homedir; break;
+    case 33: p = "\n"; break;
+
+    default: p = NULL; break;
+    }
+  return p;
+}
+
+
+/* Print the progress of the search.  */
+static gpg_error_t
+progress_cb (void *opaque, const struct vanity_progress_s *prog)
+{
+  (void)opaque;
+
+  if (!opt.quiet)
+    log_info ("%llu fingerprints in %lu s, %.0f keys/s, %.0f hashes/s,"
+              " eta %.0f s\n", prog->iterations, prog->elapsed,
+              prog->key_rate, prog->hash_rate, prog->eta);
+  if (!opt.quiet && prog->watts >= 0)
+    log_info ("%.1f W, %.1f keys/J, duty cycle %u%%\n",
+              prog->watts, prog->keys_per_joule, prog->duty);
+  return 0;
+}
+
+
+/* Read the passphrase from the first line of FNAME into secure
+   memory.  */
+static char *
+read_passphrase (const char *fname)
+{
+  estream_t fp;
+  char *buf;
+  size_t n;
+
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      log_error (_("can't open '%s': %s\n"), fname, strerror (errno));
+      return NULL;
+    }
+  buf = xmalloc_secure (101);
+  if (!es_fgets (buf, 101, fp))
+    *buf = 0;
+  es_fclose (fp);
+  n = strlen (buf);
+  while (n && (buf[n-1] == '\n' || buf[n-1] == '\r'))
+    buf[--n] = 0;
+  return buf;
+}
+
+
+/* Assuan data callback storing the data in the membuf OPAQUE.  */
+static gpg_error_t
+membuf_data_cb (void *opaque, const void *buffer, size_t length)
+{
+  membuf_t *data = opaque;
+
+  if (buffer)
+    put_membuf (data, buffer, length);
+  return 0;
+}
+
+
+/* Handle the inquiries of an IMPORT_KEY command.  */
+static gpg_error_t
+inq_import_key (void *opaque, const char *line)
+{
+  struct import_parm_s *parm = opaque;
+
+  if (has_leading_keyword (line, "KEYDATA"))
+    return assuan_send_data (parm->ctx, parm->key, parm->keylen);
+  if (parm->passphrase
+      && (has_leading_keyword (line, "NEW_PASSPHRASE")
+          || has_leading_keyword (line, "PASSPHRASE")))
+    return assuan_send_data (parm->ctx, parm->passphrase,
+                             strlen (parm->passphrase));
+  log_info ("ignoring gpg-agent inquiry '%s'\n", line);
+  return 0;
+}
+
+
+/* Hand the secret key S_PRIVATE to the agent at CTX, wrapped with
+   the key wrapping key KEK.  */
+static gpg_error_t
+import_key (assuan_context_t ctx, const void *kek, size_t keklen,
+            gcry_sexp_t s_private, const char *passphrase)
+{
+  gpg_error_t err;
+  gcry_cipher_hd_t cipherhd = NULL;
+  unsigned char *key = NULL;
+  unsigned char *wrappedkey = NULL;
+  size_t keylen, wrappedkeylen;
+  struct import_parm_s parm;
+
+  err = make_canon_sexp_pad (s_private, 1, &key, &keylen);
+  if (err)
+    goto leave;
+  err = gcry_cipher_open (&cipherhd, GCRY_CIPHER_AES128,
+                          GCRY_CIPHER_MODE_AESWRAP, 0);
+  if (!err)
+    err = gcry_cipher_setkey (cipherhd, kek, keklen);
+  if (err)
+    goto leave;
+  wrappedkeylen = keylen + 8;
+  wrappedkey = xtrymalloc (wrappedkeylen);
+  if (!wrappedkey)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = gcry_cipher_encrypt (cipherhd, wrappedkey, wrappedkeylen,
+                             key, keylen);
+  if (err)
+    goto leave;
+
+  parm.ctx = ctx;
+  parm.key = wrappedkey;
+  parm.keylen = wrappedkeylen;
+  parm.passphrase = passphrase;
+  err = assuan_transact (ctx, "IMPORT_KEY", NULL, NULL,
+                         inq_import_key, &parm, NULL, NULL);
+
+ leave:
+  xfree (wrappedkey);
+  xfree (key);
+  gcry_cipher_close (cipherhd);
+  return err;
+}
+
+
+/* Run gpg with the arguments ARGV and its stdin connected to INFD and
+   stdout to OUTFD.  */
+static gpg_error_t
+run_gpg (const char **argv, int infd, int outfd)
+{
+  gpg_error_t err;
+  const char *pgmname;
+  pid_t pid;
+  int exitcode;
+
+  pgmname = (opt.gpg_program && *opt.gpg_program)
+    ? opt.gpg_program : gnupg_module_name (GNUPG_MODULE_NAME_GPG);
+  if (opt.verbose)
+    log_info ("running '%s'\n", pgmname);
+  err = gnupg_spawn_process_fd (pgmname, argv, infd, outfd,
+                                log_get_fd (), &pid);
+  if (err)
+    {
+      log_error ("error running '%s': %s\n", pgmname, gpg_strerror (err));
+      return err;
+    }
+  err = gnupg_wait_process (pgmname, pid, 1, &exitcode);
+  gnupg_release_process (pid);
+  return err;
+}
+
+
+/* Let gpg make an OpenPGP key of each of the COUNT keys KEYS which
+   the agent now holds, all in one run and written to the keyring as
+   one transaction.  Then write their public keyblocks.  */
+static gpg_error_t
+make_keyblocks (const struct stored_key_s *keys, unsigned int count)
+{
+  gpg_error_t err;
+  estream_t fp;
+  const char **argv;
+  unsigned int idx;
+  int argc;
+
+  argv = xtrycalloc (count + 20, sizeof *argv);
+  if (!argv)
+    return gpg_error_from_syserror ();
+
+  /* The parameters contain no secrets, thus a temporary file is
+     fine.  */
+  fp = es_tmpfile ();
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (argv);
+      return err;
+    }
+  es_fputs ("%bulk\n", fp);
+  for (idx=0; idx < count; idx++)
+    {
+      es_fprintf (fp, "Key-Type: %s\n",
+                  keys[idx].algo == PUBKEY_ALGO_RSA? "RSA" :
+                  keys[idx].algo == PUBKEY_ALGO_EDDSA? "EdDSA" : "ECDSA");
+      es_fprintf (fp, "Key-Grip: %s\n", keys[idx].hexgrip);
+      es_fprintf (fp, "Creation-Date: seconds=%lu\n",
+                  (unsigned long)keys[idx].created);
+      if (opt.name_real)
+        es_fprintf (fp, "Name-Real: %s\n", opt.name_real);
+      if (opt.name_email)
+        es_fprintf (fp, "Name-Email: %s\n", opt.name_email);
+      if (opt.name_comment)
+        es_fprintf (fp, "Name-Comment: %s\n", opt.name_comment);
+      if (opt.expire_date)
+        es_fprintf (fp, "Expire-Date: %s\n", opt.expire_date);
+      es_fputs ("%commit\n", fp);
+    }
+  if (es_fflush (fp) || es_fseek (fp, 0, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  argc = 0;
+  if (opt.homedir)
+    {
+      argv[argc++] = "--homedir";
+      argv[argc++] = opt.homedir;
+    }
+  argv[argc++] = "--batch";
+  if (opt.passphrase_file)
+    {
+      argv[argc++] = "--pinentry-mode";
+      argv[argc++] = "loopback";
+      argv[argc++] = "--passphrase-file";
+      argv[argc++] = opt.passphrase_file;
+    }
+  argv[argc++] = "--gen-key";
+  argv[argc] = NULL;
+  err = run_gpg (argv, es_fileno (fp), -1);
+  if (err)
+    goto leave;
+
+  argc = 0;
+  if (opt.homedir)
+    {
+      argv[argc++] = "--homedir";
+      argv[argc++] = opt.homedir;
+    }
+  argv[argc++] = "--batch";
+  if (opt.armor)
+    argv[argc++] = "--armor";
+  if (opt.output)
+    {
+      argv[argc++] = "--output";
+      argv[argc++] = opt.output;
+    }
+  argv[argc++] = "--export";
+  for (idx=0; idx < count; idx++)
+    argv[argc++] = keys[idx].hexfpr;
+  argv[argc] = NULL;
+  err = run_gpg (argv, -1, es_fileno (es_stdout));
+
+ leave:
+  es_fclose (fp);
+  xfree (argv);
+  return err;
+}
+
+
+/* Connect to the agent and store the context at R_CTX.  */
+static gpg_error_t
+start_agent (assuan_context_t *r_ctx)
+{
+  gpg_error_t err;
+  session_env_t session_env;
+
+  session_env = session_env_new ();
+  if (!session_env)
+    log_fatal ("error allocating session environment block: %s\n",
+               strerror (errno));
+  err = start_new_gpg_agent (r_ctx, GPG_ERR_SOURCE_DEFAULT, opt.homedir,
+                             opt.agent_program, NULL, NULL, session_env,
+                             1, opt.verbose, 0, NULL, NULL);
+  session_env_release (session_env);
+  return err;
+}
+
+
+/* Hand the COUNT keys KEYS to the agent.  Then make the OpenPGP key
+   of the first one.  */
+static gpg_error_t
+store_keys (const struct found_key_s *keys, unsigned int count, int algo)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  membuf_t data;
+  void *kek;
+  size_t keklen;
+  char *passphrase = NULL;
+  unsigned char grip[20];
+  struct stored_key_s stored, first;
+  unsigned int idx;
+
+  if (opt.passphrase_file)
+    {
+      passphrase = read_passphrase (opt.passphrase_file);
+      if (!passphrase)
+        return gpg_error (GPG_ERR_NO_PASSPHRASE);
+    }
+  else if (opt.no_protection)
+    passphrase = xstrdup ("");
+
+  err = start_agent (&ctx);
+  if (err)
+    {
+      xfree (passphrase);
+      return err;
+    }
+
+  if (passphrase)
+    {
+      err = assuan_transact (ctx, "OPTION pinentry-mode=loopback",
+                             NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        {
+          log_error ("gpg-agent does not allow a loopback pinentry: %s\n",
+                     gpg_strerror (err));
+          goto leave;
+        }
+    }
+
+  init_membuf_secure (&data, 64);
+  err = assuan_transact (ctx, "KEYWRAP_KEY --import", membuf_data_cb, &data,
+                         NULL, NULL, NULL, NULL);
+  kek = get_membuf (&data, &keklen);
+  if (!err && !kek)
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      xfree (kek);
+      goto leave;
+    }
+
+  for (idx=0; idx < count && !err; idx++)
+    {
+      if (!gcry_pk_get_keygrip (keys[idx].s_private, grip))
+        err = gpg_error (GPG_ERR_INTERNAL);
+      else
+        err = import_key (ctx, kek, keklen, keys[idx].s_private, passphrase);
+      if (err)
+        {
+          log_error ("error importing the key into gpg-agent: %s\n",
+                     gpg_strerror (err));
+          break;
+        }
+      stored.algo = algo;
+      stored.created = keys[idx].created;
+      bin2hex (keys[idx].fpr, VANITY_FPR_LEN, stored.hexfpr);
+      bin2hex (grip, 20, stored.hexgrip);
+      if (!idx)
+        first = stored;
+      log_info ("key %s created %lu keygrip %s item %u score %u\n",
+                stored.hexfpr, (unsigned long)stored.created, stored.hexgrip,
+                keys[idx].match, keys[idx].score);
+    }
+  xfree (kek);
+
+  if (!err && !opt.no_keyblock)
+    err = make_keyblocks (&first, 1);
+
+ leave:
+  assuan_release (ctx);
+  xfree (passphrase);
+  return err;
+}
+
+
+/* Store the keys found by the last search of JOB at KEYS, which must
+   provide space for VANITY_MAX_HITS entries; the first one, already
+   taken from JOB, is S_PRIVATE.  Returns the number of keys.  */
+static unsigned int
+take_keys (vanity_job_t job, gcry_sexp_t s_private, struct found_key_s *keys)
+{
+  gcry_sexp_t s_pub;
+  unsigned int idx, count;
+
+  count = vanity_get_hit_count (job);
+  if (!count)
+    count = 1;
+  keys[0].s_private = s_private;
+  keys[0].created = vanity_get_timestamp (job);
+  vanity_get_fingerprint (job, keys[0].fpr);
+  keys[0].match = vanity_get_match (job);
+  keys[0].score = vanity_get_score (job, 0);
+  for (idx=1; idx < count; idx++)
+    {
+      if (vanity_take_hit (job, idx, &keys[idx].s_private, &s_pub,
+                           &keys[idx].created, keys[idx].fpr,
+                           &keys[idx].match))
+        break;
+      gcry_sexp_release (s_pub);
+      keys[idx].score = vanity_get_score (job, idx);
+    }
+  return idx;
+}
+
+
+/* Release the private keys of the COUNT keys KEYS.  */
+static void
+release_keys (struct found_key_s *keys, unsigned int count)
+{
+  unsigned int idx;
+
+  for (idx=0; idx < count; idx++)
+    {
+      gcry_sexp_release (keys[idx].s_private);
+      keys[idx].s_private = NULL;
+    }
+}
+
+
+/* Decode the hex string HEX into a new buffer stored at R_BUFFER and
+   its length at R_BUFLEN.  */
+static gpg_error_t
+buffer_from_hex (const char *hex, unsigned char **r_buffer, size_t *r_buflen)
+{
+  size_t len = strlen (hex);
+
+  *r_buffer = NULL;
+  *r_buflen = 0;
+  if (!len || len % 2)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  *r_buffer = xtrymalloc (len / 2);
+  if (!*r_buffer)
+    return gpg_error_from_syserror ();
+  if (hex2bin (hex, *r_buffer, len / 2) < 0)
+    {
+      xfree (*r_buffer);
+      *r_buffer = NULL;
+      return gpg_error (GPG_ERR_INV_VALUE);
+    }
+  *r_buflen = len / 2;
+  return 0;
+}
+
+
+/* Write the line of the worker protocol given by FORMAT to stdout
+   right away.  */
+static void
+put_record (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  va_start (arg_ptr, format);
+  es_vfprintf (es_stdout, format, arg_ptr);
+  va_end (arg_ptr);
+  es_fflush (es_stdout);
+}
+
+
+/* Read a line of the worker protocol from stdin into *R_LINE of size
+   *R_LINESIZE with leading and trailing spaces removed.  Empty lines
+   and comments are skipped.  Returns false at the end of the
+   input.  */
+static int
+get_record (char **r_line, size_t *r_linesize)
+{
+  size_t maxlen;
+  ssize_t len;
+
+  for (;;)
+    {
+      maxlen = MAX_LINE_LEN;
+      len = es_read_line (es_stdin, r_line, r_linesize, &maxlen);
+      if (len <= 0)
+        return 0;
+      if (!maxlen)
+        {
+          log_error ("line too long - skipped\n");
+          continue;
+        }
+      trim_spaces (*r_line);
+      if (**r_line && **r_line != '#')
+        return 1;
+    }
+}
+
+
+/* Split the first word off the line S and return the rest of it.  */
+static char *
+next_word (char *s)
+{
+  while (*s && !spacep (s))
+    s++;
+  if (*s)
+    *s++ = 0;
+  while (spacep (s))
+    s++;
+  return s;
+}
+
+
+/* Read the job descriptor of the worker mode from stdin into OPT and
+   store the pattern at R_PATTERN and the coordinator key at
+   R_RECIPIENT.  */
+static gpg_error_t
+read_descriptor (char **r_pattern, gcry_sexp_t *r_recipient)
+{
+  gpg_error_t err = 0;
+  char *line = NULL;
+  size_t linesize = 0;
+  unsigned char *buf;
+  size_t buflen;
+  char *value;
+
+  *r_pattern = NULL;
+  *r_recipient = NULL;
+
+  while (!err)
+    {
+      if (!get_record (&line, &linesize))
+        {
+          log_error ("the job descriptor ends before \"start\"\n");
+          err = gpg_error (GPG_ERR_NO_DATA);
+          break;
+        }
+      value = next_word (line);
+      if (!strcmp (line, "start"))
+        break;
+      else if (!strcmp (line, "pattern"))
+        {
+          xfree (*r_pattern);
+          *r_pattern = xstrdup (value);
+        }
+      else if (!strcmp (line, "recipient"))
+        {
+          gcry_sexp_release (*r_recipient);
+          *r_recipient = NULL;
+          err = buffer_from_hex (value, &buf, &buflen);
+          if (!err)
+            {
+              err = gcry_sexp_sscan (r_recipient, NULL, (char *)buf, buflen);
+              xfree (buf);
+            }
+          if (err)
+            log_error ("invalid coordinator key: %s\n", gpg_strerror (err));
+        }
+      else if (!strcmp (line, "curve"))
+        opt.curve = xstrdup (value);
+      else if (!strcmp (line, "window"))
+        opt.window = xstrdup (value);
+      else if (!strcmp (line, "backward"))
+        opt.backward = 1;
+      else if (!strcmp (line, "autotune"))
+        opt.autotune = 1;
+      else if (!strcmp (line, "gpu"))
+        opt.gpu = 1;
+      else if (!strcmp (line, "hits"))
+        opt.hits = strtoul (value, NULL, 10);
+      else if (!strcmp (line, "workers"))
+        opt.workers = strtoul (value, NULL, 10);
+      else
+        {
+          log_error ("unknown keyword '%s' in the job descriptor\n", line);
+          err = gpg_error (GPG_ERR_UNKNOWN_OPTION);
+        }
+    }
+  es_free (line);
+  if (!err && (!*r_pattern || !*r_recipient))
+    {
+      log_error ("the job descriptor needs a pattern and a recipient\n");
+      err = gpg_error (GPG_ERR_MISSING_VALUE);
+    }
+  if (err)
+    {
+      xfree (*r_pattern);
+      *r_pattern = NULL;
+      gcry_sexp_release (*r_recipient);
+      *r_recipient = NULL;
+    }
+  return err;
+}
+
+
+/* The state of the worker mode.  */
+struct worker_parm_s
+{
+  gcry_sexp_t s_recipient;  /* The key of the coordinator.  */
+  const char *assignment;   /* The ID of the running assignment.  */
+};
+
+
+/* Report the progress of the search as a worker record.  */
+static gpg_error_t
+worker_progress_cb (void *opaque, const struct vanity_progress_s *prog)
+{
+  struct worker_parm_s *parm = opaque;
+
+  put_record ("progress %s %llu %llu %lu %.0f\n", parm->assignment,
+              prog->iterations, prog->keys, prog->elapsed, prog->hash_rate);
+  return 0;
+}
+
+
+/* Write the hit record for KEY, sealed to the coordinator.  */
+static gpg_error_t
+put_hit (struct worker_parm_s *parm, const struct found_key_s *key)
+{
+  gpg_error_t err;
+  unsigned char *sealed;
+  size_t sealedlen;
+  char hexfpr[2*VANITY_FPR_LEN+1];
+  char *hexsealed;
+
+  err = vanity_seal_key (parm->s_recipient, key->s_private,
+                         &sealed, &sealedlen);
+  if (err)
+    {
+      log_error ("error sealing a key: %s\n", gpg_strerror (err));
+      return err;
+    }
+  hexsealed = bin2hex (sealed, sealedlen, NULL);
+  xfree (sealed);
+  if (!hexsealed)
+    return gpg_error_from_syserror ();
+  bin2hex (key->fpr, VANITY_FPR_LEN, hexfpr);
+  put_record ("hit %s %s %lu %u %u %s\n", parm->assignment, hexfpr,
+              (unsigned long)key->created, key->match, key->score,
+              hexsealed);
+  xfree (hexsealed);
+  return 0;
+}
+
+
+/* Run the assignments read from stdin with JOB and write the records
+   of the worker protocol for the coordinator key S_RECIPIENT.  */
+static gpg_error_t
+run_worker (vanity_job_t job, gcry_sexp_t s_recipient)
+{
+  gpg_error_t err = 0;
+  struct worker_parm_s parm;
+  struct found_key_s keys[VANITY_MAX_HITS];
+  gcry_sexp_t s_private, s_public;
+  char *line = NULL;
+  size_t linesize = 0;
+  char *id, *p;
+  unsigned long long iterations;
+  unsigned long seconds;
+  unsigned int i, count, nhits;
+
+  parm.s_recipient = s_recipient;
+  parm.assignment = "-";
+  vanity_set_progress (job, worker_progress_cb, &parm);
+  put_record ("ready\n");
+
+  while (get_record (&line, &linesize))
+    {
+      p = next_word (line);
+      if (!strcmp (line, "quit"))
+        break;
+      if (strcmp (line, "assign"))
+        {
+          log_error ("unknown worker command '%s'\n", line);
+          continue;
+        }
+      id = p;
+      p = next_word (p);
+      iterations = strtoull (p, &p, 10);
+      seconds = strtoul (p, NULL, 10);
+      if (!*id)
+        {
+          log_error ("assignment without an ID\n");
+          continue;
+        }
+
+      parm.assignment = id;
+      vanity_set_max_iterations (job, iterations);
+      vanity_set_hits (job, opt.hits, seconds);
+      err = vanity_search (job, &s_private, &s_public);
+      nhits = 0;
+      if (!err)
+        {
+          gcry_sexp_release (s_public);
+          count = take_keys (job, s_private, keys);
+          for (i=0; i < count && !err; i++)
+            if (!(err = put_hit (&parm, keys + i)))
+              nhits++;
+          release_keys (keys, count);
+        }
+      /* An assignment used up without a match is not an error.  */
+      if (gpg_err_code (err) == GPG_ERR_TIMEOUT
+          || gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+        err = 0;
+      else if (err)
+        log_error ("assignment %s failed: %s\n", id, gpg_strerror (err));
+      put_record ("done %s %llu %u %u\n", id, vanity_get_iterations (job),
+                  nhits, gpg_err_code (err));
+      parm.assignment = "-";
+    }
+  es_free (line);
+  return err;
+}
+
+
+/* Create a coordinator key, write it to the new file FNAME and print
+   the matching descriptor line.  */
+static gpg_error_t
+gen_coordinator_key (const char *fname)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_parms, s_key, s_private = NULL, s_public = NULL;
+  estream_t fp;
+  unsigned char *buf = NULL;
+  char *hex;
+  size_t len;
+
+  err = gcry_sexp_build (&s_parms, NULL, "(genkey(ecc(curve nistp256)))");
+  if (err)
+    return err;
+  err = gcry_pk_genkey (&s_key, s_parms);
+  gcry_sexp_release (s_parms);
+  if (err)
+    return err;
+  s_private = gcry_sexp_find_token (s_key, "private-key", 0);
+  s_public = gcry_sexp_find_token (s_key, "public-key", 0);
+  gcry_sexp_release (s_key);
+  if (!s_private || !s_public)
+    {
+      err = gpg_error (GPG_ERR_INTERNAL);
+      goto leave;
+    }
+
+  len = gcry_sexp_sprint (s_private, GCRYSEXP_FMT_CANON, NULL, 0);
+  buf = xtrymalloc_secure (len);
+  if (!buf)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  len = gcry_sexp_sprint (s_private, GCRYSEXP_FMT_CANON, buf, len);
+  fp = es_fopen (fname, "wbx,mode=-rw");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("can't create '%s': %s\n"), fname, gpg_strerror (err));
+      goto leave;
+    }
+  if (es_fwrite (buf, len, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      log_error (_("error writing '%s': %s\n"), fname, gpg_strerror (err));
+      goto leave;
+    }
+
+  len = gcry_sexp_sprint (s_public, GCRYSEXP_FMT_CANON, NULL, 0);
+  wipememory (buf, len);
+  xfree (buf);
+  buf = xtrymalloc (len);
+  if (!buf)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  len = gcry_sexp_sprint (s_public, GCRYSEXP_FMT_CANON, buf, len);
+  hex = bin2hex (buf, len, NULL);
+  if (!hex)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  es_printf ("recipient %s\n", hex);
+  xfree (hex);
+
+ leave:
+  xfree (buf);
+  gcry_sexp_release (s_private);
+  gcry_sexp_release (s_public);
+  return err;
+}
+
+
+/* Read the coordinator key from FNAME into R_SECKEY.  */
+static gpg_error_t
+read_coordinator_key (const char *fname, gcry_sexp_t *r_seckey)
+{
+  gpg_error_t err;
+  estream_t fp;
+  unsigned char *buf;
+  size_t len;
+
+  *r_seckey = NULL;
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("can't open '%s': %s\n"), fname, gpg_strerror (err));
+      return err;
+    }
+  buf = xmalloc_secure (MAX_LINE_LEN);
+  if (es_read (fp, buf, MAX_LINE_LEN, &len))
+    err = gpg_error_from_syserror ();
+  else if (!(len = gcry_sexp_canon_len (buf, len, NULL, NULL)))
+    err = gpg_error (GPG_ERR_INV_SEXP);
+  else
+    err = gcry_sexp_sscan (r_seckey, NULL, (char *)buf, len);
+  es_fclose (fp);
+  wipememory (buf, MAX_LINE_LEN);
+  xfree (buf);
+  if (err)
+    log_error ("error reading the coordinator key '%s': %s\n",
+               fname, gpg_strerror (err));
+  return err;
+}
+
+
+/* Open the hit records of workers read from stdin with the
+   coordinator key in FNAME and hand their keys of ALGO to the agent.
+   All other lines of the worker output are ignored.  */
+static gpg_error_t
+open_hits (const char *fname, int algo)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_seckey;
+  struct found_key_s keys[VANITY_MAX_HITS];
+  unsigned int count = 0;
+  char *line = NULL;
+  size_t linesize = 0;
+  char *id, *fpr, *created, *match, *score, *hex, *p;
+  unsigned char *sealed;
+  size_t sealedlen;
+
+  err = read_coordinator_key (fname, &s_seckey);
+  if (err)
+    return err;
+
+  while (get_record (&line, &linesize))
+    {
+      p = next_word (line);
+      if (strcmp (line, "hit"))
+        continue;
+      id = p;
+      fpr = next_word (id);
+      created = next_word (fpr);
+      match = next_word (created);
+      score = next_word (match);
+      hex = next_word (score);
+      next_word (hex);
+      if (count == VANITY_MAX_HITS)
+        {
+          log_info ("ignoring more than %d hits\n", VANITY_MAX_HITS);
+          break;
+        }
+      if (hex2bin (fpr, keys[count].fpr, VANITY_FPR_LEN) < 0
+          || buffer_from_hex (hex, &sealed, &sealedlen))
+        {
+          log_error ("invalid hit record of assignment %s\n", id);
+          continue;
+        }
+      err = vanity_open_key (s_seckey, sealed, sealedlen,
+                             &keys[count].s_private);
+      xfree (sealed);
+      if (err)
+        {
+          log_error ("can't open the hit of assignment %s: %s\n",
+                     id, gpg_strerror (err));
+          err = 0;
+          continue;
+        }
+      keys[count].created = strtoul (created, NULL, 10);
+      keys[count].match = strtoul (match, NULL, 10);
+      keys[count].score = strtoul (score, NULL, 10);
+      count++;
+    }
+  es_free (line);
+  gcry_sexp_release (s_seckey);
+
+  if (!count)
+    {
+      log_error ("no hits to import\n");
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+  err = store_keys (keys, count, algo);
+  release_keys (keys, count);
+  return err;
+}
+
+
+/* The parameters of the status callback of VANITY_RESULTS.  */
+struct finalize_parm_s
+{
+  char **jobids;              /* The jobs to take, NULL for all.  */
+  int njobids;
+  struct stored_key_s *keys;  /* The keys collected.  */
+  unsigned int count;
+  unsigned int size;          /* The allocated number of KEYS.  */
+};
+
+
+/* Assuan status callback collecting the VANITY_RESULT lines of the
+   jobs listed in the finalize_parm_s OPAQUE.  */
+static gpg_error_t
+result_status_cb (void *opaque, const char *line)
+{
+  struct finalize_parm_s *parm = opaque;
+  struct stored_key_s *key;
+  char *buf, *jobid, *created, *fpr, *grip, *p;
+  gpg_error_t err = 0;
+  int i;
+
+  p = has_leading_keyword (line, "VANITY_RESULT");
+  if (!p)
+    return 0;
+  buf = xtrystrdup (p);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  jobid = buf;
+  created = next_word (jobid);
+  fpr = next_word (created);
+  grip = next_word (fpr);
+  next_word (grip);
+
+  for (i=0; i < parm->njobids; i++)
+    if (!ascii_strcasecmp (parm->jobids[i], jobid))
+      break;
+  if (parm->njobids && i == parm->njobids)
+    goto leave;
+  if (strlen (fpr) != 2*VANITY_FPR_LEN || strlen (grip) != 2*20)
+    {
+      log_error ("invalid vanity result for job %s\n", jobid);
+      goto leave;
+    }
+  if (parm->count == parm->size)
+    {
+      key = xtryrealloc (parm->keys, (parm->size + 64) * sizeof *key);
+      if (!key)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      parm->keys = key;
+      parm->size += 64;
+    }
+  key = parm->keys + parm->count++;
+  key->algo = 0;
+  key->created = strtoul (created, NULL, 10);
+  strcpy (key->hexfpr, fpr);
+  strcpy (key->hexgrip, grip);
+
+ leave:
+  xfree (buf);
+  return err;
+}
+
+
+/* Ask the agent at CTX for the public key with the keygrip HEXGRIP
+   and store its OpenPGP algorithm at R_ALGO.  */
+static gpg_error_t
+get_key_algo (assuan_context_t ctx, const char *hexgrip, int *r_algo)
+{
+  gpg_error_t err;
+  membuf_t data;
+  gcry_sexp_t s_key, l1;
+  char line[ASSUAN_LINELENGTH];
+  unsigned char *buf;
+  size_t buflen;
+  char *curve;
+
+  *r_algo = 0;
+  init_membuf (&data, 256);
+  snprintf (line, sizeof line, "READKEY %s", hexgrip);
+  err = assuan_transact (ctx, line, membuf_data_cb, &data,
+                         NULL, NULL, NULL, NULL);
+  buf = get_membuf (&data, &buflen);
+  if (!err && !buf)
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = gcry_sexp_sscan (&s_key, NULL, (char *)buf, buflen);
+  xfree (buf);
+  if (err)
+    return err;
+
+  if ((l1 = gcry_sexp_find_token (s_key, "rsa", 0)))
+    *r_algo = PUBKEY_ALGO_RSA;
+  else if ((l1 = gcry_sexp_find_token (s_key, "curve", 0)))
+    {
+      curve = gcry_sexp_nth_string (l1, 1);
+      if (!curve)
+        err = gpg_error (GPG_ERR_INV_SEXP);
+      else if (!ascii_strcasecmp (curve, "Ed25519"))
+        *r_algo = PUBKEY_ALGO_EDDSA;
+      else
+        *r_algo = PUBKEY_ALGO_ECDSA;
+      xfree (curve);
+    }
+  else
+    err = gpg_error (GPG_ERR_PUBKEY_ALGO);
+  gcry_sexp_release (l1);
+  gcry_sexp_release (s_key);
+  return err;
+}
+
+
+/* Make the OpenPGP keys of the keys in the result store of the agent
+   found by the NJOBIDS jobs JOBIDS, or of all if there are none, with
+   one run of gpg.  Their results are then removed from the store so
+   that a second run does not make them again.  */
+static gpg_error_t
+finalize_keys (char **jobids, int njobids)
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  struct finalize_parm_s parm;
+  char line[ASSUAN_LINELENGTH];
+  unsigned int idx, n;
+
+  err = start_agent (&ctx);
+  if (err)
+    return err;
+
+  memset (&parm, 0, sizeof parm);
+  parm.jobids = jobids;
+  parm.njobids = njobids;
+  err = assuan_transact (ctx, "VANITY_RESULTS", NULL, NULL, NULL, NULL,
+                         result_status_cb, &parm);
+  if (err)
+    {
+      log_error ("error listing the vanity results: %s\n",
+                 gpg_strerror (err));
+      goto leave;
+    }
+
+  /* Keys whose secret part is gone can't be made.  */
+  for (idx=n=0; idx < parm.count; idx++)
+    {
+      err = get_key_algo (ctx, parm.keys[idx].hexgrip, &parm.keys[idx].algo);
+      if (err)
+        {
+          log_error ("skipping key %s: %s\n",
+                     parm.keys[idx].hexfpr, gpg_strerror (err));
+          err = 0;
+          continue;
+        }
+      parm.keys[n++] = parm.keys[idx];
+    }
+  if (!n)
+    {
+      log_error ("no stored vanity keys to finalize\n");
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+  if (!opt.quiet)
+    log_info ("making %u OpenPGP keys\n", n);
+
+  err = make_keyblocks (parm.keys, n);
+  if (err)
+    {
+      log_error ("making the OpenPGP keys failed: %s\n", gpg_strerror (err));
+      log_info ("the keys are kept in the result store\n");
+      goto leave;
+    }
+  for (idx=0; idx < n; idx++)
+    {
+      snprintf (line, sizeof line, "VANITY_RESULTS --delete=%s",
+                parm.keys[idx].hexfpr);
+      err = assuan_transact (ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        {
+          log_error ("error removing the vanity result %s: %s\n",
+                     parm.keys[idx].hexfpr, gpg_strerror (err));
+          break;
+        }
+    }
+
+ leave:
+  xfree (parm.keys);
+  assuan_release (ctx);
+  return err;
+}
+
+
+/* Format the duration of SECONDS into BUFFER of size BUFSIZE.  */
+static const char *
+format_duration (double seconds, char *buffer, size_t bufsize)
+{
+  static struct { const char *unit; double seconds; } units[] = {
+    { "years", 365.25 * 86400 }, { "days", 86400 }, { "hours", 3600 },
+    { "minutes", 60 }
+  };
+  int i;
+
+  if (seconds < 0)
+    return "never";
+  for (i=0; i < DIM (units); i++)
+    if (seconds >= 2 * units[i].seconds)
+      {
+        snprintf (buffer, bufsize, "%.0f s (%.1f %s)", seconds,
+                  seconds / units[i].seconds, units[i].unit);
+        return buffer;
+      }
+  snprintf (buffer, bufsize, "%.1f s", seconds);
+  return buffer;
+}
+
+
+/* Print the times of the estimate EST for NODES hosts.  */
+static void
+print_estimate_times (const struct vanity_estimate_s *est,
+                      unsigned int nodes)
+{
+  char buf1[50], buf2[50];
+
+  es_printf ("%u host%s: %u key%s expected after %s, 90%% within %s\n",
+             nodes, nodes == 1? "" : "s",
+             est->hits, est->hits == 1? "" : "s",
+             format_duration (est->expected / nodes, buf1, sizeof buf1),
+             format_duration (est->p90 / nodes, buf2, sizeof buf2));
+}
+
+
+/* Print the estimate EST for one host and for --nodes hosts.  */
+static void
+print_estimate (const struct vanity_estimate_s *est)
+{
+  es_printf ("calibration: %.1f s, %llu fingerprints, %llu keys,"
+             " %lu matches\n",
+             est->seconds, est->iterations, est->keys, est->found);
+  es_printf ("rate: %.0f fingerprints/s, %.0f keys/s\n",
+             est->hash_rate, est->key_rate);
+  if (est->watts >= 0)
+    es_printf ("power: %.1f W, %.1f keys/J\n",
+               est->watts, est->keys_per_joule);
+  if (est->expected < 0)
+    {
+      es_printf ("no time estimate for this pattern\n");
+      return;
+    }
+  es_printf ("probability: %.6g per fingerprint\n", est->probability);
+  print_estimate_times (est, 1);
+  if (opt.nodes > 1)
+    print_estimate_times (est, opt.nodes);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  ARGPARSE_ARGS pargs;
+  gpg_error_t err;
+  vanity_job_t job;
+  struct vanity_estimate_s est;
+  struct vanity_verify_s verify;
+  struct vanity_memory_s memory;
+  gcry_sexp_t s_keyparam, s_private, s_public;
+  gcry_sexp_t s_recipient = NULL;
+  struct found_key_s keys[VANITY_MAX_HITS];
+  unsigned int nkeys;
+  char *pattern;
+  size_t n;
+  int i, algo;
+
+  early_system_init ();
+  set_strusage (my_strusage);
+  log_set_prefix (PGM, 1);
+
+  /* Make sure that our subsystems are ready.  */
+  i18n_init();
+  init_common_subsystems (&argc, &argv);
+  npth_init ();
+  assuan_set_gpg_err_source (GPG_ERR_SOURCE_DEFAULT);
+
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION) )
+    {
+      log_fatal (_("%s is too old (need %s, have %s)\n"), "libgcrypt",
+                 NEED_LIBGCRYPT_VERSION, gcry_check_version (NULL) );
+    }
+  gcry_control (GCRYCTL_INIT_SECMEM, 65536, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  opt.homedir = default_homedir ();
+  opt.curve = DEFAULT_CURVE;
+  opt.hits = 1;
+
+  pargs.argc  = &argc;
+  pargs.argv  = &argv;
+  pargs.flags =  1;  /* Do not remove the args.  */
+  while (arg_parse (&pargs, opts))
+    {
+      switch (pargs.r_opt)
+        {
+        case oQuiet:     opt.quiet = 1; break;
+        case oVerbose:   opt.verbose++; break;
+        case oNoVerbose: opt.verbose = 0; break;
+        case oHomedir:   opt.homedir = pargs.r.ret_str; break;
+        case oAgentProgram: opt.agent_program = pargs.r.ret_str; break;
+        case oGpgProgram: opt.gpg_program = pargs.r.ret_str; break;
+        case oCurve:     opt.curve = pargs.r.ret_str; break;
+        case oWindow:    opt.window = pargs.r.ret_str; break;
+        case oBackward:  opt.backward = 1; break;
+        case oAutotune:  opt.autotune = 1; break;
+        case oWorkers:   opt.workers = pargs.r.ret_ulong; break;
+        case oGpu:       opt.gpu = 1; break;
+        case oPinWorkers: opt.placement |= VANITY_PLACE_PIN; break;
+        case oNoSmt:     opt.placement |= VANITY_PLACE_NO_SMT; break;
+        case oReseed:    opt.reseed = pargs.r.ret_ulong; break;
+        case oGovernor:  opt.governor = pargs.r.ret_str; break;
+        case oMaxTemp:   opt.max_temperature = pargs.r.ret_ulong; break;
+        case oMemoryLimit: opt.memory_limit = pargs.r.ret_ulong; break;
+        case oWorkerMemory: opt.worker_memory = pargs.r.ret_ulong; break;
+        case oHits:      opt.hits = pargs.r.ret_ulong; break;
+        case oBudget:    opt.budget = pargs.r.ret_ulong; break;
+        case oIterations:
+          opt.iterations = strtoull (pargs.r.ret_str, NULL, 10);
+          break;
+        case oNameReal:  opt.name_real = pargs.r.ret_str; break;
+        case oNameEmail: opt.name_email = pargs.r.ret_str; break;
+        case oNameComment: opt.name_comment = pargs.r.ret_str; break;
+        case oExpireDate: opt.expire_date = pargs.r.ret_str; break;
+        case oPassphraseFile: opt.passphrase_file = pargs.r.ret_str; break;
+        case oNoProtection: opt.no_protection = 1; break;
+        case oNoKeyblock: opt.no_keyblock = 1; break;
+        case oEstimate:  opt.estimate = 1; break;
+        case oNodes:     opt.nodes = pargs.r.ret_ulong; break;
+        case oOutput:    opt.output = pargs.r.ret_str; break;
+        case oArmor:     opt.armor = 1; break;
+        case oWorker:    opt.worker = 1; break;
+        case oGenCoordKey: opt.gen_coordinator_key = pargs.r.ret_str; break;
+        case oOpenHits:  opt.open_hits = pargs.r.ret_str; break;
+        case oFinalize:  opt.finalize = 1; break;
+
+        default: pargs.err = 2; break;
+	}
+    }
+  if (log_get_errorcount (0))
+    exit (2);
+
+  if (opt.gen_coordinator_key)
+    {
+      err = gen_coordinator_key (opt.gen_coordinator_key);
+      if (err)
+        log_error ("error creating the coordinator key: %s\n",
+                   gpg_strerror (err));
+      return err? 1 : 0;
+    }
+
+  if (opt.worker)
+    {
+      if (argc)
+        usage (1);
+      if (read_descriptor (&pattern, &s_recipient))
+        exit (2);
+    }
+  else if (!argc && !opt.open_hits && !opt.finalize)
+    usage (1);
+  if (opt.finalize && opt.no_keyblock)
+    {
+      log_error ("--finalize can't be used with --no-keyblock\n");
+      exit (2);
+    }
+  if (!opt.worker && !opt.estimate && !opt.no_keyblock
+      && !opt.name_real && !opt.name_email)
+    {
+      log_error ("a user ID is required; use --name-real or --name-email\n");
+      exit (2);
+    }
+  if (opt.hits > VANITY_MAX_HITS)
+    {
+      log_error ("at most %d keys can be collected\n", VANITY_MAX_HITS);
+      exit (2);
+    }
+
+  /* The remaining arguments are the IDs of the jobs to finalize.  */
+  if (opt.finalize)
+    {
+      err = finalize_keys (argv, argc);
+      return err? 1 : 0;
+    }
+
+  algo = (!ascii_strcasecmp (opt.curve, "Ed25519")
+          ? PUBKEY_ALGO_EDDSA : PUBKEY_ALGO_ECDSA);
+
+  if (opt.open_hits)
+    {
+      err = open_hits (opt.open_hits, algo);
+      return err? 1 : 0;
+    }
+
+  /* The remaining arguments are the items of the pattern.  */
+  if (!opt.worker)
+    {
+      for (n=i=0; i < argc; i++)
+        n += strlen (argv[i]) + 1;
+      pattern = xmalloc (n);
+      *pattern = 0;
+      for (i=0; i < argc; i++)
+        {
+          if (i)
+            strcat (pattern, " ");
+          strcat (pattern, argv[i]);
+        }
+    }
+  if (algo == PUBKEY_ALGO_EDDSA)
+    err = gcry_sexp_build (&s_keyparam, NULL,
+                           "(genkey(ecc(curve %s)(flags eddsa comp)))",
+                           opt.curve);
+  else
+    err = gcry_sexp_build (&s_keyparam, NULL,
+                           "(genkey(ecc(curve %s)(flags nocomp)))",
+                           opt.curve);
+  if (err)
+    log_fatal ("error building the key parameters: %s\n", gpg_strerror (err));
+
+  err = vanity_job_new (&job, s_keyparam, algo, make_timestamp ());
+  if (err)
+    {
+      log_error ("can't search keys on curve '%s': %s\n",
+                 opt.curve, gpg_strerror (err));
+      exit (2);
+    }
+  vanity_set_workers (job, opt.workers);
+  vanity_set_gpu (job, opt.gpu);
+  vanity_set_reseed_interval (job, opt.reseed);
+  vanity_set_temperature_limit (job, opt.max_temperature);
+  vanity_set_memory_limit (job, (size_t)opt.memory_limit * 1024,
+                           (size_t)opt.worker_memory * 1024);
+  vanity_set_placement (job, opt.placement);
+  vanity_set_hits (job, opt.hits, opt.budget);
+  vanity_set_max_iterations (job, opt.iterations);
+  vanity_set_progress (job, progress_cb, NULL);
+  vanity_set_backward (job, opt.backward);
+  vanity_set_autotune (job, opt.autotune);
+  err = vanity_set_pattern (job, pattern);
+  if (err)
+    log_error ("invalid vanity pattern '%s'\n", pattern);
+  else if (opt.window && (err = vanity_set_windows (job, opt.window)))
+    log_error ("invalid vanity window '%s'\n", opt.window);
+  else if (opt.governor && (err = vanity_set_governor (job, opt.governor)))
+    log_error ("invalid governor schedule '%s'\n", opt.governor);
+  if (!err && opt.worker)
+    err = run_worker (job, s_recipient);
+  else if (!err && opt.estimate)
+    {
+      err = vanity_estimate (job, opt.budget, &est);
+      if (err)
+        log_error ("vanity estimate failed: %s\n", gpg_strerror (err));
+      else
+        print_estimate (&est);
+    }
+  else if (!err)
+    {
+      err = vanity_search (job, &s_private, &s_public);
+      if (err)
+        log_error ("vanity search failed: %s\n", gpg_strerror (err));
+    }
+  if (!err && !opt.estimate && !opt.worker)
+    {
+      if (!opt.quiet)
+        log_info ("found a key after %llu fingerprints\n",
+                  vanity_get_iterations (job));
+      gcry_sexp_release (s_public);
+      nkeys = take_keys (job, s_private, keys);
+      err = store_keys (keys, nkeys, algo);
+      release_keys (keys, nkeys);
+    }
+  if (opt.verbose)
+    {
+      vanity_get_memory (job, &memory);
+      if (memory.nworkers)
+        log_info ("memory: %lu KiB in total, %lu KiB for each of %u"
+                  " workers, %lu KiB for the pattern, %lu KiB locked\n",
+                  (unsigned long)(memory.total / 1024),
+                  (unsigned long)(memory.per_worker / 1024),
+                  memory.nworkers, (unsigned long)(memory.pattern / 1024),
+                  (unsigned long)(memory.arenas / 1024));
+    }
+  if (opt.verbose && !opt.estimate)
+    {
+      vanity_get_verify (job, &verify);
+      for (i=0; i < VANITY_NPATHS; i++)
+        if (verify.checked[i] || verify.rejected[i])
+          log_info ("%s path: %u keys confirmed, %u refuted%s\n",
+                    vanity_path_name (i), verify.checked[i],
+                    verify.rejected[i],
+                    (verify.quarantined & (1 << i))? ", quarantined" : "");
+    }
+
+  vanity_job_release (job);
+  gcry_sexp_release (s_keyparam);
+  gcry_sexp_release (s_recipient);
+  xfree (pattern);
+  return err? 1 : 0;
+}
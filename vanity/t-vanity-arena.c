@@ -0,0 +1,113 @@
+/* t-vanity-arena.c - Module test for vanity-arena.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+#define NSLOTS 5
+#define SLOTLEN 100
+
+
+/* Take all slots, check that they are distinct and cleared, and
+   hand them back.  */
+static void
+test_arena (void)
+{
+  gpg_error_t err;
+  vanity_arena_t arena;
+  unsigned char *slot[NSLOTS], *p;
+  int i, j, k;
+
+  err = _vanity_arena_new (&arena, SLOTLEN, NSLOTS);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    return;
+  if (err)
+    {
+      /* mlock may be limited; that is not a failure of the code.  */
+      fprintf (stderr, "skipping arena test: %s\n", gpg_strerror (err));
+      return;
+    }
+
+  for (k=0; k < 2; k++)
+    {
+      for (i=0; i < NSLOTS; i++)
+        {
+          slot[i] = _vanity_arena_get (arena);
+          if (!slot[i])
+            fail (100 * k + i);
+          for (j=0; j < SLOTLEN; j++)
+            if (slot[i][j])
+              fail (100 * k + 10 + i);
+          for (j=0; j < i; j++)
+            if (slot[j] + SLOTLEN > slot[i] && slot[i] + SLOTLEN > slot[j])
+              fail (100 * k + 20 + i);
+          memset (slot[i], 0xa5, SLOTLEN);
+        }
+      if (_vanity_arena_get (arena))
+        fail (100 * k + 30);
+
+      /* A slot handed back is wiped and handed out again.  */
+      _vanity_arena_put (arena, slot[2]);
+      p = _vanity_arena_get (arena);
+      if (p != slot[2] || p[0] || p[SLOTLEN - 1])
+        fail (100 * k + 40);
+      for (i=0; i < NSLOTS; i++)
+        _vanity_arena_put (arena, slot[i]);
+    }
+
+  _vanity_arena_release (arena);
+}
+
+
+/* The memory reported covers the aligned slots and is whole pages.  */
+static void
+test_memory (void)
+{
+  size_t n, m;
+
+  n = _vanity_arena_memory (SLOTLEN, NSLOTS);
+  if (n < NSLOTS * 128 || n < 4096)
+    fail (0);
+  m = _vanity_arena_memory (SLOTLEN, 1);
+  if (m > n || n - m >= NSLOTS * sizeof (unsigned int) + 4096)
+    fail (1);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_arena ();
+  test_memory ();
+
+  return 0;
+}
@@ -0,0 +1,104 @@
+/* t-vanity-cpu.c - Module test for vanity-cpu.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Check the placement order of the CPUs and that the list without
+   SMT has one entry per core.  */
+static void
+test_topology (vanity_cpus_t all)
+{
+  vanity_cpus_t cores;
+  unsigned int i, j, n;
+
+  for (i=0; i < all->n; i++)
+    {
+      for (j=i+1; j < all->n; j++)
+        if (all->cpu[i].cpu == all->cpu[j].cpu)
+          fail (0);
+      if (i && all->cpu[i].sibling < all->cpu[i-1].sibling)
+        fail (1);
+      if (i && all->cpu[i].sibling == all->cpu[i-1].sibling
+          && all->cpu[i].node < all->cpu[i-1].node)
+        fail (2);
+    }
+  if (!all->nnodes || all->nnodes > all->n)
+    fail (3);
+
+  if (_vanity_cpus_new (&cores, 0))
+    fail (10);
+  for (n=i=0; i < all->n; i++)
+    if (!all->cpu[i].sibling)
+      n++;
+  if (cores->n != n || cores->nnodes != all->nnodes)
+    fail (11);
+  for (i=0; i < cores->n; i++)
+    if (cores->cpu[i].sibling
+        || memcmp (cores->cpu + i, all->cpu + i, sizeof *all->cpu))
+      fail (12);
+  _vanity_cpus_release (cores);
+}
+
+
+/* Binding to a single CPU and to a node must work.  */
+static void
+test_bind (vanity_cpus_t all)
+{
+  gpg_error_t err;
+
+  err = _vanity_cpus_bind (all, all->n - 1, 0);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    return;
+  if (err)
+    fail (0);
+  if (_vanity_cpus_bind (all, -1, all->cpu[0].node))
+    fail (1);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  vanity_cpus_t all;
+
+  (void)argc;
+  (void)argv;
+
+  /* Without the sysfs there is nothing to test.  */
+  if (_vanity_cpus_new (&all, 1))
+    return 77;
+
+  test_topology (all);
+  test_bind (all);
+  _vanity_cpus_release (all);
+
+  return 0;
+}
@@ -0,0 +1,128 @@
+/* t-vanity-ecc.c - Module test for vanity-ecc.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Return the public key Q of the private key S-expression built from
+   CURVE and D by libgcrypt.  */
+static gcry_sexp_t
+reference_q (const char *curve, gcry_mpi_t d)
+{
+  gcry_sexp_t s_key, l1;
+  gcry_ctx_t ctx;
+  gcry_mpi_t q;
+
+  if (gcry_sexp_build (&s_key, NULL, "(private-key(ecc(curve %s)(d%m)))",
+                       curve, d))
+    fail (0);
+  if (gcry_mpi_ec_new (&ctx, s_key, NULL))
+    fail (1);
+  q = gcry_mpi_ec_get_mpi ("q", ctx, 0);
+  if (!q)
+    fail (2);
+  if (gcry_sexp_build (&l1, NULL, "(q%M)", q))
+    fail (3);
+  gcry_mpi_release (q);
+  gcry_ctx_release (ctx);
+  gcry_sexp_release (s_key);
+  return l1;
+}
+
+
+/* Compare all keys of a few batches for the curve CURVE against
+   libgcrypt.  */
+static void
+test_ecc_keys (const char *curve)
+{
+  gpg_error_t err;
+  char keyparam[100];
+  gcry_sexp_t s_param, l1;
+  vanity_ecc_t ecc;
+  gcry_mpi_t d, di;
+  unsigned char *q;
+  const void *expect;
+  size_t qlen, n;
+  int i, j;
+
+  snprintf (keyparam, sizeof keyparam,
+            "(genkey(ecc(curve %d:%s)(flags nocomp)))",
+            (int)strlen (curve), curve);
+  err = gcry_sexp_new (&s_param, keyparam, 0, 1);
+  if (err)
+    fail (10);
+  err = _vanity_ecc_new (&ecc, s_param);
+  if (err)
+    fail (11);
+  qlen = _vanity_ecc_qlen (ecc);
+  if (qlen > VANITY_MAX_QLEN)
+    fail (12);
+  q = xmalloc (qlen * VANITY_ECC_BATCH);
+  di = gcry_mpi_snew (0);
+
+  for (j=0; j < 3; j++)
+    {
+      err = _vanity_ecc_keys (ecc, NULL, &d, q);
+      if (err)
+        fail (100 + j);
+      for (i=0; i < VANITY_ECC_BATCH; i++)
+        {
+          gcry_mpi_add_ui (di, d, i);
+          l1 = reference_q (_vanity_ecc_curve (ecc), di);
+          expect = gcry_sexp_nth_data (l1, 1, &n);
+          if (n != qlen || memcmp (q + i * qlen, expect, qlen))
+            fail (1000 * j + i);
+          gcry_sexp_release (l1);
+        }
+      gcry_mpi_release (d);
+    }
+
+  gcry_mpi_release (di);
+  xfree (q);
+  _vanity_ecc_release (ecc);
+  gcry_sexp_release (s_param);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+
+  test_ecc_keys ("nistp256");
+  test_ecc_keys ("nistp521");
+  test_ecc_keys ("brainpoolP384r1");
+  test_ecc_keys ("secp256k1");
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+/* t-vanity-ed25519.c - Module test for vanity-ed25519.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Store the value of the element NAME of the private key in KEY at
+   BUFFER, which has space for 33 bytes.  Returns its length.  */
+static size_t
+get_param (gcry_sexp_t key, const char *name, unsigned char *buffer)
+{
+  gcry_sexp_t l1;
+  const char *s;
+  size_t n;
+
+  l1 = gcry_sexp_find_token (key, "private-key", 0);
+  if (l1)
+    {
+      gcry_sexp_t l2 = gcry_sexp_find_token (l1, name, 0);
+      gcry_sexp_release (l1);
+      l1 = l2;
+    }
+  if (!l1)
+    fail (0);
+  s = gcry_sexp_nth_data (l1, 1, &n);
+  if (!s || !n || n > 33)
+    fail (0);
+  memcpy (buffer, s, n);
+  gcry_sexp_release (l1);
+  return n;
+}
+
+
+/* Compare the batch key generation with each kernel against
+   libgcrypt for batches of all sizes.  */
+static void
+test_ed25519_keys (void)
+{
+  gcry_sexp_t keyparam, key;
+  unsigned char seeds[VANITY_ED25519_BATCH * 32];
+  unsigned char expect[VANITY_ED25519_BATCH * 32];
+  unsigned char q[VANITY_ED25519_BATCH * 32];
+  unsigned char buffer[33];
+  const char *name;
+  unsigned int k, n, i;
+
+  if (!_vanity_ed25519_init ())
+    {
+      fprintf (stderr, "%s: batch key generation not available\n", __FILE__);
+      return;
+    }
+
+  if (gcry_sexp_build (&keyparam, NULL,
+                       "(genkey(ecc(curve Ed25519)(flags eddsa comp"
+                       " transient-key)))"))
+    fail (0);
+  for (k=0; (name = _vanity_ed25519_kernel_list (k)); k++)
+    {
+      if (!_vanity_ed25519_select (name))
+        continue;
+
+      for (n=1; n <= VANITY_ED25519_BATCH; n++)
+        {
+          for (i=0; i < n; i++)
+            {
+              if (gcry_pk_genkey (&key, keyparam))
+                fail (k * 100 + n);
+              if (get_param (key, "d", buffer) != 32)
+                fail (k * 100 + n);
+              memcpy (seeds + 32 * i, buffer, 32);
+              if (get_param (key, "q", buffer) != 33 || buffer[0] != 0x40)
+                fail (k * 100 + n);
+              memcpy (expect + 32 * i, buffer + 1, 32);
+              gcry_sexp_release (key);
+            }
+          _vanity_ed25519_keys (seeds, n, q);
+          if (memcmp (q, expect, 32 * n))
+            fail (k * 100 + n);
+        }
+    }
+  gcry_sexp_release (keyparam);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_ed25519_keys ();
+
+  return 0;
+}
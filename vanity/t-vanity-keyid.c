@@ -0,0 +1,287 @@
+/* t-vanity-keyid.c - Module test for vanity-keyid.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+#include "../common/openpgpdefs.h"
+#include "../common/host2net.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Compare the shortcut used by the workers against the reference
+   code for a few keys of VERSION generated from KEYPARAM for ALGO.  */
+static void
+test_refkey_set_key (const char *keyparam, int algo, int version)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_param, s_key, s_public;
+  vanity_refkey_t ref, fast;
+  unsigned char oid[VANITY_MAX_OIDLEN];
+  unsigned char kdf[VANITY_KDF_PARAMS_LEN];
+  unsigned char expect[VANITY_MAX_FPR_LEN];
+  unsigned char fpr[VANITY_MAX_FPR_LEN];
+  u32 keyids[VANITY_SHA1_MAX_LANES];
+  unsigned int nbits;
+  size_t oidlen = 0;
+  size_t fprlen = _vanity_fpr_len (version);
+  int n;
+
+  err = gcry_sexp_new (&s_param, keyparam, 0, 1);
+  if (err)
+    fail (0);
+  memset (kdf, 0, sizeof kdf);
+  if (algo != PUBKEY_ALGO_RSA)
+    {
+      err = _vanity_curve_oid (s_param, oid, &oidlen, &nbits);
+      if (err)
+        fail (1);
+      _vanity_ecdh_kdf_params (nbits, kdf);
+    }
+  err = _vanity_refkey_new (&fast, NULL, algo, version);
+  if (err)
+    fail (2);
+
+  for (n=0; n < 10; n++)
+    {
+      err = gcry_pk_genkey (&s_key, s_param);
+      if (err)
+        fail (100 + n);
+      s_public = gcry_sexp_find_token (s_key, "public-key", 0);
+      if (!s_public)
+        fail (200 + n);
+      err = _vanity_refkey_new (&ref, s_public, algo, version);
+      if (err)
+        fail (300 + n);
+      err = _vanity_refkey_set_key (fast, s_key, algo, oid, oidlen, kdf);
+      if (err)
+        fail (400 + n);
+
+      _vanity_refkey_fingerprint (ref, 0x55b3a5a1, expect);
+      _vanity_refkey_fingerprint (fast, 0x55b3a5a1, fpr);
+      if (memcmp (fpr, expect, fprlen))
+        fail (500 + n);
+      if (!_vanity_refkey_keyids (fast, 0x55b3a5a1, keyids)
+          || keyids[0] != _vanity_fpr_keyid (expect, version))
+        fail (600 + n);
+
+      /* A quarantined kernel is replaced by libgcrypt.  */
+      _vanity_refkey_quarantine (fast, ((1 << VANITY_PATH_KEYID)
+                                        | (1 << VANITY_PATH_MULTI)
+                                        | (1 << VANITY_PATH_SHA256)));
+      if (_vanity_refkey_path (fast, 0) != VANITY_PATH_LIBGCRYPT
+          || _vanity_refkey_lanes (fast) != 1)
+        fail (700 + n);
+      if (_vanity_refkey_keyids (fast, 0x55b3a5a1, keyids) != 1
+          || keyids[0] != _vanity_fpr_keyid (expect, version))
+        fail (800 + n);
+      _vanity_refkey_reference_fpr (fast, 0x55b3a5a1, fpr);
+      if (memcmp (fpr, expect, fprlen))
+        fail (900 + n);
+      _vanity_refkey_quarantine (fast, 0);
+
+      _vanity_refkey_release (ref);
+      gcry_sexp_release (s_public);
+      gcry_sexp_release (s_key);
+    }
+
+  _vanity_refkey_release (fast);
+  gcry_sexp_release (s_param);
+}
+
+
+/* Check that replacing the KDF parameters of an ECDH key of VERSION
+   gives the fingerprint of the key built with them.  */
+static void
+test_refkey_set_kdf (int version)
+{
+  static const unsigned char other[VANITY_KDF_PARAMS_LEN] =
+    { 3, 1, DIGEST_ALGO_SHA512, CIPHER_ALGO_AES192 };
+  gpg_error_t err;
+  gcry_sexp_t s_param, s_key, s_public;
+  vanity_refkey_t ref, fast;
+  unsigned char oid[VANITY_MAX_OIDLEN];
+  unsigned char kdf[VANITY_KDF_PARAMS_LEN];
+  unsigned char expect[VANITY_MAX_FPR_LEN];
+  unsigned char fpr[VANITY_MAX_FPR_LEN];
+  unsigned int nbits;
+  size_t oidlen;
+  size_t fprlen = _vanity_fpr_len (version);
+
+  err = gcry_sexp_new (&s_param, "(genkey(ecc(curve 8:nistp256)"
+                       "(flags nocomp)))", 0, 1);
+  if (err)
+    fail (0);
+  err = _vanity_curve_oid (s_param, oid, &oidlen, &nbits);
+  if (err)
+    fail (1);
+  _vanity_ecdh_kdf_params (nbits, kdf);
+  err = gcry_pk_genkey (&s_key, s_param);
+  if (err)
+    fail (2);
+  s_public = gcry_sexp_find_token (s_key, "public-key", 0);
+  if (!s_public)
+    fail (3);
+
+  err = _vanity_refkey_new (&ref, s_public, PUBKEY_ALGO_ECDH, version);
+  if (!err)
+    err = _vanity_refkey_new (&fast, NULL, PUBKEY_ALGO_ECDH, version);
+  if (err)
+    fail (4);
+  _vanity_refkey_fingerprint (ref, 0x55b3a5a1, expect);
+  err = _vanity_refkey_set_key (fast, s_key, PUBKEY_ALGO_ECDH, oid, oidlen,
+                                other);
+  if (err)
+    fail (5);
+  _vanity_refkey_fingerprint (fast, 0x55b3a5a1, fpr);
+  if (!memcmp (fpr, expect, fprlen))
+    fail (6);
+  if (_vanity_refkey_set_kdf (ref, other))
+    fail (7);
+  _vanity_refkey_fingerprint (ref, 0x55b3a5a1, expect);
+  if (memcmp (fpr, expect, fprlen))
+    fail (8);
+  _vanity_refkey_reference_fpr (ref, 0x55b3a5a1, expect);
+  if (memcmp (fpr, expect, fprlen))
+    fail (9);
+
+  /* Back to the default parameters.  */
+  if (_vanity_refkey_set_kdf (fast, kdf))
+    fail (10);
+  _vanity_refkey_release (ref);
+  err = _vanity_refkey_new (&ref, s_public, PUBKEY_ALGO_ECDH, version);
+  if (err)
+    fail (11);
+  _vanity_refkey_fingerprint (ref, 0x55b3a5a1, expect);
+  _vanity_refkey_fingerprint (fast, 0x55b3a5a1, fpr);
+  if (memcmp (fpr, expect, fprlen))
+    fail (12);
+  _vanity_refkey_release (ref);
+
+  /* Other keys have no KDF parameters.  */
+  if (!_vanity_refkey_set_q (fast, (const unsigned char *)"\x40" "0123456789"
+                             "0123456789" "0123456789" "01", 33,
+                             PUBKEY_ALGO_EDDSA, oid, oidlen, NULL)
+      && !_vanity_refkey_set_kdf (fast, kdf))
+    fail (13);
+
+  _vanity_refkey_release (fast);
+  gcry_sexp_release (s_public);
+  gcry_sexp_release (s_key);
+  gcry_sexp_release (s_param);
+}
+
+
+/* Check the v5 key packet of an Ed25519 key against one built here
+   as described in RFC 4880bis.  */
+static void
+test_refkey_v5 (void)
+{
+  static const unsigned char oid[] =
+    "\x09\x2b\x06\x01\x04\x01\xda\x47\x0f\x01";
+  gpg_error_t err;
+  gcry_sexp_t s_param, s_key, s_public, l1;
+  vanity_refkey_t ref;
+  unsigned char packet[60];
+  unsigned char expect[VANITY_V5_FPR_LEN];
+  unsigned char fpr[VANITY_V5_FPR_LEN];
+  const unsigned char *q;
+  size_t qlen;
+
+  err = gcry_sexp_new (&s_param,
+                       "(genkey(ecc(curve 7:Ed25519)(flags eddsa comp)))",
+                       0, 1);
+  if (err)
+    fail (0);
+  err = gcry_pk_genkey (&s_key, s_param);
+  if (err)
+    fail (1);
+  s_public = gcry_sexp_find_token (s_key, "public-key", 0);
+  l1 = s_public? gcry_sexp_find_token (s_public, "q", 0) : NULL;
+  q = l1? (const unsigned char *)gcry_sexp_nth_data (l1, 1, &qlen) : NULL;
+  if (!q || qlen != 33)
+    fail (2);
+
+  memcpy (packet, "\x9a\x00\x00\x00\x37\x05\x55\xb3\xa5\xa1"
+          "\x16\x00\x00\x00\x2d", 15);
+  memcpy (packet + 15, oid, 10);
+  packet[25] = 0x01;
+  packet[26] = 0x07;
+  memcpy (packet + 27, q, 33);
+  gcry_md_hash_buffer (GCRY_MD_SHA256, expect, packet, sizeof packet);
+
+  err = _vanity_refkey_new (&ref, s_public, PUBKEY_ALGO_EDDSA, 5);
+  if (err)
+    fail (3);
+  if (_vanity_refkey_path (ref, 0) != VANITY_PATH_SHA256)
+    fail (4);
+  _vanity_refkey_fingerprint (ref, 0x55b3a5a1, fpr);
+  if (memcmp (fpr, expect, sizeof expect))
+    fail (5);
+  if (_vanity_fpr_keyid (fpr, 5) != buf32_to_u32 (expect + 4))
+    fail (6);
+
+  _vanity_refkey_release (ref);
+  gcry_sexp_release (l1);
+  gcry_sexp_release (s_public);
+  gcry_sexp_release (s_key);
+  gcry_sexp_release (s_param);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+  _vanity_sha1_init ();
+  _vanity_sha256_init ();
+
+  test_refkey_set_key ("(genkey(ecc(curve 7:Ed25519)(flags eddsa comp)))",
+                       PUBKEY_ALGO_EDDSA, 4);
+  test_refkey_set_key ("(genkey(ecc(curve 8:nistp256)(flags nocomp)))",
+                       PUBKEY_ALGO_ECDSA, 4);
+  test_refkey_set_key ("(genkey(ecc(curve 8:nistp256)(flags nocomp)))",
+                       PUBKEY_ALGO_ECDH, 4);
+  test_refkey_set_key ("(genkey(ecc(curve 8:nistp521)(flags nocomp)))",
+                       PUBKEY_ALGO_ECDH, 4);
+  test_refkey_set_key ("(genkey(rsa(nbits 4:1024)))", PUBKEY_ALGO_RSA, 4);
+  test_refkey_set_key ("(genkey(rsa(nbits 4:2048)))", PUBKEY_ALGO_RSA, 4);
+  test_refkey_set_kdf (4);
+
+  test_refkey_v5 ();
+  test_refkey_set_key ("(genkey(ecc(curve 7:Ed25519)(flags eddsa comp)))",
+                       PUBKEY_ALGO_EDDSA, 5);
+  test_refkey_set_key ("(genkey(ecc(curve 8:nistp521)(flags nocomp)))",
+                       PUBKEY_ALGO_ECDH, 5);
+  test_refkey_set_key ("(genkey(rsa(nbits 4:2048)))", PUBKEY_ALGO_RSA, 5);
+  test_refkey_set_kdf (5);
+
+  return 0;
+}
@@ -0,0 +1,758 @@
+/* t-vanity-match.c - Module test for vanity-match.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+#include "../common/host2net.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+static void
+test_pattern_match (void)
+{
+  static struct {
+    const char *pattern;
+    u32 keyid;
+    int match;
+  } tests[] = {
+    { "F00DF00D",            0xF00DF00D, 1 },
+    { "f00df00d",            0xF00DF00D, 1 },
+    { "0xF00DF00D",          0xF00DF00D, 1 },
+    { "F00DF00D",            0xF00DF00E, 0 },
+    { "F00DF00D DEADBEEF",   0xDEADBEEF, 1 },
+    { "F00DF00D,DEADBEEF",   0xDEADBEEF, 1 },
+    { " F00DF00D ,\tDEADBEEF ", 0xF00DF00D, 1 },
+    { "F00DF00D,DEADBEEF",   0xDEADBEEE, 0 },
+    { "CAFE",                0x1234CAFE, 1 },
+    { "CAFE",                0xCAFE1234, 0 },
+    { "??C0FFEE",            0x12C0FFEE, 1 },
+    { "..C0FFEE",            0x12C0FFEE, 1 },
+    { "??C0FFEE",            0x12C0FFEF, 0 },
+    { "F?0D",                0x0000F70D, 1 },
+    { "F00D0000/FFFF0000",   0xF00D1234, 1 },
+    { "0xF00D0000/0xFFFF0000", 0xF00D1234, 1 },
+    { "F00D0000/FFFF0000",   0xF01D1234, 0 },
+    { "1/1",                 0x00000003, 1 },
+    { "1/1",                 0x00000002, 0 },
+    { NULL }
+  };
+  static const char *bad[] = {
+    "",
+    " , ",
+    "F00DF00D0",
+    "F00DG00D",
+    "0x",
+    "F00D/",
+    "/FFFF",
+    "F00D0000/0000FFFF",
+    "F00D0000/FFFF00000",
+    NULL
+  };
+  gpg_error_t err;
+  vanity_pattern_t pattern;
+  int idx;
+
+  for (idx=0; tests[idx].pattern; idx++)
+    {
+      err = vanity_pattern_new (&pattern, tests[idx].pattern);
+      if (err)
+        fail (idx);
+      if (!vanity_pattern_match (pattern, tests[idx].keyid)
+          != !tests[idx].match)
+        fail (idx);
+      vanity_pattern_release (pattern);
+    }
+
+  for (idx=0; bad[idx]; idx++)
+    {
+      err = vanity_pattern_new (&pattern, bad[idx]);
+      if (gpg_err_code (err) != GPG_ERR_INV_VALUE || pattern)
+        fail (1000 + idx);
+    }
+}
+
+
+/* Check the 64 bit items.  */
+static void
+test_pattern_check (void)
+{
+  static struct {
+    const char *pattern;
+    u32 hkeyid;
+    u32 keyid;
+    int match;
+  } tests[] = {
+    { "0123456789ABCDEF",      0x01234567, 0x89ABCDEF, 1 },
+    { "0x0123456789abcdef",    0x01234567, 0x89ABCDEF, 1 },
+    { "0123456789ABCDEF",      0x01234568, 0x89ABCDEF, 0 },
+    { "????????89ABCDEF",      0x76543210, 0x89ABCDEF, 1 },
+    { "01??????????CDEF",      0x01FFFFFF, 0xFFFFCDEF, 1 },
+    { "01??????????CDEF",      0x02FFFFFF, 0xFFFFCDEF, 0 },
+    { "CDEF 0123456789ABCDEF", 0x01234568, 0x0000CDEF, 1 },
+    { "0100000000000000/FF00000000000000", 0x01ABCDEF, 0x12345678, 1 },
+    { "0100000000000000/FF00000000000000", 0x02ABCDEF, 0x12345678, 0 },
+    { NULL }
+  };
+  gpg_error_t err;
+  vanity_pattern_t pattern;
+  unsigned char fpr[VANITY_FPR_LEN];
+  int idx;
+
+  memset (fpr, 0, sizeof fpr);
+  for (idx=0; tests[idx].pattern; idx++)
+    {
+      err = vanity_pattern_new (&pattern, tests[idx].pattern);
+      if (err)
+        fail (idx);
+      fpr[12] = tests[idx].hkeyid >> 24;
+      fpr[13] = tests[idx].hkeyid >> 16;
+      fpr[14] = tests[idx].hkeyid >> 8;
+      fpr[15] = tests[idx].hkeyid;
+      fpr[16] = tests[idx].keyid >> 24;
+      fpr[17] = tests[idx].keyid >> 16;
+      fpr[18] = tests[idx].keyid >> 8;
+      fpr[19] = tests[idx].keyid;
+      if (!vanity_pattern_check (pattern, fpr) != !tests[idx].match)
+        fail (idx);
+      /* The low part alone must always be a candidate.  */
+      if (tests[idx].match && !vanity_pattern_match (pattern,
+                                                     tests[idx].keyid))
+        fail (idx);
+      vanity_pattern_release (pattern);
+    }
+}
+
+
+/* Compare a large compiled pattern against a naive search.  */
+static void
+test_large_pattern (void)
+{
+  enum { NEXACT = 2000, NMASKED = 40, NRANDOM = 100000 };
+  static struct { const char *string; u32 value, mask; } masked[] = {
+    { "??C0FFEE",          0x00C0FFEE, 0x00FFFFFF },
+    { "BEEF",              0x0000BEEF, 0x0000FFFF },
+    { "F00D0000/FFFF0000", 0xF00D0000, 0xFFFF0000 }
+  };
+  static u32 keyids[NEXACT];
+  static u32 values[NEXACT + NMASKED];
+  static u32 masks[NEXACT + NMASKED];
+  gpg_error_t err;
+  vanity_pattern_t pattern;
+  char *string, *p;
+  u32 keyid;
+  int i, j, n, expect;
+
+  string = xmalloc (NEXACT * 9 + NMASKED * 20 + 1);
+  p = string;
+  n = 0;
+  gcry_create_nonce (keyids, sizeof keyids);
+  for (i=0; i < NEXACT; i++)
+    {
+      /* Put the masked items in between and add a few duplicates. */
+      if (!(i % (NEXACT / NMASKED)))
+        {
+          j = (i / (NEXACT / NMASKED)) % DIM (masked);
+          p += sprintf (p, "%s ", masked[j].string);
+          values[n] = masked[j].value;
+          masks[n++] = masked[j].mask;
+        }
+      if (i && !(i % 500))
+        keyids[i] = keyids[i-1];
+      p += sprintf (p, "%08lX,", (unsigned long)keyids[i]);
+      values[n] = keyids[i];
+      masks[n++] = 0xffffffff;
+    }
+  err = vanity_pattern_new (&pattern, string);
+  if (err || vanity_pattern_count (pattern) != n)
+    fail (0);
+
+  /* The targets, random keyids and random keyids with a masked
+     suffix must all yield the first matching item.  */
+  for (i=0; i < NEXACT + NRANDOM; i++)
+    {
+      if (i < NEXACT)
+        keyid = keyids[i];
+      else
+        {
+          gcry_create_nonce (&keyid, sizeof keyid);
+          if (i % 7 == 0)
+            keyid = (keyid & 0xff000000) | 0x00C0FFEE;
+        }
+      for (j=0; j < n; j++)
+        if ((keyid & masks[j]) == values[j])
+          break;
+      expect = j < n? j + 1 : 0;
+      if (vanity_pattern_match (pattern, keyid) != expect)
+        fail (1000 + i);
+    }
+
+  vanity_pattern_release (pattern);
+  xfree (string);
+}
+
+/* Convert the 40 or, for a v5 key, 64 hex digits at S into the
+   fingerprint FPR.  */
+static void
+hex_to_fpr (const char *s, unsigned char *fpr)
+{
+  int i, n = strlen (s) / 2;
+
+  for (i=0; i < n; i++, s += 2)
+    fpr[i] = xtoi_2 (s);
+}
+
+
+/* Check the items matched against the complete fingerprint.  */
+static void
+test_fpr_items (void)
+{
+  static struct {
+    const char *pattern;
+    const char *fpr;
+    int match;
+  } tests[] = {
+    { "prefix:DEAD",     "DEAD0123456789ABCDEF0123456789ABCDEF0123", 1 },
+    { "PREFIX:0xdead",   "DEAD0123456789ABCDEF0123456789ABCDEF0123", 1 },
+    { "prefix:DE?D",     "DE1D0123456789ABCDEF0123456789ABCDEF0123", 1 },
+    { "prefix:DEAD",     "0DEAD123456789ABCDEF0123456789ABCDEF0123", 0 },
+    { "prefix:0123456789ABCDEF0123456789ABCDEF01234567",
+                         "0123456789ABCDEF0123456789ABCDEF01234567", 1 },
+    { "prefix:0123456789ABCDEF0123456789ABCDEF01234567",
+                         "0123456789ABCDEF0123456789ABCDEF01234568", 0 },
+    { "suffix:BEEF",     "0123456789ABCDEF0123456789ABCDEF0123BEEF", 1 },
+    { "suffix:0123456789ABCDEFBEEF",
+                         "0123456789ABCDEF01230123456789ABCDEFBEEF", 1 },
+    { "suffix:0123456789ABCDEFBEEF",
+                         "0123456789ABCDEF01230123456789ABCDEFBEEE", 0 },
+    { "suffix:1??3456789ABCDEFBEEF",
+                         "0123456789ABCDEF01231FF3456789ABCDEFBEEF", 1 },
+    { "word:C0FFEE",     "C0FFEE0123456789ABCDEF0123456789ABCDEF01", 1 },
+    { "word:C0FFEE",     "0123456C0FFEE789ABCDEF0123456789ABCDEF01", 1 },
+    { "word:C0FFEE",     "0123456789ABCDEF0123456789ABCDEF01C0FFEE", 1 },
+    { "word:C0FFEE",     "0123456789ABCDEF0123456789ABCDEF01C0FFE0", 0 },
+    { "word:C0??EE",     "0123456789ABCDC012EEEF0123456789ABCDEF01", 1 },
+    { "word:C0FFEE??",   "0123456789ABCDEF0123456789ABCDEF01C0FFEE", 0 },
+    { "repeat:5",        "0123456789ABCDEF0123456789AAAAAF01234567", 1 },
+    { "repeat:5",        "0123456789ABCDEF0123456789AAAA5F01234567", 0 },
+    { "repeat:5",        "0123456777779ABCDEF0123456789ABCDEF01234", 1 },
+    { "repeat:3",        "0123456789ABCDEF0123456789ABCDEF01234555", 1 },
+    { "repeat:3",        "5553456789ABCDEF0123456789ABCDEF01234567", 1 },
+    { "repeat:40",       "7777777777777777777777777777777777777777", 1 },
+    { "repeat:40",       "7777777777777777777777777777777777777778", 0 },
+    { "F00DF00D word:C0FFEE", "0123456789ABCDEF0123456789ABCDEFF00DF00D", 1 },
+    { "F00DF00D word:C0FFEE", "0123456C0FFEE89ABCDEF0123456789ABCDEF012", 2 },
+    { "word:C0FFEE F00DF00D", "0123456C0FFEE89ABCDEF01234567891F00DF00D", 1 },
+    { "repeat:9 prefix:01", "0123456789ABCDEF0123456789ABCDEF01234567", 2 },
+    { "re:^0{6}",        "000000A1B2C3D4E5F60718293A4B5C6D7E8F9012", 1 },
+    { "re:^0{6}",        "00000A1B2C3D4E5F60718293A4B5C6D7E8F90120", 0 },
+    { "re:(CAFE|BEEF).{0,12}$",
+                         "0123456789ABCDEF01234567CAFE0123456789AB", 1 },
+    { "re:(CAFE|BEEF).{0,12}$",
+                         "0123456789ABCDEF0123456CAFE0123456789ABC", 0 },
+    { "re:^.{0,2}DEAD,F00DF00D",
+                         "01DEAD456789ABCDEF0123456789ABCDEF012345", 1 },
+    { "re:^.{0,2}DEAD,F00DF00D",
+                         "012DEAD56789ABCDEF0123456789ABCDF00DF00D", 2 },
+    { NULL }
+  };
+  static const char *bad[] = {
+    "prefix:",
+    "prefix:0123456789ABCDEF0123456789ABCDEF012345678",
+    "suffix:G",
+    "word:123456789",
+    "repeat:",
+    "repeat:1",
+    "repeat:41",
+    "repeat:5x",
+    "re:",
+    "re:G",
+    "re:^0{41}",
+    NULL
+  };
+  gpg_error_t err;
+  vanity_pattern_t pattern;
+  unsigned char fpr[VANITY_FPR_LEN];
+  int idx;
+
+  for (idx=0; tests[idx].pattern; idx++)
+    {
+      err = vanity_pattern_new (&pattern, tests[idx].pattern);
+      if (err)
+        fail (idx);
+      hex_to_fpr (tests[idx].fpr, fpr);
+      if (vanity_pattern_check (pattern, fpr) != tests[idx].match)
+        fail (idx);
+      vanity_pattern_release (pattern);
+    }
+
+  /* A short suffix is a keyid item and thus needs no digest.  */
+  err = vanity_pattern_new (&pattern, "suffix:BEEF");
+  if (err || _vanity_pattern_need_digest (pattern)
+      || !vanity_pattern_match (pattern, 0x1234BEEF))
+    fail (100);
+  vanity_pattern_release (pattern);
+  err = vanity_pattern_new (&pattern, "word:BEEF");
+  if (err || !_vanity_pattern_need_digest (pattern)
+      || vanity_pattern_match (pattern, 0x1234BEEF))
+    fail (101);
+  vanity_pattern_release (pattern);
+
+  for (idx=0; bad[idx]; idx++)
+    {
+      err = vanity_pattern_new (&pattern, bad[idx]);
+      if (gpg_err_code (err) != GPG_ERR_INV_VALUE || pattern)
+        fail (1000 + idx);
+    }
+}
+
+
+/* Check patterns compiled for the SHA-256 fingerprints of v5 keys,
+   whose keyid is the start of the fingerprint.  */
+static void
+test_v5_items (void)
+{
+  static struct {
+    const char *pattern;
+    const char *fpr;
+    int match;
+  } tests[] = {
+    { "89ABCDEF", "0123456789ABCDEF0123456789ABCDEF"
+                  "0123456789ABCDEF0123456789ABCDEF", 1 },
+    { "0x0123456789abcdef", "0123456789ABCDEF0123456789ABCDEF"
+                            "0123456789ABCDEF0123456789ABCDEF", 1 },
+    { "BEEF", "0123456789ABCDEF0123456789ABCDEF"
+              "0123456789ABCDEF0123456789ABBEEF", 0 },
+    { "suffix:BEEF", "0123456789ABCDEF0123456789ABCDEF"
+                     "0123456789ABCDEF0123456789ABBEEF", 1 },
+    { "prefix:0123456789ABCDEF0123456789ABCDEF0123456789ABCDEF0123456789"
+      "ABCDEF", "0123456789ABCDEF0123456789ABCDEF"
+                "0123456789ABCDEF0123456789ABCDEF", 1 },
+    { "word:CAFEBABE", "0123456789ABCDEF0123456789ABCDEF"
+                       "0123456789ABCDEF0123456CAFEBABEF", 1 },
+    { "repeat:9", "0123456789ABCDEF0123456789ABCDEF"
+                  "0123456789ABCDEF01234567FFFFFFFF", 0 },
+    { "repeat:9", "0123456789ABCDEF0123456789ABCDEF"
+                  "0123456789ABCDEF0123456FFFFFFFFF", 1 },
+    { NULL }
+  };
+  gpg_error_t err;
+  vanity_pattern_t pattern;
+  unsigned char fpr[VANITY_V5_FPR_LEN];
+  int idx;
+
+  for (idx=0; tests[idx].pattern; idx++)
+    {
+      err = vanity_pattern_new_version (&pattern, tests[idx].pattern, 5);
+      if (err || vanity_pattern_version (pattern) != 5)
+        fail (idx);
+      hex_to_fpr (tests[idx].fpr, fpr);
+      if (vanity_pattern_check (pattern, fpr) != tests[idx].match)
+        fail (idx);
+      vanity_pattern_release (pattern);
+    }
+
+  /* The suffix of a v5 fingerprint is not its keyid.  */
+  err = vanity_pattern_new_version (&pattern, "suffix:BEEF", 5);
+  if (err || !_vanity_pattern_need_digest (pattern))
+    fail (100);
+  vanity_pattern_release (pattern);
+  /* A v4 pattern can't be longer than a v4 fingerprint.  */
+  err = vanity_pattern_new (&pattern, "prefix:0123456789ABCDEF0123456789"
+                            "ABCDEF0123456789");
+  if (gpg_err_code (err) != GPG_ERR_INV_VALUE)
+    fail (101);
+  err = vanity_pattern_new_version (&pattern, "BEEF", 6);
+  if (gpg_err_code (err) != GPG_ERR_UNKNOWN_VERSION)
+    fail (102);
+}
+
+
+/* Compare the word and repeat items against a naive search in the
+   hex fingerprint.  */
+static void
+test_fpr_random (void)
+{
+  enum { NRANDOM = 20000 };
+  gpg_error_t err;
+  vanity_pattern_t pattern;
+  unsigned char fpr[VANITY_FPR_LEN];
+  char hex[2 * VANITY_FPR_LEN + 1];
+  int i, j, run, maxrun, expect;
+
+  err = vanity_pattern_new (&pattern, "repeat:4 word:A5 word:0F?F");
+  if (err)
+    fail (0);
+  for (i=0; i < NRANDOM; i++)
+    {
+      gcry_create_nonce (fpr, sizeof fpr);
+      bin2hex (fpr, sizeof fpr, hex);
+      for (maxrun=run=1, j=1; hex[j]; j++)
+        {
+          run = hex[j] == hex[j-1]? run + 1 : 1;
+          if (run > maxrun)
+            maxrun = run;
+        }
+      expect = 0;
+      if (maxrun >= 4)
+        expect = 1;
+      else if (strstr (hex, "A5"))
+        expect = 2;
+      else
+        for (j=0; hex[j+3] && !expect; j++)
+          if (hex[j] == '0' && hex[j+1] == 'F' && hex[j+3] == 'F')
+            expect = 3;
+      if (vanity_pattern_check (pattern, fpr) != expect)
+        fail (1000 + i);
+    }
+  vanity_pattern_release (pattern);
+}
+
+
+/* Return true if KEYID passes FILTER; this is what the device
+   does.  */
+static int
+filter_lookup (const struct vanity_filter_s *filter, u32 keyid)
+{
+  unsigned int m, lo, hi, mid;
+  u32 v, idx;
+
+  for (m=0; m < filter->nmasks; m++)
+    {
+      v = keyid & filter->masks[m];
+      if (filter->bitmap_words)
+        {
+          idx = (v * 0x9e3779b1) >> filter->bitmap_shift;
+          if (idx / 32 >= filter->bitmap_words)
+            fail (99);
+          if (!(filter->bitmap[idx / 32] & ((u32)1 << (idx % 32))))
+            continue;
+        }
+      lo = filter->starts[m];
+      hi = filter->starts[m+1];
+      while (lo < hi)
+        {
+          mid = lo + (hi - lo) / 2;
+          if (filter->values[mid] < v)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+      if (lo < filter->starts[m+1] && filter->values[lo] == v)
+        return 1;
+    }
+  return 0;
+}
+
+
+/* Check the filters exported for a device against the compiled
+   patterns.  */
+static void
+test_pattern_filter (void)
+{
+  enum { NEXACT = 3000, NRANDOM = 100000 };
+  static u32 keyids[NEXACT];
+  struct vanity_filter_s filter;
+  gpg_error_t err;
+  vanity_pattern_t pattern;
+  char *string, *p;
+  u32 keyid;
+  int i, k;
+
+  string = xmalloc (NEXACT * 9 + 100);
+  gcry_create_nonce (keyids, sizeof keyids);
+  p = string + sprintf (string, "BEEF ??C0FFEE F00D0000/FFFF0000 ");
+  for (i=0; i < NEXACT; i++)
+    p += sprintf (p, "%08lX ", (unsigned long)keyids[i]);
+
+  /* A few items are compiled as a linear pattern, many into mask
+     groups with a bitmap.  */
+  for (k=0; k < 2; k++)
+    {
+      if (k)
+        err = vanity_pattern_new (&pattern, string);
+      else
+        err = vanity_pattern_new (&pattern, "BEEF ??C0FFEE 12345678 DEAD");
+      if (err)
+        fail (k);
+      err = _vanity_pattern_filter (pattern, &filter);
+      if (err || filter.nmasks != 3 + k || !!filter.bitmap_words != k)
+        fail (10 + k);
+      for (i=0; i < NEXACT + NRANDOM; i++)
+        {
+          if (i < NEXACT)
+            keyid = k? keyids[i] : (keyids[i] & ~0xffff) | 0xbeef;
+          else
+            {
+              gcry_create_nonce (&keyid, sizeof keyid);
+              if (i % 5 == 0)
+                keyid = (keyid & 0xff000000) | 0x00C0FFEE;
+              else if (i % 5 == 1)
+                keyid = (keyid & 0x0000ffff) | 0xF00D0000;
+            }
+          if (filter_lookup (&filter, keyid)
+              != !!vanity_pattern_match (pattern, keyid))
+            fail (1000 + i);
+        }
+      _vanity_filter_release (&filter);
+      vanity_pattern_release (pattern);
+    }
+
+  /* Items on the whole fingerprint can't be filtered by keyid.  */
+  err = vanity_pattern_new (&pattern, "BEEF word:A5");
+  if (err)
+    fail (20);
+  if (gpg_err_code (_vanity_pattern_filter (pattern, &filter))
+      != GPG_ERR_NOT_SUPPORTED)
+    fail (21);
+  _vanity_filter_release (&filter);
+  vanity_pattern_release (pattern);
+
+  xfree (string);
+}
+
+
+/* Check that the specialised scans are selected for the common
+   shapes and flag exactly the lanes the pattern matches.  Some lanes
+   are set to matching words; the bits in KEEP stay random.  */
+static void
+test_matcher (void)
+{
+  enum { NBATCHES = 2000 };
+  static struct {
+    const char *string;
+    const char *name;
+    u32 hit[2];
+    u32 keep[2];
+  } tests[] = {
+    { "BEEF",               "keyid16",     { 0xBEEF },     { 0xffff0000 } },
+    { "BEEF,F00D",          "keyid16x2",   { 0xF00D },     { 0xffff0000 } },
+    { "C0FFEE",             "keyid24",     { 0xC0FFEE },   { 0xff000000 } },
+    { "DEADBEEF 12345678 0BADC0DE F00DF00D",
+                            "keyid32x4",   { 0x0BADC0DE }, { 0 } },
+    { "0123456789ABCDEF",   "keyid64",     { 0x89ABCDEF }, { 0 } },
+    { "?00D",               "generic-keyid", { 0x000D },   { 0xfffff000 } },
+    { "prefix:C0FFEE",      "prefix6",
+      { 0xC0FFEE00 }, { 0x000000ff, 0xffffffff } },
+    { "prefix:DEADBEEF",    "prefix8",
+      { 0xDEADBEEF }, { 0, 0xffffffff } },
+    { "prefix:0123456789AB", "prefix-long",
+      { 0x01234567, 0x89AB0000 }, { 0, 0x0000ffff } },
+    { "prefix:A?C",         "generic-digest",
+      { 0xA0C00000 }, { 0x0f0fffff, 0xffffffff } },
+    { "re:^0{6}",           "prefix6",
+      { 0 }, { 0x000000ff, 0xffffffff } },
+    { "re:^[01]9",          "generic-digest",
+      { 0x19000000 }, { 0x00ffffff, 0xffffffff } }
+  };
+  struct vanity_matcher_s matcher;
+  vanity_pattern_t pattern;
+  u32 words[5 * VANITY_SHA1_MAX_LANES], h[5];
+  unsigned int hits, lanes, n;
+  int i, k, w, digest, expect;
+
+  for (k=0; k < DIM (tests); k++)
+    {
+      if (vanity_pattern_new (&pattern, tests[k].string))
+        fail (k);
+      _vanity_matcher_init (&matcher, pattern);
+      if (strcmp (matcher.name, tests[k].name))
+        fail (100 + k);
+      digest = _vanity_pattern_need_digest (pattern);
+      for (n=0; n < NBATCHES; n++)
+        {
+          gcry_create_nonce (words, sizeof words);
+          for (i=0; i < VANITY_SHA1_MAX_LANES; i += 4)
+            for (w=0; w < 2; w++)
+              words[w * VANITY_SHA1_MAX_LANES + i] =
+                ((words[w * VANITY_SHA1_MAX_LANES + i] & tests[k].keep[w])
+                 | tests[k].hit[w]);
+          lanes = VANITY_SHA1_MAX_LANES - n % 3;
+          hits = matcher.scan (&matcher, words, lanes);
+          for (i=0; i < VANITY_SHA1_MAX_LANES; i++)
+            {
+              if (i >= lanes)
+                expect = 0;
+              else if (!digest)
+                expect = !!vanity_pattern_match (pattern, words[i]);
+              else
+                {
+                  for (w=0; w < 5; w++)
+                    h[w] = words[w * VANITY_SHA1_MAX_LANES + i];
+                  expect = !!_vanity_pattern_check_words (pattern, h);
+                }
+              if (i < lanes && !(i % 4) && !expect)
+                fail (1000 + k);
+              /* The generic scan leaves all checks to the caller.  */
+              if (!strcmp (matcher.name, "generic-digest"))
+                expect = i < lanes;
+              if (!!(hits & (1u << i)) != expect)
+                fail (2000 + k);
+            }
+        }
+      vanity_pattern_release (pattern);
+    }
+}
+
+
+/* Check the chance of a random fingerprint to match a pattern.  All
+   values are sums of powers of two and thus exact.  */
+static void
+test_pattern_probability (void)
+{
+  static struct {
+    const char *string;
+    double p;
+  } tests[] = {
+    { "BEEF",                    1.0 / 65536 },
+    { "BEEF ??C0FFEE",           1.0 / 65536 + 1.0 / 16777216 },
+    { "12340000/FFFF0000",       1.0 / 65536 },
+    { "00000000DEADBEEF",        1.0 / 4294967296.0 / 4294967296.0 },
+    { "prefix:C0FFEE",           1.0 / 16777216 },
+    { "word:A5",                 39.0 / 256 },
+    { "repeat:8",                33.0 / 268435456 },
+    { "repeat:2",                1.0 },
+    { "re:^0{6}",                1.0 / 16777216 },
+    { "re:^[0-7]0",              1.0 / 32 },
+    { "0/0",                     1.0 }
+  };
+  vanity_pattern_t pattern;
+  int i;
+
+  for (i=0; i < DIM (tests); i++)
+    {
+      if (vanity_pattern_new (&pattern, tests[i].string))
+        fail (i);
+      if (vanity_pattern_probability (pattern) != tests[i].p)
+        fail (100 + i);
+      vanity_pattern_release (pattern);
+    }
+}
+
+
+/* Check the scores of known fingerprints, that a score below the
+   minimum is never reported as reaching it and that scores can't be
+   mixed with other items.  */
+static void
+test_pattern_score (void)
+{
+  static struct {
+    const char *pattern;
+    const char *fpr;
+    unsigned int score;
+    unsigned int item;
+  } tests[] = {
+    { "score:zeros",     "0123456789ABCDEF0123456789ABCDEF01234567", 1, 0 },
+    { "score:zeros",     "123456789ABCDEF0123456789ABCDEF012345678", 0, 0 },
+    { "score:zeros",     "0000000001234567890ABCDEF0123456789ABCDE", 9, 0 },
+    { "score:zeros",     "0000000000000000000000000000000000000000", 40, 0 },
+    { "score:run",       "0123456789ABCDEF0123456789ABCDEF01234567", 1, 0 },
+    { "score:run",       "0123456789ABCDEF0123456789AAAAAF01234567", 5, 0 },
+    { "score:run",       "0123456789ABCDEF0123456789ABCDEF0123FFFF", 4, 0 },
+    { "score:run",       "7777777777777777777777777777777777777777", 40, 0 },
+    { "score:word:C0FFEE",
+                         "0123456C0FFEE789ABCDEF0123456789ABCDEF01", 6, 0 },
+    { "score:word:C0FFEE",
+                         "0123456789ABCDEF0123456789ABCDEF01C0FFE0", 0, 0 },
+    { "score:word:C0FFEE",
+                         "0123456789ABCDEF0123456789ABCDEF01C0FFEE", 6, 0 },
+    { "score:zeros score:run",
+                         "0012345678999ABCDEF0123456789ABCDEF01234", 3, 1 },
+    { "score:zeros score:run",
+                         "0001234567899ABCDEF0123456789ABCDEF01234", 3, 0 },
+    { "score:run score:word:BEEF",
+                         "0123456789ABCDEF0123456789ABBEEF01234567", 4, 1 },
+    { NULL }
+  };
+  static const char *bad[] = {
+    "score:zeros BEEF",
+    "prefix:01 score:run",
+    "score:word:C0??EE",
+    "score:word:",
+    "score:ones",
+    NULL
+  };
+  vanity_pattern_t pattern;
+  unsigned char fpr[VANITY_FPR_LEN];
+  unsigned int score, item, min, low;
+  u32 h[5];
+  int idx, i;
+
+  for (idx=0; tests[idx].pattern; idx++)
+    {
+      if (vanity_pattern_new (&pattern, tests[idx].pattern))
+        fail (idx);
+      if (!vanity_pattern_is_scoring (pattern))
+        fail (idx);
+      hex_to_fpr (tests[idx].fpr, fpr);
+      score = vanity_pattern_score (pattern, fpr, &item);
+      if (score != tests[idx].score || item != tests[idx].item)
+        fail (idx);
+      for (i=0; i < 5; i++)
+        h[i] = buf32_to_u32 (fpr + 4 * i);
+      for (min=0; min <= 41; min++)
+        {
+          low = _vanity_pattern_score_words (pattern, h, min, &item);
+          if ((low >= min) != (score >= min) || (low >= min && low != score))
+            fail (100 + idx);
+        }
+      vanity_pattern_release (pattern);
+    }
+
+  if (vanity_pattern_new (&pattern, "BEEF")
+      || vanity_pattern_is_scoring (pattern))
+    fail (200);
+  vanity_pattern_release (pattern);
+
+  for (idx=0; bad[idx]; idx++)
+    {
+      if (gpg_err_code (vanity_pattern_new (&pattern, bad[idx]))
+          != GPG_ERR_INV_VALUE || pattern)
+        fail (1000 + idx);
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_pattern_match ();
+  test_pattern_check ();
+  test_large_pattern ();
+  test_fpr_items ();
+  test_fpr_random ();
+  test_v5_items ();
+  test_pattern_filter ();
+  test_matcher ();
+  test_pattern_probability ();
+  test_pattern_score ();
+
+  return 0;
+}
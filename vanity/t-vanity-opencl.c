@@ -0,0 +1,208 @@
+/* t-vanity-opencl.c - Module test for vanity-opencl.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+#include "../common/host2net.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Compare the candidates of a device sweep over a few random keys
+   against the CPU kernel.  */
+static void
+test_gpu_sweep (void)
+{
+  enum { NKEYS = 5, COUNT = 200000 };
+  static const u32 starts[] = { 0x555d8000, 0xffffffff - COUNT + 1 };
+  static struct vanity_sha1_s ctx[NKEYS];
+  static u32 blocks[16 * NKEYS];
+  struct vanity_gpu_hit_s hits[VANITY_GPU_MAX_HITS];
+  struct vanity_filter_s filter;
+  vanity_pattern_t pattern;
+  vanity_gpu_t gpu;
+  unsigned char packet[51];
+  unsigned char fpr[VANITY_FPR_LEN];
+  unsigned int i, k, n, nhits, expect;
+  u32 t;
+
+  if (vanity_pattern_new (&pattern, "BEEF ??C0FFEE 12340000/FFFF0000"))
+    fail (0);
+  if (_vanity_pattern_filter (pattern, &filter))
+    fail (1);
+  if (_vanity_gpu_new (&gpu, &filter))
+    fail (2);
+
+  /* Random Ed25519 key packets.  */
+  for (k=0; k < NKEYS; k++)
+    {
+      gcry_create_nonce (packet, sizeof packet);
+      packet[0] = 0x99;
+      packet[1] = 0;
+      packet[2] = sizeof packet - 3;
+      packet[3] = 4;
+      _vanity_sha1_prepare (ctx + k, packet, sizeof packet);
+      memcpy (blocks + 16 * k, ctx[k].block, sizeof ctx[k].block);
+    }
+
+  for (i=0; i < DIM (starts); i++)
+    {
+      if (_vanity_gpu_sweep (gpu, blocks, NKEYS, starts[i], COUNT,
+                             hits, &nhits))
+        fail (10 + i);
+      if (nhits > VANITY_GPU_MAX_HITS)
+        fail (20 + i);
+      for (n=0; n < nhits; n++)
+        {
+          k = hits[n].key;
+          t = hits[n].timestamp;
+          if (k >= NKEYS || t - starts[i] >= COUNT)
+            fail (100 + n);
+          _vanity_sha1_fingerprint (ctx + k, t, fpr);
+          if (hits[n].keyid != buf32_to_u32 (fpr + 16)
+              || !vanity_pattern_match (pattern, hits[n].keyid))
+            fail (200 + n);
+        }
+
+      /* No candidate may be missing.  */
+      expect = 0;
+      for (k=0; k < NKEYS; k++)
+        for (t=starts[i]; t - starts[i] < COUNT; t++)
+          {
+            _vanity_sha1_fingerprint (ctx + k, t, fpr);
+            if (vanity_pattern_match (pattern, buf32_to_u32 (fpr + 16)))
+              expect++;
+          }
+      if (nhits != expect)
+        fail (30 + i);
+    }
+
+  _vanity_gpu_release (gpu);
+  _vanity_filter_release (&filter);
+  vanity_pattern_release (pattern);
+}
+
+
+/* Generate keys on the device and compare the candidates of a sweep
+   over them against the CPU with the keys recomputed from their
+   seeds.  */
+static void
+test_gpu_keygen (void)
+{
+  enum { NKEYS = 7, COUNT = 100000, QOFF = 22 };
+  static struct vanity_sha1_s ctx[NKEYS];
+  struct vanity_gpu_hit_s hits[VANITY_GPU_MAX_HITS];
+  struct vanity_filter_s filter;
+  struct vanity_sha1_s tmpl;
+  vanity_pattern_t pattern;
+  vanity_gpu_t gpu;
+  unsigned char master[32], seed[32];
+  unsigned char packet[54];
+  unsigned char fpr[VANITY_FPR_LEN];
+  unsigned int k, n, nhits, expect;
+  gpg_error_t err;
+  u32 t, start = 0x555d8000;
+
+  if (!_vanity_ed25519_init ())
+    return;
+  if (vanity_pattern_new (&pattern, "BEEF ??C0FFEE 12340000/FFFF0000"))
+    fail (0);
+  if (_vanity_pattern_filter (pattern, &filter))
+    fail (1);
+  if (_vanity_gpu_new (&gpu, &filter))
+    fail (2);
+  err = _vanity_gpu_keygen_setup (gpu);
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    goto leave;
+  if (err)
+    fail (3);
+
+  /* An Ed25519 key packet with Q at QOFF.  */
+  memset (packet, 0, sizeof packet);
+  packet[0] = 0x99;
+  packet[2] = sizeof packet - 3;
+  packet[3] = 4;
+  packet[QOFF - 1] = 0x40;
+  _vanity_sha1_prepare (&tmpl, packet, sizeof packet);
+
+  gcry_create_nonce (master, sizeof master);
+  if (_vanity_gpu_keygen (gpu, master, tmpl.block, QOFF, NKEYS))
+    fail (4);
+  for (k=0; k < NKEYS; k++)
+    {
+      _vanity_gpu_seed (master, k, seed);
+      _vanity_ed25519_keys (seed, 1, packet + QOFF);
+      _vanity_sha1_prepare (ctx + k, packet, sizeof packet);
+    }
+
+  if (_vanity_gpu_sweep (gpu, NULL, NKEYS, start, COUNT, hits, &nhits))
+    fail (5);
+  if (nhits > VANITY_GPU_MAX_HITS)
+    fail (6);
+  for (n=0; n < nhits; n++)
+    {
+      k = hits[n].key;
+      t = hits[n].timestamp;
+      if (k >= NKEYS || t - start >= COUNT)
+        fail (100 + n);
+      _vanity_sha1_fingerprint (ctx + k, t, fpr);
+      if (hits[n].keyid != buf32_to_u32 (fpr + 16))
+        fail (200 + n);
+    }
+  expect = 0;
+  for (k=0; k < NKEYS; k++)
+    for (t=start; t - start < COUNT; t++)
+      {
+        _vanity_sha1_fingerprint (ctx + k, t, fpr);
+        if (vanity_pattern_match (pattern, buf32_to_u32 (fpr + 16)))
+          expect++;
+      }
+  if (nhits != expect)
+    fail (7);
+
+ leave:
+  _vanity_gpu_release (gpu);
+  _vanity_filter_release (&filter);
+  vanity_pattern_release (pattern);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  /* Without a device there is nothing to test.  */
+  if (!_vanity_gpu_init ())
+    return 77;
+
+  test_gpu_sweep ();
+  test_gpu_keygen ();
+
+  return 0;
+}
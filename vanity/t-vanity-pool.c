@@ -0,0 +1,177 @@
+/* t-vanity-pool.c - Module test for vanity-pool.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+#define NRECORDS 5
+#define QLEN 33
+#define SECLEN (32 * VANITY_ED25519_BATCH)
+
+static const unsigned char oid[] =
+  { 0x09, 0x2b, 0x06, 0x01, 0x04, 0x01, 0xda, 0x47, 0x0f, 0x01 };
+
+static char fname[100];
+static unsigned char key[VANITY_POOL_KEYLEN];
+static unsigned char q[NRECORDS][VANITY_ED25519_BATCH * QLEN];
+static unsigned char secret[NRECORDS][SECLEN];
+
+
+/* Fill the pool with NRECORDS records, the last of them written after
+   a partial record.  */
+static void
+test_add (void)
+{
+  vanity_pool_t pool;
+  unsigned long long rec;
+  unsigned int i;
+  FILE *fp;
+
+  if (vanity_pool_open (&pool, fname, key))
+    fail (0);
+  if (vanity_pool_count (pool))
+    fail (1);
+  if (_vanity_pool_bind (pool, VANITY_POOL_ED25519, VANITY_ED25519_BATCH,
+                         QLEN, SECLEN, oid, sizeof oid))
+    fail (2);
+  for (i=0; i < NRECORDS - 1; i++)
+    {
+      gcry_randomize (q[i], sizeof q[i], GCRY_WEAK_RANDOM);
+      gcry_randomize (secret[i], sizeof secret[i], GCRY_WEAK_RANDOM);
+      if (_vanity_pool_add (pool, q[i], secret[i], &rec) || rec != i)
+        fail (3);
+    }
+  vanity_pool_close (pool);
+
+  /* A record cut short is overwritten by the next one.  */
+  fp = fopen (fname, "ab");
+  if (!fp || fwrite (q[0], 1, 17, fp) != 17 || fclose (fp))
+    fail (4);
+  if (vanity_pool_open (&pool, fname, key))
+    fail (5);
+  if (vanity_pool_count (pool) != (NRECORDS - 1) * VANITY_ED25519_BATCH)
+    fail (6);
+  if (_vanity_pool_bind (pool, VANITY_POOL_ED25519, VANITY_ED25519_BATCH,
+                         QLEN, SECLEN, oid, sizeof oid))
+    fail (7);
+  gcry_randomize (q[i], sizeof q[i], GCRY_WEAK_RANDOM);
+  gcry_randomize (secret[i], sizeof secret[i], GCRY_WEAK_RANDOM);
+  if (_vanity_pool_add (pool, q[i], secret[i], &rec) || rec != i)
+    fail (8);
+  if (_vanity_pool_drop (pool, 2, 3))
+    fail (9);
+  vanity_pool_close (pool);
+  memset (q[2] + 3 * QLEN, 0, QLEN);
+}
+
+
+/* Read the records back.  */
+static void
+test_next (void)
+{
+  vanity_pool_t pool;
+  unsigned char qbuf[VANITY_ED25519_BATCH * QLEN];
+  unsigned char sbuf[SECLEN];
+  unsigned long long rec;
+  unsigned int i;
+
+  if (vanity_pool_open (&pool, fname, key))
+    fail (0);
+  if (vanity_pool_count (pool) != NRECORDS * VANITY_ED25519_BATCH)
+    fail (1);
+  if (gpg_err_code (_vanity_pool_bind (pool, VANITY_POOL_ECC,
+                                       VANITY_ECC_BATCH, 65, 32,
+                                       oid, sizeof oid))
+      != GPG_ERR_WRONG_PUBKEY_ALGO)
+    fail (2);
+  if (_vanity_pool_bind (pool, VANITY_POOL_ED25519, VANITY_ED25519_BATCH,
+                         QLEN, SECLEN, oid, sizeof oid))
+    fail (3);
+  for (i=0; i < NRECORDS; i++)
+    {
+      if (_vanity_pool_next (pool, qbuf, sbuf, &rec) || rec != i)
+        fail (4);
+      if (memcmp (qbuf, q[i], sizeof qbuf) || memcmp (sbuf, secret[i], SECLEN))
+        fail (5);
+    }
+  if (gpg_err_code (_vanity_pool_next (pool, qbuf, sbuf, &rec))
+      != GPG_ERR_EOF)
+    fail (6);
+
+  /* A new search starts again with the first record.  */
+  if (_vanity_pool_bind (pool, VANITY_POOL_ED25519, VANITY_ED25519_BATCH,
+                         QLEN, SECLEN, oid, sizeof oid))
+    fail (7);
+  if (_vanity_pool_next (pool, qbuf, sbuf, &rec) || rec)
+    fail (8);
+  vanity_pool_close (pool);
+}
+
+
+/* Another key must be rejected.  */
+static void
+test_wrong_key (void)
+{
+  vanity_pool_t pool;
+
+  key[0] ^= 1;
+  if (gpg_err_code (vanity_pool_open (&pool, fname, key))
+      != GPG_ERR_BAD_SECKEY)
+    fail (0);
+  key[0] ^= 1;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  if (!gcry_check_version (GCRYPT_VERSION))
+    {
+      fprintf (stderr, "libgcrypt version mismatch\n");
+      exit (2);
+    }
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  snprintf (fname, sizeof fname, "t-vanity-pool-%u.tmp",
+            (unsigned int)getpid ());
+  gcry_randomize (key, sizeof key, GCRY_WEAK_RANDOM);
+  remove (fname);
+
+  test_add ();
+  test_next ();
+  test_wrong_key ();
+
+  remove (fname);
+  return 0;
+}
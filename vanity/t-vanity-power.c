@@ -0,0 +1,244 @@
+/* t-vanity-power.c - Module test for vanity-power.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+static char topdir[100];
+
+/* The directories of the fake sysfs, parents first.  */
+static const char *dirs[] = {
+  "class", "class/powercap", "class/powercap/intel-rapl:0",
+  "class/thermal", "class/thermal/thermal_zone0",
+  "class/thermal/thermal_zone1"
+};
+
+/* The files of the fake sysfs.  */
+static const char *files[] = {
+  "class/powercap/intel-rapl:0/energy_uj",
+  "class/powercap/intel-rapl:0/max_energy_range_uj",
+  "class/thermal/thermal_zone0/temp",
+  "class/thermal/thermal_zone1/temp"
+};
+
+
+static void
+put_value (const char *name, unsigned long long value)
+{
+  char fname[300];
+  FILE *fp;
+
+  snprintf (fname, sizeof fname, "%s/%s", topdir, name);
+  fp = fopen (fname, "w");
+  if (!fp)
+    fail (1000);
+  fprintf (fp, "%llu\n", value);
+  fclose (fp);
+}
+
+
+static void
+make_sysfs (void)
+{
+  char fname[300];
+  int i;
+
+  snprintf (topdir, sizeof topdir, "t-vanity-power-%u.d",
+            (unsigned int)getpid ());
+  if (mkdir (topdir, 0700))
+    fail (1001);
+  for (i=0; i < DIM (dirs); i++)
+    {
+      snprintf (fname, sizeof fname, "%s/%s", topdir, dirs[i]);
+      if (mkdir (fname, 0700))
+        fail (1002);
+    }
+}
+
+
+static void
+remove_sysfs (void)
+{
+  char fname[300];
+  int i;
+
+  for (i=0; i < DIM (files); i++)
+    {
+      snprintf (fname, sizeof fname, "%s/%s", topdir, files[i]);
+      remove (fname);
+    }
+  for (i=DIM (dirs) - 1; i >= 0; i--)
+    {
+      snprintf (fname, sizeof fname, "%s/%s", topdir, dirs[i]);
+      rmdir (fname);
+    }
+  rmdir (topdir);
+}
+
+
+/* The energy is summed over a wrap of the counter and the hottest
+   zone is reported.  */
+static void
+test_sensors (void)
+{
+  vanity_power_t power;
+  double joules;
+  int celsius;
+
+  make_sysfs ();
+  if (_vanity_power_new (&power, topdir))
+    fail (0);
+  if (_vanity_power_energy (power, &joules)
+      || _vanity_power_temperature (power, &celsius))
+    fail (1);
+  _vanity_power_release (power);
+
+  put_value (files[0], 9000000);
+  put_value (files[1], 10000000);
+  put_value (files[2], 41000);
+  put_value (files[3], 67500);
+  if (_vanity_power_new (&power, topdir))
+    fail (2);
+  if (!_vanity_power_energy (power, &joules) || joules != 0)
+    fail (3);
+  put_value (files[0], 9500000);
+  if (!_vanity_power_energy (power, &joules) || joules != 0.5)
+    fail (4);
+  put_value (files[0], 2000000);
+  if (!_vanity_power_energy (power, &joules) || joules != 3.0)
+    fail (5);
+  if (!_vanity_power_temperature (power, &celsius) || celsius != 67)
+    fail (6);
+  _vanity_power_release (power);
+
+  remove_sysfs ();
+}
+
+
+/* Parse schedules and check their limits over the day.  */
+static void
+test_schedule (void)
+{
+  static const char *bad[] = {
+    "x", "50%%", "8-18", "8-18=", "25-3=50%", "8-18=0%", "101%",
+    "8-18=50%/60%", "8-18=4/2", "4w", "1/2/3"
+  };
+  struct vanity_governor_s gov;
+  unsigned int duty, nworkers;
+  int i, hour;
+
+  memset (&gov, 0, sizeof gov);
+  if (_vanity_governor_parse (&gov, "") || gov.nrules)
+    fail (0);
+  _vanity_governor_limits (&gov, 12, &duty, &nworkers);
+  if (duty != 100 || nworkers)
+    fail (1);
+
+  if (_vanity_governor_parse (&gov, "8-18=50%/4, 18-8=25%") || gov.nrules != 2)
+    fail (2);
+  for (hour=0; hour < 24; hour++)
+    {
+      _vanity_governor_limits (&gov, hour, &duty, &nworkers);
+      if (hour >= 8 && hour < 18)
+        {
+          if (duty != 50 || nworkers != 4)
+            fail (10 + hour);
+        }
+      else if (duty != 25 || nworkers)
+        fail (40 + hour);
+    }
+
+  /* A rule without hours applies all day; the tightest limit wins.  */
+  if (_vanity_governor_parse (&gov, "2,0-6=3/80%"))
+    fail (3);
+  _vanity_governor_limits (&gov, 5, &duty, &nworkers);
+  if (duty != 80 || nworkers != 2)
+    fail (4);
+  _vanity_governor_limits (&gov, 6, &duty, &nworkers);
+  if (duty != 100 || nworkers != 2)
+    fail (5);
+
+  for (i=0; i < DIM (bad); i++)
+    if (!_vanity_governor_parse (&gov, bad[i]))
+      fail (100 + i);
+}
+
+
+/* The thermal duty cycle goes down while it is too hot and back up
+   once it is cool enough.  */
+static void
+test_thermal (void)
+{
+  struct vanity_governor_s gov;
+  unsigned int duty, nworkers;
+  int i;
+
+  memset (&gov, 0, sizeof gov);
+  _vanity_governor_thermal (&gov, 99);
+  _vanity_governor_limits (&gov, 0, &duty, &nworkers);
+  if (duty != 100)
+    fail (0);
+
+  gov.temp_limit = 80;
+  _vanity_governor_thermal (&gov, 85);
+  _vanity_governor_limits (&gov, 0, &duty, &nworkers);
+  if (duty != 90)
+    fail (1);
+  for (i=0; i < 20; i++)
+    _vanity_governor_thermal (&gov, 85);
+  _vanity_governor_limits (&gov, 0, &duty, &nworkers);
+  if (duty != 10)
+    fail (2);
+  /* Within the hysteresis nothing changes.  */
+  _vanity_governor_thermal (&gov, 78);
+  _vanity_governor_limits (&gov, 0, &duty, &nworkers);
+  if (duty != 10)
+    fail (3);
+  for (i=0; i < 20; i++)
+    _vanity_governor_thermal (&gov, 60);
+  _vanity_governor_limits (&gov, 0, &duty, &nworkers);
+  if (duty != 100)
+    fail (4);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_sensors ();
+  test_schedule ();
+  test_thermal ();
+
+  return 0;
+}
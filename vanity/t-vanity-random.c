@@ -0,0 +1,156 @@
+/* t-vanity-random.c - Module test for vanity-random.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Two generators must not produce the same stream, and neither may
+   repeat itself, also across a reseed.  */
+static void
+test_streams (void)
+{
+  enum { RESEED = 100, LEN = 32, N = 10 };
+  vanity_rng_t a, b;
+  unsigned char buf[N][LEN];
+  unsigned char other[LEN];
+  int i, j;
+
+  if (_vanity_rng_new (&a, GCRY_WEAK_RANDOM, RESEED))
+    fail (0);
+  if (_vanity_rng_new (&b, GCRY_WEAK_RANDOM, 0))
+    fail (1);
+
+  /* N * LEN spans three reseeds of A.  */
+  for (i=0; i < N; i++)
+    if (_vanity_rng_randomize (a, buf[i], LEN))
+      fail (10 + i);
+  for (i=0; i < N; i++)
+    for (j=i+1; j < N; j++)
+      if (!memcmp (buf[i], buf[j], LEN))
+        fail (20 + i);
+
+  for (i=0; i < N; i++)
+    {
+      if (_vanity_rng_randomize (b, other, LEN))
+        fail (30 + i);
+      for (j=0; j < N; j++)
+        if (!memcmp (buf[j], other, LEN))
+          fail (40 + i);
+    }
+
+  /* A request larger than the reseed interval.  */
+  {
+    unsigned char big[3 * RESEED];
+
+    memset (big, 0, sizeof big);
+    if (_vanity_rng_randomize (a, big, sizeof big))
+      fail (50);
+    for (i=0; i < (int)sizeof big - LEN; i += LEN)
+      if (!memcmp (big + i, other, LEN) || !memcmp (big + i, buf[0], LEN))
+        fail (51);
+  }
+
+  _vanity_rng_release (a);
+  _vanity_rng_release (b);
+  _vanity_rng_release (NULL);
+}
+
+
+/* A coarse check that all byte values show up about equally often.
+   With 256 KiB the expected count is 1024 per value and a deviation
+   of 25% is far beyond any real fluctuation.  */
+static void
+test_distribution (void)
+{
+  enum { LEN = 4096, ROUNDS = 64 };
+  static unsigned char buf[LEN];
+  unsigned long counts[256];
+  vanity_rng_t rng;
+  int i, n;
+
+  memset (counts, 0, sizeof counts);
+  if (_vanity_rng_new (&rng, GCRY_WEAK_RANDOM, 16 * 1024))
+    fail (0);
+  for (n=0; n < ROUNDS; n++)
+    {
+      if (_vanity_rng_randomize (rng, buf, LEN))
+        fail (1);
+      for (i=0; i < LEN; i++)
+        counts[buf[i]]++;
+    }
+  _vanity_rng_release (rng);
+
+  for (i=0; i < 256; i++)
+    if (counts[i] < 768 || counts[i] > 1280)
+      fail (100 + i);
+}
+
+
+/* The master secrets of the key streams follow their definition and
+   differ for each stream and batch.  */
+static void
+test_stream_master (void)
+{
+  unsigned char key[VANITY_STREAM_KEYLEN];
+  unsigned char buf[VANITY_STREAM_KEYLEN + 12], hash[64];
+  unsigned char master[32], other[32];
+
+  gcry_create_nonce (key, sizeof key);
+  memcpy (buf, key, sizeof key);
+  memset (buf + sizeof key, 0, 12);
+  buf[sizeof key + 3] = 5;
+  buf[sizeof key + 4] = 0x01;
+  buf[sizeof key + 11] = 0x07;
+  gcry_md_hash_buffer (GCRY_MD_SHA512, hash, buf, sizeof buf);
+  _vanity_stream_master (key, 5, 0x0100000000000007ULL, master);
+  if (memcmp (master, hash, 32))
+    fail (0);
+
+  _vanity_stream_master (key, 6, 0x0100000000000007ULL, other);
+  if (!memcmp (master, other, 32))
+    fail (1);
+  _vanity_stream_master (key, 5, 0x0100000000000008ULL, other);
+  if (!memcmp (master, other, 32))
+    fail (2);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_streams ();
+  test_distribution ();
+  test_stream_master ();
+
+  return 0;
+}
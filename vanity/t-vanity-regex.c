@@ -0,0 +1,222 @@
+/* t-vanity-regex.c - Module test for vanity-regex.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Convert the 40 hex digits FPR into the digest words H.  */
+static void
+fpr_words (const char *fpr, u32 *h)
+{
+  int i;
+
+  memset (h, 0, VANITY_MAX_DIGEST_WORDS * sizeof *h);
+  for (i=0; i < 40; i++)
+    h[i / 8] = (h[i / 8] << 4) | xtoi_1 (fpr + i);
+}
+
+
+static vanity_regex_t
+compile (const char *string)
+{
+  vanity_regex_t regex;
+
+  if (_vanity_regex_new (&regex, string, strlen (string), 40))
+    {
+      fprintf (stderr, "compiling '%s' failed\n", string);
+      exit (1);
+    }
+  return regex;
+}
+
+
+static void
+test_match (void)
+{
+  static struct {
+    const char *regex;
+    const char *fpr;
+    int match;
+  } tests[] = {
+    { "^0{6}", "000000A1B2C3D4E5F60718293A4B5C6D7E8F9012", 1 },
+    { "^0{6}", "00000FA1B2C3D4E5F60718293A4B5C6D7E8F9012", 0 },
+    { "^0{6}", "A00000001B2C3D4E5F60718293A4B5C6D7E8F901", 0 },
+    { "0{6}", "A00000001B2C3D4E5F60718293A4B5C6D7E8F901", 1 },
+    { "(CAFE|BEEF).{0,12}$", "123456789012345678901234BEEF567890123456", 1 },
+    { "(cafe|beef).{0,12}$", "123456789012345678901234CAFE567890123456", 1 },
+    { "(CAFE|BEEF).{0,12}$", "123456789012345678901CAFE234567890123456", 0 },
+    { "(CAFE|BEEF).{0,12}$", "1234567890123456789012345678901234565EEF", 0 },
+    { "(CAFE|BEEF).{0,12}$", "123456789012345678901234567890123456BEEF", 1 },
+    { "^[0-3]+0$", "1230123012301230123012301230123012301230", 1 },
+    { "^[0-3]+0$", "1230123012301230123012301230123012301231", 0 },
+    { "^[0-3]+0$", "1230123012301230123012301230123012341230", 0 },
+    { "[^0-9]{8}", "12345678ABCDEFAB123456789012345678901234", 1 },
+    { "[^0-9]{8}", "12345678ABCDEFA2123456789012345678901234", 0 },
+    { "^(12)*3", "121212123AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 1 },
+    { "^(12)*3", "121211233AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 0 },
+    { "^A?B", "ABAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 1 },
+    { "^A?B", "BAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 1 },
+    { "^A?B", "AABAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA", 0 },
+    { "^.{38}(00|FF)$", "1234567890123456789012345678901234567800", 1 },
+    { "^.{38}(00|FF)$", "12345678901234567890123456789012345678F0", 0 },
+    { "D{2,}E{3,5}F", "1234567890DDDEEEEEF123456789012345678901", 1 },
+    { "D{2,}E{3,5}F", "1234567890DDDEEEEEEF23456789012345678901", 0 },
+    { "D{2,}E{3,5}F", "1234567890DEEEEEF12345678901234567890123", 0 },
+    { "^(|0)1", "0123456789012345678901234567890123456789", 1 },
+    { "^(|0)1", "1234567890123456789012345678901234567890", 1 },
+    { "^(|0)1", "0023456789012345678901234567890123456789", 0 }
+  };
+  vanity_regex_t regex;
+  u32 h[VANITY_MAX_DIGEST_WORDS];
+  u32 value[VANITY_MAX_DIGEST_WORDS], mask[VANITY_MAX_DIGEST_WORDS];
+  int i, w, ok;
+
+  for (i=0; i < DIM (tests); i++)
+    {
+      regex = compile (tests[i].regex);
+      fpr_words (tests[i].fpr, h);
+      if (_vanity_regex_match (regex, h) != tests[i].match)
+        fail (i);
+      /* The prefilter must pass everything which matches.  */
+      _vanity_regex_prefilter (regex, value, mask);
+      for (ok=1, w=0; w < 5; w++)
+        if ((h[w] & mask[w]) != value[w])
+          ok = 0;
+      if (tests[i].match && !ok)
+        fail (100 + i);
+      _vanity_regex_release (regex);
+    }
+}
+
+
+static void
+test_prefilter (void)
+{
+  static struct {
+    const char *regex;
+    u32 value[5];
+    u32 mask[5];
+  } tests[] = {
+    { "^0{6}", { 0 }, { 0xffffff00 } },
+    { "^[89A-F]", { 0x80000000 }, { 0x80000000 } },
+    { "^(12|13)", { 0x12000000 }, { 0xfe000000 } },
+    { "ABCD$", { 0, 0, 0, 0, 0xabcd }, { 0, 0, 0, 0, 0xffff } },
+    { "^.{8}F", { 0, 0xf0000000 }, { 0, 0xf0000000 } },
+    { "CAFE", { 0 }, { 0 } }
+  };
+  vanity_regex_t regex;
+  u32 value[VANITY_MAX_DIGEST_WORDS], mask[VANITY_MAX_DIGEST_WORDS];
+  int i, w;
+
+  for (i=0; i < DIM (tests); i++)
+    {
+      regex = compile (tests[i].regex);
+      _vanity_regex_prefilter (regex, value, mask);
+      for (w=0; w < 5; w++)
+        if (value[w] != tests[i].value[w] || mask[w] != tests[i].mask[w])
+          fail (i);
+      _vanity_regex_release (regex);
+    }
+}
+
+
+static void
+test_probability (void)
+{
+  static struct {
+    const char *regex;
+    double p;
+  } tests[] = {
+    { "^0{6}", 1.0 / (1 << 24) },
+    { "^[0-7]", 0.5 },
+    { "F$", 1.0 / 16 },
+    { "^.*$", 1.0 },
+    { "^(0|1)(0|1)", 1.0 / 64 },
+    /* Not 40 * 16^-2: the runs overlap.  */
+    { "00", 0.134418436 }
+  };
+  vanity_regex_t regex;
+  double p, diff;
+  int i;
+
+  for (i=0; i < DIM (tests); i++)
+    {
+      regex = compile (tests[i].regex);
+      p = _vanity_regex_probability (regex);
+      diff = p > tests[i].p? p - tests[i].p : tests[i].p - p;
+      if (diff > 1e-6 * tests[i].p)
+        {
+          fprintf (stderr, "'%s': %.9g\n", tests[i].regex, p);
+          fail (i);
+        }
+      _vanity_regex_release (regex);
+    }
+}
+
+
+static void
+test_bad (void)
+{
+  static const char *bad[] = {
+    "", "^", "$", "^$", "(", "(0", "0)", "[", "[0", "[]", "[9-0]", "[^0-9A-F]",
+    "G", "0**", "*0", "0{", "0{1", "0{2,1}", "0{41}", "0{1,41}",
+    "0{1}{2}", "0^", "$0", "^0{41}", "^.{39}$", "^(0{40})0"
+  };
+  vanity_regex_t regex;
+  gpg_error_t err;
+  int i;
+
+  for (i=0; i < DIM (bad); i++)
+    {
+      err = _vanity_regex_new (&regex, bad[i], strlen (bad[i]), 40);
+      if (gpg_err_code (err) != GPG_ERR_INV_VALUE || regex)
+        fail (i);
+    }
+
+  /* Remembering the last 21 digits needs too many DFA states.  */
+  err = _vanity_regex_new (&regex, "1.{20}", 6, 40);
+  if (gpg_err_code (err) != GPG_ERR_TOO_LARGE)
+    fail (100);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_match ();
+  test_prefilter ();
+  test_probability ();
+  test_bad ();
+
+  return 0;
+}
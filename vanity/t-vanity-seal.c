@@ -0,0 +1,112 @@
+/* t-vanity-seal.c - Module test for vanity-seal.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Generate a key from the parameters PARMS and store its private
+   and public parts at R_PRIVATE and R_PUBLIC.  */
+static void
+genkey (const char *parms, gcry_sexp_t *r_private, gcry_sexp_t *r_public)
+{
+  gcry_sexp_t s_parms, s_key;
+
+  if (gcry_sexp_new (&s_parms, parms, 0, 1)
+      || gcry_pk_genkey (&s_key, s_parms))
+    fail (0);
+  *r_private = gcry_sexp_find_token (s_key, "private-key", 0);
+  *r_public = gcry_sexp_find_token (s_key, "public-key", 0);
+  if (!*r_private || !*r_public)
+    fail (1);
+  gcry_sexp_release (s_key);
+  gcry_sexp_release (s_parms);
+}
+
+
+/* Seal a key to a coordinator key and open it again; a modified
+   record or the wrong coordinator key must be detected.  */
+static void
+test_seal (void)
+{
+  gpg_error_t err;
+  gcry_sexp_t coord_sec, coord_pub, other_sec, other_pub;
+  gcry_sexp_t s_key, s_pub, s_opened;
+  unsigned char *sealed;
+  size_t sealedlen;
+  int i;
+
+  genkey ("(genkey(ecc(curve 10:NIST P-256)))", &coord_sec, &coord_pub);
+  genkey ("(genkey(ecc(curve 10:NIST P-256)))", &other_sec, &other_pub);
+
+  for (i=0; i < 3; i++)
+    {
+      genkey ("(genkey(ecc(curve 7:Ed25519)(flags eddsa comp)))",
+              &s_key, &s_pub);
+      err = vanity_seal_key (coord_pub, s_key, &sealed, &sealedlen);
+      if (err)
+        fail (10 + i);
+      err = vanity_open_key (coord_sec, sealed, sealedlen, &s_opened);
+      if (err || !same_sexp (s_key, s_opened))
+        fail (20 + i);
+      gcry_sexp_release (s_opened);
+
+      err = vanity_open_key (other_sec, sealed, sealedlen, &s_opened);
+      if (gpg_err_code (err) != GPG_ERR_BAD_DATA || s_opened)
+        fail (30 + i);
+      sealed[sealedlen - 1] ^= 1;
+      err = vanity_open_key (coord_sec, sealed, sealedlen, &s_opened);
+      if (gpg_err_code (err) != GPG_ERR_BAD_DATA || s_opened)
+        fail (40 + i);
+      err = vanity_open_key (coord_sec, sealed, sealedlen - 8, &s_opened);
+      if (!err || s_opened)
+        fail (50 + i);
+
+      xfree (sealed);
+      gcry_sexp_release (s_key);
+      gcry_sexp_release (s_pub);
+    }
+
+  gcry_sexp_release (coord_sec);
+  gcry_sexp_release (coord_pub);
+  gcry_sexp_release (other_sec);
+  gcry_sexp_release (other_pub);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+  test_seal ();
+
+  return 0;
+}
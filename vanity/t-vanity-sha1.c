@@ -0,0 +1,183 @@
+/* t-vanity-sha1.c - Module test for vanity-sha1.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+#include "../common/host2net.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Compare the kernel against libgcrypt for all packet lengths it
+   supports, including those taking several blocks, and a few
+   timestamps.  */
+static void
+test_sha1_kernel (void)
+{
+  static const u32 timestamps[] = {
+    0, 1, 0x55b3a5a1, 0x80000000, 0xfffffffe, 0xffffffff
+  };
+  unsigned char packet[VANITY_SHA1_MULTI_MAXLEN];
+  unsigned char expect[VANITY_FPR_LEN];
+  unsigned char fpr[VANITY_FPR_LEN];
+  struct vanity_sha1_s ctx;
+  size_t len;
+  int i;
+
+  for (len=8; len <= VANITY_SHA1_MULTI_MAXLEN; len++)
+    {
+      gcry_create_nonce (packet, len);
+      _vanity_sha1_prepare (&ctx, packet, len);
+      for (i=0; i < DIM (timestamps); i++)
+        {
+          packet[4] = timestamps[i] >> 24;
+          packet[5] = timestamps[i] >> 16;
+          packet[6] = timestamps[i] >> 8;
+          packet[7] = timestamps[i];
+          gcry_md_hash_buffer (GCRY_MD_SHA1, expect, packet, len);
+          _vanity_sha1_fingerprint (&ctx, timestamps[i], fpr);
+          if (memcmp (fpr, expect, VANITY_FPR_LEN))
+            fail ((int)len * 100 + i);
+        }
+    }
+}
+
+
+/* Compare the keyids computed by the selected multi-lane kernel
+   against the scalar kernel.  */
+static void
+test_sha1_keyids (void)
+{
+  unsigned char packet[51];
+  unsigned char fpr[VANITY_FPR_LEN];
+  u32 keyids[VANITY_SHA1_MAX_LANES];
+  struct vanity_sha1_s ctx;
+  u32 timestamp = 0x55b3a5a1;
+  unsigned int i, n, lanes;
+
+  _vanity_sha1_init ();
+  lanes = _vanity_sha1_lanes ();
+  if (!lanes || lanes > VANITY_SHA1_MAX_LANES)
+    fail (0);
+
+  gcry_create_nonce (packet, sizeof packet);
+  _vanity_sha1_prepare (&ctx, packet, sizeof packet);
+  for (n=0; n < 100; n++, timestamp += lanes)
+    {
+      _vanity_sha1_keyids (&ctx, timestamp, keyids);
+      for (i=0; i < lanes; i++)
+        {
+          _vanity_sha1_fingerprint (&ctx, timestamp + i, fpr);
+          if (keyids[i] != buf32_to_u32 (fpr + 16))
+            fail (n * 100 + i);
+        }
+    }
+}
+
+
+/* Compare the digests computed by the selected digest kernel against
+   the scalar kernel.  */
+static void
+test_sha1_digests (void)
+{
+  unsigned char packet[51];
+  unsigned char fpr[VANITY_FPR_LEN];
+  u32 digests[5 * VANITY_SHA1_MAX_LANES];
+  struct vanity_sha1_s ctx;
+  u32 timestamp = 0xfffff000;
+  unsigned int i, n, w, lanes;
+
+  lanes = _vanity_sha1_digest_lanes ();
+  if (!lanes || lanes > VANITY_SHA1_MAX_LANES)
+    fail (0);
+
+  gcry_create_nonce (packet, sizeof packet);
+  _vanity_sha1_prepare (&ctx, packet, sizeof packet);
+  for (n=0; n < 100; n++, timestamp += lanes)
+    {
+      _vanity_sha1_digests (&ctx, timestamp, digests);
+      for (i=0; i < lanes; i++)
+        {
+          _vanity_sha1_fingerprint (&ctx, timestamp + i, fpr);
+          for (w=0; w < 5; w++)
+            if (digests[w * VANITY_SHA1_MAX_LANES + i]
+                != buf32_to_u32 (fpr + 4 * w))
+              fail (n * 100 + i);
+        }
+    }
+}
+
+
+/* Compare the digests computed by the selected multi-block kernel
+   against the scalar kernel for a packet of the size of an RSA-2048
+   key.  */
+static void
+test_sha1_multi (void)
+{
+  unsigned char packet[272];
+  unsigned char fpr[VANITY_FPR_LEN];
+  u32 digests[5 * VANITY_SHA1_MAX_LANES];
+  struct vanity_sha1_s ctx;
+  u32 timestamp = 0x55b3a5a1;
+  unsigned int i, n, w, lanes;
+
+  lanes = _vanity_sha1_multi_lanes ();
+  if (!lanes || lanes > VANITY_SHA1_MAX_LANES)
+    fail (0);
+
+  gcry_create_nonce (packet, sizeof packet);
+  _vanity_sha1_prepare (&ctx, packet, sizeof packet);
+  if (ctx.ntail != 4)
+    fail (1);
+  for (n=0; n < 100; n++, timestamp += lanes)
+    {
+      _vanity_sha1_multi_digests (&ctx, timestamp, digests);
+      for (i=0; i < lanes; i++)
+        {
+          _vanity_sha1_fingerprint (&ctx, timestamp + i, fpr);
+          for (w=0; w < 5; w++)
+            if (digests[w * VANITY_SHA1_MAX_LANES + i]
+                != buf32_to_u32 (fpr + 4 * w))
+              fail (n * 100 + i);
+        }
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_sha1_kernel ();
+  test_sha1_keyids ();
+  test_sha1_digests ();
+  test_sha1_multi ();
+
+  return 0;
+}
@@ -0,0 +1,126 @@
+/* t-vanity-sha256.c - Module test for vanity-sha256.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+#include "../common/host2net.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* Compare the scalar fingerprint against libgcrypt for all packet
+   lengths of a v5 key, including those taking several blocks, and a
+   few timestamps.  */
+static void
+test_sha256_fingerprint (void)
+{
+  static const u32 timestamps[] = {
+    0, 1, 0x55b3a5a1, 0x80000000, 0xfffffffe, 0xffffffff
+  };
+  unsigned char packet[VANITY_SHA256_MAXLEN];
+  unsigned char expect[VANITY_V5_FPR_LEN];
+  unsigned char fpr[VANITY_V5_FPR_LEN];
+  struct vanity_sha256_s ctx;
+  size_t len;
+  int i;
+
+  for (len=10; len <= VANITY_SHA256_MAXLEN; len++)
+    {
+      gcry_create_nonce (packet, len);
+      _vanity_sha256_prepare (&ctx, packet, len);
+      for (i=0; i < DIM (timestamps); i++)
+        {
+          packet[6] = timestamps[i] >> 24;
+          packet[7] = timestamps[i] >> 16;
+          packet[8] = timestamps[i] >> 8;
+          packet[9] = timestamps[i];
+          gcry_md_hash_buffer (GCRY_MD_SHA256, expect, packet, len);
+          _vanity_sha256_fingerprint (&ctx, timestamps[i], fpr);
+          if (memcmp (fpr, expect, VANITY_V5_FPR_LEN))
+            fail ((int)len * 100 + i);
+        }
+    }
+}
+
+
+/* Compare the digests computed by each kernel the CPU supports
+   against the scalar fingerprint for a single and a multi-block
+   packet.  */
+static void
+test_sha256_kernels (void)
+{
+  static const size_t lengths[] = { 60, 300 };
+  unsigned char packet[300];
+  unsigned char fpr[VANITY_V5_FPR_LEN];
+  u32 digests[VANITY_MAX_DIGEST_WORDS * VANITY_SHA1_MAX_LANES];
+  struct vanity_sha256_s ctx;
+  const char *name;
+  u32 timestamp;
+  unsigned int i, k, l, n, w, lanes;
+
+  _vanity_sha256_init ();
+  for (k=0; (name = _vanity_sha256_kernel_list (k)); k++)
+    {
+      if (!_vanity_sha256_select (name))
+        continue;
+      lanes = _vanity_sha256_lanes ();
+      if (!lanes || lanes > VANITY_SHA1_MAX_LANES)
+        fail (k);
+
+      for (l=0; l < DIM (lengths); l++)
+        {
+          gcry_create_nonce (packet, lengths[l]);
+          _vanity_sha256_prepare (&ctx, packet, lengths[l]);
+          timestamp = 0xfffff000;
+          for (n=0; n < 100; n++, timestamp += lanes)
+            {
+              _vanity_sha256_digests (&ctx, timestamp, digests);
+              for (i=0; i < lanes; i++)
+                {
+                  _vanity_sha256_fingerprint (&ctx, timestamp + i, fpr);
+                  for (w=0; w < 8; w++)
+                    if (digests[w * VANITY_SHA1_MAX_LANES + i]
+                        != buf32_to_u32 (fpr + 4 * w))
+                      fail (k * 10000 + l * 1000 + n * 10 + i);
+                }
+            }
+        }
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_sha256_fingerprint ();
+  test_sha256_kernels ();
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+/* t-vanity-sha512.c - Module test for vanity-sha512.c
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* The largest number of seeds expanded at once; this is not a
+   multiple of the lanes of any kernel.  */
+#define NSEEDS 19
+
+
+/* Compare the scalars computed by each kernel the CPU supports
+   against libgcrypt for all numbers of seeds up to NSEEDS.  */
+static void
+test_sha512_kernels (void)
+{
+  unsigned char seeds[32 * NSEEDS];
+  unsigned char scalars[32 * NSEEDS + 1];
+  unsigned char hash[64];
+  const char *name;
+  unsigned int k, n, i;
+
+  _vanity_sha512_init ();
+  for (k=0; (name = _vanity_sha512_kernel_list (k)); k++)
+    {
+      if (!_vanity_sha512_select (name))
+        continue;
+
+      for (n=1; n <= NSEEDS; n++)
+        {
+          gcry_create_nonce (seeds, 32 * n);
+          scalars[32 * n] = 0xa5;
+          _vanity_sha512_expand (seeds, n, scalars);
+          if (scalars[32 * n] != 0xa5)
+            fail (k * 100 + n);
+          for (i=0; i < n; i++)
+            {
+              gcry_md_hash_buffer (GCRY_MD_SHA512, hash, seeds + 32 * i, 32);
+              hash[0] &= 248;
+              hash[31] &= 127;
+              hash[31] |= 64;
+              if (memcmp (scalars + 32 * i, hash, 32))
+                fail (k * 100 + n);
+            }
+        }
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  test_sha512_kernels ();
+
+  return 0;
+}
@@ -0,0 +1,227 @@
+/* vanity-arena.c - Locked memory for the secrets of candidate keys
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Each batch of generated keys needs a buffer for its secrets, which
+   is released again as soon as the batch has been swept.  Taking
+   these from the secure heap of libgcrypt at the rate the workers
+   generate keys makes its single lock a point of contention and can
+   exhaust the heap, which is sized for a few long-lived keys.
+
+   Instead each worker gets an arena of equally sized slots in memory
+   of its own, which is locked once when the arena is created and
+   excluded from core dumps where the system allows.  A slot handed
+   back is wiped in place and reused by the next batch.  Only the
+   secret of a key actually found leaves the arena, when that key is
+   converted into an S-expression.
+
+   A slot is taken by the worker owning the arena but may be handed
+   back by any other one.  The critical sections are a few
+   instructions long, thus the lock is taken by spinning on
+   npth_mutex_trylock, which other than npth_mutex_lock may be used
+   without holding the npth global lock.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#if defined(HAVE_MMAP) && defined(HAVE_MLOCK)
+# include <sys/mman.h>
+#endif
+#include <npth.h>
+
+#include "vanity-defs.h"
+
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+/* Slots are aligned to this many bytes.  */
+#define SLOT_ALIGN 64
+
+
+struct vanity_arena_s
+{
+  npth_mutex_t lock;
+  size_t slotlen;            /* The length of a slot.  */
+  unsigned int nslots;       /* The number of slots.  */
+  unsigned int nfree;        /* The number of entries in FREE.  */
+  unsigned int *free;        /* The indices of the free slots.  */
+  size_t memlen;             /* The length of MEM.  */
+  unsigned char *mem;        /* The locked memory with the slots.  */
+};
+
+
+static void
+lock_arena (vanity_arena_t arena)
+{
+  while (npth_mutex_trylock (&arena->lock))
+    ;
+}
+
+
+/* Return the length of the page aligned memory for NSLOTS slots of
+   SLOTLEN bytes.  */
+static size_t
+arena_memlen (size_t slotlen, unsigned int nslots)
+{
+  long pagesize;
+
+  pagesize = sysconf (_SC_PAGESIZE);
+  if (pagesize <= 0)
+    pagesize = 4096;
+  slotlen = (slotlen + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+  return (slotlen * nslots + pagesize - 1) / pagesize * pagesize;
+}
+
+
+/* Return the bytes of memory an arena of NSLOTS slots of SLOTLEN
+   bytes takes, of which all but a few are locked.  */
+size_t
+_vanity_arena_memory (size_t slotlen, unsigned int nslots)
+{
+  return (sizeof (struct vanity_arena_s) + nslots * sizeof (unsigned int)
+          + arena_memlen (slotlen, nslots));
+}
+
+
+/* Create an arena of NSLOTS slots of SLOTLEN bytes each.  Fails if
+   the memory can't be locked; the caller then falls back to the
+   secure heap.  */
+gpg_error_t
+_vanity_arena_new (vanity_arena_t *r_arena, size_t slotlen,
+                   unsigned int nslots)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_MLOCK) && defined(MAP_ANONYMOUS)
+  gpg_error_t err;
+  vanity_arena_t arena;
+  unsigned int i;
+  int rc;
+
+  *r_arena = NULL;
+
+  if (!slotlen || !nslots)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  arena = xtrycalloc (1, sizeof *arena);
+  if (!arena)
+    return gpg_error_from_syserror ();
+  arena->slotlen = (slotlen + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+  arena->nslots = nslots;
+  arena->memlen = arena_memlen (slotlen, nslots);
+  arena->free = xtrycalloc (nslots, sizeof *arena->free);
+  if (!arena->free)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (arena);
+      return err;
+    }
+  arena->mem = mmap (NULL, arena->memlen, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (arena->mem == MAP_FAILED)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (arena->free);
+      xfree (arena);
+      return err;
+    }
+  if (mlock (arena->mem, arena->memlen))
+    {
+      err = gpg_error_from_syserror ();
+      munmap (arena->mem, arena->memlen);
+      xfree (arena->free);
+      xfree (arena);
+      return err;
+    }
+#ifdef MADV_DONTDUMP
+  madvise (arena->mem, arena->memlen, MADV_DONTDUMP);
+#endif
+  rc = npth_mutex_init (&arena->lock, NULL);
+  if (rc)
+    {
+      munlock (arena->mem, arena->memlen);
+      munmap (arena->mem, arena->memlen);
+      xfree (arena->free);
+      xfree (arena);
+      return gpg_error_from_errno (rc);
+    }
+
+  /* Hand out the first slots first.  */
+  for (i=0; i < nslots; i++)
+    arena->free[i] = nslots - 1 - i;
+  arena->nfree = nslots;
+
+  *r_arena = arena;
+  return 0;
+#else
+  (void)slotlen;
+  (void)nslots;
+  *r_arena = NULL;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+}
+
+
+/* Release ARENA.  All slots must have been handed back.  */
+void
+_vanity_arena_release (vanity_arena_t arena)
+{
+  if (!arena)
+    return;
+#if defined(HAVE_MMAP) && defined(HAVE_MLOCK) && defined(MAP_ANONYMOUS)
+  wipememory (arena->mem, arena->memlen);
+  munlock (arena->mem, arena->memlen);
+  munmap (arena->mem, arena->memlen);
+#endif
+  npth_mutex_destroy (&arena->lock);
+  xfree (arena->free);
+  xfree (arena);
+}
+
+
+/* Return a free slot of ARENA or NULL if all are in use.  The slot
+   has the length given to _vanity_arena_new and is cleared.  */
+void *
+_vanity_arena_get (vanity_arena_t arena)
+{
+  unsigned char *p = NULL;
+
+  lock_arena (arena);
+  if (arena->nfree)
+    p = arena->mem + arena->free[--arena->nfree] * arena->slotlen;
+  npth_mutex_unlock (&arena->lock);
+  return p;
+}
+
+
+/* Wipe the slot P taken from ARENA and hand it back.  */
+void
+_vanity_arena_put (vanity_arena_t arena, void *p)
+{
+  size_t idx;
+
+  if (!p)
+    return;
+  idx = ((unsigned char *)p - arena->mem) / arena->slotlen;
+  wipememory (p, arena->slotlen);
+  lock_arena (arena);
+  arena->free[arena->nfree++] = idx;
+  npth_mutex_unlock (&arena->lock);
+}
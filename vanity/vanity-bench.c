@@ -0,0 +1,867 @@
+/* vanity-bench.c - Benchmark the stages of a vanity key search
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Each stage of the search is timed separately for about a second.
+   Every result is written as one line
+
+     STAGE VARIANT PARAMETER VALUE UNIT
+
+   with the fields separated by a single space and "-" for a missing
+   parameter; comment lines start with a '#'.  The stages are:
+
+     keyid   - Preparing a generated key for the fingerprint: via
+               MPIs as g10 does it and directly from Q.
+     sha1    - Each SHA-1 kernel supported by the CPU, libgcrypt and
+               the OpenCL device, if there is one.
+     keygen  - gcry_randomize against the per-thread random stream
+               and gcry_pk_genkey against the batch key generation.
+     match   - Matching keyids against patterns of growing size, the
+               batch scan of each specialised matcher and scoring
+               digests with each kind of score item.
+     search  - Complete searches; their rate is projected to the hits
+               per hour for a keyid pattern of --width bits.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_GETTIMEOFDAY
+# include <sys/time.h>
+#endif
+#include <npth.h>
+
+#include "vanity-defs.h"
+#include "../common/openpgpdefs.h"
+#include "../common/host2net.h"
+
+#define PGM "vanity-bench"
+
+/* The number of timestamps hashed by one kernel call of the device.  */
+#define GPU_COUNT (1 << 20)
+
+/* The largest pattern width searched for; wider patterns are
+   projected from the rate of the searches.  */
+#define MAX_SEARCH_WIDTH 20
+
+static unsigned int bench_seconds = 1;
+static unsigned int search_width = 32;
+static int use_gpu;
+
+
+static void
+die (const char *what, gpg_error_t err)
+{
+  fprintf (stderr, PGM ": %s failed: %s\n", what, gpg_strerror (err));
+  exit (1);
+}
+
+
+/* Return a monotonic time in seconds.  */
+static double
+now (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#elif defined(HAVE_GETTIMEOFDAY)
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+#else
+  return time (NULL);
+#endif
+}
+
+
+static void
+print_result (const char *stage, const char *variant, const char *param,
+              double value, const char *unit)
+{
+  printf ("%s %s %s %.6g %s\n", stage, variant, param? param : "-",
+          value, unit);
+  fflush (stdout);
+}
+
+
+/* Call FNC with OPAQUE until about BENCH_SECONDS seconds have passed.
+   FNC returns the number of operations it did.  Returns the
+   operations per second.  */
+static double
+measure (unsigned long long (*fnc) (void *opaque), void *opaque)
+{
+  unsigned long long n = 0;
+  double start, elapsed;
+
+  start = now ();
+  do
+    n += fnc (opaque);
+  while ((elapsed = now () - start) < bench_seconds);
+  return n / elapsed;
+}
+
+
+/* Return a new Ed25519 key.  */
+static gcry_sexp_t
+new_ed25519_key (void)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_param, s_key;
+
+  err = gcry_sexp_build (&s_param, NULL,
+                         "(genkey(ecc(curve Ed25519)(flags eddsa)))");
+  if (err)
+    die ("gcry_sexp_build", err);
+  err = gcry_pk_genkey (&s_key, s_param);
+  if (err)
+    die ("gcry_pk_genkey", err);
+  gcry_sexp_release (s_param);
+  return s_key;
+}
+
+
+
+/*
+ * keyid
+ */
+
+struct keyid_parm_s
+{
+  gcry_sexp_t s_public;
+  vanity_refkey_t refkey;
+  const unsigned char *q;
+  size_t qlen;
+  unsigned char oid[VANITY_MAX_OIDLEN];
+  size_t oidlen;
+};
+
+
+static unsigned long long
+keyid_sexp (void *opaque)
+{
+  struct keyid_parm_s *parm = opaque;
+  vanity_refkey_t refkey;
+  unsigned char fpr[VANITY_FPR_LEN];
+  gpg_error_t err;
+  int i;
+
+  for (i=0; i < 1000; i++)
+    {
+      err = _vanity_refkey_new (&refkey, parm->s_public,
+                                PUBKEY_ALGO_EDDSA, 4);
+      if (err)
+        die ("_vanity_refkey_new", err);
+      _vanity_refkey_fingerprint (refkey, i, fpr);
+      _vanity_refkey_release (refkey);
+    }
+  return i;
+}
+
+
+static unsigned long long
+keyid_q (void *opaque)
+{
+  struct keyid_parm_s *parm = opaque;
+  unsigned char fpr[VANITY_FPR_LEN];
+  gpg_error_t err;
+  int i;
+
+  for (i=0; i < 1000; i++)
+    {
+      err = _vanity_refkey_set_q (parm->refkey, parm->q, parm->qlen,
+                                  PUBKEY_ALGO_EDDSA, parm->oid, parm->oidlen,
+                                  NULL);
+      if (err)
+        die ("_vanity_refkey_set_q", err);
+      _vanity_refkey_fingerprint (parm->refkey, i, fpr);
+    }
+  return i;
+}
+
+
+/* Time the preparation of a key including its first fingerprint.  */
+static void
+bench_keyid (void)
+{
+  struct keyid_parm_s parm;
+  gcry_sexp_t s_key, s_param, l1;
+  unsigned int nbits;
+  gpg_error_t err;
+
+  memset (&parm, 0, sizeof parm);
+  s_key = new_ed25519_key ();
+  parm.s_public = gcry_sexp_find_token (s_key, "public-key", 0);
+  err = gcry_sexp_build (&s_param, NULL, "(genkey(ecc(curve Ed25519)))");
+  if (!err)
+    err = _vanity_curve_oid (s_param, parm.oid, &parm.oidlen, &nbits);
+  if (!err)
+    err = _vanity_refkey_new (&parm.refkey, NULL, PUBKEY_ALGO_EDDSA, 4);
+  if (err)
+    die ("preparing the key", err);
+  l1 = gcry_sexp_find_token (parm.s_public, "q", 0);
+  if (!l1)
+    die ("preparing the key", gpg_error (GPG_ERR_NO_OBJ));
+  parm.q = (const unsigned char *)gcry_sexp_nth_data (l1, 1, &parm.qlen);
+
+  print_result ("keyid", "sexp", NULL, measure (keyid_sexp, &parm), "keys/s");
+  print_result ("keyid", "q", NULL, measure (keyid_q, &parm), "keys/s");
+
+  _vanity_refkey_release (parm.refkey);
+  gcry_sexp_release (l1);
+  gcry_sexp_release (s_param);
+  gcry_sexp_release (parm.s_public);
+  gcry_sexp_release (s_key);
+}
+
+
+
+/*
+ * sha1
+ */
+
+struct sha1_parm_s
+{
+  struct vanity_sha1_s ctx;
+  unsigned char packet[51];
+  u32 blocks[16 * VANITY_GPU_MAX_KEYS];
+  vanity_gpu_t gpu;
+  u32 timestamp;
+};
+
+
+static unsigned long long
+sha1_keyids (void *opaque)
+{
+  struct sha1_parm_s *parm = opaque;
+  u32 keyids[VANITY_SHA1_MAX_LANES];
+  unsigned int lanes = _vanity_sha1_lanes ();
+  unsigned int n;
+
+  for (n=0; n < 65536; n += lanes)
+    _vanity_sha1_keyids (&parm->ctx, parm->timestamp + n, keyids);
+  parm->timestamp += n;
+  return n;
+}
+
+
+static unsigned long long
+sha1_digests (void *opaque)
+{
+  struct sha1_parm_s *parm = opaque;
+  u32 digests[5 * VANITY_SHA1_MAX_LANES];
+  unsigned int lanes = _vanity_sha1_digest_lanes ();
+  unsigned int n;
+
+  for (n=0; n < 65536; n += lanes)
+    _vanity_sha1_digests (&parm->ctx, parm->timestamp + n, digests);
+  parm->timestamp += n;
+  return n;
+}
+
+
+static unsigned long long
+sha1_libgcrypt (void *opaque)
+{
+  struct sha1_parm_s *parm = opaque;
+  unsigned char fpr[VANITY_FPR_LEN];
+  unsigned int n;
+
+  for (n=0; n < 65536; n++)
+    {
+      parm->packet[4] = (parm->timestamp + n) >> 24;
+      parm->packet[5] = (parm->timestamp + n) >> 16;
+      parm->packet[6] = (parm->timestamp + n) >> 8;
+      parm->packet[7] = (parm->timestamp + n);
+      gcry_md_hash_buffer (GCRY_MD_SHA1, fpr, parm->packet,
+                           sizeof parm->packet);
+    }
+  parm->timestamp += n;
+  return n;
+}
+
+
+static unsigned long long
+sha1_gpu (void *opaque)
+{
+  struct sha1_parm_s *parm = opaque;
+  struct vanity_gpu_hit_s hits[VANITY_GPU_MAX_HITS];
+  unsigned int nhits;
+  gpg_error_t err;
+
+  err = _vanity_gpu_sweep (parm->gpu, parm->blocks, VANITY_GPU_MAX_KEYS,
+                           parm->timestamp, GPU_COUNT, hits, &nhits);
+  if (err)
+    die ("_vanity_gpu_sweep", err);
+  parm->timestamp += GPU_COUNT;
+  return (unsigned long long)GPU_COUNT * VANITY_GPU_MAX_KEYS;
+}
+
+
+/* Time each SHA-1 kernel on a random Ed25519 key packet.  */
+static void
+bench_sha1 (void)
+{
+  static struct sha1_parm_s parm;
+  struct vanity_filter_s filter;
+  vanity_pattern_t pattern;
+  char *best, *dbest;
+  const char *name;
+  gpg_error_t err;
+  unsigned int i;
+
+  gcry_create_nonce (parm.packet, sizeof parm.packet);
+  parm.packet[0] = 0x99;
+  parm.packet[1] = 0;
+  parm.packet[2] = sizeof parm.packet - 3;
+  parm.packet[3] = 4;
+  _vanity_sha1_prepare (&parm.ctx, parm.packet, sizeof parm.packet);
+  parm.timestamp = 0x55000000;
+
+  best = xstrdup (_vanity_sha1_kernel_name ());
+  dbest = xstrdup (_vanity_sha1_digest_kernel_name ());
+  for (i=0; (name = _vanity_sha1_kernel_list (i)); i++)
+    {
+      if (_vanity_sha1_select (name, 0))
+        print_result ("sha1", name, "keyids",
+                      measure (sha1_keyids, &parm), "fpr/s");
+      if (_vanity_sha1_select (name, 1))
+        print_result ("sha1", name, "digests",
+                      measure (sha1_digests, &parm), "fpr/s");
+    }
+  _vanity_sha1_select (best, 0);
+  _vanity_sha1_select (dbest, 1);
+  xfree (best);
+  xfree (dbest);
+
+  print_result ("sha1", "libgcrypt", "digests",
+                measure (sha1_libgcrypt, &parm), "fpr/s");
+
+  if (!_vanity_gpu_init ())
+    return;
+  err = vanity_pattern_new (&pattern, "DEADBEEF");
+  if (!err)
+    err = _vanity_pattern_filter (pattern, &filter);
+  if (!err)
+    err = _vanity_gpu_new (&parm.gpu, &filter);
+  if (err)
+    die ("preparing the device", err);
+  for (i=0; i < VANITY_GPU_MAX_KEYS; i++)
+    memcpy (parm.blocks + 16 * i, parm.ctx.block, sizeof parm.ctx.block);
+  print_result ("sha1", "opencl", "keyids", measure (sha1_gpu, &parm),
+                "fpr/s");
+  _vanity_gpu_release (parm.gpu);
+  _vanity_filter_release (&filter);
+  vanity_pattern_release (pattern);
+}
+
+
+
+/*
+ * keygen
+ */
+
+static unsigned long long
+keygen_gcry (void *opaque)
+{
+  gcry_sexp_t s_param = opaque;
+  gcry_sexp_t s_key;
+  gpg_error_t err;
+
+  err = gcry_pk_genkey (&s_key, s_param);
+  if (err)
+    die ("gcry_pk_genkey", err);
+  gcry_sexp_release (s_key);
+  return 1;
+}
+
+
+struct keygen_parm_s
+{
+  vanity_rng_t rng;
+  vanity_ecc_t ecc;
+};
+
+
+static unsigned long long
+keygen_ed25519 (void *opaque)
+{
+  struct keygen_parm_s *parm = opaque;
+  unsigned char seeds[32 * VANITY_ED25519_BATCH];
+  unsigned char q[32 * VANITY_ED25519_BATCH];
+  gpg_error_t err;
+
+  err = _vanity_rng_randomize (parm->rng, seeds, sizeof seeds);
+  if (err)
+    die ("_vanity_rng_randomize", err);
+  _vanity_ed25519_keys (seeds, VANITY_ED25519_BATCH, q);
+  wipememory (seeds, sizeof seeds);
+  return VANITY_ED25519_BATCH;
+}
+
+
+static unsigned long long
+keygen_sha512 (void *opaque)
+{
+  unsigned char *seeds = opaque;
+  unsigned char scalars[32 * VANITY_ED25519_BATCH];
+
+  _vanity_sha512_expand (seeds, VANITY_ED25519_BATCH, scalars);
+  /* Chain the results so that no call can be dropped.  */
+  seeds[0] ^= scalars[1];
+  return VANITY_ED25519_BATCH;
+}
+
+
+static unsigned long long
+keygen_ecc (void *opaque)
+{
+  struct keygen_parm_s *parm = opaque;
+  unsigned char buffer[VANITY_MAX_QLEN * VANITY_ECC_BATCH];
+  gcry_mpi_t d;
+  gpg_error_t err;
+
+  err = _vanity_ecc_keys (parm->ecc, parm->rng, &d, buffer);
+  if (err)
+    die ("_vanity_ecc_keys", err);
+  gcry_mpi_release (d);
+  return VANITY_ECC_BATCH;
+}
+
+
+static unsigned long long
+random_gcry (void *opaque)
+{
+  unsigned char seed[32];
+  int i;
+
+  (void)opaque;
+  for (i=0; i < 1000; i++)
+    gcry_randomize (seed, sizeof seed, GCRY_STRONG_RANDOM);
+  wipememory (seed, sizeof seed);
+  return i;
+}
+
+
+static unsigned long long
+random_stream (void *opaque)
+{
+  struct keygen_parm_s *parm = opaque;
+  unsigned char seed[32];
+  gpg_error_t err;
+  int i;
+
+  for (i=0; i < 1000; i++)
+    {
+      err = _vanity_rng_randomize (parm->rng, seed, sizeof seed);
+      if (err)
+        die ("_vanity_rng_randomize", err);
+    }
+  wipememory (seed, sizeof seed);
+  return i;
+}
+
+
+/* Time the random sources, and gcry_pk_genkey and the batch key
+   generation for Ed25519 and NIST P-256.  */
+static void
+bench_keygen (void)
+{
+  struct keygen_parm_s parm;
+  gcry_sexp_t s_param;
+  gpg_error_t err;
+
+  memset (&parm, 0, sizeof parm);
+  err = _vanity_rng_new (&parm.rng, GCRY_STRONG_RANDOM, 0);
+  if (err)
+    die ("_vanity_rng_new", err);
+  print_result ("keygen", "gcry", "random",
+                measure (random_gcry, NULL), "seeds/s");
+  print_result ("keygen", "stream", "random",
+                measure (random_stream, &parm), "seeds/s");
+
+  err = gcry_sexp_build (&s_param, NULL,
+                         "(genkey(ecc(curve Ed25519)(flags eddsa)))");
+  if (err)
+    die ("gcry_sexp_build", err);
+  print_result ("keygen", "gcry", "ed25519",
+                measure (keygen_gcry, s_param), "keys/s");
+  gcry_sexp_release (s_param);
+  if (_vanity_ed25519_init ())
+    {
+      unsigned char seeds[32 * VANITY_ED25519_BATCH];
+      const char *name;
+      char *best;
+      unsigned int i;
+
+      print_result ("keygen", "batch", "ed25519",
+                    measure (keygen_ed25519, &parm), "keys/s");
+
+      best = xstrdup (_vanity_ed25519_kernel_name ());
+      for (i=0; (name = _vanity_ed25519_kernel_list (i)); i++)
+        if (_vanity_ed25519_select (name))
+          print_result ("keygen", name, "ed25519",
+                        measure (keygen_ed25519, &parm), "keys/s");
+      _vanity_ed25519_select (best);
+      xfree (best);
+
+      gcry_create_nonce (seeds, sizeof seeds);
+      best = xstrdup (_vanity_sha512_kernel_name ());
+      for (i=0; (name = _vanity_sha512_kernel_list (i)); i++)
+        if (_vanity_sha512_select (name))
+          print_result ("keygen", name, "sha512",
+                        measure (keygen_sha512, seeds), "seeds/s");
+      _vanity_sha512_select (best);
+      xfree (best);
+    }
+
+  err = gcry_sexp_build (&s_param, NULL, "(genkey(ecc(curve nistp256)))");
+  if (err)
+    die ("gcry_sexp_build", err);
+  print_result ("keygen", "gcry", "nistp256",
+                measure (keygen_gcry, s_param), "keys/s");
+  if (!_vanity_ecc_new (&parm.ecc, s_param))
+    {
+      print_result ("keygen", "batch", "nistp256",
+                    measure (keygen_ecc, &parm), "keys/s");
+      _vanity_ecc_release (parm.ecc);
+    }
+  gcry_sexp_release (s_param);
+  _vanity_rng_release (parm.rng);
+}
+
+
+
+/*
+ * match
+ */
+
+struct match_parm_s
+{
+  vanity_pattern_t pattern;
+  struct vanity_matcher_s matcher;
+  unsigned int min_score;
+  u32 keyids[4096];
+  u32 digests[5 * 1024];
+};
+
+
+static unsigned long long
+match_keyids (void *opaque)
+{
+  struct match_parm_s *parm = opaque;
+  unsigned int i, hits = 0;
+
+  for (i=0; i < DIM (parm->keyids); i++)
+    hits += !!vanity_pattern_match (parm->pattern, parm->keyids[i]);
+  /* Keep the compiler from dropping the loop.  */
+  if (hits > DIM (parm->keyids))
+    abort ();
+  return i;
+}
+
+
+static unsigned long long
+scan_batches (void *opaque)
+{
+  struct match_parm_s *parm = opaque;
+  const struct vanity_matcher_s *m = &parm->matcher;
+  unsigned int i, n, hits = 0;
+
+  /* The digest words of a batch are VANITY_SHA1_MAX_LANES apart.  */
+  if (_vanity_pattern_need_digest (parm->pattern))
+    {
+      for (n=i=0; i + 5 * VANITY_SHA1_MAX_LANES <= DIM (parm->digests);
+           i += 5 * VANITY_SHA1_MAX_LANES, n += VANITY_SHA1_MAX_LANES)
+        hits |= m->scan (m, parm->digests + i, VANITY_SHA1_MAX_LANES);
+    }
+  else
+    {
+      for (n=i=0; i < DIM (parm->keyids);
+           i += VANITY_SHA1_MAX_LANES, n += VANITY_SHA1_MAX_LANES)
+        hits |= m->scan (m, parm->keyids + i, VANITY_SHA1_MAX_LANES);
+    }
+  /* Keep the compiler from dropping the loop.  */
+  if (hits == 0x12345)
+    abort ();
+  return n;
+}
+
+
+static unsigned long long
+score_digests (void *opaque)
+{
+  struct match_parm_s *parm = opaque;
+  unsigned int i, item, sum = 0;
+
+  for (i=0; i < DIM (parm->digests); i += 5)
+    sum += _vanity_pattern_score_words (parm->pattern, parm->digests + i,
+                                        parm->min_score, &item);
+  /* Keep the compiler from dropping the loop.  */
+  if (sum > 40 * DIM (parm->digests))
+    abort ();
+  return i / 5;
+}
+
+
+/* Time the matching of random keyids against PATTERNS of 1 up to 2^20
+   random exact keyids, the batch scans of the matchers and the
+   scoring of random digests, once for all of them and once when only
+   a score of 6 is of interest.  */
+static void
+bench_match (void)
+{
+  static const char *scan_patterns[] =
+    { "BEEF", "C0FFEE", "DEADBEEF", "BEEF,F00D", "0123456789ABCDEF",
+      "?00D", "prefix:C0FFEE", "prefix:0123456789AB", "prefix:C?FFEE" };
+  static const char *score_patterns[] =
+    { "score:zeros", "score:run", "score:word:C0FFEE" };
+  static struct match_parm_s parm;
+  unsigned int nitems, i;
+  char numbuf[20];
+  char *string, *p;
+  u32 keyid;
+  gpg_error_t err;
+
+  gcry_create_nonce (parm.keyids, sizeof parm.keyids);
+  string = xmalloc ((1 << 20) * 9 + 1);
+  for (nitems = 1; nitems <= (1 << 20); nitems *= 4)
+    {
+      p = string;
+      for (i=0; i < nitems; i++)
+        {
+          gcry_create_nonce (&keyid, sizeof keyid);
+          p += sprintf (p, "%08lX ", (unsigned long)keyid);
+        }
+      err = vanity_pattern_new (&parm.pattern, string);
+      if (err)
+        die ("vanity_pattern_new", err);
+      snprintf (numbuf, sizeof numbuf, "%u", nitems);
+      print_result ("match", "keyid", numbuf,
+                    measure (match_keyids, &parm), "keyids/s");
+      vanity_pattern_release (parm.pattern);
+    }
+  xfree (string);
+
+  gcry_create_nonce (parm.digests, sizeof parm.digests);
+  for (i=0; i < DIM (scan_patterns); i++)
+    {
+      err = vanity_pattern_new (&parm.pattern, scan_patterns[i]);
+      if (err)
+        die ("vanity_pattern_new", err);
+      _vanity_matcher_init (&parm.matcher, parm.pattern);
+      print_result ("match", "scan", parm.matcher.name,
+                    measure (scan_batches, &parm),
+                    (_vanity_pattern_need_digest (parm.pattern)
+                     ? "digests/s" : "keyids/s"));
+      vanity_pattern_release (parm.pattern);
+    }
+
+  for (i=0; i < DIM (score_patterns); i++)
+    {
+      err = vanity_pattern_new (&parm.pattern, score_patterns[i]);
+      if (err)
+        die ("vanity_pattern_new", err);
+      for (parm.min_score = 0; parm.min_score <= 6; parm.min_score += 6)
+        {
+          snprintf (numbuf, sizeof numbuf, "%s>=%u",
+                    score_patterns[i] + 6, parm.min_score);
+          print_result ("match", "score", numbuf,
+                        measure (score_digests, &parm), "digests/s");
+        }
+      vanity_pattern_release (parm.pattern);
+    }
+}
+
+
+
+/*
+ * search
+ */
+
+/* Run complete Ed25519 searches for a keyid pattern of up to
+   MAX_SEARCH_WIDTH bits and project their rate to SEARCH_WIDTH
+   bits.  */
+static void
+bench_search (void)
+{
+  unsigned int width = search_width;
+  unsigned long long iterations = 0;
+  unsigned long hits = 0;
+  gcry_sexp_t s_param, s_private, s_public;
+  vanity_job_t job;
+  double start, elapsed, rate;
+  char pattern[20], numbuf[20];
+  gpg_error_t err;
+
+  if (width > MAX_SEARCH_WIDTH)
+    width = MAX_SEARCH_WIDTH;
+  snprintf (pattern, sizeof pattern, "0/%lX",
+            (unsigned long)(((u32)1 << width) - 1));
+  err = gcry_sexp_build (&s_param, NULL,
+                         "(genkey(ecc(curve Ed25519)(flags eddsa)))");
+  if (err)
+    die ("gcry_sexp_build", err);
+
+  start = now ();
+  do
+    {
+      err = vanity_job_new (&job, s_param, PUBKEY_ALGO_EDDSA,
+                            (u32)time (NULL));
+      if (!err)
+        err = vanity_set_pattern (job, pattern);
+      if (err)
+        die ("vanity_job_new", err);
+      vanity_set_gpu (job, use_gpu);
+      err = vanity_search (job, &s_private, &s_public);
+      if (err)
+        die ("vanity_search", err);
+      iterations += vanity_get_iterations (job);
+      hits++;
+      gcry_sexp_release (s_private);
+      gcry_sexp_release (s_public);
+      vanity_job_release (job);
+    }
+  while ((elapsed = now () - start) < bench_seconds);
+  gcry_sexp_release (s_param);
+
+  rate = iterations / elapsed;
+  snprintf (numbuf, sizeof numbuf, "%u", width);
+  print_result ("search", "ed25519", numbuf, rate, "fpr/s");
+  print_result ("search", "ed25519", numbuf, hits * 3600.0 / elapsed,
+                "hits/h");
+  if (width != search_width)
+    {
+      snprintf (numbuf, sizeof numbuf, "%u", search_width);
+      print_result ("search", "ed25519", numbuf,
+                    rate * 3600.0 / 65536.0 / 65536.0
+                    * ((u32)1 << (32 - search_width)), "hits/h");
+    }
+}
+
+
+
+static void
+show_usage (int code)
+{
+  fprintf (code? stderr : stdout,
+           "usage: " PGM " [options] [STAGE...]\n"
+           "Stages: keyid sha1 keygen match search (default: all)\n"
+           "Options:\n"
+           "  --seconds N   time each measurement for N seconds\n"
+           "  --width N     project the search to N bits (1 to 32)\n"
+           "  --gpu         use the OpenCL device for the searches\n");
+  exit (code);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  static struct {
+    const char *name;
+    void (*fnc) (void);
+  } stages[] = {
+    { "keyid",  bench_keyid },
+    { "sha1",   bench_sha1 },
+    { "keygen", bench_keygen },
+    { "match",  bench_match },
+    { "search", bench_search }
+  };
+  int i, any = 0;
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && !strncmp (*argv, "--", 2))
+    {
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        show_usage (0);
+      else if (!strcmp (*argv, "--seconds") && argc > 1)
+        {
+          bench_seconds = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--width") && argc > 1)
+        {
+          search_width = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--gpu"))
+        {
+          use_gpu = 1;
+          argc--; argv++;
+        }
+      else
+        show_usage (1);
+    }
+  if (!bench_seconds || !search_width || search_width > 32)
+    show_usage (1);
+  for (i=0; i < argc; i++)
+    {
+      int j;
+
+      for (j=0; j < DIM (stages); j++)
+        if (!strcmp (argv[i], stages[j].name))
+          break;
+      if (j == DIM (stages))
+        show_usage (1);
+    }
+
+  npth_init ();
+  log_set_prefix (PGM, 1);
+  if (!gcry_check_version (GCRYPT_VERSION))
+    {
+      fprintf (stderr, PGM ": libgcrypt version mismatch\n");
+      return 1;
+    }
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+  _vanity_sha1_init ();
+
+  printf ("# " PGM " (GnuPG) " VERSION "\n");
+  printf ("# workers %u sha1 %s digests %s\n", vanity_default_workers (),
+          _vanity_sha1_kernel_name (), _vanity_sha1_digest_kernel_name ());
+  if (_vanity_gpu_init ())
+    printf ("# opencl %s\n", _vanity_gpu_name ());
+  fflush (stdout);
+
+  for (i=0; i < DIM (stages); i++)
+    {
+      int j;
+
+      if (argc)
+        {
+          for (j=0; j < argc; j++)
+            if (!strcmp (argv[j], stages[i].name))
+              break;
+          if (j == argc)
+            continue;
+        }
+      stages[i].fnc ();
+      any = 1;
+    }
+
+  return !any;
+}
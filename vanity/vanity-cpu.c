@@ -0,0 +1,200 @@
+/* vanity-cpu.c - Placement of the vanity search threads on the CPUs
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The topology is read from the sysfs of Linux.  The CPUs are put in
+   the order in which the workers are placed on them: first one
+   hardware thread of each core, grouped by NUMA node, then the second
+   threads of the cores and so on.  Thus a search with fewer workers
+   than cores never puts two of them on one core and keeps as many of
+   them as possible on one node.
+
+   Binding a thread does not move memory it already touched; the
+   kernel takes new pages from the node of the CPU which first writes
+   to them.  A thread therefore has to be bound before it allocates
+   its tables.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SCHED_SETAFFINITY
+# include <sched.h>
+#endif
+
+#include "vanity-defs.h"
+
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+
+/* Read the decimal number in the sysfs file FNAME into R_VALUE.
+   Returns false if the file does not exist or is malformed.  */
+static int
+read_number (const char *fname, int *r_value)
+{
+  FILE *fp;
+  char line[32];
+  char *endp;
+  long n;
+
+  fp = fopen (fname, "r");
+  if (!fp)
+    return 0;
+  if (!fgets (line, sizeof line, fp))
+    {
+      fclose (fp);
+      return 0;
+    }
+  fclose (fp);
+  n = strtol (line, &endp, 10);
+  if (endp == line || n < 0 || n > 1000000)
+    return 0;
+  *r_value = (int)n;
+  return 1;
+}
+
+
+/* qsort callback putting the CPUs into placement order.  */
+static int
+compare_cpus (const void *a_arg, const void *b_arg)
+{
+  const struct vanity_cpu_s *a = a_arg;
+  const struct vanity_cpu_s *b = b_arg;
+
+  if (a->sibling != b->sibling)
+    return a->sibling - b->sibling;
+  if (a->node != b->node)
+    return a->node - b->node;
+  return a->cpu - b->cpu;
+}
+
+
+/* Store the online CPUs in placement order at R_CPUS.  Unless SMT is
+   true only one hardware thread of each core is listed.  */
+gpg_error_t
+_vanity_cpus_new (vanity_cpus_t *r_cpus, int smt)
+{
+  vanity_cpus_t cpus;
+  struct vanity_cpu_s *c;
+  char fname[100];
+  int cpu, online, node, i;
+  unsigned int j;
+
+  *r_cpus = NULL;
+  cpus = xtrycalloc (1, sizeof *cpus);
+  if (!cpus)
+    return gpg_error_from_syserror ();
+
+  for (cpu=0; cpu < VANITY_MAX_CPUS; cpu++)
+    {
+      snprintf (fname, sizeof fname, SYSFS_CPU "/cpu%d", cpu);
+      if (access (fname, F_OK))
+        break;
+      /* The boot CPU usually can't be taken offline and has no such
+         file.  */
+      snprintf (fname, sizeof fname, SYSFS_CPU "/cpu%d/online", cpu);
+      if (read_number (fname, &online) && !online)
+        continue;
+
+      c = cpus->cpu + cpus->n;
+      c->cpu = cpu;
+      snprintf (fname, sizeof fname,
+                SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+      if (!read_number (fname, &c->package))
+        c->package = 0;
+      snprintf (fname, sizeof fname, SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+      if (!read_number (fname, &c->core))
+        c->core = cpu;
+      c->node = 0;
+      for (node=0; node < VANITY_MAX_NODES; node++)
+        {
+          snprintf (fname, sizeof fname, SYSFS_CPU "/cpu%d/node%d", cpu, node);
+          if (!access (fname, F_OK))
+            {
+              c->node = node;
+              break;
+            }
+        }
+
+      /* The CPUs are listed in increasing number, thus the number of
+         threads of the same core seen so far is the index of this
+         one.  */
+      c->sibling = 0;
+      for (j=0; j < cpus->n; j++)
+        if (cpus->cpu[j].package == c->package && cpus->cpu[j].core == c->core)
+          c->sibling++;
+      if (smt || !c->sibling)
+        cpus->n++;
+    }
+
+  if (!cpus->n)
+    {
+      xfree (cpus);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  qsort (cpus->cpu, cpus->n, sizeof *cpus->cpu, compare_cpus);
+  for (j=0; j < cpus->n; j++)
+    {
+      for (i=0; i < (int)j; i++)
+        if (cpus->cpu[i].node == cpus->cpu[j].node)
+          break;
+      if (i == (int)j)
+        cpus->nnodes++;
+    }
+
+  *r_cpus = cpus;
+  return 0;
+}
+
+
+void
+_vanity_cpus_release (vanity_cpus_t cpus)
+{
+  xfree (cpus);
+}
+
+
+/* Bind the calling thread to entry IDX of CPUS or, if IDX is
+   negative, to all CPUs listed for NODE.  */
+gpg_error_t
+_vanity_cpus_bind (vanity_cpus_t cpus, int idx, int node)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+  cpu_set_t set;
+  unsigned int j;
+
+  CPU_ZERO (&set);
+  if (idx >= 0)
+    CPU_SET (cpus->cpu[idx].cpu, &set);
+  else
+    for (j=0; j < cpus->n; j++)
+      if (cpus->cpu[j].node == node)
+        CPU_SET (cpus->cpu[j].cpu, &set);
+  if (sched_setaffinity (0, sizeof set, &set))
+    return gpg_error_from_syserror ();
+  return 0;
+#else
+  (void)cpus;
+  (void)idx;
+  (void)node;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+}
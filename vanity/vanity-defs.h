@@ -0,0 +1,536 @@
+/* vanity-defs.h - Internal definitions for the vanity key search engine
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_VANITY_DEFS_H
+#define GNUPG_VANITY_DEFS_H 1
+
+/* The engine runs inside gpg-agent; use its error source.  */
+#ifdef GPG_ERR_SOURCE_DEFAULT
+# if GPG_ERR_SOURCE_DEFAULT != GPG_ERR_SOURCE_GPGAGENT
+#  error GPG_ERR_SOURCE_DEFAULT already defined
+# endif
+#else
+# define GPG_ERR_SOURCE_DEFAULT  GPG_ERR_SOURCE_GPGAGENT
+#endif
+#include <gpg-error.h>
+
+#include "../common/util.h"
+#include "vanity.h"
+
+
+/* The maximum length of a curve OID in a key packet.  */
+#define VANITY_MAX_OIDLEN 16
+
+/* The maximum length of a point Q; that is an uncompressed point on
+   NIST P-521.  */
+#define VANITY_MAX_QLEN 133
+
+/* The highest CPU number and number of NUMA nodes the workers are
+   placed on.  */
+#define VANITY_MAX_CPUS 1024
+#define VANITY_MAX_NODES 64
+
+/* A range of creation times to sweep; both ends are inclusive.  */
+struct vanity_window_s
+{
+  u32 start;
+  u32 end;
+};
+
+
+/* A key found by a search.  With a stream key an Ed25519 key is only
+   recorded by REF while the search runs and recreated at its end.  */
+struct vanity_hit_s
+{
+  gcry_sexp_t s_private;    /* NULL once taken by the caller.  */
+  gcry_sexp_t s_public;
+  int has_ref;              /* REF is valid.  */
+  struct vanity_hit_ref_s ref;
+  u32 timestamp;            /* Its creation time.  */
+  u32 keyid;                /* Its low 32 bit keyid.  */
+  unsigned int match;       /* The index of the pattern item it matches.  */
+  unsigned int score;       /* Its score for a scoring pattern.  */
+  unsigned int kdf;         /* The index of its ECDH KDF parameters.  */
+  unsigned char fpr[VANITY_MAX_FPR_LEN];  /* Its fingerprint.  */
+};
+
+
+/* The largest number of values of a specialised matcher.  */
+#define VANITY_MATCHER_MAX_VALUES 4
+
+/* The scan of a pattern for one kernel batch, selected by its shape
+   when the search starts.  */
+struct vanity_matcher_s;
+typedef unsigned int (*vanity_scan_t) (const struct vanity_matcher_s *m,
+                                       const u32 *words, unsigned int n);
+struct vanity_matcher_s
+{
+  const char *name;           /* The shape for diagnostics.  */
+  vanity_scan_t scan;
+  vanity_pattern_t pattern;   /* Used by the generic scans.  */
+  u32 values[VANITY_MATCHER_MAX_VALUES];
+  u32 value2, mask2;          /* The second digest word of a prefix.  */
+};
+
+
+/* The energy and temperature sensors of the host.  */
+typedef struct vanity_power_s *vanity_power_t;
+
+/* A regular expression over the hex digits of a fingerprint.  */
+typedef struct vanity_regex_s *vanity_regex_t;
+
+/* The most rules of a governor schedule.  */
+#define VANITY_MAX_RULES 16
+
+/* A rule of the governor: during the hours from START up to END, or
+   all day if HOURS is false, limit the duty cycle of the hash workers
+   to DUTY percent and their number to WORKERS; 0 is no limit.  */
+struct vanity_rule_s
+{
+  int hours;
+  unsigned int start;
+  unsigned int end;
+  unsigned int duty;
+  unsigned int workers;
+};
+
+/* The limits set for a search.  */
+struct vanity_governor_s
+{
+  unsigned int nrules;
+  struct vanity_rule_s rules[VANITY_MAX_RULES];
+  int temp_limit;             /* Degrees Celsius or 0 for none.  */
+  unsigned int thermal_duty;  /* The duty cycle allowed by the
+                                 temperature or 0 for 100.  */
+};
+
+
+/* The state of one search.  The parameter fields are set up before
+   the workers are started and are read-only afterwards.  The result
+   fields are only accessed while holding the npth global lock; DONE
+   and the limits of the governor are also read by the workers while
+   they run unprotected.  */
+struct vanity_job_s
+{
+  gcry_sexp_t keyparam;     /* Parameters for gcry_pk_genkey.  */
+  int algo;                 /* The OpenPGP public key algorithm.  */
+  int version;              /* The key version, 4 or 5.  */
+  size_t oidlen;            /* Length of OID.  */
+  unsigned char oid[VANITY_MAX_OIDLEN];  /* The curve OID of the keys.  */
+  unsigned int nkdfs;       /* Number of ECDH KDF parameters tried.  */
+  unsigned char kdf[VANITY_MAX_KDFS][VANITY_KDF_PARAMS_LEN];  /* Those,
+                               the default one first.  */
+  unsigned int nwindows;    /* Number of creation time windows.  */
+  struct vanity_window_s windows[VANITY_MAX_WINDOWS];
+  int default_window;       /* WINDOWS has only the default window.  */
+  int autotune;             /* Shrink the default window to what the
+                               live rates need; see run_autotune.  */
+  volatile u32 tuned_start; /* The start of the default window while
+                               it is shrunk or 0.  */
+  int backward;             /* Sweep the windows from their end.  */
+  unsigned int nworkers;    /* Number of worker threads.  */
+  vanity_pattern_t pattern; /* The keyids searched for.  */
+  struct vanity_matcher_s matcher;  /* Its scan during the search.  */
+  int scoring;              /* PATTERN rates the fingerprints.  */
+  int batch_keygen;         /* Generate the keys with vanity-ed25519.c.  */
+  struct vanity_ecc_s *ecc; /* Set for incremental ECDSA/ECDH keys.  */
+  int use_gpu;              /* Sweep also on an OpenCL device.  */
+  struct vanity_gpu_s *gpu; /* The device while the search runs.  */
+  int gpu_keygen;           /* The device generates its own keys.  */
+  unsigned char *stream_key;  /* The Ed25519 seeds are derived from
+                                 it; in secure memory or NULL.  */
+  unsigned int stream_base; /* The first key stream of the next search.  */
+  unsigned int stream_end;  /* The end of its range of streams or 0.  */
+  double gpu_key_seconds;   /* Average device time per key swept.  */
+  vanity_progress_t progress_cb;  /* Called while the search runs.  */
+  void *progress_opaque;
+  vanity_pool_t pool;       /* The stored keys or NULL.  */
+  unsigned int pool_flags;  /* VANITY_POOL_ flags.  */
+  int pool_type;            /* The kind of batches in the pool during
+                               the search or 0 if not used.  */
+  gcry_random_level_t random_level;  /* The level for their secrets.  */
+  size_t reseed_interval;   /* Bytes between two seeds of a stream.  */
+  unsigned int max_hits;    /* Stop after finding this many keys.  */
+  unsigned long budget;     /* Stop after this many seconds or 0.  */
+  unsigned long long max_iterations;  /* Stop after this many or 0.  */
+
+  struct vanity_governor_s governor;  /* The limits of the workers.  */
+  volatile unsigned int duty;  /* Their duty cycle in percent.  */
+  volatile unsigned int active_workers;  /* Hash workers allowed to
+                                            run or 0 for all.  */
+  double joules;            /* Energy of the last search or -1.  */
+
+  unsigned int placement;   /* VANITY_PLACE_ flags.  */
+  struct vanity_cpus_s *cpus;  /* The CPUs while the workers are bound.  */
+
+  unsigned int nqueues;     /* One queue for each NUMA node used.  */
+  struct key_queue_s *queues[VANITY_MAX_NODES];  /* Keys for the workers.  */
+  volatile int done;        /* Set when the workers shall stop.  */
+  struct vanity_verify_s verify;  /* The verification counters.  */
+  size_t memory_limit;      /* Bytes for the whole search or 0.  */
+  size_t worker_memory_limit;  /* Bytes for one hash worker or 0.  */
+  struct vanity_memory_s memory;  /* The plan of the last search.  */
+  volatile unsigned int quarantined;  /* VERIFY.QUARANTINED as read by
+                                         the running workers.  */
+  int arena_failed;         /* A worker could not lock its arena.  */
+  int canceled;             /* Set by vanity_cancel.  */
+  gpg_error_t err;          /* The first error seen by a worker.  */
+  volatile unsigned int min_score;  /* The score a candidate needs.  */
+  unsigned int nhits;       /* The keys found so far; for a scoring
+                               pattern a heap with the lowest score
+                               first while the search runs.  */
+  struct vanity_hit_s hits[VANITY_MAX_HITS];
+  unsigned long long iterations;  /* Sum of the workers' counters.  */
+  unsigned long long keys;  /* The keys swept by the workers.  */
+  unsigned long long gpu_iterations;  /* The part of the device.  */
+  unsigned long long gpu_keys;
+  struct vanity_cost_s cost;  /* The resources of the last search.  */
+  int estimating;           /* Only count the hits; see vanity_estimate.  */
+  unsigned long nestimated; /* The hits counted.  */
+  unsigned int nrunning;    /* The workers still running.  */
+};
+
+
+/* The longest key packet the single block SHA-1 kernel can hash.  */
+#define VANITY_SHA1_MAXLEN 55
+
+/* The largest number of SHA-1 blocks of a key packet hashed by the
+   multi-block kernels and the longest such packet; that is enough
+   for an RSA key of 4096 bits.  */
+#define VANITY_SHA1_MAX_BLOCKS 9
+#define VANITY_SHA1_MULTI_MAXLEN (64 * VANITY_SHA1_MAX_BLOCKS - 9)
+
+/* The largest number of keyids computed by one kernel call.  */
+#define VANITY_SHA1_MAX_LANES 16
+
+/* The precomputed state of the SHA-1 kernel for one key packet.  The
+   fields up to BLOCK describe the first block, which has the
+   timestamp; a longer packet has further blocks which don't depend
+   on it.  */
+struct vanity_sha1_s
+{
+  u32 a, b, c, d, e;  /* The state after the first round.  */
+  u32 w[80];          /* Fixed part of the words depending on W[1].  */
+  u32 kw[80];         /* Round constant plus the fixed words.  */
+  u32 block[16];      /* The block with W[1] set to zero.  */
+  unsigned int ntail; /* The number of further blocks.  */
+  u32 tail[VANITY_SHA1_MAX_BLOCKS - 1][80];  /* Their round constants
+                                                plus message words.  */
+};
+
+
+/* The largest number of SHA-256 blocks of a v5 key packet and the
+   longest such packet; like for SHA-1 that is enough for an RSA key
+   of 4096 bits.  */
+#define VANITY_SHA256_MAX_BLOCKS 9
+#define VANITY_SHA256_MAXLEN (64 * VANITY_SHA256_MAX_BLOCKS - 9)
+
+/* The precomputed state of the SHA-256 kernel for one v5 key packet;
+   see struct vanity_sha1_s.  The timestamp is in the words W[1] and
+   W[2] of the first block.  */
+struct vanity_sha256_s
+{
+  u32 state[8];       /* The state after the first round.  */
+  u32 w[64];          /* Fixed part of the words depending on the
+                         timestamp.  */
+  u32 kw[64];         /* Round constant plus the fixed words.  */
+  u32 block[16];      /* The block with the timestamp cleared.  */
+  unsigned int ntail; /* The number of further blocks.  */
+  u32 tail[VANITY_SHA256_MAX_BLOCKS - 1][64];  /* Their round constants
+                                                  plus message words.  */
+};
+
+/* The number of words of the longest digest; that is a v5
+   fingerprint.  */
+#define VANITY_MAX_DIGEST_WORDS 8
+
+
+/* The largest number of Ed25519 keys generated by one batch.  */
+#define VANITY_ED25519_BATCH 8
+
+/* The number of words of the table returned by _vanity_ed25519_table:
+   3 field elements of 10 limbs for 8 multiples at 32 positions.  */
+#define VANITY_ED25519_TABLE_WORDS (32 * 8 * 30)
+
+/* The number of consecutive keys generated by one incremental ECDSA
+   or ECDH batch.  */
+#define VANITY_ECC_BATCH 64
+
+/* The precomputed curve for incremental key generation.  */
+typedef struct vanity_ecc_s *vanity_ecc_t;
+
+
+/* The maximum number of distinct low keyid masks of a device
+   filter.  */
+#define VANITY_FILTER_MAX_MASKS 8
+
+/* The keyid items of a pattern prepared for a device: the sorted
+   values for each distinct low keyid mask and optionally the
+   prefilter bitmap of the pattern.  */
+struct vanity_filter_s
+{
+  unsigned int nmasks;
+  u32 masks[VANITY_FILTER_MAX_MASKS];
+  unsigned int starts[VANITY_FILTER_MAX_MASKS + 1];  /* Into VALUES.  */
+  unsigned int nvalues;
+  u32 *values;
+  unsigned int bitmap_shift;  /* 32 minus the bits of the bitmap.  */
+  unsigned int bitmap_words;  /* Its size or 0 for no bitmap.  */
+  const u32 *bitmap;          /* Owned by the pattern.  */
+};
+
+/* The largest number of keys hashed by one device call.  */
+#define VANITY_GPU_MAX_KEYS 256
+
+/* The largest number of candidates returned by one device call.  */
+#define VANITY_GPU_MAX_HITS 256
+
+/* A candidate found by a device.  */
+struct vanity_gpu_hit_s
+{
+  unsigned int key;   /* The index of the key.  */
+  u32 timestamp;
+  u32 keyid;          /* Its low keyid.  */
+};
+
+/* The state of a device used by one search.  */
+typedef struct vanity_gpu_s *vanity_gpu_t;
+
+
+/* The kinds of batches in a key pool.  */
+#define VANITY_POOL_ED25519  1  /* The seeds of Ed25519 keys.  */
+#define VANITY_POOL_ECC      2  /* The first scalar of consecutive keys.  */
+
+
+/* A per-thread random stream.  */
+typedef struct vanity_rng_s *vanity_rng_t;
+
+
+/* Locked memory for the secrets of the keys a worker generates.  */
+typedef struct vanity_arena_s *vanity_arena_t;
+
+
+/* A CPU the workers may be bound to.  */
+struct vanity_cpu_s
+{
+  int cpu;            /* Its number for the kernel.  */
+  int package;
+  int core;
+  int sibling;        /* The index of this hardware thread in its core.  */
+  int node;           /* Its NUMA node.  */
+};
+
+/* The CPUs in placement order.  */
+struct vanity_cpus_s
+{
+  unsigned int n;
+  unsigned int nnodes;  /* The number of distinct nodes.  */
+  struct vanity_cpu_s cpu[VANITY_MAX_CPUS];
+};
+typedef struct vanity_cpus_s *vanity_cpus_t;
+
+
+/* A public key prepared for the reference fingerprint code.  */
+typedef struct vanity_refkey_s *vanity_refkey_t;
+
+
+/*-- vanity-arena.c --*/
+gpg_error_t _vanity_arena_new (vanity_arena_t *r_arena, size_t slotlen,
+                               unsigned int nslots);
+void _vanity_arena_release (vanity_arena_t arena);
+void *_vanity_arena_get (vanity_arena_t arena);
+void _vanity_arena_put (vanity_arena_t arena, void *p);
+size_t _vanity_arena_memory (size_t slotlen, unsigned int nslots);
+
+/*-- vanity-keyid.c --*/
+gpg_error_t _vanity_refkey_new (vanity_refkey_t *r_refkey,
+                                gcry_sexp_t s_public, int algo, int version);
+void _vanity_refkey_release (vanity_refkey_t refkey);
+size_t _vanity_refkey_memory (void);
+int _vanity_refkey_version (vanity_refkey_t refkey);
+size_t _vanity_fpr_len (int version);
+u32 _vanity_fpr_keyid (const unsigned char *fpr, int version);
+void _vanity_refkey_reference_fpr (vanity_refkey_t refkey, u32 timestamp,
+                                   unsigned char *fpr);
+int _vanity_refkey_path (vanity_refkey_t refkey, int digests);
+void _vanity_refkey_quarantine (vanity_refkey_t refkey,
+                                unsigned int quarantined);
+void _vanity_refkey_fingerprint (vanity_refkey_t refkey, u32 timestamp,
+                                 unsigned char *fpr);
+unsigned int _vanity_refkey_keyids (vanity_refkey_t refkey, u32 timestamp,
+                                    u32 *keyids);
+unsigned int _vanity_refkey_lanes (vanity_refkey_t refkey);
+unsigned int _vanity_refkey_digests (vanity_refkey_t refkey, u32 timestamp,
+                                     u32 *digests);
+unsigned int _vanity_refkey_digest_lanes (vanity_refkey_t refkey);
+gpg_error_t _vanity_curve_oid (gcry_sexp_t keyparam, unsigned char *buffer,
+                               size_t *r_len, unsigned int *r_nbits);
+void _vanity_ecdh_kdf_params (unsigned int qbits, unsigned char *kek_params);
+gpg_error_t _vanity_refkey_set_q (vanity_refkey_t refkey,
+                                  const unsigned char *q, size_t qlen,
+                                  int algo, const unsigned char *oid,
+                                  size_t oidlen, const unsigned char *kdf);
+gpg_error_t _vanity_refkey_set_key (vanity_refkey_t refkey, gcry_sexp_t s_key,
+                                    int algo, const unsigned char *oid,
+                                    size_t oidlen, const unsigned char *kdf);
+gpg_error_t _vanity_refkey_set_kdf (vanity_refkey_t refkey,
+                                    const unsigned char *kdf);
+int _vanity_refkey_block (vanity_refkey_t refkey, u32 *block);
+
+/*-- vanity-cpu.c --*/
+gpg_error_t _vanity_cpus_new (vanity_cpus_t *r_cpus, int smt);
+void _vanity_cpus_release (vanity_cpus_t cpus);
+gpg_error_t _vanity_cpus_bind (vanity_cpus_t cpus, int idx, int node);
+
+/*-- vanity-ed25519.c --*/
+int _vanity_ed25519_init (void);
+void _vanity_ed25519_keys (const unsigned char *seeds, unsigned int n,
+                           unsigned char *q);
+const char *_vanity_ed25519_kernel_list (unsigned int idx);
+int _vanity_ed25519_select (const char *name);
+const char *_vanity_ed25519_kernel_name (void);
+const u32 *_vanity_ed25519_table (void);
+
+/*-- vanity-sha512.c --*/
+void _vanity_sha512_init (void);
+const char *_vanity_sha512_kernel_list (unsigned int idx);
+int _vanity_sha512_select (const char *name);
+const char *_vanity_sha512_kernel_name (void);
+void _vanity_sha512_expand (const unsigned char *seeds, unsigned int n,
+                            unsigned char *scalars);
+
+/*-- vanity-ecc.c --*/
+gpg_error_t _vanity_ecc_new (vanity_ecc_t *r_ecc, gcry_sexp_t keyparam);
+void _vanity_ecc_release (vanity_ecc_t ecc);
+size_t _vanity_ecc_qlen (vanity_ecc_t ecc);
+size_t _vanity_ecc_memory (vanity_ecc_t ecc);
+const char *_vanity_ecc_curve (vanity_ecc_t ecc);
+gpg_error_t _vanity_ecc_keys (vanity_ecc_t ecc, vanity_rng_t rng,
+                              gcry_mpi_t *r_d, unsigned char *buffer);
+
+/*-- vanity-match.c --*/
+int _vanity_pattern_need_digest (vanity_pattern_t pattern);
+size_t _vanity_pattern_memory (vanity_pattern_t pattern);
+int _vanity_pattern_check_words (vanity_pattern_t pattern, const u32 *h);
+unsigned int _vanity_pattern_score_words (vanity_pattern_t pattern,
+                                          const u32 *h, unsigned int min_score,
+                                          unsigned int *r_item);
+gpg_error_t _vanity_pattern_filter (vanity_pattern_t pattern,
+                                    struct vanity_filter_s *filter);
+void _vanity_filter_release (struct vanity_filter_s *filter);
+void _vanity_matcher_init (struct vanity_matcher_s *matcher,
+                          vanity_pattern_t pattern);
+
+/*-- vanity-opencl.c --*/
+int _vanity_gpu_init (void);
+const char *_vanity_gpu_name (void);
+gpg_error_t _vanity_gpu_new (vanity_gpu_t *r_gpu,
+                             const struct vanity_filter_s *filter);
+void _vanity_gpu_release (vanity_gpu_t gpu);
+gpg_error_t _vanity_gpu_sweep (vanity_gpu_t gpu, const u32 *blocks,
+                               unsigned int nkeys, u32 start, u32 count,
+                               struct vanity_gpu_hit_s *hits,
+                               unsigned int *r_nhits);
+gpg_error_t _vanity_gpu_keygen_setup (vanity_gpu_t gpu);
+gpg_error_t _vanity_gpu_keygen (vanity_gpu_t gpu, const unsigned char *master,
+                                const u32 *tmpl, unsigned int qoff,
+                                unsigned int nkeys);
+void _vanity_gpu_seed (const unsigned char *master, unsigned int key,
+                       unsigned char *seed);
+
+/*-- vanity-pool.c --*/
+gpg_error_t _vanity_pool_bind (vanity_pool_t pool, int type,
+                               unsigned int nkeys, size_t qlen, size_t seclen,
+                               const unsigned char *oid, size_t oidlen);
+gpg_error_t _vanity_pool_next (vanity_pool_t pool, unsigned char *q,
+                               unsigned char *secret,
+                               unsigned long long *r_record);
+gpg_error_t _vanity_pool_add (vanity_pool_t pool, const unsigned char *q,
+                              const unsigned char *secret,
+                              unsigned long long *r_record);
+gpg_error_t _vanity_pool_drop (vanity_pool_t pool, unsigned long long record,
+                               unsigned int idx);
+
+/*-- vanity-power.c --*/
+gpg_error_t _vanity_power_new (vanity_power_t *r_power, const char *sysfs);
+void _vanity_power_release (vanity_power_t power);
+int _vanity_power_energy (vanity_power_t power, double *r_joules);
+int _vanity_power_temperature (vanity_power_t power, int *r_celsius);
+gpg_error_t _vanity_governor_parse (struct vanity_governor_s *gov,
+                                    const char *string);
+void _vanity_governor_limits (const struct vanity_governor_s *gov, int hour,
+                              unsigned int *r_duty, unsigned int *r_workers);
+void _vanity_governor_thermal (struct vanity_governor_s *gov, int celsius);
+
+/*-- vanity-random.c --*/
+gpg_error_t _vanity_rng_new (vanity_rng_t *r_rng, gcry_random_level_t level,
+                             size_t reseed);
+void _vanity_rng_release (vanity_rng_t rng);
+size_t _vanity_rng_memory (void);
+gpg_error_t _vanity_rng_randomize (vanity_rng_t rng, void *buffer,
+                                   size_t length);
+void _vanity_stream_master (const unsigned char *key, unsigned int stream,
+                            unsigned long long counter,
+                            unsigned char *master);
+
+/*-- vanity-regex.c --*/
+gpg_error_t _vanity_regex_new (vanity_regex_t *r_regex, const char *string,
+                               size_t len, unsigned int nnibbles);
+void _vanity_regex_release (vanity_regex_t regex);
+void _vanity_regex_prefilter (vanity_regex_t regex, u32 *value, u32 *mask);
+double _vanity_regex_probability (vanity_regex_t regex);
+size_t _vanity_regex_memory (vanity_regex_t regex);
+int _vanity_regex_match (vanity_regex_t regex, const u32 *h);
+
+/*-- vanity-sha1.c --*/
+void _vanity_sha1_prepare (struct vanity_sha1_s *ctx,
+                           const unsigned char *packet, size_t len);
+void _vanity_sha1_fingerprint (const struct vanity_sha1_s *ctx,
+                               u32 timestamp, unsigned char *fpr);
+void _vanity_sha1_init (void);
+const char *_vanity_sha1_kernel_list (unsigned int idx);
+int _vanity_sha1_select (const char *name, int digests);
+const char *_vanity_sha1_kernel_name (void);
+unsigned int _vanity_sha1_lanes (void);
+void _vanity_sha1_keyids (const struct vanity_sha1_s *ctx, u32 timestamp,
+                          u32 *keyids);
+const char *_vanity_sha1_digest_kernel_name (void);
+unsigned int _vanity_sha1_digest_lanes (void);
+void _vanity_sha1_digests (const struct vanity_sha1_s *ctx, u32 timestamp,
+                           u32 *digests);
+const char *_vanity_sha1_multi_kernel_name (void);
+unsigned int _vanity_sha1_multi_lanes (void);
+void _vanity_sha1_multi_digests (const struct vanity_sha1_s *ctx,
+                                 u32 timestamp, u32 *digests);
+
+
+/*-- vanity-sha256.c --*/
+void _vanity_sha256_prepare (struct vanity_sha256_s *ctx,
+                             const unsigned char *packet, size_t len);
+void _vanity_sha256_fingerprint (const struct vanity_sha256_s *ctx,
+                                 u32 timestamp, unsigned char *fpr);
+void _vanity_sha256_init (void);
+const char *_vanity_sha256_kernel_list (unsigned int idx);
+int _vanity_sha256_select (const char *name);
+const char *_vanity_sha256_kernel_name (void);
+unsigned int _vanity_sha256_lanes (void);
+void _vanity_sha256_digests (const struct vanity_sha256_s *ctx,
+                             u32 timestamp, u32 *digests);
+
+#endif /*GNUPG_VANITY_DEFS_H*/
@@ -0,0 +1,457 @@
+/* vanity-ecc.c - Incremental ECDSA and ECDH key generation
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* An ECDSA or ECDH key is the random scalar D itself with the public
+   key Q = dG.  Other than with Ed25519, where the scalar is derived
+   from a hashed seed, the keys D+1, D+2, ... thus have the public
+   keys Q+G, Q+2G, ... and a batch of consecutive keys costs one
+   scalar multiplication plus one point addition per key instead of
+   a complete gcry_pk_genkey for each.
+
+   The additions are done here in affine coordinates with the
+   multiples iG for 1 <= i < VANITY_ECC_BATCH computed once per job.
+   All points of a batch are Q+iG for the same Q, so the inversions
+   needed by the additions are independent of each other and
+   Montgomery's trick replaces them by a single one.  What remains
+   are about eight modular multiplications per key.  Only public
+   values go through this code; the secret scalar of a batch is used
+   only for the initial multiplication done by libgcrypt.
+
+   The formulas are those for curves in short Weierstrass form, which
+   covers all curves OpenPGP uses with ECDSA and ECDH.
+   _vanity_ecc_new checks a batch against libgcrypt and fails for
+   any other curve, in which case gcry_pk_genkey is used.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+
+/* About the bytes libgcrypt needs for an MPI besides its limbs.  */
+#define MPI_OVERHEAD 32
+
+
+/* The curve parameters and the precomputed multiples of G.  This is
+   read-only once created and shared by all workers of a job.  */
+struct vanity_ecc_s
+{
+  const char *curve;        /* The canonical name of the curve.  */
+  unsigned int nbits;       /* Size of the order N in bits.  */
+  size_t nbytes;            /* Length of a coordinate in bytes.  */
+  gcry_mpi_t p;             /* The field prime.  */
+  gcry_mpi_t n;             /* The order of G.  */
+  gcry_mpi_t gx[VANITY_ECC_BATCH];  /* The affine iG; index 0 unused.  */
+  gcry_mpi_t gy[VANITY_ECC_BATCH];
+};
+
+
+/* Store the coordinate A as NBYTES big endian bytes at BUFFER.  */
+static void
+put_coord (unsigned char *buffer, size_t nbytes, gcry_mpi_t a)
+{
+  size_t n;
+
+  memset (buffer, 0, nbytes);
+  if (gcry_mpi_print (GCRYMPI_FMT_USG, NULL, 0, &n, a) || n > nbytes)
+    return;
+  gcry_mpi_print (GCRYMPI_FMT_USG, buffer + nbytes - n, n, NULL, a);
+}
+
+
+/* Store the uncompressed point X,Y of ECC at BUFFER in the format
+   used by gcry_pk_genkey.  */
+static void
+put_point (vanity_ecc_t ecc, unsigned char *buffer, gcry_mpi_t x, gcry_mpi_t y)
+{
+  buffer[0] = 0x04;
+  put_coord (buffer + 1, ecc->nbytes, x);
+  put_coord (buffer + 1 + ecc->nbytes, ecc->nbytes, y);
+}
+
+
+/* Store a random scalar D for a batch of ECC at R_D.  It is taken
+   from the stream RNG, or from the weak random of libgcrypt if RNG is
+   NULL, is in secure memory and leaves room for the batch; that is
+   0 < D and D + VANITY_ECC_BATCH <= N.  */
+static gpg_error_t
+random_scalar (vanity_ecc_t ecc, vanity_rng_t rng, gcry_mpi_t *r_d)
+{
+  gpg_error_t err = 0;
+  gcry_mpi_t d = NULL;
+  gcry_mpi_t tmp;
+  unsigned char *buffer = NULL;
+  size_t nbytes = (ecc->nbits + 7) / 8;
+
+  *r_d = NULL;
+  if (rng)
+    {
+      /* A secure buffer makes gcry_mpi_scan return a secure MPI.  */
+      buffer = xtrymalloc_secure (nbytes);
+      if (!buffer)
+        return gpg_error_from_syserror ();
+    }
+  else
+    d = gcry_mpi_snew (ecc->nbits);
+  tmp = gcry_mpi_snew (ecc->nbits);
+  do
+    {
+      if (rng)
+        {
+          gcry_mpi_release (d);
+          d = NULL;
+          err = _vanity_rng_randomize (rng, buffer, nbytes);
+          if (err)
+            break;
+          if ((ecc->nbits % 8))
+            buffer[0] &= 0xff >> (8 - ecc->nbits % 8);
+          err = gcry_mpi_scan (&d, GCRYMPI_FMT_USG, buffer, nbytes, NULL);
+          if (err)
+            break;
+        }
+      else
+        gcry_mpi_randomize (d, ecc->nbits, GCRY_WEAK_RANDOM);
+      gcry_mpi_add_ui (tmp, d, VANITY_ECC_BATCH);
+    }
+  while (!gcry_mpi_cmp_ui (d, 0) || gcry_mpi_cmp (tmp, ecc->n) > 0);
+  gcry_mpi_release (tmp);
+  if (buffer)
+    {
+      wipememory (buffer, nbytes);
+      xfree (buffer);
+    }
+  if (err)
+    gcry_mpi_release (d);
+  else
+    *r_d = d;
+  return err;
+}
+
+
+/* Generate VANITY_ECC_BATCH keys of ECC and store their public keys
+   Q at BUFFER, each taking _vanity_ecc_qlen bytes.  The secret scalar
+   of the first key is stored at R_D in secure memory; the key with
+   index I has the scalar R_D + I.  The scalar is taken from RNG; a
+   NULL RNG uses weak random and is only meant for tests.  */
+gpg_error_t
+_vanity_ecc_keys (vanity_ecc_t ecc, vanity_rng_t rng,
+                  gcry_mpi_t *r_d, unsigned char *buffer)
+{
+  gpg_error_t err;
+  gcry_ctx_t ctx;
+  gcry_mpi_point_t g, q;
+  gcry_mpi_t d = NULL;
+  gcry_mpi_t x0, y0, x, y, lambda, t, inv;
+  gcry_mpi_t prod[VANITY_ECC_BATCH];
+  size_t qlen = _vanity_ecc_qlen (ecc);
+  unsigned int i;
+
+  *r_d = NULL;
+
+  err = gcry_mpi_ec_new (&ctx, NULL, ecc->curve);
+  if (err)
+    return err;
+  g = gcry_mpi_ec_get_point ("g", ctx, 1);
+  q = gcry_mpi_point_new (0);
+  x0 = gcry_mpi_new (0);
+  y0 = gcry_mpi_new (0);
+  x = gcry_mpi_new (0);
+  y = gcry_mpi_new (0);
+  lambda = gcry_mpi_new (0);
+  t = gcry_mpi_new (0);
+  inv = gcry_mpi_new (0);
+  for (i=0; i < VANITY_ECC_BATCH; i++)
+    prod[i] = gcry_mpi_new (0);
+  if (!g)
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto leave;
+    }
+
+  for (;;)
+    {
+      gcry_mpi_release (d);
+      err = random_scalar (ecc, rng, &d);
+      if (err)
+        goto leave;
+      gcry_mpi_ec_mul (q, d, g, ctx);
+      if (gcry_mpi_ec_get_affine (x0, y0, q, ctx))
+        continue;
+
+      /* PROD[I] is the product of the denominators X_iG - X0 of the
+         additions up to I.  Its inverse fails only if Q is one of the
+         precomputed multiples or their negatives; take another D in
+         that case.  */
+      gcry_mpi_set_ui (prod[0], 1);
+      for (i=1; i < VANITY_ECC_BATCH; i++)
+        {
+          gcry_mpi_subm (t, ecc->gx[i], x0, ecc->p);
+          gcry_mpi_mulm (prod[i], prod[i-1], t, ecc->p);
+        }
+      if (gcry_mpi_invm (inv, prod[VANITY_ECC_BATCH-1], ecc->p))
+        break;
+    }
+
+  put_point (ecc, buffer, x0, y0);
+  for (i=VANITY_ECC_BATCH-1; i > 0; i--)
+    {
+      /* INV is the inverse of PROD[I]; now get the inverse of the
+         denominator I alone and INV for the next round.  */
+      gcry_mpi_mulm (lambda, inv, prod[i-1], ecc->p);
+      gcry_mpi_subm (t, ecc->gx[i], x0, ecc->p);
+      gcry_mpi_mulm (inv, inv, t, ecc->p);
+
+      /* LAMBDA = (Y_iG - Y0) / (X_iG - X0)
+         X = LAMBDA^2 - X0 - X_iG
+         Y = LAMBDA (X0 - X) - Y0  */
+      gcry_mpi_subm (t, ecc->gy[i], y0, ecc->p);
+      gcry_mpi_mulm (lambda, lambda, t, ecc->p);
+      gcry_mpi_mulm (x, lambda, lambda, ecc->p);
+      gcry_mpi_subm (x, x, x0, ecc->p);
+      gcry_mpi_subm (x, x, ecc->gx[i], ecc->p);
+      gcry_mpi_subm (t, x0, x, ecc->p);
+      gcry_mpi_mulm (y, lambda, t, ecc->p);
+      gcry_mpi_subm (y, y, y0, ecc->p);
+      put_point (ecc, buffer + i * qlen, x, y);
+    }
+
+  *r_d = d;
+  d = NULL;
+
+ leave:
+  for (i=0; i < VANITY_ECC_BATCH; i++)
+    gcry_mpi_release (prod[i]);
+  gcry_mpi_release (inv);
+  gcry_mpi_release (t);
+  gcry_mpi_release (lambda);
+  gcry_mpi_release (y);
+  gcry_mpi_release (x);
+  gcry_mpi_release (y0);
+  gcry_mpi_release (x0);
+  gcry_mpi_release (d);
+  gcry_mpi_point_release (q);
+  gcry_mpi_point_release (g);
+  gcry_ctx_release (ctx);
+  return err;
+}
+
+
+/* Check a batch of ECC against libgcrypt.  The first key after the
+   initial one depends on all inversions and the last one on all
+   products of the batch; it suffices to check these two.  */
+static gpg_error_t
+selftest (vanity_ecc_t ecc)
+{
+  static const unsigned int check[] = { 1, VANITY_ECC_BATCH - 1 };
+  gpg_error_t err;
+  gcry_ctx_t ctx;
+  gcry_mpi_point_t g, q;
+  gcry_mpi_t d, k, x, y;
+  size_t qlen = _vanity_ecc_qlen (ecc);
+  unsigned char *buffer, *expect;
+  int i;
+
+  buffer = xtrymalloc (qlen * (VANITY_ECC_BATCH + 1));
+  if (!buffer)
+    return gpg_error_from_syserror ();
+  expect = buffer + qlen * VANITY_ECC_BATCH;
+
+  err = _vanity_ecc_keys (ecc, NULL, &d, buffer);
+  if (err)
+    {
+      xfree (buffer);
+      return err;
+    }
+  err = gcry_mpi_ec_new (&ctx, NULL, ecc->curve);
+  if (err)
+    {
+      gcry_mpi_release (d);
+      xfree (buffer);
+      return err;
+    }
+  g = gcry_mpi_ec_get_point ("g", ctx, 1);
+  q = gcry_mpi_point_new (0);
+  k = gcry_mpi_snew (0);
+  x = gcry_mpi_new (0);
+  y = gcry_mpi_new (0);
+  if (!g)
+    err = gpg_error (GPG_ERR_INV_OBJ);
+  for (i=0; !err && i < DIM (check); i++)
+    {
+      gcry_mpi_add_ui (k, d, check[i]);
+      gcry_mpi_ec_mul (q, k, g, ctx);
+      if (gcry_mpi_ec_get_affine (x, y, q, ctx))
+        err = gpg_error (GPG_ERR_INV_OBJ);
+      else
+        {
+          put_point (ecc, expect, x, y);
+          if (memcmp (buffer + check[i] * qlen, expect, qlen))
+            err = gpg_error (GPG_ERR_SELFTEST_FAILED);
+        }
+    }
+
+  gcry_mpi_release (y);
+  gcry_mpi_release (x);
+  gcry_mpi_release (k);
+  gcry_mpi_release (d);
+  gcry_mpi_point_release (q);
+  gcry_mpi_point_release (g);
+  gcry_ctx_release (ctx);
+  xfree (buffer);
+  return err;
+}
+
+
+/* Prepare the incremental generation of keys for the ECC key
+   parameters KEYPARAM.  Fails with GPG_ERR_NOT_SUPPORTED if this is
+   not possible for the curve.  */
+gpg_error_t
+_vanity_ecc_new (vanity_ecc_t *r_ecc, gcry_sexp_t keyparam)
+{
+  gpg_error_t err;
+  vanity_ecc_t ecc;
+  gcry_sexp_t l1, s_curve = NULL;
+  gcry_ctx_t ctx = NULL;
+  gcry_mpi_point_t g = NULL, q = NULL;
+  gcry_mpi_t k = NULL;
+  char *curve = NULL;
+  unsigned int i;
+
+  *r_ecc = NULL;
+
+  ecc = xtrycalloc (1, sizeof *ecc);
+  if (!ecc)
+    return gpg_error_from_syserror ();
+
+  /* Use the canonical curve name like gcry_pk_genkey does in the keys
+     it returns.  */
+  l1 = gcry_sexp_find_token (keyparam, "curve", 0);
+  if (l1)
+    curve = gcry_sexp_nth_string (l1, 1);
+  gcry_sexp_release (l1);
+  if (!curve)
+    {
+      err = gpg_error (GPG_ERR_NO_OBJ);
+      goto leave;
+    }
+  err = gcry_sexp_build (&s_curve, NULL, "(public-key(ecc(curve %s)))",
+                         curve);
+  if (err)
+    goto leave;
+  ecc->curve = gcry_pk_get_curve (s_curve, 0, NULL);
+  if (!ecc->curve)
+    {
+      err = gpg_error (GPG_ERR_UNKNOWN_CURVE);
+      goto leave;
+    }
+
+  err = gcry_mpi_ec_new (&ctx, NULL, ecc->curve);
+  if (err)
+    goto leave;
+  ecc->p = gcry_mpi_ec_get_mpi ("p", ctx, 1);
+  ecc->n = gcry_mpi_ec_get_mpi ("n", ctx, 1);
+  g = gcry_mpi_ec_get_point ("g", ctx, 1);
+  if (!ecc->p || !ecc->n || !g)
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+  ecc->nbits = gcry_mpi_get_nbits (ecc->n);
+  ecc->nbytes = (gcry_mpi_get_nbits (ecc->p) + 7) / 8;
+  if (_vanity_ecc_qlen (ecc) > VANITY_MAX_QLEN)
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  q = gcry_mpi_point_new (0);
+  k = gcry_mpi_new (0);
+  for (i=1; i < VANITY_ECC_BATCH; i++)
+    {
+      ecc->gx[i] = gcry_mpi_new (0);
+      ecc->gy[i] = gcry_mpi_new (0);
+      gcry_mpi_set_ui (k, i);
+      gcry_mpi_ec_mul (q, k, g, ctx);
+      if (gcry_mpi_ec_get_affine (ecc->gx[i], ecc->gy[i], q, ctx))
+        {
+          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+          goto leave;
+        }
+    }
+
+  if (selftest (ecc))
+    err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+ leave:
+  gcry_mpi_release (k);
+  gcry_mpi_point_release (q);
+  gcry_mpi_point_release (g);
+  gcry_ctx_release (ctx);
+  gcry_sexp_release (s_curve);
+  xfree (curve);
+  if (err)
+    _vanity_ecc_release (ecc);
+  else
+    *r_ecc = ecc;
+  return err;
+}
+
+
+void
+_vanity_ecc_release (vanity_ecc_t ecc)
+{
+  unsigned int i;
+
+  if (!ecc)
+    return;
+  for (i=0; i < VANITY_ECC_BATCH; i++)
+    {
+      gcry_mpi_release (ecc->gx[i]);
+      gcry_mpi_release (ecc->gy[i]);
+    }
+  gcry_mpi_release (ecc->n);
+  gcry_mpi_release (ecc->p);
+  xfree (ecc);
+}
+
+
+/* Return the length of a public key Q generated by ECC.  */
+size_t
+_vanity_ecc_qlen (vanity_ecc_t ecc)
+{
+  return 1 + 2 * ecc->nbytes;
+}
+
+
+/* Return the bytes of memory the precomputed curve ECC takes.  */
+size_t
+_vanity_ecc_memory (vanity_ecc_t ecc)
+{
+  return sizeof *ecc + (2 * VANITY_ECC_BATCH + 2) * (ecc->nbytes + MPI_OVERHEAD);
+}
+
+
+/* Return the canonical name of the curve of ECC.  */
+const char *
+_vanity_ecc_curve (vanity_ecc_t ecc)
+{
+  return ecc->curve;
+}
@@ -0,0 +1,377 @@
+/* vanity-ed25519-lanes.h - Ed25519 base point multiplication in lanes
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file is included by vanity-ed25519.c once for each vector
+   kernel; it thus has no include guard.  The kernel must define:
+
+   LANES        - The number of lanes.
+   LANES_T      - A vector type of LANES 64 bit unsigned integers.
+   LANES_FNC(N) - The name N with the suffix of the kernel.
+   LANES_ATTR   - The attributes of the functions, in particular the
+                  target.
+   MUL32(A,B)   - The products of the low 32 bits of each lane of A
+                  and B as 64 bit integers.
+
+   The field elements have ten limbs of alternately 26 and 25 bits
+   (radix 2^25.5, as in the ref10 implementation), so that the
+   products of two limbs fit into the 32x32 bit multiplication of
+   the vector units.  Each limb is a vector with one lane per key.
+   All arithmetic is unsigned; the limbs are carried after each
+   operation so that the sums of the products stay below 2^61.  */
+
+#define FE10 LANES_FNC (fe10)
+#define GE10_P3 LANES_FNC (ge10_p3)
+#define GE10_P2 LANES_FNC (ge10_p2)
+#define GE10_P1P1 LANES_FNC (ge10_p1p1)
+#define GE10_PRECOMP LANES_FNC (ge10_precomp)
+
+typedef struct
+{
+  LANES_T v[10];
+} FE10;
+
+typedef struct
+{
+  FE10 X, Y, Z, T;
+} GE10_P3;
+
+typedef struct
+{
+  FE10 X, Y, Z;
+} GE10_P2;
+
+typedef struct
+{
+  FE10 X, Y, Z, T;
+} GE10_P1P1;
+
+typedef struct
+{
+  FE10 ypx, ymx, xy2d;
+} GE10_PRECOMP;
+
+
+/* 19 * X for limbs which may be larger than 32 bits.  */
+#define MUL19(x) (((x) << 4) + ((x) << 1) + (x))
+
+
+static inline void LANES_ATTR
+LANES_FNC (fe10_carry) (FE10 *h)
+{
+  LANES_T *v = h->v;
+  LANES_T c;
+
+  /* Two chains, 0..4 and 5..9, to keep more instructions in flight.  */
+  c = v[0] >> 26; v[1] += c; v[0] &= 0x3ffffff;
+  c = v[4] >> 26; v[5] += c; v[4] &= 0x3ffffff;
+  c = v[1] >> 25; v[2] += c; v[1] &= 0x1ffffff;
+  c = v[5] >> 25; v[6] += c; v[5] &= 0x1ffffff;
+  c = v[2] >> 26; v[3] += c; v[2] &= 0x3ffffff;
+  c = v[6] >> 26; v[7] += c; v[6] &= 0x3ffffff;
+  c = v[3] >> 25; v[4] += c; v[3] &= 0x1ffffff;
+  c = v[7] >> 25; v[8] += c; v[7] &= 0x1ffffff;
+  c = v[4] >> 26; v[5] += c; v[4] &= 0x3ffffff;
+  c = v[8] >> 26; v[9] += c; v[8] &= 0x3ffffff;
+  c = v[9] >> 25; v[0] += MUL19 (c); v[9] &= 0x1ffffff;
+  c = v[0] >> 26; v[1] += c; v[0] &= 0x3ffffff;
+}
+
+
+static inline void LANES_ATTR
+LANES_FNC (fe10_add) (FE10 *h, const FE10 *f, const FE10 *g)
+{
+  int i;
+
+  for (i=0; i < 10; i++)
+    h->v[i] = f->v[i] + g->v[i];
+  LANES_FNC (fe10_carry) (h);
+}
+
+
+/* H = F - G.  4*p is added to keep the limbs positive.  */
+static inline void LANES_ATTR
+LANES_FNC (fe10_sub) (FE10 *h, const FE10 *f, const FE10 *g)
+{
+  int i;
+
+  h->v[0] = f->v[0] + 0xfffffb4 - g->v[0];
+  for (i=1; i < 10; i++)
+    h->v[i] = f->v[i] + ((i & 1)? 0x7fffffc : 0xffffffc) - g->v[i];
+  LANES_FNC (fe10_carry) (h);
+}
+
+
+/* The product of the limbs I of F and J of G, with the factor 2 if
+   both limbs have 25 bits and 19 if the product wraps around.  */
+#define FE10_T(i,j)                                             \
+  MUL32 ((((i) & (j) & 1)? f2[(i)] : f[(i)]),                   \
+         ((i) + (j) >= 10? g19[(j)] : g[(j)]))
+#define FE10_ROW(k)                                                     \
+  (FE10_T (0, (k) % 10) + FE10_T (1, ((k) + 9) % 10)                    \
+   + FE10_T (2, ((k) + 8) % 10) + FE10_T (3, ((k) + 7) % 10)            \
+   + FE10_T (4, ((k) + 6) % 10) + FE10_T (5, ((k) + 5) % 10)            \
+   + FE10_T (6, ((k) + 4) % 10) + FE10_T (7, ((k) + 3) % 10)            \
+   + FE10_T (8, ((k) + 2) % 10) + FE10_T (9, ((k) + 1) % 10))
+
+static inline void LANES_ATTR
+LANES_FNC (fe10_mul) (FE10 *h, const FE10 *ff, const FE10 *gg)
+{
+  const LANES_T *f = ff->v;
+  const LANES_T *g = gg->v;
+  LANES_T f2[10], g19[10];
+  FE10 r;
+  int i;
+
+  for (i=0; i < 10; i++)
+    {
+      f2[i] = f[i] << 1;
+      g19[i] = MUL19 (g[i]);
+    }
+  /* H may be the same as F or G.  */
+  r.v[0] = FE10_ROW (0);
+  r.v[1] = FE10_ROW (1);
+  r.v[2] = FE10_ROW (2);
+  r.v[3] = FE10_ROW (3);
+  r.v[4] = FE10_ROW (4);
+  r.v[5] = FE10_ROW (5);
+  r.v[6] = FE10_ROW (6);
+  r.v[7] = FE10_ROW (7);
+  r.v[8] = FE10_ROW (8);
+  r.v[9] = FE10_ROW (9);
+  LANES_FNC (fe10_carry) (&r);
+  *h = r;
+}
+
+#undef FE10_ROW
+#undef FE10_T
+
+
+/* Replace F by G in the lanes where MASK is all ones.  */
+static inline void LANES_ATTR
+LANES_FNC (fe10_cmov) (FE10 *f, const FE10 *g, LANES_T mask)
+{
+  int i;
+
+  for (i=0; i < 10; i++)
+    f->v[i] ^= mask & (f->v[i] ^ g->v[i]);
+}
+
+
+/* Replace F by the element STORED of the table in the lanes where
+   MASK is all ones.  */
+static inline void LANES_ATTR
+LANES_FNC (fe10_cmov_stored) (FE10 *f, const u32 *stored, LANES_T mask)
+{
+  int i;
+
+  for (i=0; i < 10; i++)
+    f->v[i] ^= mask & (f->v[i] ^ stored[i]);
+}
+
+
+static inline void LANES_ATTR
+LANES_FNC (ge10_p1p1_to_p2) (GE10_P2 *r, const GE10_P1P1 *p)
+{
+  LANES_FNC (fe10_mul) (&r->X, &p->X, &p->T);
+  LANES_FNC (fe10_mul) (&r->Y, &p->Y, &p->Z);
+  LANES_FNC (fe10_mul) (&r->Z, &p->Z, &p->T);
+}
+
+
+static inline void LANES_ATTR
+LANES_FNC (ge10_p1p1_to_p3) (GE10_P3 *r, const GE10_P1P1 *p)
+{
+  LANES_FNC (fe10_mul) (&r->X, &p->X, &p->T);
+  LANES_FNC (fe10_mul) (&r->Y, &p->Y, &p->Z);
+  LANES_FNC (fe10_mul) (&r->Z, &p->Z, &p->T);
+  LANES_FNC (fe10_mul) (&r->T, &p->X, &p->Y);
+}
+
+
+/* R = 2 * P.  */
+static void LANES_ATTR
+LANES_FNC (ge10_p2_dbl) (GE10_P1P1 *r, const GE10_P2 *p)
+{
+  FE10 t0;
+
+  LANES_FNC (fe10_mul) (&r->X, &p->X, &p->X);
+  LANES_FNC (fe10_mul) (&r->Z, &p->Y, &p->Y);
+  LANES_FNC (fe10_mul) (&r->T, &p->Z, &p->Z);
+  LANES_FNC (fe10_add) (&r->T, &r->T, &r->T);
+  LANES_FNC (fe10_add) (&r->Y, &p->X, &p->Y);
+  LANES_FNC (fe10_mul) (&t0, &r->Y, &r->Y);
+  LANES_FNC (fe10_add) (&r->Y, &r->Z, &r->X);
+  LANES_FNC (fe10_sub) (&r->Z, &r->Z, &r->X);
+  LANES_FNC (fe10_sub) (&r->X, &t0, &r->Y);
+  LANES_FNC (fe10_sub) (&r->T, &r->T, &r->Z);
+}
+
+
+/* R = P + Q.  */
+static void LANES_ATTR
+LANES_FNC (ge10_madd) (GE10_P1P1 *r, const GE10_P3 *p,
+                       const GE10_PRECOMP *q)
+{
+  FE10 t0;
+
+  LANES_FNC (fe10_add) (&r->X, &p->Y, &p->X);
+  LANES_FNC (fe10_sub) (&r->Y, &p->Y, &p->X);
+  LANES_FNC (fe10_mul) (&r->Z, &r->X, &q->ypx);
+  LANES_FNC (fe10_mul) (&r->Y, &r->Y, &q->ymx);
+  LANES_FNC (fe10_mul) (&r->T, &q->xy2d, &p->T);
+  LANES_FNC (fe10_add) (&t0, &p->Z, &p->Z);
+  LANES_FNC (fe10_sub) (&r->X, &r->Z, &r->Y);
+  LANES_FNC (fe10_add) (&r->Y, &r->Z, &r->Y);
+  LANES_FNC (fe10_add) (&r->Z, &t0, &r->T);
+  LANES_FNC (fe10_sub) (&r->T, &t0, &r->T);
+}
+
+
+/* Set T to the multiples B * 256^POS * B for the digits -8 <= B <= 8
+   of the lanes.  Like select_precomp this reads all entries of the
+   table for position POS, which is the same for all lanes.  */
+static void LANES_ATTR
+LANES_FNC (select_precomp) (GE10_PRECOMP *t, int pos, LANES_T b)
+{
+  const ge_precomp10_t *entry;
+  FE10 tmp, zero;
+  LANES_T bnegative = -(b >> 63);
+  LANES_T babs = (b ^ bnegative) - bnegative;
+  LANES_T mask;
+  int i;
+
+  memset (t, 0, sizeof *t);
+  t->ypx.v[0] += 1;
+  t->ymx.v[0] += 1;
+  for (i=0; i < 8; i++)
+    {
+      entry = &base_table10[pos][i];
+      mask = (LANES_T)(babs == (LANES_T){ 0 } + (i + 1));
+      LANES_FNC (fe10_cmov_stored) (&t->ypx, entry->ypx, mask);
+      LANES_FNC (fe10_cmov_stored) (&t->ymx, entry->ymx, mask);
+      LANES_FNC (fe10_cmov_stored) (&t->xy2d, entry->xy2d, mask);
+    }
+  /* The negative multiple has Y+X and Y-X swapped and the negated
+     product.  */
+  tmp = t->ypx;
+  LANES_FNC (fe10_cmov) (&t->ypx, &t->ymx, bnegative);
+  LANES_FNC (fe10_cmov) (&t->ymx, &tmp, bnegative);
+  memset (&zero, 0, sizeof zero);
+  LANES_FNC (fe10_sub) (&tmp, &zero, &t->xy2d);
+  LANES_FNC (fe10_cmov) (&t->xy2d, &tmp, bnegative);
+}
+
+
+/* Store lane L of F as a field element with five limbs.  The limbs
+   of F are carried and thus a pair of them fits into 51 bits plus a
+   possible carry.  */
+static void LANES_ATTR
+LANES_FNC (fe10_to_fe) (fe_t *h, const FE10 *f, int l)
+{
+  int i;
+
+  for (i=0; i < 5; i++)
+    h->v[i] = f->v[2*i][l] + (f->v[2*i + 1][l] << 26);
+}
+
+
+/* Compute the points A_L * B for the LANES little endian scalars A_L
+   of 32 bytes each at A, with A_L[31] <= 127, and store them at H.  */
+static void LANES_ATTR
+LANES_FNC (scalarmult_base) (ge_p3_t *h, const unsigned char *a)
+{
+  LANES_T e[64];
+  signed char digits[64];
+  signed char carry;
+  GE10_P3 p;
+  GE10_P1P1 r;
+  GE10_P2 s;
+  GE10_PRECOMP t;
+  int i, l;
+
+  /* The digits are the same as in ge_scalarmult_base, with one lane
+     per scalar.  */
+  for (l=0; l < LANES; l++)
+    {
+      for (i=0; i < 32; i++)
+        {
+          digits[2*i] = a[32*l + i] & 15;
+          digits[2*i + 1] = a[32*l + i] >> 4;
+        }
+      carry = 0;
+      for (i=0; i < 63; i++)
+        {
+          digits[i] += carry;
+          carry = (digits[i] + 8) >> 4;
+          digits[i] -= carry << 4;
+        }
+      digits[63] += carry;
+      for (i=0; i < 64; i++)
+        e[i][l] = (uint64_t)(int64_t)digits[i];
+    }
+
+  memset (&p, 0, sizeof p);
+  p.Y.v[0] += 1;
+  p.Z.v[0] += 1;
+  for (i=1; i < 64; i += 2)
+    {
+      LANES_FNC (select_precomp) (&t, i / 2, e[i]);
+      LANES_FNC (ge10_madd) (&r, &p, &t);
+      LANES_FNC (ge10_p1p1_to_p3) (&p, &r);
+    }
+
+  memcpy (&s, &p, sizeof s);
+  LANES_FNC (ge10_p2_dbl) (&r, &s);
+  LANES_FNC (ge10_p1p1_to_p2) (&s, &r);
+  LANES_FNC (ge10_p2_dbl) (&r, &s);
+  LANES_FNC (ge10_p1p1_to_p2) (&s, &r);
+  LANES_FNC (ge10_p2_dbl) (&r, &s);
+  LANES_FNC (ge10_p1p1_to_p2) (&s, &r);
+  LANES_FNC (ge10_p2_dbl) (&r, &s);
+  LANES_FNC (ge10_p1p1_to_p3) (&p, &r);
+
+  for (i=0; i < 64; i += 2)
+    {
+      LANES_FNC (select_precomp) (&t, i / 2, e[i]);
+      LANES_FNC (ge10_madd) (&r, &p, &t);
+      LANES_FNC (ge10_p1p1_to_p3) (&p, &r);
+    }
+
+  for (l=0; l < LANES; l++)
+    {
+      LANES_FNC (fe10_to_fe) (&h[l].X, &p.X, l);
+      LANES_FNC (fe10_to_fe) (&h[l].Y, &p.Y, l);
+      LANES_FNC (fe10_to_fe) (&h[l].Z, &p.Z, l);
+      LANES_FNC (fe10_to_fe) (&h[l].T, &p.T, l);
+    }
+
+  wipememory (digits, sizeof digits);
+  wipememory (e, sizeof e);
+  wipememory (&p, sizeof p);
+  wipememory (&r, sizeof r);
+  wipememory (&s, sizeof s);
+  wipememory (&t, sizeof t);
+}
+
+#undef MUL19
+#undef GE10_PRECOMP
+#undef GE10_P1P1
+#undef GE10_P2
+#undef GE10_P3
+#undef FE10
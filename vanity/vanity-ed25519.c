@@ -0,0 +1,955 @@
+/* vanity-ed25519.c - Batch Ed25519 key generation for the vanity search
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* An Ed25519 key is a random 32 byte seed D; the public key Q is the
+   encoded point a*B for the scalar A derived from the SHA-512 hash of
+   D (RFC-8032, section 5.1.5).  gcry_pk_genkey does this for one key
+   at a time, including building and parsing S-expressions.  The
+   vanity search only needs Q for most of the keys and uses the code
+   here to compute it for a batch of seeds at once:
+
+   - The fixed-base multiplication uses a table with the multiples
+     1..8 of 256^i * B for i = 0..31 in affine form, computed once,
+     and a signed radix 16 representation of the scalar (the method
+     of the ref10 implementation).  The table entries are selected
+     without secret dependent branches or memory accesses.
+
+   - The scalars of the batch are computed by the multi-lane SHA-512
+     kernels of vanity-sha512.c.
+
+   - With AVX2 or AVX-512 the multiplications of 4 or 8 keys are done
+     in the lanes of a vector, using field elements with ten limbs of
+     about 25.5 bit; see vanity-ed25519-lanes.h.  Like the hash
+     kernels these kernels are checked and timed once and the fastest
+     one is used.
+
+   - A point is encoded from its affine coordinates, which needs an
+     inversion of its Z coordinate.  This is the most expensive single
+     operation.  Montgomery's trick replaces the inversions of a
+     batch by a single one and three multiplications per key.
+
+   Field elements are represented with five limbs of 51 bit, which
+   needs a 128 bit integer type.  Without one, or if the self-test
+   fails, _vanity_ed25519_init returns false and gcry_pk_genkey is
+   used.  Only the found key is converted to an S-expression; the
+   search checks it with libgcrypt before returning it.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+#if defined(__GNUC__) && defined(__SIZEOF_INT128__)
+# define USE_ED25519_BATCH 1
+#endif
+
+/* The same conditions as for the SHA-1 kernels.  */
+#if defined(USE_ED25519_BATCH) && !defined(__clang__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) \
+    && (defined(__x86_64__) || defined(__i386__))
+# define USE_ED25519_X86 1
+#endif
+
+#ifdef USE_ED25519_BATCH
+#include <stdint.h>
+#include <time.h>
+#ifdef USE_ED25519_X86
+# include <immintrin.h>
+#endif
+
+typedef unsigned __int128 uint128_t;
+
+#define MASK51 (((uint64_t)1 << 51) - 1)
+
+/* An element of the field modulo 2^255 - 19.  */
+typedef struct
+{
+  uint64_t v[5];
+} fe_t;
+
+/* A point in extended coordinates: x = X/Z, y = Y/Z, x*y = T/Z.  */
+typedef struct
+{
+  fe_t X, Y, Z, T;
+} ge_p3_t;
+
+/* A point in projective coordinates: x = X/Z, y = Y/Z.  */
+typedef struct
+{
+  fe_t X, Y, Z;
+} ge_p2_t;
+
+/* The intermediate result of an addition: x = X/Z, y = Y/T.  */
+typedef struct
+{
+  fe_t X, Y, Z, T;
+} ge_p1p1_t;
+
+/* An affine point prepared for addition: y+x, y-x and 2*d*x*y.  */
+typedef struct
+{
+  fe_t ypx, ymx, xy2d;
+} ge_precomp_t;
+
+/* The same with the ten limbs of the vector kernels.  */
+typedef struct
+{
+  u32 ypx[10], ymx[10], xy2d[10];
+} ge_precomp10_t;
+
+
+/* The curve constant d and the base point in little endian.  */
+static const unsigned char curve_d[32] =
+  {
+    0xa3, 0x78, 0x59, 0x13, 0xca, 0x4d, 0xeb, 0x75,
+    0xab, 0xd8, 0x41, 0x41, 0x4d, 0x0a, 0x70, 0x00,
+    0x98, 0xe8, 0x79, 0x77, 0x79, 0x40, 0xc7, 0x8c,
+    0x73, 0xfe, 0x6f, 0x2b, 0xee, 0x6c, 0x03, 0x52
+  };
+static const unsigned char base_x[32] =
+  {
+    0x1a, 0xd5, 0x25, 0x8f, 0x60, 0x2d, 0x56, 0xc9,
+    0xb2, 0xa7, 0x25, 0x95, 0x60, 0xc7, 0x2c, 0x69,
+    0x5c, 0xdc, 0xd6, 0xfd, 0x31, 0xe2, 0xa4, 0xc0,
+    0xfe, 0x53, 0x6e, 0xcd, 0xd3, 0x36, 0x69, 0x21
+  };
+static const unsigned char base_y[32] =
+  {
+    0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66
+  };
+
+/* The first test vector of RFC-8032, section 7.1.  */
+static const unsigned char selftest_seed[32] =
+  {
+    0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60,
+    0xba, 0x84, 0x4a, 0xf4, 0x92, 0xec, 0x2c, 0xc4,
+    0x44, 0x49, 0xc5, 0x69, 0x7b, 0x32, 0x69, 0x19,
+    0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f, 0x60
+  };
+static const unsigned char selftest_q[32] =
+  {
+    0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7,
+    0xd5, 0x4b, 0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a,
+    0x0e, 0xe1, 0x72, 0xf3, 0xda, 0xa6, 0x23, 0x25,
+    0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51, 0x1a
+  };
+
+/* The table for the fixed-base multiplication: BASE_TABLE[I][J] is
+   (J+1) * 256^I * B.  */
+static ge_precomp_t base_table[32][8];
+
+/* BASE_TABLE for the vector kernels.  */
+static ge_precomp10_t base_table10[32][8];
+
+/* 0 if not yet initialized, 1 if usable and -1 if not.  */
+static int ed25519_state;
+
+
+static void
+fe_frombytes (fe_t *h, const unsigned char *s)
+{
+  uint64_t t[4];
+  int i, j;
+
+  for (i=0; i < 4; i++)
+    for (t[i]=0, j=7; j >= 0; j--)
+      t[i] = (t[i] << 8) | s[8*i + j];
+  h->v[0] = t[0] & MASK51;
+  h->v[1] = ((t[0] >> 51) | (t[1] << 13)) & MASK51;
+  h->v[2] = ((t[1] >> 38) | (t[2] << 26)) & MASK51;
+  h->v[3] = ((t[2] >> 25) | (t[3] << 39)) & MASK51;
+  h->v[4] = (t[3] >> 12) & MASK51;
+}
+
+
+/* Store the fully reduced H at S.  */
+static void
+fe_tobytes (unsigned char *s, const fe_t *f)
+{
+  uint64_t h[5], q, t[4];
+  int i, j;
+
+  memcpy (h, f->v, sizeof h);
+  for (j=0; j < 2; j++)
+    {
+      /* Carry so that all limbs are below 2^51.  */
+      for (i=0; i < 4; i++)
+        {
+          h[i+1] += h[i] >> 51;
+          h[i] &= MASK51;
+        }
+      h[0] += 19 * (h[4] >> 51);
+      h[4] &= MASK51;
+    }
+  /* Subtract p if H is at least p.  */
+  q = (h[0] + 19) >> 51;
+  for (i=1; i < 5; i++)
+    q = (h[i] + q) >> 51;
+  h[0] += 19 * q;
+  for (i=0; i < 4; i++)
+    {
+      h[i+1] += h[i] >> 51;
+      h[i] &= MASK51;
+    }
+  h[4] &= MASK51;
+
+  t[0] = h[0] | (h[1] << 51);
+  t[1] = (h[1] >> 13) | (h[2] << 38);
+  t[2] = (h[2] >> 26) | (h[3] << 25);
+  t[3] = (h[3] >> 39) | (h[4] << 12);
+  for (i=0; i < 4; i++)
+    for (j=0; j < 8; j++)
+      s[8*i + j] = t[i] >> (8 * j);
+}
+
+
+static void
+fe_carry (fe_t *h)
+{
+  uint64_t c;
+  int i;
+
+  for (i=0; i < 4; i++)
+    {
+      c = h->v[i] >> 51;
+      h->v[i] &= MASK51;
+      h->v[i+1] += c;
+    }
+  c = h->v[4] >> 51;
+  h->v[4] &= MASK51;
+  h->v[0] += 19 * c;
+}
+
+
+static void
+fe_add (fe_t *h, const fe_t *f, const fe_t *g)
+{
+  int i;
+
+  for (i=0; i < 5; i++)
+    h->v[i] = f->v[i] + g->v[i];
+  fe_carry (h);
+}
+
+
+/* H = F - G.  4*p is added to keep the limbs positive.  */
+static void
+fe_sub (fe_t *h, const fe_t *f, const fe_t *g)
+{
+  h->v[0] = f->v[0] + 0x1fffffffffffb4ULL - g->v[0];
+  h->v[1] = f->v[1] + 0x1ffffffffffffcULL - g->v[1];
+  h->v[2] = f->v[2] + 0x1ffffffffffffcULL - g->v[2];
+  h->v[3] = f->v[3] + 0x1ffffffffffffcULL - g->v[3];
+  h->v[4] = f->v[4] + 0x1ffffffffffffcULL - g->v[4];
+  fe_carry (h);
+}
+
+
+static void
+fe_neg (fe_t *h, const fe_t *f)
+{
+  fe_t zero;
+
+  memset (&zero, 0, sizeof zero);
+  fe_sub (h, &zero, f);
+}
+
+
+static void
+fe_mul (fe_t *h, const fe_t *f, const fe_t *g)
+{
+  const uint64_t *a = f->v;
+  const uint64_t *b = g->v;
+  uint64_t b1_19 = 19 * b[1];
+  uint64_t b2_19 = 19 * b[2];
+  uint64_t b3_19 = 19 * b[3];
+  uint64_t b4_19 = 19 * b[4];
+  uint128_t r0, r1, r2, r3, r4;
+  uint64_t c;
+
+  r0 = ((uint128_t)a[0] * b[0] + (uint128_t)a[1] * b4_19
+        + (uint128_t)a[2] * b3_19 + (uint128_t)a[3] * b2_19
+        + (uint128_t)a[4] * b1_19);
+  r1 = ((uint128_t)a[0] * b[1] + (uint128_t)a[1] * b[0]
+        + (uint128_t)a[2] * b4_19 + (uint128_t)a[3] * b3_19
+        + (uint128_t)a[4] * b2_19);
+  r2 = ((uint128_t)a[0] * b[2] + (uint128_t)a[1] * b[1]
+        + (uint128_t)a[2] * b[0] + (uint128_t)a[3] * b4_19
+        + (uint128_t)a[4] * b3_19);
+  r3 = ((uint128_t)a[0] * b[3] + (uint128_t)a[1] * b[2]
+        + (uint128_t)a[2] * b[1] + (uint128_t)a[3] * b[0]
+        + (uint128_t)a[4] * b4_19);
+  r4 = ((uint128_t)a[0] * b[4] + (uint128_t)a[1] * b[3]
+        + (uint128_t)a[2] * b[2] + (uint128_t)a[3] * b[1]
+        + (uint128_t)a[4] * b[0]);
+
+  r1 += (uint64_t)(r0 >> 51);
+  h->v[0] = (uint64_t)r0 & MASK51;
+  r2 += (uint64_t)(r1 >> 51);
+  h->v[1] = (uint64_t)r1 & MASK51;
+  r3 += (uint64_t)(r2 >> 51);
+  h->v[2] = (uint64_t)r2 & MASK51;
+  r4 += (uint64_t)(r3 >> 51);
+  h->v[3] = (uint64_t)r3 & MASK51;
+  c = (uint64_t)(r4 >> 51);
+  h->v[4] = (uint64_t)r4 & MASK51;
+  h->v[0] += 19 * c;
+  h->v[1] += h->v[0] >> 51;
+  h->v[0] &= MASK51;
+}
+
+
+/* H = F^(2^N).  */
+static void
+fe_sqn (fe_t *h, const fe_t *f, int n)
+{
+  fe_mul (h, f, f);
+  while (--n > 0)
+    fe_mul (h, h, h);
+}
+
+
+/* H = 1/F, computed as F^(p-2).  */
+static void
+fe_invert (fe_t *h, const fe_t *f)
+{
+  fe_t z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+  fe_sqn (&z2, f, 1);
+  fe_sqn (&t, &z2, 2);
+  fe_mul (&z9, &t, f);
+  fe_mul (&z11, &z9, &z2);
+  fe_sqn (&t, &z11, 1);
+  fe_mul (&z2_5_0, &t, &z9);
+  fe_sqn (&t, &z2_5_0, 5);
+  fe_mul (&z2_10_0, &t, &z2_5_0);
+  fe_sqn (&t, &z2_10_0, 10);
+  fe_mul (&z2_20_0, &t, &z2_10_0);
+  fe_sqn (&t, &z2_20_0, 20);
+  fe_mul (&t, &t, &z2_20_0);
+  fe_sqn (&t, &t, 10);
+  fe_mul (&z2_50_0, &t, &z2_10_0);
+  fe_sqn (&t, &z2_50_0, 50);
+  fe_mul (&z2_100_0, &t, &z2_50_0);
+  fe_sqn (&t, &z2_100_0, 100);
+  fe_mul (&t, &t, &z2_100_0);
+  fe_sqn (&t, &t, 50);
+  fe_mul (&t, &t, &z2_50_0);
+  fe_sqn (&t, &t, 5);
+  fe_mul (h, &t, &z11);
+}
+
+
+/* Replace F by G if FLAG is 1; FLAG must be 0 or 1.  */
+static void
+fe_cmov (fe_t *f, const fe_t *g, unsigned int flag)
+{
+  uint64_t mask = -(uint64_t)flag;
+  int i;
+
+  for (i=0; i < 5; i++)
+    f->v[i] ^= mask & (f->v[i] ^ g->v[i]);
+}
+
+
+/* Set the elements of F[0..N-1] to their inverses.  The inverse of
+   the product of all elements is split into the single inverses
+   (Montgomery's trick).  TMP must provide space for N elements.  */
+static void
+fe_batch_invert (fe_t *f, fe_t *tmp, unsigned int n)
+{
+  fe_t inv, t;
+  unsigned int i;
+
+  tmp[0] = f[0];
+  for (i=1; i < n; i++)
+    fe_mul (&tmp[i], &tmp[i-1], &f[i]);
+  fe_invert (&inv, &tmp[n-1]);
+  for (i = n - 1; i > 0; i--)
+    {
+      fe_mul (&t, &inv, &tmp[i-1]);
+      fe_mul (&inv, &inv, &f[i]);
+      f[i] = t;
+    }
+  f[0] = inv;
+}
+
+
+static void
+ge_p3_0 (ge_p3_t *h)
+{
+  memset (h, 0, sizeof *h);
+  h->Y.v[0] = 1;
+  h->Z.v[0] = 1;
+}
+
+
+static void
+ge_p1p1_to_p2 (ge_p2_t *r, const ge_p1p1_t *p)
+{
+  fe_mul (&r->X, &p->X, &p->T);
+  fe_mul (&r->Y, &p->Y, &p->Z);
+  fe_mul (&r->Z, &p->Z, &p->T);
+}
+
+
+static void
+ge_p1p1_to_p3 (ge_p3_t *r, const ge_p1p1_t *p)
+{
+  fe_mul (&r->X, &p->X, &p->T);
+  fe_mul (&r->Y, &p->Y, &p->Z);
+  fe_mul (&r->Z, &p->Z, &p->T);
+  fe_mul (&r->T, &p->X, &p->Y);
+}
+
+
+/* R = 2 * P.  */
+static void
+ge_p2_dbl (ge_p1p1_t *r, const ge_p2_t *p)
+{
+  fe_t t0;
+
+  fe_mul (&r->X, &p->X, &p->X);
+  fe_mul (&r->Z, &p->Y, &p->Y);
+  fe_mul (&r->T, &p->Z, &p->Z);
+  fe_add (&r->T, &r->T, &r->T);
+  fe_add (&r->Y, &p->X, &p->Y);
+  fe_mul (&t0, &r->Y, &r->Y);
+  fe_add (&r->Y, &r->Z, &r->X);
+  fe_sub (&r->Z, &r->Z, &r->X);
+  fe_sub (&r->X, &t0, &r->Y);
+  fe_sub (&r->T, &r->T, &r->Z);
+}
+
+
+/* R = P + Q.  */
+static void
+ge_madd (ge_p1p1_t *r, const ge_p3_t *p, const ge_precomp_t *q)
+{
+  fe_t t0;
+
+  fe_add (&r->X, &p->Y, &p->X);
+  fe_sub (&r->Y, &p->Y, &p->X);
+  fe_mul (&r->Z, &r->X, &q->ypx);
+  fe_mul (&r->Y, &r->Y, &q->ymx);
+  fe_mul (&r->T, &q->xy2d, &p->T);
+  fe_add (&t0, &p->Z, &p->Z);
+  fe_sub (&r->X, &r->Z, &r->Y);
+  fe_add (&r->Y, &r->Z, &r->Y);
+  fe_add (&r->Z, &t0, &r->T);
+  fe_sub (&r->T, &t0, &r->T);
+}
+
+
+/* Prepare the affine point (X,Y) for ge_madd.  */
+static void
+ge_precomp_from_affine (ge_precomp_t *r, const fe_t *x, const fe_t *y,
+                        const fe_t *d2)
+{
+  fe_add (&r->ypx, y, x);
+  fe_sub (&r->ymx, y, x);
+  fe_mul (&r->xy2d, x, y);
+  fe_mul (&r->xy2d, &r->xy2d, d2);
+}
+
+
+/* Return 1 if B equals C and 0 otherwise.  */
+static unsigned int
+equal (signed char b, signed char c)
+{
+  unsigned char x = (unsigned char)b ^ (unsigned char)c;
+  u32 y = x;
+
+  y -= 1;
+  return y >> 31;
+}
+
+
+/* Set T to B * 256^POS * B for -8 <= B <= 8 without branches or
+   table lookups depending on B.  */
+static void
+select_precomp (ge_precomp_t *t, int pos, signed char b)
+{
+  ge_precomp_t minust;
+  unsigned char bnegative = (unsigned char)b >> 7;
+  unsigned char babs = b - (((-bnegative) & b) << 1);
+  int i;
+
+  memset (t, 0, sizeof *t);
+  t->ypx.v[0] = 1;
+  t->ymx.v[0] = 1;
+  for (i=0; i < 8; i++)
+    {
+      fe_cmov (&t->ypx, &base_table[pos][i].ypx, equal (babs, i + 1));
+      fe_cmov (&t->ymx, &base_table[pos][i].ymx, equal (babs, i + 1));
+      fe_cmov (&t->xy2d, &base_table[pos][i].xy2d, equal (babs, i + 1));
+    }
+  minust.ypx = t->ymx;
+  minust.ymx = t->ypx;
+  fe_neg (&minust.xy2d, &t->xy2d);
+  fe_cmov (&t->ypx, &minust.ypx, bnegative);
+  fe_cmov (&t->ymx, &minust.ymx, bnegative);
+  fe_cmov (&t->xy2d, &minust.xy2d, bnegative);
+}
+
+
+/* H = A * B with the little endian scalar A, where A[31] <= 127.  */
+static void
+ge_scalarmult_base (ge_p3_t *h, const unsigned char *a)
+{
+  signed char e[64];
+  signed char carry;
+  ge_p1p1_t r;
+  ge_p2_t s;
+  ge_precomp_t t;
+  int i;
+
+  for (i=0; i < 32; i++)
+    {
+      e[2*i] = a[i] & 15;
+      e[2*i + 1] = a[i] >> 4;
+    }
+  /* Make each digit -8..7, the last one 0..8.  */
+  carry = 0;
+  for (i=0; i < 63; i++)
+    {
+      e[i] += carry;
+      carry = (e[i] + 8) >> 4;
+      e[i] -= carry << 4;
+    }
+  e[63] += carry;
+
+  ge_p3_0 (h);
+  for (i=1; i < 64; i += 2)
+    {
+      select_precomp (&t, i / 2, e[i]);
+      ge_madd (&r, h, &t);
+      ge_p1p1_to_p3 (h, &r);
+    }
+
+  memcpy (&s, h, sizeof s);
+  ge_p2_dbl (&r, &s);
+  ge_p1p1_to_p2 (&s, &r);
+  ge_p2_dbl (&r, &s);
+  ge_p1p1_to_p2 (&s, &r);
+  ge_p2_dbl (&r, &s);
+  ge_p1p1_to_p2 (&s, &r);
+  ge_p2_dbl (&r, &s);
+  ge_p1p1_to_p3 (h, &r);
+
+  for (i=0; i < 64; i += 2)
+    {
+      select_precomp (&t, i / 2, e[i]);
+      ge_madd (&r, h, &t);
+      ge_p1p1_to_p3 (h, &r);
+    }
+
+  wipememory (e, sizeof e);
+}
+
+
+/* Store F with the ten limbs of 26 and 25 bit of the vector
+   kernels at R.  */
+static void
+fe_to_stored (u32 *r, const fe_t *f)
+{
+  unsigned char s[32];
+  unsigned int i, pos, width, bit;
+
+  fe_tobytes (s, f);
+  for (i=0, pos=0; i < 10; i++, pos += width)
+    {
+      width = (i & 1)? 25 : 26;
+      r[i] = 0;
+      for (bit=0; bit < width; bit++)
+        r[i] |= (u32)((s[(pos + bit) / 8] >> ((pos + bit) % 8)) & 1) << bit;
+    }
+}
+
+
+static void
+precomp_to_stored (ge_precomp10_t *r, const ge_precomp_t *p)
+{
+  fe_to_stored (r->ypx, &p->ypx);
+  fe_to_stored (r->ymx, &p->ymx);
+  fe_to_stored (r->xy2d, &p->xy2d);
+}
+
+
+/* Compute BASE_TABLE and BASE_TABLE10.  */
+static void
+build_base_table (void)
+{
+  fe_t d, d2, x, y, zinv[8], tmp[8];
+  ge_p3_t p, multiples[8];
+  ge_p1p1_t r;
+  ge_p2_t s;
+  ge_precomp_t prep;
+  int i, j;
+
+  fe_frombytes (&d, curve_d);
+  fe_add (&d2, &d, &d);
+  fe_frombytes (&x, base_x);
+  fe_frombytes (&y, base_y);
+  for (i=0; i < 32; i++)
+    {
+      /* X and Y are the affine coordinates of 256^i * B.  */
+      ge_precomp_from_affine (&prep, &x, &y, &d2);
+      ge_p3_0 (&multiples[0]);
+      multiples[0].X = x;
+      multiples[0].Y = y;
+      fe_mul (&multiples[0].T, &x, &y);
+      for (j=1; j < 8; j++)
+        {
+          ge_madd (&r, &multiples[j-1], &prep);
+          ge_p1p1_to_p3 (&multiples[j], &r);
+        }
+      for (j=0; j < 8; j++)
+        zinv[j] = multiples[j].Z;
+      fe_batch_invert (zinv, tmp, 8);
+      for (j=0; j < 8; j++)
+        {
+          fe_mul (&x, &multiples[j].X, &zinv[j]);
+          fe_mul (&y, &multiples[j].Y, &zinv[j]);
+          ge_precomp_from_affine (&base_table[i][j], &x, &y, &d2);
+          precomp_to_stored (&base_table10[i][j], &base_table[i][j]);
+        }
+
+      /* Compute 256^(i+1) * B from 256^i * B which is the first
+         multiple.  */
+      p = multiples[0];
+      for (j=0; j < 8; j++)
+        {
+          memcpy (&s, &p, sizeof s);
+          ge_p2_dbl (&r, &s);
+          ge_p1p1_to_p3 (&p, &r);
+        }
+      fe_invert (&zinv[0], &p.Z);
+      fe_mul (&x, &p.X, &zinv[0]);
+      fe_mul (&y, &p.Y, &zinv[0]);
+    }
+}
+
+
+static void
+scalarmult_scalar (ge_p3_t *h, const unsigned char *a)
+{
+  ge_scalarmult_base (h, a);
+}
+
+
+#ifdef USE_ED25519_X86
+
+typedef uint64_t lanes_v4_t __attribute__ ((vector_size (32)));
+typedef uint64_t lanes_v8_t __attribute__ ((vector_size (64)));
+
+#define LANES 4
+#define LANES_T lanes_v4_t
+#define LANES_FNC(n) n ## _avx2
+#define LANES_ATTR __attribute__ ((target ("avx2")))
+#define MUL32(a,b) ((lanes_v4_t)_mm256_mul_epu32 ((__m256i)(a), (__m256i)(b)))
+#include "vanity-ed25519-lanes.h"
+#undef MUL32
+#undef LANES_ATTR
+#undef LANES_FNC
+#undef LANES_T
+#undef LANES
+
+static int
+supported_avx2 (void)
+{
+  return __builtin_cpu_supports ("avx2");
+}
+
+
+#define LANES 8
+#define LANES_T lanes_v8_t
+#define LANES_FNC(n) n ## _avx512
+#define LANES_ATTR __attribute__ ((target ("avx512f")))
+#define MUL32(a,b) ((lanes_v8_t)_mm512_mul_epu32 ((__m512i)(a), (__m512i)(b)))
+#include "vanity-ed25519-lanes.h"
+#undef MUL32
+#undef LANES_ATTR
+#undef LANES_FNC
+#undef LANES_T
+#undef LANES
+
+static int
+supported_avx512 (void)
+{
+  return __builtin_cpu_supports ("avx512f");
+}
+
+#endif /*USE_ED25519_X86*/
+
+
+/* The available kernels for the base point multiplication.  The
+   scalar kernel must be the last one.  */
+static struct
+{
+  const char *name;
+  unsigned int lanes;
+  void (*scalarmult) (ge_p3_t *h, const unsigned char *a);
+  int (*supported) (void);
+} kernels[] =
+  {
+#ifdef USE_ED25519_X86
+    { "avx512", 8, scalarmult_base_avx512, supported_avx512 },
+    { "avx2",   4, scalarmult_base_avx2,   supported_avx2 },
+#endif
+    { "scalar", 1, scalarmult_scalar,      NULL }
+  };
+
+/* The index of the selected kernel.  */
+static int selected_kernel;
+
+/* The largest number of lanes of a kernel.  */
+#define MAX_LANES 8
+
+/* The number of batches computed to time a kernel.  */
+#define CALIBRATION_BATCHES 16
+
+
+/* Compute the public keys for the N seeds at SEEDS with kernel
+   number IDX; see _vanity_ed25519_keys.  */
+static void
+compute_keys (int idx, const unsigned char *seeds, unsigned int n,
+              unsigned char *q)
+{
+  unsigned char scalars[32 * (VANITY_ED25519_BATCH + MAX_LANES)];
+  ge_p3_t points[VANITY_ED25519_BATCH + MAX_LANES];
+  fe_t zinv[VANITY_ED25519_BATCH], tmp[VANITY_ED25519_BATCH];
+  fe_t x, y;
+  unsigned char xbytes[32];
+  unsigned int lanes = kernels[idx].lanes;
+  unsigned int i;
+
+  _vanity_sha512_expand (seeds, n, scalars);
+  /* Fill the lanes left over by the last call of the kernel.  */
+  for (i=n; i % lanes; i++)
+    memcpy (scalars + 32 * i, scalars, 32);
+  for (i=0; i < n; i += lanes)
+    kernels[idx].scalarmult (points + i, scalars + 32 * i);
+  wipememory (scalars, sizeof scalars);
+
+  for (i=0; i < n; i++)
+    zinv[i] = points[i].Z;
+  fe_batch_invert (zinv, tmp, n);
+  for (i=0; i < n; i++)
+    {
+      fe_mul (&x, &points[i].X, &zinv[i]);
+      fe_mul (&y, &points[i].Y, &zinv[i]);
+      fe_tobytes (q + 32 * i, &y);
+      fe_tobytes (xbytes, &x);
+      q[32 * i + 31] ^= (xbytes[0] & 1) << 7;
+    }
+  wipememory (points, sizeof points);
+}
+
+
+/* Check kernel number IDX.  The first key is the test vector and the
+   others are compared against the scalar kernel, which must pass the
+   test vector itself.  Returns true if the kernel works correctly.  */
+static int
+selftest_kernel (int idx)
+{
+  unsigned char seeds[32 * VANITY_ED25519_BATCH];
+  unsigned char q[32 * VANITY_ED25519_BATCH];
+  unsigned char expect[32 * VANITY_ED25519_BATCH];
+  unsigned int i;
+
+  memcpy (seeds, selftest_seed, 32);
+  for (i=32; i < sizeof seeds; i++)
+    seeds[i] = i * 7 + 3;
+  compute_keys (idx, seeds, VANITY_ED25519_BATCH, q);
+  if (memcmp (q, selftest_q, 32))
+    return 0;
+  if (idx == DIM (kernels) - 1)
+    return 1;
+  compute_keys (DIM (kernels) - 1, seeds, VANITY_ED25519_BATCH, expect);
+  return !memcmp (q, expect, sizeof q);
+}
+
+
+/* Return the time in nanoseconds kernel number IDX takes for
+   CALIBRATION_BATCHES batches, or 0 if that can't be measured.  */
+static unsigned long long
+time_kernel (int idx)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  unsigned char seeds[32 * VANITY_ED25519_BATCH];
+  unsigned char q[32 * VANITY_ED25519_BATCH];
+  struct timespec start, stop;
+  unsigned int n;
+
+  memset (seeds, 0x5a, sizeof seeds);
+  if (clock_gettime (CLOCK_MONOTONIC, &start))
+    return 0;
+  for (n=0; n < CALIBRATION_BATCHES; n++)
+    {
+      compute_keys (idx, seeds, VANITY_ED25519_BATCH, q);
+      seeds[0] = q[0];
+    }
+  if (clock_gettime (CLOCK_MONOTONIC, &stop))
+    return 0;
+  return ((stop.tv_sec - start.tv_sec) * 1000000000ULL
+          + stop.tv_nsec - start.tv_nsec);
+#else
+  (void)idx;
+  return 0;
+#endif
+}
+#endif /*USE_ED25519_BATCH*/
+
+
+/* Prepare the batch key generation.  Returns true if it can be used;
+   if not, the keys need to be generated by gcry_pk_genkey.  Must be
+   called before _vanity_ed25519_keys and with the npth lock held.  */
+int
+_vanity_ed25519_init (void)
+{
+#ifdef USE_ED25519_BATCH
+  unsigned long long t, best_time = 0;
+  int i, best = -1;
+
+  if (!ed25519_state)
+    {
+      _vanity_sha512_init ();
+      build_base_table ();
+#ifdef USE_ED25519_X86
+      __builtin_cpu_init ();
+#endif
+      for (i=0; i < DIM (kernels); i++)
+        {
+          if (kernels[i].supported && !kernels[i].supported ())
+            continue;
+          if (!selftest_kernel (i))
+            {
+              log_error ("Ed25519 kernel '%s' failed the self-test\n",
+                         kernels[i].name);
+              continue;
+            }
+          t = time_kernel (i);
+          if (best == -1 || (t && t < best_time))
+            {
+              best = i;
+              best_time = t;
+            }
+        }
+      selected_kernel = best;
+      ed25519_state = best == -1? -1 : 1;
+      if (ed25519_state < 0)
+        log_error ("Ed25519 batch key generation failed the self-test\n");
+    }
+  return ed25519_state > 0;
+#else
+  return 0;
+#endif
+}
+
+
+/* Compute the public keys for the N Ed25519 secret keys at SEEDS, of
+   32 bytes each, and store their encodings at Q, again 32 bytes each.
+   N must not be larger than VANITY_ED25519_BATCH.  */
+void
+_vanity_ed25519_keys (const unsigned char *seeds, unsigned int n,
+                      unsigned char *q)
+{
+#ifdef USE_ED25519_BATCH
+  compute_keys (selected_kernel, seeds, n, q);
+#else
+  (void)seeds;
+  (void)n;
+  (void)q;
+  log_bug ("Ed25519 batch key generation not available\n");
+#endif
+}
+
+
+/* Return the name of the Ed25519 kernel number IDX in the order they
+   are tried, or NULL if there is no such kernel.  */
+const char *
+_vanity_ed25519_kernel_list (unsigned int idx)
+{
+#ifdef USE_ED25519_BATCH
+  return idx < DIM (kernels)? kernels[idx].name : NULL;
+#else
+  (void)idx;
+  return NULL;
+#endif
+}
+
+
+/* Select the Ed25519 kernel NAME instead of the fastest one.  Returns
+   false if the kernel is not supported by the CPU or fails the
+   self-test.  Must be called after a successful _vanity_ed25519_init
+   and before any search starts.  */
+int
+_vanity_ed25519_select (const char *name)
+{
+#ifdef USE_ED25519_BATCH
+  int i;
+
+  for (i=0; i < DIM (kernels); i++)
+    if (!strcmp (kernels[i].name, name))
+      break;
+  if (i == DIM (kernels)
+      || (kernels[i].supported && !kernels[i].supported ())
+      || !selftest_kernel (i))
+    return 0;
+  selected_kernel = i;
+  return 1;
+#else
+  (void)name;
+  return 0;
+#endif
+}
+
+
+/* Return the name of the selected Ed25519 kernel.  */
+const char *
+_vanity_ed25519_kernel_name (void)
+{
+#ifdef USE_ED25519_BATCH
+  return kernels[selected_kernel].name;
+#else
+  return "none";
+#endif
+}
+
+
+/* Return the table for the fixed-base multiplication with the ten
+   limbs of the vector kernels: VANITY_ED25519_TABLE_WORDS words with
+   Y+X, Y-X and 2*d*X*Y of the 8 multiples for each of the 32
+   positions.  Returns NULL if _vanity_ed25519_init did not succeed.
+   This is used by the device kernel of vanity-opencl.c.  */
+const u32 *
+_vanity_ed25519_table (void)
+{
+#ifdef USE_ED25519_BATCH
+  return ed25519_state > 0? base_table10[0][0].ypx : NULL;
+#else
+  return NULL;
+#endif
+}
@@ -0,0 +1,868 @@
+/* vanity-keyid.c - Reference fingerprint computation for the engine
+ * Copyright (C) 1998, 1999, 2000, 2001, 2003,
+ *               2004, 2006, 2010 Free Software Foundation, Inc.
+ * Copyright (C) 2014 Werner Koch
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The functions in this file mirror the corresponding code in
+   g10/keygen.c, g10/keyid.c and g10/ecdh.c.  gpg-agent does not link the g10
+   code, thus to compute the fingerprint of a freshly generated key
+   we need our own versions.  Make sure they do not diverge from the
+   originals.
+
+   Other than g10 we serialize the key packet only once per key and
+   then only patch the timestamp for each fingerprint.  The workers
+   also take a shortcut to get at the key: the curve OID and the ECDH
+   KDF parameters are looked up once per job and the point Q, or the
+   parameters of an RSA, DSA or Elgamal key, are taken directly from
+   the result of gcry_pk_genkey as byte strings, without going through
+   MPIs.  The reference path via ecckey_from_sexp or key_from_sexp is
+   still used to verify a hit.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "vanity-defs.h"
+#include "../common/openpgpdefs.h"
+#include "../common/host2net.h"
+
+
+/* The maximum length of a key packet we prepare.  An Ed25519 key
+   packet takes 51 bytes, an ECDH key on NIST P-521 or
+   brainpoolP512r1 154 bytes, an RSA key of 4096 bits 528 bytes and
+   the largest, an Elgamal key of 4096 bits, 1551 bytes.  */
+#define MAX_PACKET_LEN 1560
+
+/* The largest number of public key parameters.  */
+#define MAX_NPKEY 4
+
+/* The offsets of the timestamp, the algorithm and the public key
+   parameters in the hashed key packet of VERSION.  A v5 packet has a
+   4 byte length header and a 4 byte length of the key material.  */
+#define TIMESTAMP_OFF(v) ((v) == 5? 6 : 4)
+#define ALGO_OFF(v)      ((v) == 5? 10 : 8)
+#define PARAMS_OFF(v)    ((v) == 5? 15 : 9)
+
+
+/* A public key prepared for the fingerprint computation.  This is
+   the complete key packet as it is hashed for the fingerprint.  If
+   the packet is short enough the SHA-1 kernels are used; the multi
+   block ones if it does not fit into a single block.  The packet of
+   a v5 key is hashed with the SHA-256 kernel instead.  */
+struct vanity_refkey_s
+{
+  int version;               /* The key version, 4 or 5.  */
+  int use_kernel;
+  int multi_block;
+  unsigned int quarantined;  /* VANITY_PATH_ bits not to be used.  */
+  struct vanity_sha1_s sha1;
+  struct vanity_sha256_s sha256;
+  size_t packetlen;
+  unsigned char packet[MAX_PACKET_LEN];
+};
+
+
+/* A table with the default KEK parameters used by GnuPG.  Copied
+   from g10/ecdh.c.  */
+static const struct
+{
+  unsigned int qbits;
+  int openpgp_hash_id;   /* KEK digest algorithm. */
+  int openpgp_cipher_id; /* KEK cipher algorithm. */
+} kek_params_table[] =
+  /* Note: Must be sorted by ascending values for QBITS.  */
+  {
+    { 256, DIGEST_ALGO_SHA256, CIPHER_ALGO_AES    },
+    { 384, DIGEST_ALGO_SHA384, CIPHER_ALGO_AES256 },
+
+    /* Note: 528 is 521 rounded to the 8 bit boundary */
+    { 528, DIGEST_ALGO_SHA512, CIPHER_ALGO_AES256 }
+  };
+
+
+/* Store the default KEK parameters for an ECDH key on a curve with
+   QBITS at KEK_PARAMS, which must provide space for
+   VANITY_KDF_PARAMS_LEN bytes.  This is pk_ecdh_default_params from
+   g10/ecdh.c without the MPI wrapping.  */
+void
+_vanity_ecdh_kdf_params (unsigned int qbits, unsigned char *kek_params)
+{
+  int i;
+
+  kek_params[0] = 3; /* Number of bytes to follow. */
+  kek_params[1] = 1; /* Version for KDF+AESWRAP.   */
+
+  /* Search for matching KEK parameter.  Defaults to the strongest
+     possible choices.  Performance is not an issue here, only
+     interoperability.  */
+  for (i=0; i < DIM (kek_params_table); i++)
+    {
+      if (kek_params_table[i].qbits >= qbits
+          || i+1 == DIM (kek_params_table))
+        {
+          kek_params[2] = kek_params_table[i].openpgp_hash_id;
+          kek_params[3] = kek_params_table[i].openpgp_cipher_id;
+          break;
+        }
+    }
+  assert (i < DIM (kek_params_table));
+}
+
+
+/* Return the names of the public key parameters of the non-ECC
+   algorithm ALGO as used by libgcrypt, in the order of the key
+   packet, or NULL if ALGO is not supported.  */
+static const char *
+pubkey_elems (int algo)
+{
+  switch (algo)
+    {
+    case PUBKEY_ALGO_RSA:       return "ne";
+    case PUBKEY_ALGO_DSA:       return "pqgy";
+    case PUBKEY_ALGO_ELGAMAL_E: return "pgy";
+    default:                    return NULL;
+    }
+}
+
+
+/* Copied from g10/keygen.c.  */
+static int
+key_from_sexp (gcry_mpi_t *array, gcry_sexp_t sexp,
+               const char *topname, const char *elems)
+{
+  gcry_sexp_t list, l2;
+  const char *s;
+  int i, idx;
+  int rc = 0;
+
+  list = gcry_sexp_find_token (sexp, topname, 0);
+  if (!list)
+    return gpg_error (GPG_ERR_INV_OBJ);
+  l2 = gcry_sexp_cadr (list);
+  gcry_sexp_release (list);
+  list = l2;
+  if (!list)
+    return gpg_error (GPG_ERR_NO_OBJ);
+
+  for (idx=0,s=elems; *s; s++, idx++)
+    {
+      l2 = gcry_sexp_find_token (list, s, 1);
+      if (!l2)
+        {
+          rc = gpg_error (GPG_ERR_NO_OBJ); /* required parameter not found */
+          goto leave;
+        }
+      array[idx] = gcry_sexp_nth_mpi (l2, 1, GCRYMPI_FMT_USG);
+      gcry_sexp_release (l2);
+      if (!array[idx])
+        {
+          rc = gpg_error (GPG_ERR_INV_OBJ); /* required parameter invalid */
+          goto leave;
+        }
+    }
+  gcry_sexp_release (list);
+
+ leave:
+  if (rc)
+    {
+      for (i=0; i<idx; i++)
+        {
+          gcry_mpi_release (array[i]);
+          array[i] = NULL;
+        }
+      gcry_sexp_release (list);
+    }
+  return rc;
+}
+
+
+/* Copied from g10/keygen.c.  */
+static gpg_error_t
+ecckey_from_sexp (gcry_mpi_t *array, gcry_sexp_t sexp, int algo)
+{
+  gpg_error_t err;
+  gcry_sexp_t list, l2;
+  char *curve;
+  int i;
+  const char *oidstr;
+  unsigned int nbits;
+  unsigned char *kek_params;
+
+  array[0] = NULL;
+  array[1] = NULL;
+  array[2] = NULL;
+
+  list = gcry_sexp_find_token (sexp, "public-key", 0);
+  if (!list)
+    return gpg_error (GPG_ERR_INV_OBJ);
+  l2 = gcry_sexp_cadr (list);
+  gcry_sexp_release (list);
+  list = l2;
+  if (!list)
+    return gpg_error (GPG_ERR_NO_OBJ);
+
+  l2 = gcry_sexp_find_token (list, "curve", 0);
+  if (!l2)
+    {
+      err = gpg_error (GPG_ERR_NO_OBJ);
+      goto leave;
+    }
+  curve = gcry_sexp_nth_string (l2, 1);
+  if (!curve)
+    {
+      err = gpg_error (GPG_ERR_NO_OBJ);
+      goto leave;
+    }
+  gcry_sexp_release (l2);
+  oidstr = openpgp_curve_to_oid (curve, &nbits);
+  xfree (curve);
+  if (!oidstr)
+    {
+      /* That can't happen because we used one of the curves
+         gpg_curve_to_oid knows about.  */
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto leave;
+    }
+  err = openpgp_oid_from_str (oidstr, &array[0]);
+  if (err)
+    goto leave;
+
+  l2 = gcry_sexp_find_token (list, "q", 0);
+  if (!l2)
+    {
+      err = gpg_error (GPG_ERR_NO_OBJ);
+      goto leave;
+    }
+  array[1] = gcry_sexp_nth_mpi (l2, 1, GCRYMPI_FMT_USG);
+  gcry_sexp_release (l2);
+  if (!array[1])
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto leave;
+    }
+  gcry_sexp_release (list);
+  list = NULL;
+
+  if (algo == PUBKEY_ALGO_ECDH)
+    {
+      kek_params = xtrymalloc (VANITY_KDF_PARAMS_LEN);
+      if (!kek_params)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      _vanity_ecdh_kdf_params (nbits, kek_params);
+      array[2] = gcry_mpi_set_opaque (NULL, kek_params,
+                                      VANITY_KDF_PARAMS_LEN * 8);
+    }
+
+ leave:
+  gcry_sexp_release (list);
+  if (err)
+    {
+      for (i=0; i < 3; i++)
+        {
+          gcry_mpi_release (array[i]);
+          array[i] = NULL;
+        }
+    }
+  return err;
+}
+
+
+/* Finish the key packet of REFKEY, which has the public key
+   parameters of algorithm ALGO at PARAMS_OFF and a total length of N,
+   by filling in the header.  The timestamp is left as zero.  */
+static void
+finish_packet (vanity_refkey_t refkey, size_t n, int algo)
+{
+  unsigned char *buffer = refkey->packet;
+
+  if (refkey->version == 5)
+    {
+      buffer[0] = 0x9a;     /* ctb */
+      buffer[1] = (n-5) >> 24; /* 4 byte length header */
+      buffer[2] = (n-5) >> 16;
+      buffer[3] = (n-5) >>  8;
+      buffer[4] = (n-5);
+      buffer[5] = 5;        /* version */
+      memset (buffer + 6, 0, 4);
+      buffer[10] = algo;
+      buffer[11] = (n-15) >> 24; /* length of the key material */
+      buffer[12] = (n-15) >> 16;
+      buffer[13] = (n-15) >>  8;
+      buffer[14] = (n-15);
+      refkey->packetlen = n;
+
+      refkey->use_kernel = (n <= VANITY_SHA256_MAXLEN);
+      refkey->multi_block = 0;
+      if (refkey->use_kernel)
+        _vanity_sha256_prepare (&refkey->sha256, buffer, n);
+      return;
+    }
+
+  buffer[0] = 0x99;     /* ctb */
+  buffer[1] = (n-3) >> 8;  /* 2 byte length header */
+  buffer[2] = (n-3);
+  buffer[3] = 4;        /* version */
+  memset (buffer + 4, 0, 4);
+  buffer[8] = algo;
+  refkey->packetlen = n;
+
+  refkey->use_kernel = (n <= VANITY_SHA1_MULTI_MAXLEN);
+  refkey->multi_block = (n > VANITY_SHA1_MAXLEN);
+  if (refkey->use_kernel)
+    _vanity_sha1_prepare (&refkey->sha1, buffer, n);
+}
+
+
+/* Append the unsigned big endian integer DATA of length LEN to the
+   key packet of REFKEY at offset *R_N in the OpenPGP MPI format and
+   update *R_N.  */
+static gpg_error_t
+put_mpi (vanity_refkey_t refkey, size_t *r_n,
+         const unsigned char *data, size_t len)
+{
+  unsigned char *buffer = refkey->packet;
+  size_t n = *r_n;
+  unsigned int nbits;
+
+  /* Strip leading zeroes as done when printing an MPI.  */
+  for (; data && len && !*data; data++, len--)
+    ;
+  if (n + 2 + len > sizeof refkey->packet)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  nbits = len * 8;
+  if (len)
+    for (; !(*data & (1 << ((nbits - 1) & 7))); nbits--)
+      ;
+  buffer[n++] = nbits >> 8;
+  buffer[n++] = nbits;
+  if (len)
+    memcpy (buffer + n, data, len);
+  *r_n = n + len;
+  return 0;
+}
+
+
+/* Serialize the public key parameters ARRAY of algorithm ALGO into
+   the v4 or v5 key packet used for the fingerprint computation (see
+   hash_public_key in g10/keyid.c).  The timestamp is left as zero.
+   For the ECC algorithms the parameters are the OID, Q and for ECDH
+   the KDF parameters.  */
+static gpg_error_t
+build_packet (vanity_refkey_t refkey, gcry_mpi_t *array, int algo)
+{
+  gpg_error_t err;
+  unsigned char *buffer = refkey->packet;
+  size_t n, nbytes;
+  unsigned int nbits;
+  const void *p;
+  int i;
+  int npkey;
+
+  if (pubkey_elems (algo))
+    npkey = strlen (pubkey_elems (algo));
+  else
+    npkey = algo == PUBKEY_ALGO_ECDH? 3 : 2;
+
+  n = PARAMS_OFF (refkey->version);  /* The header up to the algo.  */
+  for (i=0; i < npkey; i++)
+    {
+      if (!array[i])
+        ;
+      else if (gcry_mpi_get_flag (array[i], GCRYMPI_FLAG_OPAQUE))
+        {
+          p = gcry_mpi_get_opaque (array[i], &nbits);
+          nbytes = (nbits+7)/8;
+          if (n + nbytes > sizeof refkey->packet)
+            return gpg_error (GPG_ERR_TOO_LARGE);
+          if (p)
+            memcpy (buffer + n, p, nbytes);
+          n += nbytes;
+        }
+      else
+        {
+          err = gcry_mpi_print (GCRYMPI_FMT_PGP, buffer + n,
+                                sizeof refkey->packet - n, &nbytes, array[i]);
+          if (err)
+            return err;
+          n += nbytes;
+        }
+    }
+
+  finish_packet (refkey, n, algo);
+  return 0;
+}
+
+
+/* Store the curve OID of the ECC key parameters KEYPARAM, as the
+   length prefixed byte string used in the key packet, at BUFFER,
+   which must provide space for VANITY_MAX_OIDLEN bytes.  The length
+   is stored at R_LEN and the size of the curve in bits at
+   R_NBITS.  */
+gpg_error_t
+_vanity_curve_oid (gcry_sexp_t keyparam, unsigned char *buffer,
+                   size_t *r_len, unsigned int *r_nbits)
+{
+  gpg_error_t err;
+  gcry_sexp_t l1;
+  gcry_mpi_t oid;
+  char *curve;
+  const char *oidstr;
+  const void *p;
+  unsigned int nbits, curvebits;
+  size_t n;
+
+  *r_len = 0;
+  *r_nbits = 0;
+
+  l1 = gcry_sexp_find_token (keyparam, "curve", 0);
+  if (!l1)
+    return gpg_error (GPG_ERR_NO_OBJ);
+  curve = gcry_sexp_nth_string (l1, 1);
+  gcry_sexp_release (l1);
+  if (!curve)
+    return gpg_error (GPG_ERR_NO_OBJ);
+  oidstr = openpgp_curve_to_oid (curve, &curvebits);
+  xfree (curve);
+  if (!oidstr)
+    return gpg_error (GPG_ERR_UNKNOWN_CURVE);
+  err = openpgp_oid_from_str (oidstr, &oid);
+  if (err)
+    return err;
+
+  p = gcry_mpi_get_opaque (oid, &nbits);
+  n = (nbits+7)/8;
+  if (!p || !n || n > VANITY_MAX_OIDLEN)
+    err = gpg_error (GPG_ERR_INV_OID_STRING);
+  else
+    {
+      memcpy (buffer, p, n);
+      *r_len = n;
+      *r_nbits = curvebits;
+    }
+  gcry_mpi_release (oid);
+  return err;
+}
+
+
+/* Set REFKEY to the public key of algorithm ALGO with the point Q of
+   length QLEN.  OID is the curve OID as returned by _vanity_curve_oid
+   for the key parameters used; for ECDH KDF are the
+   VANITY_KDF_PARAMS_LEN bytes of KDF parameters as returned by
+   _vanity_ecdh_kdf_params.  This avoids all memory allocations and
+   is what the workers use for each new key.  */
+gpg_error_t
+_vanity_refkey_set_q (vanity_refkey_t refkey, const unsigned char *q,
+                      size_t qlen, int algo,
+                      const unsigned char *oid, size_t oidlen,
+                      const unsigned char *kdf)
+{
+  size_t n, kdflen;
+  unsigned char *buffer = refkey->packet;
+
+  if (algo == PUBKEY_ALGO_ECDH)
+    kdflen = VANITY_KDF_PARAMS_LEN;
+  else if (algo == PUBKEY_ALGO_ECDSA || algo == PUBKEY_ALGO_EDDSA)
+    kdflen = 0;
+  else
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+
+  for (; q && qlen && !*q; q++, qlen--)
+    ;
+  n = PARAMS_OFF (refkey->version);
+  if (!q || !qlen
+      || n + oidlen + 2 + qlen + kdflen > sizeof refkey->packet)
+    return gpg_error (GPG_ERR_INV_OBJ);
+
+  memcpy (buffer + n, oid, oidlen);
+  n += oidlen;
+  put_mpi (refkey, &n, q, qlen);
+  if (kdflen)
+    {
+      memcpy (buffer + n, kdf, kdflen);
+      n += kdflen;
+    }
+
+  finish_packet (refkey, n, algo);
+  return 0;
+}
+
+
+/* Set REFKEY to the public key of the RSA, DSA or Elgamal algorithm
+   ALGO generated by gcry_pk_genkey as S_KEY.  */
+static gpg_error_t
+set_params (vanity_refkey_t refkey, gcry_sexp_t s_key, int algo)
+{
+  gpg_error_t err = 0;
+  gcry_sexp_t l1;
+  const unsigned char *data;
+  const char *s;
+  size_t n, len;
+  char name[2];
+
+  /* The public parameters come first; the private key has them as
+     well.  */
+  n = PARAMS_OFF (refkey->version);
+  name[1] = 0;
+  for (s = pubkey_elems (algo); !err && *s; s++)
+    {
+      name[0] = *s;
+      l1 = gcry_sexp_find_token (s_key, name, 1);
+      data = l1? (const unsigned char *)gcry_sexp_nth_data (l1, 1, &len) : NULL;
+      if (!data)
+        err = gpg_error (GPG_ERR_NO_OBJ);
+      else
+        err = put_mpi (refkey, &n, data, len);
+      gcry_sexp_release (l1);
+    }
+  if (!err)
+    finish_packet (refkey, n, algo);
+  return err;
+}
+
+
+/* Replace the KDF parameters of the ECDH key set in REFKEY by the
+   VANITY_KDF_PARAMS_LEN bytes at KDF.  They are the last field of the
+   key packet.  */
+gpg_error_t
+_vanity_refkey_set_kdf (vanity_refkey_t refkey, const unsigned char *kdf)
+{
+  size_t n = refkey->packetlen;
+  int algo;
+
+  algo = refkey->packet[ALGO_OFF (refkey->version)];
+  if (algo != PUBKEY_ALGO_ECDH
+      || n < PARAMS_OFF (refkey->version) + VANITY_KDF_PARAMS_LEN)
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+  memcpy (refkey->packet + n - VANITY_KDF_PARAMS_LEN, kdf,
+          VANITY_KDF_PARAMS_LEN);
+  finish_packet (refkey, n, algo);
+  return 0;
+}
+
+
+/* Set REFKEY to the public key of algorithm ALGO generated by
+   gcry_pk_genkey as S_KEY.  See _vanity_refkey_set_q for OID and
+   KDF, which are not used for RSA, DSA and Elgamal keys.  */
+gpg_error_t
+_vanity_refkey_set_key (vanity_refkey_t refkey, gcry_sexp_t s_key, int algo,
+                        const unsigned char *oid, size_t oidlen,
+                        const unsigned char *kdf)
+{
+  gpg_error_t err;
+  gcry_sexp_t l1;
+  const unsigned char *q;
+  size_t qlen;
+
+  if (pubkey_elems (algo))
+    return set_params (refkey, s_key, algo);
+
+  /* The public and the private key have the same Q; simply take the
+     first one.  */
+  l1 = gcry_sexp_find_token (s_key, "q", 0);
+  if (!l1)
+    return gpg_error (GPG_ERR_NO_OBJ);
+  q = (const unsigned char *)gcry_sexp_nth_data (l1, 1, &qlen);
+  err = _vanity_refkey_set_q (refkey, q, qlen, algo, oid, oidlen, kdf);
+  gcry_sexp_release (l1);
+  return err;
+}
+
+
+
+/* Prepare the public key S_PUBLIC of algorithm ALGO for use with
+   _vanity_refkey_fingerprint as a key of VERSION, which is 4 or 5.
+   If S_PUBLIC is NULL an empty object for use with
+   _vanity_refkey_set_key is returned.  */
+gpg_error_t
+_vanity_refkey_new (vanity_refkey_t *r_refkey, gcry_sexp_t s_public,
+                    int algo, int version)
+{
+  gpg_error_t err;
+  vanity_refkey_t refkey;
+  gcry_mpi_t pkey[MAX_NPKEY];
+  int i;
+
+  *r_refkey = NULL;
+
+  if (algo != PUBKEY_ALGO_EDDSA && algo != PUBKEY_ALGO_ECDSA
+      && algo != PUBKEY_ALGO_ECDH && !pubkey_elems (algo))
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+  if (version != 4 && version != 5)
+    return gpg_error (GPG_ERR_UNKNOWN_VERSION);
+
+  refkey = xtrycalloc (1, sizeof *refkey);
+  if (!refkey)
+    return gpg_error_from_syserror ();
+  refkey->version = version;
+  if (!s_public)
+    {
+      *r_refkey = refkey;
+      return 0;
+    }
+
+  memset (pkey, 0, sizeof pkey);
+  if (pubkey_elems (algo))
+    err = key_from_sexp (pkey, s_public, "public-key", pubkey_elems (algo));
+  else
+    err = ecckey_from_sexp (pkey, s_public, algo);
+  if (!err)
+    {
+      err = build_packet (refkey, pkey, algo);
+      for (i=0; i < DIM (pkey); i++)
+        gcry_mpi_release (pkey[i]);
+    }
+  if (err)
+    {
+      xfree (refkey);
+      return err;
+    }
+
+  *r_refkey = refkey;
+  return 0;
+}
+
+
+void
+_vanity_refkey_release (vanity_refkey_t refkey)
+{
+  xfree (refkey);
+}
+
+
+/* Return the bytes of memory a reference key takes.  */
+size_t
+_vanity_refkey_memory (void)
+{
+  return sizeof (struct vanity_refkey_s);
+}
+
+
+/* Return the key version of REFKEY.  */
+int
+_vanity_refkey_version (vanity_refkey_t refkey)
+{
+  return refkey->version;
+}
+
+
+/* Return the length of the fingerprint of a key of VERSION.  */
+size_t
+_vanity_fpr_len (int version)
+{
+  return version == 5? VANITY_V5_FPR_LEN : VANITY_FPR_LEN;
+}
+
+
+/* Return the low 32 bits of the keyid of a key of VERSION with the
+   fingerprint FPR.  The keyid of a v4 key is taken from the end of
+   its fingerprint and that of a v5 key from the start.  */
+u32
+_vanity_fpr_keyid (const unsigned char *fpr, int version)
+{
+  return buf32_to_u32 (fpr + (version == 5? 4 : VANITY_FPR_LEN - 4));
+}
+
+
+/* Compute the fingerprint of REFKEY assuming a creation time of
+   TIMESTAMP and store it at FPR, which must provide space for
+   VANITY_MAX_FPR_LEN bytes.  Only the timestamp of the prepared
+   packet is changed; this does not allocate any memory.  */
+void
+_vanity_refkey_fingerprint (vanity_refkey_t refkey, u32 timestamp,
+                            unsigned char *fpr)
+{
+  switch (_vanity_refkey_path (refkey, 0))
+    {
+    case VANITY_PATH_SHA256:
+      _vanity_sha256_fingerprint (&refkey->sha256, timestamp, fpr);
+      break;
+    case VANITY_PATH_LIBGCRYPT:
+      _vanity_refkey_reference_fpr (refkey, timestamp, fpr);
+      break;
+    default:
+      _vanity_sha1_fingerprint (&refkey->sha1, timestamp, fpr);
+      break;
+    }
+}
+
+
+/* Compute the fingerprint of REFKEY like _vanity_refkey_fingerprint
+   but always with libgcrypt, as fingerprint_from_pk does.  This is
+   the reference the results of the kernels are verified against.  */
+void
+_vanity_refkey_reference_fpr (vanity_refkey_t refkey, u32 timestamp,
+                              unsigned char *fpr)
+{
+  unsigned char *p = refkey->packet + TIMESTAMP_OFF (refkey->version);
+
+  p[0] = timestamp >> 24;
+  p[1] = timestamp >> 16;
+  p[2] = timestamp >>  8;
+  p[3] = timestamp;
+  gcry_md_hash_buffer (refkey->version == 5? GCRY_MD_SHA256 : GCRY_MD_SHA1,
+                       fpr, refkey->packet, refkey->packetlen);
+}
+
+
+/* Return the VANITY_PATH_ value of the path _vanity_refkey_keyids or,
+   if DIGESTS is set, _vanity_refkey_digests takes for the current key
+   of REFKEY.  */
+int
+_vanity_refkey_path (vanity_refkey_t refkey, int digests)
+{
+  int path;
+
+  if (!refkey->use_kernel)
+    return VANITY_PATH_LIBGCRYPT;
+  if (refkey->version == 5)
+    path = VANITY_PATH_SHA256;
+  else if (refkey->multi_block)
+    path = VANITY_PATH_MULTI;
+  else
+    path = digests? VANITY_PATH_DIGEST : VANITY_PATH_KEYID;
+  if ((refkey->quarantined & (1 << path)))
+    return VANITY_PATH_LIBGCRYPT;
+  return path;
+}
+
+
+/* Do not use the paths given by the VANITY_PATH_ bits of QUARANTINED
+   for REFKEY any longer; libgcrypt is used instead.  */
+void
+_vanity_refkey_quarantine (vanity_refkey_t refkey, unsigned int quarantined)
+{
+  refkey->quarantined = quarantined;
+}
+
+
+/* Compute the low 32 bit keyids of REFKEY for consecutive creation
+   times starting at TIMESTAMP and store them at KEYIDS, which must
+   provide space for VANITY_SHA1_MAX_LANES values.  Returns the number
+   of keyids computed.  */
+unsigned int
+_vanity_refkey_keyids (vanity_refkey_t refkey, u32 timestamp, u32 *keyids)
+{
+  unsigned char fpr[VANITY_MAX_FPR_LEN];
+  u32 digests[VANITY_MAX_DIGEST_WORDS * VANITY_SHA1_MAX_LANES];
+  unsigned int i, n;
+
+  switch (_vanity_refkey_path (refkey, 0))
+    {
+    case VANITY_PATH_SHA256:
+      _vanity_sha256_digests (&refkey->sha256, timestamp, digests);
+      n = _vanity_sha256_lanes ();
+      for (i=0; i < n; i++)
+        keyids[i] = digests[1 * VANITY_SHA1_MAX_LANES + i];
+      return n;
+    case VANITY_PATH_MULTI:
+      _vanity_sha1_multi_digests (&refkey->sha1, timestamp, digests);
+      n = _vanity_sha1_multi_lanes ();
+      for (i=0; i < n; i++)
+        keyids[i] = digests[4 * VANITY_SHA1_MAX_LANES + i];
+      return n;
+    case VANITY_PATH_KEYID:
+      _vanity_sha1_keyids (&refkey->sha1, timestamp, keyids);
+      return _vanity_sha1_lanes ();
+    }
+
+  _vanity_refkey_fingerprint (refkey, timestamp, fpr);
+  keyids[0] = _vanity_fpr_keyid (fpr, refkey->version);
+  return 1;
+}
+
+
+/* Return the number of keyids _vanity_refkey_keyids computes for
+   REFKEY with one call.  */
+unsigned int
+_vanity_refkey_lanes (vanity_refkey_t refkey)
+{
+  switch (_vanity_refkey_path (refkey, 0))
+    {
+    case VANITY_PATH_MULTI:  return _vanity_sha1_multi_lanes ();
+    case VANITY_PATH_KEYID:  return _vanity_sha1_lanes ();
+    case VANITY_PATH_SHA256: return _vanity_sha256_lanes ();
+    default:                 return 1;
+    }
+}
+
+
+/* Compute the complete digests of REFKEY for consecutive creation
+   times starting at TIMESTAMP and store them at DIGESTS, which must
+   provide space for VANITY_MAX_DIGEST_WORDS * VANITY_SHA1_MAX_LANES
+   words.  Word W of the digest for lane I is stored at DIGESTS[W *
+   VANITY_SHA1_MAX_LANES + I]; a v5 digest has 8 words instead of 5.
+   Returns the number of digests computed.  */
+unsigned int
+_vanity_refkey_digests (vanity_refkey_t refkey, u32 timestamp, u32 *digests)
+{
+  unsigned char fpr[VANITY_MAX_FPR_LEN];
+  int i;
+
+  switch (_vanity_refkey_path (refkey, 1))
+    {
+    case VANITY_PATH_SHA256:
+      _vanity_sha256_digests (&refkey->sha256, timestamp, digests);
+      return _vanity_sha256_lanes ();
+    case VANITY_PATH_MULTI:
+      _vanity_sha1_multi_digests (&refkey->sha1, timestamp, digests);
+      return _vanity_sha1_multi_lanes ();
+    case VANITY_PATH_DIGEST:
+      _vanity_sha1_digests (&refkey->sha1, timestamp, digests);
+      return _vanity_sha1_digest_lanes ();
+    }
+
+  _vanity_refkey_fingerprint (refkey, timestamp, fpr);
+  for (i=0; i < _vanity_fpr_len (refkey->version) / 4; i++)
+    digests[i * VANITY_SHA1_MAX_LANES] = buf32_to_u32 (fpr + 4 * i);
+  return 1;
+}
+
+
+/* Return the number of digests _vanity_refkey_digests computes for
+   REFKEY with one call.  */
+unsigned int
+_vanity_refkey_digest_lanes (vanity_refkey_t refkey)
+{
+  switch (_vanity_refkey_path (refkey, 1))
+    {
+    case VANITY_PATH_MULTI:  return _vanity_sha1_multi_lanes ();
+    case VANITY_PATH_DIGEST: return _vanity_sha1_digest_lanes ();
+    case VANITY_PATH_SHA256: return _vanity_sha256_lanes ();
+    default:                 return 1;
+    }
+}
+
+
+/* Store the SHA-1 block of REFKEY with the timestamp word set to
+   zero at BLOCK, which must provide space for 16 words.  Returns
+   false if the key packet does not fit into a single block or is
+   not hashed with SHA-1.  */
+int
+_vanity_refkey_block (vanity_refkey_t refkey, u32 *block)
+{
+  if (!refkey->use_kernel || refkey->multi_block || refkey->version == 5)
+    return 0;
+  memcpy (block, refkey->sha1.block, sizeof refkey->sha1.block);
+  return 1;
+}
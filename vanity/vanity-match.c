@@ -0,0 +1,1516 @@
+/* vanity-match.c - Keyid patterns for the vanity key search
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A pattern is a list of items separated by commas or white space.
+   A keyid matches the pattern if it matches any of the items.  An
+   item is either
+
+     NIBBLES     - Up to 8 hex digits or the wildcards '?' and '.'
+                   which are matched against the end of the keyid.
+                   "F00DF00D" is an exact keyid and "?00D" matches all
+                   keyids whose last three hex digits are "00D".
+                   Exactly 16 digits are matched against the 64 bit
+                   keyid.
+
+     VALUE/MASK  - A keyid matches if the bits set in MASK are equal
+                   to VALUE.  Both are given as up to 8 hex digits, or
+                   as exactly 16 hex digits for the 64 bit keyid.
+
+   The following items are matched against the complete fingerprint:
+
+     prefix:NIBBLES  - Up to 40 hex digits or wildcards matched against
+                       the start of the fingerprint.
+
+     suffix:NIBBLES  - Up to 40 hex digits or wildcards matched against
+                       the end of the fingerprint.  With up to 16
+                       digits this is the same as a plain NIBBLES item
+                       for a v4 key.
+
+     word:NIBBLES    - Up to 8 hex digits or wildcards found anywhere
+                       in the fingerprint.
+
+     repeat:N        - N equal hex digits in a row anywhere in the
+                       fingerprint, with N from 2 to 40.
+
+     re:REGEX        - A regular expression over the hex digits of
+                       the fingerprint as described in vanity-regex.c;
+                       "re:^0{6}" are six leading zeros and
+                       "re:(CAFE|BEEF).{0,12}$" either word within the
+                       last 16 digits.  Commas within braces are part
+                       of the item.
+
+   Instead of matching, a pattern may rate each fingerprint; the
+   search then keeps the best ones it finds within its budget.  Such
+   a pattern has only the following items and the score of a
+   fingerprint is the highest score of any item:
+
+     score:zeros         - The number of zero hex digits at the start
+                           of the fingerprint.
+
+     score:run           - The length of the longest run of equal hex
+                           digits.
+
+     score:word:NIBBLES  - The number of hex digits of NIBBLES, up to
+                           8 and without wildcards, if they appear
+                           anywhere in the fingerprint, or else 0.
+                           Several of these items make a dictionary.
+
+   An optional "0x" prefix is allowed for all hex numbers.
+
+   A pattern compiled for v5 keys with vanity_pattern_new_version
+   works on their SHA-256 fingerprints of 64 hex digits, which is
+   then also the limit for the prefix, suffix and repeat items.  The
+   keyid of a v5 key is the start of the fingerprint instead of its
+   end; thus the keyid items are matched against the first two
+   digest words and a suffix never turns into a keyid item.
+
+   The SHA-1 kernels compute only the low 32 bits of the keyid, thus
+   matching is done in two steps: vanity_pattern_match checks the low
+   32 bits for the inner loop of the search and vanity_pattern_check
+   confirms a candidate with the complete fingerprint.  Both return
+   the number of the matching item so that a hit can be routed to
+   whoever asked for that item.  Patterns with fingerprint items
+   need the complete digest of every candidate; for them the search
+   uses the digest kernels and _vanity_pattern_check_words instead.
+   They are evaluated on the digest words with precomputed values and
+   masks, never on a hex string.
+   For devices _vanity_pattern_filter exports the keyid items as
+   sorted values per mask, checked there by binary search.
+   The search itself scans each kernel batch with the matcher set up
+   by _vanity_matcher_init.  For the common shapes - up to four 16,
+   24 or 32 bit keyids, a 64 bit keyid or a prefix of up to 16 hex
+   digits - the scan is a variant instantiated from a macro with the
+   mask or shift as a constant; other patterns use vanity_pattern_match
+   for each keyid or check every digest.
+   The scores are computed by _vanity_pattern_score_words for every
+   digest; they use only a fixed number of steps and no data
+   dependent branches, except for the few rounds needed to find the
+   longest run.  Most candidates are rejected before that: items
+   which can't reach the score the search needs are skipped and the
+   leading zeros are first checked with a single comparison.
+
+   The pattern is compiled depending on its size.  A few items are
+   compared one after the other without branches.  Larger lists are
+   grouped by mask; each group is a sorted table of values and a
+   bitmap indexed by a hash of the masked keyid is put in front of
+   all tables.  The bitmap has at least 16 bits per item, so that for
+   keyids not in the list only a few percent of the lookups get past
+   it.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+#include "../common/host2net.h"
+
+
+/* The maximum number of items in a pattern.  */
+#define MAX_PATTERN_ITEMS (1 << 24)
+
+/* Patterns with up to this many items are matched linearly.  */
+#define MAX_LINEAR_ITEMS 4
+
+/* The limits for the size of the prefilter bitmap in bits.  */
+#define MIN_BITMAP_BITS 10
+#define MAX_BITMAP_BITS 27
+
+/* The maximum length of the nibbles of a word item.  */
+#define MAX_WORD_NIBBLES 8
+
+
+/* One item of a pattern.  VALUE and MASK apply to the low 32 bits
+   of the keyid, HVALUE and HMASK to the high 32 bits.  */
+struct pattern_item_s
+{
+  u32 value;
+  u32 mask;
+  u32 hvalue;
+  u32 hmask;
+};
+
+/* The types of the fingerprint items.  */
+enum fpr_item_type
+  {
+    FPR_FIXED,    /* VALUE and MASK apply to the whole digest.  */
+    FPR_WORD,     /* VALUE[0] and MASK[0] apply anywhere.  */
+    FPR_REPEAT,   /* RUNLEN equal nibbles in a row.  */
+    FPR_REGEX,    /* REGEX matches; VALUE and MASK are its prefilter.  */
+    FPR_SCORE_ZEROS,  /* Score the leading zero nibbles.  */
+    FPR_SCORE_RUN,    /* Score the longest run of equal nibbles.  */
+    FPR_SCORE_WORD    /* Score RUNLEN if VALUE[0] appears anywhere.  */
+  };
+
+/* An item matched against the complete fingerprint.  Its entry in
+   the ITEMS array of the pattern is a placeholder which never
+   matches a keyid.  */
+struct fpr_item_s
+{
+  unsigned int item;    /* The index of the item.  */
+  enum fpr_item_type type;
+  unsigned int npos;    /* FPR_WORD: The number of positions.  */
+  unsigned int runlen;  /* FPR_REPEAT: The length of the run.
+                           FPR_SCORE_WORD: The nibbles of the word.  */
+  u32 value[VANITY_MAX_DIGEST_WORDS];  /* The digest words in big
+                                         endian order.  */
+  u32 mask[VANITY_MAX_DIGEST_WORDS];
+  vanity_regex_t regex; /* FPR_REGEX: The compiled expression.  */
+};
+
+/* An entry of the sorted table of a mask group.  */
+struct group_entry_s
+{
+  u32 value;            /* The low value of the item.  */
+  unsigned int item;    /* The index of the item.  */
+};
+
+/* All items with the same low mask.  */
+struct mask_group_s
+{
+  u32 mask;
+  unsigned int nentries;
+  struct group_entry_s *entries;  /* Sorted by value and item.  */
+};
+
+struct vanity_pattern_s
+{
+  int version;                    /* The key version matched.  */
+  unsigned int nwords;            /* The words of its digests.  */
+  unsigned int keyid_word;        /* The word with the low keyid.  */
+  unsigned int nitems;
+  struct pattern_item_s *items;
+  unsigned int nlow;              /* The number of keyid items.  */
+  unsigned int nfpr;              /* The number of fingerprint items.  */
+  unsigned int nscore;            /* The number of score items.  */
+  struct fpr_item_s *fpr_items;   /* Sorted by item.  */
+  unsigned int ngroups;           /* 0 for a linear pattern.  */
+  struct mask_group_s *groups;
+  unsigned int bitmap_shift;      /* 32 minus the bits of the bitmap.  */
+  u32 *bitmap;
+  struct group_entry_s *entries;  /* Storage for all groups.  */
+};
+
+
+static int
+is_item_delim (int c)
+{
+  return c == ',' || c == ' ' || c == '\t';
+}
+
+
+/* Return the length of the item at S.  The commas within the braces
+   of a regex item belong to it.  */
+static size_t
+item_length (const char *s)
+{
+  int regex = !ascii_strncasecmp (s, "re:", 3);
+  int braces = 0;
+  size_t n;
+
+  for (n=0; s[n]; n++)
+    {
+      if (regex && s[n] == '{')
+        braces = 1;
+      else if (regex && s[n] == '}')
+        braces = 0;
+      else if (is_item_delim (s[n]) && !(braces && s[n] == ','))
+        break;
+    }
+  return n;
+}
+
+
+/* Skip an optional "0x" prefix.  */
+static const char *
+skip_0x (const char *s, size_t *len)
+{
+  if (*len > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    {
+      *len -= 2;
+      return s + 2;
+    }
+  return s;
+}
+
+
+/* Shift the nibble N into the 64 bit number HI:LO.  */
+static void
+shift_nibble (u32 *hi, u32 *lo, unsigned int n)
+{
+  *hi = (*hi << 4) | (*lo >> 28);
+  *lo = (*lo << 4) | n;
+}
+
+
+/* Parse the hex number with up to 8 or exactly 16 digits at S with
+   length LEN.  */
+static gpg_error_t
+parse_hex64 (const char *s, size_t len, u32 *r_hi, u32 *r_lo)
+{
+  u32 hi = 0, lo = 0;
+
+  s = skip_0x (s, &len);
+  if (!len || (len > 8 && len != 16))
+    return gpg_error (GPG_ERR_INV_VALUE);
+  for (; len; s++, len--)
+    {
+      if (!hexdigitp (s))
+        return gpg_error (GPG_ERR_INV_VALUE);
+      shift_nibble (&hi, &lo, xtoi_1 (s));
+    }
+  *r_hi = hi;
+  *r_lo = lo;
+  return 0;
+}
+
+
+/* Return the number of bits set in X.  */
+static unsigned int
+count_bits (u32 x)
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+
+/* Return true if FITEM rates a fingerprint instead of matching it.  */
+static int
+is_score_item (const struct fpr_item_s *fitem)
+{
+  return (fitem->type == FPR_SCORE_ZEROS || fitem->type == FPR_SCORE_RUN
+          || fitem->type == FPR_SCORE_WORD);
+}
+
+
+/* Return true if ITEM is the placeholder of a fingerprint item.  */
+static int
+is_fpr_placeholder (const struct pattern_item_s *item)
+{
+  return !!(item->value & ~item->mask);
+}
+
+
+/* Parse the up to MAXLEN nibbles or wildcards at S with length LEN
+   into the digest words VALUE and MASK of a digest with NWORDS words.
+   The nibbles are placed at the start of the digest if AT_END is
+   false or else at its end.  The number of nibbles is stored at
+   R_NIBBLES.  */
+static gpg_error_t
+parse_fpr_nibbles (const char *s, size_t len, size_t maxlen, int at_end,
+                   unsigned int nwords, u32 *value, u32 *mask,
+                   unsigned int *r_nibbles)
+{
+  unsigned int pos, shift;
+
+  s = skip_0x (s, &len);
+  if (!len || len > maxlen)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  *r_nibbles = len;
+  memset (value, 0, VANITY_MAX_DIGEST_WORDS * sizeof *value);
+  memset (mask, 0, VANITY_MAX_DIGEST_WORDS * sizeof *mask);
+  for (pos = at_end? 8 * nwords - len : 0; len; s++, len--, pos++)
+    {
+      if (*s == '?' || *s == '.')
+        continue;
+      if (!hexdigitp (s))
+        return gpg_error (GPG_ERR_INV_VALUE);
+      shift = 28 - 4 * (pos % 8);
+      value[pos / 8] |= (u32)xtoi_1 (s) << shift;
+      mask[pos / 8]  |= (u32)0x0f << shift;
+    }
+  return 0;
+}
+
+
+/* If the item at S with length LEN starts with a keyword parse it
+   and return true.  A fingerprint item for a digest of NWORDS words
+   is stored at FITEM and its placeholder at ITEM; a short suffix of
+   a v4 fingerprint is instead stored as a keyid item at ITEM.
+   Returns false with R_ERR cleared for all other items.  */
+static int
+parse_fpr_item (const char *s, size_t len, unsigned int nwords,
+                struct pattern_item_s *item, struct fpr_item_s *fitem,
+                gpg_error_t *r_err)
+{
+  unsigned long n;
+  char *endp;
+  unsigned int nibbles;
+  unsigned int fpr_nibbles = 8 * nwords;
+
+  *r_err = 0;
+  memset (fitem, 0, sizeof *fitem);
+  if (len > 7 && !ascii_strncasecmp (s, "prefix:", 7))
+    {
+      fitem->type = FPR_FIXED;
+      *r_err = parse_fpr_nibbles (s + 7, len - 7, fpr_nibbles, 0, nwords,
+                                  fitem->value, fitem->mask, &nibbles);
+    }
+  else if (len > 7 && !ascii_strncasecmp (s, "suffix:", 7))
+    {
+      fitem->type = FPR_FIXED;
+      *r_err = parse_fpr_nibbles (s + 7, len - 7, fpr_nibbles, 1, nwords,
+                                  fitem->value, fitem->mask, &nibbles);
+      if (!*r_err && nwords == 5
+          && !fitem->mask[0] && !fitem->mask[1] && !fitem->mask[2])
+        {
+          /* Only the keyid is affected.  */
+          item->value = fitem->value[4];
+          item->mask = fitem->mask[4];
+          item->hvalue = fitem->value[3];
+          item->hmask = fitem->mask[3];
+          return 1;
+        }
+    }
+  else if (len > 5 && !ascii_strncasecmp (s, "word:", 5))
+    {
+      fitem->type = FPR_WORD;
+      *r_err = parse_fpr_nibbles (s + 5, len - 5, MAX_WORD_NIBBLES, 0,
+                                  nwords, fitem->value, fitem->mask,
+                                  &nibbles);
+      if (!*r_err)
+        fitem->npos = fpr_nibbles - nibbles + 1;
+    }
+  else if (len == 11 && !ascii_strncasecmp (s, "score:zeros", 11))
+    fitem->type = FPR_SCORE_ZEROS;
+  else if (len == 9 && !ascii_strncasecmp (s, "score:run", 9))
+    fitem->type = FPR_SCORE_RUN;
+  else if (len > 11 && !ascii_strncasecmp (s, "score:word:", 11))
+    {
+      fitem->type = FPR_SCORE_WORD;
+      *r_err = parse_fpr_nibbles (s + 11, len - 11, MAX_WORD_NIBBLES, 0,
+                                  nwords, fitem->value, fitem->mask,
+                                  &nibbles);
+      if (!*r_err && count_bits (fitem->mask[0]) != 4 * nibbles)
+        *r_err = gpg_error (GPG_ERR_INV_VALUE);
+      fitem->npos = fpr_nibbles - nibbles + 1;
+      fitem->runlen = nibbles;
+    }
+  else if (len > 7 && !ascii_strncasecmp (s, "repeat:", 7))
+    {
+      fitem->type = FPR_REPEAT;
+      if (!digitp (s + 7))
+        *r_err = gpg_error (GPG_ERR_INV_VALUE);
+      else
+        {
+          n = strtoul (s + 7, &endp, 10);
+          if (endp != s + len || n < 2 || n > fpr_nibbles)
+            *r_err = gpg_error (GPG_ERR_INV_VALUE);
+          fitem->runlen = n;
+        }
+    }
+  else if (len > 3 && !ascii_strncasecmp (s, "re:", 3))
+    {
+      fitem->type = FPR_REGEX;
+      *r_err = _vanity_regex_new (&fitem->regex, s + 3, len - 3,
+                                  fpr_nibbles);
+      if (!*r_err)
+        _vanity_regex_prefilter (fitem->regex, fitem->value, fitem->mask);
+    }
+  else
+    return 0;
+
+  /* The placeholder never matches a keyid.  */
+  item->value = 1;
+  item->mask = 0;
+  item->hvalue = 0;
+  item->hmask = 0;
+  return 1;
+}
+
+
+/* Parse the item at S with length LEN into ITEM.  */
+static gpg_error_t
+parse_item (const char *s, size_t len, struct pattern_item_s *item)
+{
+  gpg_error_t err;
+  const char *slash;
+  u32 hvalue, value, hmask, mask;
+
+  slash = memchr (s, '/', len);
+  if (slash)
+    {
+      err = parse_hex64 (s, slash - s, &hvalue, &value);
+      if (!err)
+        err = parse_hex64 (slash + 1, len - (slash - s) - 1, &hmask, &mask);
+      if (err)
+        return err;
+      /* A value with bits outside of the mask can't ever match.  */
+      if ((value & ~mask) || (hvalue & ~hmask))
+        return gpg_error (GPG_ERR_INV_VALUE);
+    }
+  else
+    {
+      s = skip_0x (s, &len);
+      if (!len || (len > 8 && len != 16))
+        return gpg_error (GPG_ERR_INV_VALUE);
+      hvalue = value = hmask = mask = 0;
+      for (; len; s++, len--)
+        {
+          if (*s == '?' || *s == '.')
+            {
+              shift_nibble (&hvalue, &value, 0);
+              shift_nibble (&hmask, &mask, 0);
+              continue;
+            }
+          if (!hexdigitp (s))
+            return gpg_error (GPG_ERR_INV_VALUE);
+          shift_nibble (&hvalue, &value, xtoi_1 (s));
+          shift_nibble (&hmask, &mask, 0x0f);
+        }
+    }
+
+  item->value = value;
+  item->mask = mask;
+  item->hvalue = hvalue;
+  item->hmask = hmask;
+  return 0;
+}
+
+
+/* Return the bit of the prefilter bitmap for the masked keyid V.  */
+static inline u32
+bitmap_index (vanity_pattern_t pattern, u32 v)
+{
+  return (v * 0x9e3779b1) >> pattern->bitmap_shift;
+}
+
+
+static int
+compare_masks (const void *a, const void *b)
+{
+  const struct pattern_item_s *ia = *(const struct pattern_item_s **)a;
+  const struct pattern_item_s *ib = *(const struct pattern_item_s **)b;
+
+  if (ia->mask != ib->mask)
+    return ia->mask < ib->mask? -1 : 1;
+  if (ia->value != ib->value)
+    return ia->value < ib->value? -1 : 1;
+  return ia < ib? -1 : ia > ib;
+}
+
+
+/* Build the mask groups and the prefilter bitmap for PATTERN.  */
+static gpg_error_t
+compile_groups (vanity_pattern_t pattern)
+{
+  const struct pattern_item_s **sorted;
+  struct mask_group_s *group;
+  unsigned int i, n, bits;
+  u32 idx;
+
+  sorted = xtrymalloc (pattern->nlow * sizeof *sorted);
+  if (!sorted)
+    return gpg_error_from_syserror ();
+  for (n=i=0; i < pattern->nitems; i++)
+    if (!is_fpr_placeholder (pattern->items + i))
+      sorted[n++] = pattern->items + i;
+  qsort (sorted, pattern->nlow, sizeof *sorted, compare_masks);
+
+  for (n=1, i=1; i < pattern->nlow; i++)
+    if (sorted[i]->mask != sorted[i-1]->mask)
+      n++;
+
+  for (bits = MIN_BITMAP_BITS;
+       bits < MAX_BITMAP_BITS && (1u << bits) < 16 * pattern->nlow; bits++)
+    ;
+  pattern->bitmap_shift = 32 - bits;
+
+  pattern->groups = xtrycalloc (n, sizeof *pattern->groups);
+  pattern->entries = xtrymalloc (pattern->nlow * sizeof *pattern->entries);
+  pattern->bitmap = xtrycalloc ((1u << bits) / 32, sizeof (u32));
+  if (!pattern->groups || !pattern->entries || !pattern->bitmap)
+    {
+      xfree (sorted);
+      return gpg_error_from_syserror ();
+    }
+
+  group = NULL;
+  for (i=0; i < pattern->nlow; i++)
+    {
+      if (!group || sorted[i]->mask != group->mask)
+        {
+          group = group? group + 1 : pattern->groups;
+          group->mask = sorted[i]->mask;
+          group->entries = pattern->entries + i;
+        }
+      group->entries[group->nentries].value = sorted[i]->value;
+      group->entries[group->nentries].item = sorted[i] - pattern->items;
+      group->nentries++;
+      idx = bitmap_index (pattern, sorted[i]->value);
+      pattern->bitmap[idx / 32] |= (u32)1 << (idx % 32);
+    }
+  pattern->ngroups = n;
+
+  xfree (sorted);
+  return 0;
+}
+
+
+/* Compile the pattern STRING for the fingerprints of v4 keys and
+   store a new pattern object at R_PATTERN.  Returns GPG_ERR_INV_VALUE
+   for a malformed pattern.  */
+gpg_error_t
+vanity_pattern_new (vanity_pattern_t *r_pattern, const char *string)
+{
+  return vanity_pattern_new_version (r_pattern, string, 4);
+}
+
+
+/* Compile the pattern STRING for the fingerprints of keys of VERSION,
+   which is 4 or 5, and store a new pattern object at R_PATTERN.  */
+gpg_error_t
+vanity_pattern_new_version (vanity_pattern_t *r_pattern, const char *string,
+                            int version)
+{
+  gpg_error_t err;
+  vanity_pattern_t pattern;
+  struct pattern_item_s *items = NULL;
+  struct pattern_item_s *tmp;
+  struct fpr_item_s *fpr_items = NULL;
+  struct fpr_item_s *ftmp;
+  struct fpr_item_s fitem;
+  unsigned int nitems = 0;
+  unsigned int size = 0;
+  unsigned int nfpr = 0;
+  unsigned int fsize = 0;
+  unsigned int nscore = 0;
+  unsigned int nwords;
+  const char *s;
+  size_t n;
+
+  *r_pattern = NULL;
+
+  if (version == 4)
+    nwords = VANITY_FPR_LEN / 4;
+  else if (version == 5)
+    nwords = VANITY_V5_FPR_LEN / 4;
+  else
+    return gpg_error (GPG_ERR_UNKNOWN_VERSION);
+
+  for (s = string; *s; s += n)
+    {
+      while (*s && is_item_delim (*s))
+        s++;
+      if (!*s)
+        break;
+      n = item_length (s);
+      if (nitems == size)
+        {
+          if (size == MAX_PATTERN_ITEMS)
+            {
+              err = gpg_error (GPG_ERR_TOO_LARGE);
+              goto leave;
+            }
+          size = size? 2 * size : 16;
+          tmp = xtryrealloc (items, size * sizeof *items);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          items = tmp;
+        }
+      if (!parse_fpr_item (s, n, nwords, items + nitems, &fitem, &err))
+        err = parse_item (s, n, items + nitems);
+      else if (!err && is_fpr_placeholder (items + nitems))
+        {
+          if (nfpr == fsize)
+            {
+              fsize = fsize? 2 * fsize : 4;
+              ftmp = xtryrealloc (fpr_items, fsize * sizeof *fpr_items);
+              if (!ftmp)
+                {
+                  err = gpg_error_from_syserror ();
+                  _vanity_regex_release (fitem.regex);
+                  goto leave;
+                }
+              fpr_items = ftmp;
+            }
+          fitem.item = nitems;
+          fpr_items[nfpr++] = fitem;
+          if (is_score_item (&fitem))
+            nscore++;
+        }
+      if (err)
+        goto leave;
+      nitems++;
+    }
+  /* A pattern either matches or scores.  */
+  if (!nitems || (nscore && nscore != nitems))
+    {
+      err = gpg_error (GPG_ERR_INV_VALUE);
+      goto leave;
+    }
+
+  pattern = xtrycalloc (1, sizeof *pattern);
+  if (!pattern)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  pattern->version = version;
+  pattern->nwords = nwords;
+  pattern->keyid_word = version == 5? 1 : nwords - 1;
+  pattern->nitems = nitems;
+  pattern->items = items;
+  pattern->nlow = nitems - nfpr;
+  pattern->nfpr = nfpr;
+  pattern->fpr_items = fpr_items;
+  pattern->nscore = nscore;
+
+  if (nitems > MAX_LINEAR_ITEMS && pattern->nlow)
+    {
+      err = compile_groups (pattern);
+      if (err)
+        {
+          vanity_pattern_release (pattern);
+          return err;
+        }
+    }
+
+  *r_pattern = pattern;
+  return 0;
+
+ leave:
+  while (nfpr)
+    _vanity_regex_release (fpr_items[--nfpr].regex);
+  xfree (items);
+  xfree (fpr_items);
+  return err;
+}
+
+
+void
+vanity_pattern_release (vanity_pattern_t pattern)
+{
+  unsigned int n;
+
+  if (!pattern)
+    return;
+  for (n=0; n < pattern->nfpr; n++)
+    _vanity_regex_release (pattern->fpr_items[n].regex);
+  xfree (pattern->items);
+  xfree (pattern->fpr_items);
+  xfree (pattern->groups);
+  xfree (pattern->entries);
+  xfree (pattern->bitmap);
+  xfree (pattern);
+}
+
+
+/* Return the bytes of memory PATTERN takes.  */
+size_t
+_vanity_pattern_memory (vanity_pattern_t pattern)
+{
+  size_t n;
+  unsigned int i;
+
+  n = sizeof *pattern;
+  n += pattern->nitems * sizeof *pattern->items;
+  n += pattern->nfpr * sizeof *pattern->fpr_items;
+  for (i=0; i < pattern->nfpr; i++)
+    if (pattern->fpr_items[i].regex)
+      n += _vanity_regex_memory (pattern->fpr_items[i].regex);
+  if (pattern->ngroups)
+    {
+      n += pattern->ngroups * sizeof *pattern->groups;
+      n += pattern->nlow * sizeof *pattern->entries;
+      n += ((size_t)1 << (32 - pattern->bitmap_shift)) / 8;
+    }
+  return n;
+}
+
+
+/* Return the key version PATTERN has been compiled for.  */
+int
+vanity_pattern_version (vanity_pattern_t pattern)
+{
+  return pattern->version;
+}
+
+
+/* Return the number of items in PATTERN.  */
+unsigned int
+vanity_pattern_count (vanity_pattern_t pattern)
+{
+  return pattern->nitems;
+}
+
+
+/* Return 2 to the power of minus N.  */
+static double
+neg_pow2 (unsigned int n)
+{
+  double p = 1.0;
+
+  for (; n >= 16; n -= 16)
+    p /= 65536.0;
+  return p / (1 << n);
+}
+
+
+/* Return the probability that a random fingerprint matches PATTERN.
+   The chances of the items are summed up; this is exact for keyid
+   items, which can't overlap unless they are redundant, and an upper
+   bound for the others.  Score items never match and count as 0.  */
+double
+vanity_pattern_probability (vanity_pattern_t pattern)
+{
+  const struct pattern_item_s *item;
+  const struct fpr_item_s *fitem;
+  unsigned int n, k, bits;
+  double p = 0.0;
+
+  for (n=0, item = pattern->items; n < pattern->nitems; n++, item++)
+    if (!is_fpr_placeholder (item))
+      p += neg_pow2 (count_bits (item->mask) + count_bits (item->hmask));
+  for (n=0, fitem = pattern->fpr_items; n < pattern->nfpr; n++, fitem++)
+    switch (fitem->type)
+      {
+      case FPR_FIXED:
+        for (bits=0, k=0; k < pattern->nwords; k++)
+          bits += count_bits (fitem->mask[k]);
+        p += neg_pow2 (bits);
+        break;
+      case FPR_WORD:
+        p += fitem->npos * neg_pow2 (count_bits (fitem->mask[0]));
+        break;
+      case FPR_REPEAT:
+        p += (8 * pattern->nwords - fitem->runlen + 1)
+             * neg_pow2 (4 * (fitem->runlen - 1));
+        break;
+      case FPR_REGEX:
+        p += _vanity_regex_probability (fitem->regex);
+        break;
+      default:
+        break;
+      }
+  return p < 1.0? p : 1.0;
+}
+
+
+/* Return the first item of GROUP, in the order of the items, whose
+   low part matches KEYID and which also matches the high part HKEYID
+   if USE_HIGH is set.  Returns the item number plus one or 0.  */
+static int
+lookup_group (vanity_pattern_t pattern, const struct mask_group_s *group,
+              u32 keyid, u32 hkeyid, int use_high)
+{
+  const struct group_entry_s *entries = group->entries;
+  const struct pattern_item_s *item;
+  u32 v = keyid & group->mask;
+  unsigned int lo, hi, mid;
+
+  lo = 0;
+  hi = group->nentries;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (entries[mid].value < v)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  for (; lo < group->nentries && entries[lo].value == v; lo++)
+    {
+      item = pattern->items + entries[lo].item;
+      if (!use_high || (hkeyid & item->hmask) == item->hvalue)
+        return entries[lo].item + 1;
+    }
+  return 0;
+}
+
+
+/* Return the lowest numbered item of PATTERN matching the low 32 bit
+   KEYID and, if USE_HIGH is set, the high 32 bit HKEYID.  Returns the
+   item number plus one or 0 if no item matches.  */
+static int
+lookup (vanity_pattern_t pattern, u32 keyid, u32 hkeyid, int use_high)
+{
+  const struct pattern_item_s *item;
+  const struct mask_group_s *group;
+  unsigned int n;
+  int found, best;
+  u32 idx;
+
+  if (!pattern->nlow)
+    return 0;
+  if (!pattern->ngroups)
+    {
+      for (n=0, item = pattern->items; n < pattern->nitems; n++, item++)
+        if ((keyid & item->mask) == item->value
+            && (!use_high || (hkeyid & item->hmask) == item->hvalue))
+          return n + 1;
+      return 0;
+    }
+
+  best = 0;
+  for (n=0, group = pattern->groups; n < pattern->ngroups; n++, group++)
+    {
+      idx = bitmap_index (pattern, keyid & group->mask);
+      if (!(pattern->bitmap[idx / 32] & ((u32)1 << (idx % 32))))
+        continue;
+      found = lookup_group (pattern, group, keyid, hkeyid, use_high);
+      if (found && (!best || found < best))
+        best = found;
+    }
+  return best;
+}
+
+
+/* Return true if the low 32 bit KEYID matches PATTERN.  The value
+   returned is the number of the first matching item plus one.  A
+   match needs to be confirmed by vanity_pattern_check if the pattern
+   has 64 bit items.  Fingerprint items are not considered.  */
+int
+vanity_pattern_match (vanity_pattern_t pattern, u32 keyid)
+{
+  const struct pattern_item_s *item = pattern->items;
+  unsigned int n, hit;
+
+  if (pattern->ngroups || !pattern->nlow)
+    return lookup (pattern, keyid, 0, 0);
+
+  /* Check all items without branching; the common case is that none
+     matches.  */
+  hit = 0;
+  for (n = pattern->nitems; n; n--, item++)
+    hit |= ((keyid & item->mask) == item->value);
+  return hit? lookup (pattern, keyid, 0, 0) : 0;
+}
+
+
+/* Return a flag for each nibble of the digest H with NWORDS words,
+   starting with the most significant bit for the first nibble, which
+   is set if the nibble is equal to the next one.  The 64 nibbles of
+   a v5 fingerprint just fit.  */
+static unsigned long long
+repeat_flags (const u32 *h, unsigned int nwords)
+{
+  unsigned long long flags = 0;
+  unsigned int w;
+  u32 x, d, m;
+
+  for (w=0; w < nwords; w++)
+    {
+      x = h[w];
+      d = x ^ ((x << 4) | (w < nwords - 1? h[w+1] >> 28 : (~x & 0x0f)));
+      m = ~(((d & 0x77777777) + 0x77777777) | d) & 0x88888888;
+      m >>= 3;
+      m = (m | (m >> 3)) & 0x03030303;
+      m = (m | (m >> 6)) & 0x000f000f;
+      m = (m | (m >> 12)) & 0xff;
+      flags = (flags << 8) | m;
+    }
+  return flags;
+}
+
+
+/* Return true if the digest H with NWORDS words has RUNLEN equal
+   nibbles in a row.  */
+static int
+has_repeat (const u32 *h, unsigned int nwords, unsigned int runlen)
+{
+  unsigned long long flags = repeat_flags (h, nwords);
+  unsigned int have, step;
+
+  /* Look for RUNLEN - 1 flags in a row.  */
+  for (have = 1; have < runlen - 1 && flags; have += step)
+    {
+      step = have < runlen - 1 - have? have : runlen - 1 - have;
+      flags &= flags >> step;
+    }
+  return !!flags;
+}
+
+
+/* Return true if the nibbles of the word item FITEM appear anywhere
+   in the digest H with NWORDS words.  */
+static int
+has_word (const struct fpr_item_s *fitem, const u32 *h, unsigned int nwords)
+{
+  u32 value = fitem->value[0];
+  u32 mask = fitem->mask[0];
+  unsigned int pos, shift;
+  u32 win;
+
+  for (pos=0; pos < fitem->npos; pos++)
+    {
+      shift = 4 * (pos % 8);
+      win = h[pos / 8] << shift;
+      if (shift && pos / 8 < nwords - 1)
+        win |= h[pos / 8 + 1] >> (32 - shift);
+      if ((win & mask) == value)
+        return 1;
+    }
+  return 0;
+}
+
+
+/* Return true if the fingerprint item FITEM matches the digest H
+   with NWORDS words.  */
+static int
+match_fpr_item (const struct fpr_item_s *fitem, const u32 *h,
+                unsigned int nwords)
+{
+  unsigned int w;
+  u32 diff;
+
+  switch (fitem->type)
+    {
+    case FPR_FIXED:
+      for (diff=0, w=0; w < nwords; w++)
+        diff |= (h[w] & fitem->mask[w]) ^ fitem->value[w];
+      return !diff;
+    case FPR_WORD:
+      return has_word (fitem, h, nwords);
+    case FPR_REPEAT:
+      return has_repeat (h, nwords, fitem->runlen);
+    case FPR_REGEX:
+      for (diff=0, w=0; w < nwords; w++)
+        diff |= (h[w] & fitem->mask[w]) ^ fitem->value[w];
+      return !diff && _vanity_regex_match (fitem->regex, h);
+    default:
+      break;
+    }
+  return 0;
+}
+
+
+/* Return the number of zero nibbles at the start of the digest H
+   with NWORDS words.  */
+static unsigned int
+score_zeros (const u32 *h, unsigned int nwords)
+{
+  unsigned int w, n, total = 0;
+  u32 all = 1;    /* Set while all words so far were zero.  */
+  u32 x;
+
+  for (w=0; w < nwords; w++)
+    {
+      /* Smear the highest bit set to the right; the bits left of it
+         are the leading zeros.  */
+      x = h[w];
+      x |= x >> 1;
+      x |= x >> 2;
+      x |= x >> 4;
+      x |= x >> 8;
+      x |= x >> 16;
+      n = (32 - count_bits (x)) / 4;
+      total += n & -all;
+      all &= (n == 8);
+    }
+  return total;
+}
+
+
+/* Return the length of the longest run of equal nibbles in the
+   digest H with NWORDS words.  Each round shortens all runs of flags
+   by one.  */
+static unsigned int
+score_run (const u32 *h, unsigned int nwords)
+{
+  unsigned long long flags = repeat_flags (h, nwords);
+  unsigned int run = 1;
+
+  for (; flags; run++)
+    flags &= flags >> 1;
+  return run;
+}
+
+
+/* Return the length of the word of the score item FITEM if it
+   appears anywhere in the digest H with NWORDS words or else 0.
+   Unlike has_word this always tries all positions.  */
+static unsigned int
+score_word (const struct fpr_item_s *fitem, const u32 *h,
+            unsigned int nwords)
+{
+  u32 value = fitem->value[0];
+  u32 mask = fitem->mask[0];
+  unsigned int w, shift, npos = fitem->npos;
+  unsigned long long pair;
+  u32 found = 0;
+
+  /* The windows starting in word W are taken from it and the next
+     word; there is no need to rebuild them for every position.  */
+  for (w=0; w < nwords; w++)
+    {
+      pair = ((unsigned long long)h[w] << 32) | (w < nwords - 1? h[w+1] : 0);
+      for (shift=0; shift < 8; shift++)
+        found |= (((u32)(pair >> (32 - 4 * shift)) & mask) == value)
+                 & (8 * w + shift < npos);
+    }
+  return fitem->runlen & -found;
+}
+
+
+/* Return true if PATTERN has items which need the complete
+   fingerprint of each candidate.  */
+int
+_vanity_pattern_need_digest (vanity_pattern_t pattern)
+{
+  return !!pattern->nfpr;
+}
+
+
+/* Return true if the fingerprint given as its big endian digest
+   words H, five for a v4 and eight for a v5 key, matches PATTERN.
+   The value returned is the number of the first matching item plus
+   one.  */
+int
+_vanity_pattern_check_words (vanity_pattern_t pattern, const u32 *h)
+{
+  const struct fpr_item_s *fitem;
+  unsigned int n;
+  int best;
+
+  best = lookup (pattern, h[pattern->keyid_word],
+                 h[pattern->keyid_word - 1], 1);
+  for (n=0, fitem = pattern->fpr_items; n < pattern->nfpr; n++, fitem++)
+    {
+      if (best && fitem->item + 1 > best)
+        break;
+      if (match_fpr_item (fitem, h, pattern->nwords))
+        return fitem->item + 1;
+    }
+  return best;
+}
+
+
+/* Return the score of the digest given as its big endian words H,
+   as for _vanity_pattern_check_words, for the scoring pattern
+   PATTERN.  The index of the first item with that score is stored at
+   R_ITEM.  A score below MIN_SCORE is
+   not computed exactly; any lower value may be returned for it.  */
+unsigned int
+_vanity_pattern_score_words (vanity_pattern_t pattern, const u32 *h,
+                             unsigned int min_score, unsigned int *r_item)
+{
+  const struct fpr_item_s *fitem;
+  unsigned int n, need, score, best = 0;
+  unsigned int item = pattern->fpr_items[0].item;
+
+  need = min_score < 8? min_score : 8;
+  for (n=0, fitem = pattern->fpr_items; n < pattern->nfpr; n++, fitem++)
+    {
+      switch (fitem->type)
+        {
+        case FPR_SCORE_ZEROS:
+          if (need && (h[0] >> (32 - 4 * need)))
+            score = 0;
+          else
+            score = score_zeros (h, pattern->nwords);
+          break;
+        case FPR_SCORE_RUN:
+          score = score_run (h, pattern->nwords);
+          break;
+        default:
+          score = (fitem->runlen < min_score
+                   ? 0 : score_word (fitem, h, pattern->nwords));
+          break;
+        }
+      item = score > best? fitem->item : item;
+      best = score > best? score : best;
+    }
+  *r_item = item;
+  return best;
+}
+
+
+/* Prepare the keyid items of PATTERN for a device in FILTER.  A
+   low keyid passes the filter if its bits under one of the masks are
+   among the values for that mask; the high keyid is not checked.
+   Returns GPG_ERR_NOT_SUPPORTED if PATTERN has fingerprint items or
+   more than VANITY_FILTER_MAX_MASKS distinct masks.  FILTER refers
+   to PATTERN and must be released before it.  */
+gpg_error_t
+_vanity_pattern_filter (vanity_pattern_t pattern,
+                        struct vanity_filter_s *filter)
+{
+  const struct pattern_item_s **sorted;
+  const struct mask_group_s *group;
+  unsigned int i, n;
+
+  memset (filter, 0, sizeof *filter);
+  if (pattern->nfpr || !pattern->nlow)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  filter->values = xtrymalloc (pattern->nlow * sizeof *filter->values);
+  if (!filter->values)
+    return gpg_error_from_syserror ();
+  filter->nvalues = pattern->nlow;
+
+  if (pattern->ngroups)
+    {
+      if (pattern->ngroups > VANITY_FILTER_MAX_MASKS)
+        {
+          _vanity_filter_release (filter);
+          return gpg_error (GPG_ERR_NOT_SUPPORTED);
+        }
+      for (n=i=0, group = pattern->groups; n < pattern->ngroups; n++, group++)
+        {
+          filter->masks[n] = group->mask;
+          filter->starts[n] = group->entries - pattern->entries;
+          for (i=0; i < group->nentries; i++)
+            filter->values[filter->starts[n] + i] = group->entries[i].value;
+        }
+      filter->nmasks = pattern->ngroups;
+      filter->starts[n] = pattern->nlow;
+      filter->bitmap_shift = pattern->bitmap_shift;
+      filter->bitmap_words = (1u << (32 - pattern->bitmap_shift)) / 32;
+      filter->bitmap = pattern->bitmap;
+      return 0;
+    }
+
+  /* A linear pattern has only a few items; group them here the same
+     way without a bitmap.  */
+  sorted = xtrymalloc (pattern->nlow * sizeof *sorted);
+  if (!sorted)
+    {
+      _vanity_filter_release (filter);
+      return gpg_error_from_syserror ();
+    }
+  for (n=i=0; i < pattern->nitems; i++)
+    if (!is_fpr_placeholder (pattern->items + i))
+      sorted[n++] = pattern->items + i;
+  qsort (sorted, pattern->nlow, sizeof *sorted, compare_masks);
+  for (i=0; i < pattern->nlow; i++)
+    {
+      if (!i || sorted[i]->mask != sorted[i-1]->mask)
+        {
+          filter->masks[filter->nmasks] = sorted[i]->mask;
+          filter->starts[filter->nmasks] = i;
+          filter->nmasks++;
+        }
+      filter->values[i] = sorted[i]->value;
+    }
+  filter->starts[filter->nmasks] = pattern->nlow;
+  xfree (sorted);
+  return 0;
+}
+
+
+void
+_vanity_filter_release (struct vanity_filter_s *filter)
+{
+  xfree (filter->values);
+  memset (filter, 0, sizeof *filter);
+}
+
+
+/* Define the scan NAME for a linear pattern of NVALUES keyid items
+   which all have the low MASK.  Both are constants here so that the
+   compiler unrolls the comparisons and uses the mask as an
+   immediate.  */
+#define DEFINE_KEYID_SCAN(NAME, MASK, NVALUES)                          \
+  static unsigned int                                                   \
+  NAME (const struct vanity_matcher_s *m, const u32 *words,             \
+        unsigned int n)                                                 \
+  {                                                                     \
+    unsigned int i, k, hits = 0;                                        \
+    u32 x;                                                              \
+                                                                        \
+    for (i=0; i < n; i++)                                               \
+      {                                                                 \
+        x = words[i] & (MASK);                                          \
+        for (k=0; k < (NVALUES); k++)                                   \
+          hits |= (unsigned int)(x == m->values[k]) << i;               \
+      }                                                                 \
+    return hits;                                                        \
+  }
+
+DEFINE_KEYID_SCAN (scan_keyid16x1, 0xffff, 1)
+DEFINE_KEYID_SCAN (scan_keyid16x2, 0xffff, 2)
+DEFINE_KEYID_SCAN (scan_keyid16x3, 0xffff, 3)
+DEFINE_KEYID_SCAN (scan_keyid16x4, 0xffff, 4)
+DEFINE_KEYID_SCAN (scan_keyid24x1, 0xffffff, 1)
+DEFINE_KEYID_SCAN (scan_keyid24x2, 0xffffff, 2)
+DEFINE_KEYID_SCAN (scan_keyid24x3, 0xffffff, 3)
+DEFINE_KEYID_SCAN (scan_keyid24x4, 0xffffff, 4)
+DEFINE_KEYID_SCAN (scan_keyid32x1, 0xffffffff, 1)
+DEFINE_KEYID_SCAN (scan_keyid32x2, 0xffffffff, 2)
+DEFINE_KEYID_SCAN (scan_keyid32x3, 0xffffffff, 3)
+DEFINE_KEYID_SCAN (scan_keyid32x4, 0xffffffff, 4)
+
+/* Define the scan NAME for a pattern which is a single prefix of
+   NIBBLES hex digits, all of them in the first digest word.  */
+#define DEFINE_PREFIX_SCAN(NAME, NIBBLES)                               \
+  static unsigned int                                                   \
+  NAME (const struct vanity_matcher_s *m, const u32 *words,             \
+        unsigned int n)                                                 \
+  {                                                                     \
+    unsigned int i, hits = 0;                                           \
+                                                                        \
+    for (i=0; i < n; i++)                                               \
+      hits |= ((unsigned int)((words[i] >> (32 - 4 * (NIBBLES)))        \
+                              == m->values[0]) << i);                   \
+    return hits;                                                        \
+  }
+
+DEFINE_PREFIX_SCAN (scan_prefix1, 1)
+DEFINE_PREFIX_SCAN (scan_prefix2, 2)
+DEFINE_PREFIX_SCAN (scan_prefix3, 3)
+DEFINE_PREFIX_SCAN (scan_prefix4, 4)
+DEFINE_PREFIX_SCAN (scan_prefix5, 5)
+DEFINE_PREFIX_SCAN (scan_prefix6, 6)
+DEFINE_PREFIX_SCAN (scan_prefix7, 7)
+DEFINE_PREFIX_SCAN (scan_prefix8, 8)
+
+
+/* The scan for a single prefix of 9 to 16 hex digits.  */
+static unsigned int
+scan_prefix_long (const struct vanity_matcher_s *m, const u32 *words,
+                  unsigned int n)
+{
+  const u32 *words2 = words + VANITY_SHA1_MAX_LANES;
+  unsigned int i, hits = 0;
+
+  for (i=0; i < n; i++)
+    hits |= ((unsigned int)(words[i] == m->values[0]
+                            && (words2[i] & m->mask2) == m->value2) << i);
+  return hits;
+}
+
+
+/* The scan for keyid patterns of any other shape.  */
+static unsigned int
+scan_keyid_generic (const struct vanity_matcher_s *m, const u32 *words,
+                    unsigned int n)
+{
+  unsigned int i, hits = 0;
+
+  for (i=0; i < n; i++)
+    hits |= (unsigned int)!!vanity_pattern_match (m->pattern, words[i]) << i;
+  return hits;
+}
+
+
+/* The scan for fingerprint patterns of any other shape; every
+   digest is checked by the caller.  */
+static unsigned int
+scan_digest_generic (const struct vanity_matcher_s *m, const u32 *words,
+                     unsigned int n)
+{
+  (void)m;
+  (void)words;
+  return n < 32? (1u << n) - 1 : ~0u;
+}
+
+
+static const struct
+{
+  const char *name;
+  vanity_scan_t scan;
+} keyid_scans[3][VANITY_MATCHER_MAX_VALUES] =
+  {
+    { { "keyid16",   scan_keyid16x1 }, { "keyid16x2", scan_keyid16x2 },
+      { "keyid16x3", scan_keyid16x3 }, { "keyid16x4", scan_keyid16x4 } },
+    { { "keyid24",   scan_keyid24x1 }, { "keyid24x2", scan_keyid24x2 },
+      { "keyid24x3", scan_keyid24x3 }, { "keyid24x4", scan_keyid24x4 } },
+    { { "keyid32",   scan_keyid32x1 }, { "keyid32x2", scan_keyid32x2 },
+      { "keyid32x3", scan_keyid32x3 }, { "keyid32x4", scan_keyid32x4 } }
+  };
+
+static const char *const keyid64_names[VANITY_MATCHER_MAX_VALUES] =
+  { "keyid64", "keyid64x2", "keyid64x3", "keyid64x4" };
+
+static const struct
+{
+  const char *name;
+  vanity_scan_t scan;
+} prefix_scans[8] =
+  {
+    { "prefix1", scan_prefix1 }, { "prefix2", scan_prefix2 },
+    { "prefix3", scan_prefix3 }, { "prefix4", scan_prefix4 },
+    { "prefix5", scan_prefix5 }, { "prefix6", scan_prefix6 },
+    { "prefix7", scan_prefix7 }, { "prefix8", scan_prefix8 }
+  };
+
+
+/* Return the number of leading one bits of MASK if they are all its
+   one bits, or else 33.  */
+static unsigned int
+leading_ones (u32 mask)
+{
+  unsigned int n = 0;
+
+  while (n < 32 && (mask & ((u32)0x80000000 >> n)))
+    n++;
+  return (n < 32 && (mask << n))? 33 : n;
+}
+
+
+/* Select the keyid scan for the linear PATTERN in MATCHER.  Returns
+   false if its items don't have one of the common shapes.  */
+static int
+select_keyid_scan (struct vanity_matcher_s *matcher, vanity_pattern_t pattern)
+{
+  const struct pattern_item_s *item = pattern->items;
+  unsigned int n, shape;
+  int wide = 0;
+
+  if (pattern->ngroups || pattern->nfpr || !pattern->nlow
+      || pattern->nitems > VANITY_MATCHER_MAX_VALUES)
+    return 0;
+  switch (item->mask)
+    {
+    case 0xffff:     shape = 0; break;
+    case 0xffffff:   shape = 1; break;
+    case 0xffffffff: shape = 2; break;
+    default:
+      return 0;
+    }
+  for (n=0; n < pattern->nitems; n++, item++)
+    {
+      if (item->mask != pattern->items[0].mask)
+        return 0;
+      if (item->hmask)
+        wide = 1;
+      matcher->values[n] = item->value;
+    }
+  matcher->scan = keyid_scans[shape][n - 1].scan;
+  matcher->name = keyid_scans[shape][n - 1].name;
+  /* The high keyid is confirmed with the fingerprint.  */
+  if (wide && shape == 2)
+    matcher->name = keyid64_names[n - 1];
+  return 1;
+}
+
+
+/* Select the prefix scan for PATTERN in MATCHER.  Returns false if
+   PATTERN is not a single prefix of up to 16 hex digits without
+   wildcards.  A regex item whose prefilter is such a prefix uses the
+   scan as well; its lanes are then confirmed by the DFA.  */
+static int
+select_prefix_scan (struct vanity_matcher_s *matcher,
+                    vanity_pattern_t pattern)
+{
+  const struct fpr_item_s *fitem = pattern->fpr_items;
+  unsigned int bits, bits2, w;
+
+  if (pattern->nitems != 1 || pattern->nfpr != 1
+      || (fitem->type != FPR_FIXED && fitem->type != FPR_REGEX))
+    return 0;
+  for (w=2; w < pattern->nwords; w++)
+    if (fitem->mask[w])
+      return 0;
+  bits = leading_ones (fitem->mask[0]);
+  bits2 = leading_ones (fitem->mask[1]);
+  if (!bits || bits % 4 || bits > 32)
+    return 0;
+  if (bits < 32)
+    {
+      if (fitem->mask[1])
+        return 0;
+      matcher->values[0] = fitem->value[0] >> (32 - bits);
+      matcher->scan = prefix_scans[bits / 4 - 1].scan;
+      matcher->name = prefix_scans[bits / 4 - 1].name;
+      return 1;
+    }
+  if (!bits2)
+    {
+      matcher->values[0] = fitem->value[0];
+      matcher->scan = scan_prefix8;
+      matcher->name = "prefix8";
+      return 1;
+    }
+  if (bits2 % 4 || bits2 > 32)
+    return 0;
+  matcher->values[0] = fitem->value[0];
+  matcher->value2 = fitem->value[1];
+  matcher->mask2 = fitem->mask[1];
+  matcher->scan = scan_prefix_long;
+  matcher->name = "prefix-long";
+  return 1;
+}
+
+
+/* Set up MATCHER for the scans of PATTERN.  The scan returns a flag
+   for each of the N consecutive lanes of a kernel batch which may
+   match.  For keyid patterns WORDS are the low keyids and a flagged
+   lane still needs to be confirmed with the fingerprint.  For
+   patterns needing the digest WORDS are the digest words, each of
+   them VANITY_SHA1_MAX_LANES apart, and a flagged lane needs to be
+   checked with _vanity_pattern_check_words or, for a scoring
+   pattern, always scored.  */
+void
+_vanity_matcher_init (struct vanity_matcher_s *matcher,
+                      vanity_pattern_t pattern)
+{
+  memset (matcher, 0, sizeof *matcher);
+  matcher->pattern = pattern;
+  if (!pattern->nfpr)
+    {
+      if (!select_keyid_scan (matcher, pattern))
+        {
+          matcher->scan = scan_keyid_generic;
+          matcher->name = "generic-keyid";
+        }
+    }
+  else if (pattern->nscore || !select_prefix_scan (matcher, pattern))
+    {
+      matcher->scan = scan_digest_generic;
+      matcher->name = "generic-digest";
+    }
+}
+
+
+/* Return true if the fingerprint FPR, which has VANITY_FPR_LEN bytes
+   or VANITY_V5_FPR_LEN bytes for a v5 pattern, matches PATTERN.  The
+   value returned is the number of the first matching item plus
+   one.  */
+int
+vanity_pattern_check (vanity_pattern_t pattern, const unsigned char *fpr)
+{
+  u32 h[VANITY_MAX_DIGEST_WORDS];
+  int i;
+
+  for (i=0; i < pattern->nwords; i++)
+    h[i] = buf32_to_u32 (fpr + 4 * i);
+  return _vanity_pattern_check_words (pattern, h);
+}
+
+
+/* Return true if PATTERN rates the fingerprints instead of matching
+   them.  */
+int
+vanity_pattern_is_scoring (vanity_pattern_t pattern)
+{
+  return !!pattern->nscore;
+}
+
+
+/* Return the score of the fingerprint FPR, which has the length given
+   for vanity_pattern_check, for the scoring pattern PATTERN.  The
+   index of the first item with that score is stored at R_ITEM.  */
+unsigned int
+vanity_pattern_score (vanity_pattern_t pattern, const unsigned char *fpr,
+                      unsigned int *r_item)
+{
+  u32 h[VANITY_MAX_DIGEST_WORDS];
+  int i;
+
+  for (i=0; i < pattern->nwords; i++)
+    h[i] = buf32_to_u32 (fpr + 4 * i);
+  return _vanity_pattern_score_words (pattern, h, 0, r_item);
+}
@@ -0,0 +1,1148 @@
+/* vanity-opencl.c - OpenCL device for the vanity timestamp sweep
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A graphics card hashes a whole range of creation times for many
+   keys at once.  The device is given the SHA-1 blocks prepared by
+   vanity-sha1.c for a number of keys and a range of timestamps; each
+   work item hashes PER_ITEM consecutive timestamps of one key.  Only
+   the keyids passing the filter built by _vanity_pattern_filter are
+   returned as (key, timestamp, keyid) candidates; the host confirms
+   them with the complete fingerprint.
+
+   Like the kernels of vanity-sha1.c the device is selected and
+   checked against libgcrypt once by _vanity_gpu_init.  Each search
+   then creates its own command queue and kernel with the filter of
+   its pattern.  Without OpenCL support in the build no device is
+   ever found.
+
+   For Ed25519 the device may also generate the keys it sweeps.  Each
+   call is given a fresh random master secret; the seed of key I is
+   the first half of the SHA-512 hash of the master and I, so that
+   the host can recompute the seed of a candidate with
+   _vanity_gpu_seed and neither seeds nor public keys ever travel
+   back from the device.  The public keys are written into copies of
+   a template SHA-1 block which the sweep kernel then hashes.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <npth.h>
+
+#include "vanity-defs.h"
+#include "../common/host2net.h"
+
+#ifdef USE_VANITY_OPENCL
+# include <CL/cl.h>
+#endif
+
+
+#ifdef USE_VANITY_OPENCL
+
+/* The number of timestamps hashed by one work item.  */
+#define PER_ITEM 64
+
+/* The sweep kernel.  The candidates are stored at HITS after the
+   counter in its first word; the counter may become larger than
+   MAXHITS.  */
+static const char kernel_source[] =
+  "#define ROL(x,n) rotate ((uint)(x), (uint)(n))\n"
+  "#define F1(b,c,d) (d ^ (b & (c ^ d)))\n"
+  "#define F2(b,c,d) (b ^ c ^ d)\n"
+  "#define F3(b,c,d) ((b & c) | (d & (b | c)))\n"
+  "#define X(i) (w[(i) & 15] = ROL (w[((i) - 3) & 15] ^ w[((i) - 8) & 15]"
+  " ^ w[((i) - 14) & 15] ^ w[(i) & 15], 1))\n"
+  "#define R(f,k,i) do {"
+  " tmp = ROL (a, 5) + f (b, c, d) + e + (k) + w[(i) & 15];"
+  " e = d; d = c; c = ROL (b, 30); b = a; a = tmp;"
+  " } while (0)\n"
+  "\n"
+  "__kernel void\n"
+  "vanity_sweep (__global const uint *blocks, uint start, uint count,\n"
+  "              uint nmasks, __global const uint *masks,\n"
+  "              __global const uint *starts, __global const uint *values,\n"
+  "              uint bitmap_shift, uint bitmap_words,\n"
+  "              __global const uint *bitmap,\n"
+  "              __global uint *hits, uint maxhits)\n"
+  "{\n"
+  "  uint key = get_global_id (1);\n"
+  "  uint first = get_global_id (0) * PER_ITEM;\n"
+  "  uint block[16], w[16];\n"
+  "  uint a, b, c, d, e, tmp, keyid, v, lo, hi, mid, idx, n, i, j, m;\n"
+  "\n"
+  "  for (i=0; i < 16; i++)\n"
+  "    block[i] = blocks[16 * key + i];\n"
+  "  for (j=0; j < PER_ITEM && first + j < count; j++)\n"
+  "    {\n"
+  "      for (i=0; i < 16; i++)\n"
+  "        w[i] = block[i];\n"
+  "      w[1] = start + first + j;\n"
+  "      a = 0x67452301; b = 0xefcdab89; c = 0x98badcfe;\n"
+  "      d = 0x10325476; e = 0xc3d2e1f0;\n"
+  "      for (i=0; i < 16; i++)\n"
+  "        R (F1, 0x5a827999, i);\n"
+  "      for (; i < 20; i++)\n"
+  "        {\n"
+  "          X (i);\n"
+  "          R (F1, 0x5a827999, i);\n"
+  "        }\n"
+  "      for (; i < 40; i++)\n"
+  "        {\n"
+  "          X (i);\n"
+  "          R (F2, 0x6ed9eba1, i);\n"
+  "        }\n"
+  "      for (; i < 60; i++)\n"
+  "        {\n"
+  "          X (i);\n"
+  "          R (F3, 0x8f1bbcdc, i);\n"
+  "        }\n"
+  "      for (; i < 80; i++)\n"
+  "        {\n"
+  "          X (i);\n"
+  "          R (F2, 0xca62c1d6, i);\n"
+  "        }\n"
+  "      keyid = e + 0xc3d2e1f0;\n"
+  "\n"
+  "      for (m=0; m < nmasks; m++)\n"
+  "        {\n"
+  "          v = keyid & masks[m];\n"
+  "          if (bitmap_words)\n"
+  "            {\n"
+  "              idx = (v * 0x9e3779b1) >> bitmap_shift;\n"
+  "              if (!(bitmap[idx / 32] & (1u << (idx % 32))))\n"
+  "                continue;\n"
+  "            }\n"
+  "          lo = starts[m];\n"
+  "          hi = starts[m+1];\n"
+  "          while (lo < hi)\n"
+  "            {\n"
+  "              mid = lo + (hi - lo) / 2;\n"
+  "              if (values[mid] < v)\n"
+  "                lo = mid + 1;\n"
+  "              else\n"
+  "                hi = mid;\n"
+  "            }\n"
+  "          if (lo < starts[m+1] && values[lo] == v)\n"
+  "            {\n"
+  "              n = atomic_inc (hits);\n"
+  "              if (n < maxhits)\n"
+  "                {\n"
+  "                  hits[1 + 3 * n] = key;\n"
+  "                  hits[2 + 3 * n] = start + first + j;\n"
+  "                  hits[3 + 3 * n] = keyid;\n"
+  "                }\n"
+  "              break;\n"
+  "            }\n"
+  "        }\n"
+  "    }\n"
+  "}\n";
+
+
+/* The key generation kernel.  Each work item derives the seed of its
+   key from MASTER as done by _vanity_gpu_seed, expands it to the
+   scalar, multiplies the base point with the comb TABLE returned by
+   _vanity_ed25519_table and stores the SHA-1 block TMPL with the
+   encoded public key ORed in at byte QOFF at BLOCKS.  The field
+   arithmetic uses the same 10 limbs of radix 2^25.5 as the vector
+   kernels of vanity-ed25519.c.  */
+static const char keygen_source[] =
+  "#define ROR64(x,n) rotate ((ulong)(x), (ulong)(64 - (n)))\n"
+  "#define S0(x) (ROR64 ((x), 1) ^ ROR64 ((x), 8) ^ ((x) >> 7))\n"
+  "#define S1(x) (ROR64 ((x), 19) ^ ROR64 ((x), 61) ^ ((x) >> 6))\n"
+  "#define E0(x) (ROR64 ((x), 28) ^ ROR64 ((x), 34) ^ ROR64 ((x), 39))\n"
+  "#define E1(x) (ROR64 ((x), 14) ^ ROR64 ((x), 18) ^ ROR64 ((x), 41))\n"
+  "#define CH(x,y,z) ((z) ^ ((x) & ((y) ^ (z))))\n"
+  "#define MAJ(x,y,z) (((x) & (y)) | ((z) & ((x) | (y))))\n"
+  "\n"
+  "__constant ulong h512[8] = {\n"
+  "  0x6a09e667f3bcc908UL, 0xbb67ae8584caa73bUL, 0x3c6ef372fe94f82bUL,\n"
+  "  0xa54ff53a5f1d36f1UL, 0x510e527fade682d1UL, 0x9b05688c2b3e6c1fUL,\n"
+  "  0x1f83d9abfb41bd6bUL, 0x5be0cd19137e2179UL\n"
+  "};\n"
+  "__constant ulong k512[80] = {\n"
+  "  0x428a2f98d728ae22UL, 0x7137449123ef65cdUL, 0xb5c0fbcfec4d3b2fUL,\n"
+  "  0xe9b5dba58189dbbcUL, 0x3956c25bf348b538UL, 0x59f111f1b605d019UL,\n"
+  "  0x923f82a4af194f9bUL, 0xab1c5ed5da6d8118UL, 0xd807aa98a3030242UL,\n"
+  "  0x12835b0145706fbeUL, 0x243185be4ee4b28cUL, 0x550c7dc3d5ffb4e2UL,\n"
+  "  0x72be5d74f27b896fUL, 0x80deb1fe3b1696b1UL, 0x9bdc06a725c71235UL,\n"
+  "  0xc19bf174cf692694UL, 0xe49b69c19ef14ad2UL, 0xefbe4786384f25e3UL,\n"
+  "  0x0fc19dc68b8cd5b5UL, 0x240ca1cc77ac9c65UL, 0x2de92c6f592b0275UL,\n"
+  "  0x4a7484aa6ea6e483UL, 0x5cb0a9dcbd41fbd4UL, 0x76f988da831153b5UL,\n"
+  "  0x983e5152ee66dfabUL, 0xa831c66d2db43210UL, 0xb00327c898fb213fUL,\n"
+  "  0xbf597fc7beef0ee4UL, 0xc6e00bf33da88fc2UL, 0xd5a79147930aa725UL,\n"
+  "  0x06ca6351e003826fUL, 0x142929670a0e6e70UL, 0x27b70a8546d22ffcUL,\n"
+  "  0x2e1b21385c26c926UL, 0x4d2c6dfc5ac42aedUL, 0x53380d139d95b3dfUL,\n"
+  "  0x650a73548baf63deUL, 0x766a0abb3c77b2a8UL, 0x81c2c92e47edaee6UL,\n"
+  "  0x92722c851482353bUL, 0xa2bfe8a14cf10364UL, 0xa81a664bbc423001UL,\n"
+  "  0xc24b8b70d0f89791UL, 0xc76c51a30654be30UL, 0xd192e819d6ef5218UL,\n"
+  "  0xd69906245565a910UL, 0xf40e35855771202aUL, 0x106aa07032bbd1b8UL,\n"
+  "  0x19a4c116b8d2d0c8UL, 0x1e376c085141ab53UL, 0x2748774cdf8eeb99UL,\n"
+  "  0x34b0bcb5e19b48a8UL, 0x391c0cb3c5c95a63UL, 0x4ed8aa4ae3418acbUL,\n"
+  "  0x5b9cca4f7763e373UL, 0x682e6ff3d6b2b8a3UL, 0x748f82ee5defb2fcUL,\n"
+  "  0x78a5636f43172f60UL, 0x84c87814a1f0ab72UL, 0x8cc702081a6439ecUL,\n"
+  "  0x90befffa23631e28UL, 0xa4506cebde82bde9UL, 0xbef9a3f7b2c67915UL,\n"
+  "  0xc67178f2e372532bUL, 0xca273eceea26619cUL, 0xd186b8c721c0c207UL,\n"
+  "  0xeada7dd6cde0eb1eUL, 0xf57d4f7fee6ed178UL, 0x06f067aa72176fbaUL,\n"
+  "  0x0a637dc5a2c898a6UL, 0x113f9804bef90daeUL, 0x1b710b35131c471bUL,\n"
+  "  0x28db77f523047d84UL, 0x32caab7b40c72493UL, 0x3c9ebe0a15c9bebcUL,\n"
+  "  0x431d67c49c100d4cUL, 0x4cc5d4becb3e42b6UL, 0x597f299cfc657e2aUL,\n"
+  "  0x5fcb6fab3ad6faecUL, 0x6c44198c4a475817UL\n"
+  "};\n"
+  "\n"
+  "void\n"
+  "sha512_block (ulong *s, ulong *w)\n"
+  "{\n"
+  "  ulong a, b, c, d, e, f, g, h, t1, t2;\n"
+  "  uint i;\n"
+  "\n"
+  "  a = h512[0]; b = h512[1]; c = h512[2]; d = h512[3];\n"
+  "  e = h512[4]; f = h512[5]; g = h512[6]; h = h512[7];\n"
+  "  for (i=0; i < 80; i++)\n"
+  "    {\n"
+  "      if (i >= 16)\n"
+  "        w[i & 15] += (S1 (w[(i - 2) & 15]) + w[(i - 7) & 15]\n"
+  "                      + S0 (w[(i - 15) & 15]));\n"
+  "      t1 = h + E1 (e) + CH (e, f, g) + k512[i] + w[i & 15];\n"
+  "      t2 = E0 (a) + MAJ (a, b, c);\n"
+  "      h = g; g = f; f = e; e = d + t1;\n"
+  "      d = c; c = b; b = a; a = t1 + t2;\n"
+  "    }\n"
+  "  s[0] = a + h512[0]; s[1] = b + h512[1];\n"
+  "  s[2] = c + h512[2]; s[3] = d + h512[3];\n"
+  "  s[4] = e + h512[4]; s[5] = f + h512[5];\n"
+  "  s[6] = g + h512[6]; s[7] = h + h512[7];\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "fe_carry (uint *h, ulong *t)\n"
+  "{\n"
+  "  ulong c;\n"
+  "  uint i;\n"
+  "\n"
+  "  c = t[0] >> 26; t[1] += c; t[0] &= 0x3ffffff;\n"
+  "  c = t[4] >> 26; t[5] += c; t[4] &= 0x3ffffff;\n"
+  "  c = t[1] >> 25; t[2] += c; t[1] &= 0x1ffffff;\n"
+  "  c = t[5] >> 25; t[6] += c; t[5] &= 0x1ffffff;\n"
+  "  c = t[2] >> 26; t[3] += c; t[2] &= 0x3ffffff;\n"
+  "  c = t[6] >> 26; t[7] += c; t[6] &= 0x3ffffff;\n"
+  "  c = t[3] >> 25; t[4] += c; t[3] &= 0x1ffffff;\n"
+  "  c = t[7] >> 25; t[8] += c; t[7] &= 0x1ffffff;\n"
+  "  c = t[4] >> 26; t[5] += c; t[4] &= 0x3ffffff;\n"
+  "  c = t[8] >> 26; t[9] += c; t[8] &= 0x3ffffff;\n"
+  "  c = t[9] >> 25; t[0] += 19 * c; t[9] &= 0x1ffffff;\n"
+  "  c = t[0] >> 26; t[1] += c; t[0] &= 0x3ffffff;\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    h[i] = (uint)t[i];\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "fe_mul (uint *h, const uint *f, const uint *g)\n"
+  "{\n"
+  "  ulong t[10];\n"
+  "  uint i, j, fi, gj;\n"
+  "\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    t[i] = 0;\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    for (j=0; j < 10; j++)\n"
+  "      {\n"
+  "        fi = (i & j & 1)? 2 * f[i] : f[i];\n"
+  "        gj = (i + j >= 10)? 19 * g[j] : g[j];\n"
+  "        t[(i + j) % 10] += (ulong)fi * gj;\n"
+  "      }\n"
+  "  fe_carry (h, t);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "fe_add (uint *h, const uint *f, const uint *g)\n"
+  "{\n"
+  "  ulong t[10];\n"
+  "  uint i;\n"
+  "\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    t[i] = (ulong)f[i] + g[i];\n"
+  "  fe_carry (h, t);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "fe_sub (uint *h, const uint *f, const uint *g)\n"
+  "{\n"
+  "  ulong t[10];\n"
+  "  uint i;\n"
+  "\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    t[i] = ((ulong)f[i] + (!i? 0xfffffb4 : (i & 1)? 0x7fffffc :"
+  " 0xffffffc)\n"
+  "            - g[i]);\n"
+  "  fe_carry (h, t);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "fe_sqn (uint *h, const uint *f, uint n)\n"
+  "{\n"
+  "  fe_mul (h, f, f);\n"
+  "  while (--n)\n"
+  "    fe_mul (h, h, h);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "fe_invert (uint *h, const uint *f)\n"
+  "{\n"
+  "  uint z2[10], z9[10], z11[10], z5[10], z10[10], z20[10], z50[10];\n"
+  "  uint z100[10], t[10];\n"
+  "\n"
+  "  fe_sqn (z2, f, 1);\n"
+  "  fe_sqn (t, z2, 2);\n"
+  "  fe_mul (z9, t, f);\n"
+  "  fe_mul (z11, z9, z2);\n"
+  "  fe_sqn (t, z11, 1);\n"
+  "  fe_mul (z5, t, z9);\n"
+  "  fe_sqn (t, z5, 5);\n"
+  "  fe_mul (z10, t, z5);\n"
+  "  fe_sqn (t, z10, 10);\n"
+  "  fe_mul (z20, t, z10);\n"
+  "  fe_sqn (t, z20, 20);\n"
+  "  fe_mul (t, t, z20);\n"
+  "  fe_sqn (t, t, 10);\n"
+  "  fe_mul (z50, t, z10);\n"
+  "  fe_sqn (t, z50, 50);\n"
+  "  fe_mul (z100, t, z50);\n"
+  "  fe_sqn (t, z100, 100);\n"
+  "  fe_mul (t, t, z100);\n"
+  "  fe_sqn (t, t, 50);\n"
+  "  fe_mul (t, t, z50);\n"
+  "  fe_sqn (t, t, 5);\n"
+  "  fe_mul (h, t, z11);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "fe_tobytes (uchar *s, const uint *f)\n"
+  "{\n"
+  "  ulong t[10], acc;\n"
+  "  uint h[10], q, i, j, n, width;\n"
+  "\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    t[i] = f[i];\n"
+  "  fe_carry (h, t);\n"
+  "  q = (h[0] + 19) >> 26;\n"
+  "  for (i=1; i < 10; i++)\n"
+  "    q = (h[i] + q) >> ((i & 1)? 25 : 26);\n"
+  "  h[0] += 19 * q;\n"
+  "  for (i=0; i < 9; i++)\n"
+  "    {\n"
+  "      width = (i & 1)? 25 : 26;\n"
+  "      h[i+1] += h[i] >> width;\n"
+  "      h[i] &= (1u << width) - 1;\n"
+  "    }\n"
+  "  h[9] &= 0x1ffffff;\n"
+  "  acc = 0;\n"
+  "  for (i=0, j=0, n=0; i < 10; i++)\n"
+  "    {\n"
+  "      acc |= (ulong)h[i] << n;\n"
+  "      n += (i & 1)? 25 : 26;\n"
+  "      while (n >= 8)\n"
+  "        {\n"
+  "          s[j++] = (uchar)acc;\n"
+  "          acc >>= 8;\n"
+  "          n -= 8;\n"
+  "        }\n"
+  "    }\n"
+  "  s[j] = (uchar)acc;\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "fe_cmov (uint *f, const uint *g, uint mask)\n"
+  "{\n"
+  "  uint i;\n"
+  "\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    f[i] ^= mask & (f[i] ^ g[i]);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "fe_cmov_table (uint *f, __global const uint *g, uint mask)\n"
+  "{\n"
+  "  uint i;\n"
+  "\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    f[i] ^= mask & (f[i] ^ g[i]);\n"
+  "}\n"
+  "\n"
+  "typedef struct\n"
+  "{\n"
+  "  uint X[10], Y[10], Z[10], T[10];\n"
+  "} ge_t;\n"
+  "\n"
+  "typedef struct\n"
+  "{\n"
+  "  uint ypx[10], ymx[10], xy2d[10];\n"
+  "} ge_precomp_t;\n"
+  "\n"
+  "void\n"
+  "ge_p1p1_to_p3 (ge_t *r, const ge_t *p)\n"
+  "{\n"
+  "  fe_mul (r->X, p->X, p->T);\n"
+  "  fe_mul (r->Y, p->Y, p->Z);\n"
+  "  fe_mul (r->Z, p->Z, p->T);\n"
+  "  fe_mul (r->T, p->X, p->Y);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "ge_p2_dbl (ge_t *r, const ge_t *p)\n"
+  "{\n"
+  "  uint t0[10];\n"
+  "\n"
+  "  fe_mul (r->X, p->X, p->X);\n"
+  "  fe_mul (r->Z, p->Y, p->Y);\n"
+  "  fe_mul (r->T, p->Z, p->Z);\n"
+  "  fe_add (r->T, r->T, r->T);\n"
+  "  fe_add (r->Y, p->X, p->Y);\n"
+  "  fe_mul (t0, r->Y, r->Y);\n"
+  "  fe_add (r->Y, r->Z, r->X);\n"
+  "  fe_sub (r->Z, r->Z, r->X);\n"
+  "  fe_sub (r->X, t0, r->Y);\n"
+  "  fe_sub (r->T, r->T, r->Z);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "ge_madd (ge_t *r, const ge_t *p, const ge_precomp_t *q)\n"
+  "{\n"
+  "  uint t0[10];\n"
+  "\n"
+  "  fe_add (r->X, p->Y, p->X);\n"
+  "  fe_sub (r->Y, p->Y, p->X);\n"
+  "  fe_mul (r->Z, r->X, q->ypx);\n"
+  "  fe_mul (r->Y, r->Y, q->ymx);\n"
+  "  fe_mul (r->T, q->xy2d, p->T);\n"
+  "  fe_add (t0, p->Z, p->Z);\n"
+  "  fe_sub (r->X, r->Z, r->Y);\n"
+  "  fe_add (r->Y, r->Z, r->Y);\n"
+  "  fe_add (r->Z, t0, r->T);\n"
+  "  fe_sub (r->T, t0, r->T);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "select_precomp (ge_precomp_t *t, __global const uint *table, uint pos,\n"
+  "                int b)\n"
+  "{\n"
+  "  uint zero[10], tmp[10];\n"
+  "  uint neg = -(uint)(b < 0);\n"
+  "  uint babs = (uint)((b ^ (int)neg) - (int)neg);\n"
+  "  uint i, mask;\n"
+  "  __global const uint *entry;\n"
+  "\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    {\n"
+  "      t->ypx[i] = t->ymx[i] = t->xy2d[i] = zero[i] = 0;\n"
+  "    }\n"
+  "  t->ypx[0] = t->ymx[0] = 1;\n"
+  "  for (i=0; i < 8; i++)\n"
+  "    {\n"
+  "      entry = table + 30 * (8 * pos + i);\n"
+  "      mask = -(uint)(babs == i + 1);\n"
+  "      fe_cmov_table (t->ypx, entry, mask);\n"
+  "      fe_cmov_table (t->ymx, entry + 10, mask);\n"
+  "      fe_cmov_table (t->xy2d, entry + 20, mask);\n"
+  "    }\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    tmp[i] = t->ypx[i];\n"
+  "  fe_cmov (t->ypx, t->ymx, neg);\n"
+  "  fe_cmov (t->ymx, tmp, neg);\n"
+  "  fe_sub (tmp, zero, t->xy2d);\n"
+  "  fe_cmov (t->xy2d, tmp, neg);\n"
+  "}\n"
+  "\n"
+  "void\n"
+  "scalarmult_base (ge_t *h, __global const uint *table, const uchar *a)\n"
+  "{\n"
+  "  char e[64];\n"
+  "  char carry;\n"
+  "  ge_t r, s;\n"
+  "  ge_precomp_t t;\n"
+  "  uint i;\n"
+  "\n"
+  "  for (i=0; i < 32; i++)\n"
+  "    {\n"
+  "      e[2*i] = a[i] & 15;\n"
+  "      e[2*i + 1] = a[i] >> 4;\n"
+  "    }\n"
+  "  carry = 0;\n"
+  "  for (i=0; i < 63; i++)\n"
+  "    {\n"
+  "      e[i] += carry;\n"
+  "      carry = (e[i] + 8) >> 4;\n"
+  "      e[i] -= carry << 4;\n"
+  "    }\n"
+  "  e[63] += carry;\n"
+  "\n"
+  "  for (i=0; i < 10; i++)\n"
+  "    h->X[i] = h->Y[i] = h->Z[i] = h->T[i] = 0;\n"
+  "  h->Y[0] = h->Z[0] = 1;\n"
+  "  for (i=1; i < 64; i += 2)\n"
+  "    {\n"
+  "      select_precomp (&t, table, i / 2, e[i]);\n"
+  "      ge_madd (&r, h, &t);\n"
+  "      ge_p1p1_to_p3 (h, &r);\n"
+  "    }\n"
+  "  ge_p2_dbl (&r, h);\n"
+  "  ge_p1p1_to_p3 (&s, &r);\n"
+  "  ge_p2_dbl (&r, &s);\n"
+  "  ge_p1p1_to_p3 (&s, &r);\n"
+  "  ge_p2_dbl (&r, &s);\n"
+  "  ge_p1p1_to_p3 (&s, &r);\n"
+  "  ge_p2_dbl (&r, &s);\n"
+  "  ge_p1p1_to_p3 (h, &r);\n"
+  "  for (i=0; i < 64; i += 2)\n"
+  "    {\n"
+  "      select_precomp (&t, table, i / 2, e[i]);\n"
+  "      ge_madd (&r, h, &t);\n"
+  "      ge_p1p1_to_p3 (h, &r);\n"
+  "    }\n"
+  "}\n"
+  "\n"
+  "__kernel void\n"
+  "vanity_keygen (__global const ulong *master, __global const uint *table,\n"
+  "               __global const uint *tmpl, uint qoff, __global uint"
+  " *blocks)\n"
+  "{\n"
+  "  uint key = get_global_id (0);\n"
+  "  ulong w[16], s[8];\n"
+  "  uchar a[32], q[32], xb[32];\n"
+  "  ge_t p;\n"
+  "  uint zinv[10], x[10], y[10], block[16];\n"
+  "  uint i, pos;\n"
+  "\n"
+  "  for (i=0; i < 16; i++)\n"
+  "    w[i] = i < 4? master[i] : 0;\n"
+  "  w[4] = ((ulong)key << 32) | 0x80000000UL;\n"
+  "  w[15] = 36 * 8;\n"
+  "  sha512_block (s, w);\n"
+  "  for (i=0; i < 16; i++)\n"
+  "    w[i] = i < 4? s[i] : 0;\n"
+  "  w[4] = 0x8000000000000000UL;\n"
+  "  w[15] = 256;\n"
+  "  sha512_block (s, w);\n"
+  "  s[0] &= ~0x0700000000000000UL;\n"
+  "  s[3] = (s[3] & ~0x80UL) | 0x40;\n"
+  "  for (i=0; i < 32; i++)\n"
+  "    a[i] = (uchar)(s[i / 8] >> (56 - 8 * (i % 8)));\n"
+  "\n"
+  "  scalarmult_base (&p, table, a);\n"
+  "  fe_invert (zinv, p.Z);\n"
+  "  fe_mul (x, p.X, zinv);\n"
+  "  fe_mul (y, p.Y, zinv);\n"
+  "  fe_tobytes (q, y);\n"
+  "  fe_tobytes (xb, x);\n"
+  "  q[31] ^= (xb[0] & 1) << 7;\n"
+  "\n"
+  "  for (i=0; i < 16; i++)\n"
+  "    block[i] = tmpl[i];\n"
+  "  for (i=0; i < 32; i++)\n"
+  "    {\n"
+  "      pos = qoff + i;\n"
+  "      block[pos / 4] |= (uint)q[i] << (24 - 8 * (pos % 4));\n"
+  "    }\n"
+  "  for (i=0; i < 16; i++)\n"
+  "    blocks[16 * key + i] = block[i];\n"
+  "}\n";
+
+
+/* Store the 32 bit value VAL big endian at P.  */
+static inline void
+put_u32 (unsigned char *p, u32 val)
+{
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >>  8;
+  p[3] = val;
+}
+
+
+/* The state of a device for one search.  */
+struct vanity_gpu_s
+{
+  cl_command_queue queue;
+  cl_kernel kernel;
+  cl_mem blocks;
+  cl_mem masks;
+  cl_mem starts;
+  cl_mem values;
+  cl_mem bitmap;
+  cl_mem hits;
+  u32 hitbuf[1 + 3 * VANITY_GPU_MAX_HITS];
+  cl_kernel keygen;             /* Set up by _vanity_gpu_keygen_setup.  */
+  cl_mem master;
+  cl_mem table;
+  cl_mem tmpl;
+};
+
+
+/* The device selected by _vanity_gpu_init and its program.  */
+static int gpu_state;           /* 1 if usable, -1 if not, 0 unknown.  */
+static cl_device_id gpu_device;
+static cl_context gpu_context;
+static cl_program gpu_program;
+static char gpu_name[64];
+static int keygen_state;        /* 1 if usable, -1 if not, 0 unknown.  */
+
+
+/* A key packet with the layout of an Ed25519 key for the self-test.  */
+static const unsigned char selftest_packet[51] =
+  {
+    0x99, 0x00, 0x30, 0x04, 0x55, 0x5d, 0x89, 0x3f, 0x16, 0x09,
+    0x2b, 0x06, 0x01, 0x04, 0x01, 0xda, 0x47, 0x0f, 0x01, 0x01,
+    0x07, 0x40, 0x3f, 0x09, 0x89, 0x94, 0xbd, 0xd9, 0x16, 0xed,
+    0x40, 0x53, 0x19, 0x79, 0x34, 0xe4, 0xa8, 0x7c, 0x80, 0x73,
+    0x3a, 0x12, 0x80, 0xd6, 0x2f, 0x80, 0x10, 0x99, 0x2e, 0x43,
+    0xee
+  };
+
+
+/* Check the selected device against libgcrypt with a filter passing
+   every keyid.  Returns true if it works correctly.  */
+static int
+selftest_gpu (void)
+{
+  static const u32 starts[] = { 0x555d893f, 0xffffffc0 };
+  struct vanity_filter_s filter;
+  struct vanity_sha1_s ctx;
+  struct vanity_gpu_hit_s hits[VANITY_GPU_MAX_HITS];
+  vanity_gpu_t gpu;
+  unsigned char packet[sizeof selftest_packet];
+  unsigned char fpr[VANITY_FPR_LEN];
+  u32 value = 0;
+  unsigned int i, n, nhits;
+  int ok = 1;
+
+  memset (&filter, 0, sizeof filter);
+  filter.nmasks = 1;
+  filter.starts[1] = 1;
+  filter.nvalues = 1;
+  filter.values = &value;
+  if (_vanity_gpu_new (&gpu, &filter))
+    return 0;
+
+  memcpy (packet, selftest_packet, sizeof packet);
+  _vanity_sha1_prepare (&ctx, packet, sizeof packet);
+  for (i=0; ok && i < DIM (starts); i++)
+    {
+      if (_vanity_gpu_sweep (gpu, ctx.block, 1, starts[i], 2 * PER_ITEM,
+                             hits, &nhits)
+          || nhits != 2 * PER_ITEM)
+        ok = 0;
+      for (n=0; ok && n < nhits; n++)
+        {
+          if (hits[n].key || hits[n].timestamp - starts[i] >= 2 * PER_ITEM)
+            ok = 0;
+          put_u32 (packet + 4, hits[n].timestamp);
+          gcry_md_hash_buffer (GCRY_MD_SHA1, fpr, packet, sizeof packet);
+          if (hits[n].keyid != buf32_to_u32 (fpr + 16))
+            ok = 0;
+        }
+    }
+  _vanity_gpu_release (gpu);
+  return ok;
+}
+
+
+/* Use the first device of PLATFORM of type TYPE.  Returns true if
+   the program could be built for it.  */
+static int
+open_device (cl_platform_id platform, cl_device_type type)
+{
+  const char *sources[2] = { kernel_source, keygen_source };
+  char options[32];
+  cl_uint ndevices;
+  cl_int rc;
+
+  if (clGetDeviceIDs (platform, type, 1, &gpu_device, &ndevices)
+      != CL_SUCCESS || !ndevices)
+    return 0;
+  gpu_context = clCreateContext (NULL, 1, &gpu_device, NULL, NULL, &rc);
+  if (rc != CL_SUCCESS)
+    return 0;
+  gpu_program = clCreateProgramWithSource (gpu_context, DIM (sources),
+                                           sources, NULL, &rc);
+  if (rc == CL_SUCCESS)
+    {
+      snprintf (options, sizeof options, "-DPER_ITEM=%d", PER_ITEM);
+      rc = clBuildProgram (gpu_program, 1, &gpu_device, options, NULL, NULL);
+      if (rc == CL_SUCCESS)
+        {
+          if (clGetDeviceInfo (gpu_device, CL_DEVICE_NAME,
+                               sizeof gpu_name - 1, gpu_name, NULL)
+              != CL_SUCCESS)
+            strcpy (gpu_name, "unknown");
+          return 1;
+        }
+      npth_protect ();
+      log_info ("building the OpenCL vanity kernel failed: %d\n", (int)rc);
+      npth_unprotect ();
+      clReleaseProgram (gpu_program);
+      gpu_program = NULL;
+    }
+  clReleaseContext (gpu_context);
+  gpu_context = NULL;
+  return 0;
+}
+
+
+/* Select the first GPU or accelerator device which passes the
+   self-test.  Returns true if there is one.  Building the program
+   may take seconds; this is called without holding the npth lock.  */
+int
+_vanity_gpu_init (void)
+{
+  cl_platform_id platforms[8];
+  cl_uint nplatforms, i;
+
+  if (gpu_state)
+    return gpu_state > 0;
+
+  gpu_state = -1;
+  if (clGetPlatformIDs (DIM (platforms), platforms, &nplatforms)
+      != CL_SUCCESS)
+    return 0;
+  if (nplatforms > DIM (platforms))
+    nplatforms = DIM (platforms);
+  for (i=0; i < nplatforms; i++)
+    {
+      if (!open_device (platforms[i], CL_DEVICE_TYPE_GPU)
+          && !open_device (platforms[i], CL_DEVICE_TYPE_ACCELERATOR))
+        continue;
+      gpu_state = 1;
+      if (selftest_gpu ())
+        return 1;
+      npth_protect ();
+      log_info ("OpenCL device %s failed the self-test\n", gpu_name);
+      npth_unprotect ();
+      gpu_state = -1;
+      clReleaseProgram (gpu_program);
+      clReleaseContext (gpu_context);
+      gpu_program = NULL;
+      gpu_context = NULL;
+    }
+  return 0;
+}
+
+
+/* Return the name of the selected device.  */
+const char *
+_vanity_gpu_name (void)
+{
+  return gpu_state > 0? gpu_name : "none";
+}
+
+
+/* Return a new read-only device buffer with a copy of the NWORDS
+   words at DATA; at least one word is allocated.  */
+static cl_mem
+new_buffer (const u32 *data, size_t nwords)
+{
+  static const u32 zero;
+  cl_int rc;
+  cl_mem mem;
+
+  if (!nwords)
+    {
+      data = &zero;
+      nwords = 1;
+    }
+  mem = clCreateBuffer (gpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        nwords * sizeof (u32), (void *)data, &rc);
+  return rc == CL_SUCCESS? mem : NULL;
+}
+
+
+/* Create the device state for a search with FILTER and store it at
+   R_GPU.  Returns GPG_ERR_NOT_SUPPORTED if there is no usable
+   device.  Called without holding the npth lock.  */
+gpg_error_t
+_vanity_gpu_new (vanity_gpu_t *r_gpu, const struct vanity_filter_s *filter)
+{
+  vanity_gpu_t gpu;
+  cl_int rc;
+  cl_uint val;
+  int failed;
+
+  *r_gpu = NULL;
+  if (gpu_state <= 0)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  gpu = xtrycalloc (1, sizeof *gpu);
+  if (!gpu)
+    return gpg_error_from_syserror ();
+
+  gpu->queue = clCreateCommandQueue (gpu_context, gpu_device, 0, &rc);
+  failed = (rc != CL_SUCCESS);
+  if (!failed)
+    {
+      gpu->kernel = clCreateKernel (gpu_program, "vanity_sweep", &rc);
+      failed = (rc != CL_SUCCESS);
+    }
+  if (!failed)
+    {
+      gpu->blocks = clCreateBuffer (gpu_context, CL_MEM_READ_WRITE,
+                                    16 * VANITY_GPU_MAX_KEYS * sizeof (u32),
+                                    NULL, &rc);
+      gpu->hits = clCreateBuffer (gpu_context, CL_MEM_READ_WRITE,
+                                  sizeof gpu->hitbuf, NULL, &rc);
+      gpu->masks = new_buffer (filter->masks, filter->nmasks);
+      gpu->starts = new_buffer (filter->starts, filter->nmasks + 1);
+      gpu->values = new_buffer (filter->values, filter->nvalues);
+      gpu->bitmap = new_buffer (filter->bitmap, filter->bitmap_words);
+      failed = (!gpu->blocks || !gpu->hits || !gpu->masks || !gpu->starts
+                || !gpu->values || !gpu->bitmap);
+    }
+  if (!failed)
+    {
+      /* Arguments 1 and 2 are set for each call.  */
+      rc  = clSetKernelArg (gpu->kernel, 0, sizeof (cl_mem), &gpu->blocks);
+      val = filter->nmasks;
+      rc |= clSetKernelArg (gpu->kernel, 3, sizeof val, &val);
+      rc |= clSetKernelArg (gpu->kernel, 4, sizeof (cl_mem), &gpu->masks);
+      rc |= clSetKernelArg (gpu->kernel, 5, sizeof (cl_mem), &gpu->starts);
+      rc |= clSetKernelArg (gpu->kernel, 6, sizeof (cl_mem), &gpu->values);
+      val = filter->bitmap_shift;
+      rc |= clSetKernelArg (gpu->kernel, 7, sizeof val, &val);
+      val = filter->bitmap_words;
+      rc |= clSetKernelArg (gpu->kernel, 8, sizeof val, &val);
+      rc |= clSetKernelArg (gpu->kernel, 9, sizeof (cl_mem), &gpu->bitmap);
+      rc |= clSetKernelArg (gpu->kernel, 10, sizeof (cl_mem), &gpu->hits);
+      val = VANITY_GPU_MAX_HITS;
+      rc |= clSetKernelArg (gpu->kernel, 11, sizeof val, &val);
+      failed = (rc != CL_SUCCESS);
+    }
+  if (failed)
+    {
+      _vanity_gpu_release (gpu);
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+
+  *r_gpu = gpu;
+  return 0;
+}
+
+
+void
+_vanity_gpu_release (vanity_gpu_t gpu)
+{
+  if (!gpu)
+    return;
+  if (gpu->blocks)
+    clReleaseMemObject (gpu->blocks);
+  if (gpu->masks)
+    clReleaseMemObject (gpu->masks);
+  if (gpu->starts)
+    clReleaseMemObject (gpu->starts);
+  if (gpu->values)
+    clReleaseMemObject (gpu->values);
+  if (gpu->bitmap)
+    clReleaseMemObject (gpu->bitmap);
+  if (gpu->hits)
+    clReleaseMemObject (gpu->hits);
+  if (gpu->kernel)
+    clReleaseKernel (gpu->kernel);
+  if (gpu->master)
+    clReleaseMemObject (gpu->master);
+  if (gpu->table)
+    clReleaseMemObject (gpu->table);
+  if (gpu->tmpl)
+    clReleaseMemObject (gpu->tmpl);
+  if (gpu->keygen)
+    clReleaseKernel (gpu->keygen);
+  if (gpu->queue)
+    clReleaseCommandQueue (gpu->queue);
+  xfree (gpu);
+}
+
+
+/* Hash the NKEYS SHA-1 blocks at BLOCKS, as returned by
+   _vanity_refkey_block, or if BLOCKS is NULL those of the keys
+   generated by the last call to _vanity_gpu_keygen, for the COUNT
+   timestamps starting at START
+   and store the candidates passing the filter at HITS, which must
+   provide space for VANITY_GPU_MAX_HITS items.  Their number is
+   stored at R_NHITS; if it is larger than VANITY_GPU_MAX_HITS, only
+   an arbitrary part of them was stored and the call should be
+   repeated with fewer timestamps.  NKEYS may not be larger than
+   VANITY_GPU_MAX_KEYS and COUNT not larger than 2^31.  The order of
+   the candidates is undefined.  Called without holding the npth
+   lock.  */
+gpg_error_t
+_vanity_gpu_sweep (vanity_gpu_t gpu, const u32 *blocks, unsigned int nkeys,
+                   u32 start, u32 count, struct vanity_gpu_hit_s *hits,
+                   unsigned int *r_nhits)
+{
+  static const u32 zero;
+  size_t global[2];
+  cl_int rc;
+  unsigned int i, n;
+
+  *r_nhits = 0;
+  if (!nkeys || !count)
+    return 0;
+  if (nkeys > VANITY_GPU_MAX_KEYS || count > 0x80000000)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  rc = CL_SUCCESS;
+  if (blocks)
+    rc = clEnqueueWriteBuffer (gpu->queue, gpu->blocks, CL_FALSE, 0,
+                               16 * nkeys * sizeof (u32), blocks,
+                               0, NULL, NULL);
+  rc |= clEnqueueWriteBuffer (gpu->queue, gpu->hits, CL_FALSE, 0,
+                              sizeof zero, &zero, 0, NULL, NULL);
+  rc |= clSetKernelArg (gpu->kernel, 1, sizeof start, &start);
+  rc |= clSetKernelArg (gpu->kernel, 2, sizeof count, &count);
+  global[0] = (count + PER_ITEM - 1) / PER_ITEM;
+  global[1] = nkeys;
+  rc |= clEnqueueNDRangeKernel (gpu->queue, gpu->kernel, 2, NULL, global,
+                                NULL, 0, NULL, NULL);
+  rc |= clEnqueueReadBuffer (gpu->queue, gpu->hits, CL_TRUE, 0,
+                             sizeof gpu->hitbuf, gpu->hitbuf, 0, NULL, NULL);
+  if (rc != CL_SUCCESS)
+    return gpg_error (GPG_ERR_GENERAL);
+
+  n = gpu->hitbuf[0] < VANITY_GPU_MAX_HITS? gpu->hitbuf[0]
+                                          : VANITY_GPU_MAX_HITS;
+  for (i=0; i < n; i++)
+    {
+      hits[i].key = gpu->hitbuf[1 + 3 * i];
+      hits[i].timestamp = gpu->hitbuf[2 + 3 * i];
+      hits[i].keyid = gpu->hitbuf[3 + 3 * i];
+      if (hits[i].key >= nkeys)
+        return gpg_error (GPG_ERR_INTERNAL);
+    }
+  *r_nhits = gpu->hitbuf[0];
+  return 0;
+}
+
+
+/* Check the key generation kernel of GPU against
+   _vanity_ed25519_keys for a few keys.  Returns true if it works
+   correctly.  */
+static int
+selftest_keygen (vanity_gpu_t gpu)
+{
+  enum { NKEYS = 4, QOFF = 22 };
+  static const u32 tmpl[16];
+  unsigned char master[32], seed[32], q[32];
+  u32 blocks[16 * NKEYS], expect[16];
+  unsigned int i, k, pos;
+  int ok = 1;
+
+  for (i=0; i < sizeof master; i++)
+    master[i] = i;
+  if (_vanity_gpu_keygen (gpu, master, tmpl, QOFF, NKEYS)
+      || clEnqueueReadBuffer (gpu->queue, gpu->blocks, CL_TRUE, 0,
+                              sizeof blocks, blocks, 0, NULL, NULL)
+         != CL_SUCCESS)
+    return 0;
+  for (k=0; ok && k < NKEYS; k++)
+    {
+      _vanity_gpu_seed (master, k, seed);
+      _vanity_ed25519_keys (seed, 1, q);
+      memset (expect, 0, sizeof expect);
+      for (i=0; i < 32; i++)
+        {
+          pos = QOFF + i;
+          expect[pos / 4] |= (u32)q[i] << (24 - 8 * (pos % 4));
+        }
+      ok = !memcmp (blocks + 16 * k, expect, sizeof expect);
+    }
+  return ok;
+}
+
+
+/* Prepare GPU to generate Ed25519 keys with _vanity_gpu_keygen.  The
+   kernel is checked against the CPU on the first call.  Returns
+   GPG_ERR_NOT_SUPPORTED if the device can't generate the keys.
+   Called without holding the npth lock.  */
+gpg_error_t
+_vanity_gpu_keygen_setup (vanity_gpu_t gpu)
+{
+  const u32 *table = _vanity_ed25519_table ();
+  cl_int rc;
+  int failed;
+
+  if (keygen_state < 0 || !table)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  gpu->keygen = clCreateKernel (gpu_program, "vanity_keygen", &rc);
+  failed = (rc != CL_SUCCESS);
+  if (!failed)
+    {
+      gpu->master = clCreateBuffer (gpu_context, CL_MEM_READ_ONLY,
+                                    4 * sizeof (cl_ulong), NULL, &rc);
+      gpu->tmpl = clCreateBuffer (gpu_context, CL_MEM_READ_ONLY,
+                                  16 * sizeof (u32), NULL, &rc);
+      gpu->table = new_buffer (table, VANITY_ED25519_TABLE_WORDS);
+      failed = (!gpu->master || !gpu->tmpl || !gpu->table);
+    }
+  if (!failed)
+    {
+      /* Argument 3 is set for each call.  */
+      rc  = clSetKernelArg (gpu->keygen, 0, sizeof (cl_mem), &gpu->master);
+      rc |= clSetKernelArg (gpu->keygen, 1, sizeof (cl_mem), &gpu->table);
+      rc |= clSetKernelArg (gpu->keygen, 2, sizeof (cl_mem), &gpu->tmpl);
+      rc |= clSetKernelArg (gpu->keygen, 4, sizeof (cl_mem), &gpu->blocks);
+      failed = (rc != CL_SUCCESS);
+    }
+  if (failed)
+    return gpg_error (GPG_ERR_GENERAL);
+
+  if (!keygen_state)
+    {
+      keygen_state = selftest_keygen (gpu)? 1 : -1;
+      if (keygen_state < 0)
+        {
+          npth_protect ();
+          log_info ("OpenCL device %s failed the key generation self-test\n",
+                    gpu_name);
+          npth_unprotect ();
+        }
+    }
+  return keygen_state > 0? 0 : gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+
+/* Generate NKEYS Ed25519 keys from the 32 byte secret MASTER on GPU
+   and store their SHA-1 blocks, which are the 16 words at TMPL with
+   the public key ORed in at byte QOFF, for the next calls to
+   _vanity_gpu_sweep.  The seed of key I is returned by
+   _vanity_gpu_seed.  NKEYS may not be larger than
+   VANITY_GPU_MAX_KEYS.  Called without holding the npth lock.  */
+gpg_error_t
+_vanity_gpu_keygen (vanity_gpu_t gpu, const unsigned char *master,
+                    const u32 *tmpl, unsigned int qoff, unsigned int nkeys)
+{
+  cl_ulong words[4];
+  size_t global;
+  cl_uint val = qoff;
+  cl_int rc;
+  unsigned int i;
+
+  if (!gpu->keygen)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (!nkeys || nkeys > VANITY_GPU_MAX_KEYS || qoff + 32 > 55)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  for (i=0; i < DIM (words); i++)
+    words[i] = (((cl_ulong)buf32_to_u32 (master + 8 * i) << 32)
+                | buf32_to_u32 (master + 8 * i + 4));
+  rc  = clEnqueueWriteBuffer (gpu->queue, gpu->master, CL_TRUE, 0,
+                              sizeof words, words, 0, NULL, NULL);
+  wipememory (words, sizeof words);
+  rc |= clEnqueueWriteBuffer (gpu->queue, gpu->tmpl, CL_FALSE, 0,
+                              16 * sizeof (u32), tmpl, 0, NULL, NULL);
+  rc |= clSetKernelArg (gpu->keygen, 3, sizeof val, &val);
+  global = nkeys;
+  rc |= clEnqueueNDRangeKernel (gpu->queue, gpu->keygen, 1, NULL, &global,
+                                NULL, 0, NULL, NULL);
+  rc |= clFinish (gpu->queue);
+  return rc == CL_SUCCESS? 0 : gpg_error (GPG_ERR_GENERAL);
+}
+
+
+#else /*!USE_VANITY_OPENCL*/
+
+int
+_vanity_gpu_init (void)
+{
+  return 0;
+}
+
+const char *
+_vanity_gpu_name (void)
+{
+  return "none";
+}
+
+gpg_error_t
+_vanity_gpu_new (vanity_gpu_t *r_gpu, const struct vanity_filter_s *filter)
+{
+  (void)filter;
+  *r_gpu = NULL;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+void
+_vanity_gpu_release (vanity_gpu_t gpu)
+{
+  (void)gpu;
+}
+
+gpg_error_t
+_vanity_gpu_sweep (vanity_gpu_t gpu, const u32 *blocks, unsigned int nkeys,
+                   u32 start, u32 count, struct vanity_gpu_hit_s *hits,
+                   unsigned int *r_nhits)
+{
+  (void)gpu;
+  (void)blocks;
+  (void)nkeys;
+  (void)start;
+  (void)count;
+  (void)hits;
+  *r_nhits = 0;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+gpg_error_t
+_vanity_gpu_keygen_setup (vanity_gpu_t gpu)
+{
+  (void)gpu;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+gpg_error_t
+_vanity_gpu_keygen (vanity_gpu_t gpu, const unsigned char *master,
+                    const u32 *tmpl, unsigned int qoff, unsigned int nkeys)
+{
+  (void)gpu;
+  (void)master;
+  (void)tmpl;
+  (void)qoff;
+  (void)nkeys;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+}
+
+#endif /*!USE_VANITY_OPENCL*/
+
+
+/* Store the seed of key number KEY generated by _vanity_gpu_keygen
+   from MASTER at SEED: the first 32 bytes of the SHA-512 hash of
+   the 32 bytes of MASTER followed by KEY as a big endian 32 bit
+   word.  */
+void
+_vanity_gpu_seed (const unsigned char *master, unsigned int key,
+                  unsigned char *seed)
+{
+  unsigned char buf[36], hash[64];
+
+  memcpy (buf, master, 32);
+  buf[32] = key >> 24;
+  buf[33] = key >> 16;
+  buf[34] = key >>  8;
+  buf[35] = key;
+  gcry_md_hash_buffer (GCRY_MD_SHA512, hash, buf, sizeof buf);
+  memcpy (seed, hash, 32);
+  wipememory (buf, sizeof buf);
+  wipememory (hash, sizeof hash);
+}
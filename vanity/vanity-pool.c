@@ -0,0 +1,434 @@
+/* vanity-pool.c - A file of stored candidate keys for the vanity search
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Generating a key costs far more than computing its fingerprint for
+   one creation time, and any key can be swept for any pattern.  A
+   pool file keeps the batches of keys generated by the searches so
+   that a later search for another pattern or window sweeps them
+   again with only the hashing cost.
+
+   The file is a header of POOL_HEADER_LEN bytes followed by records
+   of equal size, one for each batch of keys:
+
+     NKEYS points Q of QLEN bytes each, in the clear;
+     the SECLEN bytes of the secret of the batch, wrapped with AESWRAP
+     (RFC 3394) under the 256 bit key of the pool: the seeds of
+     Ed25519 keys or the scalar D of the first of incremental keys.
+
+   The header gives the type of the batches, their sizes, the curve
+   and a check value, which is 16 zero bytes wrapped under the key.
+   Records are only appended; one cut short by a crash is overwritten
+   by the next.  The only change in place is clearing the Q of a key
+   a search has handed out so that no later search returns it again;
+   the sweep skips such keys.  All numbers are big endian.
+
+   When a search starts the records are mapped read-only and handed
+   to its workers one after the other.  Records added by the search
+   itself are swept by the next one.  The functions must be called
+   with the npth lock held.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+#include "vanity-defs.h"
+#include "../common/host2net.h"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+
+/* The magic at the start of a pool file.  */
+#define POOL_MAGIC "GPGVPOOL"
+
+/* The version of the format.  */
+#define POOL_VERSION 1
+
+/* The length of the header.  */
+#define POOL_HEADER_LEN 80
+
+/* The length of the plaintext of the check value.  */
+#define POOL_CHECK_LEN 16
+
+
+struct vanity_pool_s
+{
+  char *fname;
+  int fd;
+  gcry_cipher_hd_t hd;       /* AESWRAP with the key of the pool.  */
+  unsigned char check[POOL_CHECK_LEN + 8];  /* The expected check value.  */
+  int type;                  /* VANITY_POOL_ED25519 or _ECC or 0.  */
+  unsigned int nkeys;        /* The keys of each record.  */
+  size_t qlen;               /* The length of each Q.  */
+  size_t seclen;             /* The length of the unwrapped secret.  */
+  size_t reclen;             /* The length of a record.  */
+  unsigned char oid[VANITY_MAX_OIDLEN];
+  size_t oidlen;
+  unsigned long long nrecords;  /* The complete records in the file.  */
+  const unsigned char *map;  /* The records mapped for a search.  */
+  size_t maplen;
+  unsigned long long nmapped;   /* The records in MAP.  */
+  unsigned long long next;   /* The next mapped record to hand out.  */
+};
+
+
+/* Write LENGTH bytes from BUFFER at OFFSET of the file of POOL.  */
+static gpg_error_t
+write_at (vanity_pool_t pool, off_t offset, const void *buffer, size_t length)
+{
+  const char *p = buffer;
+  ssize_t n;
+
+  if (lseek (pool->fd, offset, SEEK_SET) == (off_t)-1)
+    return gpg_error_from_syserror ();
+  while (length)
+    {
+      n = write (pool->fd, p, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return gpg_error_from_syserror ();
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/* Read LENGTH bytes at OFFSET of the file of POOL into BUFFER.
+   Returns GPG_ERR_EOF if the file is shorter.  */
+static gpg_error_t
+read_at (vanity_pool_t pool, off_t offset, void *buffer, size_t length)
+{
+  char *p = buffer;
+  ssize_t n;
+
+  if (lseek (pool->fd, offset, SEEK_SET) == (off_t)-1)
+    return gpg_error_from_syserror ();
+  while (length)
+    {
+      n = read (pool->fd, p, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return gpg_error_from_syserror ();
+      if (!n)
+        return gpg_error (GPG_ERR_EOF);
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/* Open the pool file FNAME, creating it if it does not exist, with
+   the VANITY_POOL_KEYLEN bytes KEY protecting the secrets.  Returns
+   GPG_ERR_BAD_SECKEY if the file was written with another key.  The
+   type of the keys is fixed by the first search using the pool.  */
+gpg_error_t
+vanity_pool_open (vanity_pool_t *r_pool, const char *fname,
+                  const unsigned char *key)
+{
+  gpg_error_t err;
+  vanity_pool_t pool;
+  unsigned char hdr[POOL_HEADER_LEN];
+  unsigned char zero[POOL_CHECK_LEN];
+  struct stat st;
+
+  *r_pool = NULL;
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  pool->fd = -1;
+  pool->fname = xtrystrdup (fname);
+  if (!pool->fname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  err = gcry_cipher_open (&pool->hd, GCRY_CIPHER_AES256,
+                          GCRY_CIPHER_MODE_AESWRAP, GCRY_CIPHER_SECURE);
+  if (!err)
+    err = gcry_cipher_setkey (pool->hd, key, VANITY_POOL_KEYLEN);
+  if (!err)
+    {
+      memset (zero, 0, sizeof zero);
+      err = gcry_cipher_encrypt (pool->hd, pool->check, sizeof pool->check,
+                                 zero, sizeof zero);
+    }
+  if (err)
+    goto leave;
+
+  pool->fd = open (fname, O_RDWR | O_CREAT | O_BINARY, S_IRUSR | S_IWUSR);
+  if (pool->fd == -1 || fstat (pool->fd, &st))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("can't open '%s': %s\n", fname, gpg_strerror (err));
+      goto leave;
+    }
+  if (!st.st_size)
+    goto leave;  /* A new pool.  */
+
+  err = read_at (pool, 0, hdr, sizeof hdr);
+  if (!err && (memcmp (hdr, POOL_MAGIC, 8)
+               || buf32_to_uint (hdr + 8) != POOL_VERSION))
+    err = gpg_error (GPG_ERR_INV_KEYRING);
+  if (err)
+    {
+      log_error ("'%s' is not a vanity key pool\n", fname);
+      goto leave;
+    }
+  pool->type = buf32_to_uint (hdr + 12);
+  pool->nkeys = buf32_to_uint (hdr + 16);
+  pool->qlen = buf32_to_uint (hdr + 20);
+  pool->seclen = buf32_to_uint (hdr + 24);
+  pool->oidlen = buf32_to_uint (hdr + 28);
+  if ((pool->type != VANITY_POOL_ED25519 && pool->type != VANITY_POOL_ECC)
+      || !pool->nkeys || pool->nkeys > VANITY_ECC_BATCH
+      || !pool->qlen || pool->qlen > VANITY_MAX_QLEN
+      || !pool->seclen || (pool->seclen % 8)
+      || pool->seclen > 32 * VANITY_ED25519_BATCH
+      || pool->oidlen > VANITY_MAX_OIDLEN)
+    {
+      err = gpg_error (GPG_ERR_INV_KEYRING);
+      log_error ("invalid header in vanity key pool '%s'\n", fname);
+      goto leave;
+    }
+  memcpy (pool->oid, hdr + 32, pool->oidlen);
+  if (memcmp (hdr + 48, pool->check, sizeof pool->check))
+    {
+      err = gpg_error (GPG_ERR_BAD_SECKEY);
+      log_error ("vanity key pool '%s' has been written with another key\n",
+                 fname);
+      goto leave;
+    }
+  pool->reclen = pool->nkeys * pool->qlen + pool->seclen + 8;
+  pool->nrecords = (st.st_size - POOL_HEADER_LEN) / pool->reclen;
+
+ leave:
+  if (err)
+    vanity_pool_close (pool);
+  else
+    *r_pool = pool;
+  return err;
+}
+
+
+/* Release the mapping of the records of POOL.  */
+static void
+unmap_records (vanity_pool_t pool)
+{
+#ifdef HAVE_MMAP
+  if (pool->map)
+    munmap ((void *)pool->map, pool->maplen);
+#endif
+  pool->map = NULL;
+  pool->maplen = 0;
+  pool->nmapped = 0;
+  pool->next = 0;
+}
+
+
+void
+vanity_pool_close (vanity_pool_t pool)
+{
+  if (!pool)
+    return;
+  unmap_records (pool);
+  if (pool->fd != -1)
+    close (pool->fd);
+  gcry_cipher_close (pool->hd);
+  xfree (pool->fname);
+  xfree (pool);
+}
+
+
+/* Return the number of keys stored in POOL, including those already
+   handed out.  */
+unsigned long long
+vanity_pool_count (vanity_pool_t pool)
+{
+  return pool->nrecords * pool->nkeys;
+}
+
+
+/* Prepare POOL for a search generating keys of TYPE in batches of
+   NKEYS points of QLEN bytes with secrets of SECLEN bytes, a multiple
+   of 8, on the curve OID.  A new pool gets its header now.  Returns
+   GPG_ERR_WRONG_PUBKEY_ALGO if the pool holds other keys.  The
+   records stored so far are mapped to be handed out by
+   _vanity_pool_next.  */
+gpg_error_t
+_vanity_pool_bind (vanity_pool_t pool, int type, unsigned int nkeys,
+                   size_t qlen, size_t seclen,
+                   const unsigned char *oid, size_t oidlen)
+{
+  gpg_error_t err;
+  unsigned char hdr[POOL_HEADER_LEN];
+
+  unmap_records (pool);
+  if (!pool->type)
+    {
+      memset (hdr, 0, sizeof hdr);
+      memcpy (hdr, POOL_MAGIC, 8);
+      ulongtobuf (hdr + 8, POOL_VERSION);
+      ulongtobuf (hdr + 12, type);
+      ulongtobuf (hdr + 16, nkeys);
+      ulongtobuf (hdr + 20, qlen);
+      ulongtobuf (hdr + 24, seclen);
+      ulongtobuf (hdr + 28, oidlen);
+      memcpy (hdr + 32, oid, oidlen);
+      memcpy (hdr + 48, pool->check, sizeof pool->check);
+      err = write_at (pool, 0, hdr, sizeof hdr);
+      if (err)
+        {
+          log_error ("error writing '%s': %s\n",
+                     pool->fname, gpg_strerror (err));
+          return err;
+        }
+      pool->type = type;
+      pool->nkeys = nkeys;
+      pool->qlen = qlen;
+      pool->seclen = seclen;
+      pool->oidlen = oidlen;
+      memcpy (pool->oid, oid, oidlen);
+      pool->reclen = nkeys * qlen + seclen + 8;
+      pool->nrecords = 0;
+      return 0;
+    }
+
+  if (pool->type != type || pool->nkeys != nkeys || pool->qlen != qlen
+      || pool->seclen != seclen || pool->oidlen != oidlen
+      || memcmp (pool->oid, oid, oidlen))
+    return gpg_error (GPG_ERR_WRONG_PUBKEY_ALGO);
+  if (!pool->nrecords)
+    return 0;
+
+#ifdef HAVE_MMAP
+  {
+    void *p;
+
+    pool->maplen = POOL_HEADER_LEN + pool->nrecords * pool->reclen;
+    p = mmap (NULL, pool->maplen, PROT_READ, MAP_SHARED, pool->fd, 0);
+    if (p == MAP_FAILED)
+      {
+        err = gpg_error_from_syserror ();
+        log_error ("can't map '%s': %s\n", pool->fname, gpg_strerror (err));
+        pool->maplen = 0;
+        return err;
+      }
+    pool->map = p;
+  }
+#endif
+  pool->nmapped = pool->nrecords;
+  return 0;
+}
+
+
+/* Hand out the next record of POOL not yet swept by this search.
+   Its points are stored at Q and its unwrapped secret at SECRET,
+   which should be in secure memory; the index of the record is stored
+   at R_RECORD.  Returns GPG_ERR_EOF when all records have been
+   handed out.  */
+gpg_error_t
+_vanity_pool_next (vanity_pool_t pool, unsigned char *q,
+                   unsigned char *secret, unsigned long long *r_record)
+{
+  gpg_error_t err;
+  unsigned char wrapped[32 * VANITY_ED25519_BATCH + 8];
+  const unsigned char *rec;
+  size_t qbytes = pool->nkeys * pool->qlen;
+
+  if (pool->next >= pool->nmapped)
+    return gpg_error (GPG_ERR_EOF);
+  *r_record = pool->next++;
+
+  if (pool->map)
+    {
+      rec = pool->map + POOL_HEADER_LEN + *r_record * pool->reclen;
+      memcpy (q, rec, qbytes);
+      memcpy (wrapped, rec + qbytes, pool->seclen + 8);
+    }
+  else
+    {
+      err = read_at (pool, POOL_HEADER_LEN + *r_record * pool->reclen,
+                     q, qbytes);
+      if (!err)
+        err = read_at (pool, POOL_HEADER_LEN + *r_record * pool->reclen
+                       + qbytes, wrapped, pool->seclen + 8);
+      if (err)
+        return err;
+    }
+  err = gcry_cipher_decrypt (pool->hd, secret, pool->seclen,
+                             wrapped, pool->seclen + 8);
+  if (err)
+    log_error ("error unwrapping record %llu of '%s': %s\n",
+               *r_record, pool->fname, gpg_strerror (err));
+  return err;
+}
+
+
+/* Append a record with the points Q and the secret SECRET to POOL and
+   store its index at R_RECORD.  */
+gpg_error_t
+_vanity_pool_add (vanity_pool_t pool, const unsigned char *q,
+                  const unsigned char *secret, unsigned long long *r_record)
+{
+  gpg_error_t err;
+  unsigned char wrapped[32 * VANITY_ED25519_BATCH + 8];
+  size_t qbytes = pool->nkeys * pool->qlen;
+  off_t offset = POOL_HEADER_LEN + pool->nrecords * pool->reclen;
+
+  err = gcry_cipher_encrypt (pool->hd, wrapped, pool->seclen + 8,
+                             secret, pool->seclen);
+  if (!err)
+    err = write_at (pool, offset, q, qbytes);
+  if (!err)
+    err = write_at (pool, offset + qbytes, wrapped, pool->seclen + 8);
+  wipememory (wrapped, sizeof wrapped);
+  if (err)
+    return err;
+  *r_record = pool->nrecords++;
+  return 0;
+}
+
+
+/* Clear the point of key IDX of record RECORD of POOL, so that it is
+   no longer swept.  */
+gpg_error_t
+_vanity_pool_drop (vanity_pool_t pool, unsigned long long record,
+                   unsigned int idx)
+{
+  unsigned char zero[VANITY_MAX_QLEN];
+
+  memset (zero, 0, pool->qlen);
+  return write_at (pool, (POOL_HEADER_LEN + record * pool->reclen
+                          + idx * pool->qlen), zero, pool->qlen);
+}
@@ -0,0 +1,359 @@
+/* vanity-power.c - Energy and temperature of long vanity searches
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A search may run for days on a shared machine.  The governor lets
+   the operator limit the share of the CPU time the hash workers take
+   (their duty cycle) and the number of hash workers running, by the
+   hour of the day, and lowers the duty cycle while the hottest
+   thermal zone is above a limit.
+
+   The sensors are read from the sysfs of Linux: the energy counters
+   of the RAPL packages in the powercap class, which wrap at
+   max_energy_range_uj, and the thermal zones.  On other systems, and
+   where the energy counters are readable only by root, the numbers
+   are just not available.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vanity-defs.h"
+
+
+/* The most RAPL packages and thermal zones looked at.  */
+#define MAX_PACKAGES 16
+#define MAX_ZONES    64
+
+/* The thermal duty cycle changes by this many points per step and
+   recovers once the temperature is this many degrees below the
+   limit.  */
+#define THERMAL_STEP       10
+#define THERMAL_HYSTERESIS 5
+
+/* The lowest thermal duty cycle.  */
+#define THERMAL_MIN_DUTY   10
+
+
+struct vanity_power_s
+{
+  unsigned int npackages;
+  struct
+  {
+    char *fname;                  /* Its energy_uj file.  */
+    unsigned long long range;     /* The counter wraps here or 0.  */
+    unsigned long long last;      /* The last reading.  */
+  } package[MAX_PACKAGES];
+  unsigned long long microjoules; /* Consumed since the object was made.  */
+  unsigned int nzones;
+  char *zone[MAX_ZONES];          /* The temp files of the zones.  */
+};
+
+
+/* Read the decimal number in the sysfs file FNAME into R_VALUE.
+   Returns false if the file can't be read or is malformed.  */
+static int
+read_ull (const char *fname, unsigned long long *r_value)
+{
+  FILE *fp;
+  char line[32];
+  char *endp;
+
+  fp = fopen (fname, "r");
+  if (!fp)
+    return 0;
+  if (!fgets (line, sizeof line, fp))
+    {
+      fclose (fp);
+      return 0;
+    }
+  fclose (fp);
+  *r_value = strtoull (line, &endp, 10);
+  return endp != line;
+}
+
+
+/* Look for the sensors below the sysfs directory SYSFS, usually
+   "/sys", and store an object for reading them at R_POWER.  It is
+   not an error if there are none.  */
+gpg_error_t
+_vanity_power_new (vanity_power_t *r_power, const char *sysfs)
+{
+  gpg_error_t err;
+  vanity_power_t power;
+  unsigned long long value;
+  char fname[256];
+  unsigned int i, n;
+
+  *r_power = NULL;
+  if (!sysfs)
+    sysfs = "/sys";
+  power = xtrycalloc (1, sizeof *power);
+  if (!power)
+    return gpg_error_from_syserror ();
+
+  /* Only the packages; their subdomains "intel-rapl:I:J" are parts
+     of them.  */
+  for (i=0; i < MAX_PACKAGES; i++)
+    {
+      snprintf (fname, sizeof fname,
+                "%s/class/powercap/intel-rapl:%u/energy_uj", sysfs, i);
+      if (!read_ull (fname, &value))
+        continue;
+      n = power->npackages;
+      power->package[n].fname = xtrystrdup (fname);
+      if (!power->package[n].fname)
+        goto nomem;
+      power->package[n].last = value;
+      snprintf (fname, sizeof fname,
+                "%s/class/powercap/intel-rapl:%u/max_energy_range_uj",
+                sysfs, i);
+      if (!read_ull (fname, &power->package[n].range))
+        power->package[n].range = 0;
+      power->npackages++;
+    }
+
+  for (i=0; i < MAX_ZONES; i++)
+    {
+      snprintf (fname, sizeof fname,
+                "%s/class/thermal/thermal_zone%u/temp", sysfs, i);
+      if (!read_ull (fname, &value))
+        continue;
+      power->zone[power->nzones] = xtrystrdup (fname);
+      if (!power->zone[power->nzones])
+        goto nomem;
+      power->nzones++;
+    }
+
+  *r_power = power;
+  return 0;
+
+ nomem:
+  err = gpg_error_from_syserror ();
+  _vanity_power_release (power);
+  return err;
+}
+
+
+void
+_vanity_power_release (vanity_power_t power)
+{
+  unsigned int i;
+
+  if (!power)
+    return;
+  for (i=0; i < power->npackages; i++)
+    xfree (power->package[i].fname);
+  for (i=0; i < power->nzones; i++)
+    xfree (power->zone[i]);
+  xfree (power);
+}
+
+
+/* Store the energy in joules consumed by all packages since POWER was
+   created at R_JOULES.  Returns false if there are no energy
+   counters.  Must be called often enough that no counter wraps twice
+   between two calls, which takes minutes even for large servers.  */
+int
+_vanity_power_energy (vanity_power_t power, double *r_joules)
+{
+  unsigned long long value;
+  unsigned int i;
+
+  *r_joules = 0;
+  if (!power || !power->npackages)
+    return 0;
+  for (i=0; i < power->npackages; i++)
+    {
+      if (!read_ull (power->package[i].fname, &value))
+        continue;
+      if (value >= power->package[i].last)
+        power->microjoules += value - power->package[i].last;
+      else if (power->package[i].range > power->package[i].last)
+        power->microjoules += (power->package[i].range
+                               - power->package[i].last + value);
+      power->package[i].last = value;
+    }
+  *r_joules = power->microjoules / 1e6;
+  return 1;
+}
+
+
+/* Store the temperature of the hottest thermal zone in degrees
+   Celsius at R_CELSIUS.  Returns false if there is none.  */
+int
+_vanity_power_temperature (vanity_power_t power, int *r_celsius)
+{
+  unsigned long long value, hottest = 0;
+  unsigned int i;
+  int found = 0;
+
+  *r_celsius = 0;
+  if (!power)
+    return 0;
+  for (i=0; i < power->nzones; i++)
+    if (read_ull (power->zone[i], &value))
+      {
+        if (!found || value > hottest)
+          hottest = value;
+        found = 1;
+      }
+  if (found)
+    *r_celsius = (int)(hottest / 1000);
+  return found;
+}
+
+
+/* Parse the schedule STRING into GOV.  It is a list of rules
+   separated by commas, each of them an optional range of hours
+   "H-H=" followed by one or two limits separated by a slash: "N%"
+   for the duty cycle and "N" for the number of hash workers.  The
+   range includes its first hour and excludes its last one, and it may
+   wrap past midnight; a rule without one applies all day.  For
+   example "8-18=50%/4,18-8=25%" limits the search to 4 workers at
+   half duty during office hours and to a quarter of the time
+   otherwise.  The tightest limit of all matching rules wins.  */
+gpg_error_t
+_vanity_governor_parse (struct vanity_governor_s *gov, const char *string)
+{
+  struct vanity_rule_s *rule;
+  const char *s = string;
+  char *endp;
+  unsigned long a, b;
+  int nlimits;
+
+  gov->nrules = 0;
+  while (*s)
+    {
+      while (*s == ' ' || *s == ',')
+        s++;
+      if (!*s)
+        break;
+      if (gov->nrules == VANITY_MAX_RULES)
+        return gpg_error (GPG_ERR_TOO_LARGE);
+      rule = gov->rules + gov->nrules;
+      memset (rule, 0, sizeof *rule);
+
+      a = strtoul (s, &endp, 10);
+      if (endp == s)
+        return gpg_error (GPG_ERR_INV_VALUE);
+      if (*endp == '-')
+        {
+          s = endp + 1;
+          b = strtoul (s, &endp, 10);
+          if (endp == s || *endp != '=' || a > 24 || b > 24)
+            return gpg_error (GPG_ERR_INV_VALUE);
+          rule->start = a % 24;
+          rule->end = b % 24;
+          rule->hours = 1;
+          s = endp + 1;
+        }
+
+      for (nlimits=0; ; nlimits++)
+        {
+          a = strtoul (s, &endp, 10);
+          if (endp == s)
+            return gpg_error (GPG_ERR_INV_VALUE);
+          if (*endp == '%')
+            {
+              if (!a || a > 100 || rule->duty)
+                return gpg_error (GPG_ERR_INV_VALUE);
+              rule->duty = a;
+              endp++;
+            }
+          else
+            {
+              if (!a || a > 100000 || rule->workers)
+                return gpg_error (GPG_ERR_INV_VALUE);
+              rule->workers = a;
+            }
+          s = endp;
+          if (*s != '/' || nlimits)
+            break;
+          s++;
+        }
+      if (*s && *s != ',' && *s != ' ')
+        return gpg_error (GPG_ERR_INV_VALUE);
+      gov->nrules++;
+    }
+  return 0;
+}
+
+
+/* Store the limits of GOV at the hour HOUR of the day at R_DUTY, a
+   percentage, and at R_WORKERS, 0 for no limit.  The thermal duty
+   cycle is included.  */
+void
+_vanity_governor_limits (const struct vanity_governor_s *gov, int hour,
+                         unsigned int *r_duty, unsigned int *r_workers)
+{
+  const struct vanity_rule_s *rule;
+  unsigned int i;
+  int inside;
+
+  *r_duty = gov->thermal_duty? gov->thermal_duty : 100;
+  *r_workers = 0;
+  for (i=0; i < gov->nrules; i++)
+    {
+      rule = gov->rules + i;
+      if (!rule->hours || rule->start == rule->end)
+        inside = 1;
+      else if (rule->start < rule->end)
+        inside = (hour >= rule->start && hour < rule->end);
+      else
+        inside = (hour >= rule->start || hour < rule->end);
+      if (!inside)
+        continue;
+      if (rule->duty && rule->duty < *r_duty)
+        *r_duty = rule->duty;
+      if (rule->workers && (!*r_workers || rule->workers < *r_workers))
+        *r_workers = rule->workers;
+    }
+}
+
+
+/* Adjust the thermal duty cycle of GOV to the temperature CELSIUS:
+   one step down while it is above the limit, one step up once it is
+   clearly below.  */
+void
+_vanity_governor_thermal (struct vanity_governor_s *gov, int celsius)
+{
+  if (!gov->temp_limit)
+    {
+      gov->thermal_duty = 100;
+      return;
+    }
+  if (!gov->thermal_duty)
+    gov->thermal_duty = 100;
+  if (celsius > gov->temp_limit)
+    {
+      if (gov->thermal_duty > THERMAL_MIN_DUTY + THERMAL_STEP)
+        gov->thermal_duty -= THERMAL_STEP;
+      else
+        gov->thermal_duty = THERMAL_MIN_DUTY;
+    }
+  else if (celsius <= gov->temp_limit - THERMAL_HYSTERESIS)
+    {
+      if (gov->thermal_duty + THERMAL_STEP < 100)
+        gov->thermal_duty += THERMAL_STEP;
+      else
+        gov->thermal_duty = 100;
+    }
+}
@@ -0,0 +1,187 @@
+/* vanity-random.c - Per-thread random streams for the key generation
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The random pool of libgcrypt is protected by a single lock, thus
+   threads generating keys at a high rate mostly wait for each other
+   when they all use gcry_randomize.  Instead each thread gets its own
+   generator, which is seeded from libgcrypt and then produces the
+   secrets without any locking.
+
+   The generator is AES-256 in counter mode with a key in secure
+   memory.  After each request the next 32 bytes of the stream replace
+   the key, so that the secrets already handed out can't be recomputed
+   from the state of the generator.  After every RESEED bytes the key
+   is mixed with fresh random from libgcrypt at the quality level the
+   generator was created with.
+
+   A search may instead derive its Ed25519 seeds deterministically
+   from a stream key, so that a key found is recorded by its position
+   in the stream alone.  Each thread has its own stream; batch COUNTER
+   of a stream has a master secret given by _vanity_stream_master from
+   which the seeds of the batch are derived by _vanity_gpu_seed, as on
+   the OpenCL device.  Anyone knowing the stream key can recompute
+   all of these keys.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+
+/* The length of the key of the generator.  */
+#define RNG_KEYLEN 32
+
+/* About the bytes of the AES handle of libgcrypt.  */
+#define CIPHER_HANDLE_LEN 1024
+
+
+struct vanity_rng_s
+{
+  gcry_cipher_hd_t hd;
+  gcry_random_level_t level;
+  size_t reseed;             /* Bytes to produce between two seeds.  */
+  size_t left;               /* Bytes left until the next seed.  */
+  unsigned char key[RNG_KEYLEN];
+};
+
+
+/* Mix fresh random from libgcrypt into the key of RNG and set it.  */
+static gpg_error_t
+seed_rng (vanity_rng_t rng)
+{
+  unsigned char seed[RNG_KEYLEN];
+  gpg_error_t err;
+  int i;
+
+  gcry_randomize (seed, sizeof seed, rng->level);
+  for (i=0; i < RNG_KEYLEN; i++)
+    rng->key[i] ^= seed[i];
+  wipememory (seed, sizeof seed);
+  err = gcry_cipher_setkey (rng->hd, rng->key, RNG_KEYLEN);
+  if (!err)
+    err = gcry_cipher_setctr (rng->hd, NULL, 0);
+  rng->left = rng->reseed;
+  return err;
+}
+
+
+/* Create a generator seeded with random of quality LEVEL, which is
+   reseeded after producing RESEED bytes; 0 selects
+   VANITY_RESEED_INTERVAL KiB.  */
+gpg_error_t
+_vanity_rng_new (vanity_rng_t *r_rng, gcry_random_level_t level,
+                 size_t reseed)
+{
+  gpg_error_t err;
+  vanity_rng_t rng;
+
+  *r_rng = NULL;
+  rng = xtrycalloc_secure (1, sizeof *rng);
+  if (!rng)
+    return gpg_error_from_syserror ();
+  rng->level = level;
+  rng->reseed = reseed? reseed : VANITY_RESEED_INTERVAL * 1024;
+  err = gcry_cipher_open (&rng->hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_CTR,
+                          GCRY_CIPHER_SECURE);
+  if (!err)
+    err = seed_rng (rng);
+  if (err)
+    {
+      _vanity_rng_release (rng);
+      return err;
+    }
+  *r_rng = rng;
+  return 0;
+}
+
+
+/* Return the bytes of secure memory a generator takes.  */
+size_t
+_vanity_rng_memory (void)
+{
+  return sizeof (struct vanity_rng_s) + CIPHER_HANDLE_LEN;
+}
+
+
+void
+_vanity_rng_release (vanity_rng_t rng)
+{
+  if (!rng)
+    return;
+  gcry_cipher_close (rng->hd);
+  wipememory (rng, sizeof *rng);
+  xfree (rng);
+}
+
+
+/* Fill BUFFER with LENGTH random bytes from RNG.  This does not take
+   any lock unless the generator needs to be reseeded.  */
+gpg_error_t
+_vanity_rng_randomize (vanity_rng_t rng, void *buffer, size_t length)
+{
+  gpg_error_t err;
+
+  if (length >= rng->left)
+    {
+      err = seed_rng (rng);
+      if (err)
+        return err;
+    }
+  rng->left = length < rng->left? rng->left - length : 0;
+
+  memset (buffer, 0, length);
+  err = gcry_cipher_encrypt (rng->hd, buffer, length, NULL, 0);
+  if (!err)
+    {
+      memset (rng->key, 0, RNG_KEYLEN);
+      err = gcry_cipher_encrypt (rng->hd, rng->key, RNG_KEYLEN, NULL, 0);
+    }
+  if (!err)
+    err = gcry_cipher_setkey (rng->hd, rng->key, RNG_KEYLEN);
+  if (!err)
+    err = gcry_cipher_setctr (rng->hd, NULL, 0);
+  if (err)
+    wipememory (buffer, length);
+  return err;
+}
+
+
+/* Store the master secret of batch COUNTER of the key stream STREAM
+   of the stream key KEY, which has VANITY_STREAM_KEYLEN bytes, at
+   MASTER: the first 32 bytes of the SHA-512 hash of KEY, STREAM as a
+   big endian 32 bit word and COUNTER as a big endian 64 bit word.  */
+void
+_vanity_stream_master (const unsigned char *key, unsigned int stream,
+                       unsigned long long counter, unsigned char *master)
+{
+  unsigned char buf[VANITY_STREAM_KEYLEN + 12], hash[64];
+  int i;
+
+  memcpy (buf, key, VANITY_STREAM_KEYLEN);
+  for (i=0; i < 4; i++)
+    buf[VANITY_STREAM_KEYLEN + i] = stream >> (24 - 8 * i);
+  for (i=0; i < 8; i++)
+    buf[VANITY_STREAM_KEYLEN + 4 + i] = counter >> (56 - 8 * i);
+  gcry_md_hash_buffer (GCRY_MD_SHA512, hash, buf, sizeof buf);
+  memcpy (master, hash, 32);
+  wipememory (buf, sizeof buf);
+  wipememory (hash, sizeof hash);
+}
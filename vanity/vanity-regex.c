@@ -0,0 +1,888 @@
+/* vanity-regex.c - Regular expressions over the fingerprint nibbles
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The "re:" items of a pattern are regular expressions matched
+   against the hex digits of the whole fingerprint.  The language is
+   a small subset of the POSIX extended regular expressions over the
+   16 hex digits:
+
+     0-9, A-F       The digit itself, in either case.
+     .              Any digit.
+     [...]          Any of the listed digits and ranges like "0-7";
+                    with a leading '^' any digit not listed.
+     (...)          A group.
+     X|Y            X or Y.
+     X*, X+, X?     Any number of X, at least one, at most one.
+     X{N}, X{N,}, X{N,M}
+                    Exactly N, at least N or N to M times X.
+     ^, $           At the start of the expression it is anchored to
+                    the start of the fingerprint, at its end to the
+                    end.
+
+   Without '^' an expression may match anywhere in the fingerprint;
+   thus "CAFE" is the same as "word:CAFE" and "(CAFE|BEEF).{0,12}$"
+   finds either word within the last 16 digits.
+
+   An expression is compiled with Thompson's construction into an NFA
+   and that with the subset construction into a DFA, a table of 16
+   transitions per state which is run once over the digest words of
+   a candidate.  All states which can't reach an accepting state go
+   to a single dead state, which ends the scan.  Without '$' a match
+   ends it as well: all accepting states are merged into a single
+   state which never leaves.
+
+   Most candidates never get to the DFA.  Walking it over the length
+   of the fingerprint yields the digits allowed at each position of a
+   match; the bits all of them have in common give a value and a mask
+   over the digest words which every matching fingerprint has.  The
+   caller checks those first, as cheaply as a prefix item; for
+   "^0{6}" they are already the whole expression.  The same walk
+   gives the exact chance of a random fingerprint to match.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+
+/* The longest expression.  */
+#define MAX_REGEX_LEN 256
+
+/* The limits of the automata.  */
+#define MAX_NFA_NODES  2048
+#define MAX_DFA_STATES 4096
+
+/* The size of the hash table of the DFA states; a power of 2.  */
+#define STATE_HASH_SIZE (2 * MAX_DFA_STATES)
+
+/* The fixed states of the DFA.  */
+#define STATE_DEAD    0   /* The fingerprint can't match any more.  */
+#define STATE_MATCHED 1   /* It matched; only without '$'.  */
+#define STATE_START   2
+
+
+/* A node of the NFA.  A node with a SET moves on one of its digits
+   to OUT1.  A node without one moves to OUT1 and OUT2, unless they
+   are -1, without taking a digit.  */
+struct nfa_node_s
+{
+  unsigned short set;     /* A bit for each digit or 0.  */
+  short out1;
+  short out2;
+};
+
+/* A part of the NFA under construction.  END is a node without a
+   SET whose OUT1 is still to be connected.  */
+struct frag_s
+{
+  int start;
+  int end;
+};
+
+/* The state of the parser.  */
+struct parser_s
+{
+  const char *s;          /* The next character.  */
+  const char *end;        /* The end of the expression.  */
+  unsigned int maxrep;    /* The highest repetition count.  */
+  struct nfa_node_s *nodes;
+  unsigned int nnodes;
+  gpg_error_t err;
+};
+
+struct vanity_regex_s
+{
+  unsigned int nnibbles;  /* The length of the fingerprints.  */
+  unsigned int nstates;
+  unsigned short *next;   /* 16 transitions for each state.  */
+  unsigned char *accept;  /* The accepting states.  */
+  u32 value[VANITY_MAX_DIGEST_WORDS];   /* The prefilter.  */
+  u32 mask[VANITY_MAX_DIGEST_WORDS];
+  double probability;
+};
+
+
+static void
+set_error (struct parser_s *p)
+{
+  if (!p->err)
+    p->err = gpg_error (GPG_ERR_INV_VALUE);
+}
+
+
+/* Return the next character of the expression or 0 at its end.  */
+static int
+peek (struct parser_s *p)
+{
+  return p->s < p->end? *p->s : 0;
+}
+
+
+/* Return a new NFA node.  If there is no space left the error is
+   set and node 0 is returned.  */
+static int
+new_node (struct parser_s *p, unsigned int set, int out1, int out2)
+{
+  if (p->nnodes == MAX_NFA_NODES)
+    {
+      if (!p->err)
+        p->err = gpg_error (GPG_ERR_TOO_LARGE);
+      return 0;
+    }
+  p->nodes[p->nnodes].set = set;
+  p->nodes[p->nnodes].out1 = out1;
+  p->nodes[p->nnodes].out2 = out2;
+  return p->nnodes++;
+}
+
+
+/* Return a fragment taking one of the digits in SET.  */
+static struct frag_s
+frag_set (struct parser_s *p, unsigned int set)
+{
+  struct frag_s f;
+
+  f.end = new_node (p, 0, -1, -1);
+  f.start = new_node (p, set, f.end, -1);
+  return f;
+}
+
+
+/* Return a fragment taking nothing.  */
+static struct frag_s
+frag_empty (struct parser_s *p)
+{
+  struct frag_s f;
+
+  f.start = f.end = new_node (p, 0, -1, -1);
+  return f;
+}
+
+
+/* Return A followed by B.  */
+static struct frag_s
+frag_cat (struct parser_s *p, struct frag_s a, struct frag_s b)
+{
+  p->nodes[a.end].out1 = b.start;
+  a.end = b.end;
+  return a;
+}
+
+
+/* Return A or B.  */
+static struct frag_s
+frag_alt (struct parser_s *p, struct frag_s a, struct frag_s b)
+{
+  struct frag_s f;
+
+  f.end = new_node (p, 0, -1, -1);
+  f.start = new_node (p, 0, a.start, b.start);
+  p->nodes[a.end].out1 = f.end;
+  p->nodes[b.end].out1 = f.end;
+  return f;
+}
+
+
+/* Return A at most once or, with LOOP, any number of times.  */
+static struct frag_s
+frag_opt (struct parser_s *p, struct frag_s a, int loop)
+{
+  struct frag_s f;
+
+  f.end = new_node (p, 0, -1, -1);
+  f.start = new_node (p, 0, a.start, f.end);
+  p->nodes[a.end].out1 = loop? f.start : f.end;
+  return f;
+}
+
+
+/* Return A at least once.  */
+static struct frag_s
+frag_plus (struct parser_s *p, struct frag_s a)
+{
+  int end, loop;
+
+  end = new_node (p, 0, -1, -1);
+  loop = new_node (p, 0, a.start, end);
+  p->nodes[a.end].out1 = loop;
+  a.end = end;
+  return a;
+}
+
+
+/* Parse the rest of a bracket expression and return its set.  */
+static unsigned int
+parse_class (struct parser_s *p)
+{
+  unsigned int set = 0, a, b;
+  int negate = 0;
+
+  if (peek (p) == '^')
+    {
+      negate = 1;
+      p->s++;
+    }
+  while (p->s < p->end && *p->s != ']')
+    {
+      if (!hexdigitp (p->s))
+        break;
+      a = b = xtoi_1 (p->s);
+      p->s++;
+      if (peek (p) == '-' && p->s + 1 < p->end && p->s[1] != ']')
+        {
+          p->s++;
+          if (!hexdigitp (p->s))
+            break;
+          b = xtoi_1 (p->s);
+          p->s++;
+        }
+      if (b < a)
+        break;
+      for (; a <= b; a++)
+        set |= 1 << a;
+    }
+  if (peek (p) != ']')
+    {
+      set_error (p);
+      return 0xffff;
+    }
+  p->s++;
+  if (negate)
+    set = ~set & 0xffff;
+  if (!set)
+    set_error (p);
+  return set;
+}
+
+
+/* Parse a repetition count into R_N.  Returns false if there is no
+   number or it is too large.  */
+static int
+parse_count (struct parser_s *p, unsigned int *r_n)
+{
+  unsigned int n = 0;
+
+  if (!(p->s < p->end && digitp (p->s)))
+    return 0;
+  for (; p->s < p->end && digitp (p->s); p->s++)
+    {
+      n = 10 * n + atoi_1 (p->s);
+      if (n > p->maxrep)
+        return 0;
+    }
+  *r_n = n;
+  return 1;
+}
+
+
+static struct frag_s parse_alt (struct parser_s *p);
+
+
+/* Parse a digit, a set or a group.  */
+static struct frag_s
+parse_atom (struct parser_s *p)
+{
+  struct frag_s f;
+  int c = peek (p);
+
+  if (c == '(')
+    {
+      p->s++;
+      f = parse_alt (p);
+      if (peek (p) != ')')
+        set_error (p);
+      else
+        p->s++;
+      return f;
+    }
+  if (c == '[')
+    {
+      p->s++;
+      return frag_set (p, parse_class (p));
+    }
+  if (c == '.')
+    {
+      p->s++;
+      return frag_set (p, 0xffff);
+    }
+  if (c && hexdigitp (p->s))
+    {
+      p->s++;
+      return frag_set (p, 1 << xtoi_1 (p->s - 1));
+    }
+  set_error (p);
+  return frag_empty (p);
+}
+
+
+/* Parse an atom and its repetition operator, if any.  A counted
+   repetition is built from copies of the atom, for which it is
+   parsed again.  */
+static struct frag_s
+parse_repeat (struct parser_s *p)
+{
+  const char *atom = p->s;
+  const char *after;
+  struct frag_s f, copy;
+  unsigned int i, min, max;
+  int unbounded = 0;
+
+  f = parse_atom (p);
+  if (p->err)
+    return f;
+  switch (peek (p))
+    {
+    case '*': p->s++; return frag_opt (p, f, 1);
+    case '+': p->s++; return frag_plus (p, f);
+    case '?': p->s++; return frag_opt (p, f, 0);
+    case '{': p->s++; break;
+    default:  return f;
+    }
+
+  if (!parse_count (p, &min))
+    {
+      set_error (p);
+      return f;
+    }
+  max = min;
+  if (peek (p) == ',')
+    {
+      p->s++;
+      if (peek (p) == '}')
+        unbounded = 1;
+      else if (!parse_count (p, &max) || max < min)
+        {
+          set_error (p);
+          return f;
+        }
+    }
+  if (peek (p) != '}')
+    {
+      set_error (p);
+      return f;
+    }
+  after = p->s + 1;
+
+  if (!min && !unbounded && !max)
+    f = frag_empty (p);
+  else if (!min)
+    f = frag_opt (p, f, unbounded);
+  for (i=1; i < (unbounded && min? min + 1 : max) && !p->err; i++)
+    {
+      p->s = atom;
+      copy = parse_atom (p);
+      if (i < min)
+        f = frag_cat (p, f, copy);
+      else
+        f = frag_cat (p, f, frag_opt (p, copy, unbounded));
+    }
+  p->s = after;
+  return f;
+}
+
+
+/* Parse a sequence of repetitions, which may be empty.  */
+static struct frag_s
+parse_concat (struct parser_s *p)
+{
+  struct frag_s f;
+  int c;
+
+  f = frag_empty (p);
+  while (!p->err && (c = peek (p)) && c != '|' && c != ')')
+    f = frag_cat (p, f, parse_repeat (p));
+  return f;
+}
+
+
+/* Parse alternatives.  */
+static struct frag_s
+parse_alt (struct parser_s *p)
+{
+  struct frag_s f;
+
+  f = parse_concat (p);
+  while (!p->err && peek (p) == '|')
+    {
+      p->s++;
+      f = frag_alt (p, f, parse_concat (p));
+    }
+  return f;
+}
+
+
+/* The state of the subset construction.  */
+struct dfa_build_s
+{
+  const struct nfa_node_s *nodes;
+  unsigned int nnodes;
+  unsigned int nwords;    /* The words of a set of NFA nodes.  */
+  int final;              /* The accepting NFA node.  */
+  int anchored_end;
+  u32 *keep;              /* The nodes which tell states apart.  */
+  u32 *sets;              /* The set of each DFA state.  */
+  int *hash;              /* The states by the hash of their set.  */
+  int *stack;
+  unsigned int nstates;
+  unsigned short *next;
+  unsigned char *accept;
+};
+
+
+static int
+has_node (const u32 *set, int n)
+{
+  return !!(set[n / 32] & ((u32)1 << (n % 32)));
+}
+
+
+static void
+add_node (u32 *set, int n)
+{
+  set[n / 32] |= (u32)1 << (n % 32);
+}
+
+
+/* Extend SET by all nodes reachable from it without taking a digit
+   and then drop the nodes which only lead to others.  */
+static void
+closure (struct dfa_build_s *b, u32 *set)
+{
+  const struct nfa_node_s *node;
+  unsigned int i, sp = 0;
+  int n;
+
+  for (n=0; n < b->nnodes; n++)
+    if (has_node (set, n))
+      b->stack[sp++] = n;
+  while (sp)
+    {
+      node = b->nodes + b->stack[--sp];
+      if (node->set)
+        continue;
+      if (node->out1 >= 0 && !has_node (set, node->out1))
+        {
+          add_node (set, node->out1);
+          b->stack[sp++] = node->out1;
+        }
+      if (node->out2 >= 0 && !has_node (set, node->out2))
+        {
+          add_node (set, node->out2);
+          b->stack[sp++] = node->out2;
+        }
+    }
+  for (i=0; i < b->nwords; i++)
+    set[i] &= b->keep[i];
+}
+
+
+/* Return the DFA state for the closed set SET of NFA nodes, adding
+   a new one if needed, or -1 if there are too many.  */
+static int
+get_state (struct dfa_build_s *b, const u32 *set)
+{
+  unsigned int i, h;
+  u32 any = 0;
+  int st;
+
+  for (h=0, i=0; i < b->nwords; i++)
+    {
+      any |= set[i];
+      h = (h ^ set[i]) * 0x9e3779b1;
+    }
+  if (!any)
+    return STATE_DEAD;
+  if (!b->anchored_end && has_node (set, b->final))
+    return STATE_MATCHED;
+
+  for (h %= STATE_HASH_SIZE; (st = b->hash[h]) >= 0;
+       h = (h + 1) % STATE_HASH_SIZE)
+    if (!memcmp (b->sets + st * b->nwords, set, b->nwords * sizeof *set))
+      return st;
+  if (b->nstates == MAX_DFA_STATES)
+    return -1;
+  st = b->nstates++;
+  memcpy (b->sets + st * b->nwords, set, b->nwords * sizeof *set);
+  b->accept[st] = has_node (set, b->final);
+  b->hash[h] = st;
+  return st;
+}
+
+
+/* Build the DFA of the NFA in B starting at the node START.  */
+static gpg_error_t
+build_dfa (struct dfa_build_s *b, int start)
+{
+  const struct nfa_node_s *node;
+  u32 *set;
+  unsigned int c, i;
+  int n, st, to;
+
+  b->nwords = (b->nnodes + 31) / 32;
+  b->keep = xtrycalloc (b->nwords, sizeof *b->keep);
+  set = xtrymalloc (b->nwords * sizeof *set);
+  b->sets = xtrymalloc (MAX_DFA_STATES * b->nwords * sizeof *b->sets);
+  b->hash = xtrymalloc (STATE_HASH_SIZE * sizeof *b->hash);
+  b->stack = xtrymalloc (2 * b->nnodes * sizeof *b->stack);
+  b->next = xtrymalloc (16 * MAX_DFA_STATES * sizeof *b->next);
+  b->accept = xtrycalloc (MAX_DFA_STATES, 1);
+  if (!b->keep || !set || !b->sets || !b->hash || !b->stack
+      || !b->next || !b->accept)
+    {
+      xfree (set);
+      return gpg_error_from_syserror ();
+    }
+  for (n=0; n < b->nnodes; n++)
+    if (b->nodes[n].set || n == b->final)
+      add_node (b->keep, n);
+  for (i=0; i < STATE_HASH_SIZE; i++)
+    b->hash[i] = -1;
+
+  /* The dead and the matched state stay where they are.  */
+  for (c=0; c < 16; c++)
+    {
+      b->next[16 * STATE_DEAD + c] = STATE_DEAD;
+      b->next[16 * STATE_MATCHED + c] = STATE_MATCHED;
+    }
+  b->accept[STATE_MATCHED] = 1;
+  b->nstates = STATE_START;
+
+  /* The start state is always a state of its own, even if it is
+     already accepting.  */
+  memset (set, 0, b->nwords * sizeof *set);
+  add_node (set, start);
+  closure (b, set);
+  memcpy (b->sets + STATE_START * b->nwords, set, b->nwords * sizeof *set);
+  b->accept[STATE_START] = has_node (set, b->final);
+  b->nstates++;
+
+  for (st = STATE_START; st < b->nstates; st++)
+    for (c=0; c < 16; c++)
+      {
+        memset (set, 0, b->nwords * sizeof *set);
+        for (n=0; n < b->nnodes; n++)
+          {
+            node = b->nodes + n;
+            if ((node->set & (1 << c)) && has_node (b->sets + st * b->nwords, n))
+              add_node (set, node->out1);
+          }
+        closure (b, set);
+        to = get_state (b, set);
+        if (to < 0)
+          {
+            xfree (set);
+            return gpg_error (GPG_ERR_TOO_LARGE);
+          }
+        b->next[16 * st + c] = to;
+      }
+  xfree (set);
+  return 0;
+}
+
+
+/* Send all transitions of REGEX to states which can't reach an
+   accepting state to the dead state.  The second half of the accept
+   array is used for the live states.  */
+static void
+prune_dead (vanity_regex_t regex)
+{
+  unsigned char *live = regex->accept + regex->nstates;
+  unsigned int st, c;
+  int changed;
+
+  for (st=0; st < regex->nstates; st++)
+    live[st] = regex->accept[st];
+  do
+    {
+      changed = 0;
+      for (st=0; st < regex->nstates; st++)
+        for (c=0; c < 16 && !live[st]; c++)
+          if (live[regex->next[16 * st + c]])
+            live[st] = changed = 1;
+    }
+  while (changed);
+  for (st=0; st < regex->nstates; st++)
+    for (c=0; c < 16; c++)
+      if (!live[regex->next[16 * st + c]])
+        regex->next[16 * st + c] = STATE_DEAD;
+}
+
+
+/* Walk REGEX over the length of the fingerprint; compute the
+   prefilter from the digits which can appear in a match at each
+   position and the chance of a match.  Returns GPG_ERR_INV_VALUE if
+   no fingerprint can match.  */
+static gpg_error_t
+analyse (vanity_regex_t regex)
+{
+  unsigned int nstates = regex->nstates;
+  unsigned int n = regex->nnibbles;
+  unsigned int swords = (nstates + 31) / 32;
+  u32 *good, *reach, *reach2;
+  double *probbuf, *prob, *prob2, *ptmp;
+  unsigned int pos, st, c, allowed, all, common, shift;
+  unsigned short to;
+  u32 *tmp;
+
+  /* GOOD[POS] are the states from which a digest can still be
+     accepted with the remaining N - POS digits.  */
+  good = xtrycalloc ((n + 1) * swords + 2 * swords, sizeof *good);
+  prob = probbuf = xtrycalloc (2 * nstates, sizeof *prob);
+  if (!good || !probbuf)
+    {
+      xfree (good);
+      xfree (probbuf);
+      return gpg_error_from_syserror ();
+    }
+  reach = good + (n + 1) * swords;
+  reach2 = reach + swords;
+  prob2 = prob + nstates;
+
+  for (st=0; st < nstates; st++)
+    if (regex->accept[st])
+      add_node (good + n * swords, st);
+  for (pos = n; pos--; )
+    for (st=0; st < nstates; st++)
+      for (c=0; c < 16; c++)
+        if (has_node (good + (pos + 1) * swords, regex->next[16 * st + c]))
+          {
+            add_node (good + pos * swords, st);
+            break;
+          }
+
+  memset (regex->value, 0, sizeof regex->value);
+  memset (regex->mask, 0, sizeof regex->mask);
+  add_node (reach, STATE_START);
+  prob[STATE_START] = 1.0;
+  for (pos=0; pos < n; pos++)
+    {
+      allowed = 0;
+      memset (reach2, 0, swords * sizeof *reach2);
+      memset (prob2, 0, nstates * sizeof *prob2);
+      for (st=0; st < nstates; st++)
+        {
+          for (c=0; c < 16; c++)
+            prob2[regex->next[16 * st + c]] += prob[st] / 16;
+          if (!has_node (reach, st) || !has_node (good + pos * swords, st))
+            continue;
+          for (c=0; c < 16; c++)
+            {
+              to = regex->next[16 * st + c];
+              if (has_node (good + (pos + 1) * swords, to))
+                {
+                  allowed |= 1 << c;
+                  add_node (reach2, to);
+                }
+            }
+        }
+      if (!allowed)
+        {
+          xfree (good);
+          xfree (probbuf);
+          return gpg_error (GPG_ERR_INV_VALUE);
+        }
+
+      /* The bits which are the same in all allowed digits.  */
+      for (all = 0xf, common = 0, c=0; c < 16; c++)
+        if (allowed & (1 << c))
+          {
+            all &= c;
+            common |= c;
+          }
+      common = ~(all ^ common) & 0xf;
+      shift = 28 - 4 * (pos % 8);
+      regex->value[pos / 8] |= (u32)(all & common) << shift;
+      regex->mask[pos / 8] |= (u32)common << shift;
+
+      tmp = reach;
+      reach = reach2;
+      reach2 = tmp;
+      ptmp = prob;
+      prob = prob2;
+      prob2 = ptmp;
+    }
+
+  regex->probability = 0.0;
+  for (st=0; st < nstates; st++)
+    if (regex->accept[st])
+      regex->probability += prob[st];
+
+  xfree (good);
+  xfree (probbuf);
+  return 0;
+}
+
+
+/* Compile the expression at STRING of length LEN for fingerprints of
+   NNIBBLES hex digits and store a new object at R_REGEX.  Returns
+   GPG_ERR_INV_VALUE for a malformed expression or one which can't
+   match, and GPG_ERR_TOO_LARGE if the automaton gets too large.  */
+gpg_error_t
+_vanity_regex_new (vanity_regex_t *r_regex, const char *string, size_t len,
+                   unsigned int nnibbles)
+{
+  gpg_error_t err;
+  struct parser_s parser;
+  struct dfa_build_s build;
+  struct frag_s f;
+  vanity_regex_t regex = NULL;
+  int anchored_start = 0;
+  int anchored_end = 0;
+
+  *r_regex = NULL;
+  if (!len || len > MAX_REGEX_LEN || nnibbles > 8 * VANITY_MAX_DIGEST_WORDS)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  if (*string == '^')
+    {
+      anchored_start = 1;
+      string++;
+      len--;
+    }
+  if (len && string[len-1] == '$')
+    {
+      anchored_end = 1;
+      len--;
+    }
+  if (!len)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  memset (&parser, 0, sizeof parser);
+  parser.s = string;
+  parser.end = string + len;
+  parser.maxrep = nnibbles;
+  parser.nodes = xtrymalloc (MAX_NFA_NODES * sizeof *parser.nodes);
+  if (!parser.nodes)
+    return gpg_error_from_syserror ();
+  f = parse_alt (&parser);
+  if (!parser.err && parser.s != parser.end)
+    set_error (&parser);
+  if (!anchored_start)
+    f = frag_cat (&parser, frag_opt (&parser, frag_set (&parser, 0xffff), 1),
+                  f);
+  if (parser.err)
+    {
+      xfree (parser.nodes);
+      return parser.err;
+    }
+
+  memset (&build, 0, sizeof build);
+  build.nodes = parser.nodes;
+  build.nnodes = parser.nnodes;
+  build.final = f.end;
+  build.anchored_end = anchored_end;
+  err = build_dfa (&build, f.start);
+  if (err)
+    goto leave;
+
+  regex = xtrycalloc (1, sizeof *regex);
+  if (!regex)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  regex->nnibbles = nnibbles;
+  regex->nstates = build.nstates;
+  regex->next = xtrymalloc (16 * build.nstates * sizeof *regex->next);
+  regex->accept = xtrymalloc (2 * build.nstates);
+  if (!regex->next || !regex->accept)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (regex->next, build.next, 16 * build.nstates * sizeof *regex->next);
+  memcpy (regex->accept, build.accept, build.nstates);
+  prune_dead (regex);
+  err = analyse (regex);
+
+ leave:
+  xfree (build.keep);
+  xfree (build.sets);
+  xfree (build.hash);
+  xfree (build.stack);
+  xfree (build.next);
+  xfree (build.accept);
+  xfree (parser.nodes);
+  if (err)
+    _vanity_regex_release (regex);
+  else
+    *r_regex = regex;
+  return err;
+}
+
+
+void
+_vanity_regex_release (vanity_regex_t regex)
+{
+  if (!regex)
+    return;
+  xfree (regex->next);
+  xfree (regex->accept);
+  xfree (regex);
+}
+
+
+/* Store the prefilter of REGEX at VALUE and MASK, each with
+   VANITY_MAX_DIGEST_WORDS words.  A digest H can only match if
+   (H[i] & MASK[i]) == VALUE[i] for all words.  */
+void
+_vanity_regex_prefilter (vanity_regex_t regex, u32 *value, u32 *mask)
+{
+  memcpy (value, regex->value, sizeof regex->value);
+  memcpy (mask, regex->mask, sizeof regex->mask);
+}
+
+
+/* Return the bytes of memory REGEX takes.  */
+size_t
+_vanity_regex_memory (vanity_regex_t regex)
+{
+  return (sizeof *regex + 16 * regex->nstates * sizeof *regex->next
+          + 2 * regex->nstates);
+}
+
+
+/* Return the chance of a random fingerprint to match REGEX.  */
+double
+_vanity_regex_probability (vanity_regex_t regex)
+{
+  return regex->probability;
+}
+
+
+/* Return true if the digest H, given as its big endian words, matches
+   REGEX.  */
+int
+_vanity_regex_match (vanity_regex_t regex, const u32 *h)
+{
+  const unsigned short *next = regex->next;
+  unsigned int w, k, st = STATE_START;
+  u32 x;
+
+  for (w=0; w < regex->nnibbles / 8; w++)
+    for (x = h[w], k=0; k < 8; k++, x <<= 4)
+      {
+        st = next[16 * st + (x >> 28)];
+        if (st < STATE_START)
+          return st;
+      }
+  return regex->accept[st];
+}
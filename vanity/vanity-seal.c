@@ -0,0 +1,240 @@
+/* vanity-seal.c - Encrypt the keys found by a worker to its coordinator
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A worker without a home directory and agent can't store the keys
+   it finds, and the channel back to its coordinator may be anything
+   from a pipe to a log collector.  Thus each secret key is sent
+   encrypted to the ECC key of the coordinator, which only it can
+   open:
+
+     EL, the length of E, in one byte;
+     the point E = k * G of an ephemeral scalar k;
+     the private key as a padded canonical S-expression, wrapped with
+     AESWRAP (RFC 3394) under SHA-256 (SEAL_LABEL || k * Q).
+
+   This is the ECDH of libgcrypt as used for OpenPGP, without the
+   OpenPGP KDF parameters.  The coordinator key must be on one of the
+   Weierstrass curves, e.g. NIST P-256, for which libgcrypt returns
+   the shared point in the same uncompressed format on both sides.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+
+
+/* Prepended to the shared point for the key derivation.  */
+#define SEAL_LABEL "GnuPG vanity seal"
+
+/* The longest point E we accept.  */
+#define MAX_POINT_LEN 255
+
+
+/* Derive the wrapping key at KEK, which must provide space for 32
+   bytes, from the shared point POINT of length POINTLEN.  */
+static void
+derive_kek (const unsigned char *point, size_t pointlen, unsigned char *kek)
+{
+  gcry_buffer_t iov[2];
+
+  memset (iov, 0, sizeof iov);
+  iov[0].data = (void *)SEAL_LABEL;
+  iov[0].len = strlen (SEAL_LABEL);
+  iov[1].data = (void *)point;
+  iov[1].len = pointlen;
+  gcry_md_hash_buffers (GCRY_MD_SHA256, 0, kek, iov, DIM (iov));
+}
+
+
+/* Return the data of the element NAME of the S-expression SEXP and
+   store its length at R_LEN.  The list containing it is stored at
+   R_LIST and must be released by the caller.  */
+static const unsigned char *
+get_data (gcry_sexp_t sexp, const char *name, gcry_sexp_t *r_list,
+          size_t *r_len)
+{
+  *r_list = gcry_sexp_find_token (sexp, name, 0);
+  if (!*r_list)
+    return NULL;
+  return (const unsigned char *)gcry_sexp_nth_data (*r_list, 1, r_len);
+}
+
+
+/* Encrypt the private key S_PRIVATE to the ECC public key S_RECIPIENT
+   and store a newly allocated buffer with the result at R_SEALED and
+   its length at R_SEALEDLEN.  */
+gpg_error_t
+vanity_seal_key (gcry_sexp_t s_recipient, gcry_sexp_t s_private,
+                 unsigned char **r_sealed, size_t *r_sealedlen)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_data = NULL, s_ciph = NULL, l_s = NULL, l_e = NULL;
+  gcry_cipher_hd_t cipherhd = NULL;
+  gcry_mpi_t k;
+  const unsigned char *s, *e;
+  size_t slen, elen, keylen;
+  unsigned char kek[32];
+  unsigned char *key = NULL;
+  unsigned char *sealed = NULL;
+  unsigned int nbits;
+
+  *r_sealed = NULL;
+  *r_sealedlen = 0;
+
+  nbits = gcry_pk_get_nbits (s_recipient);
+  if (!nbits)
+    return gpg_error (GPG_ERR_BAD_PUBKEY);
+
+  /* The ephemeral scalar, as done by pk_ecdh_generate_ephemeral_key
+     in g10/ecdh.c.  */
+  k = gcry_mpi_new (nbits);
+  gcry_mpi_randomize (k, nbits, GCRY_STRONG_RANDOM);
+  err = gcry_sexp_build (&s_data, NULL, "%m", k);
+  gcry_mpi_release (k);
+  if (!err)
+    err = gcry_pk_encrypt (&s_ciph, s_data, s_recipient);
+  if (err)
+    goto leave;
+  s = get_data (s_ciph, "s", &l_s, &slen);
+  e = get_data (s_ciph, "e", &l_e, &elen);
+  if (!s || !e || !elen || elen > MAX_POINT_LEN)
+    {
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto leave;
+    }
+  derive_kek (s, slen, kek);
+
+  err = make_canon_sexp_pad (s_private, 1, &key, &keylen);
+  if (err)
+    goto leave;
+  sealed = xtrymalloc (1 + elen + keylen + 8);
+  if (!sealed)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  sealed[0] = elen;
+  memcpy (sealed + 1, e, elen);
+  err = gcry_cipher_open (&cipherhd, GCRY_CIPHER_AES256,
+                          GCRY_CIPHER_MODE_AESWRAP, 0);
+  if (!err)
+    err = gcry_cipher_setkey (cipherhd, kek, sizeof kek);
+  if (!err)
+    err = gcry_cipher_encrypt (cipherhd, sealed + 1 + elen, keylen + 8,
+                               key, keylen);
+  if (err)
+    goto leave;
+
+  *r_sealed = sealed;
+  *r_sealedlen = 1 + elen + keylen + 8;
+  sealed = NULL;
+
+ leave:
+  wipememory (kek, sizeof kek);
+  gcry_cipher_close (cipherhd);
+  xfree (sealed);
+  xfree (key);
+  gcry_sexp_release (l_s);
+  gcry_sexp_release (l_e);
+  gcry_sexp_release (s_ciph);
+  gcry_sexp_release (s_data);
+  return err;
+}
+
+
+/* Decrypt the buffer SEALED of length SEALEDLEN made by
+   vanity_seal_key with the ECC private key S_SECKEY of the
+   coordinator and store the private key at R_PRIVATE.  Returns
+   GPG_ERR_BAD_DATA if the buffer is not sealed to this key.  */
+gpg_error_t
+vanity_open_key (gcry_sexp_t s_seckey, const unsigned char *sealed,
+                 size_t sealedlen, gcry_sexp_t *r_private)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_ciph = NULL, s_plain = NULL, l1 = NULL;
+  gcry_cipher_hd_t cipherhd = NULL;
+  const unsigned char *point;
+  size_t elen, pointlen, wrappedlen, keylen;
+  unsigned char kek[32];
+  unsigned char *key = NULL;
+
+  *r_private = NULL;
+
+  if (!sealedlen)
+    return gpg_error (GPG_ERR_BAD_DATA);
+  elen = sealed[0];
+  if (!elen || sealedlen < 1 + elen + 24)
+    return gpg_error (GPG_ERR_BAD_DATA);
+  wrappedlen = sealedlen - 1 - elen;
+  if (wrappedlen % 8)
+    return gpg_error (GPG_ERR_BAD_DATA);
+
+  err = gcry_sexp_build (&s_ciph, NULL, "(enc-val(ecdh(e%b)))",
+                         (int)elen, sealed + 1);
+  if (!err)
+    err = gcry_pk_decrypt (&s_plain, s_ciph, s_seckey);
+  if (err)
+    goto leave;
+  point = get_data (s_plain, "value", &l1, &pointlen);
+  if (!point)
+    {
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto leave;
+    }
+  derive_kek (point, pointlen, kek);
+
+  keylen = wrappedlen - 8;
+  key = xtrymalloc_secure (keylen);
+  if (!key)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = gcry_cipher_open (&cipherhd, GCRY_CIPHER_AES256,
+                          GCRY_CIPHER_MODE_AESWRAP, 0);
+  if (!err)
+    err = gcry_cipher_setkey (cipherhd, kek, sizeof kek);
+  if (!err)
+    err = gcry_cipher_decrypt (cipherhd, key, keylen,
+                               sealed + 1 + elen, wrappedlen);
+  if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
+    err = gpg_error (GPG_ERR_BAD_DATA);
+  if (err)
+    goto leave;
+  keylen = gcry_sexp_canon_len (key, keylen, NULL, NULL);
+  if (!keylen)
+    err = gpg_error (GPG_ERR_BAD_DATA);
+  else
+    err = gcry_sexp_sscan (r_private, NULL, (const char *)key, keylen);
+
+ leave:
+  wipememory (kek, sizeof kek);
+  gcry_cipher_close (cipherhd);
+  if (key)
+    {
+      wipememory (key, wrappedlen - 8);
+      xfree (key);
+    }
+  gcry_sexp_release (l1);
+  gcry_sexp_release (s_plain);
+  gcry_sexp_release (s_ciph);
+  return err;
+}
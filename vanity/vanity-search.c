@@ -0,0 +1,3756 @@
+/* vanity-search.c - The vanity key search worker pool
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A search generates a key, sweeps its creation time over the
+   configured windows and checks the fingerprint for each timestamp.
+   This is repeated until a key with a matching keyid has been found.
+
+   The two steps are pipelined: the keygen threads generate batches
+   of keys and put them into a bounded queue from which the hash
+   workers take them.  A keygen thread waits while the queue is full;
+   a hash worker finding the queue empty generates a batch itself, so
+   that it never idles if the keygen threads can't keep up, for
+   example because the windows are small.  With only one worker there
+   is no keygen thread and that worker alternates between both steps.
+
+   Ed25519 keys are generated VANITY_ED25519_BATCH at a time by
+   vanity-ed25519.c.  ECDSA and ECDH keys are generated by
+   vanity-ecc.c as VANITY_ECC_BATCH consecutive secret scalars, thus
+   only the first secret of such a batch is stored.  Otherwise a batch
+   is a single key from gcry_pk_genkey.  That is the case for RSA,
+   DSA and Elgamal keys, which take so long to generate that their
+   default window spans years; their packets are hashed by the multi
+   block SHA-1 kernels.
+
+   If an OpenCL device is enabled and the pattern is supported by it,
+   an additional worker collects several batches and sweeps all their
+   keys over a slice of a window on the device at once.  The device
+   only returns candidates, which this worker then confirms.  Keys
+   whose packet does not fit into a single SHA-1 block are swept by
+   that worker on the CPU instead.
+
+   The device and the hash workers share the first queue, and a
+   static split of it leaves one side idle.  Thus the device worker
+   times every call and sizes its slice of timestamps so that a call
+   takes about GPU_TARGET_SECONDS, long enough to hide the launch
+   overhead and short enough to stay clear of the watchdog of display
+   drivers.  Each side keeps a running average of the time it needs
+   per key.  While that queue is less than half full and the device
+   needs less time per key than a hash worker, that worker generates
+   batches for the device instead of sweeping them; once the queue
+   fills up again it goes back to hashing.  Thus the CPUs split
+   between key generation and hashing as the live rates demand.
+
+   With VANITY_PLACE_PIN each worker is bound to one CPU and each NUMA
+   node used gets its own queue and keygen thread, which is bound to
+   the CPUs of that node.  The workers bind themselves before they
+   allocate anything, so that their tables and the batches they
+   generate come from the memory of their node.
+
+   With a scoring pattern nothing ends the search but its budget.
+   The job keeps the best keys in a heap of the size asked for with
+   vanity_set_hits and publishes the score a candidate needs to get
+   into it, so that the workers report only those.  Since the search
+   is memoryless, a worker goes on with the next key after such a
+   candidate just as after a hit.
+
+   With a key pool (see vanity-pool.c) the batches stored by earlier
+   searches are handed out first instead of generating new ones, and
+   the batches generated are added to it.  A key handed out is
+   cleared in the pool.  With VANITY_POOL_ONLY the search ends with
+   the last stored batch.
+
+   The governor set with vanity_set_governor and
+   vanity_set_temperature_limit is applied by the thread running
+   vanity_search every GOVERNOR_INTERVAL seconds; see vanity-power.c.
+   After each batch a hash worker sleeps long enough to keep to the
+   duty cycle, and the workers numbered beyond the allowed number
+   sleep until they are allowed again.  The energy of the search is
+   measured the same way.
+
+   How many creation times a key should get depends on the host: the
+   default window is only needed in full where generating a key costs
+   as much as sweeping millions of timestamps or where a device hashes
+   much faster than the CPUs generate.  With vanity_set_autotune the
+   thread running vanity_search takes the average times the workers
+   measure for generating a key and for a fingerprint every
+   GOVERNOR_INTERVAL seconds and shrinks the default window to the
+   creation times at which the key generation costs only
+   1/AUTOTUNE_OVERHEAD of the sweep.  The rate is then nearly that of
+   the full window, but the keys found are less backdated.  The
+   window never grows beyond the default and windows set by the
+   caller are not changed.  The split of the CPUs and the slices of
+   the device already follow the live rates; see above.
+
+   The queues have a fixed number of slots, the arenas are sized for
+   them and every thread holds at most one batch, or the device
+   worker the batches of one device call.  Thus the memory of a
+   search is known before it starts; plan_memory adds it up by
+   component and, with vanity_set_memory_limit, the search starts
+   only as many hash workers as fit into the budget.
+
+   The workers are npth threads but run the actual computation
+   outside of the npth global lock.  They take the lock again only to
+   log something, to access the queue or to report their result.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#ifdef HAVE_GETTIMEOFDAY
+# include <sys/time.h>
+#endif
+#include <npth.h>
+
+#include "vanity-defs.h"
+#include "../common/openpgpdefs.h"
+#include "../common/host2net.h"
+
+
+/* The upper limit for the number of worker threads.  */
+#define MAX_WORKERS 256
+
+/* Each worker logs its progress after this many fingerprints.  */
+#define PROGRESS_INTERVAL 1000000
+
+/* The microseconds between two checks whether a search with a
+   progress callback is done.  */
+#define PROGRESS_TICK 100000
+
+/* The seconds between two runs of the governor.  */
+#define GOVERNOR_INTERVAL 5
+
+/* The autotuner sizes the default window so that the keys cost at
+   most this fraction of the sweep, but to at least AUTOTUNE_MIN_WINDOW
+   seconds.  It only changes the window if that differs by more than a
+   quarter.  */
+#define AUTOTUNE_OVERHEAD   32
+#define AUTOTUNE_MIN_WINDOW 86400
+
+/* The number of queued key batches per hash worker.  */
+#define QUEUED_BATCHES_PER_WORKER 1
+
+/* The number of queued key batches for the device worker.  */
+#define GPU_QUEUED_BATCHES 32
+
+/* The number of timestamps the device sweeps in its first call and
+   the bounds for the later ones.  */
+#define GPU_SLICE     (1 << 20)
+#define GPU_MIN_SLICE (1 << 12)
+#define GPU_MAX_SLICE (1 << 26)
+
+/* The time one call to the device should take.  */
+#define GPU_TARGET_SECONDS 0.05
+
+/* A generous bound for the S-expression of a key of up to 4096 bits
+   from gcry_pk_genkey and for the bytes an MPI needs besides its
+   limbs.  */
+#define MAX_KEY_SEXP_LEN 4096
+#define MPI_OVERHEAD 32
+
+/* The curve OID of Ed25519 as stored in the key packet.  */
+static const unsigned char ed25519_oid[] =
+  { 0x09, 0x2b, 0x06, 0x01, 0x04, 0x01, 0xda, 0x47, 0x0f, 0x01 };
+
+
+/* A batch of generated keys.  It has either the single key S_KEY from
+   gcry_pk_genkey or NKEYS keys with the public keys at Q and the
+   secrets in secure memory: for Ed25519 their seeds and for
+   incremental keys the scalar D of the first key.  The seeds are
+   taken from the arena of the worker generating the batch if it has
+   a free slot.  */
+struct key_batch_s
+{
+  unsigned int nkeys;
+  gcry_sexp_t s_key;
+  unsigned char *seeds;     /* 32 bytes for each key.  */
+  vanity_arena_t arena;     /* SEEDS is a slot of it or NULL.  */
+  gcry_mpi_t d;             /* Key I has the secret D + I.  */
+  size_t qlen;              /* Length of each Q including the prefix.  */
+  unsigned char *q;         /* NKEYS times QLEN bytes.  */
+  int pooled;               /* The batch is record POOL_REC of the pool.  */
+  unsigned long long pool_rec;
+  int streamed;             /* The seeds are batch COUNTER of the key
+                               stream STREAM.  */
+  unsigned int stream;
+  unsigned long long counter;
+};
+
+/* The ring buffer of key batches passed from the keygen threads to
+   the hash workers.  */
+struct key_queue_s
+{
+  npth_mutex_t lock;
+  npth_cond_t not_full;           /* Signaled when a batch was taken.  */
+  unsigned int size;              /* Number of slots.  */
+  unsigned int head;              /* The oldest queued batch.  */
+  unsigned int count;             /* Number of queued batches.  */
+  struct key_batch_s **slots;
+};
+
+/* The size of a cache line.  */
+#define CACHE_LINE 64
+
+/* The per-thread state of a worker.  The counters are updated all the
+   time; they are kept at the end and followed by a cache line of
+   padding, so that the counters of two workers in an array never
+   share a cache line.  */
+struct worker_s
+{
+  vanity_job_t job;
+  unsigned int no;                /* Worker number for diagnostics.  */
+  int keygen;                     /* This is a keygen thread.  */
+  int gpu;                        /* This is the device worker.  */
+  int cpu;                        /* Index into JOB->CPUS or -1.  */
+  int node;                       /* The NUMA node it works on.  */
+  struct key_queue_s *queue;      /* The queue of that node or NULL.  */
+  npth_t thread;
+  vanity_refkey_t refkey;         /* Buffer for the current key.  */
+  vanity_rng_t rng;               /* Random for the keys it generates.  */
+  vanity_arena_t arena;           /* For the seeds of its batches.  */
+  u32 gpu_slice;                  /* Timestamps per call to the device.  */
+  unsigned int stream;            /* Its key stream.  */
+  unsigned long long stream_next; /* The next batch of that stream.  */
+  double key_seconds;             /* Average time to sweep one key.  */
+  double gen_seconds;             /* Average time to generate one.  */
+  double fpr_seconds;             /* Average time of a fingerprint on
+                                     the CPU.  */
+  unsigned long long iterations;  /* Fingerprints computed.  */
+  unsigned long long keys;        /* Keys swept.  */
+  unsigned long long generated;   /* Keys generated.  */
+  double cpu_seconds;             /* CPU time of the thread.  */
+  double gpu_seconds;             /* Time spent on the device.  */
+  unsigned long long fed;         /* Batches generated for the device.  */
+  char padding[CACHE_LINE];
+};
+
+
+/* The keys swept together by the device worker.  Key I is number
+   IDX[I] of the batch BATCHES[BATCH[I]] and has the SHA-1 block at
+   BLOCKS + 16 * I.  If ON_DEVICE is set, the keys have instead been
+   generated by the device from MASTER; the SHA-1 blocks stay on the
+   device and a candidate is recomputed as the single key of CHECK.
+   TMPL is the SHA-1 block of an Ed25519 key with a zero Q, which is
+   stored at byte QOFF.  */
+struct gpu_keys_s
+{
+  unsigned int nbatches;
+  struct key_batch_s *batches[VANITY_GPU_MAX_KEYS];
+  unsigned int nkeys;
+  unsigned short batch[VANITY_GPU_MAX_KEYS];
+  unsigned short idx[VANITY_GPU_MAX_KEYS];
+  u32 blocks[16 * VANITY_GPU_MAX_KEYS];
+  int on_device;
+  unsigned char *master;        /* 32 bytes in secure memory.  */
+  struct key_batch_s check;
+  u32 tmpl[16];
+  unsigned int qoff;
+  unsigned long long counter;   /* The batch of MASTER in the key stream.  */
+};
+
+
+/* Return a monotonic time in seconds.  */
+static double
+now_seconds (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#elif defined(HAVE_GETTIMEOFDAY)
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+#else
+  return time (NULL);
+#endif
+}
+
+
+/* Return the CPU time of the calling thread in seconds or -1 if the
+   system can't tell.  */
+static double
+thread_cpu_seconds (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts))
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+  return -1;
+}
+
+
+/* Fold the time SECONDS per key measured for NKEYS keys into the
+   running average at AVG.  */
+static void
+update_key_seconds (double *avg, double seconds, unsigned int nkeys)
+{
+  if (!nkeys)
+    return;
+  seconds /= nkeys;
+  *avg = *avg > 0? (3 * *avg + seconds) / 4 : seconds;
+}
+
+
+/* Store window number W of JOB at WIN.  While the default window is
+   shrunk its start is TUNED_START; the copy keeps a sweep consistent
+   when that changes meanwhile.  */
+static void
+get_window (vanity_job_t job, unsigned int w, struct vanity_window_s *win)
+{
+  u32 start;
+
+  *win = job->windows[w];
+  start = job->tuned_start;
+  if (start && job->default_window && start > win->start
+      && start <= win->end)
+    win->start = start;
+}
+
+
+/* Sleep for SECONDS or until the job of WORKER is done.  Called
+   without holding the npth lock.  */
+static void
+pause_worker (struct worker_s *worker, double seconds)
+{
+  double chunk;
+
+  while (seconds > 0 && !worker->job->done)
+    {
+      chunk = seconds < PROGRESS_TICK / 1e6? seconds : PROGRESS_TICK / 1e6;
+      usleep ((unsigned int)(chunk * 1e6));
+      seconds -= chunk;
+    }
+}
+
+
+/* Keep WORKER to the limits of the governor after it worked for BUSY
+   seconds: park it while its number is beyond the allowed number of
+   hash workers and pause it as long as the duty cycle demands.
+   Called without holding the npth lock.  */
+static void
+throttle (struct worker_s *worker, double busy)
+{
+  vanity_job_t job = worker->job;
+  unsigned int duty;
+
+  if (worker->keygen)
+    return;
+  while (!worker->gpu && job->active_workers
+         && worker->no >= job->active_workers && !job->done)
+    pause_worker (worker, PROGRESS_TICK / 1e6);
+  duty = job->duty;
+  if (duty && duty < 100)
+    pause_worker (worker, busy * (100 - duty) / duty);
+}
+
+
+/* Wake up the keygen threads waiting for space in the queues of JOB
+   so that they notice that the job is done.  Must be called with the
+   npth lock held.  */
+static void
+wake_keygen (vanity_job_t job)
+{
+  struct key_queue_s *queue;
+  unsigned int i;
+
+  for (i=0; i < job->nqueues; i++)
+    {
+      queue = job->queues[i];
+      npth_mutex_lock (&queue->lock);
+      npth_cond_broadcast (&queue->not_full);
+      npth_mutex_unlock (&queue->lock);
+    }
+}
+
+
+/* Tell the workers of JOB to stop.  Must be called with the npth
+   lock held.  */
+static void
+stop_job (vanity_job_t job)
+{
+  job->done = 1;
+  wake_keygen (job);
+}
+
+
+/* Return true if hit A of a scoring search is worse than hit B.  */
+static int
+worse_hit (const struct vanity_hit_s *a, const struct vanity_hit_s *b)
+{
+  return a->score < b->score;
+}
+
+
+/* Restore the heap order of the hits of JOB after entry IDX has been
+   replaced by a better one.  */
+static void
+sift_down (vanity_job_t job, unsigned int idx)
+{
+  struct vanity_hit_s tmp;
+  unsigned int child;
+
+  while ((child = 2 * idx + 1) < job->nhits)
+    {
+      if (child + 1 < job->nhits
+          && worse_hit (job->hits + child + 1, job->hits + child))
+        child++;
+      if (!worse_hit (job->hits + child, job->hits + idx))
+        break;
+      tmp = job->hits[idx];
+      job->hits[idx] = job->hits[child];
+      job->hits[child] = tmp;
+      idx = child;
+    }
+}
+
+
+/* Restore the heap order of the hits of JOB after entry IDX has been
+   appended.  */
+static void
+sift_up (vanity_job_t job, unsigned int idx)
+{
+  struct vanity_hit_s tmp;
+  unsigned int parent;
+
+  while (idx && worse_hit (job->hits + idx, job->hits + (parent=(idx-1)/2)))
+    {
+      tmp = job->hits[idx];
+      job->hits[idx] = job->hits[parent];
+      job->hits[parent] = tmp;
+      idx = parent;
+    }
+}
+
+
+/* Put the candidate of a worker with the score SCORE into the heap
+   of the best keys of JOB and return its entry there, replacing the
+   worst key if the heap is full.  Returns NULL if the candidate is
+   not better than all keys in the heap.  Must be called with the
+   npth lock held.  */
+static struct vanity_hit_s *
+add_scored_hit (vanity_job_t job, unsigned int score)
+{
+  struct vanity_hit_s *hit;
+  unsigned int i;
+
+  if (job->nhits < job->max_hits)
+    {
+      hit = job->hits + job->nhits++;
+      memset (hit, 0, sizeof *hit);
+    }
+  else if (score > job->hits[0].score)
+    {
+      hit = job->hits;
+      gcry_sexp_release (hit->s_private);
+      gcry_sexp_release (hit->s_public);
+      memset (hit, 0, sizeof *hit);
+    }
+  else
+    return NULL;
+
+  for (i=0; i < job->nhits; i++)
+    if (job->hits[i].score >= score && job->hits + i != hit)
+      break;
+  if (i == job->nhits)
+    log_debug ("new best vanity score %u\n", score);
+  hit->score = score;
+  return hit;
+}
+
+
+/* Reorder the heap of the best keys of a scoring JOB at its end so
+   that the best one comes first.  */
+static void
+sort_scored_hits (vanity_job_t job)
+{
+  struct vanity_hit_s tmp;
+  unsigned int n = job->nhits;
+
+  /* Heap sort: moving the worst key behind the heap until none is
+     left puts them in descending order.  */
+  while (job->nhits > 1)
+    {
+      tmp = job->hits[0];
+      job->hits[0] = job->hits[job->nhits - 1];
+      job->hits[job->nhits - 1] = tmp;
+      job->nhits--;
+      sift_down (job, 0);
+    }
+  job->nhits = n;
+}
+
+
+/* Record the result of a worker.  Must be called with the npth lock
+   held.  The job is done when it has collected the number of keys
+   asked for; a key found after that is released.  A candidate of a
+   scoring search with the score SCORE goes into the heap of the best
+   keys instead; the job then goes on.  KDF is the index of the ECDH
+   KDF parameters of the key.  If REF is not NULL only that record of
+   the key is kept until the search ends.  */
+static void
+report_hit (vanity_job_t job, gcry_sexp_t s_private, gcry_sexp_t s_public,
+            u32 timestamp, u32 keyid, unsigned int match, unsigned int score,
+            unsigned int kdf, const struct vanity_hit_ref_s *ref)
+{
+  struct vanity_hit_s *hit;
+
+  /* A calibration run only counts the hits of a matching pattern.  */
+  if (job->estimating && !job->scoring)
+    job->nestimated++;
+  if (job->done || (job->estimating && !job->scoring)
+      || (job->scoring && !(hit = add_scored_hit (job, score))))
+    {
+      gcry_sexp_release (s_private);
+      gcry_sexp_release (s_public);
+      return;
+    }
+  if (!job->scoring)
+    hit = job->hits + job->nhits++;
+  if (ref)
+    {
+      gcry_sexp_release (s_private);
+      gcry_sexp_release (s_public);
+      s_private = s_public = NULL;
+      hit->has_ref = 1;
+      hit->ref = *ref;
+    }
+  hit->s_private = s_private;
+  hit->s_public = s_public;
+  hit->timestamp = timestamp;
+  hit->keyid = keyid;
+  hit->match = match;
+  hit->kdf = kdf;
+  if (job->scoring)
+    {
+      if (hit == job->hits)
+        sift_down (job, 0);
+      else
+        sift_up (job, hit - job->hits);
+      if (job->nhits == job->max_hits)
+        job->min_score = job->hits[0].score + 1;
+    }
+  else if (job->nhits >= job->max_hits)
+    stop_job (job);
+  else
+    log_debug ("found vanity key %u of %u\n", job->nhits, job->max_hits);
+}
+
+
+/* Record the error ERR of a worker and stop the job.  Must be called
+   with the npth lock held.  */
+static void
+report_error (vanity_job_t job, gpg_error_t err)
+{
+  if (!job->done)
+    {
+      job->err = err;
+      stop_job (job);
+    }
+}
+
+
+/* Sweep the creation time of REFKEY over WINDOW, in the direction
+   configured for the job of WORKER.  Returns true if a matching keyid
+   has been found; its creation time, the keyid and the index of the
+   pattern item it matches are then stored at R_TIMESTAMP, R_KEYID and
+   R_MATCH.  For a scoring pattern this is a fingerprint with at least
+   the score the job asks for; the score is then stored at R_SCORE.
+   Called without holding the npth lock.  */
+static int
+sweep_window (struct worker_s *worker, vanity_refkey_t refkey,
+              const struct vanity_window_s *window,
+              u32 *r_timestamp, u32 *r_keyid, unsigned int *r_match,
+              unsigned int *r_score)
+{
+  vanity_job_t job = worker->job;
+  u32 keyids[VANITY_SHA1_MAX_LANES];
+  u32 digests[VANITY_MAX_DIGEST_WORDS * VANITY_SHA1_MAX_LANES];
+  unsigned char fpr[VANITY_MAX_FPR_LEN];
+  int use_digest, match;
+  u32 base, cur, h[VANITY_MAX_DIGEST_WORDS];
+  unsigned int lanes, nwords, i, j, n, w, item, hits, score = 0;
+  unsigned long long before;
+
+  /* The keyids are computed in batches for LANES consecutive creation
+     times starting at BASE.  A batch crossing the end of the window
+     is cut off; when sweeping backward the batch is moved so that it
+     ends at the current creation time CUR.  Patterns with fingerprint
+     items need the complete digests instead of the keyids.  The scan
+     of the matcher flags the candidates of a batch at once; most
+     batches have none.  */
+  use_digest = _vanity_pattern_need_digest (job->pattern);
+  nwords = _vanity_fpr_len (job->version) / 4;
+  if (use_digest)
+    lanes = _vanity_refkey_digest_lanes (refkey);
+  else
+    lanes = _vanity_refkey_lanes (refkey);
+  cur = job->backward? window->end : window->start;
+  while (!job->done)
+    {
+      if (!job->backward)
+        {
+          base = cur;
+          n = lanes;
+          if (n - 1 > window->end - base)
+            n = window->end - base + 1;
+        }
+      else
+        {
+          base = (cur - window->start >= lanes - 1
+                  ? cur - (lanes - 1) : window->start);
+          n = cur - base + 1;
+        }
+      if (use_digest)
+        _vanity_refkey_digests (refkey, base, digests);
+      else
+        _vanity_refkey_keyids (refkey, base, keyids);
+      hits = job->matcher.scan (&job->matcher,
+                                use_digest? digests : keyids, n);
+      for (j=0; j < n && hits; j++)
+        {
+          i = job->backward? n - 1 - j : j;
+          if (!(hits & (1u << i)))
+            continue;
+          hits &= ~(1u << i);
+          if (use_digest)
+            {
+              for (w=0; w < nwords; w++)
+                h[w] = digests[w * VANITY_SHA1_MAX_LANES + i];
+              if (job->scoring)
+                {
+                  score = _vanity_pattern_score_words (job->pattern, h,
+                                                       job->min_score, &item);
+                  match = score >= job->min_score? item + 1 : 0;
+                }
+              else
+                match = _vanity_pattern_check_words (job->pattern, h);
+              keyids[i] = job->version == 5? h[1] : h[4];
+            }
+          else
+            {
+              /* Confirm the candidate with the complete keyid.  */
+              _vanity_refkey_fingerprint (refkey, base + i, fpr);
+              match = vanity_pattern_check (job->pattern, fpr);
+            }
+          if (match)
+            {
+              worker->iterations += j + 1;
+              *r_timestamp = base + i;
+              *r_keyid = keyids[i];
+              *r_match = match - 1;
+              *r_score = score;
+              return 1;
+            }
+        }
+      before = worker->iterations;
+      worker->iterations += n;
+      if (before / PROGRESS_INTERVAL != worker->iterations / PROGRESS_INTERVAL)
+        {
+          npth_protect ();
+          log_debug ("worker %u progressed through %llu iterations\n",
+                     worker->no, worker->iterations);
+          npth_unprotect ();
+        }
+      if (!job->backward)
+        {
+          if (base + n - 1 == window->end)
+            break;
+          cur = base + n;
+        }
+      else
+        {
+          if (base == window->start)
+            break;
+          cur = base - 1;
+        }
+    }
+  return 0;
+}
+
+
+static void
+release_batch (struct key_batch_s *batch)
+{
+  if (!batch)
+    return;
+  gcry_sexp_release (batch->s_key);
+  if (batch->arena)
+    _vanity_arena_put (batch->arena, batch->seeds);
+  else if (batch->seeds)
+    {
+      wipememory (batch->seeds, 32 * VANITY_ED25519_BATCH);
+      xfree (batch->seeds);
+    }
+  gcry_mpi_release (batch->d);
+  xfree (batch->q);
+  xfree (batch);
+}
+
+
+/* Return the length of the secret of a batch of JOB in its pool.  */
+static size_t
+pool_seclen (vanity_job_t job)
+{
+  if (job->batch_keygen)
+    return 32 * VANITY_ED25519_BATCH;
+  return ((_vanity_ecc_qlen (job->ecc) - 1) / 2 + 7) / 8 * 8;
+}
+
+
+/* Derive the N seeds of batch COUNTER of the key stream STREAM of
+   the stream KEY and store them at SEEDS.  */
+static void
+stream_seeds (const unsigned char *key, unsigned int stream,
+              unsigned long long counter, unsigned int n,
+              unsigned char *seeds)
+{
+  unsigned char master[32];
+  unsigned int i;
+
+  _vanity_stream_master (key, stream, counter, master);
+  for (i=0; i < n; i++)
+    _vanity_gpu_seed (master, i, seeds + 32 * i);
+  wipememory (master, sizeof master);
+}
+
+
+/* Store the record of key IDX of BATCH with the creation time
+   TIMESTAMP at REF and return REF, or return NULL if the seeds of
+   BATCH do not come from a key stream.  */
+static const struct vanity_hit_ref_s *
+batch_ref (struct key_batch_s *batch, unsigned int idx, u32 timestamp,
+           struct vanity_hit_ref_s *ref)
+{
+  if (!batch->streamed)
+    return NULL;
+  ref->stream = batch->stream;
+  ref->counter = batch->counter;
+  ref->index = idx;
+  ref->timestamp = timestamp;
+  return ref;
+}
+
+
+/* Allocate the buffer for the seeds of BATCH, which is generated by
+   WORKER, from the arena of WORKER or, if that has no free slot, from
+   the secure heap.  */
+static gpg_error_t
+alloc_seeds (struct worker_s *worker, struct key_batch_s *batch)
+{
+  if (worker->arena)
+    {
+      batch->seeds = _vanity_arena_get (worker->arena);
+      if (batch->seeds)
+        {
+          batch->arena = worker->arena;
+          return 0;
+        }
+    }
+  batch->seeds = xtrymalloc_secure (32 * VANITY_ED25519_BATCH);
+  if (!batch->seeds)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Fill BATCH with the next batch stored in the pool of the job of
+   WORKER.  Returns GPG_ERR_EOF if all of them have been handed out.
+   Called without holding the npth lock.  */
+static gpg_error_t
+pool_batch (struct worker_s *worker, struct key_batch_s *batch)
+{
+  vanity_job_t job = worker->job;
+  gpg_error_t err;
+  unsigned char *secret = NULL;
+  size_t seclen = pool_seclen (job);
+
+  if (job->pool_type == VANITY_POOL_ED25519)
+    {
+      batch->qlen = 33;
+      batch->nkeys = VANITY_ED25519_BATCH;
+    }
+  else
+    {
+      batch->qlen = _vanity_ecc_qlen (job->ecc);
+      batch->nkeys = VANITY_ECC_BATCH;
+    }
+  batch->q = xtrymalloc (batch->qlen * batch->nkeys);
+  if (!batch->q)
+    return gpg_error_from_syserror ();
+  if (job->pool_type == VANITY_POOL_ED25519)
+    err = alloc_seeds (worker, batch);
+  else if (!(secret = xtrymalloc_secure (seclen)))
+    err = gpg_error_from_syserror ();
+  else
+    err = 0;
+  if (err)
+    return err;
+  npth_protect ();
+  err = _vanity_pool_next (job->pool, batch->q, secret? secret : batch->seeds,
+                           &batch->pool_rec);
+  npth_unprotect ();
+  if (!err && secret)
+    err = gcry_mpi_scan (&batch->d, GCRYMPI_FMT_USG, secret, seclen, NULL);
+  if (secret)
+    {
+      wipememory (secret, seclen);
+      xfree (secret);
+    }
+  if (!err)
+    batch->pooled = 1;
+  return err;
+}
+
+
+/* Add the batch BATCH just generated by JOB to its pool.  A failure
+   is logged and stops adding further batches.  Called without holding
+   the npth lock.  */
+static void
+add_to_pool (vanity_job_t job, struct key_batch_s *batch)
+{
+  gpg_error_t err = 0;
+  unsigned char *secret;
+  size_t seclen = pool_seclen (job);
+  size_t n;
+
+  if (batch->seeds)
+    secret = batch->seeds;
+  else
+    {
+      /* The scalar is stored with leading zeroes.  */
+      secret = xtrycalloc_secure (1, seclen);
+      if (!secret)
+        err = gpg_error_from_syserror ();
+      else
+        err = gcry_mpi_print (GCRYMPI_FMT_USG, secret, seclen, &n, batch->d);
+      if (!err)
+        {
+          memmove (secret + seclen - n, secret, n);
+          memset (secret, 0, seclen - n);
+        }
+    }
+
+  npth_protect ();
+  if (!err && (job->pool_flags & VANITY_POOL_ADD))
+    err = _vanity_pool_add (job->pool, batch->q, secret, &batch->pool_rec);
+  if (err)
+    {
+      log_error ("error adding keys to the vanity key pool: %s\n",
+                 gpg_strerror (err));
+      job->pool_flags &= ~VANITY_POOL_ADD;
+    }
+  else
+    batch->pooled = 1;
+  npth_unprotect ();
+
+  if (secret && secret != batch->seeds)
+    {
+      wipememory (secret, seclen);
+      xfree (secret);
+    }
+}
+
+
+/* Return true if key IDX of BATCH has been handed out of the pool
+   by an earlier search.  */
+static int
+dropped_key (struct key_batch_s *batch, unsigned int idx)
+{
+  return batch->pooled && !batch->q[idx * batch->qlen];
+}
+
+
+/* Clear key IDX of BATCH, which has been found, in the pool.  Called
+   without holding the npth lock.  */
+static void
+drop_from_pool (vanity_job_t job, struct key_batch_s *batch, unsigned int idx)
+{
+  gpg_error_t err;
+
+  if (!batch->pooled)
+    return;
+  npth_protect ();
+  err = _vanity_pool_drop (job->pool, batch->pool_rec, idx);
+  if (err)
+    log_error ("error removing a key from the vanity key pool: %s\n",
+               gpg_strerror (err));
+  npth_unprotect ();
+}
+
+
+/* Generate a batch of keys for the job of WORKER and store it at
+   R_BATCH.  The secrets are taken from the random stream of WORKER.
+   Called without holding the npth lock.  */
+static gpg_error_t
+generate_batch (struct worker_s *worker, struct key_batch_s **r_batch)
+{
+  vanity_job_t job = worker->job;
+  gpg_error_t err;
+  struct key_batch_s *batch;
+  unsigned char q[32 * VANITY_ED25519_BATCH];
+  unsigned int i;
+  double started;
+
+  *r_batch = NULL;
+
+  batch = xtrycalloc (1, sizeof *batch);
+  if (!batch)
+    return gpg_error_from_syserror ();
+
+  if (job->pool_type && (job->pool_flags & (VANITY_POOL_SWEEP
+                                            | VANITY_POOL_ONLY)))
+    {
+      err = pool_batch (worker, batch);
+      if (!err)
+        {
+          *r_batch = batch;
+          return 0;
+        }
+      release_batch (batch);
+      if (gpg_err_code (err) != GPG_ERR_EOF
+          || (job->pool_flags & VANITY_POOL_ONLY))
+        return err;
+      batch = xtrycalloc (1, sizeof *batch);
+      if (!batch)
+        return gpg_error_from_syserror ();
+    }
+
+  started = now_seconds ();
+  if (job->batch_keygen)
+    {
+      batch->qlen = 33;
+      batch->q = xtrymalloc (33 * VANITY_ED25519_BATCH);
+      if (!batch->q)
+        err = gpg_error_from_syserror ();
+      else
+        err = alloc_seeds (worker, batch);
+      if (err)
+        {
+          release_batch (batch);
+          return err;
+        }
+      if (job->stream_key)
+        {
+          batch->streamed = 1;
+          batch->stream = worker->stream;
+          batch->counter = worker->stream_next++;
+          stream_seeds (job->stream_key, batch->stream, batch->counter,
+                        VANITY_ED25519_BATCH, batch->seeds);
+        }
+      else
+        err = _vanity_rng_randomize (worker->rng, batch->seeds,
+                                     32 * VANITY_ED25519_BATCH);
+      if (err)
+        {
+          release_batch (batch);
+          return err;
+        }
+      _vanity_ed25519_keys (batch->seeds, VANITY_ED25519_BATCH, q);
+      for (i=0; i < VANITY_ED25519_BATCH; i++)
+        {
+          batch->q[33 * i] = 0x40;
+          memcpy (batch->q + 33 * i + 1, q + 32 * i, 32);
+        }
+      batch->nkeys = VANITY_ED25519_BATCH;
+    }
+  else if (job->ecc)
+    {
+      batch->qlen = _vanity_ecc_qlen (job->ecc);
+      batch->q = xtrymalloc (batch->qlen * VANITY_ECC_BATCH);
+      if (!batch->q)
+        {
+          err = gpg_error_from_syserror ();
+          release_batch (batch);
+          return err;
+        }
+      err = _vanity_ecc_keys (job->ecc, worker->rng, &batch->d, batch->q);
+      if (err)
+        {
+          npth_protect ();
+          log_error ("key generation failed: %s\n", gpg_strerror (err));
+          npth_unprotect ();
+          release_batch (batch);
+          return err;
+        }
+      batch->nkeys = VANITY_ECC_BATCH;
+    }
+  else
+    {
+      err = gcry_pk_genkey (&batch->s_key, job->keyparam);
+      if (err)
+        {
+          npth_protect ();
+          log_error ("key generation failed: %s\n", gpg_strerror (err));
+          npth_unprotect ();
+          xfree (batch);
+          return err;
+        }
+      batch->nkeys = 1;
+    }
+  worker->generated += batch->nkeys;
+  update_key_seconds (&worker->gen_seconds, now_seconds () - started,
+                      batch->nkeys);
+
+  if (job->pool_type && (job->pool_flags & VANITY_POOL_ADD))
+    add_to_pool (job, batch);
+
+  *r_batch = batch;
+  return 0;
+}
+
+
+/* Return the key number IDX of BATCH generated for JOB as a private
+   and a public key S-expression in the format returned by
+   gcry_pk_genkey.  */
+static gpg_error_t
+get_batch_key (vanity_job_t job, struct key_batch_s *batch, unsigned int idx,
+               gcry_sexp_t *r_private, gcry_sexp_t *r_public)
+{
+  gpg_error_t err;
+  gcry_mpi_t d;
+  const unsigned char *q = batch->q + idx * batch->qlen;
+
+  *r_private = NULL;
+  *r_public = NULL;
+
+  if (batch->s_key)
+    {
+      *r_private = gcry_sexp_find_token (batch->s_key, "private-key", 0);
+      *r_public = gcry_sexp_find_token (batch->s_key, "public-key", 0);
+      err = 0;
+    }
+  else if (batch->d)
+    {
+      d = gcry_mpi_snew (0);
+      gcry_mpi_add_ui (d, batch->d, idx);
+      err = gcry_sexp_build (r_private, NULL,
+                             "(private-key(ecc(curve %s)(q%b)(d%m)))",
+                             _vanity_ecc_curve (job->ecc),
+                             (int)batch->qlen, q, d);
+      gcry_mpi_release (d);
+      if (!err)
+        err = gcry_sexp_build (r_public, NULL,
+                               "(public-key(ecc(curve %s)(q%b)))",
+                               _vanity_ecc_curve (job->ecc),
+                               (int)batch->qlen, q);
+    }
+  else
+    {
+      err = gcry_sexp_build (r_private, NULL,
+                             "(private-key(ecc(curve Ed25519)(flags eddsa)"
+                             "(q%b)(d%b)))",
+                             33, q, 32, batch->seeds + 32 * idx);
+      if (!err)
+        err = gcry_sexp_build (r_public, NULL,
+                               "(public-key(ecc(curve Ed25519)(flags eddsa)"
+                               "(q%b)))", 33, q);
+    }
+  if (!err && (!*r_private || !*r_public))
+    err = gpg_error (GPG_ERR_INV_DATA);
+  if (err)
+    {
+      gcry_sexp_release (*r_private);
+      gcry_sexp_release (*r_public);
+      *r_private = NULL;
+      *r_public = NULL;
+    }
+  return err;
+}
+
+
+/* Take the oldest batch from the queue of WORKER and store it at
+   R_BATCH.  Returns false if the queue is empty.  Called without
+   holding the npth lock.  */
+static int
+take_batch (struct worker_s *worker, struct key_batch_s **r_batch)
+{
+  struct key_queue_s *queue = worker->queue;
+  int found = 0;
+
+  if (!queue)
+    return 0;
+  npth_protect ();
+  npth_mutex_lock (&queue->lock);
+  if (queue->count)
+    {
+      *r_batch = queue->slots[queue->head];
+      queue->head = (queue->head + 1) % queue->size;
+      queue->count--;
+      npth_cond_signal (&queue->not_full);
+      found = 1;
+    }
+  npth_mutex_unlock (&queue->lock);
+  npth_unprotect ();
+  return found;
+}
+
+
+/* Put BATCH into the queue of WORKER, waiting for a free slot.  If
+   the job is done in the meantime, the batch is released instead.
+   Called without holding the npth lock.  */
+static void
+put_batch (struct worker_s *worker, struct key_batch_s *batch)
+{
+  vanity_job_t job = worker->job;
+  struct key_queue_s *queue = worker->queue;
+
+  npth_protect ();
+  npth_mutex_lock (&queue->lock);
+  while (queue->count == queue->size && !job->done)
+    npth_cond_wait (&queue->not_full, &queue->lock);
+  if (!job->done)
+    {
+      queue->slots[(queue->head + queue->count) % queue->size] = batch;
+      queue->count++;
+      batch = NULL;
+    }
+  npth_mutex_unlock (&queue->lock);
+  npth_unprotect ();
+
+  release_batch (batch);
+}
+
+
+/* Put BATCH into the queue of WORKER if it has a free slot.  Returns
+   true if it did.  Called without holding the npth lock.  */
+static int
+offer_batch (struct worker_s *worker, struct key_batch_s *batch)
+{
+  struct key_queue_s *queue = worker->queue;
+  int done = 0;
+
+  npth_protect ();
+  npth_mutex_lock (&queue->lock);
+  if (queue->count < queue->size && !worker->job->done)
+    {
+      queue->slots[(queue->head + queue->count) % queue->size] = batch;
+      queue->count++;
+      done = 1;
+    }
+  npth_mutex_unlock (&queue->lock);
+  npth_unprotect ();
+  return done;
+}
+
+
+/* Return true if the hash WORKER shall generate keys for the device
+   instead of sweeping them itself: the device needs less time per
+   key and its queue is draining.  The fill level is read without the
+   lock; a stale value only delays the switch by a batch.  */
+static int
+feed_device (struct worker_s *worker)
+{
+  vanity_job_t job = worker->job;
+  struct key_queue_s *queue = worker->queue;
+
+  if (!job->gpu || job->gpu_keygen
+      || (job->quarantined & (1 << VANITY_PATH_GPU))
+      || queue != job->queues[0])
+    return 0;
+  if (!(job->gpu_key_seconds > 0 && worker->key_seconds > 0
+        && job->gpu_key_seconds < worker->key_seconds))
+    return 0;
+  return queue->count < queue->size / 2;
+}
+
+
+/* Load key number IDX of BATCH into the reference key of WORKER.  */
+static gpg_error_t
+set_batch_key (struct worker_s *worker, struct key_batch_s *batch,
+               unsigned int idx)
+{
+  vanity_job_t job = worker->job;
+
+  worker->keys++;
+  _vanity_refkey_quarantine (worker->refkey, job->quarantined);
+  if (batch->s_key)
+    return _vanity_refkey_set_key (worker->refkey, batch->s_key,
+                                   job->algo, job->oid, job->oidlen,
+                                   job->kdf[0]);
+  return _vanity_refkey_set_q (worker->refkey,
+                               batch->q + idx * batch->qlen, batch->qlen,
+                               job->algo, job->oid, job->oidlen, job->kdf[0]);
+}
+
+
+/* Load key number K of KEYS into the reference key of WORKER.  A
+   key generated by the device is recomputed from its seed.  */
+static gpg_error_t
+set_gpu_key (struct worker_s *worker, struct gpu_keys_s *keys,
+             unsigned int k)
+{
+  struct key_batch_s *check = &keys->check;
+
+  if (!keys->on_device)
+    return set_batch_key (worker, keys->batches[keys->batch[k]],
+                          keys->idx[k]);
+  _vanity_gpu_seed (keys->master, k, check->seeds);
+  _vanity_ed25519_keys (check->seeds, 1, check->q + 1);
+  check->q[0] = 0x40;
+  return set_batch_key (worker, check, 0);
+}
+
+
+/* Return the path that computed the fingerprints of the current key
+   of WORKER on the CPU.  */
+static int
+cpu_path (struct worker_s *worker)
+{
+  return _vanity_refkey_path (worker->refkey,
+                              _vanity_pattern_need_digest (worker->job->pattern));
+}
+
+
+/* Rebuild the key S_PUBLIC that WORKER found on PATH with the creation
+   time TIMESTAMP, the keyid KEYID, the pattern item MATCH and for a
+   scoring pattern the score SCORE from scratch and hash it with
+   libgcrypt; an ECDH key gets the KDF parameters with the index KDF.
+   Returns true if that confirms the hit.  Otherwise PATH is
+   quarantined, so that the key is not reported.  Called without
+   holding the npth lock.  */
+static int
+verify_hit (struct worker_s *worker, int path, gcry_sexp_t s_public,
+            u32 timestamp, u32 keyid, unsigned int match, unsigned int score,
+            unsigned int kdf)
+{
+  vanity_job_t job = worker->job;
+  vanity_refkey_t refkey;
+  unsigned char fpr[VANITY_MAX_FPR_LEN];
+  unsigned int item;
+  int ok;
+
+  ok = !_vanity_refkey_new (&refkey, s_public, job->algo, job->version);
+  if (ok && job->algo == PUBKEY_ALGO_ECDH)
+    ok = !_vanity_refkey_set_kdf (refkey, job->kdf[kdf]);
+  if (ok)
+    {
+      _vanity_refkey_reference_fpr (refkey, timestamp, fpr);
+      _vanity_refkey_release (refkey);
+      if (job->scoring)
+        ok = (vanity_pattern_score (job->pattern, fpr, &item) == score
+              && item == match);
+      else
+        ok = vanity_pattern_check (job->pattern, fpr) == match + 1;
+      ok = ok && _vanity_fpr_keyid (fpr, job->version) == keyid;
+    }
+
+  npth_protect ();
+  if (ok)
+    job->verify.checked[path]++;
+  else
+    {
+      job->verify.rejected[path]++;
+      if (path != VANITY_PATH_LIBGCRYPT
+          && !(job->verify.quarantined & (1 << path)))
+        {
+          log_error ("the %s path returned a wrong keyid %08lX;"
+                     " not using it any longer\n",
+                     vanity_path_name (path), (unsigned long)keyid);
+          job->verify.quarantined |= 1 << path;
+          job->quarantined = job->verify.quarantined;
+        }
+      else
+        log_error ("the %s path returned a wrong keyid %08lX\n",
+                   vanity_path_name (path), (unsigned long)keyid);
+    }
+  npth_unprotect ();
+  return ok;
+}
+
+
+/* Sweep the creation time of each key of BATCH over all windows of
+   the job of WORKER, once for each of the ECDH KDF parameters of the
+   job.  On a hit the key is stored in the job.  BATCH is released in
+   any case.  Returns an error code; finding no match is not an error.
+   Called without holding the npth lock.  */
+static gpg_error_t
+sweep_batch (struct worker_s *worker, struct key_batch_s *batch)
+{
+  vanity_job_t job = worker->job;
+  gpg_error_t err = 0;
+  gcry_sexp_t s_private, s_public;
+  struct vanity_hit_ref_s rbuf;
+  const struct vanity_hit_ref_s *ref = NULL;
+  struct vanity_window_s win;
+  u32 timestamp, keyid;
+  unsigned int i, k, w, match, score;
+  int found = 0;
+  double started = now_seconds ();
+  unsigned long long before = worker->iterations;
+
+  for (i=0; i < batch->nkeys && !job->done && !found; i++)
+    {
+      if (dropped_key (batch, i))
+        continue;
+      err = set_batch_key (worker, batch, i);
+      if (err)
+        break;
+      for (k=0; k < job->nkdfs && !job->done && !found; k++)
+        {
+          /* The KDF parameters are patched into the packet; that is
+             cheap compared to the window.  */
+          if (k && (err = _vanity_refkey_set_kdf (worker->refkey,
+                                                  job->kdf[k])))
+            break;
+          for (w=0; w < job->nwindows && !job->done && !found; w++)
+            {
+              get_window (job, w, &win);
+              found = sweep_window (worker, worker->refkey, &win,
+                                    &timestamp, &keyid, &match, &score);
+            }
+        }
+      if (err)
+        break;
+    }
+  if (!found && !job->done)
+    {
+      update_key_seconds (&worker->key_seconds, now_seconds () - started, i);
+      if (worker->iterations > before)
+        update_key_seconds (&worker->fpr_seconds,
+                            ((now_seconds () - started)
+                             / (worker->iterations - before)), 1);
+    }
+  if (found)
+    err = get_batch_key (job, batch, i - 1, &s_private, &s_public);
+  if (found && !err
+      && !verify_hit (worker, cpu_path (worker), s_public,
+                      timestamp, keyid, match, score, k - 1))
+    {
+      gcry_sexp_release (s_private);
+      gcry_sexp_release (s_public);
+      found = 0;
+    }
+  if (found && !err)
+    {
+      drop_from_pool (job, batch, i - 1);
+      ref = batch_ref (batch, i - 1, timestamp, &rbuf);
+    }
+  release_batch (batch);
+  if (err)
+    {
+      npth_protect ();
+      log_error ("key generation failed: invalid return value\n");
+      npth_unprotect ();
+      return err;
+    }
+  if (!found)
+    return 0;
+
+  npth_protect ();
+  report_hit (job, s_private, s_public, timestamp, keyid, match, score,
+              k - 1, ref);
+  npth_unprotect ();
+  return 0;
+}
+
+
+/* Scale the slice of the device WORKER so that the next call takes
+   about GPU_TARGET_SECONDS, given that the last one with the full
+   slice took SECONDS.  It grows at most twofold per call, since a
+   short call is dominated by the launch overhead.  */
+static void
+adapt_gpu_slice (struct worker_s *worker, double seconds)
+{
+  double slice = worker->gpu_slice;
+
+  if (seconds <= 0 || seconds * 2 < GPU_TARGET_SECONDS)
+    slice *= 2;
+  else
+    slice *= GPU_TARGET_SECONDS / seconds;
+  if (slice < GPU_MIN_SLICE)
+    slice = GPU_MIN_SLICE;
+  else if (slice > GPU_MAX_SLICE)
+    slice = GPU_MAX_SLICE;
+  worker->gpu_slice = (u32)slice;
+}
+
+
+/* Sweep WINDOW for all keys of KEYS on the device, in the direction
+   configured for the job of WORKER.  Returns true if a matching keyid
+   has been found; the index of the key in KEYS, its creation time,
+   the keyid and the index of the pattern item it matches are then
+   stored at R_KEY, R_TIMESTAMP, R_KEYID and R_MATCH.  If several keys
+   match, the one with the earliest creation time (the latest when
+   sweeping backward) is returned.  Called without holding the npth
+   lock.  */
+static gpg_error_t
+sweep_gpu_window (struct worker_s *worker, struct gpu_keys_s *keys,
+                  const struct vanity_window_s *window, int *r_found,
+                  unsigned int *r_key, u32 *r_timestamp, u32 *r_keyid,
+                  unsigned int *r_match)
+{
+  vanity_job_t job = worker->job;
+  struct vanity_gpu_hit_s hits[VANITY_GPU_MAX_HITS];
+  unsigned char fpr[VANITY_MAX_FPR_LEN];
+  gpg_error_t err;
+  u32 base, cur, n, slice = worker->gpu_slice;
+  unsigned int i, k, nhits;
+  unsigned long long before;
+  double started, seconds;
+  int match;
+
+  *r_found = 0;
+  cur = job->backward? window->end : window->start;
+  while (!job->done)
+    {
+      n = slice;
+      if (!job->backward)
+        {
+          base = cur;
+          if (n - 1 > window->end - base)
+            n = window->end - base + 1;
+        }
+      else
+        {
+          base = (cur - window->start >= n - 1
+                  ? cur - (n - 1) : window->start);
+          n = cur - base + 1;
+        }
+      started = now_seconds ();
+      err = _vanity_gpu_sweep (job->gpu, keys->on_device? NULL : keys->blocks,
+                               keys->nkeys, base, n, hits, &nhits);
+      if (err)
+        return err;
+      seconds = now_seconds () - started;
+      if (n == worker->gpu_slice)
+        adapt_gpu_slice (worker, seconds);
+      if (nhits > VANITY_GPU_MAX_HITS)
+        {
+          /* Too many candidates; retry with a smaller slice.  This
+             terminates because there is at most one candidate per
+             key and timestamp.  */
+          slice = n / 2;
+          continue;
+        }
+
+      for (i=0; i < nhits; i++)
+        {
+          k = hits[i].key;
+          if (*r_found
+              && (job->backward? hits[i].timestamp < *r_timestamp
+                  : hits[i].timestamp > *r_timestamp))
+            continue;
+          if (*r_found && hits[i].timestamp == *r_timestamp && k > *r_key)
+            continue;
+          err = set_gpu_key (worker, keys, k);
+          if (err)
+            return err;
+          _vanity_refkey_fingerprint (worker->refkey, hits[i].timestamp, fpr);
+          match = vanity_pattern_check (job->pattern, fpr);
+          if (!match)
+            continue;
+          *r_found = 1;
+          *r_key = k;
+          *r_timestamp = hits[i].timestamp;
+          *r_keyid = _vanity_fpr_keyid (fpr, job->version);
+          *r_match = match - 1;
+        }
+
+      before = worker->iterations;
+      worker->iterations += (unsigned long long)n * keys->nkeys;
+      if (before / PROGRESS_INTERVAL != worker->iterations / PROGRESS_INTERVAL)
+        {
+          npth_protect ();
+          log_debug ("worker %u progressed through %llu iterations\n",
+                     worker->no, worker->iterations);
+          npth_unprotect ();
+        }
+      if (*r_found)
+        break;
+      if (!job->backward)
+        {
+          if (base + n - 1 == window->end)
+            break;
+          cur = base + n;
+        }
+      else
+        {
+          if (base == window->start)
+            break;
+          cur = base - 1;
+        }
+    }
+  return 0;
+}
+
+
+/* Sweep all keys of the batches in KEYS over all windows of the job
+   of WORKER, using the device for the keys which fit into a single
+   SHA-1 block.  On a hit the key is stored in the job.  The batches
+   are released in any case.  Called without holding the npth
+   lock.  */
+static gpg_error_t
+sweep_gpu (struct worker_s *worker, struct gpu_keys_s *keys)
+{
+  vanity_job_t job = worker->job;
+  gpg_error_t err = 0;
+  gcry_sexp_t s_private, s_public;
+  struct key_batch_s *batch = NULL;
+  struct vanity_hit_ref_s rbuf;
+  const struct vanity_hit_ref_s *ref = NULL;
+  struct vanity_window_s win;
+  u32 timestamp, keyid;
+  unsigned int b, i, w, match, score = 0;
+  unsigned int k = 0;
+  int found = 0;
+  int path = VANITY_PATH_GPU;
+  double started;
+
+  keys->nkeys = 0;
+  for (b=0; b < keys->nbatches && !err && !found && !job->done; b++)
+    for (i=0; i < keys->batches[b]->nkeys && !found; i++)
+      {
+        if (dropped_key (keys->batches[b], i))
+          continue;
+        err = set_batch_key (worker, keys->batches[b], i);
+        if (err)
+          break;
+        if (_vanity_refkey_block (worker->refkey,
+                                  keys->blocks + 16 * keys->nkeys))
+          {
+            keys->batch[keys->nkeys] = b;
+            keys->idx[keys->nkeys] = i;
+            keys->nkeys++;
+            continue;
+          }
+        for (w=0; w < job->nwindows && !job->done && !found; w++)
+          {
+            get_window (job, w, &win);
+            found = sweep_window (worker, worker->refkey, &win,
+                                  &timestamp, &keyid, &match, &score);
+          }
+        if (found)
+          {
+            batch = keys->batches[b];
+            k = i;
+            path = cpu_path (worker);
+          }
+      }
+
+  started = now_seconds ();
+  for (w=0; w < job->nwindows && keys->nkeys && !err && !found && !job->done;
+       w++)
+    {
+      get_window (job, w, &win);
+      err = sweep_gpu_window (worker, keys, &win, &found,
+                              &k, &timestamp, &keyid, &match);
+      if (err)
+        {
+          npth_protect ();
+          log_error ("vanity sweep on the OpenCL device failed: %s\n",
+                     gpg_strerror (err));
+          npth_unprotect ();
+        }
+      else if (found)
+        {
+          batch = keys->batches[keys->batch[k]];
+          k = keys->idx[k];
+        }
+    }
+  if (keys->nkeys && !err && !found && !job->done)
+    update_key_seconds (&job->gpu_key_seconds, now_seconds () - started,
+                        keys->nkeys);
+
+  if (found)
+    err = get_batch_key (job, batch, k, &s_private, &s_public);
+  if (found && !err
+      && !verify_hit (worker, path, s_public, timestamp, keyid, match, score,
+                      0))
+    {
+      gcry_sexp_release (s_private);
+      gcry_sexp_release (s_public);
+      found = 0;
+    }
+  if (found && !err)
+    {
+      drop_from_pool (job, batch, k);
+      ref = batch_ref (batch, k, timestamp, &rbuf);
+    }
+  for (b=0; b < keys->nbatches; b++)
+    release_batch (keys->batches[b]);
+  keys->nbatches = 0;
+  keys->nkeys = 0;
+  if (err || !found)
+    return err;
+
+  npth_protect ();
+  report_hit (job, s_private, s_public, timestamp, keyid, match, score, 0,
+              ref);
+  npth_unprotect ();
+  return 0;
+}
+
+
+/* Prepare KEYS for the keys generated by the device WORKER: allocate
+   the master secret and the batch for a candidate and build the
+   template block.  Called without holding the npth lock.  */
+static gpg_error_t
+prepare_gpu_keygen (struct worker_s *worker, struct gpu_keys_s *keys)
+{
+  vanity_job_t job = worker->job;
+  struct key_batch_s *check = &keys->check;
+  gpg_error_t err;
+
+  keys->master = xtrymalloc_secure (32);
+  if (!keys->master)
+    return gpg_error_from_syserror ();
+  check->nkeys = 1;
+  check->qlen = 33;
+  check->q = xtrycalloc (1, 33);
+  if (!check->q)
+    return gpg_error_from_syserror ();
+  err = alloc_seeds (worker, check);
+  if (err)
+    return err;
+
+  check->q[0] = 0x40;
+  err = _vanity_refkey_set_q (worker->refkey, check->q, 33, job->algo,
+                              job->oid, job->oidlen, job->kdf[0]);
+  if (err)
+    return err;
+  if (!_vanity_refkey_block (worker->refkey, keys->tmpl))
+    return gpg_error (GPG_ERR_INTERNAL);
+  /* Q is the last field of the key packet, whose length in bits is
+     the last word of the block.  */
+  keys->qoff = keys->tmpl[15] / 8 - 32;
+  keys->on_device = 1;
+  return 0;
+}
+
+
+/* Generate VANITY_GPU_MAX_KEYS keys on the device WORKER with a fresh
+   master secret from its random stream or its key stream and sweep
+   them over all windows of its job.  On a hit the key is stored in the job.  Called
+   without holding the npth lock.  */
+static gpg_error_t
+sweep_gpu_keygen (struct worker_s *worker, struct gpu_keys_s *keys)
+{
+  vanity_job_t job = worker->job;
+  gpg_error_t err;
+  gcry_sexp_t s_private, s_public;
+  struct vanity_hit_ref_s rbuf;
+  struct vanity_window_s win;
+  u32 timestamp, keyid;
+  unsigned int w, k, match;
+  int found = 0;
+  double started;
+
+  if (job->stream_key)
+    {
+      keys->counter = worker->stream_next++;
+      _vanity_stream_master (job->stream_key, worker->stream, keys->counter,
+                             keys->master);
+    }
+  else
+    {
+      err = _vanity_rng_randomize (worker->rng, keys->master, 32);
+      if (err)
+        return err;
+    }
+  started = now_seconds ();
+  keys->nkeys = VANITY_GPU_MAX_KEYS;
+  err = _vanity_gpu_keygen (job->gpu, keys->master, keys->tmpl, keys->qoff,
+                            keys->nkeys);
+  if (!err)
+    worker->generated += keys->nkeys;
+  for (w=0; w < job->nwindows && !err && !found && !job->done; w++)
+    {
+      get_window (job, w, &win);
+      err = sweep_gpu_window (worker, keys, &win, &found,
+                              &k, &timestamp, &keyid, &match);
+    }
+  if (err)
+    {
+      npth_protect ();
+      log_error ("vanity key generation on the OpenCL device failed: %s\n",
+                 gpg_strerror (err));
+      npth_unprotect ();
+    }
+  else if (!found && !job->done)
+    {
+      update_key_seconds (&job->gpu_key_seconds, now_seconds () - started,
+                          keys->nkeys);
+      worker->keys += keys->nkeys;
+    }
+
+  if (found && !err)
+    err = set_gpu_key (worker, keys, k);
+  if (found && !err)
+    err = get_batch_key (job, &keys->check, 0, &s_private, &s_public);
+  if (found && !err
+      && !verify_hit (worker, VANITY_PATH_GPU, s_public, timestamp, keyid,
+                      match, 0, 0))
+    {
+      gcry_sexp_release (s_private);
+      gcry_sexp_release (s_public);
+      found = 0;
+    }
+  wipememory (keys->master, 32);
+  keys->nkeys = 0;
+  if (err || !found)
+    return err;
+
+  rbuf.stream = worker->stream;
+  rbuf.counter = keys->counter;
+  rbuf.index = k;
+  rbuf.timestamp = timestamp;
+  npth_protect ();
+  report_hit (job, s_private, s_public, timestamp, keyid, match, 0, 0,
+              job->stream_key? &rbuf : NULL);
+  npth_unprotect ();
+  return 0;
+}
+
+
+/* Collect queued batches for the device WORKER in KEYS until no
+   further batch is guaranteed to fit; if the queue is empty generate
+   one batch.  Called without holding the npth lock.  */
+static gpg_error_t
+collect_batches (struct worker_s *worker, struct gpu_keys_s *keys)
+{
+  struct key_batch_s *batch;
+  unsigned int n = 0;
+  gpg_error_t err;
+
+  keys->nbatches = 0;
+  while (n + VANITY_ECC_BATCH <= VANITY_GPU_MAX_KEYS
+         && take_batch (worker, &batch))
+    {
+      keys->batches[keys->nbatches++] = batch;
+      n += batch->nkeys;
+    }
+  if (keys->nbatches)
+    return 0;
+  err = generate_batch (worker, &batch);
+  if (!err)
+    keys->batches[keys->nbatches++] = batch;
+  return err;
+}
+
+
+/* Create the arena for the seeds of the batches WORKER generates.
+   A keygen thread needs a slot for each batch in its queue and for
+   each one taken by a worker, the others only for the batch they
+   sweep.  Without the arena the seeds come from the secure heap.
+   Must be called with the npth lock held.  */
+static void
+create_arena (struct worker_s *worker)
+{
+  vanity_job_t job = worker->job;
+  gpg_error_t err;
+  unsigned int nslots;
+
+  nslots = worker->keygen? 2 * worker->queue->size + 1 : 1;
+  err = _vanity_arena_new (&worker->arena, 32 * VANITY_ED25519_BATCH, nslots);
+  if (err && !job->arena_failed)
+    log_info ("can't lock memory for the vanity key secrets: %s\n",
+              gpg_strerror (err));
+  if (err)
+    job->arena_failed = 1;
+}
+
+
+/* The thread function of a hash worker or a keygen thread.  */
+static void *
+worker_thread (void *arg)
+{
+  struct worker_s *worker = arg;
+  vanity_job_t job = worker->job;
+  struct key_batch_s *batch;
+  struct gpu_keys_s *keys = NULL;
+  gpg_error_t err = 0;
+  double started, cpu;
+  int device;
+
+  /* Bind the thread before it allocates anything; see above.  */
+  if (job->cpus)
+    {
+      err = _vanity_cpus_bind (job->cpus, worker->cpu, worker->node);
+      if (err)
+        log_info ("error binding vanity worker %u: %s\n",
+                  worker->no, gpg_strerror (err));
+      err = 0;
+    }
+
+  if (!worker->keygen)
+    err = _vanity_refkey_new (&worker->refkey, NULL, job->algo,
+                              job->version);
+  if (!err && job->batch_keygen)
+    create_arena (worker);
+  if (!err && worker->gpu)
+    {
+      keys = xtrycalloc (1, sizeof *keys);
+      if (!keys)
+        err = gpg_error_from_syserror ();
+    }
+  npth_unprotect ();
+  /* Seeding may have to wait for the system RNG; do it outside of
+     the lock.  */
+  if (!err)
+    err = _vanity_rng_new (&worker->rng, job->random_level,
+                           job->reseed_interval);
+  if (!err && worker->gpu && job->gpu_keygen)
+    err = prepare_gpu_keygen (worker, keys);
+  while (!job->done && !err)
+    {
+      started = now_seconds ();
+      device = 0;
+      if (worker->keygen)
+        {
+          err = generate_batch (worker, &batch);
+          if (!err)
+            put_batch (worker, batch);
+        }
+      else if (worker->gpu && job->gpu_keygen
+               && !(job->quarantined & (1 << VANITY_PATH_GPU)))
+        {
+          device = 1;
+          err = sweep_gpu_keygen (worker, keys);
+        }
+      else if (worker->gpu
+               && !(job->quarantined & (1 << VANITY_PATH_GPU)))
+        {
+          device = 1;
+          err = collect_batches (worker, keys);
+          if (!err)
+            err = sweep_gpu (worker, keys);
+        }
+      else if (feed_device (worker))
+        {
+          err = generate_batch (worker, &batch);
+          if (!err && offer_batch (worker, batch))
+            worker->fed++;
+          else if (!err)
+            err = sweep_batch (worker, batch);
+        }
+      else if (take_batch (worker, &batch))
+        err = sweep_batch (worker, batch);
+      else
+        {
+          err = generate_batch (worker, &batch);
+          if (!err)
+            err = sweep_batch (worker, batch);
+        }
+      if (device)
+        worker->gpu_seconds += now_seconds () - started;
+      /* Without a CPU clock for the thread its busy time is
+         counted.  */
+      cpu = thread_cpu_seconds ();
+      worker->cpu_seconds = (cpu >= 0? cpu : worker->cpu_seconds
+                             + now_seconds () - started);
+      if (job->duty < 100 || job->active_workers)
+        throttle (worker, now_seconds () - started);
+    }
+  /* With VANITY_POOL_ONLY the stored keys have all been swept.  */
+  if (gpg_err_code (err) == GPG_ERR_EOF)
+    err = 0;
+  npth_protect ();
+  _vanity_refkey_release (worker->refkey);
+  worker->refkey = NULL;
+  _vanity_rng_release (worker->rng);
+  worker->rng = NULL;
+  if (keys)
+    {
+      xfree (keys->master);
+      if (keys->check.arena)
+        _vanity_arena_put (keys->check.arena, keys->check.seeds);
+      else if (keys->check.seeds)
+        {
+          wipememory (keys->check.seeds, 32 * VANITY_ED25519_BATCH);
+          xfree (keys->check.seeds);
+        }
+      xfree (keys->check.q);
+    }
+  xfree (keys);
+
+  if (err)
+    report_error (job, err);
+  if (!--job->nrunning && !job->done)
+    stop_job (job);
+
+  return NULL;
+}
+
+
+/* Add a batch queue with NSLOTS slots to JOB.  */
+static gpg_error_t
+create_queue (vanity_job_t job, unsigned int nslots)
+{
+  struct key_queue_s *queue;
+  int rc;
+
+  queue = xtrycalloc (1, sizeof *queue);
+  if (!queue)
+    return gpg_error_from_syserror ();
+  queue->size = nslots;
+  queue->slots = xtrycalloc (queue->size, sizeof *queue->slots);
+  if (!queue->slots)
+    {
+      xfree (queue);
+      return gpg_error_from_syserror ();
+    }
+  rc = npth_mutex_init (&queue->lock, NULL);
+  if (!rc)
+    {
+      rc = npth_cond_init (&queue->not_full, NULL);
+      if (rc)
+        npth_mutex_destroy (&queue->lock);
+    }
+  if (rc)
+    {
+      xfree (queue->slots);
+      xfree (queue);
+      return gpg_error_from_errno (rc);
+    }
+  job->queues[job->nqueues++] = queue;
+  return 0;
+}
+
+
+/* Release the batch queues of JOB with all batches still in them.  */
+static void
+destroy_queues (vanity_job_t job)
+{
+  struct key_queue_s *queue;
+
+  while (job->nqueues)
+    {
+      queue = job->queues[--job->nqueues];
+      for (; queue->count; queue->count--)
+        {
+          release_batch (queue->slots[queue->head]);
+          queue->head = (queue->head + 1) % queue->size;
+        }
+      npth_cond_destroy (&queue->not_full);
+      npth_mutex_destroy (&queue->lock);
+      xfree (queue->slots);
+      xfree (queue);
+    }
+}
+
+
+/* Return true if ALGO is one of the ECC algorithms.  */
+static int
+ecc_algo_p (int algo)
+{
+  return (algo == PUBKEY_ALGO_EDDSA || algo == PUBKEY_ALGO_ECDSA
+          || algo == PUBKEY_ALGO_ECDH);
+}
+
+
+/* Return true if the flags list of the key parameters KEYPARAM has
+   the flag NAME.  */
+static int
+has_keyparam_flag (gcry_sexp_t keyparam, const char *name)
+{
+  gcry_sexp_t l1;
+  const char *s;
+  size_t n;
+  int i, found = 0;
+
+  l1 = gcry_sexp_find_token (keyparam, "flags", 0);
+  for (i=1; l1 && !found && (s = gcry_sexp_nth_data (l1, i, &n)); i++)
+    found = (n == strlen (name) && !memcmp (s, name, n));
+  gcry_sexp_release (l1);
+  return found;
+}
+
+
+/* Check that the D and Q of the key HIT found by JOB belong together
+   by signing and verifying a message with libgcrypt.  For ECDH keys
+   this is done with ECDSA, which uses the same keys.  */
+static gpg_error_t
+check_key (vanity_job_t job, struct vanity_hit_s *hit)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_data, s_sig = NULL;
+  unsigned char hash[64];
+
+  memset (hash, 0x42, sizeof hash);
+  if (job->algo == PUBKEY_ALGO_EDDSA)
+    err = gcry_sexp_build (&s_data, NULL,
+                           "(data(flags eddsa)(hash-algo sha512)(value %b))",
+                           (int)sizeof hash, hash);
+  else
+    err = gcry_sexp_build (&s_data, NULL, "(data(flags raw)(value %b))",
+                           32, hash);
+  if (err)
+    return err;
+  err = gcry_pk_sign (&s_sig, s_data, hit->s_private);
+  if (!err)
+    err = gcry_pk_verify (s_sig, s_data, hit->s_public);
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_data);
+  return err;
+}
+
+
+/* Compute the fingerprint of the key HIT found by JOB the usual way
+   and make sure that it agrees with the kernels, which only computed
+   the keyid; verify_hit already checked that.  Also check the key
+   itself if it was not generated by libgcrypt.  */
+static gpg_error_t
+check_hit (vanity_job_t job, struct vanity_hit_s *hit)
+{
+  gpg_error_t err;
+  vanity_refkey_t refkey;
+  unsigned int item;
+  int ok;
+
+  err = _vanity_refkey_new (&refkey, hit->s_public, job->algo, job->version);
+  if (!err && job->algo == PUBKEY_ALGO_ECDH)
+    err = _vanity_refkey_set_kdf (refkey, job->kdf[hit->kdf]);
+  if (err)
+    {
+      _vanity_refkey_release (refkey);
+      return err;
+    }
+  _vanity_refkey_reference_fpr (refkey, hit->timestamp, hit->fpr);
+  _vanity_refkey_release (refkey);
+  if (job->scoring)
+    ok = (vanity_pattern_score (job->pattern, hit->fpr, &item) == hit->score
+          && item == hit->match);
+  else
+    ok = vanity_pattern_check (job->pattern, hit->fpr) == hit->match + 1;
+  if (_vanity_fpr_keyid (hit->fpr, job->version) != hit->keyid || !ok)
+    {
+      log_error ("vanity kernel returned a wrong keyid\n");
+      return gpg_error (GPG_ERR_INTERNAL);
+    }
+  if (job->batch_keygen || job->ecc)
+    {
+      err = check_key (job, hit);
+      if (err)
+        {
+          log_error ("vanity key generation returned a bad key: %s\n",
+                     gpg_strerror (err));
+          return gpg_error (GPG_ERR_INTERNAL);
+        }
+    }
+  return 0;
+}
+
+
+/* Release the keys collected by JOB.  */
+static void
+release_hits (vanity_job_t job)
+{
+  for (; job->nhits; job->nhits--)
+    {
+      gcry_sexp_release (job->hits[job->nhits - 1].s_private);
+      gcry_sexp_release (job->hits[job->nhits - 1].s_public);
+    }
+  memset (job->hits, 0, sizeof job->hits);
+}
+
+
+
+/* Return the number of workers to use if none has been configured;
+   that is one for each online CPU.  */
+unsigned int
+vanity_default_workers (void)
+{
+  long n;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+#else
+  n = 1;
+#endif
+  if (n < 1)
+    n = 1;
+  else if (n > MAX_WORKERS)
+    n = MAX_WORKERS;
+  return (unsigned int)n;
+}
+
+
+/* Create a new search job for keys of the OpenPGP algorithm ALGO,
+   which must be EdDSA, ECDSA, ECDH, RSA, DSA or Elgamal, generated
+   from KEYPARAM.  Unless windows are set, the creation times tried
+   are the VANITY_DEFAULT_WINDOW seconds up to TIMESTAMP, or the
+   VANITY_DEFAULT_WIDE_WINDOW seconds for the non-ECC algorithms.
+   KEYPARAM is not copied and must be valid until the job has been
+   released.  */
+gpg_error_t
+vanity_job_new (vanity_job_t *r_job, gcry_sexp_t keyparam,
+                int algo, u32 timestamp)
+{
+  gpg_error_t err;
+  vanity_job_t job;
+  unsigned int nbits;
+  u32 window;
+
+  *r_job = NULL;
+
+  if (!ecc_algo_p (algo) && algo != PUBKEY_ALGO_RSA
+      && algo != PUBKEY_ALGO_DSA && algo != PUBKEY_ALGO_ELGAMAL_E)
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+
+  job = xtrycalloc (1, sizeof *job);
+  if (!job)
+    return gpg_error_from_syserror ();
+
+  job->keyparam = keyparam;
+  job->algo = algo;
+  if (ecc_algo_p (algo))
+    {
+      err = _vanity_curve_oid (keyparam, job->oid, &job->oidlen, &nbits);
+      if (err)
+        {
+          xfree (job);
+          return err;
+        }
+      if (algo == PUBKEY_ALGO_ECDH)
+        _vanity_ecdh_kdf_params (nbits, job->kdf[0]);
+      window = VANITY_DEFAULT_WINDOW;
+    }
+  else
+    window = VANITY_DEFAULT_WIDE_WINDOW;
+  job->nkdfs = 1;
+  job->nwindows = 1;
+  job->windows[0].end = timestamp;
+  job->windows[0].start = timestamp > window? timestamp - window : 1;
+  job->default_window = 1;
+  job->max_hits = 1;
+  job->version = 4;
+
+  *r_job = job;
+  return 0;
+}
+
+
+void
+vanity_job_release (vanity_job_t job)
+{
+  if (!job)
+    return;
+  release_hits (job);
+  vanity_pattern_release (job->pattern);
+  _vanity_ecc_release (job->ecc);
+  if (job->stream_key)
+    {
+      wipememory (job->stream_key, VANITY_STREAM_KEYLEN);
+      xfree (job->stream_key);
+    }
+  xfree (job);
+}
+
+
+/* Set the number of worker threads for JOB.  A value of 0 selects
+   one worker per CPU or, with VANITY_PLACE_NO_SMT, per core.  */
+void
+vanity_set_workers (vanity_job_t job, unsigned int nworkers)
+{
+  if (nworkers > MAX_WORKERS)
+    nworkers = MAX_WORKERS;
+  job->nworkers = nworkers;
+}
+
+
+/* Search v5 keys with their SHA-256 fingerprints if VERSION is 5
+   instead of the default of 4.  This needs to be called before the
+   pattern is set.  */
+gpg_error_t
+vanity_set_version (vanity_job_t job, int version)
+{
+  if (version != 4 && version != 5)
+    return gpg_error (GPG_ERR_UNKNOWN_VERSION);
+  if (job->pattern && vanity_pattern_version (job->pattern) != version)
+    return gpg_error (GPG_ERR_CONFLICT);
+  job->version = version;
+  return 0;
+}
+
+
+/* Return the key version JOB searches for.  */
+int
+vanity_get_version (vanity_job_t job)
+{
+  return job->version;
+}
+
+
+/* Set the keyids JOB searches for to the pattern STRING.  See
+   vanity-match.c for the syntax.  Must be called with the npth lock
+   held.  */
+gpg_error_t
+vanity_set_pattern (vanity_job_t job, const char *string)
+{
+  gpg_error_t err;
+  vanity_pattern_t pattern;
+
+  /* Compiling a long list of patterns may take a while; don't block
+     the other threads meanwhile.  */
+  npth_unprotect ();
+  err = vanity_pattern_new_version (&pattern, string, job->version);
+  npth_protect ();
+  if (err)
+    return err;
+  vanity_pattern_release (job->pattern);
+  job->pattern = pattern;
+  job->scoring = vanity_pattern_is_scoring (pattern);
+  return 0;
+}
+
+
+/* Add the creation times from START to END, inclusive, to the
+   windows JOB sweeps.  The first window added replaces the default
+   window.  */
+gpg_error_t
+vanity_add_window (vanity_job_t job, u32 start, u32 end)
+{
+  if (!start || start > end)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (job->default_window)
+    {
+      job->nwindows = 0;
+      job->default_window = 0;
+      job->tuned_start = 0;
+    }
+  if (job->nwindows == VANITY_MAX_WINDOWS)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  job->windows[job->nwindows].start = start;
+  job->windows[job->nwindows].end = end;
+  job->nwindows++;
+  return 0;
+}
+
+
+/* The hash and key wrap algorithms OpenPGP allows in the KDF
+   parameters of an ECDH key; see pk_ecdh_encrypt_with_shared_point
+   in g10/ecdh.c.  */
+struct kdf_algo_s
+{
+  const char *name;
+  int id;
+};
+static const struct kdf_algo_s kdf_hashes[] =
+  {
+    { "SHA256", DIGEST_ALGO_SHA256 },
+    { "SHA384", DIGEST_ALGO_SHA384 },
+    { "SHA512", DIGEST_ALGO_SHA512 }
+  };
+static const struct kdf_algo_s kdf_ciphers[] =
+  {
+    { "AES128", CIPHER_ALGO_AES },
+    { "AES", CIPHER_ALGO_AES },
+    { "AES192", CIPHER_ALGO_AES192 },
+    { "AES256", CIPHER_ALGO_AES256 }
+  };
+
+
+/* Return the id of the algorithm with the name of length LEN at S in
+   the table TABLE with N entries, or 0 if there is none.  */
+static int
+kdf_algo_id (const char *s, size_t len, const struct kdf_algo_s *table,
+             unsigned int n)
+{
+  unsigned int i;
+
+  for (i=0; i < n; i++)
+    if (strlen (table[i].name) == len
+        && !ascii_strncasecmp (s, table[i].name, len))
+      return table[i].id;
+  return 0;
+}
+
+
+/* Add the KDF parameters for the hash algorithm HASH and the key wrap
+   algorithm CIPHER to those JOB tries, unless they are already
+   there.  */
+static gpg_error_t
+add_kdf (vanity_job_t job, int hash, int cipher)
+{
+  unsigned char kdf[VANITY_KDF_PARAMS_LEN];
+  unsigned int i;
+
+  kdf[0] = 3; /* Number of bytes to follow. */
+  kdf[1] = 1; /* Version for KDF+AESWRAP.   */
+  kdf[2] = hash;
+  kdf[3] = cipher;
+  for (i=0; i < job->nkdfs; i++)
+    if (!memcmp (job->kdf[i], kdf, sizeof kdf))
+      return 0;
+  if (job->nkdfs == VANITY_MAX_KDFS)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  memcpy (job->kdf[job->nkdfs++], kdf, sizeof kdf);
+  return 0;
+}
+
+
+/* Set the KDF parameters the ECDH keys of JOB are tried with from
+   STRING, a list of HASH/CIPHER pairs such as "SHA256/AES128"
+   separated by commas or white space; HASH is SHA256, SHA384 or
+   SHA512 and CIPHER AES128, AES192 or AES256.  "all" stands for all
+   of them.  Each key is swept over all windows once for each of the
+   parameters, in the order given, so that a single key yields as many
+   fingerprints for each creation time.  The first pair replaces the
+   default parameters of the curve; to keep them they must be listed
+   first.  Returns GPG_ERR_PUBKEY_ALGO if JOB is not for ECDH keys.  */
+gpg_error_t
+vanity_set_kdf_params (vanity_job_t job, const char *string)
+{
+  gpg_error_t err = 0;
+  const char *s = string;
+  size_t n;
+  int hash, cipher, h, c;
+
+  if (job->algo != PUBKEY_ALGO_ECDH)
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+  job->nkdfs = 0;
+  while (*s && !err)
+    {
+      while (*s == ',' || spacep (s))
+        s++;
+      if (!*s)
+        break;
+      for (n=0; s[n] && s[n] != ',' && s[n] != '/' && !spacep (s + n); n++)
+        ;
+      if (n == 3 && s[n] != '/' && !ascii_strncasecmp (s, "all", 3))
+        {
+          for (h=0; h < DIM (kdf_hashes) && !err; h++)
+            for (c=0; c < DIM (kdf_ciphers) && !err; c++)
+              if (strcmp (kdf_ciphers[c].name, "AES"))
+                err = add_kdf (job, kdf_hashes[h].id, kdf_ciphers[c].id);
+          s += n;
+          continue;
+        }
+      hash = kdf_algo_id (s, n, kdf_hashes, DIM (kdf_hashes));
+      if (!hash || s[n] != '/')
+        {
+          err = gpg_error (GPG_ERR_INV_VALUE);
+          break;
+        }
+      s += n + 1;
+      for (n=0; s[n] && s[n] != ',' && !spacep (s + n); n++)
+        ;
+      cipher = kdf_algo_id (s, n, kdf_ciphers, DIM (kdf_ciphers));
+      if (!cipher)
+        {
+          err = gpg_error (GPG_ERR_INV_VALUE);
+          break;
+        }
+      s += n;
+      err = add_kdf (job, hash, cipher);
+    }
+  if (!err && !job->nkdfs)
+    err = gpg_error (GPG_ERR_INV_VALUE);
+  if (err)
+    {
+      /* Fall back to the default parameters of the curve.  */
+      unsigned char oid[VANITY_MAX_OIDLEN];
+      size_t oidlen;
+      unsigned int nbits;
+
+      job->nkdfs = 1;
+      if (!_vanity_curve_oid (job->keyparam, oid, &oidlen, &nbits))
+        _vanity_ecdh_kdf_params (nbits, job->kdf[0]);
+    }
+  return err;
+}
+
+
+/* Set the windows of JOB from STRING, a list of START/END pairs of
+   seconds since Epoch separated by commas or white space.  */
+gpg_error_t
+vanity_set_windows (vanity_job_t job, const char *string)
+{
+  gpg_error_t err;
+  const char *s = string;
+  char *endp;
+  unsigned long start, end;
+
+  while (*s)
+    {
+      while (*s == ',' || spacep (s))
+        s++;
+      if (!*s)
+        break;
+      if (!digitp (s))
+        return gpg_error (GPG_ERR_INV_VALUE);
+      start = strtoul (s, &endp, 10);
+      if (*endp != '/' || !digitp (endp + 1))
+        return gpg_error (GPG_ERR_INV_VALUE);
+      s = endp + 1;
+      end = strtoul (s, &endp, 10);
+      s = endp;
+      if (*s && *s != ',' && !spacep (s))
+        return gpg_error (GPG_ERR_INV_VALUE);
+      if (start > 0xffffffff || end > 0xffffffff)
+        return gpg_error (GPG_ERR_INV_VALUE);
+      err = vanity_add_window (job, start, end);
+      if (err)
+        return err;
+    }
+  if (job->default_window)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  return 0;
+}
+
+
+/* Let JOB shrink its default window to what the rates of the host
+   need if AUTOTUNE is true.  The window found is kept for the next
+   searches of JOB.  */
+void
+vanity_set_autotune (vanity_job_t job, int autotune)
+{
+  job->autotune = !!autotune;
+  if (!autotune)
+    job->tuned_start = 0;
+}
+
+
+/* Sweep the windows of JOB from their end to their start if BACKWARD
+   is true.  The default is to start with the oldest creation time.  */
+void
+vanity_set_backward (vanity_job_t job, int backward)
+{
+  job->backward = !!backward;
+}
+
+
+/* Let JOB sweep also on an OpenCL device if USE_GPU is true.  This
+   is only done if a device is found and supports the pattern.  */
+void
+vanity_set_gpu (vanity_job_t job, int use_gpu)
+{
+  job->use_gpu = !!use_gpu;
+}
+
+
+/* Reseed the random stream of each worker of JOB from the system RNG
+   after it produced KBYTES KiB of secrets; 0 selects the default of
+   VANITY_RESEED_INTERVAL.  */
+void
+vanity_set_reseed_interval (vanity_job_t job, unsigned int kbytes)
+{
+  job->reseed_interval = (size_t)kbytes * 1024;
+}
+
+
+/* Set how the workers of JOB are placed on the CPUs to the
+   VANITY_PLACE_ flags FLAGS.  */
+void
+vanity_set_placement (vanity_job_t job, unsigned int flags)
+{
+  job->placement = flags;
+}
+
+
+/* Let JOB collect NHITS keys, at most VANITY_MAX_HITS, instead of
+   stopping at the first.  If SECONDS is not 0 the search stops after
+   that time with the keys found so far; NHITS may then be 0 to
+   collect as many as possible.  For a scoring pattern NHITS is the
+   number of best keys kept.  */
+void
+vanity_set_hits (vanity_job_t job, unsigned int nhits, unsigned long seconds)
+{
+  if (!nhits)
+    nhits = seconds? VANITY_MAX_HITS : 1;
+  else if (nhits > VANITY_MAX_HITS)
+    nhits = VANITY_MAX_HITS;
+  job->max_hits = nhits;
+  job->budget = seconds;
+}
+
+
+/* Stop JOB after it computed about ITERATIONS fingerprints with the
+   keys found so far; 0 removes the limit.  Together with the time
+   budget of vanity_set_hits, whichever comes first ends the search.
+   A search with a scoring pattern needs at least one of them.  */
+void
+vanity_set_max_iterations (vanity_job_t job, unsigned long long iterations)
+{
+  job->max_iterations = iterations;
+}
+
+
+/* Call CB with OPAQUE every VANITY_PROGRESS_INTERVAL seconds while
+   JOB is searched.  CB is called from the thread running
+   vanity_search with the npth lock held.  */
+void
+vanity_set_progress (vanity_job_t job, vanity_progress_t cb, void *opaque)
+{
+  job->progress_cb = cb;
+  job->progress_opaque = opaque;
+}
+
+
+/* Limit the hash workers of JOB by the hour of the day according to
+   SCHEDULE; see _vanity_governor_parse for its syntax.  NULL or an
+   empty string removes the limits.  */
+gpg_error_t
+vanity_set_governor (vanity_job_t job, const char *schedule)
+{
+  struct vanity_governor_s gov;
+  gpg_error_t err;
+
+  gov = job->governor;
+  err = _vanity_governor_parse (&gov, schedule? schedule : "");
+  if (err)
+    return err;
+  job->governor = gov;
+  return 0;
+}
+
+
+/* Limit the memory of the searches of JOB to JOB_LIMIT bytes and of
+   each of its hash workers to WORKER_LIMIT bytes; 0 removes a limit.
+   A search starts only as many workers as fit into the limit of the
+   job and fails with GPG_ERR_ENOMEM if not even one does.  */
+void
+vanity_set_memory_limit (vanity_job_t job, size_t job_limit,
+                         size_t worker_limit)
+{
+  job->memory_limit = job_limit;
+  job->worker_memory_limit = worker_limit;
+}
+
+
+/* Lower the duty cycle of the hash workers of JOB while the hottest
+   thermal zone of the host is above CELSIUS degrees; 0 removes the
+   limit.  */
+void
+vanity_set_temperature_limit (vanity_job_t job, int celsius)
+{
+  job->governor.temp_limit = celsius > 0? celsius : 0;
+}
+
+
+/* Let JOB sweep first the keys stored in POOL and store the keys it
+   generates there, as selected by the VANITY_POOL_ FLAGS.  A pool is
+   only used for Ed25519 keys and for incremental ECDSA and ECDH
+   keys; POOL must stay open until the job has been released.  */
+void
+vanity_set_pool (vanity_job_t job, vanity_pool_t pool, unsigned int flags)
+{
+  job->pool = pool;
+  job->pool_flags = pool? flags : 0;
+}
+
+
+/* Derive the seeds of the Ed25519 keys of JOB from the stream KEY of
+   VANITY_STREAM_KEYLEN bytes instead of the system RNG, or stop doing
+   so if KEY is NULL.  A key found is then only recorded by its
+   position in the key streams, see vanity_get_hit_ref, until the
+   search ends.  Each search of JOB uses new streams; the same KEY
+   must not be given to another job since it would generate the same
+   keys.  Other kinds of keys are not affected.  */
+gpg_error_t
+vanity_set_stream_key (vanity_job_t job, const unsigned char *key)
+{
+  if (job->stream_key)
+    {
+      wipememory (job->stream_key, VANITY_STREAM_KEYLEN);
+      xfree (job->stream_key);
+      job->stream_key = NULL;
+    }
+  if (!key)
+    return 0;
+  job->stream_key = xtrymalloc_secure (VANITY_STREAM_KEYLEN);
+  if (!job->stream_key)
+    return gpg_error_from_syserror ();
+  memcpy (job->stream_key, key, VANITY_STREAM_KEYLEN);
+  return 0;
+}
+
+
+/* Restrict the searches of JOB to the COUNT key streams starting at
+   FIRST; a COUNT of 0 removes the limit.  Each thread of a search
+   takes one of the streams, so that the hosts given disjoint ranges
+   of streams for the same stream key never check the same key.  A
+   search fails with GPG_ERR_LIMIT_REACHED if not enough of the
+   streams are left; see vanity_get_stream_next.  */
+gpg_error_t
+vanity_set_stream_range (vanity_job_t job, unsigned int first,
+                         unsigned int count)
+{
+  if (count && first > (unsigned int)-1 - count)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  job->stream_base = first;
+  job->stream_end = count? first + count : 0;
+  return 0;
+}
+
+
+/* Set the limits of the workers of JOB for the current time and the
+   temperature read from POWER.  Must be called with the npth lock
+   held.  */
+static void
+run_governor (vanity_job_t job, vanity_power_t power)
+{
+  struct tm *tp;
+  time_t now;
+  unsigned int duty, nworkers;
+  int celsius;
+
+  if (job->governor.temp_limit
+      && _vanity_power_temperature (power, &celsius))
+    _vanity_governor_thermal (&job->governor, celsius);
+  now = time (NULL);
+  tp = localtime (&now);
+  _vanity_governor_limits (&job->governor, tp? tp->tm_hour : 0,
+                           &duty, &nworkers);
+  if (duty != job->duty || nworkers != job->active_workers)
+    {
+      if (nworkers)
+        log_debug ("vanity governor: duty cycle %u%%, at most %u hash"
+                   " workers\n", duty, nworkers);
+      else
+        log_debug ("vanity governor: duty cycle %u%%, all hash workers\n",
+                   duty);
+    }
+  job->duty = duty;
+  job->active_workers = nworkers;
+}
+
+
+/* Resize the default window of JOB from the average times the
+   NSTARTED WORKERS measured; see the comment at the top.  Without the
+   dedicated keygen threads, which share the CPUs with them, the hash
+   workers could either generate KEYRATE keys per second or compute
+   HASHRATE fingerprints per second, plus those of the device unless
+   it generates its own keys.  Each key is swept over the window once
+   for each of the KDF parameters.  Must be called with the npth lock
+   held.  */
+static void
+run_autotune (vanity_job_t job, struct worker_s *workers,
+              unsigned int nstarted)
+{
+  struct worker_s *w;
+  double gen = 0, fpr = 0, devrate = 0, keyrate, hashrate, want;
+  unsigned int i, ngen = 0, nfpr = 0, nhash = 0;
+  u32 end, policy, cur, window;
+
+  if (!job->autotune || !job->default_window || job->nwindows != 1)
+    return;
+  for (i=0; i < nstarted; i++)
+    {
+      w = workers + i;
+      if (w->gpu)
+        {
+          if (!job->gpu_keygen && w->gpu_seconds > 0)
+            devrate = w->iterations / w->gpu_seconds;
+          continue;
+        }
+      if (w->gen_seconds > 0)
+        {
+          gen += w->gen_seconds;
+          ngen++;
+        }
+      if (w->keygen)
+        continue;
+      nhash++;
+      if (w->fpr_seconds > 0)
+        {
+          fpr += w->fpr_seconds;
+          nfpr++;
+        }
+    }
+  if (!ngen || !nhash || (!nfpr && !devrate))
+    return;  /* Not yet measured.  */
+  keyrate = nhash / (gen / ngen);
+  hashrate = (nfpr? nhash / (fpr / nfpr) : 0) + devrate;
+  want = AUTOTUNE_OVERHEAD * hashrate / (keyrate * job->nkdfs);
+
+  end = job->windows[0].end;
+  policy = end - job->windows[0].start + 1;
+  cur = job->tuned_start? end - job->tuned_start + 1 : policy;
+  if (want >= policy)
+    window = policy;
+  else if (want < AUTOTUNE_MIN_WINDOW)
+    window = AUTOTUNE_MIN_WINDOW < policy? AUTOTUNE_MIN_WINDOW : policy;
+  else
+    window = (u32)want;
+  if ((double)window * 4 > (double)cur * 3
+      && (double)window * 4 < (double)cur * 5)
+    return;
+
+  log_debug ("vanity autotune: window of %lu seconds for %.0f keys and"
+             " %.0f fingerprints per second\n",
+             (unsigned long)window, keyrate, hashrate);
+  job->tuned_start = window < policy? end - window + 1 : 0;
+}
+
+
+/* Call the progress callback of JOB, if any, until it is done and
+   stop it when its time or iteration budget is used up.  The counters of the
+   NSTARTED WORKERS are read while they are updated; a slightly stale
+   sum is good enough here.  The search is memoryless, thus the
+   expected time to a hit depends only on the current rate.  This
+   also runs the governor and reads the energy counters of POWER
+   often enough that they can't wrap unnoticed.  Must be called with
+   the npth lock held.  */
+static void
+report_progress (vanity_job_t job, struct worker_s *workers,
+                 unsigned int nstarted, vanity_power_t power)
+{
+  gpg_error_t err;
+  struct vanity_progress_s prog;
+  unsigned long long last_iterations = 0, last_keys = 0;
+  unsigned long long total;
+  time_t started, last, now;
+  double joules, last_joules = 0;
+  unsigned int ticks = 0, govticks = 0;
+  unsigned int i;
+  int celsius;
+
+  memset (&prog, 0, sizeof prog);
+  prog.probability = vanity_pattern_probability (job->pattern);
+  started = last = gnupg_get_time ();
+  while (!job->done)
+    {
+      npth_usleep (PROGRESS_TICK);
+      ticks++;
+      if (++govticks >= GOVERNOR_INTERVAL * (1000000 / PROGRESS_TICK))
+        {
+          govticks = 0;
+          run_governor (job, power);
+          run_autotune (job, workers, nstarted);
+          _vanity_power_energy (power, &joules);
+        }
+      if (job->budget && !job->done
+          && gnupg_get_time () - started >= job->budget)
+        {
+          log_debug ("vanity search budget of %lu seconds used up\n",
+                     job->budget);
+          stop_job (job);
+        }
+      if (job->max_iterations && !job->done)
+        {
+          for (total=0, i=0; i < nstarted; i++)
+            total += workers[i].iterations;
+          if (total >= job->max_iterations)
+            {
+              log_debug ("vanity search budget of %llu iterations used up\n",
+                         job->max_iterations);
+              stop_job (job);
+            }
+        }
+      if (job->done || !job->progress_cb
+          || ticks < VANITY_PROGRESS_INTERVAL * (1000000 / PROGRESS_TICK))
+        continue;
+      ticks = 0;
+      prog.iterations = prog.keys = prog.generated = 0;
+      prog.gpu_iterations = prog.gpu_keys = 0;
+      prog.cpu_seconds = prog.gpu_seconds = 0;
+      for (i=0; i < nstarted; i++)
+        {
+          prog.iterations += workers[i].iterations;
+          prog.keys += workers[i].keys;
+          prog.generated += workers[i].generated;
+          prog.cpu_seconds += workers[i].cpu_seconds;
+          prog.gpu_seconds += workers[i].gpu_seconds;
+          if (workers[i].gpu)
+            {
+              prog.gpu_iterations += workers[i].iterations;
+              prog.gpu_keys += workers[i].keys;
+            }
+        }
+      /* The counts are read without the locks of the queues.  */
+      prog.queued = prog.queue_slots = 0;
+      for (i=0; i < job->nqueues; i++)
+        {
+          prog.queued += job->queues[i]->count;
+          prog.queue_slots += job->queues[i]->size;
+        }
+      now = gnupg_get_time ();
+      prog.watts = prog.keys_per_joule = -1;
+      if (now > last)
+        {
+          prog.hash_rate = (double)(prog.iterations - last_iterations)
+                           / (now - last);
+          prog.key_rate = (double)(prog.keys - last_keys) / (now - last);
+          if (_vanity_power_energy (power, &joules) && joules > last_joules)
+            {
+              prog.watts = (joules - last_joules) / (now - last);
+              prog.keys_per_joule = ((double)(prog.keys - last_keys)
+                                     / (joules - last_joules));
+              last_joules = joules;
+            }
+          last_iterations = prog.iterations;
+          last_keys = prog.keys;
+          last = now;
+        }
+      prog.temperature = (_vanity_power_temperature (power, &celsius)
+                          ? celsius : -1);
+      prog.duty = job->duty;
+      prog.active_workers = job->active_workers;
+      prog.elapsed = now - started;
+      if (prog.hash_rate > 0 && prog.probability > 0)
+        prog.eta = 1.0 / (prog.probability * prog.hash_rate);
+      else
+        prog.eta = -1;
+      err = job->progress_cb (job->progress_opaque, &prog);
+      if (err)
+        report_error (job, err);
+    }
+}
+
+
+/* Return the bytes of a key batch of JOB besides the seeds, which
+   are in the arenas.  */
+static size_t
+batch_memory (vanity_job_t job)
+{
+  size_t n = sizeof (struct key_batch_s);
+
+  if (job->batch_keygen)
+    n += 33 * VANITY_ED25519_BATCH;
+  else if (job->ecc)
+    n += (_vanity_ecc_qlen (job->ecc) * VANITY_ECC_BATCH
+          + pool_seclen (job) + MPI_OVERHEAD);
+  else
+    n += MAX_KEY_SEXP_LEN;
+  return n;
+}
+
+
+/* Store the memory the search of JOB with NWORKERS hash workers and
+   NGPU device workers needs at MEM.  Each thread holds one batch and
+   the device worker up to the batches of VANITY_GPU_MAX_KEYS keys;
+   the others are in the queues.  */
+static void
+plan_memory (vanity_job_t job, unsigned int nworkers, unsigned int ngpu,
+             struct vanity_memory_s *mem)
+{
+  size_t batch = batch_memory (job);
+  size_t slotlen = 32 * VANITY_ED25519_BATCH;
+  unsigned int nkeygen, nthreads, nqueued;
+
+  nkeygen = 0;
+  if (nworkers > 1 || ngpu)
+    nkeygen = (job->cpus && job->cpus->nnodes < nworkers
+               ? job->cpus->nnodes : job->cpus? nworkers : 1);
+  nthreads = nworkers + nkeygen + ngpu;
+  nqueued = (nkeygen? (nworkers * QUEUED_BATCHES_PER_WORKER
+                       + GPU_QUEUED_BATCHES * ngpu) : 0);
+
+  memset (mem, 0, sizeof *mem);
+  mem->nworkers = nworkers;
+  mem->pattern = _vanity_pattern_memory (job->pattern);
+  mem->tables = job->ecc? _vanity_ecc_memory (job->ecc) : 0;
+  mem->threads = (nthreads * (sizeof (struct worker_s) + _vanity_rng_memory ())
+                  + (nworkers + ngpu) * _vanity_refkey_memory ());
+  mem->batches = ((nworkers + nkeygen + nqueued) * batch
+                  + nkeygen * sizeof (struct key_queue_s)
+                  + nqueued * sizeof (struct key_batch_s *));
+  mem->device = ngpu * (sizeof (struct gpu_keys_s)
+                        + VANITY_GPU_MAX_KEYS / VANITY_ED25519_BATCH * batch);
+  if (job->batch_keygen)
+    {
+      mem->arenas = (nworkers + ngpu) * _vanity_arena_memory (slotlen, 1);
+      if (nkeygen)
+        mem->arenas += nkeygen * _vanity_arena_memory
+          (slotlen, 2 * ((nqueued + nkeygen - 1) / nkeygen) + 1);
+    }
+  mem->total = (mem->pattern + mem->tables + mem->threads + mem->batches
+                + mem->arenas + mem->device);
+
+  mem->per_worker = (sizeof (struct worker_s) + _vanity_rng_memory ()
+                     + _vanity_refkey_memory () + batch);
+  if (nkeygen)
+    mem->per_worker += (QUEUED_BATCHES_PER_WORKER
+                        * (batch + sizeof (struct key_batch_s *)));
+  if (job->batch_keygen)
+    {
+      mem->per_worker += _vanity_arena_memory (slotlen, 1);
+      if (nkeygen)
+        mem->per_worker += 2 * QUEUED_BATCHES_PER_WORKER * slotlen;
+    }
+}
+
+
+/* Plan the memory of the search of JOB with up to *R_NWORKERS hash
+   workers and NGPU device workers into JOB->MEMORY and lower
+   *R_NWORKERS until the search fits into the limit of the job.  */
+static gpg_error_t
+fit_memory (vanity_job_t job, unsigned int *r_nworkers, unsigned int ngpu)
+{
+  struct vanity_memory_s *mem = &job->memory;
+  unsigned int n = *r_nworkers;
+
+  plan_memory (job, n, ngpu, mem);
+  if (job->worker_memory_limit && mem->per_worker > job->worker_memory_limit)
+    {
+      log_error ("a vanity worker needs %lu KiB, more than its limit"
+                 " of %lu KiB\n", (unsigned long)(mem->per_worker / 1024),
+                 (unsigned long)(job->worker_memory_limit / 1024));
+      return gpg_error (GPG_ERR_ENOMEM);
+    }
+  while (job->memory_limit && mem->total > job->memory_limit && n > 1)
+    plan_memory (job, --n, ngpu, mem);
+  if (job->memory_limit && mem->total > job->memory_limit)
+    {
+      log_error ("the vanity search needs %lu KiB, more than its limit"
+                 " of %lu KiB\n", (unsigned long)(mem->total / 1024),
+                 (unsigned long)(job->memory_limit / 1024));
+      return gpg_error (GPG_ERR_ENOMEM);
+    }
+  if (n < *r_nworkers)
+    log_info ("the memory limit allows only %u of %u vanity workers\n",
+              n, *r_nworkers);
+  *r_nworkers = n;
+  log_debug ("vanity search memory: %lu KiB for the pattern, %lu KiB for"
+             " tables, %lu KiB for %u workers, %lu KiB for batches,"
+             " %lu KiB locked, %lu KiB for the device\n",
+             (unsigned long)(mem->pattern / 1024),
+             (unsigned long)(mem->tables / 1024),
+             (unsigned long)(mem->threads / 1024), n,
+             (unsigned long)(mem->batches / 1024),
+             (unsigned long)(mem->arenas / 1024),
+             (unsigned long)(mem->device / 1024));
+  return 0;
+}
+
+
+/* Run the search for JOB.  This starts the workers and waits until
+   they found the number of matching keys set with vanity_set_hits or
+   its time budget is used up.  On success the private and the public
+   part of the first key are stored at R_PRIVATE and R_PUBLIC; the
+   caller owns them.  The other keys can be taken with
+   vanity_take_hit.  Must be called with the npth lock held.  */
+gpg_error_t
+vanity_search (vanity_job_t job,
+               gcry_sexp_t *r_private, gcry_sexp_t *r_public)
+{
+  gpg_error_t err = 0;
+  struct worker_s *workers;
+  struct vanity_filter_s filter;
+  unsigned int nworkers, nkeygen, ngpu, nstarted, nnodes, i, q;
+  unsigned long long fed;
+  int nodes[VANITY_MAX_NODES];       /* The node of each queue.  */
+  unsigned int nslots[VANITY_MAX_NODES];
+  vanity_cpus_t cpus = NULL;
+  vanity_power_t power = NULL;
+  struct worker_s *w;
+  npth_attr_t tattr;
+  double joules, started, cpu, cpu_end;
+  int rc;
+
+  *r_private = NULL;
+  *r_public = NULL;
+  memset (&job->cost, 0, sizeof job->cost);
+  started = now_seconds ();
+  cpu = thread_cpu_seconds ();
+
+  if (!job->pattern)
+    return gpg_error (GPG_ERR_NO_DATA);
+  /* A scoring search would never end.  */
+  if (job->scoring && !job->budget && !job->max_iterations)
+    return gpg_error (GPG_ERR_MISSING_VALUE);
+
+  /* Only the v4 Ed25519 key packets fit into the single SHA-1 block
+     the device hashes.  */
+  if (job->use_gpu && !job->gpu)
+    {
+      if (job->version != 4)
+        err = gpg_error (GPG_ERR_UNKNOWN_VERSION);
+      else if (job->algo != PUBKEY_ALGO_EDDSA)
+        err = gpg_error (GPG_ERR_PUBKEY_ALGO);
+      else
+        err = _vanity_pattern_filter (job->pattern, &filter);
+      if (err)
+        log_info ("not using the OpenCL device for this search: %s\n",
+                  gpg_strerror (err));
+      else
+        {
+          /* Building the kernels takes a while; don't block the
+             other threads meanwhile.  */
+          npth_unprotect ();
+          if (_vanity_gpu_init ())
+            err = _vanity_gpu_new (&job->gpu, &filter);
+          else
+            err = gpg_error (GPG_ERR_ENODEV);
+          npth_protect ();
+          if (gpg_err_code (err) == GPG_ERR_ENODEV)
+            log_info ("no usable OpenCL device found\n");
+          else if (err)
+            log_error ("error setting up the OpenCL device: %s\n",
+                       gpg_strerror (err));
+        }
+      if (job->version == 4 && job->algo == PUBKEY_ALGO_EDDSA)
+        _vanity_filter_release (&filter);
+      err = 0;
+    }
+  ngpu = job->gpu? 1 : 0;
+
+  if (job->placement)
+    {
+      err = _vanity_cpus_new (&cpus, !(job->placement & VANITY_PLACE_NO_SMT));
+      if (err)
+        log_info ("can't read the CPU topology: %s\n", gpg_strerror (err));
+      err = 0;
+    }
+  nworkers = (job->nworkers? job->nworkers
+              : cpus? cpus->n : vanity_default_workers ());
+  if (cpus && (job->placement & VANITY_PLACE_PIN))
+    job->cpus = cpus;
+
+  _vanity_sha1_init ();
+  if (job->version == 5)
+    _vanity_sha256_init ();
+  job->batch_keygen = (job->oidlen == sizeof ed25519_oid
+                       && !memcmp (job->oid, ed25519_oid, job->oidlen)
+                       && has_keyparam_flag (job->keyparam, "eddsa")
+                       && has_keyparam_flag (job->keyparam, "comp")
+                       && _vanity_ed25519_init ());
+  if ((job->algo == PUBKEY_ALGO_ECDSA || job->algo == PUBKEY_ALGO_ECDH)
+      && !job->ecc && !has_keyparam_flag (job->keyparam, "comp"))
+    {
+      /* This takes a few scalar multiplications; don't block the
+         other threads meanwhile.  */
+      npth_unprotect ();
+      err = _vanity_ecc_new (&job->ecc, job->keyparam);
+      npth_protect ();
+      if (err)
+        log_info ("incremental key generation not possible: %s\n",
+                  gpg_strerror (err));
+      err = 0;
+    }
+  /* Only the Ed25519 seeds are taken from the key streams; the other
+     keys would not stay within the range.  */
+  if (job->stream_key && job->stream_end && !job->batch_keygen)
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+  err = fit_memory (job, &nworkers, ngpu);
+  if (err)
+    goto leave;
+
+  /* A single keygen thread easily keeps up with many hash workers
+     sweeping the default window.  The bound workers of each node get
+     their own one; the device worker uses the first queue.  */
+  workers = xtrycalloc (nworkers + VANITY_MAX_NODES + ngpu, sizeof *workers);
+  if (!workers)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  nnodes = 1;
+  nodes[0] = job->cpus? job->cpus->cpu[0].node : 0;
+  nslots[0] = GPU_QUEUED_BATCHES * ngpu;
+  for (i=0; i < nworkers; i++)
+    {
+      w = workers + i;
+      w->cpu = job->cpus? (int)(i % job->cpus->n) : -1;
+      w->node = job->cpus? job->cpus->cpu[w->cpu].node : 0;
+      for (q=0; q < nnodes && nodes[q] != w->node; q++)
+        ;
+      if (q == nnodes)
+        {
+          nodes[nnodes++] = w->node;
+          nslots[q] = 0;
+        }
+      nslots[q] += QUEUED_BATCHES_PER_WORKER;
+    }
+  nkeygen = (nworkers > 1 || ngpu)? nnodes : 0;
+  for (q=0; q < nkeygen && !err; q++)
+    err = create_queue (job, nslots[q]);
+  if (err)
+    {
+      destroy_queues (job);
+      xfree (workers);
+      goto leave;
+    }
+  for (i=0; i < nworkers + nkeygen + ngpu; i++)
+    {
+      w = workers + i;
+      w->job = job;
+      w->no = i;
+      w->stream = job->stream_base + i;
+      w->keygen = (i >= nworkers && i < nworkers + nkeygen);
+      w->gpu = (i >= nworkers + nkeygen);
+      if (w->keygen)
+        {
+          w->cpu = -1;
+          w->node = nodes[i - nworkers];
+        }
+      else if (w->gpu)
+        {
+          w->cpu = -1;
+          w->node = nodes[0];
+          w->gpu_slice = GPU_SLICE;
+        }
+      if (nkeygen)
+        {
+          for (q=0; nodes[q] != w->node; q++)
+            ;
+          w->queue = job->queues[q];
+        }
+    }
+  if (job->stream_key && job->stream_end
+      && job->stream_end - job->stream_base < nworkers + nkeygen + ngpu)
+    {
+      log_error ("only %u of the %u key streams needed are left\n",
+                 job->stream_end - job->stream_base,
+                 nworkers + nkeygen + ngpu);
+      destroy_queues (job);
+      xfree (workers);
+      err = gpg_error (GPG_ERR_LIMIT_REACHED);
+      goto leave;
+    }
+  /* The next search of the job must not repeat these key streams.  */
+  job->stream_base += nworkers + nkeygen + ngpu;
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      destroy_queues (job);
+      xfree (workers);
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+
+  job->random_level = (has_keyparam_flag (job->keyparam, "transient-key")
+                       ? GCRY_STRONG_RANDOM : GCRY_VERY_STRONG_RANDOM);
+  _vanity_matcher_init (&job->matcher, job->pattern);
+  log_debug ("starting vanity search with %u workers and %u keygen threads"
+             " using the %s kernel, the %s matcher%s\n",
+             nworkers, nkeygen,
+             (job->version == 5
+              ? _vanity_sha256_kernel_name ()
+              : _vanity_pattern_need_digest (job->pattern)
+              ? _vanity_sha1_digest_kernel_name ()
+              : !ecc_algo_p (job->algo)
+              ? _vanity_sha1_multi_kernel_name ()
+              : _vanity_sha1_kernel_name ()),
+             job->matcher.name,
+             (job->batch_keygen? " and batch key generation"
+              : job->ecc? " and incremental key generation" : ""));
+  if (job->cpus)
+    log_debug ("binding the workers to %u CPUs on %u of %u nodes\n",
+               nworkers < job->cpus->n? nworkers : job->cpus->n,
+               nnodes, job->cpus->nnodes);
+  if (ngpu)
+    log_debug ("sweeping also on the OpenCL device %s\n", _vanity_gpu_name ());
+  job->pool_type = 0;
+  if (job->pool)
+    {
+      if (job->batch_keygen)
+        err = _vanity_pool_bind (job->pool, VANITY_POOL_ED25519,
+                                 VANITY_ED25519_BATCH, 33, pool_seclen (job),
+                                 job->oid, job->oidlen);
+      else if (job->ecc)
+        err = _vanity_pool_bind (job->pool, VANITY_POOL_ECC,
+                                 VANITY_ECC_BATCH, _vanity_ecc_qlen (job->ecc),
+                                 pool_seclen (job), job->oid, job->oidlen);
+      else
+        err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      if (err)
+        log_info ("not using the vanity key pool: %s\n", gpg_strerror (err));
+      else
+        {
+          job->pool_type = job->batch_keygen? VANITY_POOL_ED25519
+                                             : VANITY_POOL_ECC;
+          if (job->pool_flags & (VANITY_POOL_SWEEP | VANITY_POOL_ONLY))
+            log_debug ("sweeping %llu stored keys first\n",
+                       vanity_pool_count (job->pool));
+        }
+      /* Without the pool there is nothing to sweep.  */
+      if (!(job->pool_flags & VANITY_POOL_ONLY))
+        err = 0;
+    }
+  /* The keys of the pool are generated and swept on the CPU.  */
+  job->gpu_keygen = 0;
+  if (!err && ngpu && job->batch_keygen && !job->pool_type)
+    {
+      npth_unprotect ();
+      err = _vanity_gpu_keygen_setup (job->gpu);
+      npth_protect ();
+      if (!err)
+        {
+          job->gpu_keygen = 1;
+          log_debug ("the OpenCL device also generates its keys\n");
+        }
+      else if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        log_info ("not generating keys on the OpenCL device: %s\n",
+                  gpg_strerror (err));
+      err = 0;
+    }
+  release_hits (job);
+  job->min_score = 0;
+  job->gpu_key_seconds = 0;
+  job->duty = 100;
+  job->active_workers = 0;
+  job->governor.thermal_duty = 0;
+  job->joules = -1;
+  if (_vanity_power_new (&power, NULL))
+    power = NULL;
+  run_governor (job, power);
+  /* A job canceled before it got here ends right away.  */
+  job->done = job->canceled;
+  job->arena_failed = 0;
+  job->err = job->canceled? gpg_error (GPG_ERR_CANCELED) : 0;
+  job->nrunning = nworkers + nkeygen + ngpu;
+  for (nstarted=0; !err && nstarted < nworkers + nkeygen + ngpu; nstarted++)
+    {
+      rc = npth_create (&workers[nstarted].thread, &tattr,
+                        worker_thread, workers + nstarted);
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          log_error ("error spawning vanity worker: %s\n", strerror (rc));
+          break;
+        }
+      npth_setname_np (workers[nstarted].thread,
+                       (workers[nstarted].keygen? "vanity-keygen"
+                        : workers[nstarted].gpu? "vanity-gpu"
+                        : "vanity-worker"));
+    }
+  npth_attr_destroy (&tattr);
+
+  /* If not all workers could be started, stop the others.  */
+  if (err)
+    report_error (job, err);
+  else
+    report_progress (job, workers, nstarted, power);
+
+  job->iterations = job->keys = 0;
+  job->gpu_iterations = job->gpu_keys = 0;
+  for (i=0; i < nstarted; i++)
+    {
+      npth_join (workers[i].thread, NULL);
+      job->iterations += workers[i].iterations;
+      job->keys += workers[i].keys;
+      if (workers[i].gpu)
+        {
+          job->gpu_iterations += workers[i].iterations;
+          job->gpu_keys += workers[i].keys;
+        }
+      job->cost.keys += workers[i].generated;
+      job->cost.cpu_seconds += workers[i].cpu_seconds;
+      job->cost.gpu_seconds += workers[i].gpu_seconds;
+    }
+  /* The setup and the progress reports of this thread count as
+     well.  */
+  if (cpu >= 0 && (cpu_end = thread_cpu_seconds ()) >= cpu)
+    job->cost.cpu_seconds += cpu_end - cpu;
+  job->cost.hashes = job->iterations;
+  job->cost.wall_seconds = now_seconds () - started;
+  if (ngpu && job->iterations)
+    {
+      for (fed=0, i=0; i < nworkers; i++)
+        fed += workers[i].fed;
+      w = workers + nworkers + nkeygen;
+      log_debug ("the OpenCL device computed %.0f%% of the fingerprints"
+                 " with slices of %u timestamps; the hash workers"
+                 " generated %llu batches for it\n",
+                 100.0 * w->iterations / job->iterations,
+                 w->gpu_slice, fed);
+    }
+  if (_vanity_power_energy (power, &joules))
+    {
+      job->joules = joules;
+      if (joules > 0)
+        log_debug ("the vanity search used %.0f J, %.1f keys/J\n",
+                   joules, job->keys / joules);
+    }
+  _vanity_power_release (power);
+  /* The queued batches may have their seeds in the arenas.  */
+  destroy_queues (job);
+  for (i=0; i < nworkers + nkeygen + ngpu; i++)
+    _vanity_arena_release (workers[i].arena);
+  xfree (workers);
+  _vanity_gpu_release (job->gpu);
+  job->gpu = NULL;
+  job->cpus = NULL;
+  _vanity_cpus_release (cpus);
+
+  if (job->err)
+    return job->err;
+  /* Without an error the workers only stop early when a budget is
+     used up.  */
+  if (!job->nhits)
+    return gpg_error (job->budget || job->max_iterations
+                      ? GPG_ERR_TIMEOUT : GPG_ERR_NOT_FOUND);
+  if (job->scoring)
+    sort_scored_hits (job);
+
+  for (i=0; i < job->nhits; i++)
+    {
+      if (job->hits[i].has_ref)
+        {
+          err = vanity_regenerate_key (job->stream_key, &job->hits[i].ref,
+                                       &job->hits[i].s_private,
+                                       &job->hits[i].s_public);
+          if (err)
+            return err;
+        }
+      err = check_hit (job, job->hits + i);
+      if (err)
+        return err;
+    }
+
+  if (job->scoring)
+    log_debug ("best vanity key %08lX has score %u (item %u) after"
+               " %llu iterations\n",
+               (unsigned long)job->hits[0].keyid, job->hits[0].score,
+               job->hits[0].match, job->iterations);
+  else
+    log_debug ("Hit desired key %08lX (item %u) after %llu iterations!\n",
+               (unsigned long)job->hits[0].keyid, job->hits[0].match,
+               job->iterations);
+  if (job->nhits > 1)
+    log_debug ("collected %u vanity keys\n", job->nhits);
+  if (job->verify.quarantined)
+    log_info ("vanity paths quarantined after wrong keys:%s%s%s%s%s\n",
+              ((job->verify.quarantined & (1 << VANITY_PATH_KEYID))
+               ? " keyid" : ""),
+              ((job->verify.quarantined & (1 << VANITY_PATH_DIGEST))
+               ? " digest" : ""),
+              ((job->verify.quarantined & (1 << VANITY_PATH_MULTI))
+               ? " multi-block" : ""),
+              ((job->verify.quarantined & (1 << VANITY_PATH_GPU))
+               ? " OpenCL" : ""),
+              ((job->verify.quarantined & (1 << VANITY_PATH_SHA256))
+               ? " SHA-256" : ""));
+  *r_private = job->hits[0].s_private;
+  *r_public = job->hits[0].s_public;
+  job->hits[0].s_private = NULL;
+  job->hits[0].s_public = NULL;
+  return 0;
+
+ leave:
+  _vanity_gpu_release (job->gpu);
+  job->gpu = NULL;
+  job->cpus = NULL;
+  _vanity_cpus_release (cpus);
+  return err;
+}
+
+
+/* Cancel the search of JOB, which may be running in another thread
+   or not yet be started; it then fails with GPG_ERR_CANCELED.  Must
+   be called with the npth lock held.  */
+void
+vanity_cancel (vanity_job_t job)
+{
+  job->canceled = 1;
+  report_error (job, gpg_error (GPG_ERR_CANCELED));
+}
+
+
+/* Return e to the power of minus X for X >= 0.  The engine does not
+   need libm for anything else.  */
+static double
+exp_neg (double x)
+{
+  unsigned int halvings = 0, i;
+  double y, term;
+
+  for (; x > 0.5; x /= 2)
+    halvings++;
+  for (y = term = 1.0, i=1; i < 20; i++)
+    {
+      term *= x / i;
+      y += term;
+    }
+  while (halvings--)
+    y *= y;
+  return 1.0 / y;
+}
+
+
+/* Return the chance that a search has found at least HITS keys by
+   the time X hits are expected.  The hits are a Poisson process,
+   thus this is the gamma distribution.  */
+static double
+hit_chance (double x, unsigned int hits)
+{
+  double sum, term;
+  unsigned int i;
+
+  for (sum = term = 1.0, i=1; i < hits; i++)
+    {
+      term *= x / i;
+      sum += term;
+    }
+  return 1.0 - exp_neg (x) * sum;
+}
+
+
+/* Return the number of seconds within which a search with an
+   expected RATE of hits per second finds HITS keys with a chance of
+   QUANTILE, or -1 if RATE is not positive.  The time for N hosts is
+   this value divided by N.  */
+double
+vanity_hit_time (double rate, unsigned int hits, double quantile)
+{
+  double lo, hi, mid;
+  int i;
+
+  if (!(rate > 0) || !hits || !(quantile > 0 && quantile < 1))
+    return -1;
+  for (hi = hits; hit_chance (hi, hits) < quantile; hi *= 2)
+    ;
+  for (lo=0, i=0; i < 60; i++)
+    {
+      mid = (lo + hi) / 2;
+      if (hit_chance (mid, hits) < quantile)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return hi / rate;
+}
+
+
+/* Estimate how long JOB takes without changing any storage.  This
+   runs the search of JOB with its pattern, windows and backends as
+   set up for about SECONDS seconds, or VANITY_ESTIMATE_SECONDS if
+   that is 0, and stores the measured rates and the projected times
+   to the number of hits set with vanity_set_hits at R_EST.  The keys
+   found meanwhile are released and a key pool set for JOB is not
+   used.  The projection for a scoring pattern is -1.  Must be called
+   with the npth lock held.  */
+gpg_error_t
+vanity_estimate (vanity_job_t job, unsigned int seconds,
+                 struct vanity_estimate_s *r_est)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_private, s_public;
+  unsigned long budget = job->budget;
+  unsigned long long max_iterations = job->max_iterations;
+  vanity_pool_t pool = job->pool;
+  unsigned int pool_flags = job->pool_flags;
+  vanity_progress_t progress_cb = job->progress_cb;
+  double started, rate;
+
+  memset (r_est, 0, sizeof *r_est);
+  if (!job->pattern)
+    return gpg_error (GPG_ERR_NO_DATA);
+
+  job->budget = seconds? seconds : VANITY_ESTIMATE_SECONDS;
+  job->max_iterations = 0;
+  job->pool = NULL;
+  job->pool_flags = 0;
+  job->progress_cb = NULL;
+  job->estimating = 1;
+  job->nestimated = 0;
+  started = now_seconds ();
+  err = vanity_search (job, &s_private, &s_public);
+  r_est->seconds = now_seconds () - started;
+  job->estimating = 0;
+  job->budget = budget;
+  job->max_iterations = max_iterations;
+  job->pool = pool;
+  job->pool_flags = pool_flags;
+  job->progress_cb = progress_cb;
+  if (!err)
+    {
+      gcry_sexp_release (s_private);
+      gcry_sexp_release (s_public);
+    }
+  else if (gpg_err_code (err) == GPG_ERR_TIMEOUT)
+    err = 0;
+  release_hits (job);
+  if (err)
+    return err;
+
+  r_est->iterations = job->iterations;
+  r_est->keys = job->keys;
+  r_est->found = job->nestimated;
+  if (r_est->seconds > 0)
+    {
+      r_est->hash_rate = job->iterations / r_est->seconds;
+      r_est->key_rate = job->keys / r_est->seconds;
+    }
+  r_est->watts = r_est->keys_per_joule = -1;
+  if (job->joules > 0 && r_est->seconds > 0)
+    {
+      r_est->watts = job->joules / r_est->seconds;
+      r_est->keys_per_joule = job->keys / job->joules;
+    }
+  r_est->probability = (job->scoring? 0
+                        : vanity_pattern_probability (job->pattern));
+  r_est->hits = job->max_hits;
+  rate = r_est->probability * r_est->hash_rate;
+  if (rate > 0)
+    {
+      r_est->expected = job->max_hits / rate;
+      r_est->p90 = vanity_hit_time (rate, job->max_hits, 0.9);
+    }
+  else
+    r_est->expected = r_est->p90 = -1;
+  return 0;
+}
+
+
+/* Return the creation time of the key found by JOB.  */
+u32
+vanity_get_timestamp (vanity_job_t job)
+{
+  return job->hits[0].timestamp;
+}
+
+
+/* Return the index of the item of the pattern matched by the key
+   found by JOB.  If several items match, this is the first one.  */
+unsigned int
+vanity_get_match (vanity_job_t job)
+{
+  return job->hits[0].match;
+}
+
+
+/* Return the score of key number IDX found by the last search of JOB
+   with a scoring pattern, or 0.  The keys are ordered by descending
+   score.  */
+unsigned int
+vanity_get_score (vanity_job_t job, unsigned int idx)
+{
+  return idx < job->nhits? job->hits[idx].score : 0;
+}
+
+
+/* Return the number of fingerprints computed by the last search of
+   JOB, whether or not it found a key.  */
+unsigned long long
+vanity_get_iterations (vanity_job_t job)
+{
+  return job->iterations;
+}
+
+
+/* Return the number of keys swept by the last search of JOB.  */
+unsigned long long
+vanity_get_keys (vanity_job_t job)
+{
+  return job->keys;
+}
+
+
+/* Store the fingerprints computed and the keys swept by the OpenCL
+   device during the last search of JOB at R_ITERATIONS and R_KEYS.
+   They are part of the counts of vanity_get_iterations and
+   vanity_get_keys.  */
+void
+vanity_get_gpu_counts (vanity_job_t job, unsigned long long *r_iterations,
+                       unsigned long long *r_keys)
+{
+  *r_iterations = job->gpu_iterations;
+  *r_keys = job->gpu_keys;
+}
+
+
+/* Return true if the pattern of JOB rates the fingerprints.  */
+int
+vanity_is_scoring (vanity_job_t job)
+{
+  return job->scoring;
+}
+
+
+/* Store the resources used by the last search of JOB at R_COST.  */
+void
+vanity_get_cost (vanity_job_t job, struct vanity_cost_s *r_cost)
+{
+  *r_cost = job->cost;
+}
+
+
+/* Add the fraction SHARE of COST to SUM.  This splits the cost of a
+   search for several jobs; the wall time is added in full because
+   the search took that long for each of them.  */
+void
+vanity_cost_add (struct vanity_cost_s *sum, const struct vanity_cost_s *cost,
+                 double share)
+{
+  sum->cpu_seconds += share * cost->cpu_seconds;
+  sum->gpu_seconds += share * cost->gpu_seconds;
+  sum->keys += (unsigned long long)(share * cost->keys + 0.5);
+  sum->hashes += (unsigned long long)(share * cost->hashes + 0.5);
+  sum->wall_seconds += cost->wall_seconds;
+}
+
+
+/* Return the first key stream not yet used by the searches of JOB.
+   The streams before it down to the start of the range set with
+   vanity_set_stream_range have been handed to the threads.  */
+unsigned int
+vanity_get_stream_next (vanity_job_t job)
+{
+  return job->stream_base;
+}
+
+
+/* Store the verification counters of JOB at R_VERIFY.  */
+void
+vanity_get_verify (vanity_job_t job, struct vanity_verify_s *r_verify)
+{
+  *r_verify = job->verify;
+}
+
+
+/* Store the memory planned for the last search of JOB at R_MEM.  */
+void
+vanity_get_memory (vanity_job_t job, struct vanity_memory_s *r_mem)
+{
+  *r_mem = job->memory;
+}
+
+
+/* Return a name for the VANITY_PATH_ value PATH for diagnostics.  */
+const char *
+vanity_path_name (int path)
+{
+  switch (path)
+    {
+    case VANITY_PATH_KEYID:     return _vanity_sha1_kernel_name ();
+    case VANITY_PATH_DIGEST:    return _vanity_sha1_digest_kernel_name ();
+    case VANITY_PATH_MULTI:     return _vanity_sha1_multi_kernel_name ();
+    case VANITY_PATH_SHA256:    return _vanity_sha256_kernel_name ();
+    case VANITY_PATH_GPU:       return "OpenCL";
+    case VANITY_PATH_LIBGCRYPT: return "libgcrypt";
+    default:                    return "?";
+    }
+}
+
+
+/* Store the fingerprint of the key found by JOB at FPR, which must
+   provide space for VANITY_MAX_FPR_LEN bytes.  Only VANITY_FPR_LEN
+   bytes are stored unless JOB searches for v5 keys.  */
+void
+vanity_get_fingerprint (vanity_job_t job, unsigned char *fpr)
+{
+  memcpy (fpr, job->hits[0].fpr, _vanity_fpr_len (job->version));
+}
+
+
+/* Return the number of keys found by the last search of JOB.  The
+   first one is returned by vanity_search itself.  */
+unsigned int
+vanity_get_hit_count (vanity_job_t job)
+{
+  return job->nhits;
+}
+
+
+/* Take key number IDX found by the last search of JOB.  The caller
+   owns the parts stored at R_PRIVATE and R_PUBLIC.  Its creation time,
+   its fingerprint and the index of the pattern item it matches are
+   stored at R_TIMESTAMP, R_FPR and R_MATCH.  Returns GPG_ERR_NOT_FOUND
+   if there is no such key or it has already been taken.  */
+gpg_error_t
+vanity_take_hit (vanity_job_t job, unsigned int idx,
+                 gcry_sexp_t *r_private, gcry_sexp_t *r_public,
+                 u32 *r_timestamp, unsigned char *r_fpr,
+                 unsigned int *r_match)
+{
+  struct vanity_hit_s *hit;
+
+  *r_private = *r_public = NULL;
+  if (idx >= job->nhits || !job->hits[idx].s_private)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  hit = job->hits + idx;
+  *r_private = hit->s_private;
+  *r_public = hit->s_public;
+  hit->s_private = hit->s_public = NULL;
+  *r_timestamp = hit->timestamp;
+  memcpy (r_fpr, hit->fpr, _vanity_fpr_len (job->version));
+  *r_match = hit->match;
+  return 0;
+}
+
+
+/* Store the compact record of key number IDX found by the last search
+   of JOB at R_REF.  Returns GPG_ERR_NOT_FOUND if there is no such key
+   and GPG_ERR_NO_DATA if it was not generated from the stream key of
+   JOB.  */
+gpg_error_t
+vanity_get_hit_ref (vanity_job_t job, unsigned int idx,
+                    struct vanity_hit_ref_s *r_ref)
+{
+  if (idx >= job->nhits)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  if (!job->hits[idx].has_ref)
+    return gpg_error (GPG_ERR_NO_DATA);
+  *r_ref = job->hits[idx].ref;
+  return 0;
+}
+
+
+/* Store the VANITY_KDF_PARAMS_LEN bytes of ECDH KDF parameters of
+   key number IDX found by the last search of JOB at R_KDF.  They are
+   part of the fingerprint; the key must be published with them.
+   Returns GPG_ERR_NOT_FOUND if there is no such key.  */
+gpg_error_t
+vanity_get_kdf_params (vanity_job_t job, unsigned int idx,
+                       unsigned char *r_kdf)
+{
+  if (idx >= job->nhits)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  memcpy (r_kdf, job->kdf[job->hits[idx].kdf], VANITY_KDF_PARAMS_LEN);
+  return 0;
+}
+
+
+/* Recreate the Ed25519 key recorded by REF of a search with the stream
+   key KEY and store it at R_PRIVATE and R_PUBLIC in the format
+   returned by gcry_pk_genkey.  Must be called with the npth lock
+   held.  */
+gpg_error_t
+vanity_regenerate_key (const unsigned char *key,
+                       const struct vanity_hit_ref_s *ref,
+                       gcry_sexp_t *r_private, gcry_sexp_t *r_public)
+{
+  gpg_error_t err;
+  unsigned char *secret;
+  unsigned char q[33];
+
+  *r_private = *r_public = NULL;
+  if (!_vanity_ed25519_init ())
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  /* The master secret and the seed.  */
+  secret = xtrymalloc_secure (64);
+  if (!secret)
+    return gpg_error_from_syserror ();
+  _vanity_stream_master (key, ref->stream, ref->counter, secret);
+  _vanity_gpu_seed (secret, ref->index, secret + 32);
+  _vanity_ed25519_keys (secret + 32, 1, q + 1);
+  q[0] = 0x40;
+
+  err = gcry_sexp_build (r_private, NULL,
+                         "(private-key(ecc(curve Ed25519)(flags eddsa)"
+                         "(q%b)(d%b)))", 33, q, 32, secret + 32);
+  if (!err)
+    err = gcry_sexp_build (r_public, NULL,
+                           "(public-key(ecc(curve Ed25519)(flags eddsa)"
+                           "(q%b)))", 33, q);
+  wipememory (secret, 64);
+  xfree (secret);
+  if (err)
+    {
+      gcry_sexp_release (*r_private);
+      *r_private = NULL;
+    }
+  return err;
+}
@@ -0,0 +1,176 @@
+/* vanity-sha1-rounds.h - Unrolled rounds of the vanity SHA-1 kernels
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file is included by vanity-sha1.c into the body of each
+   kernel; it thus has no include guard.  The kernel must define
+   SHA1_T as the type of the state words, declare the state A to E,
+   initialized from the CTX, and the timestamp word X1.  The rounds
+   1 to 79 are computed; see vanity-sha1.c for the meaning of the
+   RV and RF rounds.
+
+   If SHA1_KEYID_ONLY is defined the last four rounds are skipped.
+   They don't change the final E anymore but only rotate it into
+   place; after round 75 it is ROL (E, 30).  */
+
+  SHA1_T x17, x20, x23, x25, x26, x28, x29, x31, x32, x33, x34, x35,
+      x36, x37, x38, x39, x40, x41, x42, x43, x44, x45, x46, x47, x48,
+      x49, x50, x51, x52, x53, x54, x55, x56, x57, x58, x59, x60, x61,
+      x62, x63, x64, x65, x66, x67, x68, x69, x70, x71, x72, x73, x74,
+      x75;
+#ifndef SHA1_KEYID_ONLY
+  SHA1_T x76, x77, x78, x79;
+#endif
+
+  RV (e, a, b, c, d, F1, K1, x1);
+  RF (d, e, a, b, c, F1, 2);
+  RF (c, d, e, a, b, F1, 3);
+  RF (b, c, d, e, a, F1, 4);
+  RF (a, b, c, d, e, F1, 5);
+  RF (e, a, b, c, d, F1, 6);
+  RF (d, e, a, b, c, F1, 7);
+  RF (c, d, e, a, b, F1, 8);
+  RF (b, c, d, e, a, F1, 9);
+  RF (a, b, c, d, e, F1, 10);
+  RF (e, a, b, c, d, F1, 11);
+  RF (d, e, a, b, c, F1, 12);
+  RF (c, d, e, a, b, F1, 13);
+  RF (b, c, d, e, a, F1, 14);
+  RF (a, b, c, d, e, F1, 15);
+  RF (e, a, b, c, d, F1, 16);
+  x17 = ctx->w[17] ^ ROL (x1, 1);
+  RV (d, e, a, b, c, F1, K1, x17);
+  RF (c, d, e, a, b, F1, 18);
+  RF (b, c, d, e, a, F1, 19);
+  x20 = ctx->w[20] ^ ROL (x17, 1);
+  RV (a, b, c, d, e, F2, K2, x20);
+  RF (e, a, b, c, d, F2, 21);
+  RF (d, e, a, b, c, F2, 22);
+  x23 = ctx->w[23] ^ ROL (x20, 1);
+  RV (c, d, e, a, b, F2, K2, x23);
+  RF (b, c, d, e, a, F2, 24);
+  x25 = ctx->w[25] ^ ROL (x17, 1);
+  RV (a, b, c, d, e, F2, K2, x25);
+  x26 = ctx->w[26] ^ ROL (x23, 1);
+  RV (e, a, b, c, d, F2, K2, x26);
+  RF (d, e, a, b, c, F2, 27);
+  x28 = ctx->w[28] ^ ROL (x25 ^ x20, 1);
+  RV (c, d, e, a, b, F2, K2, x28);
+  x29 = ctx->w[29] ^ ROL (x26, 1);
+  RV (b, c, d, e, a, F2, K2, x29);
+  RF (a, b, c, d, e, F2, 30);
+  x31 = ctx->w[31] ^ ROL (x28 ^ x23 ^ x17, 1);
+  RV (e, a, b, c, d, F2, K2, x31);
+  x32 = ctx->w[32] ^ ROL (x29, 1);
+  RV (d, e, a, b, c, F2, K2, x32);
+  x33 = ctx->w[33] ^ ROL (x25 ^ x17, 1);
+  RV (c, d, e, a, b, F2, K2, x33);
+  x34 = ctx->w[34] ^ ROL (x31 ^ x26 ^ x20, 1);
+  RV (b, c, d, e, a, F2, K2, x34);
+  x35 = ctx->w[35] ^ ROL (x32, 1);
+  RV (a, b, c, d, e, F2, K2, x35);
+  x36 = ctx->w[36] ^ ROL (x33 ^ x28 ^ x20, 1);
+  RV (e, a, b, c, d, F2, K2, x36);
+  x37 = ctx->w[37] ^ ROL (x34 ^ x29 ^ x23, 1);
+  RV (d, e, a, b, c, F2, K2, x37);
+  x38 = ctx->w[38] ^ ROL (x35, 1);
+  RV (c, d, e, a, b, F2, K2, x38);
+  x39 = ROL (x36 ^ x31 ^ x25 ^ x23, 1);
+  RV (b, c, d, e, a, F2, K2, x39);
+  x40 = ctx->w[40] ^ ROL (x37 ^ x32 ^ x26, 1);
+  RV (a, b, c, d, e, F3, K3, x40);
+  x41 = ctx->w[41] ^ ROL (x38 ^ x33 ^ x25, 1);
+  RV (e, a, b, c, d, F3, K3, x41);
+  x42 = ROL (x39 ^ x34 ^ x28 ^ x26, 1);
+  RV (d, e, a, b, c, F3, K3, x42);
+  x43 = ctx->w[43] ^ ROL (x40 ^ x35 ^ x29, 1);
+  RV (c, d, e, a, b, F3, K3, x43);
+  x44 = ctx->w[44] ^ ROL (x41 ^ x36 ^ x28, 1);
+  RV (b, c, d, e, a, F3, K3, x44);
+  x45 = ROL (x42 ^ x37 ^ x31 ^ x29, 1);
+  RV (a, b, c, d, e, F3, K3, x45);
+  x46 = ctx->w[46] ^ ROL (x43 ^ x38 ^ x32, 1);
+  RV (e, a, b, c, d, F3, K3, x46);
+  x47 = ROL (x44 ^ x39 ^ x33 ^ x31, 1);
+  RV (d, e, a, b, c, F3, K3, x47);
+  x48 = ROL (x45 ^ x40 ^ x34 ^ x32, 1);
+  RV (c, d, e, a, b, F3, K3, x48);
+  x49 = ROL (x46 ^ x41 ^ x35 ^ x33, 1);
+  RV (b, c, d, e, a, F3, K3, x49);
+  x50 = ROL (x47 ^ x42 ^ x36 ^ x34, 1);
+  RV (a, b, c, d, e, F3, K3, x50);
+  x51 = ROL (x48 ^ x43 ^ x37 ^ x35, 1);
+  RV (e, a, b, c, d, F3, K3, x51);
+  x52 = ROL (x49 ^ x44 ^ x38 ^ x36, 1);
+  RV (d, e, a, b, c, F3, K3, x52);
+  x53 = ROL (x50 ^ x45 ^ x39 ^ x37, 1);
+  RV (c, d, e, a, b, F3, K3, x53);
+  x54 = ROL (x51 ^ x46 ^ x40 ^ x38, 1);
+  RV (b, c, d, e, a, F3, K3, x54);
+  x55 = ROL (x52 ^ x47 ^ x41 ^ x39, 1);
+  RV (a, b, c, d, e, F3, K3, x55);
+  x56 = ROL (x53 ^ x48 ^ x42 ^ x40, 1);
+  RV (e, a, b, c, d, F3, K3, x56);
+  x57 = ROL (x54 ^ x49 ^ x43 ^ x41, 1);
+  RV (d, e, a, b, c, F3, K3, x57);
+  x58 = ROL (x55 ^ x50 ^ x44 ^ x42, 1);
+  RV (c, d, e, a, b, F3, K3, x58);
+  x59 = ROL (x56 ^ x51 ^ x45 ^ x43, 1);
+  RV (b, c, d, e, a, F3, K3, x59);
+  x60 = ROL (x57 ^ x52 ^ x46 ^ x44, 1);
+  RV (a, b, c, d, e, F4, K4, x60);
+  x61 = ROL (x58 ^ x53 ^ x47 ^ x45, 1);
+  RV (e, a, b, c, d, F4, K4, x61);
+  x62 = ROL (x59 ^ x54 ^ x48 ^ x46, 1);
+  RV (d, e, a, b, c, F4, K4, x62);
+  x63 = ROL (x60 ^ x55 ^ x49 ^ x47, 1);
+  RV (c, d, e, a, b, F4, K4, x63);
+  x64 = ROL (x61 ^ x56 ^ x50 ^ x48, 1);
+  RV (b, c, d, e, a, F4, K4, x64);
+  x65 = ROL (x62 ^ x57 ^ x51 ^ x49, 1);
+  RV (a, b, c, d, e, F4, K4, x65);
+  x66 = ROL (x63 ^ x58 ^ x52 ^ x50, 1);
+  RV (e, a, b, c, d, F4, K4, x66);
+  x67 = ROL (x64 ^ x59 ^ x53 ^ x51, 1);
+  RV (d, e, a, b, c, F4, K4, x67);
+  x68 = ROL (x65 ^ x60 ^ x54 ^ x52, 1);
+  RV (c, d, e, a, b, F4, K4, x68);
+  x69 = ROL (x66 ^ x61 ^ x55 ^ x53, 1);
+  RV (b, c, d, e, a, F4, K4, x69);
+  x70 = ROL (x67 ^ x62 ^ x56 ^ x54, 1);
+  RV (a, b, c, d, e, F4, K4, x70);
+  x71 = ROL (x68 ^ x63 ^ x57 ^ x55, 1);
+  RV (e, a, b, c, d, F4, K4, x71);
+  x72 = ROL (x69 ^ x64 ^ x58 ^ x56, 1);
+  RV (d, e, a, b, c, F4, K4, x72);
+  x73 = ROL (x70 ^ x65 ^ x59 ^ x57, 1);
+  RV (c, d, e, a, b, F4, K4, x73);
+  x74 = ROL (x71 ^ x66 ^ x60 ^ x58, 1);
+  RV (b, c, d, e, a, F4, K4, x74);
+  x75 = ROL (x72 ^ x67 ^ x61 ^ x59, 1);
+  RV (a, b, c, d, e, F4, K4, x75);
+#ifndef SHA1_KEYID_ONLY
+  x76 = ROL (x73 ^ x68 ^ x62 ^ x60, 1);
+  RV (e, a, b, c, d, F4, K4, x76);
+  x77 = ROL (x74 ^ x69 ^ x63 ^ x61, 1);
+  RV (d, e, a, b, c, F4, K4, x77);
+  x78 = ROL (x75 ^ x70 ^ x64 ^ x62, 1);
+  RV (c, d, e, a, b, F4, K4, x78);
+  x79 = ROL (x76 ^ x71 ^ x65 ^ x63, 1);
+  RV (b, c, d, e, a, F4, K4, x79);
+#endif /*!SHA1_KEYID_ONLY*/
@@ -0,0 +1,1104 @@
+/* vanity-sha1.c - SHA-1 kernel for the vanity timestamp sweep
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The key packet of an Ed25519 key is short enough to fit with the
+   SHA-1 padding into a single 64 byte block.  During the sweep only
+   the timestamp changes, which is exactly the message word W[1].
+
+   Thus _vanity_sha1_prepare computes everything which does not
+   depend on W[1] once per key: the first round, the message schedule
+   words which do not depend on W[1] (with the round constant already
+   added) and, for those which do, the part contributed by the fixed
+   words.  Because the schedule is linear, a word depending on W[1]
+   is its fixed part XORed with the rotated XOR of its dependent
+   inputs.  _vanity_sha1_fingerprint then only does the remaining 79
+   rounds and the dependent part of the schedule.
+
+   Besides the scalar kernel there are multi-lane kernels which hash
+   several consecutive timestamps at once using SIMD instructions, and
+   kernels using the SHA-1 instructions of x86 and ARMv8 CPUs.  They
+   only return the keyid, that is the last word of the hash.  Each
+   kernel the CPU supports is checked against libgcrypt and timed
+   once; the fastest one is used.  Patterns on the whole fingerprint
+   need the complete digest; the scalar and the SIMD kernels have a
+   second variant for this which is selected the same way.
+
+   Which words depend on W[1] follows from the schedule recurrence
+   W[t] = ROL (W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16], 1).  The unrolled
+   code in vanity-sha1-rounds.h encodes that; it must match the table
+   computed by _vanity_sha1_prepare.
+
+   Longer packets, like those of RSA keys, take several blocks.  The
+   timestamp is still in the first one, thus only that block is
+   hashed as above; the further blocks don't depend on the timestamp
+   at all and their complete message schedule is computed once.  What
+   remains for them are the 80 rounds of each block, chained from the
+   state of the previous one.  There is a multi-block variant of the
+   scalar and the SIMD kernels for this, selected like the others.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+#include "../common/host2net.h"
+
+
+/* Multi-lane kernels are built with GCC's vector extension.  On x86
+   the instruction set is selected at runtime; on ARM NEON is used if
+   the build targets it.  */
+#if defined(__GNUC__) && !defined(__clang__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# if defined(__x86_64__) || defined(__i386__)
+#  define USE_SHA1_X86 1
+# elif defined(__ARM_NEON) || defined(__aarch64__)
+#  define USE_SHA1_NEON 1
+#  if defined(__aarch64__) && defined(__linux__) && __GNUC__ >= 8
+#   define USE_SHA1_ARMV8 1
+#  endif
+# endif
+#endif
+
+#include <time.h>
+#ifdef USE_SHA1_X86
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+#ifdef USE_SHA1_ARMV8
+# include <arm_neon.h>
+# include <sys/auxv.h>
+# include <asm/hwcap.h>
+#endif
+
+
+#define ROL(x,n) (((x) << (n)) | ((x) >> (32-(n))))
+
+#define K1  0x5A827999L
+#define K2  0x6ED9EBA1L
+#define K3  0x8F1BBCDCL
+#define K4  0xCA62C1D6L
+#define F1(x,y,z)   ( z ^ ( x & ( y ^ z ) ) )
+#define F2(x,y,z)   ( x ^ y ^ z )
+#define F3(x,y,z)   ( ( x & y ) | ( z & ( x | y ) ) )
+#define F4(x,y,z)   ( x ^ y ^ z )
+
+#define H0  0x67452301L
+#define H1  0xEFCDAB89L
+#define H2  0x98BADCFEL
+#define H3  0x10325476L
+#define H4  0xC3D2E1F0L
+
+/* A round with a message word depending on the timestamp.  */
+#define RV(a,b,c,d,e,f,k,w)  do                               \
+    {                                                         \
+      e += ROL (a, 5) + f (b, c, d) + k + (w);                \
+      b = ROL (b, 30);                                        \
+    } while (0)
+
+/* A round with a fixed message word.  */
+#define RF(a,b,c,d,e,f,t)  do                                 \
+    {                                                         \
+      e += ROL (a, 5) + f (b, c, d) + ctx->kw[t];             \
+      b = ROL (b, 30);                                        \
+    } while (0)
+
+
+/* Store the digests A to E, which may be vectors, of their lanes at
+   P; see _vanity_sha1_digests for the layout.  */
+#define PUT_DIGESTS(p,a,b,c,d,e)  do                                  \
+    {                                                                 \
+      memcpy ((p),                           &(a), sizeof (a));       \
+      memcpy ((p) +   VANITY_SHA1_MAX_LANES, &(b), sizeof (b));       \
+      memcpy ((p) + 2*VANITY_SHA1_MAX_LANES, &(c), sizeof (c));       \
+      memcpy ((p) + 3*VANITY_SHA1_MAX_LANES, &(d), sizeof (d));       \
+      memcpy ((p) + 4*VANITY_SHA1_MAX_LANES, &(e), sizeof (e));       \
+    } while (0)
+
+/* Store the state words A to E of a single block as the digests.  */
+#define STORE_DIGESTS(p,a,b,c,d,e)  do                                \
+    {                                                                 \
+      a += H0; b += H1; c += H2; d += H3; e += H4;                    \
+      PUT_DIGESTS ((p), a, b, c, d, e);                               \
+    } while (0)
+
+/* A round of a block after the first one; KW is its round constant
+   plus message word.  */
+#define RT(a,b,c,d,e,f,kw)  do                                \
+    {                                                         \
+      e += ROL (a, 5) + f (b, c, d) + (kw);                   \
+      b = ROL (b, 30);                                        \
+    } while (0)
+
+/* The 20 rounds with function F starting at round T0 of the block
+   with the words KW_.  */
+#define TAIL_ROUNDS(f,t0)                                     \
+  for (t_=(t0); t_ < (t0) + 20; t_ += 5)                      \
+    {                                                         \
+      RT (a, b, c, d, e, f, kw_[t_]);                         \
+      RT (e, a, b, c, d, f, kw_[t_+1]);                       \
+      RT (d, e, a, b, c, f, kw_[t_+2]);                       \
+      RT (c, d, e, a, b, f, kw_[t_+3]);                       \
+      RT (b, c, d, e, a, f, kw_[t_+4]);                       \
+    }
+
+/* Chain the state A to E of type T after the rounds of the first
+   block through the further blocks of CTX.  A to E are then the
+   digest with the initial value already added.  */
+#define HASH_TAIL(T)  do                                                \
+    {                                                                   \
+      T h0_ = a + H0, h1_ = b + H1, h2_ = c + H2;                       \
+      T h3_ = d + H3, h4_ = e + H4;                                     \
+      const u32 *kw_;                                                   \
+      unsigned int i_;                                                  \
+      int t_;                                                           \
+                                                                        \
+      for (i_=0; i_ < ctx->ntail; i_++)                                 \
+        {                                                               \
+          kw_ = ctx->tail[i_];                                          \
+          a = h0_; b = h1_; c = h2_; d = h3_; e = h4_;                  \
+          TAIL_ROUNDS (F1, 0);                                          \
+          TAIL_ROUNDS (F2, 20);                                         \
+          TAIL_ROUNDS (F3, 40);                                         \
+          TAIL_ROUNDS (F4, 60);                                         \
+          h0_ += a; h1_ += b; h2_ += c; h3_ += d; h4_ += e;             \
+        }                                                               \
+      a = h0_; b = h1_; c = h2_; d = h3_; e = h4_;                      \
+    } while (0)
+
+
+/* Store the 32 bit value VAL big endian at P.  */
+static inline void
+put_u32 (unsigned char *p, u32 val)
+{
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >>  8;
+  p[3] = val;
+}
+
+
+static u32
+round_constant (int t)
+{
+  return t < 20? K1 : t < 40? K2 : t < 60? K3 : K4;
+}
+
+
+/* Prepare CTX for the key packet PACKET of length LEN.  LEN may not
+   be larger than VANITY_SHA1_MULTI_MAXLEN and the timestamp must be
+   at offset 4.  The timestamp in PACKET is ignored.  A packet longer
+   than VANITY_SHA1_MAXLEN needs the multi-block kernels.  */
+void
+_vanity_sha1_prepare (struct vanity_sha1_s *ctx,
+                      const unsigned char *packet, size_t len)
+{
+  unsigned char block[64 * VANITY_SHA1_MAX_BLOCKS];
+  unsigned char depends[80];
+  size_t nblocks;
+  u32 w[80];
+  u32 a, b, c, d, e;
+  unsigned int i;
+  int t;
+
+  nblocks = (len + 9 + 63) / 64;
+  memset (block, 0, 64 * nblocks);
+  memcpy (block, packet, len);
+  memset (block + 4, 0, 4);
+  block[len] = 0x80;
+  put_u32 (block + 64 * nblocks - 4, len * 8);
+
+  for (t=0; t < 16; t++)
+    {
+      w[t] = buf32_to_u32 (block + 4*t);
+      depends[t] = (t == 1);
+      ctx->block[t] = w[t];
+    }
+  for (; t < 80; t++)
+    {
+      u32 fixed = 0;
+      static const int offs[] = { 3, 8, 14, 16 };
+      int i;
+
+      depends[t] = 0;
+      for (i=0; i < DIM (offs); i++)
+        {
+          if (depends[t-offs[i]])
+            depends[t] = 1;
+          else
+            fixed ^= w[t-offs[i]];
+        }
+      w[t] = ROL (fixed, 1);
+    }
+
+  for (t=0; t < 80; t++)
+    {
+      ctx->w[t] = depends[t]? w[t] : 0;
+      ctx->kw[t] = depends[t]? 0 : round_constant (t) + w[t];
+    }
+
+  /* The first round only uses W[0].  */
+  a = H0; b = H1; c = H2; d = H3; e = H4;
+  RF (a, b, c, d, e, F1, 0);
+  ctx->a = a; ctx->b = b; ctx->c = c; ctx->d = d; ctx->e = e;
+
+  /* The further blocks are fixed.  */
+  ctx->ntail = nblocks - 1;
+  for (i=0; i < ctx->ntail; i++)
+    {
+      for (t=0; t < 16; t++)
+        w[t] = buf32_to_u32 (block + 64 * (i + 1) + 4*t);
+      for (; t < 80; t++)
+        w[t] = ROL (w[t-3] ^ w[t-8] ^ w[t-14] ^ w[t-16], 1);
+      for (t=0; t < 80; t++)
+        ctx->tail[i][t] = round_constant (t) + w[t];
+    }
+}
+
+
+/* Compute the fingerprint of the packet prepared in CTX with its
+   timestamp set to TIMESTAMP and store it at FPR.  */
+void
+_vanity_sha1_fingerprint (const struct vanity_sha1_s *ctx, u32 timestamp,
+                          unsigned char *fpr)
+{
+  u32 a = ctx->a, b = ctx->b, c = ctx->c, d = ctx->d, e = ctx->e;
+  u32 x1 = timestamp;
+#define SHA1_T u32
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  HASH_TAIL (u32);
+  put_u32 (fpr,      a);
+  put_u32 (fpr +  4, b);
+  put_u32 (fpr +  8, c);
+  put_u32 (fpr + 12, d);
+  put_u32 (fpr + 16, e);
+}
+
+
+
+/* Compute the keyid only; this is the scalar kernel.  Like all the
+   other kernels it skips the rounds not needed for the keyid.  */
+static void
+keyids_scalar (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *keyids)
+{
+  u32 a = ctx->a, b = ctx->b, c = ctx->c, d = ctx->d, e = ctx->e;
+  u32 x1 = timestamp;
+#define SHA1_T u32
+#define SHA1_KEYID_ONLY 1
+#include "vanity-sha1-rounds.h"
+#undef SHA1_KEYID_ONLY
+#undef SHA1_T
+
+  keyids[0] = H4 + ROL (e, 30);
+}
+
+
+/* The scalar kernel for complete digests.  */
+static void
+digests_scalar (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  u32 a = ctx->a, b = ctx->b, c = ctx->c, d = ctx->d, e = ctx->e;
+  u32 x1 = timestamp;
+#define SHA1_T u32
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  STORE_DIGESTS (digests, a, b, c, d, e);
+}
+
+
+/* The scalar kernel for packets of several blocks.  */
+static void
+multi_scalar (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  u32 a = ctx->a, b = ctx->b, c = ctx->c, d = ctx->d, e = ctx->e;
+  u32 x1 = timestamp;
+#define SHA1_T u32
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  HASH_TAIL (u32);
+  PUT_DIGESTS (digests, a, b, c, d, e);
+}
+
+
+/* The multi-lane kernels hash consecutive timestamps in the lanes of
+   a vector.  They are written with the vector extension of GCC and
+   compiled for the respective instruction set; which one is used is
+   decided at runtime.  */
+#ifdef USE_SHA1_X86
+
+typedef u32 sha1_v4_t  __attribute__ ((vector_size (16)));
+typedef u32 sha1_v8_t  __attribute__ ((vector_size (32)));
+typedef u32 sha1_v16_t __attribute__ ((vector_size (64)));
+
+static void __attribute__ ((target ("sse2")))
+keyids_sse2 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *keyids)
+{
+  sha1_v4_t zero = { 0 };
+  sha1_v4_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v4_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v4_t x1 = (sha1_v4_t){ 0, 1, 2, 3 } + timestamp;
+#define SHA1_T sha1_v4_t
+#define SHA1_KEYID_ONLY 1
+#include "vanity-sha1-rounds.h"
+#undef SHA1_KEYID_ONLY
+#undef SHA1_T
+
+  e = ROL (e, 30) + H4;
+  memcpy (keyids, &e, sizeof e);
+}
+
+static void __attribute__ ((target ("sse2")))
+digests_sse2 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  sha1_v4_t zero = { 0 };
+  sha1_v4_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v4_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v4_t x1 = (sha1_v4_t){ 0, 1, 2, 3 } + timestamp;
+#define SHA1_T sha1_v4_t
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  STORE_DIGESTS (digests, a, b, c, d, e);
+}
+
+static void __attribute__ ((target ("sse2")))
+multi_sse2 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  sha1_v4_t zero = { 0 };
+  sha1_v4_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v4_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v4_t x1 = (sha1_v4_t){ 0, 1, 2, 3 } + timestamp;
+#define SHA1_T sha1_v4_t
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  HASH_TAIL (sha1_v4_t);
+  PUT_DIGESTS (digests, a, b, c, d, e);
+}
+
+static int
+supported_sse2 (void)
+{
+  return __builtin_cpu_supports ("sse2");
+}
+
+
+static void __attribute__ ((target ("avx2")))
+keyids_avx2 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *keyids)
+{
+  sha1_v8_t zero = { 0 };
+  sha1_v8_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v8_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v8_t x1 = (sha1_v8_t){ 0, 1, 2, 3, 4, 5, 6, 7 } + timestamp;
+#define SHA1_T sha1_v8_t
+#define SHA1_KEYID_ONLY 1
+#include "vanity-sha1-rounds.h"
+#undef SHA1_KEYID_ONLY
+#undef SHA1_T
+
+  e = ROL (e, 30) + H4;
+  memcpy (keyids, &e, sizeof e);
+}
+
+static void __attribute__ ((target ("avx2")))
+digests_avx2 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  sha1_v8_t zero = { 0 };
+  sha1_v8_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v8_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v8_t x1 = (sha1_v8_t){ 0, 1, 2, 3, 4, 5, 6, 7 } + timestamp;
+#define SHA1_T sha1_v8_t
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  STORE_DIGESTS (digests, a, b, c, d, e);
+}
+
+static void __attribute__ ((target ("avx2")))
+multi_avx2 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  sha1_v8_t zero = { 0 };
+  sha1_v8_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v8_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v8_t x1 = (sha1_v8_t){ 0, 1, 2, 3, 4, 5, 6, 7 } + timestamp;
+#define SHA1_T sha1_v8_t
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  HASH_TAIL (sha1_v8_t);
+  PUT_DIGESTS (digests, a, b, c, d, e);
+}
+
+static int
+supported_avx2 (void)
+{
+  return __builtin_cpu_supports ("avx2");
+}
+
+
+static void __attribute__ ((target ("avx512f")))
+keyids_avx512 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *keyids)
+{
+  sha1_v16_t zero = { 0 };
+  sha1_v16_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v16_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v16_t x1 = (sha1_v16_t){ 0, 1, 2, 3, 4, 5, 6, 7,
+                                8, 9, 10, 11, 12, 13, 14, 15 } + timestamp;
+#define SHA1_T sha1_v16_t
+#define SHA1_KEYID_ONLY 1
+#include "vanity-sha1-rounds.h"
+#undef SHA1_KEYID_ONLY
+#undef SHA1_T
+
+  e = ROL (e, 30) + H4;
+  memcpy (keyids, &e, sizeof e);
+}
+
+static void __attribute__ ((target ("avx512f")))
+digests_avx512 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  sha1_v16_t zero = { 0 };
+  sha1_v16_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v16_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v16_t x1 = (sha1_v16_t){ 0, 1, 2, 3, 4, 5, 6, 7,
+                                8, 9, 10, 11, 12, 13, 14, 15 } + timestamp;
+#define SHA1_T sha1_v16_t
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  STORE_DIGESTS (digests, a, b, c, d, e);
+}
+
+static void __attribute__ ((target ("avx512f")))
+multi_avx512 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  sha1_v16_t zero = { 0 };
+  sha1_v16_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v16_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v16_t x1 = (sha1_v16_t){ 0, 1, 2, 3, 4, 5, 6, 7,
+                                8, 9, 10, 11, 12, 13, 14, 15 } + timestamp;
+#define SHA1_T sha1_v16_t
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  HASH_TAIL (sha1_v16_t);
+  PUT_DIGESTS (digests, a, b, c, d, e);
+}
+
+static int
+supported_avx512 (void)
+{
+  return __builtin_cpu_supports ("avx512f");
+}
+
+
+
+/* The SHA extensions compute the schedule themselves, thus this
+   kernel hashes the complete block.  Two timestamps are interleaved
+   to hide the latency of the round instructions.  The word order in
+   the registers is reversed; the first word is in the highest lane.  */
+#define SHANI_LANES 2
+#define SHANI_EACH(stmt) do {                                   \
+    int l_;                                                     \
+    for (l_=0; l_ < SHANI_LANES; l_++)                          \
+      { stmt; }                                                 \
+  } while (0)
+
+/* Rounds 4*G to 4*G+3 for G > 0.  The message words are updated
+   up to three groups in advance; the words of the last group are not
+   computed because that group is skipped.  */
+#define SHANI_STEP(g) do {                                              \
+    if ((g) & 1)                                                        \
+      {                                                                 \
+        SHANI_EACH (e1[l_] = _mm_sha1nexte_epu32 (e1[l_], m[(g)%4][l_])); \
+        SHANI_EACH (e0[l_] = abcd[l_]);                                 \
+      }                                                                 \
+    else                                                                \
+      {                                                                 \
+        SHANI_EACH (e0[l_] = _mm_sha1nexte_epu32 (e0[l_], m[(g)%4][l_])); \
+        SHANI_EACH (e1[l_] = abcd[l_]);                                 \
+      }                                                                 \
+    if ((g) >= 3 && (g) <= 17)                                          \
+      SHANI_EACH (m[((g)+1)%4][l_]                                      \
+                  = _mm_sha1msg2_epu32 (m[((g)+1)%4][l_], m[(g)%4][l_])); \
+    SHANI_EACH (abcd[l_] = _mm_sha1rnds4_epu32                          \
+                (abcd[l_], ((g) & 1)? e1[l_] : e0[l_], (g)/5));         \
+    if ((g) >= 1 && (g) <= 15)                                          \
+      SHANI_EACH (m[((g)+3)%4][l_]                                      \
+                  = _mm_sha1msg1_epu32 (m[((g)+3)%4][l_], m[(g)%4][l_])); \
+    if ((g) >= 2 && (g) <= 16)                                          \
+      SHANI_EACH (m[((g)+2)%4][l_]                                      \
+                  = _mm_xor_si128 (m[((g)+2)%4][l_], m[(g)%4][l_]));    \
+  } while (0)
+
+static void __attribute__ ((target ("sha,sse4.1")))
+keyids_shani (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *keyids)
+{
+  const u32 *w = ctx->block;
+  __m128i abcd[SHANI_LANES], e0[SHANI_LANES], e1[SHANI_LANES];
+  __m128i m[4][SHANI_LANES];
+  __m128i iv_abcd, iv_e;
+  int l;
+
+  iv_abcd = _mm_set_epi32 (H0, H1, H2, H3);
+  iv_e = _mm_set_epi32 (H4, 0, 0, 0);
+  for (l=0; l < SHANI_LANES; l++)
+    {
+      abcd[l] = iv_abcd;
+      m[0][l] = _mm_set_epi32 (w[0], timestamp + l, w[2], w[3]);
+      m[1][l] = _mm_set_epi32 (w[4], w[5], w[6], w[7]);
+      m[2][l] = _mm_set_epi32 (w[8], w[9], w[10], w[11]);
+      m[3][l] = _mm_set_epi32 (w[12], w[13], w[14], w[15]);
+    }
+
+  SHANI_EACH (e0[l_] = _mm_add_epi32 (iv_e, m[0][l_]));
+  SHANI_EACH (e1[l_] = abcd[l_]);
+  SHANI_EACH (abcd[l_] = _mm_sha1rnds4_epu32 (abcd[l_], e0[l_], 0));
+  SHANI_STEP (1);  SHANI_STEP (2);  SHANI_STEP (3);  SHANI_STEP (4);
+  SHANI_STEP (5);  SHANI_STEP (6);  SHANI_STEP (7);  SHANI_STEP (8);
+  SHANI_STEP (9);  SHANI_STEP (10); SHANI_STEP (11); SHANI_STEP (12);
+  SHANI_STEP (13); SHANI_STEP (14); SHANI_STEP (15); SHANI_STEP (16);
+  SHANI_STEP (17); SHANI_STEP (18);
+
+  /* The rounds 76 to 79 are skipped: the final E is the rotated A
+     after round 75.  sha1nexte does the rotation and adds H4.  */
+  SHANI_EACH (e0[l_] = _mm_sha1nexte_epu32 (abcd[l_], iv_e));
+  for (l=0; l < SHANI_LANES; l++)
+    keyids[l] = _mm_extract_epi32 (e0[l], 3);
+}
+
+static int
+supported_shani (void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  /* There is no __builtin_cpu_supports keyword for SHA in all GCC
+     versions, thus we look at CPUID leaf 7 ourself.  */
+  if (__get_cpuid_max (0, NULL) < 7)
+    return 0;
+  __cpuid_count (7, 0, eax, ebx, ecx, edx);
+  (void)eax; (void)ecx; (void)edx;
+  return (ebx & (1 << 29)) && __builtin_cpu_supports ("sse4.1");
+}
+
+#endif /*USE_SHA1_X86*/
+
+
+#ifdef USE_SHA1_ARMV8
+
+/* Rounds 4*G to 4*G+3 using the ARMv8 SHA1 instructions F.  TMP holds
+   the message words plus round constant of the next two groups.  The
+   words for the skipped last group are not computed.  */
+#define ARMV8_STEP(g,f) do {                                            \
+    if ((g) & 1)                                                        \
+      {                                                                 \
+        e0 = vsha1h_u32 (vgetq_lane_u32 (abcd, 0));                     \
+        abcd = f (abcd, e1, tmp[1]);                                    \
+      }                                                                 \
+    else                                                                \
+      {                                                                 \
+        e1 = vsha1h_u32 (vgetq_lane_u32 (abcd, 0));                     \
+        abcd = f (abcd, e0, tmp[0]);                                    \
+      }                                                                 \
+    if ((g) <= 16)                                                      \
+      tmp[(g)%2] = vaddq_u32 (m[((g)+2)%4], k[(g) <= 16? ((g)+2)/5 : 0]); \
+    if ((g) >= 1 && (g) <= 15)                                          \
+      m[((g)+3)%4] = vsha1su1q_u32 (m[((g)+3)%4], m[((g)+2)%4]);        \
+    if ((g) <= 14)                                                      \
+      m[(g)%4] = vsha1su0q_u32 (m[(g)%4], m[((g)+1)%4], m[((g)+2)%4]);  \
+  } while (0)
+
+static void __attribute__ ((target ("+crypto")))
+keyids_armv8 (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *keyids)
+{
+  static const u32 iv[4] = { H0, H1, H2, H3 };
+  uint32x4_t abcd, m[4], tmp[2], k[4];
+  uint32_t e0, e1;
+
+  abcd = vld1q_u32 (iv);
+  e0 = H4;
+  m[0] = vsetq_lane_u32 (timestamp, vld1q_u32 (ctx->block), 1);
+  m[1] = vld1q_u32 (ctx->block + 4);
+  m[2] = vld1q_u32 (ctx->block + 8);
+  m[3] = vld1q_u32 (ctx->block + 12);
+  k[0] = vdupq_n_u32 (K1);
+  k[1] = vdupq_n_u32 (K2);
+  k[2] = vdupq_n_u32 (K3);
+  k[3] = vdupq_n_u32 (K4);
+  tmp[0] = vaddq_u32 (m[0], k[0]);
+  tmp[1] = vaddq_u32 (m[1], k[0]);
+
+  ARMV8_STEP (0, vsha1cq_u32);  ARMV8_STEP (1, vsha1cq_u32);
+  ARMV8_STEP (2, vsha1cq_u32);  ARMV8_STEP (3, vsha1cq_u32);
+  ARMV8_STEP (4, vsha1cq_u32);  ARMV8_STEP (5, vsha1pq_u32);
+  ARMV8_STEP (6, vsha1pq_u32);  ARMV8_STEP (7, vsha1pq_u32);
+  ARMV8_STEP (8, vsha1pq_u32);  ARMV8_STEP (9, vsha1pq_u32);
+  ARMV8_STEP (10, vsha1mq_u32); ARMV8_STEP (11, vsha1mq_u32);
+  ARMV8_STEP (12, vsha1mq_u32); ARMV8_STEP (13, vsha1mq_u32);
+  ARMV8_STEP (14, vsha1mq_u32); ARMV8_STEP (15, vsha1pq_u32);
+  ARMV8_STEP (16, vsha1pq_u32); ARMV8_STEP (17, vsha1pq_u32);
+  ARMV8_STEP (18, vsha1pq_u32);
+
+  /* The rounds 76 to 79 are skipped: the final E is the rotated A
+     after round 75.  */
+  keyids[0] = H4 + vsha1h_u32 (vgetq_lane_u32 (abcd, 0));
+}
+
+static int
+supported_armv8 (void)
+{
+  return !!(getauxval (AT_HWCAP) & HWCAP_SHA1);
+}
+
+#endif /*USE_SHA1_ARMV8*/
+
+
+#ifdef USE_SHA1_NEON
+
+typedef u32 sha1_v4_t  __attribute__ ((vector_size (16)));
+
+/* NEON is part of the base architecture of the build, thus there is
+   nothing to check at runtime.  */
+static void
+keyids_neon (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *keyids)
+{
+  sha1_v4_t zero = { 0 };
+  sha1_v4_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v4_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v4_t x1 = (sha1_v4_t){ 0, 1, 2, 3 } + timestamp;
+#define SHA1_T sha1_v4_t
+#define SHA1_KEYID_ONLY 1
+#include "vanity-sha1-rounds.h"
+#undef SHA1_KEYID_ONLY
+#undef SHA1_T
+
+  e = ROL (e, 30) + H4;
+  memcpy (keyids, &e, sizeof e);
+}
+
+static void
+digests_neon (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  sha1_v4_t zero = { 0 };
+  sha1_v4_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v4_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v4_t x1 = (sha1_v4_t){ 0, 1, 2, 3 } + timestamp;
+#define SHA1_T sha1_v4_t
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  STORE_DIGESTS (digests, a, b, c, d, e);
+}
+
+static void
+multi_neon (const struct vanity_sha1_s *ctx, u32 timestamp, u32 *digests)
+{
+  sha1_v4_t zero = { 0 };
+  sha1_v4_t a = zero + ctx->a, b = zero + ctx->b, c = zero + ctx->c;
+  sha1_v4_t d = zero + ctx->d, e = zero + ctx->e;
+  sha1_v4_t x1 = (sha1_v4_t){ 0, 1, 2, 3 } + timestamp;
+#define SHA1_T sha1_v4_t
+#include "vanity-sha1-rounds.h"
+#undef SHA1_T
+
+  HASH_TAIL (sha1_v4_t);
+  PUT_DIGESTS (digests, a, b, c, d, e);
+}
+
+#endif /*USE_SHA1_NEON*/
+
+
+/* The available kernels.  Which one is the fastest depends on the
+   CPU, thus those passing the self-test are timed and the fastest is
+   used.  This is done separately for the keyid, the digest and the
+   multi-block variants.  The scalar kernel must be the last one.  */
+typedef void (*kernel_fnc_t) (const struct vanity_sha1_s *ctx,
+                              u32 timestamp, u32 *result);
+static struct
+{
+  const char *name;
+  unsigned int lanes;
+  kernel_fnc_t keyids;
+  kernel_fnc_t digests;  /* NULL if there is no digest variant.  */
+  kernel_fnc_t multi;    /* NULL if there is no multi-block variant.  */
+  int (*supported) (void);
+} kernels[] =
+  {
+#ifdef USE_SHA1_X86
+    { "shani",   SHANI_LANES, keyids_shani, NULL, NULL, supported_shani },
+    { "avx512", 16, keyids_avx512, digests_avx512, multi_avx512,
+      supported_avx512 },
+    { "avx2",    8, keyids_avx2,   digests_avx2,   multi_avx2,
+      supported_avx2 },
+    { "sse2",    4, keyids_sse2,   digests_sse2,   multi_sse2,
+      supported_sse2 },
+#endif
+#ifdef USE_SHA1_ARMV8
+    { "armv8",   1, keyids_armv8,  NULL,           NULL, supported_armv8 },
+#endif
+#ifdef USE_SHA1_NEON
+    { "neon",    4, keyids_neon,   digests_neon,   multi_neon,   NULL },
+#endif
+    { "scalar",  1, keyids_scalar, digests_scalar, multi_scalar, NULL }
+  };
+
+/* The indices of the selected kernels.  */
+static int selected_kernel = -1;
+static int selected_digests = -1;
+static int selected_multi = -1;
+
+/* The number of keyids computed to time a kernel.  */
+#define CALIBRATION_KEYIDS 65536
+
+
+/* A key packet with the layout of an Ed25519 key for the self-test.  */
+static const unsigned char selftest_packet[51] =
+  {
+    0x99, 0x00, 0x30, 0x04, 0x55, 0x5d, 0x89, 0x3f, 0x16, 0x09,
+    0x2b, 0x06, 0x01, 0x04, 0x01, 0xda, 0x47, 0x0f, 0x01, 0x01,
+    0x07, 0x40, 0x3f, 0x09, 0x89, 0x94, 0xbd, 0xd9, 0x16, 0xed,
+    0x40, 0x53, 0x19, 0x79, 0x34, 0xe4, 0xa8, 0x7c, 0x80, 0x73,
+    0x3a, 0x12, 0x80, 0xd6, 0x2f, 0x80, 0x10, 0x99, 0x2e, 0x43,
+    0xee
+  };
+
+
+/* The lengths of the packets used to check the multi-block kernels:
+   the shortest one, one filling two blocks exactly and the longest
+   one.  */
+static const size_t selftest_multi_lengths[] =
+  { VANITY_SHA1_MAXLEN + 1, 128 - 9, VANITY_SHA1_MULTI_MAXLEN };
+
+/* Return a key packet of length LEN for checking and timing the
+   multi-block kernels.  The contents don't matter.  */
+static const unsigned char *
+selftest_multi_packet (size_t len)
+{
+  static unsigned char packet[VANITY_SHA1_MULTI_MAXLEN];
+  size_t i;
+
+  for (i=0; i < sizeof packet; i++)
+    packet[i] = i * 7 + 3;
+  packet[0] = 0x99;
+  packet[1] = (len - 3) >> 8;
+  packet[2] = (len - 3);
+  packet[3] = 4;
+  return packet;
+}
+
+
+/* Check the multi-block variant FNC of a kernel with LANES lanes
+   against libgcrypt.  Returns true if it works correctly.  */
+static int
+selftest_multi (kernel_fnc_t fnc, unsigned int lanes)
+{
+  static const u32 timestamps[] = { 0x555d893f, 0xfffffff0 };
+  static struct vanity_sha1_s ctx;
+  unsigned char packet[VANITY_SHA1_MULTI_MAXLEN];
+  unsigned char fpr[VANITY_FPR_LEN];
+  u32 digests[5 * VANITY_SHA1_MAX_LANES];
+  unsigned int i, k, n, w;
+  size_t len;
+
+  for (k=0; k < DIM (selftest_multi_lengths); k++)
+    {
+      len = selftest_multi_lengths[k];
+      memcpy (packet, selftest_multi_packet (len), len);
+      _vanity_sha1_prepare (&ctx, packet, len);
+      for (i=0; i < DIM (timestamps); i++)
+        {
+          fnc (&ctx, timestamps[i], digests);
+          for (n=0; n < lanes; n++)
+            {
+              put_u32 (packet + 4, timestamps[i] + n);
+              gcry_md_hash_buffer (GCRY_MD_SHA1, fpr, packet, len);
+              for (w=0; w < 5; w++)
+                if (digests[w * VANITY_SHA1_MAX_LANES + n]
+                    != buf32_to_u32 (fpr + 4 * w))
+                  return 0;
+            }
+        }
+    }
+  return 1;
+}
+
+
+/* Check kernel number IDX, including its digest and multi-block
+   variants, against libgcrypt.  Returns true if it works
+   correctly.  */
+static int
+selftest_kernel (int idx)
+{
+  static const u32 timestamps[] = { 0x555d893f, 0x00000001, 0xfffffff0 };
+  struct vanity_sha1_s ctx;
+  unsigned char packet[sizeof selftest_packet];
+  unsigned char fpr[VANITY_FPR_LEN];
+  u32 keyids[VANITY_SHA1_MAX_LANES];
+  u32 digests[5 * VANITY_SHA1_MAX_LANES];
+  unsigned int i, n, w;
+
+  memcpy (packet, selftest_packet, sizeof packet);
+  _vanity_sha1_prepare (&ctx, packet, sizeof packet);
+  for (i=0; i < DIM (timestamps); i++)
+    {
+      kernels[idx].keyids (&ctx, timestamps[i], keyids);
+      if (kernels[idx].digests)
+        kernels[idx].digests (&ctx, timestamps[i], digests);
+      for (n=0; n < kernels[idx].lanes; n++)
+        {
+          put_u32 (packet + 4, timestamps[i] + n);
+          gcry_md_hash_buffer (GCRY_MD_SHA1, fpr, packet, sizeof packet);
+          if (keyids[n] != buf32_to_u32 (fpr + 16))
+            return 0;
+          if (!kernels[idx].digests)
+            continue;
+          for (w=0; w < 5; w++)
+            if (digests[w * VANITY_SHA1_MAX_LANES + n]
+                != buf32_to_u32 (fpr + 4 * w))
+              return 0;
+        }
+    }
+  if (kernels[idx].multi
+      && !selftest_multi (kernels[idx].multi, kernels[idx].lanes))
+    return 0;
+  return 1;
+}
+
+
+/* Return the time in nanoseconds the kernel function FNC with LANES
+   lanes takes for CALIBRATION_KEYIDS timestamps of the key packet
+   PACKET of length LEN, or 0 if that can't be measured.  */
+static unsigned long long
+time_kernel (kernel_fnc_t fnc, unsigned int lanes,
+             const unsigned char *packet, size_t len)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  static struct vanity_sha1_s ctx;
+  u32 result[5 * VANITY_SHA1_MAX_LANES];
+  struct timespec start, stop;
+  u32 timestamp;
+
+  _vanity_sha1_prepare (&ctx, packet, len);
+  if (clock_gettime (CLOCK_MONOTONIC, &start))
+    return 0;
+  for (timestamp=0; timestamp < CALIBRATION_KEYIDS; timestamp += lanes)
+    fnc (&ctx, timestamp, result);
+  if (clock_gettime (CLOCK_MONOTONIC, &stop))
+    return 0;
+  return ((stop.tv_sec - start.tv_sec) * 1000000000ULL
+          + stop.tv_nsec - start.tv_nsec);
+#else
+  (void)fnc;
+  (void)lanes;
+  (void)packet;
+  (void)len;
+  return 0;
+#endif
+}
+
+
+/* Select the fastest kernels supported by the CPU which pass the
+   self-test.  This needs to be called before any of the functions
+   below is used.  */
+void
+_vanity_sha1_init (void)
+{
+  unsigned long long t, best_time = 0, best_dtime = 0, best_mtime = 0;
+  int i, best = -1, dbest = -1, mbest = -1;
+  size_t mlen = 128 - 9;
+
+  if (selected_kernel != -1)
+    return;
+
+#ifdef USE_SHA1_X86
+  __builtin_cpu_init ();
+#endif
+  for (i=0; i < DIM (kernels); i++)
+    {
+      if (kernels[i].supported && !kernels[i].supported ())
+        continue;
+      if (!selftest_kernel (i))
+        {
+          log_error ("SHA-1 kernel '%s' failed the self-test\n",
+                     kernels[i].name);
+          continue;
+        }
+      t = time_kernel (kernels[i].keyids, kernels[i].lanes,
+                       selftest_packet, sizeof selftest_packet);
+      if (best == -1 || (t && t < best_time))
+        {
+          best = i;
+          best_time = t;
+        }
+      if (kernels[i].digests)
+        {
+          t = time_kernel (kernels[i].digests, kernels[i].lanes,
+                           selftest_packet, sizeof selftest_packet);
+          if (dbest == -1 || (t && t < best_dtime))
+            {
+              dbest = i;
+              best_dtime = t;
+            }
+        }
+      /* The blocks after the first cost the same for all packets;
+         two blocks suffice to compare the kernels.  */
+      if (kernels[i].multi)
+        {
+          t = time_kernel (kernels[i].multi, kernels[i].lanes,
+                           selftest_multi_packet (mlen), mlen);
+          if (mbest == -1 || (t && t < best_mtime))
+            {
+              mbest = i;
+              best_mtime = t;
+            }
+        }
+    }
+  if (best == -1 || dbest == -1 || mbest == -1)
+    log_fatal ("no working SHA-1 kernel\n");
+  selected_kernel = best;
+  selected_digests = dbest;
+  selected_multi = mbest;
+}
+
+
+/* Return the name of kernel number IDX in the order they are tried,
+   or NULL if there is no such kernel.  This is used to benchmark each
+   kernel.  */
+const char *
+_vanity_sha1_kernel_list (unsigned int idx)
+{
+  return idx < DIM (kernels)? kernels[idx].name : NULL;
+}
+
+
+/* Select the kernel NAME instead of the fastest one for the keyids,
+   or for the digests if DIGESTS is set.  Returns false if the kernel
+   has no such variant, is not supported by the CPU or fails the
+   self-test.  Must be called after _vanity_sha1_init and before any
+   search starts.  */
+int
+_vanity_sha1_select (const char *name, int digests)
+{
+  int i;
+
+  for (i=0; i < DIM (kernels); i++)
+    if (!strcmp (kernels[i].name, name))
+      break;
+  if (i == DIM (kernels) || (digests && !kernels[i].digests)
+      || (kernels[i].supported && !kernels[i].supported ())
+      || !selftest_kernel (i))
+    return 0;
+  if (digests)
+    selected_digests = i;
+  else
+    selected_kernel = i;
+  return 1;
+}
+
+
+/* Return the name of the selected kernel.  */
+const char *
+_vanity_sha1_kernel_name (void)
+{
+  return kernels[selected_kernel].name;
+}
+
+
+/* Return the number of keyids computed by _vanity_sha1_keyids.  */
+unsigned int
+_vanity_sha1_lanes (void)
+{
+  return kernels[selected_kernel].lanes;
+}
+
+
+/* Compute the keyids of the packet prepared in CTX for the
+   consecutive timestamps starting at TIMESTAMP.  The number of
+   keyids stored at KEYIDS is given by _vanity_sha1_lanes; this is at
+   most VANITY_SHA1_MAX_LANES.  The packet must fit into a single
+   block.  */
+void
+_vanity_sha1_keyids (const struct vanity_sha1_s *ctx, u32 timestamp,
+                     u32 *keyids)
+{
+  kernels[selected_kernel].keyids (ctx, timestamp, keyids);
+}
+
+
+/* Return the name of the kernel selected for the digests.  */
+const char *
+_vanity_sha1_digest_kernel_name (void)
+{
+  return kernels[selected_digests].name;
+}
+
+
+/* Return the number of digests computed by _vanity_sha1_digests.  */
+unsigned int
+_vanity_sha1_digest_lanes (void)
+{
+  return kernels[selected_digests].lanes;
+}
+
+
+/* Compute the complete digests of the packet prepared in CTX for the
+   consecutive timestamps starting at TIMESTAMP.  The number of
+   digests is given by _vanity_sha1_digest_lanes.  Word W of the
+   digest for lane I is stored at DIGESTS[W * VANITY_SHA1_MAX_LANES +
+   I], thus DIGESTS must provide space for 5 * VANITY_SHA1_MAX_LANES
+   words.  The packet must fit into a single block.  */
+void
+_vanity_sha1_digests (const struct vanity_sha1_s *ctx, u32 timestamp,
+                      u32 *digests)
+{
+  kernels[selected_digests].digests (ctx, timestamp, digests);
+}
+
+
+/* Return the name of the kernel selected for packets of several
+   blocks.  */
+const char *
+_vanity_sha1_multi_kernel_name (void)
+{
+  return kernels[selected_multi].name;
+}
+
+
+/* Return the number of digests computed by
+   _vanity_sha1_multi_digests.  */
+unsigned int
+_vanity_sha1_multi_lanes (void)
+{
+  return kernels[selected_multi].lanes;
+}
+
+
+/* Compute the complete digests of the packet prepared in CTX, which
+   may take several blocks, like _vanity_sha1_digests.  The number of
+   digests is given by _vanity_sha1_multi_lanes.  */
+void
+_vanity_sha1_multi_digests (const struct vanity_sha1_s *ctx, u32 timestamp,
+                            u32 *digests)
+{
+  kernels[selected_multi].multi (ctx, timestamp, digests);
+}
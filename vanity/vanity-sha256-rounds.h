@@ -0,0 +1,146 @@
+/* vanity-sha256-rounds.h - Unrolled rounds of the vanity SHA-256 kernels
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file is included by vanity-sha256.c into the body of each
+   kernel; it thus has no include guard.  The kernel must define
+   SHA256_T as the type of the state words, declare the state A to H,
+   initialized from the CTX, and the timestamp words X1 and X2.  The
+   rounds 1 to 63 of the first block are computed; see
+   vanity-sha256.c for the meaning of the RV and RF rounds.  */
+
+  SHA256_T x16, x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27,
+      x28, x29, x30, x31, x32, x33, x34, x35, x36, x37, x38, x39, x40,
+      x41, x42, x43, x44, x45, x46, x47, x48, x49, x50, x51, x52, x53,
+      x54, x55, x56, x57, x58, x59, x60, x61, x62, x63;
+  SHA256_T t_;
+
+  RV (a, b, c, d, e, f, g, h, 1, x1);
+  RV (h, a, b, c, d, e, f, g, 2, x2);
+  RF (g, h, a, b, c, d, e, f, 3);
+  RF (f, g, h, a, b, c, d, e, 4);
+  RF (e, f, g, h, a, b, c, d, 5);
+  RF (d, e, f, g, h, a, b, c, 6);
+  RF (c, d, e, f, g, h, a, b, 7);
+  RF (b, c, d, e, f, g, h, a, 8);
+  RF (a, b, c, d, e, f, g, h, 9);
+  RF (h, a, b, c, d, e, f, g, 10);
+  RF (g, h, a, b, c, d, e, f, 11);
+  RF (f, g, h, a, b, c, d, e, 12);
+  RF (e, f, g, h, a, b, c, d, 13);
+  RF (d, e, f, g, h, a, b, c, 14);
+  RF (c, d, e, f, g, h, a, b, 15);
+  x16 = ctx->w[16] + S0 (x1);
+  RV (b, c, d, e, f, g, h, a, 16, x16);
+  x17 = ctx->w[17] + S0 (x2) + x1;
+  RV (a, b, c, d, e, f, g, h, 17, x17);
+  x18 = ctx->w[18] + S1 (x16) + x2;
+  RV (h, a, b, c, d, e, f, g, 18, x18);
+  x19 = ctx->w[19] + S1 (x17);
+  RV (g, h, a, b, c, d, e, f, 19, x19);
+  x20 = ctx->w[20] + S1 (x18);
+  RV (f, g, h, a, b, c, d, e, 20, x20);
+  x21 = ctx->w[21] + S1 (x19);
+  RV (e, f, g, h, a, b, c, d, 21, x21);
+  x22 = ctx->w[22] + S1 (x20);
+  RV (d, e, f, g, h, a, b, c, 22, x22);
+  x23 = ctx->w[23] + S1 (x21) + x16;
+  RV (c, d, e, f, g, h, a, b, 23, x23);
+  x24 = ctx->w[24] + S1 (x22) + x17;
+  RV (b, c, d, e, f, g, h, a, 24, x24);
+  x25 = ctx->w[25] + S1 (x23) + x18;
+  RV (a, b, c, d, e, f, g, h, 25, x25);
+  x26 = ctx->w[26] + S1 (x24) + x19;
+  RV (h, a, b, c, d, e, f, g, 26, x26);
+  x27 = ctx->w[27] + S1 (x25) + x20;
+  RV (g, h, a, b, c, d, e, f, 27, x27);
+  x28 = ctx->w[28] + S1 (x26) + x21;
+  RV (f, g, h, a, b, c, d, e, 28, x28);
+  x29 = ctx->w[29] + S1 (x27) + x22;
+  RV (e, f, g, h, a, b, c, d, 29, x29);
+  x30 = ctx->w[30] + S1 (x28) + x23;
+  RV (d, e, f, g, h, a, b, c, 30, x30);
+  x31 = ctx->w[31] + S1 (x29) + x24 + S0 (x16);
+  RV (c, d, e, f, g, h, a, b, 31, x31);
+  x32 = ctx->w[32] + S1 (x30) + x25 + S0 (x17) + x16;
+  RV (b, c, d, e, f, g, h, a, 32, x32);
+  x33 = ctx->w[33] + S1 (x31) + x26 + S0 (x18) + x17;
+  RV (a, b, c, d, e, f, g, h, 33, x33);
+  x34 = ctx->w[34] + S1 (x32) + x27 + S0 (x19) + x18;
+  RV (h, a, b, c, d, e, f, g, 34, x34);
+  x35 = ctx->w[35] + S1 (x33) + x28 + S0 (x20) + x19;
+  RV (g, h, a, b, c, d, e, f, 35, x35);
+  x36 = ctx->w[36] + S1 (x34) + x29 + S0 (x21) + x20;
+  RV (f, g, h, a, b, c, d, e, 36, x36);
+  x37 = ctx->w[37] + S1 (x35) + x30 + S0 (x22) + x21;
+  RV (e, f, g, h, a, b, c, d, 37, x37);
+  x38 = ctx->w[38] + S1 (x36) + x31 + S0 (x23) + x22;
+  RV (d, e, f, g, h, a, b, c, 38, x38);
+  x39 = ctx->w[39] + S1 (x37) + x32 + S0 (x24) + x23;
+  RV (c, d, e, f, g, h, a, b, 39, x39);
+  x40 = ctx->w[40] + S1 (x38) + x33 + S0 (x25) + x24;
+  RV (b, c, d, e, f, g, h, a, 40, x40);
+  x41 = ctx->w[41] + S1 (x39) + x34 + S0 (x26) + x25;
+  RV (a, b, c, d, e, f, g, h, 41, x41);
+  x42 = ctx->w[42] + S1 (x40) + x35 + S0 (x27) + x26;
+  RV (h, a, b, c, d, e, f, g, 42, x42);
+  x43 = ctx->w[43] + S1 (x41) + x36 + S0 (x28) + x27;
+  RV (g, h, a, b, c, d, e, f, 43, x43);
+  x44 = ctx->w[44] + S1 (x42) + x37 + S0 (x29) + x28;
+  RV (f, g, h, a, b, c, d, e, 44, x44);
+  x45 = ctx->w[45] + S1 (x43) + x38 + S0 (x30) + x29;
+  RV (e, f, g, h, a, b, c, d, 45, x45);
+  x46 = ctx->w[46] + S1 (x44) + x39 + S0 (x31) + x30;
+  RV (d, e, f, g, h, a, b, c, 46, x46);
+  x47 = ctx->w[47] + S1 (x45) + x40 + S0 (x32) + x31;
+  RV (c, d, e, f, g, h, a, b, 47, x47);
+  x48 = ctx->w[48] + S1 (x46) + x41 + S0 (x33) + x32;
+  RV (b, c, d, e, f, g, h, a, 48, x48);
+  x49 = ctx->w[49] + S1 (x47) + x42 + S0 (x34) + x33;
+  RV (a, b, c, d, e, f, g, h, 49, x49);
+  x50 = ctx->w[50] + S1 (x48) + x43 + S0 (x35) + x34;
+  RV (h, a, b, c, d, e, f, g, 50, x50);
+  x51 = ctx->w[51] + S1 (x49) + x44 + S0 (x36) + x35;
+  RV (g, h, a, b, c, d, e, f, 51, x51);
+  x52 = ctx->w[52] + S1 (x50) + x45 + S0 (x37) + x36;
+  RV (f, g, h, a, b, c, d, e, 52, x52);
+  x53 = ctx->w[53] + S1 (x51) + x46 + S0 (x38) + x37;
+  RV (e, f, g, h, a, b, c, d, 53, x53);
+  x54 = ctx->w[54] + S1 (x52) + x47 + S0 (x39) + x38;
+  RV (d, e, f, g, h, a, b, c, 54, x54);
+  x55 = ctx->w[55] + S1 (x53) + x48 + S0 (x40) + x39;
+  RV (c, d, e, f, g, h, a, b, 55, x55);
+  x56 = ctx->w[56] + S1 (x54) + x49 + S0 (x41) + x40;
+  RV (b, c, d, e, f, g, h, a, 56, x56);
+  x57 = ctx->w[57] + S1 (x55) + x50 + S0 (x42) + x41;
+  RV (a, b, c, d, e, f, g, h, 57, x57);
+  x58 = ctx->w[58] + S1 (x56) + x51 + S0 (x43) + x42;
+  RV (h, a, b, c, d, e, f, g, 58, x58);
+  x59 = ctx->w[59] + S1 (x57) + x52 + S0 (x44) + x43;
+  RV (g, h, a, b, c, d, e, f, 59, x59);
+  x60 = ctx->w[60] + S1 (x58) + x53 + S0 (x45) + x44;
+  RV (f, g, h, a, b, c, d, e, 60, x60);
+  x61 = ctx->w[61] + S1 (x59) + x54 + S0 (x46) + x45;
+  RV (e, f, g, h, a, b, c, d, 61, x61);
+  x62 = ctx->w[62] + S1 (x60) + x55 + S0 (x47) + x46;
+  RV (d, e, f, g, h, a, b, c, 62, x62);
+  x63 = ctx->w[63] + S1 (x61) + x56 + S0 (x48) + x47;
+  RV (c, d, e, f, g, h, a, b, 63, x63);
+
+  /* After the 63 rounds the names are rotated by one place.  */
+  t_ = a; a = b; b = c; c = d; d = e; e = f; f = g; g = h; h = t_;
@@ -0,0 +1,770 @@
+/* vanity-sha256.c - SHA-256 kernel for the vanity timestamp sweep
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The fingerprint of a v5 key is the SHA-256 hash of the key packet
+   prefixed with 0x9A and a four byte length.  The timestamp is then
+   at offset 6 and thus straddles the message words W[1] and W[2];
+   all other words of the first block are fixed for a key.
+
+   The precomputation follows the SHA-1 kernel in vanity-sha1.c:
+   _vanity_sha256_prepare does the first round, which only uses W[0],
+   adds the round constant to the fixed words W[3] to W[15] and
+   computes for each word of the schedule which depends on the
+   timestamp the sum of its fixed terms.  The schedule of SHA-256 is
+   not linear, but it is a sum of terms each taken from a single
+   earlier word; a dependent word is thus its fixed part plus the
+   terms of its dependent inputs.  The unrolled code in
+   vanity-sha256-rounds.h encodes which words depend on the timestamp
+   and must match the table computed here.
+
+   Even the packet of an Ed25519 key does not fit with the padding
+   into a single block; the further blocks don't depend on the
+   timestamp and their complete schedule, with the round constants
+   added, is computed once.  What remains for them are the 64 rounds
+   of each block.
+
+   Besides the scalar kernel there are multi-lane kernels which hash
+   several consecutive timestamps at once using SIMD instructions and
+   one using the SHA instructions of x86 CPUs.  All of them compute
+   the complete digest; the keyid is its second word.  Each kernel
+   the CPU supports is checked against libgcrypt and timed once; the
+   fastest one is used.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vanity-defs.h"
+#include "../common/host2net.h"
+
+
+/* The same conditions as for the SHA-1 kernels.  */
+#if defined(__GNUC__) && !defined(__clang__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# if defined(__x86_64__) || defined(__i386__)
+#  define USE_SHA256_X86 1
+# elif defined(__ARM_NEON) || defined(__aarch64__)
+#  define USE_SHA256_NEON 1
+# endif
+#endif
+
+#include <time.h>
+#ifdef USE_SHA256_X86
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+
+
+#define ROR(x,n) (((x) >> (n)) | ((x) << (32-(n))))
+
+#define S0(x)  (ROR ((x), 7) ^ ROR ((x), 18) ^ ((x) >> 3))
+#define S1(x)  (ROR ((x), 17) ^ ROR ((x), 19) ^ ((x) >> 10))
+#define E0(x)  (ROR ((x), 2) ^ ROR ((x), 13) ^ ROR ((x), 22))
+#define E1(x)  (ROR ((x), 6) ^ ROR ((x), 11) ^ ROR ((x), 25))
+#define CH(x,y,z)   ( (z) ^ ( (x) & ( (y) ^ (z) ) ) )
+#define MAJ(x,y,z)  ( ( (x) & (y) ) | ( (z) & ( (x) | (y) ) ) )
+
+#define H0  0x6a09e667L
+#define H1  0xbb67ae85L
+#define H2  0x3c6ef372L
+#define H3  0xa54ff53aL
+#define H4  0x510e527fL
+#define H5  0x9b05688cL
+#define H6  0x1f83d9abL
+#define H7  0x5be0cd19L
+
+static const u32 k256[64] =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+/* A round with the round constant plus message word KW.  It leaves
+   the new A in H and the new E in D; the next round is called with
+   the names rotated by one place.  */
+#define R(a,b,c,d,e,f,g,h,kw)  do                             \
+    {                                                         \
+      h += E1 (e) + CH (e, f, g) + (kw);                      \
+      d += h;                                                 \
+      h += E0 (a) + MAJ (a, b, c);                            \
+    } while (0)
+
+/* A round T with a message word depending on the timestamp.  */
+#define RV(a,b,c,d,e,f,g,h,t,w)  R (a, b, c, d, e, f, g, h, k256[t] + (w))
+
+/* A round T with a fixed message word.  */
+#define RF(a,b,c,d,e,f,g,h,t)    R (a, b, c, d, e, f, g, h, ctx->kw[t])
+
+
+/* Store the digests A to H, which may be vectors, of their lanes at
+   P; see _vanity_sha256_digests for the layout.  */
+#define PUT_DIGESTS(p,a,b,c,d,e,f,g,h)  do                            \
+    {                                                                 \
+      memcpy ((p),                           &(a), sizeof (a));       \
+      memcpy ((p) +   VANITY_SHA1_MAX_LANES, &(b), sizeof (b));       \
+      memcpy ((p) + 2*VANITY_SHA1_MAX_LANES, &(c), sizeof (c));       \
+      memcpy ((p) + 3*VANITY_SHA1_MAX_LANES, &(d), sizeof (d));       \
+      memcpy ((p) + 4*VANITY_SHA1_MAX_LANES, &(e), sizeof (e));       \
+      memcpy ((p) + 5*VANITY_SHA1_MAX_LANES, &(f), sizeof (f));       \
+      memcpy ((p) + 6*VANITY_SHA1_MAX_LANES, &(g), sizeof (g));       \
+      memcpy ((p) + 7*VANITY_SHA1_MAX_LANES, &(h), sizeof (h));       \
+    } while (0)
+
+/* Chain the state A to H of type T after the rounds of the first
+   block through the further blocks of CTX.  A to H are then the
+   digest with the initial value already added.  */
+#define HASH_TAIL(T)  do                                                \
+    {                                                                   \
+      T h0_ = a + H0, h1_ = b + H1, h2_ = c + H2, h3_ = d + H3;         \
+      T h4_ = e + H4, h5_ = f + H5, h6_ = g + H6, h7_ = h + H7;         \
+      const u32 *kw_;                                                   \
+      unsigned int i_;                                                  \
+      int t_;                                                           \
+                                                                        \
+      for (i_=0; i_ < ctx->ntail; i_++)                                 \
+        {                                                               \
+          kw_ = ctx->tail[i_];                                          \
+          a = h0_; b = h1_; c = h2_; d = h3_;                           \
+          e = h4_; f = h5_; g = h6_; h = h7_;                           \
+          for (t_=0; t_ < 64; t_ += 8)                                  \
+            {                                                           \
+              R (a, b, c, d, e, f, g, h, kw_[t_]);                      \
+              R (h, a, b, c, d, e, f, g, kw_[t_+1]);                    \
+              R (g, h, a, b, c, d, e, f, kw_[t_+2]);                    \
+              R (f, g, h, a, b, c, d, e, kw_[t_+3]);                    \
+              R (e, f, g, h, a, b, c, d, kw_[t_+4]);                    \
+              R (d, e, f, g, h, a, b, c, kw_[t_+5]);                    \
+              R (c, d, e, f, g, h, a, b, kw_[t_+6]);                    \
+              R (b, c, d, e, f, g, h, a, kw_[t_+7]);                    \
+            }                                                           \
+          h0_ += a; h1_ += b; h2_ += c; h3_ += d;                       \
+          h4_ += e; h5_ += f; h6_ += g; h7_ += h;                       \
+        }                                                               \
+      a = h0_; b = h1_; c = h2_; d = h3_;                               \
+      e = h4_; f = h5_; g = h6_; h = h7_;                               \
+    } while (0)
+
+/* Declare the state A to H of type T, initialized from CTX.  */
+#define LOAD_STATE(T)                                                   \
+  T zero_ = { 0 };                                                      \
+  T a = zero_ + ctx->state[0], b = zero_ + ctx->state[1];               \
+  T c = zero_ + ctx->state[2], d = zero_ + ctx->state[3];               \
+  T e = zero_ + ctx->state[4], f = zero_ + ctx->state[5];               \
+  T g = zero_ + ctx->state[6], h = zero_ + ctx->state[7]
+
+
+/* Store the 32 bit value VAL big endian at P.  */
+static inline void
+put_u32 (unsigned char *p, u32 val)
+{
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >>  8;
+  p[3] = val;
+}
+
+
+/* Prepare CTX for the v5 key packet PACKET of length LEN, as it is
+   hashed for the fingerprint.  LEN may not be larger than
+   VANITY_SHA256_MAXLEN and the timestamp must be at offset 6.  The
+   timestamp in PACKET is ignored.  */
+void
+_vanity_sha256_prepare (struct vanity_sha256_s *ctx,
+                        const unsigned char *packet, size_t len)
+{
+  unsigned char block[64 * VANITY_SHA256_MAX_BLOCKS];
+  unsigned char depends[64];
+  size_t nblocks;
+  u32 w[64];
+  u32 a, b, c, d, e, f, g, h;
+  unsigned int i;
+  int t;
+
+  nblocks = (len + 9 + 63) / 64;
+  memset (block, 0, 64 * nblocks);
+  memcpy (block, packet, len);
+  memset (block + 6, 0, 4);
+  block[len] = 0x80;
+  put_u32 (block + 64 * nblocks - 4, len * 8);
+
+  for (t=0; t < 16; t++)
+    {
+      w[t] = buf32_to_u32 (block + 4*t);
+      depends[t] = (t == 1 || t == 2);
+      ctx->block[t] = w[t];
+    }
+  for (; t < 64; t++)
+    {
+      u32 fixed = 0;
+
+      depends[t] = (depends[t-2] || depends[t-7]
+                    || depends[t-15] || depends[t-16]);
+      if (!depends[t-2])
+        fixed += S1 (w[t-2]);
+      if (!depends[t-7])
+        fixed += w[t-7];
+      if (!depends[t-15])
+        fixed += S0 (w[t-15]);
+      if (!depends[t-16])
+        fixed += w[t-16];
+      w[t] = fixed;
+    }
+
+  for (t=0; t < 64; t++)
+    {
+      ctx->w[t] = depends[t]? w[t] : 0;
+      ctx->kw[t] = depends[t]? 0 : k256[t] + w[t];
+    }
+
+  /* The first round only uses W[0].  Store the state with the names
+     rotated back.  */
+  a = H0; b = H1; c = H2; d = H3; e = H4; f = H5; g = H6; h = H7;
+  RF (a, b, c, d, e, f, g, h, 0);
+  ctx->state[0] = h; ctx->state[1] = a; ctx->state[2] = b;
+  ctx->state[3] = c; ctx->state[4] = d; ctx->state[5] = e;
+  ctx->state[6] = f; ctx->state[7] = g;
+
+  /* The further blocks are fixed.  */
+  ctx->ntail = nblocks - 1;
+  for (i=0; i < ctx->ntail; i++)
+    {
+      for (t=0; t < 16; t++)
+        w[t] = buf32_to_u32 (block + 64 * (i + 1) + 4*t);
+      for (; t < 64; t++)
+        w[t] = S1 (w[t-2]) + w[t-7] + S0 (w[t-15]) + w[t-16];
+      for (t=0; t < 64; t++)
+        ctx->tail[i][t] = k256[t] + w[t];
+    }
+}
+
+
+/* Compute the fingerprint of the packet prepared in CTX with its
+   timestamp set to TIMESTAMP and store it at FPR, which must provide
+   space for VANITY_V5_FPR_LEN bytes.  */
+void
+_vanity_sha256_fingerprint (const struct vanity_sha256_s *ctx,
+                            u32 timestamp, unsigned char *fpr)
+{
+  u32 a = ctx->state[0], b = ctx->state[1], c = ctx->state[2];
+  u32 d = ctx->state[3], e = ctx->state[4], f = ctx->state[5];
+  u32 g = ctx->state[6], h = ctx->state[7];
+  u32 x1 = ctx->block[1] | (timestamp >> 16);
+  u32 x2 = ctx->block[2] | (timestamp << 16);
+#define SHA256_T u32
+#include "vanity-sha256-rounds.h"
+#undef SHA256_T
+
+  HASH_TAIL (u32);
+  put_u32 (fpr,      a);
+  put_u32 (fpr +  4, b);
+  put_u32 (fpr +  8, c);
+  put_u32 (fpr + 12, d);
+  put_u32 (fpr + 16, e);
+  put_u32 (fpr + 20, f);
+  put_u32 (fpr + 24, g);
+  put_u32 (fpr + 28, h);
+}
+
+
+
+/* The scalar kernel.  */
+static void
+digests_scalar (const struct vanity_sha256_s *ctx, u32 timestamp,
+                u32 *digests)
+{
+  u32 a = ctx->state[0], b = ctx->state[1], c = ctx->state[2];
+  u32 d = ctx->state[3], e = ctx->state[4], f = ctx->state[5];
+  u32 g = ctx->state[6], h = ctx->state[7];
+  u32 x1 = ctx->block[1] | (timestamp >> 16);
+  u32 x2 = ctx->block[2] | (timestamp << 16);
+#define SHA256_T u32
+#include "vanity-sha256-rounds.h"
+#undef SHA256_T
+
+  HASH_TAIL (u32);
+  PUT_DIGESTS (digests, a, b, c, d, e, f, g, h);
+}
+
+
+/* The multi-lane kernels hash consecutive timestamps in the lanes of
+   a vector, like those of vanity-sha1.c.  */
+#ifdef USE_SHA256_X86
+
+typedef u32 sha256_v4_t  __attribute__ ((vector_size (16)));
+typedef u32 sha256_v8_t  __attribute__ ((vector_size (32)));
+typedef u32 sha256_v16_t __attribute__ ((vector_size (64)));
+
+static void __attribute__ ((target ("sse2")))
+digests_sse2 (const struct vanity_sha256_s *ctx, u32 timestamp, u32 *digests)
+{
+  LOAD_STATE (sha256_v4_t);
+  sha256_v4_t ts = (sha256_v4_t){ 0, 1, 2, 3 } + timestamp;
+  sha256_v4_t x1 = (ts >> 16) | ctx->block[1];
+  sha256_v4_t x2 = (ts << 16) | ctx->block[2];
+#define SHA256_T sha256_v4_t
+#include "vanity-sha256-rounds.h"
+#undef SHA256_T
+
+  HASH_TAIL (sha256_v4_t);
+  PUT_DIGESTS (digests, a, b, c, d, e, f, g, h);
+}
+
+static int
+supported_sse2 (void)
+{
+  return __builtin_cpu_supports ("sse2");
+}
+
+
+static void __attribute__ ((target ("avx2")))
+digests_avx2 (const struct vanity_sha256_s *ctx, u32 timestamp, u32 *digests)
+{
+  LOAD_STATE (sha256_v8_t);
+  sha256_v8_t ts = (sha256_v8_t){ 0, 1, 2, 3, 4, 5, 6, 7 } + timestamp;
+  sha256_v8_t x1 = (ts >> 16) | ctx->block[1];
+  sha256_v8_t x2 = (ts << 16) | ctx->block[2];
+#define SHA256_T sha256_v8_t
+#include "vanity-sha256-rounds.h"
+#undef SHA256_T
+
+  HASH_TAIL (sha256_v8_t);
+  PUT_DIGESTS (digests, a, b, c, d, e, f, g, h);
+}
+
+static int
+supported_avx2 (void)
+{
+  return __builtin_cpu_supports ("avx2");
+}
+
+
+static void __attribute__ ((target ("avx512f")))
+digests_avx512 (const struct vanity_sha256_s *ctx, u32 timestamp,
+                u32 *digests)
+{
+  LOAD_STATE (sha256_v16_t);
+  sha256_v16_t ts = (sha256_v16_t){ 0, 1, 2, 3, 4, 5, 6, 7,
+                                    8, 9, 10, 11, 12, 13, 14, 15 } + timestamp;
+  sha256_v16_t x1 = (ts >> 16) | ctx->block[1];
+  sha256_v16_t x2 = (ts << 16) | ctx->block[2];
+#define SHA256_T sha256_v16_t
+#include "vanity-sha256-rounds.h"
+#undef SHA256_T
+
+  HASH_TAIL (sha256_v16_t);
+  PUT_DIGESTS (digests, a, b, c, d, e, f, g, h);
+}
+
+static int
+supported_avx512 (void)
+{
+  return __builtin_cpu_supports ("avx512f");
+}
+
+
+
+/* The SHA extensions compute the schedule themselves, thus this
+   kernel hashes the complete first block.  The further blocks use
+   the precomputed round constants plus message words directly, so
+   that only the round instructions remain for them.  Two timestamps
+   are interleaved to hide the latency of the round instructions.
+   The state is kept in the ABEF and CDGH layout of sha256rnds2.  */
+#define SHANI_LANES 2
+#define SHANI_EACH(stmt) do {                                   \
+    int l_;                                                     \
+    for (l_=0; l_ < SHANI_LANES; l_++)                          \
+      { stmt; }                                                 \
+  } while (0)
+
+/* Four rounds with the round constants plus message words KW.  */
+#define SHANI_ROUNDS(kw) do {                                           \
+    SHANI_EACH (s1[l_] = _mm_sha256rnds2_epu32 (s1[l_], s0[l_], kw[l_])); \
+    SHANI_EACH (kw[l_] = _mm_shuffle_epi32 (kw[l_], 0x0e));             \
+    SHANI_EACH (s0[l_] = _mm_sha256rnds2_epu32 (s0[l_], s1[l_], kw[l_])); \
+  } while (0)
+
+/* Rounds 4*G to 4*G+3 of the first block with the message words
+   M[G%4], updating the words of the next groups.  */
+#define SHANI_STEP(g) do {                                              \
+    SHANI_EACH (kw[l_] = _mm_add_epi32                                  \
+                (m[(g)%4][l_],                                          \
+                 _mm_loadu_si128 ((const __m128i *)(k256 + 4*(g)))));   \
+    SHANI_EACH (s1[l_] = _mm_sha256rnds2_epu32 (s1[l_], s0[l_], kw[l_])); \
+    if ((g) >= 3 && (g) <= 14)                                          \
+      {                                                                 \
+        SHANI_EACH (tmp[l_] = _mm_alignr_epi8 (m[(g)%4][l_],            \
+                                               m[((g)+3)%4][l_], 4));   \
+        SHANI_EACH (m[((g)+1)%4][l_] = _mm_add_epi32                    \
+                    (m[((g)+1)%4][l_], tmp[l_]));                       \
+        SHANI_EACH (m[((g)+1)%4][l_] = _mm_sha256msg2_epu32             \
+                    (m[((g)+1)%4][l_], m[(g)%4][l_]));                  \
+      }                                                                 \
+    SHANI_EACH (kw[l_] = _mm_shuffle_epi32 (kw[l_], 0x0e));             \
+    SHANI_EACH (s0[l_] = _mm_sha256rnds2_epu32 (s0[l_], s1[l_], kw[l_])); \
+    if ((g) >= 1 && (g) <= 12)                                          \
+      SHANI_EACH (m[((g)+3)%4][l_] = _mm_sha256msg1_epu32               \
+                  (m[((g)+3)%4][l_], m[(g)%4][l_]));                    \
+  } while (0)
+
+static void __attribute__ ((target ("sha,sse4.1")))
+digests_shani (const struct vanity_sha256_s *ctx, u32 timestamp,
+               u32 *digests)
+{
+  const u32 *w = ctx->block;
+  __m128i s0[SHANI_LANES], s1[SHANI_LANES], save0[SHANI_LANES];
+  __m128i save1[SHANI_LANES], m[4][SHANI_LANES], kw[SHANI_LANES];
+  __m128i tmp[SHANI_LANES];
+  const u32 *tail;
+  unsigned int i;
+  u32 ts;
+  int l, g;
+
+  for (l=0; l < SHANI_LANES; l++)
+    {
+      ts = timestamp + l;
+      s0[l] = _mm_set_epi32 (H0, H1, H4, H5);
+      s1[l] = _mm_set_epi32 (H2, H3, H6, H7);
+      m[0][l] = _mm_set_epi32 (w[3], w[2] | (ts << 16),
+                               w[1] | (ts >> 16), w[0]);
+      m[1][l] = _mm_set_epi32 (w[7], w[6], w[5], w[4]);
+      m[2][l] = _mm_set_epi32 (w[11], w[10], w[9], w[8]);
+      m[3][l] = _mm_set_epi32 (w[15], w[14], w[13], w[12]);
+    }
+  SHANI_EACH (save0[l_] = s0[l_]);
+  SHANI_EACH (save1[l_] = s1[l_]);
+
+  SHANI_STEP (0);  SHANI_STEP (1);  SHANI_STEP (2);  SHANI_STEP (3);
+  SHANI_STEP (4);  SHANI_STEP (5);  SHANI_STEP (6);  SHANI_STEP (7);
+  SHANI_STEP (8);  SHANI_STEP (9);  SHANI_STEP (10); SHANI_STEP (11);
+  SHANI_STEP (12); SHANI_STEP (13); SHANI_STEP (14); SHANI_STEP (15);
+  SHANI_EACH (s0[l_] = _mm_add_epi32 (s0[l_], save0[l_]));
+  SHANI_EACH (s1[l_] = _mm_add_epi32 (s1[l_], save1[l_]));
+
+  for (i=0; i < ctx->ntail; i++)
+    {
+      tail = ctx->tail[i];
+      SHANI_EACH (save0[l_] = s0[l_]);
+      SHANI_EACH (save1[l_] = s1[l_]);
+      for (g=0; g < 16; g++)
+        {
+          SHANI_EACH (kw[l_] = _mm_loadu_si128
+                      ((const __m128i *)(tail + 4*g)));
+          SHANI_ROUNDS (kw);
+        }
+      SHANI_EACH (s0[l_] = _mm_add_epi32 (s0[l_], save0[l_]));
+      SHANI_EACH (s1[l_] = _mm_add_epi32 (s1[l_], save1[l_]));
+    }
+
+  for (l=0; l < SHANI_LANES; l++)
+    {
+      digests[0 * VANITY_SHA1_MAX_LANES + l] = _mm_extract_epi32 (s0[l], 3);
+      digests[1 * VANITY_SHA1_MAX_LANES + l] = _mm_extract_epi32 (s0[l], 2);
+      digests[2 * VANITY_SHA1_MAX_LANES + l] = _mm_extract_epi32 (s1[l], 3);
+      digests[3 * VANITY_SHA1_MAX_LANES + l] = _mm_extract_epi32 (s1[l], 2);
+      digests[4 * VANITY_SHA1_MAX_LANES + l] = _mm_extract_epi32 (s0[l], 1);
+      digests[5 * VANITY_SHA1_MAX_LANES + l] = _mm_extract_epi32 (s0[l], 0);
+      digests[6 * VANITY_SHA1_MAX_LANES + l] = _mm_extract_epi32 (s1[l], 1);
+      digests[7 * VANITY_SHA1_MAX_LANES + l] = _mm_extract_epi32 (s1[l], 0);
+    }
+}
+
+static int
+supported_shani (void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  /* See supported_shani in vanity-sha1.c.  */
+  if (__get_cpuid_max (0, NULL) < 7)
+    return 0;
+  __cpuid_count (7, 0, eax, ebx, ecx, edx);
+  (void)eax; (void)ecx; (void)edx;
+  return (ebx & (1 << 29)) && __builtin_cpu_supports ("sse4.1");
+}
+
+#endif /*USE_SHA256_X86*/
+
+
+#ifdef USE_SHA256_NEON
+
+typedef u32 sha256_v4_t  __attribute__ ((vector_size (16)));
+
+static void
+digests_neon (const struct vanity_sha256_s *ctx, u32 timestamp, u32 *digests)
+{
+  LOAD_STATE (sha256_v4_t);
+  sha256_v4_t ts = (sha256_v4_t){ 0, 1, 2, 3 } + timestamp;
+  sha256_v4_t x1 = (ts >> 16) | ctx->block[1];
+  sha256_v4_t x2 = (ts << 16) | ctx->block[2];
+#define SHA256_T sha256_v4_t
+#include "vanity-sha256-rounds.h"
+#undef SHA256_T
+
+  HASH_TAIL (sha256_v4_t);
+  PUT_DIGESTS (digests, a, b, c, d, e, f, g, h);
+}
+
+#endif /*USE_SHA256_NEON*/
+
+
+/* The available kernels.  The scalar kernel must be the last one.  */
+typedef void (*kernel_fnc_t) (const struct vanity_sha256_s *ctx,
+                              u32 timestamp, u32 *digests);
+static struct
+{
+  const char *name;
+  unsigned int lanes;
+  kernel_fnc_t digests;
+  int (*supported) (void);
+} kernels[] =
+  {
+#ifdef USE_SHA256_X86
+    { "shani",  SHANI_LANES, digests_shani,  supported_shani },
+    { "avx512", 16,          digests_avx512, supported_avx512 },
+    { "avx2",    8,          digests_avx2,   supported_avx2 },
+    { "sse2",    4,          digests_sse2,   supported_sse2 },
+#endif
+#ifdef USE_SHA256_NEON
+    { "neon",    4,          digests_neon,   NULL },
+#endif
+    { "scalar",  1,          digests_scalar, NULL }
+  };
+
+/* The index of the selected kernel.  */
+static int selected_kernel = -1;
+
+/* The number of digests computed to time a kernel.  */
+#define CALIBRATION_DIGESTS 32768
+
+
+/* A v5 key packet with the layout of an Ed25519 key for the
+   self-test and the timing; it takes two blocks.  */
+static const unsigned char selftest_packet[60] =
+  {
+    0x9a, 0x00, 0x00, 0x00, 0x37, 0x05, 0x55, 0x5d, 0x89, 0x3f,
+    0x16, 0x00, 0x00, 0x00, 0x2d, 0x09, 0x2b, 0x06, 0x01, 0x04,
+    0x01, 0xda, 0x47, 0x0f, 0x01, 0x01, 0x07, 0x40, 0x3f, 0x09,
+    0x89, 0x94, 0xbd, 0xd9, 0x16, 0xed, 0x40, 0x53, 0x19, 0x79,
+    0x34, 0xe4, 0xa8, 0x7c, 0x80, 0x73, 0x3a, 0x12, 0x80, 0xd6,
+    0x2f, 0x80, 0x10, 0x99, 0x2e, 0x43, 0xee, 0x11, 0x22, 0x33
+  };
+
+/* The further lengths of the packets used to check the kernels: a
+   single block, one filling two blocks exactly and the longest
+   one.  */
+static const size_t selftest_lengths[] =
+  { 64 - 9, 128 - 9, VANITY_SHA256_MAXLEN };
+
+
+/* Check the kernel FNC with LANES lanes for the packet PACKET of
+   length LEN against libgcrypt.  Returns true if it works
+   correctly.  */
+static int
+selftest_packet_len (kernel_fnc_t fnc, unsigned int lanes,
+                     unsigned char *packet, size_t len)
+{
+  static const u32 timestamps[] = { 0x555d893f, 0x00000001, 0xfffffff0 };
+  static struct vanity_sha256_s ctx;
+  unsigned char fpr[VANITY_V5_FPR_LEN];
+  u32 digests[8 * VANITY_SHA1_MAX_LANES];
+  unsigned int i, n, w;
+
+  _vanity_sha256_prepare (&ctx, packet, len);
+  for (i=0; i < DIM (timestamps); i++)
+    {
+      fnc (&ctx, timestamps[i], digests);
+      for (n=0; n < lanes; n++)
+        {
+          put_u32 (packet + 6, timestamps[i] + n);
+          gcry_md_hash_buffer (GCRY_MD_SHA256, fpr, packet, len);
+          for (w=0; w < 8; w++)
+            if (digests[w * VANITY_SHA1_MAX_LANES + n]
+                != buf32_to_u32 (fpr + 4 * w))
+              return 0;
+        }
+    }
+  return 1;
+}
+
+
+/* Check kernel number IDX against libgcrypt.  Returns true if it
+   works correctly.  */
+static int
+selftest_kernel (int idx)
+{
+  static unsigned char packet[VANITY_SHA256_MAXLEN];
+  unsigned int k;
+  size_t i, len;
+
+  memcpy (packet, selftest_packet, sizeof selftest_packet);
+  if (!selftest_packet_len (kernels[idx].digests, kernels[idx].lanes,
+                            packet, sizeof selftest_packet))
+    return 0;
+  for (k=0; k < DIM (selftest_lengths); k++)
+    {
+      len = selftest_lengths[k];
+      for (i=0; i < len; i++)
+        packet[i] = i * 7 + 3;
+      if (!selftest_packet_len (kernels[idx].digests, kernels[idx].lanes,
+                                packet, len))
+        return 0;
+    }
+  return 1;
+}
+
+
+/* Return the time in nanoseconds kernel number IDX takes for
+   CALIBRATION_DIGESTS timestamps of the self-test packet, or 0 if
+   that can't be measured.  */
+static unsigned long long
+time_kernel (int idx)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  static struct vanity_sha256_s ctx;
+  u32 digests[8 * VANITY_SHA1_MAX_LANES];
+  struct timespec start, stop;
+  u32 timestamp;
+
+  _vanity_sha256_prepare (&ctx, selftest_packet, sizeof selftest_packet);
+  if (clock_gettime (CLOCK_MONOTONIC, &start))
+    return 0;
+  for (timestamp=0; timestamp < CALIBRATION_DIGESTS;
+       timestamp += kernels[idx].lanes)
+    kernels[idx].digests (&ctx, timestamp, digests);
+  if (clock_gettime (CLOCK_MONOTONIC, &stop))
+    return 0;
+  return ((stop.tv_sec - start.tv_sec) * 1000000000ULL
+          + stop.tv_nsec - start.tv_nsec);
+#else
+  (void)idx;
+  return 0;
+#endif
+}
+
+
+/* Select the fastest kernel supported by the CPU which passes the
+   self-test.  This needs to be called before any of the functions
+   below is used.  */
+void
+_vanity_sha256_init (void)
+{
+  unsigned long long t, best_time = 0;
+  int i, best = -1;
+
+  if (selected_kernel != -1)
+    return;
+
+#ifdef USE_SHA256_X86
+  __builtin_cpu_init ();
+#endif
+  for (i=0; i < DIM (kernels); i++)
+    {
+      if (kernels[i].supported && !kernels[i].supported ())
+        continue;
+      if (!selftest_kernel (i))
+        {
+          log_error ("SHA-256 kernel '%s' failed the self-test\n",
+                     kernels[i].name);
+          continue;
+        }
+      t = time_kernel (i);
+      if (best == -1 || (t && t < best_time))
+        {
+          best = i;
+          best_time = t;
+        }
+    }
+  if (best == -1)
+    log_fatal ("no working SHA-256 kernel\n");
+  selected_kernel = best;
+}
+
+
+/* Return the name of kernel number IDX in the order they are tried,
+   or NULL if there is no such kernel.  */
+const char *
+_vanity_sha256_kernel_list (unsigned int idx)
+{
+  return idx < DIM (kernels)? kernels[idx].name : NULL;
+}
+
+
+/* Select the kernel NAME instead of the fastest one.  Returns false
+   if the kernel is not supported by the CPU or fails the self-test.
+   Must be called after _vanity_sha256_init and before any search
+   starts.  */
+int
+_vanity_sha256_select (const char *name)
+{
+  int i;
+
+  for (i=0; i < DIM (kernels); i++)
+    if (!strcmp (kernels[i].name, name))
+      break;
+  if (i == DIM (kernels)
+      || (kernels[i].supported && !kernels[i].supported ())
+      || !selftest_kernel (i))
+    return 0;
+  selected_kernel = i;
+  return 1;
+}
+
+
+/* Return the name of the selected kernel.  */
+const char *
+_vanity_sha256_kernel_name (void)
+{
+  return kernels[selected_kernel].name;
+}
+
+
+/* Return the number of digests computed by _vanity_sha256_digests.  */
+unsigned int
+_vanity_sha256_lanes (void)
+{
+  return kernels[selected_kernel].lanes;
+}
+
+
+/* Compute the digests of the v5 packet prepared in CTX for the
+   consecutive timestamps starting at TIMESTAMP.  The number of
+   digests is given by _vanity_sha256_lanes.  Word W of the digest
+   for lane I is stored at DIGESTS[W * VANITY_SHA1_MAX_LANES + I],
+   thus DIGESTS must provide space for 8 * VANITY_SHA1_MAX_LANES
+   words.  */
+void
+_vanity_sha256_digests (const struct vanity_sha256_s *ctx, u32 timestamp,
+                        u32 *digests)
+{
+  kernels[selected_kernel].digests (ctx, timestamp, digests);
+}
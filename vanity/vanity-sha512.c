@@ -0,0 +1,496 @@
+/* vanity-sha512.c - Multi-lane SHA-512 for the Ed25519 seed expansion
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The scalar of an Ed25519 key is the clamped first half of the
+   SHA-512 hash of its 32 byte seed.  With the batched scalar
+   multiplication of vanity-ed25519.c these hashes are a notable part
+   of the key generation.  They are all of the same short length and
+   thus take a single block whose words 4 to 15 are the padding; the
+   kernels here hash the seeds of a batch in the lanes of a vector
+   and clamp the result before storing it.
+
+   Like the SHA-256 kernels each kernel the CPU supports is checked
+   against libgcrypt and timed once; the fastest one is used.  This
+   includes libgcrypt itself, which wins over the kernels without
+   wide vectors on most CPUs.  The seeds are secret, but the code has
+   no data dependent branches or memory accesses.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "vanity-defs.h"
+
+
+/* The same conditions as for the SHA-1 kernels.  */
+#if defined(__GNUC__) && !defined(__clang__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# if defined(__x86_64__) || defined(__i386__)
+#  define USE_SHA512_X86 1
+# elif defined(__ARM_NEON) || defined(__aarch64__)
+#  define USE_SHA512_NEON 1
+# endif
+#endif
+
+#include <time.h>
+
+
+#define ROR64(x,n) (((x) >> (n)) | ((x) << (64-(n))))
+
+#define S0(x)  (ROR64 ((x), 1) ^ ROR64 ((x), 8) ^ ((x) >> 7))
+#define S1(x)  (ROR64 ((x), 19) ^ ROR64 ((x), 61) ^ ((x) >> 6))
+#define E0(x)  (ROR64 ((x), 28) ^ ROR64 ((x), 34) ^ ROR64 ((x), 39))
+#define E1(x)  (ROR64 ((x), 14) ^ ROR64 ((x), 18) ^ ROR64 ((x), 41))
+#define CH(x,y,z)   ( (z) ^ ( (x) & ( (y) ^ (z) ) ) )
+#define MAJ(x,y,z)  ( ( (x) & (y) ) | ( (z) & ( (x) | (y) ) ) )
+
+static const uint64_t h512[8] =
+  {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+  };
+
+static const uint64_t k512[80] =
+  {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+    0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+    0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+    0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+    0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+    0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+    0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+    0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+    0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+    0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+    0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+    0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+    0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+    0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+    0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+    0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+    0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+    0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+    0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+    0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+  };
+
+/* The message words 4 to 15 of a 32 byte message: the padding and
+   the length of 256 bit.  */
+#define PAD_WORD4  0x8000000000000000ULL
+#define PAD_WORD15 256
+
+
+/* A round with the message word W.  It leaves the new A in H and the
+   new E in D; the next round is called with the names rotated by one
+   place.  */
+#define R(a,b,c,d,e,f,g,h,t,w)  do                            \
+    {                                                         \
+      h += E1 (e) + CH (e, f, g) + k512[t] + (w);             \
+      d += h;                                                 \
+      h += E0 (a) + MAJ (a, b, c);                            \
+    } while (0)
+
+/* Eight rounds starting with round T, which is a multiple of 8.  W
+   is the ring of the last 16 message words.  */
+#define R8(t) do                                                \
+    {                                                           \
+      R (a, b, c, d, e, f, g, h, (t),   W ((t)));               \
+      R (h, a, b, c, d, e, f, g, (t)+1, W ((t)+1));             \
+      R (g, h, a, b, c, d, e, f, (t)+2, W ((t)+2));             \
+      R (f, g, h, a, b, c, d, e, (t)+3, W ((t)+3));             \
+      R (e, f, g, h, a, b, c, d, (t)+4, W ((t)+4));             \
+      R (d, e, f, g, h, a, b, c, (t)+5, W ((t)+5));             \
+      R (c, d, e, f, g, h, a, b, (t)+6, W ((t)+6));             \
+      R (b, c, d, e, f, g, h, a, (t)+7, W ((t)+7));             \
+    } while (0)
+
+/* Message word T of the schedule; for T >= 16 it is computed into
+   the ring.  */
+#define W(t)  ((t) < 16? w[(t)]                                         \
+               : (w[(t)&15] += S1 (w[((t)-2)&15]) + w[((t)-7)&15]       \
+                  + S0 (w[((t)-15)&15])))
+
+/* The body of a kernel with the lane type T and L lanes.  It hashes
+   the L seeds at SEEDS and stores the clamped scalars at SCALARS.  */
+#define EXPAND_BODY(T,L) do                                             \
+    {                                                                   \
+      T zero_ = { 0 };                                                  \
+      T w[16], a, b, c, d, e, f, g, h;                                  \
+      uint64_t lane_[L];                                                \
+      int i_, l_, t_;                                                   \
+                                                                        \
+      for (i_=0; i_ < 4; i_++)                                          \
+        {                                                               \
+          for (l_=0; l_ < (L); l_++)                                    \
+            lane_[l_] = buf64_be (seeds + 32 * l_ + 8 * i_);            \
+          memcpy (&w[i_], lane_, sizeof w[i_]);                         \
+        }                                                               \
+      w[4] = zero_ + PAD_WORD4;                                         \
+      for (i_=5; i_ < 15; i_++)                                         \
+        w[i_] = zero_;                                                  \
+      w[15] = zero_ + PAD_WORD15;                                       \
+                                                                        \
+      a = zero_ + h512[0]; b = zero_ + h512[1];                         \
+      c = zero_ + h512[2]; d = zero_ + h512[3];                         \
+      e = zero_ + h512[4]; f = zero_ + h512[5];                         \
+      g = zero_ + h512[6]; h = zero_ + h512[7];                         \
+      R8 (0);  R8 (8);                                                  \
+      for (t_=16; t_ < 80; t_ += 8)                                     \
+        R8 (t_);                                                        \
+                                                                        \
+      /* Only the first half of the hash is the scalar; clamp it as  */ \
+      /* described in RFC-8032, section 5.1.5.  */                      \
+      a += h512[0]; b += h512[1]; c += h512[2]; d += h512[3];           \
+      a &= ~(uint64_t)0x0700000000000000ULL;                            \
+      d = (d & ~(uint64_t)0x80) | 0x40;                                 \
+      PUT_LANES (a, 0, L);                                              \
+      PUT_LANES (b, 1, L);                                              \
+      PUT_LANES (c, 2, L);                                              \
+      PUT_LANES (d, 3, L);                                              \
+      wipememory (w, sizeof w);                                         \
+      wipememory (lane_, sizeof lane_);                                 \
+    } while (0)
+
+/* Store the word X of type T with the L lanes as word I of the
+   scalars.  */
+#define PUT_LANES(x,i,L) do                                             \
+    {                                                                   \
+      memcpy (lane_, &(x), sizeof (x));                                 \
+      for (l_=0; l_ < (L); l_++)                                        \
+        put_u64 (scalars + 32 * l_ + 8 * (i), lane_[l_]);               \
+    } while (0)
+
+
+/* Return the 64 bit big endian value at P.  */
+static inline uint64_t
+buf64_be (const unsigned char *p)
+{
+  return (((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48)
+          | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+          | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16)
+          | ((uint64_t)p[6] <<  8) | p[7]);
+}
+
+
+/* Store the value VAL big endian at P.  */
+static inline void
+put_u64 (unsigned char *p, uint64_t val)
+{
+  int i;
+
+  for (i=7; i >= 0; i--, val >>= 8)
+    p[i] = val;
+}
+
+
+
+/* The kernel using libgcrypt, whose SHA-512 is written in assembler
+   for many CPUs and may be faster than the scalar kernel.  */
+static void
+expand_gcry (const unsigned char *seeds, unsigned char *scalars)
+{
+  unsigned char hash[64];
+
+  gcry_md_hash_buffer (GCRY_MD_SHA512, hash, seeds, 32);
+  hash[0] &= 248;
+  hash[31] &= 127;
+  hash[31] |= 64;
+  memcpy (scalars, hash, 32);
+  wipememory (hash, sizeof hash);
+}
+
+
+/* The scalar kernel.  */
+static void
+expand_scalar (const unsigned char *seeds, unsigned char *scalars)
+{
+  EXPAND_BODY (uint64_t, 1);
+}
+
+
+#ifdef USE_SHA512_X86
+
+typedef uint64_t sha512_v2_t __attribute__ ((vector_size (16)));
+typedef uint64_t sha512_v4_t __attribute__ ((vector_size (32)));
+typedef uint64_t sha512_v8_t __attribute__ ((vector_size (64)));
+
+static void __attribute__ ((target ("sse2")))
+expand_sse2 (const unsigned char *seeds, unsigned char *scalars)
+{
+  EXPAND_BODY (sha512_v2_t, 2);
+}
+
+static int
+supported_sse2 (void)
+{
+  return __builtin_cpu_supports ("sse2");
+}
+
+
+static void __attribute__ ((target ("avx2")))
+expand_avx2 (const unsigned char *seeds, unsigned char *scalars)
+{
+  EXPAND_BODY (sha512_v4_t, 4);
+}
+
+static int
+supported_avx2 (void)
+{
+  return __builtin_cpu_supports ("avx2");
+}
+
+
+/* AVX-512F has 64 bit rotations; GCC uses them for ROR64.  */
+static void __attribute__ ((target ("avx512f")))
+expand_avx512 (const unsigned char *seeds, unsigned char *scalars)
+{
+  EXPAND_BODY (sha512_v8_t, 8);
+}
+
+static int
+supported_avx512 (void)
+{
+  return __builtin_cpu_supports ("avx512f");
+}
+
+#endif /*USE_SHA512_X86*/
+
+
+#ifdef USE_SHA512_NEON
+
+typedef uint64_t sha512_v2_t __attribute__ ((vector_size (16)));
+
+static void
+expand_neon (const unsigned char *seeds, unsigned char *scalars)
+{
+  EXPAND_BODY (sha512_v2_t, 2);
+}
+
+#endif /*USE_SHA512_NEON*/
+
+
+/* The available kernels.  The scalar kernel must be the last one.  */
+typedef void (*kernel_fnc_t) (const unsigned char *seeds,
+                              unsigned char *scalars);
+static struct
+{
+  const char *name;
+  unsigned int lanes;
+  kernel_fnc_t expand;
+  int (*supported) (void);
+} kernels[] =
+  {
+#ifdef USE_SHA512_X86
+    { "avx512", 8, expand_avx512, supported_avx512 },
+    { "avx2",   4, expand_avx2,   supported_avx2 },
+    { "sse2",   2, expand_sse2,   supported_sse2 },
+#endif
+#ifdef USE_SHA512_NEON
+    { "neon",   2, expand_neon,   NULL },
+#endif
+    { "gcry",   1, expand_gcry,   NULL },
+    { "scalar", 1, expand_scalar, NULL }
+  };
+
+/* The index of the selected kernel.  */
+static int selected_kernel = -1;
+
+/* The number of seeds expanded to time a kernel.  */
+#define CALIBRATION_SEEDS 16384
+
+/* The largest number of lanes of a kernel.  */
+#define MAX_LANES 8
+
+
+/* Check kernel number IDX against libgcrypt.  Returns true if it
+   works correctly.  */
+static int
+selftest_kernel (int idx)
+{
+  unsigned char seeds[32 * MAX_LANES];
+  unsigned char scalars[32 * MAX_LANES];
+  unsigned char hash[64];
+  unsigned int lanes = kernels[idx].lanes;
+  unsigned int i, l;
+  int k;
+
+  for (k=0; k < 3; k++)
+    {
+      for (i=0; i < 32 * lanes; i++)
+        seeds[i] = k == 1? 0xff : k? i * 7 + 3 : 0;
+      kernels[idx].expand (seeds, scalars);
+      for (l=0; l < lanes; l++)
+        {
+          gcry_md_hash_buffer (GCRY_MD_SHA512, hash, seeds + 32 * l, 32);
+          hash[0] &= 248;
+          hash[31] &= 127;
+          hash[31] |= 64;
+          if (memcmp (scalars + 32 * l, hash, 32))
+            return 0;
+        }
+    }
+  return 1;
+}
+
+
+/* Return the time in nanoseconds kernel number IDX takes for
+   CALIBRATION_SEEDS seeds, or 0 if that can't be measured.  */
+static unsigned long long
+time_kernel (int idx)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  unsigned char seeds[32 * MAX_LANES];
+  unsigned char scalars[32 * MAX_LANES];
+  struct timespec start, stop;
+  unsigned int n;
+
+  memset (seeds, 0x5a, sizeof seeds);
+  if (clock_gettime (CLOCK_MONOTONIC, &start))
+    return 0;
+  for (n=0; n < CALIBRATION_SEEDS; n += kernels[idx].lanes)
+    {
+      kernels[idx].expand (seeds, scalars);
+      seeds[0] = scalars[0];
+    }
+  if (clock_gettime (CLOCK_MONOTONIC, &stop))
+    return 0;
+  return ((stop.tv_sec - start.tv_sec) * 1000000000ULL
+          + stop.tv_nsec - start.tv_nsec);
+#else
+  (void)idx;
+  return 0;
+#endif
+}
+
+
+/* Select the fastest kernel supported by the CPU which passes the
+   self-test.  This needs to be called before any of the functions
+   below is used.  */
+void
+_vanity_sha512_init (void)
+{
+  unsigned long long t, best_time = 0;
+  int i, best = -1;
+
+  if (selected_kernel != -1)
+    return;
+
+#ifdef USE_SHA512_X86
+  __builtin_cpu_init ();
+#endif
+  for (i=0; i < DIM (kernels); i++)
+    {
+      if (kernels[i].supported && !kernels[i].supported ())
+        continue;
+      if (!selftest_kernel (i))
+        {
+          log_error ("SHA-512 kernel '%s' failed the self-test\n",
+                     kernels[i].name);
+          continue;
+        }
+      t = time_kernel (i);
+      if (best == -1 || (t && t < best_time))
+        {
+          best = i;
+          best_time = t;
+        }
+    }
+  if (best == -1)
+    log_fatal ("no working SHA-512 kernel\n");
+  selected_kernel = best;
+}
+
+
+/* Return the name of kernel number IDX in the order they are tried,
+   or NULL if there is no such kernel.  */
+const char *
+_vanity_sha512_kernel_list (unsigned int idx)
+{
+  return idx < DIM (kernels)? kernels[idx].name : NULL;
+}
+
+
+/* Select the kernel NAME instead of the fastest one.  Returns false
+   if the kernel is not supported by the CPU or fails the self-test.
+   Must be called after _vanity_sha512_init and before any search
+   starts.  */
+int
+_vanity_sha512_select (const char *name)
+{
+  int i;
+
+  for (i=0; i < DIM (kernels); i++)
+    if (!strcmp (kernels[i].name, name))
+      break;
+  if (i == DIM (kernels)
+      || (kernels[i].supported && !kernels[i].supported ())
+      || !selftest_kernel (i))
+    return 0;
+  selected_kernel = i;
+  return 1;
+}
+
+
+/* Return the name of the selected kernel.  */
+const char *
+_vanity_sha512_kernel_name (void)
+{
+  return kernels[selected_kernel].name;
+}
+
+
+/* Compute the Ed25519 scalars of the N seeds at SEEDS, of 32 bytes
+   each, and store them at SCALARS, again 32 bytes each.  The lanes
+   left over by the last call of the kernel are filled with a copy
+   of the first seed.  */
+void
+_vanity_sha512_expand (const unsigned char *seeds, unsigned int n,
+                       unsigned char *scalars)
+{
+  unsigned char tmpseeds[32 * MAX_LANES];
+  unsigned char tmpscalars[32 * MAX_LANES];
+  unsigned int lanes = kernels[selected_kernel].lanes;
+  kernel_fnc_t expand = kernels[selected_kernel].expand;
+  unsigned int i, rest;
+
+  for (i=0; i + lanes <= n; i += lanes)
+    expand (seeds + 32 * i, scalars + 32 * i);
+  rest = n - i;
+  if (rest)
+    {
+      memcpy (tmpseeds, seeds + 32 * i, 32 * rest);
+      for (; rest < lanes; rest++)
+        memcpy (tmpseeds + 32 * rest, seeds, 32);
+      expand (tmpseeds, tmpscalars);
+      memcpy (scalars + 32 * i, tmpscalars, 32 * (n - i));
+      wipememory (tmpseeds, sizeof tmpseeds);
+      wipememory (tmpscalars, sizeof tmpscalars);
+    }
+}
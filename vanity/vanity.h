@@ -0,0 +1,306 @@
+/* vanity.h - Interface to the vanity key search engine
+ * Copyright (C) 2026 The gnupg-vanity authors
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_VANITY_H
+#define GNUPG_VANITY_H 1
+
+#include <gcrypt.h>
+#include "../common/types.h"
+
+/* The default number of seconds the timestamp sweep goes back from
+   the current time if no window has been set.  */
+#define VANITY_DEFAULT_WINDOW 2000000
+
+/* The default window for RSA, DSA and Elgamal keys.  Generating such
+   a key takes much longer than hashing its packet, thus the sweep
+   tries about four years of creation times for each key.  */
+#define VANITY_DEFAULT_WIDE_WINDOW 126230400
+
+/* The maximum number of creation time windows of a search.  */
+#define VANITY_MAX_WINDOWS 16
+
+/* The number of seconds between two calls of the progress callback
+   of a search.  */
+#define VANITY_PROGRESS_INTERVAL 10
+
+/* The default KiB of secrets a worker derives from its random stream
+   before reseeding it from the system RNG.  */
+#define VANITY_RESEED_INTERVAL 1024
+
+/* The largest number of keys a search collects.  */
+#define VANITY_MAX_HITS 64
+
+/* Flags for vanity_set_placement.  */
+#define VANITY_PLACE_PIN     1  /* Bind the workers to the CPUs.  */
+#define VANITY_PLACE_NO_SMT  2  /* Use only one thread of each core.  */
+
+/* The length of the key protecting the secrets of a key pool.  */
+#define VANITY_POOL_KEYLEN 32
+
+/* Flags for vanity_set_pool.  */
+#define VANITY_POOL_SWEEP  1  /* Sweep the stored keys first.  */
+#define VANITY_POOL_ADD    2  /* Store the keys generated.  */
+#define VANITY_POOL_ONLY   4  /* Sweep only the stored keys.  */
+
+/* A file of stored candidate keys.  */
+typedef struct vanity_pool_s *vanity_pool_t;
+
+/* The length of the KDF parameters of an ECDH key.  */
+#define VANITY_KDF_PARAMS_LEN 4
+
+/* The largest number of ECDH KDF parameters a search tries; that are
+   all combinations of the hash and key wrap algorithms OpenPGP
+   allows.  */
+#define VANITY_MAX_KDFS 9
+
+/* The length of the key of vanity_set_stream_key.  */
+#define VANITY_STREAM_KEYLEN 32
+
+/* The compact record of an Ed25519 key found by a search with a
+   stream key: seed INDEX of batch COUNTER of the key stream STREAM.
+   vanity_regenerate_key recreates the key from it.  */
+struct vanity_hit_ref_s
+{
+  unsigned int stream;
+  unsigned long long counter;
+  unsigned int index;
+  u32 timestamp;                /* Its creation time.  */
+};
+
+/* An object describing one vanity key search.  */
+typedef struct vanity_job_s *vanity_job_t;
+
+/* Length of a v4 fingerprint.  */
+#define VANITY_FPR_LEN 20
+
+/* Length of a v5 fingerprint and of the longest fingerprint.  */
+#define VANITY_V5_FPR_LEN 32
+#define VANITY_MAX_FPR_LEN 32
+
+/* A compiled keyid pattern.  */
+typedef struct vanity_pattern_s *vanity_pattern_t;
+
+/* The state of a search passed to its progress callback.  The rates
+   are measured over the last interval.  */
+struct vanity_progress_s
+{
+  unsigned long long iterations;  /* Fingerprints computed so far.  */
+  unsigned long long keys;        /* Keys swept so far.  */
+  unsigned long elapsed;          /* Seconds since the start.  */
+  double key_rate;                /* Keys per second.  */
+  double hash_rate;               /* Fingerprints per second.  */
+  double probability;             /* Chance of a fingerprint to match.  */
+  double eta;                     /* Expected seconds to a hit or -1.  */
+  double watts;                   /* Power of the CPU packages or -1.  */
+  double keys_per_joule;          /* Keys swept per joule or -1.  */
+  int temperature;                /* Of the hottest zone in C or -1.  */
+  unsigned int duty;              /* Duty cycle of the hash workers.  */
+  unsigned int active_workers;    /* Hash workers allowed or 0 for all.  */
+  double cpu_seconds;             /* CPU time of the workers so far.  */
+  double gpu_seconds;             /* Time of the device so far.  */
+  unsigned long long generated;   /* Keys generated so far.  */
+  unsigned long long gpu_iterations;  /* The part of ITERATIONS and  */
+  unsigned long long gpu_keys;        /* of KEYS from the device.  */
+  unsigned int queued;            /* Key batches waiting in the queues.  */
+  unsigned int queue_slots;       /* The size of all queues.  */
+};
+
+/* The resources used by a search.  The keys taken from a key pool
+   are swept but not generated; an OpenCL device is busy for
+   GPU_SECONDS while its worker also uses some CPU time.  */
+struct vanity_cost_s
+{
+  double cpu_seconds;             /* CPU time of all threads.  */
+  double gpu_seconds;             /* Time the device was computing.  */
+  unsigned long long keys;        /* Keys generated.  */
+  unsigned long long hashes;      /* Fingerprints computed.  */
+  double wall_seconds;            /* Duration of the search.  */
+};
+
+/* The default number of seconds of the calibration run of
+   vanity_estimate.  */
+#define VANITY_ESTIMATE_SECONDS 5
+
+/* The result of vanity_estimate.  The times are for one host and
+   are -1 if the pattern has no chance to match.  */
+struct vanity_estimate_s
+{
+  double seconds;                 /* Length of the calibration run.  */
+  unsigned long long iterations;  /* Fingerprints computed by it.  */
+  unsigned long long keys;        /* Keys swept by it.  */
+  unsigned long found;            /* Matching keys seen by it.  */
+  double hash_rate;               /* Fingerprints per second.  */
+  double key_rate;                /* Keys per second.  */
+  double probability;             /* Chance of a fingerprint to match.  */
+  unsigned int hits;              /* The number of keys asked for.  */
+  double expected;                /* Expected seconds to find them.  */
+  double p90;                     /* Seconds to find them with a chance
+                                     of 90%.  */
+  double watts;                   /* Power of the CPU packages or -1.  */
+  double keys_per_joule;          /* Keys swept per joule or -1.  */
+};
+
+/* The paths computing the fingerprints during a search.  */
+#define VANITY_PATH_KEYID     0  /* The SHA-1 keyid kernel.  */
+#define VANITY_PATH_DIGEST    1  /* The SHA-1 digest kernel.  */
+#define VANITY_PATH_MULTI     2  /* The multi-block SHA-1 kernel.  */
+#define VANITY_PATH_GPU       3  /* The OpenCL device.  */
+#define VANITY_PATH_LIBGCRYPT 4  /* libgcrypt for the longest packets.  */
+#define VANITY_PATH_SHA256    5  /* The SHA-256 kernel for v5 keys.  */
+#define VANITY_NPATHS         6
+
+/* The counters of the verification of the keys found by a job since
+   it was created.  Each key is rebuilt from its public key and hashed
+   with libgcrypt before it is accepted; a path that returned a wrong
+   one is quarantined and replaced by libgcrypt for the rest of the
+   job.  */
+struct vanity_verify_s
+{
+  unsigned int checked[VANITY_NPATHS];   /* Keys confirmed for each path.  */
+  unsigned int rejected[VANITY_NPATHS];  /* Keys refuted for each path.  */
+  unsigned int quarantined;              /* Bit (1 << PATH) for each
+                                            quarantined path.  */
+};
+
+/* The memory of a search by component as planned when it starts.
+   The queues and arenas have fixed sizes and each thread holds at
+   most a fixed number of key batches, thus these are upper bounds
+   for what the engine allocates while the search runs.  */
+struct vanity_memory_s
+{
+  size_t pattern;         /* The compiled pattern.  */
+  size_t tables;          /* The tables of incremental key generation.  */
+  size_t threads;         /* The state of all threads.  */
+  size_t batches;         /* The key batches queued or being swept.  */
+  size_t arenas;          /* The locked memory for their secrets.  */
+  size_t device;          /* The buffers of the device worker.  */
+  size_t total;
+  size_t per_worker;      /* The share of one hash worker.  */
+  unsigned int nworkers;  /* The hash workers started.  */
+};
+
+/* The type of the progress callback of a search.  Returning an error
+   stops the search with that error.  */
+typedef gpg_error_t (*vanity_progress_t)
+     (void *opaque, const struct vanity_progress_s *progress);
+
+
+/*-- vanity-match.c --*/
+gpg_error_t vanity_pattern_new (vanity_pattern_t *r_pattern,
+                                const char *string);
+gpg_error_t vanity_pattern_new_version (vanity_pattern_t *r_pattern,
+                                        const char *string, int version);
+int vanity_pattern_version (vanity_pattern_t pattern);
+void vanity_pattern_release (vanity_pattern_t pattern);
+unsigned int vanity_pattern_count (vanity_pattern_t pattern);
+double vanity_pattern_probability (vanity_pattern_t pattern);
+int vanity_pattern_match (vanity_pattern_t pattern, u32 keyid);
+int vanity_pattern_check (vanity_pattern_t pattern, const unsigned char *fpr);
+int vanity_pattern_is_scoring (vanity_pattern_t pattern);
+unsigned int vanity_pattern_score (vanity_pattern_t pattern,
+                                   const unsigned char *fpr,
+                                   unsigned int *r_item);
+
+
+/*-- vanity-seal.c --*/
+gpg_error_t vanity_seal_key (gcry_sexp_t s_recipient, gcry_sexp_t s_private,
+                             unsigned char **r_sealed, size_t *r_sealedlen);
+gpg_error_t vanity_open_key (gcry_sexp_t s_seckey,
+                             const unsigned char *sealed, size_t sealedlen,
+                             gcry_sexp_t *r_private);
+
+/*-- vanity-pool.c --*/
+gpg_error_t vanity_pool_open (vanity_pool_t *r_pool, const char *fname,
+                              const unsigned char *key);
+void vanity_pool_close (vanity_pool_t pool);
+unsigned long long vanity_pool_count (vanity_pool_t pool);
+
+
+/*-- vanity-search.c --*/
+gpg_error_t vanity_job_new (vanity_job_t *r_job, gcry_sexp_t keyparam,
+                            int algo, u32 timestamp);
+void vanity_job_release (vanity_job_t job);
+void vanity_set_workers (vanity_job_t job, unsigned int nworkers);
+gpg_error_t vanity_set_version (vanity_job_t job, int version);
+int vanity_get_version (vanity_job_t job);
+gpg_error_t vanity_set_pattern (vanity_job_t job, const char *string);
+gpg_error_t vanity_add_window (vanity_job_t job, u32 start, u32 end);
+gpg_error_t vanity_set_windows (vanity_job_t job, const char *string);
+void vanity_set_backward (vanity_job_t job, int backward);
+void vanity_set_autotune (vanity_job_t job, int autotune);
+void vanity_set_gpu (vanity_job_t job, int use_gpu);
+void vanity_set_reseed_interval (vanity_job_t job, unsigned int kbytes);
+void vanity_set_placement (vanity_job_t job, unsigned int flags);
+void vanity_set_hits (vanity_job_t job, unsigned int nhits,
+                      unsigned long seconds);
+void vanity_set_max_iterations (vanity_job_t job,
+                                unsigned long long iterations);
+void vanity_set_progress (vanity_job_t job,
+                          vanity_progress_t cb, void *opaque);
+void vanity_set_pool (vanity_job_t job, vanity_pool_t pool,
+                      unsigned int flags);
+gpg_error_t vanity_set_stream_key (vanity_job_t job,
+                                   const unsigned char *key);
+gpg_error_t vanity_set_stream_range (vanity_job_t job, unsigned int first,
+                                     unsigned int count);
+gpg_error_t vanity_set_kdf_params (vanity_job_t job, const char *string);
+gpg_error_t vanity_set_governor (vanity_job_t job, const char *schedule);
+void vanity_set_temperature_limit (vanity_job_t job, int celsius);
+void vanity_set_memory_limit (vanity_job_t job, size_t job_limit,
+                              size_t worker_limit);
+unsigned int vanity_default_workers (void);
+
+gpg_error_t vanity_search (vanity_job_t job,
+                           gcry_sexp_t *r_private, gcry_sexp_t *r_public);
+void vanity_cancel (vanity_job_t job);
+double vanity_hit_time (double rate, unsigned int hits, double quantile);
+gpg_error_t vanity_estimate (vanity_job_t job, unsigned int seconds,
+                             struct vanity_estimate_s *r_est);
+void vanity_get_verify (vanity_job_t job, struct vanity_verify_s *r_verify);
+void vanity_get_memory (vanity_job_t job, struct vanity_memory_s *r_mem);
+const char *vanity_path_name (int path);
+u32 vanity_get_timestamp (vanity_job_t job);
+void vanity_get_fingerprint (vanity_job_t job, unsigned char *fpr);
+unsigned int vanity_get_match (vanity_job_t job);
+unsigned int vanity_get_score (vanity_job_t job, unsigned int idx);
+unsigned long long vanity_get_iterations (vanity_job_t job);
+unsigned long long vanity_get_keys (vanity_job_t job);
+void vanity_get_gpu_counts (vanity_job_t job, unsigned long long *r_iterations,
+                            unsigned long long *r_keys);
+int vanity_is_scoring (vanity_job_t job);
+void vanity_get_cost (vanity_job_t job, struct vanity_cost_s *r_cost);
+void vanity_cost_add (struct vanity_cost_s *sum,
+                      const struct vanity_cost_s *cost, double share);
+unsigned int vanity_get_stream_next (vanity_job_t job);
+unsigned int vanity_get_hit_count (vanity_job_t job);
+gpg_error_t vanity_take_hit (vanity_job_t job, unsigned int idx,
+                             gcry_sexp_t *r_private, gcry_sexp_t *r_public,
+                             u32 *r_timestamp, unsigned char *r_fpr,
+                             unsigned int *r_match);
+gpg_error_t vanity_get_hit_ref (vanity_job_t job, unsigned int idx,
+                                struct vanity_hit_ref_s *r_ref);
+gpg_error_t vanity_get_kdf_params (vanity_job_t job, unsigned int idx,
+                                   unsigned char *r_kdf);
+gpg_error_t vanity_regenerate_key (const unsigned char *key,
+                                   const struct vanity_hit_ref_s *ref,
+                                   gcry_sexp_t *r_private,
+                                   gcry_sexp_t *r_public);
+
+
+#endif /*GNUPG_VANITY_H*/